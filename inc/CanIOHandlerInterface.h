@@ -149,6 +149,52 @@ class CanIOHandlerInterface
          * @return 0 if successful, 1 if successful but with errors and -1 if failed
          */
          virtual int initialize() = 0;
+
+        /**
+         * @brief A PDO CAN message as passed to processPdoBatch()
+         */
+        struct Frame
+        {
+            int pdo; /**< PDO channel, 1 to 4 */
+            const unsigned char* data;
+            size_t size;
+        };
+
+        /**
+         * @brief Called once per receive batch with all new PDO CAN messages
+         *        for this node, in the order that they were received
+         * @param frames The messages
+         * @param n The number of messages
+         * @return 0 if successfull, 1 if nothing was done or -1 if an error occurred
+         * @note Called by the CanMaster. The default implementation passes
+         *       each message on to processPdo1-4; override it to handle a
+         *       whole batch at once.
+         */
+        virtual int processPdoBatch( const Frame* frames, size_t n )
+        {
+            int rc = 1;
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                unsigned char* data = const_cast<unsigned char*>(frames[i].data);
+                int r = -1;
+
+                switch (frames[i].pdo)
+                {
+                    case 1: r = processPdo1( data, frames[i].size ); break;
+                    case 2: r = processPdo2( data, frames[i].size ); break;
+                    case 3: r = processPdo3( data, frames[i].size ); break;
+                    case 4: r = processPdo4( data, frames[i].size ); break;
+                }
+
+                if (r < 0)
+                    rc = -1;
+                else if (r == 0 && rc > 0)
+                    rc = 0;
+            }
+
+            return rc;
+        }
 };
 
 
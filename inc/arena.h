@@ -0,0 +1,84 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <stdarg.h>
+
+/* Bump allocator for things that all go away at the same time.
+ *
+ * Memory is handed out from the front of a buffer that the owner provides,
+ * typically right behind the struct that holds the arena. Whatever does not
+ * fit goes into blocks from malloc(), which are freed by arena_reset(). Nothing
+ * is freed on its own. An arena that is all zeroes is valid and empty.
+ *
+ * Arenas are not thread safe.
+ */
+
+struct arena_block;
+
+struct arena {
+	char* base;
+	size_t size;
+	char* pos;
+	char* end;
+	struct arena_block* blocks;
+	size_t n_block_bytes; /* allocated since the last reset */
+};
+
+void arena_init(struct arena* self, void* buffer, size_t size);
+
+/* Frees the blocks */
+void arena_destroy(struct arena* self);
+
+/* Everything that was allocated is gone. The blocks are freed, so a request
+ * that needed a lot does not keep it from others.
+ */
+void arena_reset(struct arena* self);
+
+/* Returns NULL if out of memory. The memory is aligned for any type, and it is
+ * not cleared.
+ */
+void* arena_alloc(struct arena* self, size_t size);
+
+void* arena_zalloc(struct arena* self, size_t size);
+
+/* Copy size bytes into the arena with a terminating '\0' */
+char* arena_strndup(struct arena* self, const char* str, size_t size);
+
+/* Text that grows in the arena, in place when nothing has been allocated
+ * behind it. is_bad is set if the arena runs out of memory, and nothing more
+ * is added after that.
+ */
+struct arena_text {
+	struct arena* arena;
+	char* data;
+	size_t length;
+	size_t size;
+	int is_bad;
+};
+
+void arena_text_init(struct arena_text* self, struct arena* arena);
+
+void arena_printf(struct arena_text* self, const char* fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+void arena_vprintf(struct arena_text* self, const char* fmt, va_list ap);
+
+void arena_append(struct arena_text* self, const void* data, size_t size);
+
+#endif /* ARENA_H_ */
@@ -0,0 +1,9 @@
+#ifndef BUS_REST_H_
+#define BUS_REST_H_
+
+/* GET /bus gives the error state of the CAN controller and counts of the
+ * error frames that it has reported, by kind.
+ */
+void bus_rest_service(struct rest_client* client, const void* content);
+
+#endif /* BUS_REST_H_ */
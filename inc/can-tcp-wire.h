@@ -0,0 +1,108 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CAN_TCP_WIRE_H_
+#define CAN_TCP_WIRE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct can_frame;
+struct can_filter;
+
+/* The can-tcp bridge sends struct can_frame as it is laid out in memory, with
+ * can_id in network byte order: 16 bytes per frame whatever the DLC.
+ *
+ * Peers that both know it can switch to a compact encoding instead, where
+ * each frame is
+ *
+ *   byte     DLC in the low nibble; bit 4 is set if a delta timestamp follows
+ *   varint   (CAN ID << 3) | ERR << 2 | RTR << 1 | EFF
+ *   varint   microseconds since the previous timestamp (optional)
+ *   DLC bytes of payload, none for remote requests
+ *
+ * Varints are LEB128, least significant group first, so a PDO of 8 bytes
+ * takes 11 bytes and a heartbeat 4.
+ *
+ * The switch is negotiated with control records, which have the legacy
+ * layout with a DLC of 0xff. SocketCAN refuses such frames, so an old bridge
+ * that forwards one to its bus does no harm. A peer that wants the compact
+ * encoding sends CAN_TCP_WIRE_OFFER. A peer that accepts sends
+ * CAN_TCP_WIRE_SWITCH, and every byte it sends after that is compact. Each
+ * side sends its own SWITCH, so the two directions change over separately.
+ * In the compact encoding, a control record is sent as the byte 0xff
+ * followed by the 16 bytes of the record.
+ *
+ * CAN_TCP_WIRE_FILTER sets the frames that the peer wants to receive, in the
+ * same terms as CAN_RAW_FILTER. The number of filters is in the byte after
+ * the type, and the record is followed by that many pairs of can_id and
+ * can_mask in network byte order. No filters means all frames.
+ */
+
+#define CAN_TCP_WIRE_MAX_SIZE (1 + 5 + 10 + 8)
+#define CAN_TCP_WIRE_MAX_FILTERS 64
+#define CAN_TCP_WIRE_MAX_FILTER_SIZE \
+	(1 + sizeof(struct can_frame) + CAN_TCP_WIRE_MAX_FILTERS * 8)
+
+enum can_tcp_wire_control {
+	CAN_TCP_WIRE_DATA = 0,
+	CAN_TCP_WIRE_OFFER,
+	CAN_TCP_WIRE_SWITCH,
+	CAN_TCP_WIRE_FILTER,
+};
+
+/* cf is in host byte order. */
+void can_tcp_wire_make_control(struct can_frame* cf,
+			       enum can_tcp_wire_control type);
+enum can_tcp_wire_control
+can_tcp_wire_get_control(const struct can_frame* cf);
+
+/* Encodes one frame into dst, which must hold CAN_TCP_WIRE_MAX_SIZE bytes.
+ * The timestamp delta is only encoded if ts is not NULL. Returns the size of
+ * the record.
+ */
+size_t can_tcp_wire_encode(void* dst, const struct can_frame* cf,
+			   const uint64_t* ts);
+
+/* Decodes one frame from the start of src. If the record has a timestamp and
+ * ts is not NULL, it receives the delta, and 0 otherwise.
+ *
+ * Returns the size of the record, 0 if src ends before the record does or -1
+ * if it is not a valid record.
+ */
+ssize_t can_tcp_wire_decode(struct can_frame* cf, uint64_t* ts,
+			    const void* src, size_t size);
+
+/* Encodes a CAN_TCP_WIRE_FILTER record along with its filters into dst,
+ * which must hold CAN_TCP_WIRE_MAX_FILTER_SIZE bytes. Returns the size or -1
+ * if there are more than CAN_TCP_WIRE_MAX_FILTERS filters.
+ */
+ssize_t can_tcp_wire_encode_filter(void* dst, const struct can_filter* filter,
+				   size_t n, int is_compact);
+
+/* Decodes the filters that follow the CAN_TCP_WIRE_FILTER record cf. dst must
+ * hold CAN_TCP_WIRE_MAX_FILTERS filters. Returns the number of bytes used, as
+ * can_tcp_wire_decode() does.
+ */
+ssize_t can_tcp_wire_decode_filter(struct can_filter* dst, size_t* n,
+				   const struct can_frame* cf,
+				   const void* src, size_t size);
+
+/* Returns 1 if the frame passes the filters or if there are none. */
+int can_tcp_wire_filter_match(const struct can_filter* filter, size_t n,
+			      uint32_t can_id);
+
+#endif /* CAN_TCP_WIRE_H_ */
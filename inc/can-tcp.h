@@ -16,9 +16,44 @@
 #ifndef CAN_TCP_H_
 #define CAN_TCP_H_
 
+#include <stddef.h>
+
+struct can_filter;
+
 int can_tcp_open(const char* addr, int port);
 int can_tcp_bridge_server(const char* can, int port);
 int can_tcp_bridge_client(const char* can, const char* address, int port);
 
+/* The same over SOCK_SEQPACKET sockets in the UNIX domain, for peers on the
+ * same host. See net_unix_listen() for the paths.
+ */
+int can_tcp_bridge_unix_server(const char* can, const char* path);
+int can_tcp_bridge_unix_client(const char* can, const char* path);
+
+/* Publish the frames from the CAN interface to a UDP multicast group, given
+ * as "<group>[:<port>]", for any number of subscribers. See sock-udp.h for
+ * the datagrams. Nothing is received from the group.
+ */
+int can_tcp_bridge_multicast(const char* can, const char* address, int ttl);
+
+/* By default, the frames from each read are forwarded right away. With a
+ * window of 0, the frames of a whole main loop iteration are gathered and
+ * sent to each peer in one go, and with a window of more than 0, frames are
+ * gathered for that many microseconds. The frames on the wire stay the same.
+ */
+void can_tcp_set_batch_window(int window);
+
+/* With compact set, bridge clients offer the compact wire encoding of
+ * can-tcp-wire.h to the server, and use it if the server accepts. Servers
+ * always accept, and keep the legacy encoding for clients that do not ask.
+ */
+void can_tcp_set_compact(int use_compact);
+
+/* Bridge clients ask the server to send only the frames that pass these
+ * filters, which work like CAN_RAW_FILTER. Returns -1 if there are more than
+ * CAN_TCP_WIRE_MAX_FILTERS.
+ */
+int can_tcp_set_filter(const struct can_filter* filter, size_t n);
+
 #endif /* CAN_TCP_H_ */
 
@@ -30,12 +30,23 @@
 
 struct co_drv;
 struct co_sdo_req;
+struct co_sdo_batch;
 
 enum co_sdo_type {
 	CO_SDO_DOWNLOAD = 1,
 	CO_SDO_UPLOAD
 };
 
+/* Requests of higher priority are sent first. Requests are CO_SDO_PRIO_DRIVER
+ * unless set otherwise.
+ */
+enum co_sdo_priority {
+	CO_SDO_PRIO_REALTIME = 1,
+	CO_SDO_PRIO_DRIVER,
+	CO_SDO_PRIO_CONFIG,
+	CO_SDO_PRIO_BACKGROUND,
+};
+
 enum co_sdo_status {
 	CO_SDO_REQ_PENDING = 0,
 	CO_SDO_REQ_OK,
@@ -56,11 +67,41 @@ struct co_emcy {
 	uint64_t manufacturer_error;
 };
 
+/* The value of a mapping entry in 0x1600-0x17FF and 0x1A00-0x1BFF */
+#define CO_PDO_MAPPING(index, subindex, length) \
+	((uint32_t)(index) << 16 | (uint32_t)(subindex) << 8 | (length))
+
+enum co_signal_type {
+	CO_SIGNAL_UNSIGNED = 0,
+	CO_SIGNAL_SIGNED,
+	CO_SIGNAL_REAL,
+};
+
+/* An object that is mapped into a PDO. Integers of up to 64 bits are in u or
+ * i depending on their type, and REAL32 and REAL64 are in f.
+ */
+struct co_signal {
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t length; /* bits */
+	enum co_signal_type type;
+	union {
+		uint64_t u;
+		int64_t i;
+		double f;
+	};
+};
+
 typedef void (*co_free_fn)(void*);
 typedef void (*co_pdo_fn)(struct co_drv*, const void* data, size_t size);
+typedef void (*co_pdo_ts_fn)(struct co_drv*, const void* data, size_t size,
+			     uint64_t timestamp);
 typedef void (*co_sdo_done_fn)(struct co_drv*, struct co_sdo_req* req);
+typedef void (*co_sdo_batch_fn)(struct co_drv*, struct co_sdo_batch* batch);
 typedef void (*co_emcy_fn)(struct co_drv*, struct co_emcy*);
 typedef void (*co_start_fn)(struct co_drv*);
+typedef void (*co_signal_fn)(struct co_drv*, const struct co_signal* signals,
+			     size_t count, uint64_t timestamp);
 
 const char* co_get_network_name(const struct co_drv* self);
 int co_get_nodeid(const struct co_drv* self);
@@ -77,9 +118,114 @@ void co_set_pdo1_fn(struct co_drv* self, co_pdo_fn fn);
 void co_set_pdo2_fn(struct co_drv* self, co_pdo_fn fn);
 void co_set_pdo3_fn(struct co_drv* self, co_pdo_fn fn);
 void co_set_pdo4_fn(struct co_drv* self, co_pdo_fn fn);
+
+/* Like co_set_pdoN_fn() but the callback also receives the time of arrival of
+ * the frame in microseconds since the epoch. This takes precedence over the
+ * plain callback.
+ */
+void co_set_pdo1_ts_fn(struct co_drv* self, co_pdo_ts_fn fn);
+void co_set_pdo2_ts_fn(struct co_drv* self, co_pdo_ts_fn fn);
+void co_set_pdo3_ts_fn(struct co_drv* self, co_pdo_ts_fn fn);
+void co_set_pdo4_ts_fn(struct co_drv* self, co_pdo_ts_fn fn);
 void co_set_emcy_fn(struct co_drv* self, co_emcy_fn fn);
 void co_set_start_fn(struct co_drv* self, co_start_fn fn);
 
+/* Master-side PDO mapping
+ *
+ * Called from the init function of the driver, co_tpdo_map() and co_rpdo_map()
+ * have the master write the given mapping, a list of CO_PDO_MAPPING() values,
+ * to the node before starting it. With a NULL mapping, the mapping that the
+ * node already has is read instead. Either way, it is compiled once into a
+ * table of bit offsets, lengths and types, taken from the EDS of the node if
+ * there is one.
+ *
+ * After that, every TPDO n is decoded into signals, which are passed to the
+ * signal callback and can be looked at with co_tpdo_get_signals() at any time.
+ * RPDO n is sent with co_rpdo_send_signals() after filling in the signals from
+ * co_rpdo_get_signals(). Neither is available until the mapping is known, and
+ * a node is not started before then unless the driver starts it itself.
+ *
+ * Signals are in mapping order; co_tpdo_find_signal() and co_rpdo_find_signal()
+ * give the position of an object, or -1 if it is not mapped.
+ */
+int co_tpdo_map(struct co_drv* self, int n, const uint32_t* mapping,
+		size_t count);
+int co_rpdo_map(struct co_drv* self, int n, const uint32_t* mapping,
+		size_t count);
+
+/* Calls co_tpdo_map() for the existing mapping if the driver has not */
+void co_set_tpdo_signal_fn(struct co_drv* self, int n, co_signal_fn fn);
+
+int co_tpdo_find_signal(const struct co_drv* self, int n, int index,
+			int subindex);
+const struct co_signal* co_tpdo_get_signals(const struct co_drv* self, int n,
+					    size_t* count);
+
+int co_rpdo_find_signal(const struct co_drv* self, int n, int index,
+			int subindex);
+struct co_signal* co_rpdo_get_signals(struct co_drv* self, int n,
+				      size_t* count);
+int co_rpdo_send_signals(struct co_drv* self, int n);
+
+/* PDOs 1 to CO_PDO_MAX on any COB-ID
+ *
+ * co_set_tpdo_fn() registers a callback for TPDO n, which the node sends on
+ * cob_id. A cob_id of 0 stands for the predefined COB-ID of PDO 1-4, so that
+ * co_set_tpdo_fn(self, 1, 0, fn) is the same as co_set_pdo1_ts_fn(self, fn).
+ * A NULL callback removes the PDO. The COB-ID must not be used by anything
+ * else on the bus.
+ *
+ * co_rpdo() sends RPDO n on the COB-ID that was set with co_set_rpdo_cob_id(),
+ * or on the predefined one for RPDO 1-4.
+ */
+#define CO_PDO_MAX 512
+
+int co_set_tpdo_fn(struct co_drv* self, int n, uint32_t cob_id,
+		   co_pdo_ts_fn fn);
+int co_set_rpdo_cob_id(struct co_drv* self, int n, uint32_t cob_id);
+
+/* Pass TPDO n on to the driver only when its payload differs from the previous
+ * one. This applies to every callback of the PDO, including the one set with
+ * co_set_tpdo_signal_fn(). For a PDO on a COB-ID of its own, call this after
+ * co_set_tpdo_fn().
+ */
+int co_set_tpdo_on_change(struct co_drv* self, int n, int is_on_change);
+
+/* All TPDOs of the node that arrived in one receive batch, in the order that
+ * they arrived, after the per-PDO callbacks have been called. n is the number
+ * of the PDO as in co_set_tpdo_fn() and the timestamp is the time of arrival
+ * as for co_set_pdo1_ts_fn(). sync_count is the number of SYNCs that the master
+ * had sent when the batch was passed on; it wraps around, and a change from the
+ * previous batch means that a new SYNC cycle has begun.
+ *
+ * The frames are only valid for the duration of the call. A batch holds at most
+ * CO_PDO_BATCH_MAX frames; more than that are passed on in several calls.
+ */
+#define CO_PDO_BATCH_MAX 64
+
+struct co_pdo_frame {
+	int n;
+	uint64_t timestamp;
+	const void* data;
+	size_t size;
+};
+
+typedef void (*co_pdo_batch_fn)(struct co_drv*,
+				const struct co_pdo_frame* frames,
+				size_t count, unsigned int sync_count);
+
+int co_set_pdo_batch_fn(struct co_drv* self, co_pdo_batch_fn fn);
+
+int co_rpdo(struct co_drv* self, int n, const void* data, size_t size);
+
+/* PDO payloads are at most 8 bytes, or 64 bytes if the master runs with CAN FD
+ * enabled. Payloads longer than 8 bytes are sent as FD frames and padded to
+ * the next valid FD length.
+ *
+ * These may be called from any thread. RPDOs from threads other than the main
+ * loop are handed to it without locking; if one is sent again before the main
+ * loop gets to it, only the latest payload goes out.
+ */
 int co_rpdo1(struct co_drv* self, const void* data, size_t size);
 int co_rpdo2(struct co_drv* self, const void* data, size_t size);
 int co_rpdo3(struct co_drv* self, const void* data, size_t size);
@@ -88,11 +234,62 @@ int co_rpdo4(struct co_drv* self, const void* data, size_t size);
 void co_setopt(struct co_drv* self, enum co_options opt);
 void co_start(struct co_drv* self);
 
+/* Where the PDO and EMCY callbacks of the driver run
+ *
+ * CO_EXEC_INLINE runs them on the main loop as frames arrive, which is the
+ * default. CO_EXEC_THREAD gives the driver a thread of its own, fed by a queue,
+ * so that a slow callback holds up only this driver; those callbacks should
+ * not call into the master other than through co_rpdo*(). With CO_EXEC_AUTO, a
+ * driver that is written for that runs inline until its callbacks go over
+ * budget a few times and is then moved to a thread.
+ *
+ * Callbacks that take longer than the budget in microseconds are logged. A
+ * budget of 0 takes driver_callback_budget from the configuration.
+ */
+enum co_exec_mode {
+	CO_EXEC_INLINE = 0,
+	CO_EXEC_THREAD,
+	CO_EXEC_AUTO,
+};
+
+int co_set_exec_mode(struct co_drv* self, enum co_exec_mode mode);
+void co_set_callback_budget(struct co_drv* self, uint32_t budget_us);
+
+/* Called once per SYNC cycle while the master sends SYNC, for drivers that do
+ * their control computation per cycle rather than per frame. The call comes
+ * once every TPDO that the driver has a callback for has arrived after the
+ * SYNC, or at the input deadline, cycle_input_deadline microseconds after the
+ * SYNC, with n_missing set to the number of those that did not. A driver
+ * without TPDO callbacks is called right after the SYNC. sync_count is as for
+ * co_set_pdo_batch_fn().
+ *
+ * The cycle functions of the drivers whose inputs are in run in parallel, on
+ * the main loop and the worker threads, or on the thread of a driver with
+ * CO_EXEC_THREAD. The main loop waits for them, so no other callback of an
+ * inline driver runs at the same time. RPDOs sent from them are staged
+ * together once they are done. Calls that take longer than budget_us are
+ * logged; a budget of 0 takes driver_cycle_budget from the configuration, or
+ * the time from the input deadline to the next SYNC if that is not set.
+ */
+typedef void (*co_cycle_fn)(struct co_drv*, unsigned int sync_count,
+			    int n_missing);
+
+int co_set_cycle_fn(struct co_drv* self, co_cycle_fn fn, uint32_t budget_us);
+
+/* Requests come from a pool and may be kept and started again once they are
+ * done, also from their done callback. A request keeps its settings and, for
+ * an upload, its buffer, and payloads of up to 8 bytes are stored within the
+ * request, so a driver that reads or writes an object every cycle doesn't
+ * allocate anything after the first time. Starting a request that is still
+ * pending fails.
+ */
 struct co_sdo_req* co_sdo_req_new(struct co_drv* drv);
 void co_sdo_req_ref(struct co_sdo_req* self);
 int co_sdo_req_unref(struct co_sdo_req* self);
 void co_sdo_req_set_indices(struct co_sdo_req* self, int index, int subindex);
 void co_sdo_req_set_type(struct co_sdo_req* self, enum co_sdo_type type);
+void co_sdo_req_set_priority(struct co_sdo_req* self,
+			     enum co_sdo_priority priority);
 void co_sdo_req_set_data(struct co_sdo_req* self, const void* data, size_t sz);
 void co_sdo_req_set_done_fn(struct co_sdo_req* self, co_sdo_done_fn fn);
 void co_sdo_req_set_context(struct co_sdo_req* self, void* context,
@@ -105,6 +302,37 @@ int co_sdo_req_get_index(const struct co_sdo_req* self);
 int co_sdo_req_get_subindex(const struct co_sdo_req* self);
 enum co_sdo_status co_sdo_req_get_status(const struct co_sdo_req* self);
 
+/* A batch of uploads and downloads that is queued as one unit and reports
+ * once when all of them are done. Items are referred to by the order in which
+ * they were added. With CO_SDO_BATCH_STOP_ON_ERROR, items that have not been
+ * started when one of them fails are cancelled.
+ */
+enum co_sdo_batch_flags {
+	CO_SDO_BATCH_STOP_ON_ERROR = 1,
+};
+
+struct co_sdo_batch* co_sdo_batch_new(struct co_drv* drv, int flags);
+void co_sdo_batch_ref(struct co_sdo_batch* self);
+int co_sdo_batch_unref(struct co_sdo_batch* self);
+void co_sdo_batch_set_priority(struct co_sdo_batch* self,
+			       enum co_sdo_priority priority);
+int co_sdo_batch_add_upload(struct co_sdo_batch* self, int index,
+			    int subindex);
+int co_sdo_batch_add_download(struct co_sdo_batch* self, int index,
+			      int subindex, const void* data, size_t size);
+void co_sdo_batch_set_done_fn(struct co_sdo_batch* self, co_sdo_batch_fn fn);
+void co_sdo_batch_set_context(struct co_sdo_batch* self, void* context,
+			      co_free_fn free_fn);
+void* co_sdo_batch_get_context(const struct co_sdo_batch* self);
+int co_sdo_batch_start(struct co_sdo_batch* self);
+size_t co_sdo_batch_get_count(const struct co_sdo_batch* self);
+enum co_sdo_status co_sdo_batch_get_status(const struct co_sdo_batch* self);
+enum co_sdo_status co_sdo_batch_get_item_status(const struct co_sdo_batch* self,
+						size_t i);
+const void* co_sdo_batch_get_item_data(const struct co_sdo_batch* self,
+				       size_t i);
+size_t co_sdo_batch_get_item_size(const struct co_sdo_batch* self, size_t i);
+
 int co_sdo_send_blob(struct co_drv* self, int index, int subindex,
 		     const void* payload, size_t size);
 
@@ -16,11 +16,12 @@
 #ifndef _CANOPEN_H
 #define _CANOPEN_H
 
+#include <stdint.h>
+#include <linux/can.h>
+
 #define CANOPEN_NODEID_MIN 1
 #define CANOPEN_NODEID_MAX 127
 
-struct can_frame;
-
 enum canopen_range {
 	R_NMT = 0,
 	R_SYNC = 0x80,
@@ -66,8 +67,29 @@ struct canopen_msg {
 	enum canopen_object object;
 };
 
-int canopen_get_object_type(struct canopen_msg* msg,
-			    const struct can_frame* frame);
+/* Object types by function code, which is the upper 4 bits of the COB-ID. The
+ * second column is for node id 0, which is NMT, SYNC and TIMESTAMP for the
+ * first three function codes.
+ */
+extern const uint16_t canopen__object_by_function[16][2];
+
+/* Returns -1 for COB-IDs that are not in the predefined connection set, with
+ * msg->id set to the COB-ID.
+ */
+static inline int canopen_get_object_type(struct canopen_msg* msg,
+					  const struct can_frame* frame)
+{
+	uint32_t cob = frame->can_id & CAN_SFF_MASK;
+	unsigned int nodeid = cob & 0x7f;
+
+	enum canopen_object object = (enum canopen_object)
+		canopen__object_by_function[cob >> 7][nodeid == 0];
+
+	msg->object = object;
+	msg->id = object != CANOPEN_UNSPEC ? (int)nodeid : (int)cob;
+
+	return object != CANOPEN_UNSPEC ? 0 : -1;
+}
 
 #endif /* _CANOPEN_H */
 
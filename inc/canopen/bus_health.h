@@ -0,0 +1,86 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_BUS_HEALTH_H
+#define _CANOPEN_BUS_HEALTH_H
+
+#include <stdint.h>
+
+struct can_frame;
+
+/* Bus health from the error frames of the CAN controller.
+ *
+ * Error frames tell when the controller moves between the error states, goes
+ * bus-off or is restarted. Not every driver reports the way back to error
+ * active, so an error state is also left once there have been no error frames
+ * for the recovery time.
+ *
+ * Timestamps are in microseconds on any clock, as long as the same clock is
+ * used throughout.
+ */
+
+enum co_bus_state {
+	CO_BUS_ERROR_ACTIVE = 0,
+	CO_BUS_ERROR_WARNING,
+	CO_BUS_ERROR_PASSIVE,
+	CO_BUS_OFF,
+};
+
+struct co_bus_health {
+	enum co_bus_state state;
+
+	uint64_t n_error_frames;
+	uint64_t n_tx_timeouts;
+	uint64_t n_lost_arbitration;
+	uint64_t n_overflows;
+	uint64_t n_protocol_errors;
+	uint64_t n_transceiver_errors;
+	uint64_t n_no_ack;
+	uint64_t n_bus_errors;
+	uint64_t n_error_warning;
+	uint64_t n_error_passive;
+	uint64_t n_bus_off;
+	uint64_t n_restarts;
+
+	/* As last reported by the controller */
+	unsigned int tx_error_count;
+	unsigned int rx_error_count;
+
+	uint64_t last_error;
+};
+
+void co_bus_health_reset(void);
+
+/* Default 5 s. 0 keeps an error state until the controller reports that it
+ * is error active again.
+ */
+void co_bus_health_set_recovery_time(uint64_t recovery_time);
+
+/* Returns 1 if the frame changed the state, 0 otherwise */
+int co_bus_health_on_error_frame(const struct can_frame* cf,
+				 uint64_t timestamp);
+
+enum co_bus_state co_bus_health_get_state(uint64_t now);
+void co_bus_health_get(struct co_bus_health* dst, uint64_t now);
+
+/* Error passive or bus-off */
+static inline int co_bus_is_degraded(enum co_bus_state state)
+{
+	return state >= CO_BUS_ERROR_PASSIVE;
+}
+
+const char* co_bus_state_name(enum co_bus_state state);
+
+#endif /* _CANOPEN_BUS_HEALTH_H */
@@ -0,0 +1,66 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_BUS_LOAD_H
+#define _CANOPEN_BUS_LOAD_H
+
+#include <stdint.h>
+#include <linux/can.h>
+
+/* Bus load estimation.
+ *
+ * Frames are counted as they are received or sent, from any thread, and the
+ * load is sampled on the main loop. Each sample is the share of the bit
+ * time since the previous sample that was taken up by frames, and the load
+ * is a moving average of the samples that weighs the newest one by 1/4.
+ *
+ * Frames are counted with the worst case number of stuff bits, and CAN FD
+ * frames as if all of them were sent at the nominal bit rate, so the estimate
+ * errs on the high side.
+ *
+ * Load is in per mille of the bit rate. Timestamps are in microseconds on
+ * any clock, as long as the same clock is used throughout.
+ */
+
+#define CO_BUS_LOAD_MAX 1000
+
+struct co_bus_load {
+	uint32_t bitrate; /* bits/s */
+
+	/* Bits counted since init, updated atomically */
+	uint64_t n_bits;
+
+	uint64_t last_bits;
+	uint64_t last_time;
+	unsigned int load;
+};
+
+/* Frame length in bits on the wire, including the interframe space */
+unsigned int co_bus_load_frame_bits(const struct canfd_frame* cf);
+
+void co_bus_load_init(struct co_bus_load* self, uint32_t bitrate,
+		      uint64_t now);
+
+void co_bus_load_count(struct co_bus_load* self, const struct canfd_frame* cf);
+
+/* Returns the new load */
+unsigned int co_bus_load_sample(struct co_bus_load* self, uint64_t now);
+
+static inline unsigned int co_bus_load_get(const struct co_bus_load* self)
+{
+	return __atomic_load_n(&self->load, __ATOMIC_RELAXED);
+}
+
+#endif /* _CANOPEN_BUS_LOAD_H */
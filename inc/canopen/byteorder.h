@@ -17,9 +17,82 @@
 #define _CANOPEN_BYTEORDER_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
-void byteorder(void* dst, const void* src, size_t size);
-void byteorder2(void* dst, const void* src, size_t dst_size, size_t src_size);
+/* CANopen is little endian. Conversions of 1, 2, 4 and 8 bytes are inlined,
+ * and as their sizes are nearly always known at compile time, they come down
+ * to a move, or a move and a byte swap on big endian hosts. Other sizes, such
+ * as those of 24, 40 and 48 bit integers, take the generic path.
+ */
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BYTEORDER_IS_SWAPPED 1
+#else
+#define BYTEORDER_IS_SWAPPED 0
+#endif
+
+/* Reverse the order of src_size bytes of src into the end of dst */
+void byteorder__reverse(void* dst, const void* src, size_t dst_size,
+			size_t src_size);
+
+static inline uint16_t byteorder_u16(uint16_t value)
+{
+	return BYTEORDER_IS_SWAPPED ? __builtin_bswap16(value) : value;
+}
+
+static inline uint32_t byteorder_u32(uint32_t value)
+{
+	return BYTEORDER_IS_SWAPPED ? __builtin_bswap32(value) : value;
+}
+
+static inline uint64_t byteorder_u64(uint64_t value)
+{
+	return BYTEORDER_IS_SWAPPED ? __builtin_bswap64(value) : value;
+}
+
+#define BYTEORDER__COPY(bits, dst, src) \
+({ \
+	uint##bits##_t _v; \
+	memcpy(&_v, src, sizeof(_v)); \
+	_v = byteorder_u##bits(_v); \
+	memcpy(dst, &_v, sizeof(_v)); \
+})
+
+static inline void byteorder(void* dst, const void* src, size_t size)
+{
+	switch (size) {
+	case 0: return;
+	case 1: memcpy(dst, src, 1); return;
+	case 2: BYTEORDER__COPY(16, dst, src); return;
+	case 4: BYTEORDER__COPY(32, dst, src); return;
+	case 8: BYTEORDER__COPY(64, dst, src); return;
+	}
+
+	if (BYTEORDER_IS_SWAPPED)
+		byteorder__reverse(dst, src, size, size);
+	else
+		memcpy(dst, src, size);
+}
+
+/* Convert src_size bytes into a dst_size wide integer. The bytes of dst that
+ * src does not cover are left as they are. If src is wider than dst, as it
+ * is when a node sends more bytes than the object has, only its least
+ * significant bytes are used.
+ */
+static inline void byteorder2(void* dst, const void* src, size_t dst_size,
+			      size_t src_size)
+{
+	if (src_size > dst_size)
+		src_size = dst_size;
+
+	if (dst_size == src_size)
+		byteorder(dst, src, src_size);
+	else if (BYTEORDER_IS_SWAPPED)
+		byteorder__reverse(dst, src, dst_size, src_size);
+	else
+		memcpy(dst, src, src_size);
+}
 
 #define BYTEORDER(dst, value) \
 ({ \
@@ -29,4 +102,3 @@ void byteorder2(void* dst, const void* src, size_t dst_size, size_t src_size);
 
 
 #endif /* _CANOPEN_BYTEORDER_H */
-
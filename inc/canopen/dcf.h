@@ -0,0 +1,113 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_DCF_H
+#define _CANOPEN_DCF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Concise DCF (CiA 302-3): the configuration of a node as a list of object
+ * values in the order they are to be written. The file is a 32 bit count
+ * followed by that many entries of a 16 bit index, an 8 bit subindex, a 32 bit
+ * size and the data, all little endian.
+ *
+ * A DCF is downloaded to a node as one SDO batch, either as separate downloads
+ * of its entries or as a single download of the whole file to object 0x1F22,
+ * which nodes that support it apply themselves.
+ *
+ * Nodes that have object 0x1020 are given the CRC-32 and size of the DCF in
+ * 0x1020:1 and 0x1020:2 once the download is done; these are meant to hold
+ * the date and time of the configuration but serve just as well here. The
+ * download can be skipped when they still match. 0x1020:1 is cleared first so
+ * that an interrupted download is not taken for a finished one.
+ */
+
+#define CO_DCF_VERIFY_INDEX 0x1020
+#define CO_DCF_OBJECT_INDEX 0x1f22
+
+struct sdo_batch;
+
+enum co_dcf_flags {
+	/* Write the verification values in 0x1020 */
+	CO_DCF_VERIFY = 1,
+
+	/* Write the whole DCF to 0x1F22 instead of each entry */
+	CO_DCF_OBJECT = 2,
+};
+
+struct co_dcf {
+	uint8_t* data;
+	size_t size;
+	uint32_t n_entries;
+	uint32_t checksum;
+};
+
+struct co_dcf_entry {
+	uint16_t index;
+	uint8_t subindex;
+	uint32_t size;
+	const uint8_t* data;
+};
+
+/* The data is copied. Fails if the entries do not add up to the size. */
+int co_dcf_parse(struct co_dcf* self, const void* data, size_t size);
+int co_dcf_load(struct co_dcf* self, const char* path);
+void co_dcf_destroy(struct co_dcf* self);
+
+/* Start with *pos = 0. Returns 0 while there are entries. */
+int co_dcf_next(const struct co_dcf* self, size_t* pos,
+		struct co_dcf_entry* entry);
+
+uint32_t co_dcf_crc32(uint32_t crc, const void* data, size_t size);
+
+/* Adds uploads of 0x1020:1 and 0x1020:2 that co_dcf_is_verified() checks;
+ * they must be the first items of the batch.
+ */
+int co_dcf_add_verify_uploads(struct sdo_batch* batch);
+
+/* Returns 1 if the node already has this DCF, 0 if it has another one and -1
+ * if it has no 0x1020.
+ */
+int co_dcf_is_verified(const struct co_dcf* self,
+		       const struct sdo_batch* batch);
+
+/* nodeid is the subindex of 0x1F22 that is written with CO_DCF_OBJECT */
+int co_dcf_add_downloads(const struct co_dcf* self, struct sdo_batch* batch,
+			 enum co_dcf_flags flags, int nodeid);
+
+/* Snapshots of the object dictionary of a node are DCFs too. A snapshot is
+ * made from a batch of uploads and restored by uploading the current value of
+ * each entry and downloading only those that differ.
+ */
+
+/* Takes the uploads in the batch that succeeded, in their order */
+int co_dcf_from_uploads(struct co_dcf* self, const struct sdo_batch* batch);
+
+int co_dcf_add_entry_uploads(const struct co_dcf* self,
+			     struct sdo_batch* batch);
+
+/* Adds downloads of the entries that differ from the uploads in current,
+ * which must have been added by co_dcf_add_entry_uploads(). A PDO that is to
+ * change is disabled while it is written: the number of mapped objects is
+ * set to 0, or the COB-ID is marked invalid, and restored last. Returns the
+ * number of entries that differ.
+ */
+ssize_t co_dcf_add_changed_downloads(const struct co_dcf* self,
+				     const struct sdo_batch* current,
+				     struct sdo_batch* batch);
+
+#endif /* _CANOPEN_DCF_H */
@@ -1,4 +1,4 @@
-/* Copyright (c) 2014-2016, Marel
+/* Copyright (c) 2018, Marel
  *
  * Permission to use, copy, modify, and/or distribute this software for any
  * purpose with or without fee is hereby granted, provided that the above
@@ -13,12 +13,22 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
-#ifndef STREAM_H_
-#define STREAM_H_
+#ifndef _CANOPEN_DRV_CYCLE_H
+#define _CANOPEN_DRV_CYCLE_H
 
-#include <stdio.h>
+#include <stddef.h>
 
-FILE* stream_open(int fd, const char* mode);
+/* Running the cycle functions of drivers, see co_set_cycle_fn().
+ *
+ * co_drv_cycle_run() is called on the main loop with the drivers whose inputs
+ * for a SYNC cycle are in. A driver with a thread of its own gets the call as
+ * a job in its queue. The others are shared out between the caller and up to
+ * n_helpers worker threads, and co_drv_cycle_run() returns once all of them
+ * are done. Each call is timed against the cycle_watchdog of the node.
+ */
+
+struct co_drv;
 
-#endif /* STREAM_H_ */
+void co_drv_cycle_run(struct co_drv* const* drv, size_t n, size_t n_helpers);
 
+#endif /* _CANOPEN_DRV_CYCLE_H */
@@ -0,0 +1,83 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_DRV_EXEC_H
+#define _CANOPEN_DRV_EXEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "canopen-driver.h"
+
+/* Execution of driver callbacks, see co_set_exec_mode().
+ *
+ * The master wraps each PDO or EMCY callback of a driver in a job and hands
+ * it to co_drv_exec_run(). Inline drivers run the job on the spot and have its
+ * duration checked against their budget. Threaded drivers get a copy of the
+ * job in a single-producer, single-consumer queue which their thread drains;
+ * jobs are dropped while the queue is full.
+ */
+
+struct co_drv;
+struct co_drv_job;
+struct co_drv_exec;
+struct co_drv_watchdog;
+
+typedef void (*co_drv_job_fn)(struct co_drv*, const struct co_drv_job*);
+
+struct co_drv_job {
+	co_drv_job_fn fn;
+	const char* what; /* for the log */
+	int n;
+	uint64_t timestamp;
+	const uint8_t* data;
+	size_t size;
+	const struct co_emcy* emcy;
+	struct co_drv_watchdog* watchdog; /* NULL for the node's */
+};
+
+/* Callback durations of a node, in microseconds */
+struct co_drv_watchdog {
+	uint32_t budget; /* 0 means the default */
+	uint64_t max_time;
+	uint64_t n_overruns;
+	uint64_t n_dropped;
+};
+
+#define CO_DRV_EXEC_QUEUE_LENGTH 256
+
+/* An inline driver with CO_EXEC_AUTO that goes over budget this many times is
+ * moved to a thread of its own
+ */
+#define CO_DRV_EXEC_DEMOTE_COUNT 3
+
+/* 0 turns the watchdog off for drivers that have no budget of their own */
+void co_drv_exec_set_default_budget(uint32_t budget_us);
+
+/* Starts or stops the thread of the driver as the mode requires */
+int co_drv_exec_set_mode(struct co_drv* drv, enum co_exec_mode mode);
+
+void co_drv_exec_run(struct co_drv* drv, const struct co_drv_job* job);
+
+/* Stops the thread of the driver, if it has one, discarding queued jobs */
+void co_drv_exec_stop(struct co_drv* drv);
+
+/* Records that a callback of node nodeid that started at start took too long,
+ * going by the budget in the watchdog. start is taken from fastclock_us().
+ * Returns 1 if it was over budget.
+ */
+int co_drv_watchdog_check(struct co_drv_watchdog* watchdog, int nodeid,
+			  const char* what, uint64_t start);
+
+#endif /* _CANOPEN_DRV_EXEC_H */
@@ -0,0 +1,63 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef DRV_REGISTRY_H_
+#define DRV_REGISTRY_H_
+
+struct co_drv;
+
+/* Drivers are found by scanning the driver directory once instead of probing
+ * the file system for every node. Each DSO is opened the first time a node
+ * needs it and stays open until the registry is cleared, so nodes that use
+ * the same driver share one handle.
+ *
+ * The registry may be used from any thread.
+ */
+
+/* Replaces the contents of the registry with the drivers in dir. Returns the
+ * number of drivers found or -1 if dir could not be read. Without an explicit
+ * scan, the default driver directory is scanned on first use.
+ */
+int co_drv_registry_scan(const char* dir);
+
+/* Returns 1 if there is a driver called name, regardless of case */
+int co_drv_registry_has(const char* name);
+
+/* Sets the DSO handle and init function of drv. A DSO that fails to load is
+ * not tried again until the next scan.
+ */
+int co_drv_registry_get(struct co_drv* drv, const char* name);
+
+/* Returns the DSO of the driver called name if it is open, or NULL */
+void* co_drv_registry_peek(const char* name);
+
+/* Closes the DSO so that the next lookup loads the file again, e.g. after it
+ * has been replaced. No node may be using it.
+ */
+int co_drv_registry_close(const void* dso);
+
+/* Makes the next lookup load the file again like co_drv_registry_close(), but
+ * keeps the DSO open until co_drv_registry_commit_reload(), so that
+ * co_drv_registry_revert_reload() can go back to it if the new one fails. No
+ * node may be using the DSO in the meantime.
+ */
+int co_drv_registry_begin_reload(const void* dso);
+int co_drv_registry_commit_reload(const void* dso);
+int co_drv_registry_revert_reload(const void* dso);
+
+/* All drivers must have been unloaded */
+void co_drv_registry_clear(void);
+
+#endif /* DRV_REGISTRY_H_ */
@@ -16,6 +16,8 @@
 #ifndef CANOPEN_DUMP_H_
 #define CANOPEN_DUMP_H_
 
+#include <stdint.h>
+
 #define CO_DUMP_FILTER_SHIFT 8
 #define CO_DUMP_PDO_FILTER_SHIFT 16
 #define CO_DUMP_FILTER_MASK 0x00ffff00
@@ -24,6 +26,8 @@ enum co_dump_options {
 	CO_DUMP_TCP = 1,
 	CO_DUMP_TIMESTAMP = 1 << 1,
 	CO_DUMP_FILE = 1 << 2,
+	CO_DUMP_RECOVER = 1 << 3,
+	CO_DUMP_STATS = 1 << 4,
 
 	CO_DUMP_FILTER_NMT = 1 << (CO_DUMP_FILTER_SHIFT + 0),
 	CO_DUMP_FILTER_SYNC = 1 << (CO_DUMP_FILTER_SHIFT + 1),
@@ -41,6 +45,30 @@ enum co_dump_options {
 			   | CO_DUMP_FILTER_PDO3 | CO_DUMP_FILTER_PDO4,
 };
 
+/* Selects the frames to dump from a trace file. Times are in microseconds
+ * since the epoch; a to of 0 means no upper limit and a nodeid of -1 matches
+ * all nodes.
+ */
+struct co_dump_range {
+	uint64_t from;
+	uint64_t to;
+	int nodeid;
+};
+
+/* With CO_DUMP_STATS, a summary of the traffic is printed every interval_ms
+ * (default 1000) instead of the frames. Bus load is computed against bitrate
+ * (default 500000).
+ */
+void co_dump_set_stats_params(unsigned int interval_ms, unsigned int bitrate);
+
+/* Instead of decoding the frames, write them to stdout in the given format:
+ * "pcapng", "candump" (candump -l) or "raw" (trace buffer dump). Returns -1
+ * for unknown formats.
+ */
+int co_dump_set_output_format(const char* name);
+
 int co_dump(const char* addr, enum co_dump_options options);
+int co_dump_file(const char* path, enum co_dump_options options,
+		 const struct co_dump_range* range);
 
 #endif /*  CANOPEN_DUMP_H_ */
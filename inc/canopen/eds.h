@@ -16,8 +16,8 @@
 #ifndef CANOPEN_EDS_H_
 #define CANOPEN_EDS_H_
 
+#include <stddef.h>
 #include "canopen/types.h"
-#include "sys/tree.h"
 
 enum eds_obj_access {
 	EDS_OBJ_R = 1,
@@ -38,22 +38,48 @@ struct eds_obj {
 	const char* scaling;
 };
 
-struct eds_obj_node;
-
-RB_HEAD(eds_obj_tree, eds_obj_node);
-
 struct canopen_eds {
 	uint32_t vendor;
 	uint32_t product;
 	uint32_t revision;
 	char name[256];
 
-	struct eds_obj_tree obj_tree;
+	/* Only the device info is read when the database is loaded. The
+	 * objects are parsed from the file at path when the EDS is first
+	 * looked up.
+	 */
+	char* path;
+	int is_parsed;
+
+	/* Sorted by key, for bisection */
+	struct eds_obj* objs;
+	size_t n_objs;
+
+	/* Set when loaded from a compiled image. The objects are unpacked
+	 * from the image on first use.
+	 */
+	const void* image_objs;
 };
 
+/* Uses the compiled image of the EDS directory if there is one that is up to
+ * date and parses the EDS files otherwise.
+ */
 int eds_db_load(void);
 void eds_db_unload(void);
 
+/* Objects are otherwise parsed the first time that they are needed */
+void eds_db_parse_all(void);
+
+/* Parses the EDS files in dir and writes them to a compiled image at path.
+ * The image is only used for the directory that it was compiled from and
+ * only while the EDS files in it stay the same.
+ */
+int eds_db_compile(const char* dir, const char* path);
+
+/* The default location of the EDS directory and its compiled image */
+const char* eds_db_get_path(void);
+const char* eds_db_get_image_path(void);
+
 const struct canopen_eds* eds_db_find(int vendor, int product, int revision);
 const struct canopen_eds* eds_db_find_by_name(const char* name);
 
@@ -0,0 +1,80 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_EMCY_LIMIT_H
+#define _CANOPEN_EMCY_LIMIT_H
+
+#include <stdint.h>
+
+/* Rate limiting of the EMCYs that are passed on to drivers.
+ *
+ * An EMCY that differs from the previous one of the node in its error code or
+ * error register is a change of state and is always passed on; this includes
+ * the error reset, code 0x0000, after a fault. Repeats are handled by the
+ * policy:
+ *
+ * CO_EMCY_POLICY_ALL passes on every EMCY.
+ *
+ * CO_EMCY_POLICY_FIRST passes on the first of a run of repeats and then counts
+ * them as aggregated until the window is over, when the next repeat is passed
+ * on again.
+ *
+ * CO_EMCY_POLICY_RATE passes on repeats as long as the node has tokens left in
+ * its bucket, which holds up to burst tokens and is refilled at rate tokens per
+ * second. Repeats beyond that are counted as dropped.
+ *
+ * Timestamps are in microseconds on any clock, as long as the same clock is
+ * used throughout.
+ */
+
+enum co_emcy_policy {
+	CO_EMCY_POLICY_ALL = 0,
+	CO_EMCY_POLICY_FIRST,
+	CO_EMCY_POLICY_RATE,
+};
+
+struct co_emcy_limit_config {
+	enum co_emcy_policy policy;
+	uint32_t window; /* ms */
+	uint32_t rate; /* per second */
+	uint32_t burst;
+};
+
+struct co_emcy_limit {
+	int has_last;
+	uint16_t last_code;
+	uint8_t last_reg;
+
+	uint64_t window_start;
+
+	/* In millionths of a token */
+	uint64_t tokens;
+	uint64_t last_refill;
+
+	uint64_t n_passed;
+	uint64_t n_aggregated;
+	uint64_t n_dropped;
+};
+
+/* Returns 1 if the EMCY is to be passed on and 0 if it is held back */
+int co_emcy_limit_check(struct co_emcy_limit* self,
+			const struct co_emcy_limit_config* config,
+			uint16_t code, uint8_t reg, uint64_t now);
+
+/* Returns -1 if the name is not known */
+int co_emcy_policy_from_string(const char* name);
+const char* co_emcy_policy_name(enum co_emcy_policy policy);
+
+#endif /* _CANOPEN_EMCY_LIMIT_H */
@@ -0,0 +1,83 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_HANDOVER_H
+#define _CANOPEN_HANDOVER_H
+
+#include <unistd.h>
+#include <stdint.h>
+
+/* Warm restart of the master.
+ *
+ * A running master listens on a SOCK_SEQPACKET UNIX socket. A new master
+ * connects to it and asks for the bus. The running master answers with its
+ * state and passes its open sockets with SCM_RIGHTS, and it lets go of the
+ * bus once the new master has confirmed that it got them. If there is no
+ * confirmation within CO_HANDOVER_TIMEOUT, the running master carries on as
+ * before.
+ *
+ * Paths that start with '@' are in the abstract namespace.
+ */
+
+#define CO_HANDOVER_TIMEOUT 1000 /* ms */
+#define CO_HANDOVER_FDS_MAX 4
+#define CO_HANDOVER_NODES_MAX 127
+
+enum co_handover_node_flags {
+	CO_HANDOVER_NODE_STARTED = 1,
+	CO_HANDOVER_NODE_HEARTBEAT = 2,
+};
+
+struct co_handover_node {
+	uint8_t nodeid;
+	uint8_t flags;
+	uint16_t reserved;
+	uint32_t device_type;
+	uint32_t vendor_id, product_code, revision_number;
+
+	/* Estimate of the SDO round trip time in microseconds */
+	uint64_t srtt, rttvar;
+
+	char name[64];
+	char hw_version[64];
+	char sw_version[64];
+} __attribute__((packed));
+
+struct co_handover_state {
+	uint32_t magic;
+	uint8_t sock_type;
+	uint8_t n_nodes;
+	uint16_t reserved;
+	struct co_handover_node node[CO_HANDOVER_NODES_MAX];
+} __attribute__((packed));
+
+/* Accepts a request on the listening socket and answers it. Blocks for up to
+ * CO_HANDOVER_TIMEOUT. Returns 0 once the receiver has confirmed, after which
+ * the caller must not use the bus any more.
+ */
+int co_handover_give(int listen_fd, struct co_handover_state* state,
+		     const int* fds, size_t n_fds);
+
+/* Accepts a request and closes it, so the sender starts cold */
+void co_handover_refuse(int listen_fd);
+
+/* Fails with ENOENT or ECONNREFUSED if no one is listening on the path and
+ * with ECONNRESET if the request was refused. On success, n_fds is the number
+ * of file descriptors that were received.
+ */
+int co_handover_take(const char* path, struct co_handover_state* state,
+		     int* fds, size_t* n_fds);
+
+#endif /* _CANOPEN_HANDOVER_H */
@@ -0,0 +1,47 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef IDENTITY_CACHE_H_
+#define IDENTITY_CACHE_H_
+
+#include <stdint.h>
+
+/* Identities of the nodes on a bus, kept on disk between runs of the master
+ * so that drivers can be loaded without reading the identity of every node
+ * first. The identity of a node must be confirmed once its driver is loaded.
+ *
+ * The cache may be used from any thread.
+ */
+
+struct identity_cache_entry {
+	uint32_t device_type;
+	uint32_t vendor_id, product_code, revision_number;
+	char name[64];
+	char hw_version[64];
+	char sw_version[64];
+};
+
+/* A missing file is an empty cache */
+int identity_cache_load(const char* path);
+
+/* Writes the cache if anything has changed since it was loaded or saved */
+int identity_cache_save(const char* path);
+
+int identity_cache_get(int nodeid, struct identity_cache_entry* dst);
+void identity_cache_set(int nodeid, const struct identity_cache_entry* src);
+void identity_cache_invalidate(int nodeid);
+void identity_cache_clear(void);
+
+#endif /* IDENTITY_CACHE_H_ */
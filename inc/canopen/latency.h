@@ -0,0 +1,71 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_LATENCY_H
+#define _CANOPEN_LATENCY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* RPDO to TPDO round trip latency.
+ *
+ * Each rule pairs an RPDO of a node with one of its TPDOs. When the RPDO is
+ * sent, the time and payload are remembered. The next TPDO that matches
+ * finishes the round trip and its latency goes into the histogram of the
+ * rule. If the rule has a mask, the TPDO only matches if the masked bytes
+ * are the same as those of the RPDO, e.g. when a node echoes a command.
+ * An RPDO that is sent again before it was answered counts as unanswered.
+ *
+ * Histogram bucket i counts latencies v with 2^i <= v < 2^(i + 1)
+ * microseconds, like the ones in canopen/stats.h.
+ */
+
+#define CO_LATENCY_RULES_MAX 32
+#define CO_LATENCY_MASK_SIZE 8
+#define CO_LATENCY_N_BUCKETS 24
+
+struct co_latency_rule {
+	int nodeid;
+	int rpdo, tpdo;
+	size_t mask_size;
+	uint8_t mask[CO_LATENCY_MASK_SIZE];
+};
+
+struct co_latency_stats {
+	uint64_t count;
+	uint64_t n_unanswered;
+	uint64_t max;
+	uint64_t bucket[CO_LATENCY_N_BUCKETS];
+};
+
+int co_latency_add_rule(const struct co_latency_rule* rule);
+void co_latency_clear(void);
+
+void co_latency_enable(int is_enabled);
+int co_latency_is_enabled(void);
+
+/* Timestamps are in microseconds on CLOCK_REALTIME, like those of the sock
+ * layer.
+ */
+void co_latency_on_tx(uint32_t cob_id, const void* data, size_t size,
+		      uint64_t timestamp);
+void co_latency_on_rx(uint32_t cob_id, const void* data, size_t size,
+		      uint64_t timestamp);
+
+/* Returns -1 if there is no rule i */
+int co_latency_get(size_t i, struct co_latency_rule* rule,
+		   struct co_latency_stats* stats);
+
+#endif /* _CANOPEN_LATENCY_H */
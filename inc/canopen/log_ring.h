@@ -0,0 +1,61 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_LOG_RING_H
+#define _CANOPEN_LOG_RING_H
+
+#include <stdint.h>
+
+/* Logging from the hot paths of the master.
+ *
+ * co_log() hands messages to a thread of their own through a lock-free ring,
+ * so that a storm of EMCYs or timeouts doesn't hold up frame processing while
+ * syslog writes. Messages are identified by a key, e.g. the EMCY code and the
+ * node id. Only the first message for a key in each window is formatted and
+ * logged; the rest are counted, and the count is logged along with the last
+ * message when the window closes. Messages are dropped while the ring is full,
+ * and the number of dropped messages is logged later on.
+ *
+ * Until co_log_start() has been called, messages are logged on the spot.
+ */
+
+#define CO_LOG_RING_LENGTH 256
+#define CO_LOG_KEY_COUNT 256
+#define CO_LOG_MESSAGE_MAX 256
+
+/* A key of 0 is never aggregated */
+#define CO_LOG_KEY(kind, a, b) \
+	((uint64_t)(kind) << 48 | (uint64_t)((a) & 0xffff) << 32 \
+	 | (uint32_t)(b))
+
+enum co_log_kind {
+	CO_LOG_EMCY = 1,
+	CO_LOG_HEARTBEAT_TIMEOUT,
+	CO_LOG_LATE_NODE,
+};
+
+/* A window of 0 turns aggregation off */
+int co_log_start(uint32_t window_ms);
+
+/* Logs what is left and stops the thread */
+void co_log_stop(void);
+
+/* Returns 1 if the message was queued or logged, 0 if it was counted as a
+ * repeat and -1 if it was dropped
+ */
+int co_log(int level, uint64_t key, const char* fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+#endif /* _CANOPEN_LOG_RING_H */
@@ -0,0 +1,147 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_LSS_H
+#define _CANOPEN_LSS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mloop.h>
+#include "sock.h"
+
+/* LSS master (CiA 305) that assigns node ids to nodes that have none.
+ *
+ * Nodes without a node id are found one at a time with Fastscan, which
+ * bisects the 128 bit identity of the nodes that are left in 4 x 33 queries.
+ * A query that is answered advances at once and a query that is not answered
+ * costs one timeout, so finding a node takes one timeout per bit of its
+ * identity that is set.
+ *
+ * Each node that is found is given the node id that assign_fn returns for its
+ * identity. The node id is stored in the node if is_store is set, and the node
+ * is switched back to the waiting state where it no longer takes part in
+ * Fastscan. The new node ids only become active once the nodes are reset.
+ *
+ * A scan that loses track of a node, because two nodes answered at different
+ * times for example, starts over from the first query up to
+ * CO_LSS_RETRIES_MAX times.
+ *
+ * The scan runs on the main loop. Responses from CO_LSS_SLAVE_COB_ID must be
+ * fed to co_lss_feed().
+ */
+
+#define CO_LSS_MASTER_COB_ID 0x7e5
+#define CO_LSS_SLAVE_COB_ID 0x7e4
+
+#define CO_LSS_RETRIES_MAX 3
+
+struct co_lss;
+
+enum co_lss_cs {
+	CO_LSS_CS_SWITCH_GLOBAL = 0x04,
+	CO_LSS_CS_CONFIGURE_NODEID = 0x11,
+	CO_LSS_CS_STORE = 0x17,
+	CO_LSS_CS_IDENTIFY_SLAVE = 0x4f,
+	CO_LSS_CS_FASTSCAN = 0x51,
+};
+
+enum co_lss_state {
+	CO_LSS_STATE_IDLE = 0,
+	CO_LSS_STATE_CONFIRM,
+	CO_LSS_STATE_SCAN,
+	CO_LSS_STATE_VERIFY,
+	CO_LSS_STATE_CONFIGURE,
+	CO_LSS_STATE_STORE,
+};
+
+enum co_lss_status {
+	CO_LSS_OK = 0,
+	CO_LSS_TIMEOUT,
+	CO_LSS_REFUSED,
+	CO_LSS_UNKNOWN_IDENTITY,
+	CO_LSS_CANCELLED,
+};
+
+struct co_lss_identity {
+	uint32_t vendor_id;
+	uint32_t product_code;
+	uint32_t revision_number;
+	uint32_t serial_number;
+};
+
+/* Returns the node id to assign or -1 if there is none */
+typedef int (*co_lss_assign_fn)(struct co_lss* lss,
+				const struct co_lss_identity* identity);
+typedef void (*co_lss_fn)(struct co_lss* lss);
+
+struct co_lss {
+	struct sock sock;
+	struct mloop_timer* timer;
+	int is_running;
+	enum co_lss_state state;
+	enum co_lss_status status;
+
+	/* The part of the identity that is being scanned, 0 to 3, and the bit
+	 * of it that is being checked
+	 */
+	int sub;
+	int bit;
+	uint32_t id_number;
+	uint32_t part[4];
+
+	int nodeid;
+	int n_retries;
+	int is_store;
+
+	size_t n_assigned;
+	size_t n_frames;
+
+	co_lss_assign_fn assign_fn;
+	co_lss_fn on_done;
+	void* context;
+};
+
+struct co_lss_info {
+	unsigned long timeout; /* ms */
+	int is_store;
+	co_lss_assign_fn assign_fn;
+	co_lss_fn on_done;
+	void* context;
+};
+
+int co_lss_init(struct co_lss* self, const struct sock* sock);
+void co_lss_destroy(struct co_lss* self);
+
+int co_lss_start(struct co_lss* self, const struct co_lss_info* info);
+void co_lss_stop(struct co_lss* self);
+
+int co_lss_feed(struct co_lss* self, const struct can_frame* cf);
+
+/* The identity of the node that was found last */
+void co_lss_get_identity(const struct co_lss* self,
+			 struct co_lss_identity* identity);
+
+/* Parses "vendor:product:revision:serial", each part in any base that strtoul
+ * takes.
+ */
+int co_lss_identity_from_string(struct co_lss_identity* identity,
+				const char* str);
+
+int co_lss_identity_is_equal(const struct co_lss_identity* a,
+			     const struct co_lss_identity* b);
+
+const char* co_lss_status_to_string(enum co_lss_status status);
+
+#endif /* _CANOPEN_LSS_H */
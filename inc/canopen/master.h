@@ -20,6 +20,8 @@
 #include <assert.h>
 #include "canopen.h"
 #include "canopen-driver.h"
+#include "canopen/drv_exec.h"
+#include "canopen/emcy_limit.h"
 #include "type-macros.h"
 
 enum co_master_driver_type {
@@ -30,7 +32,67 @@ enum co_master_driver_type {
 
 typedef int (*co_drv_init_fn)(struct co_drv*);
 
+struct pdo_map;
+
+/* Payload of the last TPDO that was passed on, see co_set_tpdo_on_change() */
+struct co_pdo_last {
+	int is_valid;
+	uint8_t len;
+	uint8_t data[64];
+};
+
+/* PDOs that are registered on COB-IDs of their own */
+struct co_drv_pdo {
+	int n;
+	uint32_t cob_id;
+	co_pdo_ts_fn fn;
+	struct co_pdo_last last;
+	unsigned int cycle; /* The SYNC cycle in which it last arrived */
+};
+
+/* TPDOs that are collected for co_set_pdo_batch_fn() by whoever runs the
+ * callbacks of the driver
+ */
+struct co_pdo_batch {
+	size_t n_frames;
+	struct co_pdo_frame frame[CO_PDO_BATCH_MAX];
+	uint8_t data[CO_PDO_BATCH_MAX][64];
+};
+
+/* The first members are the ones that are used when a TPDO is dispatched */
 struct co_drv {
+	co_pdo_fn pdo1_fn, pdo2_fn, pdo3_fn, pdo4_fn;
+	co_pdo_ts_fn pdo1_ts_fn, pdo2_ts_fn, pdo3_ts_fn, pdo4_ts_fn;
+
+	/* See co_set_exec_mode(); exec is only there while the driver has a
+	 * thread of its own
+	 */
+	enum co_exec_mode exec_mode;
+	struct co_drv_exec* exec;
+
+	/* See co_set_pdo_batch_fn(); is_pdo_batch_pending is set on the main
+	 * loop while frames of the current receive batch are on their way
+	 */
+	co_pdo_batch_fn pdo_batch_fn;
+	struct co_pdo_batch* pdo_batch;
+	int is_pdo_batch_pending;
+
+	/* Master-side PDO mapping, see co_tpdo_map() */
+	struct pdo_map* tpdo_map[4];
+	co_signal_fn tpdo_signal_fn[4];
+
+	/* See co_set_tpdo_fn() and co_set_rpdo_cob_id() */
+	struct co_drv_pdo* tpdo;
+	size_t n_tpdos;
+	struct co_drv_pdo* rpdo;
+	size_t n_rpdos;
+
+	/* Bit n is set if TPDO n is only passed on when it changes */
+	uint8_t tpdo_on_change[CO_PDO_MAX / 8 + 1];
+
+	co_emcy_fn emcy_fn;
+	co_start_fn start_fn;
+
 	void* dso;
 	co_drv_init_fn init_fn;
 
@@ -39,42 +101,83 @@ struct co_drv {
 	void* context;
 	co_free_fn free_fn;
 
-	co_pdo_fn pdo1_fn, pdo2_fn, pdo3_fn, pdo4_fn;
-	co_emcy_fn emcy_fn;
-	co_start_fn start_fn;
-
 	enum co_options options;
 
-	char iface[256];
+	struct pdo_map* rpdo_map[4];
+	void* pdo_setup;
+
+	/* CO_OPT_INHIBIT_START was set by the master until the mapping is set up */
+	int is_start_held;
+
+	/* See co_set_cycle_fn(). cycle is the SYNC count of the cycle that the
+	 * driver is in and cycle_missing the number of its inputs that have not
+	 * arrived in it yet. cycle_inputs has bit n - 1 set if TPDO n of 1-4 is
+	 * one of them, and tpdo_cycle holds the cycle in which it last arrived.
+	 */
+	co_cycle_fn cycle_fn;
+	uint32_t cycle_budget;
+	unsigned int cycle;
+	int cycle_missing;
+	int is_cycle_pending;
+	unsigned int cycle_inputs;
+	unsigned int tpdo_cycle[4];
 };
 
+/* The node table holds what is needed for handling frames. It is looked at for
+ * every frame, so the fields that the mux uses come first and each entry
+ * starts on a cache line of its own. Names and identity are in the separate
+ * struct co_master_node_ident.
+ */
 struct co_master_node {
 	enum co_master_driver_type driver_type;
+	int is_initialized;
+
+	/* TPDOs 1-4 that are only passed on when they change, as a bit mask
+	 * taken from the tpdo_on_change parameter
+	 */
+	unsigned int tpdo_on_change;
 
 	void* driver;
-	void* master_iface;
 
 	struct co_drv ndrv;
 
+	/* Written by whichever thread runs the driver callbacks */
+	struct co_drv_watchdog watchdog;
+	struct co_drv_watchdog cycle_watchdog;
+
+	/* Node guarding deadlines in microseconds on CLOCK_MONOTONIC, checked
+	 * by a single sweep timer. 0 means not armed.
+	 */
+	uint64_t heartbeat_deadline;
+	uint64_t ping_deadline;
+
+	uint32_t ntimeouts;
+	int is_loading;
+
 	uint32_t device_type;
 	int is_heartbeat_supported;
 
+	void* master_iface;
+
+	struct co_pdo_last tpdo_last[4];
+
+	/* EMCYs that are passed on to the driver, see emcy_policy */
+	struct co_emcy_limit emcy_limit;
+} __attribute__((aligned(64)));
+
+struct co_master_node_ident {
 	uint32_t vendor_id, product_code, revision_number;
 
-	struct mloop_timer* heartbeat_timer;
-	struct mloop_timer* ping_timer;
+	/* The identity was taken from the identity cache */
+	int is_identity_unconfirmed;
 
 	char name[64];
 	char hw_version[64];
 	char sw_version[64];
-
-	int is_loading;
-	int is_initialized;
-
-	uint32_t ntimeouts;
 };
 
 extern struct co_master_node co_master_node_[];
+extern struct co_master_node_ident co_master_node_ident_[];
 
 static inline int co_master_get_node_id(const struct co_master_node* node)
 {
@@ -88,14 +191,82 @@ static inline struct co_master_node* co_master_get_node(int nodeid)
 	return &co_master_node_[nodeid];
 }
 
+static inline struct co_master_node_ident* co_master_get_ident(int nodeid)
+{
+	assert(CANOPEN_NODEID_MIN <= nodeid && nodeid <= CANOPEN_NODEID_MAX);
+	return &co_master_node_ident_[nodeid];
+}
+
 int co_master_run(void);
 
+struct canopen_eds;
+
+/* Finds the EDS that matches the identity or the name of a node */
+const struct canopen_eds* co_master_find_eds(int nodeid);
+
+/* Run one master for each of the given interfaces. The REST port of the n-th
+ * bus is offset by n from the configured port.
+ */
+int co_master_run_buses(const char* const* ifaces, size_t n);
+
+/* Replaces the DSO of a new style driver with the file that is now on disk,
+ * for every node that uses it. The nodes keep their NMT state; only the
+ * driver is freed, initialized and started again. If the new driver fails to
+ * load or initialize for any of them, they all go back to the old one. A NULL
+ * name reloads every driver that is in use. Returns the number of nodes
+ * affected or -1 if the driver is not loaded, drivers are being loaded or the
+ * new driver failed.
+ */
+int co_master_reload_driver(const char* name);
+
+/* Reads the configuration file again and applies what has changed to the
+ * nodes that are running, without resetting them. Global parameters other
+ * than those in CFG__RELOADABLE_PARAMETERS need a restart. Returns the number
+ * of nodes whose configuration changed or -1 if the file could not be read or
+ * drivers are being loaded.
+ */
+int co_master_reload_config(void);
+
+/* Counters of the master itself, for monitoring. They are read without
+ * locking, so they may be slightly out of date.
+ */
+struct co_master_stats {
+	uint64_t n_heartbeat_timeouts;
+	uint64_t n_nodes_lost;
+	uint64_t n_tx_dropped;
+	size_t tx_queue_length;
+
+	/* Frames recorded in the trace buffer since it was created, out of a
+	 * ring of trace_length frames. trace_length is 0 without a trace buffer.
+	 */
+	uint64_t n_trace_frames;
+	size_t trace_length;
+
+	/* In per mille of bus_bitrate, see canopen/bus_load.h */
+	unsigned int bus_load;
+	int is_sdo_held;
+};
+
+void co_master_get_stats(struct co_master_stats* dst);
+
 int co_drv_load(struct co_drv* drv, const char* name);
 int co_drv_init(struct co_drv* drv);
 void co_drv_unload(struct co_drv* drv);
 
 int co__rpdox(int nodeid, int type, const void* data, size_t size);
+int co__send_pdo(uint32_t cob_id, const void* data, size_t size);
 int co__start(int nodeid);
+void co__update_filters(int nodeid);
+
+/* Dispatches frames as if they had been received; for benchmarks */
+void co__mux_on_frames(const struct canfd_frame* cf, const uint64_t* ts,
+		       size_t n);
+
+/* Starts a SYNC cycle and ends its inputs as if the SYNC had been sent and the
+ * input deadline had passed; for tests
+ */
+void co__cycle_begin(unsigned int sync_count);
+void co__cycle_deadline(void);
 
 static inline struct co_master_node* co_drv_node(const struct co_drv* drv)
 {
@@ -17,9 +17,12 @@
 #define CANOPEN_NETWORK_H_
 
 #include <stdint.h>
+#include <stddef.h>
+
+#include "canopen.h"
+#include "sock.h"
 
 struct can_frame;
-struct sock;
 
 /* Reset the network and see which nodes respond to the reset signal.
  *
@@ -28,7 +31,8 @@ struct sock;
  */
 int co_net_reset(const struct sock* sock, char* nodes_seen, int timeout);
 
-/* Reset each node individually and see if it responds to the reset signal.
+/* Reset the nodes in the range and see which respond to the reset signal.
+ * A range that covers all node ids is reset with a single broadcast.
  *
  * nodes_seen must be an array of length 128; prior values are not cleared.
  * start/stop is an inclusive range of node ids to probe
@@ -50,6 +54,72 @@ int co_net_probe_sdo(const struct sock* sock, char* nodes_seen, int start,
 		     int end, int timeout);
 
 int co_net_send_nmt(const struct sock* sock, int cs, int nodeid);
+
+/* Send an NMT command to each node in the inclusive range, as a broadcast if
+ * the range covers all node ids
+ */
+int co_net_send_nmt_range(const struct sock* sock, int cs, int start, int end);
+/* Scan the network for nodes and read their identities.
+ *
+ * All nodes are asked for their device type at once, and each node that
+ * answers is asked for the next object as soon as it has answered the
+ * previous one, so a scan takes about one timeout no matter how many node
+ * ids are covered. A node that does not answer within the timeout is left
+ * out, or is left with what it has answered so far.
+ *
+ * Strings that do not fit are cut short. timeout is in ms.
+ */
+#define CO_NET_SCAN_STRING_SIZE 64
+
+struct co_net_node_info {
+	int is_present;
+	uint32_t device_type;
+	uint32_t vendor_id, product_code, revision_number, serial_number;
+	char name[CO_NET_SCAN_STRING_SIZE];
+	char hw_version[CO_NET_SCAN_STRING_SIZE];
+	char sw_version[CO_NET_SCAN_STRING_SIZE];
+};
+
+struct co_net__scan_state {
+	unsigned int step;
+	int is_waiting;
+	int is_segmented;
+	int toggle;
+	uint64_t deadline;
+	size_t size;
+	uint8_t buffer[CO_NET_SCAN_STRING_SIZE];
+};
+
+struct co_net_scan {
+	int start, end;
+	int timeout;
+	size_t n_waiting;
+	struct co_net_node_info node[CANOPEN_NODEID_MAX + 1];
+	struct co_net__scan_state state[CANOPEN_NODEID_MAX + 1];
+};
+
+int co_net_scan(const struct sock* sock, struct co_net_scan* scan, int start,
+		int end, int timeout);
+
+/* Opens the bus at addr, scans it and closes it again */
+int co_net_scan_bus(enum sock_type type, const char* addr,
+		    struct co_net_scan* scan, int start, int end, int timeout);
+
+/* The steps of co_net_scan(), for those who do their own I/O. Each writes the
+ * requests that are to be sent next into out and returns their number. out
+ * must have room for CANOPEN_NODEID_MAX frames. Time is in ms on any clock.
+ */
+size_t co_net_scan_begin(struct co_net_scan* scan, int start, int end,
+			 int timeout, struct can_frame* out, uint64_t now);
+size_t co_net_scan_feed(struct co_net_scan* scan, const struct can_frame* cf,
+			struct can_frame* out, uint64_t now);
+
+/* Gives up on the nodes that are past their deadline and returns the time
+ * until the next deadline, or -1 if the scan is done.
+ */
+int co_net_scan_expire(struct co_net_scan* scan, uint64_t now);
+
+int co_net__request_heartbeat(const struct sock* sock, int nodeid);
 int co_net__request_device_type(const struct sock* sock, int nodeid);
 
 int co_net__wait_for_bootup(const struct sock* sock, char* nodes_seen,
@@ -0,0 +1,58 @@
+#ifndef CANOPEN_PDO_MAP_H_
+#define CANOPEN_PDO_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "canopen-driver.h"
+
+/* Compiled PDO Mappings
+ *
+ * A mapping is compiled once into a flat table with the byte position, shift
+ * and mask of every mapped object, so that decoding and encoding a PDO is a
+ * single pass over the table without looking at the mapping again. Decoded
+ * values are kept in the map until the next PDO arrives.
+ */
+
+#define PDO_MAP_ENTRIES_MAX 64
+#define PDO_MAP_SIZE_MAX 64 /* bytes */
+
+struct canopen_eds;
+
+struct pdo_map_entry {
+	uint16_t byte;
+	uint8_t shift;
+	uint8_t n_bytes;
+	uint64_t mask;
+};
+
+struct pdo_map {
+	int is_ready;
+
+	/* The mapping that the driver asked for, if any */
+	int has_mapping;
+	uint32_t mapping[PDO_MAP_ENTRIES_MAX];
+	size_t n_mapping;
+
+	size_t size; /* bytes */
+	size_t n_entries;
+	struct pdo_map_entry entry[PDO_MAP_ENTRIES_MAX];
+	struct co_signal signal[PDO_MAP_ENTRIES_MAX];
+};
+
+/* Types are taken from the EDS if one is given. Objects that it does not have
+ * are unsigned. Dummy entries, whose index is a data type, get that type.
+ * Returns -1 if the entries are not valid or do not fit in a PDO.
+ */
+int pdo_map_compile(struct pdo_map* self, const uint32_t* mapping, size_t n,
+		    const struct canopen_eds* eds);
+
+int pdo_map_find(const struct pdo_map* self, int index, int subindex);
+
+/* Returns -1 if the PDO is shorter than the mapping */
+int pdo_map_decode(struct pdo_map* self, const void* data, size_t size);
+
+/* Writes the signals of the map to dst and returns the size of the PDO */
+ssize_t pdo_map_encode(const struct pdo_map* self, void* dst, size_t size);
+
+#endif /* CANOPEN_PDO_MAP_H_ */
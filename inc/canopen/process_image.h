@@ -0,0 +1,79 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_PROCESS_IMAGE_H
+#define _CANOPEN_PROCESS_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Shared memory process image.
+ *
+ * The master writes the last TPDO received and the last RPDO sent for PDOs
+ * 1-4 of every node into a POSIX shared memory object named
+ * "/canopen-pi.<iface>". Other processes map it read-only and take snapshots
+ * of single PDOs without any system calls or locks.
+ *
+ * Each slot is guarded by a sequence counter that is odd while the slot is
+ * being written. Readers copy the slot and retry if the counter was odd or
+ * changed in the meantime.
+ */
+
+#define CO_PI_MAGIC 0x43504931 /* "CPI1" */
+#define CO_PI_NODE_COUNT 128
+#define CO_PI_PDO_COUNT 4
+#define CO_PI_DATA_SIZE 64
+
+enum co_pi_direction {
+	CO_PI_TPDO = 0,
+	CO_PI_RPDO,
+};
+
+struct co_pi_slot {
+	uint32_t seq;
+	uint32_t len;
+	uint64_t timestamp;
+	uint8_t data[CO_PI_DATA_SIZE];
+};
+
+struct co_pi {
+	uint32_t magic;
+	uint32_t size;
+	struct co_pi_slot slot[CO_PI_NODE_COUNT][2][CO_PI_PDO_COUNT];
+};
+
+/* A consistent copy of a slot. The timestamp is in microseconds on
+ * CLOCK_REALTIME.
+ */
+struct co_pi_value {
+	uint64_t timestamp;
+	size_t len;
+	uint8_t data[CO_PI_DATA_SIZE];
+};
+
+/* Master side */
+int co_pi_init(const char* iface);
+void co_pi_cleanup(void);
+int co_pi_is_open(void);
+void co_pi_write(enum co_pi_direction direction, int nodeid, int n,
+		 const void* data, size_t len, uint64_t timestamp);
+
+/* Reader side. co_pi_read() returns -1 if the PDO has never been seen. */
+const struct co_pi* co_pi_open(const char* iface);
+void co_pi_close(const struct co_pi* pi);
+int co_pi_read(const struct co_pi* pi, enum co_pi_direction direction,
+	       int nodeid, int n, struct co_pi_value* dst);
+
+#endif /* _CANOPEN_PROCESS_IMAGE_H */
@@ -0,0 +1,84 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_REPLAY_H_
+#define CANOPEN_REPLAY_H_
+
+#include <stdint.h>
+
+#include "sock.h"
+
+/* Replays the traffic of a trace file onto a bus, e.g. a vcan interface with
+ * a master under test on it.
+ *
+ * By default only what the nodes send is replayed: TPDOs, SDO responses,
+ * heartbeats and EMCYs. Everything else on the bus while the trace is being
+ * replayed, i.e. the output of the master, can be recorded to a file.
+ */
+
+/* Replays every frame, including ones that are not CANopen objects */
+#define CO_REPLAY_ALL UINT32_MAX
+
+struct co_replay_params {
+	/* The trace to replay, in any format that canopen-dump -f reads */
+	const char* path;
+
+	/* Frames received during the replay are written here unless NULL */
+	const char* output;
+
+	/* "raw", "pcapng" or "candump"; NULL means "raw" */
+	const char* output_format;
+
+	/* 1.0 keeps the original timing, 2.0 plays twice as fast and 0.0
+	 * sends the frames as fast as the bus takes them.
+	 */
+	double speed;
+
+	/* Objects to replay as a mask of enum canopen_object. 0 selects the
+	 * objects that nodes send.
+	 */
+	uint32_t objects;
+
+	/* Time to keep recording after the last frame, in milliseconds */
+	unsigned int linger;
+};
+
+struct co_replay_stats {
+	uint64_t n_sent;
+	uint64_t n_skipped;
+	uint64_t n_received;
+
+	/* Microseconds from the first to the last frame sent */
+	uint64_t duration;
+
+	/* How late frames went out compared to their original timing, in
+	 * microseconds.
+	 */
+	uint64_t lag_sum;
+	uint64_t lag_max;
+};
+
+/* Opens the bus at addr, replays the trace and closes the bus again. Returns
+ * -1 on error.
+ */
+int co_replay(enum sock_type type, const char* addr,
+	      const struct co_replay_params* params,
+	      struct co_replay_stats* stats);
+
+/* Like co_replay(), but on a bus that is already open */
+int co_replay_sock(struct sock* sock, const struct co_replay_params* params,
+		   struct co_replay_stats* stats);
+
+#endif /* CANOPEN_REPLAY_H_ */
@@ -32,6 +32,12 @@
 #define SDO_EXPEDIATED_DATA_SIZE 4
 #define SDO_MULTIPLEXER_IDX 1
 #define SDO_MULTIPLEXER_SIZE 3
+#define SDO_BLOCK_SIZE_MAX 127
+#define SDO_BLOCK_SIZE_IDX 4
+#define SDO_BLOCK_PST_IDX 5
+#define SDO_BLOCK_ACKSEQ_IDX 1
+#define SDO_BLOCK_NEXT_SIZE_IDX 2
+#define SDO_BLOCK_CRC_IDX 1
 
 enum sdo_ccs {
 	SDO_CCS_DL_SEG_REQ = 0,
@@ -39,6 +45,8 @@ enum sdo_ccs {
 	SDO_CCS_UL_INIT_REQ = 2,
 	SDO_CCS_UL_SEG_REQ = 3,
 	SDO_CCS_ABORT = 4,
+	SDO_CCS_BLOCK_UL_REQ = 5,
+	SDO_CCS_BLOCK_DL_REQ = 6,
 };
 
 enum sdo_scs {
@@ -47,6 +55,22 @@ enum sdo_scs {
 	SDO_SCS_UL_INIT_RES = 2,
 	SDO_SCS_DL_INIT_RES = 3,
 	SDO_SCS_ABORT = 4,
+	SDO_SCS_BLOCK_DL_RES = 5,
+	SDO_SCS_BLOCK_UL_RES = 6,
+};
+
+/* The command specifier is the upper 3 bits of the first byte */
+#define SDO_CS_COUNT 8
+
+/* Block download requests and block upload responses use bit 1 as a size
+ * indicator, so only SDO_BLOCK_INIT and SDO_BLOCK_END can be told apart in
+ * those.
+ */
+enum sdo_block_subcmd {
+	SDO_BLOCK_INIT = 0,
+	SDO_BLOCK_END = 1,
+	SDO_BLOCK_ACK = 2,
+	SDO_BLOCK_START = 3,
 };
 
 enum sdo_abort_code {
@@ -236,9 +260,103 @@ static inline void sdo_copy_multiplexer(struct can_frame* dst,
 	       SDO_MULTIPLEXER_SIZE);
 }
 
+static inline int sdo_block_get_subcmd(const struct can_frame* frame)
+{
+	return frame->data[0] & 3;
+}
+
+static inline int sdo_block_is_end(const struct can_frame* frame)
+{
+	return frame->data[0] & 1;
+}
+
+static inline void sdo_block_set_subcmd(struct can_frame* frame,
+					enum sdo_block_subcmd subcmd)
+{
+	frame->data[0] &= ~3;
+	frame->data[0] |= subcmd;
+}
+
+static inline int sdo_block_has_crc(const struct can_frame* frame)
+{
+	return !!(frame->data[0] & 4);
+}
+
+static inline void sdo_block_use_crc(struct can_frame* frame)
+{
+	frame->data[0] |= 4;
+}
+
+static inline int sdo_block_is_size_indicated(const struct can_frame* frame)
+{
+	return !!(frame->data[0] & 2);
+}
+
+static inline void sdo_block_indicate_size(struct can_frame* frame)
+{
+	frame->data[0] |= 2;
+}
+
+/* Number of bytes in the last segment that hold data, as given by the end
+ * frame of a block transfer
+ */
+static inline size_t sdo_block_get_end_size(const struct can_frame* frame)
+{
+	return 7 - ((frame->data[0] >> 2) & 7);
+}
+
+static inline void sdo_block_set_end_size(struct can_frame* frame,
+					  size_t size)
+{
+	frame->data[0] &= ~(7 << 2);
+	frame->data[0] |= (7 - size) << 2;
+}
+
+static inline uint16_t sdo_block_get_crc(const struct can_frame* frame)
+{
+	uint16_t crc;
+	byteorder(&crc, &frame->data[SDO_BLOCK_CRC_IDX], sizeof(crc));
+	return crc;
+}
+
+static inline void sdo_block_set_crc(struct can_frame* frame, uint16_t crc)
+{
+	byteorder(&frame->data[SDO_BLOCK_CRC_IDX], &crc, sizeof(crc));
+}
+
+/* Segments within a block have no command specifier. Their first byte holds
+ * a sequence number from 1 and a flag that marks the last segment.
+ */
+static inline int sdo_block_get_seqno(const struct can_frame* frame)
+{
+	return frame->data[0] & 0x7f;
+}
+
+static inline int sdo_block_is_last_segment(const struct can_frame* frame)
+{
+	return !!(frame->data[0] & 0x80);
+}
+
+static inline void sdo_block_set_seqno(struct can_frame* frame, int seqno,
+				       int is_last)
+{
+	frame->data[0] = seqno | (is_last ? 0x80 : 0);
+}
+
+/* A segment with sequence number 0 is never sent, so this is what an abort
+ * looks like in the middle of a block.
+ */
+static inline int sdo_block_is_abort(const struct can_frame* frame)
+{
+	return frame->data[0] == SDO_SCS_ABORT << 5;
+}
+
 void sdo_abort(struct can_frame* frame, enum sdo_abort_code code, int index,
 	       int subindex);
 
+/* CRC-16-CCITT with an initial value of 0, as used by block transfers */
+uint16_t sdo_crc16(uint16_t crc, const void* data, size_t size);
+
 const char* sdo_strerror(enum sdo_abort_code code);
 
 #endif /* _CANOPEN_SDO_H */
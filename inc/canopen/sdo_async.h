@@ -27,13 +27,30 @@ struct can_frame;
 
 typedef void (*sdo_async_fn)(struct sdo_async* async);
 typedef void (*sdo_async_free_fn)(void* ptr);
+typedef int (*sdo_async_send_fn)(struct sdo_async* async,
+				 struct can_frame* cf);
 
 enum sdo_async_comm_state {
 	SDO_ASYNC_COMM_START = 0,
-	SDO_ASYNC_COMM_INIT_RESPONSE,
-	SDO_ASYNC_COMM_SEG_RESPONSE,
+	SDO_ASYNC_COMM_INIT_DL_RESPONSE,
+	SDO_ASYNC_COMM_INIT_UL_RESPONSE,
+	SDO_ASYNC_COMM_INIT_BLOCK_DL_RESPONSE,
+	SDO_ASYNC_COMM_INIT_BLOCK_UL_RESPONSE,
+	SDO_ASYNC_COMM_DL_SEG_RESPONSE,
+	SDO_ASYNC_COMM_UL_SEG_RESPONSE,
+	SDO_ASYNC_COMM_BLOCK_ACK,
+	SDO_ASYNC_COMM_BLOCK_SEGMENT,
+	SDO_ASYNC_COMM_BLOCK_DL_END,
+	SDO_ASYNC_COMM_BLOCK_UL_END,
+	SDO_ASYNC_N_COMM_STATES,
 };
 
+/* Downloads of more than this many bytes and all uploads use block transfers
+ * if a block size is set. Smaller uploads are switched to a normal transfer
+ * by the server.
+ */
+#define SDO_ASYNC_BLOCK_THRESHOLD (3 * SDO_SEGMENT_MAX_SIZE)
+
 enum sdo_async_quirks_flags {
 	SDO_ASYNC_QUIRK_NONE = 0,
 	SDO_ASYNC_QUIRK_IGNORE_MULTIPLEXER = 1,
@@ -44,6 +61,8 @@ enum sdo_async_quirks_flags {
 struct sdo_async {
 	struct sock sock;
 	unsigned int nodeid;
+	uint32_t tx_cob_id; /* Client to server, R_RSDO + nodeid by default */
+	uint32_t rx_cob_id; /* Server to client, R_TSDO + nodeid by default */
 	enum sdo_req_type type;
 	int is_running;
 	enum sdo_async_comm_state comm_state;
@@ -59,6 +78,26 @@ struct sdo_async {
 	void* context;
 	sdo_async_free_fn free_fn;
 	int is_size_indicated;
+	sdo_async_send_fn send_fn;
+
+	/* Time from the last frame sent to the last response received in
+	 * microseconds, or 0 if nothing was received.
+	 */
+	uint64_t sent_at;
+	uint64_t rtt;
+
+	/* Block size to ask for in uploads; 0 disables block transfers */
+	unsigned int block_size;
+	unsigned int blksize; /* Negotiated for the current block */
+	int is_block;
+	int use_crc;
+	int seqno;
+	size_t block_start;
+
+	/* The next segment request with everything but the toggle bit, the
+	 * data and the size filled in
+	 */
+	struct can_frame seg_template;
 };
 
 struct sdo_async_info {
@@ -75,6 +114,10 @@ struct sdo_async_info {
 int sdo_async_init(struct sdo_async* self, const struct sock* sock, int nodeid);
 void sdo_async_destroy(struct sdo_async* self);
 
+/* Hand outgoing frames to fn instead of sending them straight to the socket.
+ */
+void sdo_async_set_send_fn(struct sdo_async* self, sdo_async_send_fn fn);
+
 int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info);
 int sdo_async_stop(struct sdo_async* self);
 
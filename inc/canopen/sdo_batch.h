@@ -0,0 +1,106 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SDO_BATCH_H_
+#define SDO_BATCH_H_
+
+#include <stddef.h>
+#include "vector.h"
+#include "arc.h"
+#include "canopen/sdo.h"
+#include "canopen/sdo_req_enums.h"
+
+/* SDO Request Batches
+ *
+ * A batch is a list of uploads and downloads that is submitted to the queue of
+ * a node as one unit: either all of them are queued or none. The batch is done
+ * when all of its items are, and on_done is then called once. The items keep
+ * their order within their priority, and uploads may run on any of the
+ * node's channels and as block transfers if the node supports them.
+ *
+ * With SDO_BATCH_STOP_ON_ERROR, items that have not been started when one of
+ * them fails are cancelled.
+ */
+
+struct sdo_batch;
+struct sdo_req;
+struct sdo_req_queue;
+
+typedef void (*sdo_batch_fn)(struct sdo_batch*);
+typedef void (*sdo_batch_free_fn)(void*);
+
+enum sdo_batch_flags {
+	SDO_BATCH_STOP_ON_ERROR = 1,
+};
+
+struct sdo_batch_item {
+	struct sdo_batch* parent;
+	struct sdo_req* req;
+	enum sdo_req_type type;
+	int index, subindex;
+	struct vector data;
+	enum sdo_req_status status;
+	enum sdo_abort_code abort_code;
+	int is_size_indicated;
+};
+
+struct sdo_batch {
+	int ref;
+	enum sdo_req_priority priority;
+	enum sdo_batch_flags flags;
+	struct sdo_batch_item* items;
+	size_t n_items;
+	size_t n_pending;
+	int is_started;
+	int is_done;
+	struct sdo_req_queue* queue;
+	sdo_batch_fn on_done;
+	void* context;
+	sdo_batch_free_fn context_free_fn;
+};
+
+struct sdo_batch* sdo_batch_new(enum sdo_req_priority priority,
+				enum sdo_batch_flags flags);
+
+/* For batches that are embedded in another object. They are freed with
+ * free() when the last reference is dropped.
+ */
+void sdo_batch_init(struct sdo_batch* self, enum sdo_req_priority priority,
+		    enum sdo_batch_flags flags);
+
+int sdo_batch_add_upload(struct sdo_batch* self, int index, int subindex);
+int sdo_batch_add_download(struct sdo_batch* self, int index, int subindex,
+			   const void* data, size_t size);
+
+/* Items may not be added after this. The batch holds a reference to itself
+ * until it is done.
+ */
+int sdo_batch_start(struct sdo_batch* self, struct sdo_req_queue* queue);
+void sdo_batch_wait(struct sdo_batch* self);
+
+/* SDO_REQ_OK if all items succeeded, otherwise the status of the first item
+ * in the batch that did not.
+ */
+enum sdo_req_status sdo_batch_get_status(const struct sdo_batch* self);
+
+static inline const struct sdo_batch_item*
+sdo_batch_get_item(const struct sdo_batch* self, size_t i)
+{
+	return i < self->n_items ? &self->items[i] : NULL;
+}
+
+ARC_PROTOTYPE(sdo_batch)
+
+#endif /* SDO_BATCH_H_ */
@@ -0,0 +1,47 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SDO_CACHE_H_
+#define SDO_CACHE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "canopen/eds.h"
+
+/* Cache of uploaded values of objects that never change while a node is
+ * running. Only objects that the EDS of the node marks as const may be
+ * stored. All entries of a node must be dropped when it boots up.
+ *
+ * The cache may be used from any thread.
+ */
+
+static inline int sdo_cache_is_cacheable(const struct eds_obj* obj)
+{
+	return obj && (obj->access & EDS_OBJ_CONST);
+}
+
+int sdo_cache_put(int nodeid, int index, int subindex, const void* data,
+		  size_t size, int is_size_indicated);
+
+/* Copies up to size bytes of the value into dst. Returns the full size of the
+ * value or -1 if it is not cached.
+ */
+ssize_t sdo_cache_get(int nodeid, int index, int subindex, void* dst,
+		      size_t size, int* is_size_indicated);
+
+void sdo_cache_invalidate_node(int nodeid);
+void sdo_cache_clear(void);
+
+#endif /* SDO_CACHE_H_ */
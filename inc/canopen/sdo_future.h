@@ -0,0 +1,91 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SDO_FUTURE_H_
+#define SDO_FUTURE_H_
+
+#include <stddef.h>
+#include "arc.h"
+#include "canopen/sdo_req_enums.h"
+
+/* SDO Futures
+ *
+ * A future stands for the outcome of SDO transfers that are in progress.
+ * Instead of blocking until they are done, the caller attaches a continuation
+ * with sdo_future_then(), which is run on the main loop once the future is
+ * done. Futures for transfers to any number of nodes can be combined with
+ * sdo_future_when_all().
+ *
+ * A future that has not been started successfully is never returned, and
+ * every future is done eventually: transfers that are cancelled, e.g.
+ * because their node is lost, count as done with SDO_REQ_CANCELLED.
+ */
+
+struct sdo_future;
+struct sdo_batch;
+struct sdo_req_queue;
+
+typedef void (*sdo_future_fn)(struct sdo_future*);
+typedef void (*sdo_future_free_fn)(void*);
+
+/* The future takes over the done callback and context of the batch */
+struct sdo_future* sdo_future_start(struct sdo_batch* batch,
+				    struct sdo_req_queue* queue);
+
+struct sdo_future* sdo_future_read(struct sdo_req_queue* queue,
+				   enum sdo_req_priority priority,
+				   int index, int subindex);
+struct sdo_future* sdo_future_write(struct sdo_req_queue* queue,
+				    enum sdo_req_priority priority,
+				    int index, int subindex,
+				    const void* data, size_t size);
+
+/* Done when all of the given futures are done. A future can only be part of
+ * one such combination.
+ */
+struct sdo_future* sdo_future_when_all(struct sdo_future* const* futures,
+				       size_t n);
+
+/* Only one continuation may be attached. It is run even if the future is
+ * already done.
+ */
+int sdo_future_then(struct sdo_future* self, sdo_future_fn fn, void* context,
+		    sdo_future_free_fn free_fn);
+
+void* sdo_future_get_context(const struct sdo_future* self);
+
+/* For callers that are not on the main loop */
+void sdo_future_wait(struct sdo_future* self);
+
+int sdo_future_is_done(const struct sdo_future* self);
+
+/* SDO_REQ_OK if all transfers succeeded, otherwise the status of the first
+ * one that did not.
+ */
+enum sdo_req_status sdo_future_get_status(const struct sdo_future* self);
+
+/* The batch of a started future or NULL for combined futures */
+const struct sdo_batch* sdo_future_get_batch(const struct sdo_future* self);
+
+/* The value from the first item of a started future */
+const void* sdo_future_get_data(const struct sdo_future* self, size_t* size);
+
+size_t sdo_future_get_child_count(const struct sdo_future* self);
+struct sdo_future* sdo_future_get_child(const struct sdo_future* self,
+					size_t i);
+
+ARC_PROTOTYPE(sdo_future)
+
+#endif /* SDO_FUTURE_H_ */
@@ -27,14 +27,34 @@
 #include "canopen/sdo_req_enums.h"
 #include "type-macros.h"
 
+/* Payloads up to this size are stored within the request itself. That covers
+ * expedited transfers and most short strings, such as names and versions,
+ * so most requests never touch the heap for their data.
+ */
+#define SDO_REQ_INLINE_SIZE 32
+
+/* Client channels per node, including the default one */
+#define SDO_REQ_CHANNELS_MAX 8
+
+/* Default bounds for the response timeout, in milliseconds */
+#define SDO_REQ_TIMEOUT_MIN 100
+#define SDO_REQ_TIMEOUT_MAX 1000
+
+/* A request that is first in line for its priority is started at the latest
+ * after this many requests of higher priority have been started ahead of it.
+ */
+#define SDO_REQ_AGING_LIMIT 8
+
 struct sdo_req;
 struct sock;
+struct objpool;
 
 typedef void (*sdo_req_fn)(struct sdo_req*);
 typedef void (*sdo_req_free_fn)(void*);
 
 struct sdo_req_info {
 	enum sdo_req_type type;
+	enum sdo_req_priority priority;
 	int index, subindex;
 	sdo_req_fn on_done;
 	const void* dl_data;
@@ -42,12 +62,26 @@ struct sdo_req_info {
 	void* context;
 };
 
+struct sdo_req_channel_info {
+	uint32_t tx_cob_id;
+	uint32_t rx_cob_id;
+};
+
 struct sdo_req_queue;
 
+TAILQ_HEAD(sdo_req_list, sdo_req);
+
 struct sdo_req {
 	int ref;
 	TAILQ_ENTRY(sdo_req) links;
+
+	/* Identical uploads that wait for the result of this one */
+	struct sdo_req_list waiters;
+	struct sdo_req* primary;
+
 	enum sdo_req_type type;
+	enum sdo_req_priority priority;
+	unsigned int n_passed;
 	int index, subindex;
 	struct vector data;
 	enum sdo_req_status status;
@@ -57,18 +91,41 @@ struct sdo_req {
 	void* context;
 	sdo_req_free_fn context_free_fn;
 	int is_size_indicated;
-};
 
-TAILQ_HEAD(sdo_req_list, sdo_req);
+	/* The pool that the request came from, or NULL if it was malloc'ed */
+	struct objpool* pool;
+
+	/* The request is on a channel. If it's started again before the
+	 * channel lets go of it, it is queued on restart_queue afterwards.
+	 * Both are guarded by the queue lock.
+	 */
+	int is_running;
+	struct sdo_req_queue* restart_queue;
+
+	char inline_data[SDO_REQ_INLINE_SIZE];
+};
 
 struct sdo_req_queue {
 	pthread_mutex_t mutex;
 	size_t size;
 	size_t limit;
-	struct sdo_req_list list;
+	struct sdo_req_list list[SDO_REQ_PRIO_COUNT];
 	struct sdo_async sdo_client;
-	struct mloop_idle* idle;
+	struct sdo_async* channel[SDO_REQ_CHANNELS_MAX]; /* [0] is sdo_client */
+	size_t n_channels;
 	int nodeid;
+
+	/* Smoothed round trip time and its mean deviation in microseconds */
+	uint64_t srtt, rttvar;
+	unsigned long timeout_min, timeout_max; /* ms */
+	int is_lost;
+
+	/* Outcomes of the transfers that have run on the channels of the
+	 * queue, updated on the main loop. Round trip times are in
+	 * microseconds.
+	 */
+	uint64_t n_ok, n_aborts, n_timeouts;
+	uint64_t rtt_total, rtt_max, n_rtts;
 };
 
 int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
@@ -79,15 +136,81 @@ int sdo_req_queues_init(const struct sock* sock, size_t limit,
 			enum sdo_async_quirks_flags quirks);
 void sdo_req_queues_cleanup();
 
+/* Applies to the queues that exist and to those that are created later */
+void sdo_req_queues_set_send_fn(sdo_async_send_fn fn);
+
+/* The queue of a node is created on first use. Returns NULL if that fails.
+ * Starting a request on a NULL queue fails, so the result can be passed on
+ * to sdo_req_start() without checking.
+ */
 struct sdo_req_queue* sdo_req_queue_get(int nodeid);
+
+/* Returns NULL if the queue of the node has not been created yet */
+struct sdo_req_queue* sdo_req_queue_find(int nodeid);
 void sdo_req_queue_flush(struct sdo_req_queue* self);
 
+/* The response timeout follows the measured round trip time of the node,
+ * like the retransmission timeout of TCP, within these bounds. Until there
+ * are measurements it is the maximum.
+ */
+void sdo_req_queue_set_timeout_bounds(struct sdo_req_queue* self,
+				      unsigned long min_ms,
+				      unsigned long max_ms);
+unsigned long sdo_req_queue_get_timeout(const struct sdo_req_queue* self);
+
+/* A lost node does not get any more requests: queued requests are cancelled
+ * and new ones fail until the node is back.
+ */
+void sdo_req_queue_set_lost(struct sdo_req_queue* self, int is_lost);
+
+/* Replace the additional client channels of a queue. They inherit their
+ * settings from the default channel. Requests that are running on the old
+ * channels are cancelled.
+ *
+ * Uploads are spread across all idle channels. A download waits until all
+ * channels are idle and nothing else starts until it is done, so writes keep
+ * their order with respect to everything else in the queue.
+ */
+int sdo_req_queue_set_channels(struct sdo_req_queue* self,
+			       const struct sdo_req_channel_info* info,
+			       size_t n);
+
+/* Requests of the given priority and lower stay in their queues until they
+ * are released, which marks all queues as ready. Requests that are already
+ * running are not affected.
+ */
+void sdo_req_queues_hold(enum sdo_req_priority priority);
+void sdo_req_queues_release(void);
+int sdo_req_queues_is_held(void);
+
+/* Returns NULL if none of the channels receives on rx_cob_id */
+struct sdo_async* sdo_req_queue_find_channel(struct sdo_req_queue* self,
+					     uint32_t rx_cob_id);
+
 struct sdo_req* sdo_req_new(struct sdo_req_info* info);
 void sdo_req_free(struct sdo_req* self);
 
+/* Use this rather than changing the data vector directly, as it may point
+ * into the request.
+ */
+int sdo_req_set_data(struct sdo_req* self, const void* data, size_t size);
+
+/* A request that is done can be started again, also from its on_done. It
+ * keeps its settings and, for an upload, its buffer. Starting a request that
+ * is still pending fails.
+ */
 int sdo_req_start(struct sdo_req* self, struct sdo_req_queue* queue);
 void sdo_req_wait(struct sdo_req* self);
 
+/* Takes a request that has not been started yet off its queue and drops the
+ * reference of the queue. The request is not passed to its on_done.
+ * Returns -1 if the request is already running or done.
+ */
+int sdo_req_queue_cancel(struct sdo_req_queue* self, struct sdo_req* req);
+
+void sdo_req_queue__lock(struct sdo_req_queue* self);
+void sdo_req_queue__unlock(struct sdo_req_queue* self);
+
 int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req);
 struct sdo_req* sdo_req_queue__dequeue(struct sdo_req_queue* self);
 
@@ -21,6 +21,18 @@ enum sdo_req_type {
 	SDO_REQ_DOWNLOAD
 };
 
+/* A queue starts requests of higher priority first. Requests that get zero
+ * have SDO_REQ_PRIO_DRIVER.
+ */
+enum sdo_req_priority {
+	SDO_REQ_PRIO_REALTIME = 1,
+	SDO_REQ_PRIO_DRIVER,
+	SDO_REQ_PRIO_CONFIG,
+	SDO_REQ_PRIO_BACKGROUND,
+};
+
+#define SDO_REQ_PRIO_COUNT 4
+
 enum sdo_req_status {
 	SDO_REQ_PENDING = 0,
 	SDO_REQ_OK,
@@ -27,7 +27,13 @@ struct can_frame;
 enum sdo_srv_comm_state {
 	SDO_SRV_COMM_INIT_REQ = 0,
 	SDO_SRV_COMM_DL_SEG_REQ,
-	SDO_SRV_COMM_UL_SEG_REQ
+	SDO_SRV_COMM_UL_SEG_REQ,
+	SDO_SRV_COMM_BLOCK_DL_SEG,
+	SDO_SRV_COMM_BLOCK_DL_END,
+	SDO_SRV_COMM_BLOCK_UL_START,
+	SDO_SRV_COMM_BLOCK_UL_ACK,
+	SDO_SRV_COMM_BLOCK_UL_END,
+	SDO_SRV_N_COMM_STATES,
 };
 
 typedef int (*sdo_srv_fn)(struct sdo_srv* srv);
@@ -45,6 +51,18 @@ struct sdo_srv {
 	int is_toggled;
 	enum sdo_req_status status;
 	enum sdo_abort_code abort_code;
+
+	/* Block size to ask for in downloads; SDO_BLOCK_SIZE_MAX by default */
+	unsigned int block_size;
+	unsigned int blksize; /* Negotiated for the current block */
+	int use_crc;
+	int seqno;
+	size_t block_start;
+
+	/* The next segment response with everything but the toggle bit, the
+	 * data and the size filled in
+	 */
+	struct can_frame seg_template;
 };
 
 int sdo_srv_init(struct sdo_srv* self, const struct sock* sock, int nodeid,
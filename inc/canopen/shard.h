@@ -0,0 +1,95 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_SHARD_H
+#define _CANOPEN_SHARD_H
+
+#include <unistd.h>
+#include <stdint.h>
+
+struct canfd_frame;
+struct co_shard_owner;
+struct co_shard_client;
+
+/* Sharing of one bus between several master processes.
+ *
+ * The owner is the only process that reads the bus. It listens on a
+ * SOCK_SEQPACKET UNIX socket where shards register the range of node ids that
+ * they manage. A range that overlaps the range of the owner or of another
+ * shard is refused. The range is released when the shard closes the
+ * connection.
+ *
+ * Registered shards map a ring in shared memory into which the owner copies
+ * every frame that it receives, and the owner signals an eventfd of each
+ * shard after every batch. There is only one writer and the ring is
+ * overwritten as it goes along, so a shard that falls more than
+ * CO_SHARD_RING_SIZE frames behind loses frames. Those are counted.
+ *
+ * Paths that start with '@' are in the abstract namespace.
+ */
+
+#define CO_SHARD_RING_SIZE 8192 /* frames */
+#define CO_SHARD_MAX 32
+
+enum co_shard_msg_type {
+	CO_SHARD_MSG_REGISTER = 1,
+	CO_SHARD_MSG_ACCEPT,
+	CO_SHARD_MSG_REJECT,
+};
+
+struct co_shard_msg {
+	uint8_t type;
+	uint8_t range_start;
+	uint8_t range_stop;
+	uint8_t reserved;
+} __attribute__((packed));
+
+struct co_shard_owner* co_shard_owner_new(const char* path, int range_start,
+					  int range_stop);
+void co_shard_owner_free(struct co_shard_owner* self);
+
+/* Readable when there are connections or messages to process */
+int co_shard_owner_get_fd(const struct co_shard_owner* self);
+
+/* Accepts new shards and handles registrations and disconnects without
+ * blocking
+ */
+void co_shard_owner_process(struct co_shard_owner* self);
+
+/* Copies the frames to the ring and wakes up the shards */
+void co_shard_owner_publish(struct co_shard_owner* self,
+			    const struct canfd_frame* cf, const uint64_t* ts,
+			    size_t n);
+
+size_t co_shard_owner_get_n_shards(const struct co_shard_owner* self);
+
+/* Fails with EADDRINUSE if the owner refuses the range */
+struct co_shard_client* co_shard_client_open(const char* path,
+					     int range_start, int range_stop);
+void co_shard_client_close(struct co_shard_client* self);
+
+/* Readable while there are frames in the ring */
+int co_shard_client_get_fd(const struct co_shard_client* self);
+
+/* Readable when the owner has gone away */
+int co_shard_client_get_control_fd(const struct co_shard_client* self);
+
+/* Returns the number of frames, which may be 0, without blocking */
+ssize_t co_shard_client_recv(struct co_shard_client* self,
+			     struct canfd_frame* cf, uint64_t* ts, size_t n);
+
+uint64_t co_shard_client_get_n_lost(const struct co_shard_client* self);
+
+#endif /* _CANOPEN_SHARD_H */
@@ -0,0 +1,74 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_STATS_H
+#define _CANOPEN_STATS_H
+
+#include <stdint.h>
+
+/* Traffic statistics.
+ *
+ * Every thread that records statistics gets its own set of counters, so
+ * recording never contends. Readers add up the counters of all threads.
+ *
+ * Counters are kept per 11-bit COB-ID. A COB-ID splits into a function code
+ * (cob_id >> 7) and a node id (cob_id & 0x7f); NMT and SYNC count towards
+ * node 0.
+ *
+ * Histogram bucket i counts values v with 2^i <= v < 2^(i + 1) microseconds.
+ * Bucket 0 also counts 0 and the last bucket counts anything larger.
+ */
+
+#define CO_STATS_FUNCTION_COUNT 16
+#define CO_STATS_NODE_COUNT 128
+#define CO_STATS_N_BUCKETS 24
+
+enum co_stats_histogram {
+	CO_STATS_TPDO1_INTERVAL = 0,
+	CO_STATS_TPDO2_INTERVAL,
+	CO_STATS_TPDO3_INTERVAL,
+	CO_STATS_TPDO4_INTERVAL,
+	CO_STATS_HEARTBEAT_INTERVAL,
+	CO_STATS_SDO_RTT,
+	CO_STATS_HISTOGRAM_COUNT
+};
+
+struct co_stats_node {
+	uint64_t rx[CO_STATS_FUNCTION_COUNT];
+	uint64_t tx[CO_STATS_FUNCTION_COUNT];
+	uint64_t histogram[CO_STATS_HISTOGRAM_COUNT][CO_STATS_N_BUCKETS];
+};
+
+/* Clear all counters and restart the clock */
+void co_stats_reset(void);
+
+/* Time of the last reset in microseconds on CLOCK_MONOTONIC */
+uint64_t co_stats_get_start_time(void);
+
+/* Timestamps are in microseconds on any clock, as long as received and sent
+ * frames use the same one.
+ */
+void co_stats_count_rx(uint32_t cob_id, uint64_t timestamp);
+void co_stats_count_tx(uint32_t cob_id, uint64_t timestamp);
+
+void co_stats_get_node(struct co_stats_node* dst, int nodeid);
+uint64_t co_stats_get_rx(uint32_t cob_id);
+uint64_t co_stats_get_tx(uint32_t cob_id);
+
+/* Returns NULL for function codes that are not used by CANopen */
+const char* co_stats_function_name(unsigned int function);
+const char* co_stats_histogram_name(enum co_stats_histogram histogram);
+
+#endif /* _CANOPEN_STATS_H */
@@ -0,0 +1,56 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_SYNC_H
+#define _CANOPEN_SYNC_H
+
+#include <stdint.h>
+
+/* SYNC producer thread.
+ *
+ * The thread sleeps until absolute deadlines on CLOCK_MONOTONIC, so that the
+ * SYNC period does not drift or depend on the main loop. Jitter is the time
+ * between a deadline and the moment the thread woke up for it. If a whole
+ * period is missed, the missed deadlines are counted as overruns and skipped.
+ *
+ * Jitter histogram bucket i counts values v with 2^i <= v < 2^(i + 1)
+ * microseconds, like the ones in canopen/stats.h.
+ */
+
+#define CO_SYNC_N_BUCKETS 24
+
+struct co_sync_stats {
+	uint64_t count;
+	uint64_t n_overruns;
+	uint64_t jitter_max;
+	uint64_t bucket[CO_SYNC_N_BUCKETS];
+};
+
+typedef void (*co_sync_fn)(void);
+
+/* A priority above 0 runs the thread with SCHED_FIFO at that priority. If that
+ * is not permitted, the thread runs with the default policy.
+ */
+int co_sync_start(uint64_t period_us, int priority, co_sync_fn fn);
+void co_sync_stop(void);
+int co_sync_is_running(void);
+
+void co_sync_get_stats(struct co_sync_stats* dst);
+void co_sync_reset_stats(void);
+
+uint64_t co_sync__advance(uint64_t* deadline, uint64_t now, uint64_t period,
+			  uint64_t* n_missed);
+
+#endif /* _CANOPEN_SYNC_H */
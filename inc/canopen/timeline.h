@@ -0,0 +1,61 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_TIMELINE_H
+#define _CANOPEN_TIMELINE_H
+
+#include <stdio.h>
+
+/* Spans of the bootup phases of the master and of each node.
+ *
+ * The master's own phases are recorded as node 0. For nodes, CO_TIMELINE_INIT
+ * and CO_TIMELINE_START are the calls to the init_fn and start_fn of their
+ * drivers. Only the last span of
+ * each phase is kept, so a node that is set up again replaces its earlier
+ * spans. The timeline is written in the Chrome trace event format, which
+ * chrome://tracing and Perfetto can show, with one track per node.
+ */
+
+enum co_timeline_phase {
+	CO_TIMELINE_RESET = 0,
+	CO_TIMELINE_PROBE,
+	CO_TIMELINE_WAIT,
+	CO_TIMELINE_IDENTITY,
+	CO_TIMELINE_CONFIG,
+	CO_TIMELINE_DRIVER_LOAD,
+	CO_TIMELINE_INIT,
+	CO_TIMELINE_PDO_SETUP,
+	CO_TIMELINE_START,
+	CO_TIMELINE_PHASE_COUNT
+};
+
+void co_timeline_enable(int is_enabled);
+int co_timeline_is_enabled(void);
+
+/* Forgets all spans and makes timestamps relative to now */
+void co_timeline_reset(void);
+
+/* These may be called from any thread, but only one thread may work on a
+ * given phase of a node at a time.
+ */
+void co_timeline_begin(int nodeid, enum co_timeline_phase phase);
+void co_timeline_end(int nodeid, enum co_timeline_phase phase);
+
+const char* co_timeline_phase_name(enum co_timeline_phase phase);
+
+/* Writes the finished spans as JSON */
+int co_timeline_dump(FILE* stream);
+
+#endif /* _CANOPEN_TIMELINE_H */
@@ -0,0 +1,66 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_TIMESTAMP_H
+#define _CANOPEN_TIMESTAMP_H
+
+#include <stdint.h>
+#include <linux/can.h>
+#include "canopen/byteorder.h"
+
+/* The TIME object carries a TIME_OF_DAY: milliseconds after midnight in
+ * 28 bits followed by days since January 1, 1984 in 16 bits.
+ */
+
+#define TIMESTAMP_SIZE 6
+#define TIMESTAMP_MS_MASK 0x0fffffffU
+#define TIMESTAMP_MS_PER_DAY 86400000ULL
+
+/* Seconds from the Unix epoch to January 1, 1984 */
+#define TIMESTAMP_EPOCH 441763200ULL
+
+static inline int timestamp_is_valid(const struct can_frame* frame)
+{
+	return frame->can_dlc == TIMESTAMP_SIZE;
+}
+
+/* Takes and gives microseconds since the Unix epoch */
+static inline void timestamp_set(struct can_frame* frame, uint64_t unix_us)
+{
+	uint64_t ms = unix_us / 1000ULL - TIMESTAMP_EPOCH * 1000ULL;
+
+	uint32_t ms_of_day = ms % TIMESTAMP_MS_PER_DAY;
+	uint16_t days = ms / TIMESTAMP_MS_PER_DAY;
+
+	frame->can_dlc = TIMESTAMP_SIZE;
+	byteorder(&frame->data[0], &ms_of_day, sizeof(ms_of_day));
+	byteorder(&frame->data[4], &days, sizeof(days));
+}
+
+static inline uint64_t timestamp_get(const struct can_frame* frame)
+{
+	uint32_t ms_of_day;
+	uint16_t days;
+
+	byteorder(&ms_of_day, &frame->data[0], sizeof(ms_of_day));
+	byteorder(&days, &frame->data[4], sizeof(days));
+
+	ms_of_day &= TIMESTAMP_MS_MASK;
+
+	return ((uint64_t)days * TIMESTAMP_MS_PER_DAY + ms_of_day
+		+ TIMESTAMP_EPOCH * 1000ULL) * 1000ULL;
+}
+
+#endif /* _CANOPEN_TIMESTAMP_H */
@@ -17,6 +17,7 @@
 #define CANOPEN_INFO_H_
 
 #include <stdint.h>
+#include <stddef.h>
 #include <assert.h>
 
 struct canopen_info {
@@ -28,9 +29,79 @@ struct canopen_info {
 	char name[64];
 	char hw_version[64];
 	char sw_version[64];
+	uint32_t rx_frames;
+	uint32_t tx_frames;
+};
+
+/* Follows the 127 node entries. The state is an enum co_bus_state. */
+struct canopen_bus_info {
+	uint32_t state;
+	uint32_t error_frames;
+	uint32_t tx_timeouts;
+	uint32_t lost_arbitration;
+	uint32_t error_passive;
+	uint32_t bus_off;
+	uint32_t tx_error_count;
+	uint32_t rx_error_count;
+};
+
+/* Per-node counters, placed after struct canopen_bus_info at
+ * canopen_diag_offset() so that readers which only know about the structs
+ * above keep working.
+ *
+ * Readers must check that the version is one they know and step through the
+ * entries by entry_size. Fields are only ever added at the end of struct
+ * canopen_node_diag, and the version is bumped each time, so a reader can
+ * tell from entry_size which fields are there.
+ *
+ * The counters are refreshed on every heartbeat of the node, except for the
+ * EMCY ones which are updated as EMCYs arrive. Times are in microseconds.
+ */
+#define CANOPEN_DIAG_VERSION 2
+
+struct canopen_diag_header {
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct canopen_node_diag {
+	/* Indexed by function code, i.e. the COB-ID shifted right by 7 */
+	uint64_t rx_frames[16];
+	uint64_t tx_frames[16];
+
+	uint64_t sdo_ok;
+	uint64_t sdo_aborts;
+	uint64_t sdo_timeouts;
+	uint64_t sdo_rtt_avg;
+	uint64_t sdo_rtt_max;
+
+	uint64_t emcy_count;
+	uint32_t emcy_last_code;
+	uint32_t emcy_last_register;
+
+	uint64_t callback_time_max;
+	uint64_t callback_overruns;
+	uint64_t callback_dropped;
+
+	/* Since version 2: EMCYs held back from the driver, see emcy_policy */
+	uint64_t emcy_aggregated;
+	uint64_t emcy_dropped;
 };
 
 extern struct canopen_info* canopen_info_;
+extern struct canopen_bus_info* canopen_bus_info_;
+extern struct canopen_diag_header* canopen_diag_header_;
+extern struct canopen_node_diag* canopen_node_diag_;
+
+/* Offset of struct canopen_diag_header from the start of the shared memory */
+static inline size_t canopen_diag_offset(void)
+{
+	size_t offset = sizeof(struct canopen_info) * 127
+		      + sizeof(struct canopen_bus_info);
+	return (offset + 7) & ~(size_t)7;
+}
 
 static inline struct canopen_info* canopen_info_get(int nodeid)
 {
@@ -38,6 +109,12 @@ static inline struct canopen_info* canopen_info_get(int nodeid)
 	return &canopen_info_[nodeid - 1];
 }
 
+static inline struct canopen_node_diag* canopen_node_diag_get(int nodeid)
+{
+	assert(1 <= nodeid && nodeid <= 127);
+	return &canopen_node_diag_[nodeid - 1];
+}
+
 int canopen_info_init(const char* iface);
 void canopen_info_cleanup(void);
 
@@ -0,0 +1,83 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CBOR_H_
+#define CBOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vector.h"
+
+/* A CBOR (RFC 7049) encoder for the REST services. Items are appended to a
+ * vector with their heads written directly, so nothing is formatted.
+ *
+ * An encoder that fails to grow its vector remembers it and ignores further
+ * items, so that a whole document can be written before checking is_bad.
+ */
+struct cbor {
+	struct vector vector;
+	int is_bad;
+};
+
+enum cbor_major {
+	CBOR_UINT = 0,
+	CBOR_NEGINT = 1,
+	CBOR_BYTES = 2,
+	CBOR_TEXT = 3,
+	CBOR_ARRAY = 4,
+	CBOR_MAP = 5,
+	CBOR_TAG = 6,
+	CBOR_SIMPLE = 7,
+};
+
+#define CBOR_CONTENT_TYPE "application/cbor"
+
+int cbor_init(struct cbor* self, size_t size);
+void cbor_destroy(struct cbor* self);
+
+void cbor_put_head(struct cbor* self, enum cbor_major major, uint64_t value);
+
+static inline void cbor_put_uint(struct cbor* self, uint64_t value)
+{
+	cbor_put_head(self, CBOR_UINT, value);
+}
+
+void cbor_put_int(struct cbor* self, int64_t value);
+void cbor_put_bytes(struct cbor* self, const void* data, size_t size);
+void cbor_put_text(struct cbor* self, const char* str, size_t length);
+void cbor_put_string(struct cbor* self, const char* str);
+void cbor_put_bool(struct cbor* self, int value);
+void cbor_put_null(struct cbor* self);
+void cbor_put_float(struct cbor* self, float value);
+void cbor_put_double(struct cbor* self, double value);
+
+static inline void cbor_put_array(struct cbor* self, size_t n)
+{
+	cbor_put_head(self, CBOR_ARRAY, n);
+}
+
+static inline void cbor_put_map(struct cbor* self, size_t n)
+{
+	cbor_put_head(self, CBOR_MAP, n);
+}
+
+/* Indefinite length arrays and maps for when the number of items is not
+ * known up front. Each must be closed with cbor_put_break().
+ */
+void cbor_begin_array(struct cbor* self);
+void cbor_begin_map(struct cbor* self);
+void cbor_put_break(struct cbor* self);
+
+#endif /* CBOR_H_ */
@@ -25,29 +25,114 @@
 	X(uint, n_workers, 4) \
 	X(uint, worker_stack_size, 0) \
 	X(uint, job_queue_length, 256) \
+	X(bool, use_work_stealing, 0) \
+	X(string, worker_cpus, "") \
+	X(bool, use_busy_poll, 0) \
+	X(bool, use_fast_clock, 0) \
+	X(int, mux_cpu, -1) \
+	X(int, mux_priority, -1) \
+	X(uint, mux_budget, 16 /* batches */) \
+	X(uint, mloop_max_events, 256) \
+	X(int, worker_priority, 0) \
+	X(bool, lock_memory, 0) \
+	X(uint, heap_reserve_size, 4194304 /* bytes */) \
 	X(uint, sdo_queue_length, 1024) \
 	X(uint, rest_port, 9191) \
+	X(uint, rest_max_clients, 64) \
+	X(uint, rest_max_jobs, 2) \
+	X(uint, rest_max_waiting_jobs, 32) \
+	X(uint, sdo_gateway_port, 0) \
 	X(bool, be_strict, 0) \
 	X(bool, use_tcp, 0) \
+	X(bool, use_can_fd, 0) \
+	X(bool, use_io_uring, 0) \
 	X(uint, heartbeat_period, 0 /* ms */) \
 	X(uint, heartbeat_timeout, 0 /* ms */) \
 	X(uint, n_timeouts_max, 2) \
+	X(uint, master_nodeid, 0) \
+	X(uint, master_heartbeat_period, 0 /* ms */) \
 	X(uint, range_start, 0) \
 	X(uint, range_stop, 0) \
+	X(string, shard_role, "") \
+	X(string, shard_path, "") \
+	X(bool, enable_handover, 0) \
+	X(string, handover_path, "") \
 	X(uint, sync_interval, 0 /* us */) \
+	X(bool, enable_sync_rpdo, 0) \
+	X(bool, use_sync_thread, 0) \
+	X(uint, sync_priority, 0) \
+	X(uint, sync_counter_overflow, 0) \
+	X(uint, time_interval, 0 /* ms */) \
+	X(uint, timer_slack, 10 /* ms */) \
+	X(uint, guard_frames_per_ms, 0) \
 	X(uint, trace_buffer_size, 0) \
 	X(string, trace_dump_path, "/var/log/canopen") \
+	X(string, trace_dump_format, "raw") \
+	X(uint, trace_event_buffer_size, 0) \
+	X(string, trace_buffer_file, "") \
+	X(string, trace_objects, "") \
+	X(uint, trace_range_start, 0) \
+	X(uint, trace_range_stop, 0) \
+	X(uint, trace_cob_mask, 0) \
+	X(uint, trace_cob_id, 0) \
+	X(uint, trace_pdo_decimation, 0) \
 	X(bool, enable_bootup_trace, 0) \
+	X(bool, enable_bootup_timeline, 0) \
 	X(bool, enable_incident_trace, 0) \
+	X(bool, enable_trace_stream, 0) \
+	X(uint, trace_stream_file_size, 67108864 /* bytes */) \
+	X(uint, trace_stream_file_age, 0 /* s */) \
+	X(uint, trace_stream_retention, 1073741824 /* bytes */) \
+	X(string, identity_cache_dir, "") \
+	X(bool, enable_process_image, 0) \
+	X(uint, bus_error_recovery_time, 5000 /* ms */) \
+	X(uint, bus_degraded_sdo_rate, 100 /* frames/s */) \
+	X(uint, driver_callback_budget, 1000 /* us */) \
+	X(uint, driver_cycle_budget, 0 /* us */) \
+	X(uint, cycle_input_deadline, 0 /* us */) \
+	X(uint, log_repeat_window, 1000 /* ms */) \
+	X(string, emcy_policy, "first") \
+	X(uint, emcy_repeat_window, 1000 /* ms */) \
+	X(uint, emcy_rate, 10 /* per s */) \
+	X(uint, emcy_burst, 20) \
+	X(bool, enable_lss, 0) \
+	X(uint, lss_timeout, 10 /* ms */) \
+	X(bool, lss_store_nodeid, 1) \
+	X(uint, bus_bitrate, 500000 /* bits/s */) \
+	X(uint, sdo_bus_budget, 0 /* % */) \
 
 #define CFG__NODE_PARAMETERS \
 	X(bool, has_zero_guard_status, 0) \
 	X(bool, ignore_sdo_multiplexer, 1) \
 	X(bool, send_full_sdo_frame, 0) \
+	X(uint, sdo_block_size, 0) \
+	X(string, sdo_channels, "") \
+	X(uint, sdo_timeout_min, 100 /* ms */) \
+	X(uint, sdo_timeout_max, 1000 /* ms */) \
 	X(uint, heartbeat_period, 10000 /* ms */) \
 	X(uint, heartbeat_timeout, 1000 /* ms */) \
 	X(uint, n_timeouts_max, 0) \
 	X(bool, enable_node_guarding, 1) \
+	X(bool, watch_master_heartbeat, 1) \
+	X(string, tpdo_on_change, "") \
+	X(string, lss_identity, "") \
+	X(string, dcf_path, "") \
+	X(bool, use_dcf_object, 0) \
+	X(bool, store_dcf, 0) \
+
+/* Global parameters that cfg_reload_file() takes from the file. The others
+ * only take effect at startup.
+ */
+#define CFG__RELOADABLE_PARAMETERS \
+	X(uint, heartbeat_period) \
+	X(uint, heartbeat_timeout) \
+	X(uint, n_timeouts_max) \
+	X(uint, sync_interval) \
+	X(bool, enable_sync_rpdo) \
+	X(uint, time_interval) \
+	X(uint, timer_slack) \
+	X(uint, guard_frames_per_ms) \
+	X(bool, enable_incident_trace) \
 
 #define CFG__DEFINE_bool(name) int name
 #define CFG__DEFINE_uint(name) uint64_t name
@@ -87,6 +172,26 @@ void cfg_load_globals(void);
 int cfg_load_file(const char* path);
 void cfg_unload_file(void);
 
+enum cfg_reloadable {
+#define X(type, name) CFG_RELOADABLE_ ## name,
+	CFG__RELOADABLE_PARAMETERS
+#undef X
+};
+
+/* Parses the file given to cfg_load_file() again and takes the reloadable
+ * global parameters from it. Those that are not in the file go back to their
+ * defaults, and those given on the command line are left alone. The previous
+ * configuration is copied to old. Node parameters are not touched; call
+ * cfg_load_node() for the nodes that should see the new file. Nothing changes
+ * if the file cannot be parsed.
+ */
+int cfg_reload_file(struct cfg* old);
+
+/* Keeps cfg_reload_file() from changing a parameter, e.g. one that was given
+ * on the command line.
+ */
+void cfg_keep_on_reload(enum cfg_reloadable param);
+
 void cfg_load_node(int id);
 
 const char* cfg__file_read(int nodeid, const char* key);
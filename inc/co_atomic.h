@@ -40,6 +40,12 @@
 #define co_atomic_add_fetch(ptr, value) \
 	__atomic_add_fetch(ptr, value, __ATOMIC_SEQ_CST)
 
+#define co_atomic_fetch_or(ptr, value) \
+	__atomic_fetch_or(ptr, value, __ATOMIC_SEQ_CST)
+
+#define co_atomic_exchange(ptr, value) \
+	__atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST)
+
 #else
 
 #define co_atomic_cas(ptr, expected, desired) \
@@ -62,6 +68,13 @@
 
 #define co_atomic_sub_fetch(ptr, value) __sync_sub_and_fetch(ptr, value)
 #define co_atomic_add_fetch(ptr, value) __sync_add_and_fetch(ptr, value)
+#define co_atomic_fetch_or(ptr, value) __sync_fetch_and_or(ptr, value)
+
+#define co_atomic_exchange(ptr, value) \
+({ \
+	__sync_synchronize(); \
+	__sync_lock_test_and_set(ptr, value); \
+})
 
 #endif /* HAVE_NEW_ATOMICS */
 
@@ -17,6 +17,7 @@
 #define _MLOOP_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <signal.h>
 
 #ifdef __cplusplus
@@ -27,8 +28,11 @@ enum mloop_timer_type {
 	MLOOP_TIMER_RELATIVE = 0,
 	MLOOP_TIMER_ABSOLUTE = 1,
 	MLOOP_TIMER_PERIODIC = 2,
+	MLOOP_TIMER_PRECISE = 4,
 };
 
+#define MLOOP_TIMER_PRECISE MLOOP_TIMER_PRECISE
+
 enum mloop_socket_event {
 	MLOOP_SOCKET_EVENT_NONE = 0,
 	MLOOP_SOCKET_EVENT_IN = 1 << 0,
@@ -74,9 +78,42 @@ struct mloop* mloop_scope_new(struct mloop* mloop);
 struct mloop* mloop_default(void);
 
 /* Set the length of the job queue for the global thread pool
+ *
+ * The queue has a lane of this length for each priority. mloop_work_start()
+ * fails with EAGAIN when the lane is full.
  */
 void mloop_set_job_queue_size(size_t qsize);
 
+/* Give each thread in the global thread pool a queue of its own
+ *
+ * Jobs that are started from within a worker thread then go onto that
+ * worker's queue, and idle workers steal jobs from the others. A worker runs
+ * its own jobs newest first and priorities only apply to the shared queue.
+ *
+ * This must be set before the thread pool is started.
+ */
+void mloop_set_work_stealing(int enable);
+#define mloop_set_work_stealing mloop_set_work_stealing
+
+/* Pin the threads in the global thread pool to CPUs
+ *
+ * Worker i runs on cpus[i % n]. Pass n = 0 to let the workers run anywhere.
+ *
+ * This must be set before the thread pool is started.
+ */
+int mloop_set_worker_cpus(const int* cpus, size_t n);
+#define mloop_set_worker_cpus mloop_set_worker_cpus
+
+/* Run the threads in the global thread pool with SCHED_FIFO at the given
+ * priority. 0 means that they inherit the scheduling of the thread that
+ * starts them, which is the default.
+ *
+ * This must be set before the thread pool is started. Starting the pool
+ * fails if the process may not use real-time scheduling.
+ */
+int mloop_set_worker_priority(int priority);
+#define mloop_set_worker_priority mloop_set_worker_priority
+
 /* Set the stack size of new threads in the global thread pool
  */
 void mloop_set_worker_stack_size(size_t stack_size);
@@ -112,6 +149,14 @@ int mloop_run(struct mloop* self);
  */
 int mloop_run_once(struct mloop* self);
 
+/* The CLOCK_MONOTONIC time in nanoseconds at which the current iteration
+ * began. Callbacks that need the time but not to the microsecond can use this
+ * instead of asking the kernel again. Between iterations it is the current
+ * time.
+ */
+uint64_t mloop_now(const struct mloop* self);
+#define mloop_now mloop_now
+
 /* Iterate once through a running main loop.
  */
 void mloop_iterate(struct mloop* self);
@@ -127,6 +172,69 @@ void mloop_exit(struct mloop* self);
  */
 int mloop_get_pollfd(const struct mloop* self);
 
+/* Set the most events that are taken from epoll in one iteration. The loop
+ * starts out taking 16 at a time and doubles that, up to this limit, for as
+ * long as the batches come back full. The default is 256.
+ */
+int mloop_set_max_events(struct mloop* self, size_t max_events);
+#define mloop_set_max_events mloop_set_max_events
+
+#define MLOOP_STATS_N_BUCKETS 24
+#define MLOOP_STATS_CALLBACKS_MAX 64
+
+/* Bucket i counts durations d with 2^i <= d < 2^(i + 1) microseconds. Bucket
+ * 0 also counts anything shorter and the last bucket anything longer.
+ */
+struct mloop_stats_histogram {
+	uint64_t count;
+	uint64_t max; /* us */
+	uint64_t bucket[MLOOP_STATS_N_BUCKETS];
+};
+
+struct mloop_stats_callback {
+	const void* fn;
+	struct mloop_stats_histogram duration;
+};
+
+struct mloop_stats {
+	/* Time from epoll_wait() returning until the loop waits again */
+	struct mloop_stats_histogram iteration;
+
+	/* How long after their deadline timers were fired. Precise timers are
+	 * not included.
+	 */
+	struct mloop_stats_histogram timer_lag;
+
+	/* Time from an async job or a finished work item being queued until
+	 * its callback is run
+	 */
+	struct mloop_stats_histogram async_latency;
+
+	/* Times the loop was woken up from another thread or by an async job,
+	 * and wakeups that were merged into one that was already pending
+	 */
+	unsigned long n_wakeups;
+	unsigned long n_wakeups_coalesced;
+
+	/* The number of events that are currently taken from epoll at a time */
+	size_t event_batch_size;
+
+	/* Jobs waiting for the global thread pool, now and at most */
+	size_t job_queue_depth;
+	size_t job_queue_depth_max;
+
+	/* Time spent in each callback that was run by the loop, keyed by the
+	 * address of the callback function
+	 */
+	size_t n_callbacks;
+	struct mloop_stats_callback callback[MLOOP_STATS_CALLBACKS_MAX];
+};
+
+/* Get statistics about an mloop. This may be called from any thread.
+ */
+void mloop_get_stats(const struct mloop* self, struct mloop_stats* stats);
+#define mloop_get_stats mloop_get_stats
+
 /* Create a new timer.
  */
 struct mloop_timer* mloop_timer_new(struct mloop* self);
@@ -167,6 +275,10 @@ int mloop_timer_stop(struct mloop_timer* timer);
  * A relative timeout is relative to the time at which the timer was started,
  * but an absolute timeout is relative to the value of the system's monotonic
  * clock.
+ *
+ * Timers run on a wheel with a resolution of one millisecond, so that starting
+ * and stopping them is cheap. Add MLOOP_TIMER_PRECISE to give a timer its own
+ * timerfd instead; this is meant for short periods where jitter matters.
  */
 void mloop_timer_set_type(struct mloop_timer* timer,
 			  enum mloop_timer_type type);
@@ -179,6 +291,12 @@ enum mloop_timer_type mloop_timer_get_type(const struct mloop_timer* timer);
  */
 void mloop_timer_set_time(struct mloop_timer* timer, uint64_t time);
 
+/* Allow a timer on the wheel to fire up to slack nanoseconds late, so that
+ * it can share a wakeup with other timers. Precise timers have no slack.
+ */
+void mloop_timer_set_slack(struct mloop_timer* timer, uint64_t slack);
+#define mloop_timer_set_slack mloop_timer_set_slack
+
 /* Set the context pointer. Can point to whatever you want.
  *
  * If you specify a free_fn, it will be called with the context pointer as an
@@ -268,11 +386,27 @@ mloop_socket_get_event(const struct mloop_socket* socket);
  * MLOOP_SOCKET_EVENT_IN | MLOOP_SOCKET_EVENT_PRI
  *
  * This can be set to any combination of IN, PRI and OUT but you will always
- * receive events for ERR and HUP.
+ * receive events for ERR and HUP. It may be changed while the socket is
+ * started.
  */
 void mloop_socket_set_event(struct mloop_socket* socket,
 			    enum mloop_socket_event event);
 
+/* Have epoll report the socket only when something new arrives on it. The
+ * callback must then read until the socket would block, or stop early and
+ * call mloop_socket_continue(). It may be changed while the socket is
+ * started.
+ */
+void mloop_socket_set_edge_triggered(struct mloop_socket* socket, int enable);
+#define mloop_socket_set_edge_triggered mloop_socket_set_edge_triggered
+
+/* Call the callback of an edge-triggered socket again on the next iteration
+ * even if nothing new arrives. This is for callbacks that stop reading after
+ * a fixed budget, so that one busy socket does not hold up the others. It
+ * does nothing for level-triggered sockets, which epoll reports again anyway.
+ */
+void mloop_socket_continue(struct mloop_socket* socket);
+
 /* Create an async job object.
  *
  * An async job is a single non-blocking task that will be run once at the end of
@@ -326,7 +460,7 @@ void* mloop_async_get_context(const struct mloop_async* async);
 
 /* Set the priority of the task. Zero is the highest priority.
  *
- * Range: 0 - ULONG_MAX.
+ * Range: 0 - ULONG_MAX. As with work, priorities from 3 and up are the same.
  *
  * Warning: Setting the priority to anything above the lowest priority and
  * re-starting the job within the event callback will STARVE async jobs with
@@ -400,7 +534,9 @@ void* mloop_work_get_context(const struct mloop_work* work);
 
 /* Set the priority of a job. Zero is the highest priority.
  *
- * Range: 0 - ULONG_MAX.
+ * Range: 0 - ULONG_MAX. Jobs are queued in four fixed-priority lanes, so all
+ * priorities from 3 and up are the same. Jobs of equal priority run in the
+ * order in which they were started.
  */
 void mloop_work_set_priority(struct mloop_work* work, unsigned long priority);
 
@@ -0,0 +1,53 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MPMCQ_H_
+#define MPMCQ_H_
+
+#include <stddef.h>
+
+/* Bounded lock-free multi-producer multi-consumer FIFO queue.
+ *
+ * Each cell carries a sequence number that tells producers and consumers
+ * whose turn it is, so a push or pop costs one compare-and-swap unless other
+ * threads are racing for the same position.
+ */
+
+struct mpmcq_cell {
+	unsigned long sequence;
+	void* data;
+};
+
+struct mpmcq {
+	size_t mask;
+	struct mpmcq_cell* cell;
+	unsigned long head __attribute__((aligned(64)));
+	unsigned long tail __attribute__((aligned(64)));
+};
+
+/* The size is rounded up to a power of 2 */
+int mpmcq_init(struct mpmcq* self, size_t size);
+void mpmcq_destroy(struct mpmcq* self);
+
+/* Returns -1 if the queue is full */
+int mpmcq_push(struct mpmcq* self, void* data);
+
+/* Returns -1 if the queue is empty */
+int mpmcq_pop(struct mpmcq* self, void** data);
+
+/* The result may be outdated by the time it is returned */
+int mpmcq_is_empty(const struct mpmcq* self);
+
+#endif /* MPMCQ_H_ */
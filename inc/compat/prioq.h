@@ -17,16 +17,36 @@
 #define PRIOQ_H_
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
 #include <pthread.h>
 
+/* Priorities below PRIOQ_N_LEVELS each have a FIFO of their own and a bit in
+ * a bitmap that tells which ones are non-empty, so that inserting and popping
+ * them takes constant time. Anything higher goes on a binary heap that is only
+ * looked at when all the FIFOs are empty.
+ */
+#define PRIOQ_N_LEVELS 64
+
+#define PRIOQ__NIL ((unsigned long)-1)
+
 struct prioq_elem {
 	unsigned long priority;
 	unsigned long sequence_;
 	void* data;
 };
 
+struct prioq_slot {
+	struct prioq_elem elem;
+	unsigned long next;
+};
+
+struct prioq_level {
+	unsigned long first;
+	unsigned long last;
+};
+
 struct prioq {
 	size_t size;
 	unsigned long sequence;
@@ -34,6 +54,12 @@ struct prioq {
 	pthread_mutex_t mutex;
 	pthread_cond_t suspend_cond;
 	struct prioq_elem* head;
+	size_t heap_size;
+	struct prioq_slot* slots;
+	unsigned long free_slot;
+	size_t n_queued;
+	uint64_t levels_used;
+	struct prioq_level level[PRIOQ_N_LEVELS];
 };
 
 int prioq_init(struct prioq* self, size_t size);
@@ -51,6 +77,11 @@ int prioq_insert(struct prioq* self, unsigned long priority, void* data);
 
 int prioq_pop(struct prioq* self, struct prioq_elem* elem, int timeout);
 
+static inline int prioq__is_empty(const struct prioq* self)
+{
+	return self->n_queued == 0 && self->index == 0;
+}
+
 static inline unsigned long prioq__parent(unsigned long index)
 {
 	return (index - 1) >> 1;
@@ -0,0 +1,51 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WSDEQUE_H_
+#define WSDEQUE_H_
+
+#include <stddef.h>
+
+/* Bounded work-stealing deque (Chase-Lev).
+ *
+ * Only the owner may push and pop; these work on the bottom end, so the owner
+ * gets the most recently pushed item first. Any thread may steal from the top
+ * end, which gives the oldest item.
+ */
+
+struct wsdeque {
+	long top __attribute__((aligned(64)));
+	long bottom __attribute__((aligned(64)));
+	void** buffer;
+	long mask;
+};
+
+/* The size is rounded up to a power of 2 */
+int wsdeque_init(struct wsdeque* self, size_t size);
+void wsdeque_destroy(struct wsdeque* self);
+
+/* Returns -1 if the deque is full */
+int wsdeque_push(struct wsdeque* self, void* data);
+
+/* Returns -1 if the deque is empty */
+int wsdeque_pop(struct wsdeque* self, void** data);
+
+/* Returns -1 if the deque is empty or another thread got the item first */
+int wsdeque_steal(struct wsdeque* self, void** data);
+
+/* The result may be outdated by the time it is returned */
+int wsdeque_is_empty(const struct wsdeque* self);
+
+#endif /* WSDEQUE_H_ */
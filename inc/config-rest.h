@@ -0,0 +1,9 @@
+#ifndef CONFIG_REST_H_
+#define CONFIG_REST_H_
+
+/* PUT /config/reload reads the configuration file again and applies the
+ * changes to the nodes that are running.
+ */
+void config_rest_service(struct rest_client* client, const void* content);
+
+#endif /* CONFIG_REST_H_ */
@@ -28,6 +28,14 @@ struct canopen_data {
 };
 
 char* canopen_data_tostring(char* dst, size_t size, struct canopen_data* src);
+struct cbor;
+
+/* Numbers and booleans become CBOR numbers and booleans, visible strings text
+ * and other strings and domains byte strings. Returns -1 if the type has no
+ * encoding or the data does not fit it.
+ */
+int canopen_data_tocbor(struct cbor* dst, const struct canopen_data* src);
+
 int canopen_data_fromstring(struct canopen_data* dst,
 			    enum canopen_type expected_type, const char* str);
 
@@ -0,0 +1,10 @@
+#ifndef DRIVER_REST_H_
+#define DRIVER_REST_H_
+
+/* PUT /driver/<name>/reload replaces the driver called name with the file
+ * that is now in the driver directory, for all nodes that use it. Nodes keep
+ * their NMT state.
+ */
+void driver_rest_service(struct rest_client* client, const void* content);
+
+#endif /* DRIVER_REST_H_ */
@@ -0,0 +1,28 @@
+#ifndef EVENTS_REST_H_
+#define EVENTS_REST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "canopen/nmt.h"
+
+struct rest_client;
+struct co_emcy;
+
+/* GET /events[?node=<id>,...][&type=pdo,emcy,nmt][&interval=<ms>] streams
+ * events as server-sent events until the client goes away. EMCY and NMT
+ * state changes are sent as they happen. TPDOs 1-4 are sent at most once per
+ * interval per PDO, with the latest value and the number of values that were
+ * coalesced into it. A client that does not keep up loses events and is told
+ * how many.
+ */
+void events_rest_service(struct rest_client* client, const void* content);
+void events_rest_cleanup(void);
+
+int events_rest_is_active(void);
+void events_rest_on_pdo(int nodeid, int n, const void* data, size_t len,
+			uint64_t timestamp);
+void events_rest_on_emcy(int nodeid, const struct co_emcy* emcy);
+void events_rest_on_nmt(int nodeid, enum nmt_state state);
+void events_rest_on_node_lost(int nodeid);
+
+#endif /* EVENTS_REST_H_ */
@@ -37,14 +37,28 @@ struct http_req {
 	size_t header_length;
 	size_t content_length;
 	char* content_type;
+	char* if_none_match;
+	char* accept;
+	int is_connection_close;
+	int is_connection_upgrade;
+	char* upgrade;
+	char* websocket_key;
+	char* websocket_version;
 	size_t url_index;
 	char* url[URL_INDEX_MAX];
 	size_t url_query_index;
 	struct http_url_query url_query[URL_QUERY_INDEX_MAX];
 };
 
-int http_req_parse(struct http_req* req, const char* head);
+/* Parse the head of a request in place. The strings in the request point
+ * into the head, which is modified, so the head must outlive the request. If
+ * the head is moved, http_req_rebase() makes the request point at the new
+ * copy. The head must be terminated, and only the first header_length bytes
+ * of it are touched.
+ */
+int http_req_parse(struct http_req* req, char* head);
 void http_req_free(struct http_req* req);
+void http_req_rebase(struct http_req* req, const void* from, void* to);
 
 const char* http_req_query(struct http_req* req, const char* key);
 
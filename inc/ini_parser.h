@@ -21,19 +21,39 @@
 
 struct ini_key_value {
 	char* value;
-	char key[0];
+	const char* key;
+	char buffer[0];
 };
 
 struct ini_section {
 	struct vector kv;
-	char section[0];
+	const char* section;
+	char buffer[0];
 };
 
 struct ini_file {
 	struct vector section;
+
+	/* Set by ini_parse_file(). Names and values then point into the text
+	 * of the file and the tables are allocated in bulk.
+	 */
+	char* text;
+	size_t text_size;
+	int is_mapped;
+	struct vector sections;
+	struct vector kvs;
+	struct vector kv_index;
 };
 
+/* Both return 0 on success, -1 if memory ran out or the file could not be
+ * read and minus the line number of the first line that is not valid.
+ */
 int ini_parse(struct ini_file* file, FILE* stream);
+
+/* Parses the file without copying any of it: the file is mapped privately
+ * and terminated and lower-cased in place.
+ */
+int ini_parse_file(struct ini_file* file, const char* path);
 void ini_destroy(struct ini_file* file);
 
 const char* ini_find(const struct ini_file* file, const char* section,
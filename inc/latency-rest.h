@@ -0,0 +1,13 @@
+#ifndef LATENCY_REST_H_
+#define LATENCY_REST_H_
+
+/* GET /latency gives the RPDO to TPDO round trip latencies of every rule.
+ *
+ * PUT /latency/rule?node=<nodeid>&rpdo=<n>&tpdo=<n>[&mask=<hex>] adds a rule,
+ * PUT /latency/clear removes all rules and PUT /latency/start and
+ * PUT /latency/stop turn tracing on and off. The mask is given as up to eight
+ * bytes in hex, e.g. mask=ff00 to compare the first byte of the payloads.
+ */
+void latency_rest_service(struct rest_client* client, const void* content);
+
+#endif /* LATENCY_REST_H_ */
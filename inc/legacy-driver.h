@@ -28,6 +28,13 @@ struct legacy_master_iface {
 	int (*set_node_state)(int nodeid, int state);
 };
 
+/* Must match CanIOHandlerInterface::Frame */
+struct legacy_pdo_frame {
+	int n;
+	const unsigned char* data;
+	size_t size;
+};
+
 void* legacy_master_iface_new(struct legacy_master_iface*);
 void legacy_master_iface_delete(void*);
 
@@ -53,6 +60,10 @@ int legacy_driver_iface_process_sdo(void* obj, int index, int subindex,
 int legacy_driver_iface_process_pdo(void* obj, int n, const unsigned char* data,
 				    size_t size);
 
+int legacy_driver_iface_process_pdo_batch(void* obj,
+					  const struct legacy_pdo_frame* frames,
+					  size_t n);
+
 int legacy_driver_iface_process_node_state(void* obj, int state);
 
 #endif /* LEGACY_DRIVER_H_ */
@@ -0,0 +1,10 @@
+#ifndef METRICS_REST_H_
+#define METRICS_REST_H_
+
+/* GET /metrics gives the traffic counters, SDO queues, node guarding, TX
+ * queue, trace buffer, main loop and REST statistics of the master in the
+ * Prometheus text format. Everything is read without taking locks.
+ */
+void metrics_rest_service(struct rest_client* client, const void* content);
+
+#endif /* METRICS_REST_H_ */
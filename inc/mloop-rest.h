@@ -0,0 +1,10 @@
+#ifndef MLOOP_REST_H_
+#define MLOOP_REST_H_
+
+/* GET /mloop gives the loop iteration time, timer lag, async latency, job
+ * queue depth and the run time of each callback of the main loop. Times are
+ * in microseconds.
+ */
+void mloop_rest_service(struct rest_client* client, const void* content);
+
+#endif /* MLOOP_REST_H_ */
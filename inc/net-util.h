@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 struct can_frame;
+struct iovec;
 
 /* A wrapper around 'write' with ms timeout
  */
@@ -29,6 +30,10 @@ ssize_t net_write(int fd, const void* src, size_t size, int timeout);
  */
 ssize_t net_read(int fd, void* dst, size_t size, int timeout);
 
+/* A wrapper around 'writev' for sockets that never blocks or raises SIGPIPE
+ */
+ssize_t net_send_iov(int fd, struct iovec* iov, int iovcnt);
+
 ssize_t net_write_frame(int fd, const struct can_frame* cf, int timeout);
 ssize_t net_read_frame(int fd, struct can_frame* cf, int timeout);
 ssize_t net_filtered_read_frame(int fd, struct can_frame* cf, int timeout,
@@ -41,4 +46,10 @@ int net_fix_sndbuf(int fd);
 int net_reuse_addr(int fd);
 int net_dont_delay(int fd);
 
+/* SOCK_SEQPACKET sockets in the UNIX domain, one frame per packet. Paths
+ * that start with '@' are in the abstract namespace.
+ */
+int net_unix_connect(const char* path);
+int net_unix_listen(const char* path);
+
 #endif /* NET_UTIL_H_ */
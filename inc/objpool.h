@@ -0,0 +1,54 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OBJPOOL_H_
+#define OBJPOOL_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* Fixed-size object pool.
+ *
+ * Objects are carved out of slabs that are never returned to the system.
+ * Freed objects go onto a small per-thread cache first, so allocating and
+ * freeing on the same thread normally takes no lock. When a cache overflows,
+ * half of it is handed back to the shared free list, and an empty cache is
+ * refilled from there.
+ *
+ * Pools are meant to be defined statically using OBJPOOL_INITIALIZER(); they
+ * set themselves up on first use and are never destroyed.
+ */
+
+struct objpool_object;
+
+struct objpool {
+	size_t size;
+	pthread_mutex_t mutex;
+	int is_ready;
+	pthread_key_t key;
+	struct objpool_object* free;
+};
+
+#define OBJPOOL_INITIALIZER(type) { \
+	.size = sizeof(type), \
+	.mutex = PTHREAD_MUTEX_INITIALIZER, \
+}
+
+/* Returns NULL if out of memory. The object is not cleared. */
+void* objpool_alloc(struct objpool* self);
+
+void objpool_free(struct objpool* self, void* ptr);
+
+#endif /* OBJPOOL_H_ */
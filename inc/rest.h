@@ -17,15 +17,30 @@
 #define CANOPEN_REST_H_
 
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/queue.h>
+#include <sys/uio.h>
 #include "http.h"
 #include "vector.h"
+#include "arena.h"
+
+/* Replies are written to the socket without blocking, and whatever does not
+ * fit in the socket buffer is sent when it becomes writable. The content is
+ * copied for that unless it stays valid until it has been sent.
+ */
+enum rest_content_ownership {
+	REST_CONTENT_COPY = 0,
+	REST_CONTENT_STATIC, /* valid for as long as the connection */
+	REST_CONTENT_GIVEN, /* handed over, and freed when it has been sent */
+};
 
 struct rest_reply_data {
 	const char* status_code;
 	const char* content_type;
 	ssize_t content_length;
 	const void* content;
+	const char* etag;
+	enum rest_content_ownership ownership;
 };
 
 enum rest_client_state {
@@ -33,15 +48,65 @@ enum rest_client_state {
 	REST_CLIENT_CONTENT,
 	REST_CLIENT_SERVICING,
 	REST_CLIENT_DISCONNECTED,
-	REST_CLIENT_DONE
+	REST_CLIENT_DONE,
+	REST_CLIENT_UPGRADED,
 };
 
+struct mloop_socket;
+struct mloop_work;
+struct rest_output;
+
+STAILQ_HEAD(rest_output_queue, rest_output);
+
+struct rest_client;
+
+typedef void (*rest_input_fn)(struct rest_client* client);
+
+/* A client connection. Connections are kept open between requests unless the
+ * client asks for "Connection: close", so services must give every reply a
+ * length. Pipelined requests are queued in the buffer and serviced one at a
+ * time as each one reaches REST_CLIENT_DONE.
+ *
+ * Services allocate whatever they need for a request from the arena, which
+ * is reset when the next request is taken up. It must not be used from
+ * worker threads.
+ */
 struct rest_client {
+	LIST_ENTRY(rest_client) links;
 	int ref;
 	enum rest_client_state state;
 	struct vector buffer;
 	struct http_req req;
-	FILE* output;
+	struct rest_output_queue output;
+	size_t output_length; /* bytes waiting to be sent */
+	struct mloop_socket* socket;
+	uint64_t start_time; /* us on CLOCK_MONOTONIC, 0 when not timed */
+	struct arena arena;
+	rest_input_fn input_fn; /* when upgraded */
+	void* input_context;
+	int is_closing;
+};
+
+#define REST_STATS_N_BUCKETS 24
+
+/* Requests are timed from the time their head has been parsed until they are
+ * done. Bucket i counts durations d with 2^i <= d < 2^(i + 1) microseconds,
+ * bucket 0 also counts anything shorter and the last bucket anything longer.
+ */
+struct rest_stats {
+	uint64_t n_requests;
+	uint64_t latency_sum; /* us */
+	uint64_t latency[REST_STATS_N_BUCKETS];
+
+	/* Time that jobs waited for a job slot, in the same buckets */
+	uint64_t job_wait_sum; /* us */
+	uint64_t job_wait[REST_STATS_N_BUCKETS];
+
+	size_t n_clients;
+	size_t n_jobs_running;
+	size_t n_jobs_waiting;
+	uint64_t n_clients_rejected;
+	uint64_t n_jobs_rejected;
 };
 
 typedef void (*rest_fn)(struct rest_client* client, const void* content);
@@ -56,10 +121,60 @@ struct rest_service {
 int rest_init(int port);
 void rest_cleanup();
 
+/* Serves on a socket that is already listening, e.g. one that was handed over
+ * by another process. The socket is closed by the main loop.
+ */
+int rest_init_fd(int lfd);
+int rest_get_server_fd(void);
+
+/* Stops accepting new clients */
+void rest_stop_server(void);
+
 int rest_register_service(enum http_method method, const char* path,
 			  rest_fn fn);
-void rest_reply(FILE* output, struct rest_reply_data* data);
-void rest_reply_header(FILE* output, struct rest_reply_data* data);
+void rest_reply(struct rest_client* client, struct rest_reply_data* data);
+
+/* True if the Accept header of the request names the content type */
+int rest_is_accepted(const struct http_req* req, const char* content_type);
+void rest_reply_header(struct rest_client* client,
+		       struct rest_reply_data* data);
+
+/* Write more of a reply whose header has been sent. The data is copied if it
+ * cannot be sent right away.
+ */
+void rest_write(struct rest_client* client, const void* data, size_t size);
+
+/* Take over the connection from HTTP, e.g. for WebSocket, after the reply
+ * that switches protocols has been written. The request is done and cleared,
+ * so it must not be touched afterwards. Input that arrives from then on is
+ * left in the buffer and fn is called with it. fn takes what it has handled
+ * from the front of the buffer with rest_consume().
+ */
+void rest_upgrade(struct rest_client* client, rest_input_fn fn,
+		  void* context);
+void rest_consume(struct rest_client* client, size_t size);
+
+/* Closes the connection once the output waiting for it has been sent. Input
+ * is ignored from then on.
+ */
+void rest_close(struct rest_client* client);
+
+void rest_get_stats(struct rest_stats* dst);
+
+/* Connections beyond max_clients are answered with 503 Service Unavailable
+ * and closed.
+ *
+ * Services give their worker jobs to rest_work_start() instead of
+ * mloop_work_start(). At most max_jobs of them are on the worker pool at a
+ * time, at the lowest priority, so that they cannot take up the workers that
+ * load drivers at bootup. Others wait for their turn, and when
+ * max_waiting_jobs are waiting, rest_work_start() fails with EAGAIN. The done
+ * function of every job that was started must call rest_work_done().
+ */
+void rest_set_limits(size_t max_clients, size_t max_jobs,
+		     size_t max_waiting_jobs);
+int rest_work_start(struct mloop_work* work);
+void rest_work_done(void);
 
 void rest_client_ref(struct rest_client* self);
 int rest_client_unref(struct rest_client* self);
@@ -71,5 +186,11 @@ void rest__init_service_list(void);
 
 int rest__open_server(int port);
 int rest__read(struct vector* buffer, int fd);
+int rest__have_head(struct vector* buffer);
+void rest__next_request(struct rest_client* client);
+void rest__write(struct rest_client* client, struct iovec* iov, int iovcnt,
+		 enum rest_content_ownership ownership);
+void rest__flush(struct rest_client* client);
+void rest__drop_output(struct rest_client* client);
 
 #endif /* CANOPEN_REST_H_ */
@@ -0,0 +1,15 @@
+#ifndef SDO_BULK_REST_H_
+#define SDO_BULK_REST_H_
+
+/* GET or PUT /sdo with a list of objects, one per line, as the content:
+ *
+ *   <nodeid> <index> <subindex> [<type>] [= <value>]
+ *
+ * Objects with a value are written and the others are read. The type is
+ * taken from the EDS if it is left out. The objects of each node are queued
+ * as one batch and all nodes are served at the same time. The reply is a
+ * JSON array with the outcome of each object, in the order given.
+ */
+void sdo_bulk_rest_service(struct rest_client* client, const void* content);
+
+#endif /* SDO_BULK_REST_H_ */
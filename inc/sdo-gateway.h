@@ -0,0 +1,88 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SDO_GATEWAY_H_
+#define SDO_GATEWAY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Binary SDO gateway over TCP, in the spirit of CiA 309-3.
+ *
+ * Clients send requests, each tagged with an id of their choosing, and may
+ * send as many as they like without waiting. The requests go into the SDO
+ * queues of their nodes as they arrive, so the transfers to different nodes
+ * run side by side, and every answer is sent as soon as its transfer is done.
+ * Answers therefore come back in any order and carry the tag of their
+ * request.
+ *
+ * A request is a struct sdo_gateway_request followed by size bytes of data
+ * for a download. An answer is a struct sdo_gateway_response followed by
+ * size bytes of data for a successful upload. The abort code is 0 if the
+ * transfer succeeded. All fields are little endian, as on CANopen.
+ *
+ * A client that has SDO_GATEWAY_PENDING_MAX requests waiting for answers is
+ * not read from until some are done, and neither is one that does not read
+ * its answers. The connection is closed on a request that is not valid.
+ */
+
+#define SDO_GATEWAY_SIZE_MAX (1 << 20)
+#define SDO_GATEWAY_PENDING_MAX 256
+
+enum sdo_gateway_type {
+	SDO_GATEWAY_UPLOAD = 1,
+	SDO_GATEWAY_DOWNLOAD,
+};
+
+struct sdo_gateway_request {
+	uint32_t tag;
+	uint8_t type;
+	uint8_t nodeid;
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t reserved[3];
+	uint32_t size;
+} __attribute__((packed));
+
+struct sdo_gateway_response {
+	uint32_t tag;
+	uint32_t abort_code;
+	uint32_t size;
+} __attribute__((packed));
+
+/* Decodes the request at the start of src into host byte order. Returns the
+ * size of the request with its data, 0 if src ends before the request does
+ * or -1 if it is not valid.
+ */
+ssize_t sdo_gateway_decode_request(struct sdo_gateway_request* req,
+				   const void* src, size_t size);
+
+/* Encodes a response header in little endian into dst */
+void sdo_gateway_encode_response(void* dst, uint32_t tag, uint32_t abort_code,
+				 uint32_t size);
+
+int sdo_gateway_init(int port);
+int sdo_gateway_init_fd(int lfd);
+
+/* The listening socket, or -1 if the gateway is not running */
+int sdo_gateway_get_server_fd(void);
+
+/* Stops accepting new clients */
+void sdo_gateway_stop_server(void);
+
+void sdo_gateway_cleanup(void);
+
+#endif /* SDO_GATEWAY_H_ */
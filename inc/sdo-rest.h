@@ -3,4 +3,7 @@
 
 void sdo_rest_service(struct rest_client* client, const void* content);
 
+/* Drops the EDS dumps that have been kept for GET /sdo/<nodeid> */
+void sdo_rest_cleanup(void);
+
 #endif /* SDO_REST_H_ */
@@ -0,0 +1,13 @@
+#ifndef SNAPSHOT_REST_H_
+#define SNAPSHOT_REST_H_
+
+/* GET /snapshot/<nodeid> gives the values of every object in the EDS of the
+ * node that can be both read and written, as a concise DCF.
+ *
+ * PUT /snapshot/<nodeid> with such a DCF as content reads the current values
+ * of its entries and writes only those that differ. The reply tells how many
+ * entries there were, how many differed and how many could not be written.
+ */
+void snapshot_rest_service(struct rest_client* client, const void* content);
+
+#endif /* SNAPSHOT_REST_H_ */
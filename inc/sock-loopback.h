@@ -0,0 +1,69 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SOCK_LOOPBACK_H_
+#define SOCK_LOOPBACK_H_
+
+#include <unistd.h>
+#include <stdint.h>
+
+struct canfd_frame;
+struct sock_loopback;
+
+/* In-process virtual CAN bus.
+ *
+ * Endpoints that are opened with the same name share a bus, and every frame
+ * that one of them sends is put on the receive ring of each of the others,
+ * as on a CAN interface that does not receive its own frames. Each endpoint
+ * has an eventfd that is readable while its ring holds frames, so it can be
+ * polled like any other socket. The rings are lock-free; only opening and
+ * closing endpoints takes a lock.
+ *
+ * Addresses are "<name>[@<bitrate>]". Without a bit rate, frames arrive as
+ * soon as they are sent. With one, each frame occupies the bus for as long as
+ * it would take with worst case bit stuffing and is timestamped with the time
+ * that it would have been received. Blocking sends wait for that time, while
+ * non-blocking ones fail with ENOBUFS once the bus is booked more than
+ * SOCK_LOOPBACK_BACKLOG ahead, like a full transmit queue.
+ *
+ * A receiver whose ring is full loses the frame, and the losses are counted.
+ */
+
+#define SOCK_LOOPBACK_RING_SIZE 4096
+#define SOCK_LOOPBACK_BACKLOG 10000000ULL /* ns */
+
+struct sock_loopback* sock_loopback_open(const char* addr);
+void sock_loopback_close(struct sock_loopback* self);
+
+int sock_loopback_get_fd(const struct sock_loopback* self);
+
+/* Frames that were lost because the ring of this endpoint was full */
+uint64_t sock_loopback_get_n_dropped(const struct sock_loopback* self);
+
+/* Returns the number of frames sent or -1 on error */
+ssize_t sock_loopback_send(struct sock_loopback* self,
+			   const struct canfd_frame* cf, size_t n, int flags);
+
+/* Waits for the first frame unless flags has MSG_DONTWAIT. Timestamps are in
+ * microseconds since the epoch.
+ */
+ssize_t sock_loopback_recv(struct sock_loopback* self, struct canfd_frame* cf,
+			   uint64_t* ts, size_t n, int flags);
+
+/* Like sock_loopback_recv() for one frame, waiting at most timeout ms */
+int sock_loopback_timed_recv(struct sock_loopback* self,
+			     struct canfd_frame* cf, uint64_t* ts, int timeout);
+
+#endif /* SOCK_LOOPBACK_H_ */
@@ -0,0 +1,87 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SOCK_UDP_H_
+#define SOCK_UDP_H_
+
+#include <unistd.h>
+#include <stdint.h>
+
+struct can_frame;
+struct canfd_frame;
+struct sockaddr_in;
+struct sock_udp;
+
+/* UDP multicast distribution of CAN frames.
+ *
+ * A publisher such as canbridge --multicast sends datagrams that start with
+ * a header and carry up to SOCK_UDP_MAX_FRAMES classic frames in the 16-byte
+ * layout of the TCP bridge, i.e. with can_id in network byte order. The
+ * header holds the sequence number of the first frame, so subscribers can
+ * tell how many frames were lost on the way.
+ */
+
+#define SOCK_UDP_MAGIC 0x434d4331 /* "CMC1" */
+#define SOCK_UDP_MAX_FRAMES 64
+#define SOCK_UDP_DEFAULT_PORT 5555
+
+struct sock_udp_header {
+	uint32_t magic;
+	uint32_t seq;
+	uint16_t n_frames;
+	uint16_t reserved;
+} __attribute__((packed));
+
+#define SOCK_UDP_MAX_SIZE (sizeof(struct sock_udp_header) \
+			   + SOCK_UDP_MAX_FRAMES * 16)
+
+struct sock_udp_stats {
+	uint64_t n_frames;
+	uint64_t n_lost;
+	uint64_t n_gaps;
+	uint64_t n_invalid;
+};
+
+/* Parses "<group>[:<port>]". Returns -1 on invalid addresses. */
+int sock_udp_parse_address(struct sockaddr_in* dst, const char* addr);
+
+/* Publisher side: a socket for sending to the group, with the given TTL */
+int sock_udp_open_publisher(int ttl);
+
+/* Fills in a datagram for n frames, which are already in network byte order.
+ * Returns its size.
+ */
+size_t sock_udp_encode(void* dst, uint32_t seq, const struct can_frame* cf,
+		       size_t n);
+
+/* Subscriber side: a socket that has joined the group */
+int sock_udp_open_subscriber(const char* addr);
+
+struct sock_udp* sock_udp_new(void);
+void sock_udp_free(struct sock_udp* self);
+
+/* Receive up to n frames. Frames that are left over from a datagram are
+ * returned before the socket is read again, so readers that poll the socket
+ * should ask for at least SOCK_UDP_MAX_FRAMES at a time.
+ */
+ssize_t sock_udp_recv(struct sock_udp* self, int fd, struct canfd_frame* cf,
+		      uint64_t* ts, size_t n, int flags);
+
+int sock_udp_has_pending(const struct sock_udp* self);
+
+void sock_udp_get_stats(const struct sock_udp* self,
+			struct sock_udp_stats* stats);
+
+#endif /* SOCK_UDP_H_ */
@@ -0,0 +1,58 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SOCK_URING_H_
+#define SOCK_URING_H_
+
+#include <unistd.h>
+#include <stdint.h>
+
+struct canfd_frame;
+struct msghdr;
+struct sock_uring;
+
+/* io_uring backend for datagram sockets.
+ *
+ * Frames are received by a multishot recvmsg into a ring of buffers that is
+ * registered with the kernel, so a steady stream of frames costs no system
+ * calls apart from the occasional wake-up. Bursts are sent as one chain of
+ * linked send requests with a single system call.
+ *
+ * sock_uring_new() returns NULL if the kernel lacks the required features
+ * and the caller should then carry on with plain system calls.
+ */
+struct sock_uring* sock_uring_new(int fd);
+void sock_uring_free(struct sock_uring* self);
+
+/* This becomes readable when there are received frames to collect */
+int sock_uring_get_fd(const struct sock_uring* self);
+
+/* Collect up to n received frames. The timeout is in milliseconds; 0 means
+ * don't wait and -1 means wait forever. Returns the number of frames or -1 on
+ * error or timeout.
+ */
+ssize_t sock_uring_recv(struct sock_uring* self, struct canfd_frame* cf,
+			uint64_t* ts, size_t n, int timeout);
+
+/* Send n frames in order. Returns the number of frames sent or -1 if none
+ * could be sent.
+ */
+ssize_t sock_uring_send(struct sock_uring* self,
+			const struct canfd_frame* cf, size_t n, int flags);
+
+/* Implemented in sock.c */
+uint64_t sock_get_cmsg_timestamp(struct msghdr* msg);
+
+#endif /* SOCK_URING_H_ */
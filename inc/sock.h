@@ -17,20 +17,34 @@
 #define CAN_SOCK_H_
 
 #include <unistd.h>
+#include <stdint.h>
+
+#include "sock-uring.h"
 
 struct can_frame;
+struct canfd_frame;
 struct tracebuffer;
+struct sock_uring;
+struct sock_udp;
+struct sock_udp_stats;
+struct sock_loopback;
 
 enum sock_type {
 	SOCK_TYPE_UNSPEC = 0,
 	SOCK_TYPE_CAN = 1,
 	SOCK_TYPE_TCP = 2,
+	SOCK_TYPE_UNIX = 3,
+	SOCK_TYPE_UDP = 4,
+	SOCK_TYPE_LOOPBACK = 5,
 };
 
 struct sock {
 	enum sock_type type;
 	int fd;
 	struct tracebuffer* tb;
+	struct sock_uring* uring;
+	struct sock_udp* udp;
+	struct sock_loopback* loopback;
 };
 
 static inline void sock_init(struct sock* sock, enum sock_type type, int fd,
@@ -39,20 +53,86 @@ static inline void sock_init(struct sock* sock, enum sock_type type, int fd,
 	sock->type = type;
 	sock->fd = fd;
 	sock->tb = tb;
+	sock->uring = NULL;
+	sock->udp = NULL;
+	sock->loopback = NULL;
 }
 
+/* The address may start with a scheme that overrides the type:
+ * "can:<iface>", "tcp:<host>[:<port>]", "unix:<path>", "udp:<group>[:<port>]"
+ * or "loop:<name>[@<bitrate>]". UNIX sockets are SOCK_SEQPACKET with one frame
+ * in host byte order per packet, as on CAN, and paths that start with '@' are
+ * in the abstract namespace. UDP sockets subscribe to a multicast feed, see
+ * sock-udp.h, and can only receive. Loopback sockets are on a bus within the
+ * process, see sock-loopback.h, and their fd is only good for polling.
+ */
 int sock_open(struct sock* sock, enum sock_type type, const char* addr,
 	      struct tracebuffer* tb);
 
 ssize_t sock_send(const struct sock* sock, struct can_frame* cf, int flags);
 int sock_timed_send(const struct sock* sock, struct can_frame* cf, int timeout);
 
+/* Send n frames with as few system calls as possible.
+ *
+ * The frames are left as they are, and a TCP socket is never left with part
+ * of a frame written. Returns the number of frames sent or -1 on error.
+ */
+ssize_t sock_send_batch(const struct sock* sock, const struct can_frame* cf,
+			size_t n, int flags);
+
 ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags);
 int sock_timed_recv(const struct sock* sock, struct can_frame* cf, int timeout);
 
-static inline int sock_close(struct sock* sock)
+/* Receive up to n frames in one go.
+ *
+ * If ts is not NULL, it receives the time of arrival of each frame in
+ * microseconds since the epoch. Kernel timestamps are used if they have been
+ * enabled with sock_enable_timestamps().
+ *
+ * Returns the number of frames received, 0 if the peer has closed the
+ * connection or -1 on error.
+ */
+ssize_t sock_recv_batch(const struct sock* sock, struct can_frame* cf,
+			uint64_t* ts, size_t n, int flags);
+
+/* Ask the kernel to timestamp received frames. Only supported for CAN.
+ */
+int sock_enable_timestamps(const struct sock* sock);
+
+/* Allow CAN FD frames on the socket. Only supported for CAN.
+ */
+int sock_enable_fd_frames(const struct sock* sock);
+
+/* Receive CAN error frames as well. Only supported for CAN.
+ */
+int sock_enable_error_frames(const struct sock* sock);
+
+/* The FD variants carry both classic and FD frames; FD frames are marked with
+ * CANFD_FDF in the flags field. A TCP stream can only carry classic frames.
+ */
+ssize_t sock_send_fd(const struct sock* sock, struct canfd_frame* cf,
+		     int flags);
+ssize_t sock_send_fd_batch(const struct sock* sock,
+			   const struct canfd_frame* cf, size_t n, int flags);
+ssize_t sock_recv_fd_batch(const struct sock* sock, struct canfd_frame* cf,
+			   uint64_t* ts, size_t n, int flags);
+
+/* Move receiving and batched sending over to io_uring. Only supported for
+ * CAN. The rest of the API stays the same, but the socket must be polled via
+ * sock_get_poll_fd() from then on.
+ */
+int sock_enable_uring(struct sock* sock);
+
+static inline int sock_get_poll_fd(const struct sock* sock)
 {
-	return close(sock->fd);
+	return sock->uring ? sock_uring_get_fd(sock->uring) : sock->fd;
 }
 
+/* Counts of received and lost frames of a UDP subscriber. Returns -1 for
+ * other types.
+ */
+int sock_get_udp_stats(const struct sock* sock, struct sock_udp_stats* stats);
+
+int sock_close(struct sock* sock);
+
 #endif /* CAN_SOCK_H_ */
@@ -19,6 +19,10 @@
 #include <sys/socket.h>
 #include <linux/can.h>
 
+#ifndef CANFD_FDF
+#define CANFD_FDF 0x04
+#endif
+
 #define CANOPEN_SLAVE_FILTER_LENGTH 9
 #define CANOPEN_MASTER_FILTER_LENGTH 10
 
@@ -27,6 +31,35 @@ void socketcan_make_master_filters(struct can_filter* filters, int nodeid);
 int socketcan_open(const char* iface);
 int socketcan_apply_filters(int fd, struct can_filter* filters, int n);
 
+/* Let the socket send and receive CAN FD frames as well as classic frames.
+ */
+int socketcan_enable_fd_frames(int fd);
+
+/* Receive the error frames of the CAN controller, i.e. frames with
+ * CAN_ERR_FLAG set, about error states, bus-off, TX timeouts, lost arbitration
+ * and so on.
+ */
+int socketcan_enable_error_frames(int fd);
+
+/* Round a payload size up to the nearest length that a CAN FD frame can carry.
+ * The size must not exceed CANFD_MAX_DLEN.
+ */
+size_t socketcan_fd_length(size_t size);
+
+/* The head of a CAN FD frame has the same layout as a classic frame, so code
+ * that only deals with classic frames may look at an FD frame through this.
+ */
+static inline const struct can_frame*
+canfd_as_can_frame(const struct canfd_frame* cfd)
+{
+	return (const struct can_frame*)cfd;
+}
+
+static inline int canfd_is_fd(const struct canfd_frame* cfd)
+{
+	return !!(cfd->flags & CANFD_FDF);
+}
+
 int socketcan_open_slave(const char* iface, int nodeid);
 int socketcan_open_master(const char* iface, int nodeid);
 
@@ -0,0 +1,10 @@
+#ifndef STATS_REST_H_
+#define STATS_REST_H_
+
+/* GET /stats lists the traffic of every node that has any and
+ * GET /stats/<nodeid> gives the traffic of a single node. Rates are averaged
+ * over the time since the previous request for the same node.
+ */
+void stats_rest_service(struct rest_client* client, const void* content);
+
+#endif /* STATS_REST_H_ */
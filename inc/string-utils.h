@@ -51,6 +51,12 @@ char* string_tolower(char* str);
 
 char* string_replace_char(char m, char r, char* str);
 
+/* Parses a comma separated list of non-negative numbers and ranges such as
+ * "0,2,4-7" into dst. Returns the number of values or -1 if the list is
+ * malformed or has more than max values.
+ */
+int string_parse_int_list(int* dst, size_t max, const char* str);
+
 #ifndef IN_STRING_UTILS_C_
 #undef SPACE_CHARACTER
 #endif
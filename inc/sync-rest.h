@@ -0,0 +1,10 @@
+#ifndef SYNC_REST_H_
+#define SYNC_REST_H_
+
+/* GET /sync gives the number of SYNC frames sent by the SYNC thread, the
+ * number of periods that it missed and a histogram of its jitter in
+ * microseconds.
+ */
+void sync_rest_service(struct rest_client* client, const void* content);
+
+#endif /* SYNC_REST_H_ */
@@ -63,4 +63,28 @@ static inline uint64_t gettime_s(clockid_t clk_id)
 	return gettime_ms(clk_id) / 1000ULL;
 }
 
+/* A cheap monotonic clock for stamping frames and measuring latencies. Once
+ * fastclock_init() has succeeded, it reads the CPU's counter (an invariant TSC
+ * on x86-64 or cntvct on arm64) instead of calling clock_gettime(), which is a
+ * system call on boards whose clocksource has no vDSO support. The counter is
+ * calibrated against CLOCK_MONOTONIC, and the calibration is refreshed every
+ * second once it has settled. Until fastclock_init() is called, or if there
+ * is no usable counter, it is CLOCK_MONOTONIC.
+ *
+ * fastclock_init() returns -1 if it falls back to clock_gettime().
+ */
+int fastclock_init(void);
+
+uint64_t fastclock_ns(void);
+
+/* Converts a fastclock_ns() time to wall-clock microseconds */
+uint64_t fastclock_to_realtime_us(uint64_t ns);
+
+static inline uint64_t fastclock_us(void)
+{
+	return fastclock_ns() / 1000ULL;
+}
+
+uint64_t fastclock_realtime_us(void);
+
 #endif /* TIME_UTILS_H_ */
@@ -0,0 +1,75 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/queue.h>
+
+/* Hashed timer wheel.
+ *
+ * Time is counted in ticks of whatever length the user chooses. An entry is
+ * put into the slot of its deadline modulo TIMER_WHEEL_SIZE, so adding and
+ * removing entries is O(1) and advancing the wheel by one tick only touches
+ * the entries in one slot. Entries that are more than TIMER_WHEEL_SIZE ticks
+ * away stay in their slot for the extra rounds.
+ *
+ * This is meant for large numbers of periodic events that would otherwise
+ * need one system timer each, e.g. simulated PDOs.
+ */
+
+#define TIMER_WHEEL_SIZE 256
+
+struct timer_wheel_entry {
+	LIST_ENTRY(timer_wheel_entry) links;
+	uint64_t deadline;
+	int is_pending;
+};
+
+LIST_HEAD(timer_wheel_list, timer_wheel_entry);
+
+struct timer_wheel {
+	uint64_t now;
+	size_t n_pending;
+	struct timer_wheel_list slot[TIMER_WHEEL_SIZE];
+};
+
+typedef void (*timer_wheel_fn)(struct timer_wheel_entry*, void* context);
+
+void timer_wheel_init(struct timer_wheel* self, uint64_t now);
+
+/* Deadlines that are not in the future expire on the next tick. Adding an
+ * entry that is already pending moves it.
+ */
+void timer_wheel_add(struct timer_wheel* self, struct timer_wheel_entry* entry,
+		     uint64_t deadline);
+
+void timer_wheel_remove(struct timer_wheel* self,
+			struct timer_wheel_entry* entry);
+
+/* Calls fn for every entry whose deadline is at or before now. The callback
+ * may add or remove any entry, including the one that expired.
+ */
+void timer_wheel_advance(struct timer_wheel* self, uint64_t now,
+			 timer_wheel_fn fn, void* context);
+
+static inline int timer_wheel_is_empty(const struct timer_wheel* self)
+{
+	return self->n_pending == 0;
+}
+
+#endif /* TIMER_WHEEL_H_ */
@@ -21,23 +21,132 @@
 #include <stdint.h>
 
 #include "socketcan.h"
+#include "canopen.h"
 
+/* Classic frames are recorded in the head of the FD frame; FD frames have
+ * CANFD_FDF set in cfd.flags.
+ */
 struct tb_frame {
 	uint64_t timestamp;
-	struct can_frame cf;
+	union {
+		struct can_frame cf;
+		struct canfd_frame cfd;
+	};
+};
+
+/* The buffer is a ring that any number of threads may append to at the same
+ * time. Writers reserve a position with an atomic increment of the head and
+ * each slot carries a sequence number that is odd while the slot is being
+ * written and otherwise tells which position the slot holds. tb_dump() copies
+ * out every slot that is consistent without stopping the writers.
+ */
+struct tb_slot {
+	uint64_t seq;
+	struct tb_frame frame;
+};
+
+/* Frames are only recorded if they pass the filter.
+ *
+ * objects is a mask of enum canopen_object; 0 records all objects and frames
+ * that are not CANopen objects are only recorded then. Frames of nodes outside
+ * range_start-range_stop are dropped; frames that are not addressed to a node
+ * always pass. A frame passes the COB-ID filter if
+ * (cob_id & cob_mask) == (filter.cob_id & cob_mask). With a pdo_decimation of
+ * n > 1, only every n-th frame of each PDO COB-ID is recorded.
+ */
+struct tb_filter {
+	uint32_t objects;
+	int range_start;
+	int range_stop;
+	uint32_t cob_mask;
+	uint32_t cob_id;
+	unsigned int pdo_decimation;
 };
 
+/* NMT, EMCY, SDO and heartbeat frames go to the event ring if there is one */
+#define TB_EVENT_OBJECTS (CANOPEN_NMT | CANOPEN_EMCY | CANOPEN_TSDO \
+			  | CANOPEN_RSDO | CANOPEN_HEARTBEAT)
+
 struct tracebuffer {
 	size_t length;
-	size_t index;
-	size_t count;
-	int is_blocked;
-	struct tb_frame* data;
+	uint64_t head;
+	struct tb_slot* slots;
+
+	int has_filter;
+	struct tb_filter filter;
+	uint32_t* pdo_count;
+
+	struct tracebuffer* events;
+
+	/* Set if the rings live in a file; see tb_init_file() */
+	void* map;
+	size_t map_size;
+	int is_mapped;
 };
 
+/* Layout of a trace buffer file: this header, followed by the slots of the
+ * main ring and then those of the event ring. The write position of a ring
+ * is not stored; it follows from the sequence numbers of the slots.
+ */
+#define TB_FILE_MAGIC 0x52424354 /* "TCBR" */
+#define TB_FILE_VERSION 1
+
+struct tb_file_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t slot_size;
+	uint64_t length;
+	uint64_t event_length;
+	uint64_t created;
+	uint8_t reserved[32];
+};
+
+typedef void (*tb_frame_fn)(const struct tb_frame* frame, void* context);
+
 int tb_init(struct tracebuffer* self, size_t size);
+
+/* Like tb_init(), but event_size bytes of size go to a separate ring for
+ * rare events, so that cyclic traffic does not push them out.
+ */
+int tb_init_split(struct tracebuffer* self, size_t size, size_t event_size);
+
+/* Like tb_init_split(), but the rings are kept in a shared mapping of the
+ * file at path, e.g. on /dev/shm, so that they outlive the process. Any
+ * previous content of the file is discarded.
+ */
+int tb_init_file(struct tracebuffer* self, const char* path, size_t size,
+		 size_t event_size);
+
+/* Read back the frames of a file left behind by tb_init_file() and pass them
+ * to fn in the order of their timestamps. Frames that were being written when
+ * the process went away are left out.
+ */
+int tb_recover(const char* path, tb_frame_fn fn, void* context);
+
+int tb_set_filter(struct tracebuffer* self, const struct tb_filter* filter);
 void tb_destroy(struct tracebuffer* self);
 void tb_append(struct tracebuffer* self, const struct can_frame* frame);
+
+/* Append a frame with a timestamp that was taken elsewhere, e.g. by the kernel.
+ * The timestamp is in microseconds since the epoch.
+ */
+void tb_append_ts(struct tracebuffer* self, const struct can_frame* frame,
+		  uint64_t timestamp);
+void tb_append_fd(struct tracebuffer* self, const struct canfd_frame* frame,
+		  uint64_t timestamp);
+/* Writes the frames of both rings in the order of their timestamps */
 void tb_dump(struct tracebuffer* self, FILE* stream);
 
+/* Like tb_dump(), but passes the frames to fn instead */
+void tb_foreach(const struct tracebuffer* self, tb_frame_fn fn, void* context);
+
+/* Copy up to max frames of one ring, i.e. self or self->events, starting at
+ * position *cursor, and advance the cursor past them. Frames that were
+ * overwritten before they could be read are skipped, so the cursor may advance
+ * further than the returned count. Reading stops at the first frame that is
+ * still being written.
+ */
+size_t tb_read(struct tracebuffer* self, uint64_t* cursor,
+	       struct tb_frame* dst, size_t max);
+
 #endif /* _TRACE_BUFFER_H */
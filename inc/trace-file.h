@@ -0,0 +1,130 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_FILE_H
+#define _TRACE_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "trace-buffer.h"
+
+/* Indexed trace file format.
+ *
+ * A file starts with a header, followed by blocks of frames. Each block has a
+ * header with the earliest and latest timestamp of its frames and a bitmap of
+ * the node ids that appear in it, so that readers can skip blocks without
+ * decoding them. When a
+ * file is closed, a copy of all block headers with their offsets is appended
+ * as an index, followed by a trailer that points at it. Files that were not
+ * closed properly have no trailer; they can still be read by walking the
+ * blocks.
+ *
+ * All fields are in host byte order. Timestamps are in microseconds since
+ * the epoch.
+ */
+
+#define TRACE_FILE_MAGIC 0x52544f43 /* "COTR" */
+#define TRACE_FILE_BLOCK_MAGIC 0x4b4c4243 /* "CBLK" */
+#define TRACE_FILE_INDEX_MAGIC 0x58444943 /* "CIDX" */
+#define TRACE_FILE_VERSION 1
+
+struct trace_file_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint16_t frame_size;
+	uint8_t range_start;
+	uint8_t range_stop;
+	uint32_t reserved;
+	uint64_t created;
+	char iface[32];
+};
+
+/* Node 0 stands for frames that are not addressed to a node, like SYNC */
+struct trace_file_block {
+	uint32_t magic;
+	uint32_t n_frames;
+	uint64_t t_min;
+	uint64_t t_max;
+	uint8_t nodes[16];
+};
+
+struct trace_file_index_entry {
+	uint64_t offset;
+	struct trace_file_block block;
+};
+
+struct trace_file_trailer {
+	uint64_t index_offset;
+	uint32_t n_blocks;
+	uint32_t magic;
+};
+
+int trace_file_frame_nodeid(const struct tb_frame* frame);
+
+/* Writer. The caller owns the file descriptor. */
+struct trace_file_writer {
+	int fd;
+	uint64_t offset;
+	size_t n_blocks;
+	size_t capacity;
+	struct trace_file_index_entry* index;
+	int is_unindexed;
+};
+
+int trace_file_writer_init(struct trace_file_writer* self, int fd,
+			   const char* iface, int range_start, int range_stop);
+int trace_file_write_block(struct trace_file_writer* self,
+			   const struct tb_frame* frames, size_t n);
+
+/* Append the index and trailer and free the writer's resources */
+int trace_file_writer_finish(struct trace_file_writer* self);
+
+/* Reader. The file is mapped into memory. */
+struct trace_file {
+	const uint8_t* map;
+	size_t size;
+	const struct trace_file_header* header;
+	const struct trace_file_index_entry* index;
+	size_t n_blocks;
+};
+
+/* Returns 0 on success, 1 if the file is not in the indexed format and -1 on
+ * error.
+ */
+int trace_file_open(struct trace_file* self, const char* path);
+void trace_file_close(struct trace_file* self);
+
+/* Frames outside [from, to] or not belonging to nodeid are skipped. A to of 0
+ * means no upper limit and a nodeid of -1 matches all frames.
+ */
+struct trace_file_filter {
+	uint64_t from;
+	uint64_t to;
+	int nodeid;
+};
+
+int trace_file_filter_match(const struct trace_file_filter* filter,
+			    const struct tb_frame* frame);
+
+typedef void (*trace_file_frame_fn)(const struct tb_frame* frame,
+				    void* context);
+
+int trace_file_scan(const struct trace_file* self,
+		    const struct trace_file_filter* filter,
+		    trace_file_frame_fn fn, void* context);
+
+#endif /* _TRACE_FILE_H */
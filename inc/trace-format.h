@@ -0,0 +1,68 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_FORMAT_H
+#define _TRACE_FORMAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trace-buffer.h"
+#include "trace-file.h"
+
+/* Conversion between trace frames and the capture formats of other tools:
+ * pcapng and pcap with LINKTYPE_CAN_SOCKETCAN, as read by Wireshark, and the
+ * log format of can-utils' candump -l, i.e. lines like
+ * "(1520000000.123456) can0 185#DEADBEEF".
+ */
+
+enum trace_format {
+	TRACE_FORMAT_RAW = 0,
+	TRACE_FORMAT_PCAPNG,
+	TRACE_FORMAT_CANDUMP,
+};
+
+/* Returns -1 for unknown names. Names are "raw", "pcapng" and "candump". */
+int trace_format_from_string(enum trace_format* dst, const char* name);
+const char* trace_format_extension(enum trace_format format);
+
+struct trace_export {
+	FILE* stream;
+	enum trace_format format;
+	char iface[32];
+};
+
+/* Writes the file header, if the format has one */
+int trace_export_begin(struct trace_export* self, FILE* stream,
+		       enum trace_format format, const char* iface);
+int trace_export_frame(struct trace_export* self, const struct tb_frame* frame);
+
+/* Suitable as a tb_frame_fn with the exporter as context */
+void trace_export_frame_fn(const struct tb_frame* frame, void* context);
+
+/* Reads a pcapng, pcap or candump log file and passes its CAN frames to fn.
+ * Returns 0 on success, 1 if the file is in none of these formats and -1 on
+ * error.
+ */
+int trace_import(const char* path, tb_frame_fn fn, void* context);
+
+/* Reads any trace that canopen-dump -f understands: an indexed trace file,
+ * one of the formats above or a plain trace buffer dump. Only frames that
+ * match the filter are passed to fn; filter may be NULL.
+ */
+int trace_read(const char* path, const struct trace_file_filter* filter,
+	       tb_frame_fn fn, void* context);
+
+#endif /* _TRACE_FORMAT_H */
@@ -0,0 +1,53 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_STREAM_H
+#define _TRACE_STREAM_H
+
+#include <stdint.h>
+
+struct tracebuffer;
+
+/* Continuous trace capture.
+ *
+ * A background thread drains the trace buffer into files named
+ * "stream-<iface>-<date>-<time>.<n>.trace" in a directory, using the indexed
+ * format from trace-file.h. Slashes in iface are replaced by underscores. A
+ * new file is started when the current one holds file_size bytes of frames
+ * or, if file_age is non-zero, when it is file_age seconds old. Whenever a
+ * file is started, the oldest ones are removed until the stream files of the
+ * interface take up no more than retention bytes; a retention of 0 keeps
+ * everything.
+ *
+ * Frames that are overwritten in the trace buffer before the thread gets to
+ * them are counted as dropped.
+ */
+struct trace_stream_params {
+	const char* path;
+	const char* iface;
+	int range_start;
+	int range_stop;
+	uint64_t file_size;
+	uint64_t file_age;
+	uint64_t retention;
+};
+
+int trace_stream_start(struct tracebuffer* tb,
+		       const struct trace_stream_params* params);
+void trace_stream_stop(void);
+
+uint64_t trace_stream_get_dropped(void);
+
+#endif /* _TRACE_STREAM_H */
@@ -0,0 +1,96 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TST_BENCH_H
+#define _TST_BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TST_BENCH_HAVE_CYCLES 1
+#else
+#define TST_BENCH_HAVE_CYCLES 0
+#endif
+
+/* Each benchmark is run with twice as many iterations until it takes at least
+ * this long, in nanoseconds.
+ */
+#ifndef TST_BENCH_MIN_TIME
+#define TST_BENCH_MIN_TIME 50000000ULL
+#endif
+
+/* Keeps the compiler from optimising away a value that is not used */
+#define TST_BENCH_KEEP(value) __asm__ __volatile__("" : : "g"(value) : "memory")
+
+static inline uint64_t tst_bench__ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Reference cycles of the time stamp counter, which runs at a fixed rate on
+ * current CPUs, or 0 where there is no such counter.
+ */
+static inline uint64_t tst_bench__cycles(void)
+{
+#if TST_BENCH_HAVE_CYCLES
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static inline void tst_bench__report(const char* name, uint64_t n,
+				     uint64_t ns, uint64_t cycles)
+{
+	if (TST_BENCH_HAVE_CYCLES)
+		printf("%-40s %12.1f ns/op %12.1f cycles/op %12llu ops\n", name,
+		       (double)ns / n, (double)cycles / n,
+		       (unsigned long long)n);
+	else
+		printf("%-40s %12.1f ns/op %12s cycles/op %12llu ops\n", name,
+		       (double)ns / n, "-", (unsigned long long)n);
+
+	fflush(stdout);
+}
+
+/* Times the statements given after the name. Anything that they need must be
+ * set up before, and each iteration must leave things as they found them.
+ * Iterations that do more than one operation are reported per operation.
+ */
+#define TST_BENCH_N(name, ops_per_iteration, ...) do { \
+	uint64_t n_ = 1, ns_, cycles_; \
+	while (1) { \
+		uint64_t start_ns_ = tst_bench__ns(); \
+		uint64_t start_cycles_ = tst_bench__cycles(); \
+		for (uint64_t i_ = 0; i_ < n_; ++i_) { \
+			__VA_ARGS__; \
+		} \
+		cycles_ = tst_bench__cycles() - start_cycles_; \
+		ns_ = tst_bench__ns() - start_ns_; \
+		if (ns_ >= TST_BENCH_MIN_TIME || n_ >= (1ULL << 40)) \
+			break; \
+		n_ *= 2; \
+	} \
+	tst_bench__report(name, n_ * (ops_per_iteration), ns_, cycles_); \
+} while (0)
+
+#define TST_BENCH(name, ...) TST_BENCH_N(name, 1, __VA_ARGS__)
+
+#endif /* _TST_BENCH_H */
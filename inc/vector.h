@@ -54,6 +54,12 @@ static inline int vector_reserve(struct vector* self, size_t size)
 	return self->size < size ? vector__grow(self, size * 2) : 0;
 }
 
+/* Make room for exactly size bytes, for when the final length is known */
+static inline int vector_reserve_exact(struct vector* self, size_t size)
+{
+	return self->size < size ? vector__grow(self, size) : 0;
+}
+
 static inline int vector_append(struct vector* self, const void* data,
 				size_t size)
 {
@@ -95,4 +101,14 @@ static inline int vector_copy(struct vector* dst, const struct vector* src)
 	return vector_assign(dst, src->data, src->index);
 }
 
+/* Exchange the storage of two vectors, so that ownership of a buffer can be
+ * handed over without copying its contents.
+ */
+static inline void vector_swap(struct vector* a, struct vector* b)
+{
+	struct vector tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
 #endif /* _VECTOR_H_INCLUDED */
@@ -0,0 +1,29 @@
+#ifndef WS_REST_H_
+#define WS_REST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct rest_client;
+
+/* GET /ws[?interval=<ms>] upgrades the connection to a WebSocket. Clients send
+ * text messages with one command per line:
+ *
+ *   sub <nodeid> [<n>]          send TPDO n, or TPDOs 1-4, of the node
+ *   unsub <nodeid> [<n>]
+ *   rpdo <nodeid> <n> <hex>     write RPDO n of the node
+ *
+ * RPDO writes go through the process image like those of drivers. They are
+ * only held for the next SYNC when enable_sync_rpdo is set; otherwise they are
+ * sent at once. TPDO values are sent at most once per interval per PDO, with
+ * the latest value and the number of values that were coalesced into it.
+ * Values keep being coalesced while the client does not keep up.
+ */
+void ws_rest_service(struct rest_client* client, const void* content);
+void ws_rest_cleanup(void);
+
+int ws_rest_is_active(void);
+void ws_rest_on_pdo(int nodeid, int n, const void* data, size_t len,
+		    uint64_t timestamp);
+
+#endif /* WS_REST_H_ */
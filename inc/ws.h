@@ -0,0 +1,71 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_WS_H_
+#define CANOPEN_WS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Server side of the WebSocket framing, RFC 6455 */
+
+#define WS_PAYLOAD_MAX 4096
+#define WS_HEADER_MAX 10
+#define WS_ACCEPT_SIZE 29 /* with the terminator */
+
+enum ws_opcode {
+	WS_CONTINUATION = 0,
+	WS_TEXT = 1,
+	WS_BINARY = 2,
+	WS_CLOSE = 8,
+	WS_PING = 9,
+	WS_PONG = 10,
+};
+
+enum ws_close_code {
+	WS_CLOSE_NORMAL = 1000,
+	WS_CLOSE_PROTOCOL_ERROR = 1002,
+	WS_CLOSE_UNSUPPORTED = 1003,
+	WS_CLOSE_TOO_BIG = 1009,
+};
+
+struct ws_frame {
+	int is_final;
+	enum ws_opcode opcode;
+	size_t header_length;
+	size_t payload_length;
+	uint8_t mask[4];
+};
+
+/* Decodes the frame at the start of src. Returns the size of the frame with
+ * its payload, 0 if src ends before the frame does or -1 if it is not valid.
+ * Frames from clients must be masked, and payloads larger than
+ * WS_PAYLOAD_MAX are not valid; payload_length tells those apart.
+ */
+ssize_t ws_decode_frame(struct ws_frame* frame, const void* src, size_t size);
+
+/* The payload is unmasked in place */
+void ws_unmask(const struct ws_frame* frame, void* payload);
+
+/* Encodes the header of an unmasked, final frame into dst, which must have
+ * room for WS_HEADER_MAX bytes. Returns the size of the header.
+ */
+size_t ws_encode_header(void* dst, enum ws_opcode opcode, size_t size);
+
+/* The Sec-WebSocket-Accept value for a Sec-WebSocket-Key */
+void ws_accept_key(char* dst, const char* key);
+
+#endif /* CANOPEN_WS_H_ */
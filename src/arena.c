@@ -0,0 +1,223 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include "arena.h"
+
+#define ARENA__ALIGN 16
+#define ARENA__MIN_BLOCK 4096
+#define ARENA__MIN_TEXT 256
+
+struct arena_block {
+	struct arena_block* next;
+};
+
+static inline char* arena__align(char* ptr)
+{
+	return (char*)(((uintptr_t)ptr + ARENA__ALIGN - 1)
+		       & ~(uintptr_t)(ARENA__ALIGN - 1));
+}
+
+void arena_init(struct arena* self, void* buffer, size_t size)
+{
+	memset(self, 0, sizeof(*self));
+	self->base = buffer;
+	self->size = buffer ? size : 0;
+	self->pos = self->base;
+	self->end = self->base + self->size;
+}
+
+static void arena__free_blocks(struct arena* self)
+{
+	while (self->blocks) {
+		struct arena_block* block = self->blocks;
+		self->blocks = block->next;
+		free(block);
+	}
+
+	self->n_block_bytes = 0;
+}
+
+void arena_destroy(struct arena* self)
+{
+	arena__free_blocks(self);
+	self->pos = self->end = self->base;
+}
+
+void arena_reset(struct arena* self)
+{
+	arena__free_blocks(self);
+	self->pos = self->base;
+	self->end = self->base + self->size;
+}
+
+/* Blocks grow with the total, so that a request that needs a lot does not
+ * call malloc() for every piece of it.
+ */
+static void* arena__alloc_block(struct arena* self, size_t size)
+{
+	size_t block_size = size + sizeof(struct arena_block) + ARENA__ALIGN;
+	if (block_size < size)
+		return NULL;
+
+	if (block_size < ARENA__MIN_BLOCK)
+		block_size = ARENA__MIN_BLOCK;
+
+	if (block_size < self->n_block_bytes)
+		block_size = self->n_block_bytes;
+
+	struct arena_block* block = malloc(block_size);
+	if (!block)
+		return NULL;
+
+	block->next = self->blocks;
+	self->blocks = block;
+	self->n_block_bytes += block_size;
+
+	char* ptr = arena__align((char*)(block + 1));
+	self->pos = ptr + size;
+	self->end = (char*)block + block_size;
+
+	return ptr;
+}
+
+void* arena_alloc(struct arena* self, size_t size)
+{
+	if (self->pos) {
+		char* ptr = arena__align(self->pos);
+		if (ptr <= self->end && size <= (size_t)(self->end - ptr)) {
+			self->pos = ptr + size;
+			return ptr;
+		}
+	}
+
+	return arena__alloc_block(self, size);
+}
+
+void* arena_zalloc(struct arena* self, size_t size)
+{
+	void* ptr = arena_alloc(self, size);
+	if (ptr)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+char* arena_strndup(struct arena* self, const char* str, size_t size)
+{
+	char* copy = arena_alloc(self, size + 1);
+	if (!copy)
+		return NULL;
+
+	memcpy(copy, str, size);
+	copy[size] = '\0';
+	return copy;
+}
+
+void arena_text_init(struct arena_text* self, struct arena* arena)
+{
+	memset(self, 0, sizeof(*self));
+	self->arena = arena;
+}
+
+static int arena__text_reserve(struct arena_text* self, size_t size)
+{
+	struct arena* arena = self->arena;
+
+	size_t new_size = self->size * 2;
+	if (new_size < size)
+		new_size = size;
+	if (new_size < ARENA__MIN_TEXT)
+		new_size = ARENA__MIN_TEXT;
+
+	/* Nothing has been allocated behind the text, so it can grow where it
+	 * is
+	 */
+	if (self->data && self->data + self->size == arena->pos
+	 && size <= (size_t)(arena->end - self->data)) {
+		size_t room = arena->end - self->data;
+		self->size = new_size < room ? new_size : room;
+		arena->pos = self->data + self->size;
+		return 0;
+	}
+
+	char* data = arena_alloc(arena, new_size);
+	if (!data)
+		return -1;
+
+	if (self->length)
+		memcpy(data, self->data, self->length);
+
+	self->data = data;
+	self->size = new_size;
+	return 0;
+}
+
+void arena_vprintf(struct arena_text* self, const char* fmt, va_list ap)
+{
+	if (self->is_bad)
+		return;
+
+	va_list copy;
+	va_copy(copy, ap);
+
+	size_t space = self->size - self->length;
+	int rc = vsnprintf(self->data ? self->data + self->length : NULL,
+			   space, fmt, ap);
+	if (rc < 0)
+		goto failure;
+
+	if ((size_t)rc >= space) {
+		if (arena__text_reserve(self, self->length + rc + 1) < 0)
+			goto failure;
+
+		vsnprintf(self->data + self->length, self->size - self->length,
+			  fmt, copy);
+	}
+
+	self->length += rc;
+	va_end(copy);
+	return;
+
+failure:
+	self->is_bad = 1;
+	va_end(copy);
+}
+
+void arena_printf(struct arena_text* self, const char* fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	arena_vprintf(self, fmt, ap);
+	va_end(ap);
+}
+
+void arena_append(struct arena_text* self, const void* data, size_t size)
+{
+	if (self->is_bad)
+		return;
+
+	if (self->size - self->length <= size
+	 && arena__text_reserve(self, self->length + size + 1) < 0) {
+		self->is_bad = 1;
+		return;
+	}
+
+	memcpy(self->data + self->length, data, size);
+	self->length += size;
+	self->data[self->length] = '\0';
+}
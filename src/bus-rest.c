@@ -0,0 +1,106 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "canopen/bus_health.h"
+#include "rest.h"
+#include "bus-rest.h"
+#include "time-utils.h"
+
+static void bus_rest__reply(struct rest_client* client,
+			    const char* status_code, const char* type,
+			    const char* message, size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void bus_rest__error(struct rest_client* client,
+			    const char* status_code, const char* message)
+{
+	bus_rest__reply(client, status_code, "text/plain", message,
+			strlen(message));
+}
+
+void bus_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (client->req.url_index > 1) {
+		bus_rest__error(client, "404 Not Found", "Not found\r\n");
+		return;
+	}
+
+	uint64_t now = gettime_us(CLOCK_REALTIME);
+
+	struct co_bus_health health;
+	co_bus_health_get(&health, now);
+
+	struct arena_text text;
+	arena_text_init(&text, &client->arena);
+	struct arena_text* out = &text;
+
+	arena_printf(out, "{\n \"state\": \"%s\"",
+		     co_bus_state_name(health.state));
+	arena_printf(out, ",\n \"tx-error-count\": %u", health.tx_error_count);
+	arena_printf(out, ",\n \"rx-error-count\": %u", health.rx_error_count);
+	arena_printf(out, ",\n \"error-frames\": %" PRIu64,
+		     health.n_error_frames);
+	arena_printf(out, ",\n \"tx-timeouts\": %" PRIu64,
+		     health.n_tx_timeouts);
+	arena_printf(out, ",\n \"lost-arbitration\": %" PRIu64,
+		     health.n_lost_arbitration);
+	arena_printf(out, ",\n \"overflows\": %" PRIu64, health.n_overflows);
+	arena_printf(out, ",\n \"protocol-errors\": %" PRIu64,
+		     health.n_protocol_errors);
+	arena_printf(out, ",\n \"transceiver-errors\": %" PRIu64,
+		     health.n_transceiver_errors);
+	arena_printf(out, ",\n \"no-ack\": %" PRIu64, health.n_no_ack);
+	arena_printf(out, ",\n \"bus-errors\": %" PRIu64, health.n_bus_errors);
+	arena_printf(out, ",\n \"error-warning\": %" PRIu64,
+		     health.n_error_warning);
+	arena_printf(out, ",\n \"error-passive\": %" PRIu64,
+		     health.n_error_passive);
+	arena_printf(out, ",\n \"bus-off\": %" PRIu64, health.n_bus_off);
+	arena_printf(out, ",\n \"restarts\": %" PRIu64, health.n_restarts);
+
+	if (health.last_error)
+		arena_printf(out, ",\n \"seconds-since-error\": %.3f",
+			     now > health.last_error
+			     ? (now - health.last_error) / 1e6 : 0.0);
+
+	arena_printf(out, "\n}\n");
+
+	if (out->is_bad) {
+		bus_rest__error(client, "500 Internal Server Error",
+				"Out of memory\r\n");
+		return;
+	}
+
+	bus_rest__reply(client, "200 OK", "application/json", out->data,
+			out->length);
+}
@@ -0,0 +1,204 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <linux/can.h>
+#include <linux/can/error.h>
+
+#include "canopen/bus_health.h"
+
+#ifndef CAN_ERR_CNT
+#define CAN_ERR_CNT 0x00000200U
+#endif
+
+#ifndef CAN_ERR_CRTL_ACTIVE
+#define CAN_ERR_CRTL_ACTIVE 0x40
+#endif
+
+/* Counters have a single writer, the receiver; the state is also read by the
+ * senders.
+ */
+#define bus_health__read(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define bus_health__write(ptr, value) \
+	__atomic_store_n(ptr, value, __ATOMIC_RELAXED)
+#define bus_health__inc(ptr) \
+	bus_health__write(ptr, bus_health__read(ptr) + 1)
+
+static struct co_bus_health bus_health__;
+static uint64_t bus_health__recovery_time = 5000000;
+
+void co_bus_health_reset(void)
+{
+	memset(&bus_health__, 0, sizeof(bus_health__));
+}
+
+void co_bus_health_set_recovery_time(uint64_t recovery_time)
+{
+	bus_health__recovery_time = recovery_time;
+}
+
+static enum co_bus_state bus_health__state_from_counts(unsigned int tec,
+							unsigned int rec)
+{
+	unsigned int count = tec > rec ? tec : rec;
+
+	if (count >= 128)
+		return CO_BUS_ERROR_PASSIVE;
+
+	if (count >= 96)
+		return CO_BUS_ERROR_WARNING;
+
+	return CO_BUS_ERROR_ACTIVE;
+}
+
+static int bus_health__set_state(enum co_bus_state state)
+{
+	struct co_bus_health* self = &bus_health__;
+
+	enum co_bus_state old = bus_health__read(&self->state);
+	if (state == old)
+		return 0;
+
+	switch (state) {
+	case CO_BUS_ERROR_WARNING: bus_health__inc(&self->n_error_warning); break;
+	case CO_BUS_ERROR_PASSIVE: bus_health__inc(&self->n_error_passive); break;
+	case CO_BUS_OFF: bus_health__inc(&self->n_bus_off); break;
+	default: break;
+	}
+
+	bus_health__write(&self->state, state);
+	return 1;
+}
+
+int co_bus_health_on_error_frame(const struct can_frame* cf,
+				 uint64_t timestamp)
+{
+	struct co_bus_health* self = &bus_health__;
+	uint32_t error = cf->can_id & CAN_ERR_MASK;
+	int has_state = 0;
+
+	/* An error state that has expired is left before the frame is looked
+	 * at, so that a new one counts again.
+	 */
+	enum co_bus_state state = co_bus_health_get_state(timestamp);
+	bus_health__write(&self->state, state);
+
+	bus_health__inc(&self->n_error_frames);
+	bus_health__write(&self->last_error, timestamp);
+
+	if (error & CAN_ERR_TX_TIMEOUT)
+		bus_health__inc(&self->n_tx_timeouts);
+
+	if (error & CAN_ERR_LOSTARB)
+		bus_health__inc(&self->n_lost_arbitration);
+
+	if (error & CAN_ERR_CNT) {
+		bus_health__write(&self->tx_error_count, cf->data[6]);
+		bus_health__write(&self->rx_error_count, cf->data[7]);
+	}
+
+	if (error & CAN_ERR_CRTL) {
+		uint8_t crtl = cf->data[1];
+
+		if (crtl & (CAN_ERR_CRTL_RX_OVERFLOW | CAN_ERR_CRTL_TX_OVERFLOW))
+			bus_health__inc(&self->n_overflows);
+
+		if (crtl & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE)) {
+			state = CO_BUS_ERROR_PASSIVE;
+			has_state = 1;
+		} else if (crtl & (CAN_ERR_CRTL_RX_WARNING
+				   | CAN_ERR_CRTL_TX_WARNING)) {
+			state = CO_BUS_ERROR_WARNING;
+			has_state = 1;
+		} else if (crtl & CAN_ERR_CRTL_ACTIVE) {
+			state = CO_BUS_ERROR_ACTIVE;
+			has_state = 1;
+		}
+	}
+
+	if (!has_state && (error & CAN_ERR_CNT) && state != CO_BUS_OFF)
+		state = bus_health__state_from_counts(cf->data[6], cf->data[7]);
+
+	if (error & CAN_ERR_PROT)
+		bus_health__inc(&self->n_protocol_errors);
+
+	if (error & CAN_ERR_TRX)
+		bus_health__inc(&self->n_transceiver_errors);
+
+	if (error & CAN_ERR_ACK)
+		bus_health__inc(&self->n_no_ack);
+
+	if (error & CAN_ERR_BUSERROR)
+		bus_health__inc(&self->n_bus_errors);
+
+	if (error & CAN_ERR_BUSOFF)
+		state = CO_BUS_OFF;
+
+	if (error & CAN_ERR_RESTARTED) {
+		bus_health__inc(&self->n_restarts);
+		state = CO_BUS_ERROR_ACTIVE;
+	}
+
+	return bus_health__set_state(state);
+}
+
+enum co_bus_state co_bus_health_get_state(uint64_t now)
+{
+	const struct co_bus_health* self = &bus_health__;
+
+	enum co_bus_state state = bus_health__read(&self->state);
+	if (state == CO_BUS_ERROR_ACTIVE || !bus_health__recovery_time)
+		return state;
+
+	uint64_t last_error = bus_health__read(&self->last_error);
+
+	return now >= last_error + bus_health__recovery_time
+	     ? CO_BUS_ERROR_ACTIVE : state;
+}
+
+void co_bus_health_get(struct co_bus_health* dst, uint64_t now)
+{
+	const struct co_bus_health* self = &bus_health__;
+
+	dst->state = co_bus_health_get_state(now);
+	dst->n_error_frames = bus_health__read(&self->n_error_frames);
+	dst->n_tx_timeouts = bus_health__read(&self->n_tx_timeouts);
+	dst->n_lost_arbitration = bus_health__read(&self->n_lost_arbitration);
+	dst->n_overflows = bus_health__read(&self->n_overflows);
+	dst->n_protocol_errors = bus_health__read(&self->n_protocol_errors);
+	dst->n_transceiver_errors =
+		bus_health__read(&self->n_transceiver_errors);
+	dst->n_no_ack = bus_health__read(&self->n_no_ack);
+	dst->n_bus_errors = bus_health__read(&self->n_bus_errors);
+	dst->n_error_warning = bus_health__read(&self->n_error_warning);
+	dst->n_error_passive = bus_health__read(&self->n_error_passive);
+	dst->n_bus_off = bus_health__read(&self->n_bus_off);
+	dst->n_restarts = bus_health__read(&self->n_restarts);
+	dst->tx_error_count = bus_health__read(&self->tx_error_count);
+	dst->rx_error_count = bus_health__read(&self->rx_error_count);
+	dst->last_error = bus_health__read(&self->last_error);
+}
+
+const char* co_bus_state_name(enum co_bus_state state)
+{
+	switch (state) {
+	case CO_BUS_ERROR_ACTIVE: return "error-active";
+	case CO_BUS_ERROR_WARNING: return "error-warning";
+	case CO_BUS_ERROR_PASSIVE: return "error-passive";
+	case CO_BUS_OFF: return "bus-off";
+	}
+
+	return "unknown";
+}
@@ -0,0 +1,67 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "canopen/bus_load.h"
+#include "co_atomic.h"
+
+unsigned int co_bus_load_frame_bits(const struct canfd_frame* cf)
+{
+	unsigned int header = cf->can_id & CAN_EFF_FLAG ? 54 : 34;
+	unsigned int len = cf->can_id & CAN_RTR_FLAG ? 0 : cf->len;
+	unsigned int stuffed = header + 8 * len;
+
+	/* 13 bits of CRC delimiter, ACK, EOF and interframe space */
+	return stuffed + (stuffed - 1) / 4 + 13;
+}
+
+void co_bus_load_init(struct co_bus_load* self, uint32_t bitrate,
+		      uint64_t now)
+{
+	memset(self, 0, sizeof(*self));
+	self->bitrate = bitrate;
+	self->last_time = now;
+}
+
+void co_bus_load_count(struct co_bus_load* self, const struct canfd_frame* cf)
+{
+	co_atomic_add_fetch(&self->n_bits, co_bus_load_frame_bits(cf));
+}
+
+unsigned int co_bus_load_sample(struct co_bus_load* self, uint64_t now)
+{
+	if (now <= self->last_time || self->bitrate == 0)
+		return self->load;
+
+	uint64_t n_bits = co_atomic_load(&self->n_bits);
+	uint64_t bits = n_bits - self->last_bits;
+	uint64_t capacity = (now - self->last_time) * self->bitrate / 1000000;
+
+	self->last_bits = n_bits;
+	self->last_time = now;
+
+	uint64_t sample = capacity ? bits * CO_BUS_LOAD_MAX / capacity
+				   : CO_BUS_LOAD_MAX;
+	if (sample > CO_BUS_LOAD_MAX)
+		sample = CO_BUS_LOAD_MAX;
+
+	/* Rounded towards the sample so that the load can reach it */
+	uint64_t sum = 3 * self->load + sample;
+	unsigned int load = sample > self->load ? (sum + 3) / 4 : sum / 4;
+	__atomic_store_n(&self->load, load, __ATOMIC_RELAXED);
+
+	return load;
+}
@@ -0,0 +1,264 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/can.h>
+
+#include "can-tcp-wire.h"
+
+#define CAN_TCP_WIRE_TS_FLAG 0x10
+#define CAN_TCP_WIRE_CONTROL_DLC 0xff
+#define CAN_TCP_WIRE_ESCAPE 0xff
+
+static const char can_tcp_wire__magic[4] = { 'C', 'T', 'C', 'P' };
+
+void can_tcp_wire_make_control(struct can_frame* cf,
+			       enum can_tcp_wire_control type)
+{
+	memset(cf, 0, sizeof(*cf));
+
+	cf->can_dlc = CAN_TCP_WIRE_CONTROL_DLC;
+	memcpy(cf->data, can_tcp_wire__magic, sizeof(can_tcp_wire__magic));
+	cf->data[4] = type;
+}
+
+enum can_tcp_wire_control
+can_tcp_wire_get_control(const struct can_frame* cf)
+{
+	if (cf->can_dlc != CAN_TCP_WIRE_CONTROL_DLC)
+		return CAN_TCP_WIRE_DATA;
+
+	if (memcmp(cf->data, can_tcp_wire__magic,
+		   sizeof(can_tcp_wire__magic)) != 0)
+		return CAN_TCP_WIRE_DATA;
+
+	return cf->data[4];
+}
+
+static size_t can_tcp_wire__put_varint(unsigned char* dst, uint64_t value)
+{
+	size_t i = 0;
+
+	while (value >= 0x80) {
+		dst[i++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+
+	dst[i++] = value;
+	return i;
+}
+
+/* Returns the number of bytes used, 0 if more are needed or -1 if the varint
+ * is longer than max bytes.
+ */
+static ssize_t can_tcp_wire__get_varint(uint64_t* dst, const unsigned char* src,
+					size_t size, size_t max)
+{
+	uint64_t value = 0;
+
+	for (size_t i = 0; i < max; ++i) {
+		if (i >= size)
+			return 0;
+
+		value |= (uint64_t)(src[i] & 0x7f) << (7 * i);
+
+		if (!(src[i] & 0x80)) {
+			*dst = value;
+			return i + 1;
+		}
+	}
+
+	return -1;
+}
+
+size_t can_tcp_wire_encode(void* dst, const struct can_frame* cf,
+			   const uint64_t* ts)
+{
+	unsigned char* out = dst;
+	size_t len = 0;
+
+	int is_rtr = !!(cf->can_id & CAN_RTR_FLAG);
+	uint32_t mask = cf->can_id & (CAN_EFF_FLAG | CAN_ERR_FLAG)
+		      ? CAN_EFF_MASK : CAN_SFF_MASK;
+
+	uint32_t id = (cf->can_id & mask) << 3
+		    | !!(cf->can_id & CAN_ERR_FLAG) << 2
+		    | is_rtr << 1
+		    | !!(cf->can_id & CAN_EFF_FLAG);
+
+	int dlc = cf->can_dlc > CAN_MAX_DLEN ? CAN_MAX_DLEN : cf->can_dlc;
+
+	out[len++] = dlc | (ts ? CAN_TCP_WIRE_TS_FLAG : 0);
+	len += can_tcp_wire__put_varint(&out[len], id);
+
+	if (ts)
+		len += can_tcp_wire__put_varint(&out[len], *ts);
+
+	if (!is_rtr) {
+		memcpy(&out[len], cf->data, dlc);
+		len += dlc;
+	}
+
+	return len;
+}
+
+ssize_t can_tcp_wire_decode(struct can_frame* cf, uint64_t* ts,
+			    const void* src, size_t size)
+{
+	const unsigned char* in = src;
+
+	if (size < 1)
+		return 0;
+
+	if (in[0] == CAN_TCP_WIRE_ESCAPE) {
+		if (size < 1 + sizeof(*cf))
+			return 0;
+
+		memcpy(cf, &in[1], sizeof(*cf));
+		cf->can_id = ntohl(cf->can_id);
+
+		if (ts)
+			*ts = 0;
+
+		return 1 + sizeof(*cf);
+	}
+
+	int dlc = in[0] & 0x0f;
+	int has_ts = !!(in[0] & CAN_TCP_WIRE_TS_FLAG);
+
+	if (dlc > CAN_MAX_DLEN || (in[0] & ~(0x0f | CAN_TCP_WIRE_TS_FLAG)))
+		return -1;
+
+	size_t pos = 1;
+	uint64_t id = 0;
+
+	ssize_t rc = can_tcp_wire__get_varint(&id, &in[pos], size - pos, 5);
+	if (rc <= 0)
+		return rc;
+
+	pos += rc;
+
+	if (id > UINT32_MAX || (!(id & 5) && (id >> 3) > CAN_SFF_MASK))
+		return -1;
+
+	uint64_t delta = 0;
+
+	if (has_ts) {
+		rc = can_tcp_wire__get_varint(&delta, &in[pos], size - pos, 10);
+		if (rc <= 0)
+			return rc;
+
+		pos += rc;
+	}
+
+	int is_rtr = !!(id & 2);
+	size_t payload = is_rtr ? 0 : dlc;
+
+	if (size - pos < payload)
+		return 0;
+
+	memset(cf, 0, sizeof(*cf));
+
+	cf->can_id = id >> 3;
+	if (id & 1)
+		cf->can_id |= CAN_EFF_FLAG;
+	if (is_rtr)
+		cf->can_id |= CAN_RTR_FLAG;
+	if (id & 4)
+		cf->can_id |= CAN_ERR_FLAG;
+
+	cf->can_dlc = dlc;
+	memcpy(cf->data, &in[pos], payload);
+
+	if (ts)
+		*ts = delta;
+
+	return pos + payload;
+}
+
+ssize_t can_tcp_wire_encode_filter(void* dst, const struct can_filter* filter,
+				   size_t n, int is_compact)
+{
+	unsigned char* out = dst;
+	size_t len = 0;
+
+	if (n > CAN_TCP_WIRE_MAX_FILTERS)
+		return -1;
+
+	if (is_compact)
+		out[len++] = CAN_TCP_WIRE_ESCAPE;
+
+	struct can_frame cf;
+	can_tcp_wire_make_control(&cf, CAN_TCP_WIRE_FILTER);
+	cf.data[5] = n;
+	cf.can_id = htonl(cf.can_id);
+
+	memcpy(&out[len], &cf, sizeof(cf));
+	len += sizeof(cf);
+
+	for (size_t i = 0; i < n; ++i) {
+		uint32_t pair[2] = { htonl(filter[i].can_id),
+				     htonl(filter[i].can_mask) };
+		memcpy(&out[len], pair, sizeof(pair));
+		len += sizeof(pair);
+	}
+
+	return len;
+}
+
+ssize_t can_tcp_wire_decode_filter(struct can_filter* dst, size_t* n,
+				   const struct can_frame* cf,
+				   const void* src, size_t size)
+{
+	size_t count = cf->data[5];
+
+	if (count > CAN_TCP_WIRE_MAX_FILTERS)
+		return -1;
+
+	if (size < count * 8)
+		return 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t pair[2];
+		memcpy(pair, (const char*)src + i * 8, sizeof(pair));
+		dst[i].can_id = ntohl(pair[0]);
+		dst[i].can_mask = ntohl(pair[1]);
+	}
+
+	*n = count;
+	return count * 8;
+}
+
+int can_tcp_wire_filter_match(const struct can_filter* filter, size_t n,
+			      uint32_t can_id)
+{
+	if (n == 0)
+		return 1;
+
+	for (size_t i = 0; i < n; ++i) {
+		uint32_t id = filter[i].can_id & ~CAN_INV_FILTER;
+		int is_match = (can_id & filter[i].can_mask)
+			     == (id & filter[i].can_mask);
+
+		if (filter[i].can_id & CAN_INV_FILTER)
+			is_match = !is_match;
+
+		if (is_match)
+			return 1;
+	}
+
+	return 0;
+}
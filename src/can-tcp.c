@@ -17,25 +17,85 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
 #include <mloop.h>
 
 #include "sys/queue.h"
 #include "socketcan.h"
 #include "net-util.h"
 #include "sock.h"
+#include "can-tcp-wire.h"
+#include "sock-udp.h"
+
+#define CAN_TCP_BATCH_SIZE 64
+
+/* Batches that are read from a peer before the others get a turn */
+#define CAN_TCP_READ_BUDGET 16
+
+/* Frames in the ring that are sent to peers. A power of 2. */
+#define CAN_TCP_RING_SIZE 4096
+
+#define CAN_TCP_RETRY_INTERVAL 1000 /* us */
 
 size_t strlcpy(char*, const char*, size_t);
 
+/* Less than 0 sends the frames of each read right away, 0 gathers the frames
+ * of one main loop iteration and anything else gathers them for that many
+ * microseconds.
+ */
+static int can_tcp__batch_window = -1;
+
+/* Offer the compact wire encoding when connecting */
+static int can_tcp__use_compact = 0;
+
+/* The frames that a client asks the server for */
+static struct can_filter can_tcp__filter[CAN_TCP_WIRE_MAX_FILTERS];
+static size_t can_tcp__n_filters = 0;
+
 struct can_tcp;
 
+/* Each peer sends from the shared ring at its own pace, starting at its
+ * cursor. Peers never block: a peer whose socket is full waits for it to
+ * become writable while the others carry on, and if the ring wraps around in
+ * the meantime, the frames it missed are counted as dropped.
+ */
 struct can_tcp_entry {
 	struct sock sock;
 	struct can_tcp* parent;
 	LIST_ENTRY(can_tcp_entry) links;
+
+	uint64_t cursor;
+	uint64_t n_dropped;
+
+	/* Encoded frames that have not been written yet */
+	unsigned char partial[CAN_TCP_BATCH_SIZE * CAN_TCP_WIRE_MAX_SIZE];
+	size_t partial_pos;
+	size_t partial_len;
+
+	/* Bytes received that do not make up a whole frame yet */
+	unsigned char in[CAN_TCP_BATCH_SIZE * sizeof(struct can_frame)];
+	size_t in_len;
+
+	int is_compact_in;
+	int is_compact_out;
+	int is_switch_pending;
+
+	/* What the peer wants to receive */
+	struct can_filter filter[CAN_TCP_WIRE_MAX_FILTERS];
+	size_t n_filters;
+
+	/* Multicast publishing */
+	struct sockaddr_in group;
+	uint32_t seq;
+
+	int is_stalled;
+	int is_broken;
+	struct mloop_socket* writable;
 };
 
 LIST_HEAD(can_tcp_list, can_tcp_entry);
@@ -49,6 +109,15 @@ struct can_tcp {
 	struct can_tcp_list list;
 	size_t ref;
 	enum can_tcp_state state;
+	int is_flush_scheduled;
+	struct mloop_timer* flush_timer;
+
+	/* Frames are kept in network byte order, as on the TCP wire, along
+	 * with the peer that they came from.
+	 */
+	struct can_frame ring[CAN_TCP_RING_SIZE];
+	const struct can_tcp_entry* source[CAN_TCP_RING_SIZE];
+	uint64_t head;
 };
 
 static struct can_tcp* can_tcp__new(void)
@@ -68,6 +137,11 @@ static struct can_tcp* can_tcp__new(void)
 
 static void can_tcp__free(struct can_tcp* self)
 {
+	if (self->flush_timer) {
+		mloop_timer_stop(self->flush_timer);
+		mloop_timer_unref(self->flush_timer);
+	}
+
 	free(self);
 }
 
@@ -82,41 +156,662 @@ static void can_tcp__unref(struct can_tcp* self)
 		can_tcp__free(self);
 }
 
-void my_sock_send(struct sock* sock, const struct can_frame* cf)
+__attribute__((visibility("default")))
+void can_tcp_set_batch_window(int window)
+{
+	can_tcp__batch_window = window;
+}
+
+__attribute__((visibility("default")))
+void can_tcp_set_compact(int use_compact)
+{
+	can_tcp__use_compact = use_compact;
+}
+
+__attribute__((visibility("default")))
+int can_tcp_set_filter(const struct can_filter* filter, size_t n)
+{
+	if (n > CAN_TCP_WIRE_MAX_FILTERS)
+		return -1;
+
+	memcpy(can_tcp__filter, filter, n * sizeof(*filter));
+	can_tcp__n_filters = n;
+	return 0;
+}
+
+static inline size_t can_tcp__slot(uint64_t pos)
+{
+	return pos & (CAN_TCP_RING_SIZE - 1);
+}
+
+/* Peers get neither their own frames back nor what they filtered out */
+static int can_tcp_entry__wants(const struct can_tcp_entry* entry,
+				size_t slot)
+{
+	const struct can_tcp* parent = entry->parent;
+
+	if (parent->source[slot] == entry)
+		return 0;
+
+	return can_tcp_wire_filter_match(entry->filter, entry->n_filters,
+					 ntohl(parent->ring[slot].can_id));
+}
+
+static int can_tcp__schedule_flush(struct can_tcp* self, int delay);
+static void can_tcp_entry__on_writable(struct mloop_socket* socket);
+
+/* Skips frames that have been overwritten while the entry was stalled */
+static void can_tcp_entry__catch_up(struct can_tcp_entry* entry)
+{
+	const struct can_tcp* parent = entry->parent;
+
+	if (parent->head - entry->cursor <= CAN_TCP_RING_SIZE)
+		return;
+
+	uint64_t tail = parent->head - CAN_TCP_RING_SIZE;
+
+	if (entry->n_dropped == 0)
+		fprintf(stderr, "can-tcp: peer on fd %d is falling behind; dropping frames\n",
+			entry->sock.fd);
+
+	entry->n_dropped += tail - entry->cursor;
+	entry->cursor = tail;
+}
+
+static int can_tcp_entry__wait_writable(struct can_tcp_entry* entry)
+{
+	if (!entry->writable) {
+		entry->writable = mloop_socket_new(mloop_default());
+		if (!entry->writable)
+			return -1;
+
+		/* The reader has the socket in the same epoll set */
+		mloop_socket_set_fd(entry->writable, dup(entry->sock.fd));
+		mloop_socket_set_event(entry->writable, MLOOP_SOCKET_EVENT_OUT);
+		mloop_socket_set_context(entry->writable, entry, NULL);
+		mloop_socket_set_callback(entry->writable,
+					  can_tcp_entry__on_writable);
+	}
+
+	if (mloop_socket_start(entry->writable) < 0)
+		return -1;
+
+	entry->is_stalled = 1;
+	return 0;
+}
+
+static int can_tcp_entry__on_error(struct can_tcp_entry* entry, int error)
 {
-	struct can_frame cp;
-	memcpy(&cp, cf, sizeof(cp));
-	sock_send(sock, &cp, 0);
+	if (error == EAGAIN || error == EWOULDBLOCK) {
+		if (can_tcp_entry__wait_writable(entry) == 0)
+			return -1;
+
+		error = errno;
+	}
+
+	/* The reader notices the closed connection and removes the entry */
+	if (error != EINTR)
+		entry->is_broken = 1;
+
+	return -1;
 }
 
-static void can_tcp__send_to_others(struct can_tcp_entry* entry,
-				    struct can_frame* cf)
+static int can_tcp_entry__flush_partial(struct can_tcp_entry* entry)
+{
+	while (entry->partial_pos < entry->partial_len) {
+		ssize_t rc = send(entry->sock.fd,
+				  &entry->partial[entry->partial_pos],
+				  entry->partial_len - entry->partial_pos,
+				  MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc < 0)
+			return can_tcp_entry__on_error(entry, errno);
+
+		entry->partial_pos += rc;
+	}
+
+	entry->partial_pos = 0;
+	entry->partial_len = 0;
+	return 0;
+}
+
+/* Control records always have the legacy layout */
+static int can_tcp_entry__send_control(struct can_tcp_entry* entry,
+				       enum can_tcp_wire_control type)
+{
+	struct can_frame cf;
+	can_tcp_wire_make_control(&cf, type);
+	cf.can_id = htonl(cf.can_id);
+
+	memcpy(&entry->partial[entry->partial_len], &cf, sizeof(cf));
+	entry->partial_len += sizeof(cf);
+
+	return can_tcp_entry__flush_partial(entry);
+}
+
+static int can_tcp_entry__send_filter(struct can_tcp_entry* entry,
+				      const struct can_filter* filter,
+				      size_t n)
+{
+	ssize_t len = can_tcp_wire_encode_filter(
+			&entry->partial[entry->partial_len], filter, n,
+			entry->is_compact_out);
+	if (len < 0)
+		return -1;
+
+	entry->partial_len += len;
+
+	return can_tcp_entry__flush_partial(entry);
+}
+
+static int can_tcp_entry__flush_compact(struct can_tcp_entry* entry)
+{
+	const struct can_tcp* parent = entry->parent;
+
+	while (entry->cursor < parent->head) {
+		size_t n = 0;
+		uint64_t end = entry->cursor;
+
+		for (; end < parent->head && n < CAN_TCP_BATCH_SIZE; ++end) {
+			size_t slot = can_tcp__slot(end);
+			if (!can_tcp_entry__wants(entry, slot))
+				continue;
+
+			struct can_frame cf = parent->ring[slot];
+			cf.can_id = ntohl(cf.can_id);
+
+			entry->partial_len += can_tcp_wire_encode(
+				&entry->partial[entry->partial_len], &cf, NULL);
+			++n;
+		}
+
+		entry->cursor = end;
+
+		if (can_tcp_entry__flush_partial(entry) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Frames go out with one sendmsg() per run of up to CAN_TCP_BATCH_SIZE
+ * frames, straight from the ring.
+ */
+static int can_tcp_entry__flush_tcp(struct can_tcp_entry* entry)
+{
+	const struct can_tcp* parent = entry->parent;
+
+	if (can_tcp_entry__flush_partial(entry) < 0)
+		return -1;
+
+	if (entry->is_switch_pending) {
+		entry->is_switch_pending = 0;
+		entry->is_compact_out = 1;
+
+		if (can_tcp_entry__send_control(entry, CAN_TCP_WIRE_SWITCH) < 0)
+			return -1;
+	}
+
+	can_tcp_entry__catch_up(entry);
+
+	if (entry->is_compact_out)
+		return can_tcp_entry__flush_compact(entry);
+
+	while (entry->cursor < parent->head) {
+		struct iovec iov[CAN_TCP_BATCH_SIZE];
+		uint64_t pos[CAN_TCP_BATCH_SIZE];
+		size_t n = 0;
+		uint64_t end = entry->cursor;
+
+		for (; end < parent->head && n < CAN_TCP_BATCH_SIZE; ++end) {
+			size_t slot = can_tcp__slot(end);
+			if (!can_tcp_entry__wants(entry, slot))
+				continue;
+
+			iov[n].iov_base = (void*)&parent->ring[slot];
+			iov[n].iov_len = sizeof(parent->ring[slot]);
+			pos[n++] = end;
+		}
+
+		if (n == 0) {
+			entry->cursor = end;
+			break;
+		}
+
+		struct msghdr msg = {
+			.msg_iov = iov,
+			.msg_iovlen = n,
+		};
+
+		ssize_t rc = sendmsg(entry->sock.fd, &msg,
+				     MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc < 0)
+			return can_tcp_entry__on_error(entry, errno);
+
+		size_t full = rc / sizeof(struct can_frame);
+		size_t rest = rc % sizeof(struct can_frame);
+
+		if (full == n) {
+			entry->cursor = end;
+			continue;
+		}
+
+		entry->cursor = pos[full] + 1;
+
+		if (rest) {
+			memcpy(entry->partial, (char*)iov[full].iov_base + rest,
+			       sizeof(struct can_frame) - rest);
+			entry->partial_len = sizeof(struct can_frame) - rest;
+		} else {
+			entry->cursor = pos[full];
+		}
+
+		/* The socket is full */
+		return can_tcp_entry__on_error(entry, EAGAIN);
+	}
+
+	return 0;
+}
+
+/* CAN and UNIX sockets take one frame per packet */
+static int can_tcp_entry__flush_packets(struct can_tcp_entry* entry)
 {
 	struct can_tcp* parent = entry->parent;
+
+	can_tcp_entry__catch_up(entry);
+
+	while (entry->cursor < parent->head) {
+		struct can_frame cf[CAN_TCP_BATCH_SIZE];
+		uint64_t pos[CAN_TCP_BATCH_SIZE];
+		size_t n = 0;
+		uint64_t end = entry->cursor;
+
+		for (; end < parent->head && n < CAN_TCP_BATCH_SIZE; ++end) {
+			size_t slot = can_tcp__slot(end);
+			if (!can_tcp_entry__wants(entry, slot))
+				continue;
+
+			cf[n] = parent->ring[slot];
+			cf[n].can_id = ntohl(cf[n].can_id);
+			pos[n++] = end;
+		}
+
+		if (n == 0) {
+			entry->cursor = end;
+			break;
+		}
+
+		ssize_t rc = sock_send_batch(&entry->sock, cf, n,
+					     MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc < 0) {
+			/* The interface queue gives no event when there is
+			 * room again, so it is polled.
+			 */
+			if (errno == ENOBUFS)
+				return can_tcp__schedule_flush(parent,
+						CAN_TCP_RETRY_INTERVAL);
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return can_tcp_entry__wait_writable(entry);
+
+			if (entry->sock.type != SOCK_TYPE_CAN)
+				return can_tcp_entry__on_error(entry, errno);
+
+			/* The interface refuses this frame, e.g. because
+			 * its DLC is out of range. Skip it.
+			 */
+			++entry->n_dropped;
+			entry->cursor = pos[0] + 1;
+			continue;
+		}
+
+		entry->cursor = (size_t)rc == n ? end : pos[rc];
+	}
+
+	return 0;
+}
+
+/* Each batch goes out as one datagram. Frames that cannot be sent are lost
+ * like those that get lost on the network, and subscribers see the gap in the
+ * sequence numbers.
+ */
+static int can_tcp_entry__flush_datagrams(struct can_tcp_entry* entry)
+{
+	const struct can_tcp* parent = entry->parent;
+	unsigned char buffer[SOCK_UDP_MAX_SIZE];
+
+	can_tcp_entry__catch_up(entry);
+
+	while (entry->cursor < parent->head) {
+		struct can_frame cf[SOCK_UDP_MAX_FRAMES];
+		size_t n = 0;
+		uint64_t end = entry->cursor;
+
+		for (; end < parent->head && n < SOCK_UDP_MAX_FRAMES; ++end) {
+			size_t slot = can_tcp__slot(end);
+			if (can_tcp_entry__wants(entry, slot))
+				cf[n++] = parent->ring[slot];
+		}
+
+		if (n == 0) {
+			entry->cursor = end;
+			break;
+		}
+
+		size_t size = sock_udp_encode(buffer, entry->seq, cf, n);
+
+		ssize_t rc = sendto(entry->sock.fd, buffer, size, MSG_DONTWAIT,
+				    (struct sockaddr*)&entry->group,
+				    sizeof(entry->group));
+		if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return can_tcp_entry__wait_writable(entry);
+
+		if (rc < 0)
+			entry->n_dropped += n;
+
+		entry->seq += n;
+		entry->cursor = end;
+	}
+
+	return 0;
+}
+
+static void can_tcp_entry__flush(struct can_tcp_entry* entry)
+{
+	if (entry->is_stalled || entry->is_broken)
+		return;
+
+	switch (entry->sock.type) {
+	case SOCK_TYPE_TCP: can_tcp_entry__flush_tcp(entry); break;
+	case SOCK_TYPE_UDP: can_tcp_entry__flush_datagrams(entry); break;
+	default: can_tcp_entry__flush_packets(entry); break;
+	}
+}
+
+static void can_tcp_entry__on_writable(struct mloop_socket* socket)
+{
+	struct can_tcp_entry* entry = mloop_socket_get_context(socket);
+
+	mloop_socket_stop(socket);
+	entry->is_stalled = 0;
+
+	can_tcp_entry__flush(entry);
+}
+
+static void can_tcp__flush(struct can_tcp* self)
+{
 	struct can_tcp_entry* elem = NULL;
 
-	LIST_FOREACH(elem, &parent->list, links)
-		if (elem != entry)
-			my_sock_send(&elem->sock, cf);
+	self->is_flush_scheduled = 0;
+
+	LIST_FOREACH(elem, &self->list, links)
+		can_tcp_entry__flush(elem);
+}
+
+static void can_tcp__on_flush(struct mloop_async* async)
+{
+	can_tcp__flush(mloop_async_get_context(async));
+}
+
+static void can_tcp__on_flush_timer(struct mloop_timer* timer)
+{
+	can_tcp__flush(mloop_timer_get_context(timer));
+}
+
+static int can_tcp__start_flush_timer(struct can_tcp* self, int delay)
+{
+	if (!self->flush_timer) {
+		self->flush_timer = mloop_timer_new(mloop_default());
+		if (!self->flush_timer)
+			return -1;
+
+		mloop_timer_set_type(self->flush_timer, MLOOP_TIMER_RELATIVE);
+		mloop_timer_set_context(self->flush_timer, self, NULL);
+		mloop_timer_set_callback(self->flush_timer,
+					 can_tcp__on_flush_timer);
+	}
+
+	mloop_timer_set_time(self->flush_timer, delay * 1000ULL);
+	return mloop_timer_start(self->flush_timer);
+}
+
+/* Frames are sent after delay microseconds, or at the end of the current
+ * main loop iteration if the delay is 0.
+ */
+static int can_tcp__schedule_flush(struct can_tcp* self, int delay)
+{
+	if (self->is_flush_scheduled)
+		return 0;
+
+	if (delay > 0) {
+		if (can_tcp__start_flush_timer(self, delay) < 0)
+			return -1;
+	} else {
+		struct mloop_async* async = mloop_async_new(mloop_default());
+		if (!async)
+			return -1;
+
+		can_tcp__ref(self);
+		mloop_async_set_context(async, self,
+					(mloop_free_fn)can_tcp__unref);
+		mloop_async_set_callback(async, can_tcp__on_flush);
+
+		int rc = mloop_async_start(async);
+		mloop_async_unref(async);
+
+		if (rc < 0)
+			return -1;
+	}
+
+	self->is_flush_scheduled = 1;
+	return 0;
+}
+
+static void can_tcp__append(struct can_tcp* self,
+			    const struct can_tcp_entry* source,
+			    const struct can_frame* cf, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		size_t slot = can_tcp__slot(self->head++);
+
+		self->ring[slot] = cf[i];
+		self->ring[slot].can_id = htonl(cf[i].can_id);
+		self->source[slot] = source;
+	}
+
+	if (can_tcp__batch_window < 0
+	 || can_tcp__schedule_flush(self, can_tcp__batch_window) < 0)
+		can_tcp__flush(self);
+}
+
+static void can_tcp_entry__on_control(struct can_tcp_entry* entry,
+				      enum can_tcp_wire_control type)
+{
+	switch (type) {
+	case CAN_TCP_WIRE_SWITCH:
+		entry->is_compact_in = 1;
+		/* fall through */
+	case CAN_TCP_WIRE_OFFER:
+		/* Either way, the peer knows the compact encoding */
+		if (!entry->is_compact_out)
+			entry->is_switch_pending = 1;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Returns the size of the frame at the start of src, 0 if it is not all
+ * there yet or -1 if it is garbage. Control records are handled and yield no
+ * frame.
+ */
+static ssize_t can_tcp_entry__decode(struct can_tcp_entry* entry,
+				     struct can_frame* cf, int* is_frame,
+				     const unsigned char* src, size_t size)
+{
+	ssize_t rc = sizeof(*cf);
+
+	*is_frame = 0;
+
+	if (entry->is_compact_in) {
+		rc = can_tcp_wire_decode(cf, NULL, src, size);
+		if (rc <= 0)
+			return rc;
+	} else {
+		if (size < sizeof(*cf))
+			return 0;
+
+		memcpy(cf, src, sizeof(*cf));
+		cf->can_id = ntohl(cf->can_id);
+	}
+
+	enum can_tcp_wire_control type = can_tcp_wire_get_control(cf);
+	if (type == CAN_TCP_WIRE_DATA) {
+		*is_frame = 1;
+		return rc;
+	}
+
+	if (type == CAN_TCP_WIRE_FILTER) {
+		ssize_t trailer = can_tcp_wire_decode_filter(entry->filter,
+							     &entry->n_filters,
+							     cf, src + rc,
+							     size - rc);
+		if (trailer <= 0)
+			return trailer;
+
+		rc += trailer;
+	}
+
+	can_tcp_entry__on_control(entry, type);
+	return rc;
+}
+
+/* The readers return 1 if there may be more to read, 0 if the socket has been
+ * drained and -1 if it should be closed.
+ */
+static int can_tcp_entry__read_tcp(struct can_tcp_entry* entry)
+{
+	struct can_frame cf[CAN_TCP_BATCH_SIZE];
+	size_t n = 0;
+	size_t pos = 0;
+
+	size_t space = sizeof(entry->in) - entry->in_len;
+	ssize_t rc = recv(entry->sock.fd, &entry->in[entry->in_len], space,
+			  MSG_DONTWAIT);
+	if (rc == 0)
+		return -1;
+
+	if (rc < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+	int is_full = (size_t)rc == space;
+	entry->in_len += rc;
+
+	while (pos < entry->in_len) {
+		if (n == CAN_TCP_BATCH_SIZE) {
+			can_tcp__append(entry->parent, entry, cf, n);
+			n = 0;
+		}
+
+		int is_frame;
+		rc = can_tcp_entry__decode(entry, &cf[n], &is_frame,
+					   &entry->in[pos],
+					   entry->in_len - pos);
+		if (rc < 0) {
+			fprintf(stderr, "can-tcp: invalid data from peer on fd %d\n",
+				entry->sock.fd);
+			return -1;
+		}
+
+		if (rc == 0)
+			break;
+
+		pos += rc;
+		n += is_frame;
+	}
+
+	entry->in_len -= pos;
+	memmove(entry->in, &entry->in[pos], entry->in_len);
+
+	if (n > 0)
+		can_tcp__append(entry->parent, entry, cf, n);
+
+	if (entry->is_switch_pending)
+		can_tcp_entry__flush(entry);
+
+	return is_full;
+}
+
+static int can_tcp_entry__read_packets(struct can_tcp_entry* entry)
+{
+	struct can_frame cf[CAN_TCP_BATCH_SIZE];
+
+	ssize_t n = sock_recv_batch(&entry->sock, cf, NULL, CAN_TCP_BATCH_SIZE,
+				    MSG_DONTWAIT);
+	if (n == 0)
+		return -1;
+
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+	can_tcp__append(entry->parent, entry, cf, n);
+	return n == CAN_TCP_BATCH_SIZE;
+}
+
+/* The publishing socket only sends. Anything that still arrives is
+ * discarded.
+ */
+static int can_tcp_entry__read_datagrams(struct can_tcp_entry* entry)
+{
+	unsigned char buffer[SOCK_UDP_MAX_SIZE];
+
+	while (recv(entry->sock.fd, buffer, sizeof(buffer), MSG_DONTWAIT) >= 0)
+		;
+
+	return 0;
+}
+
+static int can_tcp_entry__read(struct can_tcp_entry* entry)
+{
+	switch (entry->sock.type) {
+	case SOCK_TYPE_TCP: return can_tcp_entry__read_tcp(entry);
+	case SOCK_TYPE_UDP: return can_tcp_entry__read_datagrams(entry);
+	default: break;
+	}
+
+	return can_tcp_entry__read_packets(entry);
 }
 
 static void can_tcp__forward_message(struct mloop_socket* socket)
 {
-	struct can_frame cf;
 	struct can_tcp_entry* entry = mloop_socket_get_context(socket);
 	assert(entry);
 
-	if (sock_recv(&entry->sock, &cf, MSG_DONTWAIT) <= 0) {
-		mloop_socket_stop(socket);
-		return;
-	}
+	int rc = 1;
 
-	can_tcp__send_to_others(entry, &cf);
+	for (int i = 0; i < CAN_TCP_READ_BUDGET && rc > 0; ++i)
+		rc = can_tcp_entry__read(entry);
+
+	if (rc < 0)
+		mloop_socket_stop(socket);
+#ifdef mloop_socket_set_edge_triggered
+	else if (rc > 0)
+		mloop_socket_continue(socket);
+#endif
 }
 
 static void can_tcp_entry__free(void* ptr)
 {
 	struct can_tcp_entry* entry = ptr;
+
+	if (entry->n_dropped)
+		fprintf(stderr, "can-tcp: peer on fd %d dropped %llu frames\n",
+			entry->sock.fd, (unsigned long long)entry->n_dropped);
+
+	if (entry->writable) {
+		mloop_socket_stop(entry->writable);
+		mloop_socket_unref(entry->writable);
+	}
+
 	LIST_REMOVE(entry, links);
 	sock_close(&entry->sock);
 	can_tcp__unref(entry->parent);
@@ -130,6 +825,11 @@ can_tcp__add_entry(struct can_tcp* self, const struct sock* sock)
 	if (!entry)
 		return NULL;
 
+	memset(entry, 0, sizeof(*entry));
+
+	/* New peers only get what arrives from now on */
+	entry->cursor = self->head;
+
 	struct mloop_socket* s = mloop_socket_new(mloop_default());
 	if (!s)
 		goto failure;
@@ -141,6 +841,9 @@ can_tcp__add_entry(struct can_tcp* self, const struct sock* sock)
 	mloop_socket_set_context(s, entry, can_tcp_entry__free);
 	mloop_socket_set_callback(s, can_tcp__forward_message);
 	mloop_socket_set_fd(s, sock->fd);
+#ifdef mloop_socket_set_edge_triggered
+	mloop_socket_set_edge_triggered(s, 1);
+#endif
 
 	int rc = mloop_socket_start(s);
 	mloop_socket_unref(s);
@@ -206,7 +909,7 @@ failure:
 	return -1;
 }
 
-static void can_tcp__on_connection(struct mloop_socket* socket)
+static void can_tcp__accept(struct mloop_socket* socket, enum sock_type type)
 {
 	int sfd = mloop_socket_get_fd(socket);
 	struct can_tcp* can_tcp = mloop_socket_get_context(socket);
@@ -218,9 +921,10 @@ static void can_tcp__on_connection(struct mloop_socket* socket)
 		return;
 	}
 
-	net_dont_delay(connfd);
+	if (type == SOCK_TYPE_TCP)
+		net_dont_delay(connfd);
 
-	struct sock sock = { .fd = connfd, .type = SOCK_TYPE_TCP };
+	struct sock sock = { .fd = connfd, .type = type };
 
 	struct mloop_socket* s = can_tcp__add_entry(can_tcp, &sock);
 	if (!s) {
@@ -234,7 +938,18 @@ failure:
 	close(connfd);
 }
 
-struct mloop_socket* can_tcp__setup_server(int port)
+static void can_tcp__on_connection(struct mloop_socket* socket)
+{
+	can_tcp__accept(socket, SOCK_TYPE_TCP);
+}
+
+static void can_tcp__on_unix_connection(struct mloop_socket* socket)
+{
+	can_tcp__accept(socket, SOCK_TYPE_UNIX);
+}
+
+static struct mloop_socket*
+can_tcp__setup_server(int sfd, mloop_socket_fn on_connection)
 {
 	struct can_tcp* can_tcp = can_tcp__new();
 	if (!can_tcp) {
@@ -242,12 +957,6 @@ struct mloop_socket* can_tcp__setup_server(int port)
 		return NULL;
 	}
 
-	int sfd = open_tcp_server(port);
-	if (sfd < 0) {
-		perror("Could not open tcp server");
-		goto server_failure;
-	}
-
 	struct mloop_socket* s = mloop_socket_new(mloop_default());
 	if (!s) {
 		perror("Could not create server socket handler");
@@ -256,7 +965,7 @@ struct mloop_socket* can_tcp__setup_server(int port)
 
 	mloop_socket_set_context(s, can_tcp, (mloop_free_fn)can_tcp__unref);
 	mloop_socket_set_fd(s, sfd);
-	mloop_socket_set_callback(s, can_tcp__on_connection);
+	mloop_socket_set_callback(s, on_connection);
 
 	int rc = mloop_socket_start(s);
 	if (rc < 0)
@@ -268,25 +977,25 @@ struct mloop_socket* can_tcp__setup_server(int port)
 
 handler_failure:
 	close(sfd);
-server_failure:
 	can_tcp__free(can_tcp);
 	return NULL;
 }
 
-__attribute__((visibility("default")))
-int can_tcp_bridge_server(const char* can, int port)
+static int can_tcp__bridge_server(const char* can, int sfd,
+				  mloop_socket_fn on_connection)
 {
 	struct sock cansock;
 
 	if (can) {
 		if (sock_open(&cansock, SOCK_TYPE_CAN, can, NULL) < 0) {
 			perror("Could not open CAN interface");
+			close(sfd);
 			return -1;
 		}
 		net_fix_sndbuf(cansock.fd);
 	}
 
-	struct mloop_socket* s = can_tcp__setup_server(port);
+	struct mloop_socket* s = can_tcp__setup_server(sfd, on_connection);
 	if (!s)
 		goto server_failure;
 
@@ -310,13 +1019,36 @@ server_failure:
 }
 
 __attribute__((visibility("default")))
-int can_tcp_bridge_client(const char* can, const char* address, int port)
+int can_tcp_bridge_server(const char* can, int port)
+{
+	int sfd = open_tcp_server(port);
+	if (sfd < 0) {
+		perror("Could not open tcp server");
+		return -1;
+	}
+
+	return can_tcp__bridge_server(can, sfd, can_tcp__on_connection);
+}
+
+__attribute__((visibility("default")))
+int can_tcp_bridge_unix_server(const char* can, const char* path)
+{
+	int sfd = net_unix_listen(path);
+	if (sfd < 0) {
+		perror("Could not open unix server");
+		return -1;
+	}
+
+	return can_tcp__bridge_server(can, sfd, can_tcp__on_unix_connection);
+}
+
+static int can_tcp__bridge_client(const char* can, struct sock* connsock)
 {
 	struct sock cansock;
 
 	struct can_tcp* can_tcp = can_tcp__new();
 	if (!can_tcp)
-		return -1;
+		goto failure;
 
 	if (can) {
 		if (sock_open(&cansock, SOCK_TYPE_CAN, can, NULL) < 0)
@@ -324,12 +1056,6 @@ int can_tcp_bridge_client(const char* can, const char* address, int port)
 		net_fix_sndbuf(cansock.fd);
 	}
 
-	int connfd = can_tcp_open(address, port);
-	if (connfd < 0)
-		goto tcpsock_failure;
-
-	struct sock connsock = { .fd = connfd, .type = SOCK_TYPE_TCP };
-
 	struct mloop_socket* s1;
 	if (can)  {
 		s1 = can_tcp__add_entry(can_tcp, &cansock);
@@ -337,10 +1063,22 @@ int can_tcp_bridge_client(const char* can, const char* address, int port)
 			goto s1_failure;
 	}
 
-	struct mloop_socket* s2 = can_tcp__add_entry(can_tcp, &connsock);
+	struct mloop_socket* s2 = can_tcp__add_entry(can_tcp, connsock);
 	if (!s2)
 		goto s2_failure;
 
+	struct can_tcp_entry* entry = mloop_socket_get_context(s2);
+
+	/* Negotiation only applies to the TCP encoding */
+	if (connsock->type == SOCK_TYPE_TCP) {
+		if (can_tcp__use_compact)
+			can_tcp_entry__send_control(entry, CAN_TCP_WIRE_OFFER);
+
+		if (can_tcp__n_filters > 0)
+			can_tcp_entry__send_filter(entry, can_tcp__filter,
+						   can_tcp__n_filters);
+	}
+
 	can_tcp__unref(can_tcp);
 
 	return 0;
@@ -349,11 +1087,80 @@ s2_failure:
 	if (can)
 		mloop_socket_stop(s1);
 s1_failure:
-	sock_close(&connsock);
-tcpsock_failure:
 	if (can)
 		sock_close(&cansock);
 cansock_failure:
 	can_tcp__free(can_tcp);
+failure:
+	sock_close(connsock);
+	return -1;
+}
+
+__attribute__((visibility("default")))
+int can_tcp_bridge_client(const char* can, const char* address, int port)
+{
+	int connfd = can_tcp_open(address, port);
+	if (connfd < 0)
+		return -1;
+
+	struct sock connsock = { .fd = connfd, .type = SOCK_TYPE_TCP };
+	return can_tcp__bridge_client(can, &connsock);
+}
+
+__attribute__((visibility("default")))
+int can_tcp_bridge_unix_client(const char* can, const char* path)
+{
+	int connfd = net_unix_connect(path);
+	if (connfd < 0)
+		return -1;
+
+	struct sock connsock = { .fd = connfd, .type = SOCK_TYPE_UNIX };
+	return can_tcp__bridge_client(can, &connsock);
+}
+
+__attribute__((visibility("default")))
+int can_tcp_bridge_multicast(const char* can, const char* address, int ttl)
+{
+	struct sockaddr_in group;
+	if (sock_udp_parse_address(&group, address) < 0)
+		return -1;
+
+	int fd = sock_udp_open_publisher(ttl);
+	if (fd < 0)
+		return -1;
+
+	struct sock udpsock = { .fd = fd, .type = SOCK_TYPE_UDP };
+
+	struct can_tcp* can_tcp = can_tcp__new();
+	if (!can_tcp)
+		goto can_tcp_failure;
+
+	struct sock cansock;
+	if (sock_open(&cansock, SOCK_TYPE_CAN, can, NULL) < 0)
+		goto cansock_failure;
+
+	struct mloop_socket* s1 = can_tcp__add_entry(can_tcp, &cansock);
+	if (!s1)
+		goto s1_failure;
+
+	struct mloop_socket* s2 = can_tcp__add_entry(can_tcp, &udpsock);
+	if (!s2)
+		goto s2_failure;
+
+	struct can_tcp_entry* entry = mloop_socket_get_context(s2);
+	entry->group = group;
+
+	can_tcp__unref(can_tcp);
+	return 0;
+
+s2_failure:
+	mloop_socket_stop(s1);
+	goto cansock_failure;
+s1_failure:
+	sock_close(&cansock);
+cansock_failure:
+	can_tcp__free(can_tcp);
+can_tcp_failure:
+	close(fd);
 	return -1;
 }
@@ -16,10 +16,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <getopt.h>
 #include <mloop.h>
+#include <linux/can.h>
 
 #include "can-tcp.h"
+#include "can-tcp-wire.h"
 
 const char usage_[] =
 "Usage: canbridge [options] [interface]\n"
@@ -27,12 +30,33 @@ const char usage_[] =
 "Options:\n"
 "    -h, --help                 Get help.\n"
 "    -L, --listen[=port]        Listen on TCP port. Default 5555.\n"
+"                               --listen=unix:<path> listens on a UNIX\n"
+"                               socket instead.\n"
 "    -c, --connect=host[:port]  Connect to TCP server. Default 5555.\n"
+"                               --connect=unix:<path> connects to a UNIX\n"
+"                               socket.\n"
+"    -m, --multicast=group[:port]\n"
+"                               Publish the frames to a UDP multicast\n"
+"                               group. Default port 5555.\n"
+"    -t, --ttl=hops             Multicast TTL. Default 1.\n"
 "    -C, --create               Try to create a virtual CAN interface.\n"
+"    -b, --batch[=us]           Gather frames and send them together, for\n"
+"                               one main loop iteration or for us\n"
+"                               microseconds.\n"
+"    -z, --compact              Ask the server for the compact encoding,\n"
+"                               which omits padding and unused bytes.\n"
+"    -f, --filter=id:mask,...   Ask the server for only the frames that\n"
+"                               match, as with candump. id~mask inverts\n"
+"                               a filter. Values are in hex.\n"
 "\n"
 "Examples:\n"
 "    $ canbridge can0 --listen=1234\n"
 "    $ canbridge vcan0 --connect=127.0.0.1:1234\n"
+"    $ canbridge can0 --listen=1234 --batch=2000\n"
+"    $ canbridge vcan0 --connect=10.0.0.1:1234 --compact\n"
+"    $ canbridge vcan0 --connect=10.0.0.1:1234 --filter=80:780,700:780\n"
+"    $ canbridge --listen=unix:@sim\n"
+"    $ canbridge can0 --multicast=239.255.42.1 --batch=1000\n"
 "\n";
 
 static inline int print_usage(FILE* output, int status)
@@ -58,6 +82,36 @@ static int try_setup(const char* iface)
 	return system(buffer);
 }
 
+static int set_filter(const char* arg)
+{
+	struct can_filter filter[CAN_TCP_WIRE_MAX_FILTERS];
+	size_t n = 0;
+
+	while (*arg) {
+		if (n >= CAN_TCP_WIRE_MAX_FILTERS)
+			return -1;
+
+		char* end = NULL;
+		filter[n].can_id = strtoul(arg, &end, 16);
+
+		if (*end != ':' && *end != '~')
+			return -1;
+
+		if (*end == '~')
+			filter[n].can_id |= CAN_INV_FILTER;
+
+		filter[n].can_mask = strtoul(end + 1, &end, 16);
+
+		if (*end != ',' && *end != '\0')
+			return -1;
+
+		++n;
+		arg = *end ? end + 1 : end;
+	}
+
+	return can_tcp_set_filter(filter, n);
+}
+
 static void on_signal_event(struct mloop_signal* sig, int signo)
 {
 	(void)sig;
@@ -72,15 +126,22 @@ int main(int argc, char* argv[])
 		{ "listen",  optional_argument, 0, 'L' },
 		{ "connect", required_argument, 0, 'c' },
 		{ "create",  no_argument,       0, 'C' },
+		{ "batch",   optional_argument, 0, 'b' },
+		{ "compact", no_argument,       0, 'z' },
+		{ "filter",  required_argument, 0, 'f' },
+		{ "multicast", required_argument, 0, 'm' },
+		{ "ttl",     required_argument, 0, 't' },
 		{ 0, 0, 0, 0 }
 	};
 
 	const char* listen_ = NULL;
 	const char* connect_ = NULL;
+	const char* multicast = NULL;
+	int ttl = 1;
 	int create = 0;
 
 	while (1) {
-		int c = getopt_long(argc, argv, "hL::c:C", long_options, NULL);
+		int c = getopt_long(argc, argv, "hL::c:Cb::zf:m:t:", long_options, NULL);
 		if (c < 0)
 			break;
 
@@ -88,7 +149,19 @@ int main(int argc, char* argv[])
 		case 'h': return print_usage(stdout, 0);
 		case 'L': listen_ = optarg ? optarg : "5555"; break;
 		case 'c': connect_ = optarg; break;
+		case 'm': multicast = optarg; break;
+		case 't': ttl = atoi(optarg); break;
 		case 'C': create = 1; break;
+		case 'b':
+			can_tcp_set_batch_window(optarg ? atoi(optarg) : 0);
+			break;
+		case 'z': can_tcp_set_compact(1); break;
+		case 'f':
+			if (set_filter(optarg) < 0) {
+				fprintf(stderr, "Invalid filter: %s\n", optarg);
+				return print_usage(stderr, 1);
+			}
+			break;
 		}
 	}
 
@@ -97,13 +170,18 @@ int main(int argc, char* argv[])
 
 	const char* iface = args[0];
 
-	if (listen_ && connect_) {
-		fprintf(stderr, "Can't have both listen and connect arguments\n");
+	if (!!listen_ + !!connect_ + !!multicast > 1) {
+		fprintf(stderr, "Can't have more than one of listen, connect and multicast arguments\n");
 		return print_usage(stderr, 1);
 	}
 
-	if (!listen_ && !connect_) {
-		fprintf(stderr, "You must either listen or connect\n");
+	if (!listen_ && !connect_ && !multicast) {
+		fprintf(stderr, "You must either listen, connect or multicast\n");
+		return print_usage(stderr, 1);
+	}
+
+	if (multicast && !iface) {
+		fprintf(stderr, "Multicast needs a CAN interface\n");
 		return print_usage(stderr, 1);
 	}
 
@@ -127,12 +205,30 @@ int main(int argc, char* argv[])
 	struct mloop* mloop = mloop_default();
 	mloop_ref(mloop);
 
-	if (listen_) {
+	const char* unix_path = NULL;
+
+	if (multicast) {
+		if (can_tcp_bridge_multicast(iface, multicast, ttl) < 0) {
+			perror("Could not create multicast publisher");
+			goto failure;
+		}
+	} else if (listen_ && strncmp(listen_, "unix:", 5) == 0) {
+		unix_path = listen_ + 5;
+		if (can_tcp_bridge_unix_server(iface, unix_path) < 0) {
+			perror("Could not create interface bridge");
+			goto failure;
+		}
+	} else if (listen_) {
 		int port = atoi(listen_);
 		if (can_tcp_bridge_server(iface, port) < 0) {
 			perror("Could not create interface bridge");
 			goto failure;
 		}
+	} else if (strncmp(connect_, "unix:", 5) == 0) {
+		if (can_tcp_bridge_unix_client(iface, connect_ + 5) < 0) {
+			perror("Could not create interface bridge");
+			goto failure;
+		}
 	} else {
 		int port = 5555;
 		char* portptr = strchr(connect_, ':');
@@ -168,6 +264,9 @@ int main(int argc, char* argv[])
 
 	mloop_run(mloop);
 
+	if (unix_path && unix_path[0] != '@')
+		unlink(unix_path);
+
 failure:
 	mloop_unref(mloop);
 	return 1;
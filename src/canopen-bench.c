@@ -0,0 +1,1091 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/can.h>
+
+#include "canopen.h"
+#include "canopen/nmt.h"
+#include "canopen/heartbeat.h"
+#include "sock.h"
+#include "time-utils.h"
+
+const char usage_[] =
+"Usage: canopen-bench [options]\n"
+"\n"
+"Starts canopen-master against a number of virtual nodes and measures it.\n"
+"Results are written as one JSON object per line.\n"
+"\n"
+"Options:\n"
+"    -h, --help                 Get help.\n"
+"    -n, --nodes                Set the number of nodes (default 16).\n"
+"    -i, --interface            Use this bus, e.g. can:vcan0 or tcp:host:port,\n"
+"                               instead of a private canbridge.\n"
+"    -R, --rest-port            Set TCP port of the master (default 9797).\n"
+"    -t, --time                 Seconds per throughput scenario (default 2).\n"
+"    -r, --pdo-rate             SYNCs per second in the pdo scenario\n"
+"                               (default 1000).\n"
+"    -s, --scenarios            Comma separated scenarios to run (default\n"
+"                               all): bootup, sdo, segmented, pdo, latency,\n"
+"                               rest, eds.\n"
+"    -o, --output               Write results to a file.\n"
+"    -k, --keep                 Keep the logs and configuration files.\n"
+"\n"
+"The binaries are taken from the directory of canopen-bench.\n"
+"\n"
+"Examples:\n"
+"    $ canopen-bench\n"
+"    $ canopen-bench -n 100 -s sdo,pdo -o results.json\n"
+"    $ canopen-bench -i can:vcan0 -n 32\n"
+"\n";
+
+#define BULK_ITEMS_MAX 1024
+#define N_EXPEDITED_OBJECTS 32
+#define N_SEGMENTED_OBJECTS 16
+#define SEGMENTED_SIZE 100
+#define N_LATENCY_SAMPLES 1000
+#define LATENCY_TIMEOUT 100000 /* us */
+#define BOOTUP_TIMEOUT 30000000 /* us */
+#define N_REST_CONNECTIONS 4
+#define N_EDS_DUMPS 10
+
+enum scenario {
+	SCENARIO_BOOTUP = 1 << 0,
+	SCENARIO_SDO = 1 << 1,
+	SCENARIO_SEGMENTED = 1 << 2,
+	SCENARIO_PDO = 1 << 3,
+	SCENARIO_LATENCY = 1 << 4,
+	SCENARIO_REST = 1 << 5,
+	SCENARIO_EDS = 1 << 6,
+	SCENARIO_ALL = 0x7f,
+};
+
+static const char* scenario_name_[] = {
+	"bootup", "sdo", "segmented", "pdo", "latency", "rest", "eds", NULL
+};
+
+struct http_conn {
+	int fd;
+	char* buffer;
+	size_t size, length;
+};
+
+static int n_nodes_ = 16;
+static int rest_port_ = 9797;
+static double duration_ = 2.0;
+static int pdo_rate_ = 1000;
+static int keep_files_ = 0;
+static FILE* output_;
+
+static char bin_dir_[256];
+static char tmp_dir_[64];
+static char iface_[256];
+static struct sock bus_;
+
+static pid_t bridge_pid_ = -1;
+static pid_t vnode_pid_ = -1;
+static pid_t master_pid_ = -1;
+
+static inline int print_usage(FILE* output, int status)
+{
+	fprintf(output, "%s", usage_);
+	return status;
+}
+
+static uint64_t now_us(void)
+{
+	return gettime_us(CLOCK_MONOTONIC);
+}
+
+static void report(const char* scenario, const char* metric, double value,
+		   const char* unit)
+{
+	fprintf(output_, "{ \"scenario\": \"%s\", \"metric\": \"%s\", "
+		"\"value\": %.3f, \"unit\": \"%s\", \"nodes\": %d }\n",
+		scenario, metric, value, unit, n_nodes_);
+	fflush(output_);
+}
+
+static void report_skipped(const char* scenario, const char* reason)
+{
+	fprintf(output_, "{ \"scenario\": \"%s\", \"skipped\": \"%s\", "
+		"\"nodes\": %d }\n", scenario, reason, n_nodes_);
+	fflush(output_);
+}
+
+static unsigned int parse_scenarios(const char* str)
+{
+	unsigned int scenarios = 0;
+	char* copy = strdup(str);
+	char* saveptr = NULL;
+
+	for (char* name = strtok_r(copy, ",", &saveptr); name;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		int i;
+		for (i = 0; scenario_name_[i]; ++i)
+			if (strcmp(name, scenario_name_[i]) == 0)
+				break;
+
+		if (!scenario_name_[i]) {
+			fprintf(stderr, "Unknown scenario: %s\n", name);
+			scenarios = 0;
+			break;
+		}
+
+		scenarios |= 1 << i;
+	}
+
+	free(copy);
+	return scenarios;
+}
+
+static int find_bin_dir(void)
+{
+	ssize_t len = readlink("/proc/self/exe", bin_dir_, sizeof(bin_dir_) - 1);
+	if (len < 0)
+		return -1;
+
+	bin_dir_[len] = '\0';
+
+	char* slash = strrchr(bin_dir_, '/');
+	if (!slash)
+		return -1;
+
+	*slash = '\0';
+	return 0;
+}
+
+/* Processes */
+
+static pid_t spawn(const char* log_name, char* const argv[])
+{
+	char log_path[128];
+	snprintf(log_path, sizeof(log_path), "%s/%s", tmp_dir_, log_name);
+
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+
+	int fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0) {
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+
+	execv(argv[0], argv);
+	perror(argv[0]);
+	_exit(127);
+}
+
+static void terminate(pid_t* pid)
+{
+	if (*pid < 0)
+		return;
+
+	kill(*pid, SIGTERM);
+
+	for (int i = 0; i < 200; ++i) {
+		if (waitpid(*pid, NULL, WNOHANG) != 0)
+			goto done;
+
+		usleep(10000);
+	}
+
+	kill(*pid, SIGKILL);
+	waitpid(*pid, NULL, 0);
+done:
+	*pid = -1;
+}
+
+static int is_alive(pid_t pid)
+{
+	return pid >= 0 && waitpid(pid, NULL, WNOHANG) == 0;
+}
+
+static const char* bin_path(const char* name)
+{
+	static char path[300];
+	snprintf(path, sizeof(path), "%s/%s", bin_dir_, name);
+	return path;
+}
+
+static int start_bridge(void)
+{
+	char bridge[300];
+	char listen[128];
+
+	snprintf(iface_, sizeof(iface_), "unix:@canopen-bench-%d", getpid());
+	snprintf(listen, sizeof(listen), "--listen=%s", iface_);
+	strcpy(bridge, bin_path("canbridge"));
+
+	char* argv[] = { bridge, listen, NULL };
+	bridge_pid_ = spawn("canbridge.log", argv);
+	if (bridge_pid_ < 0)
+		return -1;
+
+	/* Wait for the listening socket */
+	for (int i = 0; i < 200; ++i) {
+		if (sock_open(&bus_, SOCK_TYPE_CAN, iface_, NULL) >= 0)
+			return 0;
+
+		if (!is_alive(bridge_pid_))
+			break;
+
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+static int write_vnode_config(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return -1;
+
+	fprintf(file,
+		"[device]\n"
+		"heartbeat=yes\n"
+		"bootup=standard\n\n"
+		"[1000sub0]\ntype=UNSIGNED32\nvalue=0x191\n\n"
+		"[1008sub0]\ntype=VISIBLE_STRING\nvalue=canopen-bench\n\n"
+		"[1018sub0]\ntype=UNSIGNED8\nvalue=4\n\n"
+		"[1018sub1]\ntype=UNSIGNED32\nvalue=0\n\n"
+		"[1018sub2]\ntype=UNSIGNED32\nvalue=0\n\n"
+		"[1018sub3]\ntype=UNSIGNED32\nvalue=0\n\n"
+		"[1018sub4]\ntype=UNSIGNED32\nvalue=0\n\n"
+		"[tpdo1]\nsync=1\nlength=8\ncounter=yes\n\n"
+		"[tpdo2]\nrpdo=1\n\n");
+
+	for (int i = 1; i <= N_EXPEDITED_OBJECTS; ++i)
+		fprintf(file, "[2000sub%x]\ntype=UNSIGNED32\nvalue=%d\n"
+			"access=rw\n\n", i, i);
+
+	char text[SEGMENTED_SIZE + 1];
+	memset(text, 'x', SEGMENTED_SIZE);
+	text[SEGMENTED_SIZE] = '\0';
+
+	for (int i = 0; i < N_SEGMENTED_OBJECTS; ++i)
+		fprintf(file, "[%xsub0]\ntype=VISIBLE_STRING\nvalue=%s\n\n",
+			0x2100 + i, text);
+
+	return fclose(file);
+}
+
+static int start_vnodes(void)
+{
+	char vnode[300];
+	char config[128];
+	char range[16];
+
+	snprintf(config, sizeof(config), "%s/vnode.ini", tmp_dir_);
+	if (write_vnode_config(config) < 0)
+		return -1;
+
+	snprintf(range, sizeof(range), "1-%d", n_nodes_);
+	strcpy(vnode, bin_path("canopen-vnode"));
+
+	char* argv[] = { vnode, "-c", config, iface_, range, NULL };
+	vnode_pid_ = spawn("canopen-vnode.log", argv);
+	return vnode_pid_ < 0 ? -1 : 0;
+}
+
+static int start_master(void)
+{
+	char master[300];
+	char port[16];
+
+	snprintf(port, sizeof(port), "%d", rest_port_);
+	strcpy(master, bin_path("canopen-master"));
+
+	char* argv[] = { master, "-R", port, iface_, NULL };
+	master_pid_ = spawn("canopen-master.log", argv);
+	return master_pid_ < 0 ? -1 : 0;
+}
+
+static void remove_files(void)
+{
+	static const char* file[] = {
+		"vnode.ini", "canbridge.log", "canopen-vnode.log",
+		"canopen-master.log", NULL
+	};
+
+	char path[128];
+
+	for (int i = 0; file[i]; ++i) {
+		snprintf(path, sizeof(path), "%s/%s", tmp_dir_, file[i]);
+		unlink(path);
+	}
+
+	rmdir(tmp_dir_);
+}
+
+/* Bus */
+
+static ssize_t recv_frames(struct can_frame* cf, size_t n, int timeout_us)
+{
+	if (timeout_us > 0) {
+		int rc = sock_timed_recv(&bus_, cf, timeout_us / 1000);
+		return rc < 0 ? -1 : 1;
+	}
+
+	return sock_recv_batch(&bus_, cf, NULL, n, MSG_DONTWAIT);
+}
+
+static void drain_bus(void)
+{
+	struct can_frame cf[64];
+
+	while (recv_frames(cf, 64, 0) > 0)
+		;
+}
+
+static void send_frame(uint32_t cob_id, const void* data, size_t size)
+{
+	struct can_frame cf = { .can_id = cob_id, .can_dlc = size };
+	memcpy(cf.data, data, size);
+	sock_send(&bus_, &cf, 0);
+}
+
+static void send_nmt(enum nmt_cs cs, int nodeid)
+{
+	uint8_t data[2] = { cs, nodeid };
+	send_frame(R_NMT, data, sizeof(data));
+}
+
+/* Node ids that have been seen in frames matching a condition */
+struct node_set {
+	uint8_t is_set[CANOPEN_NODEID_MAX + 1];
+	int count;
+};
+
+static void node_set_add(struct node_set* set, int nodeid)
+{
+	if (nodeid < CANOPEN_NODEID_MIN || nodeid > n_nodes_)
+		return;
+
+	if (!set->is_set[nodeid]) {
+		set->is_set[nodeid] = 1;
+		++set->count;
+	}
+}
+
+static int wait_for_bootups(uint64_t timeout)
+{
+	struct node_set set = { 0 };
+	uint64_t deadline = now_us() + timeout;
+
+	while (set.count < n_nodes_ && now_us() < deadline) {
+		struct can_frame cf;
+		if (recv_frames(&cf, 1, 10000) <= 0)
+			continue;
+
+		if ((cf.can_id & ~0x7f) == R_HEARTBEAT && cf.can_dlc == 1
+		 && heartbeat_is_bootup(&cf))
+			node_set_add(&set, cf.can_id & 0x7f);
+	}
+
+	return set.count == n_nodes_ ? 0 : -1;
+}
+
+/* The master ends the setup of a node with either a start or, if it has no
+ * driver for it, a stop command.
+ */
+static int wait_for_setup(uint64_t timeout)
+{
+	struct node_set set = { 0 };
+	uint64_t deadline = now_us() + timeout;
+
+	while (set.count < n_nodes_ && now_us() < deadline) {
+		struct can_frame cf;
+		if (recv_frames(&cf, 1, 10000) <= 0)
+			continue;
+
+		if (cf.can_id != R_NMT || !nmt_is_valid(&cf))
+			continue;
+
+		enum nmt_cs cs = nmt_get_cs(&cf);
+		if (cs == NMT_CS_START || cs == NMT_CS_STOP)
+			node_set_add(&set, nmt_get_nodeid(&cf));
+	}
+
+	return set.count == n_nodes_ ? 0 : -1;
+}
+
+/* HTTP */
+
+static int http_connect(struct http_conn* conn)
+{
+	memset(conn, 0, sizeof(*conn));
+
+	conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (conn->fd < 0)
+		return -1;
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(rest_port_),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+	};
+
+	if (connect(conn->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(conn->fd);
+		return -1;
+	}
+
+	int one = 1;
+	setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	return 0;
+}
+
+static void http_close(struct http_conn* conn)
+{
+	close(conn->fd);
+	free(conn->buffer);
+}
+
+static int http__fill(struct http_conn* conn, size_t size)
+{
+	if (conn->size < size) {
+		size_t new_size = size < 4096 ? 4096 : size * 2;
+		char* buffer = realloc(conn->buffer, new_size + 1);
+		if (!buffer)
+			return -1;
+
+		conn->buffer = buffer;
+		conn->size = new_size;
+	}
+
+	while (conn->length < size) {
+		ssize_t rc = read(conn->fd, conn->buffer + conn->length,
+				  conn->size - conn->length);
+		if (rc <= 0)
+			return -1;
+
+		conn->length += rc;
+	}
+
+	conn->buffer[conn->length] = '\0';
+	return 0;
+}
+
+static char* http__find_header_end(struct http_conn* conn)
+{
+	while (1) {
+		char* end = conn->length
+			  ? strstr(conn->buffer, "\r\n\r\n") : NULL;
+		if (end)
+			return end + 4;
+
+		if (http__fill(conn, conn->length + 1) < 0)
+			return NULL;
+	}
+}
+
+/* Sends a request and waits for the whole reply. The body of the reply is
+ * copied into *body if that is not NULL and must then be freed.
+ */
+static int http_request(struct http_conn* conn, const char* method,
+			const char* path, const char* content,
+			size_t content_length, char** body, size_t* body_length)
+{
+	char head[256];
+	int head_length = snprintf(head, sizeof(head),
+				   "%s %s HTTP/1.1\r\n"
+				   "Host: localhost\r\n"
+				   "Content-Length: %zu\r\n\r\n",
+				   method, path, content_length);
+
+	if (write(conn->fd, head, head_length) != head_length)
+		return -1;
+
+	if (content_length
+	 && write(conn->fd, content, content_length) != (ssize_t)content_length)
+		return -1;
+
+	char* header_end = http__find_header_end(conn);
+	if (!header_end)
+		return -1;
+
+	int status = atoi(conn->buffer + strlen("HTTP/1.1 "));
+
+	size_t length = 0;
+	for (char* line = strstr(conn->buffer, "\r\n"); line && line < header_end;
+	     line = strstr(line + 2, "\r\n"))
+		if (strncasecmp(line + 2, "content-length:", 15) == 0)
+			length = strtoul(line + 2 + 15, NULL, 10);
+
+	size_t head_size = header_end - conn->buffer;
+	if (http__fill(conn, head_size + length) < 0)
+		return -1;
+
+	if (body) {
+		*body = malloc(length + 1);
+		if (!*body)
+			return -1;
+
+		memcpy(*body, conn->buffer + head_size, length);
+		(*body)[length] = '\0';
+		*body_length = length;
+	}
+
+	conn->length -= head_size + length;
+	memmove(conn->buffer, conn->buffer + head_size + length, conn->length);
+	conn->buffer[conn->length] = '\0';
+
+	return status;
+}
+
+static int wait_for_rest(uint64_t timeout)
+{
+	uint64_t deadline = now_us() + timeout;
+
+	while (now_us() < deadline) {
+		struct http_conn conn;
+		if (http_connect(&conn) == 0) {
+			http_close(&conn);
+			return 0;
+		}
+
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+static int count_occurrences(const char* str, const char* pattern)
+{
+	int count = 0;
+
+	while ((str = strstr(str, pattern))) {
+		++count;
+		str += strlen(pattern);
+	}
+
+	return count;
+}
+
+/* Scenarios */
+
+static void run_bootup(unsigned int scenarios)
+{
+	uint64_t start = now_us();
+
+	if (start_master() < 0 || wait_for_setup(BOOTUP_TIMEOUT) < 0) {
+		report_skipped("bootup", "not all nodes were set up");
+		return;
+	}
+
+	uint64_t stop = now_us();
+
+	if (scenarios & SCENARIO_BOOTUP)
+		report("bootup", "time", (stop - start) / 1e3, "ms");
+}
+
+/* Runs bulk uploads of the nodes first to last for the configured time and
+ * returns the rate of successful uploads.
+ */
+static double run_bulk_uploads(const char* scenario, int first, int last,
+			       int index, int n_indices, int subindex,
+			       int n_subindices)
+{
+	char* content = malloc(BULK_ITEMS_MAX * 32);
+	if (!content)
+		return -1.0;
+
+	size_t length = 0;
+	int n_items = 0;
+
+	for (int node = first; node <= last; ++node)
+		for (int i = 0; i < n_indices; ++i)
+			for (int j = 0; j < n_subindices; ++j) {
+				if (n_items == BULK_ITEMS_MAX)
+					goto done;
+
+				length += sprintf(content + length,
+						  "%d %x %d %s\n", node,
+						  index + i, subindex + j,
+						  subindex ? "UNSIGNED32"
+							   : "VISIBLE_STRING");
+				++n_items;
+			}
+done:;
+
+	struct http_conn conn;
+	if (http_connect(&conn) < 0) {
+		free(content);
+		return -1.0;
+	}
+
+	uint64_t n_ok = 0, n_failed = 0;
+	uint64_t start = now_us();
+	uint64_t end = start + duration_ * 1e6;
+	uint64_t now = start;
+
+	while (now < end) {
+		char* body = NULL;
+		size_t body_length = 0;
+
+		int status = http_request(&conn, "PUT", "/sdo", content, length,
+					  &body, &body_length);
+		if (status != 200) {
+			free(body);
+			break;
+		}
+
+		int ok = count_occurrences(body, "\"value\"");
+		n_ok += ok;
+		n_failed += n_items - ok;
+		free(body);
+
+		now = now_us();
+	}
+
+	http_close(&conn);
+	free(content);
+
+	if (n_ok + n_failed == 0)
+		return -1.0;
+
+	if (n_failed)
+		report(scenario, "failed", n_failed, "requests");
+
+	return n_ok / ((now - start) / 1e6);
+}
+
+static int bulk_nodes(int n_per_node)
+{
+	int n = BULK_ITEMS_MAX / n_per_node;
+	return n < n_nodes_ ? n : n_nodes_;
+}
+
+static void run_sdo(void)
+{
+	int n = N_EXPEDITED_OBJECTS;
+
+	double rate = run_bulk_uploads("sdo", 1, 1, 0x2000, 1, 1, n);
+	if (rate < 0.0) {
+		report_skipped("sdo", "bulk request failed");
+		return;
+	}
+
+	report("sdo", "node-rate", rate, "1/s");
+
+	rate = run_bulk_uploads("sdo", 1, bulk_nodes(n), 0x2000, 1, 1, n);
+	if (rate >= 0.0)
+		report("sdo", "aggregate-rate", rate, "1/s");
+}
+
+static void run_segmented(void)
+{
+	int n = N_SEGMENTED_OBJECTS;
+
+	double rate = run_bulk_uploads("segmented", 1, 1, 0x2100, n, 0, 1);
+	if (rate < 0.0) {
+		report_skipped("segmented", "bulk request failed");
+		return;
+	}
+
+	report("segmented", "node-rate", rate, "1/s");
+	report("segmented", "node-throughput", rate * SEGMENTED_SIZE, "B/s");
+
+	rate = run_bulk_uploads("segmented", 1, bulk_nodes(n), 0x2100, n, 0, 1);
+	if (rate < 0.0)
+		return;
+
+	report("segmented", "aggregate-rate", rate, "1/s");
+	report("segmented", "aggregate-throughput", rate * SEGMENTED_SIZE,
+	       "B/s");
+}
+
+/* Sum of the TPDO1 frames that the master has received from all nodes */
+static int64_t get_tpdo1_count(void)
+{
+	struct http_conn conn;
+	if (http_connect(&conn) < 0)
+		return -1;
+
+	char* body = NULL;
+	size_t length = 0;
+	int status = http_request(&conn, "GET", "/stats", NULL, 0, &body,
+				  &length);
+	http_close(&conn);
+
+	if (status != 200) {
+		free(body);
+		return -1;
+	}
+
+	static const char pattern[] = "\"TPDO1\": { \"count\": ";
+	int64_t count = 0;
+
+	for (const char* p = strstr(body, pattern); p;
+	     p = strstr(p + 1, pattern))
+		count += strtoull(p + strlen(pattern), NULL, 10);
+
+	free(body);
+	return count;
+}
+
+static void run_pdo(void)
+{
+	int64_t before = get_tpdo1_count();
+	if (before < 0) {
+		report_skipped("pdo", "could not get stats");
+		return;
+	}
+
+	uint64_t period = 1000000 / pdo_rate_;
+	uint64_t start = now_us();
+	uint64_t end = start + duration_ * 1e6;
+	uint64_t n_syncs = 0;
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (now_us() < end) {
+		send_frame(R_SYNC, NULL, 0);
+		++n_syncs;
+		drain_bus();
+
+		add_to_timespec(&next, period * 1000);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	double elapsed = (now_us() - start) / 1e6;
+
+	/* Let the master catch up */
+	usleep(200000);
+	drain_bus();
+
+	int64_t after = get_tpdo1_count();
+	if (after < 0) {
+		report_skipped("pdo", "could not get stats");
+		return;
+	}
+
+	double expected = (double)n_syncs * n_nodes_;
+	double received = after - before;
+
+	report("pdo", "offered-rate", expected / elapsed, "1/s");
+	report("pdo", "rate", received / elapsed, "1/s");
+	report("pdo", "loss", expected > 0 ? 1.0 - received / expected : 0.0,
+	       "ratio");
+}
+
+static int cmp_u64(const void* p1, const void* p2)
+{
+	uint64_t v1 = *(const uint64_t*)p1;
+	uint64_t v2 = *(const uint64_t*)p2;
+	return (v1 > v2) - (v1 < v2);
+}
+
+/* Each node echoes RPDO 1 in TPDO 2 */
+static void run_latency(void)
+{
+	uint64_t sample[N_LATENCY_SAMPLES];
+	int n_samples = 0, n_lost = 0;
+
+	drain_bus();
+
+	for (uint32_t seq = 0; seq < N_LATENCY_SAMPLES; ++seq) {
+		int nodeid = 1 + seq % n_nodes_;
+		uint8_t data[8] = { 0 };
+		memcpy(data, &seq, sizeof(seq));
+
+		uint64_t start = now_us();
+		uint64_t deadline = start + LATENCY_TIMEOUT;
+		send_frame(R_RPDO1 + nodeid, data, sizeof(data));
+
+		while (1) {
+			uint64_t now = now_us();
+			if (now >= deadline) {
+				++n_lost;
+				break;
+			}
+
+			struct can_frame cf;
+			if (recv_frames(&cf, 1, deadline - now) <= 0)
+				continue;
+
+			if (cf.can_id != (canid_t)(R_TPDO2 + nodeid)
+			 || memcmp(cf.data, &seq, sizeof(seq)) != 0)
+				continue;
+
+			sample[n_samples++] = now_us() - start;
+			break;
+		}
+	}
+
+	if (n_samples == 0) {
+		report_skipped("latency", "no PDO was echoed");
+		return;
+	}
+
+	qsort(sample, n_samples, sizeof(sample[0]), cmp_u64);
+
+	uint64_t sum = 0;
+	for (int i = 0; i < n_samples; ++i)
+		sum += sample[i];
+
+	report("latency", "mean", (double)sum / n_samples, "us");
+	report("latency", "p50", sample[n_samples / 2], "us");
+	report("latency", "p99", sample[n_samples * 99 / 100], "us");
+	report("latency", "max", sample[n_samples - 1], "us");
+	report("latency", "lost", n_lost, "frames");
+}
+
+struct rest_load {
+	pthread_t thread;
+	uint64_t end;
+	uint64_t count;
+	int is_failed;
+};
+
+static void* rest_load_main(void* arg)
+{
+	struct rest_load* load = arg;
+	struct http_conn conn;
+
+	if (http_connect(&conn) < 0) {
+		load->is_failed = 1;
+		return NULL;
+	}
+
+	while (now_us() < load->end) {
+		if (http_request(&conn, "GET", "/stats/1", NULL, 0, NULL,
+				 NULL) != 200) {
+			load->is_failed = 1;
+			break;
+		}
+
+		++load->count;
+	}
+
+	http_close(&conn);
+	return NULL;
+}
+
+static void run_rest(void)
+{
+	struct rest_load load[N_REST_CONNECTIONS];
+	uint64_t start = now_us();
+
+	for (int i = 0; i < N_REST_CONNECTIONS; ++i) {
+		memset(&load[i], 0, sizeof(load[i]));
+		load[i].end = start + duration_ * 1e6;
+		pthread_create(&load[i].thread, NULL, rest_load_main, &load[i]);
+	}
+
+	uint64_t count = 0;
+	int is_failed = 0;
+
+	for (int i = 0; i < N_REST_CONNECTIONS; ++i) {
+		pthread_join(load[i].thread, NULL);
+		count += load[i].count;
+		is_failed |= load[i].is_failed;
+	}
+
+	double elapsed = (now_us() - start) / 1e6;
+
+	if (is_failed)
+		report_skipped("rest", "request failed");
+	else
+		report("rest", "rate", count / elapsed, "1/s");
+}
+
+static void run_eds(void)
+{
+	struct http_conn conn;
+	if (http_connect(&conn) < 0) {
+		report_skipped("eds", "could not connect");
+		return;
+	}
+
+	uint64_t total = 0;
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < N_EDS_DUMPS; ++i) {
+		char* body = NULL;
+		uint64_t start = now_us();
+
+		int status = http_request(&conn, "GET", "/sdo/1", NULL, 0,
+					  &body, &size);
+		total += now_us() - start;
+		free(body);
+
+		if (status != 200)
+			break;
+	}
+
+	http_close(&conn);
+
+	if (i < N_EDS_DUMPS) {
+		report_skipped("eds", "no EDS for the nodes");
+		return;
+	}
+
+	report("eds", "time", total / 1e3 / N_EDS_DUMPS, "ms");
+	report("eds", "size", size, "B");
+}
+
+static int run(unsigned int scenarios, const char* iface)
+{
+	if (iface) {
+		strncpy(iface_, iface, sizeof(iface_) - 1);
+		if (sock_open(&bus_, SOCK_TYPE_CAN, iface_, NULL) < 0) {
+			perror("Could not open the bus");
+			return -1;
+		}
+	} else if (start_bridge() < 0) {
+		fprintf(stderr, "Could not start canbridge\n");
+		return -1;
+	}
+
+	if (start_vnodes() < 0 || wait_for_bootups(5000000) < 0) {
+		fprintf(stderr, "Could not start the virtual nodes\n");
+		return -1;
+	}
+
+	run_bootup(scenarios);
+
+	if (wait_for_rest(5000000) < 0) {
+		fprintf(stderr, "The master did not start\n");
+		return -1;
+	}
+
+	/* The master stops nodes that it has no driver for */
+	send_nmt(NMT_CS_START, 0);
+	usleep(100000);
+	drain_bus();
+
+	if (scenarios & SCENARIO_SDO)
+		run_sdo();
+
+	if (scenarios & SCENARIO_SEGMENTED)
+		run_segmented();
+
+	if (scenarios & SCENARIO_PDO)
+		run_pdo();
+
+	if (scenarios & SCENARIO_LATENCY)
+		run_latency();
+
+	if (scenarios & SCENARIO_REST)
+		run_rest();
+
+	if (scenarios & SCENARIO_EDS)
+		run_eds();
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	static const struct option long_options[] = {
+		{ "help",      no_argument,       0, 'h' },
+		{ "nodes",     required_argument, 0, 'n' },
+		{ "interface", required_argument, 0, 'i' },
+		{ "rest-port", required_argument, 0, 'R' },
+		{ "time",      required_argument, 0, 't' },
+		{ "pdo-rate",  required_argument, 0, 'r' },
+		{ "scenarios", required_argument, 0, 's' },
+		{ "output",    required_argument, 0, 'o' },
+		{ "keep",      no_argument,       0, 'k' },
+		{ 0, 0, 0, 0 }
+	};
+
+	const char* iface = NULL;
+	const char* output = NULL;
+	unsigned int scenarios = SCENARIO_ALL;
+
+	while (1) {
+		int c = getopt_long(argc, argv, "hn:i:R:t:r:s:o:k", long_options,
+				    NULL);
+		if (c < 0)
+			break;
+
+		switch (c) {
+		case 'h': return print_usage(stdout, 0);
+		case 'n': n_nodes_ = atoi(optarg); break;
+		case 'i': iface = optarg; break;
+		case 'R': rest_port_ = atoi(optarg); break;
+		case 't': duration_ = atof(optarg); break;
+		case 'r': pdo_rate_ = atoi(optarg); break;
+		case 's': scenarios = parse_scenarios(optarg); break;
+		case 'o': output = optarg; break;
+		case 'k': keep_files_ = 1; break;
+		default: return print_usage(stderr, 1);
+		}
+	}
+
+	if (optind != argc || scenarios == 0 || pdo_rate_ <= 0
+	 || n_nodes_ < CANOPEN_NODEID_MIN || n_nodes_ > CANOPEN_NODEID_MAX)
+		return print_usage(stderr, 1);
+
+	output_ = output ? fopen(output, "w") : stdout;
+	if (!output_) {
+		perror("Could not open output file");
+		return 1;
+	}
+
+	if (find_bin_dir() < 0) {
+		perror("Could not find the binaries");
+		return 1;
+	}
+
+	strcpy(tmp_dir_, "/tmp/canopen-bench.XXXXXX");
+	if (!mkdtemp(tmp_dir_)) {
+		perror("Could not create temporary directory");
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int rc = run(scenarios, iface);
+
+	terminate(&master_pid_);
+	terminate(&vnode_pid_);
+	terminate(&bridge_pid_);
+
+	if (keep_files_ || rc < 0)
+		fprintf(stderr, "Logs are in %s\n", tmp_dir_);
+	else
+		remove_files();
+
+	if (output)
+		fclose(output_);
+
+	return rc < 0 ? 1 : 0;
+}
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <time.h>
 #include <mloop.h>
 
 #include "canopen/dump.h"
@@ -29,16 +30,35 @@ const char usage_[] =
 "    -u, --time                 Show time of arrival.\n"
 "    -T, --tcp                  Connect via TCP.\n"
 "    -f, --file                 Dump from trace buffer file.\n"
+"    -r, --recover              Dump from the trace_buffer_file of a master\n"
+"                               that is no longer running.\n"
 "    -n, --nmt                  Show NMT.\n"
 "    -S, --sync                 Show SYNC.\n"
 "    -e, --emcy                 Show EMCY.\n"
 "    -p, --pdo[=mask]           Show PDO.\n"
 "    -s, --sdo                  Show SDO.\n"
 "    -H, --heartbeat            Show heartbeat.\n"
+"        --from=time            Skip file frames before time.\n"
+"        --to=time              Skip file frames after time.\n"
+"        --node=id              Only show file frames of a node.\n"
+"        --stats[=ms]           Print a summary of the traffic every ms\n"
+"                               milliseconds (default 1000) instead of frames.\n"
+"        --bitrate=bps          Bit rate for the bus load in --stats\n"
+"                               (default 500000).\n"
+"        --format=name          Write the frames in another format instead\n"
+"                               of decoding them: pcapng, candump or raw.\n"
+"\n"
+"Files may also be pcapng, pcap or candump -l logs.\n"
+"\n"
+"Times are either seconds since the epoch or local time in the form\n"
+"\"YYYY-MM-DD HH:MM:SS\", both with optional fractions of a second.\n"
 "\n"
 "Examples:\n"
 "    $ canopen-dump can0\n"
 "    $ canopen-dump -T 127.0.0.1\n"
+"    $ canopen-dump -f --from=\"2018-03-01 12:00:00\" --to=\"2018-03-01 12:00:10\" \\\n"
+"          --node=5 /var/log/canopen/stream-180301-080000.000000.trace\n"
+"    $ canopen-dump --format=pcapng can0 > can0.pcapng\n"
 "\n";
 
 static inline int print_usage(FILE* output, int status)
@@ -54,6 +74,41 @@ unsigned int apply_pdo_option(const char* arg)
 	     : CO_DUMP_FILTER_PDO;
 }
 
+/* Returns microseconds since the epoch or 0 if the time cannot be parsed */
+static uint64_t parse_time(const char* str)
+{
+	char* end = NULL;
+	double fraction = 0.0;
+	time_t t;
+
+	double seconds = strtod(str, &end);
+	if (end != str && *end == '\0')
+		return seconds > 0.0 ? (uint64_t)(seconds * 1e6) : 0;
+
+	struct tm tm = { .tm_isdst = -1 };
+	end = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+	if (!end)
+		end = strptime(str, "%Y-%m-%dT%H:%M:%S", &tm);
+
+	if (!end)
+		return 0;
+
+	if (*end == '.') {
+		char* frac_end = NULL;
+		fraction = strtod(end, &frac_end);
+		end = frac_end;
+	}
+
+	if (*end != '\0')
+		return 0;
+
+	t = mktime(&tm);
+	if (t < 0)
+		return 0;
+
+	return t * 1000000ULL + (uint64_t)(fraction * 1e6);
+}
+
 int main(int argc, char* argv[])
 {
 	static const struct option long_options[] = {
@@ -61,19 +116,29 @@ int main(int argc, char* argv[])
 		{ "time",      no_argument,       0, 'u' },
 		{ "tcp",       no_argument,       0, 'T' },
 		{ "file",      no_argument,       0, 'f' },
+		{ "recover",   no_argument,       0, 'r' },
 		{ "nmt",       no_argument,       0, 'n' },
 		{ "sync",      no_argument,       0, 'S' },
 		{ "emcy",      no_argument,       0, 'e' },
 		{ "pdo",       optional_argument, 0, 'p' },
 		{ "sdo",       no_argument,       0, 's' },
 		{ "heartbeat", no_argument,       0, 'H' },
+		{ "from",      required_argument, 0, 'F' },
+		{ "to",        required_argument, 0, 't' },
+		{ "node",      required_argument, 0, 'N' },
+		{ "stats",     optional_argument, 0, 'A' },
+		{ "bitrate",   required_argument, 0, 'B' },
+		{ "format",    required_argument, 0, 'O' },
 		{ 0, 0, 0, 0 }
 	};
 
 	enum co_dump_options opt = 0;
+	struct co_dump_range range = { .nodeid = -1 };
+	int has_range = 0;
+	unsigned int stats_interval = 0, bitrate = 0;
 
 	while (1) {
-		int c = getopt_long(argc, argv, "huTfnSepsiH", long_options, NULL);
+		int c = getopt_long(argc, argv, "huTfrnSepsiH", long_options, NULL);
 		if (c < 0)
 			break;
 
@@ -82,12 +147,44 @@ int main(int argc, char* argv[])
 		case 'u': opt |= CO_DUMP_TIMESTAMP; break;
 		case 'T': opt |= CO_DUMP_TCP; break;
 		case 'f': opt |= CO_DUMP_FILE; break;
+		case 'r': opt |= CO_DUMP_RECOVER; break;
 		case 'n': opt |= CO_DUMP_FILTER_NMT; break;
 		case 'S': opt |= CO_DUMP_FILTER_SYNC; break;
 		case 'e': opt |= CO_DUMP_FILTER_EMCY; break;
 		case 'p': opt |= apply_pdo_option(optarg); break;
 		case 's': opt |= CO_DUMP_FILTER_SDO; break;
 		case 'H': opt |= CO_DUMP_FILTER_HEARTBEAT; break;
+		case 'F':
+			range.from = parse_time(optarg);
+			if (!range.from)
+				return print_usage(stderr, 1);
+			has_range = 1;
+			break;
+		case 't':
+			range.to = parse_time(optarg);
+			if (!range.to)
+				return print_usage(stderr, 1);
+			has_range = 1;
+			break;
+		case 'N':
+			range.nodeid = strtol(optarg, NULL, 0);
+			if (range.nodeid < 0 || range.nodeid > 127)
+				return print_usage(stderr, 1);
+			has_range = 1;
+			break;
+		case 'A':
+			opt |= CO_DUMP_STATS;
+			stats_interval = optarg ? strtoul(optarg, NULL, 0) : 0;
+			break;
+		case 'B':
+			bitrate = strtoul(optarg, NULL, 0);
+			if (!bitrate)
+				return print_usage(stderr, 1);
+			break;
+		case 'O':
+			if (co_dump_set_output_format(optarg) < 0)
+				return print_usage(stderr, 1);
+			break;
 		default: return print_usage(stderr, 1);
 		}
 	}
@@ -100,7 +197,14 @@ int main(int argc, char* argv[])
 
 	const char* iface = args[0];
 
-	setvbuf(stdout, NULL, _IOLBF, 0);
+	co_dump_set_stats_params(stats_interval, bitrate);
+
+	if (has_range) {
+		if (!(opt & (CO_DUMP_FILE | CO_DUMP_RECOVER)))
+			return print_usage(stderr, 1);
+
+		return co_dump_file(iface, opt, &range);
+	}
 
 	return co_dump(iface, opt);
 }
@@ -0,0 +1,78 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "canopen/eds.h"
+
+const char usage_[] =
+"Usage: canopen-eds-compile [options]\n"
+"\n"
+"Compiles a directory of EDS files into an image that the master can map\n"
+"instead of parsing the files when it starts.\n"
+"\n"
+"Options:\n"
+"    -h, --help                 Get help.\n"
+"    -d, --directory            Set the EDS directory.\n"
+"    -o, --output               Set the path of the image.\n"
+"\n"
+"Examples:\n"
+"    $ canopen-eds-compile\n"
+"    $ canopen-eds-compile -d eds.d -o eds.db\n"
+"\n";
+
+static inline int print_usage(FILE* output, int status)
+{
+	fprintf(output, "%s", usage_);
+	return status;
+}
+
+int main(int argc, char* argv[])
+{
+	static const struct option long_options[] = {
+		{ "help",      no_argument,       0, 'h' },
+		{ "directory", required_argument, 0, 'd' },
+		{ "output",    required_argument, 0, 'o' },
+		{ 0, 0, 0, 0 }
+	};
+
+	const char* dir = eds_db_get_path();
+	const char* output = eds_db_get_image_path();
+
+	while (1) {
+		int c = getopt_long(argc, argv, "hd:o:", long_options, NULL);
+		if (c < 0)
+			break;
+
+		switch (c) {
+		case 'h': return print_usage(stdout, 0);
+		case 'd': dir = optarg; break;
+		case 'o': output = optarg; break;
+		default: return print_usage(stderr, 1);
+		}
+	}
+
+	if (optind != argc)
+		return print_usage(stderr, 1);
+
+	if (eds_db_compile(dir, output) < 0) {
+		fprintf(stderr, "Failed to compile %s into %s\n", dir, output);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "canopen/network.h"
+
+const char usage_[] =
+"Usage: canopen-ls [options] <interface>\n"
+"\n"
+"Lists the nodes on the bus along with their identities. All node ids are\n"
+"probed at once, so a scan takes about one timeout.\n"
+"\n"
+"Do not scan a bus that a master is running on; its SDO clients would see\n"
+"the answers.\n"
+"\n"
+"Options:\n"
+"    -h, --help                 Get help.\n"
+"    -T, --tcp                  Connect via TCP.\n"
+"    -t, --timeout=ms           Time to wait for each answer (default 100).\n"
+"    -r, --range=first-last     Only scan these node ids.\n"
+"\n"
+"Examples:\n"
+"    $ canopen-ls can0\n"
+"    $ canopen-ls -r 1-16 -t 50 can0\n"
+"    $ canopen-ls -T 127.0.0.1\n"
+"\n";
+
+static struct co_net_scan scan_;
+
+static inline int print_usage(FILE* output, int status)
+{
+	fprintf(output, "%s", usage_);
+	return status;
+}
+
+/* "<first>-<last>" */
+static int parse_range(const char* str, int* first, int* last)
+{
+	char* end = NULL;
+
+	*first = strtol(str, &end, 10);
+	if (end == str || *end != '-')
+		return -1;
+
+	str = end + 1;
+	*last = strtol(str, &end, 10);
+	if (end == str || *end != '\0')
+		return -1;
+
+	if (*first < CANOPEN_NODEID_MIN || *last > CANOPEN_NODEID_MAX
+	 || *first > *last)
+		return -1;
+
+	return 0;
+}
+
+static void print_nodes(const struct co_net_scan* scan)
+{
+	printf("ID\tNAME\tTYPE\tVENDOR\tPRODUCT\tREVISION\tSERIAL\tHWVER\tSWVER\n");
+
+	for (int i = scan->start; i <= scan->end; ++i) {
+		const struct co_net_node_info* node = &scan->node[i];
+		if (!node->is_present)
+			continue;
+
+		printf("%d\t%s\t0x%08x\t0x%08x\t0x%08x\t0x%08x\t0x%08x\t%s\t%s\n",
+		       i, node->name, node->device_type, node->vendor_id,
+		       node->product_code, node->revision_number,
+		       node->serial_number, node->hw_version, node->sw_version);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	static const struct option long_options[] = {
+		{ "help",    no_argument,       0, 'h' },
+		{ "tcp",     no_argument,       0, 'T' },
+		{ "timeout", required_argument, 0, 't' },
+		{ "range",   required_argument, 0, 'r' },
+		{ 0, 0, 0, 0 }
+	};
+
+	int use_tcp = 0;
+	int timeout = 100;
+	int first = CANOPEN_NODEID_MIN, last = CANOPEN_NODEID_MAX;
+
+	while (1) {
+		int c = getopt_long(argc, argv, "hTt:r:", long_options, NULL);
+		if (c < 0)
+			break;
+
+		switch (c) {
+		case 'h': return print_usage(stdout, 0);
+		case 'T': use_tcp = 1; break;
+		case 't':
+			timeout = strtol(optarg, NULL, 0);
+			if (timeout <= 0) {
+				fprintf(stderr, "Invalid timeout: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'r':
+			if (parse_range(optarg, &first, &last) < 0) {
+				fprintf(stderr, "Invalid range: %s\n", optarg);
+				return 1;
+			}
+			break;
+		default: return print_usage(stderr, 1);
+		}
+	}
+
+	if (argc - optind != 1)
+		return print_usage(stderr, 1);
+
+	const char* iface = argv[optind];
+
+	enum sock_type type = use_tcp ? SOCK_TYPE_TCP : SOCK_TYPE_CAN;
+
+	if (co_net_scan_bus(type, iface, &scan_, first, last, timeout) < 0) {
+		fprintf(stderr, "Could not scan %s: %s\n", iface,
+			strerror(errno));
+		return 1;
+	}
+
+	print_nodes(&scan_);
+	return 0;
+}
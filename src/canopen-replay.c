@@ -0,0 +1,132 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "canopen/replay.h"
+
+const char usage_[] =
+"Usage: canopen-replay [options] <interface> <trace>\n"
+"\n"
+"Options:\n"
+"    -h, --help                 Get help.\n"
+"    -T, --tcp                  Connect via TCP.\n"
+"    -s, --speed=factor         Play faster or slower than the original\n"
+"                               timing (default 1.0).\n"
+"    -a, --fast                 Send the frames as fast as possible.\n"
+"    -A, --all                  Replay every frame, not only node output.\n"
+"    -o, --output=file          Record the frames received meanwhile.\n"
+"        --format=name          Format of the recording: raw, pcapng or\n"
+"                               candump (default raw).\n"
+"        --linger=ms            Keep recording for ms milliseconds after the\n"
+"                               last frame (default 100).\n"
+"\n"
+"Only TPDOs, SDO responses, heartbeats and EMCYs are replayed, unless --all\n"
+"is given, so that a master on the bus answers them as it would in the\n"
+"field. The trace may be in any format that canopen-dump -f reads.\n"
+"\n"
+"Examples:\n"
+"    $ canopen-replay vcan0 /var/log/canopen/stream-180301-080000.000000.trace\n"
+"    $ canopen-replay -a -o master.trace vcan0 field.pcapng\n"
+"\n";
+
+static inline int print_usage(FILE* output, int status)
+{
+	fprintf(output, "%s", usage_);
+	return status;
+}
+
+static void print_stats(const struct co_replay_stats* stats)
+{
+	double seconds = stats->duration / 1e6;
+
+	printf("Sent %" PRIu64 " frames in %.3f s", stats->n_sent, seconds);
+	if (seconds > 0.0)
+		printf(" (%.0f frames/s)", stats->n_sent / seconds);
+	printf(", skipped %" PRIu64 "\n", stats->n_skipped);
+
+	printf("Received %" PRIu64 " frames\n", stats->n_received);
+
+	if (stats->n_sent)
+		printf("Lag: mean %" PRIu64 " us, max %" PRIu64 " us\n",
+		       stats->lag_sum / stats->n_sent, stats->lag_max);
+}
+
+int main(int argc, char* argv[])
+{
+	static const struct option long_options[] = {
+		{ "help",   no_argument,       0, 'h' },
+		{ "tcp",    no_argument,       0, 'T' },
+		{ "speed",  required_argument, 0, 's' },
+		{ "fast",   no_argument,       0, 'a' },
+		{ "all",    no_argument,       0, 'A' },
+		{ "output", required_argument, 0, 'o' },
+		{ "format", required_argument, 0, 'O' },
+		{ "linger", required_argument, 0, 'L' },
+		{ 0, 0, 0, 0 }
+	};
+
+	struct co_replay_params params = {
+		.speed = 1.0,
+		.linger = 100,
+	};
+
+	int use_tcp = 0;
+
+	while (1) {
+		int c = getopt_long(argc, argv, "hTs:aAo:", long_options, NULL);
+		if (c < 0)
+			break;
+
+		switch (c) {
+		case 'h': return print_usage(stdout, 0);
+		case 'T': use_tcp = 1; break;
+		case 's':
+			params.speed = strtod(optarg, NULL);
+			if (params.speed <= 0.0)
+				return print_usage(stderr, 1);
+			break;
+		case 'a': params.speed = 0.0; break;
+		case 'A': params.objects = CO_REPLAY_ALL; break;
+		case 'o': params.output = optarg; break;
+		case 'O': params.output_format = optarg; break;
+		case 'L': params.linger = strtoul(optarg, NULL, 0); break;
+		default: return print_usage(stderr, 1);
+		}
+	}
+
+	int nargs = argc - optind;
+	char** args = &argv[optind];
+
+	if (nargs < 2)
+		return print_usage(stderr, 1);
+
+	params.path = args[1];
+
+	enum sock_type type = use_tcp ? SOCK_TYPE_TCP : SOCK_TYPE_CAN;
+
+	struct co_replay_stats stats;
+	if (co_replay(type, args[0], &params, &stats) < 0) {
+		perror("Replay failed");
+		return 1;
+	}
+
+	print_stats(&stats);
+	return 0;
+}
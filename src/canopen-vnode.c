@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <getopt.h>
 #include <mloop.h>
 
@@ -24,14 +25,18 @@
 const char usage_[] =
 "Usage: canopen-vnode [options] <interface> <nodeid> [nodeid] [...]\n"
 "\n"
+"Any number of nodes share one process and one socket. A range of node ids\n"
+"can be given as <first>-<last>.\n"
+"\n"
 "Options:\n"
 "    -h, --help                 Get help.\n"
 "    -T, --tcp                  Connect via TCP.\n"
 "    -c, --config               Set path to config file.\n"
 "\n"
 "Examples:\n"
-"    $ canopen-vnode can0\n"
-"    $ canopen-vnode -T 127.0.0.1\n"
+"    $ canopen-vnode can0 5\n"
+"    $ canopen-vnode -T 127.0.0.1 5 6\n"
+"    $ canopen-vnode -c vnode.ini unix:@sim 1-100\n"
 "\n";
 
 static struct vnode* node[127];
@@ -42,31 +47,37 @@ static inline int print_usage(FILE* output, int status)
 	return status;
 }
 
-int init_nodes(enum sock_type type, const char* config, const char* iface,
-	       char* ids[], int n_ids)
+static int parse_nodeid(const char* str, char** end)
 {
-	memset(node, 0, sizeof(node));
+	long nodeid = strtol(str, end, 10);
+	if (*end == str || nodeid < 1 || nodeid > 127)
+		return -1;
 
-	int i;
-	for (i = 0; i < n_ids; ++i) {
-		int nodeid = atoi(ids[i]);
+	return nodeid;
+}
 
-		struct vnode* vnode = co_vnode_new(type, iface, config, nodeid);
-		if (!vnode)
-			goto failure;
+/* "<nodeid>" or "<first>-<last>" */
+static int parse_range(const char* str, int* first, int* last)
+{
+	char* end = NULL;
+
+	*first = parse_nodeid(str, &end);
+	if (*first < 0)
+		return -1;
 
-		node[nodeid - 1] = vnode;
+	if (*end == '\0') {
+		*last = *first;
+		return 0;
 	}
 
-	return 0;
+	if (*end != '-')
+		return -1;
 
-failure:
-	for (--i; i >= 0; --i) {
-		int nodeid = atoi(ids[i]);
-		co_vnode_destroy(node[nodeid - 1]);
-	}
+	*last = parse_nodeid(end + 1, &end);
+	if (*last < *first || *end != '\0')
+		return -1;
 
-	return -1;
+	return 0;
 }
 
 void destroy_nodes(void)
@@ -76,6 +87,38 @@ void destroy_nodes(void)
 			co_vnode_destroy(node[i]);
 }
 
+int init_nodes(enum sock_type type, const char* config, const char* iface,
+	       char* ids[], int n_ids)
+{
+	memset(node, 0, sizeof(node));
+
+	for (int i = 0; i < n_ids; ++i) {
+		int first, last;
+		if (parse_range(ids[i], &first, &last) < 0) {
+			fprintf(stderr, "Invalid node id: %s\n", ids[i]);
+			goto failure;
+		}
+
+		for (int nodeid = first; nodeid <= last; ++nodeid) {
+			struct vnode* vnode =
+				co_vnode_new(type, iface, config, nodeid);
+			if (!vnode) {
+				fprintf(stderr, "Could not create node %d: %s\n",
+					nodeid, strerror(errno));
+				goto failure;
+			}
+
+			node[nodeid - 1] = vnode;
+		}
+	}
+
+	return 0;
+
+failure:
+	destroy_nodes();
+	return -1;
+}
+
 int main(int argc, char* argv[])
 {
 	static const struct option long_options[] = {
@@ -20,79 +20,24 @@
 
 #include "canopen.h"
 
-int canopen_get_object_type(struct canopen_msg* msg,
-			    const struct can_frame* frame)
-{
-	uint32_t cob = frame->can_id & CAN_SFF_MASK;
-	enum canopen_range id = (enum canopen_range)cob;
-
-	switch (id) {
-	case R_NMT:
-		msg->id = 0;
-		msg->object = CANOPEN_NMT;
-		return 0;
-	case R_SYNC:
-		msg->id = 0;
-		msg->object = CANOPEN_SYNC;
-		return 0;
-	case R_TIMESTAMP:
-		msg->id = 0;
-		msg->object = CANOPEN_TIMESTAMP;
-		return 0;
-	case EMCY_LOW ... EMCY_HIGH:
-		msg->id = id - R_EMCY;
-		msg->object = CANOPEN_EMCY;
-		return 0;
-	case TPDO1_LOW ... TPDO1_HIGH:
-		msg->id = id - R_TPDO1;
-		msg->object = CANOPEN_TPDO1;
-		return 0;
-	case RPDO1_LOW ... RPDO1_HIGH:
-		msg->id = id - R_RPDO1;
-		msg->object = CANOPEN_RPDO1;
-		return 0;
-	case TPDO2_LOW ... TPDO2_HIGH:
-		msg->id = id - R_TPDO2;
-		msg->object = CANOPEN_TPDO2;
-		return 0;
-	case RPDO2_LOW ... RPDO2_HIGH:
-		msg->id = id - R_RPDO2;
-		msg->object = CANOPEN_RPDO2;
-		return 0;
-	case TPDO3_LOW ... TPDO3_HIGH:
-		msg->id = id - R_TPDO3;
-		msg->object = CANOPEN_TPDO3;
-		return 0;
-	case RPDO3_LOW ... RPDO3_HIGH:
-		msg->id = id - R_RPDO3;
-		msg->object = CANOPEN_RPDO3;
-		return 0;
-	case TPDO4_LOW ... TPDO4_HIGH:
-		msg->id = id - R_TPDO4;
-		msg->object = CANOPEN_TPDO4;
-		return 0;
-	case RPDO4_LOW ... RPDO4_HIGH:
-		msg->id = id - R_RPDO4;
-		msg->object = CANOPEN_RPDO4;
-		return 0;
-	case TSDO_LOW ... TSDO_HIGH:
-		msg->id = id - R_TSDO;
-		msg->object = CANOPEN_TSDO;
-		return 0;
-	case RSDO_LOW ... RSDO_HIGH:
-		msg->id = id - R_RSDO;
-		msg->object = CANOPEN_RSDO;
-		return 0;
-	case HEARTBEAT_LOW ... HEARTBEAT_HIGH:
-		msg->id = id - R_HEARTBEAT;
-		msg->object = CANOPEN_HEARTBEAT;
-		return 0;
-	default:
-		msg->id = id;
-		msg->object = CANOPEN_UNSPEC;
-		return -1;
-	}
-}
+const uint16_t canopen__object_by_function[16][2] = {
+	{ CANOPEN_UNSPEC, CANOPEN_NMT },
+	{ CANOPEN_EMCY, CANOPEN_SYNC },
+	{ CANOPEN_UNSPEC, CANOPEN_TIMESTAMP },
+	{ CANOPEN_TPDO1, CANOPEN_TPDO1 },
+	{ CANOPEN_RPDO1, CANOPEN_RPDO1 },
+	{ CANOPEN_TPDO2, CANOPEN_TPDO2 },
+	{ CANOPEN_RPDO2, CANOPEN_RPDO2 },
+	{ CANOPEN_TPDO3, CANOPEN_TPDO3 },
+	{ CANOPEN_RPDO3, CANOPEN_RPDO3 },
+	{ CANOPEN_TPDO4, CANOPEN_TPDO4 },
+	{ CANOPEN_RPDO4, CANOPEN_RPDO4 },
+	{ CANOPEN_TSDO, CANOPEN_TSDO },
+	{ CANOPEN_RSDO, CANOPEN_RSDO },
+	{ CANOPEN_UNSPEC, CANOPEN_UNSPEC },
+	{ CANOPEN_HEARTBEAT, CANOPEN_HEARTBEAT },
+	{ CANOPEN_UNSPEC, CANOPEN_UNSPEC },
+};
 
 int canopen_get_object_type_simple(struct canopen_msg* msg,
 				   struct can_frame* frame, unsigned int nodeid)
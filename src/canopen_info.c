@@ -14,10 +14,14 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <sharedmalloc.h>
 #include "canopen_info.h"
 
 struct canopen_info* canopen_info_ = NULL;
+struct canopen_bus_info* canopen_bus_info_ = NULL;
+struct canopen_diag_header* canopen_diag_header_ = NULL;
+struct canopen_node_diag* canopen_node_diag_ = NULL;
 
 static const char canopen_info_name[] = "canopen2";
 static const char canopen_info_description[] = "canopen2.xml";
@@ -28,14 +32,34 @@ int canopen_info_init(const char* iface)
 	snprintf(buffer, sizeof(buffer), "%s.%s", canopen_info_name, iface);
 	buffer[sizeof(buffer) - 1] = '\0';
 
-	canopen_info_ = s_malloc(sizeof(struct canopen_info) * 127, buffer,
-				 canopen_info_description);
+	size_t size = canopen_diag_offset()
+		    + sizeof(struct canopen_diag_header)
+		    + sizeof(struct canopen_node_diag) * 127;
+
+	canopen_info_ = s_malloc(size, buffer, canopen_info_description);
 	if (!canopen_info_)
 		return -1;
 
 	for (size_t i = 0; i < 127; ++i)
 		canopen_info_[i].is_active = 0;
 
+	canopen_bus_info_ = (struct canopen_bus_info*)&canopen_info_[127];
+	memset(canopen_bus_info_, 0, sizeof(*canopen_bus_info_));
+
+	char* base = (char*)canopen_info_;
+
+	canopen_diag_header_ =
+		(struct canopen_diag_header*)(base + canopen_diag_offset());
+	canopen_node_diag_ = (struct canopen_node_diag*)&canopen_diag_header_[1];
+	memset(canopen_node_diag_, 0, sizeof(struct canopen_node_diag) * 127);
+
+	/* The version goes last so that readers don't see a half-made header */
+	canopen_diag_header_->entry_size = sizeof(struct canopen_node_diag);
+	canopen_diag_header_->count = 127;
+	canopen_diag_header_->reserved = 0;
+	__atomic_store_n(&canopen_diag_header_->version, CANOPEN_DIAG_VERSION,
+			 __ATOMIC_RELEASE);
+
 	return 0;
 }
 
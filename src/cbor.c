@@ -0,0 +1,140 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cbor.h"
+
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+#define CBOR_NULL 22
+#define CBOR_FLOAT32 26
+#define CBOR_FLOAT64 27
+#define CBOR_INDEFINITE 31
+#define CBOR_BREAK 0xff
+
+int cbor_init(struct cbor* self, size_t size)
+{
+	self->is_bad = 0;
+	return vector_init(&self->vector, size);
+}
+
+void cbor_destroy(struct cbor* self)
+{
+	vector_destroy(&self->vector);
+}
+
+static void cbor__append(struct cbor* self, const void* data, size_t size)
+{
+	if (self->is_bad)
+		return;
+
+	if (vector_append(&self->vector, data, size) < 0)
+		self->is_bad = 1;
+}
+
+/* Multi-byte values are in network byte order */
+static void cbor__put_be(struct cbor* self, uint8_t initial, uint64_t value,
+			 int size)
+{
+	uint8_t buffer[9];
+
+	buffer[0] = initial;
+	for (int i = 0; i < size; ++i)
+		buffer[size - i] = value >> (8 * i);
+
+	cbor__append(self, buffer, size + 1);
+}
+
+void cbor_put_head(struct cbor* self, enum cbor_major major, uint64_t value)
+{
+	uint8_t type = major << 5;
+
+	if (value < 24)
+		cbor__put_be(self, type | value, 0, 0);
+	else if (value <= UINT8_MAX)
+		cbor__put_be(self, type | 24, value, 1);
+	else if (value <= UINT16_MAX)
+		cbor__put_be(self, type | 25, value, 2);
+	else if (value <= UINT32_MAX)
+		cbor__put_be(self, type | 26, value, 4);
+	else
+		cbor__put_be(self, type | 27, value, 8);
+}
+
+void cbor_put_int(struct cbor* self, int64_t value)
+{
+	if (value >= 0)
+		cbor_put_head(self, CBOR_UINT, value);
+	else
+		cbor_put_head(self, CBOR_NEGINT, -1 - value);
+}
+
+void cbor_put_bytes(struct cbor* self, const void* data, size_t size)
+{
+	cbor_put_head(self, CBOR_BYTES, size);
+	cbor__append(self, data, size);
+}
+
+void cbor_put_text(struct cbor* self, const char* str, size_t length)
+{
+	cbor_put_head(self, CBOR_TEXT, length);
+	cbor__append(self, str, length);
+}
+
+void cbor_put_string(struct cbor* self, const char* str)
+{
+	cbor_put_text(self, str, strlen(str));
+}
+
+void cbor_put_bool(struct cbor* self, int value)
+{
+	cbor_put_head(self, CBOR_SIMPLE, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void cbor_put_null(struct cbor* self)
+{
+	cbor_put_head(self, CBOR_SIMPLE, CBOR_NULL);
+}
+
+void cbor_put_float(struct cbor* self, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	cbor__put_be(self, CBOR_SIMPLE << 5 | CBOR_FLOAT32, bits, 4);
+}
+
+void cbor_put_double(struct cbor* self, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	cbor__put_be(self, CBOR_SIMPLE << 5 | CBOR_FLOAT64, bits, 8);
+}
+
+void cbor_begin_array(struct cbor* self)
+{
+	cbor__put_be(self, CBOR_ARRAY << 5 | CBOR_INDEFINITE, 0, 0);
+}
+
+void cbor_begin_map(struct cbor* self)
+{
+	cbor__put_be(self, CBOR_MAP << 5 | CBOR_INDEFINITE, 0, 0);
+}
+
+void cbor_put_break(struct cbor* self)
+{
+	cbor__put_be(self, CBOR_BREAK, 0, 0);
+}
@@ -24,6 +24,14 @@
 
 static int cfg__is_initialised = 0;
 static struct ini_file ini;
+static char cfg__path[256];
+static uint32_t cfg__kept;
+
+static struct {
+#define X(type, name) CFG__DEFINE_(type, name);
+	CFG__RELOADABLE_PARAMETERS
+#undef X
+} cfg__reloadable_defaults;
 
 size_t strlcpy(char*, const char*, size_t);
 
@@ -37,6 +45,10 @@ void cfg_load_defaults(void)
 	CFG__PARAMETERS
 #undef X
 
+#define X(type, name) \
+	memcpy(&cfg__reloadable_defaults.name, &cfg.name, sizeof(cfg.name));
+	CFG__RELOADABLE_PARAMETERS
+#undef X
 }
 
 void cfg__load_node_defaults(int id)
@@ -107,19 +119,50 @@ int cfg__load_stream(FILE* stream)
 EXPORT
 int cfg_load_file(const char* path)
 {
-	int r = -1;
+	if (ini_parse_file(&ini, path) < 0)
+		return -1;
+
+	strlcpy(cfg__path, path, sizeof(cfg__path));
+	cfg__is_initialised = 1;
+	return 0;
+}
+
+EXPORT
+int cfg_reload_file(struct cfg* old)
+{
+	struct ini_file next;
+	const char* v;
 
-	FILE* stream = fopen(path, "r");
-	if (!stream)
+	if (!cfg__path[0] || ini_parse_file(&next, cfg__path) < 0)
 		return -1;
 
-	if (cfg__load_stream(stream) < 0)
-		goto failure;
+	memcpy(old, &cfg, sizeof(*old));
+
+	cfg_unload_file();
+	ini = next;
+	cfg__is_initialised = 1;
+
+#define X(type, name) \
+		if (!(cfg__kept & (1U << CFG_RELOADABLE_ ## name))) { \
+			memcpy(&cfg.name, &cfg__reloadable_defaults.name, \
+			       sizeof(cfg.name)); \
+			v = ini_find(&ini, "master", XSTR(name)); \
+			if (v) { \
+				CFG__SET_(type, cfg.name, \
+					  CFG__STRTO_(type, v)); \
+			} \
+		}
 
-	r = 0;
-failure:
-	fclose(stream);
-	return r;
+	CFG__RELOADABLE_PARAMETERS
+#undef X
+
+	return 0;
+}
+
+EXPORT
+void cfg_keep_on_reload(enum cfg_reloadable param)
+{
+	cfg__kept |= 1U << param;
 }
 
 EXPORT
@@ -143,12 +186,12 @@ const char* cfg__get_by_nodeid(int nodeid, const char* key)
 
 const char* cfg__get_by_name(int nodeid, const char* key)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	if (!node || !*node->name)
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+	if (!*ident->name)
 		return NULL;
 
 	char section[256];
-	snprintf(section, sizeof(section) - 1, "=%s", node->name);
+	snprintf(section, sizeof(section) - 1, "=%s", ident->name);
 	section[sizeof(section) - 1] = '\0';
 
 	return ini_find(&ini, section, key);
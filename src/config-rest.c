@@ -0,0 +1,58 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "canopen/master.h"
+#include "rest.h"
+#include "config-rest.h"
+
+static void config_rest__reply(struct rest_client* client,
+			       const char* status_code, const char* message)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = "text/plain",
+		.content_length = strlen(message),
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+void config_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (client->req.url_index != 2
+	 || strcmp(client->req.url[1], "reload") != 0) {
+		config_rest__reply(client, "404 Not Found", "Not found\r\n");
+		return;
+	}
+
+	int n = co_master_reload_config();
+	if (n < 0) {
+		config_rest__reply(client, "409 Conflict",
+				   "Configuration could not be read or nodes are being loaded\r\n");
+		return;
+	}
+
+	char message[64];
+	snprintf(message, sizeof(message), "Reconfigured %d nodes\r\n", n);
+	config_rest__reply(client, "200 OK", message);
+}
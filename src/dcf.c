@@ -0,0 +1,407 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canopen/dcf.h"
+#include "canopen/sdo_batch.h"
+#include "vector.h"
+
+/* Index, subindex and size */
+#define CO_DCF__ENTRY_HEADER_SIZE 7
+
+static inline uint32_t co_dcf__get_u32(const uint8_t* src)
+{
+	return src[0] | src[1] << 8 | src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static inline void co_dcf__set_u32(uint8_t* dst, uint32_t value)
+{
+	dst[0] = value;
+	dst[1] = value >> 8;
+	dst[2] = value >> 16;
+	dst[3] = value >> 24;
+}
+
+uint32_t co_dcf_crc32(uint32_t crc, const void* data, size_t size)
+{
+	const uint8_t* p = data;
+
+	crc = ~crc;
+
+	while (size--) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; ++i)
+			crc = (crc >> 1) ^ (0xedb88320UL & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+int co_dcf_next(const struct co_dcf* self, size_t* pos,
+		struct co_dcf_entry* entry)
+{
+	if (*pos == 0)
+		*pos = sizeof(uint32_t);
+
+	if (*pos + CO_DCF__ENTRY_HEADER_SIZE > self->size)
+		return -1;
+
+	const uint8_t* p = self->data + *pos;
+	uint32_t size = co_dcf__get_u32(p + 3);
+
+	if (size > self->size - *pos - CO_DCF__ENTRY_HEADER_SIZE)
+		return -1;
+
+	entry->index = p[0] | p[1] << 8;
+	entry->subindex = p[2];
+	entry->size = size;
+	entry->data = p + CO_DCF__ENTRY_HEADER_SIZE;
+
+	*pos += CO_DCF__ENTRY_HEADER_SIZE + size;
+	return 0;
+}
+
+int co_dcf_parse(struct co_dcf* self, const void* data, size_t size)
+{
+	memset(self, 0, sizeof(*self));
+
+	if (size < sizeof(uint32_t))
+		return -1;
+
+	self->data = malloc(size);
+	if (!self->data)
+		return -1;
+
+	memcpy(self->data, data, size);
+	self->size = size;
+
+	uint32_t n_entries = co_dcf__get_u32(self->data);
+
+	size_t pos = 0;
+	struct co_dcf_entry entry;
+	for (uint32_t i = 0; i < n_entries; ++i)
+		if (co_dcf_next(self, &pos, &entry) < 0)
+			goto failure;
+
+	if ((n_entries ? pos : sizeof(uint32_t)) != size)
+		goto failure;
+
+	self->n_entries = n_entries;
+	self->checksum = co_dcf_crc32(0, self->data, size);
+	return 0;
+
+failure:
+	co_dcf_destroy(self);
+	return -1;
+}
+
+int co_dcf_load(struct co_dcf* self, const char* path)
+{
+	FILE* stream = fopen(path, "rb");
+	if (!stream)
+		return -1;
+
+	int rc = -1;
+	uint8_t* data = NULL;
+
+	if (fseek(stream, 0, SEEK_END) < 0)
+		goto done;
+
+	long size = ftell(stream);
+	if (size < 0 || fseek(stream, 0, SEEK_SET) < 0)
+		goto done;
+
+	data = malloc(size ? size : 1);
+	if (!data)
+		goto done;
+
+	if (fread(data, 1, size, stream) != (size_t)size)
+		goto done;
+
+	rc = co_dcf_parse(self, data, size);
+
+done:
+	free(data);
+	fclose(stream);
+	return rc;
+}
+
+void co_dcf_destroy(struct co_dcf* self)
+{
+	free(self->data);
+	self->data = NULL;
+	self->size = 0;
+}
+
+int co_dcf_add_verify_uploads(struct sdo_batch* batch)
+{
+	if (sdo_batch_add_upload(batch, CO_DCF_VERIFY_INDEX, 1) < 0)
+		return -1;
+
+	return sdo_batch_add_upload(batch, CO_DCF_VERIFY_INDEX, 2);
+}
+
+static int co_dcf__get_verify_value(const struct sdo_batch* batch, size_t i,
+				    uint32_t* value)
+{
+	const struct sdo_batch_item* item = sdo_batch_get_item(batch, i);
+	if (!item || item->status != SDO_REQ_OK
+	 || item->data.index != sizeof(*value))
+		return -1;
+
+	*value = co_dcf__get_u32(item->data.data);
+	return 0;
+}
+
+int co_dcf_is_verified(const struct co_dcf* self,
+		       const struct sdo_batch* batch)
+{
+	uint32_t checksum, size;
+
+	if (co_dcf__get_verify_value(batch, 0, &checksum) < 0
+	 || co_dcf__get_verify_value(batch, 1, &size) < 0)
+		return -1;
+
+	return checksum == self->checksum && size == self->size;
+}
+
+static int co_dcf__add_u32(struct sdo_batch* batch, int index, int subindex,
+			   uint32_t value)
+{
+	uint8_t data[4];
+	co_dcf__set_u32(data, value);
+	return sdo_batch_add_download(batch, index, subindex, data,
+				      sizeof(data));
+}
+
+static int co_dcf__add_entries(const struct co_dcf* self,
+			       struct sdo_batch* batch)
+{
+	size_t pos = 0;
+	struct co_dcf_entry entry;
+
+	for (uint32_t i = 0; i < self->n_entries; ++i) {
+		if (co_dcf_next(self, &pos, &entry) < 0)
+			return -1;
+
+		if (sdo_batch_add_download(batch, entry.index, entry.subindex,
+					   entry.data, entry.size) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int co_dcf_add_downloads(const struct co_dcf* self, struct sdo_batch* batch,
+			 enum co_dcf_flags flags, int nodeid)
+{
+	if (flags & CO_DCF_VERIFY)
+		if (co_dcf__add_u32(batch, CO_DCF_VERIFY_INDEX, 1, 0) < 0)
+			return -1;
+
+	if (flags & CO_DCF_OBJECT) {
+		if (sdo_batch_add_download(batch, CO_DCF_OBJECT_INDEX, nodeid,
+					   self->data, self->size) < 0)
+			return -1;
+	} else if (co_dcf__add_entries(self, batch) < 0) {
+		return -1;
+	}
+
+	if (!(flags & CO_DCF_VERIFY))
+		return 0;
+
+	if (co_dcf__add_u32(batch, CO_DCF_VERIFY_INDEX, 2, self->size) < 0)
+		return -1;
+
+	return co_dcf__add_u32(batch, CO_DCF_VERIFY_INDEX, 1, self->checksum);
+}
+
+int co_dcf_from_uploads(struct co_dcf* self, const struct sdo_batch* batch)
+{
+	struct vector data;
+	if (vector_init(&data, 256) < 0)
+		return -1;
+
+	uint8_t header[CO_DCF__ENTRY_HEADER_SIZE];
+	uint32_t n_entries = 0;
+
+	memset(header, 0, sizeof(uint32_t));
+	if (vector_append(&data, header, sizeof(uint32_t)) < 0)
+		goto failure;
+
+	for (size_t i = 0; i < batch->n_items; ++i) {
+		const struct sdo_batch_item* item = &batch->items[i];
+		if (item->type != SDO_REQ_UPLOAD || item->status != SDO_REQ_OK)
+			continue;
+
+		header[0] = item->index;
+		header[1] = item->index >> 8;
+		header[2] = item->subindex;
+		co_dcf__set_u32(header + 3, item->data.index);
+
+		if (vector_append(&data, header, sizeof(header)) < 0
+		 || vector_append(&data, item->data.data, item->data.index) < 0)
+			goto failure;
+
+		++n_entries;
+	}
+
+	co_dcf__set_u32(data.data, n_entries);
+
+	int rc = co_dcf_parse(self, data.data, data.index);
+	vector_destroy(&data);
+	return rc;
+
+failure:
+	vector_destroy(&data);
+	return -1;
+}
+
+int co_dcf_add_entry_uploads(const struct co_dcf* self,
+			     struct sdo_batch* batch)
+{
+	size_t pos = 0;
+	struct co_dcf_entry entry;
+
+	while (co_dcf_next(self, &pos, &entry) == 0)
+		if (sdo_batch_add_upload(batch, entry.index,
+					 entry.subindex) < 0)
+			return -1;
+
+	return 0;
+}
+
+static int co_dcf__is_unchanged(const struct co_dcf_entry* entry,
+				const struct sdo_batch_item* current)
+{
+	return current && current->status == SDO_REQ_OK
+	    && current->data.index == entry->size
+	    && memcmp(current->data.data, entry->data, entry->size) == 0;
+}
+
+/* The subindex that disables a PDO while it is changed, or -1 */
+static int co_dcf__get_guard(int index)
+{
+	if ((0x1600 <= index && index < 0x1800)
+	 || (0x1a00 <= index && index < 0x1c00))
+		return 0;
+
+	if ((0x1400 <= index && index < 0x1600)
+	 || (0x1800 <= index && index < 0x1a00))
+		return 1;
+
+	return -1;
+}
+
+static int co_dcf__add_disable(struct sdo_batch* batch,
+			       const struct co_dcf_entry* guard)
+{
+	if (guard->subindex == 0) {
+		uint8_t zero = 0;
+		return sdo_batch_add_download(batch, guard->index, 0, &zero, 1);
+	}
+
+	if (guard->size != 4)
+		return -1;
+
+	uint8_t cob_id[4];
+	memcpy(cob_id, guard->data, sizeof(cob_id));
+	cob_id[3] |= 0x80;
+	return sdo_batch_add_download(batch, guard->index, guard->subindex,
+				      cob_id, sizeof(cob_id));
+}
+
+/* The n entries have the same index */
+static ssize_t co_dcf__add_changed_object(const struct co_dcf_entry* entries,
+					  const struct sdo_batch_item* current,
+					  size_t n, struct sdo_batch* batch)
+{
+	int guard_subindex = co_dcf__get_guard(entries[0].index);
+	const struct co_dcf_entry* guard = NULL;
+	ssize_t n_changed = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		if (!co_dcf__is_unchanged(&entries[i], &current[i]))
+			++n_changed;
+
+		if (entries[i].subindex == guard_subindex)
+			guard = &entries[i];
+	}
+
+	if (n_changed == 0)
+		return 0;
+
+	if (guard && co_dcf__add_disable(batch, guard) < 0)
+		guard = NULL;
+
+	for (size_t i = 0; i < n; ++i) {
+		const struct co_dcf_entry* entry = &entries[i];
+
+		if (entry == guard || co_dcf__is_unchanged(entry, &current[i]))
+			continue;
+
+		if (sdo_batch_add_download(batch, entry->index, entry->subindex,
+					   entry->data, entry->size) < 0)
+			return -1;
+	}
+
+	if (guard && sdo_batch_add_download(batch, guard->index,
+					    guard->subindex, guard->data,
+					    guard->size) < 0)
+		return -1;
+
+	return n_changed;
+}
+
+ssize_t co_dcf_add_changed_downloads(const struct co_dcf* self,
+				     const struct sdo_batch* current,
+				     struct sdo_batch* batch)
+{
+	if (current->n_items != self->n_entries)
+		return -1;
+
+	struct co_dcf_entry* entries =
+		malloc((self->n_entries + 1) * sizeof(*entries));
+	if (!entries)
+		return -1;
+
+	size_t pos = 0;
+	for (uint32_t i = 0; i < self->n_entries; ++i)
+		co_dcf_next(self, &pos, &entries[i]);
+
+	ssize_t n_changed = 0;
+
+	for (size_t start = 0, end; start < self->n_entries; start = end) {
+		for (end = start + 1; end < self->n_entries; ++end)
+			if (entries[end].index != entries[start].index)
+				break;
+
+		ssize_t n = co_dcf__add_changed_object(&entries[start],
+						       &current->items[start],
+						       end - start, batch);
+		if (n < 0) {
+			n_changed = -1;
+			break;
+		}
+
+		n_changed += n;
+	}
+
+	free(entries);
+	return n_changed;
+}
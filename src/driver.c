@@ -15,21 +15,19 @@
 
 #include <stdlib.h>
 #include <stdint.h>
-#include <dlfcn.h>
-#include <unistd.h>
 #include "socketcan.h"
 #include "canopen/master.h"
 #include "canopen/sdo_req.h"
+#include "canopen/sdo_batch.h"
 #include "canopen/emcy.h"
+#include "canopen/drv_registry.h"
+#include "canopen/pdo_map.h"
+#include "canopen/drv_exec.h"
+#include "objpool.h"
 #include "canopen-driver.h"
 #include "string-utils.h"
 #include "plog.h"
-
-#ifndef DRIVER_PATH
-#define DRIVER_PATH "/usr/lib/canopen"
-#endif
-
-size_t strlcpy(char*, const char*, size_t);
+#include "cfg.h"
 
 struct co_sdo_req {
 	struct sdo_req req;
@@ -37,50 +35,18 @@ struct co_sdo_req {
 	co_sdo_done_fn on_done;
 };
 
-const char* co__drv_find_dso(const char* name)
-{
-	static __thread char result[256];
-
-	char name_buffer[256];
-	strlcpy(name_buffer, name, 256);
+static struct objpool co__sdo_req_pool = OBJPOOL_INITIALIZER(struct co_sdo_req);
 
-	snprintf(result, sizeof(result), DRIVER_PATH "/co_drv_%s.so",
-		 string_tolower(name_buffer));
-	result[sizeof(result) - 1] = '\0';
-
-	if (access(result, R_OK) < 0)
-		return NULL;
-
-	return result;
-}
+struct co_sdo_batch {
+	struct sdo_batch batch;
+	struct co_drv* drv;
+	co_sdo_batch_fn on_done;
+};
 
 int co_drv_load(struct co_drv* drv, const char* name)
 {
 	assert(!drv->dso);
-
-	const char* path = co__drv_find_dso(name);
-	if (!path)
-		return -1;
-
-	drv->dso = dlopen(path, RTLD_NOW | RTLD_LOCAL);
-	const char* err = dlerror();
-	if (!drv->dso) {
-		plog(LOG_ERROR, "driver: Failed to load driver for '%s': %s",
-		     name, err);
-		return -1;
-	}
-
-	drv->init_fn = dlsym(drv->dso, "co_drv_init");
-	dlerror();
-	if (drv->init_fn)
-		return 0;
-
-	plog(LOG_ERROR, "driver: DSO for '%s' does not export an 'init' function",
-	     name);
-
-	dlclose(drv->dso);
-	memset(drv, 0, sizeof(*drv));
-	return -1;
+	return co_drv_registry_get(drv, name);
 }
 
 int co_drv_init(struct co_drv* drv)
@@ -90,11 +56,21 @@ int co_drv_init(struct co_drv* drv)
 
 void co_drv_unload(struct co_drv* drv)
 {
+	co_drv_exec_stop(drv);
+
 	if (drv->context && drv->free_fn)
 		drv->free_fn(drv->context);
 
-	dlclose(drv->dso);
+	free(drv->tpdo);
+	free(drv->rpdo);
+	free(drv->pdo_batch);
 
+	for (int i = 0; i < 4; ++i) {
+		free(drv->tpdo_map[i]);
+		free(drv->rpdo_map[i]);
+	}
+
+	/* The DSO stays open in the registry for other nodes */
 	memset(drv, 0, sizeof(*drv));
 }
 
@@ -112,22 +88,22 @@ uint32_t co_get_device_type(const struct co_drv* self)
 
 uint32_t co_get_vendor_id(const struct co_drv* self)
 {
-	return co_drv_node(self)->vendor_id;
+	return co_master_get_ident(co_get_nodeid(self))->vendor_id;
 }
 
 uint32_t co_get_product_code(const struct co_drv* self)
 {
-	return co_drv_node(self)->product_code;
+	return co_master_get_ident(co_get_nodeid(self))->product_code;
 }
 
 uint32_t co_get_revision_number(const struct co_drv* self)
 {
-	return co_drv_node(self)->revision_number;
+	return co_master_get_ident(co_get_nodeid(self))->revision_number;
 }
 
 const char* co_get_name(const struct co_drv* self)
 {
-	return co_drv_node(self)->name;
+	return co_master_get_ident(co_get_nodeid(self))->name;
 }
 
 void co_set_context(struct co_drv* self, void* context, co_free_fn fn)
@@ -144,21 +120,61 @@ void* co_get_context(const struct co_drv* self)
 void co_set_pdo1_fn(struct co_drv* self, co_pdo_fn fn)
 {
 	self->pdo1_fn = fn;
+	co__update_filters(co_get_nodeid(self));
 }
 
 void co_set_pdo2_fn(struct co_drv* self, co_pdo_fn fn)
 {
 	self->pdo2_fn = fn;
+	co__update_filters(co_get_nodeid(self));
 }
 
 void co_set_pdo3_fn(struct co_drv* self, co_pdo_fn fn)
 {
 	self->pdo3_fn = fn;
+	co__update_filters(co_get_nodeid(self));
 }
 
 void co_set_pdo4_fn(struct co_drv* self, co_pdo_fn fn)
 {
 	self->pdo4_fn = fn;
+	co__update_filters(co_get_nodeid(self));
+}
+
+void co_set_pdo1_ts_fn(struct co_drv* self, co_pdo_ts_fn fn)
+{
+	self->pdo1_ts_fn = fn;
+	co__update_filters(co_get_nodeid(self));
+}
+
+void co_set_pdo2_ts_fn(struct co_drv* self, co_pdo_ts_fn fn)
+{
+	self->pdo2_ts_fn = fn;
+	co__update_filters(co_get_nodeid(self));
+}
+
+void co_set_pdo3_ts_fn(struct co_drv* self, co_pdo_ts_fn fn)
+{
+	self->pdo3_ts_fn = fn;
+	co__update_filters(co_get_nodeid(self));
+}
+
+void co_set_pdo4_ts_fn(struct co_drv* self, co_pdo_ts_fn fn)
+{
+	self->pdo4_ts_fn = fn;
+	co__update_filters(co_get_nodeid(self));
+}
+
+int co_set_pdo_batch_fn(struct co_drv* self, co_pdo_batch_fn fn)
+{
+	if (fn && !self->pdo_batch) {
+		self->pdo_batch = calloc(1, sizeof(*self->pdo_batch));
+		if (!self->pdo_batch)
+			return -1;
+	}
+
+	self->pdo_batch_fn = fn;
+	return 0;
 }
 
 int co_rpdo1(struct co_drv* self, const void* data, size_t size)
@@ -181,6 +197,242 @@ int co_rpdo4(struct co_drv* self, const void* data, size_t size)
 	return co__rpdox(co_get_nodeid(self), R_RPDO4, data, size);
 }
 
+static int co__pdo_map(struct co_drv* self, struct pdo_map** slot,
+		       const uint32_t* mapping, size_t count)
+{
+	/* The mapping is set up when the driver has been initialized */
+	if (co_drv_node(self)->is_initialized || count > PDO_MAP_ENTRIES_MAX)
+		return -1;
+
+	struct pdo_map* map = *slot;
+	if (!map) {
+		map = calloc(1, sizeof(*map));
+		if (!map)
+			return -1;
+
+		*slot = map;
+	}
+
+	map->is_ready = 0;
+	map->has_mapping = mapping != NULL;
+	map->n_mapping = mapping ? count : 0;
+
+	if (mapping)
+		memcpy(map->mapping, mapping, count * sizeof(*mapping));
+
+	co__update_filters(co_get_nodeid(self));
+	return 0;
+}
+
+int co_tpdo_map(struct co_drv* self, int n, const uint32_t* mapping,
+		size_t count)
+{
+	if (n < 1 || n > 4)
+		return -1;
+
+	return co__pdo_map(self, &self->tpdo_map[n - 1], mapping, count);
+}
+
+int co_rpdo_map(struct co_drv* self, int n, const uint32_t* mapping,
+		size_t count)
+{
+	if (n < 1 || n > 4)
+		return -1;
+
+	return co__pdo_map(self, &self->rpdo_map[n - 1], mapping, count);
+}
+
+void co_set_tpdo_signal_fn(struct co_drv* self, int n, co_signal_fn fn)
+{
+	if (n < 1 || n > 4)
+		return;
+
+	if (fn && !self->tpdo_map[n - 1])
+		co_tpdo_map(self, n, NULL, 0);
+
+	self->tpdo_signal_fn[n - 1] = fn;
+	co__update_filters(co_get_nodeid(self));
+}
+
+static const struct pdo_map* co__ready_map(struct pdo_map* const* maps, int n)
+{
+	if (n < 1 || n > 4)
+		return NULL;
+
+	const struct pdo_map* map = maps[n - 1];
+	return map && map->is_ready ? map : NULL;
+}
+
+int co_tpdo_find_signal(const struct co_drv* self, int n, int index,
+			int subindex)
+{
+	const struct pdo_map* map = co__ready_map(self->tpdo_map, n);
+	return map ? pdo_map_find(map, index, subindex) : -1;
+}
+
+const struct co_signal* co_tpdo_get_signals(const struct co_drv* self, int n,
+					    size_t* count)
+{
+	const struct pdo_map* map = co__ready_map(self->tpdo_map, n);
+	*count = map ? map->n_entries : 0;
+	return map ? map->signal : NULL;
+}
+
+int co_rpdo_find_signal(const struct co_drv* self, int n, int index,
+			int subindex)
+{
+	const struct pdo_map* map = co__ready_map(self->rpdo_map, n);
+	return map ? pdo_map_find(map, index, subindex) : -1;
+}
+
+struct co_signal* co_rpdo_get_signals(struct co_drv* self, int n,
+				      size_t* count)
+{
+	if (!co__ready_map(self->rpdo_map, n)) {
+		*count = 0;
+		return NULL;
+	}
+
+	struct pdo_map* map = self->rpdo_map[n - 1];
+	*count = map->n_entries;
+	return map->signal;
+}
+
+int co_rpdo_send_signals(struct co_drv* self, int n)
+{
+	static const int rpdo[] = { R_RPDO1, R_RPDO2, R_RPDO3, R_RPDO4 };
+
+	const struct pdo_map* map = co__ready_map(self->rpdo_map, n);
+	if (!map)
+		return -1;
+
+	unsigned char data[PDO_MAP_SIZE_MAX];
+	ssize_t size = pdo_map_encode(map, data, sizeof(data));
+	if (size < 0)
+		return -1;
+
+	return co__rpdox(co_get_nodeid(self), rpdo[n - 1], data, size);
+}
+
+static struct co_drv_pdo* co__find_pdo(struct co_drv_pdo* table, size_t size,
+				       int n)
+{
+	for (size_t i = 0; i < size; ++i)
+		if (table[i].n == n)
+			return &table[i];
+
+	return NULL;
+}
+
+static int co__set_pdo(struct co_drv_pdo** table, size_t* size, int n,
+		       uint32_t cob_id, co_pdo_ts_fn fn)
+{
+	struct co_drv_pdo* pdo = co__find_pdo(*table, *size, n);
+
+	if (cob_id == 0) {
+		if (pdo)
+			*pdo = (*table)[--*size];
+		return 0;
+	}
+
+	if (!pdo) {
+		pdo = realloc(*table, (*size + 1) * sizeof(*pdo));
+		if (!pdo)
+			return -1;
+
+		*table = pdo;
+		pdo = &pdo[(*size)++];
+		pdo->n = n;
+		pdo->cob_id = 0;
+	}
+
+	if (pdo->cob_id != cob_id)
+		pdo->last.is_valid = 0;
+
+	pdo->cob_id = cob_id;
+	pdo->fn = fn;
+	return 0;
+}
+
+static inline uint32_t co__predefined_cob_id(const struct co_drv* self,
+					     int function, int n)
+{
+	return n <= 4 ? function + (n - 1) * 0x100 + co_get_nodeid(self) : 0;
+}
+
+int co_set_tpdo_fn(struct co_drv* self, int n, uint32_t cob_id,
+		   co_pdo_ts_fn fn)
+{
+	static void (*const set_ts_fn[])(struct co_drv*, co_pdo_ts_fn) = {
+		co_set_pdo1_ts_fn, co_set_pdo2_ts_fn,
+		co_set_pdo3_ts_fn, co_set_pdo4_ts_fn,
+	};
+
+	if (n < 1 || n > CO_PDO_MAX || cob_id > CAN_SFF_MASK)
+		return -1;
+
+	uint32_t predefined = co__predefined_cob_id(self, R_TPDO1, n);
+	if (cob_id == 0)
+		cob_id = predefined;
+
+	if (cob_id == 0)
+		return -1;
+
+	int rc;
+	if (cob_id == predefined) {
+		set_ts_fn[n - 1](self, fn);
+		rc = co__set_pdo(&self->tpdo, &self->n_tpdos, n, 0, NULL);
+	} else {
+		rc = co__set_pdo(&self->tpdo, &self->n_tpdos, n,
+				 fn ? cob_id : 0, fn);
+	}
+
+	co__update_filters(co_get_nodeid(self));
+	return rc;
+}
+
+int co_set_rpdo_cob_id(struct co_drv* self, int n, uint32_t cob_id)
+{
+	if (n < 1 || n > CO_PDO_MAX || cob_id > CAN_SFF_MASK)
+		return -1;
+
+	if (cob_id == co__predefined_cob_id(self, R_RPDO1, n))
+		cob_id = 0;
+
+	return co__set_pdo(&self->rpdo, &self->n_rpdos, n, cob_id, NULL);
+}
+
+int co_set_tpdo_on_change(struct co_drv* self, int n, int is_on_change)
+{
+	if (n < 1 || n > CO_PDO_MAX)
+		return -1;
+
+	if (is_on_change)
+		self->tpdo_on_change[n / 8] |= 1 << (n % 8);
+	else
+		self->tpdo_on_change[n / 8] &= ~(1 << (n % 8));
+
+	struct co_drv_pdo* pdo = co__find_pdo(self->tpdo, self->n_tpdos, n);
+	if (pdo)
+		pdo->last.is_valid = 0;
+
+	if (n <= 4)
+		co_drv_node(self)->tpdo_last[n - 1].is_valid = 0;
+
+	return 0;
+}
+
+int co_rpdo(struct co_drv* self, int n, const void* data, size_t size)
+{
+	const struct co_drv_pdo* pdo =
+		co__find_pdo(self->rpdo, self->n_rpdos, n);
+	if (pdo)
+		return co__send_pdo(pdo->cob_id, data, size);
+
+	uint32_t cob_id = co__predefined_cob_id(self, R_RPDO1, n);
+	return cob_id ? co__send_pdo(cob_id, data, size) : -1;
+}
+
 void co_set_emcy_fn(struct co_drv* self, co_emcy_fn fn)
 {
 	self->emcy_fn = fn;
@@ -193,7 +445,7 @@ void co_set_start_fn(struct co_drv* self, co_start_fn fn)
 
 const char* co_get_network_name(const struct co_drv* self)
 {
-	return self->iface;
+	return cfg.iface;
 }
 
 void co_sdo_req_ref(struct co_sdo_req* self)
@@ -217,7 +469,7 @@ static void co__sdo_req_on_done(struct sdo_req* req)
 
 struct co_sdo_req* co_sdo_req_new(struct co_drv* drv)
 {
-	struct co_sdo_req* self = malloc(sizeof(*self));
+	struct co_sdo_req* self = objpool_alloc(&co__sdo_req_pool);
 	if (!self)
 		return NULL;
 
@@ -225,6 +477,7 @@ struct co_sdo_req* co_sdo_req_new(struct co_drv* drv)
 
 	struct sdo_req* req = &self->req;
 
+	req->pool = &co__sdo_req_pool;
 	req->ref = 1;
 	req->on_done = co__sdo_req_on_done;
 	self->drv = drv;
@@ -252,9 +505,28 @@ void co_sdo_req_set_type(struct co_sdo_req* self, enum co_sdo_type type)
 	}
 }
 
+static enum sdo_req_priority co__sdo_priority(enum co_sdo_priority priority)
+{
+	switch (priority) {
+	case CO_SDO_PRIO_REALTIME: return SDO_REQ_PRIO_REALTIME;
+	case CO_SDO_PRIO_DRIVER: return SDO_REQ_PRIO_DRIVER;
+	case CO_SDO_PRIO_CONFIG: return SDO_REQ_PRIO_CONFIG;
+	case CO_SDO_PRIO_BACKGROUND: return SDO_REQ_PRIO_BACKGROUND;
+	}
+
+	abort();
+	return 0;
+}
+
+void co_sdo_req_set_priority(struct co_sdo_req* self,
+			     enum co_sdo_priority priority)
+{
+	self->req.priority = co__sdo_priority(priority);
+}
+
 void co_sdo_req_set_data(struct co_sdo_req* self, const void* data, size_t size)
 {
-	vector_assign(&self->req.data, data, size);
+	sdo_req_set_data(&self->req, data, size);
 }
 
 void co_sdo_req_set_done_fn(struct co_sdo_req* self, co_sdo_done_fn fn)
@@ -300,9 +572,9 @@ int co_sdo_req_get_subindex(const struct co_sdo_req* self)
 	return self->req.subindex;
 }
 
-enum co_sdo_status co_sdo_req_get_status(const struct co_sdo_req* self)
+static enum co_sdo_status co__sdo_status(enum sdo_req_status status)
 {
-	switch (self->req.status) {
+	switch (status) {
 	case SDO_REQ_PENDING: return CO_SDO_REQ_PENDING;
 	case SDO_REQ_OK: return CO_SDO_REQ_OK;
 	case SDO_REQ_LOCAL_ABORT: return CO_SDO_REQ_LOCAL_ABORT;
@@ -315,6 +587,121 @@ enum co_sdo_status co_sdo_req_get_status(const struct co_sdo_req* self)
 	return -1;
 }
 
+enum co_sdo_status co_sdo_req_get_status(const struct co_sdo_req* self)
+{
+	return co__sdo_status(self->req.status);
+}
+
+static void co__sdo_batch_on_done(struct sdo_batch* batch)
+{
+	struct co_sdo_batch* self = (void*)batch;
+
+	co_sdo_batch_fn on_done = self->on_done;
+	if (on_done)
+		on_done(self->drv, self);
+}
+
+struct co_sdo_batch* co_sdo_batch_new(struct co_drv* drv, int flags)
+{
+	struct co_sdo_batch* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+
+	enum sdo_batch_flags batch_flags = 0;
+	if (flags & CO_SDO_BATCH_STOP_ON_ERROR)
+		batch_flags |= SDO_BATCH_STOP_ON_ERROR;
+
+	sdo_batch_init(&self->batch, SDO_REQ_PRIO_DRIVER, batch_flags);
+	self->batch.on_done = co__sdo_batch_on_done;
+	self->drv = drv;
+
+	return self;
+}
+
+void co_sdo_batch_ref(struct co_sdo_batch* self)
+{
+	sdo_batch_ref(&self->batch);
+}
+
+int co_sdo_batch_unref(struct co_sdo_batch* self)
+{
+	return sdo_batch_unref(&self->batch);
+}
+
+void co_sdo_batch_set_priority(struct co_sdo_batch* self,
+			       enum co_sdo_priority priority)
+{
+	self->batch.priority = co__sdo_priority(priority);
+}
+
+int co_sdo_batch_add_upload(struct co_sdo_batch* self, int index,
+			    int subindex)
+{
+	return sdo_batch_add_upload(&self->batch, index, subindex);
+}
+
+int co_sdo_batch_add_download(struct co_sdo_batch* self, int index,
+			      int subindex, const void* data, size_t size)
+{
+	return sdo_batch_add_download(&self->batch, index, subindex, data,
+				      size);
+}
+
+void co_sdo_batch_set_done_fn(struct co_sdo_batch* self, co_sdo_batch_fn fn)
+{
+	self->on_done = fn;
+}
+
+void co_sdo_batch_set_context(struct co_sdo_batch* self, void* context,
+			      co_free_fn free_fn)
+{
+	self->batch.context = context;
+	self->batch.context_free_fn = free_fn;
+}
+
+void* co_sdo_batch_get_context(const struct co_sdo_batch* self)
+{
+	return self->batch.context;
+}
+
+int co_sdo_batch_start(struct co_sdo_batch* self)
+{
+	int nodeid = co_get_nodeid(self->drv);
+	return sdo_batch_start(&self->batch, sdo_req_queue_get(nodeid));
+}
+
+size_t co_sdo_batch_get_count(const struct co_sdo_batch* self)
+{
+	return self->batch.n_items;
+}
+
+enum co_sdo_status co_sdo_batch_get_status(const struct co_sdo_batch* self)
+{
+	return co__sdo_status(sdo_batch_get_status(&self->batch));
+}
+
+enum co_sdo_status co_sdo_batch_get_item_status(const struct co_sdo_batch* self,
+						size_t i)
+{
+	const struct sdo_batch_item* item = sdo_batch_get_item(&self->batch, i);
+	return item ? co__sdo_status(item->status) : CO_SDO_REQ_PENDING;
+}
+
+const void* co_sdo_batch_get_item_data(const struct co_sdo_batch* self,
+				       size_t i)
+{
+	const struct sdo_batch_item* item = sdo_batch_get_item(&self->batch, i);
+	return item ? item->data.data : NULL;
+}
+
+size_t co_sdo_batch_get_item_size(const struct co_sdo_batch* self, size_t i)
+{
+	const struct sdo_batch_item* item = sdo_batch_get_item(&self->batch, i);
+	return item ? item->data.index : 0;
+}
+
 int co_sdo_send_blob(struct co_drv* self, int index, int subindex,
 		     const void* payload, size_t size)
 {
@@ -350,4 +737,21 @@ void co_start(struct co_drv* self)
 	co__start(co_get_nodeid(self));
 }
 
+int co_set_exec_mode(struct co_drv* self, enum co_exec_mode mode)
+{
+	return co_drv_exec_set_mode(self, mode);
+}
+
+void co_set_callback_budget(struct co_drv* self, uint32_t budget_us)
+{
+	co_drv_node(self)->watchdog.budget = budget_us;
+}
+
+int co_set_cycle_fn(struct co_drv* self, co_cycle_fn fn, uint32_t budget_us)
+{
+	self->cycle_fn = fn;
+	self->cycle_budget = budget_us;
+	return 0;
+}
+
 #pragma GCC visibility pop
@@ -0,0 +1,184 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mloop.h"
+#include "canopen/master.h"
+#include "canopen/drv_cycle.h"
+#include "canopen/drv_exec.h"
+#include "time-utils.h"
+#include "plog.h"
+
+/* Helpers take drivers off co_drv_cycle__drv by moving co_drv_cycle__next
+ * along. It holds the generation of the run in the upper half and the number
+ * of drivers next to the index, so that both are checked in the same compare
+ * and swap. A helper that only gets going after its run is over takes nothing
+ * from the next one.
+ */
+#define CO_DRV_CYCLE__GENERATION(x) ((uint32_t)((x) >> 32))
+#define CO_DRV_CYCLE__LIMIT(x) ((uint32_t)((x) >> 16) & 0xffff)
+#define CO_DRV_CYCLE__INDEX(x) ((uint32_t)(x) & 0xffff)
+
+static struct co_drv* co_drv_cycle__drv[CANOPEN_NODEID_MAX + 1];
+static uint64_t co_drv_cycle__next = 0;
+
+/* Both are protected by the mutex */
+static size_t co_drv_cycle__n = 0;
+static size_t co_drv_cycle__n_done = 0;
+
+static pthread_mutex_t co_drv_cycle__mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t co_drv_cycle__cond = PTHREAD_COND_INITIALIZER;
+
+/* Logged once until helpers can be started again */
+static int co_drv_cycle__is_helper_failing = 0;
+
+static void co_drv_cycle__call(struct co_drv* drv)
+{
+	struct co_master_node* node = co_drv_node(drv);
+
+	uint64_t start = fastclock_us();
+	drv->cycle_fn(drv, drv->cycle, drv->cycle_missing);
+	co_drv_watchdog_check(&node->cycle_watchdog,
+			      co_master_get_node_id(node), "cycle", start);
+}
+
+static void co_drv_cycle__run_job(struct co_drv* drv,
+				  const struct co_drv_job* job)
+{
+	drv->cycle_fn(drv, (unsigned int)job->n, (int)job->size);
+}
+
+/* Returns the number of drivers that were run */
+static size_t co_drv_cycle__work(uint32_t generation)
+{
+	size_t n_run = 0;
+	uint64_t next = __atomic_load_n(&co_drv_cycle__next, __ATOMIC_ACQUIRE);
+
+	while (CO_DRV_CYCLE__GENERATION(next) == generation
+	    && CO_DRV_CYCLE__INDEX(next) < CO_DRV_CYCLE__LIMIT(next)) {
+		if (!__atomic_compare_exchange_n(&co_drv_cycle__next, &next,
+						 next + 1, 0, __ATOMIC_ACQUIRE,
+						 __ATOMIC_ACQUIRE))
+			continue;
+
+		uint32_t index = CO_DRV_CYCLE__INDEX(next);
+		co_drv_cycle__call(co_drv_cycle__drv[index]);
+		++n_run;
+
+		next = __atomic_load_n(&co_drv_cycle__next, __ATOMIC_ACQUIRE);
+	}
+
+	return n_run;
+}
+
+static void co_drv_cycle__report(size_t n_run)
+{
+	if (n_run == 0)
+		return;
+
+	pthread_mutex_lock(&co_drv_cycle__mutex);
+	co_drv_cycle__n_done += n_run;
+	if (co_drv_cycle__n_done == co_drv_cycle__n)
+		pthread_cond_signal(&co_drv_cycle__cond);
+	pthread_mutex_unlock(&co_drv_cycle__mutex);
+}
+
+static void co_drv_cycle__help(struct mloop_work* work)
+{
+	uint32_t generation = (uintptr_t)mloop_work_get_context(work);
+	co_drv_cycle__report(co_drv_cycle__work(generation));
+}
+
+static int co_drv_cycle__start_helper(uint32_t generation)
+{
+	struct mloop_work* work = mloop_work_new(mloop_default());
+	if (!work)
+		return -1;
+
+	mloop_work_set_context(work, (void*)(uintptr_t)generation, NULL);
+	mloop_work_set_work_fn(work, co_drv_cycle__help);
+	int rc = mloop_work_start(work);
+	mloop_work_unref(work);
+
+	return rc;
+}
+
+static void co_drv_cycle__start_helpers(uint32_t generation, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		if (co_drv_cycle__start_helper(generation) < 0) {
+			if (!co_drv_cycle__is_helper_failing)
+				plog(LOG_WARNING, "drv_cycle: Could not start helpers; cycle callbacks are run on the main thread");
+
+			co_drv_cycle__is_helper_failing = 1;
+			return;
+		}
+
+	co_drv_cycle__is_helper_failing = 0;
+}
+
+static void co_drv_cycle__queue(struct co_drv* drv)
+{
+	struct co_drv_job job = {
+		.fn = co_drv_cycle__run_job,
+		.what = "cycle",
+		.n = (int)drv->cycle,
+		.size = drv->cycle_missing,
+		.watchdog = &co_drv_node(drv)->cycle_watchdog,
+	};
+
+	co_drv_exec_run(drv, &job);
+}
+
+void co_drv_cycle_run(struct co_drv* const* drv, size_t n, size_t n_helpers)
+{
+	size_t n_inline = 0;
+
+	for (size_t i = 0; i < n; ++i)
+		if (drv[i]->exec)
+			co_drv_cycle__queue(drv[i]);
+		else
+			co_drv_cycle__drv[n_inline++] = drv[i];
+
+	if (n_inline == 0)
+		return;
+
+	uint64_t next = __atomic_load_n(&co_drv_cycle__next, __ATOMIC_RELAXED);
+	uint32_t generation = CO_DRV_CYCLE__GENERATION(next) + 1;
+
+	pthread_mutex_lock(&co_drv_cycle__mutex);
+	co_drv_cycle__n = n_inline;
+	co_drv_cycle__n_done = 0;
+	pthread_mutex_unlock(&co_drv_cycle__mutex);
+
+	__atomic_store_n(&co_drv_cycle__next,
+			 (uint64_t)generation << 32 | (uint64_t)n_inline << 16,
+			 __ATOMIC_RELEASE);
+
+	/* The caller takes its share too, so this gets done even if the
+	 * workers are all busy
+	 */
+	co_drv_cycle__start_helpers(generation, n_helpers < n_inline
+						? n_helpers : n_inline - 1);
+
+	co_drv_cycle__report(co_drv_cycle__work(generation));
+
+	pthread_mutex_lock(&co_drv_cycle__mutex);
+	while (co_drv_cycle__n_done < co_drv_cycle__n)
+		pthread_cond_wait(&co_drv_cycle__cond, &co_drv_cycle__mutex);
+	pthread_mutex_unlock(&co_drv_cycle__mutex);
+}
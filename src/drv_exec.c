@@ -0,0 +1,298 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "canopen/master.h"
+#include "canopen/drv_exec.h"
+#include "co_atomic.h"
+#include "time-utils.h"
+#include "plog.h"
+
+struct co_drv_exec__slot {
+	struct co_drv_job job;
+	uint8_t data[64];
+	struct co_emcy emcy;
+};
+
+struct co_drv_exec {
+	struct co_drv* drv;
+	pthread_t thread;
+
+	/* head is only written by the driver thread and tail by the main loop.
+	 * Both count up forever and are reduced modulo the queue length.
+	 */
+	size_t head, tail;
+
+	int is_sleeping;
+	int is_stopping;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	struct co_drv_exec__slot slot[CO_DRV_EXEC_QUEUE_LENGTH];
+};
+
+static uint32_t co_drv_exec__default_budget = 0;
+
+static inline int co_drv_exec__is_power_of_two(uint64_t n)
+{
+	return (n & (n - 1)) == 0;
+}
+
+static inline uint32_t
+co_drv_exec__budget(const struct co_drv_watchdog* watchdog)
+{
+	return watchdog->budget ? watchdog->budget
+				: co_drv_exec__default_budget;
+}
+
+void co_drv_exec_set_default_budget(uint32_t budget_us)
+{
+	co_drv_exec__default_budget = budget_us;
+}
+
+int co_drv_watchdog_check(struct co_drv_watchdog* watchdog, int nodeid,
+			  const char* what, uint64_t start)
+{
+	uint64_t duration = fastclock_us() - start;
+
+	if (duration > watchdog->max_time)
+		watchdog->max_time = duration;
+
+	uint32_t budget = co_drv_exec__budget(watchdog);
+	if (budget == 0 || duration <= budget)
+		return 0;
+
+	/* Logging every overrun would only make things worse */
+	uint64_t n = ++watchdog->n_overruns;
+	if (co_drv_exec__is_power_of_two(n))
+		plog(LOG_WARNING, "Driver of node %d spent %" PRIu64 " us in %s callback, over its budget of %" PRIu32 " us (%" PRIu64 " times so far)",
+		     nodeid, duration, what, budget, n);
+
+	return 1;
+}
+
+static int co_drv_exec__wait(struct co_drv_exec* self)
+{
+	pthread_mutex_lock(&self->mutex);
+
+	/* The main loop reads this after it has moved the tail, so either it
+	 * sees that we are sleeping or we see the new tail
+	 */
+	co_atomic_store(&self->is_sleeping, 1);
+
+	while (!self->is_stopping
+	    && co_atomic_load(&self->tail) == self->head)
+		pthread_cond_wait(&self->cond, &self->mutex);
+
+	co_atomic_store(&self->is_sleeping, 0);
+
+	int is_stopping = self->is_stopping;
+
+	pthread_mutex_unlock(&self->mutex);
+
+	return is_stopping ? -1 : 0;
+}
+
+static void* co_drv_exec__main(void* arg)
+{
+	struct co_drv_exec* self = arg;
+	struct co_drv* drv = self->drv;
+	struct co_master_node* node = co_drv_node(drv);
+	int nodeid = co_master_get_node_id(node);
+
+	while (!co_atomic_load(&self->is_stopping)) {
+		size_t head = self->head;
+
+		if (co_atomic_load(&self->tail) == head) {
+			if (co_drv_exec__wait(self) < 0)
+				break;
+			continue;
+		}
+
+		struct co_drv_exec__slot* slot =
+			&self->slot[head % CO_DRV_EXEC_QUEUE_LENGTH];
+
+		struct co_drv_watchdog* watchdog = slot->job.watchdog
+						  ? slot->job.watchdog
+						  : &node->watchdog;
+
+		uint64_t start = fastclock_us();
+		slot->job.fn(drv, &slot->job);
+		co_drv_watchdog_check(watchdog, nodeid, slot->job.what, start);
+
+		co_atomic_store(&self->head, head + 1);
+	}
+
+	return NULL;
+}
+
+static int co_drv_exec__push(struct co_drv_exec* self,
+			     const struct co_drv_job* job)
+{
+	size_t tail = self->tail;
+
+	if (tail - co_atomic_load(&self->head) >= CO_DRV_EXEC_QUEUE_LENGTH)
+		return -1;
+
+	struct co_drv_exec__slot* slot =
+		&self->slot[tail % CO_DRV_EXEC_QUEUE_LENGTH];
+
+	slot->job = *job;
+
+	if (job->data) {
+		size_t size = job->size < sizeof(slot->data) ? job->size
+							     : sizeof(slot->data);
+		memcpy(slot->data, job->data, size);
+		slot->job.data = slot->data;
+		slot->job.size = size;
+	}
+
+	if (job->emcy) {
+		slot->emcy = *job->emcy;
+		slot->job.emcy = &slot->emcy;
+	}
+
+	co_atomic_store(&self->tail, tail + 1);
+
+	if (co_atomic_load(&self->is_sleeping)) {
+		pthread_mutex_lock(&self->mutex);
+		pthread_cond_signal(&self->cond);
+		pthread_mutex_unlock(&self->mutex);
+	}
+
+	return 0;
+}
+
+static int co_drv_exec__start(struct co_drv* drv)
+{
+	if (drv->exec)
+		return 0;
+
+	struct co_drv_exec* self = calloc(1, sizeof(*self));
+	if (!self)
+		return -1;
+
+	self->drv = drv;
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->cond, NULL);
+
+	if (pthread_create(&self->thread, NULL, co_drv_exec__main, self) != 0)
+		goto failure;
+
+	char name[16];
+	snprintf(name, sizeof(name), "co-drv-%d",
+		 co_master_get_node_id(co_drv_node(drv)));
+	pthread_setname_np(self->thread, name);
+
+	drv->exec = self;
+	return 0;
+
+failure:
+	pthread_cond_destroy(&self->cond);
+	pthread_mutex_destroy(&self->mutex);
+	free(self);
+	return -1;
+}
+
+void co_drv_exec_stop(struct co_drv* drv)
+{
+	struct co_drv_exec* self = drv->exec;
+	if (!self)
+		return;
+
+	pthread_mutex_lock(&self->mutex);
+	co_atomic_store(&self->is_stopping, 1);
+	pthread_cond_signal(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+
+	pthread_join(self->thread, NULL);
+
+	pthread_cond_destroy(&self->cond);
+	pthread_mutex_destroy(&self->mutex);
+	free(self);
+
+	drv->exec = NULL;
+}
+
+int co_drv_exec_set_mode(struct co_drv* drv, enum co_exec_mode mode)
+{
+	switch (mode) {
+	case CO_EXEC_INLINE:
+		co_drv_exec_stop(drv);
+		break;
+	case CO_EXEC_THREAD:
+		if (co_drv_exec__start(drv) < 0)
+			return -1;
+		break;
+	case CO_EXEC_AUTO:
+		break;
+	default:
+		return -1;
+	}
+
+	drv->exec_mode = mode;
+	return 0;
+}
+
+static void co_drv_exec__demote(struct co_drv* drv, int nodeid)
+{
+	if (co_drv_exec__start(drv) < 0) {
+		plog(LOG_ERROR, "Could not move the driver of node %d to a thread of its own",
+		     nodeid);
+		return;
+	}
+
+	plog(LOG_WARNING, "Driver of node %d keeps going over its budget; its callbacks now run on a thread of their own",
+	     nodeid);
+}
+
+void co_drv_exec_run(struct co_drv* drv, const struct co_drv_job* job)
+{
+	struct co_master_node* node = co_drv_node(drv);
+	struct co_drv_watchdog* watchdog = job->watchdog ? job->watchdog
+							 : &node->watchdog;
+
+	if (drv->exec) {
+		if (co_drv_exec__push(drv->exec, job) == 0)
+			return;
+
+		uint64_t n = ++node->watchdog.n_dropped;
+		if (co_drv_exec__is_power_of_two(n))
+			plog(LOG_WARNING, "Driver of node %d is falling behind; dropped %s (%" PRIu64 " callbacks so far)",
+			     co_master_get_node_id(node), job->what, n);
+		return;
+	}
+
+	if (co_drv_exec__budget(watchdog) == 0) {
+		job->fn(drv, job);
+		return;
+	}
+
+	uint64_t start = fastclock_us();
+	job->fn(drv, job);
+
+	int nodeid = co_master_get_node_id(node);
+	if (!co_drv_watchdog_check(watchdog, nodeid, job->what, start))
+		return;
+
+	if (drv->exec_mode == CO_EXEC_AUTO && watchdog == &node->watchdog
+	 && watchdog->n_overruns >= CO_DRV_EXEC_DEMOTE_COUNT)
+		co_drv_exec__demote(drv, nodeid);
+}
@@ -0,0 +1,384 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "canopen/master.h"
+#include "canopen/drv_registry.h"
+#include "string-utils.h"
+#include "plog.h"
+
+#ifndef DRIVER_PATH
+#define DRIVER_PATH "/usr/lib/canopen"
+#endif
+
+#define DRV_REGISTRY__PREFIX "co_drv_"
+#define DRV_REGISTRY__SUFFIX ".so"
+
+size_t strlcpy(char*, const char*, size_t);
+
+struct drv_registry__entry {
+	char name[64];
+	char path[256];
+	void* dso;
+	co_drv_init_fn init_fn;
+	int fd; /* The file that dso was loaded from */
+	void* old_dso; /* Kept open during a reload */
+	int old_fd;
+	int is_broken;
+};
+
+static struct drv_registry__entry* drv_registry__entries = NULL;
+static size_t drv_registry__size = 0;
+static int drv_registry__is_scanned = 0;
+static pthread_mutex_t drv_registry__mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int drv_registry__cmp(const void* a, const void* b)
+{
+	const struct drv_registry__entry* x = a;
+	const struct drv_registry__entry* y = b;
+	return strcmp(x->name, y->name);
+}
+
+static void drv_registry__dlclose(void* dso, int fd)
+{
+	dlclose(dso);
+
+	if (fd >= 0)
+		close(fd);
+}
+
+static void drv_registry__clear(void)
+{
+	for (size_t i = 0; i < drv_registry__size; ++i) {
+		struct drv_registry__entry* entry = &drv_registry__entries[i];
+
+		if (entry->dso)
+			drv_registry__dlclose(entry->dso, entry->fd);
+
+		if (entry->old_dso && entry->old_dso != entry->dso)
+			drv_registry__dlclose(entry->old_dso, entry->old_fd);
+	}
+
+	free(drv_registry__entries);
+	drv_registry__entries = NULL;
+	drv_registry__size = 0;
+	drv_registry__is_scanned = 0;
+}
+
+/* Returns the driver name or NULL if the file is not a driver */
+static const char* drv_registry__name(char* dst, size_t size,
+				      const char* file)
+{
+	size_t prefix_len = strlen(DRV_REGISTRY__PREFIX);
+	size_t suffix_len = strlen(DRV_REGISTRY__SUFFIX);
+	size_t len = strlen(file);
+
+	if (len <= prefix_len + suffix_len
+	 || strncmp(file, DRV_REGISTRY__PREFIX, prefix_len) != 0
+	 || strcmp(file + len - suffix_len, DRV_REGISTRY__SUFFIX) != 0)
+		return NULL;
+
+	size_t name_len = len - prefix_len - suffix_len;
+	if (name_len >= size)
+		return NULL;
+
+	memcpy(dst, file + prefix_len, name_len);
+	dst[name_len] = '\0';
+
+	return string_tolower(dst);
+}
+
+static int drv_registry__scan(const char* dir)
+{
+	struct drv_registry__entry* entries = NULL;
+	size_t size = 0, capacity = 0;
+
+	DIR* dirp = opendir(dir);
+	if (!dirp) {
+		drv_registry__is_scanned = 1;
+		return -1;
+	}
+
+	struct dirent* dirent;
+	while ((dirent = readdir(dirp))) {
+		char name[64];
+		if (!drv_registry__name(name, sizeof(name), dirent->d_name))
+			continue;
+
+		if (size >= capacity) {
+			size_t new_capacity = capacity ? capacity * 2 : 16;
+			void* new_entries = realloc(entries,
+					new_capacity * sizeof(*entries));
+			if (!new_entries)
+				goto failure;
+
+			entries = new_entries;
+			capacity = new_capacity;
+		}
+
+		struct drv_registry__entry* entry = &entries[size++];
+		memset(entry, 0, sizeof(*entry));
+		strlcpy(entry->name, name, sizeof(entry->name));
+		snprintf(entry->path, sizeof(entry->path), "%s/%s", dir,
+			 dirent->d_name);
+		entry->fd = -1;
+		entry->old_fd = -1;
+	}
+
+	closedir(dirp);
+
+	qsort(entries, size, sizeof(*entries), drv_registry__cmp);
+
+	drv_registry__entries = entries;
+	drv_registry__size = size;
+	drv_registry__is_scanned = 1;
+	return size;
+
+failure:
+	free(entries);
+	closedir(dirp);
+	return -1;
+}
+
+int co_drv_registry_scan(const char* dir)
+{
+	pthread_mutex_lock(&drv_registry__mutex);
+	drv_registry__clear();
+	int rc = drv_registry__scan(dir);
+	pthread_mutex_unlock(&drv_registry__mutex);
+	return rc;
+}
+
+static struct drv_registry__entry* drv_registry__find(const char* name)
+{
+	if (!drv_registry__is_scanned)
+		drv_registry__scan(DRIVER_PATH);
+
+	struct drv_registry__entry key;
+	strlcpy(key.name, name, sizeof(key.name));
+	string_tolower(key.name);
+
+	return bsearch(&key, drv_registry__entries, drv_registry__size,
+		       sizeof(key), drv_registry__cmp);
+}
+
+int co_drv_registry_has(const char* name)
+{
+	pthread_mutex_lock(&drv_registry__mutex);
+	int rc = drv_registry__find(name) != NULL;
+	pthread_mutex_unlock(&drv_registry__mutex);
+	return rc;
+}
+
+/* dlopen() hands out a DSO that is already open under the same name or from
+ * the same file. While the old DSO is kept open for a reload, a file that has
+ * been replaced is opened under the name of its descriptor instead, which is
+ * unique for as long as the descriptor stays open.
+ */
+static void* drv_registry__dlopen(struct drv_registry__entry* entry)
+{
+	if (!entry->old_dso)
+		return dlopen(entry->path, RTLD_NOW | RTLD_LOCAL);
+
+	struct stat st, old_st;
+	if (fstat(entry->fd, &st) == 0 && fstat(entry->old_fd, &old_st) == 0
+	 && st.st_dev == old_st.st_dev && st.st_ino == old_st.st_ino) {
+		close(entry->fd);
+		entry->fd = entry->old_fd;
+		return entry->old_dso;
+	}
+
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", entry->fd);
+
+	return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+}
+
+static int drv_registry__open(struct drv_registry__entry* entry)
+{
+	if (entry->dso)
+		return 0;
+
+	if (entry->is_broken)
+		return -1;
+
+	entry->fd = open(entry->path, O_RDONLY | O_CLOEXEC);
+	entry->dso = entry->fd >= 0 ? drv_registry__dlopen(entry) : NULL;
+	const char* err = dlerror();
+	if (!entry->dso) {
+		plog(LOG_ERROR, "driver: Failed to load driver for '%s': %s",
+		     entry->name, err ? err : "Could not open the file");
+		goto failure;
+	}
+
+	entry->init_fn = dlsym(entry->dso, "co_drv_init");
+	dlerror();
+	if (entry->init_fn)
+		return 0;
+
+	plog(LOG_ERROR, "driver: DSO for '%s' does not export an 'init' function",
+	     entry->name);
+
+	dlclose(entry->dso);
+	entry->dso = NULL;
+failure:
+	if (entry->fd >= 0)
+		close(entry->fd);
+
+	entry->fd = -1;
+	entry->is_broken = 1;
+	return -1;
+}
+
+int co_drv_registry_get(struct co_drv* drv, const char* name)
+{
+	int rc = -1;
+
+	pthread_mutex_lock(&drv_registry__mutex);
+
+	struct drv_registry__entry* entry = drv_registry__find(name);
+	if (!entry || drv_registry__open(entry) < 0)
+		goto done;
+
+	drv->dso = entry->dso;
+	drv->init_fn = entry->init_fn;
+	rc = 0;
+
+done:
+	pthread_mutex_unlock(&drv_registry__mutex);
+	return rc;
+}
+
+void* co_drv_registry_peek(const char* name)
+{
+	pthread_mutex_lock(&drv_registry__mutex);
+	struct drv_registry__entry* entry = drv_registry__find(name);
+	void* dso = entry ? entry->dso : NULL;
+	pthread_mutex_unlock(&drv_registry__mutex);
+	return dso;
+}
+
+int co_drv_registry_close(const void* dso)
+{
+	int rc = -1;
+
+	pthread_mutex_lock(&drv_registry__mutex);
+
+	for (size_t i = 0; i < drv_registry__size; ++i) {
+		struct drv_registry__entry* entry = &drv_registry__entries[i];
+		if (!dso || entry->dso != dso)
+			continue;
+
+		drv_registry__dlclose(entry->dso, entry->fd);
+		entry->dso = NULL;
+		entry->fd = -1;
+		entry->init_fn = NULL;
+		entry->is_broken = 0;
+		rc = 0;
+		break;
+	}
+
+	pthread_mutex_unlock(&drv_registry__mutex);
+	return rc;
+}
+
+static struct drv_registry__entry* drv_registry__find_old(const void* dso)
+{
+	for (size_t i = 0; i < drv_registry__size; ++i)
+		if (dso && drv_registry__entries[i].old_dso == dso)
+			return &drv_registry__entries[i];
+
+	return NULL;
+}
+
+int co_drv_registry_begin_reload(const void* dso)
+{
+	int rc = -1;
+
+	pthread_mutex_lock(&drv_registry__mutex);
+
+	for (size_t i = 0; i < drv_registry__size; ++i) {
+		struct drv_registry__entry* entry = &drv_registry__entries[i];
+		if (!dso || entry->dso != dso || entry->old_dso)
+			continue;
+
+		entry->old_dso = entry->dso;
+		entry->old_fd = entry->fd;
+		entry->dso = NULL;
+		entry->fd = -1;
+		entry->init_fn = NULL;
+		entry->is_broken = 0;
+		rc = 0;
+		break;
+	}
+
+	pthread_mutex_unlock(&drv_registry__mutex);
+	return rc;
+}
+
+int co_drv_registry_commit_reload(const void* dso)
+{
+	pthread_mutex_lock(&drv_registry__mutex);
+
+	struct drv_registry__entry* entry = drv_registry__find_old(dso);
+	if (entry) {
+		/* An unchanged file gives back the old DSO */
+		if (entry->old_dso != entry->dso)
+			drv_registry__dlclose(entry->old_dso, entry->old_fd);
+
+		entry->old_dso = NULL;
+		entry->old_fd = -1;
+	}
+
+	pthread_mutex_unlock(&drv_registry__mutex);
+	return entry ? 0 : -1;
+}
+
+int co_drv_registry_revert_reload(const void* dso)
+{
+	pthread_mutex_lock(&drv_registry__mutex);
+
+	struct drv_registry__entry* entry = drv_registry__find_old(dso);
+	if (entry) {
+		if (entry->dso && entry->dso != entry->old_dso)
+			drv_registry__dlclose(entry->dso, entry->fd);
+
+		entry->dso = entry->old_dso;
+		entry->fd = entry->old_fd;
+		entry->init_fn = dlsym(entry->dso, "co_drv_init");
+		entry->is_broken = 0;
+		entry->old_dso = NULL;
+		entry->old_fd = -1;
+	}
+
+	pthread_mutex_unlock(&drv_registry__mutex);
+	return entry ? 0 : -1;
+}
+
+void co_drv_registry_clear(void)
+{
+	pthread_mutex_lock(&drv_registry__mutex);
+	drv_registry__clear();
+	pthread_mutex_unlock(&drv_registry__mutex);
+}
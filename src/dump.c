@@ -14,7 +14,12 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "socketcan.h"
 #include "canopen.h"
@@ -23,14 +28,19 @@
 #include "canopen/network.h"
 #include "canopen/heartbeat.h"
 #include "canopen/emcy.h"
+#include "canopen/timestamp.h"
 #include "canopen/dump.h"
+#include "canopen/bus_load.h"
 #include "net-util.h"
 #include "sock.h"
+#include "sock-udp.h"
 #include "canopen/sdo-dict.h"
 #include "vector.h"
 #include "canopen/error.h"
 #include "time-utils.h"
 #include "trace-buffer.h"
+#include "trace-file.h"
+#include "trace-format.h"
 
 #ifndef CAN_MAX_DLC
 #define CAN_MAX_DLC 8
@@ -38,28 +48,222 @@
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+#define OUT_BUFFER_SIZE 65536
+#define OUT_LINE_MAX 1024
+#define DUMP_BATCH_SIZE 64
+
 #define printx(cf, fmt, ...) \
-	printf(fmt "%s\n", ## __VA_ARGS__, (cf)->can_id & CAN_RTR_FLAG ? " [RTR]" : "")
+do { \
+	out_printf(fmt, ## __VA_ARGS__); \
+	out_eol(cf); \
+} while (0)
 
 struct node_state {
 	uint32_t current_mux;
 	struct vector sdo_data;
 	int device_type;
+
+	/* Statistics for the current interval */
+	uint64_t n_frames;
+	uint64_t n_emcy;
+	uint64_t last_heartbeat;
+	uint64_t n_heartbeat_periods;
+	uint64_t heartbeat_period_sum;
+	uint64_t heartbeat_period_min;
+	uint64_t heartbeat_period_max;
+};
+
+enum dump_stats_class {
+	DUMP_STATS_NMT = 0,
+	DUMP_STATS_SYNC,
+	DUMP_STATS_TIME,
+	DUMP_STATS_EMCY,
+	DUMP_STATS_PDO,
+	DUMP_STATS_SDO,
+	DUMP_STATS_HEARTBEAT,
+	DUMP_STATS_OTHER,
+	DUMP_STATS_CLASS_COUNT
+};
+
+struct dump_stats {
+	uint64_t start;
+	uint64_t n_frames;
+	uint64_t n_bits;
+	uint64_t n_class[DUMP_STATS_CLASS_COUNT];
+	uint64_t n_sdo_transfers;
+	uint64_t n_sdo_aborts;
 };
 
 static enum co_dump_options options_ = 0;
 static struct node_state node_state_[127] = { 0 };
 static uint64_t current_time_ = 0;
 
+static uint64_t stats_interval_ = 1000000; /* us */
+static uint64_t stats_bitrate_ = 500000;
+static struct dump_stats stats_;
+
+/* With an output format set, frames are converted instead of decoded */
+static int is_exporting_ = 0;
+static enum trace_format export_format_;
+static struct trace_export export_;
+
+/* Output is gathered in a large buffer and written to stdout when the buffer
+ * fills up, after each batch of frames from the bus and at the end of a file.
+ * The common messages are formatted by hand; the rest go through
+ * out_printf().
+ */
+static char out_buffer_[OUT_BUFFER_SIZE];
+static size_t out_index_ = 0;
+
 char* strlcpy(char* dst, const char* src, size_t size);
 const char* hexdump(const void* data, size_t size);
 
-static inline void print_ts(void)
+static void out_write(const char* data, size_t size)
 {
-	uint64_t t = current_time_;
+	while (size > 0) {
+		ssize_t rc = write(STDOUT_FILENO, data, size);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return;
+		}
+
+		data += rc;
+		size -= rc;
+	}
+}
+
+static void out_flush(void)
+{
+	out_write(out_buffer_, out_index_);
+	out_index_ = 0;
+
+	if (is_exporting_)
+		fflush(stdout);
+}
+
+static inline void out_reserve(size_t size)
+{
+	if (out_index_ + size > sizeof(out_buffer_))
+		out_flush();
+}
+
+static void out_mem(const void* data, size_t size)
+{
+	if (size > sizeof(out_buffer_) / 2) {
+		out_flush();
+		out_write(data, size);
+		return;
+	}
+
+	out_reserve(size);
+	memcpy(&out_buffer_[out_index_], data, size);
+	out_index_ += size;
+}
+
+static inline void out_str(const char* str)
+{
+	out_mem(str, strlen(str));
+}
+
+static inline void out_char(char c)
+{
+	out_reserve(1);
+	out_buffer_[out_index_++] = c;
+}
+
+static void out_uint_width(uint64_t value, int width)
+{
+	char digits[24];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	while (n < width)
+		digits[n++] = '0';
+
+	out_reserve(n);
+
+	while (n)
+		out_buffer_[out_index_++] = digits[--n];
+}
+
+static inline void out_uint(uint64_t value)
+{
+	out_uint_width(value, 0);
+}
+
+static void out_hex_bytes(const void* data, size_t size)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	const uint8_t* p = data;
+
+	out_reserve(2 * size);
+
+	for (size_t i = 0; i < size; ++i) {
+		out_buffer_[out_index_++] = hex[p[i] >> 4];
+		out_buffer_[out_index_++] = hex[p[i] & 0xf];
+	}
+}
+
+__attribute__((format(printf, 1, 2)))
+static void out_printf(const char* fmt, ...)
+{
+	va_list ap;
+
+	out_reserve(OUT_LINE_MAX);
 
+	size_t room = sizeof(out_buffer_) - out_index_;
+
+	va_start(ap, fmt);
+	int n = vsnprintf(&out_buffer_[out_index_], room, fmt, ap);
+	va_end(ap);
+
+	if (n < 0)
+		return;
+
+	if ((size_t)n < room) {
+		out_index_ += n;
+		return;
+	}
+
+	/* Long messages get a buffer of their own */
+	char* str = malloc(n + 1);
+	if (!str)
+		return;
+
+	va_start(ap, fmt);
+	vsnprintf(str, n + 1, fmt, ap);
+	va_end(ap);
+
+	out_mem(str, n);
+	free(str);
+}
+
+static inline void out_eol(const struct can_frame* cf)
+{
+	if (cf->can_id & CAN_RTR_FLAG)
+		out_str(" [RTR]");
+
+	out_char('\n');
+}
+
+static void print_time(uint64_t t)
+{
+	out_uint(t / 1000000ULL);
+	out_char('.');
+	out_uint_width(t % 1000000ULL, 6);
+	out_char(' ');
+}
+
+static inline void print_ts(void)
+{
 	if (options_ & CO_DUMP_TIMESTAMP)
-		printf("%llu.%06llu ", t / 1000000ULL, t % 1000000ULL);
+		print_time(current_time_);
 }
 
 static inline struct node_state* get_node_state(int nodeid)
@@ -98,10 +302,16 @@ static int dump_nmt(struct can_frame* cf)
 
 	print_ts();
 
+	out_str("NMT ");
+
 	if (nodeid == 0)
-		printx(cf, "NMT ALL %s", nmt_cs_str(cs));
+		out_str("ALL");
 	else
-		printx(cf, "NMT %d %s", nodeid, nmt_cs_str(cs));
+		out_uint(nodeid);
+
+	out_char(' ');
+	out_str(nmt_cs_str(cs));
+	out_eol(cf);
 
 	return 0;
 }
@@ -114,7 +324,8 @@ static int dump_sync(struct can_frame* cf)
 	(void)cf;
 
 	print_ts();
-	printx(cf, "SYNC");
+	out_str("SYNC");
+	out_eol(cf);
 
 	return 0;
 }
@@ -124,10 +335,23 @@ static int dump_timestamp(struct can_frame* cf)
 	if (!(options_ & CO_DUMP_FILTER_TIMESTAMP))
 		return 0;
 
-	(void)cf;
-
 	print_ts();
-	printx(cf, "TIMESTAMP TODO");
+
+	if (!timestamp_is_valid(cf)) {
+		printx(cf, "TIMESTAMP invalid length %d", cf->can_dlc);
+		return 0;
+	}
+
+	uint64_t t = timestamp_get(cf);
+	time_t seconds = t / 1000000ULL;
+
+	struct tm tm;
+	char buffer[32];
+	strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S",
+		 gmtime_r(&seconds, &tm));
+
+	printx(cf, "TIMESTAMP %s.%03llu", buffer,
+	       (unsigned long long)(t / 1000ULL % 1000ULL));
 
 	return 0;
 }
@@ -162,15 +386,27 @@ static int is_pdo_in_filter(int n)
 }
 
 static int dump_pdo(int type, int n, struct canopen_msg* msg,
-		    struct can_frame* cf)
+		    struct canfd_frame* cf)
 {
 	if (!is_pdo_in_filter(n))
 		return 0;
 
 	print_ts();
 
-	printx(cf, "%cPDO%d %d length=%d,data=%s", type, n, msg->id,
-	       cf->can_dlc, hexdump(cf->data, cf->can_dlc));
+	out_char(type);
+	out_str("PDO");
+	out_uint(n);
+	out_char(' ');
+	out_uint(msg->id);
+	out_str(" length=");
+	out_uint(cf->len);
+	out_str(",data=");
+	out_hex_bytes(cf->data, cf->len);
+
+	if (canfd_is_fd(cf))
+		out_str(" [FD]");
+
+	out_eol((struct can_frame*)cf);
 
 	return 0;
 }
@@ -198,7 +434,7 @@ static int dump_sdo_dl_init_req(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("RSDO %d init-download-%s index=%x,subindex=%d", msg->id,
+	out_printf("RSDO %d init-download-%s index=%x,subindex=%d", msg->id,
 	       is_expediated ? "expediated" : "segment", index, subindex);
 
 	if (!is_expediated && is_size_indicated && cf->can_dlc == CAN_MAX_DLC) {
@@ -250,20 +486,20 @@ static int dump_sdo_dl_seg_req(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("RSDO %d download-segment%s size=%d,data=%s", msg->id,
+	out_printf("RSDO %d download-segment%s size=%d,data=%s", msg->id,
 	       is_end ? "-end" : "", size, get_segment_data(state, data, size));
 
 	if (state && is_end) {
 		const void* final_data = state->sdo_data.data;
 		size_t final_size = state->sdo_data.index;
 
-		printf(",final-size=%d,final-data=%s", final_size,
+		out_printf(",final-size=%d,final-data=%s", final_size,
 		       get_segment_data(state, final_data, final_size));
 
 		state->current_mux = 0;
 	}
 
-	printx(cf, "");
+	out_eol(cf);
 	return 0;
 }
 
@@ -339,7 +575,7 @@ static int dump_sdo_ul_init_res(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("TSDO %d init-upload-%s index=%x,subindex=%d", msg->id,
+	out_printf("TSDO %d init-upload-%s index=%x,subindex=%d", msg->id,
 	       is_expediated ? "expediated" : "segment", index, subindex);
 
 	if (!is_expediated && is_size_indicated && cf->can_dlc == CAN_MAX_DLC) {
@@ -378,18 +614,18 @@ static int dump_sdo_ul_seg_res(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("TSDO %d upload-segment%s size=%d,data=%s", msg->id,
+	out_printf("TSDO %d upload-segment%s size=%d,data=%s", msg->id,
 	       is_end ? "-end" : "", size, get_segment_data(state, data, size));
 
 	if (state && is_end) {
 		const void* final_data = state->sdo_data.data;
 		size_t final_size = state->sdo_data.index;
 
-		printf(",final-size=%d,final-data=%s", final_size,
+		out_printf(",final-size=%d,final-data=%s", final_size,
 		       get_segment_data(state, final_data, final_size));
 	}
 
-	printx(cf, "");
+	out_eol(cf);
 	return 0;
 }
 
@@ -455,20 +691,27 @@ static int dump_heartbeat(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
+	out_str("HEARTBEAT ");
+	out_uint(msg->id);
+
 	if (heartbeat_is_bootup(cf)) {
-		printx(cf, "HEARTBEAT %d bootup", msg->id);
+		out_str(" bootup");
 	} else if (state == 1) {
-		printx(cf, "HEARTBEAT %d poll", msg->id);
+		out_str(" poll");
 	} else {
-		printx(cf, "HEARTBEAT %d state=%s", msg->id, state_str(state));
+		out_str(" state=");
+		out_str(state_str(state));
 	}
 
+	out_eol(cf);
+
 	return 0;
 }
 
-static int multiplex(struct can_frame* cf)
+static int multiplex(struct canfd_frame* cfd)
 {
 	struct canopen_msg msg;
+	struct can_frame* cf = (struct can_frame*)cfd;
 
 	if (canopen_get_object_type(&msg, cf) != 0)
 		return -1;
@@ -478,14 +721,14 @@ static int multiplex(struct can_frame* cf)
 	case CANOPEN_SYNC: return dump_sync(cf);
 	case CANOPEN_TIMESTAMP: return dump_timestamp(cf);
 	case CANOPEN_EMCY: return dump_emcy(&msg, cf);
-	case CANOPEN_TPDO1: return dump_pdo('T', 1, &msg, cf);
-	case CANOPEN_TPDO2: return dump_pdo('T', 2, &msg, cf);
-	case CANOPEN_TPDO3: return dump_pdo('T', 3, &msg, cf);
-	case CANOPEN_TPDO4: return dump_pdo('T', 4, &msg, cf);
-	case CANOPEN_RPDO1: return dump_pdo('R', 1, &msg, cf);
-	case CANOPEN_RPDO2: return dump_pdo('R', 2, &msg, cf);
-	case CANOPEN_RPDO3: return dump_pdo('R', 3, &msg, cf);
-	case CANOPEN_RPDO4: return dump_pdo('R', 4, &msg, cf);
+	case CANOPEN_TPDO1: return dump_pdo('T', 1, &msg, cfd);
+	case CANOPEN_TPDO2: return dump_pdo('T', 2, &msg, cfd);
+	case CANOPEN_TPDO3: return dump_pdo('T', 3, &msg, cfd);
+	case CANOPEN_TPDO4: return dump_pdo('T', 4, &msg, cfd);
+	case CANOPEN_RPDO1: return dump_pdo('R', 1, &msg, cfd);
+	case CANOPEN_RPDO2: return dump_pdo('R', 2, &msg, cfd);
+	case CANOPEN_RPDO3: return dump_pdo('R', 3, &msg, cfd);
+	case CANOPEN_RPDO4: return dump_pdo('R', 4, &msg, cfd);
 	case CANOPEN_TSDO: return dump_tsdo(&msg, cf);
 	case CANOPEN_RSDO: return dump_rsdo(&msg, cf);
 	case CANOPEN_HEARTBEAT: return dump_heartbeat(&msg, cf);
@@ -497,19 +740,283 @@ static int multiplex(struct can_frame* cf)
 	return -1;
 }
 
+static const char* stats_class_name_[DUMP_STATS_CLASS_COUNT] = {
+	[DUMP_STATS_NMT] = "nmt",
+	[DUMP_STATS_SYNC] = "sync",
+	[DUMP_STATS_TIME] = "time",
+	[DUMP_STATS_EMCY] = "emcy",
+	[DUMP_STATS_PDO] = "pdo",
+	[DUMP_STATS_SDO] = "sdo",
+	[DUMP_STATS_HEARTBEAT] = "heartbeat",
+	[DUMP_STATS_OTHER] = "other",
+};
+
+static enum dump_stats_class stats_class(enum canopen_object object)
+{
+	switch (object) {
+	case CANOPEN_NMT: return DUMP_STATS_NMT;
+	case CANOPEN_SYNC: return DUMP_STATS_SYNC;
+	case CANOPEN_TIMESTAMP: return DUMP_STATS_TIME;
+	case CANOPEN_EMCY: return DUMP_STATS_EMCY;
+	case CANOPEN_TPDO1: case CANOPEN_TPDO2:
+	case CANOPEN_TPDO3: case CANOPEN_TPDO4:
+	case CANOPEN_RPDO1: case CANOPEN_RPDO2:
+	case CANOPEN_RPDO3: case CANOPEN_RPDO4:
+		return DUMP_STATS_PDO;
+	case CANOPEN_TSDO: case CANOPEN_RSDO: return DUMP_STATS_SDO;
+	case CANOPEN_HEARTBEAT: return DUMP_STATS_HEARTBEAT;
+	default: break;
+	}
+
+	return DUMP_STATS_OTHER;
+}
+
+static void stats_on_heartbeat(struct node_state* state)
+{
+	uint64_t now = current_time_;
+
+	if (state->last_heartbeat && now > state->last_heartbeat) {
+		uint64_t period = now - state->last_heartbeat;
+
+		if (state->n_heartbeat_periods == 0
+		 || period < state->heartbeat_period_min)
+			state->heartbeat_period_min = period;
+
+		if (period > state->heartbeat_period_max)
+			state->heartbeat_period_max = period;
+
+		state->heartbeat_period_sum += period;
+		state->n_heartbeat_periods++;
+	}
+
+	state->last_heartbeat = now;
+}
+
+static void stats_on_sdo(const struct canopen_msg* msg,
+			 const struct can_frame* cf)
+{
+	if (cf->can_dlc < 1)
+		return;
+
+	int cs = sdo_get_cs(cf);
+
+	if (cs == SDO_CCS_ABORT) {
+		stats_.n_sdo_aborts++;
+		return;
+	}
+
+	if (msg->object == CANOPEN_RSDO
+	 && (cs == SDO_CCS_DL_INIT_REQ || cs == SDO_CCS_UL_INIT_REQ
+	  || cs == SDO_CCS_BLOCK_DL_REQ || cs == SDO_CCS_BLOCK_UL_REQ))
+		stats_.n_sdo_transfers++;
+}
+
+static void print_rate(const char* name, uint64_t count, double dt)
+{
+	out_printf(" %s=%.1f/s", name, count / dt);
+}
+
+static void stats_print(uint64_t now)
+{
+	double dt = (now - stats_.start) / 1e6;
+	if (dt <= 0.0)
+		return;
+
+	double load = 100.0 * stats_.n_bits / (stats_bitrate_ * dt);
+
+	print_time(now);
+	out_printf("bus-load=%.1f%%", load);
+	print_rate("frames", stats_.n_frames, dt);
+
+	for (int i = 0; i < DUMP_STATS_CLASS_COUNT; ++i)
+		if (stats_.n_class[i])
+			print_rate(stats_class_name_[i], stats_.n_class[i], dt);
+
+	print_rate("sdo-transfers", stats_.n_sdo_transfers, dt);
+	out_printf(" sdo-aborts=%llu\n",
+		   (unsigned long long)stats_.n_sdo_aborts);
+
+	for (int i = 0; i < 127; ++i) {
+		struct node_state* state = &node_state_[i];
+		if (!state->n_frames)
+			continue;
+
+		out_printf("  node %d:", i + 1);
+		print_rate("frames", state->n_frames, dt);
+
+		if (state->n_emcy)
+			out_printf(" emcy=%llu",
+				   (unsigned long long)state->n_emcy);
+
+		if (state->n_heartbeat_periods)
+			out_printf(" heartbeat-period=%.1fms,jitter=%.1fms",
+				   state->heartbeat_period_sum / 1e3
+				   / state->n_heartbeat_periods,
+				   (state->heartbeat_period_max
+				    - state->heartbeat_period_min) / 1e3);
+
+		out_char('\n');
+
+		state->n_frames = 0;
+		state->n_emcy = 0;
+		state->n_heartbeat_periods = 0;
+		state->heartbeat_period_sum = 0;
+		state->heartbeat_period_min = 0;
+		state->heartbeat_period_max = 0;
+	}
+
+	memset(&stats_, 0, sizeof(stats_));
+	stats_.start = now;
+}
+
+static void stats_on_frame(struct canfd_frame* cfd)
+{
+	struct canopen_msg msg = { 0 };
+	struct can_frame* cf = (struct can_frame*)cfd;
+	uint64_t now = current_time_;
+
+	if (!stats_.start)
+		stats_.start = now;
+
+	if (now >= stats_.start + stats_interval_)
+		stats_print(now);
+
+	int is_canopen = !(cf->can_id & CAN_EFF_FLAG)
+		      && canopen_get_object_type(&msg, cf) == 0;
+	enum dump_stats_class class = is_canopen ? stats_class(msg.object)
+						 : DUMP_STATS_OTHER;
+
+	stats_.n_frames++;
+	stats_.n_bits += co_bus_load_frame_bits(cfd);
+	stats_.n_class[class]++;
+
+	struct node_state* state = is_canopen ? get_node_state(msg.id) : NULL;
+	if (state)
+		state->n_frames++;
+
+	switch (class) {
+	case DUMP_STATS_EMCY:
+		if (state)
+			state->n_emcy++;
+		break;
+	case DUMP_STATS_SDO:
+		stats_on_sdo(&msg, cf);
+		break;
+	case DUMP_STATS_HEARTBEAT:
+		if (state)
+			stats_on_heartbeat(state);
+		break;
+	default:
+		break;
+	}
+}
+
+static void stats_finish(void)
+{
+	if (stats_.start && current_time_ > stats_.start)
+		stats_print(current_time_);
+}
+
+static void export_frame(const struct canfd_frame* cfd)
+{
+	struct tb_frame frame = {
+		.timestamp = current_time_,
+		.cfd = *cfd,
+	};
+
+	trace_export_frame(&export_, &frame);
+}
+
+static void process_frame(struct canfd_frame* cfd)
+{
+	if (is_exporting_)
+		export_frame(cfd);
+	else if (options_ & CO_DUMP_STATS)
+		stats_on_frame(cfd);
+	else
+		multiplex(cfd);
+}
+
+__attribute__((visibility("default")))
+void co_dump_set_stats_params(unsigned int interval_ms, unsigned int bitrate)
+{
+	if (interval_ms)
+		stats_interval_ = interval_ms * 1000ULL;
+
+	if (bitrate)
+		stats_bitrate_ = bitrate;
+}
+
+__attribute__((visibility("default")))
+int co_dump_set_output_format(const char* name)
+{
+	if (trace_format_from_string(&export_format_, name) < 0)
+		return -1;
+
+	is_exporting_ = 1;
+	return 0;
+}
+
+static int begin_export(const char* iface)
+{
+	static char buffer[1 << 20];
+
+	if (!is_exporting_)
+		return 0;
+
+	setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+
+	return trace_export_begin(&export_, stdout, export_format_, iface);
+}
+
+/* Frames lost from a multicast feed are reported as they are noticed */
+static void report_lost_frames(const struct sock* sock, uint64_t* n_lost)
+{
+	struct sock_udp_stats stats;
+	if (sock_get_udp_stats(sock, &stats) < 0 || stats.n_lost == *n_lost)
+		return;
+
+	fprintf(stderr, "Lost %llu frames from the multicast feed (%llu in total)\n",
+		(unsigned long long)(stats.n_lost - *n_lost),
+		(unsigned long long)stats.n_lost);
+
+	*n_lost = stats.n_lost;
+}
+
 static void run_dumper(struct sock* sock)
 {
-	struct can_frame cf;
+	uint64_t n_lost = 0;
+	struct canfd_frame cf[DUMP_BATCH_SIZE];
+	uint64_t ts[DUMP_BATCH_SIZE];
+
+	/* The TCP bridge is read one frame at a time. On CAN and UNIX
+	 * sockets, a batch holds whatever has queued up after the first frame.
+	 */
+	int is_packet = sock->type != SOCK_TYPE_TCP;
+	size_t n = is_packet ? DUMP_BATCH_SIZE : 1;
+	int flags = is_packet ? MSG_WAITFORONE : MSG_WAITALL;
 
 	while (1) {
-		memset(&cf, 0, sizeof(cf));
+		memset(cf, 0, n * sizeof(cf[0]));
 
-		if (sock_recv(sock, &cf, MSG_WAITALL) <= 0)
+		ssize_t count = sock_recv_fd_batch(sock, cf, ts, n, flags);
+		if (count <= 0)
 			break;
 
-		current_time_ = gettime_us(CLOCK_REALTIME);
-		multiplex(&cf);
+		report_lost_frames(sock, &n_lost);
+
+		for (ssize_t i = 0; i < count; ++i) {
+			current_time_ = ts[i];
+			process_frame(&cf[i]);
+		}
+
+		out_flush();
 	}
+
+	if (options_ & CO_DUMP_STATS)
+		stats_finish();
+
+	out_flush();
 }
 
 static void resolve_filters(enum co_dump_options options)
@@ -521,39 +1028,77 @@ static void resolve_filters(enum co_dump_options options)
 		  : CO_DUMP_FILTER_MASK;
 }
 
-static int dump_file(const char* path, enum co_dump_options options)
+static void dump_trace_frame(const struct tb_frame* frame, void* context)
 {
-	FILE* stream = fopen(path, "r");
-	if (!stream)
-		return -1;
+	(void)context;
 
-	struct tb_frame frame;
-	while (fread(&frame, sizeof(frame), 1, stream)) {
-		current_time_ = frame.timestamp;
-		multiplex(&frame.cf);
-	}
+	struct canfd_frame cfd = frame->cfd;
 
-	fclose(stream);
-	return 0;
+	current_time_ = frame->timestamp;
+	process_frame(&cfd);
+}
+
+static void dump_filtered_frame(const struct tb_frame* frame, void* context)
+{
+	const struct trace_file_filter* filter = context;
+
+	if (trace_file_filter_match(filter, frame))
+		dump_trace_frame(frame, NULL);
+}
+
+static int dump_file(const char* path, enum co_dump_options options,
+		     const struct co_dump_range* range)
+{
+	struct trace_file_filter filter = {
+		.from = range ? range->from : 0,
+		.to = range ? range->to : 0,
+		.nodeid = range ? range->nodeid : -1,
+	};
+
+	if (options & CO_DUMP_RECOVER)
+		return tb_recover(path, dump_filtered_frame, &filter);
+
+	return trace_read(path, &filter, dump_trace_frame, NULL);
 }
 
 __attribute__((visibility("default")))
-int co_dump(const char* addr, enum co_dump_options options)
+int co_dump_file(const char* path, enum co_dump_options options,
+		 const struct co_dump_range* range)
 {
 	vector_init(&string_buffer_, 256);
 	node_state_init();
 
 	resolve_filters(options);
 
-	if (options & CO_DUMP_FILE) {
-		if (dump_file(addr, options) < 0) {
-			perror("Could not read file");
-			return 1;
-		}
+	if (begin_export("can0") < 0)
+		return 1;
 
-		return 0;
+	int rc = dump_file(path, options, range);
+
+	if (options_ & CO_DUMP_STATS)
+		stats_finish();
+
+	out_flush();
+
+	if (rc < 0) {
+		perror("Could not read file");
+		return 1;
 	}
 
+	return 0;
+}
+
+__attribute__((visibility("default")))
+int co_dump(const char* addr, enum co_dump_options options)
+{
+	if (options & (CO_DUMP_FILE | CO_DUMP_RECOVER))
+		return co_dump_file(addr, options, NULL);
+
+	vector_init(&string_buffer_, 256);
+	node_state_init();
+
+	resolve_filters(options);
+
 	struct sock sock;
 	enum sock_type type = options & CO_DUMP_TCP ? SOCK_TYPE_TCP
 						    : SOCK_TYPE_CAN;
@@ -562,8 +1107,15 @@ int co_dump(const char* addr, enum co_dump_options options)
 		return 1;
 	}
 
-	if (type == SOCK_TYPE_CAN)
+	if (type == SOCK_TYPE_CAN) {
 		net_fix_sndbuf(sock.fd);
+		sock_enable_fd_frames(&sock);
+	}
+
+	if (begin_export(type == SOCK_TYPE_CAN ? addr : "can0") < 0) {
+		sock_close(&sock);
+		return 1;
+	}
 
 	run_dumper(&sock);
 
@@ -15,7 +15,14 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <strings.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <ftw.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/resource.h>
 #include <errno.h>
 #include <stddef.h>
@@ -23,14 +30,10 @@
 #include "plog.h"
 
 #include "vector.h"
-#include "sys/tree.h"
 
 #include "canopen/eds.h"
 #include "ini_parser.h"
-
-#ifndef __unused
-#define __unused __attribute__((unused))
-#endif
+#include "co_atomic.h"
 
 #ifndef ABS
 #define ABS(a) ((a) > 0 ? (a) : -(a))
@@ -40,50 +43,75 @@
 #define EDS_PATH "/var/marel/canmaster/eds.d"
 #endif
 
-struct eds_obj_node {
-	struct eds_obj obj;
+#ifndef EDS_IMAGE_PATH
+#define EDS_IMAGE_PATH EDS_PATH ".db"
+#endif
 
-	RB_ENTRY(eds_obj_node) rb_entry;
+/* The compiled image is laid out as a header followed by the EDS records,
+ * the object records of all EDS files sorted by key within each file, and a
+ * table of nul terminated strings. Strings are referred to by their offset in
+ * the table. Everything is in host byte order, as the image is made on the
+ * machine that uses it.
+ */
+#define EDS_IMAGE_MAGIC 0x42445345 /* "ESDB" */
+#define EDS_IMAGE_VERSION 1
+#define EDS_IMAGE_NO_STRING UINT32_MAX
+
+/* Describes the EDS files that an image was compiled from */
+struct eds_image_fingerprint {
+	uint64_t mtime;
+	uint64_t size;
+	uint32_t count;
+	uint32_t reserved;
+};
 
-	char buffer[0];
+struct eds_image_header {
+	uint32_t magic;
+	uint32_t version;
+	struct eds_image_fingerprint fingerprint;
+	uint32_t n_eds;
+	uint32_t n_objs;
+	uint32_t strings_size;
+	uint32_t reserved;
 };
 
-static inline int eds_obj_cmp(const struct eds_obj_node* o1,
-			      const struct eds_obj_node* o2)
-{
-	uint32_t k1 = o1->obj.key;
-	uint32_t k2 = o2->obj.key;
+struct eds_image_eds {
+	uint32_t vendor;
+	uint32_t product;
+	uint32_t revision;
+	uint32_t name;
+	uint32_t first_obj;
+	uint32_t n_objs;
+};
 
-	return k1 < k2 ? -1 : k1 > k2;
-}
+enum eds_image_string {
+	EDS_IMAGE_NAME = 0,
+	EDS_IMAGE_DEFAULT_VALUE,
+	EDS_IMAGE_LOW_LIMIT,
+	EDS_IMAGE_HIGH_LIMIT,
+	EDS_IMAGE_UNIT,
+	EDS_IMAGE_SCALING,
+	EDS_IMAGE_N_STRINGS,
+};
 
-RB_GENERATE_STATIC(eds_obj_tree, eds_obj_node, rb_entry, eds_obj_cmp);
+struct eds_image_obj {
+	uint32_t key;
+	uint16_t type;
+	uint16_t access;
+	uint32_t string[EDS_IMAGE_N_STRINGS];
+};
 
 size_t strlcpy(char*, const char*, size_t);
 
-static inline int eds__get_index(const struct eds_obj_node* node)
-{
-	return node->obj.key >> 8;
-}
-
-static inline int eds__get_subindex(const struct eds_obj_node* node)
-{
-	return node->obj.key & 0xff;
-}
-
-static inline void eds__set_index(struct eds_obj_node* node, int index)
-{
-	node->obj.key &= ~0xffff00;
-	node->obj.key |= index << 8;
-}
+static struct vector eds__db;
+static pthread_mutex_t eds__parse_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static inline void eds__set_subindex(struct eds_obj_node* node, int subindex)
-{
-	node->obj.key &= ~0xff;
-	node->obj.key |= subindex;
-}
+static const struct canopen_eds*
+eds__get_parsed(const struct canopen_eds* eds);
 
-static struct vector eds__db;
+static void* eds__image = NULL;
+static size_t eds__image_size = 0;
+static const char* eds__image_strings = NULL;
 
 struct canopen_eds* eds_db_get(int index)
 {
@@ -115,11 +143,11 @@ const struct canopen_eds* eds_db_find(int vendor, int product, int revision)
 			continue;
 		}
 
-		return eds;
+		return eds__get_parsed(eds);
 	}
 
 	if (best_match >= 0)
-		return eds_db_get(best_match);
+		return eds__get_parsed(eds_db_get(best_match));
 
 	return NULL;
 }
@@ -144,29 +172,89 @@ const struct canopen_eds* eds_db_find_by_name(const char* name)
 		best_match = eds;
 	}
 
-	return best_match;
+	return eds__get_parsed(best_match);
 }
 
-struct eds_obj_node* eds__obj_new(size_t buffer_size)
+static inline const char* eds__image_string(uint32_t offset)
 {
-	struct eds_obj_node* obj;
-	size_t size = sizeof(*obj) + buffer_size;
+	return offset == EDS_IMAGE_NO_STRING ? NULL
+					     : eds__image_strings + offset;
+}
 
-	obj = malloc(size);
-	if (!obj)
-		return 0;
+static struct eds_obj* eds__unpack_image(const struct canopen_eds* eds)
+{
+	struct eds_obj* objs = malloc(eds->n_objs * sizeof(*objs));
+	if (!objs)
+		return NULL;
+
+	const struct eds_image_obj* src = eds->image_objs;
+
+	for (size_t i = 0; i < eds->n_objs; ++i) {
+		struct eds_obj* obj = &objs[i];
+		const uint32_t* string = src[i].string;
+
+		obj->key = src[i].key;
+		obj->type = src[i].type;
+		obj->access = src[i].access;
+		obj->name = eds__image_string(string[EDS_IMAGE_NAME]);
+		obj->default_value =
+			eds__image_string(string[EDS_IMAGE_DEFAULT_VALUE]);
+		obj->low_limit = eds__image_string(string[EDS_IMAGE_LOW_LIMIT]);
+		obj->high_limit =
+			eds__image_string(string[EDS_IMAGE_HIGH_LIMIT]);
+		obj->unit = eds__image_string(string[EDS_IMAGE_UNIT]);
+		obj->scaling = eds__image_string(string[EDS_IMAGE_SCALING]);
+	}
+
+	return objs;
+}
+
+/* Returns the objects of the EDS, parsing the file or unpacking the image on
+ * first use, or NULL if it has none.
+ */
+static const struct eds_obj* eds__get_objs(const struct canopen_eds* eds)
+{
+	struct canopen_eds* self = (struct canopen_eds*)eds;
+
+	eds__get_parsed(eds);
+
+	if (eds->n_objs == 0)
+		return NULL;
+
+	struct eds_obj* objs = co_atomic_load(&self->objs);
+	if (objs || !eds->image_objs)
+		return objs;
 
-	memset(obj, 0, size);
+	/* Unpacking is done by whichever thread gets there first */
+	objs = eds__unpack_image(eds);
+	if (!objs)
+		return NULL;
+
+	if (!co_atomic_cas(&self->objs, (struct eds_obj*)NULL, objs)) {
+		free(objs);
+		objs = co_atomic_load(&self->objs);
+	}
+
+	return objs;
+}
 
-	return obj;
+static int eds__obj_cmp(const void* key, const void* obj)
+{
+	uint32_t k1 = *(const uint32_t*)key;
+	uint32_t k2 = ((const struct eds_obj*)obj)->key;
+	return k1 < k2 ? -1 : k1 > k2;
 }
 
 const struct eds_obj* eds_obj_find(const struct canopen_eds* eds,
 				   int index, int subindex)
 {
 	uint32_t key = (index << 8) | subindex;
-	void* cmp = (char*)&key;
-	return (void*)RB_FIND(eds_obj_tree, (void*)&eds->obj_tree, cmp);
+
+	const struct eds_obj* objs = eds__get_objs(eds);
+	if (!objs)
+		return NULL;
+
+	return bsearch(&key, objs, eds->n_objs, sizeof(*objs), eds__obj_cmp);
 }
 
 static inline int eds__extension_matches(const char* path, const char* ext)
@@ -177,12 +265,11 @@ static inline int eds__extension_matches(const char* path, const char* ext)
 
 static void eds__clear(struct canopen_eds* eds)
 {
-	struct eds_obj_node* node;
-	while (!RB_EMPTY(&eds->obj_tree)) {
-		node = RB_MIN(eds_obj_tree, &eds->obj_tree);
-		RB_REMOVE(eds_obj_tree, &eds->obj_tree, node);
-		free(node);
-	}
+	free(eds->objs);
+	eds->objs = NULL;
+
+	if (!eds->image_objs)
+		eds->n_objs = 0;
 }
 
 int eds__get_section_index(const char* str)
@@ -217,36 +304,53 @@ enum eds_obj_access eds__get_access_type(const char* str)
 	return 0;
 }
 
-static void eds__insert(struct canopen_eds* eds, struct eds_obj_node* node)
+struct eds__pending_obj {
+	struct eds_obj obj;
+	size_t order;
+};
+
+static int eds__pending_obj_cmp(const void* p1, const void* p2)
 {
-	struct eds_obj_node* existing;
+	const struct eds__pending_obj* o1 = p1;
+	const struct eds__pending_obj* o2 = p2;
 
-	existing = RB_INSERT(eds_obj_tree, &eds->obj_tree, node);
-	if (!existing)
-		return;
+	if (o1->obj.key != o2->obj.key)
+		return o1->obj.key < o2->obj.key ? -1 : 1;
 
-	RB_REMOVE(eds_obj_tree, &eds->obj_tree, existing);
-	free(existing);
+	return o1->order < o2->order ? -1 : o1->order > o2->order;
+}
 
-	RB_INSERT(eds_obj_tree, &eds->obj_tree, node);
+static inline size_t eds__string_size(const char* str)
+{
+	return str ? strlen(str) + 1 : 0;
 }
 
-static const char*
-eds__append_buffer_value(struct eds_obj_node* node, const char* value,
-			 size_t* index)
+static const char* eds__copy_string(char** buffer, const char* str)
 {
-	if (!value)
+	if (!str)
 		return NULL;
 
-	size_t i = *index;
-	*index += strlen(value) + 1;
-	return strcpy(&node->buffer[i], value);
-
+	char* dst = *buffer;
+	size_t size = strlen(str) + 1;
+	memcpy(dst, str, size);
+	*buffer += size;
+	return dst;
 }
 
-static int eds__convert_obj_tree(struct canopen_eds* eds, struct ini_file* ini)
+/* The objects are stored in a single block: an array sorted by key, followed
+ * by their strings. If an object appears more than once, the last one wins.
+ */
+static int eds__convert_objs(struct canopen_eds* eds, struct ini_file* ini)
 {
-	for (size_t i = 0; i < ini_get_length(ini); ++i) {
+	size_t n_sections = ini_get_length(ini);
+	size_t n = 0, strings_size = 0;
+
+	struct eds__pending_obj* pending =
+		malloc((n_sections ? n_sections : 1) * sizeof(*pending));
+	if (!pending)
+		return -1;
+
+	for (size_t i = 0; i < n_sections; ++i) {
 		const struct ini_section* section = ini_get_section(ini, i);
 
 		int index = eds__get_section_index(section->section);
@@ -265,116 +369,200 @@ static int eds__convert_obj_tree(struct canopen_eds* eds, struct ini_file* ini)
 		if (!access)
 			access = "ro";
 
-		const char* name = ini_find_key(section, "parametername");
-		const char* default_val = ini_find_key(section, "defaultvalue");
-		const char* low_limit	= ini_find_key(section, "lowlimit");
-		const char* high_limit	= ini_find_key(section, "highlimit");
-		const char* unit	= ini_find_key(section, "x-unit");
-		const char* scaling	= ini_find_key(section, "x-scaling");
-
-		size_t buffer_size = (name ? strlen(name) + 1 : 0)
-				   + (default_val ? strlen(default_val) + 1 : 0)
-				   + (low_limit ? strlen(low_limit) + 1 : 0)
-				   + (high_limit ? strlen(high_limit) + 1 : 0)
-				   + (unit ? strlen(unit) + 1 : 0)
-				   + (scaling ? strlen(scaling) + 1 : 0);
-
-		struct eds_obj_node* obj = eds__obj_new(buffer_size);
-		if (!obj)
-			return -1;
-
-		obj->obj.type = strtoul(type, NULL, 0);
-		obj->obj.access = eds__get_access_type(access);
-		obj->obj.key = (index << 8) | subindex;
-
-		size_t idx = 0;
-		obj->obj.name = eds__append_buffer_value(obj, name, &idx);
-		obj->obj.default_value
-			= eds__append_buffer_value(obj, default_val, &idx);
-		obj->obj.low_limit
-			= eds__append_buffer_value(obj, low_limit, &idx);
-		obj->obj.high_limit
-			= eds__append_buffer_value(obj, high_limit, &idx);
-		obj->obj.unit = eds__append_buffer_value(obj, unit, &idx);
-		obj->obj.scaling = eds__append_buffer_value(obj, scaling, &idx);
-
-		eds__insert(eds, obj);
+		struct eds_obj* obj = &pending[n].obj;
+		pending[n].order = n;
+		++n;
+
+		obj->type = strtoul(type, NULL, 0);
+		obj->access = eds__get_access_type(access);
+		obj->key = (index << 8) | subindex;
+		obj->name = ini_find_key(section, "parametername");
+		obj->default_value = ini_find_key(section, "defaultvalue");
+		obj->low_limit = ini_find_key(section, "lowlimit");
+		obj->high_limit = ini_find_key(section, "highlimit");
+		obj->unit = ini_find_key(section, "x-unit");
+		obj->scaling = ini_find_key(section, "x-scaling");
+	}
+
+	qsort(pending, n, sizeof(*pending), eds__pending_obj_cmp);
+
+	size_t n_unique = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (i + 1 < n && pending[i + 1].obj.key == pending[i].obj.key)
+			continue;
+
+		const struct eds_obj* obj = &pending[i].obj;
+		strings_size += eds__string_size(obj->name)
+			      + eds__string_size(obj->default_value)
+			      + eds__string_size(obj->low_limit)
+			      + eds__string_size(obj->high_limit)
+			      + eds__string_size(obj->unit)
+			      + eds__string_size(obj->scaling);
+
+		pending[n_unique++] = pending[i];
+	}
+
+	struct eds_obj* objs = malloc(n_unique * sizeof(*objs) + strings_size);
+	if (!objs && n_unique > 0) {
+		free(pending);
+		return -1;
+	}
+
+	char* strings = (char*)&objs[n_unique];
+
+	for (size_t i = 0; i < n_unique; ++i) {
+		const struct eds_obj* src = &pending[i].obj;
+		struct eds_obj* dst = &objs[i];
+
+		dst->key = src->key;
+		dst->type = src->type;
+		dst->access = src->access;
+		dst->name = eds__copy_string(&strings, src->name);
+		dst->default_value = eds__copy_string(&strings,
+						      src->default_value);
+		dst->low_limit = eds__copy_string(&strings, src->low_limit);
+		dst->high_limit = eds__copy_string(&strings, src->high_limit);
+		dst->unit = eds__copy_string(&strings, src->unit);
+		dst->scaling = eds__copy_string(&strings, src->scaling);
 	}
 
+	free(pending);
+
+	eds->objs = objs;
+	eds->n_objs = n_unique;
 	return 0;
 }
 
-static int eds__convert_ini(struct ini_file* ini)
+static char* eds__trim(char* str)
 {
-	const char* vendor = ini_find(ini, "deviceinfo", "vendornumber");
-	if (!vendor)
-		return -1;
+	while (isspace(*str))
+		++str;
 
-	const char* product = ini_find(ini, "deviceinfo", "productnumber");
-	if (!product)
-		return -1;
+	char* end = str + strlen(str);
+	while (end > str && isspace(end[-1]))
+		*--end = '\0';
+
+	return str;
+}
+
+/* Only the device info section is read here. The rest of the file is parsed
+ * when the EDS is first used.
+ */
+static int eds__index_file(const char* path)
+{
+	char line[512];
+	char vendor[64] = "", product[64] = "", revision[64] = "";
+	char name[256] = "";
+	int is_in_section = 0;
 
-	const char* revision = ini_find(ini, "deviceinfo", "revisionnumber");
-	if (!revision)
+	FILE* file = fopen(path, "r");
+	if (!file)
 		return -1;
 
-	const char* name = ini_find(ini, "deviceinfo", "productname");
-	if (!name)
+	while (fgets(line, sizeof(line), file)) {
+		char* str = eds__trim(line);
+
+		if (*str == '\0' || *str == ';')
+			continue;
+
+		if (*str == '[') {
+			if (is_in_section)
+				break;
+
+			is_in_section = strcasecmp(str, "[deviceinfo]") == 0;
+			continue;
+		}
+
+		char* eq = strchr(str, '=');
+		if (!is_in_section || !eq)
+			continue;
+
+		*eq = '\0';
+		const char* key = eds__trim(str);
+		const char* value = eds__trim(eq + 1);
+
+		if (strcasecmp(key, "vendornumber") == 0)
+			strlcpy(vendor, value, sizeof(vendor));
+		else if (strcasecmp(key, "productnumber") == 0)
+			strlcpy(product, value, sizeof(product));
+		else if (strcasecmp(key, "revisionnumber") == 0)
+			strlcpy(revision, value, sizeof(revision));
+		else if (strcasecmp(key, "productname") == 0)
+			strlcpy(name, value, sizeof(name));
+	}
+
+	fclose(file);
+
+	if (!*vendor || !*product || !*revision || !*name) {
+		plog(LOG_DEBUG, "Failed to convert EDS %s", path);
 		return -1;
+	}
 
 	struct canopen_eds eds;
 	memset(&eds, 0, sizeof(eds));
 
-	RB_INIT(&eds.obj_tree);
-
 	eds.vendor = strtoul(vendor, NULL, 0);
 	eds.product = strtoul(product, NULL, 0);
 	eds.revision = strtoul(revision, NULL, 0);
 	strlcpy(eds.name, name, sizeof(eds.name));
 
-	if (eds__convert_obj_tree(&eds, ini) < 0)
-		goto failure;
+	eds.path = strdup(path);
+	if (!eds.path)
+		return -1;
 
-	if (vector_append(&eds__db, &eds, sizeof(eds)) < 0)
-		goto failure;
+	if (vector_append(&eds__db, &eds, sizeof(eds)) < 0) {
+		free(eds.path);
+		return -1;
+	}
 
+	plog(LOG_DEBUG, "Indexed EDS %s", path);
 	return 0;
-
-failure:
-	eds__clear(&eds);
-	return -1;
 }
 
-static int eds__load_file(const char* path)
+static int eds__parse(struct canopen_eds* eds)
 {
-	FILE* file = fopen(path, "r");
-	if (!file)
-		return -1;
-
 	struct ini_file ini;
 
-	int lineno = ini_parse(&ini, file);
+	int lineno = ini_parse_file(&ini, eds->path);
 	if (lineno < 0) {
-		plog(LOG_DEBUG, "Failed to parse EDS %s, line %d", path,
+		plog(LOG_DEBUG, "Failed to parse EDS %s, line %d", eds->path,
 		     -lineno);
-		goto failure;
-	}
-
-	if (eds__convert_ini(&ini) < 0) {
-		plog(LOG_DEBUG, "Failed to convert EDS %s", path);
-		goto failure;
+		return -1;
 	}
 
-	plog(LOG_DEBUG, "Loaded EDS %s", path);
+	int rc = eds__convert_objs(eds, &ini);
+	if (rc < 0)
+		eds__clear(eds);
+	else
+		plog(LOG_DEBUG, "Loaded EDS %s", eds->path);
 
-	fclose(file);
 	ini_destroy(&ini);
-	return 0;
+	return rc;
+}
 
-failure:
-	fclose(file);
-	ini_destroy(&ini);
-	return -1;
+/* Objects are parsed by whichever thread first needs them. An EDS that fails
+ * to parse has no objects.
+ */
+static const struct canopen_eds*
+eds__get_parsed(const struct canopen_eds* eds)
+{
+	struct canopen_eds* self = (struct canopen_eds*)eds;
+
+	if (!eds || co_atomic_load(&self->is_parsed))
+		return eds;
+
+	pthread_mutex_lock(&eds__parse_mutex);
+
+	if (!self->is_parsed) {
+		if (eds__parse(self) < 0)
+			plog(LOG_ERROR, "Failed to load EDS %s", self->path);
+
+		co_atomic_store(&self->is_parsed, 1);
+	}
+
+	pthread_mutex_unlock(&eds__parse_mutex);
+
+	return eds;
 }
 
 static int eds__walker(const char* fpath, const struct stat* sb,
@@ -389,7 +577,7 @@ static int eds__walker(const char* fpath, const struct stat* sb,
 	if (!eds__extension_matches(fpath, ".eds"))
 		return 0;
 
-	eds__load_file(fpath);
+	eds__index_file(fpath);
 
 	return 0;
 }
@@ -400,22 +588,182 @@ static inline int eds__get_maxfiles(void)
 	return getrlimit(RLIMIT_NOFILE, &rlim) >= 0 ? rlim.rlim_cur / 2 : 3;
 }
 
-static inline const char* eds__get_path(void)
+__attribute__((visibility("default")))
+const char* eds_db_get_path(void)
 {
 	return EDS_PATH;
 }
 
-static inline int eds__load_all_files(void)
+__attribute__((visibility("default")))
+const char* eds_db_get_image_path(void)
 {
-	return nftw(eds__get_path(), eds__walker, eds__get_maxfiles(),
-		    FTW_DEPTH);
+	return EDS_IMAGE_PATH;
 }
 
-int eds_db_load(void)
+static inline int eds__load_all_files(const char* dir)
+{
+	return nftw(dir, eds__walker, eds__get_maxfiles(), FTW_DEPTH);
+}
+
+/* nftw() has no context argument */
+static struct eds_image_fingerprint eds__fingerprint;
+
+static int eds__fingerprint_walker(const char* fpath, const struct stat* sb,
+				   int type, struct FTW* ftwbuf)
+{
+	(void)ftwbuf;
+
+	if (type != FTW_F || !eds__extension_matches(fpath, ".eds"))
+		return 0;
+
+	uint64_t mtime = sb->st_mtim.tv_sec * UINT64_C(1000000000)
+		       + sb->st_mtim.tv_nsec;
+	if (mtime > eds__fingerprint.mtime)
+		eds__fingerprint.mtime = mtime;
+
+	eds__fingerprint.size += sb->st_size;
+	eds__fingerprint.count++;
+
+	return 0;
+}
+
+/* Only looks at the metadata of the files, which is much cheaper than
+ * parsing them.
+ */
+static int eds__get_fingerprint(struct eds_image_fingerprint* dst,
+				const char* dir)
+{
+	memset(&eds__fingerprint, 0, sizeof(eds__fingerprint));
+
+	if (nftw(dir, eds__fingerprint_walker, eds__get_maxfiles(),
+		 FTW_DEPTH) < 0)
+		return -1;
+
+	*dst = eds__fingerprint;
+	return 0;
+}
+
+static int eds__image_is_valid(const void* image, size_t size,
+			       const struct eds_image_fingerprint* fingerprint)
+{
+	const struct eds_image_header* header = image;
+
+	if (size < sizeof(*header)
+	 || header->magic != EDS_IMAGE_MAGIC
+	 || header->version != EDS_IMAGE_VERSION)
+		return 0;
+
+	if (memcmp(&header->fingerprint, fingerprint, sizeof(*fingerprint)))
+		return 0;
+
+	uint64_t expected = sizeof(*header)
+			  + (uint64_t)header->n_eds * sizeof(struct eds_image_eds)
+			  + (uint64_t)header->n_objs * sizeof(struct eds_image_obj)
+			  + header->strings_size;
+	if (expected != size)
+		return 0;
+
+	const char* strings = (const char*)image + size - header->strings_size;
+	if (header->strings_size > 0 && strings[header->strings_size - 1])
+		return 0;
+
+	const struct eds_image_eds* eds = (const void*)(header + 1);
+	const struct eds_image_obj* objs = (const void*)(eds + header->n_eds);
+
+	for (uint32_t i = 0; i < header->n_eds; ++i)
+		if (eds[i].name >= header->strings_size
+		 || eds[i].first_obj > header->n_objs
+		 || eds[i].n_objs > header->n_objs - eds[i].first_obj)
+			return 0;
+
+	for (uint32_t i = 0; i < header->n_objs; ++i)
+		for (int j = 0; j < EDS_IMAGE_N_STRINGS; ++j)
+			if (objs[i].string[j] != EDS_IMAGE_NO_STRING
+			 && objs[i].string[j] >= header->strings_size)
+				return 0;
+
+	return 1;
+}
+
+static int eds__load_image(const char* path,
+			   const struct eds_image_fingerprint* fingerprint)
 {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return -1;
+	}
+
+	void* image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return -1;
+
+	if (!eds__image_is_valid(image, st.st_size, fingerprint)) {
+		plog(LOG_NOTICE, "EDS image %s is out of date", path);
+		goto failure;
+	}
+
+	const struct eds_image_header* header = image;
+	const struct eds_image_eds* records = (const void*)(header + 1);
+	const struct eds_image_obj* objs =
+		(const void*)(records + header->n_eds);
+
+	eds__image_strings = (const char*)(objs + header->n_objs);
+
+	if (vector_reserve(&eds__db, header->n_eds * sizeof(struct canopen_eds))
+			< 0)
+		goto failure;
+
+	for (uint32_t i = 0; i < header->n_eds; ++i) {
+		const struct eds_image_eds* record = &records[i];
+
+		struct canopen_eds eds;
+		memset(&eds, 0, sizeof(eds));
+
+		eds.vendor = record->vendor;
+		eds.product = record->product;
+		eds.revision = record->revision;
+		strlcpy(eds.name, eds__image_strings + record->name,
+			sizeof(eds.name));
+
+		eds.image_objs = &objs[record->first_obj];
+		eds.n_objs = record->n_objs;
+		eds.is_parsed = 1;
+
+		vector_append(&eds__db, &eds, sizeof(eds));
+	}
+
+	eds__image = image;
+	eds__image_size = st.st_size;
+
+	plog(LOG_DEBUG, "Loaded %u EDS files from %s", header->n_eds, path);
+	return 0;
+
+failure:
+	eds__image_strings = NULL;
+	munmap(image, st.st_size);
+	return -1;
+}
+
+int eds__db_load_from(const char* dir, const char* image_path)
+{
+	/* The database may have been loaded before forking */
+	if (eds__db.data)
+		return 0;
+
 	vector_reserve(&eds__db, 16);
 
-	if (eds__load_all_files() < 0)
+	struct eds_image_fingerprint fingerprint;
+	if (image_path && eds__get_fingerprint(&fingerprint, dir) == 0
+	 && eds__load_image(image_path, &fingerprint) == 0)
+		return 0;
+
+	if (eds__load_all_files(dir) < 0)
 		goto failure;
 
 	return 0;
@@ -425,25 +773,191 @@ failure:
 	return -1;
 }
 
+int eds_db_load(void)
+{
+	return eds__db_load_from(eds_db_get_path(), eds_db_get_image_path());
+}
+
+void eds_db_parse_all(void)
+{
+	for (size_t i = 0; i < eds_db_length(); ++i)
+		eds__get_parsed(eds_db_get(i));
+}
+
+static uint32_t eds__image_add_string(struct vector* strings,
+				      const char* str)
+{
+	if (!str)
+		return EDS_IMAGE_NO_STRING;
+
+	uint32_t offset = strings->index;
+	if (vector_append(strings, str, strlen(str) + 1) < 0)
+		return EDS_IMAGE_NO_STRING;
+
+	return offset;
+}
+
+static int eds__write_image(FILE* file,
+			    const struct eds_image_fingerprint* fingerprint)
+{
+	int rc = -1;
+	struct vector records, objs, strings;
+
+	size_t n_eds = eds_db_length();
+
+	if (vector_init(&records, 256) < 0)
+		return -1;
+	if (vector_init(&objs, 4096) < 0)
+		goto objs_failure;
+	if (vector_init(&strings, 4096) < 0)
+		goto strings_failure;
+
+	for (size_t i = 0; i < n_eds; ++i) {
+		const struct canopen_eds* eds = eds_db_get(i);
+
+		struct eds_image_eds record = {
+			.vendor = eds->vendor,
+			.product = eds->product,
+			.revision = eds->revision,
+			.name = eds__image_add_string(&strings, eds->name),
+			.first_obj = objs.index / sizeof(struct eds_image_obj),
+		};
+
+		const struct eds_obj* obj;
+		for (obj = eds_obj_first(eds); obj; obj = eds_obj_next(eds, obj)) {
+			struct eds_image_obj entry = {
+				.key = obj->key,
+				.type = obj->type,
+				.access = obj->access,
+			};
+
+			uint32_t* string = entry.string;
+			string[EDS_IMAGE_NAME] =
+				eds__image_add_string(&strings, obj->name);
+			string[EDS_IMAGE_DEFAULT_VALUE] = eds__image_add_string(
+					&strings, obj->default_value);
+			string[EDS_IMAGE_LOW_LIMIT] =
+				eds__image_add_string(&strings, obj->low_limit);
+			string[EDS_IMAGE_HIGH_LIMIT] = eds__image_add_string(
+					&strings, obj->high_limit);
+			string[EDS_IMAGE_UNIT] =
+				eds__image_add_string(&strings, obj->unit);
+			string[EDS_IMAGE_SCALING] =
+				eds__image_add_string(&strings, obj->scaling);
+
+			if (vector_append(&objs, &entry, sizeof(entry)) < 0)
+				goto failure;
+
+			++record.n_objs;
+		}
+
+		if (vector_append(&records, &record, sizeof(record)) < 0)
+			goto failure;
+	}
+
+	/* Keeps the string table a multiple of 4 bytes long */
+	while (strings.index % 4)
+		if (vector_append(&strings, "", 1) < 0)
+			goto failure;
+
+	struct eds_image_header header = {
+		.magic = EDS_IMAGE_MAGIC,
+		.version = EDS_IMAGE_VERSION,
+		.fingerprint = *fingerprint,
+		.n_eds = n_eds,
+		.n_objs = objs.index / sizeof(struct eds_image_obj),
+		.strings_size = strings.index,
+	};
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1
+	 || fwrite(records.data, 1, records.index, file) != records.index
+	 || fwrite(objs.data, 1, objs.index, file) != objs.index
+	 || fwrite(strings.data, 1, strings.index, file) != strings.index)
+		goto failure;
+
+	rc = 0;
+
+failure:
+	vector_destroy(&strings);
+strings_failure:
+	vector_destroy(&objs);
+objs_failure:
+	vector_destroy(&records);
+	return rc;
+}
+
+__attribute__((visibility("default")))
+int eds_db_compile(const char* dir, const char* path)
+{
+	int rc = -1;
+	struct eds_image_fingerprint fingerprint;
+	char tmp_path[PATH_MAX];
+
+	/* Take the fingerprint first so that an EDS file that changes while
+	 * the image is being compiled makes the image stale.
+	 */
+	if (eds__get_fingerprint(&fingerprint, dir) < 0)
+		return -1;
+
+	eds_db_unload();
+
+	if (eds__db_load_from(dir, NULL) < 0)
+		return -1;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE* file = fopen(tmp_path, "w");
+	if (!file)
+		goto done;
+
+	if (eds__write_image(file, &fingerprint) < 0) {
+		fclose(file);
+		unlink(tmp_path);
+		goto done;
+	}
+
+	if (fclose(file) != 0 || rename(tmp_path, path) < 0) {
+		unlink(tmp_path);
+		goto done;
+	}
+
+	rc = 0;
+
+done:
+	eds_db_unload();
+	return rc;
+}
+
 static void eds__db_clear(void)
 {
-	for (size_t i = 0; i < eds__db.index / sizeof(struct canopen_eds); ++i)
-		eds__clear(eds_db_get(i));
+	for (size_t i = 0; i < eds__db.index / sizeof(struct canopen_eds); ++i) {
+		struct canopen_eds* eds = eds_db_get(i);
+		eds__clear(eds);
+		free(eds->path);
+	}
 }
 
 void eds_db_unload(void)
 {
 	eds__db_clear();
 	vector_destroy(&eds__db);
+	memset(&eds__db, 0, sizeof(eds__db));
+
+	if (eds__image) {
+		munmap(eds__image, eds__image_size);
+		eds__image = NULL;
+		eds__image_size = 0;
+		eds__image_strings = NULL;
+	}
 }
 
 const struct eds_obj* eds_obj_first(const struct canopen_eds* eds)
 {
-	return (void*)RB_MIN(eds_obj_tree, (void*)&eds->obj_tree);
+	return eds__get_objs(eds);
 }
 
 const struct eds_obj* eds_obj_next(const struct canopen_eds* eds,
 				   const struct eds_obj* obj)
 {
-	return (void*)RB_NEXT(eds_obj_tree, &eds->obj_tree, (void*)obj);
+	return obj < &eds->objs[eds->n_objs - 1] ? obj + 1 : NULL;
 }
@@ -0,0 +1,126 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "canopen/emcy_limit.h"
+
+#define CO_EMCY_LIMIT__TOKEN 1000000ULL
+
+static void co_emcy_limit__refill(struct co_emcy_limit* self,
+				  const struct co_emcy_limit_config* config,
+				  uint64_t now)
+{
+	uint64_t capacity = config->burst * CO_EMCY_LIMIT__TOKEN;
+
+	if (self->last_refill == 0) {
+		self->tokens = capacity;
+	} else if (now > self->last_refill) {
+		/* Rates are per second and time is in microseconds, so this is
+		 * already in millionths of a token
+		 */
+		self->tokens += (now - self->last_refill) * config->rate;
+		if (self->tokens > capacity)
+			self->tokens = capacity;
+	}
+
+	self->last_refill = now;
+}
+
+static int co_emcy_limit__check_repeat(struct co_emcy_limit* self,
+				       const struct co_emcy_limit_config* config,
+				       uint64_t now)
+{
+	switch (config->policy) {
+	case CO_EMCY_POLICY_FIRST:
+		if (now - self->window_start < config->window * 1000ULL) {
+			++self->n_aggregated;
+			return 0;
+		}
+
+		self->window_start = now;
+		return 1;
+
+	case CO_EMCY_POLICY_RATE:
+		if (self->tokens < CO_EMCY_LIMIT__TOKEN) {
+			++self->n_dropped;
+			return 0;
+		}
+
+		self->tokens -= CO_EMCY_LIMIT__TOKEN;
+		return 1;
+
+	case CO_EMCY_POLICY_ALL:
+	default:
+		return 1;
+	}
+}
+
+int co_emcy_limit_check(struct co_emcy_limit* self,
+			const struct co_emcy_limit_config* config,
+			uint16_t code, uint8_t reg, uint64_t now)
+{
+	co_emcy_limit__refill(self, config, now);
+
+	int is_repeat = self->has_last && self->last_code == code
+		     && self->last_reg == reg;
+
+	int rc = 1;
+
+	if (is_repeat) {
+		rc = co_emcy_limit__check_repeat(self, config, now);
+	} else {
+		self->has_last = 1;
+		self->last_code = code;
+		self->last_reg = reg;
+		self->window_start = now;
+
+		/* Changes of state still take a token if there is one */
+		if (self->tokens >= CO_EMCY_LIMIT__TOKEN)
+			self->tokens -= CO_EMCY_LIMIT__TOKEN;
+	}
+
+	if (rc)
+		++self->n_passed;
+
+	return rc;
+}
+
+static const char* co_emcy_limit__policy_name[] = {
+	[CO_EMCY_POLICY_ALL] = "all",
+	[CO_EMCY_POLICY_FIRST] = "first",
+	[CO_EMCY_POLICY_RATE] = "rate",
+};
+
+#define CO_EMCY_LIMIT__N_POLICIES \
+	(sizeof(co_emcy_limit__policy_name) \
+	 / sizeof(co_emcy_limit__policy_name[0]))
+
+int co_emcy_policy_from_string(const char* name)
+{
+	for (size_t i = 0; i < CO_EMCY_LIMIT__N_POLICIES; ++i)
+		if (strcmp(name, co_emcy_limit__policy_name[i]) == 0)
+			return i;
+
+	return -1;
+}
+
+const char* co_emcy_policy_name(enum co_emcy_policy policy)
+{
+	if ((size_t)policy >= CO_EMCY_LIMIT__N_POLICIES)
+		return "unknown";
+
+	return co_emcy_limit__policy_name[policy];
+}
@@ -0,0 +1,473 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/queue.h>
+#include <mloop.h>
+
+#include "canopen.h"
+#include "canopen/nmt.h"
+#include "canopen-driver.h"
+#include "rest.h"
+#include "events-rest.h"
+
+#define EVENTS_REST_PDO_COUNT 4
+#define EVENTS_REST_DATA_SIZE 64
+#define EVENTS_REST_DEFAULT_INTERVAL 100
+#define EVENTS_REST_MIN_INTERVAL 10
+#define EVENTS_REST_MAX_OUTPUT (256 * 1024)
+#define EVENTS_REST_MAX_EVENT 512
+
+enum events_rest_type {
+	EVENTS_REST_PDO = 1 << 0,
+	EVENTS_REST_EMCY = 1 << 1,
+	EVENTS_REST_NMT = 1 << 2,
+	EVENTS_REST_ALL = EVENTS_REST_PDO | EVENTS_REST_EMCY | EVENTS_REST_NMT
+};
+
+/* The latest value of a PDO that has not been sent yet. Values that arrive
+ * before the next tick replace it and are counted as coalesced.
+ */
+struct events_rest_pdo {
+	int is_pending;
+	uint32_t n_coalesced;
+	size_t len;
+	uint64_t timestamp;
+	uint8_t data[EVENTS_REST_DATA_SIZE];
+};
+
+struct events_rest_sub {
+	LIST_ENTRY(events_rest_sub) links;
+	struct rest_client* client;
+	struct mloop_timer* timer;
+	unsigned int types;
+	uint8_t is_node[CANOPEN_NODEID_MAX + 1];
+	int have_pdo;
+	uint64_t n_lost;
+	struct vector output;
+	struct events_rest_pdo pdo[CANOPEN_NODEID_MAX + 1]
+				  [EVENTS_REST_PDO_COUNT];
+};
+
+struct events_rest_nmt {
+	int is_known;
+	enum nmt_state state;
+};
+
+static LIST_HEAD(, events_rest_sub) events_rest__subs =
+	LIST_HEAD_INITIALIZER(events_rest__subs);
+
+static struct events_rest_nmt events_rest__nmt[CANOPEN_NODEID_MAX + 1];
+
+static void events_rest__reply(struct rest_client* client,
+			       const char* status_code, const char* message)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = "text/plain",
+		.content_length = strlen(message),
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static const char* events_rest__nmt_state_name(enum nmt_state state)
+{
+	switch (state) {
+	case NMT_STATE_BOOTUP: return "bootup";
+	case NMT_STATE_STOPPED: return "stopped";
+	case NMT_STATE_OPERATIONAL: return "operational";
+	case NMT_STATE_PREOPERATIONAL: return "pre-operational";
+	}
+
+	return "unknown";
+}
+
+static int events_rest__is_wanted(const struct events_rest_sub* sub,
+				  enum events_rest_type type, int nodeid)
+{
+	return (sub->types & type) && sub->is_node[nodeid]
+	    && sub->client->state != REST_CLIENT_DISCONNECTED;
+}
+
+/* Each event is a single chunk of the chunked reply */
+static void events_rest__emit(struct events_rest_sub* sub, const char* name,
+			      const char* fmt, ...)
+{
+	char data[EVENTS_REST_MAX_EVENT];
+	char chunk[EVENTS_REST_MAX_EVENT + 64];
+
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(data, sizeof(data), fmt, ap);
+	va_end(ap);
+
+	int len = snprintf(chunk, sizeof(chunk), "event: %s\ndata: %s\n\n",
+			   name, data);
+
+	char head[16];
+	int head_len = snprintf(head, sizeof(head), "%x\r\n", len);
+
+	size_t size = head_len + len + 2;
+	if (sub->client->output_length + sub->output.index + size
+	    > EVENTS_REST_MAX_OUTPUT) {
+		sub->n_lost++;
+		return;
+	}
+
+	if (vector_append(&sub->output, head, head_len) < 0
+	 || vector_append(&sub->output, chunk, len) < 0
+	 || vector_append(&sub->output, "\r\n", 2) < 0)
+		sub->n_lost++;
+}
+
+/* Replies are written without blocking, and the connection keeps what the
+ * socket did not take. Events are lost while that is over the limit, so that a
+ * slow client only loses its own events instead of stalling the main loop.
+ */
+static void events_rest__flush(struct events_rest_sub* sub)
+{
+	struct rest_client* client = sub->client;
+
+	if (client->state == REST_CLIENT_DISCONNECTED)
+		return;
+
+	if (sub->output.index > 0) {
+		rest_write(client, sub->output.data, sub->output.index);
+		sub->output.index = 0;
+	}
+
+	if (sub->n_lost && client->output_length == 0) {
+		uint64_t n_lost = sub->n_lost;
+		sub->n_lost = 0;
+		events_rest__emit(sub, "lost", "{ \"count\": %" PRIu64 " }",
+				  n_lost);
+	}
+}
+
+static void events_rest__emit_pdo(struct events_rest_sub* sub, int nodeid,
+				  int n, struct events_rest_pdo* pdo)
+{
+	char hex[2 * EVENTS_REST_DATA_SIZE + 1];
+
+	for (size_t i = 0; i < pdo->len; ++i)
+		sprintf(&hex[2 * i], "%02x", pdo->data[i]);
+	hex[2 * pdo->len] = '\0';
+
+	events_rest__emit(sub, "pdo", "{ \"node\": %d, \"tpdo\": %d, "
+			  "\"data\": \"%s\", \"timestamp\": %" PRIu64
+			  ", \"coalesced\": %" PRIu32 " }", nodeid, n + 1, hex,
+			  pdo->timestamp, pdo->n_coalesced);
+
+	pdo->is_pending = 0;
+	pdo->n_coalesced = 0;
+}
+
+static void events_rest__emit_pending_pdos(struct events_rest_sub* sub)
+{
+	for (int nodeid = 0; nodeid <= CANOPEN_NODEID_MAX; ++nodeid)
+		for (int n = 0; n < EVENTS_REST_PDO_COUNT; ++n)
+			if (sub->pdo[nodeid][n].is_pending)
+				events_rest__emit_pdo(sub, nodeid, n,
+						      &sub->pdo[nodeid][n]);
+
+	sub->have_pdo = 0;
+}
+
+static void events_rest__sub_free(struct events_rest_sub* sub)
+{
+	if (sub->timer) {
+		mloop_timer_stop(sub->timer);
+		mloop_timer_unref(sub->timer);
+	}
+
+	LIST_REMOVE(sub, links);
+	vector_destroy(&sub->output);
+	rest_client_unref(sub->client);
+	free(sub);
+}
+
+static void events_rest__on_tick(struct mloop_timer* timer)
+{
+	struct events_rest_sub* sub = mloop_timer_get_context(timer);
+
+	if (sub->client->state == REST_CLIENT_DISCONNECTED) {
+		events_rest__sub_free(sub);
+		return;
+	}
+
+	if (sub->have_pdo)
+		events_rest__emit_pending_pdos(sub);
+
+	events_rest__flush(sub);
+}
+
+static int events_rest__parse_nodes(struct events_rest_sub* sub,
+				    const char* str)
+{
+	if (!str) {
+		memset(sub->is_node, 1, sizeof(sub->is_node));
+		return 0;
+	}
+
+	char* end = NULL;
+
+	while (*str) {
+		unsigned long nodeid = strtoul(str, &end, 10);
+		if (end == str || nodeid < CANOPEN_NODEID_MIN
+		 || nodeid > CANOPEN_NODEID_MAX)
+			return -1;
+
+		sub->is_node[nodeid] = 1;
+
+		if (*end == '\0')
+			break;
+		if (*end != ',')
+			return -1;
+
+		str = end + 1;
+	}
+
+	return 0;
+}
+
+static int events_rest__parse_types(struct events_rest_sub* sub,
+				    const char* str)
+{
+	if (!str) {
+		sub->types = EVENTS_REST_ALL;
+		return 0;
+	}
+
+	while (*str) {
+		size_t len = strcspn(str, ",");
+
+		if (len == 3 && strncmp(str, "pdo", 3) == 0)
+			sub->types |= EVENTS_REST_PDO;
+		else if (len == 4 && strncmp(str, "emcy", 4) == 0)
+			sub->types |= EVENTS_REST_EMCY;
+		else if (len == 3 && strncmp(str, "nmt", 3) == 0)
+			sub->types |= EVENTS_REST_NMT;
+		else
+			return -1;
+
+		str += len;
+		if (*str == ',')
+			++str;
+	}
+
+	return sub->types ? 0 : -1;
+}
+
+static int events_rest__parse_interval(int* dst, const char* str)
+{
+	if (!str) {
+		*dst = EVENTS_REST_DEFAULT_INTERVAL;
+		return 0;
+	}
+
+	char* end = NULL;
+	long value = strtol(str, &end, 10);
+	if (!*str || *end != '\0' || value < EVENTS_REST_MIN_INTERVAL)
+		return -1;
+
+	*dst = value;
+	return 0;
+}
+
+static int events_rest__start_timer(struct events_rest_sub* sub,
+				    int interval)
+{
+	sub->timer = mloop_timer_new(mloop_default());
+	if (!sub->timer)
+		return -1;
+
+	mloop_timer_set_type(sub->timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_time(sub->timer, interval * 1000000ULL);
+	mloop_timer_set_context(sub->timer, sub, NULL);
+	mloop_timer_set_callback(sub->timer, events_rest__on_tick);
+
+	return mloop_timer_start(sub->timer);
+}
+
+static void events_rest__emit_known_states(struct events_rest_sub* sub)
+{
+	if (!(sub->types & EVENTS_REST_NMT))
+		return;
+
+	for (int nodeid = 0; nodeid <= CANOPEN_NODEID_MAX; ++nodeid) {
+		const struct events_rest_nmt* nmt = &events_rest__nmt[nodeid];
+
+		if (nmt->is_known && sub->is_node[nodeid])
+			events_rest__emit(sub, "nmt",
+					  "{ \"node\": %d, \"state\": \"%s\" }",
+					  nodeid,
+					  events_rest__nmt_state_name(nmt->state));
+	}
+}
+
+void events_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (client->req.url_index != 1) {
+		events_rest__reply(client, "404 Not Found", "Not found\r\n");
+		return;
+	}
+
+	struct events_rest_sub* sub = calloc(1, sizeof(*sub));
+	if (!sub) {
+		events_rest__reply(client, "500 Internal Server Error",
+				   "Out of memory\r\n");
+		return;
+	}
+
+	int interval = 0;
+
+	if (events_rest__parse_nodes(sub,
+			http_req_query(&client->req, "node")) < 0
+	 || events_rest__parse_types(sub,
+			http_req_query(&client->req, "type")) < 0
+	 || events_rest__parse_interval(&interval,
+			http_req_query(&client->req, "interval")) < 0) {
+		free(sub);
+		events_rest__reply(client, "400 Bad Request",
+				   "Invalid subscription\r\n");
+		return;
+	}
+
+	if (events_rest__start_timer(sub, interval) < 0) {
+		if (sub->timer)
+			mloop_timer_unref(sub->timer);
+		free(sub);
+		events_rest__reply(client, "500 Internal Server Error",
+				   "Could not start timer\r\n");
+		return;
+	}
+
+	sub->client = client;
+	rest_client_ref(client);
+	LIST_INSERT_HEAD(&events_rest__subs, sub, links);
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "text/event-stream",
+		.content_length = -1,
+	};
+
+	rest_reply_header(client, &reply);
+
+	/* The stream never ends, so the connection is not reused */
+	client->state = REST_CLIENT_SERVICING;
+
+	events_rest__emit_known_states(sub);
+	events_rest__flush(sub);
+}
+
+int events_rest_is_active(void)
+{
+	return !LIST_EMPTY(&events_rest__subs);
+}
+
+void events_rest_on_pdo(int nodeid, int n, const void* data, size_t len,
+			uint64_t timestamp)
+{
+	struct events_rest_sub* sub;
+
+	if (len > EVENTS_REST_DATA_SIZE)
+		len = EVENTS_REST_DATA_SIZE;
+
+	LIST_FOREACH(sub, &events_rest__subs, links) {
+		if (!events_rest__is_wanted(sub, EVENTS_REST_PDO, nodeid))
+			continue;
+
+		struct events_rest_pdo* pdo = &sub->pdo[nodeid][n - 1];
+
+		if (pdo->is_pending)
+			pdo->n_coalesced++;
+
+		pdo->is_pending = 1;
+		pdo->len = len;
+		pdo->timestamp = timestamp;
+		memcpy(pdo->data, data, len);
+
+		sub->have_pdo = 1;
+	}
+}
+
+void events_rest_on_emcy(int nodeid, const struct co_emcy* emcy)
+{
+	struct events_rest_sub* sub;
+
+	LIST_FOREACH(sub, &events_rest__subs, links) {
+		if (!events_rest__is_wanted(sub, EVENTS_REST_EMCY, nodeid))
+			continue;
+
+		events_rest__emit(sub, "emcy", "{ \"node\": %d, "
+				  "\"code\": \"%#06x\", \"register\": \"%#04x\", "
+				  "\"manufacturer-error\": \"%#012" PRIx64 "\" }",
+				  nodeid, emcy->code, emcy->reg,
+				  emcy->manufacturer_error);
+		events_rest__flush(sub);
+	}
+}
+
+static void events_rest__on_state(int nodeid, const char* state)
+{
+	struct events_rest_sub* sub;
+
+	LIST_FOREACH(sub, &events_rest__subs, links) {
+		if (!events_rest__is_wanted(sub, EVENTS_REST_NMT, nodeid))
+			continue;
+
+		events_rest__emit(sub, "nmt",
+				  "{ \"node\": %d, \"state\": \"%s\" }",
+				  nodeid, state);
+		events_rest__flush(sub);
+	}
+}
+
+void events_rest_on_nmt(int nodeid, enum nmt_state state)
+{
+	struct events_rest_nmt* nmt = &events_rest__nmt[nodeid];
+
+	if (nmt->is_known && nmt->state == state)
+		return;
+
+	nmt->is_known = 1;
+	nmt->state = state;
+
+	events_rest__on_state(nodeid, events_rest__nmt_state_name(state));
+}
+
+void events_rest_on_node_lost(int nodeid)
+{
+	events_rest__nmt[nodeid].is_known = 0;
+	events_rest__on_state(nodeid, "lost");
+}
+
+void events_rest_cleanup(void)
+{
+	while (!LIST_EMPTY(&events_rest__subs))
+		events_rest__sub_free(LIST_FIRST(&events_rest__subs));
+}
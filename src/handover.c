@@ -0,0 +1,234 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "net-util.h"
+#include "canopen/handover.h"
+
+#define CO_HANDOVER__MAGIC 0x43484f31 /* "CHO1" */
+
+enum co_handover__msg_type {
+	CO_HANDOVER__MSG_REQUEST = 1,
+	CO_HANDOVER__MSG_ACK,
+};
+
+struct co_handover__msg {
+	uint32_t magic;
+	uint32_t type;
+};
+
+static size_t co_handover__state_size(size_t n_nodes)
+{
+	return offsetof(struct co_handover_state, node)
+	     + n_nodes * sizeof(struct co_handover_node);
+}
+
+static int co_handover__wait(int fd)
+{
+	struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+
+	int rc = poll(&pollfd, 1, CO_HANDOVER_TIMEOUT);
+	if (rc == 0)
+		errno = ETIMEDOUT;
+
+	return rc == 1 ? 0 : -1;
+}
+
+static int co_handover__send_msg(int fd, enum co_handover__msg_type type)
+{
+	struct co_handover__msg msg = {
+		.magic = CO_HANDOVER__MAGIC,
+		.type = type,
+	};
+
+	return send(fd, &msg, sizeof(msg), MSG_NOSIGNAL) == sizeof(msg)
+	     ? 0 : -1;
+}
+
+static int co_handover__recv_msg(int fd, enum co_handover__msg_type type)
+{
+	struct co_handover__msg msg;
+
+	if (co_handover__wait(fd) < 0)
+		return -1;
+
+	ssize_t rsize = recv(fd, &msg, sizeof(msg), 0);
+	if (rsize < 0)
+		return -1;
+
+	if (rsize != sizeof(msg) || msg.magic != CO_HANDOVER__MAGIC
+	 || msg.type != type) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	return 0;
+}
+
+static ssize_t co_handover__send_state(int fd,
+				       const struct co_handover_state* state,
+				       const int* fds, size_t n_fds)
+{
+	struct iovec iov = {
+		.iov_base = (void*)state,
+		.iov_len = co_handover__state_size(state->n_nodes),
+	};
+	char control[CMSG_SPACE(sizeof(int) * CO_HANDOVER_FDS_MAX)];
+	struct msghdr hdr = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if (n_fds > 0) {
+		memset(control, 0, sizeof(control));
+		hdr.msg_control = control;
+		hdr.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n_fds);
+	}
+
+	return sendmsg(fd, &hdr, MSG_NOSIGNAL);
+}
+
+static ssize_t co_handover__recv_state(int fd, struct co_handover_state* state,
+				       int* fds, size_t* n_fds)
+{
+	struct iovec iov = { .iov_base = state, .iov_len = sizeof(*state) };
+	char control[CMSG_SPACE(sizeof(int) * CO_HANDOVER_FDS_MAX)];
+	struct msghdr hdr = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+
+	*n_fds = 0;
+
+	ssize_t rsize = recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC);
+	if (rsize < 0)
+		return -1;
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+	 && cmsg->cmsg_type == SCM_RIGHTS) {
+		*n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), *n_fds * sizeof(int));
+	}
+
+	return rsize;
+}
+
+int co_handover_give(int listen_fd, struct co_handover_state* state,
+		     const int* fds, size_t n_fds)
+{
+	if (n_fds > CO_HANDOVER_FDS_MAX
+	 || state->n_nodes > CO_HANDOVER_NODES_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	int rc = -1;
+
+	if (co_handover__recv_msg(fd, CO_HANDOVER__MSG_REQUEST) < 0)
+		goto done;
+
+	state->magic = CO_HANDOVER__MAGIC;
+	state->reserved = 0;
+
+	if (co_handover__send_state(fd, state, fds, n_fds) < 0)
+		goto done;
+
+	rc = co_handover__recv_msg(fd, CO_HANDOVER__MSG_ACK);
+
+done:
+	close(fd);
+	return rc;
+}
+
+void co_handover_refuse(int listen_fd)
+{
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd >= 0)
+		close(fd);
+}
+
+static void co_handover__close_all(const int* fds, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		close(fds[i]);
+}
+
+int co_handover_take(const char* path, struct co_handover_state* state,
+		     int* fds, size_t* n_fds)
+{
+	*n_fds = 0;
+
+	int fd = net_unix_connect(path);
+	if (fd < 0)
+		return -1;
+
+	/* The request may also be refused before it has been sent */
+	if (co_handover__send_msg(fd, CO_HANDOVER__MSG_REQUEST) < 0) {
+		if (errno == EPIPE)
+			errno = ECONNRESET;
+		goto failure;
+	}
+
+	if (co_handover__wait(fd) < 0)
+		goto failure;
+
+	ssize_t rsize = co_handover__recv_state(fd, state, fds, n_fds);
+	if (rsize < 0)
+		goto failure;
+
+	/* The connection is closed without an answer if the request is
+	 * refused
+	 */
+	if (rsize == 0) {
+		errno = ECONNRESET;
+		goto failure;
+	}
+
+	if ((size_t)rsize < co_handover__state_size(0)
+	 || state->magic != CO_HANDOVER__MAGIC
+	 || state->n_nodes > CO_HANDOVER_NODES_MAX
+	 || (size_t)rsize != co_handover__state_size(state->n_nodes)) {
+		errno = EPROTO;
+		goto state_failure;
+	}
+
+	if (co_handover__send_msg(fd, CO_HANDOVER__MSG_ACK) < 0)
+		goto state_failure;
+
+	close(fd);
+	return 0;
+
+state_failure:
+	co_handover__close_all(fds, *n_fds);
+	*n_fds = 0;
+failure:
+	close(fd);
+	return -1;
+}
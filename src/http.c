@@ -15,66 +15,17 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <ctype.h>
-#include "vector.h"
 #include "http.h"
 
-enum httplex_token_type {
-	HTTPLEX_SOLIDUS,
-	HTTPLEX_CR,
-	HTTPLEX_LF,
-	HTTPLEX_WS,
-	HTTPLEX_LITERAL,
-	HTTPLEX_KEY,
-	HTTPLEX_VALUE,
-	HTTPLEX_QUERY,
-	HTTPLEX_AMPERSAND,
-	HTTPLEX_EQ,
-	HTTPLEX_END,
-};
-
-struct httplex_token {
-	enum httplex_token_type type;
-	const char* value;
-};
-
-enum httplex_state {
-	HTTPLEX_STATE_REQUEST = 0,
-	HTTPLEX_STATE_KEY,
-	HTTPLEX_STATE_VALUE,
-};
-
-struct httplex {
-	enum httplex_state state;
-	struct httplex_token current_token;
-	const char* input;
-	const char* pos;
-	const char* next_pos;
-	struct vector buffer;
-	int accepted;
-	int errno_;
-};
-
-int httplex_init(struct httplex* self, const char* input)
-{
-	memset(self, 0, sizeof(*self));
-
-	self->input = input;
-	self->pos = input;
-	self->accepted = 1;
-
-	if (vector_reserve(&self->buffer, 256) < 0)
-		return -1;
-
-	return 0;
-}
-
-void httplex_destroy(struct httplex* self)
-{
-	vector_destroy(&self->buffer);
-}
+/* The request is parsed in a single pass over the head, which is cut up in
+ * place: separators after path elements, query keys and values and header
+ * values are overwritten with terminators and the request points into the
+ * head. Nothing is allocated.
+ */
 
-static inline int httplex__is_literal(char c)
+static inline int http__is_literal(char c)
 {
 	switch (c) {
 	case '/': case '\r': case '\n': case ' ': case '\t':
@@ -85,454 +36,240 @@ static inline int httplex__is_literal(char c)
 	return isprint(c);
 }
 
-static inline size_t httplex__literal_length(const char* str)
+static inline size_t http__literal_length(const char* str)
 {
 	size_t len = 0;
-	while (httplex__is_literal(*str++))
+	while (http__is_literal(*str++))
 		++len;
 	return len;
 }
 
-int httplex__classify_request_token(struct httplex* self)
+static inline int http__is_word(const char* str, size_t len, const char* word)
 {
-	switch (*self->pos) {
-	case '/':
-		self->current_token.type = HTTPLEX_SOLIDUS;
-		self->next_pos = self->pos + strspn(self->pos, "/");
-		return 0;
-	case '\r':
-		self->current_token.type = HTTPLEX_CR;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '\n':
-		self->current_token.type = HTTPLEX_LF;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '?':
-		self->current_token.type = HTTPLEX_QUERY;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '&':
-		self->current_token.type = HTTPLEX_AMPERSAND;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '=':
-		self->current_token.type = HTTPLEX_EQ;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case ' ':
-	case '\t':
-		self->current_token.type = HTTPLEX_WS;
-		self->next_pos = self->pos + strspn(self->pos, " \t");
-		return 0;
-	}
-
-	if (httplex__is_literal(*self->pos)) {
-		self->current_token.type = HTTPLEX_LITERAL;
-		size_t len = httplex__literal_length(self->pos);
-		self->next_pos = self->pos + len;
-		vector_assign(&self->buffer, self->pos, len);
-		vector_append(&self->buffer, "", 1);
-		self->current_token.value = self->buffer.data;
-		return 0;
-	}
-
-	return -1;
-}
-
-static inline int httplex__is_key_char(char c)
-{
-	return isalnum(c) || c == '-';
-}
-
-static inline size_t httplex__key_length(const char* str)
-{
-	size_t len = 0;
-	while (httplex__is_key_char(*str++))
-		++len;
-	return len;
+	return strlen(word) == len && strncasecmp(str, word, len) == 0;
 }
 
-int httplex__classify_key_token(struct httplex* self)
+static char* http__method(struct http_req* req, char* pos)
 {
-	switch (*self->pos) {
-	case '\r':
-		self->current_token.type = HTTPLEX_CR;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '\n':
-		self->current_token.type = HTTPLEX_LF;
-		self->next_pos = self->pos + 1;
-		return 0;
-	}
-
-	if (!httplex__is_key_char(*self->pos))
-		return -1;
-
-	size_t len = httplex__key_length(self->pos);
-
-	if (self->pos[len] != ':')
-		return -1;
-
-	len += 1;
+	size_t len = http__literal_length(pos);
 
-	self->next_pos = self->pos + len;
-	self->next_pos += strspn(self->next_pos, " \t");
-
-	vector_assign(&self->buffer, self->pos, len - 1);
-	vector_append(&self->buffer, "", 1);
-
-	self->current_token.type = HTTPLEX_KEY;
-	self->current_token.value = self->buffer.data;
-	return 0;
-}
-
-int httplex__classify_value_token(struct httplex* self)
-{
-	size_t len = strcspn(self->pos, "\r");
-	if (strncmp(&self->pos[len], "\r\n", 2) != 0)
-		return -1;
-
-	self->next_pos = self->pos + len + 2;
-
-	vector_assign(&self->buffer, self->pos, len);
-	vector_append(&self->buffer, "", 1);
-
-	self->current_token.type = HTTPLEX_VALUE;
-	self->current_token.value = self->buffer.data;
-	return 0;
-}
-
-int httplex__classify_token(struct httplex* self)
-{
-	switch (self->state) {
-	case HTTPLEX_STATE_REQUEST:
-		return httplex__classify_request_token(self);
-	case HTTPLEX_STATE_KEY:
-		return httplex__classify_key_token(self);
-	case HTTPLEX_STATE_VALUE:
-		return httplex__classify_value_token(self);
-	};
-
-	abort();
-	return -1;
-}
-
-struct httplex_token* httplex_next_token(struct httplex* self)
-{
-	if (self->current_token.type == HTTPLEX_END)
-		return &self->current_token;
-
-	if (!self->accepted)
-		return &self->current_token;
-
-	if (self->next_pos)
-		self->pos = self->next_pos;
-
-	if (httplex__classify_token(self) < 0)
+	if (http__is_word(pos, len, "GET"))
+		req->method = HTTP_GET;
+	else if (http__is_word(pos, len, "PUT"))
+		req->method = HTTP_PUT;
+	else if (http__is_word(pos, len, "OPTIONS"))
+		req->method = HTTP_OPTIONS;
+	else
 		return NULL;
 
-	self->accepted = 0;
-
-	return &self->current_token;
-}
-
-static inline int httplex_accept_token(struct httplex* self)
-{
-	self->accepted = 1;
-	return 1;
-}
-
-int http__literal(struct httplex* lex, const char* str)
-{
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
-
-	if (tok->type != HTTPLEX_LITERAL)
-		return 0;
-
-	if (strcasecmp(str, tok->value) != 0)
-		return 0;
-
-	return httplex_accept_token(lex);
+	return pos + len;
 }
 
-int http__get(struct http_req* req, struct httplex* lex)
+static char* http__ws(char* pos)
 {
-	if (!http__literal(lex, "GET"))
-		return 0;
-
-	req->method = HTTP_GET;
-	return 1;
+	size_t len = strspn(pos, " \t");
+	return len > 0 ? pos + len : NULL;
 }
 
-int http__put(struct http_req* req, struct httplex* lex)
+static char* http__version(char* pos)
 {
-	if (!http__literal(lex, "PUT"))
-		return 0;
+	if (strncasecmp(pos, "HTTP/1.1\r\n", 10) != 0)
+		return NULL;
 
-	req->method = HTTP_PUT;
-	return 1;
+	return pos + 10;
 }
 
-int http__options(struct http_req* req, struct httplex* lex)
+static int http__url_path(struct http_req* req, char* pos)
 {
-	if (!http__literal(lex, "OPTIONS"))
-		return 0;
-
-	req->method = HTTP_OPTIONS;
-	return 1;
-}
+	if (*pos != '/')
+		return -1;
 
-int http__method(struct http_req* req, struct httplex* lex)
-{
-	return http__get(req, lex)
-	    || http__put(req, lex)
-	    || http__options(req, lex);
-}
+	while (1) {
+		pos += strspn(pos, "/");
+		if (*pos == '\0')
+			return 0;
 
-int http__peek(struct httplex* lex, enum httplex_token_type type)
-{
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
+		size_t len = http__literal_length(pos);
+		if (len == 0 || (pos[len] != '/' && pos[len] != '\0'))
+			return -1;
 
-	if (tok->type != type)
-		return 0;
+		if (req->url_index >= URL_INDEX_MAX)
+			return -1;
 
-	return 1;
-}
+		req->url[req->url_index++] = pos;
 
-int http__expect(struct httplex* lex, enum httplex_token_type type)
-{
-	return http__peek(lex, type) && httplex_accept_token(lex);
-}
+		if (pos[len] == '\0')
+			return 0;
 
-int http__version(struct httplex* lex)
-{
-	return http__literal(lex, "HTTP")
-	    && http__expect(lex, HTTPLEX_SOLIDUS)
-	    && http__literal(lex, "1.1");
+		pos[len] = '\0';
+		pos += len + 1;
+	}
 }
 
-int http__url_path(struct http_req* req, struct httplex* lex)
+static int http__url_query(struct http_req* req, char* pos)
 {
-	if (!http__expect(lex, HTTPLEX_SOLIDUS))
-		return 0;
+	while (*pos != '\0') {
+		size_t len = http__literal_length(pos);
+		if (len == 0)
+			return -1;
 
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
+		if (req->url_query_index >= URL_QUERY_INDEX_MAX)
+			return -1;
 
-	if (tok->type != HTTPLEX_LITERAL)
-		return tok->type == HTTPLEX_WS;
+		struct http_url_query* query =
+			&req->url_query[req->url_query_index++];
 
-	if (req->url_index >= URL_INDEX_MAX)
-		return 0;
-
-	char* elem = strdup(tok->value);
-	if (!elem)
-		return 0;
+		query->key = pos;
+		pos += len;
 
-	req->url[req->url_index++] = elem;
+		if (*pos == '=') {
+			*pos++ = '\0';
+			len = http__literal_length(pos);
+			query->value = pos;
+			pos += len;
+		} else {
+			query->value = pos;
+		}
 
-	httplex_accept_token(lex);
+		if (*pos == '&')
+			*pos++ = '\0';
+		else if (*pos != '\0')
+			return -1;
+	}
 
-	return http__peek(lex, HTTPLEX_SOLIDUS)
-	     ? http__url_path(req, lex) : 1;
+	return 0;
 }
 
-int http__url_query_key(struct http_req* req, struct httplex* lex)
+static int http__url(struct http_req* req, char* url)
 {
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
-
-	if (tok->type != HTTPLEX_LITERAL)
-		return 0;
+	char* query = strchr(url, '?');
+	if (query)
+		*query++ = '\0';
 
-	if (req->url_index >= URL_INDEX_MAX)
-		return 0;
-
-	char* elem = strdup(tok->value);
-	if (!elem)
-		return 0;
-
-	req->url_query[req->url_query_index].key = elem;
+	if (http__url_path(req, url) < 0)
+		return -1;
 
-	return httplex_accept_token(lex);
+	return query ? http__url_query(req, query) : 0;
 }
 
-int http__url_query_value(struct http_req* req, struct httplex* lex)
+static char* http__request(struct http_req* req, char* pos)
 {
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
+	pos = http__method(req, pos);
+	if (!pos)
+		return NULL;
 
-	if (tok->type != HTTPLEX_LITERAL)
-		return 0;
+	pos = http__ws(pos);
+	if (!pos)
+		return NULL;
 
-	if (req->url_index >= URL_INDEX_MAX)
-		return 0;
+	char* url = pos;
+	pos += strcspn(pos, " \t\r\n");
+	char* url_end = pos;
 
-	char* elem = strdup(tok->value);
-	if (!elem)
-		return 0;
+	pos = http__ws(pos);
+	if (!pos)
+		return NULL;
 
-	req->url_query[req->url_query_index++].value = elem;
+	pos = http__version(pos);
+	if (!pos)
+		return NULL;
 
-	return httplex_accept_token(lex);
-}
+	*url_end = '\0';
 
-int http__url_query(struct http_req* req, struct httplex* lex)
-{
-	return http__url_query_key(req, lex)
-	    && http__expect(lex, HTTPLEX_EQ)
-	    && http__url_query_value(req, lex)
-	    && http__expect(lex, HTTPLEX_AMPERSAND)
-	       ? http__url_query(req, lex) : 1;
+	return http__url(req, url) < 0 ? NULL : pos;
 }
 
-int http__url(struct http_req* req, struct httplex* lex)
+static void http__header_value(struct http_req* req, const char* key,
+			       size_t key_len, char* value)
 {
-	return http__url_path(req, lex)
-	    && http__expect(lex, HTTPLEX_QUERY) ? http__url_query(req, lex) : 1;
+	if (http__is_word(key, key_len, "Content-Length"))
+		req->content_length = strtoul(value, NULL, 10);
+	else if (http__is_word(key, key_len, "Content-Type"))
+		req->content_type = value;
+	else if (http__is_word(key, key_len, "If-None-Match"))
+		req->if_none_match = value;
+	else if (http__is_word(key, key_len, "Accept"))
+		req->accept = value;
+	else if (http__is_word(key, key_len, "Connection")) {
+		req->is_connection_close = !!strcasestr(value, "close");
+		req->is_connection_upgrade = !!strcasestr(value, "upgrade");
+	} else if (http__is_word(key, key_len, "Upgrade"))
+		req->upgrade = value;
+	else if (http__is_word(key, key_len, "Sec-WebSocket-Key"))
+		req->websocket_key = value;
+	else if (http__is_word(key, key_len, "Sec-WebSocket-Version"))
+		req->websocket_version = value;
 }
 
-int http__request(struct http_req* req, struct httplex* lex)
+static char* http__header(struct http_req* req, char* pos)
 {
-	return http__method(req, lex)
-	    && http__expect(lex, HTTPLEX_WS)
-	    && http__url(req, lex)
-	    && http__expect(lex, HTTPLEX_WS)
-	    && http__version(lex)
-	    && http__expect(lex, HTTPLEX_CR)
-	    && http__expect(lex, HTTPLEX_LF);
-}
+	while (strncmp(pos, "\r\n", 2) != 0) {
+		size_t key_len = strcspn(pos, ": \t\r\n");
+		if (key_len == 0 || pos[key_len] != ':')
+			return NULL;
 
-int http__expect_key(struct httplex* lex, const char* key)
-{
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
+		char* value = pos + key_len + 1;
+		value += strspn(value, " \t");
 
-	if (tok->type != HTTPLEX_KEY)
-		return 0;
+		size_t value_len = strcspn(value, "\r\n");
+		if (strncmp(&value[value_len], "\r\n", 2) != 0)
+			return NULL;
 
-	if (key && strcasecmp(tok->value, key) != 0)
-		return 0;
+		value[value_len] = '\0';
+		http__header_value(req, pos, key_len, value);
 
-	return httplex_accept_token(lex);
-}
-
-int http__content_length(struct http_req* req, struct httplex* lex)
-{
-	lex->state = HTTPLEX_STATE_KEY;
-	if (!http__expect_key(lex, "Content-Length"))
-		return 0;
-
-	lex->state = HTTPLEX_STATE_VALUE;
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
-
-	if (tok->type != HTTPLEX_VALUE)
-		return 0;
-
-	req->content_length = atoi(tok->value);
+		pos = value + value_len + 2;
+	}
 
-	return httplex_accept_token(lex);
+	return pos + 2;
 }
 
-int http__content_type(struct http_req* req, struct httplex* lex)
+int http_req_parse(struct http_req* req, char* head)
 {
-	lex->state = HTTPLEX_STATE_KEY;
-	if (!http__expect_key(lex, "Content-Type"))
-		return 0;
-
-	lex->state = HTTPLEX_STATE_VALUE;
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
-
-	if (tok->type != HTTPLEX_VALUE)
-		return 0;
-
-	req->content_type = strdup(tok->value);
-
-	return httplex_accept_token(lex);
-}
+	memset(req, 0, sizeof(*req));
 
-int http__dummy_kv(struct httplex* lex)
-{
-	lex->state = HTTPLEX_STATE_KEY;
-	if (!http__expect_key(lex, NULL))
-		return 0;
+	char* pos = http__request(req, head);
+	if (!pos)
+		return -1;
 
-	lex->state = HTTPLEX_STATE_VALUE;
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
+	pos = http__header(req, pos);
+	if (!pos)
+		return -1;
 
-	if (tok->type != HTTPLEX_VALUE)
-		return 0;
+	req->header_length = pos - head;
 
-	return httplex_accept_token(lex);
+	return 0;
 }
 
-
-int http__header_kv(struct http_req* req, struct httplex* lex)
+void http_req_free(struct http_req* req)
 {
-	return http__content_length(req, lex)
-	    || http__content_type(req, lex)
-	    || http__dummy_kv(lex);
+	(void)req;
 }
 
-int http__header(struct http_req* req, struct httplex* lex)
+static inline char* http__rebase(char* ptr, uintptr_t from, char* to)
 {
-	while (http__header_kv(req, lex));
-
-	lex->state = HTTPLEX_STATE_KEY;
-	if (http__expect(lex, HTTPLEX_CR))
-		return http__expect(lex, HTTPLEX_LF);
-
-	return 1;
+	return ptr ? to + ((uintptr_t)ptr - from) : NULL;
 }
 
-int http_req_parse(struct http_req* req, const char* input)
+void http_req_rebase(struct http_req* req, const void* from, void* to)
 {
-	int rc = -1;
-	memset(req, 0, sizeof(*req));
-
-	struct httplex lex;
-	if (httplex_init(&lex, input) < 0)
-		return -1;
-
-	if (!http__request(req, &lex))
-		goto failure;
-
-	if (!http__header(req, &lex))
-		goto failure;
+	uintptr_t base = (uintptr_t)from;
 
-	req->header_length = lex.next_pos - input;
-
-	rc = 0;
-failure:
-	httplex_destroy(&lex);
-	return rc;
-}
-
-void http_req_free(struct http_req* req)
-{
-	free(req->content_type);
+	req->content_type = http__rebase(req->content_type, base, to);
+	req->if_none_match = http__rebase(req->if_none_match, base, to);
+	req->accept = http__rebase(req->accept, base, to);
+	req->upgrade = http__rebase(req->upgrade, base, to);
+	req->websocket_key = http__rebase(req->websocket_key, base, to);
+	req->websocket_version = http__rebase(req->websocket_version, base,
+					      to);
 
 	for (size_t i = 0; i < req->url_index; ++i)
-		free(req->url[i]);
+		req->url[i] = http__rebase(req->url[i], base, to);
 
 	for (size_t i = 0; i < req->url_query_index; ++i) {
-		free(req->url_query[i].key);
-		free(req->url_query[i].value);
+		struct http_url_query* query = &req->url_query[i];
+		query->key = http__rebase(query->key, base, to);
+		query->value = http__rebase(query->value, base, to);
 	}
 }
 
@@ -0,0 +1,233 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "canopen.h"
+#include "canopen/identity_cache.h"
+
+size_t strlcpy(char*, const char*, size_t);
+
+/* One line per node:
+ * <nodeid> <device type> <vendor> <product> <revision> <name> <hw> <sw>
+ * with the fields separated by tabs.
+ */
+#define IDENTITY_CACHE__N_FIELDS 8
+
+struct identity_cache__slot {
+	int is_valid;
+	struct identity_cache_entry entry;
+};
+
+static struct identity_cache__slot
+identity_cache__slots[CANOPEN_NODEID_MAX + 1];
+static int identity_cache__is_dirty = 0;
+static pthread_mutex_t identity_cache__mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int identity_cache__parse_line(char* line)
+{
+	char* field[IDENTITY_CACHE__N_FIELDS];
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	for (int i = 0; i < IDENTITY_CACHE__N_FIELDS; ++i) {
+		field[i] = strsep(&line, "\t");
+		if (!field[i])
+			return -1;
+	}
+
+	char* end = NULL;
+	int nodeid = strtol(field[0], &end, 10);
+	if (*end != '\0' || nodeid < CANOPEN_NODEID_MIN
+	 || nodeid > CANOPEN_NODEID_MAX)
+		return -1;
+
+	struct identity_cache__slot* slot = &identity_cache__slots[nodeid];
+	struct identity_cache_entry* entry = &slot->entry;
+
+	entry->device_type = strtoul(field[1], NULL, 0);
+	entry->vendor_id = strtoul(field[2], NULL, 0);
+	entry->product_code = strtoul(field[3], NULL, 0);
+	entry->revision_number = strtoul(field[4], NULL, 0);
+	strlcpy(entry->name, field[5], sizeof(entry->name));
+	strlcpy(entry->hw_version, field[6], sizeof(entry->hw_version));
+	strlcpy(entry->sw_version, field[7], sizeof(entry->sw_version));
+
+	slot->is_valid = 1;
+	return 0;
+}
+
+int identity_cache_load(const char* path)
+{
+	char line[512];
+
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return errno == ENOENT ? 0 : -1;
+
+	pthread_mutex_lock(&identity_cache__mutex);
+
+	while (fgets(line, sizeof(line), file))
+		identity_cache__parse_line(line);
+
+	identity_cache__is_dirty = 0;
+
+	pthread_mutex_unlock(&identity_cache__mutex);
+
+	fclose(file);
+	return 0;
+}
+
+/* Tabs and line breaks would break up the line */
+static const char* identity_cache__clean(char* dst, const char* src,
+					 size_t size)
+{
+	strlcpy(dst, src, size);
+
+	for (char* p = dst; *p; ++p)
+		if (*p == '\t' || *p == '\r' || *p == '\n')
+			*p = ' ';
+
+	return dst;
+}
+
+static int identity_cache__write(FILE* file)
+{
+	char name[64], hw_version[64], sw_version[64];
+
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		const struct identity_cache__slot* slot =
+			&identity_cache__slots[i];
+		if (!slot->is_valid)
+			continue;
+
+		const struct identity_cache_entry* entry = &slot->entry;
+
+		if (fprintf(file, "%d\t%#x\t%#x\t%#x\t%#x\t%s\t%s\t%s\n", i,
+			    entry->device_type, entry->vendor_id,
+			    entry->product_code, entry->revision_number,
+			    identity_cache__clean(name, entry->name,
+						  sizeof(name)),
+			    identity_cache__clean(hw_version,
+						  entry->hw_version,
+						  sizeof(hw_version)),
+			    identity_cache__clean(sw_version,
+						  entry->sw_version,
+						  sizeof(sw_version))) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int identity_cache_save(const char* path)
+{
+	int rc = -1;
+	char tmp_path[256];
+
+	pthread_mutex_lock(&identity_cache__mutex);
+
+	if (!identity_cache__is_dirty) {
+		rc = 0;
+		goto done;
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	tmp_path[sizeof(tmp_path) - 1] = '\0';
+
+	/* Readers always see either the old or the new file */
+	FILE* file = fopen(tmp_path, "w");
+	if (!file)
+		goto done;
+
+	if (identity_cache__write(file) < 0) {
+		fclose(file);
+		goto failure;
+	}
+
+	if (fclose(file) != 0)
+		goto failure;
+
+	if (rename(tmp_path, path) < 0)
+		goto failure;
+
+	identity_cache__is_dirty = 0;
+	rc = 0;
+	goto done;
+
+failure:
+	unlink(tmp_path);
+done:
+	pthread_mutex_unlock(&identity_cache__mutex);
+	return rc;
+}
+
+int identity_cache_get(int nodeid, struct identity_cache_entry* dst)
+{
+	int rc = -1;
+
+	pthread_mutex_lock(&identity_cache__mutex);
+
+	const struct identity_cache__slot* slot =
+		&identity_cache__slots[nodeid];
+	if (slot->is_valid) {
+		*dst = slot->entry;
+		rc = 0;
+	}
+
+	pthread_mutex_unlock(&identity_cache__mutex);
+	return rc;
+}
+
+void identity_cache_set(int nodeid, const struct identity_cache_entry* src)
+{
+	pthread_mutex_lock(&identity_cache__mutex);
+
+	struct identity_cache__slot* slot = &identity_cache__slots[nodeid];
+
+	if (!slot->is_valid || memcmp(&slot->entry, src, sizeof(*src)) != 0) {
+		slot->entry = *src;
+		slot->is_valid = 1;
+		identity_cache__is_dirty = 1;
+	}
+
+	pthread_mutex_unlock(&identity_cache__mutex);
+}
+
+void identity_cache_invalidate(int nodeid)
+{
+	pthread_mutex_lock(&identity_cache__mutex);
+
+	struct identity_cache__slot* slot = &identity_cache__slots[nodeid];
+	if (slot->is_valid) {
+		slot->is_valid = 0;
+		identity_cache__is_dirty = 1;
+	}
+
+	pthread_mutex_unlock(&identity_cache__mutex);
+}
+
+void identity_cache_clear(void)
+{
+	pthread_mutex_lock(&identity_cache__mutex);
+	memset(identity_cache__slots, 0, sizeof(identity_cache__slots));
+	identity_cache__is_dirty = 0;
+	pthread_mutex_unlock(&identity_cache__mutex);
+}
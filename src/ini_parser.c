@@ -16,7 +16,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "ini_parser.h"
 #include "vector.h"
@@ -76,7 +81,8 @@ static struct ini_section* ini__new_section(const char* name)
 
 	memset(section, 0, sizeof(*section));
 
-	memcpy(section->section, name, name_size);
+	memcpy(section->buffer, name, name_size);
+	section->section = section->buffer;
 
 	if (vector_init(&section->kv, 8 * sizeof(void*)) < 0)
 		goto failure;
@@ -129,10 +135,11 @@ static struct ini_key_value* ini__new_key_value(const char* key,
 
 	memset(kv, 0, sizeof(*kv));
 
-	kv->value = kv->key + key_size;
+	kv->value = kv->buffer + key_size;
 
-	strcpy(kv->key, key);
+	strcpy(kv->buffer, key);
 	strcpy(kv->value, value);
+	kv->key = kv->buffer;
 
 	return kv;
 }
@@ -256,8 +263,201 @@ done:
 	return lineno;
 }
 
+static int ini__map_file(struct ini_file* self, const char* path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		goto failure;
+
+	size_t size = st.st_size;
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	/* The rest of the last page of a mapping reads as zeros, so the text
+	 * is terminated unless it fills the page.
+	 */
+	if (size > 0 && size % page_size != 0) {
+		void* text = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE, fd, 0);
+		if (text != MAP_FAILED) {
+			self->text = text;
+			self->text_size = size;
+			self->is_mapped = 1;
+			close(fd);
+			return 0;
+		}
+	}
+
+	self->text = malloc(size + 1);
+	if (!self->text)
+		goto failure;
+
+	size_t n = 0;
+	while (n < size) {
+		ssize_t rc = read(fd, self->text + n, size - n);
+		if (rc <= 0)
+			goto read_failure;
+		n += rc;
+	}
+
+	self->text[size] = '\0';
+	self->text_size = size;
+	close(fd);
+	return 0;
+
+read_failure:
+	free(self->text);
+	self->text = NULL;
+failure:
+	close(fd);
+	return -1;
+}
+
+/* The key values of a section are contiguous in kvs. While parsing, the index
+ * of the first one is kept in kv.index of the section.
+ */
+static int ini__add_section_slice(struct ini_file* self, const char* name)
+{
+	struct ini_section section;
+	memset(&section, 0, sizeof(section));
+
+	section.section = name;
+	section.kv.index = self->kvs.index / sizeof(struct ini_key_value);
+
+	return vector_append(&self->sections, &section, sizeof(section));
+}
+
+static int ini__parse_line_slice(struct ini_file* self, char* line)
+{
+	char* trimmed = ini__trim(line);
+
+	if (ini__is_empty(trimmed) || ini__is_comment(trimmed))
+		return 0;
+
+	if (ini__is_section(trimmed)) {
+		char* end = trimmed + strlen(trimmed) - 1;
+		if (*end != ']')
+			return -1;
+
+		*end = '\0';
+		return ini__add_section_slice(self, ini__to_lower(trimmed + 1));
+	}
+
+	char* eq = strchr(trimmed, '=');
+	if (!eq)
+		return -1;
+
+	*eq = '\0';
+
+	struct ini_key_value kv = {
+		.value = ini__trim_left(eq + 1),
+		.key = ini__to_lower(ini__trim_right(trimmed)),
+	};
+
+	return vector_append(&self->kvs, &kv, sizeof(kv));
+}
+
+static int ini__link_slices(struct ini_file* self)
+{
+	struct ini_section* sections = self->sections.data;
+	size_t n_sections = self->sections.index / sizeof(*sections);
+
+	struct ini_key_value* kvs = self->kvs.data;
+	size_t n_kvs = self->kvs.index / sizeof(*kvs);
+
+	if (vector_reserve_exact(&self->section, n_sections * sizeof(void*)) < 0
+	 || vector_reserve_exact(&self->kv_index, n_kvs * sizeof(void*)) < 0)
+		return -1;
+
+	struct ini_key_value** index = self->kv_index.data;
+	for (size_t i = 0; i < n_kvs; ++i)
+		index[i] = &kvs[i];
+	self->kv_index.index = n_kvs * sizeof(void*);
+
+	struct ini_section** section = self->section.data;
+	for (size_t i = 0; i < n_sections; ++i) {
+		size_t first = sections[i].kv.index;
+		size_t last = i + 1 < n_sections ? sections[i + 1].kv.index
+						 : n_kvs;
+
+		sections[i].kv.data = &index[first];
+		sections[i].kv.index = (last - first) * sizeof(void*);
+		sections[i].kv.size = sections[i].kv.index;
+
+		section[i] = &sections[i];
+	}
+	self->section.index = n_sections * sizeof(void*);
+
+	return 0;
+}
+
+int ini_parse_file(struct ini_file* self, const char* path)
+{
+	int lineno = 0;
+
+	memset(self, 0, sizeof(*self));
+
+	if (ini__map_file(self, path) < 0)
+		return -1;
+
+	if (vector_init(&self->section, 64 * sizeof(void*)) < 0
+	 || vector_init(&self->sections, 64 * sizeof(struct ini_section)) < 0
+	 || vector_init(&self->kvs, 256 * sizeof(struct ini_key_value)) < 0
+	 || vector_init(&self->kv_index, 256 * sizeof(void*)) < 0)
+		goto failure;
+
+	if (ini__add_section_slice(self, "(root)") < 0)
+		goto failure;
+
+	char* line = self->text;
+	char* end = self->text + self->text_size;
+
+	while (line < end) {
+		char* newline = memchr(line, '\n', end - line);
+		if (newline)
+			*newline = '\0';
+
+		--lineno;
+
+		if (ini__parse_line_slice(self, line) < 0)
+			goto failure;
+
+		line = newline ? newline + 1 : end;
+	}
+
+	if (ini__link_slices(self) < 0) {
+		lineno = -1;
+		goto failure;
+	}
+
+	ini__sort(self);
+
+	return 0;
+
+failure:
+	ini_destroy(self);
+	return lineno < 0 ? lineno : -1;
+}
+
 void ini_destroy(struct ini_file* file)
 {
+	if (file->text) {
+		if (file->is_mapped)
+			munmap(file->text, file->text_size);
+		else
+			free(file->text);
+
+		vector_destroy(&file->kv_index);
+		vector_destroy(&file->kvs);
+		vector_destroy(&file->sections);
+		vector_destroy(&file->section);
+		memset(file, 0, sizeof(*file));
+		return;
+	}
+
 	struct ini_section** section = file->section.data;
 	size_t section_end = file->section.index / sizeof(void*);
 
@@ -278,9 +478,8 @@ void ini_destroy(struct ini_file* file)
 const char* ini_find_key(const struct ini_section* section, const char* key)
 {
 	struct ini_key_value** kvp;
-	char kbuf[sizeof(struct ini_key_value) + strlen(key) + 1];
-	struct ini_key_value* key_key = (void*)kbuf;
-	strcpy(key_key->key, key);
+	struct ini_key_value key_kv = { .key = key };
+	const struct ini_key_value* key_key = &key_kv;
 	kvp = bsearch(&key_key, section->kv.data,
 		     section->kv.index / sizeof(void*), sizeof(void*),
 		     ini__key_cmp);
@@ -297,9 +496,8 @@ const struct ini_section* ini_find_section(const struct ini_file* file,
 					   const char* section)
 {
 	struct ini_section** sp;
-	char sbuf[sizeof(struct ini_section) + strlen(section) + 1];
-	struct ini_section* section_key = (void*)sbuf;
-	strcpy(section_key->section, section);
+	struct ini_section section_sect = { .section = section };
+	const struct ini_section* section_key = &section_sect;
 	sp = bsearch(&section_key, file->section.data,
 		     file->section.index / sizeof(void*), sizeof(void*),
 		     ini__section_cmp);
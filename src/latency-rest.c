@@ -0,0 +1,197 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "canopen/latency.h"
+#include "rest.h"
+#include "latency-rest.h"
+
+static void latency_rest__reply(struct rest_client* client,
+				const char* status_code, const char* type,
+				const char* message, size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void latency_rest__text(struct rest_client* client,
+			       const char* status_code, const char* message)
+{
+	latency_rest__reply(client, status_code, "text/plain", message,
+			    strlen(message));
+}
+
+static int latency_rest__parse_int(int* dst, const char* str)
+{
+	if (!str || !*str)
+		return -1;
+
+	char* end = NULL;
+	long value = strtol(str, &end, 10);
+	if (*end != '\0')
+		return -1;
+
+	*dst = value;
+	return 0;
+}
+
+static int latency_rest__parse_mask(struct co_latency_rule* rule,
+				    const char* str)
+{
+	size_t length = strlen(str);
+	if (length % 2 != 0 || length / 2 > CO_LATENCY_MASK_SIZE)
+		return -1;
+
+	for (size_t i = 0; i < length / 2; ++i) {
+		char byte[3] = { str[2 * i], str[2 * i + 1], '\0' };
+		char* end = NULL;
+
+		rule->mask[i] = strtoul(byte, &end, 16);
+		if (*end != '\0')
+			return -1;
+	}
+
+	rule->mask_size = length / 2;
+	return 0;
+}
+
+static void latency_rest__add_rule(struct rest_client* client)
+{
+	struct co_latency_rule rule;
+	memset(&rule, 0, sizeof(rule));
+
+	const char* mask = http_req_query(&client->req, "mask");
+
+	if (latency_rest__parse_int(&rule.nodeid,
+			http_req_query(&client->req, "node")) < 0
+	 || latency_rest__parse_int(&rule.rpdo,
+			http_req_query(&client->req, "rpdo")) < 0
+	 || latency_rest__parse_int(&rule.tpdo,
+			http_req_query(&client->req, "tpdo")) < 0
+	 || (mask && latency_rest__parse_mask(&rule, mask) < 0)) {
+		latency_rest__text(client, "400 Bad Request",
+				   "Invalid rule\r\n");
+		return;
+	}
+
+	if (co_latency_add_rule(&rule) < 0) {
+		latency_rest__text(client, "400 Bad Request",
+				   "Rule was rejected\r\n");
+		return;
+	}
+
+	latency_rest__text(client, "200 OK", "OK\r\n");
+}
+
+static void latency_rest__print_rule(struct arena_text* out,
+				     const struct co_latency_rule* rule,
+				     const struct co_latency_stats* stats)
+{
+	arena_printf(out, "  { \"node\": %d, \"rpdo\": %d, \"tpdo\": %d"
+		     ", \"mask\": \"", rule->nodeid, rule->rpdo, rule->tpdo);
+
+	for (size_t i = 0; i < rule->mask_size; ++i)
+		arena_printf(out, "%02x", rule->mask[i]);
+
+	arena_printf(out, "\", \"count\": %" PRIu64 ", \"unanswered\": %" PRIu64
+		     ", \"max\": %" PRIu64 ", \"buckets\": [", stats->count,
+		     stats->n_unanswered, stats->max);
+
+	int last = CO_LATENCY_N_BUCKETS - 1;
+	while (last >= 0 && stats->bucket[last] == 0)
+		--last;
+
+	for (int i = 0; i <= last; ++i)
+		arena_printf(out, "%s%" PRIu64, i ? ", " : "",
+			     stats->bucket[i]);
+
+	arena_printf(out, "] }");
+}
+
+static void latency_rest__get(struct rest_client* client)
+{
+	struct arena_text text;
+	arena_text_init(&text, &client->arena);
+	struct arena_text* out = &text;
+
+	arena_printf(out, "{\n \"is-enabled\": %s,\n \"rules\": [",
+		     co_latency_is_enabled() ? "true" : "false");
+
+	struct co_latency_rule rule;
+	struct co_latency_stats stats;
+	size_t i;
+
+	for (i = 0; co_latency_get(i, &rule, &stats) == 0; ++i) {
+		arena_printf(out, "%s\n", i ? "," : "");
+		latency_rest__print_rule(out, &rule, &stats);
+	}
+
+	arena_printf(out, "%s]\n}\n", i ? "\n " : "");
+
+	if (out->is_bad) {
+		latency_rest__text(client, "500 Internal Server Error",
+				   "Out of memory\r\n");
+		return;
+	}
+
+	latency_rest__reply(client, "200 OK", "application/json", out->data,
+			    out->length);
+}
+
+void latency_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (client->req.method == HTTP_GET) {
+		if (client->req.url_index != 1) {
+			latency_rest__text(client, "404 Not Found",
+					   "Not found\r\n");
+			return;
+		}
+
+		latency_rest__get(client);
+		return;
+	}
+
+	const char* action = client->req.url_index == 2 ? client->req.url[1]
+							: "";
+
+	if (strcmp(action, "rule") == 0) {
+		latency_rest__add_rule(client);
+	} else if (strcmp(action, "clear") == 0) {
+		co_latency_clear();
+		latency_rest__text(client, "200 OK", "OK\r\n");
+	} else if (strcmp(action, "start") == 0) {
+		co_latency_enable(1);
+		latency_rest__text(client, "200 OK", "OK\r\n");
+	} else if (strcmp(action, "stop") == 0) {
+		co_latency_enable(0);
+		latency_rest__text(client, "200 OK", "OK\r\n");
+	} else {
+		latency_rest__text(client, "404 Not Found", "Not found\r\n");
+	}
+}
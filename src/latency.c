@@ -0,0 +1,186 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "canopen.h"
+#include "canopen/latency.h"
+
+struct co_latency__entry {
+	struct co_latency_rule rule;
+	uint32_t rpdo_cob_id, tpdo_cob_id;
+
+	int is_pending;
+	uint64_t sent_at;
+	uint8_t sent[CO_LATENCY_MASK_SIZE];
+
+	struct co_latency_stats stats;
+};
+
+static struct co_latency__entry co_latency__entry[CO_LATENCY_RULES_MAX];
+static size_t co_latency__n_entries = 0;
+static int co_latency__is_enabled = 0;
+
+/* Frames are sent from any thread holding the TX lock, but received and
+ * reported on the main loop.
+ */
+static pthread_mutex_t co_latency__lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline unsigned int co_latency__bucket(uint64_t value)
+{
+	if (value == 0)
+		return 0;
+
+	unsigned int bucket = 63 - __builtin_clzll(value);
+	return bucket < CO_LATENCY_N_BUCKETS ? bucket : CO_LATENCY_N_BUCKETS - 1;
+}
+
+static inline uint32_t co_latency__cob_id(int function, int n, int nodeid)
+{
+	return function + (n - 1) * 0x100 + nodeid;
+}
+
+int co_latency_add_rule(const struct co_latency_rule* rule)
+{
+	if (rule->nodeid < CANOPEN_NODEID_MIN || rule->nodeid > CANOPEN_NODEID_MAX
+	 || rule->rpdo < 1 || rule->rpdo > 4 || rule->tpdo < 1 || rule->tpdo > 4
+	 || rule->mask_size > CO_LATENCY_MASK_SIZE)
+		return -1;
+
+	int rc = -1;
+
+	pthread_mutex_lock(&co_latency__lock);
+
+	if (co_latency__n_entries >= CO_LATENCY_RULES_MAX)
+		goto done;
+
+	struct co_latency__entry* entry =
+		&co_latency__entry[co_latency__n_entries];
+
+	memset(entry, 0, sizeof(*entry));
+	entry->rule = *rule;
+	entry->rpdo_cob_id = co_latency__cob_id(R_RPDO1, rule->rpdo,
+						rule->nodeid);
+	entry->tpdo_cob_id = co_latency__cob_id(R_TPDO1, rule->tpdo,
+						rule->nodeid);
+
+	rc = co_latency__n_entries++;
+
+done:
+	pthread_mutex_unlock(&co_latency__lock);
+	return rc;
+}
+
+void co_latency_clear(void)
+{
+	pthread_mutex_lock(&co_latency__lock);
+	co_latency__n_entries = 0;
+	pthread_mutex_unlock(&co_latency__lock);
+}
+
+void co_latency_enable(int is_enabled)
+{
+	__atomic_store_n(&co_latency__is_enabled, is_enabled, __ATOMIC_RELAXED);
+}
+
+int co_latency_is_enabled(void)
+{
+	return __atomic_load_n(&co_latency__is_enabled, __ATOMIC_RELAXED);
+}
+
+void co_latency_on_tx(uint32_t cob_id, const void* data, size_t size,
+		      uint64_t timestamp)
+{
+	pthread_mutex_lock(&co_latency__lock);
+
+	for (size_t i = 0; i < co_latency__n_entries; ++i) {
+		struct co_latency__entry* entry = &co_latency__entry[i];
+		if (entry->rpdo_cob_id != cob_id)
+			continue;
+
+		if (entry->is_pending)
+			entry->stats.n_unanswered++;
+
+		size_t n = size < CO_LATENCY_MASK_SIZE ? size
+						       : CO_LATENCY_MASK_SIZE;
+
+		memset(entry->sent, 0, sizeof(entry->sent));
+		memcpy(entry->sent, data, n);
+
+		entry->sent_at = timestamp;
+		entry->is_pending = 1;
+	}
+
+	pthread_mutex_unlock(&co_latency__lock);
+}
+
+static int co_latency__is_match(const struct co_latency__entry* entry,
+				const uint8_t* data, size_t size)
+{
+	const struct co_latency_rule* rule = &entry->rule;
+
+	for (size_t i = 0; i < rule->mask_size; ++i) {
+		uint8_t received = i < size ? data[i] : 0;
+		if ((received ^ entry->sent[i]) & rule->mask[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+void co_latency_on_rx(uint32_t cob_id, const void* data, size_t size,
+		      uint64_t timestamp)
+{
+	pthread_mutex_lock(&co_latency__lock);
+
+	for (size_t i = 0; i < co_latency__n_entries; ++i) {
+		struct co_latency__entry* entry = &co_latency__entry[i];
+		if (entry->tpdo_cob_id != cob_id || !entry->is_pending
+		 || !co_latency__is_match(entry, data, size))
+			continue;
+
+		struct co_latency_stats* stats = &entry->stats;
+
+		uint64_t latency = timestamp > entry->sent_at
+				 ? timestamp - entry->sent_at : 0;
+
+		stats->count++;
+		stats->bucket[co_latency__bucket(latency)]++;
+		if (latency > stats->max)
+			stats->max = latency;
+
+		entry->is_pending = 0;
+	}
+
+	pthread_mutex_unlock(&co_latency__lock);
+}
+
+int co_latency_get(size_t i, struct co_latency_rule* rule,
+		   struct co_latency_stats* stats)
+{
+	int rc = -1;
+
+	pthread_mutex_lock(&co_latency__lock);
+
+	if (i < co_latency__n_entries) {
+		*rule = co_latency__entry[i].rule;
+		*stats = co_latency__entry[i].stats;
+		rc = 0;
+	}
+
+	pthread_mutex_unlock(&co_latency__lock);
+	return rc;
+}
@@ -15,6 +15,7 @@
 
 #include <exception>
 #include <stdlib.h>
+#include <stddef.h>
 #include "plog.h"
 
 extern "C" {
@@ -203,6 +204,29 @@ int legacy_driver_iface_process_pdo(void* obj, int n, const unsigned char* data,
 	return -1;
 }
 
+static_assert(sizeof(legacy_pdo_frame) == sizeof(CanIOHandlerInterface::Frame)
+	      && offsetof(legacy_pdo_frame, n)
+		 == offsetof(CanIOHandlerInterface::Frame, pdo)
+	      && offsetof(legacy_pdo_frame, data)
+		 == offsetof(CanIOHandlerInterface::Frame, data)
+	      && offsetof(legacy_pdo_frame, size)
+		 == offsetof(CanIOHandlerInterface::Frame, size),
+	      "legacy_pdo_frame must match CanIOHandlerInterface::Frame");
+
+int legacy_driver_iface_process_pdo_batch(void* obj,
+					  const struct legacy_pdo_frame* frames,
+					  size_t n)
+{
+	auto iface = (CanIOHandlerInterface*)obj;
+	try {
+		return iface->processPdoBatch(
+			(const CanIOHandlerInterface::Frame*)frames, n);
+	} catch (exception& e) {
+		plogx(LOG_ERROR, "Caught exception: %s", e.what());
+		return -1;
+	}
+}
+
 int legacy_driver_iface_process_node_state(void* obj, int state)
 {
 	auto iface = (CanIOHandlerInterface*)obj;
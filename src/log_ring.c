@@ -0,0 +1,381 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#include "canopen/log_ring.h"
+#include "mpmcq.h"
+#include "co_atomic.h"
+#include "time-utils.h"
+#include "plog.h"
+
+/* How far a key may be from its hash position in the key table */
+#define CO_LOG_KEY_PROBES 8
+
+struct co_log__record {
+	int level;
+	int key_index; /* -1 if the message is not aggregated */
+
+	/* Repeats of the key in the window that this message closed */
+	unsigned long n_repeats;
+	uint64_t window;
+
+	char message[CO_LOG_MESSAGE_MAX];
+};
+
+/* The window of a key is opened by whoever manages to move window_start */
+struct co_log__key {
+	uint64_t key;
+	uint64_t window_start;
+	unsigned long n_repeats;
+};
+
+/* The last message of each key, only used by the log thread */
+struct co_log__last {
+	int level;
+	char message[CO_LOG_MESSAGE_MAX];
+};
+
+static struct co_log__record co_log__record[CO_LOG_RING_LENGTH];
+static struct co_log__key co_log__key[CO_LOG_KEY_COUNT];
+static struct co_log__last co_log__last[CO_LOG_KEY_COUNT];
+
+static struct mpmcq co_log__free;
+static struct mpmcq co_log__ready;
+
+static uint64_t co_log__window = 0; /* us */
+static unsigned long co_log__n_dropped = 0;
+
+static int co_log__is_running = 0;
+static int co_log__is_sleeping = 0;
+static int co_log__is_stopping = 0;
+static pthread_t co_log__thread;
+static pthread_mutex_t co_log__mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t co_log__cond;
+
+static inline size_t co_log__hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key % CO_LOG_KEY_COUNT;
+}
+
+static struct co_log__key* co_log__find_key(uint64_t key)
+{
+	size_t start = co_log__hash(key);
+
+	for (size_t i = 0; i < CO_LOG_KEY_PROBES; ++i) {
+		struct co_log__key* entry =
+			&co_log__key[(start + i) % CO_LOG_KEY_COUNT];
+
+		uint64_t current = co_atomic_load(&entry->key);
+		if (current == key)
+			return entry;
+
+		if (current != 0)
+			continue;
+
+		if (__atomic_compare_exchange_n(&entry->key, &current, key, 0,
+						__ATOMIC_SEQ_CST,
+						__ATOMIC_SEQ_CST)
+		 || current == key)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Returns 1 if the window of the key had closed, or is_forced is set, and a
+ * new one was opened
+ */
+static int co_log__open_window(struct co_log__key* entry, uint64_t now,
+			       int is_forced, unsigned long* n_repeats,
+			       uint64_t* window)
+{
+	uint64_t start = co_atomic_load(&entry->window_start);
+
+	if (!is_forced && start != 0 && now - start < co_log__window)
+		return 0;
+
+	if (!__atomic_compare_exchange_n(&entry->window_start, &start, now, 0,
+					 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		return 0;
+
+	*n_repeats = __atomic_exchange_n(&entry->n_repeats, 0,
+					 __ATOMIC_SEQ_CST);
+	*window = now - start;
+	return 1;
+}
+
+static void co_log__log_repeats(int key_index, unsigned long n_repeats,
+				uint64_t window)
+{
+	const struct co_log__last* last = &co_log__last[key_index];
+
+	if (n_repeats == 0 || !last->message[0])
+		return;
+
+	plog(last->level, "%s x%lu in %.1fs", last->message, n_repeats,
+	     window / 1e6);
+}
+
+static void co_log__log_record(const struct co_log__record* record)
+{
+	if (record->key_index >= 0) {
+		co_log__log_repeats(record->key_index, record->n_repeats,
+				    record->window);
+
+		struct co_log__last* last = &co_log__last[record->key_index];
+		last->level = record->level;
+		memcpy(last->message, record->message, sizeof(last->message));
+	}
+
+	plog(record->level, "%s", record->message);
+}
+
+/* Closes the windows that nothing has come along to close */
+static void co_log__sweep(uint64_t now, int is_final)
+{
+	for (int i = 0; i < CO_LOG_KEY_COUNT; ++i) {
+		struct co_log__key* entry = &co_log__key[i];
+
+		if (co_atomic_load(&entry->key) == 0
+		 || co_atomic_load(&entry->n_repeats) == 0)
+			continue;
+
+		unsigned long n_repeats;
+		uint64_t window;
+
+		if (co_log__open_window(entry, now, is_final, &n_repeats,
+					&window))
+			co_log__log_repeats(i, n_repeats, window);
+	}
+
+	unsigned long n_dropped = __atomic_exchange_n(&co_log__n_dropped, 0,
+						      __ATOMIC_SEQ_CST);
+	if (n_dropped)
+		plog(LOG_WARNING, "Dropped %lu log messages", n_dropped);
+}
+
+static int co_log__drain(void)
+{
+	int n = 0;
+	void* ptr;
+
+	while (mpmcq_pop(&co_log__ready, &ptr) == 0) {
+		co_log__log_record(ptr);
+		mpmcq_push(&co_log__free, ptr);
+		++n;
+	}
+
+	return n;
+}
+
+static void co_log__wait(uint64_t timeout_us)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	deadline.tv_sec += timeout_us / 1000000;
+	deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_nsec -= 1000000000;
+		deadline.tv_sec += 1;
+	}
+
+	pthread_mutex_lock(&co_log__mutex);
+
+	/* Producers read this after they have queued, so either they see that
+	 * we are sleeping or we see what they queued
+	 */
+	co_atomic_store(&co_log__is_sleeping, 1);
+
+	int rc = 0;
+	while (rc != ETIMEDOUT && !co_log__is_stopping
+	    && mpmcq_is_empty(&co_log__ready))
+		rc = pthread_cond_timedwait(&co_log__cond, &co_log__mutex,
+					    &deadline);
+
+	co_atomic_store(&co_log__is_sleeping, 0);
+
+	pthread_mutex_unlock(&co_log__mutex);
+}
+
+static void* co_log__main(void* arg)
+{
+	(void)arg;
+
+	uint64_t interval = co_log__window ? co_log__window : 1000000;
+	uint64_t next_sweep = gettime_us(CLOCK_MONOTONIC) + interval;
+
+	while (!co_atomic_load(&co_log__is_stopping)) {
+		co_log__drain();
+
+		uint64_t now = gettime_us(CLOCK_MONOTONIC);
+		if (now >= next_sweep) {
+			co_log__sweep(now, 0);
+			next_sweep = now + interval;
+		}
+
+		co_log__wait(next_sweep > now ? next_sweep - now : 0);
+	}
+
+	co_log__drain();
+	co_log__sweep(gettime_us(CLOCK_MONOTONIC), 1);
+
+	return NULL;
+}
+
+static void co_log__wake(void)
+{
+	if (!co_atomic_load(&co_log__is_sleeping))
+		return;
+
+	pthread_mutex_lock(&co_log__mutex);
+	pthread_cond_signal(&co_log__cond);
+	pthread_mutex_unlock(&co_log__mutex);
+}
+
+int co_log_start(uint32_t window_ms)
+{
+	if (co_log__is_running)
+		return 0;
+
+	co_log__window = (uint64_t)window_ms * 1000;
+	co_log__is_stopping = 0;
+	co_log__n_dropped = 0;
+	memset(co_log__key, 0, sizeof(co_log__key));
+	memset(co_log__last, 0, sizeof(co_log__last));
+
+	if (mpmcq_init(&co_log__free, CO_LOG_RING_LENGTH) < 0)
+		return -1;
+
+	if (mpmcq_init(&co_log__ready, CO_LOG_RING_LENGTH) < 0)
+		goto ready_failure;
+
+	for (int i = 0; i < CO_LOG_RING_LENGTH; ++i)
+		mpmcq_push(&co_log__free, &co_log__record[i]);
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&co_log__cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&co_log__thread, NULL, co_log__main, NULL) != 0)
+		goto thread_failure;
+
+	pthread_setname_np(co_log__thread, "co-log");
+
+	co_atomic_store(&co_log__is_running, 1);
+	return 0;
+
+thread_failure:
+	pthread_cond_destroy(&co_log__cond);
+	mpmcq_destroy(&co_log__ready);
+ready_failure:
+	mpmcq_destroy(&co_log__free);
+	return -1;
+}
+
+void co_log_stop(void)
+{
+	if (!co_log__is_running)
+		return;
+
+	/* Anything that comes after this is logged on the spot */
+	co_atomic_store(&co_log__is_running, 0);
+
+	pthread_mutex_lock(&co_log__mutex);
+	co_atomic_store(&co_log__is_stopping, 1);
+	pthread_cond_signal(&co_log__cond);
+	pthread_mutex_unlock(&co_log__mutex);
+
+	pthread_join(co_log__thread, NULL);
+
+	pthread_cond_destroy(&co_log__cond);
+	mpmcq_destroy(&co_log__ready);
+	mpmcq_destroy(&co_log__free);
+}
+
+int co_log(int level, uint64_t key, const char* fmt, ...)
+{
+	va_list ap;
+
+	if (!co_atomic_load(&co_log__is_running)) {
+		char message[CO_LOG_MESSAGE_MAX];
+
+		va_start(ap, fmt);
+		vsnprintf(message, sizeof(message), fmt, ap);
+		va_end(ap);
+
+		plog(level, "%s", message);
+		return 1;
+	}
+
+	int key_index = -1;
+	unsigned long n_repeats = 0;
+	uint64_t window = 0;
+
+	struct co_log__key* entry = key && co_log__window
+				  ? co_log__find_key(key) : NULL;
+	if (entry) {
+		uint64_t now = gettime_us(CLOCK_MONOTONIC);
+
+		if (!co_log__open_window(entry, now, 0, &n_repeats,
+					 &window)) {
+			__atomic_add_fetch(&entry->n_repeats, 1,
+					   __ATOMIC_SEQ_CST);
+			return 0;
+		}
+
+		key_index = entry - co_log__key;
+	}
+
+	void* ptr;
+	if (mpmcq_pop(&co_log__free, &ptr) < 0) {
+		/* A message of a key is still shown as a repeat */
+		if (entry)
+			__atomic_add_fetch(&entry->n_repeats, n_repeats + 1,
+					   __ATOMIC_SEQ_CST);
+		else
+			__atomic_add_fetch(&co_log__n_dropped, 1,
+					   __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	struct co_log__record* record = ptr;
+	record->level = level;
+	record->key_index = key_index;
+	record->n_repeats = n_repeats;
+	record->window = window;
+
+	va_start(ap, fmt);
+	vsnprintf(record->message, sizeof(record->message), fmt, ap);
+	va_end(ap);
+
+	/* The free list and the ring are the same size */
+	mpmcq_push(&co_log__ready, record);
+	co_log__wake();
+
+	return 1;
+}
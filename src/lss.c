@@ -0,0 +1,358 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <mloop.h>
+
+#include "canopen/lss.h"
+#include "canopen.h"
+#include "sock.h"
+
+/* Older versions of mloop give every timer its own timerfd anyway */
+#ifndef MLOOP_TIMER_PRECISE
+#define MLOOP_TIMER_PRECISE 0
+#endif
+
+#define CO_LSS__CONFIRM_BIT 0x80
+
+static void co_lss__send(struct co_lss* self, struct can_frame* cf)
+{
+	cf->can_id = CO_LSS_MASTER_COB_ID;
+	cf->can_dlc = 8;
+	++self->n_frames;
+	sock_send(&self->sock, cf, 0);
+}
+
+static void co_lss__send_cs(struct co_lss* self, enum co_lss_cs cs,
+			    uint8_t arg)
+{
+	struct can_frame cf;
+	memset(&cf, 0, sizeof(cf));
+	cf.data[0] = cs;
+	cf.data[1] = arg;
+	co_lss__send(self, &cf);
+}
+
+static void co_lss__send_fastscan(struct co_lss* self, uint32_t id_number,
+				  int bit, int sub, int next)
+{
+	struct can_frame cf;
+	memset(&cf, 0, sizeof(cf));
+	cf.data[0] = CO_LSS_CS_FASTSCAN;
+	cf.data[1] = id_number;
+	cf.data[2] = id_number >> 8;
+	cf.data[3] = id_number >> 16;
+	cf.data[4] = id_number >> 24;
+	cf.data[5] = bit;
+	cf.data[6] = sub;
+	cf.data[7] = next;
+	co_lss__send(self, &cf);
+}
+
+/* Sends the request of the current state and waits for the answer */
+static void co_lss__query(struct co_lss* self)
+{
+	switch (self->state) {
+	case CO_LSS_STATE_CONFIRM:
+		co_lss__send_fastscan(self, 0, CO_LSS__CONFIRM_BIT, 0, 0);
+		break;
+	case CO_LSS_STATE_SCAN:
+		co_lss__send_fastscan(self, self->id_number, self->bit,
+				      self->sub, self->sub);
+		break;
+	case CO_LSS_STATE_VERIFY:
+		co_lss__send_fastscan(self, self->id_number, 0, self->sub,
+				      (self->sub + 1) % 4);
+		break;
+	case CO_LSS_STATE_CONFIGURE:
+		co_lss__send_cs(self, CO_LSS_CS_CONFIGURE_NODEID,
+				self->nodeid);
+		break;
+	case CO_LSS_STATE_STORE:
+		co_lss__send_cs(self, CO_LSS_CS_STORE, 0);
+		break;
+	default:
+		abort();
+	}
+
+	mloop_timer_stop(self->timer);
+	mloop_timer_start(self->timer);
+}
+
+static void co_lss__finish(struct co_lss* self, enum co_lss_status status)
+{
+	mloop_timer_stop(self->timer);
+
+	/* No node may be left in the configuration state */
+	co_lss__send_cs(self, CO_LSS_CS_SWITCH_GLOBAL, 0);
+
+	self->state = CO_LSS_STATE_IDLE;
+	self->status = status;
+	self->is_running = 0;
+
+	if (self->on_done)
+		self->on_done(self);
+}
+
+static void co_lss__confirm(struct co_lss* self)
+{
+	self->state = CO_LSS_STATE_CONFIRM;
+	co_lss__query(self);
+}
+
+static void co_lss__scan_part(struct co_lss* self, int sub)
+{
+	self->state = CO_LSS_STATE_SCAN;
+	self->sub = sub;
+	self->bit = 31;
+	self->id_number = 0;
+	co_lss__query(self);
+}
+
+static void co_lss__next_bit(struct co_lss* self)
+{
+	if (self->bit == 0)
+		self->state = CO_LSS_STATE_VERIFY;
+	else
+		--self->bit;
+
+	co_lss__query(self);
+}
+
+/* The node that was found is in the configuration state now */
+static void co_lss__on_found(struct co_lss* self)
+{
+	struct co_lss_identity identity;
+	co_lss_get_identity(self, &identity);
+
+	int nodeid = self->assign_fn ? self->assign_fn(self, &identity) : -1;
+	if (nodeid < CANOPEN_NODEID_MIN || nodeid > CANOPEN_NODEID_MAX) {
+		co_lss__finish(self, CO_LSS_UNKNOWN_IDENTITY);
+		return;
+	}
+
+	self->nodeid = nodeid;
+	self->state = CO_LSS_STATE_CONFIGURE;
+	co_lss__query(self);
+}
+
+static void co_lss__on_assigned(struct co_lss* self)
+{
+	++self->n_assigned;
+	self->n_retries = 0;
+
+	/* The node has a pending node id and stays out of further scans */
+	co_lss__send_cs(self, CO_LSS_CS_SWITCH_GLOBAL, 0);
+	co_lss__confirm(self);
+}
+
+static void co_lss__on_timeout(struct mloop_timer* timer)
+{
+	struct co_lss* self = mloop_timer_get_context(timer);
+
+	switch (self->state) {
+	case CO_LSS_STATE_CONFIRM:
+		/* Every node has a node id */
+		co_lss__finish(self, CO_LSS_OK);
+		break;
+	case CO_LSS_STATE_SCAN:
+		self->id_number |= 1UL << self->bit;
+		co_lss__next_bit(self);
+		break;
+	case CO_LSS_STATE_VERIFY:
+		if (++self->n_retries > CO_LSS_RETRIES_MAX)
+			co_lss__finish(self, CO_LSS_TIMEOUT);
+		else
+			co_lss__confirm(self);
+		break;
+	case CO_LSS_STATE_CONFIGURE:
+	case CO_LSS_STATE_STORE:
+		co_lss__finish(self, CO_LSS_TIMEOUT);
+		break;
+	default:
+		break;
+	}
+}
+
+int co_lss_init(struct co_lss* self, const struct sock* sock)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->timer = mloop_timer_new(mloop_default());
+	if (!self->timer)
+		return -1;
+
+	self->sock = *sock;
+	mloop_timer_set_type(self->timer, MLOOP_TIMER_RELATIVE
+					  | MLOOP_TIMER_PRECISE);
+	mloop_timer_set_context(self->timer, self, NULL);
+	mloop_timer_set_callback(self->timer, co_lss__on_timeout);
+
+	return 0;
+}
+
+void co_lss_destroy(struct co_lss* self)
+{
+	mloop_timer_stop(self->timer);
+	mloop_timer_unref(self->timer);
+}
+
+int co_lss_start(struct co_lss* self, const struct co_lss_info* info)
+{
+	if (self->is_running)
+		return -1;
+
+	mloop_timer_set_time(self->timer, info->timeout * 1000000ULL);
+
+	self->is_running = 1;
+	self->status = CO_LSS_OK;
+	self->is_store = info->is_store;
+	self->assign_fn = info->assign_fn;
+	self->on_done = info->on_done;
+	self->context = info->context;
+	self->n_assigned = 0;
+	self->n_frames = 0;
+	self->n_retries = 0;
+
+	co_lss__confirm(self);
+	return 0;
+}
+
+void co_lss_stop(struct co_lss* self)
+{
+	if (!self->is_running)
+		return;
+
+	co_lss__finish(self, CO_LSS_CANCELLED);
+}
+
+int co_lss_feed(struct co_lss* self, const struct can_frame* cf)
+{
+	if (!self->is_running || cf->can_dlc < 1)
+		return -1;
+
+	uint8_t cs = cf->data[0];
+	uint8_t error = cf->can_dlc > 1 ? cf->data[1] : 0;
+
+	switch (self->state) {
+	case CO_LSS_STATE_CONFIRM:
+		if (cs != CO_LSS_CS_IDENTIFY_SLAVE)
+			return -1;
+
+		co_lss__scan_part(self, 0);
+		break;
+	case CO_LSS_STATE_SCAN:
+		if (cs != CO_LSS_CS_IDENTIFY_SLAVE)
+			return -1;
+
+		co_lss__next_bit(self);
+		break;
+	case CO_LSS_STATE_VERIFY:
+		if (cs != CO_LSS_CS_IDENTIFY_SLAVE)
+			return -1;
+
+		self->part[self->sub] = self->id_number;
+
+		if (self->sub == 3)
+			co_lss__on_found(self);
+		else
+			co_lss__scan_part(self, self->sub + 1);
+		break;
+	case CO_LSS_STATE_CONFIGURE:
+		if (cs != CO_LSS_CS_CONFIGURE_NODEID)
+			return -1;
+
+		if (error != 0) {
+			co_lss__finish(self, CO_LSS_REFUSED);
+		} else if (self->is_store) {
+			self->state = CO_LSS_STATE_STORE;
+			co_lss__query(self);
+		} else {
+			co_lss__on_assigned(self);
+		}
+		break;
+	case CO_LSS_STATE_STORE:
+		if (cs != CO_LSS_CS_STORE)
+			return -1;
+
+		if (error != 0)
+			co_lss__finish(self, CO_LSS_REFUSED);
+		else
+			co_lss__on_assigned(self);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+void co_lss_get_identity(const struct co_lss* self,
+			 struct co_lss_identity* identity)
+{
+	identity->vendor_id = self->part[0];
+	identity->product_code = self->part[1];
+	identity->revision_number = self->part[2];
+	identity->serial_number = self->part[3];
+}
+
+int co_lss_identity_from_string(struct co_lss_identity* identity,
+				const char* str)
+{
+	uint32_t part[4];
+	char* end = (char*)str;
+
+	for (int i = 0; i < 4; ++i) {
+		if (i > 0 && *end++ != ':')
+			return -1;
+
+		const char* start = end;
+		part[i] = strtoul(start, &end, 0);
+		if (end == start)
+			return -1;
+	}
+
+	if (*end != '\0')
+		return -1;
+
+	identity->vendor_id = part[0];
+	identity->product_code = part[1];
+	identity->revision_number = part[2];
+	identity->serial_number = part[3];
+	return 0;
+}
+
+int co_lss_identity_is_equal(const struct co_lss_identity* a,
+			     const struct co_lss_identity* b)
+{
+	return a->vendor_id == b->vendor_id
+	    && a->product_code == b->product_code
+	    && a->revision_number == b->revision_number
+	    && a->serial_number == b->serial_number;
+}
+
+const char* co_lss_status_to_string(enum co_lss_status status)
+{
+	switch (status) {
+	case CO_LSS_OK: return "OK";
+	case CO_LSS_TIMEOUT: return "TIMEOUT";
+	case CO_LSS_REFUSED: return "REFUSED";
+	case CO_LSS_UNKNOWN_IDENTITY: return "UNKNOWN_IDENTITY";
+	case CO_LSS_CANCELLED: return "CANCELLED";
+	}
+
+	return "UNKNOWN";
+}
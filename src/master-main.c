@@ -35,18 +35,24 @@
 size_t strlcpy(char*, const char*, size_t);
 
 const char usage_[] =
-"Usage: canopen-master [options] <interface>\n"
+"Usage: canopen-master [options] <interface> [<interface>...]\n"
 "\n"
 "Options:\n"
 "    -h, --help                Get help.\n"
 "    -W, --worker-threads      Set the number of worker threads (default 4).\n"
 "    -s, --worker-stack-size   Set worker thread stack size.\n"
 "    -j, --job-queue-length    Set length of the job queue (default 256).\n"
+"    -w, --work-stealing       Give each worker thread its own job queue.\n"
+"    -b, --busy-poll           Poll the CAN bus without ever sleeping.\n"
 "    -S, --sdo-queue-length    Set length of the sdo queue (default 1024).\n"
 "    -R, --rest-port           Set TCP port of the rest service (default 9191).\n"
 "    -f, --strict              Force strict communication patterns.\n"
 "    -T, --use-tcp             Interface argument is a TCP service address.\n"
+"    -F, --can-fd              Enable CAN FD frames for PDOs.\n"
+"    -U, --io-uring            Use io_uring for CAN bus I/O.\n"
 "    -n, --range               Set node id range (inclusive) to be managed.\n"
+"    -o, --shard-role          Share the bus with other masters as \"owner\"\n"
+"                              or \"shard\".\n"
 "    -p, --heartbeat-period    Set heartbeat period (default 10000ms).\n"
 "    -P, --heartbeat-timeout   Set heartbeat timeout (default 1000ms).\n"
 "    -x, --ntimeouts-max       Set maximum number of timeouts (default 2).\n"
@@ -67,6 +73,9 @@ const char appbase_usage_[] =
 "    $ canopen-master can0 -i0\n"
 "    $ canopen-master can1 -i1 -R9192\n"
 "    $ canopen-master can0 -n65-127\n"
+"    $ canopen-master can0 -n1-64 -oowner\n"
+"    $ canopen-master can0 -n65-127 -oshard -R9192\n"
+"    $ canopen-master can0 can1 can2 can3\n"
 "\n";
 #endif /* NO_MAREL_CODE */
 
@@ -133,11 +142,16 @@ int main(int argc, char* argv[])
 		{ "worker-threads",    required_argument, 0, 'W' },
 		{ "worker-stack-size", required_argument, 0, 's' },
 		{ "job-queue-length",  required_argument, 0, 'j' },
+		{ "work-stealing",     no_argument,       0, 'w' },
+		{ "busy-poll",         no_argument,       0, 'b' },
 		{ "sdo-queue-length",  required_argument, 0, 'S' },
 		{ "rest-port",         required_argument, 0, 'R' },
 		{ "strict",            no_argument,       0, 'f' },
 		{ "use-tcp",           no_argument,       0, 'T' },
+		{ "can-fd",            no_argument,       0, 'F' },
+		{ "io-uring",          no_argument,       0, 'U' },
 		{ "range",             required_argument, 0, 'n' },
+		{ "shard-role",        required_argument, 0, 'o' },
 		{ "heartbeat-period",  required_argument, 0, 'p' },
 		{ "heartbeat-timeout", required_argument, 0, 'P' },
 		{ "ntimeouts-max",     required_argument, 0, 'x' },
@@ -145,7 +159,7 @@ int main(int argc, char* argv[])
 	};
 
 	while (1) {
-		int c = getopt_long(argc, argv, "W:s:j:S:R:fTn:p:P:x:",
+		int c = getopt_long(argc, argv, "W:s:j:wbS:R:fTFUn:o:p:P:x:",
 				    long_options, NULL);
 		if (c < 0)
 			break;
@@ -156,19 +170,30 @@ int main(int argc, char* argv[])
 			  break;
 		case 'j': cfg.job_queue_length = strtoul(optarg, NULL, 0);
 			  break;
+		case 'w': cfg.use_work_stealing = 1; break;
+		case 'b': cfg.use_busy_poll = 1; break;
 		case 'S': cfg.sdo_queue_length = strtoul(optarg, NULL, 0);
 			  break;
 		case 'p': cfg.heartbeat_period = strtoul(optarg, NULL, 0);
+			  cfg_keep_on_reload(CFG_RELOADABLE_heartbeat_period);
 			  break;
 		case 'P': cfg.heartbeat_timeout = strtoul(optarg, NULL, 0);
+			  cfg_keep_on_reload(CFG_RELOADABLE_heartbeat_timeout);
+			  break;
+		case 'x': cfg.n_timeouts_max = strtoul(optarg, NULL, 0);
+			  cfg_keep_on_reload(CFG_RELOADABLE_n_timeouts_max);
 			  break;
-		case 'x': cfg.n_timeouts_max = strtoul(optarg, NULL, 0); break;
 		case 'R': cfg.rest_port = atoi(optarg); break;
 		case 'f': cfg.be_strict = 1; break;
 		case 'T': cfg.use_tcp = 1; break;
+		case 'F': cfg.use_can_fd = 1; break;
+		case 'U': cfg.use_io_uring = 1; break;
 		case 'n': if (parse_range(optarg) < 0)
 				  return print_usage(stderr, 1);
 			  break;
+		case 'o': strlcpy(cfg.shard_role, optarg,
+				  sizeof(cfg.shard_role));
+			  break;
 		case 'h': return print_usage(stdout, 0);
 		case '?': break;
 		default:  return print_usage(stderr, 1);
@@ -181,9 +206,7 @@ int main(int argc, char* argv[])
 	if (nargs < 1)
 		return print_usage(stderr, 1);
 
-	strlcpy(cfg.iface, args[0], sizeof(cfg.iface));
-
-	int r = co_master_run();
+	int r = co_master_run_buses((const char* const*)args, nargs);
 
 	cfg_unload_file();
 
@@ -21,8 +21,14 @@
 #include <ctype.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <malloc.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/can/raw.h>
 #include "plog.h"
 
 #include "mloop.h"
@@ -33,13 +39,46 @@
 #include "canopen/network.h"
 #include "canopen/nmt.h"
 #include "canopen/heartbeat.h"
+#include "canopen/timestamp.h"
 #include "canopen/emcy.h"
 #include "canopen/eds.h"
 #include "canopen/master.h"
 #include "canopen/sdo_sync.h"
+#include "canopen/byteorder.h"
+#include "canopen/sdo_cache.h"
+#include "canopen/sdo_batch.h"
+#include "canopen/sdo_future.h"
+#include "canopen/timeline.h"
+#include "canopen/identity_cache.h"
+#include "canopen/drv_registry.h"
+#include "canopen/pdo_map.h"
+#include "canopen/process_image.h"
+#include "canopen/sync.h"
+#include "canopen/latency.h"
 #include "canopen/error.h"
 #include "rest.h"
 #include "sdo-rest.h"
+#include "sdo-gateway.h"
+#include "stats-rest.h"
+#include "mloop-rest.h"
+#include "driver-rest.h"
+#include "snapshot-rest.h"
+#include "config-rest.h"
+#include "sync-rest.h"
+#include "bus-rest.h"
+#include "latency-rest.h"
+#include "events-rest.h"
+#include "ws-rest.h"
+#include "metrics-rest.h"
+#include "canopen/stats.h"
+#include "canopen/bus_health.h"
+#include "canopen/log_ring.h"
+#include "canopen/lss.h"
+#include "canopen/dcf.h"
+#include "canopen/bus_load.h"
+#include "canopen/shard.h"
+#include "canopen/handover.h"
+#include "canopen/drv_cycle.h"
 #include "time-utils.h"
 #include "profiling.h"
 #include "string-utils.h"
@@ -47,6 +86,10 @@
 #include "sock.h"
 #include "cfg.h"
 #include "trace-buffer.h"
+#include "trace-stream.h"
+#include "trace-format.h"
+#include "co_atomic.h"
+#include "mpmcq.h"
 
 #ifndef NO_MAREL_CODE
 #include <appcbase.h>
@@ -61,6 +104,31 @@
 #define __unused __attribute__((unused))
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+#define ARRAY_LENGTH(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Older versions of mloop give every timer its own timerfd anyway */
+#ifndef MLOOP_TIMER_PRECISE
+#define MLOOP_TIMER_PRECISE 0
+#endif
+
+/* Maximum number of frames to read from the socket per system call */
+#define MUX_BATCH_SIZE 64
+
+/* Maximum number of frames that can wait for transmission in each priority
+ * class. This must be a power of 2.
+ */
+#define TX_QUEUE_SIZE 256
+
+/* How long to wait before retrying when the interface's queue is full */
+#define TX_RETRY_INTERVAL 1000000LL /* ns */
+
+/* How much of the stack to fault in when memory is locked */
+#define PREFAULT_STACK_SIZE (256 * 1024)
+
+/* A bootup phase ends when no new node has answered for this long */
+#define BOOTUP_QUIET_TIME 100000000LL /* ns */
 
 #define for_each_node(index) \
 	for(index = nodeid_min(); index <= nodeid_max(); ++index)
@@ -75,6 +143,12 @@ static char nodes_seen_[CANOPEN_NODEID_MAX + 1];
 static char nodes_seen_late_[CANOPEN_NODEID_MAX + 1];
 /* Note: nodes_seen_[0] is unused */
 
+/* Nodes that have been asked for their device type by the probe and have not
+ * answered yet. Their drivers are not loaded until they answer or the probe
+ * is over, as the load would otherwise take the answer for one of its own.
+ */
+static char sdo_probe_pending_[CANOPEN_NODEID_MAX + 1];
+
 static unsigned int n_scheduled_bootups = 0;
 static unsigned int n_inhibited_starts = 0;
 
@@ -86,25 +160,228 @@ enum master_state {
 
 static enum master_state master_state_ = MASTER_STATE_STARTUP;
 
+/* The bootup sequence runs on the main loop. All nodes are reset and those
+ * that do not send a bootup message are asked for a heartbeat. Drivers are
+ * loaded as soon as a node answers, so loading overlaps with looking for the
+ * remaining nodes. Nodes are started once every phase is over and the last
+ * driver has been loaded.
+ */
+enum bootup_phase {
+	BOOTUP_PHASE_LSS = 0,
+	BOOTUP_PHASE_RESET,
+	BOOTUP_PHASE_PROBE,
+	BOOTUP_PHASE_LOAD,
+	BOOTUP_PHASE_DONE,
+};
+
+static enum bootup_phase bootup_phase_ = BOOTUP_PHASE_RESET;
+static struct mloop_timer* bootup_timer_ = NULL;
+
+/* Node ids are assigned to the identities in the lss_identity of the nodes */
+static struct co_lss lss_;
+static struct co_lss_identity lss_identity_[CANOPEN_NODEID_MAX + 1];
+static char has_lss_identity_[CANOPEN_NODEID_MAX + 1];
+
+/* Checks the node guarding deadlines of all nodes */
+static struct mloop_timer* guard_timer_ = NULL;
+static struct mloop_timer* sync_timer_ = NULL;
+static unsigned int sync_counter_ = 0;
+
+/* SYNCs sent since start in any case, see co_set_pdo_batch_fn() */
+static unsigned int sync_count_ = 0;
+
+/* SYNC cycles of drivers with a cycle function, see co_set_cycle_fn(). A cycle
+ * begins on the main loop once its SYNC has been sent. Drivers whose inputs
+ * come in during a receive batch are run at the end of it, and those that are
+ * still waiting at the input deadline are run then.
+ */
+static struct mloop_timer* cycle_timer_ = NULL;
+static struct co_drv* cycle_ready_[CANOPEN_NODEID_MAX + 1];
+static size_t cycle_n_ready_ = 0;
+static size_t cycle_n_pending_ = 0;
+static int cycle_begin_is_scheduled_ = 0;
+
+static struct co_emcy_limit_config emcy_limit_config_;
+static struct mloop_timer* time_timer_ = NULL;
+static uint64_t time_next_us_ = 0;
+static struct mloop_timer* master_heartbeat_timer_ = NULL;
+
+#ifndef CO_MASTER_BUSES_MAX
+#define CO_MASTER_BUSES_MAX 16
+#endif
+
 static void* driver_manager_;
 pthread_mutex_t driver_manager_lock_ = PTHREAD_MUTEX_INITIALIZER;
 
 static struct mloop* mloop_ = NULL;
 static struct mloop_socket* mux_handler_ = NULL;
+static struct mloop_idle* mux_poller_ = NULL;
+
+/* With shard_role set, several masters share the bus, see canopen/shard.h.
+ * The owner reads the bus for all of them and is the only one to send SYNC,
+ * TIME and broadcast NMT.
+ */
+enum shard_role {
+	SHARD_ROLE_NONE = 0,
+	SHARD_ROLE_OWNER,
+	SHARD_ROLE_SHARD,
+};
+
+static enum shard_role shard_role_ = SHARD_ROLE_NONE;
+static struct co_shard_owner* shard_owner_ = NULL;
+static struct co_shard_client* shard_client_ = NULL;
+static struct mloop_socket* shard_handler_ = NULL;
+
+/* With enable_handover set, a new master takes the sockets and the node table
+ * over from a running one instead of booting the network up again, see
+ * canopen/handover.h.
+ */
+enum handover_fd {
+	HANDOVER_FD_BUS = 0,
+	HANDOVER_FD_REST,
+	HANDOVER_FD_LISTEN,
+	HANDOVER_FD_GATEWAY, /* only if the SDO gateway is running */
+	HANDOVER_FD_COUNT,
+};
+
+static int handover_fd_[HANDOVER_FD_COUNT] = { -1, -1, -1, -1 };
+static struct mloop_socket* handover_handler_ = NULL;
+static struct co_handover_state handover_;
+static int is_warm_start_ = 0;
+static int is_handed_over_ = 0;
+static const struct co_handover_node* handover_node_[CANOPEN_NODEID_MAX + 1];
+static char is_warm_node_[CANOPEN_NODEID_MAX + 1];
 
 static struct tracebuffer tracebuffer_;
 
+static uint64_t n_heartbeat_timeouts_ = 0;
+static uint64_t n_nodes_lost_ = 0;
+static enum trace_format trace_dump_format_ = TRACE_FORMAT_RAW;
+
+typedef int (*mux_frame_fn)(struct co_master_node*,
+			    const struct canfd_frame*);
+
+struct mux_entry {
+	mux_frame_fn fn;
+	struct co_master_node* node;
+
+	/* Index into the PDO table of the node for handle_new_tpdo() */
+	unsigned int pdo;
+};
+
+/* Frame handlers indexed by 11-bit COB-ID */
+static struct mux_entry mux_table_[CAN_SFF_MASK + 1];
+
+/* Time of arrival of the frame that is currently being dispatched */
+static uint64_t mux_timestamp_ = 0;
+
+/* CLOCK_MONOTONIC in microseconds when the current batch was received */
+static uint64_t mux_now_ = 0;
+
+/* For callbacks on the main loop that need the time no more precisely than
+ * when the loop woke up. The clock is read when there is no loop.
+ */
+static inline uint64_t loop_now_us(void)
+{
+#ifdef mloop_now
+	struct mloop* loop = mloop_default();
+	if (loop)
+		return mloop_now(loop) / 1000ULL;
+#endif
+	return gettime_us(CLOCK_MONOTONIC);
+}
+
+/* The PDO table index of the mux entry that is currently being dispatched */
+static unsigned int mux_pdo_ = 0;
+
+/* Frames are sent in order of class, so process data is never held up by
+ * bulk SDO transfers.
+ */
+enum tx_class {
+	TX_CLASS_NMT = 0, /* NMT, SYNC and anything else not listed below */
+	TX_CLASS_PDO,
+	TX_CLASS_SDO,
+	TX_CLASS_COUNT
+};
+
+struct tx_queue {
+	struct canfd_frame frame[TX_QUEUE_SIZE];
+	size_t head;
+	size_t length;
+};
+
+static struct tx_queue tx_queue_[TX_CLASS_COUNT];
+static uint64_t tx_n_dropped_ = 0;
+static int tx_flush_is_scheduled_ = 0;
+static int tx_is_blocked_ = 0;
+static struct mloop_socket* tx_writable_ = NULL;
+static struct mloop_timer* tx_retry_timer_ = NULL;
+static struct mloop_timer* tx_throttle_timer_ = NULL;
+static pthread_mutex_t tx_stage_lock_ = PTHREAD_MUTEX_INITIALIZER;
+
+/* While the bus is error passive, SDO frames are sent at no more than
+ * bus_degraded_sdo_rate per second. This is the time up to which the rate has
+ * been used up, in microseconds on CLOCK_MONOTONIC.
+ */
+static uint64_t tx_sdo_credit_time_ = 0;
+
+/* Bits on the wire of the frames that are received and sent. While the load
+ * is at or above sdo_bus_budget, background SDO requests are held back.
+ */
+#define BUS_LOAD_INTERVAL 100 /* ms */
+static struct co_bus_load bus_load_;
+static struct mloop_timer* bus_load_timer_ = NULL;
+
+/* RPDOs sent from threads other than the main loop, see tx_pdo_post(). Each
+ * COB-ID has a slot with the latest payload, guarded by a sequence number that
+ * is odd while the slot is being written. A COB-ID is queued for the main loop
+ * when its slot becomes pending, so a thread that sends faster than the main
+ * loop drains only replaces the payload.
+ */
+struct tx_pdo_slot {
+	unsigned long sequence;
+	int is_pending;
+	struct canfd_frame frame;
+};
+
+static struct tx_pdo_slot tx_pdo_slot_[CAN_SFF_MASK + 1];
+static struct mpmcq tx_pdo_queue_;
+static int tx_pdo_drain_is_scheduled_ = 0;
+static pthread_t tx_loop_thread_;
+
+/* RPDOs waiting for the next SYNC, indexed by COB-ID */
+static struct canfd_frame pdo_image_[CAN_SFF_MASK + 1];
+static uint8_t pdo_image_is_staged_[CAN_SFF_MASK + 1];
+static uint16_t pdo_image_order_[CAN_SFF_MASK + 1];
+static size_t pdo_image_length_ = 0;
+static int pdo_image_is_active_ = 0;
+
+/* Largest PDO payload; raised to CANFD_MAX_DLEN if CAN FD is enabled */
+static size_t pdo_size_max_ = CAN_MAX_DLEN;
+
 static void* master_iface_init(int nodeid);
 static int master_request_sdo(int nodeid, int index, int subindex);
 static int master_send_sdo(int nodeid, int index, int subindex,
 			   unsigned char* data, size_t size);
 static int master_send_pdo(int nodeid, int n, unsigned char* data, size_t size);
 static void unload_legacy_module(int device_type, void* driver);
-static void on_bootup_done(struct mloop_work* self);
-static int init_heartbeat_timer(struct co_master_node* node);
-static int init_ping_timer(struct co_master_node* node);
+static void flush_legacy_pdos(void);
+static void queue_pdo_batch(struct co_master_node* node, int n,
+			    const struct canfd_frame* cf);
+static void process_image_write(enum co_pi_direction direction,
+				const struct canfd_frame* cf, uint64_t timestamp);
+static void check_bootup_done(void);
+static void mux_table_update(int nodeid);
+static int update_filters(void);
+static void load_sdo_channels(int nodeid);
+static void load_tpdo_on_change(int nodeid);
+static void clear_sdo_channels(int nodeid);
+static int schedule_load_driver(int nodeid);
+static int init_directory(const char* path);
+static int start_warm_bootup(void);
 
 struct co_master_node co_master_node_[CANOPEN_NODEID_MAX + 1];
+struct co_master_node_ident co_master_node_ident_[CANOPEN_NODEID_MAX + 1];
 /* Note: node_[0] is unused */
 
 static inline int nodeid_min(void)
@@ -144,1409 +421,5333 @@ static inline uint32_t get_revision_number(int nodeid)
 
 static inline int set_heartbeat_period(int nodeid, uint16_t period)
 {
-	struct sdo_req_info info = { .index = 0x1017, .subindex = 0 };
+	struct sdo_req_info info = {
+		.priority = SDO_REQ_PRIO_CONFIG,
+		.index = 0x1017,
+		.subindex = 0
+	};
 	return sdo_sync_write_u16(nodeid, &info, period);
 }
 
-static char* get_string(int nodeid, int index, int subindex)
+/* Nodes watch the heartbeat of the master if master_nodeid and
+ * master_heartbeat_period are set, also on shards where the owner produces
+ * it
+ */
+static inline int is_master_heartbeat_watched(int nodeid)
 {
-	static __thread char buffer[256];
-
-	struct sdo_req* req = sdo_sync_read(nodeid, index, subindex);
-	if (!req)
-		return NULL;
-
-	memcpy(buffer, req->data.data, MIN(req->data.index, sizeof(buffer)));
-	buffer[MIN(req->data.index, sizeof(buffer) - 1)] = '\0';
-
-	sdo_req_unref(req);
-	return buffer;
+	return cfg.master_nodeid && cfg.master_heartbeat_period
+	    && cfg.node[nodeid].watch_master_heartbeat;
 }
 
-static void stop_heartbeat_timer(int nodeid)
+/* The first entry of the consumer heartbeat time is used for the master. An
+ * entry that is in use must be cleared before it can be changed.
+ */
+static int set_consumer_heartbeat(int nodeid)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = node->heartbeat_timer;
-	mloop_timer_stop(timer);
-	mloop_timer_unref(timer);
-	node->heartbeat_timer = NULL;
-}
+	struct sdo_req_info info = {
+		.priority = SDO_REQ_PRIO_CONFIG,
+		.index = 0x1016,
+		.subindex = 1
+	};
 
-static void stop_ping_timer(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = node->ping_timer;
-	mloop_timer_stop(timer);
-	mloop_timer_unref(timer);
-	node->ping_timer = NULL;
+	uint64_t time = cfg.master_heartbeat_period
+		      + cfg.node[nodeid].heartbeat_timeout;
+	if (time > UINT16_MAX)
+		time = UINT16_MAX;
+
+	if (sdo_sync_write_u32(nodeid, &info, 0) < 0)
+		return -1;
+
+	return sdo_sync_write_u32(nodeid, &info,
+				  (cfg.master_nodeid & 0x7f) << 16 | time);
 }
 
-#ifndef NO_MAREL_CODE
-static void unload_legacy_driver(int nodeid)
+void co_master_get_stats(struct co_master_stats* dst)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
+	dst->n_heartbeat_timeouts = n_heartbeat_timeouts_;
+	dst->n_nodes_lost = n_nodes_lost_;
+	dst->n_tx_dropped = co_atomic_load(&tx_n_dropped_);
 
-	unload_legacy_module(node->device_type, node->driver);
+	dst->tx_queue_length = 0;
+	for (int i = 0; i < TX_CLASS_COUNT; ++i)
+		dst->tx_queue_length += co_atomic_load(&tx_queue_[i].length);
 
-	legacy_master_iface_delete(node->master_iface);
+	dst->n_trace_frames = co_atomic_load(&tracebuffer_.head);
+	dst->trace_length = tracebuffer_.slots ? tracebuffer_.length : 0;
 
-	node->driver = NULL;
-	node->master_iface = NULL;
+	dst->bus_load = co_bus_load_get(&bus_load_);
+	dst->is_sdo_held = sdo_req_queues_is_held();
 }
-#endif /* NO_MAREL_CODE */
 
-/* This is an expediated fire-and-forget SDO message to tell buggy Marel
- * CANopen nodes that don't have a driver to shut up.
- *
- * The sdo_req interface is not used for this because we're not interested in
- * the response and it would require more complicated code.
- */
-static void turn_off_heartbeat(int nodeid)
+const struct canopen_eds* co_master_find_eds(int nodeid)
 {
-	struct can_frame cf = { .can_id = R_RSDO + nodeid };
-	sdo_set_cs(&cf, SDO_CCS_DL_INIT_REQ);
-	sdo_set_index(&cf, 0x1017);
-	sdo_set_subindex(&cf, 0);
-	sdo_indicate_size(&cf);
-	sdo_expediate(&cf);
-	sdo_set_expediated_size(&cf, sizeof(uint16_t));
-	cf.can_dlc = SDO_EXPEDIATED_DATA_IDX + sizeof(uint16_t);
-	sock_send(&socket_, &cf, 0);
-}
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
 
-static void stop_node_guarding(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
+	const struct canopen_eds* eds;
 
-	if (!cfg.node[nodeid].enable_node_guarding)
-		return;
+	if (ident->vendor_id == 0)
+		return eds_db_find_by_name(ident->name);
 
-	stop_heartbeat_timer(nodeid);
+	eds = eds_db_find(ident->vendor_id, ident->product_code,
+			  ident->revision_number);
+	if (eds)
+		return eds;
 
-	if (!node->is_heartbeat_supported)
-		stop_ping_timer(nodeid);
+	return eds_db_find(ident->vendor_id, ident->product_code, -1);
 }
 
-static void unload_driver(int nodeid)
+static char* get_string(int nodeid, int index, int subindex)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-
-	node->is_initialized = 0;
+	static __thread char buffer[256];
 
-	stop_node_guarding(nodeid);
+	ssize_t size = sdo_cache_get(nodeid, index, subindex, buffer,
+				     sizeof(buffer) - 1, NULL);
+	if (size >= 0) {
+		buffer[MIN((size_t)size, sizeof(buffer) - 1)] = '\0';
+		return buffer;
+	}
 
-	sdo_req_queue_flush(sdo_req_queue_get(nodeid));
+	struct sdo_req* req = sdo_sync_read(nodeid, index, subindex);
+	if (!req)
+		return NULL;
 
-	switch (node->driver_type) {
-#ifndef NO_MAREL_CODE
-	case CO_MASTER_DRIVER_LEGACY:
-		unload_legacy_driver(nodeid);
-		break;
-#endif /* NO_MAREL_CODE */
-	case CO_MASTER_DRIVER_NEW:
-		co_drv_unload(&node->ndrv);
-		break;
-	case CO_MASTER_DRIVER_NONE:
-	default:
-		abort();
-		break;
-	}
+	const void* data = req->data.data;
+	size_t length = req->data.index;
 
-	node->device_type = 0;
-	node->is_heartbeat_supported = 0;
-	node->driver_type = CO_MASTER_DRIVER_NONE;
+	const struct canopen_eds* eds = co_master_find_eds(nodeid);
+	if (eds && sdo_cache_is_cacheable(eds_obj_find(eds, index, subindex)))
+		sdo_cache_put(nodeid, index, subindex, data, length,
+			      req->is_size_indicated);
 
-	if (master_state_ == MASTER_STATE_STOPPING)
-		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
+	memcpy(buffer, data, MIN(length, sizeof(buffer)));
+	buffer[MIN(length, sizeof(buffer) - 1)] = '\0';
 
-#ifndef NO_MAREL_CODE
-	struct canopen_info* info = canopen_info_get(nodeid);
-	info->is_active = 0;
-#endif /* NO_MAREL_CODE */
+	sdo_req_unref(req);
+	return buffer;
 }
 
-static char* compose_trace_name(char* dst, size_t size)
-{
-	struct tm tm;
-	time_t t = time(NULL);
+static void on_tx_writable(struct mloop_socket* self);
+static void on_tx_retry(struct mloop_timer* self);
+static void on_tx_throttle(struct mloop_timer* self);
 
-	localtime_r(&t, &tm);
-	int rc = strftime(dst, size, "%y%m%d-%H%M%S", &tm);
-	assert(rc >= 0);
+static enum tx_class tx_class_of(uint32_t can_id)
+{
+	switch (can_id & CAN_SFF_MASK & ~0x7f) {
+	case R_RPDO1:
+	case R_RPDO2:
+	case R_RPDO3:
+	case R_RPDO4:
+		return TX_CLASS_PDO;
+	case R_RSDO:
+		return TX_CLASS_SDO;
+	}
 
-	return dst;
+	return TX_CLASS_NMT;
 }
 
-static void compose_trace_buffer_path(char* path, size_t size, const char* name)
+/* Wait for the socket to become writable if the socket buffer is full, or
+ * poll with a timer if the interface's queue is full; the latter does not
+ * generate any event.
+ */
+static int tx_wait_nolock(int error)
 {
-	char ts[32];
+	if (error == ENOBUFS) {
+		if (!tx_retry_timer_) {
+			tx_retry_timer_ = mloop_timer_new(mloop_default());
+			if (!tx_retry_timer_)
+				return -1;
+
+			mloop_timer_set_type(tx_retry_timer_,
+					     MLOOP_TIMER_RELATIVE);
+			mloop_timer_set_time(tx_retry_timer_,
+					     TX_RETRY_INTERVAL);
+			mloop_timer_set_callback(tx_retry_timer_, on_tx_retry);
+		}
 
-	if (!name)
-		name = compose_trace_name(ts, sizeof(ts));
+		return mloop_timer_start(tx_retry_timer_);
+	}
 
-	snprintf(path, size, "%s/%s.trace", cfg.trace_dump_path, name);
-	path[size - 1] = '\0';
+	if (!tx_writable_) {
+		tx_writable_ = mloop_socket_new(mloop_default());
+		if (!tx_writable_)
+			return -1;
+
+		/* The receiver has the socket in the same epoll set */
+		mloop_socket_set_fd(tx_writable_, dup(socket_.fd));
+		mloop_socket_set_event(tx_writable_, MLOOP_SOCKET_EVENT_OUT);
+		mloop_socket_set_callback(tx_writable_, on_tx_writable);
+	}
+
+	return mloop_socket_start(tx_writable_);
 }
 
-static void do_dump_tracebuffer(struct mloop_work* work)
+/* Sends up to max frames of the queue, as many as the socket takes, and
+ * returns 0 if they have all been sent, or the error that stopped it
+ * otherwise.
+ */
+static int tx_send_queue_nolock(struct tx_queue* queue, size_t max)
 {
-	assert(cfg.trace_buffer_size > 0);
+	size_t total = 0;
 
-	const char* name = mloop_work_get_context(work);
+	while (queue->length > 0 && total < max) {
+		size_t n = MIN(queue->length, TX_QUEUE_SIZE - queue->head);
+		n = MIN(n, max - total);
 
-	char path[256];
-	compose_trace_buffer_path(path, sizeof(path), name);
+		/* Taken before sending so that no reply can be older */
+		uint64_t now = gettime_us(CLOCK_REALTIME);
 
-	FILE* stream = fopen(path, "w");
-	if (!stream)
-		return;
+		ssize_t rc = sock_send_fd_batch(&socket_,
+						&queue->frame[queue->head], n,
+						MSG_DONTWAIT);
+		size_t sent = rc > 0 ? rc : 0;
+		int error = errno;
 
-	tb_dump(&tracebuffer_, stream);
+		for (size_t i = 0; i < sent; ++i) {
+			const struct canfd_frame* cf =
+				&queue->frame[queue->head + i];
 
-	fclose(stream);
-}
+			co_stats_count_tx(cf->can_id, now);
+			co_bus_load_count(&bus_load_, cf);
 
-static void dump_tracebuffer(const char* name)
-{
-	if (cfg.trace_buffer_size == 0)
-		return;
+			if (co_latency_is_enabled())
+				co_latency_on_tx(cf->can_id & CAN_SFF_MASK,
+						 cf->data, cf->len, now);
+		}
 
-	struct mloop_work* work = mloop_work_new(mloop_default());
-	if (!work)
-		return;
+		queue->head = (queue->head + sent) & (TX_QUEUE_SIZE - 1);
+		queue->length -= sent;
+		total += sent;
 
-	if (name) {
-		char* str = strdup(name);
-		if (str)
-			mloop_work_set_context(work, str, free);
+		if (sent != n)
+			return error ? error : EAGAIN;
 	}
 
-	mloop_work_set_work_fn(work, do_dump_tracebuffer);
-	mloop_work_start(work);
-	mloop_work_unref(work);
+	return 0;
 }
 
-static void on_heartbeat_timeout(struct mloop_timer* timer)
+/* Returns -1 if the socket can't take any more frames at the moment.
+ *
+ * A failing socket would fail every frame in the queue, so a frame is only
+ * logged if its error differs from the one before it. The rest are counted
+ * as dropped and summed up at the end.
+ */
+static int tx_flush_queue_nolock(struct tx_queue* queue, size_t max)
 {
-	struct co_master_node* node = mloop_timer_get_context(timer);
-	int nodeid = co_master_get_node_id(node);
+	int error, last_error = 0, rc = 0;
+	size_t n_quiet = 0;
 
-	node->ntimeouts++;
+	while ((error = tx_send_queue_nolock(queue, max)) != 0) {
+		int is_full = error == EAGAIN || error == EWOULDBLOCK
+			   || error == ENOBUFS;
 
-#ifndef NO_MAREL_CODE
-	struct canopen_info* info = canopen_info_get(nodeid);
-	info->skipped_heartbeats++;
-#endif /* NO_MAREL_CODE */
+		if (is_full && tx_wait_nolock(error) == 0) {
+			tx_is_blocked_ = 1;
+			rc = -1;
+			break;
+		}
 
-	plog(LOG_DEBUG, "Node \"%s\" with id %d has missed %u heartbeats",
-	     node->name, nodeid, node->ntimeouts);
+		if (error != last_error)
+			plog(LOG_WARNING, "Failed to send frame with COB-ID %#x: %s",
+			     queue->frame[queue->head].can_id,
+			     strerror(error));
+		else
+			++n_quiet;
 
-	if (node->ntimeouts <= cfg.node[nodeid].n_timeouts_max)
-		return;
+		last_error = error;
+		co_atomic_add_fetch(&tx_n_dropped_, 1);
 
-	plog(LOG_NOTICE, "Node \"%s\" with id %d has timed out; unloading...",
-	     node->name, nodeid);
+		/* Skip the frame that could not be sent */
+		queue->head = (queue->head + 1) & (TX_QUEUE_SIZE - 1);
+		queue->length -= 1;
+	}
 
-	if (cfg.enable_incident_trace)
-		dump_tracebuffer(NULL);
+	if (n_quiet > 0)
+		plog(LOG_WARNING, "Failed to send %zu more frames", n_quiet);
 
-	co_net_send_nmt(&socket_, NMT_CS_RESET_NODE, nodeid);
-	unload_driver(co_master_get_node_id(node));
+	return rc;
 }
 
-static struct mloop_timer* get_heartbeat_timer(struct co_master_node* node)
+static int tx_start_throttle_timer_nolock(uint64_t delay)
 {
-	if (!node->heartbeat_timer)
-		init_heartbeat_timer(node);
+	if (!tx_throttle_timer_) {
+		tx_throttle_timer_ = mloop_timer_new(mloop_default());
+		if (!tx_throttle_timer_)
+			return -1;
 
-	return node->heartbeat_timer;
-}
+		mloop_timer_set_type(tx_throttle_timer_, MLOOP_TIMER_RELATIVE);
+		mloop_timer_set_callback(tx_throttle_timer_, on_tx_throttle);
+	}
 
-static struct mloop_timer* get_ping_timer(struct co_master_node* node)
-{
-	if (!node->ping_timer)
-		init_ping_timer(node);
+	if (mloop_timer_is_started(tx_throttle_timer_))
+		return 0;
 
-	return node->ping_timer;
+	mloop_timer_set_time(tx_throttle_timer_, delay * 1000ULL);
+	return mloop_timer_start(tx_throttle_timer_);
 }
 
-static int start_heartbeat_timer(int nodeid)
+/* The number of SDO frames that may be sent now. A burst of up to 100 ms
+ * worth of frames is allowed.
+ */
+static size_t tx_sdo_budget_nolock(uint64_t now)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = get_heartbeat_timer(node);
-	node->ntimeouts = 0;
-	return mloop_timer_start(timer);
-}
+	uint64_t rate = cfg.bus_degraded_sdo_rate;
 
-static int restart_heartbeat_timer(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = node->heartbeat_timer;
-	assert(timer);
+	if (rate == 0 || !co_bus_is_degraded(co_bus_health_get_state(
+				gettime_us(CLOCK_REALTIME))))
+		return SIZE_MAX;
 
-	if (!cfg.node[nodeid].enable_node_guarding)
+	uint64_t burst = MAX(rate / 10, 1);
+	uint64_t period = 1000000ULL / rate;
+
+	if (now < tx_sdo_credit_time_)
 		return 0;
 
-	mloop_timer_stop(timer);
+	if (tx_sdo_credit_time_ == 0 || now - tx_sdo_credit_time_ > burst * period)
+		tx_sdo_credit_time_ = now - burst * period;
 
-	return mloop_timer_start(timer);
+	return (now - tx_sdo_credit_time_) / MAX(period, 1);
 }
 
-static void on_ping_timeout(struct mloop_timer* timer)
+static int tx_flush_sdo_nolock(struct tx_queue* queue)
 {
-	struct co_master_node* node = mloop_timer_get_context(timer);
-	int nodeid = co_master_get_node_id(node);
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
 
-	struct can_frame cf = { 0 };
+	size_t budget = tx_sdo_budget_nolock(now);
+	if (budget == SIZE_MAX)
+		return tx_flush_queue_nolock(queue, SIZE_MAX);
 
-	cf.can_id = R_HEARTBEAT + nodeid;
-	cf.can_id |= CAN_RTR_FLAG;
-	cf.can_dlc = 1;
-	heartbeat_set_state(&cf, 1);
+	size_t length = queue->length;
+	int rc = tx_flush_queue_nolock(queue, budget);
 
-	sock_send(&socket_, &cf, 0);
-}
+	uint64_t period = MAX(1000000ULL / cfg.bus_degraded_sdo_rate, 1);
+	tx_sdo_credit_time_ += (length - queue->length) * period;
 
-static int start_ping_timer(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = get_ping_timer(node);
-	return mloop_timer_start(timer);
+	if (queue->length > 0
+	 && tx_start_throttle_timer_nolock(MAX(period, 1000)) < 0)
+		return tx_flush_queue_nolock(queue, SIZE_MAX);
+
+	return rc;
 }
 
-static void start_nodeguarding(int nodeid)
+static void tx_flush_nolock(void)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-
-	if (!cfg.node[nodeid].enable_node_guarding)
+	if (tx_is_blocked_)
 		return;
 
-	if (!node->is_heartbeat_supported)
-		start_ping_timer(nodeid);
-
-	start_heartbeat_timer(nodeid);
+	for (int i = 0; i < TX_CLASS_COUNT; ++i) {
+		int rc = i == TX_CLASS_SDO
+		       ? tx_flush_sdo_nolock(&tx_queue_[i])
+		       : tx_flush_queue_nolock(&tx_queue_[i], SIZE_MAX);
+		if (rc < 0)
+			return;
+	}
 }
 
-#ifndef NO_MAREL_CODE
-static void* load_legacy_module(const char* name, int device_type,
-				void* master_iface)
+static void tx_flush(void)
 {
-	void* driver = NULL;
-	pthread_mutex_lock(&driver_manager_lock_);
-	int rc = legacy_driver_manager_create_handler(driver_manager_, name,
-						      device_type, master_iface,
-						      &driver);
-	pthread_mutex_unlock(&driver_manager_lock_);
-	return rc >= 0 ? driver : NULL;
+	pthread_mutex_lock(&tx_stage_lock_);
+	tx_flush_nolock();
+	pthread_mutex_unlock(&tx_stage_lock_);
 }
 
-static void unload_legacy_module(int device_type, void* driver)
+static void tx_unblock(void)
 {
-	pthread_mutex_lock(&driver_manager_lock_);
-	legacy_driver_delete_handler(driver_manager_, device_type, driver);
-	pthread_mutex_unlock(&driver_manager_lock_);
+	pthread_mutex_lock(&tx_stage_lock_);
+	tx_is_blocked_ = 0;
+	tx_flush_nolock();
+	pthread_mutex_unlock(&tx_stage_lock_);
 }
-#endif /* NO_MAREL_CODE */
 
-static int load_profile_driver(int nodeid)
+static void on_tx_writable(struct mloop_socket* self)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-
-	char buffer[256];
-	unsigned int profile = co_master_get_device_profile(node);
-	snprintf(buffer, sizeof(buffer), "cia%u", profile);
-	buffer[sizeof(buffer) - 1] = '\0';
-
-	return co_drv_load(&node->ndrv, buffer);
+	mloop_socket_stop(self);
+	tx_unblock();
 }
 
-static int load_new_driver(int nodeid)
+static void on_tx_retry(struct mloop_timer* self)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
+	(void)self;
+	tx_unblock();
+}
 
-	if (co_drv_load(&node->ndrv, node->name) < 0)
-		if (load_profile_driver(nodeid) < 0)
-			return -1;
+static void on_tx_throttle(struct mloop_timer* self)
+{
+	(void)self;
+	tx_flush();
+}
 
-	node->driver_type = CO_MASTER_DRIVER_NEW;
+static void on_tx_flush(struct mloop_async* self)
+{
+	(void)self;
 
-	return 0;
+	pthread_mutex_lock(&tx_stage_lock_);
+	tx_flush_is_scheduled_ = 0;
+	tx_flush_nolock();
+	pthread_mutex_unlock(&tx_stage_lock_);
 }
 
-#ifndef NO_MAREL_CODE
-static int load_legacy_driver(int nodeid)
+static int tx_schedule_flush_nolock(void)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
+	if (tx_flush_is_scheduled_ || tx_is_blocked_)
+		return 0;
 
-	void* master_iface = master_iface_init(nodeid);
-	if (!master_iface)
+	struct mloop_async* async = mloop_async_new(mloop_default());
+	if (!async)
 		return -1;
 
-	void* driver = load_legacy_module(node->name, node->device_type,
-					  master_iface);
-	if (!driver)
-		goto failure;
+	mloop_async_set_callback(async, on_tx_flush);
 
-	node->driver_type = CO_MASTER_DRIVER_LEGACY;
-	node->driver = driver;
-	node->master_iface = master_iface;
+	int rc = mloop_async_start(async);
+	mloop_async_unref(async);
 
-	return 0;
+	if (rc >= 0)
+		tx_flush_is_scheduled_ = 1;
 
-failure:
-	legacy_master_iface_delete(master_iface);
-	node->master_iface = NULL;
-	return -1;
+	return rc;
 }
-#endif /* NO_MAREL_CODE */
 
-static int is_nodename_char(int c)
+static void tx_cleanup(void)
 {
-	return isalnum(c) || c == '-' || c == '_';
-}
+	if (tx_writable_) {
+		mloop_socket_stop(tx_writable_);
+		mloop_socket_unref(tx_writable_);
+		tx_writable_ = NULL;
+	}
 
-#ifndef NO_MAREL_CODE
-static void initialize_info_structure(int nodeid)
-{
-	struct canopen_info* info = canopen_info_get(nodeid);
-	struct co_master_node* node = co_master_get_node(nodeid);
+	if (tx_retry_timer_) {
+		mloop_timer_stop(tx_retry_timer_);
+		mloop_timer_unref(tx_retry_timer_);
+		tx_retry_timer_ = NULL;
+	}
 
-	info->device_type = node->device_type;
-	strlcpy(info->name, node->name, sizeof(info->name));
-	strlcpy(info->hw_version, node->hw_version, sizeof(info->hw_version));
-	strlcpy(info->sw_version, node->sw_version, sizeof(info->sw_version));
+	if (tx_throttle_timer_) {
+		mloop_timer_stop(tx_throttle_timer_);
+		mloop_timer_unref(tx_throttle_timer_);
+		tx_throttle_timer_ = NULL;
+	}
 }
 
-static void load_error_register(int nodeid)
+/* Frames staged here are queued by priority class and sent at the end of the
+ * current main loop iteration, or as soon as the socket can take them if it
+ * is full.
+ */
+static int tx_push_nolock(struct tx_queue* queue, const struct canfd_frame* cf)
 {
-	struct canopen_info* info = canopen_info_get(nodeid);
+	if (queue->length >= TX_QUEUE_SIZE)
+		tx_flush_nolock();
 
-	errno = 0;
-	info->error_register = sdo_sync_read_u8(nodeid, 0x1001, 0);
-	if (info->error_register == 0 && errno != 0) {
-		plog(LOG_WARNING, "load_driver: Could not get/convert error register for node %d",
-		     nodeid);
+	if (queue->length >= TX_QUEUE_SIZE) {
+		plog(LOG_WARNING, "TX queue is full; dropping frame with COB-ID %#x",
+		     cf->can_id);
+		co_atomic_add_fetch(&tx_n_dropped_, 1);
+		return -1;
 	}
-}
-#endif /* NO_MAREL_CODE */
 
-static const char* driver_type_str(enum co_master_driver_type type)
-{
-	switch (type) {
-	case CO_MASTER_DRIVER_NONE: return "none";
-	case CO_MASTER_DRIVER_NEW: return "driver";
-	case CO_MASTER_DRIVER_LEGACY: return "legacy driver";
+	size_t tail = (queue->head + queue->length++) & (TX_QUEUE_SIZE - 1);
+	queue->frame[tail] = *cf;
+
+	if (tx_schedule_flush_nolock() < 0) {
+		tx_flush_nolock();
+		return -1;
 	}
 
-	return "UNKNOWN";
+	return 0;
 }
 
-static void apply_quirks(struct co_master_node* node)
+static int tx_stage_fd(const struct canfd_frame* cf)
 {
-	int nodeid = co_master_get_node_id(node);
-
-	struct sdo_req_queue* sdo_queue = sdo_req_queue_get(nodeid);
-	struct sdo_async* sdo_client = &sdo_queue->sdo_client;
-
-	if (cfg.node[nodeid].ignore_sdo_multiplexer)
-		sdo_client->quirks |= SDO_ASYNC_QUIRK_IGNORE_MULTIPLEXER;
-	else
-		sdo_client->quirks &= ~SDO_ASYNC_QUIRK_IGNORE_MULTIPLEXER;
-
-	if (cfg.node[nodeid].send_full_sdo_frame)
-		sdo_client->quirks |= SDO_ASYNC_QUIRK_NEEDS_FULL_FRAME;
-	else
-		sdo_client->quirks &= ~SDO_ASYNC_QUIRK_NEEDS_FULL_FRAME;
-
+	pthread_mutex_lock(&tx_stage_lock_);
+	int rc = tx_push_nolock(&tx_queue_[tx_class_of(cf->can_id)], cf);
+	pthread_mutex_unlock(&tx_stage_lock_);
 
+	return rc;
 }
 
-static int load_any_driver(int nodeid)
+static int tx_stage(const struct can_frame* cf)
 {
-	if (load_new_driver(nodeid) >= 0)
-		return 0;
-
-#ifndef NO_MAREL_CODE
-	if (load_legacy_driver(nodeid) >= 0)
-		return 0;
-#endif /* NO_MAREL_CODE */
-
-	return -1;
+	struct canfd_frame cfd;
+	memcpy(&cfd, cf, sizeof(*cf));
+	cfd.flags = 0;
+	return tx_stage_fd(&cfd);
 }
 
-static int load_driver(int nodeid)
+/* With enable_sync_rpdo, RPDOs are held in the process image until the next
+ * SYNC. Only the last frame staged for each COB-ID during a cycle is kept, and
+ * the frames go out in the order in which their COB-IDs were first staged.
+ */
+static int pdo_image_stage(const struct canfd_frame* cf)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
+	uint32_t cob_id = cf->can_id & CAN_SFF_MASK;
 
-	node->name[0] = '\0';
-	cfg_load_node(nodeid);
-	apply_quirks(node);
+	pthread_mutex_lock(&tx_stage_lock_);
 
-	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
-		plog(LOG_ERROR, "load_driver: A driver is already loaded for node %d",
-		     nodeid);
-		return -1;
+	if (!pdo_image_is_active_) {
+		pthread_mutex_unlock(&tx_stage_lock_);
+		return tx_stage_fd(cf);
 	}
 
-	errno = 0;
-	node->device_type = get_device_type(nodeid);
-	if (node->device_type == 0 && errno != 0) {
-		plog(LOG_WARNING, "load_driver: Could not get/convert device type for node %d",
-		     nodeid);
-		return -1;
+	if (!pdo_image_is_staged_[cob_id]) {
+		pdo_image_is_staged_[cob_id] = 1;
+		pdo_image_order_[pdo_image_length_++] = cob_id;
 	}
 
-	char* name = get_string(nodeid, 0x1008, 0);
-	if (!name) {
-		plog(LOG_WARNING, "load_driver: Could not get name of node %d",
-		     nodeid);
-		return -1;
-	}
+	pdo_image_[cob_id] = *cf;
 
-	string_keep_if(is_nodename_char, name);
-	strlcpy(node->name, name, sizeof(node->name));
+	pthread_mutex_unlock(&tx_stage_lock_);
 
-	/* Reload config when we have the name of the node */
-	cfg_load_node(nodeid);
-	apply_quirks(node);
+	return 0;
+}
 
-	if (node_has_identity(nodeid)) {
-		node->vendor_id = get_vendor_id(nodeid);
-		node->product_code = get_product_code(nodeid);
-		node->revision_number = get_revision_number(nodeid);
+/* The staged frames are put in the PDO queue, followed by the SYNC frame if
+ * there is one, so that the SYNC cannot overtake them.
+ */
+static int pdo_image_flush_nolock(const struct canfd_frame* sync)
+{
+	struct tx_queue* queue = &tx_queue_[TX_CLASS_PDO];
+	int rc = 0;
+
+	for (size_t i = 0; i < pdo_image_length_; ++i) {
+		uint32_t cob_id = pdo_image_order_[i];
+		pdo_image_is_staged_[cob_id] = 0;
+
+		if (tx_push_nolock(queue, &pdo_image_[cob_id]) < 0)
+			rc = -1;
 	}
 
-	uint64_t heartbeat_period = cfg.node[nodeid].heartbeat_period;
-	if (cfg.node[nodeid].enable_node_guarding)
-		node->is_heartbeat_supported = set_heartbeat_period(nodeid, heartbeat_period) >= 0;
+	pdo_image_length_ = 0;
 
-	char* hw_version = get_string(nodeid, 0x1009, 0);
-	if (!hw_version)
-		hw_version = "";
+	if (sync && tx_push_nolock(queue, sync) < 0)
+		rc = -1;
 
-	strlcpy(node->hw_version, string_trim(hw_version),
-		sizeof(node->hw_version));
+	return rc;
+}
 
-	char* sw_version = get_string(nodeid, 0x100A, 0);
-	if (!sw_version)
-		sw_version = "";
+static void pdo_image_set_active(int is_active)
+{
+	pthread_mutex_lock(&tx_stage_lock_);
 
-	strlcpy(node->sw_version, string_trim(sw_version),
-		sizeof(node->sw_version));
+	if (!is_active)
+		pdo_image_flush_nolock(NULL);
 
-#ifndef NO_MAREL_CODE
-	initialize_info_structure(nodeid);
+	pdo_image_is_active_ = is_active;
 
-	load_error_register(nodeid);
-#endif /* NO_MAREL_CODE */
+	pthread_mutex_unlock(&tx_stage_lock_);
+}
 
-	if (load_any_driver(nodeid) < 0) {
-		if (node->is_heartbeat_supported)
-			turn_off_heartbeat(nodeid);
+static int tx_stage_pdo(const struct canfd_frame* cf)
+{
+	if (co_pi_is_open())
+		process_image_write(CO_PI_RPDO, cf, fastclock_realtime_us());
 
-		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
-		plog(LOG_NOTICE, "load_driver: There is no driver available for \"%s\" at id %d",
-		     node->name, nodeid);
-		return -1;
-	}
+	return pdo_image_stage(cf);
+}
 
-	plog(LOG_DEBUG, "load_driver: Successfully loaded %s for \"%s\" at id %d",
-	     driver_type_str(node->driver_type), node->name, nodeid);
+static int tx_pdo_init(void)
+{
+	tx_loop_thread_ = pthread_self();
+	tx_pdo_drain_is_scheduled_ = 0;
+	memset(tx_pdo_slot_, 0, sizeof(tx_pdo_slot_));
 
-	return 0;
+	return mpmcq_init(&tx_pdo_queue_, CAN_SFF_MASK + 1);
+}
 
+static void tx_pdo_cleanup(void)
+{
+	mpmcq_destroy(&tx_pdo_queue_);
+	memset(&tx_pdo_queue_, 0, sizeof(tx_pdo_queue_));
 }
 
-#ifndef NO_MAREL_CODE
-static int initialize_legacy_driver(int nodeid)
+static void tx_pdo_read(struct tx_pdo_slot* slot, struct canfd_frame* cf)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct canopen_info* info = canopen_info_get(nodeid);
+	unsigned long sequence;
 
-	int rc = legacy_driver_iface_initialize(node->driver);
-	if (rc >= 0) {
-		info->is_active = 1;
-		info->last_seen = time(NULL);
-	} else {
-		if (node->is_heartbeat_supported)
-			turn_off_heartbeat(nodeid);
+	do {
+		while ((sequence = co_atomic_load(&slot->sequence)) & 1)
+			sched_yield();
 
-		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
+		*cf = slot->frame;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (co_atomic_load(&slot->sequence) != sequence);
+}
 
-		plog(LOG_ERROR, "initialize_legacy_driver: Failed to initialize \"%s\" with id %d",
-		     node->name, nodeid);
+static void tx_pdo_write(struct tx_pdo_slot* slot,
+			 const struct canfd_frame* cf)
+{
+	unsigned long sequence;
 
-		unload_legacy_module(node->device_type, node->driver);
-		legacy_master_iface_delete(node->master_iface);
-		node->driver = NULL;
-		node->master_iface = NULL;
-		node->driver_type = CO_MASTER_DRIVER_NONE;
-	}
+	/* Writers of the same COB-ID take turns */
+	do {
+		while ((sequence = co_atomic_load(&slot->sequence)) & 1)
+			sched_yield();
+	} while (!co_atomic_cas(&slot->sequence, sequence, sequence + 1));
 
-	return rc;
+	slot->frame = *cf;
+
+	co_atomic_store(&slot->sequence, sequence + 2);
 }
-#endif /* NO_MAREL_CODE */
 
-static int initialize_new_driver(int nodeid)
+/* Stages the RPDOs that other threads have posted, in the order in which their
+ * COB-IDs became pending. This runs on the main loop and on the SYNC thread.
+ */
+static void tx_pdo_drain(void)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	int rc = co_drv_init(&node->ndrv);
-	if (rc >= 0) {
-#ifndef NO_MAREL_CODE
-		struct canopen_info* info = canopen_info_get(nodeid);
-		info->is_active = 1;
-		info->last_seen = time(NULL);
-#endif /* NO_MAREL_CODE */
+	/* Nothing is posted before tx_pdo_init() */
+	if (!tx_pdo_queue_.cell)
+		return;
 
-		if (master_state_ == MASTER_STATE_STARTUP
-		 && node->ndrv.options & CO_OPT_INHIBIT_START)
-			++n_inhibited_starts;
-	} else {
-		if (node->is_heartbeat_supported)
-			turn_off_heartbeat(nodeid);
+	co_atomic_store(&tx_pdo_drain_is_scheduled_, 0);
 
-		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
+	void* item;
 
-		plog(LOG_ERROR, "initialize_new_driver: Failed to initialize \"%s\" with id %d",
-		     node->name, nodeid);
+	while (mpmcq_pop(&tx_pdo_queue_, &item) == 0) {
+		uint32_t cob_id = (uintptr_t)item - 1;
+		struct tx_pdo_slot* slot = &tx_pdo_slot_[cob_id];
 
-		co_drv_unload(&node->ndrv);
-		node->driver_type = CO_MASTER_DRIVER_NONE;
+		/* A payload written after this is queued again */
+		co_atomic_store(&slot->is_pending, 0);
+
+		struct canfd_frame cf;
+		tx_pdo_read(slot, &cf);
+		tx_stage_pdo(&cf);
 	}
+}
 
-	return rc;
+static void on_tx_pdo_drain(struct mloop_async* self)
+{
+	(void)self;
+	tx_pdo_drain();
 }
 
-static int initialize_driver(int nodeid)
+static int tx_pdo_schedule_drain(void)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
+	if (co_atomic_exchange(&tx_pdo_drain_is_scheduled_, 1))
+		return 0;
 
-	switch (node->driver_type) {
-	case CO_MASTER_DRIVER_NEW:
-		return initialize_new_driver(nodeid);
-#ifndef NO_MAREL_CODE
-	case CO_MASTER_DRIVER_LEGACY:
-		return initialize_legacy_driver(nodeid);
-#endif /* NO_MAREL_CODE */
-	case CO_MASTER_DRIVER_NONE:
-		return -1;
-	default:
-		abort();
-		break;
-	}
+	struct mloop_async* async = mloop_async_new(mloop_default());
+	if (!async)
+		goto failure;
+
+	mloop_async_set_callback(async, on_tx_pdo_drain);
+
+	int rc = mloop_async_start(async);
+	mloop_async_unref(async);
+
+	if (rc < 0)
+		goto failure;
+
+	return 0;
+
+failure:
+	co_atomic_store(&tx_pdo_drain_is_scheduled_, 0);
+	return -1;
 }
 
-static void run_net_probe(struct mloop_work* self)
+/* Called by threads other than the main loop. Nothing here takes a lock that
+ * the main loop holds, so the caller can't be held up by it.
+ */
+static int tx_pdo_post(const struct canfd_frame* cf)
 {
-	(void)self;
+	uint32_t cob_id = cf->can_id & CAN_SFF_MASK;
+	struct tx_pdo_slot* slot = &tx_pdo_slot_[cob_id];
 
-	profile("Probe network...\n");
-
-	int start = CANOPEN_NODEID_MIN, stop = CANOPEN_NODEID_MAX;
+	tx_pdo_write(slot, cf);
 
-	if (cfg.range_start == 0 && cfg.range_stop == 0) {
-		co_net_reset(&socket_, nodes_seen_, 100);
-	} else  {
-		start = cfg.range_start;
-		stop = cfg.range_stop;
-		co_net_reset_range(&socket_, nodes_seen_, start, stop,
-				   100 * (start - stop + 1));
+	if (co_atomic_exchange(&slot->is_pending, 1) == 0
+	 && mpmcq_push(&tx_pdo_queue_, (void*)(uintptr_t)(cob_id + 1)) < 0) {
+		/* Can't happen as long as the queue has room for every COB-ID */
+		co_atomic_store(&slot->is_pending, 0);
+		co_atomic_add_fetch(&tx_n_dropped_, 1);
+		return -1;
 	}
 
-	co_net_probe(&socket_, nodes_seen_, start, stop, 100);
+	return tx_pdo_schedule_drain();
 }
 
-static void run_load_driver(struct mloop_work* self)
+static int tx_stage_sdo(struct sdo_async* sdo, struct can_frame* cf)
 {
-	struct co_master_node* node = mloop_work_get_context(self);
-	int nodeid = co_master_get_node_id(node);
-	load_driver(nodeid);
-	node->is_loading = 0;
+	(void)sdo;
+	return tx_stage(cf);
 }
 
-static void call_start_fn(struct co_master_node* node)
+static int tx_stage_nmt(int cs, int nodeid)
 {
-	co_start_fn start_fn;
+	struct can_frame cf = { .can_id = R_NMT, .can_dlc = 2 };
+	nmt_set_cs(&cf, cs);
+	nmt_set_nodeid(&cf, nodeid);
+	return tx_stage(&cf);
+}
+
+static void stop_heartbeat_timer(int nodeid)
+{
+	co_master_get_node(nodeid)->heartbeat_deadline = 0;
+}
+
+static void stop_ping_timer(int nodeid)
+{
+	co_master_get_node(nodeid)->ping_deadline = 0;
+}
+
+#ifndef NO_MAREL_CODE
+static void unload_legacy_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	/* Deliver whatever the driver has received before it goes away */
+	flush_legacy_pdos();
+
+	unload_legacy_module(node->device_type, node->driver);
+
+	legacy_master_iface_delete(node->master_iface);
+
+	node->driver = NULL;
+	node->master_iface = NULL;
+}
+#endif /* NO_MAREL_CODE */
+
+/* This is an expediated fire-and-forget SDO message to tell buggy Marel
+ * CANopen nodes that don't have a driver to shut up.
+ *
+ * The sdo_req interface is not used for this because we're not interested in
+ * the response and it would require more complicated code.
+ */
+static void turn_off_heartbeat(int nodeid)
+{
+	struct can_frame cf = { .can_id = R_RSDO + nodeid };
+	sdo_set_cs(&cf, SDO_CCS_DL_INIT_REQ);
+	sdo_set_index(&cf, 0x1017);
+	sdo_set_subindex(&cf, 0);
+	sdo_indicate_size(&cf);
+	sdo_expediate(&cf);
+	sdo_set_expediated_size(&cf, sizeof(uint16_t));
+	cf.can_dlc = SDO_EXPEDIATED_DATA_IDX + sizeof(uint16_t);
+	sock_send(&socket_, &cf, 0);
+}
+
+static void stop_node_guarding(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	if (!cfg.node[nodeid].enable_node_guarding)
+		return;
+
+	stop_heartbeat_timer(nodeid);
+
+	if (!node->is_heartbeat_supported)
+		stop_ping_timer(nodeid);
+}
+
+static void unload_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	node->is_initialized = 0;
+	clear_sdo_channels(nodeid);
+	mux_table_update(nodeid);
+	update_filters();
+
+	stop_node_guarding(nodeid);
+
+	struct sdo_req_queue* sdo_queue = sdo_req_queue_find(nodeid);
+	if (sdo_queue)
+		sdo_req_queue_flush(sdo_queue);
 
 	switch (node->driver_type) {
-	case CO_MASTER_DRIVER_NEW:
-		start_fn = node->ndrv.start_fn;
-		if (start_fn)
-			start_fn(&node->ndrv);
-		break;
 #ifndef NO_MAREL_CODE
 	case CO_MASTER_DRIVER_LEGACY:
-		legacy_driver_iface_process_node_state(node->driver, 1);
+		unload_legacy_driver(nodeid);
 		break;
 #endif /* NO_MAREL_CODE */
+	case CO_MASTER_DRIVER_NEW:
+		co_drv_unload(&node->ndrv);
+		break;
 	case CO_MASTER_DRIVER_NONE:
+	default:
+		abort();
 		break;
 	}
+
+	node->device_type = 0;
+	node->is_heartbeat_supported = 0;
+	ident->is_identity_unconfirmed = 0;
+	node->driver_type = CO_MASTER_DRIVER_NONE;
+	memset(&node->watchdog, 0, sizeof(node->watchdog));
+	node->emcy_limit.has_last = 0;
+
+	/* The nodes belong to the new master after a handover */
+	if (master_state_ == MASTER_STATE_STOPPING && !is_handed_over_)
+		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
+
+#ifndef NO_MAREL_CODE
+	struct canopen_info* info = canopen_info_get(nodeid);
+	info->is_active = 0;
+#endif /* NO_MAREL_CODE */
 }
 
-static void start_single_node(struct co_master_node* node)
+static char* compose_trace_name(char* dst, size_t size)
 {
-	int nodeid = co_master_get_node_id(node);
-	co_net_send_nmt(&socket_, NMT_CS_START, nodeid);
-	start_nodeguarding(nodeid);
-	call_start_fn(node);
+	struct tm tm;
+	time_t t = time(NULL);
+
+	localtime_r(&t, &tm);
+	int rc = strftime(dst, size, "%y%m%d-%H%M%S", &tm);
+	assert(rc >= 0);
+
+	return dst;
 }
 
-static void on_load_driver_done(struct mloop_work* self)
+static void compose_trace_buffer_path(char* path, size_t size, const char* name)
 {
-	struct co_master_node* node = mloop_work_get_context(self);
-	int nodeid = co_master_get_node_id(node);
+	char ts[32];
 
-	--n_scheduled_bootups;
+	if (!name)
+		name = compose_trace_name(ts, sizeof(ts));
 
-	if (node->driver_type == CO_MASTER_DRIVER_NONE)
-		return;
+	snprintf(path, size, "%s/%s.%s", cfg.trace_dump_path, name,
+		 trace_format_extension(trace_dump_format_));
+	path[size - 1] = '\0';
+}
 
-	if (initialize_driver(nodeid) < 0)
-		return;
+static void do_dump_tracebuffer(struct mloop_work* work)
+{
+	assert(cfg.trace_buffer_size > 0);
 
-	node->is_initialized = 1;
+	const char* name = mloop_work_get_context(work);
 
-	if (master_state_ == MASTER_STATE_STARTUP)
-		return;
+	char path[256];
+	compose_trace_buffer_path(path, sizeof(path), name);
 
-	if (node->driver_type == CO_MASTER_DRIVER_NEW
-	 && node->ndrv.options & CO_OPT_INHIBIT_START)
+	FILE* stream = fopen(path, "w");
+	if (!stream)
 		return;
 
-	start_single_node(node);
+	if (trace_dump_format_ == TRACE_FORMAT_RAW) {
+		tb_dump(&tracebuffer_, stream);
+	} else {
+		struct trace_export export;
+		if (trace_export_begin(&export, stream, trace_dump_format_,
+				       cfg.iface) == 0)
+			tb_foreach(&tracebuffer_, trace_export_frame_fn,
+				   &export);
+	}
+
+	fclose(stream);
 }
 
-static int schedule_load_driver(int nodeid)
+static const struct {
+	const char* name;
+	uint32_t objects;
+} trace_object_names_[] = {
+	{ "nmt", CANOPEN_NMT },
+	{ "sync", CANOPEN_SYNC },
+	{ "time", CANOPEN_TIMESTAMP },
+	{ "emcy", CANOPEN_EMCY },
+	{ "tpdo", CANOPEN_TPDO1 | CANOPEN_TPDO2 | CANOPEN_TPDO3
+		  | CANOPEN_TPDO4 },
+	{ "rpdo", CANOPEN_RPDO1 | CANOPEN_RPDO2 | CANOPEN_RPDO3
+		  | CANOPEN_RPDO4 },
+	{ "pdo", CANOPEN_TPDO1 | CANOPEN_TPDO2 | CANOPEN_TPDO3 | CANOPEN_TPDO4
+		 | CANOPEN_RPDO1 | CANOPEN_RPDO2 | CANOPEN_RPDO3
+		 | CANOPEN_RPDO4 },
+	{ "sdo", CANOPEN_TSDO | CANOPEN_RSDO },
+	{ "heartbeat", CANOPEN_HEARTBEAT },
+};
+
+/* The trace_objects parameter is a comma separated list of object names from
+ * trace_object_names_, e.g. "nmt,emcy,sdo". Returns -1 on unknown names.
+ */
+static int parse_trace_objects(uint32_t* dst, const char* str)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	if (node->is_loading)
-		return 0;
+	*dst = 0;
 
-	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
-		if (!node->is_initialized)
+	while (*str) {
+		size_t len = strcspn(str, ",");
+		size_t i;
+
+		for (i = 0; i < ARRAY_LENGTH(trace_object_names_); ++i)
+			if (strlen(trace_object_names_[i].name) == len
+			 && strncmp(str, trace_object_names_[i].name, len) == 0)
+				break;
+
+		if (i == ARRAY_LENGTH(trace_object_names_))
 			return -1;
 
-		unload_driver(nodeid);
+		*dst |= trace_object_names_[i].objects;
+		str += str[len] ? len + 1 : len;
+	}
+
+	return 0;
+}
+
+/* A trace buffer file from the previous run, e.g. one that ended in a crash, is
+ * kept as <file>.prev for canopen-dump -r.
+ */
+static int init_tracebuffer(void)
+{
+	const char* path = cfg.trace_buffer_file;
+
+	if (string_is_empty(path))
+		return tb_init_split(&tracebuffer_, cfg.trace_buffer_size,
+				     cfg.trace_event_buffer_size);
+
+	char prev[sizeof(cfg.trace_buffer_file) + 8];
+	snprintf(prev, sizeof(prev), "%s.prev", path);
+
+	if (rename(path, prev) == 0)
+		plog(LOG_NOTICE, "Trace buffer of previous run kept in %s",
+		     prev);
+	else if (errno != ENOENT)
+		plog(LOG_WARNING, "Could not keep trace buffer %s: %m", path);
+
+	return tb_init_file(&tracebuffer_, path, cfg.trace_buffer_size,
+			    cfg.trace_event_buffer_size);
+}
+
+static void load_trace_filter(void)
+{
+	struct tb_filter filter = {
+		.range_start = cfg.trace_range_start,
+		.range_stop = cfg.trace_range_stop ? cfg.trace_range_stop
+						   : CANOPEN_NODEID_MAX,
+		.cob_mask = cfg.trace_cob_mask,
+		.cob_id = cfg.trace_cob_id,
+		.pdo_decimation = cfg.trace_pdo_decimation,
+	};
+
+	if (parse_trace_objects(&filter.objects, cfg.trace_objects) < 0) {
+		plog(LOG_WARNING, "Invalid trace_objects: \"%s\"",
+		     cfg.trace_objects);
+		filter.objects = 0;
 	}
 
+	if (!filter.objects && !cfg.trace_range_start && !cfg.trace_range_stop
+	 && !filter.cob_mask && filter.pdo_decimation <= 1)
+		return;
+
+	if (tb_set_filter(&tracebuffer_, &filter) < 0)
+		plog(LOG_WARNING, "Could not set trace filter: %m");
+}
+
+static void dump_tracebuffer(const char* name)
+{
+	if (cfg.trace_buffer_size == 0)
+		return;
+
 	struct mloop_work* work = mloop_work_new(mloop_default());
 	if (!work)
-		return -1;
+		return;
 
-	mloop_work_set_context(work, node, NULL);
-	mloop_work_set_work_fn(work, run_load_driver);
-	mloop_work_set_done_fn(work, on_load_driver_done);
+	if (name) {
+		char* str = strdup(name);
+		if (str)
+			mloop_work_set_context(work, str, free);
+	}
 
-	int rc = mloop_work_start(work);
-	if (rc >= 0)
-		++n_scheduled_bootups;
+	mloop_work_set_work_fn(work, do_dump_tracebuffer);
+	if (mloop_work_start(work) < 0)
+		plog(LOG_WARNING, "Could not start the trace buffer dump");
+	mloop_work_unref(work);
+}
+
+static void do_dump_timeline(struct mloop_work* work)
+{
+	(void)work;
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/bootup-timeline.json",
+		 cfg.trace_dump_path);
+
+	if (init_directory(cfg.trace_dump_path) < 0) {
+		plog(LOG_WARNING, "Could not create %s: %s", cfg.trace_dump_path,
+		     strerror(errno));
+		return;
+	}
+
+	FILE* stream = fopen(path, "w");
+	if (!stream) {
+		plog(LOG_WARNING, "Could not open %s: %s", path,
+		     strerror(errno));
+		return;
+	}
+
+	co_timeline_dump(stream);
+	fclose(stream);
+}
+
+static void dump_timeline(void)
+{
+	struct mloop_work* work = mloop_work_new(mloop_default());
+	if (!work)
+		return;
 
+	mloop_work_set_work_fn(work, do_dump_timeline);
+	if (mloop_work_start(work) < 0)
+		plog(LOG_WARNING, "Could not start the bootup timeline dump");
 	mloop_work_unref(work);
+}
 
-	node->is_loading = 1;
+static inline uint64_t heartbeat_timeout_us(int nodeid)
+{
+	return (cfg.node[nodeid].heartbeat_period
+		+ cfg.node[nodeid].heartbeat_timeout) * 1000ULL;
+}
 
-	return rc;
+static inline uint64_t ping_period_us(int nodeid)
+{
+	return cfg.node[nodeid].heartbeat_period * 1000ULL;
 }
 
-static int handle_bootup(struct co_master_node* node)
+static void on_heartbeat_timeout(struct co_master_node* node)
 {
 	int nodeid = co_master_get_node_id(node);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
 
-	if (master_state_ == MASTER_STATE_STARTUP) {
-		nodes_seen_late_[nodeid] = 1;
-		return 0;
-	}
+	node->ntimeouts++;
+	n_heartbeat_timeouts_++;
 
-	return schedule_load_driver(nodeid);
+#ifndef NO_MAREL_CODE
+	struct canopen_info* info = canopen_info_get(nodeid);
+	info->skipped_heartbeats++;
+#endif /* NO_MAREL_CODE */
+
+	co_log(LOG_DEBUG, CO_LOG_KEY(CO_LOG_HEARTBEAT_TIMEOUT, nodeid, 0),
+	       "Node \"%s\" with id %d has missed %u heartbeats",
+	       ident->name, nodeid, node->ntimeouts);
+
+	if (node->ntimeouts <= cfg.node[nodeid].n_timeouts_max)
+		return;
+
+	co_log(LOG_NOTICE, CO_LOG_KEY(CO_LOG_HEARTBEAT_TIMEOUT, nodeid, 1),
+	       "Node \"%s\" with id %d has timed out; unloading...",
+	       ident->name, nodeid);
+
+	if (cfg.enable_incident_trace)
+		dump_tracebuffer(NULL);
+
+	/* Don't let requests wait for a node that is gone */
+	struct sdo_req_queue* sdo_queue = sdo_req_queue_find(nodeid);
+	if (sdo_queue)
+		sdo_req_queue_set_lost(sdo_queue, 1);
+
+	n_nodes_lost_++;
+	events_rest_on_node_lost(nodeid);
+
+	co_net_send_nmt(&socket_, NMT_CS_RESET_NODE, nodeid);
+	unload_driver(co_master_get_node_id(node));
 }
 
-static void log_emcy(struct co_master_node* node, struct co_emcy* emcy)
+static int start_heartbeat_timer(int nodeid)
 {
-	int level = emcy->code != 0 ? LOG_EMERG : LOG_NOTICE;
-	int profile = co_master_get_device_profile(node);
+	struct co_master_node* node = co_master_get_node(nodeid);
+	node->ntimeouts = 0;
+	node->heartbeat_deadline = gettime_us(CLOCK_MONOTONIC)
+				 + heartbeat_timeout_us(nodeid);
+	return 0;
+}
+
+/* Called for every heartbeat, so this only moves the deadline */
+static int restart_heartbeat_timer(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	if (!cfg.node[nodeid].enable_node_guarding)
+		return 0;
+
+	/* Node guarding was enabled by a reload and 0x1017 is being set */
+	if (!node->heartbeat_deadline)
+		return 0;
+
+	node->heartbeat_deadline = mux_now_ + heartbeat_timeout_us(nodeid);
+	return 0;
+}
+
+static void send_ping(int nodeid)
+{
+	struct can_frame cf = { 0 };
+
+	cf.can_id = R_HEARTBEAT + nodeid;
+	cf.can_id |= CAN_RTR_FLAG;
+	cf.can_dlc = 1;
+	heartbeat_set_state(&cf, 1);
+
+	sock_send(&socket_, &cf, 0);
+}
+
+/* Each node is pinged at its own phase of the period, which goes by node id,
+ * so that nodes that are started together are not all pinged at once. The
+ * first ping comes within a period, before the first heartbeat deadline.
+ */
+static int start_ping_timer(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	uint64_t period = ping_period_us(nodeid);
+
+	if (!period) {
+		node->ping_deadline = 0;
+		return 0;
+	}
+
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+	uint64_t phase = period * nodeid / (CANOPEN_NODEID_MAX + 1);
+	uint64_t wait = (phase + period - now % period) % period;
+
+	node->ping_deadline = now + (wait ? wait : period);
+	return 0;
+}
+
+/* Missed deadlines are not made up for; the next one is a period from now */
+static inline uint64_t next_deadline(uint64_t deadline, uint64_t period,
+				     uint64_t now)
+{
+	deadline += period;
+	return deadline > now ? deadline : now + period;
+}
+
+/* With guard_frames_per_ms set, a sweep sends no more pings than that, so no
+ * millisecond has more. The rest stay due for the next sweep, which starts
+ * with the first node that was held back.
+ */
+static void on_guard_sweep(struct mloop_timer* timer)
+{
+	(void)timer;
+
+	static int first_held = 0;
+
+	uint64_t now = loop_now_us();
+	unsigned int budget = cfg.guard_frames_per_ms;
+	int n = nodeid_max() - nodeid_min() + 1;
+	int start = first_held;
+
+	if (start < nodeid_min() || start > nodeid_max())
+		start = nodeid_min();
+
+	first_held = 0;
+
+	for (int j = 0; j < n; ++j) {
+		int i = nodeid_min() + (start - nodeid_min() + j) % n;
+		struct co_master_node* node = co_master_get_node(i);
+
+		if (node->ping_deadline && now >= node->ping_deadline) {
+			if (cfg.guard_frames_per_ms && budget == 0) {
+				if (!first_held)
+					first_held = i;
+			} else {
+				node->ping_deadline = next_deadline(
+					node->ping_deadline,
+					ping_period_us(i), now);
+				send_ping(i);
+				--budget;
+			}
+		}
+
+		if (!node->heartbeat_deadline || now < node->heartbeat_deadline)
+			continue;
+
+		node->heartbeat_deadline = cfg.node[i].n_timeouts_max > 0
+			? next_deadline(node->heartbeat_deadline,
+					heartbeat_timeout_us(i), now)
+			: 0;
+
+		/* This may unload the driver and disarm both deadlines */
+		on_heartbeat_timeout(node);
+	}
+}
+
+/* Deadlines are checked every timer_slack milliseconds, so a timeout may be
+ * noticed up to that late. A slack of 0 checks every millisecond.
+ */
+static int start_guard_timer(void)
+{
+	if (!guard_timer_) {
+		guard_timer_ = mloop_timer_new(mloop_default());
+		if (!guard_timer_)
+			return -1;
+
+		mloop_timer_set_type(guard_timer_, MLOOP_TIMER_PERIODIC);
+		mloop_timer_set_callback(guard_timer_, on_guard_sweep);
+	}
+
+	uint64_t interval = cfg.timer_slack > 0 ? cfg.timer_slack : 1;
+
+	mloop_timer_stop(guard_timer_);
+	mloop_timer_set_time(guard_timer_, interval * 1000000ULL);
+
+	return mloop_timer_start(guard_timer_);
+}
+
+static void stop_guard_timer(void)
+{
+	if (!guard_timer_)
+		return;
+
+	mloop_timer_stop(guard_timer_);
+	mloop_timer_unref(guard_timer_);
+	guard_timer_ = NULL;
+}
+
+static void start_nodeguarding(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	if (!cfg.node[nodeid].enable_node_guarding)
+		return;
+
+	if (!node->is_heartbeat_supported)
+		start_ping_timer(nodeid);
+
+	start_heartbeat_timer(nodeid);
+}
+
+#ifndef NO_MAREL_CODE
+static void* load_legacy_module(const char* name, int device_type,
+				void* master_iface)
+{
+	void* driver = NULL;
+	pthread_mutex_lock(&driver_manager_lock_);
+	int rc = legacy_driver_manager_create_handler(driver_manager_, name,
+						      device_type, master_iface,
+						      &driver);
+	pthread_mutex_unlock(&driver_manager_lock_);
+	return rc >= 0 ? driver : NULL;
+}
+
+static void unload_legacy_module(int device_type, void* driver)
+{
+	pthread_mutex_lock(&driver_manager_lock_);
+	legacy_driver_delete_handler(driver_manager_, device_type, driver);
+	pthread_mutex_unlock(&driver_manager_lock_);
+}
+#endif /* NO_MAREL_CODE */
+
+static int load_profile_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	char buffer[256];
+	unsigned int profile = co_master_get_device_profile(node);
+	snprintf(buffer, sizeof(buffer), "cia%u", profile);
+	buffer[sizeof(buffer) - 1] = '\0';
+
+	return co_drv_load(&node->ndrv, buffer);
+}
+
+static int load_new_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	if (co_drv_load(&node->ndrv, ident->name) < 0)
+		if (load_profile_driver(nodeid) < 0)
+			return -1;
+
+	node->driver_type = CO_MASTER_DRIVER_NEW;
+
+	return 0;
+}
+
+#ifndef NO_MAREL_CODE
+static int load_legacy_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	void* master_iface = master_iface_init(nodeid);
+	if (!master_iface)
+		return -1;
+
+	void* driver = load_legacy_module(ident->name, node->device_type,
+					  master_iface);
+	if (!driver)
+		goto failure;
+
+	node->driver_type = CO_MASTER_DRIVER_LEGACY;
+	node->driver = driver;
+	node->master_iface = master_iface;
+
+	return 0;
+
+failure:
+	legacy_master_iface_delete(master_iface);
+	node->master_iface = NULL;
+	return -1;
+}
+#endif /* NO_MAREL_CODE */
+
+static int is_nodename_char(int c)
+{
+	return isalnum(c) || c == '-' || c == '_';
+}
+
+#ifndef NO_MAREL_CODE
+static void initialize_info_structure(int nodeid)
+{
+	struct canopen_info* info = canopen_info_get(nodeid);
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	info->device_type = node->device_type;
+	strlcpy(info->name, ident->name, sizeof(info->name));
+	strlcpy(info->hw_version, ident->hw_version, sizeof(info->hw_version));
+	strlcpy(info->sw_version, ident->sw_version, sizeof(info->sw_version));
+}
+
+static void load_error_register(int nodeid)
+{
+	struct canopen_info* info = canopen_info_get(nodeid);
+
+	errno = 0;
+	info->error_register = sdo_sync_read_u8(nodeid, 0x1001, 0);
+	if (info->error_register == 0 && errno != 0) {
+		plog(LOG_WARNING, "load_driver: Could not get/convert error register for node %d",
+		     nodeid);
+	}
+}
+#endif /* NO_MAREL_CODE */
+
+static const char* driver_type_str(enum co_master_driver_type type)
+{
+	switch (type) {
+	case CO_MASTER_DRIVER_NONE: return "none";
+	case CO_MASTER_DRIVER_NEW: return "driver";
+	case CO_MASTER_DRIVER_LEGACY: return "legacy driver";
+	}
+
+	return "UNKNOWN";
+}
+
+static void apply_quirks(struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+
+	struct sdo_req_queue* sdo_queue = sdo_req_queue_get(nodeid);
+	if (!sdo_queue)
+		return;
+
+	struct sdo_async* sdo_client = &sdo_queue->sdo_client;
+
+	if (cfg.node[nodeid].ignore_sdo_multiplexer)
+		sdo_client->quirks |= SDO_ASYNC_QUIRK_IGNORE_MULTIPLEXER;
+	else
+		sdo_client->quirks &= ~SDO_ASYNC_QUIRK_IGNORE_MULTIPLEXER;
+
+	if (cfg.node[nodeid].send_full_sdo_frame)
+		sdo_client->quirks |= SDO_ASYNC_QUIRK_NEEDS_FULL_FRAME;
+	else
+		sdo_client->quirks &= ~SDO_ASYNC_QUIRK_NEEDS_FULL_FRAME;
+
+	sdo_client->block_size = cfg.node[nodeid].sdo_block_size;
+
+	sdo_req_queue_set_timeout_bounds(sdo_queue,
+					 cfg.node[nodeid].sdo_timeout_min,
+					 cfg.node[nodeid].sdo_timeout_max);
+}
+
+static void compose_identity_cache_path(char* path, size_t size)
+{
+	snprintf(path, size, "%s/%s.identity", cfg.identity_cache_dir,
+		 cfg.iface);
+	path[size - 1] = '\0';
+}
+
+static void save_identity_cache(void)
+{
+	if (!cfg.identity_cache_dir[0])
+		return;
+
+	char path[256];
+	compose_identity_cache_path(path, sizeof(path));
+
+	if (identity_cache_save(path) < 0)
+		plog(LOG_WARNING, "save_identity_cache: Could not write %s: %m",
+		     path);
+}
+
+static void store_identity(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+	struct identity_cache_entry entry;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.device_type = node->device_type;
+	entry.vendor_id = ident->vendor_id;
+	entry.product_code = ident->product_code;
+	entry.revision_number = ident->revision_number;
+	strlcpy(entry.name, ident->name, sizeof(entry.name));
+	strlcpy(entry.hw_version, ident->hw_version, sizeof(entry.hw_version));
+	strlcpy(entry.sw_version, ident->sw_version, sizeof(entry.sw_version));
+
+	identity_cache_set(nodeid, &entry);
+}
+
+static int load_cached_identity(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+	struct identity_cache_entry entry;
+
+	if (!cfg.identity_cache_dir[0] || identity_cache_get(nodeid, &entry) < 0)
+		return -1;
+
+	node->device_type = entry.device_type;
+	ident->vendor_id = entry.vendor_id;
+	ident->product_code = entry.product_code;
+	ident->revision_number = entry.revision_number;
+	strlcpy(ident->name, entry.name, sizeof(ident->name));
+	strlcpy(ident->hw_version, entry.hw_version, sizeof(ident->hw_version));
+	strlcpy(ident->sw_version, entry.sw_version, sizeof(ident->sw_version));
+
+	ident->is_identity_unconfirmed = 1;
+	return 0;
+}
+
+/* The master that handed the node over has confirmed its identity */
+static int load_handed_over_identity(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+	const struct co_handover_node* hnode = handover_node_[nodeid];
+
+	if (!hnode)
+		return -1;
+
+	node->device_type = hnode->device_type;
+	ident->vendor_id = hnode->vendor_id;
+	ident->product_code = hnode->product_code;
+	ident->revision_number = hnode->revision_number;
+	strlcpy(ident->name, hnode->name, sizeof(ident->name));
+	strlcpy(ident->hw_version, hnode->hw_version, sizeof(ident->hw_version));
+	strlcpy(ident->sw_version, hnode->sw_version, sizeof(ident->sw_version));
+
+	return 0;
+}
+
+static int read_identity(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	errno = 0;
+	node->device_type = get_device_type(nodeid);
+	if (node->device_type == 0 && errno != 0) {
+		plog(LOG_WARNING, "load_driver: Could not get/convert device type for node %d",
+		     nodeid);
+		return -1;
+	}
+
+	char* name = get_string(nodeid, 0x1008, 0);
+	if (!name) {
+		plog(LOG_WARNING, "load_driver: Could not get name of node %d",
+		     nodeid);
+		return -1;
+	}
+
+	string_keep_if(is_nodename_char, name);
+	strlcpy(ident->name, name, sizeof(ident->name));
+
+	ident->vendor_id = 0;
+	ident->product_code = 0;
+	ident->revision_number = 0;
+
+	if (node_has_identity(nodeid)) {
+		ident->vendor_id = get_vendor_id(nodeid);
+		ident->product_code = get_product_code(nodeid);
+		ident->revision_number = get_revision_number(nodeid);
+	}
+
+	char* hw_version = get_string(nodeid, 0x1009, 0);
+	if (!hw_version)
+		hw_version = "";
+
+	strlcpy(ident->hw_version, string_trim(hw_version),
+		sizeof(ident->hw_version));
+
+	char* sw_version = get_string(nodeid, 0x100A, 0);
+	if (!sw_version)
+		sw_version = "";
+
+	strlcpy(ident->sw_version, string_trim(sw_version),
+		sizeof(ident->sw_version));
+
+	if (cfg.identity_cache_dir[0])
+		store_identity(nodeid);
+
+	return 0;
+}
+
+static int is_same_u32(const struct sdo_batch* batch, size_t i,
+		       uint32_t expected)
+{
+	const struct sdo_batch_item* item = sdo_batch_get_item(batch, i);
+	if (!item || item->status != SDO_REQ_OK || item->data.index > 4)
+		return 0;
+
+	uint32_t value = 0;
+	byteorder2(&value, item->data.data, sizeof(value), item->data.index);
+	return value == expected;
+}
+
+static void on_identity_confirmed(struct sdo_future* future)
+{
+	struct co_master_node* node = sdo_future_get_context(future);
+	const struct sdo_batch* batch = sdo_future_get_batch(future);
+	int nodeid = co_master_get_node_id(node);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	/* The driver may have been reloaded in the meantime */
+	if (!ident->is_identity_unconfirmed)
+		return;
+
+	ident->is_identity_unconfirmed = 0;
+
+	int is_same = is_same_u32(batch, 0, node->device_type);
+	if (batch->n_items > 1)
+		is_same = is_same && is_same_u32(batch, 1, ident->vendor_id)
+			  && is_same_u32(batch, 2, ident->product_code)
+			  && is_same_u32(batch, 3, ident->revision_number);
+
+	if (is_same)
+		return;
+
+	plog(LOG_NOTICE, "confirm_identity: Identity of node %d has changed; reloading its driver",
+	     nodeid);
+
+	identity_cache_invalidate(nodeid);
+	schedule_load_driver(nodeid);
+}
+
+/* A single batch confirms what was taken from the cache */
+static void confirm_identity(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	if (!batch)
+		return;
+
+	sdo_batch_add_upload(batch, 0x1000, 0);
+
+	if (ident->vendor_id != 0)
+		for (int i = 1; i <= 3; ++i)
+			sdo_batch_add_upload(batch, 0x1018, i);
+
+	struct sdo_future* future =
+		sdo_future_start(batch, sdo_req_queue_get(nodeid));
+	sdo_batch_unref(batch);
+	if (!future) {
+		plog(LOG_WARNING, "confirm_identity: Could not confirm identity of node %d",
+		     nodeid);
+		return;
+	}
+
+	sdo_future_then(future, on_identity_confirmed, node, NULL);
+	sdo_future_unref(future);
+}
+
+/* PDO setup: TPDO 1-4 are 0 to 3 and RPDO 1-4 are 4 to 7 */
+#define PDO_SETUP_COUNT 8
+
+struct pdo_setup {
+	struct co_master_node* node;
+	size_t first_item[PDO_SETUP_COUNT];
+	size_t n_items[PDO_SETUP_COUNT];
+	int is_reading[PDO_SETUP_COUNT];
+};
+
+static struct pdo_map* get_pdo_map(struct co_drv* drv, int i)
+{
+	return i < 4 ? drv->tpdo_map[i] : drv->rpdo_map[i - 4];
+}
+
+static inline int pdo_comm_index(int i)
+{
+	return i < 4 ? 0x1800 + i : 0x1400 + i - 4;
+}
+
+static inline int pdo_map_index(int i)
+{
+	return pdo_comm_index(i) + 0x200;
+}
+
+/* The mux only listens to the default COB-IDs */
+static inline uint32_t pdo_cob_id(int i, int nodeid)
+{
+	return (i < 4 ? R_TPDO1 + i * 0x100 : R_RPDO1 + (i - 4) * 0x100)
+		+ nodeid;
+}
+
+static int has_pdo_maps(struct co_drv* drv)
+{
+	for (int i = 0; i < PDO_SETUP_COUNT; ++i)
+		if (get_pdo_map(drv, i))
+			return 1;
+
+	return 0;
+}
+
+static int add_u32_download(struct sdo_batch* batch, int index, int subindex,
+			    uint32_t value)
+{
+	uint32_t network_order = 0;
+	byteorder(&network_order, &value, sizeof(network_order));
+	return sdo_batch_add_download(batch, index, subindex, &network_order,
+				      sizeof(network_order));
+}
+
+/* The PDO is disabled while its mapping is written, as in CiA 301 */
+static int add_pdo_mapping_downloads(struct sdo_batch* batch, int i,
+				     int nodeid, const struct pdo_map* map)
+{
+	int comm_index = pdo_comm_index(i);
+	int map_index = pdo_map_index(i);
+	uint32_t cob_id = pdo_cob_id(i, nodeid);
+	uint8_t zero = 0, count = map->n_mapping;
+
+	if (add_u32_download(batch, comm_index, 1, cob_id | 0x80000000) < 0
+	 || sdo_batch_add_download(batch, map_index, 0, &zero, 1) < 0)
+		return -1;
+
+	for (size_t j = 0; j < map->n_mapping; ++j)
+		if (add_u32_download(batch, map_index, j + 1,
+				     map->mapping[j]) < 0)
+			return -1;
+
+	if (sdo_batch_add_download(batch, map_index, 0, &count, 1) < 0
+	 || add_u32_download(batch, comm_index, 1, cob_id) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int is_pdo_setup_ok(const struct sdo_batch* batch,
+			   const struct pdo_setup* setup, int i)
+{
+	for (size_t j = 0; j < setup->n_items[i]; ++j) {
+		const struct sdo_batch_item* item =
+			sdo_batch_get_item(batch, setup->first_item[i] + j);
+		if (!item || item->status != SDO_REQ_OK)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void compile_pdo_map(struct co_master_node* node, int i,
+			    const uint32_t* mapping, size_t n)
+{
+	int nodeid = co_master_get_node_id(node);
+	struct pdo_map* map = get_pdo_map(&node->ndrv, i);
+
+	if (pdo_map_compile(map, mapping, n, co_master_find_eds(nodeid)) < 0)
+		plog(LOG_ERROR, "pdo_setup: Invalid mapping in 0x%x of node %d",
+		     pdo_map_index(i), nodeid);
+}
+
+static void finish_pdo_setup(struct pdo_setup* setup)
+{
+	struct co_master_node* node = setup->node;
+
+	co_timeline_end(co_master_get_node_id(node), CO_TIMELINE_PDO_SETUP);
+
+	node->ndrv.pdo_setup = NULL;
+	free(setup);
+
+	if (node->ndrv.is_start_held) {
+		node->ndrv.is_start_held = 0;
+		co__start(co_master_get_node_id(node));
+	}
+}
+
+/* The driver may have been unloaded or reloaded in the meantime */
+static struct pdo_setup* get_pdo_setup(struct sdo_future* future)
+{
+	struct pdo_setup* setup = sdo_future_get_context(future);
+
+	if (setup->node->ndrv.pdo_setup == setup)
+		return setup;
+
+	free(setup);
+	return NULL;
+}
+
+static void on_pdo_mapping_read(struct sdo_future* future)
+{
+	struct pdo_setup* setup = get_pdo_setup(future);
+	if (!setup)
+		return;
+
+	const struct sdo_batch* batch = sdo_future_get_batch(future);
+	int nodeid = co_master_get_node_id(setup->node);
+
+	for (int i = 0; i < PDO_SETUP_COUNT; ++i) {
+		if (!setup->is_reading[i])
+			continue;
+
+		if (!is_pdo_setup_ok(batch, setup, i)) {
+			plog(LOG_ERROR, "pdo_setup: Could not read 0x%x of node %d",
+			     pdo_map_index(i), nodeid);
+			continue;
+		}
+
+		uint32_t mapping[PDO_MAP_ENTRIES_MAX];
+
+		for (size_t j = 0; j < setup->n_items[i]; ++j) {
+			const struct sdo_batch_item* item =
+				sdo_batch_get_item(batch, setup->first_item[i] + j);
+			mapping[j] = 0;
+			byteorder2(&mapping[j], item->data.data,
+				   sizeof(mapping[j]), item->data.index);
+		}
+
+		compile_pdo_map(setup->node, i, mapping, setup->n_items[i]);
+	}
+
+	finish_pdo_setup(setup);
+}
+
+static void on_pdo_setup_done(struct sdo_future* future)
+{
+	struct pdo_setup* setup = get_pdo_setup(future);
+	if (!setup)
+		return;
+
+	const struct sdo_batch* batch = sdo_future_get_batch(future);
+	struct co_master_node* node = setup->node;
+	int nodeid = co_master_get_node_id(node);
+	struct sdo_batch* next = NULL;
+
+	for (int i = 0; i < PDO_SETUP_COUNT; ++i) {
+		struct pdo_map* map = get_pdo_map(&node->ndrv, i);
+		if (!map)
+			continue;
+
+		if (!is_pdo_setup_ok(batch, setup, i)) {
+			plog(LOG_ERROR, "pdo_setup: Could not %s 0x%x of node %d",
+			     map->has_mapping ? "write" : "read",
+			     pdo_map_index(i), nodeid);
+			continue;
+		}
+
+		if (map->has_mapping) {
+			compile_pdo_map(node, i, map->mapping, map->n_mapping);
+			continue;
+		}
+
+		const struct sdo_batch_item* item =
+			sdo_batch_get_item(batch, setup->first_item[i]);
+		uint8_t count = 0;
+		byteorder2(&count, item->data.data, sizeof(count),
+			   item->data.index);
+
+		if (count == 0 || count > PDO_MAP_ENTRIES_MAX) {
+			compile_pdo_map(node, i, NULL, count);
+			continue;
+		}
+
+		if (!next)
+			next = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+		if (!next)
+			break;
+
+		setup->first_item[i] = next->n_items;
+		setup->n_items[i] = count;
+		setup->is_reading[i] = 1;
+
+		for (int j = 1; j <= count; ++j)
+			if (sdo_batch_add_upload(next, pdo_map_index(i), j) < 0)
+				setup->is_reading[i] = 0;
+	}
+
+	if (!next) {
+		finish_pdo_setup(setup);
+		return;
+	}
+
+	struct sdo_future* read =
+		sdo_future_start(next, sdo_req_queue_get(nodeid));
+	sdo_batch_unref(next);
+	if (!read) {
+		plog(LOG_ERROR, "pdo_setup: Could not read the PDO mapping of node %d",
+		     nodeid);
+		finish_pdo_setup(setup);
+		return;
+	}
+
+	sdo_future_then(read, on_pdo_mapping_read, setup, NULL);
+	sdo_future_unref(read);
+}
+
+/* A single batch writes the mappings that the driver gave and reads the
+ * number of entries of the others. Those are then read with a second batch.
+ */
+static int start_pdo_setup(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	struct pdo_setup* setup = calloc(1, sizeof(*setup));
+	if (!setup)
+		return -1;
+
+	setup->node = node;
+
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	if (!batch)
+		goto batch_failure;
+
+	for (int i = 0; i < PDO_SETUP_COUNT; ++i) {
+		const struct pdo_map* map = get_pdo_map(&node->ndrv, i);
+		if (!map)
+			continue;
+
+		setup->first_item[i] = batch->n_items;
+
+		/* A node that was handed over has the mapping already and
+		 * it cannot be changed while the node is operational
+		 */
+		if (map->has_mapping) {
+			if (!is_warm_node_[nodeid]
+			 && add_pdo_mapping_downloads(batch, i, nodeid,
+							map) < 0)
+				goto failure;
+		} else if (sdo_batch_add_upload(batch, pdo_map_index(i), 0) < 0) {
+			goto failure;
+		}
+
+		setup->n_items[i] = batch->n_items - setup->first_item[i];
+	}
+
+	struct sdo_future* future =
+		sdo_future_start(batch, sdo_req_queue_get(nodeid));
+	if (!future)
+		goto failure;
+
+	sdo_batch_unref(batch);
+
+	node->ndrv.pdo_setup = setup;
+	sdo_future_then(future, on_pdo_setup_done, setup, NULL);
+	sdo_future_unref(future);
+	return 0;
+
+failure:
+	sdo_batch_unref(batch);
+batch_failure:
+	free(setup);
+	return -1;
+}
+
+/* Nodes are started once their mappings are known, unless the driver starts
+ * them itself.
+ */
+static void setup_pdo_maps(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_drv* drv = &node->ndrv;
+
+	if (!has_pdo_maps(drv))
+		return;
+
+	int is_held = !(drv->options & CO_OPT_INHIBIT_START);
+
+	co_timeline_begin(nodeid, CO_TIMELINE_PDO_SETUP);
+
+	if (start_pdo_setup(nodeid) < 0) {
+		plog(LOG_ERROR, "pdo_setup: Could not set up the PDO mapping of node %d",
+		     nodeid);
+		return;
+	}
+
+	if (is_held) {
+		drv->options |= CO_OPT_INHIBIT_START;
+		drv->is_start_held = 1;
+	}
+}
+
+static int load_any_driver(int nodeid)
+{
+	if (load_new_driver(nodeid) >= 0)
+		return 0;
+
+#ifndef NO_MAREL_CODE
+	if (load_legacy_driver(nodeid) >= 0)
+		return 0;
+#endif /* NO_MAREL_CODE */
+
+	return -1;
+}
+
+/* The node may have been replaced by one for which there is a driver */
+static int load_driver_uncached(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	if (!ident->is_identity_unconfirmed)
+		return -1;
+
+	ident->is_identity_unconfirmed = 0;
+	identity_cache_invalidate(nodeid);
+
+	if (read_identity(nodeid) < 0)
+		return -1;
+
+	cfg_load_node(nodeid);
+	apply_quirks(node);
+
+	return load_any_driver(nodeid);
+}
+
+/* Returns 1 if the node has the DCF already, 0 if not and -1 if it cannot
+ * tell because it has no 0x1020.
+ */
+static int read_dcf_verification(const struct co_dcf* dcf, int nodeid)
+{
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	if (!batch)
+		return -1;
+
+	int rc = -1;
+
+	if (co_dcf_add_verify_uploads(batch) < 0
+	 || sdo_batch_start(batch, sdo_req_queue_get(nodeid)) < 0)
+		goto done;
+
+	sdo_batch_wait(batch);
+	rc = co_dcf_is_verified(dcf, batch);
+
+done:
+	sdo_batch_unref(batch);
+	return rc;
+}
+
+static int download_dcf(const struct co_dcf* dcf, int nodeid,
+			enum co_dcf_flags flags,
+			enum sdo_abort_code* abort_code)
+{
+	static const char save[] = { 's', 'a', 'v', 'e' };
+
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_CONFIG,
+						SDO_BATCH_STOP_ON_ERROR);
+	if (!batch)
+		return -1;
+
+	int rc = -1;
+	*abort_code = 0;
+
+	if (co_dcf_add_downloads(dcf, batch, flags, nodeid) < 0)
+		goto done;
+
+	if (cfg.node[nodeid].store_dcf
+	 && sdo_batch_add_download(batch, 0x1010, 1, save, sizeof(save)) < 0)
+		goto done;
+
+	if (sdo_batch_start(batch, sdo_req_queue_get(nodeid)) < 0)
+		goto done;
+
+	sdo_batch_wait(batch);
+
+	for (size_t i = 0; i < batch->n_items; ++i)
+		if (batch->items[i].status != SDO_REQ_OK) {
+			*abort_code = batch->items[i].abort_code;
+			goto done;
+		}
+
+	rc = 0;
+done:
+	sdo_batch_unref(batch);
+	return rc;
+}
+
+/* The configuration in the DCF of a node is downloaded as one batch unless
+ * 0x1020 shows that the node has it already.
+ */
+static int apply_dcf(int nodeid)
+{
+	const char* path = cfg.node[nodeid].dcf_path;
+	if (!path[0])
+		return 0;
+
+	struct co_dcf dcf;
+	if (co_dcf_load(&dcf, path) < 0) {
+		plog(LOG_ERROR, "apply_dcf: Could not load \"%s\" for node %d",
+		     path, nodeid);
+		return -1;
+	}
+
+	int rc = 0;
+	int is_verified = read_dcf_verification(&dcf, nodeid);
+	if (is_verified > 0) {
+		plog(LOG_DEBUG, "apply_dcf: Node %d already has \"%s\"",
+		     nodeid, path);
+		goto done;
+	}
+
+	enum co_dcf_flags flags = is_verified == 0 ? CO_DCF_VERIFY : 0;
+	if (cfg.node[nodeid].use_dcf_object)
+		flags |= CO_DCF_OBJECT;
+
+	enum sdo_abort_code abort_code;
+	rc = download_dcf(&dcf, nodeid, flags, &abort_code);
+
+	if (rc < 0 && flags & CO_DCF_OBJECT
+	 && (abort_code == SDO_ABORT_NEXIST
+	  || abort_code == SDO_ABORT_SUBNEXIST)) {
+		plog(LOG_NOTICE, "apply_dcf: Node %d has no 0x%x; writing each entry instead",
+		     nodeid, CO_DCF_OBJECT_INDEX);
+		rc = download_dcf(&dcf, nodeid, flags & ~CO_DCF_OBJECT,
+				  &abort_code);
+	}
+
+	if (rc < 0)
+		plog(LOG_ERROR, "apply_dcf: Could not download \"%s\" to node %d: %s",
+		     path, nodeid, sdo_strerror(abort_code));
+	else
+		plog(LOG_DEBUG, "apply_dcf: Downloaded %u entries to node %d",
+		     dcf.n_entries, nodeid);
+
+done:
+	co_dcf_destroy(&dcf);
+	return rc;
+}
+
+static int configure_node(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	uint64_t heartbeat_period = cfg.node[nodeid].heartbeat_period;
+	if (cfg.node[nodeid].enable_node_guarding)
+		node->is_heartbeat_supported = set_heartbeat_period(nodeid, heartbeat_period) >= 0;
+
+	/* Before the DCF, which may set up the consumer differently */
+	if (is_master_heartbeat_watched(nodeid)
+	 && set_consumer_heartbeat(nodeid) < 0)
+		plog(LOG_DEBUG, "load_driver: Node %d cannot watch the master heartbeat",
+		     nodeid);
+
+	return apply_dcf(nodeid);
+}
+
+static int load_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	ident->name[0] = '\0';
+	cfg_load_node(nodeid);
+	apply_quirks(node);
+
+	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
+		plog(LOG_ERROR, "load_driver: A driver is already loaded for node %d",
+		     nodeid);
+		return -1;
+	}
+
+	ident->is_identity_unconfirmed = 0;
+
+	co_timeline_begin(nodeid, CO_TIMELINE_IDENTITY);
+	int rc = load_handed_over_identity(nodeid) < 0
+	      && load_cached_identity(nodeid) < 0 && read_identity(nodeid) < 0;
+	co_timeline_end(nodeid, CO_TIMELINE_IDENTITY);
+	if (rc)
+		return -1;
+
+	/* Reload config when we have the name of the node */
+	cfg_load_node(nodeid);
+	apply_quirks(node);
+
+	co_timeline_begin(nodeid, CO_TIMELINE_CONFIG);
+
+	if (is_warm_node_[nodeid])
+		/* Configured by the master that handed the node over */
+		node->is_heartbeat_supported = !!(handover_node_[nodeid]->flags
+						  & CO_HANDOVER_NODE_HEARTBEAT);
+	else
+		rc = configure_node(nodeid);
+
+#ifndef NO_MAREL_CODE
+	initialize_info_structure(nodeid);
+
+	load_error_register(nodeid);
+#endif /* NO_MAREL_CODE */
+
+	co_timeline_end(nodeid, CO_TIMELINE_CONFIG);
+
+	if (rc < 0) {
+		if (node->is_heartbeat_supported)
+			turn_off_heartbeat(nodeid);
+
+		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
+		return -1;
+	}
+
+	co_timeline_begin(nodeid, CO_TIMELINE_DRIVER_LOAD);
+	rc = load_any_driver(nodeid) < 0 && load_driver_uncached(nodeid) < 0;
+	co_timeline_end(nodeid, CO_TIMELINE_DRIVER_LOAD);
+
+	if (rc) {
+		if (node->is_heartbeat_supported)
+			turn_off_heartbeat(nodeid);
+
+		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
+		plog(LOG_NOTICE, "load_driver: There is no driver available for \"%s\" at id %d",
+		     ident->name, nodeid);
+		return -1;
+	}
+
+	plog(LOG_DEBUG, "load_driver: Successfully loaded %s for \"%s\" at id %d",
+	     driver_type_str(node->driver_type), ident->name, nodeid);
+
+	return 0;
+
+}
+
+#ifndef NO_MAREL_CODE
+static int initialize_legacy_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+	struct canopen_info* info = canopen_info_get(nodeid);
+
+	int rc = legacy_driver_iface_initialize(node->driver);
+	if (rc >= 0) {
+		info->is_active = 1;
+		info->last_seen = time(NULL);
+	} else {
+		if (node->is_heartbeat_supported)
+			turn_off_heartbeat(nodeid);
+
+		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
+
+		plog(LOG_ERROR, "initialize_legacy_driver: Failed to initialize \"%s\" with id %d",
+		     ident->name, nodeid);
+
+		unload_legacy_module(node->device_type, node->driver);
+		legacy_master_iface_delete(node->master_iface);
+		node->driver = NULL;
+		node->master_iface = NULL;
+		node->driver_type = CO_MASTER_DRIVER_NONE;
+	}
+
+	return rc;
+}
+#endif /* NO_MAREL_CODE */
+
+/* Leaves the NMT state of the node alone if the driver fails */
+static int try_initialize_new_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+	int rc = co_drv_init(&node->ndrv);
+	if (rc < 0) {
+		plog(LOG_ERROR, "initialize_new_driver: Failed to initialize \"%s\" with id %d",
+		     ident->name, nodeid);
+
+		co_drv_unload(&node->ndrv);
+		node->driver_type = CO_MASTER_DRIVER_NONE;
+		return rc;
+	}
+
+#ifndef NO_MAREL_CODE
+	struct canopen_info* info = canopen_info_get(nodeid);
+	info->is_active = 1;
+	info->last_seen = time(NULL);
+#endif /* NO_MAREL_CODE */
+
+	setup_pdo_maps(nodeid);
+
+	if (master_state_ == MASTER_STATE_STARTUP
+	 && node->ndrv.options & CO_OPT_INHIBIT_START)
+		++n_inhibited_starts;
+
+	return rc;
+}
+
+/* A node without a driver is stopped rather than left running unattended */
+static void stop_driverless_node(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	if (node->is_heartbeat_supported)
+		turn_off_heartbeat(nodeid);
+
+	co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
+}
+
+static int initialize_new_driver(int nodeid)
+{
+	int rc = try_initialize_new_driver(nodeid);
+	if (rc < 0)
+		stop_driverless_node(nodeid);
+
+	return rc;
+}
+
+static int initialize_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	switch (node->driver_type) {
+	case CO_MASTER_DRIVER_NEW:
+		return initialize_new_driver(nodeid);
+#ifndef NO_MAREL_CODE
+	case CO_MASTER_DRIVER_LEGACY:
+		return initialize_legacy_driver(nodeid);
+#endif /* NO_MAREL_CODE */
+	case CO_MASTER_DRIVER_NONE:
+		return -1;
+	default:
+		abort();
+		break;
+	}
+}
+
+static void run_load_driver(struct mloop_work* self)
+{
+	struct co_master_node* node = mloop_work_get_context(self);
+	int nodeid = co_master_get_node_id(node);
+	load_driver(nodeid);
+	node->is_loading = 0;
+}
+
+static void call_start_fn(struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+	co_start_fn start_fn;
+
+	if (node->driver_type == CO_MASTER_DRIVER_NONE)
+		return;
+
+	co_timeline_begin(nodeid, CO_TIMELINE_START);
+
+	switch (node->driver_type) {
+	case CO_MASTER_DRIVER_NEW:
+		start_fn = node->ndrv.start_fn;
+		if (start_fn)
+			start_fn(&node->ndrv);
+		break;
+#ifndef NO_MAREL_CODE
+	case CO_MASTER_DRIVER_LEGACY:
+		legacy_driver_iface_process_node_state(node->driver, 1);
+		break;
+#endif /* NO_MAREL_CODE */
+	case CO_MASTER_DRIVER_NONE:
+		break;
+	}
+
+	co_timeline_end(nodeid, CO_TIMELINE_START);
+}
+
+static void start_single_node(struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+	tx_stage_nmt(NMT_CS_START, nodeid);
+	start_nodeguarding(nodeid);
+	call_start_fn(node);
+}
+
+static void finish_load_driver(struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	if (node->driver_type == CO_MASTER_DRIVER_NONE)
+		return;
+
+	co_timeline_begin(nodeid, CO_TIMELINE_INIT);
+	int rc = initialize_driver(nodeid);
+	co_timeline_end(nodeid, CO_TIMELINE_INIT);
+	if (rc < 0)
+		return;
+
+	node->is_initialized = 1;
+	load_sdo_channels(nodeid);
+	load_tpdo_on_change(nodeid);
+	mux_table_update(nodeid);
+	update_filters();
+
+	if (ident->is_identity_unconfirmed)
+		confirm_identity(nodeid);
+
+	if (master_state_ == MASTER_STATE_STARTUP)
+		return;
+
+	if (node->driver_type == CO_MASTER_DRIVER_NEW
+	 && node->ndrv.options & CO_OPT_INHIBIT_START)
+		return;
+
+	start_single_node(node);
+}
+
+static void on_load_driver_done(struct mloop_work* self)
+{
+	struct co_master_node* node = mloop_work_get_context(self);
+
+	--n_scheduled_bootups;
+
+	finish_load_driver(node);
+
+	/* Later reloads start from scratch */
+	int nodeid = co_master_get_node_id(node);
+	handover_node_[nodeid] = NULL;
+	is_warm_node_[nodeid] = 0;
+
+	if (n_scheduled_bootups == 0)
+		save_identity_cache();
+
+	check_bootup_done();
+}
+
+static int schedule_load_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	if (node->is_loading)
+		return 0;
+
+	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
+		if (!node->is_initialized)
+			return -1;
+
+		unload_driver(nodeid);
+	}
+
+	struct mloop_work* work = mloop_work_new(mloop_default());
+	if (!work)
+		return -1;
+
+	mloop_work_set_context(work, node, NULL);
+	mloop_work_set_work_fn(work, run_load_driver);
+	mloop_work_set_done_fn(work, on_load_driver_done);
+
+	int rc = mloop_work_start(work);
+	if (rc >= 0)
+		++n_scheduled_bootups;
+
+	mloop_work_unref(work);
+
+	node->is_loading = 1;
+
+	return rc;
+}
+
+/* The mux table must not call into the driver while it is being replaced */
+static void suspend_new_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	node->is_initialized = 0;
+	mux_table_update(nodeid);
+
+	struct sdo_req_queue* sdo_queue = sdo_req_queue_find(nodeid);
+	if (sdo_queue)
+		sdo_req_queue_flush(sdo_queue);
+
+	co_drv_unload(&node->ndrv);
+	node->driver_type = CO_MASTER_DRIVER_NONE;
+}
+
+/* Unlike finish_load_driver(), this leaves the NMT state of the node alone */
+static int resume_new_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_ident* ident = co_master_get_ident(nodeid);
+
+	if (load_new_driver(nodeid) < 0) {
+		plog(LOG_ERROR, "reload_driver: Failed to load a driver for \"%s\" at id %d",
+		     ident->name, nodeid);
+		mux_table_update(nodeid);
+		update_filters();
+		return -1;
+	}
+
+	if (try_initialize_new_driver(nodeid) < 0) {
+		mux_table_update(nodeid);
+		update_filters();
+		return -1;
+	}
+
+	node->is_initialized = 1;
+	mux_table_update(nodeid);
+	update_filters();
+
+	if (master_state_ != MASTER_STATE_STARTUP
+	 && !(node->ndrv.options & CO_OPT_INHIBIT_START))
+		call_start_fn(node);
+
+	return 0;
+}
+
+/* Returns the number of nodes that were using the DSO, or -1 if they could
+ * not all be moved to the new one
+ */
+static int reload_dso(void* dso)
+{
+	int nodes[CANOPEN_NODEID_MAX + 1];
+	int i, n = 0;
+
+	for_each_node(i) {
+		struct co_master_node* node = co_master_get_node(i);
+
+		if (node->driver_type != CO_MASTER_DRIVER_NEW
+		 || node->ndrv.dso != dso)
+			continue;
+
+		/* Still being initialized */
+		if (!node->is_initialized)
+			return -1;
+
+		nodes[n++] = i;
+	}
+
+	for (i = 0; i < n; ++i)
+		suspend_new_driver(nodes[i]);
+
+	co_drv_registry_begin_reload(dso);
+
+	for (i = 0; i < n; ++i)
+		if (resume_new_driver(nodes[i]) < 0)
+			break;
+
+	if (i == n) {
+		co_drv_registry_commit_reload(dso);
+		return n;
+	}
+
+	/* The old driver is still open, so the nodes go back to it */
+	plog(LOG_ERROR, "reload_driver: Keeping the old driver for %d node(s)",
+	     n);
+
+	while (i--)
+		suspend_new_driver(nodes[i]);
+
+	co_drv_registry_revert_reload(dso);
+
+	for (i = 0; i < n; ++i)
+		if (resume_new_driver(nodes[i]) < 0)
+			stop_driverless_node(nodes[i]);
+
+	return -1;
+}
+
+int co_master_reload_driver(const char* name)
+{
+	int i;
+
+	/* Drivers that are being loaded may hold on to the old DSO */
+	for_each_node(i)
+		if (co_master_get_node(i)->is_loading)
+			return -1;
+
+	if (name) {
+		void* dso = co_drv_registry_peek(name);
+		return dso ? reload_dso(dso) : -1;
+	}
+
+	int n = 0;
+	char is_done[CANOPEN_NODEID_MAX + 1] = { 0 };
+
+	for_each_node(i) {
+		struct co_master_node* node = co_master_get_node(i);
+
+		if (is_done[i] || node->driver_type != CO_MASTER_DRIVER_NEW)
+			continue;
+
+		void* dso = node->ndrv.dso;
+
+		for (int j = i; j <= nodeid_max(); ++j)
+			if (co_master_get_node(j)->driver_type
+					== CO_MASTER_DRIVER_NEW
+			 && co_master_get_node(j)->ndrv.dso == dso)
+				is_done[j] = 1;
+
+		int rc = reload_dso(dso);
+		if (rc > 0)
+			n += rc;
+	}
+
+	return n;
+}
+
+static inline int is_looking_for_nodes(void)
+{
+	return master_state_ == MASTER_STATE_STARTUP
+	    && bootup_phase_ > BOOTUP_PHASE_LSS
+	    && bootup_phase_ < BOOTUP_PHASE_LOAD;
+}
+
+/* Every new node keeps the current bootup phase going a little longer */
+static int handle_node_found(struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+
+	if (nodes_seen_[nodeid])
+		return 0;
+
+	nodes_seen_[nodeid] = 1;
+	co_timeline_end(nodeid, CO_TIMELINE_PROBE);
+
+	mloop_timer_stop(bootup_timer_);
+	mloop_timer_start(bootup_timer_);
+
+	if (sdo_probe_pending_[nodeid])
+		return 0;
+
+	return schedule_load_driver(nodeid);
+}
+
+static int is_sdo_probe_response(const struct can_frame* cf)
+{
+	int cs = sdo_get_cs(cf);
+
+	return (cs == SDO_SCS_UL_INIT_RES || cs == SDO_SCS_ABORT)
+	    && sdo_get_index(cf) == 0x1000 && sdo_get_subindex(cf) == 0;
+}
+
+/* An abort is as good as an answer; the node is there */
+static int handle_sdo_probe_response(struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+
+	sdo_probe_pending_[nodeid] = 0;
+
+	if (!is_looking_for_nodes())
+		return 0;
+
+	if (nodes_seen_[nodeid])
+		return schedule_load_driver(nodeid);
+
+	return handle_node_found(node);
+}
+
+/* Nodes that answered the heartbeat request but not the SDO are loaded now */
+static void finish_sdo_probe(void)
+{
+	int i;
+	for_each_node(i) {
+		if (!sdo_probe_pending_[i])
+			continue;
+
+		sdo_probe_pending_[i] = 0;
+
+		if (nodes_seen_[i])
+			schedule_load_driver(i);
+	}
+}
+
+static int handle_bootup(struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+
+	/* The node may have been replaced or updated */
+	sdo_cache_invalidate_node(nodeid);
+
+	if (is_looking_for_nodes())
+		return handle_node_found(node);
+
+	if (master_state_ == MASTER_STATE_STARTUP) {
+		/* Every node is reset once the LSS scan is done */
+		if (bootup_phase_ != BOOTUP_PHASE_LSS)
+			nodes_seen_late_[nodeid] = 1;
+		return 0;
+	}
+
+	return schedule_load_driver(nodeid);
+}
+
+static void log_emcy(struct co_master_node* node, struct co_emcy* emcy)
+{
+	int level = emcy->code != 0 ? LOG_EMERG : LOG_NOTICE;
+	int profile = co_master_get_device_profile(node);
+	int nodeid = co_master_get_node_id(node);
+
+	co_log(level, CO_LOG_KEY(CO_LOG_EMCY, nodeid, emcy->code),
+	       "Node %d: Code 0x%04x: %s", nodeid, emcy->code,
+	       error_code_to_string(emcy->code, profile));
+}
+
+static void run_new_emcy(struct co_drv* drv, const struct co_drv_job* job)
+{
+	struct co_emcy emcy = *job->emcy;
+	drv->emcy_fn(drv, &emcy);
+}
+
+static int handle_emcy(struct co_master_node* node,
+		       const struct canfd_frame* cfd)
+{
+	const struct can_frame* frame = canfd_as_can_frame(cfd);
+
+	if (frame->can_dlc == 0)
+		return handle_bootup(node);
+
+	uint32_t error_register = emcy_get_register(frame);
+
+	int nodeid = co_master_get_node_id(node);
+
+#ifndef NO_MAREL_CODE
+	canopen_info_get(nodeid)->error_register = error_register;
+
+	struct canopen_node_diag* diag = canopen_node_diag_get(nodeid);
+	diag->emcy_last_code = emcy_get_code(frame);
+	diag->emcy_last_register = error_register;
+	++diag->emcy_count;
+#endif /* NO_MAREL_CODE */
+
+	struct co_emcy emcy = {
+		.code = emcy_get_code(frame),
+		.reg = error_register,
+		.manufacturer_error = emcy_get_manufacturer_error(frame)
+	};
+
+	if (node->driver_type != CO_MASTER_DRIVER_NONE)
+		log_emcy(node, &emcy);
+
+	if (!co_emcy_limit_check(&node->emcy_limit, &emcy_limit_config_,
+				 emcy.code, emcy.reg, mux_timestamp_))
+		return 0;
+
+	events_rest_on_emcy(nodeid, &emcy);
+
+	switch (node->driver_type) {
+	case CO_MASTER_DRIVER_NONE:
+		return -1;
+#ifndef NO_MAREL_CODE
+	case CO_MASTER_DRIVER_LEGACY: {
+		uint64_t start = fastclock_us();
+		legacy_driver_iface_process_emr(node->driver, emcy.code,
+						emcy.reg,
+						emcy.manufacturer_error);
+		co_drv_watchdog_check(&node->watchdog, nodeid, "EMCY", start);
+		break;
+	}
+#endif /* NO_MAREL_CODE */
+	case CO_MASTER_DRIVER_NEW:
+		if (node->ndrv.emcy_fn) {
+			struct co_drv_job job = {
+				.fn = run_new_emcy,
+				.what = "EMCY",
+				.timestamp = mux_timestamp_,
+				.emcy = &emcy,
+			};
+
+			co_drv_exec_run(&node->ndrv, &job);
+		}
+		break;
+	}
+
+	return 0;
+}
+
+#ifndef NO_MAREL_CODE
+static void update_node_diag(const struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+	struct canopen_node_diag* diag = canopen_node_diag_get(nodeid);
+
+	for (int i = 0; i < CO_STATS_FUNCTION_COUNT; ++i) {
+		diag->rx_frames[i] = co_stats_get_rx((i << 7) | nodeid);
+		diag->tx_frames[i] = co_stats_get_tx((i << 7) | nodeid);
+	}
+
+	const struct sdo_req_queue* queue = sdo_req_queue_find(nodeid);
+	if (queue) {
+		diag->sdo_ok = queue->n_ok;
+		diag->sdo_aborts = queue->n_aborts;
+		diag->sdo_timeouts = queue->n_timeouts;
+		diag->sdo_rtt_avg = queue->n_rtts
+				  ? queue->rtt_total / queue->n_rtts : 0;
+		diag->sdo_rtt_max = queue->rtt_max;
+	}
+
+	diag->emcy_aggregated = node->emcy_limit.n_aggregated;
+	diag->emcy_dropped = node->emcy_limit.n_dropped;
+
+	diag->callback_time_max = node->watchdog.max_time;
+	diag->callback_overruns = node->watchdog.n_overruns;
+	diag->callback_dropped = node->watchdog.n_dropped;
+}
+#endif /* NO_MAREL_CODE */
+
+static int handle_heartbeat(struct co_master_node* node,
+			     const struct canfd_frame* cfd)
+{
+	const struct can_frame* frame = canfd_as_can_frame(cfd);
+
+	int nodeid = co_master_get_node_id(node);
+
+	if (!heartbeat_is_valid(frame))
+		return -1;
+
+	events_rest_on_nmt(nodeid, heartbeat_get_state(frame));
+
+	struct sdo_req_queue* sdo_queue = sdo_req_queue_find(nodeid);
+	if (sdo_queue && sdo_queue->is_lost)
+		sdo_req_queue_set_lost(sdo_queue, 0);
+
+	if (heartbeat_is_bootup(frame)
+	 && !cfg.node[nodeid].has_zero_guard_status)
+		return handle_bootup(node);
+
+	if (is_looking_for_nodes())
+		return handle_node_found(node);
+
+	if (master_state_ == MASTER_STATE_STARTUP)
+		return 0;
+
+	/* This can happen if the CAN bus is disconnected but not the power to
+	 * the node. We reset communication to refresh the state.
+	 */
+	if (node->driver_type == CO_MASTER_DRIVER_NONE) {
+		if (heartbeat_get_state(frame) != NMT_STATE_STOPPED
+		 && !node->is_loading)
+			co_net_send_nmt(&socket_, NMT_CS_RESET_COMMUNICATION,
+					nodeid);
+
+		return 0;
+	}
+
+	if (!node->is_initialized)
+		return -1;
+
+	restart_heartbeat_timer(nodeid);
+
+	/* Make sure the node is in operational state */
+	if (heartbeat_get_state(frame) != NMT_STATE_OPERATIONAL)
+		tx_stage_nmt(NMT_CS_START, nodeid);
+
+#ifndef NO_MAREL_CODE
+	struct canopen_info* info = canopen_info_get(nodeid);
+	info->last_seen = fastclock_realtime_us() / 1000000ULL;
+	info->skipped_heartbeats = 0;
+	info->rx_frames = 0;
+	info->tx_frames = 0;
+	for (int i = 0; i < CO_STATS_FUNCTION_COUNT; ++i) {
+		info->rx_frames += co_stats_get_rx((i << 7) | nodeid);
+		info->tx_frames += co_stats_get_tx((i << 7) | nodeid);
+	}
+
+	update_node_diag(node);
+#endif /* NO_MAREL_CODE */
+
+	return 0;
+}
+
+static int handle_sdo(struct co_master_node* node,
+		      const struct canfd_frame* cf)
+{
+	int nodeid = co_master_get_node_id(node);
+
+	if (sdo_probe_pending_[nodeid]
+	 && is_sdo_probe_response(canfd_as_can_frame(cf)))
+		return handle_sdo_probe_response(node);
+
+	struct sdo_req_queue* queue = sdo_req_queue_find(nodeid);
+	if (!queue)
+		return -1;
+
+	struct sdo_async* sdo_proc = sdo_req_queue_find_channel(queue,
+								cf->can_id);
+	if (!sdo_proc)
+		return -1;
+
+	return sdo_async_feed(sdo_proc, canfd_as_can_frame(cf));
+}
+
+static int handle_lss(struct co_master_node* node,
+		      const struct canfd_frame* cf)
+{
+	(void)node;
+	return co_lss_feed(&lss_, canfd_as_can_frame(cf));
+}
+
+static int handle_nmt(struct co_master_node* node,
+		      const struct canfd_frame* cf)
+{
+	(void)node;
+
+	/* On a shared bus, the shards send NMT to their own nodes and the owner
+	 * looks out for other masters on behalf of all of them.
+	 */
+	if (shard_role_ == SHARD_ROLE_SHARD)
+		return 0;
+
+	int nodeid = cf->data[1];
+	if (shard_role_ == SHARD_ROLE_OWNER && nodeid != 0
+	 && (nodeid < nodeid_min() || nodeid > nodeid_max()))
+		return 0;
+
+	plog(LOG_ALERT, "Received NMT! Another CANopen master is not allowed on the bus!");
+	return 0;
+}
+
+/* Returns 1 if the payload is the same as last time and stores it otherwise */
+static inline int is_pdo_unchanged(struct co_pdo_last* last,
+				   const struct canfd_frame* cf)
+{
+	if (last->is_valid && last->len == cf->len
+	 && memcmp(last->data, cf->data, cf->len) == 0)
+		return 1;
+
+	last->is_valid = 1;
+	last->len = cf->len;
+	memcpy(last->data, cf->data, cf->len);
+	return 0;
+}
+
+static inline int is_tpdo_on_change(const struct co_master_node* node, int n)
+{
+	return (n <= 4 && node->tpdo_on_change & (1 << (n - 1)))
+	    || node->ndrv.tpdo_on_change[n / 8] & (1 << (n % 8));
+}
+
+/* Counts a TPDO towards the cycle inputs of the driver; cycle is where the
+ * PDO keeps the cycle in which it last arrived
+ */
+static inline void note_cycle_input(struct co_drv* drv, unsigned int* cycle)
+{
+	if (!drv->is_cycle_pending || *cycle == drv->cycle)
+		return;
+
+	*cycle = drv->cycle;
+
+	if (--drv->cycle_missing > 0)
+		return;
+
+	drv->is_cycle_pending = 0;
+	cycle_n_pending_--;
+	cycle_ready_[cycle_n_ready_++] = drv;
+}
+
+#define MAKE_NEW_DRIVER_PDO_HANDLER(n) \
+static void run_new_tpdo ## n(struct co_drv* drv, \
+			      const struct co_drv_job* job) \
+{ \
+	struct pdo_map* map = drv->tpdo_map[n - 1]; \
+	if (map && pdo_map_decode(map, job->data, job->size) >= 0 \
+	 && drv->tpdo_signal_fn[n - 1]) \
+		drv->tpdo_signal_fn[n - 1](drv, map->signal, map->n_entries, \
+					   job->timestamp); \
+	if (drv->pdo ## n ## _ts_fn) \
+		drv->pdo ## n ## _ts_fn(drv, job->data, job->size, \
+					job->timestamp); \
+	else if (drv->pdo ## n ## _fn) \
+		drv->pdo ## n ## _fn(drv, job->data, job->size); \
+} \
+\
+static int handle_new_tpdo ## n(struct co_master_node* node, \
+				const struct canfd_frame* cf) \
+{ \
+	if (node->ndrv.cycle_inputs & (1 << (n - 1))) \
+		note_cycle_input(&node->ndrv, &node->ndrv.tpdo_cycle[n - 1]); \
+	if (is_tpdo_on_change(node, n) \
+	 && is_pdo_unchanged(&node->tpdo_last[n - 1], cf)) \
+		return 0; \
+	struct co_drv_job job = { \
+		.fn = run_new_tpdo ## n, \
+		.what = "TPDO" #n, \
+		.timestamp = mux_timestamp_, \
+		.data = cf->data, \
+		.size = cf->len, \
+	}; \
+	co_drv_exec_run(&node->ndrv, &job); \
+	queue_pdo_batch(node, n, cf); \
+	return 0; \
+}
+
+MAKE_NEW_DRIVER_PDO_HANDLER(1)
+MAKE_NEW_DRIVER_PDO_HANDLER(2)
+MAKE_NEW_DRIVER_PDO_HANDLER(3)
+MAKE_NEW_DRIVER_PDO_HANDLER(4)
+
+static void run_new_tpdo(struct co_drv* drv, const struct co_drv_job* job)
+{
+	drv->tpdo[job->n].fn(drv, job->data, job->size, job->timestamp);
+}
+
+static int handle_new_tpdo(struct co_master_node* node,
+			   const struct canfd_frame* cf)
+{
+	struct co_drv* drv = &node->ndrv;
+	if (mux_pdo_ >= drv->n_tpdos)
+		return -1;
+
+	struct co_drv_pdo* pdo = &drv->tpdo[mux_pdo_];
+	note_cycle_input(drv, &pdo->cycle);
+
+	if (is_tpdo_on_change(node, pdo->n) && is_pdo_unchanged(&pdo->last, cf))
+		return 0;
+
+	struct co_drv_job job = {
+		.fn = run_new_tpdo,
+		.what = "TPDO",
+		.n = mux_pdo_,
+		.timestamp = mux_timestamp_,
+		.data = cf->data,
+		.size = cf->len,
+	};
+
+	co_drv_exec_run(drv, &job);
+	queue_pdo_batch(node, pdo->n, cf);
+	return 0;
+}
+
+/* Frames for co_set_pdo_batch_fn() are collected by jobs of their own so that
+ * they stay in order with the other callbacks, on whichever thread runs them.
+ * Each node that got any is sent a job at the end of the receive batch which
+ * passes them on.
+ */
+static struct co_master_node* pdo_batch_node_[CANOPEN_NODEID_MAX + 1];
+static size_t pdo_batch_n_nodes_ = 0;
+
+static void deliver_pdo_batch(struct co_drv* drv, unsigned int sync_count)
+{
+	struct co_pdo_batch* batch = drv->pdo_batch;
+
+	size_t n_frames = batch->n_frames;
+	batch->n_frames = 0;
+
+	if (n_frames > 0 && drv->pdo_batch_fn)
+		drv->pdo_batch_fn(drv, batch->frame, n_frames, sync_count);
+}
+
+static void run_pdo_batch_add(struct co_drv* drv, const struct co_drv_job* job)
+{
+	struct co_pdo_batch* batch = drv->pdo_batch;
+
+	if (batch->n_frames >= CO_PDO_BATCH_MAX)
+		deliver_pdo_batch(drv, __atomic_load_n(&sync_count_,
+						       __ATOMIC_RELAXED));
+
+	size_t i = batch->n_frames++;
+	size_t size = MIN(job->size, sizeof(batch->data[i]));
+	memcpy(batch->data[i], job->data, size);
+
+	struct co_pdo_frame* frame = &batch->frame[i];
+	frame->n = job->n;
+	frame->timestamp = job->timestamp;
+	frame->data = batch->data[i];
+	frame->size = size;
+}
+
+static void run_pdo_batch_flush(struct co_drv* drv,
+				const struct co_drv_job* job)
+{
+	deliver_pdo_batch(drv, (unsigned int)job->n);
+}
+
+static void queue_pdo_batch(struct co_master_node* node, int n,
+			    const struct canfd_frame* cf)
+{
+	struct co_drv* drv = &node->ndrv;
+	if (!drv->pdo_batch_fn)
+		return;
+
+	struct co_drv_job job = {
+		.fn = run_pdo_batch_add,
+		.what = "TPDO batch",
+		.n = n,
+		.timestamp = mux_timestamp_,
+		.data = cf->data,
+		.size = cf->len,
+	};
+
+	co_drv_exec_run(drv, &job);
+
+	if (!drv->is_pdo_batch_pending) {
+		drv->is_pdo_batch_pending = 1;
+		pdo_batch_node_[pdo_batch_n_nodes_++] = node;
+	}
+}
+
+static void flush_pdo_batches(void)
+{
+	unsigned int sync_count = __atomic_load_n(&sync_count_,
+						  __ATOMIC_RELAXED);
+
+	for (size_t i = 0; i < pdo_batch_n_nodes_; ++i) {
+		struct co_drv* drv = &pdo_batch_node_[i]->ndrv;
+
+		/* The driver may have been unloaded in the meantime */
+		if (!drv->is_pdo_batch_pending)
+			continue;
+
+		drv->is_pdo_batch_pending = 0;
+
+		struct co_drv_job job = {
+			.fn = run_pdo_batch_flush,
+			.what = "TPDO batch",
+			.n = (int)sync_count,
+		};
+
+		co_drv_exec_run(drv, &job);
+	}
+
+	pdo_batch_n_nodes_ = 0;
+}
+
+/* TPDOs 1-4 are inputs if the driver has a callback for them */
+static int count_cycle_inputs(struct co_drv* drv)
+{
+	unsigned int inputs = 0;
+
+	if (drv->pdo1_fn || drv->pdo1_ts_fn)
+		inputs |= 1 << 0;
+	if (drv->pdo2_fn || drv->pdo2_ts_fn)
+		inputs |= 1 << 1;
+	if (drv->pdo3_fn || drv->pdo3_ts_fn)
+		inputs |= 1 << 2;
+	if (drv->pdo4_fn || drv->pdo4_ts_fn)
+		inputs |= 1 << 3;
+
+	for (int i = 0; i < 4; ++i)
+		if (drv->tpdo_signal_fn[i])
+			inputs |= 1 << i;
+
+	drv->cycle_inputs = inputs;
+	return __builtin_popcount(inputs) + drv->n_tpdos;
+}
+
+static uint32_t cycle_input_deadline(void)
+{
+	return cfg.cycle_input_deadline ? cfg.cycle_input_deadline
+					: cfg.sync_interval / 2;
+}
+
+static uint32_t cycle_budget(const struct co_drv* drv)
+{
+	if (drv->cycle_budget)
+		return drv->cycle_budget;
+
+	if (cfg.driver_cycle_budget)
+		return cfg.driver_cycle_budget;
+
+	uint32_t deadline = cycle_input_deadline();
+	return cfg.sync_interval > deadline ? cfg.sync_interval - deadline
+					    : cfg.sync_interval;
+}
+
+static void run_ready_cycles(void)
+{
+	if (cycle_n_ready_ == 0)
+		return;
+
+	co_drv_cycle_run(cycle_ready_, cycle_n_ready_, cfg.n_workers);
+	cycle_n_ready_ = 0;
+
+	/* RPDOs sent from the workers go out with those from the main loop */
+	tx_pdo_drain();
+}
+
+/* Drivers that were unloaded in the meantime are no longer pending, so the
+ * count is only a hint that there may be any
+ */
+static void end_cycle_inputs(void)
+{
+	for (int i = nodeid_min(); i <= nodeid_max() && cycle_n_pending_ > 0;
+	     ++i) {
+		struct co_drv* drv = &co_master_get_node(i)->ndrv;
+		if (!drv->is_cycle_pending)
+			continue;
+
+		drv->is_cycle_pending = 0;
+		cycle_ready_[cycle_n_ready_++] = drv;
+	}
+
+	cycle_n_pending_ = 0;
+	run_ready_cycles();
+}
+
+static void on_cycle_deadline(struct mloop_timer* timer)
+{
+	(void)timer;
+	end_cycle_inputs();
+}
+
+static void start_cycle_timer(void)
+{
+	uint32_t deadline = cycle_input_deadline();
+	if (deadline == 0 || cycle_n_pending_ == 0)
+		return;
+
+	if (!cycle_timer_) {
+		cycle_timer_ = mloop_timer_new(mloop_default());
+		if (!cycle_timer_)
+			goto failure;
+
+		mloop_timer_set_callback(cycle_timer_, on_cycle_deadline);
+		mloop_timer_set_type(cycle_timer_, MLOOP_TIMER_RELATIVE
+						 | MLOOP_TIMER_PRECISE);
+	}
+
+	mloop_timer_stop(cycle_timer_);
+	mloop_timer_set_time(cycle_timer_, deadline * 1000ULL);
+
+	if (mloop_timer_start(cycle_timer_) >= 0)
+		return;
+
+failure:
+	plog(LOG_ERROR, "Could not start the cycle input deadline timer");
+	end_cycle_inputs();
+}
+
+/* Drivers that are still waiting for the previous cycle are run first */
+static void begin_cycle(unsigned int sync_count)
+{
+	end_cycle_inputs();
+
+	for (int i = nodeid_min(); i <= nodeid_max(); ++i) {
+		struct co_master_node* node = co_master_get_node(i);
+		struct co_drv* drv = &node->ndrv;
+
+		if (node->driver_type != CO_MASTER_DRIVER_NEW
+		 || !node->is_initialized || !drv->cycle_fn)
+			continue;
+
+		drv->cycle = sync_count;
+		drv->cycle_missing = count_cycle_inputs(drv);
+		node->cycle_watchdog.budget = cycle_budget(drv);
+
+		if (drv->cycle_missing == 0) {
+			cycle_ready_[cycle_n_ready_++] = drv;
+		} else {
+			drv->is_cycle_pending = 1;
+			cycle_n_pending_++;
+		}
+	}
+
+	run_ready_cycles();
+	start_cycle_timer();
+}
+
+static void on_cycle_begin(struct mloop_async* self)
+{
+	(void)self;
+
+	co_atomic_store(&cycle_begin_is_scheduled_, 0);
+	begin_cycle(__atomic_load_n(&sync_count_, __ATOMIC_RELAXED));
+}
+
+/* For SYNCs from the SYNC thread; cycles that are missed in the meantime are
+ * skipped
+ */
+static void schedule_cycle_begin(void)
+{
+	if (co_atomic_exchange(&cycle_begin_is_scheduled_, 1))
+		return;
+
+	struct mloop_async* async = mloop_async_new(mloop_default());
+	if (!async)
+		goto failure;
+
+	mloop_async_set_callback(async, on_cycle_begin);
+
+	int rc = mloop_async_start(async);
+	mloop_async_unref(async);
+
+	if (rc >= 0)
+		return;
+
+failure:
+	co_atomic_store(&cycle_begin_is_scheduled_, 0);
+}
+
+void co__cycle_begin(unsigned int sync_count)
+{
+	begin_cycle(sync_count);
+}
+
+void co__cycle_deadline(void)
+{
+	end_cycle_inputs();
+}
+
+#ifndef NO_MAREL_CODE
+struct legacy_pdo_pending {
+	struct co_master_node* node;
+	struct legacy_pdo_frame frame;
+};
+
+/* Legacy TPDOs are held back until the end of each receive batch so that
+ * every driver gets all of its node's frames in one call. The frame data
+ * points into the receive buffer, which outlives the batch.
+ */
+static struct legacy_pdo_pending legacy_pdo_pending_[MUX_BATCH_SIZE];
+static size_t legacy_pdo_n_pending_ = 0;
+
+static void flush_legacy_pdos(void)
+{
+	struct legacy_pdo_frame frames[MUX_BATCH_SIZE];
+
+	size_t n_pending = legacy_pdo_n_pending_;
+	legacy_pdo_n_pending_ = 0;
+
+	for (size_t i = 0; i < n_pending; ++i) {
+		struct co_master_node* node = legacy_pdo_pending_[i].node;
+		if (!node)
+			continue;
+
+		size_t n = 0;
+
+		for (size_t j = i; j < n_pending; ++j) {
+			struct legacy_pdo_pending* pending =
+				&legacy_pdo_pending_[j];
+
+			if (pending->node != node)
+				continue;
+
+			frames[n++] = pending->frame;
+			pending->node = NULL;
+		}
+
+		if (!node->driver)
+			continue;
+
+		uint64_t start = fastclock_us();
+		legacy_driver_iface_process_pdo_batch(node->driver, frames, n);
+		co_drv_watchdog_check(&node->watchdog,
+				      co_master_get_node_id(node), "TPDO",
+				      start);
+	}
+}
+
+static void queue_legacy_pdo(struct co_master_node* node, int n,
+			     const struct canfd_frame* cf)
+{
+	if (legacy_pdo_n_pending_ >= MUX_BATCH_SIZE)
+		flush_legacy_pdos();
+
+	struct legacy_pdo_pending* pending =
+		&legacy_pdo_pending_[legacy_pdo_n_pending_++];
+
+	pending->node = node;
+	pending->frame.n = n;
+	pending->frame.data = cf->data;
+	pending->frame.size = cf->len;
+}
+
+#define MAKE_LEGACY_PDO_HANDLER(n) \
+static int handle_legacy_tpdo ## n(struct co_master_node* node, \
+				   const struct canfd_frame* cf) \
+{ \
+	if (!node->driver) \
+		return -1; \
+	if (node->tpdo_on_change & (1 << (n - 1)) \
+	 && is_pdo_unchanged(&node->tpdo_last[n - 1], cf)) \
+		return 0; \
+	queue_legacy_pdo(node, n, cf); \
+	return 0; \
+}
+
+MAKE_LEGACY_PDO_HANDLER(1)
+MAKE_LEGACY_PDO_HANDLER(2)
+MAKE_LEGACY_PDO_HANDLER(3)
+MAKE_LEGACY_PDO_HANDLER(4)
+#endif /* NO_MAREL_CODE */
+
+static inline void mux_table_set(uint32_t cob_id, mux_frame_fn fn,
+				 struct co_master_node* node)
+{
+	mux_table_[cob_id].fn = fn;
+	mux_table_[cob_id].node = node;
+	mux_table_[cob_id].pdo = 0;
+}
+
+static void mux_table_update_pdos(struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+
+	for (uint32_t i = 0; i <= CAN_SFF_MASK; ++i)
+		if (mux_table_[i].fn == handle_new_tpdo
+		 && mux_table_[i].node == node)
+			mux_table_set(i, NULL, NULL);
+
+	if (!node->is_initialized || node->driver_type != CO_MASTER_DRIVER_NEW)
+		return;
+
+	for (size_t i = 0; i < node->ndrv.n_tpdos; ++i) {
+		const struct co_drv_pdo* pdo = &node->ndrv.tpdo[i];
+
+		if (mux_table_[pdo->cob_id].fn) {
+			plog(LOG_WARNING, "COB-ID 0x%x of TPDO %d of node %d is already in use",
+			     pdo->cob_id, pdo->n, nodeid);
+			continue;
+		}
+
+		mux_table_set(pdo->cob_id, handle_new_tpdo, node);
+		mux_table_[pdo->cob_id].pdo = i;
+	}
+}
+
+/* This must be called whenever the driver state of a node changes */
+static void mux_table_update(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	mux_frame_fn pdo_fn[4] = { NULL, NULL, NULL, NULL };
+
+	if (node->is_initialized) {
+		switch (node->driver_type) {
+		case CO_MASTER_DRIVER_NEW:
+			pdo_fn[0] = handle_new_tpdo1;
+			pdo_fn[1] = handle_new_tpdo2;
+			pdo_fn[2] = handle_new_tpdo3;
+			pdo_fn[3] = handle_new_tpdo4;
+			break;
+#ifndef NO_MAREL_CODE
+		case CO_MASTER_DRIVER_LEGACY:
+			pdo_fn[0] = handle_legacy_tpdo1;
+			pdo_fn[1] = handle_legacy_tpdo2;
+			pdo_fn[2] = handle_legacy_tpdo3;
+			pdo_fn[3] = handle_legacy_tpdo4;
+			break;
+#endif /* NO_MAREL_CODE */
+		case CO_MASTER_DRIVER_NONE:
+			break;
+		}
+	}
+
+	mux_table_set(R_TPDO1 + nodeid, pdo_fn[0], node);
+	mux_table_set(R_TPDO2 + nodeid, pdo_fn[1], node);
+	mux_table_set(R_TPDO3 + nodeid, pdo_fn[2], node);
+	mux_table_set(R_TPDO4 + nodeid, pdo_fn[3], node);
+	mux_table_set(R_TSDO + nodeid, handle_sdo, node);
+	mux_table_set(R_EMCY + nodeid, handle_emcy, node);
+	mux_table_set(R_HEARTBEAT + nodeid, handle_heartbeat, node);
+
+	struct sdo_req_queue* sdo_queue = sdo_req_queue_find(nodeid);
+	if (sdo_queue)
+		for (size_t i = 1; i < sdo_queue->n_channels; ++i)
+			mux_table_set(sdo_queue->channel[i]->rx_cob_id,
+				      handle_sdo, node);
+
+	mux_table_update_pdos(node);
+}
+
+static void mux_table_init(void)
+{
+	int i;
+
+	memset(mux_table_, 0, sizeof(mux_table_));
+
+	mux_table_set(R_NMT, handle_nmt, NULL);
+	mux_table_set(CO_LSS_SLAVE_COB_ID, handle_lss, NULL);
+
+	for_each_node(i)
+		mux_table_update(i);
+}
+
+/* Additional SDO client channels are given as comma separated pairs of
+ * COB-IDs, e.g. "0x641:0x5c1,0x642:0x5c2". The first COB-ID of a pair carries
+ * requests to the node and the second carries its responses. The node must
+ * have matching SDO server parameters (0x1201 and up).
+ */
+static int parse_sdo_channels(struct sdo_req_channel_info* dst, size_t max,
+			      const char* str)
+{
+	size_t n = 0;
+	char* end;
+
+	while (*str) {
+		if (n >= max)
+			return -1;
+
+		unsigned long tx = strtoul(str, &end, 0);
+		if (end == str || *end != ':')
+			return -1;
+
+		str = end + 1;
+		unsigned long rx = strtoul(str, &end, 0);
+		if (end == str || tx > CAN_SFF_MASK || rx > CAN_SFF_MASK)
+			return -1;
+
+		dst[n].tx_cob_id = tx;
+		dst[n].rx_cob_id = rx;
+		++n;
+
+		if (*end == ',' && end[1] != '\0')
+			++end;
+		else if (*end != '\0')
+			return -1;
+
+		str = end;
+	}
+
+	return n;
+}
+
+static void load_sdo_channels(int nodeid)
+{
+	struct sdo_req_channel_info info[SDO_REQ_CHANNELS_MAX - 1];
+	const char* str = cfg.node[nodeid].sdo_channels;
+
+	if (string_is_empty(str))
+		return;
+
+	int n = parse_sdo_channels(info, ARRAY_LENGTH(info), str);
+	if (n < 0) {
+		plog(LOG_WARNING, "Invalid SDO channel list for node %d: %s",
+		     nodeid, str);
+		return;
+	}
+
+	struct sdo_req_queue* queue = sdo_req_queue_get(nodeid);
+	if (!queue || sdo_req_queue_set_channels(queue, info, n) < 0)
+		plog(LOG_ERROR, "Could not set up SDO channels for node %d",
+		     nodeid);
+}
+
+static void clear_sdo_channels(int nodeid)
+{
+	struct sdo_req_queue* queue = sdo_req_queue_find(nodeid);
+	if (!queue)
+		return;
+
+	for (size_t i = 1; i < queue->n_channels; ++i)
+		mux_table_set(queue->channel[i]->rx_cob_id, NULL, NULL);
+
+	sdo_req_queue_set_channels(queue, NULL, 0);
+}
+
+/* The tpdo_on_change parameter is a comma separated list of TPDOs among 1-4,
+ * e.g. "1,3".
+ */
+static void load_tpdo_on_change(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	const char* str = cfg.node[nodeid].tpdo_on_change;
+
+	node->tpdo_on_change = 0;
+	memset(node->tpdo_last, 0, sizeof(node->tpdo_last));
+
+	while (*str) {
+		char* end = NULL;
+		unsigned long n = strtoul(str, &end, 10);
+
+		if (end == str || n < 1 || n > 4 || (*end && *end != ',')) {
+			plog(LOG_WARNING, "Invalid tpdo_on_change for node %d: \"%s\"",
+			     nodeid, cfg.node[nodeid].tpdo_on_change);
+			node->tpdo_on_change = 0;
+			return;
+		}
+
+		node->tpdo_on_change |= 1 << (n - 1);
+		str = *end ? end + 1 : end;
+	}
+}
+
+/* TPDO 1-4 or, for n = 0, those on COB-IDs of their own */
+static int node_wants_pdo(const struct co_master_node* node, int n)
+{
+	if (!node->is_initialized)
+		return 0;
+
+	switch (node->driver_type) {
+	case CO_MASTER_DRIVER_NEW:
+		switch (n) {
+		case 0: return node->ndrv.n_tpdos > 0;
+		case 1: return node->ndrv.pdo1_fn || node->ndrv.pdo1_ts_fn
+			    || node->ndrv.tpdo_map[0];
+		case 2: return node->ndrv.pdo2_fn || node->ndrv.pdo2_ts_fn
+			    || node->ndrv.tpdo_map[1];
+		case 3: return node->ndrv.pdo3_fn || node->ndrv.pdo3_ts_fn
+			    || node->ndrv.tpdo_map[2];
+		case 4: return node->ndrv.pdo4_fn || node->ndrv.pdo4_ts_fn
+			    || node->ndrv.tpdo_map[3];
+		}
+		break;
+#ifndef NO_MAREL_CODE
+	case CO_MASTER_DRIVER_LEGACY:
+		return 1;
+#endif /* NO_MAREL_CODE */
+	case CO_MASTER_DRIVER_NONE:
+		break;
+	}
+
+	return 0;
+}
+
+static inline void add_filter(struct can_filter* filters, size_t* n,
+			      uint32_t can_id, uint32_t mask)
+{
+	filters[*n].can_id = can_id;
+	filters[*n].can_mask = mask | CAN_EFF_FLAG | CAN_RTR_FLAG;
+	++*n;
+}
+
+static int apply_filters(struct can_filter* filters, size_t n)
+{
+	if (socketcan_apply_filters(socket_.fd, filters, n) < 0) {
+		plog(LOG_WARNING, "Failed to install CAN filters: %m");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Let the kernel drop frames that we have no use for. Objects that are
+ * handled for every node in the range are matched by function code if the
+ * range covers the whole network.
+ */
+static int update_filters(void)
+{
+	static const uint32_t node_objects[] = { R_EMCY, R_TSDO, R_HEARTBEAT };
+	static const uint32_t pdo_objects[] = {
+		R_TPDO1, R_TPDO2, R_TPDO3, R_TPDO4
+	};
+	static const uint32_t function_mask = CAN_SFF_MASK & ~0x7f;
+
+	size_t n = 0, n_extra = 0;
+	int i;
+
+	if (socket_.type != SOCK_TYPE_CAN)
+		return 0;
+
+	/* The owner passes on everything, and shards get it from the owner */
+	if (shard_role_ == SHARD_ROLE_OWNER)
+		return 0;
+
+	if (shard_role_ == SHARD_ROLE_SHARD)
+		return apply_filters(NULL, 0);
+
+	for_each_node(i)
+		if (node_wants_pdo(co_master_get_node(i), 0))
+			n_extra += co_master_get_node(i)->ndrv.n_tpdos;
+
+	struct can_filter* filters = malloc(sizeof(*filters)
+			* (2 + (6 + SDO_REQ_CHANNELS_MAX) * CANOPEN_NODEID_MAX
+			   + n_extra));
+	if (!filters) {
+		plog(LOG_WARNING, "Failed to install CAN filters: %m");
+		return -1;
+	}
+
+	add_filter(filters, &n, R_NMT, CAN_SFF_MASK);
+
+	if (cfg.enable_lss)
+		add_filter(filters, &n, CO_LSS_SLAVE_COB_ID, CAN_SFF_MASK);
+
+	int is_full_range = nodeid_min() == CANOPEN_NODEID_MIN
+			 && nodeid_max() == CANOPEN_NODEID_MAX;
+
+	for (size_t j = 0; j < ARRAY_LENGTH(node_objects); ++j) {
+		if (is_full_range) {
+			add_filter(filters, &n, node_objects[j], function_mask);
+			continue;
+		}
+
+		for_each_node(i)
+			add_filter(filters, &n, node_objects[j] + i,
+				   CAN_SFF_MASK);
+	}
+
+	for_each_node(i)
+		for (size_t j = 0; j < ARRAY_LENGTH(pdo_objects); ++j)
+			if (node_wants_pdo(co_master_get_node(i), j + 1))
+				add_filter(filters, &n, pdo_objects[j] + i,
+					   CAN_SFF_MASK);
+
+	for_each_node(i) {
+		const struct sdo_req_queue* queue = sdo_req_queue_find(i);
+		if (!queue)
+			continue;
+
+		for (size_t j = 1; j < queue->n_channels; ++j)
+			add_filter(filters, &n, queue->channel[j]->rx_cob_id,
+				   CAN_SFF_MASK);
+	}
+
+	for_each_node(i) {
+		const struct co_master_node* node = co_master_get_node(i);
+		if (!node_wants_pdo(node, 0))
+			continue;
+
+		for (size_t j = 0; j < node->ndrv.n_tpdos; ++j)
+			add_filter(filters, &n, node->ndrv.tpdo[j].cob_id,
+				   CAN_SFF_MASK);
+	}
+
+	/* The kernel has a limit; the mux drops what it does not want anyway */
+	if (n > CAN_RAW_FILTER_MAX) {
+		n = 0;
+		add_filter(filters, &n, 0, 0);
+	}
+
+	int rc = apply_filters(filters, n);
+	free(filters);
+	return rc;
+}
+
+void co__update_filters(int nodeid)
+{
+	if (!co_master_get_node(nodeid)->is_initialized)
+		return;
+
+	mux_table_update(nodeid);
+	update_filters();
+}
+
+/* Returns the number of a PDO 1-4 on its predefined COB-ID or 0 */
+static int get_pdo_number(uint32_t first, const struct canfd_frame* cf)
+{
+	uint32_t function = cf->can_id & CAN_SFF_MASK & ~0x7f;
+
+	if (function < first || function > first + 0x300
+	 || (function - first) % 0x100 != 0)
+		return 0;
+
+	return (function - first) / 0x100 + 1;
+}
+
+/* Only PDOs 1-4 on their predefined COB-IDs are in the process image */
+static void process_image_write(enum co_pi_direction direction,
+				const struct canfd_frame* cf, uint64_t timestamp)
+{
+	int n = get_pdo_number(direction == CO_PI_TPDO ? R_TPDO1 : R_RPDO1, cf);
+	if (n == 0)
+		return;
+
+	co_pi_write(direction, cf->can_id & 0x7f, n, cf->data, cf->len,
+		    timestamp);
+}
+
+static void events_write(const struct canfd_frame* cf, uint64_t timestamp)
+{
+	int n = get_pdo_number(R_TPDO1, cf);
+	if (n == 0)
+		return;
+
+	events_rest_on_pdo(cf->can_id & 0x7f, n, cf->data, cf->len,
+			   timestamp);
+}
+
+static void ws_write(const struct canfd_frame* cf, uint64_t timestamp)
+{
+	int n = get_pdo_number(R_TPDO1, cf);
+	if (n == 0)
+		return;
+
+	ws_rest_on_pdo(cf->can_id & 0x7f, n, cf->data, cf->len, timestamp);
+}
+
+static void mux_on_error_frame(const struct canfd_frame* cf,
+			       uint64_t timestamp)
+{
+	if (co_bus_health_on_error_frame(canfd_as_can_frame(cf), timestamp)) {
+		enum co_bus_state state = co_bus_health_get_state(timestamp);
+
+		plog(state == CO_BUS_ERROR_ACTIVE ? LOG_NOTICE : LOG_WARNING,
+		     "CAN bus on %s is %s%s", cfg.iface,
+		     co_bus_state_name(state),
+		     co_bus_is_degraded(state) && cfg.bus_degraded_sdo_rate
+		     ? "; throttling SDO traffic" : "");
+	}
+
+#ifndef NO_MAREL_CODE
+	struct co_bus_health health;
+	co_bus_health_get(&health, timestamp);
+
+	canopen_bus_info_->state = health.state;
+	canopen_bus_info_->error_frames = health.n_error_frames;
+	canopen_bus_info_->tx_timeouts = health.n_tx_timeouts;
+	canopen_bus_info_->lost_arbitration = health.n_lost_arbitration;
+	canopen_bus_info_->error_passive = health.n_error_passive;
+	canopen_bus_info_->bus_off = health.n_bus_off;
+	canopen_bus_info_->tx_error_count = health.tx_error_count;
+	canopen_bus_info_->rx_error_count = health.rx_error_count;
+#endif /* NO_MAREL_CODE */
+}
+
+static void mux_on_frame(const struct canfd_frame* cf, uint64_t timestamp)
+{
+	if (cf->can_id & CAN_ERR_FLAG) {
+		mux_on_error_frame(cf, timestamp);
+		return;
+	}
+
+	/* Frames that are not for us take up the bus too */
+	co_bus_load_count(&bus_load_, cf);
+
+	if (cf->can_id & (CAN_RTR_FLAG | CAN_EFF_FLAG))
+		return;
+
+	mux_timestamp_ = timestamp;
+
+	co_stats_count_rx(cf->can_id, timestamp);
+
+	if (co_pi_is_open())
+		process_image_write(CO_PI_TPDO, cf, timestamp);
+
+	if (events_rest_is_active())
+		events_write(cf, timestamp);
+
+	if (ws_rest_is_active())
+		ws_write(cf, timestamp);
+
+	if (co_latency_is_enabled())
+		co_latency_on_rx(cf->can_id & CAN_SFF_MASK, cf->data, cf->len,
+				 timestamp);
+
+	const struct mux_entry* entry = &mux_table_[cf->can_id & CAN_SFF_MASK];
+	if (entry->fn) {
+		mux_pdo_ = entry->pdo;
+		entry->fn(entry->node, cf);
+	}
+}
+
+static void mux_on_frames(const struct canfd_frame* cf, const uint64_t* ts,
+			  size_t n)
+{
+	mux_now_ = loop_now_us();
+
+	for (size_t i = 0; i < n; ++i)
+		mux_on_frame(&cf[i], ts[i]);
+
+	flush_pdo_batches();
+	run_ready_cycles();
+
+#ifndef NO_MAREL_CODE
+	flush_legacy_pdos();
+#endif /* NO_MAREL_CODE */
+}
+
+void co__mux_on_frames(const struct canfd_frame* cf, const uint64_t* ts,
+		       size_t n)
+{
+	mux_on_frames(cf, ts, n);
+}
+
+static ssize_t mux_recv_batch(struct canfd_frame* cf, uint64_t* ts)
+{
+	if (!shard_client_)
+		return sock_recv_fd_batch(&socket_, cf, ts, MUX_BATCH_SIZE,
+					  MSG_DONTWAIT);
+
+	/* Losing the owner is noticed on the control connection */
+	ssize_t n = co_shard_client_recv(shard_client_, cf, ts,
+					 MUX_BATCH_SIZE);
+	if (n == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return n;
+}
+
+/* Reads at most budget batches so that a flood of frames cannot hold up the
+ * rest of the main loop. Returns 0 if the connection has been closed and
+ * MUX_BATCH_SIZE if the budget ran out before the socket was drained.
+ */
+static ssize_t mux_receive(unsigned int budget)
+{
+	struct canfd_frame cf[MUX_BATCH_SIZE];
+	uint64_t ts[MUX_BATCH_SIZE];
+	ssize_t n = -1;
+
+	for (unsigned int i = 0; i < budget; ++i) {
+		n = mux_recv_batch(cf, ts);
+		if (n <= 0)
+			return n;
+
+		if (shard_owner_)
+			co_shard_owner_publish(shard_owner_, cf, ts, n);
+
+		mux_on_frames(cf, ts, n);
+
+		if (n < MUX_BATCH_SIZE)
+			return n;
+	}
+
+	return n;
+}
+
+static void mux_handler_fn(struct mloop_socket* self)
+{
+	ssize_t n = mux_receive(cfg.mux_budget ? cfg.mux_budget : 1);
+	if (n == 0)
+		mloop_socket_stop(self);
+#ifdef mloop_socket_set_edge_triggered
+	else if (n == MUX_BATCH_SIZE)
+		mloop_socket_continue(self);
+#endif
+}
+
+/* In busy-poll mode the socket is read on every main loop iteration instead
+ * of waiting for epoll to report it. The idle condition always holds, which
+ * also keeps the main loop from ever blocking.
+ */
+static int mux_poll_cond(struct mloop_idle* self)
+{
+	(void)self;
+	return 1;
+}
+
+static void mux_poll_fn(struct mloop_idle* self)
+{
+	if (mux_receive(cfg.mux_budget ? cfg.mux_budget : 1) == 0)
+		mloop_idle_stop(self);
+}
+
+static int init_mux_poller(void)
+{
+	mux_poller_ = mloop_idle_new(mloop_default());
+	if (!mux_poller_)
+		return -1;
+
+	mloop_idle_set_cond_fn(mux_poller_, mux_poll_cond);
+	mloop_idle_set_idle_fn(mux_poller_, mux_poll_fn);
+
+	return mloop_idle_start(mux_poller_);
+}
+
+static int init_multiplexer()
+{
+	mux_table_init();
+
+	update_filters();
+
+	if (cfg.use_busy_poll)
+		return init_mux_poller();
+
+	mux_handler_ = mloop_socket_new(mloop_default());
+	if (!mux_handler_)
+		return -1;
+
+	mloop_socket_set_fd(mux_handler_, shard_client_
+			    ? co_shard_client_get_fd(shard_client_)
+			    : sock_get_poll_fd(&socket_));
+	mloop_socket_set_callback(mux_handler_, mux_handler_fn);
+
+#ifdef mloop_socket_set_edge_triggered
+	/* Only sockets that deliver one frame per read are known to be empty
+	 * after a short batch. Streams and datagrams are buffered by the sock
+	 * layer and a ring may not make a new edge for every completion.
+	 */
+	if (((socket_.type == SOCK_TYPE_CAN && !socket_.uring)
+	  || socket_.type == SOCK_TYPE_UNIX) && !shard_client_)
+		mloop_socket_set_edge_triggered(mux_handler_, 1);
+#endif
+
+	return mloop_socket_start(mux_handler_);
+}
+
+static void shard_owner_fn(struct mloop_socket* self)
+{
+	(void)self;
+	co_shard_owner_process(shard_owner_);
+}
+
+/* Nothing more can be received without the owner */
+static void shard_client_fn(struct mloop_socket* self)
+{
+	plog(LOG_ERROR, "Lost the connection to the shard owner");
+
+	mloop_socket_stop(self);
+
+	if (mux_handler_)
+		mloop_socket_stop(mux_handler_);
+
+	if (mux_poller_)
+		mloop_idle_stop(mux_poller_);
+}
+
+static int shard_role_from_string(const char* str)
+{
+	if (str[0] == '\0')
+		return SHARD_ROLE_NONE;
+
+	if (strcmp(str, "owner") == 0)
+		return SHARD_ROLE_OWNER;
+
+	if (strcmp(str, "shard") == 0)
+		return SHARD_ROLE_SHARD;
+
+	return -1;
+}
+
+/* Shards register before the bootup so that no two masters ever touch the
+ * same node
+ */
+static int init_sharding(void)
+{
+	char path[256];
+
+	int role = shard_role_from_string(cfg.shard_role);
+	if (role < 0) {
+		plog(LOG_ERROR, "Unknown shard_role \"%s\"", cfg.shard_role);
+		return -1;
+	}
+
+	shard_role_ = role;
+	if (shard_role_ == SHARD_ROLE_NONE)
+		return 0;
+
+	if (socket_.type != SOCK_TYPE_CAN) {
+		plog(LOG_ERROR, "Sharding is only supported on CAN interfaces");
+		return -1;
+	}
+
+	if (cfg.shard_path[0])
+		strlcpy(path, cfg.shard_path, sizeof(path));
+	else
+		snprintf(path, sizeof(path), "@canopen-shard.%s", cfg.iface);
+
+	shard_handler_ = mloop_socket_new(mloop_default());
+	if (!shard_handler_)
+		return -1;
+
+	if (shard_role_ == SHARD_ROLE_OWNER) {
+		shard_owner_ = co_shard_owner_new(path, nodeid_min(),
+						  nodeid_max());
+		if (!shard_owner_) {
+			plog(LOG_ERROR, "Could not listen for shards on %s: %s",
+			     path, strerror(errno));
+			return -1;
+		}
+
+		mloop_socket_set_fd(shard_handler_,
+				    co_shard_owner_get_fd(shard_owner_));
+		mloop_socket_set_callback(shard_handler_, shard_owner_fn);
+	} else {
+		shard_client_ = co_shard_client_open(path, nodeid_min(),
+						     nodeid_max());
+		if (!shard_client_) {
+			plog(LOG_ERROR, "Could not register nodes %d-%d with the shard owner on %s: %s",
+			     nodeid_min(), nodeid_max(), path, strerror(errno));
+			return -1;
+		}
+
+		mloop_socket_set_fd(shard_handler_,
+			co_shard_client_get_control_fd(shard_client_));
+		mloop_socket_set_callback(shard_handler_, shard_client_fn);
+	}
+
+	return mloop_socket_start(shard_handler_);
+}
+
+static void cleanup_sharding(void)
+{
+	if (shard_handler_) {
+		mloop_socket_stop(shard_handler_);
+		mloop_socket_set_fd(shard_handler_, -1);
+		mloop_socket_unref(shard_handler_);
+		shard_handler_ = NULL;
+	}
+
+	co_shard_owner_free(shard_owner_);
+	shard_owner_ = NULL;
+
+	co_shard_client_close(shard_client_);
+	shard_client_ = NULL;
+}
+
+static void load_late_nodes(void)
+{
+	int i;
+	for_each_node(i)
+		if (nodes_seen_late_[i]) {
+			co_log(LOG_WARNING, CO_LOG_KEY(CO_LOG_LATE_NODE, i, 0),
+			       "Node %d was late", i);
+			schedule_load_driver(i);
+		}
+}
+
+static int push_time_nolock(struct tx_queue* queue)
+{
+	struct can_frame cf = { .can_id = R_TIMESTAMP };
+	timestamp_set(&cf, gettime_us(CLOCK_REALTIME));
+
+	struct canfd_frame cfd;
+	memcpy(&cfd, &cf, sizeof(cf));
+	cfd.flags = 0;
+
+	return tx_push_nolock(queue, &cfd);
+}
+
+/* While SYNC is being sent, TIME follows the first SYNC of each interval */
+static void send_time_on_sync_nolock(struct tx_queue* queue)
+{
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+	if (now < time_next_us_)
+		return;
+
+	push_time_nolock(queue);
+	time_next_us_ = now + cfg.time_interval * 1000ULL;
+}
+
+static void on_time(struct mloop_timer* self)
+{
+	(void)self;
+
+	pthread_mutex_lock(&tx_stage_lock_);
+	push_time_nolock(&tx_queue_[TX_CLASS_NMT]);
+	pthread_mutex_unlock(&tx_stage_lock_);
+}
+
+/* Pre-operational during bootup and operational once the nodes are started */
+static void on_master_heartbeat(struct mloop_timer* self)
+{
+	(void)self;
+
+	struct can_frame cf = {
+		.can_id = R_HEARTBEAT + (cfg.master_nodeid & 0x7f),
+		.can_dlc = 1,
+	};
+
+	heartbeat_set_state(&cf, master_state_ == MASTER_STATE_RUNNING
+				 ? NMT_STATE_OPERATIONAL
+				 : NMT_STATE_PREOPERATIONAL);
+	tx_stage(&cf);
+}
+
+/* Started before the nodes are reset, so that they have heard from the master
+ * by the time they are told to watch it. Only the owner of a shared bus
+ * produces it.
+ */
+static int start_master_heartbeat(void)
+{
+	if (!cfg.master_nodeid || !cfg.master_heartbeat_period
+	 || shard_role_ == SHARD_ROLE_SHARD)
+		return 0;
+
+	if (cfg.master_nodeid > CANOPEN_NODEID_MAX) {
+		plog(LOG_WARNING, "Invalid master_nodeid %u; not sending a heartbeat",
+		     (unsigned int)cfg.master_nodeid);
+		return 0;
+	}
+
+	master_heartbeat_timer_ = mloop_timer_new(mloop_default());
+	if (!master_heartbeat_timer_)
+		return -1;
+
+	mloop_timer_set_callback(master_heartbeat_timer_, on_master_heartbeat);
+	mloop_timer_set_type(master_heartbeat_timer_, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_time(master_heartbeat_timer_,
+			     cfg.master_heartbeat_period * 1000000ULL);
+
+	on_master_heartbeat(master_heartbeat_timer_);
+
+	return mloop_timer_start(master_heartbeat_timer_);
+}
+
+static void stop_master_heartbeat(void)
+{
+	if (!master_heartbeat_timer_)
+		return;
+
+	mloop_timer_stop(master_heartbeat_timer_);
+	mloop_timer_unref(master_heartbeat_timer_);
+	master_heartbeat_timer_ = NULL;
+}
+
+static int start_time_producer(void)
+{
+	time_next_us_ = 0;
+
+	if (cfg.time_interval == 0 || cfg.sync_interval != 0
+	 || shard_role_ == SHARD_ROLE_SHARD)
+		return 0;
+
+	if (!time_timer_) {
+		time_timer_ = mloop_timer_new(mloop_default());
+		if (!time_timer_)
+			return -1;
+
+		mloop_timer_set_callback(time_timer_, on_time);
+		mloop_timer_set_type(time_timer_, MLOOP_TIMER_PERIODIC);
+	}
+
+	mloop_timer_set_time(time_timer_, cfg.time_interval * 1000000ULL);
+
+	return mloop_timer_start(time_timer_);
+}
+
+static void stop_time_producer(void)
+{
+	if (time_timer_)
+		mloop_timer_stop(time_timer_);
+}
+
+/* Driver requests are never held back, so drivers keep their SDOs and
+ * the budget only applies to REST and other background traffic.
+ */
+static void on_bus_load_sample(struct mloop_timer* self)
+{
+	(void)self;
+
+	unsigned int load = co_bus_load_sample(&bus_load_, loop_now_us());
+
+	if (cfg.sdo_bus_budget == 0 || load < cfg.sdo_bus_budget * 10)
+		sdo_req_queues_release();
+	else if (!sdo_req_queues_is_held())
+		sdo_req_queues_hold(SDO_REQ_PRIO_BACKGROUND);
+}
+
+static int start_bus_load_timer(void)
+{
+	co_bus_load_init(&bus_load_, cfg.bus_bitrate,
+			 gettime_us(CLOCK_MONOTONIC));
+
+	if (!bus_load_timer_) {
+		bus_load_timer_ = mloop_timer_new(mloop_default());
+		if (!bus_load_timer_)
+			return -1;
+
+		mloop_timer_set_callback(bus_load_timer_, on_bus_load_sample);
+		mloop_timer_set_type(bus_load_timer_, MLOOP_TIMER_PERIODIC);
+	}
+
+	mloop_timer_stop(bus_load_timer_);
+	mloop_timer_set_time(bus_load_timer_, BUS_LOAD_INTERVAL * 1000000ULL);
+
+	return mloop_timer_start(bus_load_timer_);
+}
+
+/* The SYNC counter runs from 1 to sync_counter_overflow, see CiA 301 0x1019 */
+static void send_sync(int is_immediate)
+{
+	struct canfd_frame cf = {
+		.can_id = R_SYNC,
+		.len = 0,
+	};
+
+	if (cfg.sync_counter_overflow >= 2) {
+		if (++sync_counter_ > cfg.sync_counter_overflow)
+			sync_counter_ = 1;
+
+		cf.len = 1;
+		cf.data[0] = sync_counter_;
+	}
+
+	unsigned int sync_count = __atomic_add_fetch(&sync_count_, 1,
+						     __ATOMIC_RELAXED);
+
+	/* RPDOs that other threads have sent by now belong to this cycle */
+	tx_pdo_drain();
+
+	pthread_mutex_lock(&tx_stage_lock_);
+
+	struct tx_queue* queue;
+
+	if (pdo_image_is_active_) {
+		queue = &tx_queue_[TX_CLASS_PDO];
+		pdo_image_flush_nolock(&cf);
+	} else {
+		queue = &tx_queue_[TX_CLASS_NMT];
+		tx_push_nolock(queue, &cf);
+	}
+
+	if (cfg.time_interval > 0)
+		send_time_on_sync_nolock(queue);
+
+	/* Anything that can't be sent here is left to the scheduled flush */
+	if (is_immediate && !tx_is_blocked_)
+		tx_send_queue_nolock(queue, SIZE_MAX);
+
+	pthread_mutex_unlock(&tx_stage_lock_);
+
+	if (is_immediate)
+		schedule_cycle_begin();
+	else
+		begin_cycle(sync_count);
+}
+
+static void on_sync(struct mloop_timer* self)
+{
+	(void)self;
+	send_sync(0);
+}
+
+static void on_sync_thread(void)
+{
+	send_sync(1);
+}
+
+static int start_sync_timer(void)
+{
+	if (cfg.sync_interval == 0 || shard_role_ == SHARD_ROLE_SHARD)
+		return 0;
+
+	sync_counter_ = 0;
+
+	if (cfg.use_sync_thread) {
+		if (co_sync_start(cfg.sync_interval, cfg.sync_priority,
+				  on_sync_thread) < 0)
+			return -1;
+
+		pdo_image_set_active(cfg.enable_sync_rpdo);
+		return 0;
+	}
+
+	if (!sync_timer_) {
+		sync_timer_ = mloop_timer_new(mloop_default());
+		if (!sync_timer_)
+			return -1;
+
+		mloop_timer_set_callback(sync_timer_, on_sync);
+		mloop_timer_set_type(sync_timer_,
+				     MLOOP_TIMER_PERIODIC | MLOOP_TIMER_PRECISE);
+	}
+
+	mloop_timer_set_time(sync_timer_, cfg.sync_interval * 1000ULL);
+
+	if (mloop_timer_start(sync_timer_) < 0)
+		return -1;
+
+	pdo_image_set_active(cfg.enable_sync_rpdo);
+	return 0;
+}
+
+static void stop_sync_timer(void)
+{
+	co_sync_stop();
+
+	pdo_image_set_active(0);
+
+	if (sync_timer_)
+		mloop_timer_stop(sync_timer_);
+}
+
+/* Every node that answered the reset has a driver and none is held back from
+ * starting
+ */
+static int can_start_all_by_broadcast(void)
+{
+	if (nodeid_min() != CANOPEN_NODEID_MIN
+	 || nodeid_max() != CANOPEN_NODEID_MAX)
+		return 0;
+
+	int i;
+	for_each_node(i) {
+		const struct co_master_node* node = co_master_get_node(i);
+
+		if (nodes_seen_[i] && node->driver_type == CO_MASTER_DRIVER_NONE)
+			return 0;
+
+		if (node->driver_type == CO_MASTER_DRIVER_NEW
+		 && node->ndrv.options & CO_OPT_INHIBIT_START)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void start_all_nodes(void)
+{
+	int i;
+
+	/* Nodes that were not properly registered must not be started, so a
+	 * broadcast is only used if there are none.
+	 */
+	profile("Start nodes...\n");
+	co_timeline_begin(0, CO_TIMELINE_START);
+
+	if (can_start_all_by_broadcast()) {
+		tx_stage_nmt(NMT_CS_START, 0);
+	} else {
+		for_each_node_reverse(i)
+			if (co_master_get_node(i)->driver_type
+					!= CO_MASTER_DRIVER_NONE)
+				tx_stage_nmt(NMT_CS_START, i);
+	}
+
+	profile("Start node guarding...\n");
+	for_each_node(i)
+		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
+			start_nodeguarding(i);
+
+	profile("Notify drivers about start...\n");
+	for_each_node(i)
+		call_start_fn(co_master_get_node(i));
+
+	co_timeline_end(0, CO_TIMELINE_START);
+	profile("Boot-up finished!\n");
+
+	master_state_ = MASTER_STATE_RUNNING;
+
+	load_late_nodes();
+
+	start_sync_timer();
+	start_time_producer();
+
+	if (cfg.enable_bootup_trace)
+		dump_tracebuffer("bootup");
+
+	if (cfg.enable_bootup_timeline)
+		dump_timeline();
+}
+
+static void check_bootup_done(void)
+{
+	if (bootup_phase_ != BOOTUP_PHASE_LOAD || n_scheduled_bootups > 0)
+		return;
+
+	bootup_phase_ = BOOTUP_PHASE_DONE;
+	co_timeline_end(0, CO_TIMELINE_WAIT);
+
+	mloop_timer_unref(bootup_timer_);
+	bootup_timer_ = NULL;
+
+	if (n_inhibited_starts == 0)
+		start_all_nodes();
+}
+
+/* Nodes that do not answer remote frames, which many CAN controllers do not
+ * support, are found by their answer to an upload of the device type. The
+ * requests go out in batches with the rest of the TX queue.
+ */
+static void probe_nodes(void)
+{
+	int i;
+
+	profile("Probe network...\n");
+
+	for_each_node(i) {
+		if (nodes_seen_[i])
+			continue;
+
+		struct can_frame rtr = {
+			.can_id = (R_HEARTBEAT + i) | CAN_RTR_FLAG,
+		};
+		tx_stage(&rtr);
+
+		struct can_frame sdo;
+		sdo_clear_frame(&sdo);
+		sdo.can_id = R_RSDO + i;
+		sdo.can_dlc = CAN_MAX_DLEN;
+		sdo_set_cs(&sdo, SDO_CCS_UL_INIT_REQ);
+		sdo_set_index(&sdo, 0x1000);
+		sdo_set_subindex(&sdo, 0);
+
+		if (tx_stage(&sdo) == 0)
+			sdo_probe_pending_[i] = 1;
+	}
+}
+
+static void on_bootup_timeout(struct mloop_timer* timer)
+{
+	switch (bootup_phase_) {
+	case BOOTUP_PHASE_RESET:
+		bootup_phase_ = BOOTUP_PHASE_PROBE;
+		co_timeline_end(0, CO_TIMELINE_RESET);
+		co_timeline_begin(0, CO_TIMELINE_PROBE);
+		probe_nodes();
+		mloop_timer_start(timer);
+		break;
+	case BOOTUP_PHASE_PROBE:
+		profile("Wait for drivers...\n");
+		finish_sdo_probe();
+		bootup_phase_ = BOOTUP_PHASE_LOAD;
+		co_timeline_end(0, CO_TIMELINE_PROBE);
+		co_timeline_begin(0, CO_TIMELINE_WAIT);
+		check_bootup_done();
+		break;
+	default:
+		break;
+	}
+}
+
+static void reset_nodes(void)
+{
+	int i;
+
+	profile("Reset network...\n");
+
+	co_timeline_reset();
+	co_timeline_begin(0, CO_TIMELINE_RESET);
+
+	/* Nodes are probed from the reset until they are found */
+	for_each_node(i)
+		co_timeline_begin(i, CO_TIMELINE_PROBE);
+
+	co_net_send_nmt_range(&socket_, NMT_CS_RESET_COMMUNICATION,
+			      nodeid_min(), nodeid_max());
+}
+
+/* A negative mux_priority leaves the scheduling of the main loop as it is,
+ * except on Marel systems where it defaults to SCHED_FIFO at priority 25.
+ */
+static void set_priority(void)
+{
+	int priority = cfg.mux_priority;
+
+#ifndef NO_MAREL_CODE
+	if (priority < 0)
+		priority = 25;
+#endif
+
+	if (priority < 0)
+		return;
+
+	struct sched_param param = { .sched_priority = priority };
+	int policy = priority > 0 ? SCHED_FIFO : SCHED_OTHER;
+
+	int rc = pthread_setschedparam(pthread_self(), policy, &param);
+	if (rc != 0)
+		plog(LOG_WARNING, "Could not set main loop priority to %d: %s",
+		     priority, strerror(rc));
+}
+
+static int start_reset(void)
+{
+	bootup_phase_ = BOOTUP_PHASE_RESET;
+	reset_nodes();
+
+	return mloop_timer_start(bootup_timer_);
+}
+
+static int lss_assign(struct co_lss* lss,
+		      const struct co_lss_identity* identity)
+{
+	(void)lss;
+
+	int i;
+	for_each_node(i)
+		if (has_lss_identity_[i]
+		 && co_lss_identity_is_equal(&lss_identity_[i], identity)) {
+			plog(LOG_INFO, "LSS: Assigning node id %d to %#x:%#x:%#x:%#x",
+			     i, identity->vendor_id, identity->product_code,
+			     identity->revision_number,
+			     identity->serial_number);
+			return i;
+		}
+
+	plog(LOG_WARNING, "LSS: No node id for %#x:%#x:%#x:%#x",
+	     identity->vendor_id, identity->product_code,
+	     identity->revision_number, identity->serial_number);
+	return -1;
+}
+
+static void on_lss_done(struct co_lss* lss)
+{
+	if (lss->status == CO_LSS_CANCELLED)
+		return;
+
+	if (lss->status == CO_LSS_OK)
+		plog(LOG_INFO, "LSS: Assigned %zu node ids in %zu frames",
+		     lss->n_assigned, lss->n_frames);
+	else
+		plog(LOG_WARNING, "LSS: Scan stopped with %s after assigning %zu node ids",
+		     co_lss_status_to_string(lss->status), lss->n_assigned);
+
+	/* The new node ids become active when the nodes are reset */
+	if (start_reset() < 0)
+		plog(LOG_ERROR, "Could not start bootup timer");
+}
+
+static void load_lss_identities(void)
+{
+	int i;
+
+	for_each_node(i) {
+		cfg_load_node(i);
+
+		const char* str = cfg.node[i].lss_identity;
+		if (!str[0])
+			continue;
+
+		if (co_lss_identity_from_string(&lss_identity_[i], str) < 0) {
+			plog(LOG_WARNING, "Invalid lss_identity for node %d: \"%s\"",
+			     i, str);
+			continue;
+		}
 
-	plog(level, "Node %d: Code 0x%04x: %s",
-	     co_master_get_node_id(node), emcy->code,
-	     error_code_to_string(emcy->code, profile));
+		has_lss_identity_[i] = 1;
+	}
 }
 
-static int handle_emcy(struct co_master_node* node,
-		       const struct can_frame* frame)
+static int start_lss(void)
 {
-	if (frame->can_dlc == 0)
-		return handle_bootup(node);
+	profile("Assign node ids...\n");
 
-	uint32_t error_register = emcy_get_register(frame);
-
-	int nodeid = co_master_get_node_id(node);
+	load_lss_identities();
 
-#ifndef NO_MAREL_CODE
-	canopen_info_get(nodeid)->error_register = error_register;
-#endif /* NO_MAREL_CODE */
+	if (co_lss_init(&lss_, &socket_) < 0)
+		return -1;
 
-	struct co_emcy emcy = {
-		.code = emcy_get_code(frame),
-		.reg = error_register,
-		.manufacturer_error = emcy_get_manufacturer_error(frame)
+	struct co_lss_info info = {
+		.timeout = cfg.lss_timeout,
+		.is_store = cfg.lss_store_nodeid,
+		.assign_fn = lss_assign,
+		.on_done = on_lss_done,
 	};
 
-	if (node->driver_type != CO_MASTER_DRIVER_NONE)
-		log_emcy(node, &emcy);
-
-	switch (node->driver_type) {
-	case CO_MASTER_DRIVER_NONE:
-		return -1;
-#ifndef NO_MAREL_CODE
-	case CO_MASTER_DRIVER_LEGACY:
-		legacy_driver_iface_process_emr(node->driver, emcy.code,
-						emcy.reg,
-						emcy.manufacturer_error);
-		break;
-#endif /* NO_MAREL_CODE */
-	case CO_MASTER_DRIVER_NEW:
-		if (node->ndrv.emcy_fn)
-			node->ndrv.emcy_fn(&node->ndrv, &emcy);
-		break;
-	}
-
-	return 0;
+	bootup_phase_ = BOOTUP_PHASE_LSS;
+	return co_lss_start(&lss_, &info);
 }
 
-static int handle_heartbeat(struct co_master_node* node,
-			     const struct can_frame* frame)
+static int start_bootup(void)
 {
-	int nodeid = co_master_get_node_id(node);
+	profile("Initialize multiplexer...\n");
+	if (init_multiplexer() < 0)
+		return -1;
 
-	if (!heartbeat_is_valid(frame))
+	if (start_guard_timer() < 0)
 		return -1;
 
-	if (heartbeat_is_bootup(frame)
-	 && !cfg.node[nodeid].has_zero_guard_status)
-		return handle_bootup(node);
+	if (start_master_heartbeat() < 0)
+		return -1;
 
-	if (master_state_ == MASTER_STATE_STARTUP)
-		return 0;
+	bootup_timer_ = mloop_timer_new(mloop_default());
+	if (!bootup_timer_)
+		return -1;
 
-	/* This can happen if the CAN bus is disconnected but not the power to
-	 * the node. We reset communication to refresh the state.
-	 */
-	if (node->driver_type == CO_MASTER_DRIVER_NONE) {
-		if (heartbeat_get_state(frame) != NMT_STATE_STOPPED
-		 && !node->is_loading)
-			co_net_send_nmt(&socket_, NMT_CS_RESET_COMMUNICATION,
-					nodeid);
+	mloop_timer_set_time(bootup_timer_, BOOTUP_QUIET_TIME);
+	mloop_timer_set_callback(bootup_timer_, on_bootup_timeout);
 
-		return 0;
-	}
+	co_timeline_enable(cfg.enable_bootup_timeline);
 
-	if (!node->is_initialized)
-		return -1;
+	if (is_warm_start_)
+		return start_warm_bootup();
 
-	restart_heartbeat_timer(nodeid);
+	if (cfg.enable_lss)
+		return start_lss();
 
-	/* Make sure the node is in operational state */
-	if (heartbeat_get_state(frame) != NMT_STATE_OPERATIONAL)
-		co_net_send_nmt(&socket_, NMT_CS_START, nodeid);
+	return start_reset();
+}
 
 #ifndef NO_MAREL_CODE
-	struct canopen_info* info = canopen_info_get(nodeid);
-	info->last_seen = time(NULL);
-	info->skipped_heartbeats = 0;
-#endif /* NO_MAREL_CODE */
+static int on_tickermaster_alive(void)
+{
+	return start_bootup();
+}
 
+static int appbase_dummy()
+{
 	return 0;
 }
 
-static int handle_sdo(struct co_master_node* node, const struct can_frame* cf)
+static int run_appbase()
 {
-	int nodeid = co_master_get_node_id(node);
-	struct sdo_async* sdo_proc = &sdo_req_queue_get(nodeid)->sdo_client;
-	return sdo_async_feed(sdo_proc, cf);
-}
-
-static int handle_not_loaded(struct co_master_node* node,
-			     const struct canopen_msg* msg,
-			     const struct can_frame* frame)
-{
-	switch (msg->object)
-	{
-	case CANOPEN_EMCY:
-		return handle_emcy(node, frame);
-	case CANOPEN_HEARTBEAT:
-		return handle_heartbeat(node, frame);
-	case CANOPEN_TSDO:
-		return handle_sdo(node, frame);
-	default:
-		break;
-	}
+	appcbase_t cb = { 0 };
+	cb.queue_timeout_ms = -1;
+	cb.usetm = 1;
+	cb.initialize = appbase_dummy;
+	cb.deinitialize = appbase_dummy;
+	cb.on_tickmaster_alive = on_tickermaster_alive;
 
-	return -1;
+	if (appbase_initialize("canopen", appbase_get_instance(), &cb) != 0)
+		return 1;
+
+	set_priority();
+
+	mloop_run(mloop_);
+
+	appbase_deinitialize();
+
+	return 0;
 }
 
-#ifndef NO_MAREL_CODE
-static int handle_with_legacy(struct co_master_node* node,
-			      const struct canopen_msg* msg,
-			      const struct can_frame* cf)
+static int master_set_node_state(int nodeid, int state)
 {
-	void* driver = node->driver;
-	if (!driver)
-		return -1;
+	(void)nodeid;
+	(void)state;
 
-	switch (msg->object)
-	{
-	case CANOPEN_TPDO1:
-		return legacy_driver_iface_process_pdo(driver, 1, cf->data,
-						       cf->can_dlc);
-	case CANOPEN_TPDO2:
-		return legacy_driver_iface_process_pdo(driver, 2, cf->data,
-						       cf->can_dlc);
-	case CANOPEN_TPDO3:
-		return legacy_driver_iface_process_pdo(driver, 3, cf->data,
-						       cf->can_dlc);
-	case CANOPEN_TPDO4:
-		return legacy_driver_iface_process_pdo(driver, 4, cf->data,
-						       cf->can_dlc);
-	case CANOPEN_TSDO:
-		return handle_sdo(node, cf);
-	case CANOPEN_EMCY:
-		return handle_emcy(node, cf);
-	case CANOPEN_HEARTBEAT:
-		return handle_heartbeat(node, cf);
-	default:
-		break;
-	}
+	/* not allowed */
+	return 0;
+}
 
-	return -1;
+static inline
+struct co_master_node*
+get_node_from_sdo_queue(const struct sdo_req_queue* queue)
+{
+	return co_master_get_node(queue->nodeid);
 }
-#endif /* NO_MAREL_CODE */
 
-static int handle_with_new_driver(struct co_master_node* node,
-				  const struct canopen_msg* msg,
-				  const struct can_frame* cf)
+static void on_master_sdo_request_done(struct sdo_req* req)
 {
-	struct co_drv* drv = &node->ndrv;
+	struct co_master_node* node = get_node_from_sdo_queue(req->parent);
+	void* driver = node->driver;
+	assert(driver);
 
-	switch (msg->object)
-	{
-	case CANOPEN_TPDO1:
-		if (drv->pdo1_fn)
-			drv->pdo1_fn(drv, cf->data, cf->can_dlc);
-		return 0;
-	case CANOPEN_TPDO2:
-		if (drv->pdo2_fn)
-			drv->pdo2_fn(drv, cf->data, cf->can_dlc);
-		return 0;
-	case CANOPEN_TPDO3:
-		if (drv->pdo3_fn)
-			drv->pdo3_fn(drv, cf->data, cf->can_dlc);
-		return 0;
-	case CANOPEN_TPDO4:
-		if (drv->pdo4_fn)
-			drv->pdo4_fn(drv, cf->data, cf->can_dlc);
-		return 0;
-	case CANOPEN_TSDO:
-		return handle_sdo(node, cf);
-	case CANOPEN_EMCY:
-		return handle_emcy(node, cf);
-	case CANOPEN_HEARTBEAT:
-		return handle_heartbeat(node, cf);
-	default:
-		break;
+	uint64_t start = fastclock_us();
+
+	if (req->status == SDO_REQ_OK) {
+		legacy_driver_iface_process_sdo(driver,
+						req->index,
+						req->subindex,
+						(unsigned char*)req->data.data,
+						req->data.index);
+	} else {
+		legacy_driver_iface_process_sdo(driver,
+						req->index,
+						req->subindex,
+						NULL, 0);
 	}
 
-	return -1;
+	co_drv_watchdog_check(&node->watchdog, co_master_get_node_id(node),
+			      "SDO", start);
 }
 
-static void mux_on_frame(const struct can_frame* cf)
+static int master_request_sdo(int nodeid, int index, int subindex)
 {
-	struct canopen_msg msg;
+	struct sdo_req_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = index,
+		.subindex = subindex,
+		.on_done = on_master_sdo_request_done
+	};
 
-	if (cf->can_id & (CAN_RTR_FLAG | CAN_EFF_FLAG | CAN_ERR_FLAG))
-		return;
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req)
+		return -1;
 
-	if (canopen_get_object_type(&msg, cf) < 0)
-		return;
+	int rc = sdo_req_start(req, sdo_req_queue_get(nodeid));
 
-	if (msg.object == CANOPEN_NMT) {
-		plog(LOG_ALERT, "Received NMT! Another CANopen master is not allowed on the bus!");
-		return;
-	}
+	sdo_req_unref(req);
+	return rc;
+}
 
-	if (!(nodeid_min() <= msg.id && msg.id <= nodeid_max()))
-		return;
+static void on_master_sdo_send_done(struct sdo_req* req)
+{
+	(void)req;
+}
 
-	struct co_master_node* node = co_master_get_node(msg.id);
+static int master_send_sdo(int nodeid, int index, int subindex,
+			   unsigned char* data, size_t size)
+{
+	struct sdo_req_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = index,
+		.subindex = subindex,
+		.dl_data = data,
+		.dl_size = size,
+		.on_done = on_master_sdo_send_done
+	};
 
-	if (!node->is_initialized) {
-		handle_not_loaded(node, &msg, cf);
-		return;
-	}
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req)
+		return -1;
 
-	switch (node->driver_type) {
-	case CO_MASTER_DRIVER_NONE:
-		handle_not_loaded(node, &msg, cf);
-		break;
-#ifndef NO_MAREL_CODE
-	case CO_MASTER_DRIVER_LEGACY:
-		handle_with_legacy(node, &msg, cf);
-		break;
+	int rc = sdo_req_start(req, sdo_req_queue_get(nodeid));
+
+	sdo_req_unref(req);
+	return rc;
+}
 #endif /* NO_MAREL_CODE */
-	case CO_MASTER_DRIVER_NEW:
-		handle_with_new_driver(node, &msg, cf);
-		break;
-	}
+
+int co__rpdox(int nodeid, int type, const void* data, size_t size)
+{
+	return co__send_pdo(type + nodeid, data, size);
 }
 
-static void mux_handler_fn(struct mloop_socket* self)
+int co__send_pdo(uint32_t cob_id, const void* data, size_t size)
 {
-	struct can_frame cf;
+	if (!data || size > pdo_size_max_ || cob_id > CAN_SFF_MASK)
+		return -1;
 
-	while (1) {
-		memset(&cf, 0, sizeof(cf));
+	/* Payloads that fit in a classic frame are sent as such so that nodes
+	 * without FD support can still share the bus.
+	 */
+	struct canfd_frame cf = {
+		.can_id = cob_id,
+		.len = socketcan_fd_length(size),
+		.flags = size > CAN_MAX_DLEN ? CANFD_FDF | CANFD_BRS : 0,
+	};
 
-		ssize_t rsize = sock_recv(&socket_, &cf, MSG_DONTWAIT);
-		if (rsize == 0)
-			mloop_socket_stop(self);
+	memcpy(cf.data, data, size);
 
-		if (rsize <= 0)
-			return;
+	if (tx_pdo_queue_.cell
+	 && !pthread_equal(pthread_self(), tx_loop_thread_))
+		return tx_pdo_post(&cf);
 
-		mux_on_frame(&cf);
-	}
+	return tx_stage_pdo(&cf);
 }
 
-static int init_multiplexer()
+int co__start(int nodeid)
 {
-	mux_handler_ = mloop_socket_new(mloop_default());
-	if (!mux_handler_)
+	struct co_master_node* node = co_master_get_node(nodeid);
+	assert(node);
+
+	if (!(node->ndrv.options & CO_OPT_INHIBIT_START))
 		return -1;
 
-	mloop_socket_set_fd(mux_handler_, socket_.fd);
-	mloop_socket_set_callback(mux_handler_, mux_handler_fn);
+	node->ndrv.options &= ~CO_OPT_INHIBIT_START;
 
-	return mloop_socket_start(mux_handler_);
+	if (master_state_ != MASTER_STATE_STARTUP)
+		start_single_node(node);
+	else if (--n_inhibited_starts == 0 && bootup_phase_ == BOOTUP_PHASE_DONE)
+		start_all_nodes();
+
+	return 0;
 }
 
-static void wait_for_bootup(struct mloop_work* self)
+#ifndef NO_MAREL_CODE
+static int master_send_pdo(int nodeid, int n, unsigned char* data, size_t size)
 {
-	(void)self;
-	while (n_scheduled_bootups > 0)
-		usleep(100);
+	switch (n) {
+	case 1: return co__rpdox(nodeid, R_RPDO1, data, size);
+	case 2: return co__rpdox(nodeid, R_RPDO2, data, size);
+	case 3: return co__rpdox(nodeid, R_RPDO3, data, size);
+	case 4: return co__rpdox(nodeid, R_RPDO4, data, size);
+	}
+
+	abort();
+	return -1;
 }
 
-static void schedule_bootup_done(void)
+static void* master_iface_init(int nodeid)
 {
-	struct mloop_work* work = mloop_work_new(mloop_default());
-	assert(work);
-	mloop_work_set_work_fn(work, wait_for_bootup);
-	mloop_work_set_done_fn(work, on_bootup_done);
-
-	int rc = mloop_work_start(work);
-	assert(rc == 0);
+	struct legacy_master_iface cb;
+	cb.set_node_state = master_set_node_state;
+	cb.request_sdo = master_request_sdo;
+	cb.send_sdo = master_send_sdo;
+	cb.send_pdo = master_send_pdo;
+	cb.nodeid = nodeid;
 
-	mloop_work_unref(work);
+	return legacy_master_iface_new(&cb);
 }
+#endif /* NO_MAREL_CODE */
 
-
-static void run_bootup(void)
+static void unload_all_drivers()
 {
 	int i;
-	profile("Load drivers...\n");
 	for_each_node(i)
-		if (nodes_seen_[i])
-			schedule_load_driver(i);
+		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
+			unload_driver(i);
+}
 
-	schedule_bootup_done();
+static inline int is_node_started(const struct co_master_node* node)
+{
+	return master_state_ == MASTER_STATE_RUNNING && node->is_initialized
+	    && !(node->driver_type == CO_MASTER_DRIVER_NEW
+		 && node->ndrv.options & CO_OPT_INHIBIT_START);
 }
 
-static void load_late_nodes(void)
+static void restart_node_guarding(int nodeid)
 {
-	int i;
-	for_each_node(i)
-		if (nodes_seen_late_[i]) {
-			plog(LOG_WARNING, "Node %d was late", i);
-			schedule_load_driver(i);
-		}
+	stop_heartbeat_timer(nodeid);
+	stop_ping_timer(nodeid);
+
+	if (is_node_started(co_master_get_node(nodeid)))
+		start_nodeguarding(nodeid);
 }
 
-static void on_sync(struct mloop_timer* self)
+static void on_heartbeat_period_reloaded(struct sdo_req* req)
 {
-	(void)self;
+	struct co_master_node* node = req->context;
+	int nodeid = co_master_get_node_id(node);
 
-	struct can_frame cf = {
-		.can_id = R_SYNC,
-		.can_dlc = 0,
-	};
+	if (!node->is_initialized || !cfg.node[nodeid].enable_node_guarding)
+		return;
 
-	sock_send(&socket_, &cf, 0);
+	node->is_heartbeat_supported = req->status == SDO_REQ_OK;
+	restart_node_guarding(nodeid);
 }
 
-static int start_sync_timer(void)
+static int reload_heartbeat_period(int nodeid)
 {
-	if (cfg.sync_interval == 0)
-		return 0;
+	uint16_t period = cfg.node[nodeid].heartbeat_period;
+	uint16_t network_order = 0;
+	byteorder(&network_order, &period, sizeof(network_order));
+
+	struct sdo_req_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.priority = SDO_REQ_PRIO_CONFIG,
+		.index = 0x1017,
+		.subindex = 0,
+		.dl_data = &network_order,
+		.dl_size = sizeof(network_order),
+		.on_done = on_heartbeat_period_reloaded,
+		.context = co_master_get_node(nodeid)
+	};
 
-	struct mloop_timer* timer = mloop_timer_new(mloop_default());
-	if (!timer)
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req)
 		return -1;
 
-	mloop_timer_set_callback(timer, on_sync);
-	mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
-	mloop_timer_set_time(timer, cfg.sync_interval * 1000ULL);
+	int rc = sdo_req_start(req, sdo_req_queue_get(nodeid));
 
-	int rc = mloop_timer_start(timer);
-	mloop_timer_unref(timer);
+	sdo_req_unref(req);
 	return rc;
 }
 
-static void start_all_nodes(void)
+#define is_node_cfg_changed(old, nodeid, name) \
+	((old)->node[nodeid].name != cfg.node[nodeid].name)
+
+static void reload_node_config(int nodeid, const struct cfg* old)
 {
-	int i;
+	struct co_master_node* node = co_master_get_node(nodeid);
 
-	/* We start each node individually because we don't want to start nodes
-	 * that were not properly registered.
-	 */
-	profile("Start nodes...\n");
-	for_each_node_reverse(i)
-		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
-			co_net_send_nmt(&socket_, NMT_CS_START, i);
+	cfg_load_node(nodeid);
 
-	profile("Start node guarding...\n");
-	for_each_node(i)
-		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
-			start_nodeguarding(i);
+	if (is_node_cfg_changed(old, nodeid, ignore_sdo_multiplexer)
+	 || is_node_cfg_changed(old, nodeid, send_full_sdo_frame)
+	 || is_node_cfg_changed(old, nodeid, sdo_block_size)
+	 || is_node_cfg_changed(old, nodeid, sdo_timeout_min)
+	 || is_node_cfg_changed(old, nodeid, sdo_timeout_max))
+		apply_quirks(node);
+
+	if (strcmp(old->node[nodeid].sdo_channels,
+		   cfg.node[nodeid].sdo_channels) != 0) {
+		clear_sdo_channels(nodeid);
+		load_sdo_channels(nodeid);
+		mux_table_update(nodeid);
+		update_filters();
+	}
 
-	profile("Notify drivers about start...\n");
-	for_each_node(i)
-		call_start_fn(co_master_get_node(i));
+	if (strcmp(old->node[nodeid].tpdo_on_change,
+		   cfg.node[nodeid].tpdo_on_change) != 0)
+		load_tpdo_on_change(nodeid);
 
-	profile("Boot-up finished!\n");
+	int is_enabled = cfg.node[nodeid].enable_node_guarding;
+	int was_enabled = old->node[nodeid].enable_node_guarding;
 
-	master_state_ = MASTER_STATE_RUNNING;
+	if (!is_enabled) {
+		if (was_enabled) {
+			stop_heartbeat_timer(nodeid);
+			stop_ping_timer(nodeid);
+		}
+		return;
+	}
 
-	load_late_nodes();
+	/* The timers are set up again once the node has its new period */
+	if (!was_enabled || is_node_cfg_changed(old, nodeid, heartbeat_period)) {
+		stop_heartbeat_timer(nodeid);
+		stop_ping_timer(nodeid);
 
-	start_sync_timer();
+		if (reload_heartbeat_period(nodeid) < 0)
+			plog(LOG_ERROR, "reload_config: Could not set the heartbeat period of node %d",
+			     nodeid);
+		return;
+	}
 
-	if (cfg.enable_bootup_trace)
-		dump_tracebuffer("bootup");
+	if (is_node_cfg_changed(old, nodeid, heartbeat_timeout)
+	 || is_node_cfg_changed(old, nodeid, n_timeouts_max)
+	 || old->timer_slack != cfg.timer_slack)
+		restart_node_guarding(nodeid);
 }
 
-static void on_bootup_done(struct mloop_work* self)
+int co_master_reload_config(void)
 {
-	(void)self;
+	int i, n = 0;
 
-	if (n_inhibited_starts == 0)
-		start_all_nodes();
+	/* Drivers that are being loaded read the configuration */
+	for_each_node(i)
+		if (co_master_get_node(i)->is_loading)
+			return -1;
+
+	struct cfg* old = malloc(sizeof(*old));
+	if (!old)
+		return -1;
+
+	if (cfg_reload_file(old) < 0) {
+		free(old);
+		return -1;
+	}
+
+	if ((old->sync_interval != cfg.sync_interval
+	  || old->enable_sync_rpdo != cfg.enable_sync_rpdo)
+	 && master_state_ == MASTER_STATE_RUNNING) {
+		stop_sync_timer();
+		if (start_sync_timer() < 0)
+			plog(LOG_ERROR, "reload_config: Could not start the SYNC timer");
+	}
+
+	if (old->bus_bitrate != cfg.bus_bitrate && bus_load_timer_
+	 && start_bus_load_timer() < 0)
+		plog(LOG_ERROR, "reload_config: Could not restart the bus load estimator");
+
+	if (old->timer_slack != cfg.timer_slack && guard_timer_
+	 && start_guard_timer() < 0)
+		plog(LOG_ERROR, "reload_config: Could not restart the node guarding timer");
+
+	if ((old->time_interval != cfg.time_interval
+	  || old->sync_interval != cfg.sync_interval)
+	 && master_state_ == MASTER_STATE_RUNNING) {
+		stop_time_producer();
+		if (start_time_producer() < 0)
+			plog(LOG_ERROR, "reload_config: Could not start the TIME timer");
+	}
+
+	for_each_node(i) {
+		if (!co_master_get_node(i)->is_initialized)
+			continue;
+
+		reload_node_config(i, old);
+
+		if (memcmp(&old->node[i], &cfg.node[i], sizeof(cfg.node[i])) != 0)
+			++n;
+	}
+
+	free(old);
+	return n;
 }
 
-static void on_net_probe_done(struct mloop_work* self)
+static int init_directory(const char* path)
 {
-	(void)self;
+	struct stat st;
 
-	profile("Initialize multiplexer...\n");
-	int __unused rc = init_multiplexer();
-	assert(rc == 0);
+	if (stat(path, &st) == 0) {
+		if (!S_ISDIR(st.st_mode)) {
+			errno = EEXIST;
+			return -1;
+		}
+	} else {
+		if (mkdir(path, 0755) < 0)
+			return -1;
+	}
 
-	run_bootup();
+	return 0;
 }
 
-static void set_priority(void)
+void on_stop_signal(struct mloop_signal* sig, int signo)
 {
-	struct sched_param prio = { .sched_priority = 25 };
-	sched_setscheduler(getpid(), SCHED_FIFO, &prio);
+	(void)sig;
+
+	switch (signo) {
+	case SIGUSR1:
+		dump_tracebuffer(NULL);
+		break;
+	case SIGUSR2:
+		plog(LOG_NOTICE, "Reloading configuration");
+		if (co_master_reload_config() < 0)
+			plog(LOG_ERROR, "Could not reload the configuration");
+		break;
+	case SIGHUP:
+		plog(LOG_NOTICE, "Reloading drivers");
+		if (co_master_reload_driver(NULL) < 0)
+			plog(LOG_ERROR, "Could not reload drivers while nodes are being loaded");
+		break;
+	default:
+		mloop_exit(mloop_default());
+		break;
+	}
 }
 
-static int start_bootup(void)
+int init_signal_handler(struct mloop* mloop)
 {
-	struct mloop_work* work = mloop_work_new(mloop_default());
-	if (!work)
+	struct mloop_signal* ms = mloop_signal_new(mloop);
+	if (!ms)
 		return -1;
 
-	mloop_work_set_work_fn(work, run_net_probe);
-	mloop_work_set_done_fn(work, on_net_probe_done);
+	sigset_t s;
+	sigemptyset(&s);
+	sigaddset(&s, SIGINT);
+	sigaddset(&s, SIGTERM);
+	sigaddset(&s, SIGQUIT);
+	sigaddset(&s, SIGUSR1);
+	sigaddset(&s, SIGUSR2);
+	sigaddset(&s, SIGHUP);
 
-	int rc = mloop_work_start(work);
-	mloop_work_unref(work);
+	pthread_sigmask(SIG_BLOCK, &s, NULL);
 
+	mloop_signal_set_signals(ms, &s);
+	mloop_signal_set_callback(ms, on_stop_signal);
+	int rc = mloop_signal_start(ms);
+	mloop_signal_unref(ms);
 	return rc;
 }
 
-#ifndef NO_MAREL_CODE
-static int on_tickermaster_alive(void)
+static void compose_handover_path(char* path, size_t size)
 {
-	return start_bootup();
+	if (cfg.handover_path[0])
+		strlcpy(path, cfg.handover_path, size);
+	else
+		snprintf(path, size, "@canopen-master.%s", cfg.iface);
 }
 
-static int appbase_dummy()
+/* Returns -1 only if a running master refused to hand over, because the bus
+ * must then not be opened a second time. Without a running master, the
+ * master starts cold.
+ */
+static int take_handover(void)
 {
-	return 0;
-}
+	char path[256];
+	int fds[CO_HANDOVER_FDS_MAX];
+	size_t n_fds = 0;
 
-static int run_appbase()
-{
-	appcbase_t cb = { 0 };
-	cb.queue_timeout_ms = -1;
-	cb.usetm = 1;
-	cb.initialize = appbase_dummy;
-	cb.deinitialize = appbase_dummy;
-	cb.on_tickmaster_alive = on_tickermaster_alive;
+	compose_handover_path(path, sizeof(path));
 
-	if (appbase_initialize("canopen", appbase_get_instance(), &cb) != 0)
-		return 1;
+	if (co_handover_take(path, &handover_, fds, &n_fds) < 0) {
+		if (errno == ENOENT || errno == ECONNREFUSED)
+			return 0;
 
-	set_priority();
+		plog(LOG_ERROR, "The master on %s did not hand over: %s",
+		     path, strerror(errno));
+		return -1;
+	}
 
-	mloop_run(mloop_);
+	if (n_fds < HANDOVER_FD_GATEWAY || n_fds > HANDOVER_FD_COUNT
+	 || handover_.sock_type != SOCK_TYPE_CAN) {
+		plog(LOG_ERROR, "Got an invalid handover from the master on %s",
+		     path);
+		for (size_t i = 0; i < n_fds; ++i)
+			close(fds[i]);
+		return -1;
+	}
 
-	appbase_deinitialize();
+	memcpy(handover_fd_, fds, n_fds * sizeof(int));
+
+	for (int i = 0; i < handover_.n_nodes; ++i) {
+		struct co_handover_node* hnode = &handover_.node[i];
+		int nodeid = hnode->nodeid;
+
+		if (nodeid < nodeid_min() || nodeid > nodeid_max())
+			continue;
+
+		hnode->name[sizeof(hnode->name) - 1] = '\0';
+		hnode->hw_version[sizeof(hnode->hw_version) - 1] = '\0';
+		hnode->sw_version[sizeof(hnode->sw_version) - 1] = '\0';
 
+		handover_node_[nodeid] = hnode;
+		is_warm_node_[nodeid] =
+			!!(hnode->flags & CO_HANDOVER_NODE_STARTED);
+	}
+
+	is_warm_start_ = 1;
+
+	plog(LOG_NOTICE, "Took %d nodes over from the master on %s",
+	     handover_.n_nodes, path);
 	return 0;
 }
 
-static int master_set_node_state(int nodeid, int state)
+static int open_rest_server(void)
 {
-	(void)nodeid;
-	(void)state;
+	if (!is_warm_start_)
+		return rest_init(cfg.rest_port);
 
-	/* not allowed */
+	if (rest_init_fd(handover_fd_[HANDOVER_FD_REST]) < 0)
+		return -1;
+
+	handover_fd_[HANDOVER_FD_REST] = -1;
 	return 0;
 }
 
-static inline
-struct co_master_node*
-get_node_from_sdo_queue(const struct sdo_req_queue* queue)
+/* The gateway that was handed over keeps its port */
+static int open_sdo_gateway(void)
 {
-	return co_master_get_node(queue->nodeid);
-}
+	int fd = handover_fd_[HANDOVER_FD_GATEWAY];
+	handover_fd_[HANDOVER_FD_GATEWAY] = -1;
 
-static void on_master_sdo_request_done(struct sdo_req* req)
-{
-	struct co_master_node* node = get_node_from_sdo_queue(req->parent);
-	void* driver = node->driver;
-	assert(driver);
+	if (cfg.sdo_gateway_port == 0) {
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
 
-	if (req->status == SDO_REQ_OK) {
-		legacy_driver_iface_process_sdo(driver,
-						req->index,
-						req->subindex,
-						(unsigned char*)req->data.data,
-						req->data.index);
-	} else {
-		legacy_driver_iface_process_sdo(driver,
-						req->index,
-						req->subindex,
-						NULL, 0);
+	if (fd < 0)
+		return sdo_gateway_init(cfg.sdo_gateway_port);
+
+	if (sdo_gateway_init_fd(fd) < 0) {
+		close(fd);
+		return -1;
 	}
+
+	return 0;
 }
 
-static int master_request_sdo(int nodeid, int index, int subindex)
+static int open_bus(enum sock_type type)
 {
-	struct sdo_req_info info = {
-		.type = SDO_REQ_UPLOAD,
-		.index = index,
-		.subindex = subindex,
-		.on_done = on_master_sdo_request_done
-	};
+	struct tracebuffer* tb = cfg.trace_buffer_size > 0 ? &tracebuffer_ : NULL;
 
-	struct sdo_req* req = sdo_req_new(&info);
-	if (!req)
-		return -1;
+	if (!is_warm_start_)
+		return sock_open(&socket_, type, cfg.iface, tb);
 
-	int rc = sdo_req_start(req, sdo_req_queue_get(nodeid));
+	sock_init(&socket_, SOCK_TYPE_CAN, handover_fd_[HANDOVER_FD_BUS], tb);
+	handover_fd_[HANDOVER_FD_BUS] = -1;
+	return 0;
+}
 
-	sdo_req_unref(req);
-	return rc;
+/* Frames that are queued in the sock layer or in a ring would be lost */
+static int can_hand_over(void)
+{
+	return master_state_ == MASTER_STATE_RUNNING
+	    && bootup_phase_ == BOOTUP_PHASE_DONE
+	    && shard_role_ == SHARD_ROLE_NONE
+	    && socket_.type == SOCK_TYPE_CAN && !socket_.uring
+	    && rest_get_server_fd() >= 0 && !is_handed_over_;
 }
 
-static void on_master_sdo_send_done(struct sdo_req* req)
+static void get_handover_state(struct co_handover_state* state)
 {
-	(void)req;
+	int i;
+
+	memset(state, 0, sizeof(*state));
+	state->sock_type = socket_.type;
+
+	for_each_node(i) {
+		const struct co_master_node* node = co_master_get_node(i);
+		const struct co_master_node_ident* ident = co_master_get_ident(i);
+
+		if (node->driver_type == CO_MASTER_DRIVER_NONE
+		 || !node->is_initialized)
+			continue;
+
+		struct co_handover_node* hnode = &state->node[state->n_nodes++];
+
+		hnode->nodeid = i;
+		hnode->device_type = node->device_type;
+		hnode->vendor_id = ident->vendor_id;
+		hnode->product_code = ident->product_code;
+		hnode->revision_number = ident->revision_number;
+		strlcpy(hnode->name, ident->name, sizeof(hnode->name));
+		strlcpy(hnode->hw_version, ident->hw_version,
+			sizeof(hnode->hw_version));
+		strlcpy(hnode->sw_version, ident->sw_version,
+			sizeof(hnode->sw_version));
+
+		if (is_node_started(node))
+			hnode->flags |= CO_HANDOVER_NODE_STARTED;
+
+		if (node->is_heartbeat_supported)
+			hnode->flags |= CO_HANDOVER_NODE_HEARTBEAT;
+
+		const struct sdo_req_queue* queue = sdo_req_queue_find(i);
+		if (queue) {
+			hnode->srtt = queue->srtt;
+			hnode->rttvar = queue->rttvar;
+		}
+	}
 }
 
-static int master_send_sdo(int nodeid, int index, int subindex,
-			   unsigned char* data, size_t size)
+/* Nothing goes out on the bus from here on. The drivers are unloaded without
+ * stopping the nodes on the way out.
+ */
+static void hand_over(void)
 {
-	struct sdo_req_info info = {
-		.type = SDO_REQ_DOWNLOAD,
-		.index = index,
-		.subindex = subindex,
-		.dl_data = data,
-		.dl_size = size,
-		.on_done = on_master_sdo_send_done
-	};
+	is_handed_over_ = 1;
 
-	struct sdo_req* req = sdo_req_new(&info);
-	if (!req)
-		return -1;
+	stop_sync_timer();
+	stop_time_producer();
+	stop_master_heartbeat();
+	stop_guard_timer();
 
-	int rc = sdo_req_start(req, sdo_req_queue_get(nodeid));
+	if (mux_handler_)
+		mloop_socket_stop(mux_handler_);
 
-	sdo_req_unref(req);
-	return rc;
+	if (mux_poller_)
+		mloop_idle_stop(mux_poller_);
+
+	rest_stop_server();
+	sdo_gateway_stop_server();
+	mloop_socket_stop(handover_handler_);
+
+	mloop_exit(mloop_default());
 }
-#endif /* NO_MAREL_CODE */
 
-int co__rpdox(int nodeid, int type, const void* data, size_t size)
+static void on_handover_request(struct mloop_socket* self)
 {
-	if (!data || size > CAN_MAX_DLEN)
-		return -1;
+	static struct co_handover_state state;
+	int listen_fd = mloop_socket_get_fd(self);
 
-	struct can_frame cf = {
-		.can_id = type + nodeid,
-		.can_dlc = size
+	if (!can_hand_over()) {
+		plog(LOG_NOTICE, "Refused a handover request");
+		co_handover_refuse(listen_fd);
+		return;
+	}
+
+	get_handover_state(&state);
+
+	int fds[HANDOVER_FD_COUNT] = {
+		[HANDOVER_FD_BUS] = socket_.fd,
+		[HANDOVER_FD_REST] = rest_get_server_fd(),
+		[HANDOVER_FD_LISTEN] = listen_fd,
+		[HANDOVER_FD_GATEWAY] = sdo_gateway_get_server_fd(),
 	};
 
-	memcpy(cf.data, data, size);
+	size_t n_fds = fds[HANDOVER_FD_GATEWAY] >= 0 ? HANDOVER_FD_COUNT
+						     : HANDOVER_FD_GATEWAY;
+
+	if (co_handover_give(listen_fd, &state, fds, n_fds) < 0) {
+		plog(LOG_WARNING, "Handover failed: %s", strerror(errno));
+		return;
+	}
 
-	return sock_send(&socket_, &cf, 0);
+	plog(LOG_NOTICE, "Handed %d nodes over to the new master",
+	     state.n_nodes);
 
+	hand_over();
 }
 
-int co__start(int nodeid)
+static int init_handover(void)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	assert(node);
+	if (!cfg.enable_handover)
+		return 0;
 
-	if (!(node->ndrv.options & CO_OPT_INHIBIT_START))
-		return -1;
+	if (shard_role_ != SHARD_ROLE_NONE) {
+		plog(LOG_WARNING, "Handover is not supported on a shared bus");
+		return 0;
+	}
 
-	node->ndrv.options &= ~CO_OPT_INHIBIT_START;
+	int fd = handover_fd_[HANDOVER_FD_LISTEN];
+	handover_fd_[HANDOVER_FD_LISTEN] = -1;
+
+	if (fd < 0) {
+		char path[256];
+		compose_handover_path(path, sizeof(path));
+
+		fd = net_unix_listen(path);
+		if (fd < 0) {
+			plog(LOG_ERROR, "Could not listen for handover requests on %s: %s",
+			     path, strerror(errno));
+			return -1;
+		}
+	}
+
+	net_dont_block(fd);
 
-	if (master_state_ != MASTER_STATE_STARTUP)
-		start_single_node(node);
-	else if (--n_inhibited_starts == 0)
-		start_all_nodes();
+	handover_handler_ = mloop_socket_new(mloop_default());
+	if (!handover_handler_) {
+		close(fd);
+		return -1;
+	}
 
-	return 0;
+	mloop_socket_set_fd(handover_handler_, fd);
+	mloop_socket_set_callback(handover_handler_, on_handover_request);
+	return mloop_socket_start(handover_handler_);
 }
 
-#ifndef NO_MAREL_CODE
-static int master_send_pdo(int nodeid, int n, unsigned char* data, size_t size)
+static void cleanup_handover(void)
 {
-	switch (n) {
-	case 1: return co__rpdox(nodeid, R_RPDO1, data, size);
-	case 2: return co__rpdox(nodeid, R_RPDO2, data, size);
-	case 3: return co__rpdox(nodeid, R_RPDO3, data, size);
-	case 4: return co__rpdox(nodeid, R_RPDO4, data, size);
+	if (handover_handler_) {
+		mloop_socket_stop(handover_handler_);
+		mloop_socket_unref(handover_handler_);
+		handover_handler_ = NULL;
 	}
 
-	abort();
-	return -1;
+	/* Left over if the startup failed half way */
+	for (int i = 0; i < HANDOVER_FD_COUNT; ++i)
+		if (handover_fd_[i] >= 0)
+			close(handover_fd_[i]);
+
+	memset(handover_fd_, -1, sizeof(handover_fd_));
 }
 
-static void* master_iface_init(int nodeid)
+/* The nodes are up and configured already, so they are neither reset nor
+ * probed. Their drivers are loaded and they are started as usual, which
+ * changes nothing for those that are operational.
+ */
+static int start_warm_bootup(void)
 {
-	struct legacy_master_iface cb;
-	cb.set_node_state = master_set_node_state;
-	cb.request_sdo = master_request_sdo;
-	cb.send_sdo = master_send_sdo;
-	cb.send_pdo = master_send_pdo;
-	cb.nodeid = nodeid;
+	int i;
 
-	return legacy_master_iface_new(&cb);
-}
-#endif /* NO_MAREL_CODE */
+	profile("Take nodes over...\n");
 
-static int init_heartbeat_timer(struct co_master_node* node)
-{
-	int nodeid = co_master_get_node_id(node);
+	bootup_phase_ = BOOTUP_PHASE_LOAD;
+	co_timeline_begin(0, CO_TIMELINE_WAIT);
 
-	struct mloop_timer* timer = mloop_timer_new(mloop_default());
-	if (!timer)
-		return -1;
+	for_each_node(i) {
+		const struct co_handover_node* hnode = handover_node_[i];
+		if (!hnode)
+			continue;
 
-	uint64_t period = cfg.node[nodeid].heartbeat_period
-			+ cfg.node[nodeid].heartbeat_timeout;
+		nodes_seen_[i] = 1;
 
-	if (cfg.node[nodeid].n_timeouts_max > 0)
-		mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
+		struct sdo_req_queue* queue = sdo_req_queue_get(i);
+		if (queue) {
+			queue->srtt = hnode->srtt;
+			queue->rttvar = hnode->rttvar;
+		}
 
-	mloop_timer_set_context(timer, node, NULL);
-	mloop_timer_set_time(timer, period * 1000000LL);
-	mloop_timer_set_callback(timer, on_heartbeat_timeout);
-	node->heartbeat_timer = timer;
+		if (schedule_load_driver(i) < 0)
+			plog(LOG_ERROR, "Could not schedule loading of the driver for node %d",
+			     i);
+	}
 
+	check_bootup_done();
 	return 0;
 }
 
-static int init_ping_timer(struct co_master_node* node)
+static void set_worker_priority(void)
 {
-	int nodeid = co_master_get_node_id(node);
+	if (cfg.worker_priority <= 0)
+		return;
 
-	struct mloop_timer* timer = mloop_timer_new(mloop_default());
-	if (!timer)
-		return -1;
+#ifdef mloop_set_worker_priority
+	if (mloop_set_worker_priority(cfg.worker_priority) < 0)
+		plog(LOG_WARNING, "Invalid worker priority: %d",
+		     (int)cfg.worker_priority);
+#else
+	plog(LOG_WARNING, "Worker priorities are not supported by mloop");
+#endif
+}
+
+static void set_worker_affinity(void)
+{
+	int cpus[64];
 
-	mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
-	mloop_timer_set_context(timer, node, NULL);
-	mloop_timer_set_time(timer, cfg.node[nodeid].heartbeat_period * 1000000LL);
-	mloop_timer_set_callback(timer, on_ping_timeout);
-	node->ping_timer = timer;
+	if (string_is_empty(cfg.worker_cpus))
+		return;
 
-	return 0;
+	int n = string_parse_int_list(cpus, 64, cfg.worker_cpus);
+	if (n < 0) {
+		plog(LOG_WARNING, "Invalid worker CPU list: %s",
+		     cfg.worker_cpus);
+		return;
+	}
+
+#ifdef mloop_set_worker_cpus
+	if (mloop_set_worker_cpus(cpus, n) < 0)
+		plog(LOG_WARNING, "Could not pin worker threads to CPUs %s",
+		     cfg.worker_cpus);
+#else
+	plog(LOG_WARNING, "Worker CPU affinity is not supported by mloop");
+#endif
 }
 
-static void unload_all_drivers()
+static void prefault_stack(void)
 {
-	int i;
-	for_each_node(i)
-		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
-			unload_driver(i);
+	volatile char stack[PREFAULT_STACK_SIZE];
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	for (size_t i = 0; i < sizeof(stack); i += page_size)
+		stack[i] = 0;
 }
 
-static int init_trace_dump_path(const char* path)
+static void prefault_heap(size_t size)
 {
-	struct stat st;
+	char* heap = malloc(size);
+	if (!heap)
+		return;
 
-	if (stat(path, &st) == 0) {
-		if (!S_ISDIR(st.st_mode)) {
-			errno = EEXIST;
-			return -1;
-		}
-	} else {
-		if (mkdir(path, 0755) < 0)
-			return -1;
-	}
+	long page_size = sysconf(_SC_PAGESIZE);
 
-	return 0;
+	for (size_t i = 0; i < size; i += page_size)
+		((volatile char*)heap)[i] = 0;
+
+	free(heap);
 }
 
-void on_stop_signal(struct mloop_signal* sig, int signo)
+/* Memory that is touched up front and locked can not cause page faults later
+ * on. The heap is kept from shrinking so that the pre-faulted part stays
+ * mapped.
+ */
+static void lock_memory(void)
 {
-	(void)sig;
+	if (!cfg.lock_memory)
+		return;
 
-	switch (signo) {
-	case SIGUSR1:
-		dump_tracebuffer(NULL);
-		break;
-	default:
-		mloop_exit(mloop_default());
-		break;
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		plog(LOG_WARNING, "Could not lock memory: %s", strerror(errno));
+		return;
 	}
+
+	prefault_stack();
+	prefault_heap(cfg.heap_reserve_size);
 }
 
-int init_signal_handler(struct mloop* mloop)
+/* This must be done after the workers have been started or they would
+ * inherit it.
+ */
+static void set_mux_affinity(void)
 {
-	struct mloop_signal* ms = mloop_signal_new(mloop);
-	if (!ms)
-		return -1;
+	if (cfg.mux_cpu < 0)
+		return;
 
-	sigset_t s;
-	sigemptyset(&s);
-	sigaddset(&s, SIGINT);
-	sigaddset(&s, SIGTERM);
-	sigaddset(&s, SIGQUIT);
-	sigaddset(&s, SIGUSR1);
+	if (cfg.mux_cpu >= CPU_SETSIZE) {
+		plog(LOG_WARNING, "Invalid main loop CPU: %d", (int)cfg.mux_cpu);
+		return;
+	}
 
-	pthread_sigmask(SIG_BLOCK, &s, NULL);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cfg.mux_cpu, &set);
 
-	mloop_signal_set_signals(ms, &s);
-	mloop_signal_set_callback(ms, on_stop_signal);
-	int rc = mloop_signal_start(ms);
-	mloop_signal_unref(ms);
-	return rc;
+	int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rc != 0)
+		plog(LOG_WARNING, "Failed to pin the main loop to CPU %d: %s",
+		     (int)cfg.mux_cpu, strerror(rc));
 }
 
 __attribute__((visibility("default")))
@@ -1557,30 +5758,96 @@ int co_master_run(void)
 	profiling_reset();
 	profile("Starting up canopen-master...\n");
 
+	lock_memory();
+
+	if (cfg.use_fast_clock && fastclock_init() < 0)
+		plog(LOG_NOTICE, "No usable CPU counter; timestamps are taken with clock_gettime()");
+
 	memset(nodes_seen_, 0, sizeof(nodes_seen_));
 	memset(nodes_seen_late_, 0, sizeof(nodes_seen_));
+	memset(sdo_probe_pending_, 0, sizeof(sdo_probe_pending_));
 	memset(co_master_node_, 0, sizeof(co_master_node_));
+	memset(co_master_node_ident_, 0, sizeof(co_master_node_ident_));
 
 	mloop_ = mloop_default();
 	mloop_ref(mloop_);
 
+	if (tx_pdo_init() < 0) {
+		rc = 1;
+		goto rest_init_failure;
+	}
+
 	profile("Load EDS database...\n");
 	eds_db_load();
 
+	if (cfg.enable_handover && cfg.shard_role[0] == '\0'
+	 && take_handover() < 0) {
+		rc = 1;
+		goto rest_init_failure;
+	}
+
 	profile("Initialize and register SDO REST service...\n");
-	if (rest_init(cfg.rest_port) < 0) {
+	if (open_rest_server() < 0) {
 		perror("Could not initialize rest service");
 		goto rest_init_failure;
 	}
 
+	rest_set_limits(cfg.rest_max_clients, cfg.rest_max_jobs,
+			cfg.rest_max_waiting_jobs);
+
 	if (rest_register_service(HTTP_GET | HTTP_PUT,
 				  "sdo", sdo_rest_service) < 0)
 		goto rest_service_failure;
 
+	if (rest_register_service(HTTP_GET, "stats", stats_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "mloop", mloop_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_PUT, "driver", driver_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_PUT, "config", config_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "sync", sync_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "bus", bus_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET | HTTP_PUT, "latency",
+				  latency_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "events", events_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "ws", ws_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "metrics", metrics_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET | HTTP_PUT, "snapshot",
+				  snapshot_rest_service) < 0)
+		goto rest_service_failure;
+
+	profile("Initialize SDO gateway...\n");
+	if (open_sdo_gateway() < 0) {
+		perror("Could not initialize SDO gateway");
+		goto rest_service_failure;
+	}
+
+	co_stats_reset();
+
+	co_bus_health_reset();
+	co_bus_health_set_recovery_time(cfg.bus_error_recovery_time * 1000ULL);
+
 	profile("Open interface...\n");
 	enum sock_type sock_type = cfg.use_tcp ? SOCK_TYPE_TCP : SOCK_TYPE_CAN;
-	if (sock_open(&socket_, sock_type, cfg.iface,
-		      cfg.trace_buffer_size > 0 ? &tracebuffer_ : NULL) < 0) {
+	if (open_bus(sock_type) < 0) {
 		perror("Could not open CAN bus");
 		goto socketcan_open_failure;
 	}
@@ -1592,6 +5859,11 @@ int co_master_run(void)
 	}
 #endif /* NO_MAREL_CODE */
 
+	if (cfg.enable_process_image && co_pi_init(cfg.iface) < 0) {
+		perror("Could not create process image");
+		goto process_image_failure;
+	}
+
 	enum sdo_async_quirks_flags sdo_quirks;
 	sdo_quirks = cfg.be_strict ? SDO_ASYNC_QUIRK_NONE : SDO_ASYNC_QUIRK_ALL;
 
@@ -1600,9 +5872,62 @@ int co_master_run(void)
 			< 0)
 		goto sdo_req_queues_failure;
 
-	if (sock_type == SOCK_TYPE_CAN)
+	sdo_req_queues_set_send_fn(tx_stage_sdo);
+
+	if (init_sharding() < 0) {
+		rc = 1;
+		goto sharding_failure;
+	}
+
+	if (init_handover() < 0) {
+		rc = 1;
+		goto handover_failure;
+	}
+
+	if (socket_.type == SOCK_TYPE_CAN) {
 		net_fix_sndbuf(socket_.fd);
 
+		if (sock_enable_timestamps(&socket_) < 0)
+			plog(LOG_WARNING, "Kernel receive timestamps are not available");
+
+		/* Shards get error frames from the owner */
+		if (shard_role_ != SHARD_ROLE_SHARD
+		 && sock_enable_error_frames(&socket_) < 0)
+			plog(LOG_WARNING, "CAN error frames are not available");
+
+		if (cfg.use_can_fd) {
+			if (sock_enable_fd_frames(&socket_) == 0)
+				pdo_size_max_ = CANFD_MAX_DLEN;
+			else
+				plog(LOG_WARNING, "CAN FD is not supported on %s",
+				     cfg.iface);
+		}
+
+		if (cfg.use_io_uring && sock_enable_uring(&socket_) < 0)
+			plog(LOG_WARNING, "io_uring is not available: %s",
+			     strerror(errno));
+	}
+
+	co_drv_exec_set_default_budget(cfg.driver_callback_budget);
+
+	int emcy_policy = co_emcy_policy_from_string(cfg.emcy_policy);
+	if (emcy_policy < 0) {
+		plog(LOG_WARNING, "Unknown emcy_policy \"%s\"; passing on all EMCYs",
+		     cfg.emcy_policy);
+		emcy_policy = CO_EMCY_POLICY_ALL;
+	}
+
+	emcy_limit_config_.policy = emcy_policy;
+	emcy_limit_config_.window = cfg.emcy_repeat_window;
+	emcy_limit_config_.rate = cfg.emcy_rate;
+	emcy_limit_config_.burst = cfg.emcy_burst;
+
+	if (co_log_start(cfg.log_repeat_window) < 0)
+		plog(LOG_WARNING, "Could not start the log thread; logging on the main loop instead");
+
+	if (start_bus_load_timer() < 0)
+		plog(LOG_WARNING, "Could not start the bus load estimator; SDOs are not throttled");
+
 #ifndef NO_MAREL_CODE
 	profile("Create legacy driver manager...\n");
 	driver_manager_ = legacy_driver_manager_new();
@@ -1615,25 +5940,72 @@ int co_master_run(void)
 	mloop_set_job_queue_size(cfg.job_queue_length);
 	mloop_set_worker_stack_size(cfg.job_queue_length);
 
+#ifdef mloop_set_max_events
+	if (mloop_set_max_events(mloop_default(), cfg.mloop_max_events) < 0)
+		plog(LOG_WARNING, "Could not set the main loop event batch size");
+#endif
+#ifdef mloop_set_work_stealing
+	mloop_set_work_stealing(cfg.use_work_stealing);
+#endif
+	set_worker_affinity();
+	set_worker_priority();
+
 	profile("Start worker threads...\n");
 	if (mloop_require_workers(cfg.n_workers) != 0) {
 		rc = 1;
 		goto worker_failure;
 	}
 
+	set_mux_affinity();
+
 	if (cfg.trace_buffer_size > 0) {
 		profile("Initialize trace buffer...\n");
-		if (tb_init(&tracebuffer_, cfg.trace_buffer_size) < 0) {
+		if (init_tracebuffer() < 0) {
 			perror("Could not initialize trace buffer");
 			rc = 1;
 			goto tracebuffer_failure;
 		}
 
-		if (init_trace_dump_path(cfg.trace_dump_path) < 0) {
+		load_trace_filter();
+
+		if (trace_format_from_string(&trace_dump_format_,
+					     cfg.trace_dump_format) < 0)
+			plog(LOG_WARNING, "Invalid trace_dump_format: \"%s\"",
+			     cfg.trace_dump_format);
+
+		if (init_directory(cfg.trace_dump_path) < 0) {
 			perror("Could not create directory for trace dump");
 			rc = 1;
 			goto trace_dump_path_failure;
 		}
+
+		if (cfg.enable_trace_stream) {
+			struct trace_stream_params params = {
+				.path = cfg.trace_dump_path,
+				.iface = cfg.iface,
+				.range_start = nodeid_min(),
+				.range_stop = nodeid_max(),
+				.file_size = cfg.trace_stream_file_size,
+				.file_age = cfg.trace_stream_file_age,
+				.retention = cfg.trace_stream_retention,
+			};
+
+			if (trace_stream_start(&tracebuffer_, &params) < 0)
+				plog(LOG_WARNING, "Could not start trace stream");
+		}
+	} else if (cfg.enable_trace_stream) {
+		plog(LOG_WARNING, "enable_trace_stream requires trace_buffer_size");
+	}
+
+	if (cfg.identity_cache_dir[0]) {
+		char path[256];
+		compose_identity_cache_path(path, sizeof(path));
+
+		/* Without the cache, identities are read from the nodes */
+		if (init_directory(cfg.identity_cache_dir) < 0
+		 || identity_cache_load(path) < 0)
+			plog(LOG_WARNING, "Could not load identity cache %s: %m",
+			     path);
 	}
 
 	init_signal_handler(mloop_);
@@ -1641,8 +6013,12 @@ int co_master_run(void)
 #ifndef NO_MAREL_CODE
 	rc = run_appbase();
 #else
-	if (start_bootup() < 0)
+	if (start_bootup() < 0) {
+		rc = 1;
 		goto bootup_failure;
+	}
+
+	set_priority();
 
 	rc = mloop_run(mloop_);
 #endif /* NO_MAREL_CODE */
@@ -1651,12 +6027,63 @@ int co_master_run(void)
 
 	unload_all_drivers();
 
+	stop_sync_timer();
+	stop_time_producer();
+
+	if (!is_handed_over_) {
+		tx_pdo_drain();
+		tx_flush();
+	}
+	tx_cleanup();
+
+	if (sync_timer_) {
+		mloop_timer_unref(sync_timer_);
+		sync_timer_ = NULL;
+	}
+
+	if (cycle_timer_) {
+		mloop_timer_stop(cycle_timer_);
+		mloop_timer_unref(cycle_timer_);
+		cycle_timer_ = NULL;
+	}
+
+	if (time_timer_) {
+		mloop_timer_unref(time_timer_);
+		time_timer_ = NULL;
+	}
+
+bootup_failure:
+	stop_guard_timer();
+	stop_master_heartbeat();
+
+	if (bus_load_timer_) {
+		mloop_timer_stop(bus_load_timer_);
+		mloop_timer_unref(bus_load_timer_);
+		bus_load_timer_ = NULL;
+	}
+
+	if (lss_.timer) {
+		co_lss_stop(&lss_);
+		co_lss_destroy(&lss_);
+	}
+
+	if (bootup_timer_) {
+		mloop_timer_stop(bootup_timer_);
+		mloop_timer_unref(bootup_timer_);
+	}
+
 	if (mux_handler_) {
 		mloop_socket_set_fd(mux_handler_, -1);
 		mloop_socket_unref(mux_handler_);
 	}
 
-bootup_failure:
+	if (mux_poller_) {
+		mloop_idle_stop(mux_poller_);
+		mloop_idle_unref(mux_poller_);
+	}
+
+	trace_stream_stop();
+
 trace_dump_path_failure:
 	if (cfg.trace_buffer_size > 0)
 		tb_destroy(&tracebuffer_);
@@ -1667,24 +6094,187 @@ worker_failure:
 #endif /* NO_MAREL_CODE */
 
 driver_manager_failure:
+	co_log_stop();
+handover_failure:
+	cleanup_handover();
+sharding_failure:
+	cleanup_sharding();
 	sdo_req_queues_cleanup();
+	sdo_cache_clear();
+	co_drv_registry_clear();
 
 sdo_req_queues_failure:
 	if (socket_.fd >= 0)
 		sock_close(&socket_);
 
+	co_pi_cleanup();
+process_image_failure:
 #ifndef NO_MAREL_CODE
 	canopen_info_cleanup();
 #endif /* NO_MAREL_CODE */
 info_failure:
 socketcan_open_failure:
 rest_service_failure:
+	sdo_gateway_cleanup();
+	ws_rest_cleanup();
+	events_rest_cleanup();
+	sdo_rest_cleanup();
 	rest_cleanup();
 
 rest_init_failure:
+	cleanup_handover();
 	eds_db_unload();
+	tx_pdo_cleanup();
 
 	mloop_unref(mloop_);
 	return rc;
 }
 
+
+static pid_t bus_pid_[CO_MASTER_BUSES_MAX];
+static size_t n_buses_ = 0;
+
+static const int forwarded_signals_[] = {
+	SIGINT, SIGTERM, SIGQUIT, SIGUSR1, SIGUSR2, SIGHUP
+};
+
+static void forward_signal(int signo)
+{
+	for (size_t i = 0; i < n_buses_; ++i)
+		if (bus_pid_[i] > 0)
+			kill(bus_pid_[i], signo);
+}
+
+static void pin_to_cpu(int index)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus <= 1)
+		return;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(index % ncpus, &set);
+
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		plog(LOG_WARNING, "Failed to set CPU affinity for %s: %s",
+		     cfg.iface, strerror(errno));
+}
+
+/* Slashes in the interface name are replaced so that it stays one path
+ * component
+ */
+static void append_iface(char* path, size_t size, char separator)
+{
+	if (string_is_empty(path))
+		return;
+
+	size_t len = strlen(path);
+	snprintf(path + len, size - len, "%c%s", separator, cfg.iface);
+
+	for (char* p = path + len + 1; *p; ++p)
+		if (*p == '/')
+			*p = '_';
+}
+
+static int run_bus(const char* iface, int index)
+{
+	strlcpy(cfg.iface, iface, sizeof(cfg.iface));
+	cfg.rest_port += index;
+
+	if (cfg.sdo_gateway_port)
+		cfg.sdo_gateway_port += index;
+
+	/* The buses must not share files or sockets. The default handover and
+	 * shard paths already have the interface in them.
+	 */
+	append_iface(cfg.trace_buffer_file, sizeof(cfg.trace_buffer_file), '.');
+	append_iface(cfg.handover_path, sizeof(cfg.handover_path), '.');
+	append_iface(cfg.shard_path, sizeof(cfg.shard_path), '.');
+
+	init_directory(cfg.trace_dump_path);
+	append_iface(cfg.trace_dump_path, sizeof(cfg.trace_dump_path), '/');
+
+	pin_to_cpu(index);
+
+	return co_master_run();
+}
+
+/* Each bus is driven by a process of its own because the master keeps its
+ * state in globals. The EDS database is loaded and fully parsed before
+ * forking so that it is parsed once and its pages are shared between the
+ * buses. Driver DSOs are shared through the page cache.
+ */
+__attribute__((visibility("default")))
+int co_master_run_buses(const char* const* ifaces, size_t n)
+{
+	int rc = 0;
+
+	if (n == 0 || n > CO_MASTER_BUSES_MAX)
+		return -1;
+
+	if (n == 1) {
+		strlcpy(cfg.iface, ifaces[0], sizeof(cfg.iface));
+		return co_master_run();
+	}
+
+	profile("Load shared EDS database...\n");
+	eds_db_load();
+	eds_db_parse_all();
+
+	const size_t n_signals = ARRAY_LENGTH(forwarded_signals_);
+	sigset_t forwarded, mask;
+	sigemptyset(&forwarded);
+	for (size_t i = 0; i < n_signals; ++i)
+		sigaddset(&forwarded, forwarded_signals_[i]);
+
+	struct sigaction sa = { .sa_handler = forward_signal };
+	sa.sa_mask = forwarded;
+	for (size_t i = 0; i < n_signals; ++i)
+		sigaction(forwarded_signals_[i], &sa, NULL);
+
+	/* A signal that arrives while a bus is being forked is held back until
+	 * its pid has been stored, so that it reaches the new bus as well.
+	 */
+	for (size_t i = 0; i < n; ++i) {
+		sigprocmask(SIG_BLOCK, &forwarded, &mask);
+
+		pid_t pid = fork();
+		if (pid < 0) {
+			sigprocmask(SIG_SETMASK, &mask, NULL);
+			plog(LOG_ERROR, "Failed to start master for %s: %s",
+			     ifaces[i], strerror(errno));
+			forward_signal(SIGTERM);
+			rc = -1;
+			break;
+		}
+
+		if (pid == 0) {
+			sa.sa_handler = SIG_DFL;
+			for (size_t j = 0; j < n_signals; ++j)
+				sigaction(forwarded_signals_[j], &sa, NULL);
+
+			sigprocmask(SIG_SETMASK, &mask, NULL);
+			_exit(run_bus(ifaces[i], i) == 0 ? 0 : 1);
+		}
+
+		bus_pid_[i] = pid;
+		n_buses_ = i + 1;
+
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+	}
+
+	for (size_t i = 0; i < n_buses_; ++i) {
+		int status = 0;
+
+		while (waitpid(bus_pid_[i], &status, 0) < 0 && errno == EINTR);
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			rc = -1;
+
+		bus_pid_[i] = 0;
+	}
+
+	eds_db_unload();
+
+	return rc;
+}
@@ -0,0 +1,458 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <mloop.h>
+
+#include "canopen.h"
+#include "canopen/master.h"
+#include "canopen/stats.h"
+#include "canopen/sdo_req.h"
+#include "canopen/bus_health.h"
+#include "co_atomic.h"
+#include "rest.h"
+#include "metrics-rest.h"
+#include "time-utils.h"
+
+#define METRICS_REST_CONTENT_TYPE "text/plain; version=0.0.4"
+
+static void metrics_rest__reply(struct rest_client* client,
+				const char* status_code, const char* type,
+				const char* message, size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void metrics_rest__error(struct rest_client* client,
+				const char* status_code, const char* message)
+{
+	metrics_rest__reply(client, status_code, "text/plain", message,
+			    strlen(message));
+}
+
+static void metrics_rest__print_type(struct arena_text* out, const char* name,
+				     const char* type, const char* help)
+{
+	arena_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name,
+		     type);
+}
+
+/* All histograms in the master have buckets that double in width from one
+ * microsecond, with the last bucket counting anything larger. The upper
+ * bounds are printed in seconds. A sum is only printed if it is known.
+ */
+static void metrics_rest__print_histogram(struct arena_text* out,
+					  const char* name,
+					  const char* labels,
+					  const uint64_t* bucket, size_t n,
+					  const uint64_t* sum)
+{
+	const char* sep = *labels ? "," : "";
+	uint64_t count = 0;
+
+	for (size_t i = 0; i + 1 < n; ++i) {
+		count += bucket[i];
+		arena_printf(out, "%s_bucket{%s%sle=\"%g\"} %" PRIu64 "\n",
+			     name, labels, sep, (double)(2ULL << i) / 1e6,
+			     count);
+	}
+
+	count += bucket[n - 1];
+	arena_printf(out, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name,
+		     labels, sep, count);
+
+	const char* open = *labels ? "{" : "";
+	const char* close = *labels ? "}" : "";
+
+	if (sum)
+		arena_printf(out, "%s_sum%s%s%s %g\n", name, open, labels,
+			     close, *sum / 1e6);
+
+	arena_printf(out, "%s_count%s%s%s %" PRIu64 "\n", name, open, labels,
+		     close, count);
+}
+
+static int metrics_rest__is_empty(const uint64_t* bucket, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		if (bucket[i])
+			return 0;
+
+	return 1;
+}
+
+static void metrics_rest__print_frames(struct arena_text* out, const char* name,
+				       const char* help, int is_tx,
+				       const struct co_stats_node* stats)
+{
+	metrics_rest__print_type(out, name, "counter", help);
+
+	for (int nodeid = 0; nodeid < CO_STATS_NODE_COUNT; ++nodeid) {
+		const uint64_t* count = is_tx ? stats[nodeid].tx
+					      : stats[nodeid].rx;
+
+		for (int i = 0; i < CO_STATS_FUNCTION_COUNT; ++i) {
+			const char* function = co_stats_function_name(i);
+			if (!function || count[i] == 0)
+				continue;
+
+			arena_printf(out,
+				     "%s{node=\"%d\",function=\"%s\"} %" PRIu64
+				     "\n", name, nodeid, function, count[i]);
+		}
+	}
+}
+
+static void metrics_rest__print_node_histograms(struct arena_text* out,
+						const char* name,
+				const char* help, enum co_stats_histogram first,
+				int n_histograms,
+				const struct co_stats_node* stats)
+{
+	metrics_rest__print_type(out, name, "histogram", help);
+
+	for (int nodeid = 0; nodeid < CO_STATS_NODE_COUNT; ++nodeid)
+		for (int i = 0; i < n_histograms; ++i) {
+			const uint64_t* bucket =
+				stats[nodeid].histogram[first + i];
+
+			if (metrics_rest__is_empty(bucket, CO_STATS_N_BUCKETS))
+				continue;
+
+			char labels[32];
+			if (n_histograms > 1)
+				snprintf(labels, sizeof(labels),
+					 "node=\"%d\",tpdo=\"%d\"", nodeid,
+					 i + 1);
+			else
+				snprintf(labels, sizeof(labels),
+					 "node=\"%d\"", nodeid);
+
+			metrics_rest__print_histogram(out, name, labels, bucket,
+						      CO_STATS_N_BUCKETS, NULL);
+		}
+}
+
+static void metrics_rest__print_traffic(struct arena_text* out)
+{
+	struct co_stats_node* stats =
+		arena_alloc(out->arena, CO_STATS_NODE_COUNT * sizeof(*stats));
+	if (!stats)
+		return;
+
+	for (int i = 0; i < CO_STATS_NODE_COUNT; ++i)
+		co_stats_get_node(&stats[i], i);
+
+	metrics_rest__print_frames(out, "canopen_frames_received_total",
+				   "Frames received by node and function.", 0,
+				   stats);
+	metrics_rest__print_frames(out, "canopen_frames_sent_total",
+				   "Frames sent by node and function.", 1,
+				   stats);
+
+	metrics_rest__print_node_histograms(out,
+			"canopen_tpdo_interval_seconds",
+			"Time between consecutive TPDOs.",
+			CO_STATS_TPDO1_INTERVAL, 4, stats);
+	metrics_rest__print_node_histograms(out,
+			"canopen_heartbeat_interval_seconds",
+			"Time between consecutive heartbeats.",
+			CO_STATS_HEARTBEAT_INTERVAL, 1, stats);
+	metrics_rest__print_node_histograms(out,
+			"canopen_sdo_rtt_seconds",
+			"SDO round trip time.", CO_STATS_SDO_RTT, 1, stats);
+}
+
+/* The queue members are read without taking the queue lock. A value may be
+ * out of date, but never torn.
+ */
+static void metrics_rest__print_sdo_queues(struct arena_text* out)
+{
+	metrics_rest__print_type(out, "canopen_sdo_queue_length", "gauge",
+				 "SDO requests waiting or running per node.");
+
+	for (int nodeid = CANOPEN_NODEID_MIN; nodeid <= CANOPEN_NODEID_MAX;
+	     ++nodeid) {
+		struct sdo_req_queue* queue = sdo_req_queue_find(nodeid);
+		if (queue)
+			arena_printf(out,
+				     "canopen_sdo_queue_length{node=\"%d\"} "
+				     "%zu\n", nodeid,
+				     co_atomic_load(&queue->size));
+	}
+
+	metrics_rest__print_type(out, "canopen_sdo_srtt_seconds", "gauge",
+				 "Smoothed SDO round trip time per node.");
+
+	for (int nodeid = CANOPEN_NODEID_MIN; nodeid <= CANOPEN_NODEID_MAX;
+	     ++nodeid) {
+		struct sdo_req_queue* queue = sdo_req_queue_find(nodeid);
+		uint64_t srtt = queue ? co_atomic_load(&queue->srtt) : 0;
+
+		if (srtt)
+			arena_printf(out,
+				     "canopen_sdo_srtt_seconds{node=\"%d\"} "
+				     "%g\n", nodeid, srtt / 1e6);
+	}
+}
+
+static void metrics_rest__print_nodes(struct arena_text* out)
+{
+	metrics_rest__print_type(out, "canopen_node_missed_heartbeats",
+				 "gauge", "Heartbeats missed in a row per "
+				 "loaded node.");
+
+	for (int nodeid = CANOPEN_NODEID_MIN; nodeid <= CANOPEN_NODEID_MAX;
+	     ++nodeid) {
+		const struct co_master_node* node = co_master_get_node(nodeid);
+		if (node->driver_type == CO_MASTER_DRIVER_NONE)
+			continue;
+
+		arena_printf(out,
+			     "canopen_node_missed_heartbeats{node=\"%d\"} %"
+			     PRIu32 "\n", nodeid, node->ntimeouts);
+	}
+	metrics_rest__print_type(out, "canopen_emcy_held_back_total",
+				 "counter", "EMCYs not passed on to the driver "
+				 "per node and reason.");
+
+	for (int nodeid = CANOPEN_NODEID_MIN; nodeid <= CANOPEN_NODEID_MAX;
+	     ++nodeid) {
+		const struct co_emcy_limit* limit =
+			&co_master_get_node(nodeid)->emcy_limit;
+
+		if (limit->n_aggregated)
+			arena_printf(out,
+				     "canopen_emcy_held_back_total{node=\"%d\","
+				     "reason=\"aggregated\"} %" PRIu64 "\n",
+				     nodeid, limit->n_aggregated);
+
+		if (limit->n_dropped)
+			arena_printf(out,
+				     "canopen_emcy_held_back_total{node=\"%d\","
+				     "reason=\"dropped\"} %" PRIu64 "\n",
+				     nodeid, limit->n_dropped);
+	}
+}
+
+static void metrics_rest__print_counter(struct arena_text* out,
+					const char* name,
+					const char* help, uint64_t value)
+{
+	metrics_rest__print_type(out, name, "counter", help);
+	arena_printf(out, "%s %" PRIu64 "\n", name, value);
+}
+
+static void metrics_rest__print_gauge(struct arena_text* out, const char* name,
+				      const char* help, uint64_t value)
+{
+	metrics_rest__print_type(out, name, "gauge", help);
+	arena_printf(out, "%s %" PRIu64 "\n", name, value);
+}
+
+static void metrics_rest__print_master(struct arena_text* out)
+{
+	struct co_master_stats stats;
+	co_master_get_stats(&stats);
+
+	metrics_rest__print_counter(out, "canopen_heartbeat_timeouts_total",
+				    "Heartbeats that were missed.",
+				    stats.n_heartbeat_timeouts);
+	metrics_rest__print_counter(out, "canopen_nodes_lost_total",
+				    "Nodes unloaded after missing too many "
+				    "heartbeats.", stats.n_nodes_lost);
+	metrics_rest__print_counter(out, "canopen_tx_dropped_frames_total",
+				    "Frames dropped because the TX queue was "
+				    "full.", stats.n_tx_dropped);
+	metrics_rest__print_gauge(out, "canopen_tx_queue_frames",
+				  "Frames waiting in the TX queue.",
+				  stats.tx_queue_length);
+	metrics_rest__print_gauge(out, "canopen_bus_load_permille",
+				  "Estimated bus load in per mille of the bit "
+				  "rate.", stats.bus_load);
+	metrics_rest__print_gauge(out, "canopen_sdo_background_held",
+				  "1 while background SDOs are held back for "
+				  "sdo_bus_budget.", stats.is_sdo_held);
+
+	if (stats.trace_length == 0)
+		return;
+
+	uint64_t used = stats.n_trace_frames < stats.trace_length
+		      ? stats.n_trace_frames : stats.trace_length;
+
+	metrics_rest__print_counter(out, "canopen_trace_frames_total",
+				    "Frames recorded in the trace buffer.",
+				    stats.n_trace_frames);
+	metrics_rest__print_gauge(out, "canopen_trace_buffer_frames",
+				  "Frames the trace buffer can hold.",
+				  stats.trace_length);
+	metrics_rest__print_gauge(out, "canopen_trace_buffer_used_frames",
+				  "Frames held by the trace buffer.", used);
+}
+
+static void metrics_rest__print_bus(struct arena_text* out)
+{
+	struct co_bus_health health;
+	co_bus_health_get(&health, gettime_us(CLOCK_REALTIME));
+
+	metrics_rest__print_counter(out, "canopen_bus_error_frames_total",
+				    "Error frames received.",
+				    health.n_error_frames);
+	metrics_rest__print_counter(out, "canopen_bus_overflows_total",
+				    "Frames lost to receive overflows.",
+				    health.n_overflows);
+	metrics_rest__print_gauge(out, "canopen_bus_tx_error_count",
+				  "Transmit error counter of the controller.",
+				  health.tx_error_count);
+	metrics_rest__print_gauge(out, "canopen_bus_rx_error_count",
+				  "Receive error counter of the controller.",
+				  health.rx_error_count);
+}
+
+#ifdef mloop_get_stats
+
+static void metrics_rest__print_mloop_histogram(struct arena_text* out,
+						const char* name,
+		const char* help, const struct mloop_stats_histogram* histogram)
+{
+	metrics_rest__print_type(out, name, "histogram", help);
+	metrics_rest__print_histogram(out, name, "", histogram->bucket,
+				      MLOOP_STATS_N_BUCKETS, NULL);
+}
+
+static void metrics_rest__print_mloop(struct arena_text* out)
+{
+	struct mloop_stats* stats = arena_alloc(out->arena, sizeof(*stats));
+	if (!stats)
+		return;
+
+	mloop_get_stats(mloop_default(), stats);
+
+	metrics_rest__print_mloop_histogram(out,
+			"canopen_mloop_iteration_seconds",
+			"Time spent in each main loop iteration.",
+			&stats->iteration);
+	metrics_rest__print_mloop_histogram(out,
+			"canopen_mloop_timer_lag_seconds",
+			"How late timers were fired.", &stats->timer_lag);
+	metrics_rest__print_mloop_histogram(out,
+			"canopen_mloop_async_latency_seconds",
+			"Time from queuing an async job until it is run.",
+			&stats->async_latency);
+	metrics_rest__print_gauge(out, "canopen_mloop_event_batch_size",
+				  "Events taken from epoll at a time.",
+				  stats->event_batch_size);
+	metrics_rest__print_counter(out, "canopen_mloop_wakeups_total",
+				    "Wakeups of the main loop by other threads "
+				    "or async jobs.", stats->n_wakeups);
+	metrics_rest__print_counter(out,
+				    "canopen_mloop_wakeups_coalesced_total",
+				    "Wakeups that were merged into one that "
+				    "was already pending.",
+				    stats->n_wakeups_coalesced);
+	metrics_rest__print_gauge(out, "canopen_mloop_job_queue_length",
+				  "Jobs waiting for a worker thread.",
+				  stats->job_queue_depth);
+	metrics_rest__print_gauge(out, "canopen_mloop_job_queue_length_max",
+				  "Most jobs that have waited for a worker "
+				  "thread.", stats->job_queue_depth_max);
+}
+
+#else
+
+static void metrics_rest__print_mloop(struct arena_text* out)
+{
+	(void)out;
+}
+
+#endif /* mloop_get_stats */
+
+static void metrics_rest__print_rest(struct arena_text* out)
+{
+	struct rest_stats stats;
+	rest_get_stats(&stats);
+
+	const char* name = "canopen_rest_request_duration_seconds";
+
+	metrics_rest__print_type(out, name, "histogram",
+				 "Time taken to serve REST requests.");
+	metrics_rest__print_histogram(out, name, "", stats.latency,
+				      REST_STATS_N_BUCKETS, &stats.latency_sum);
+
+	name = "canopen_rest_job_wait_seconds";
+
+	metrics_rest__print_type(out, name, "histogram",
+				 "Time REST jobs waited for a job slot.");
+	metrics_rest__print_histogram(out, name, "", stats.job_wait,
+				      REST_STATS_N_BUCKETS, &stats.job_wait_sum);
+
+	metrics_rest__print_gauge(out, "canopen_rest_clients",
+				  "Open REST connections.", stats.n_clients);
+	metrics_rest__print_gauge(out, "canopen_rest_jobs_running",
+				  "REST jobs on the worker pool.",
+				  stats.n_jobs_running);
+	metrics_rest__print_gauge(out, "canopen_rest_jobs_waiting",
+				  "REST jobs waiting for a job slot.",
+				  stats.n_jobs_waiting);
+	metrics_rest__print_counter(out, "canopen_rest_rejected_clients_total",
+				    "REST connections turned away.",
+				    stats.n_clients_rejected);
+	metrics_rest__print_counter(out, "canopen_rest_rejected_jobs_total",
+				    "REST jobs turned away.",
+				    stats.n_jobs_rejected);
+}
+
+void metrics_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (client->req.url_index > 1) {
+		metrics_rest__error(client, "404 Not Found", "Not found\r\n");
+		return;
+	}
+
+	struct arena_text text;
+	arena_text_init(&text, &client->arena);
+	struct arena_text* out = &text;
+
+	metrics_rest__print_traffic(out);
+	metrics_rest__print_sdo_queues(out);
+	metrics_rest__print_nodes(out);
+	metrics_rest__print_master(out);
+	metrics_rest__print_bus(out);
+	metrics_rest__print_mloop(out);
+	metrics_rest__print_rest(out);
+
+	if (out->is_bad) {
+		metrics_rest__error(client, "500 Internal Server Error",
+				    "Out of memory\r\n");
+		return;
+	}
+
+	metrics_rest__reply(client, "200 OK", METRICS_REST_CONTENT_TYPE,
+			    out->data, out->length);
+}
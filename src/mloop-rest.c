@@ -0,0 +1,162 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dlfcn.h>
+#include <mloop.h>
+
+#include "rest.h"
+#include "mloop-rest.h"
+
+static void mloop_rest__reply(struct rest_client* client,
+			      const char* status_code, const char* type,
+			      const char* message, size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void mloop_rest__error(struct rest_client* client,
+			      const char* status_code, const char* message)
+{
+	mloop_rest__reply(client, status_code, "text/plain", message,
+			  strlen(message));
+}
+
+#ifdef mloop_get_stats
+
+static void mloop_rest__print_histogram(struct arena_text* out,
+				const struct mloop_stats_histogram* histogram)
+{
+	int last = MLOOP_STATS_N_BUCKETS - 1;
+	while (last >= 0 && histogram->bucket[last] == 0)
+		--last;
+
+	arena_printf(out, "{ \"count\": %" PRIu64 ", \"max\": %" PRIu64
+		     ", \"buckets\": [", histogram->count, histogram->max);
+
+	for (int i = 0; i <= last; ++i)
+		arena_printf(out, "%s%" PRIu64, i ? ", " : "",
+			     histogram->bucket[i]);
+
+	arena_printf(out, "] }");
+}
+
+/* Callbacks are only known by their address, so look up the symbol. Static
+ * functions need the binary to be linked with -rdynamic to be found.
+ */
+static void mloop_rest__print_callback_name(struct arena_text* out,
+					    const void* fn)
+{
+	Dl_info info;
+
+	if (dladdr(fn, &info) && info.dli_sname)
+		arena_printf(out, "\"%s\"", info.dli_sname);
+	else
+		arena_printf(out, "\"%p\"", fn);
+}
+
+static void mloop_rest__print_callbacks(struct arena_text* out,
+					const struct mloop_stats* stats)
+{
+	arena_printf(out, " \"callbacks\": [");
+
+	for (size_t i = 0; i < stats->n_callbacks; ++i) {
+		const struct mloop_stats_callback* callback =
+			&stats->callback[i];
+
+		arena_printf(out, "%s\n  { \"name\": ", i ? "," : "");
+		mloop_rest__print_callback_name(out, callback->fn);
+		arena_printf(out, ", \"duration\": ");
+		mloop_rest__print_histogram(out, &callback->duration);
+		arena_printf(out, " }");
+	}
+
+	arena_printf(out, "%s]", stats->n_callbacks ? "\n " : "");
+}
+
+void mloop_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (client->req.url_index > 1) {
+		mloop_rest__error(client, "404 Not Found", "Not found\r\n");
+		return;
+	}
+
+	struct mloop_stats* stats = arena_alloc(&client->arena,
+						sizeof(*stats));
+	if (!stats) {
+		mloop_rest__error(client, "500 Internal Server Error",
+				  "Out of memory\r\n");
+		return;
+	}
+
+	mloop_get_stats(mloop_default(), stats);
+
+	struct arena_text text;
+	arena_text_init(&text, &client->arena);
+	struct arena_text* out = &text;
+
+	arena_printf(out, "{\n \"iteration\": ");
+	mloop_rest__print_histogram(out, &stats->iteration);
+	arena_printf(out, ",\n \"timer-lag\": ");
+	mloop_rest__print_histogram(out, &stats->timer_lag);
+	arena_printf(out, ",\n \"async-latency\": ");
+	mloop_rest__print_histogram(out, &stats->async_latency);
+	arena_printf(out, ",\n \"event-batch-size\": %zu",
+		     stats->event_batch_size);
+	arena_printf(out, ",\n \"wakeups\": %lu", stats->n_wakeups);
+	arena_printf(out, ",\n \"wakeups-coalesced\": %lu",
+		     stats->n_wakeups_coalesced);
+	arena_printf(out, ",\n \"job-queue-depth\": %zu",
+		     stats->job_queue_depth);
+	arena_printf(out, ",\n \"job-queue-depth-max\": %zu,\n",
+		     stats->job_queue_depth_max);
+	mloop_rest__print_callbacks(out, stats);
+	arena_printf(out, "\n}\n");
+
+	if (out->is_bad) {
+		mloop_rest__error(client, "500 Internal Server Error",
+				  "Out of memory\r\n");
+		return;
+	}
+
+	mloop_rest__reply(client, "200 OK", "application/json", out->data,
+			  out->length);
+}
+
+#else
+
+void mloop_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	mloop_rest__error(client, "501 Not Implemented",
+			  "This mloop does not collect statistics\r\n");
+}
+
+#endif /* mloop_get_stats */
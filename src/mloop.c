@@ -21,6 +21,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -30,16 +31,40 @@
 #include <sys/signalfd.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
 #include <execinfo.h>
 #include <sys/queue.h>
 
 #include "atomic_compat.h"
 #include "mloop.h"
-#include "prioq.h"
+#include "mpmcq.h"
+#include "wsdeque.h"
+#include "objpool.h"
 
 #define EXPORT __attribute__((visibility("default")))
 
-#define MAX_EVENTS 16
+/* The number of events taken from epoll at a time grows while the batches
+ * come back full and shrinks again when they come back mostly empty.
+ */
+#define MLOOP__MIN_EVENTS 16
+#define MLOOP__MAX_EVENTS_DEFAULT 256
+
+/* Jobs are queued in fixed-priority lanes. Priorities from
+ * MLOOP__N_LANES - 1 and up share the last lane.
+ */
+#define MLOOP__N_LANES 4
+#define MLOOP__ASYNC_QUEUE_SIZE 1024
+
+/* The timer wheel has MLOOP__WHEEL_LEVELS levels of 64 slots. A slot on level
+ * l spans 64^l ticks, so the wheel covers 2^24 ticks, or about 4.6 hours, and
+ * anything further out waits on an overflow list.
+ */
+#define MLOOP__WHEEL_TICK 1000000ULL /* ns */
+#define MLOOP__WHEEL_LEVELS 4
+#define MLOOP__WHEEL_SLOT_BITS 6
+#define MLOOP__WHEEL_SLOTS (1 << MLOOP__WHEEL_SLOT_BITS)
 
 #define mloop__cas(ptr, expected, desired) \
 ({ \
@@ -99,18 +124,50 @@ struct mloop_socket {
 	int fd;
 	enum mloop_socket_event revents;
 	enum mloop_socket_event events;
+	int is_edge_triggered;
+	int is_continued;
+	TAILQ_ENTRY(mloop_socket) continue_links;
 };
 
+struct mloop__lanes {
+	struct mpmcq lane[MLOOP__N_LANES];
+};
+
+LIST_HEAD(mloop__timer_list, mloop_timer);
+
 struct mloop_timer {
 	struct mloop_socket socket; /* Do not move */
 	/* Members specific to timer can be added below */
 	enum mloop_timer_type timer_type;
 	uint64_t time;
+	uint64_t slack; /* ns */
+	int is_on_wheel;
+	uint64_t deadline; /* ns */
+	uint64_t tick; /* The tick at which it is due on the wheel */
+	struct mloop__timer_list* list;
+	LIST_ENTRY(mloop_timer) wheel_links;
+};
+
+/* All timers that are not precise share one timerfd per core. The timerfd is
+ * armed for the earliest slot that holds anything, so starting or stopping a
+ * timer only takes a system call if it becomes the earliest one.
+ */
+struct mloop__wheel {
+	struct mloop_socket socket;
+	pthread_mutex_t mutex;
+	uint64_t current; /* The last tick that has been processed */
+	uint64_t armed; /* The tick that the timerfd is armed for or 0 */
+	size_t count;
+	uint64_t occupied[MLOOP__WHEEL_LEVELS];
+	struct mloop__timer_list slot[MLOOP__WHEEL_LEVELS][MLOOP__WHEEL_SLOTS];
+	struct mloop__timer_list overflow;
+	struct mloop__timer_list expired;
 };
 
 #define MLOOP_JOB_COMMON \
 	unsigned long priority; \
-	int is_cancelled;
+	int is_cancelled; \
+	uint64_t queued_at; /* ns */
 
 struct mloop_async {
 	MLOOP_COMMON /* Do not move */
@@ -144,17 +201,36 @@ struct mloop_idle {
 
 LIST_HEAD(mloop_object_list, mloop_common);
 TAILQ_HEAD(mloop_idle_list, mloop_idle);
+TAILQ_HEAD(mloop_socket_list, mloop_socket);
+
+/* Statistics are only written by the thread that runs the loop */
+struct mloop__stats {
+	struct mloop_stats_histogram iteration;
+	struct mloop_stats_histogram timer_lag;
+	struct mloop_stats_histogram async_latency;
+	unsigned long n_wakeups;
+	struct mloop_stats_callback callback[MLOOP_STATS_CALLBACKS_MAX];
+};
 
 struct mloop_core {
 	int ref;
 	int epollfd;
 	struct mloop_socket break_out_socket;
+	int is_break_out_pending;
+	unsigned long n_wakeups_coalesced;
+	struct mloop__wheel wheel;
+	struct mloop__stats stats;
+	struct epoll_event* events;
+	int n_events;
+	int max_events;
+	struct mloop_socket_list continued;
 	int do_exit;
-	struct prioq async_jobs;
+	struct mloop__lanes async_jobs;
 	struct mloop_idle_list idle_jobs;
 	pthread_mutex_t idle_list_mutex;
 	struct mloop_object_list free_list;
 	pthread_mutex_t free_list_mutex;
+	uint64_t now; /* Start of the current iteration, 0 between them */
 };
 
 struct mloop {
@@ -170,15 +246,126 @@ static enum mloop_type mloop__debug = MLOOP_INIT;
 
 #define NTHREADS_MAX 32
 
-static struct prioq mloop__job_queue;
+static struct mloop__lanes mloop__job_queue;
+static long mloop__n_queued_jobs = 0;
+static long mloop__n_queued_jobs_max = 0;
+static int mloop__job_event = -1;
+static int mloop__n_parked = 0;
+
+/* In work-stealing mode each worker has a deque of its own */
+static int mloop__use_work_stealing = 0;
+static struct wsdeque mloop__deques[NTHREADS_MAX];
+static int mloop__n_deques = 0;
+static __thread int mloop__worker_id = -1;
 static int mloop__nthreads = 0;
 static size_t mloop__qsize = 64;
 static size_t mloop__stacksize = 0;
 static pthread_t mloop__threads[NTHREADS_MAX];
+static int mloop__worker_cpus[NTHREADS_MAX];
+static size_t mloop__n_worker_cpus = 0;
+static int mloop__worker_priority = 0;
 
 static struct mloop* mloop__default = NULL;
 static size_t mloop__core_count = 0;
 
+/* The most frequently created objects come from pools */
+static struct objpool mloop__socket_pool =
+	OBJPOOL_INITIALIZER(struct mloop_socket);
+static struct objpool mloop__timer_pool =
+	OBJPOOL_INITIALIZER(struct mloop_timer);
+static struct objpool mloop__async_pool =
+	OBJPOOL_INITIALIZER(struct mloop_async);
+static struct objpool mloop__work_pool =
+	OBJPOOL_INITIALIZER(struct mloop_work);
+
+static inline uint64_t mloop__now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define mloop__stats_load(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define mloop__stats_store(ptr, value) \
+	__atomic_store_n(ptr, value, __ATOMIC_RELAXED)
+#define mloop__stats_inc(ptr) \
+	mloop__stats_store(ptr, mloop__stats_load(ptr) + 1)
+
+static void mloop__histogram_record(struct mloop_stats_histogram* self,
+				    uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+
+	unsigned int bucket = us ? 63 - __builtin_clzll(us) : 0;
+	if (bucket >= MLOOP_STATS_N_BUCKETS)
+		bucket = MLOOP_STATS_N_BUCKETS - 1;
+
+	mloop__stats_inc(&self->count);
+	mloop__stats_inc(&self->bucket[bucket]);
+
+	if (us > self->max)
+		mloop__stats_store(&self->max, us);
+}
+
+/* Callbacks are kept in an open addressing table. Entries are never removed,
+ * so readers only need to see the address before the counters.
+ */
+static struct mloop_stats_callback*
+mloop__stats_find_callback(struct mloop__stats* self, const void* fn)
+{
+	size_t hash = ((uintptr_t)fn >> 2) * 2654435761U;
+
+	for (size_t i = 0; i < MLOOP_STATS_CALLBACKS_MAX; ++i) {
+		struct mloop_stats_callback* entry =
+			&self->callback[(hash + i) % MLOOP_STATS_CALLBACKS_MAX];
+
+		const void* key = __atomic_load_n(&entry->fn, __ATOMIC_RELAXED);
+		if (key == fn)
+			return entry;
+
+		if (!key) {
+			__atomic_store_n(&entry->fn, fn, __ATOMIC_RELEASE);
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void mloop__stats_callback(struct mloop_core* core, const void* fn,
+				  uint64_t start)
+{
+	uint64_t duration = mloop__now() - start;
+
+	struct mloop_stats_callback* entry =
+		mloop__stats_find_callback(&core->stats, fn);
+	if (entry)
+		mloop__histogram_record(&entry->duration, duration);
+}
+
+static void mloop__histogram_copy(struct mloop_stats_histogram* dst,
+				  const struct mloop_stats_histogram* src)
+{
+	dst->count = mloop__stats_load(&src->count);
+	dst->max = mloop__stats_load(&src->max);
+
+	for (int i = 0; i < MLOOP_STATS_N_BUCKETS; ++i)
+		dst->bucket[i] = mloop__stats_load(&src->bucket[i]);
+}
+
+static void mloop__count_queued_job(long n)
+{
+	long depth = __atomic_add_fetch(&mloop__n_queued_jobs, n,
+					__ATOMIC_RELAXED);
+
+	long max = mloop__stats_load(&mloop__n_queued_jobs_max);
+	while (depth > max
+	    && !__atomic_compare_exchange_n(&mloop__n_queued_jobs_max, &max,
+					    depth, 1, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+}
+
 enum mloop__debug_parser_token {
 	MLOOP__START = 0,
 	MLOOP__NAME,
@@ -356,10 +543,24 @@ static inline void mloop__do_exit(struct mloop* self)
 	mloop__atomic_store(&self->core->do_exit, 1);
 }
 
+/* Anyone may wake the loop, but only the first one after the loop has picked
+ * up the last wakeup needs to write to the eventfd. The loop clears the flag
+ * before it goes through the async jobs, so nothing queued before the flag
+ * was seen set can be missed.
+ */
 static inline void mloop__break_out(struct mloop* self)
 {
+	struct mloop_core* core = self->core;
+
+	if (__atomic_exchange_n(&core->is_break_out_pending, 1,
+				__ATOMIC_SEQ_CST)) {
+		__atomic_add_fetch(&core->n_wakeups_coalesced, 1,
+				   __ATOMIC_RELAXED);
+		return;
+	}
+
 	uint64_t one = 1;
-	(void)write(self->core->break_out_socket.fd, &one, sizeof(one));
+	(void)write(core->break_out_socket.fd, &one, sizeof(one));
 }
 
 static inline int mloop__change_state(void* obj_ptr, enum mloop_state expected,
@@ -656,6 +857,116 @@ int mloop_idle_unref(struct mloop_idle* self)
 	return mloop__unref_any(self);
 }
 
+static int mloop__lanes_init(struct mloop__lanes* self, size_t size)
+{
+	int i;
+
+	for (i = 0; i < MLOOP__N_LANES; ++i)
+		if (mpmcq_init(&self->lane[i], size) < 0)
+			goto failure;
+
+	return 0;
+
+failure:
+	while (i-- > 0)
+		mpmcq_destroy(&self->lane[i]);
+	return -1;
+}
+
+static void mloop__lanes_destroy(struct mloop__lanes* self)
+{
+	for (int i = 0; i < MLOOP__N_LANES; ++i)
+		mpmcq_destroy(&self->lane[i]);
+}
+
+static inline int mloop__lanes_push(struct mloop__lanes* self,
+				    unsigned long priority, void* data)
+{
+	int lane = priority < MLOOP__N_LANES ? priority : MLOOP__N_LANES - 1;
+	return mpmcq_push(&self->lane[lane], data);
+}
+
+static inline int mloop__lanes_pop(struct mloop__lanes* self, void** data)
+{
+	for (int i = 0; i < MLOOP__N_LANES; ++i)
+		if (mpmcq_pop(&self->lane[i], data) == 0)
+			return 0;
+
+	return -1;
+}
+
+static inline int mloop__lanes_is_empty(const struct mloop__lanes* self)
+{
+	for (int i = 0; i < MLOOP__N_LANES; ++i)
+		if (!mpmcq_is_empty(&self->lane[i]))
+			return 0;
+
+	return 1;
+}
+
+static int mloop__have_work(void)
+{
+	if (!mloop__lanes_is_empty(&mloop__job_queue))
+		return 1;
+
+	int n = mloop__atomic_load(&mloop__n_deques);
+	for (int i = 0; i < n; ++i)
+		if (!wsdeque_is_empty(&mloop__deques[i]))
+			return 1;
+
+	return 0;
+}
+
+/* Take a job from the worker's own deque, the shared queue or, failing
+ * those, from the other workers' deques.
+ */
+static int mloop__get_work(void** data)
+{
+	int id = mloop__worker_id;
+
+	if (mloop__use_work_stealing
+	 && wsdeque_pop(&mloop__deques[id], data) == 0)
+		return 0;
+
+	if (mloop__lanes_pop(&mloop__job_queue, data) == 0)
+		return 0;
+
+	if (!mloop__use_work_stealing)
+		return -1;
+
+	int n = mloop__atomic_load(&mloop__n_deques);
+	for (int i = 1; i < n; ++i)
+		if (wsdeque_steal(&mloop__deques[(id + i) % n], data) == 0)
+			return 0;
+
+	return -1;
+}
+
+/* Idle workers sleep on a semaphore eventfd. A worker announces that it is
+ * about to park before it checks the queue one last time, and a producer
+ * checks for parked workers after it has pushed, so no wake-up is lost.
+ */
+static void mloop__park_worker(void)
+{
+	__atomic_add_fetch(&mloop__n_parked, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (!mloop__have_work()) {
+		uint64_t count;
+		(void)read(mloop__job_event, &count, sizeof(count));
+	}
+
+	__atomic_sub_fetch(&mloop__n_parked, 1, __ATOMIC_SEQ_CST);
+}
+
+static void mloop__wake_workers(uint64_t count)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (mloop__atomic_load(&mloop__n_parked) > 0)
+		(void)write(mloop__job_event, &count, sizeof(count));
+}
+
 static void mloop__block_all_signals()
 {
 	sigset_t mask;
@@ -667,44 +978,54 @@ static void mloop__block_all_signals()
 static int mloop__forward_work(struct mloop_work* work)
 {
 	struct mloop* mloop = work->parent;
-	struct prioq* queue = &mloop->core->async_jobs;
-	struct mloop_async* async = (struct mloop_async*)work;
+	struct mloop__lanes* queue = &mloop->core->async_jobs;
 
-	/* We lock the async queue here so that we can keep it blocked until the
-	 * state has been changed to MLOOP_STARTED. Otherwise the main thread
-	 * can start processing the job before the state has been changed.
+	/* The state must be changed before the job is queued. Otherwise the
+	 * main thread could start processing it first.
 	 */
-	prioq__lock(queue);
-	if (prioq_insert(queue, async->priority, async) < 0)
-		goto failure;
-
-	mloop__break_out(mloop);
 	mloop__change_state(work, MLOOP_STARTING, MLOOP_STARTED);
 
-	prioq__unlock(queue);
+	work->queued_at = mloop__now();
+
+	/* The result must not be lost, so wait for the main loop to make room
+	 * unless it is shutting down.
+	 */
+	while (mloop__lanes_push(queue, work->priority, work) < 0) {
+		if (mloop__is_exiting(mloop))
+			goto failure;
+
+		mloop__break_out(mloop);
+		sched_yield();
+	}
+
+	mloop__break_out(mloop);
 	return 0;
 
 failure:
-	mloop__change_state(work, MLOOP_STARTING, MLOOP_STOPPED);
-	prioq__unlock(queue);
+	mloop__change_state(work, MLOOP_STARTED, MLOOP_STOPPED);
+	mloop__object_list_remove(work);
 	return -1;
 }
 
 static void* mloop__worker_fn(void* context)
 {
-	(void)context;
+	mloop__worker_id = (intptr_t)context;
 
 	mloop__block_all_signals();
 
 	while (1) {
-		struct prioq_elem elem;
-		if (prioq_pop(&mloop__job_queue, &elem, -1) < 0)
+		void* data;
+		if (mloop__get_work(&data) < 0) {
+			mloop__park_worker();
 			continue;
+		}
 
-		if (elem.data == NULL)
+		if (data == NULL)
 			break;
 
-		struct mloop_work* work = elem.data;
+		mloop__count_queued_job(-1);
+
+		struct mloop_work* work = data;
 		if (work->is_cancelled)
 			goto cancelled;
 
@@ -740,7 +1061,10 @@ static void mloop__reap_threads()
 
 	/* A thread returns if it's sent a null-job */
 	for (int i = 0; i < mloop__nthreads; ++i)
-		prioq_insert(&mloop__job_queue, 0, NULL);
+		while (mloop__lanes_push(&mloop__job_queue, 0, NULL) < 0)
+			sched_yield();
+
+	mloop__wake_workers(mloop__nthreads);
 
 	int rc = clock_gettime(CLOCK_REALTIME, &ts);
 	assert(rc == 0);
@@ -752,8 +1076,19 @@ static void mloop__reap_threads()
 
 void mloop__stop_workers()
 {
+	if (mloop__job_event < 0)
+		return;
+
 	mloop__reap_threads();
-	prioq_destroy(&mloop__job_queue);
+	mloop__lanes_destroy(&mloop__job_queue);
+	close(mloop__job_event);
+	mloop__job_event = -1;
+	mloop__nthreads = 0;
+
+	for (int i = 0; i < mloop__n_deques; ++i)
+		wsdeque_destroy(&mloop__deques[i]);
+
+	mloop__n_deques = 0;
 }
 
 static int mloop__start_threads(size_t stacksize, int required)
@@ -762,68 +1097,493 @@ static int mloop__start_threads(size_t stacksize, int required)
 
 	pthread_attr_t attr;
 
-	pthread_attr_init(&attr);
+	pthread_attr_init(&attr);
+
+	if (stacksize != 0)
+		pthread_attr_setstacksize(&attr, stacksize);
+
+	if (mloop__worker_priority > 0) {
+		struct sched_param param = {
+			.sched_priority = mloop__worker_priority
+		};
+
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+
+	int i;
+	for (i = mloop__nthreads; i < required; ++i) {
+		if (mloop__use_work_stealing && i >= mloop__n_deques) {
+			rc = wsdeque_init(&mloop__deques[i], mloop__qsize);
+			if (rc < 0) {
+				mloop__nthreads = i;
+				mloop__reap_threads();
+				break;
+			}
+
+			mloop__atomic_store(&mloop__n_deques, i + 1);
+		}
+
+		if (mloop__n_worker_cpus > 0) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(mloop__worker_cpus[i % mloop__n_worker_cpus],
+				&set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+
+		rc = pthread_create(&mloop__threads[i], &attr,
+				    mloop__worker_fn, (void*)(intptr_t)i);
+		if (rc != 0) {
+			errno = rc;
+			rc = -1;
+			mloop__nthreads = i;
+			mloop__reap_threads();
+			break;
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+	return rc;
+}
+
+EXPORT
+void mloop_set_job_queue_size(size_t qsize)
+{
+	mloop__qsize = qsize;
+}
+
+EXPORT
+void mloop_set_work_stealing(int enable)
+{
+	if (mloop__nthreads == 0)
+		mloop__use_work_stealing = enable;
+}
+
+EXPORT
+int mloop_set_worker_cpus(const int* cpus, size_t n)
+{
+	if (mloop__nthreads != 0 || n > NTHREADS_MAX)
+		return -1;
+
+	for (size_t i = 0; i < n; ++i)
+		if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+			return -1;
+
+	memcpy(mloop__worker_cpus, cpus, n * sizeof(*cpus));
+	mloop__n_worker_cpus = n;
+
+	return 0;
+}
+
+EXPORT
+int mloop_set_worker_priority(int priority)
+{
+	if (mloop__nthreads != 0 || priority < 0
+	 || priority > sched_get_priority_max(SCHED_FIFO))
+		return -1;
+
+	mloop__worker_priority = priority;
+	return 0;
+}
+
+EXPORT
+void mloop_set_worker_stack_size(size_t stack_size)
+{
+	mloop__stacksize = stack_size;
+}
+
+EXPORT
+int mloop_require_workers(int nthreads)
+{
+	if (nthreads <= 0 || nthreads >= NTHREADS_MAX)
+		return -1;
+
+	if (nthreads <= mloop__nthreads)
+		return 0;
+
+	if (mloop__nthreads == 0) {
+		mloop__job_event = eventfd(0, EFD_SEMAPHORE);
+		if (mloop__job_event < 0)
+			return -1;
+
+		if (mloop__lanes_init(&mloop__job_queue, mloop__qsize) < 0) {
+			close(mloop__job_event);
+			mloop__job_event = -1;
+			return -1;
+		}
+	}
+
+	if (mloop__start_threads(mloop__stacksize, nthreads) < 0)
+		goto thread_start_failure;
+
+	mloop__nthreads = nthreads;
+
+	return 0;
+
+thread_start_failure:
+	mloop__nthreads = 0;
+	return -1;
+}
+
+void mloop__on_break_out_event(struct mloop_socket* socket)
+{
+	struct mloop_core* core = socket->parent_core;
+
+	mloop__atomic_store(&core->is_break_out_pending, 0);
+
+	uint64_t count = 0;
+	(void)read(socket->fd, &count, sizeof(count));
+
+	mloop__stats_inc(&core->stats.n_wakeups);
+}
+
+static inline unsigned int mloop__wheel_shift(int level)
+{
+	return level * MLOOP__WHEEL_SLOT_BITS;
+}
+
+static inline unsigned int mloop__wheel_index(uint64_t tick, int level)
+{
+	return (tick >> mloop__wheel_shift(level)) & (MLOOP__WHEEL_SLOTS - 1);
+}
+
+/* A timer with slack may fire at any tick up to deadline + slack. Out of that
+ * window it takes the tick that the timerfd is already armed for or else the
+ * one with the most trailing zeros, so that timers with overlapping windows
+ * end up firing in the same wakeup.
+ */
+static void mloop__wheel_set_tick(const struct mloop__wheel* self,
+				  struct mloop_timer* timer)
+{
+	uint64_t tick = (timer->deadline + MLOOP__WHEEL_TICK - 1)
+		      / MLOOP__WHEEL_TICK;
+	uint64_t limit = (timer->deadline + timer->slack) / MLOOP__WHEEL_TICK;
+
+	if (limit <= tick) {
+		timer->tick = tick;
+		return;
+	}
+
+	if (tick <= self->armed && self->armed <= limit) {
+		timer->tick = self->armed;
+		return;
+	}
+
+	unsigned int bit = 63 - __builtin_clzll(tick ^ limit);
+	timer->tick = limit & ~((1ULL << bit) - 1);
+}
+
+static void mloop__wheel_insert(struct mloop__wheel* self,
+				struct mloop_timer* timer)
+{
+	uint64_t tick = timer->tick;
+
+	struct mloop__timer_list* list;
+
+	if (tick <= self->current) {
+		list = &self->expired;
+	} else {
+		/* The highest bit in which the tick differs from the current
+		 * tick decides the level.
+		 */
+		uint64_t diff = tick ^ self->current;
+		int level = (63 - __builtin_clzll(diff))
+			  / MLOOP__WHEEL_SLOT_BITS;
+
+		if (level < MLOOP__WHEEL_LEVELS) {
+			unsigned int index = mloop__wheel_index(tick, level);
+			list = &self->slot[level][index];
+			self->occupied[level] |= 1ULL << index;
+		} else {
+			list = &self->overflow;
+		}
+	}
+
+	LIST_INSERT_HEAD(list, timer, wheel_links);
+	timer->list = list;
+}
+
+static void mloop__wheel_remove(struct mloop__wheel* self,
+				struct mloop_timer* timer)
+{
+	struct mloop__timer_list* list = timer->list;
+
+	LIST_REMOVE(timer, wheel_links);
+	timer->list = NULL;
+
+	ptrdiff_t pos = list - &self->slot[0][0];
+	if (0 <= pos && pos < MLOOP__WHEEL_LEVELS * MLOOP__WHEEL_SLOTS
+	 && LIST_EMPTY(list))
+		self->occupied[pos / MLOOP__WHEEL_SLOTS] &=
+			~(1ULL << (pos % MLOOP__WHEEL_SLOTS));
+}
+
+/* Returns the next tick after the current one at which a slot must be fired
+ * or cascaded or 0 if all slots are empty.
+ */
+static uint64_t mloop__wheel_next_slot_tick(const struct mloop__wheel* self)
+{
+	for (int level = 0; level < MLOOP__WHEEL_LEVELS; ++level) {
+		unsigned int index = mloop__wheel_index(self->current, level);
+		if (index == MLOOP__WHEEL_SLOTS - 1)
+			continue;
+
+		uint64_t later = self->occupied[level] & (~0ULL << (index + 1));
+		if (!later)
+			continue;
+
+		unsigned int shift = mloop__wheel_shift(level + 1);
+		return ((self->current >> shift) << shift)
+		     | ((uint64_t)__builtin_ctzll(later)
+			<< mloop__wheel_shift(level));
+	}
+
+	if (!LIST_EMPTY(&self->overflow)) {
+		unsigned int shift = mloop__wheel_shift(MLOOP__WHEEL_LEVELS);
+		return ((self->current >> shift) + 1) << shift;
+	}
+
+	return 0;
+}
+
+/* Like mloop__wheel_next_slot_tick() but expired timers are due right away */
+static uint64_t mloop__wheel_next_tick(const struct mloop__wheel* self)
+{
+	if (!LIST_EMPTY(&self->expired))
+		return self->current;
+
+	return mloop__wheel_next_slot_tick(self);
+}
+
+static void mloop__wheel_cascade(struct mloop__wheel* self,
+				 struct mloop__timer_list* list)
+{
+	while (!LIST_EMPTY(list)) {
+		struct mloop_timer* timer = LIST_FIRST(list);
+		mloop__wheel_remove(self, timer);
+		mloop__wheel_insert(self, timer);
+	}
+}
+
+static void mloop__wheel_process_tick(struct mloop__wheel* self,
+				      uint64_t tick)
+{
+	self->current = tick;
+
+	uint64_t mask = (1ULL << mloop__wheel_shift(MLOOP__WHEEL_LEVELS)) - 1;
+	if ((tick & mask) == 0)
+		mloop__wheel_cascade(self, &self->overflow);
+
+	/* Higher levels go first because they may refill lower ones */
+	for (int level = MLOOP__WHEEL_LEVELS - 1; level >= 0; --level) {
+		mask = (1ULL << mloop__wheel_shift(level)) - 1;
+		if ((tick & mask) != 0)
+			continue;
+
+		unsigned int index = mloop__wheel_index(tick, level);
+		mloop__wheel_cascade(self, &self->slot[level][index]);
+	}
+}
+
+static void mloop__wheel_advance(struct mloop__wheel* self, uint64_t now)
+{
+	uint64_t now_tick = now / MLOOP__WHEEL_TICK;
+
+	/* Expired timers that have not been popped yet must not hold back the
+	 * slots, or the current tick would skip past them below.
+	 */
+	for (;;) {
+		uint64_t tick = mloop__wheel_next_slot_tick(self);
+		if (tick == 0 || tick > now_tick)
+			break;
+
+		mloop__wheel_process_tick(self, tick);
+	}
+
+	if (self->current < now_tick)
+		self->current = now_tick;
+}
+
+static void mloop__wheel_arm(struct mloop__wheel* self)
+{
+	uint64_t tick = mloop__wheel_next_tick(self);
+	if (tick == 0 || tick == self->armed)
+		return;
+
+	uint64_t time = tick * MLOOP__WHEEL_TICK;
+
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+
+	its.it_value.tv_sec = time / 1000000000ULL;
+	its.it_value.tv_nsec = time % 1000000000ULL;
+
+	if (timerfd_settime(self->socket.fd, TFD_TIMER_ABSTIME, &its, NULL) == 0)
+		self->armed = tick;
+}
+
+static void mloop__wheel_add(struct mloop__wheel* self,
+			     struct mloop_timer* timer, uint64_t now)
+{
+	pthread_mutex_lock(&self->mutex);
+
+	if (self->count++ == 0)
+		mloop__wheel_advance(self, now);
+
+	mloop__wheel_set_tick(self, timer);
+	mloop__wheel_insert(self, timer);
+
+	uint64_t tick = mloop__wheel_next_tick(self);
+	if (self->armed == 0 || tick < self->armed)
+		mloop__wheel_arm(self);
+
+	pthread_mutex_unlock(&self->mutex);
+}
+
+static void mloop__wheel_del(struct mloop__wheel* self,
+			     struct mloop_timer* timer)
+{
+	pthread_mutex_lock(&self->mutex);
+
+	if (timer->list) {
+		mloop__wheel_remove(self, timer);
+		self->count--;
+	}
+
+	pthread_mutex_unlock(&self->mutex);
+}
+
+static struct mloop_timer* mloop__wheel_pop_expired(struct mloop__wheel* self)
+{
+	pthread_mutex_lock(&self->mutex);
+
+	struct mloop_timer* timer = LIST_FIRST(&self->expired);
+	if (!timer) {
+		mloop__wheel_arm(self);
+		goto done;
+	}
+
+	mloop__wheel_remove(self, timer);
+	mloop_timer_ref(timer);
+
+	uint64_t now = mloop__now();
+	if (now > timer->deadline)
+		mloop__histogram_record(&self->socket.parent_core->stats.timer_lag,
+					now - timer->deadline);
+
+	if (!(timer->timer_type & MLOOP_TIMER_PERIODIC)) {
+		self->count--;
+		goto done;
+	}
+
+	/* Missed periods are skipped, like a timerfd would do */
+	timer->deadline += timer->time;
+	if (timer->deadline <= now)
+		timer->deadline += ((now - timer->deadline) / timer->time + 1)
+				 * timer->time;
+
+	mloop__wheel_set_tick(self, timer);
+	mloop__wheel_insert(self, timer);
+
+done:
+	pthread_mutex_unlock(&self->mutex);
+	return timer;
+}
+
+static void mloop__wheel_fire(struct mloop_timer* timer)
+{
+	struct mloop_socket* socket = &timer->socket;
+	mloop_socket_fn callback_fn = socket->callback_fn;
+
+	struct mloop_core* core = socket->parent_core;
+	uint64_t start;
+
+	if (timer->timer_type & MLOOP_TIMER_PERIODIC) {
+		if (callback_fn && mloop_timer_is_started(timer)) {
+			start = mloop__now();
+			callback_fn(socket);
+			mloop__stats_callback(core, callback_fn, start);
+		}
+		return;
+	}
+
+	/* Single-shot timers are stopped before the callback so that they may
+	 * be started again from within it.
+	 */
+	if (mloop__change_state(timer, MLOOP_STARTED, MLOOP_STOPPING) < 0)
+		return;
+
+	mloop__object_list_remove(timer);
 
-	if (stacksize != 0)
-		pthread_attr_setstacksize(&attr, stacksize);
+	int rc = mloop__change_state(timer, MLOOP_STOPPING, MLOOP_STOPPED);
+	assert(rc == 0);
+	(void)rc;
 
-	int i;
-	for (i = mloop__nthreads; i < required; ++i) {
-		rc = pthread_create(&mloop__threads[i], &attr,
-				    mloop__worker_fn, NULL);
-		if (rc < 0) {
-			errno = rc;
-			mloop__nthreads = i;
-			mloop__reap_threads();
-			break;
-		}
+	if (callback_fn) {
+		start = mloop__now();
+		callback_fn(socket);
+		mloop__stats_callback(core, callback_fn, start);
 	}
-
-	pthread_attr_destroy(&attr);
-	return rc;
 }
 
-EXPORT
-void mloop_set_job_queue_size(size_t qsize)
+void mloop__on_wheel_event(struct mloop_socket* socket)
 {
-	mloop__qsize = qsize;
-}
+	struct mloop__wheel* self = (struct mloop__wheel*)socket;
+	uint64_t count = 0;
+	(void)read(socket->fd, &count, sizeof(count));
 
-EXPORT
-void mloop_set_worker_stack_size(size_t stack_size)
-{
-	mloop__stacksize = stack_size;
+	pthread_mutex_lock(&self->mutex);
+	self->armed = 0;
+	mloop__wheel_advance(self, mloop__now());
+	pthread_mutex_unlock(&self->mutex);
+
+	struct mloop_timer* timer;
+	while ((timer = mloop__wheel_pop_expired(self))) {
+		mloop__wheel_fire(timer);
+		mloop_timer_unref(timer);
+	}
 }
 
-EXPORT
-int mloop_require_workers(int nthreads)
+static int mloop__wheel_init(struct mloop* mloop, struct mloop__wheel* self)
 {
-	if (nthreads <= 0 || nthreads >= NTHREADS_MAX)
+	self->socket.parent = mloop;
+	self->socket.parent_core = mloop->core;
+	self->socket.ref = 1;
+	self->socket.callback_fn = mloop__on_wheel_event;
+	self->socket.events = MLOOP_SOCKET_EVENT_IN | MLOOP_SOCKET_EVENT_PRI;
+	self->socket.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (self->socket.fd < 0)
 		return -1;
 
-	if (nthreads <= mloop__nthreads)
-		return 0;
+	if (mloop__start_socket(mloop, &self->socket) < 0)
+		goto failure;
 
-	if (mloop__nthreads == 0)
-		if (prioq_init(&mloop__job_queue, mloop__qsize) < 0)
-			return -1;
+	self->socket.state = MLOOP_STARTED;
 
-	if (mloop__start_threads(mloop__stacksize, nthreads) < 0)
-		goto thread_start_failure;
+	pthread_mutex_init(&self->mutex, NULL);
 
-	mloop__nthreads = nthreads;
+	for (int i = 0; i < MLOOP__WHEEL_LEVELS; ++i)
+		for (int j = 0; j < MLOOP__WHEEL_SLOTS; ++j)
+			LIST_INIT(&self->slot[i][j]);
+
+	LIST_INIT(&self->overflow);
+	LIST_INIT(&self->expired);
+
+	self->current = mloop__now() / MLOOP__WHEEL_TICK;
 
 	return 0;
 
-thread_start_failure:
-	mloop__nthreads = 0;
+failure:
+	close(self->socket.fd);
 	return -1;
 }
 
-void mloop__on_break_out_event(struct mloop_socket* socket)
+static void mloop__wheel_destroy(struct mloop__wheel* self)
 {
-	uint64_t count = 0;
-	(void)read(socket->fd, &count, sizeof(count));
+	pthread_mutex_destroy(&self->mutex);
+	close(self->socket.fd);
 }
 
 static struct mloop_core* mloop_core__new(struct mloop* mloop)
@@ -834,7 +1594,13 @@ static struct mloop_core* mloop_core__new(struct mloop* mloop)
 
 	memset(self, 0, sizeof(*self));
 
-	self->epollfd = epoll_create(MAX_EVENTS);
+	self->max_events = MLOOP__MAX_EVENTS_DEFAULT;
+	self->n_events = MLOOP__MIN_EVENTS;
+	self->events = malloc(self->max_events * sizeof(*self->events));
+	if (!self->events)
+		goto events_failure;
+
+	self->epollfd = epoll_create(MLOOP__MIN_EVENTS);
 	if (self->epollfd < 0)
 		goto epoll_failure;
 
@@ -856,7 +1622,10 @@ static struct mloop_core* mloop_core__new(struct mloop* mloop)
 
 	break_out_socket->state = MLOOP_STARTED;
 
-	if (prioq_init(&self->async_jobs, 64) < 0)
+	if (mloop__wheel_init(mloop, &self->wheel) < 0)
+		goto wheel_failure;
+
+	if (mloop__lanes_init(&self->async_jobs, MLOOP__ASYNC_QUEUE_SIZE) < 0)
 		goto async_job_queue_failure;
 
 	pthread_mutex_init(&mloop->object_list_mutex, NULL);
@@ -865,6 +1634,7 @@ static struct mloop_core* mloop_core__new(struct mloop* mloop)
 	LIST_INIT(&mloop->objects);
 	LIST_INIT(&self->free_list);
 	TAILQ_INIT(&self->idle_jobs);
+	TAILQ_INIT(&self->continued);
 
 	self->ref = 1;
 
@@ -873,12 +1643,17 @@ static struct mloop_core* mloop_core__new(struct mloop* mloop)
 	return self;
 
 async_job_queue_failure:
+	mloop__socket_stop(&self->wheel.socket);
+	mloop__wheel_destroy(&self->wheel);
+wheel_failure:
 	mloop__socket_stop(break_out_socket);
 break_out_socket_add_failure:
 	close(break_out_socket->fd);
 break_out_socket_fd_failure:
 	close(self->epollfd);
 epoll_failure:
+	free(self->events);
+events_failure:
 	free(self);
 	return NULL;
 }
@@ -905,17 +1680,30 @@ failure:
 	return NULL;
 }
 
+static void mloop__continued_clear(struct mloop_core* self)
+{
+	while (!TAILQ_EMPTY(&self->continued)) {
+		struct mloop_socket* socket = TAILQ_FIRST(&self->continued);
+		TAILQ_REMOVE(&self->continued, socket, continue_links);
+		socket->is_continued = 0;
+		mloop_socket_unref(socket);
+	}
+}
+
 static void mloop_core__free(struct mloop_core* self)
 {
 	if (__atomic_sub_fetch(&mloop__core_count, 1, __ATOMIC_SEQ_CST) == 0)
 		mloop__stop_workers();
 
 	mloop__idle_list_clear(self);
+	mloop__continued_clear(self);
 	mloop__collect(self);
 	pthread_mutex_destroy(&self->idle_list_mutex);
-	prioq_destroy(&self->async_jobs);
+	mloop__lanes_destroy(&self->async_jobs);
+	mloop__wheel_destroy(&self->wheel);
 	close(self->break_out_socket.fd);
 	close(self->epollfd);
+	free(self->events);
 	free(self);
 }
 
@@ -1000,7 +1788,7 @@ struct mloop* mloop_default()
 EXPORT
 struct mloop_socket* mloop_socket_new(struct mloop* creator)
 {
-	struct mloop_socket* self = malloc(sizeof(*self));
+	struct mloop_socket* self = objpool_alloc(&mloop__socket_pool);
 	if (!self)
 		return NULL;
 
@@ -1020,7 +1808,7 @@ struct mloop_socket* mloop_socket_new(struct mloop* creator)
 EXPORT
 struct mloop_timer* mloop_timer_new(struct mloop* creator)
 {
-	struct mloop_timer* self = malloc(sizeof(*self));
+	struct mloop_timer* self = objpool_alloc(&mloop__timer_pool);
 	if (!self)
 		return NULL;
 
@@ -1032,17 +1820,12 @@ struct mloop_timer* mloop_timer_new(struct mloop* creator)
 	socket->creator = creator;
 	socket->events = MLOOP_SOCKET_EVENT_IN | MLOOP_SOCKET_EVENT_PRI;
 
-	socket->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-	if (socket->fd < 0)
-		goto timerfd_create_failure;
+	/* Only precise timers get a timerfd and it is created on demand */
+	socket->fd = -1;
 
 	mloop__print_debug(self, "new", 1, 1);
 
 	return self;
-
-timerfd_create_failure:
-	free(self);
-	return NULL;
 }
 
 void mloop__signal_reader(struct mloop_socket* socket)
@@ -1095,7 +1878,7 @@ failure:
 EXPORT
 struct mloop_async* mloop_async_new(struct mloop* creator)
 {
-	struct mloop_async* self = malloc(sizeof(*self));
+	struct mloop_async* self = objpool_alloc(&mloop__async_pool);
 	if (!self)
 		return NULL;
 
@@ -1112,7 +1895,7 @@ struct mloop_async* mloop_async_new(struct mloop* creator)
 EXPORT
 struct mloop_work* mloop_work_new(struct mloop* creator)
 {
-	struct mloop_work* self = malloc(sizeof(*self));
+	struct mloop_work* self = objpool_alloc(&mloop__work_pool);
 	if (!self)
 		return NULL;
 
@@ -1146,39 +1929,59 @@ struct mloop_idle* mloop_idle_new(struct mloop* creator)
 	return self;
 }
 
-EXPORT
-void mloop_socket_free(struct mloop_socket* self)
+static void mloop__socket_close(struct mloop_socket* self)
 {
 	mloop__free_context(self);
 	if (self->fd >= 0)
 		close(self->fd);
-	free(self);
+}
+
+EXPORT
+void mloop_socket_free(struct mloop_socket* self)
+{
+	switch (self->type) {
+	case MLOOP_TIMER:
+		mloop_timer_free((struct mloop_timer*)self);
+		break;
+	case MLOOP_SIGNAL:
+		mloop_signal_free((struct mloop_signal*)self);
+		break;
+	default:
+		mloop__socket_close(self);
+		objpool_free(&mloop__socket_pool, self);
+		break;
+	}
 }
 
 EXPORT
 void mloop_timer_free(struct mloop_timer* self)
 {
-	mloop_socket_free(&self->socket);
+	if (self->list)
+		mloop__wheel_del(&self->socket.parent_core->wheel, self);
+
+	mloop__socket_close(&self->socket);
+	objpool_free(&mloop__timer_pool, self);
 }
 
 EXPORT
 void mloop_async_free(struct mloop_async* self)
 {
 	mloop__free_context(self);
-	free(self);
+	objpool_free(&mloop__async_pool, self);
 }
 
 EXPORT
 void mloop_work_free(struct mloop_work* self)
 {
 	mloop__free_context(self);
-	free(self);
+	objpool_free(&mloop__work_pool, self);
 }
 
 EXPORT
 void mloop_signal_free(struct mloop_signal* self)
 {
-	mloop_socket_free(&self->socket);
+	mloop__socket_close(&self->socket);
+	free(self);
 }
 
 EXPORT
@@ -1220,13 +2023,6 @@ mloop_socket_get_event(const struct mloop_socket* socket)
 	return socket->revents;
 }
 
-EXPORT
-void mloop_socket_set_event(struct mloop_socket* socket,
-			    enum mloop_socket_event events)
-{
-	socket->events = events;
-}
-
 enum mloop_socket_event
 mloop__get_socket_event(uint32_t events)
 {
@@ -1250,6 +2046,86 @@ uint32_t mloop__get_epoll_event(enum mloop_socket_event events)
 	return e;
 }
 
+static inline uint32_t
+mloop__socket_epoll_event(const struct mloop_socket* socket)
+{
+	return mloop__get_epoll_event(socket->events)
+	     | (socket->is_edge_triggered ? EPOLLET : 0);
+}
+
+static void mloop__socket_modify(struct mloop_socket* socket)
+{
+	if (!mloop_socket_is_started(socket))
+		return;
+
+	struct epoll_event event = {
+		.events = mloop__socket_epoll_event(socket),
+		.data.ptr = socket
+	};
+
+	epoll_ctl(socket->parent->core->epollfd, EPOLL_CTL_MOD, socket->fd,
+		  &event);
+}
+
+EXPORT
+void mloop_socket_set_event(struct mloop_socket* socket,
+			    enum mloop_socket_event events)
+{
+	socket->events = events;
+	mloop__socket_modify(socket);
+}
+
+EXPORT
+void mloop_socket_set_edge_triggered(struct mloop_socket* socket, int enable)
+{
+	socket->is_edge_triggered = !!enable;
+	mloop__socket_modify(socket);
+}
+
+/* Level-triggered sockets are reported by epoll for as long as they have
+ * anything left, so only edge-triggered ones need to be called again.
+ */
+EXPORT
+void mloop_socket_continue(struct mloop_socket* socket)
+{
+	if (!socket->is_edge_triggered || socket->is_continued
+	 || !mloop_socket_is_started(socket))
+		return;
+
+	struct mloop_core* core = socket->parent_core;
+
+	socket->is_continued = 1;
+	mloop_socket_ref(socket);
+	TAILQ_INSERT_TAIL(&core->continued, socket, continue_links);
+}
+
+/* Only sockets that were continued before this point are run, so one that
+ * continues itself every time waits for the next iteration like everyone
+ * else.
+ */
+static void mloop__process_continued(struct mloop* self)
+{
+	struct mloop_socket_list list = TAILQ_HEAD_INITIALIZER(list);
+	TAILQ_CONCAT(&list, &self->core->continued, continue_links);
+
+	while (!TAILQ_EMPTY(&list)) {
+		struct mloop_socket* socket = TAILQ_FIRST(&list);
+		TAILQ_REMOVE(&list, socket, continue_links);
+		socket->is_continued = 0;
+
+		mloop_socket_fn callback_fn = socket->callback_fn;
+		if (callback_fn && mloop_socket_is_started(socket)) {
+			socket->revents = MLOOP_SOCKET_EVENT_IN;
+
+			uint64_t start = mloop__now();
+			callback_fn(socket);
+			mloop__stats_callback(self->core, callback_fn, start);
+		}
+
+		mloop_socket_unref(socket);
+	}
+}
+
 void mloop__process_events(struct mloop* self, struct epoll_event* events,
 			   int nfds)
 {
@@ -1274,8 +2150,18 @@ void mloop__process_events(struct mloop* self, struct epoll_event* events,
 		socket->revents = mloop__get_socket_event(event->events);
 
 		mloop_socket_fn callback_fn = socket->callback_fn;
-		if (callback_fn && mloop_socket_is_started(socket))
-			callback_fn(socket);
+		if (callback_fn && mloop_socket_is_started(socket)) {
+			/* Timers on the wheel are accounted for one by one */
+			if (callback_fn == mloop__on_wheel_event
+			 || callback_fn == mloop__on_break_out_event) {
+				callback_fn(socket);
+			} else {
+				uint64_t start = mloop__now();
+				callback_fn(socket);
+				mloop__stats_callback(self->core, callback_fn,
+						      start);
+			}
+		}
 
 		if (socket->type == MLOOP_TIMER)
 			mloop__process_timer(socket);
@@ -1285,23 +2171,24 @@ void mloop__process_events(struct mloop* self, struct epoll_event* events,
 		mloop__unref_any(events[i].data.ptr);
 }
 
-void mloop__process_async_jobs(struct mloop* self)
+static void mloop__process_async_job(struct mloop* self, void* data)
 {
-	struct prioq_elem elem;
-
-	if (prioq_pop(&self->core->async_jobs, &elem, 0) < 0)
-		return;
-
-	struct mloop_async* async = elem.data;
+	struct mloop_async* async = data;
 	assert(async);
 	assert(async->state == MLOOP_STARTED);
 
 	if (async->is_cancelled)
 		goto cancelled;
 
+	uint64_t start = mloop__now();
+	mloop__histogram_record(&self->core->stats.async_latency,
+				start - async->queued_at);
+
 	mloop_async_fn callback_fn = async->callback_fn;
-	if (callback_fn)
+	if (callback_fn) {
 		callback_fn(async);
+		mloop__stats_callback(self->core, callback_fn, start);
+	}
 
 cancelled:
 	if (mloop__object_list_remove(async) == 0)
@@ -1311,6 +2198,25 @@ cancelled:
 	assert(rc == 0);
 }
 
+/* All jobs that have completed are run in one pass. The pass is bounded by
+ * the size of the queue so that a job that keeps restarting itself cannot
+ * starve the sockets.
+ */
+void mloop__process_async_jobs(struct mloop* self)
+{
+	void* data;
+
+	for (int i = 0; i < MLOOP__ASYNC_QUEUE_SIZE; ++i) {
+		if (mloop__is_exiting(self))
+			break;
+
+		if (mloop__lanes_pop(&self->core->async_jobs, &data) < 0)
+			break;
+
+		mloop__process_async_job(self, data);
+	}
+}
+
 void mloop__process_idle_jobs(struct mloop* self)
 {
 	/* Note: pop() does not unreference the job and this is crucial for the
@@ -1322,8 +2228,11 @@ void mloop__process_idle_jobs(struct mloop* self)
 	mloop_idle_cond_fn cond_fn = job->cond_fn;
 	if (cond_fn && cond_fn(job)) {
 		mloop_idle_fn idle_fn = job->idle_fn;
-		if (idle_fn)
+		if (idle_fn) {
+			uint64_t start = mloop__now();
 			idle_fn(job);
+			mloop__stats_callback(self->core, idle_fn, start);
+		}
 	}
 
 	if (mloop_idle_unref(job) > 0)
@@ -1349,15 +2258,64 @@ static inline int mloop__have_idle_jobs(struct mloop* self)
 
 static inline int mloop__have_async_or_idle_jobs(struct mloop* self)
 {
-	return self->core->async_jobs.index > 0 || mloop__have_idle_jobs(self);
+	return !mloop__lanes_is_empty(&self->core->async_jobs)
+	    || !TAILQ_EMPTY(&self->core->continued)
+	    || mloop__have_idle_jobs(self);
+}
+
+static int mloop__wait(struct mloop* self, int timeout)
+{
+	struct mloop_core* core = self->core;
+
+	int nfds = epoll_wait(core->epollfd, core->events, core->n_events,
+			      timeout);
+	if (nfds < 0)
+		return nfds;
+
+	if (nfds == core->n_events && core->n_events < core->max_events) {
+		core->n_events *= 2;
+		if (core->n_events > core->max_events)
+			core->n_events = core->max_events;
+	} else if (nfds < core->n_events / 4
+		&& core->n_events > MLOOP__MIN_EVENTS) {
+		core->n_events /= 2;
+		if (core->n_events < MLOOP__MIN_EVENTS)
+			core->n_events = MLOOP__MIN_EVENTS;
+	}
+
+	return nfds;
+}
+
+static void mloop__iterate(struct mloop* self, int nfds)
+{
+	uint64_t start = mloop__now();
+	__atomic_store_n(&self->core->now, start, __ATOMIC_RELAXED);
+
+	mloop__process_continued(self);
+
+	if (nfds > 0)
+		mloop__process_events(self, self->core->events, nfds);
+
+	mloop__process_async_jobs(self);
+	mloop__process_idle_jobs(self);
+	mloop__collect(self->core);
+
+	__atomic_store_n(&self->core->now, 0, __ATOMIC_RELAXED);
+
+	mloop__histogram_record(&self->core->stats.iteration,
+				mloop__now() - start);
+}
+
+EXPORT
+uint64_t mloop_now(const struct mloop* self)
+{
+	uint64_t now = __atomic_load_n(&self->core->now, __ATOMIC_RELAXED);
+	return now ? now : mloop__now();
 }
 
 EXPORT
 int mloop_run(struct mloop* self)
 {
-	struct epoll_event events[MAX_EVENTS];
-	memset(events, 0, sizeof(events));
-
 	self->core->do_exit = 0;
 
 	int old_cancel_type = 0;
@@ -1369,18 +2327,11 @@ int mloop_run(struct mloop* self)
 	while (!mloop__is_exiting(self)) {
 		int timeout = mloop__have_async_or_idle_jobs(self) ? 0 : -1;
 
-		int nfds = epoll_wait(self->core->epollfd, events, MAX_EVENTS,
-				      timeout);
+		int nfds = mloop__wait(self, timeout);
 
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-		if (nfds > 0)
-			mloop__process_events(self, events, nfds);
-
-		mloop__process_async_jobs(self);
-		mloop__process_idle_jobs(self);
-		mloop__collect(self->core);
-
+		mloop__iterate(self, nfds);
 
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	}
@@ -1394,19 +2345,71 @@ int mloop_run(struct mloop* self)
 EXPORT
 int mloop_run_once(struct mloop* self)
 {
-	struct epoll_event events[MAX_EVENTS];
+	mloop__iterate(self, mloop__wait(self, 0));
+	return 0;
+}
 
-	int nfds = epoll_wait(self->core->epollfd, events, MAX_EVENTS, 0);
-	if (nfds > 0)
-		mloop__process_events(self, events, nfds);
+EXPORT
+int mloop_set_max_events(struct mloop* self, size_t max_events)
+{
+	struct mloop_core* core = self->core;
 
-	mloop__process_async_jobs(self);
-	mloop__process_idle_jobs(self);
-	mloop__collect(self->core);
+	if (max_events < MLOOP__MIN_EVENTS)
+		max_events = MLOOP__MIN_EVENTS;
+
+	if (max_events > INT_MAX / sizeof(*core->events)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct epoll_event* events =
+		realloc(core->events, max_events * sizeof(*events));
+	if (!events)
+		return -1;
+
+	core->events = events;
+	core->max_events = max_events;
+
+	if (core->n_events > core->max_events)
+		core->n_events = core->max_events;
 
 	return 0;
 }
 
+EXPORT
+void mloop_get_stats(const struct mloop* self, struct mloop_stats* stats)
+{
+	const struct mloop__stats* src = &self->core->stats;
+
+	memset(stats, 0, sizeof(*stats));
+
+	mloop__histogram_copy(&stats->iteration, &src->iteration);
+	mloop__histogram_copy(&stats->timer_lag, &src->timer_lag);
+	mloop__histogram_copy(&stats->async_latency, &src->async_latency);
+
+	stats->n_wakeups = mloop__stats_load(&src->n_wakeups);
+	stats->event_batch_size = self->core->n_events;
+	stats->n_wakeups_coalesced =
+		mloop__stats_load(&self->core->n_wakeups_coalesced);
+
+	long depth = mloop__stats_load(&mloop__n_queued_jobs);
+	stats->job_queue_depth = depth > 0 ? depth : 0;
+	stats->job_queue_depth_max = mloop__stats_load(&mloop__n_queued_jobs_max);
+
+	for (int i = 0; i < MLOOP_STATS_CALLBACKS_MAX; ++i) {
+		const struct mloop_stats_callback* entry = &src->callback[i];
+
+		const void* fn = __atomic_load_n(&entry->fn, __ATOMIC_ACQUIRE);
+		if (!fn)
+			continue;
+
+		struct mloop_stats_callback* dst =
+			&stats->callback[stats->n_callbacks++];
+		dst->fn = fn;
+		mloop__histogram_copy(&dst->duration, &entry->duration);
+	}
+}
+
 EXPORT
 void mloop_iterate(struct mloop* self)
 {
@@ -1423,7 +2426,7 @@ void mloop_exit(struct mloop* self)
 static int mloop__start_socket(struct mloop* self, struct mloop_socket* socket)
 {
 	struct epoll_event event = {
-		.events = mloop__get_epoll_event(socket->events),
+		.events = mloop__socket_epoll_event(socket),
 		.data.ptr = socket
 	};
 
@@ -1484,6 +2487,25 @@ int mloop_socket_stop(struct mloop_socket* self)
 	return src;
 }
 
+static int mloop__timer_start_on_wheel(struct mloop* mloop,
+				       struct mloop_timer* timer)
+{
+	struct mloop_socket* socket = &timer->socket;
+	uint64_t now = mloop__now();
+
+	timer->deadline = timer->timer_type & MLOOP_TIMER_ABSOLUTE
+			? timer->time : now + timer->time;
+	timer->is_on_wheel = 1;
+
+	socket->parent = mloop;
+	socket->parent_core = mloop->core;
+
+	mloop__object_list_add(socket);
+	mloop__wheel_add(&mloop->core->wheel, timer, now);
+
+	return 0;
+}
+
 EXPORT
 int mloop_timer_start(struct mloop_timer* timer)
 {
@@ -1496,6 +2518,19 @@ int mloop_timer_start(struct mloop_timer* timer)
 	if (mloop__change_state(socket, MLOOP_STOPPED, MLOOP_STARTING) < 0)
 		return -1;
 
+	if (!(timer->timer_type & MLOOP_TIMER_PRECISE)) {
+		mloop__timer_start_on_wheel(mloop, timer);
+		goto done;
+	}
+
+	timer->is_on_wheel = 0;
+
+	if (socket->fd < 0) {
+		socket->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (socket->fd < 0)
+			goto failure;
+	}
+
 	struct timespec ts = {
 		.tv_sec = timer->time / 1000000000LL,
 		.tv_nsec = timer->time % 1000000000LL
@@ -1517,6 +2552,7 @@ int mloop_timer_start(struct mloop_timer* timer)
 	if (mloop__start_socket(mloop, socket) < 0)
 		goto failure;
 
+done:;
 	int rc = mloop__change_state(socket, MLOOP_STARTING, MLOOP_STARTED);
 	assert(rc == 0);
 
@@ -1536,6 +2572,17 @@ int mloop_timer_stop(struct mloop_timer* self)
 	if (mloop__change_state(self, MLOOP_STARTED, MLOOP_STOPPING) < 0)
 		return -1;
 
+	if (self->is_on_wheel) {
+		mloop__wheel_del(&socket->parent_core->wheel, self);
+
+		mloop_socket_ref(socket);
+		mloop__object_list_remove(socket);
+		if (mloop_socket_unref(socket) == 0)
+			return 0;
+
+		goto done;
+	}
+
 	struct itimerspec its;
 	memset(&its, 0, sizeof(its));
 
@@ -1547,6 +2594,7 @@ int mloop_timer_stop(struct mloop_timer* self)
 	if (mloop_socket_unref(socket) == 0)
 		return 0;
 
+done:;
 	int rc = mloop__change_state(self, MLOOP_STOPPING, MLOOP_STOPPED);
 	assert(rc == 0);
 
@@ -1657,19 +2705,36 @@ int mloop_idle_stop(struct mloop_idle* self)
 
 static int mloop__start_async(struct mloop* self, struct mloop_async* async)
 {
-	struct prioq* queue = &self->core->async_jobs;
+	struct mloop__lanes* queue = &self->core->async_jobs;
 
 	async->parent = self;
 	async->parent_core = self->core;
 	async->is_cancelled = 0;
 
-	if (prioq_insert(queue, async->priority, async) < 0)
-		return -1;
-
 	mloop__object_list_add(async);
+
+	/* The state must be changed before the job is queued. Otherwise the
+	 * main thread could start processing it first.
+	 */
+	int rc = mloop__change_state(async, MLOOP_STARTING, MLOOP_STARTED);
+	assert(rc == 0);
+	(void)rc;
+
+	async->queued_at = mloop__now();
+
+	if (mloop__lanes_push(queue, async->priority, async) < 0)
+		goto failure;
+
 	mloop__break_out(self);
 
 	return 0;
+
+failure:
+	rc = mloop__change_state(async, MLOOP_STARTED, MLOOP_STARTING);
+	assert(rc == 0);
+	mloop__object_list_remove(async);
+	errno = EAGAIN;
+	return -1;
 }
 
 EXPORT
@@ -1680,23 +2745,10 @@ int mloop_async_start(struct mloop_async* async)
 	if (mloop__change_state(async, MLOOP_STOPPED, MLOOP_STARTING) < 0)
 		return -1;
 
-	/* We lock the async queue here so that we can keep it blocked until the
-	 * state has been changed to MLOOP_STARTED. Otherwise the main thread
-	 * can start processing the job before the state has been changed.
-	 */
-	prioq__lock(&mloop->core->async_jobs);
-	if (mloop__start_async(mloop, async) < 0)
-		goto failure;
-
-	int rc = mloop__change_state(async, MLOOP_STARTING, MLOOP_STARTED);
-	assert(rc == 0);
-	prioq__unlock(&mloop->core->async_jobs);
-
-	return 0;
+	if (mloop__start_async(mloop, async) == 0)
+		return 0;
 
-failure:
-	prioq__unlock(&mloop__job_queue);
-	rc = mloop__change_state(async, MLOOP_STARTING, MLOOP_STOPPED);
+	int rc = mloop__change_state(async, MLOOP_STARTING, MLOOP_STOPPED);
 	assert(rc == 0);
 	return -1;
 }
@@ -1720,23 +2772,35 @@ int mloop_work_start(struct mloop_work* work)
 	work->parent_core = mloop->core;
 	work->is_cancelled = 0;
 
-	/* We lock the work queue here so that we can keep it blocked until the
-	 * object has been added to the list of active objects.
-	 *
-	 * We could also reverse the order and add "mloop__object_list_remove()"
-	 * to the failure case for prioq_insert()
-	 */
-	prioq__lock(&mloop__job_queue);
-	if (prioq_insert(&mloop__job_queue, work->priority, work) < 0)
+	if (mloop__nthreads == 0)
 		goto failure;
 
+	/* The object must be on the list of active objects before it is queued
+	 * because a worker may finish the job straight away.
+	 */
 	mloop__object_list_add(work);
-	prioq__unlock(&mloop__job_queue);
+
+	/* Counted before it is queued so that a worker can not take it first */
+	mloop__count_queued_job(1);
+
+	int id = mloop__worker_id;
+	if (mloop__use_work_stealing && id >= 0
+	 && wsdeque_push(&mloop__deques[id], work) == 0)
+		goto done;
+
+	if (mloop__lanes_push(&mloop__job_queue, work->priority, work) < 0) {
+		mloop__count_queued_job(-1);
+		mloop__object_list_remove(work);
+		errno = EAGAIN;
+		goto failure;
+	}
+
+done:
+	mloop__wake_workers(1);
 
 	return 0;
 
 failure:
-	prioq__unlock(&mloop__job_queue);
 	rc = mloop__change_state(work, MLOOP_STARTING, MLOOP_STOPPED);
 	assert(rc == 0);
 	return -1;
@@ -1752,7 +2816,8 @@ EXPORT
 void mloop_timer_set_type(struct mloop_timer* self,
 			  enum mloop_timer_type type)
 {
-	assert(type != (MLOOP_TIMER_ABSOLUTE | MLOOP_TIMER_PERIODIC));
+	assert((type & (MLOOP_TIMER_ABSOLUTE | MLOOP_TIMER_PERIODIC))
+	       != (MLOOP_TIMER_ABSOLUTE | MLOOP_TIMER_PERIODIC));
 
 	self->timer_type = type;
 }
@@ -1769,6 +2834,12 @@ void mloop_timer_set_time(struct mloop_timer* self, uint64_t time)
 	self->time = time;
 }
 
+EXPORT
+void mloop_timer_set_slack(struct mloop_timer* self, uint64_t slack)
+{
+	self->slack = slack;
+}
+
 EXPORT
 void mloop_timer_set_context(struct mloop_timer* self, void* context,
 			     mloop_free_fn free_fn)
@@ -0,0 +1,112 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include "mpmcq.h"
+
+#define mpmcq__load(ptr, order) __atomic_load_n(ptr, __ATOMIC_##order)
+#define mpmcq__store(ptr, val, order) \
+	__atomic_store_n(ptr, val, __ATOMIC_##order)
+#define mpmcq__cas(ptr, expected_ptr, desired) \
+	__atomic_compare_exchange_n(ptr, expected_ptr, desired, 1, \
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
+int mpmcq_init(struct mpmcq* self, size_t size)
+{
+	size_t n = 1;
+	while (n < size)
+		n <<= 1;
+
+	self->cell = malloc(n * sizeof(*self->cell));
+	if (!self->cell)
+		return -1;
+
+	for (size_t i = 0; i < n; ++i) {
+		self->cell[i].sequence = i;
+		self->cell[i].data = NULL;
+	}
+
+	self->mask = n - 1;
+	self->head = 0;
+	self->tail = 0;
+
+	return 0;
+}
+
+void mpmcq_destroy(struct mpmcq* self)
+{
+	free(self->cell);
+}
+
+int mpmcq_push(struct mpmcq* self, void* data)
+{
+	unsigned long pos = mpmcq__load(&self->head, RELAXED);
+	struct mpmcq_cell* cell;
+
+	for (;;) {
+		cell = &self->cell[pos & self->mask];
+		unsigned long sequence = mpmcq__load(&cell->sequence, ACQUIRE);
+		long diff = (long)(sequence - pos);
+
+		if (diff == 0) {
+			if (mpmcq__cas(&self->head, &pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = mpmcq__load(&self->head, RELAXED);
+		}
+	}
+
+	cell->data = data;
+	mpmcq__store(&cell->sequence, pos + 1, RELEASE);
+
+	return 0;
+}
+
+int mpmcq_pop(struct mpmcq* self, void** data)
+{
+	unsigned long pos = mpmcq__load(&self->tail, RELAXED);
+	struct mpmcq_cell* cell;
+
+	for (;;) {
+		cell = &self->cell[pos & self->mask];
+		unsigned long sequence = mpmcq__load(&cell->sequence, ACQUIRE);
+		long diff = (long)(sequence - (pos + 1));
+
+		if (diff == 0) {
+			if (mpmcq__cas(&self->tail, &pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = mpmcq__load(&self->tail, RELAXED);
+		}
+	}
+
+	*data = cell->data;
+	mpmcq__store(&cell->sequence, pos + self->mask + 1, RELEASE);
+
+	return 0;
+}
+
+int mpmcq_is_empty(const struct mpmcq* self)
+{
+	unsigned long pos = mpmcq__load(&self->tail, RELAXED);
+	const struct mpmcq_cell* cell = &self->cell[pos & self->mask];
+	unsigned long sequence = mpmcq__load(&cell->sequence, ACQUIRE);
+
+	return (long)(sequence - (pos + 1)) < 0;
+}
@@ -19,10 +19,12 @@
 #include <time.h>
 #include <poll.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/tcp.h>
 #include "plog.h"
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
 #include <fcntl.h>
 
 #include "socketcan.h"
@@ -47,6 +49,16 @@ ssize_t net_write(int fd, const void* src, size_t size, int timeout)
 	return rc;
 }
 
+ssize_t net_send_iov(int fd, struct iovec* iov, int iovcnt)
+{
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = iovcnt,
+	};
+
+	return sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
 ssize_t net_write_frame(int fd, const struct can_frame* cf, int timeout)
 {
 	return net_write(fd, cf, sizeof(*cf), timeout);
@@ -118,3 +130,78 @@ int net_dont_delay(int fd)
 	int one = 1;
 	return setsockopt(fd, SOL_TCP, TCP_NODELAY, &one, sizeof(one));
 }
+
+static int net__unix_address(struct sockaddr_un* addr, socklen_t* len,
+			     const char* path)
+{
+	size_t size = strlen(path);
+	if (size == 0 || size >= sizeof(addr->sun_path))
+		return -1;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	memcpy(addr->sun_path, path, size);
+
+	/* Abstract names are not terminated */
+	if (path[0] == '@') {
+		addr->sun_path[0] = '\0';
+		*len = offsetof(struct sockaddr_un, sun_path) + size;
+	} else {
+		*len = sizeof(*addr);
+	}
+
+	return 0;
+}
+
+int net_unix_connect(const char* path)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+
+	if (net__unix_address(&addr, &len, path) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr*)&addr, len) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int net_unix_listen(const char* path)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+
+	if (net__unix_address(&addr, &len, path) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	/* A socket file left behind by an earlier run would fail the bind */
+	if (path[0] != '@')
+		unlink(path);
+
+	if (bind(fd, (struct sockaddr*)&addr, len) < 0)
+		goto failure;
+
+	if (listen(fd, 16) < 0)
+		goto failure;
+
+	return fd;
+
+failure:
+	close(fd);
+	return -1;
+}
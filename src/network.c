@@ -14,6 +14,8 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <time.h>
 #include <poll.h>
@@ -31,6 +33,7 @@
 #include "sock.h"
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 int co_net_send_nmt(const struct sock* sock, int cs, int nodeid)
 {
@@ -42,6 +45,33 @@ int co_net_send_nmt(const struct sock* sock, int cs, int nodeid)
 	return sock_send(sock, &cf, 0);
 }
 
+int co_net_send_nmt_range(const struct sock* sock, int cs, int start, int end)
+{
+	if (start <= CANOPEN_NODEID_MIN && end >= CANOPEN_NODEID_MAX)
+		return co_net_send_nmt(sock, cs, 0);
+
+	struct can_frame cf[CANOPEN_NODEID_MAX];
+	size_t n = 0;
+
+	for (int i = start; i <= end; ++i) {
+		memset(&cf[n], 0, sizeof(cf[n]));
+		cf[n].can_dlc = 2;
+		nmt_set_cs(&cf[n], cs);
+		nmt_set_nodeid(&cf[n], i);
+		++n;
+	}
+
+	for (size_t sent = 0; sent < n; ) {
+		ssize_t rc = sock_send_batch(sock, &cf[sent], n - sent, 0);
+		if (rc <= 0)
+			return -1;
+
+		sent += rc;
+	}
+
+	return 0;
+}
+
 int co_net__request_heartbeat(const struct sock* sock, int nodeid)
 {
 	struct can_frame cf = { 0 };
@@ -125,8 +155,7 @@ int co_net_reset(const struct sock* sock, char* nodes_seen, int timeout)
 int co_net_reset_range(const struct sock* sock, char* nodes_seen, int start,
 		       int end, int timeout)
 {
-	for (int i = start; i <= end; ++i)
-		co_net_send_nmt(sock, NMT_CS_RESET_COMMUNICATION, i);
+	co_net_send_nmt_range(sock, NMT_CS_RESET_COMMUNICATION, start, end);
 
 	return co_net__wait_for_bootup(sock, nodes_seen, start, end, timeout);
 }
@@ -150,3 +179,307 @@ int co_net_probe_sdo(const struct sock* sock, char* nodes_seen, int start,
 
 	return co_net__wait_for_sdo(sock, nodes_seen, start, end, timeout);
 }
+
+static const struct {
+	uint16_t index;
+	uint8_t subindex;
+} co_net__scan_objects[] = {
+	{ 0x1000, 0 }, /* Device type */
+	{ 0x1018, 1 }, /* Vendor id */
+	{ 0x1018, 2 }, /* Product code */
+	{ 0x1018, 3 }, /* Revision number */
+	{ 0x1018, 4 }, /* Serial number */
+	{ 0x1008, 0 }, /* Manufacturer device name */
+	{ 0x1009, 0 }, /* Manufacturer hardware version */
+	{ 0x100a, 0 }, /* Manufacturer software version */
+};
+
+#define CO_NET__SCAN_N_STEPS \
+	(sizeof(co_net__scan_objects) / sizeof(co_net__scan_objects[0]))
+
+static void co_net__scan_request(struct co_net_scan* scan, int nodeid,
+				 struct can_frame* out, uint64_t now)
+{
+	struct co_net__scan_state* state = &scan->state[nodeid];
+
+	sdo_clear_frame(out);
+	out->can_id = R_RSDO + nodeid;
+	out->can_dlc = CAN_MAX_DLEN;
+
+	if (state->is_segmented) {
+		sdo_set_cs(out, SDO_CCS_UL_SEG_REQ);
+		if (state->toggle)
+			sdo_toggle(out);
+	} else {
+		sdo_set_cs(out, SDO_CCS_UL_INIT_REQ);
+		sdo_set_index(out, co_net__scan_objects[state->step].index);
+		sdo_set_subindex(out, co_net__scan_objects[state->step].subindex);
+	}
+
+	if (!state->is_waiting)
+		++scan->n_waiting;
+
+	state->is_waiting = 1;
+	state->deadline = now + scan->timeout;
+}
+
+static void co_net__scan_stop(struct co_net_scan* scan, int nodeid)
+{
+	struct co_net__scan_state* state = &scan->state[nodeid];
+
+	if (state->is_waiting)
+		--scan->n_waiting;
+
+	state->is_waiting = 0;
+}
+
+static void co_net__scan_append(struct co_net__scan_state* state,
+				const uint8_t* data, size_t size)
+{
+	size_t room = sizeof(state->buffer) - state->size;
+	if (size > room)
+		size = room;
+
+	memcpy(&state->buffer[state->size], data, size);
+	state->size += size;
+}
+
+static void co_net__scan_store(struct co_net_scan* scan, int nodeid)
+{
+	struct co_net_node_info* info = &scan->node[nodeid];
+	struct co_net__scan_state* state = &scan->state[nodeid];
+
+	uint32_t value = 0;
+	byteorder(&value, state->buffer, MIN(state->size, sizeof(value)));
+
+	char* string = NULL;
+
+	switch (state->step) {
+	case 0: info->device_type = value; break;
+	case 1: info->vendor_id = value; break;
+	case 2: info->product_code = value; break;
+	case 3: info->revision_number = value; break;
+	case 4: info->serial_number = value; break;
+	case 5: string = info->name; break;
+	case 6: string = info->hw_version; break;
+	case 7: string = info->sw_version; break;
+	}
+
+	if (string) {
+		size_t size = MIN(state->size, CO_NET_SCAN_STRING_SIZE - 1);
+		memcpy(string, state->buffer, size);
+		string[size] = '\0';
+	}
+}
+
+/* Moves on to the next object; aborted objects are left at zero */
+static size_t co_net__scan_next(struct co_net_scan* scan, int nodeid,
+				struct can_frame* out, uint64_t now)
+{
+	struct co_net__scan_state* state = &scan->state[nodeid];
+
+	state->is_segmented = 0;
+	state->toggle = 0;
+	state->size = 0;
+
+	if (++state->step >= CO_NET__SCAN_N_STEPS) {
+		co_net__scan_stop(scan, nodeid);
+		return 0;
+	}
+
+	co_net__scan_request(scan, nodeid, out, now);
+	return 1;
+}
+
+static size_t co_net__scan_abort(struct co_net_scan* scan, int nodeid,
+				 struct can_frame* out,
+				 enum sdo_abort_code code)
+{
+	sdo_clear_frame(out);
+	out->can_id = R_RSDO + nodeid;
+	out->can_dlc = CAN_MAX_DLEN;
+	sdo_set_cs(out, SDO_CCS_ABORT);
+	sdo_set_index(out, co_net__scan_objects[scan->state[nodeid].step].index);
+	sdo_set_subindex(out,
+			 co_net__scan_objects[scan->state[nodeid].step].subindex);
+	sdo_set_abort_code(out, code);
+
+	co_net__scan_stop(scan, nodeid);
+	return 1;
+}
+
+size_t co_net_scan_begin(struct co_net_scan* scan, int start, int end,
+			 int timeout, struct can_frame* out, uint64_t now)
+{
+	memset(scan, 0, sizeof(*scan));
+	scan->start = MAX(start, CANOPEN_NODEID_MIN);
+	scan->end = MIN(end, CANOPEN_NODEID_MAX);
+	scan->timeout = timeout;
+
+	size_t n = 0;
+
+	for (int i = scan->start; i <= scan->end; ++i)
+		co_net__scan_request(scan, i, &out[n++], now);
+
+	return n;
+}
+
+size_t co_net_scan_feed(struct co_net_scan* scan, const struct can_frame* cf,
+			struct can_frame* out, uint64_t now)
+{
+	if (cf->can_id & (CAN_RTR_FLAG | CAN_EFF_FLAG | CAN_ERR_FLAG))
+		return 0;
+
+	int nodeid = (cf->can_id & CAN_SFF_MASK) - R_TSDO;
+	if (nodeid < scan->start || nodeid > scan->end
+	 || cf->can_dlc < SDO_EXPEDIATED_DATA_IDX)
+		return 0;
+
+	struct co_net__scan_state* state = &scan->state[nodeid];
+	if (!state->is_waiting)
+		return 0;
+
+	int cs = sdo_get_cs(cf);
+
+	if (state->is_segmented) {
+		if (cs == SDO_SCS_ABORT)
+			return co_net__scan_next(scan, nodeid, out, now);
+
+		if (cs != SDO_SCS_UL_SEG_RES)
+			return co_net__scan_abort(scan, nodeid, out,
+						  SDO_ABORT_INVALID_CS);
+
+		if (sdo_is_toggled(cf) != state->toggle)
+			return co_net__scan_abort(scan, nodeid, out,
+						  SDO_ABORT_TOGGLE);
+
+		co_net__scan_append(state, &cf->data[SDO_SEGMENT_IDX],
+				    sdo_get_segment_size(cf));
+
+		if (sdo_is_end_segment(cf)) {
+			co_net__scan_store(scan, nodeid);
+			return co_net__scan_next(scan, nodeid, out, now);
+		}
+
+		state->toggle = !state->toggle;
+		co_net__scan_request(scan, nodeid, out, now);
+		return 1;
+	}
+
+	/* Answers to other clients on the bus are not for us */
+	if (sdo_get_index(cf) != co_net__scan_objects[state->step].index
+	 || sdo_get_subindex(cf) != co_net__scan_objects[state->step].subindex)
+		return 0;
+
+	scan->node[nodeid].is_present = 1;
+
+	if (cs == SDO_SCS_ABORT)
+		return co_net__scan_next(scan, nodeid, out, now);
+
+	if (cs != SDO_SCS_UL_INIT_RES)
+		return co_net__scan_abort(scan, nodeid, out,
+					  SDO_ABORT_INVALID_CS);
+
+	if (sdo_is_expediated(cf)) {
+		size_t size = sdo_is_size_indicated(cf)
+			    ? sdo_get_expediated_size(cf)
+			    : SDO_EXPEDIATED_DATA_SIZE;
+
+		co_net__scan_append(state, &cf->data[SDO_EXPEDIATED_DATA_IDX],
+				    size);
+		co_net__scan_store(scan, nodeid);
+		return co_net__scan_next(scan, nodeid, out, now);
+	}
+
+	state->is_segmented = 1;
+	co_net__scan_request(scan, nodeid, out, now);
+	return 1;
+}
+
+int co_net_scan_expire(struct co_net_scan* scan, uint64_t now)
+{
+	uint64_t next = UINT64_MAX;
+
+	for (int i = scan->start; i <= scan->end; ++i) {
+		struct co_net__scan_state* state = &scan->state[i];
+		if (!state->is_waiting)
+			continue;
+
+		if (state->deadline <= now)
+			co_net__scan_stop(scan, i);
+		else if (state->deadline < next)
+			next = state->deadline;
+	}
+
+	return scan->n_waiting ? (int)(next - now) : -1;
+}
+
+int co_net_scan(const struct sock* sock, struct co_net_scan* scan, int start,
+		int end, int timeout)
+{
+	struct can_frame out[CANOPEN_NODEID_MAX];
+	struct can_frame in[CANOPEN_NODEID_MAX];
+
+	size_t n_out = co_net_scan_begin(scan, start, end, timeout, out,
+					 gettime_ms(CLOCK_MONOTONIC));
+
+	while (1) {
+		for (size_t sent = 0; sent < n_out; ) {
+			ssize_t rc = sock_send_batch(sock, &out[sent],
+						     n_out - sent, 0);
+			if (rc <= 0)
+				return -1;
+
+			sent += rc;
+		}
+
+		n_out = 0;
+
+		int wait = co_net_scan_expire(scan, gettime_ms(CLOCK_MONOTONIC));
+		if (wait < 0)
+			return 0;
+
+		struct pollfd pollfd = {
+			.fd = sock_get_poll_fd(sock),
+			.events = POLLIN,
+		};
+
+		if (poll(&pollfd, 1, wait) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (!(pollfd.revents & POLLIN))
+			continue;
+
+		/* Room is left for one request per frame */
+		ssize_t n_in = sock_recv_batch(sock, in, NULL,
+					       CANOPEN_NODEID_MAX,
+					       MSG_DONTWAIT);
+		if (n_in < 0 && errno == EAGAIN)
+			continue;
+		if (n_in <= 0)
+			return -1;
+
+		uint64_t now = gettime_ms(CLOCK_MONOTONIC);
+
+		for (ssize_t i = 0; i < n_in; ++i)
+			n_out += co_net_scan_feed(scan, &in[i], &out[n_out],
+						  now);
+	}
+}
+
+__attribute__((visibility("default")))
+int co_net_scan_bus(enum sock_type type, const char* addr,
+		    struct co_net_scan* scan, int start, int end, int timeout)
+{
+	struct sock sock;
+	if (sock_open(&sock, type, addr, NULL) < 0)
+		return -1;
+
+	int rc = co_net_scan(&sock, scan, start, end, timeout);
+
+	sock_close(&sock);
+	return rc;
+}
@@ -0,0 +1,217 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include "objpool.h"
+
+#define OBJPOOL__ALIGN 16
+#define OBJPOOL__SLAB_COUNT 32
+#define OBJPOOL__CACHE_MAX 64
+
+struct objpool_object {
+	struct objpool_object* next;
+};
+
+struct objpool__cache {
+	struct objpool* pool;
+	struct objpool_object* head;
+	size_t count;
+};
+
+static inline size_t objpool__object_size(const struct objpool* self)
+{
+	size_t size = self->size;
+	if (size < sizeof(struct objpool_object))
+		size = sizeof(struct objpool_object);
+
+	return (size + OBJPOOL__ALIGN - 1) & ~(size_t)(OBJPOOL__ALIGN - 1);
+}
+
+/* Hands a list of objects back to the shared free list */
+static void objpool__give_back(struct objpool* self,
+			       struct objpool_object* head,
+			       struct objpool_object* tail)
+{
+	pthread_mutex_lock(&self->mutex);
+	tail->next = self->free;
+	self->free = head;
+	pthread_mutex_unlock(&self->mutex);
+}
+
+static void objpool__cache_free(void* ptr)
+{
+	struct objpool__cache* cache = ptr;
+
+	struct objpool_object* tail = cache->head;
+	if (tail) {
+		while (tail->next)
+			tail = tail->next;
+
+		objpool__give_back(cache->pool, cache->head, tail);
+	}
+
+	free(cache);
+}
+
+static int objpool__setup(struct objpool* self)
+{
+	if (__atomic_load_n(&self->is_ready, __ATOMIC_ACQUIRE))
+		return 0;
+
+	int rc = 0;
+
+	pthread_mutex_lock(&self->mutex);
+
+	if (!self->is_ready) {
+		rc = pthread_key_create(&self->key, objpool__cache_free);
+		if (rc == 0)
+			__atomic_store_n(&self->is_ready, 1, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&self->mutex);
+
+	return rc == 0 ? 0 : -1;
+}
+
+static struct objpool__cache* objpool__get_cache(struct objpool* self)
+{
+	if (objpool__setup(self) < 0)
+		return NULL;
+
+	struct objpool__cache* cache = pthread_getspecific(self->key);
+	if (cache)
+		return cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->pool = self;
+
+	if (pthread_setspecific(self->key, cache) != 0) {
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+/* Takes up to half a cache worth of objects from the shared free list or
+ * from a new slab. Must be called with the mutex held.
+ */
+static struct objpool_object* objpool__refill_locked(struct objpool* self,
+						     size_t* count)
+{
+	struct objpool_object* head = self->free;
+
+	if (!head) {
+		size_t size = objpool__object_size(self);
+		char* slab = malloc(size * OBJPOOL__SLAB_COUNT);
+		if (!slab)
+			return NULL;
+
+		for (size_t i = 0; i < OBJPOOL__SLAB_COUNT; ++i) {
+			struct objpool_object* obj = (void*)(slab + i * size);
+			obj->next = i + 1 < OBJPOOL__SLAB_COUNT
+				  ? (void*)(slab + (i + 1) * size) : NULL;
+		}
+
+		head = (void*)slab;
+	}
+
+	struct objpool_object* tail = head;
+	*count = 1;
+
+	while (tail->next && *count < OBJPOOL__CACHE_MAX / 2) {
+		tail = tail->next;
+		++*count;
+	}
+
+	self->free = tail->next;
+	tail->next = NULL;
+
+	return head;
+}
+
+void* objpool_alloc(struct objpool* self)
+{
+	struct objpool__cache* cache = objpool__get_cache(self);
+	struct objpool_object* obj;
+
+	if (cache && cache->head) {
+		obj = cache->head;
+		cache->head = obj->next;
+		cache->count--;
+		return obj;
+	}
+
+	size_t count = 0;
+
+	pthread_mutex_lock(&self->mutex);
+	obj = objpool__refill_locked(self, &count);
+	pthread_mutex_unlock(&self->mutex);
+
+	if (!obj)
+		return NULL;
+
+	if (cache) {
+		cache->head = obj->next;
+		cache->count = count - 1;
+	} else if (obj->next) {
+		/* No cache to keep the rest in */
+		struct objpool_object* tail = obj->next;
+		while (tail->next)
+			tail = tail->next;
+
+		objpool__give_back(self, obj->next, tail);
+	}
+
+	return obj;
+}
+
+void objpool_free(struct objpool* self, void* ptr)
+{
+	if (!ptr)
+		return;
+
+	struct objpool_object* obj = ptr;
+	struct objpool__cache* cache = objpool__get_cache(self);
+
+	if (!cache) {
+		objpool__give_back(self, obj, obj);
+		return;
+	}
+
+	obj->next = cache->head;
+	cache->head = obj;
+
+	if (++cache->count < OBJPOOL__CACHE_MAX)
+		return;
+
+	/* Keep the most recently freed half */
+	struct objpool_object* tail = cache->head;
+	for (size_t i = 1; i < OBJPOOL__CACHE_MAX / 2; ++i)
+		tail = tail->next;
+
+	struct objpool_object* rest = tail->next;
+	tail->next = NULL;
+	cache->count = OBJPOOL__CACHE_MAX / 2;
+
+	struct objpool_object* rest_tail = rest;
+	while (rest_tail->next)
+		rest_tail = rest_tail->next;
+
+	objpool__give_back(self, rest, rest_tail);
+}
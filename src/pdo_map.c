@@ -0,0 +1,221 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include "canopen/types.h"
+#include "canopen/eds.h"
+#include "canopen/pdo_map.h"
+
+#define PDO_MAP__DUMMY_INDEX_MAX 0x1f
+
+static enum co_signal_type pdo_map__signal_type(enum canopen_type type,
+						unsigned int length)
+{
+	if (canopen_type_is_signed_integer(type))
+		return CO_SIGNAL_SIGNED;
+
+	if ((type == CANOPEN_REAL32 && length == 32)
+	 || (type == CANOPEN_REAL64 && length == 64))
+		return CO_SIGNAL_REAL;
+
+	return CO_SIGNAL_UNSIGNED;
+}
+
+static enum canopen_type pdo_map__object_type(const struct canopen_eds* eds,
+					      int index, int subindex)
+{
+	if (index <= PDO_MAP__DUMMY_INDEX_MAX)
+		return index;
+
+	if (!eds)
+		return CANOPEN_UNKNOWN;
+
+	const struct eds_obj* obj = eds_obj_find(eds, index, subindex);
+	return obj ? obj->type : CANOPEN_UNKNOWN;
+}
+
+int pdo_map_compile(struct pdo_map* self, const uint32_t* mapping, size_t n,
+		    const struct canopen_eds* eds)
+{
+	unsigned int offset = 0;
+
+	self->is_ready = 0;
+
+	if (n > PDO_MAP_ENTRIES_MAX)
+		goto failure;
+
+	for (size_t i = 0; i < n; ++i) {
+		int index = mapping[i] >> 16;
+		int subindex = (mapping[i] >> 8) & 0xff;
+		unsigned int length = mapping[i] & 0xff;
+
+		if (length == 0 || length > 64
+		 || offset + length > PDO_MAP_SIZE_MAX * 8)
+			goto failure;
+
+		struct pdo_map_entry* entry = &self->entry[i];
+		entry->byte = offset / 8;
+		entry->shift = offset % 8;
+		entry->n_bytes = (entry->shift + length + 7) / 8;
+		entry->mask = length == 64 ? UINT64_MAX : (1ULL << length) - 1;
+
+		enum canopen_type type =
+			pdo_map__object_type(eds, index, subindex);
+
+		struct co_signal* signal = &self->signal[i];
+		memset(signal, 0, sizeof(*signal));
+		signal->index = index;
+		signal->subindex = subindex;
+		signal->length = length;
+		signal->type = pdo_map__signal_type(type, length);
+
+		offset += length;
+	}
+
+	self->n_entries = n;
+	self->size = (offset + 7) / 8;
+	self->is_ready = 1;
+	return 0;
+
+failure:
+	errno = EINVAL;
+	return -1;
+}
+
+int pdo_map_find(const struct pdo_map* self, int index, int subindex)
+{
+	if (!self->is_ready)
+		return -1;
+
+	for (size_t i = 0; i < self->n_entries; ++i)
+		if (self->signal[i].index == index
+		 && self->signal[i].subindex == subindex)
+			return i;
+
+	return -1;
+}
+
+static inline uint64_t pdo_map__load(const struct pdo_map_entry* entry,
+				     const uint8_t* data)
+{
+	const uint8_t* p = data + entry->byte;
+	unsigned int n = entry->n_bytes < 8 ? entry->n_bytes : 8;
+	uint64_t value = 0;
+
+	for (unsigned int i = 0; i < n; ++i)
+		value |= (uint64_t)p[i] << (i * 8);
+
+	value >>= entry->shift;
+
+	/* A 64 bit value that does not start on a byte boundary */
+	if (entry->n_bytes > 8)
+		value |= (uint64_t)p[8] << (64 - entry->shift);
+
+	return value & entry->mask;
+}
+
+static inline void pdo_map__store(const struct pdo_map_entry* entry,
+				  uint8_t* data, uint64_t value)
+{
+	uint8_t* p = data + entry->byte;
+	unsigned int n = entry->n_bytes < 8 ? entry->n_bytes : 8;
+
+	value &= entry->mask;
+
+	for (unsigned int i = 0; i < n; ++i)
+		p[i] |= (uint8_t)((value << entry->shift) >> (i * 8));
+
+	if (entry->n_bytes > 8)
+		p[8] |= (uint8_t)(value >> (64 - entry->shift));
+}
+
+static inline void pdo_map__to_signal(struct co_signal* signal, uint64_t raw)
+{
+	switch (signal->type) {
+	case CO_SIGNAL_UNSIGNED:
+		signal->u = raw;
+		break;
+	case CO_SIGNAL_SIGNED:
+		if (signal->length < 64) {
+			unsigned int shift = 64 - signal->length;
+			signal->i = (int64_t)(raw << shift) >> shift;
+		} else {
+			signal->i = raw;
+		}
+		break;
+	case CO_SIGNAL_REAL:
+		if (signal->length == 32) {
+			uint32_t raw32 = raw;
+			float f;
+			memcpy(&f, &raw32, sizeof(f));
+			signal->f = f;
+		} else {
+			memcpy(&signal->f, &raw, sizeof(signal->f));
+		}
+		break;
+	}
+}
+
+static inline uint64_t pdo_map__from_signal(const struct co_signal* signal)
+{
+	uint64_t raw;
+
+	switch (signal->type) {
+	case CO_SIGNAL_REAL:
+		if (signal->length == 32) {
+			float f = signal->f;
+			uint32_t raw32;
+			memcpy(&raw32, &f, sizeof(raw32));
+			return raw32;
+		}
+
+		memcpy(&raw, &signal->f, sizeof(raw));
+		return raw;
+	case CO_SIGNAL_SIGNED:
+		return signal->i;
+	case CO_SIGNAL_UNSIGNED:
+		break;
+	}
+
+	return signal->u;
+}
+
+int pdo_map_decode(struct pdo_map* self, const void* data, size_t size)
+{
+	if (!self->is_ready || size < self->size)
+		return -1;
+
+	for (size_t i = 0; i < self->n_entries; ++i)
+		pdo_map__to_signal(&self->signal[i],
+				   pdo_map__load(&self->entry[i], data));
+
+	return 0;
+}
+
+ssize_t pdo_map_encode(const struct pdo_map* self, void* dst, size_t size)
+{
+	if (!self->is_ready || size < self->size)
+		return -1;
+
+	memset(dst, 0, self->size);
+
+	for (size_t i = 0; i < self->n_entries; ++i)
+		pdo_map__store(&self->entry[i], dst,
+			       pdo_map__from_signal(&self->signal[i]));
+
+	return self->size;
+}
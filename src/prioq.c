@@ -21,12 +21,43 @@
 #include "prioq.h"
 #include "thread-utils.h"
 
+static void prioq__link_free(struct prioq* self, size_t from, size_t to)
+{
+	for (size_t i = from; i < to; ++i)
+		self->slots[i].next = i + 1 < to ? i + 1 : self->free_slot;
+
+	if (from < to)
+		self->free_slot = from;
+}
+
+static void prioq__reset_levels(struct prioq* self)
+{
+	self->free_slot = PRIOQ__NIL;
+	self->n_queued = 0;
+	self->levels_used = 0;
+
+	for (int i = 0; i < PRIOQ_N_LEVELS; ++i) {
+		self->level[i].first = PRIOQ__NIL;
+		self->level[i].last = PRIOQ__NIL;
+	}
+
+	prioq__link_free(self, 0, self->size);
+}
+
 int prioq_init(struct prioq* self, size_t size)
 {
+	if (size == 0)
+		size = 1;
+
 	self->sequence = 0;
 	self->size = size;
 	self->index = 0;
-	self->head = calloc(size, sizeof(*self->head));
+	self->head = NULL;
+	self->heap_size = 0;
+	self->slots = malloc(size * sizeof(*self->slots));
+
+	if (self->slots)
+		prioq__reset_levels(self);
 
 	pthread_mutexattr_t attr;
 	pthread_mutexattr_init(&attr);
@@ -36,13 +67,14 @@ int prioq_init(struct prioq* self, size_t size)
 
 	pthread_cond_init(&self->suspend_cond, NULL);
 
-	return self->head ? 0 : -1;
+	return self->slots ? 0 : -1;
 }
 
 void prioq_destroy(struct prioq* self)
 {
 	pthread_mutex_destroy(&self->mutex);
 	pthread_cond_destroy(&self->suspend_cond);
+	free(self->slots);
 	free(self->head);
 }
 
@@ -51,9 +83,25 @@ void prioq_clear(struct prioq* self)
 	prioq__lock(self);
 	self->sequence = 0;
 	self->index = 0;
+	prioq__reset_levels(self);
 	prioq__unlock(self);
 }
 
+static int prioq__grow_heap(struct prioq* self, size_t size)
+{
+	if (self->heap_size >= size)
+		return 0;
+
+	struct prioq_elem* new_head = realloc(self->head,
+					      size * sizeof(*self->head));
+	if (!new_head)
+		return -1;
+
+	self->heap_size = size;
+	self->head = new_head;
+	return 0;
+}
+
 int prioq_copy(struct prioq* dst, struct prioq* src)
 {
 	int rc;
@@ -61,7 +109,11 @@ int prioq_copy(struct prioq* dst, struct prioq* src)
 	prioq__lock(dst);
 	prioq__lock(src);
 
-	rc = prioq_grow(dst, src->index);
+	rc = prioq_grow(dst, src->size);
+	if (rc < 0)
+		goto done;
+
+	rc = prioq__grow_heap(dst, src->index);
 	if (rc < 0)
 		goto done;
 
@@ -70,6 +122,16 @@ int prioq_copy(struct prioq* dst, struct prioq* src)
 
 	memcpy(dst->head, src->head, dst->index * sizeof(*dst->head));
 
+	/* Slots keep their indices, so the lists carry over as they are and
+	 * whatever dst has beyond src is free.
+	 */
+	memcpy(dst->slots, src->slots, src->size * sizeof(*dst->slots));
+	memcpy(dst->level, src->level, sizeof(dst->level));
+	dst->levels_used = src->levels_used;
+	dst->n_queued = src->n_queued;
+	dst->free_slot = src->free_slot;
+	prioq__link_free(dst, src->size, dst->size);
+
 	rc = 0;
 done:
 	prioq__unlock(src);
@@ -110,15 +172,16 @@ int prioq_grow(struct prioq* self, size_t size)
 		goto done;
 	}
 
-	struct prioq_elem* new_head = realloc(self->head,
-					      size * sizeof(*self->head));
-	if (!new_head) {
+	struct prioq_slot* new_slots = realloc(self->slots,
+					       size * sizeof(*self->slots));
+	if (!new_slots) {
 		rc = -1;
 		goto done;
 	}
 
+	self->slots = new_slots;
+	prioq__link_free(self, self->size, size);
 	self->size = size;
-	self->head = new_head;
 
 	rc = 1;
 done:
@@ -126,15 +189,14 @@ done:
 	return rc;
 }
 
-int prioq_insert(struct prioq* self, unsigned long priority, void* data)
+static int prioq__insert_heap(struct prioq* self, unsigned long priority,
+			      void* data)
 {
-	int rc = -1;
-
-	prioq__lock(self);
-
-	if (self->index >= self->size)
-		if (prioq_grow(self, self->size*2) < 0)
-			goto done;
+	if (self->index >= self->heap_size)
+		if (prioq__grow_heap(self, self->heap_size
+					   ? self->heap_size * 2
+					   : self->size) < 0)
+			return -1;
 
 	struct prioq_elem* elem = &self->head[self->index++];
 
@@ -143,6 +205,48 @@ int prioq_insert(struct prioq* self, unsigned long priority, void* data)
 	elem->sequence_ = self->sequence++;
 
 	prioq__bubble_up(self, self->index - 1);
+	return 0;
+}
+
+static int prioq__insert_level(struct prioq* self, unsigned long priority,
+			       void* data)
+{
+	if (self->free_slot == PRIOQ__NIL)
+		if (prioq_grow(self, self->size * 2) < 0)
+			return -1;
+
+	unsigned long i = self->free_slot;
+	struct prioq_slot* slot = &self->slots[i];
+	self->free_slot = slot->next;
+
+	slot->elem.priority = priority;
+	slot->elem.data = data;
+	slot->elem.sequence_ = self->sequence++;
+	slot->next = PRIOQ__NIL;
+
+	struct prioq_level* level = &self->level[priority];
+	if (level->last == PRIOQ__NIL)
+		level->first = i;
+	else
+		self->slots[level->last].next = i;
+	level->last = i;
+
+	self->levels_used |= UINT64_C(1) << priority;
+	self->n_queued++;
+	return 0;
+}
+
+int prioq_insert(struct prioq* self, unsigned long priority, void* data)
+{
+	int rc = -1;
+
+	prioq__lock(self);
+
+	rc = priority < PRIOQ_N_LEVELS
+	   ? prioq__insert_level(self, priority, data)
+	   : prioq__insert_heap(self, priority, data);
+	if (rc < 0)
+		goto done;
 
 	pthread_cond_signal(&self->suspend_cond);
 
@@ -152,21 +256,45 @@ done:
 	return rc;
 }
 
+static void prioq__pop_level(struct prioq* self, struct prioq_elem* elem)
+{
+	int priority = __builtin_ctzll(self->levels_used);
+	struct prioq_level* level = &self->level[priority];
+
+	unsigned long i = level->first;
+	struct prioq_slot* slot = &self->slots[i];
+	*elem = slot->elem;
+
+	level->first = slot->next;
+	if (level->first == PRIOQ__NIL) {
+		level->last = PRIOQ__NIL;
+		self->levels_used &= ~(UINT64_C(1) << priority);
+	}
+
+	slot->next = self->free_slot;
+	self->free_slot = i;
+	self->n_queued--;
+}
+
 int prioq_pop(struct prioq* self, struct prioq_elem* elem, int timeout)
 {
 	prioq__lock(self);
 
 	int rc = block_thread_while_empty(&self->suspend_cond, &self->mutex,
-					  timeout, self->index == 0);
+					  timeout, prioq__is_empty(self));
 	if (rc < 0)
 		goto done;
 
-	assert(self->index > 0);
+	if (self->levels_used) {
+		prioq__pop_level(self, elem);
+	} else {
+		assert(self->index > 0);
 
-	*elem = self->head[0];
-	self->head[0] = self->head[--self->index];
+		*elem = self->head[0];
+		self->head[0] = self->head[--self->index];
 
-	prioq__sink_down(self, 0);
+		prioq__sink_down(self, 0);
+	}
 
 	rc = 1;
 done:
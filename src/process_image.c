@@ -0,0 +1,188 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "canopen/process_image.h"
+
+static struct co_pi* co_pi__image = NULL;
+static char co_pi__name[256];
+
+/* RPDOs may be sent from any thread, but each slot needs a single writer */
+static pthread_mutex_t co_pi__lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void co_pi__format_name(char* dst, size_t size, const char* iface)
+{
+	snprintf(dst, size, "/canopen-pi.%s", iface);
+}
+
+static inline int co_pi__is_valid_slot(int nodeid, int n)
+{
+	return 0 <= nodeid && nodeid < CO_PI_NODE_COUNT
+	    && 1 <= n && n <= CO_PI_PDO_COUNT;
+}
+
+int co_pi_init(const char* iface)
+{
+	co_pi__format_name(co_pi__name, sizeof(co_pi__name), iface);
+
+	int fd = shm_open(co_pi__name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, sizeof(struct co_pi)) < 0)
+		goto failure;
+
+	void* image = mmap(NULL, sizeof(struct co_pi), PROT_READ | PROT_WRITE,
+			   MAP_SHARED, fd, 0);
+	if (image == MAP_FAILED)
+		goto failure;
+
+	close(fd);
+
+	co_pi__image = image;
+	memset(co_pi__image, 0, sizeof(*co_pi__image));
+	co_pi__image->size = sizeof(*co_pi__image);
+	__atomic_store_n(&co_pi__image->magic, CO_PI_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+
+failure:
+	close(fd);
+	shm_unlink(co_pi__name);
+	return -1;
+}
+
+void co_pi_cleanup(void)
+{
+	if (!co_pi__image)
+		return;
+
+	munmap(co_pi__image, sizeof(*co_pi__image));
+	shm_unlink(co_pi__name);
+	co_pi__image = NULL;
+}
+
+int co_pi_is_open(void)
+{
+	return co_pi__image != NULL;
+}
+
+static void co_pi__write_slot(struct co_pi_slot* slot, const void* data,
+			      size_t len, uint64_t timestamp)
+{
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->len = len;
+	slot->timestamp = timestamp;
+	memcpy(slot->data, data, len);
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void co_pi_write(enum co_pi_direction direction, int nodeid, int n,
+		 const void* data, size_t len, uint64_t timestamp)
+{
+	if (!co_pi__image || !co_pi__is_valid_slot(nodeid, n))
+		return;
+
+	if (len > CO_PI_DATA_SIZE)
+		len = CO_PI_DATA_SIZE;
+
+	struct co_pi_slot* slot = &co_pi__image->slot[nodeid][direction][n - 1];
+
+	/* TPDOs are only written from the main loop */
+	if (direction == CO_PI_TPDO) {
+		co_pi__write_slot(slot, data, len, timestamp);
+		return;
+	}
+
+	pthread_mutex_lock(&co_pi__lock);
+	co_pi__write_slot(slot, data, len, timestamp);
+	pthread_mutex_unlock(&co_pi__lock);
+}
+
+__attribute__((visibility("default")))
+const struct co_pi* co_pi_open(const char* iface)
+{
+	char name[256];
+	co_pi__format_name(name, sizeof(name), iface);
+
+	int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct co_pi)) {
+		close(fd);
+		return NULL;
+	}
+
+	const struct co_pi* pi = mmap(NULL, sizeof(*pi), PROT_READ, MAP_SHARED,
+				      fd, 0);
+	close(fd);
+	if (pi == MAP_FAILED)
+		return NULL;
+
+	if (__atomic_load_n(&pi->magic, __ATOMIC_ACQUIRE) != CO_PI_MAGIC
+	 || pi->size != sizeof(*pi)) {
+		co_pi_close(pi);
+		return NULL;
+	}
+
+	return pi;
+}
+
+__attribute__((visibility("default")))
+void co_pi_close(const struct co_pi* pi)
+{
+	munmap((void*)pi, sizeof(*pi));
+}
+
+__attribute__((visibility("default")))
+int co_pi_read(const struct co_pi* pi, enum co_pi_direction direction,
+	       int nodeid, int n, struct co_pi_value* dst)
+{
+	if (!co_pi__is_valid_slot(nodeid, n))
+		return -1;
+
+	const struct co_pi_slot* slot = &pi->slot[nodeid][direction][n - 1];
+	uint32_t before, after;
+
+	do {
+		before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (before & 1)
+			continue;
+
+		size_t len = slot->len;
+		dst->len = len <= CO_PI_DATA_SIZE ? len : CO_PI_DATA_SIZE;
+		dst->timestamp = slot->timestamp;
+		memcpy(dst->data, slot->data, dst->len);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	} while ((before & 1) || before != after);
+
+	return before != 0 ? 0 : -1;
+}
@@ -0,0 +1,294 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/prctl.h>
+
+#include "canopen.h"
+#include "canopen/replay.h"
+#include "socketcan.h"
+#include "sock.h"
+#include "time-utils.h"
+#include "trace-buffer.h"
+#include "trace-format.h"
+
+#define REPLAY_BATCH_SIZE 64
+
+#define REPLAY_NODE_OBJECTS \
+	(CANOPEN_TPDO1 | CANOPEN_TPDO2 | CANOPEN_TPDO3 | CANOPEN_TPDO4 \
+	 | CANOPEN_TSDO | CANOPEN_HEARTBEAT | CANOPEN_EMCY)
+
+struct replay {
+	struct sock* sock;
+	const struct co_replay_params* params;
+	struct co_replay_stats* stats;
+	uint32_t objects;
+
+	FILE* output;
+	struct trace_export export;
+
+	int is_started;
+	uint64_t trace_start;
+	uint64_t wall_start;
+	uint64_t last_sent;
+
+	struct canfd_frame batch[REPLAY_BATCH_SIZE];
+	size_t batch_len;
+
+	int error;
+};
+
+static inline uint64_t replay__now(void)
+{
+	return gettime_us(CLOCK_MONOTONIC);
+}
+
+/* Takes whatever has been received without blocking */
+static void replay__record(struct replay* self)
+{
+	struct canfd_frame cf[REPLAY_BATCH_SIZE];
+	uint64_t ts[REPLAY_BATCH_SIZE];
+
+	while (1) {
+		memset(cf, 0, sizeof(cf));
+
+		ssize_t count = sock_recv_fd_batch(self->sock, cf, ts,
+						   REPLAY_BATCH_SIZE,
+						   MSG_DONTWAIT);
+		if (count <= 0)
+			break;
+
+		self->stats->n_received += count;
+
+		if (!self->output)
+			continue;
+
+		for (ssize_t i = 0; i < count; ++i) {
+			struct tb_frame frame = {
+				.timestamp = ts[i],
+				.cfd = cf[i],
+			};
+
+			trace_export_frame(&self->export, &frame);
+		}
+	}
+}
+
+/* Records incoming frames until the given time */
+static void replay__wait(struct replay* self, uint64_t until)
+{
+	struct pollfd pollfd = {
+		.fd = sock_get_poll_fd(self->sock),
+		.events = POLLIN,
+	};
+
+	while (1) {
+		uint64_t now = replay__now();
+		if (now >= until)
+			break;
+
+		struct timespec timeout = ns_to_timespec((until - now) * 1000ULL);
+
+		int rc = ppoll(&pollfd, 1, &timeout, NULL);
+		if (rc < 0 && errno != EINTR) {
+			self->error = -1;
+			break;
+		}
+
+		if (rc > 0)
+			replay__record(self);
+	}
+}
+
+static void replay__flush(struct replay* self)
+{
+	size_t pos = 0;
+
+	while (pos < self->batch_len) {
+		ssize_t rc = sock_send_fd_batch(self->sock, &self->batch[pos],
+						self->batch_len - pos, 0);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+
+			self->error = -1;
+			break;
+		}
+
+		pos += rc;
+	}
+
+	self->stats->n_sent += pos;
+	self->batch_len = 0;
+
+	self->last_sent = replay__now();
+}
+
+static int replay__is_selected(const struct replay* self,
+			       const struct canfd_frame* cfd)
+{
+	/* A TCP stream cannot carry FD frames */
+	if (self->sock->type == SOCK_TYPE_TCP && canfd_is_fd(cfd))
+		return 0;
+
+	if (self->objects == CO_REPLAY_ALL)
+		return 1;
+
+	struct canopen_msg msg;
+	canopen_get_object_type(&msg, canfd_as_can_frame(cfd));
+
+	return !!(msg.object & self->objects);
+}
+
+static void replay__frame(const struct tb_frame* frame, void* context)
+{
+	struct replay* self = context;
+
+	if (self->error)
+		return;
+
+	if (!replay__is_selected(self, &frame->cfd)) {
+		self->stats->n_skipped++;
+		return;
+	}
+
+	uint64_t now = replay__now();
+
+	if (!self->is_started) {
+		self->trace_start = frame->timestamp;
+		self->wall_start = now;
+		self->is_started = 1;
+	}
+
+	double speed = self->params->speed;
+
+	if (speed > 0.0) {
+		uint64_t offset = frame->timestamp > self->trace_start
+				? frame->timestamp - self->trace_start : 0;
+		uint64_t target = self->wall_start + (uint64_t)(offset / speed);
+
+		/* Frames that are due are sent together */
+		if (target > now) {
+			replay__flush(self);
+			replay__wait(self, target);
+			now = replay__now();
+		}
+
+		uint64_t lag = now > target ? now - target : 0;
+		self->stats->lag_sum += lag;
+		if (lag > self->stats->lag_max)
+			self->stats->lag_max = lag;
+	}
+
+	if (self->batch_len == REPLAY_BATCH_SIZE) {
+		replay__flush(self);
+		replay__record(self);
+	}
+
+	self->batch[self->batch_len++] = frame->cfd;
+}
+
+static int replay__open_output(struct replay* self)
+{
+	const struct co_replay_params* params = self->params;
+
+	if (!params->output)
+		return 0;
+
+	enum trace_format format = TRACE_FORMAT_RAW;
+	if (params->output_format
+	 && trace_format_from_string(&format, params->output_format) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	self->output = fopen(params->output, "w");
+	if (!self->output)
+		return -1;
+
+	if (trace_export_begin(&self->export, self->output, format, "can0") < 0) {
+		fclose(self->output);
+		self->output = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int co_replay_sock(struct sock* sock, const struct co_replay_params* params,
+		   struct co_replay_stats* stats)
+{
+	struct replay* self = calloc(1, sizeof(*self));
+	if (!self)
+		return -1;
+
+	memset(stats, 0, sizeof(*stats));
+
+	self->sock = sock;
+	self->params = params;
+	self->stats = stats;
+	self->objects = params->objects ? params->objects : REPLAY_NODE_OBJECTS;
+
+	int rc = -1;
+
+	if (replay__open_output(self) < 0)
+		goto done;
+
+	/* The frames are paced with ppoll(), so it should wake up on time */
+	prctl(PR_SET_TIMERSLACK, 1000UL);
+
+	rc = trace_read(params->path, NULL, replay__frame, self);
+
+	replay__flush(self);
+
+	if (self->is_started)
+		stats->duration = self->last_sent - self->wall_start;
+
+	replay__wait(self, replay__now() + params->linger * 1000ULL);
+
+	if (self->output && fclose(self->output) != 0)
+		rc = -1;
+
+	if (self->error)
+		rc = -1;
+
+done:
+	free(self);
+	return rc < 0 ? -1 : 0;
+}
+
+__attribute__((visibility("default")))
+int co_replay(enum sock_type type, const char* addr,
+	      const struct co_replay_params* params,
+	      struct co_replay_stats* stats)
+{
+	struct sock sock;
+	if (sock_open(&sock, type, addr, NULL) < 0)
+		return -1;
+
+	if (type == SOCK_TYPE_CAN) {
+		sock_enable_fd_frames(&sock);
+		sock_enable_timestamps(&sock);
+	}
+
+	int rc = co_replay_sock(&sock, params, stats);
+
+	sock_close(&sock);
+	return rc;
+}
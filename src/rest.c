@@ -17,7 +17,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdarg.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -29,13 +31,59 @@
 #include "http.h"
 #include "vector.h"
 #include "rest.h"
-#include "stream.h"
+#include "time-utils.h"
 
 #define REST_BACKLOG 16
+#define REST_WORK_PRIORITY 3
+#define REST_MAX_HEAD 512
+#define REST_MAX_IOV 16
+#define REST_READ_SIZE 4096
+
+/* Room for a request's allocations that comes with each client */
+#define REST_ARENA_SIZE 4096
+
+/* Content up to this size is given room as soon as its length is known */
+#define REST_MAX_CONTENT_RESERVE 65536
+
+/* Output that the socket did not take yet. Copies are kept right behind the
+ * struct.
+ */
+struct rest_output {
+	STAILQ_ENTRY(rest_output) links;
+	const char* data;
+	size_t size;
+	void* buffer; /* freed when sent */
+};
+
+/* The head of a reply is put together here before it is sent */
+struct rest_head {
+	char data[REST_MAX_HEAD];
+	size_t length;
+};
+
+/* A job that is waiting for one of the REST job slots */
+struct rest_job {
+	STAILQ_ENTRY(rest_job) links;
+	struct mloop_work* work;
+	uint64_t queued_time;
+};
 
 SLIST_HEAD(rest_service_list, rest_service);
+LIST_HEAD(rest_client_list, rest_client);
+STAILQ_HEAD(rest_job_queue, rest_job);
 
 static struct rest_service_list rest_service_list_;
+static struct rest_client_list rest_client_list_;
+static struct rest_job_queue rest_job_queue_ =
+	STAILQ_HEAD_INITIALIZER(rest_job_queue_);
+static struct mloop_idle* rest__idle = NULL;
+static struct mloop_socket* rest__server = NULL;
+
+static size_t rest__max_clients = 64;
+static size_t rest__max_jobs = 2;
+static size_t rest__max_waiting_jobs = 32;
+
+static void rest__process(struct rest_client* client);
 
 int rest__service_is_match(const struct rest_service* service,
 			   const struct http_req* req)
@@ -85,29 +133,28 @@ failure:
 
 int rest__read(struct vector* buffer, int fd)
 {
-	errno = 0;
-	char input[256];
-	ssize_t size = read(fd, &input, sizeof(input));
-	if (size == 0)
-		return -1;
+	char input[REST_READ_SIZE];
 
-	if (size < 0)
-		return (errno == EWOULDBLOCK || errno == EAGAIN) ? 0 : -1;
+	while (1) {
+		errno = 0;
+		ssize_t size = read(fd, &input, sizeof(input));
+		if (size == 0)
+			return -1;
 
-	if (vector_append(buffer, input, size) < 0)
-		return -1;
+		if (size < 0)
+			return (errno == EWOULDBLOCK || errno == EAGAIN) ? 0 : -1;
 
-	return rest__read(buffer, fd);
+		if (vector_append(buffer, input, size) < 0)
+			return -1;
+	}
 }
 
-int rest__read_head(struct vector* buffer, int fd)
+int rest__have_head(struct vector* buffer)
 {
-	int rc = rest__read(buffer, fd);
-	if (rc < 0)
+	if (vector_append(buffer, "", 1) < 0)
 		return -1;
 
-	vector_append(buffer, "", 1);
-	rc = !!strstr(buffer->data, "\r\n\r\n");
+	int rc = !!strstr(buffer->data, "\r\n\r\n");
 	buffer->index--;
 
 	return rc;
@@ -115,13 +162,15 @@ int rest__read_head(struct vector* buffer, int fd)
 
 static struct rest_client* rest_client_new()
 {
-	struct rest_client* self = malloc(sizeof(*self));
+	struct rest_client* self = malloc(sizeof(*self) + REST_ARENA_SIZE);
 	if (!self)
 		return NULL;
 
 	memset(self, 0, sizeof(*self));
 
 	self->ref = 1;
+	STAILQ_INIT(&self->output);
+	arena_init(&self->arena, self + 1, REST_ARENA_SIZE);
 
 	if (vector_init(&self->buffer, 256) < 0)
 		goto failure;
@@ -136,7 +185,9 @@ failure:
 void rest_client_free(struct rest_client* self)
 {
 	if (!self) return;
+	rest__drop_output(self);
 	vector_destroy(&self->buffer);
+	arena_destroy(&self->arena);
 	if (self->state > REST_CLIENT_START)
 		http_req_free(&self->req);
 	free(self);
@@ -156,70 +207,414 @@ int rest_client_unref(struct rest_client* self)
 	return ref;
 }
 
-static inline void rest__print_status_code(FILE* output, const char* status)
+static struct rest_stats rest__stats_;
+
+void rest_get_stats(struct rest_stats* dst)
+{
+	*dst = rest__stats_;
+}
+
+static inline unsigned int rest__bucket(uint64_t duration)
+{
+	unsigned int bucket = duration ? 63 - __builtin_clzll(duration) : 0;
+	return bucket < REST_STATS_N_BUCKETS ? bucket : REST_STATS_N_BUCKETS - 1;
+}
+
+static void rest__count_request(struct rest_client* client)
+{
+	if (!client->start_time)
+		return;
+
+	uint64_t duration = gettime_us(CLOCK_MONOTONIC) - client->start_time;
+	client->start_time = 0;
+
+	rest__stats_.n_requests++;
+	rest__stats_.latency_sum += duration;
+	rest__stats_.latency[rest__bucket(duration)]++;
+}
+
+void rest_set_limits(size_t max_clients, size_t max_jobs,
+		     size_t max_waiting_jobs)
+{
+	rest__max_clients = max_clients;
+	rest__max_jobs = max_jobs ? max_jobs : 1;
+	rest__max_waiting_jobs = max_waiting_jobs;
+}
+
+static int rest__start_job(struct mloop_work* work, uint64_t queued_time)
+{
+	mloop_work_set_priority(work, REST_WORK_PRIORITY);
+
+	if (mloop_work_start(work) < 0)
+		return -1;
+
+	uint64_t wait_time = gettime_us(CLOCK_MONOTONIC) - queued_time;
+	rest__stats_.job_wait_sum += wait_time;
+	rest__stats_.job_wait[rest__bucket(wait_time)]++;
+	rest__stats_.n_jobs_running++;
+
+	return 0;
+}
+
+int rest_work_start(struct mloop_work* work)
+{
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+
+	if (rest__stats_.n_jobs_running < rest__max_jobs)
+		return rest__start_job(work, now);
+
+	if (rest__stats_.n_jobs_waiting >= rest__max_waiting_jobs)
+		goto reject;
+
+	struct rest_job* job = malloc(sizeof(*job));
+	if (!job)
+		goto reject;
+
+	mloop_work_ref(work);
+	job->work = work;
+	job->queued_time = now;
+
+	STAILQ_INSERT_TAIL(&rest_job_queue_, job, links);
+	rest__stats_.n_jobs_waiting++;
+
+	return 0;
+
+reject:
+	rest__stats_.n_jobs_rejected++;
+	errno = EAGAIN;
+	return -1;
+}
+
+/* A job that could not be started when its turn came is dropped, and its
+ * context freed with it.
+ */
+void rest_work_done(void)
 {
-	fprintf(output, "HTTP/1.1 %s\r\n", status);
+	rest__stats_.n_jobs_running--;
+
+	while (!STAILQ_EMPTY(&rest_job_queue_)
+	    && rest__stats_.n_jobs_running < rest__max_jobs) {
+		struct rest_job* job = STAILQ_FIRST(&rest_job_queue_);
+		STAILQ_REMOVE_HEAD(&rest_job_queue_, links);
+		rest__stats_.n_jobs_waiting--;
+
+		rest__start_job(job->work, job->queued_time);
+
+		mloop_work_unref(job->work);
+		free(job);
+	}
 }
 
-static inline void rest__print_server(FILE* output)
+static void rest__printf(struct rest_head* head, const char* fmt, ...)
 {
-	fprintf(output, "Server: CANopen master REST service\r\n");
+	size_t space = sizeof(head->data) - head->length;
+
+	va_list ap;
+	va_start(ap, fmt);
+	int rc = vsnprintf(head->data + head->length, space, fmt, ap);
+	va_end(ap);
+
+	if (rc > 0)
+		head->length += (size_t)rc < space ? (size_t)rc : space - 1;
 }
 
-static inline void rest__print_content_type(FILE* output, const char* type)
+static inline void rest__print_status_code(struct rest_head* head,
+					   const char* status)
 {
-	fprintf(output, "Content-Type: %s\r\n", type);
+	rest__printf(head, "HTTP/1.1 %s\r\n", status);
 }
 
-static inline void rest__print_content_length(FILE* output, size_t length)
+static inline void rest__print_server(struct rest_head* head)
 {
-	fprintf(output, "Content-Length: %u\r\n", length);
+	rest__printf(head, "Server: CANopen master REST service\r\n");
 }
 
-static inline void rest__print_connection_type(FILE* output)
+static inline void rest__print_content_type(struct rest_head* head,
+					    const char* type)
 {
-	fprintf(output, "Connection: close\r\n");
+	rest__printf(head, "Content-Type: %s\r\n", type);
 }
 
-static inline void rest__print_allow_origin(FILE* output)
+static inline void rest__print_content_length(struct rest_head* head,
+					      size_t length)
 {
-	fprintf(output, "Access-Control-Allow-Origin: *\r\n");
+	rest__printf(head, "Content-Length: %zu\r\n", length);
 }
 
-static inline void rest__print_allow_methods(FILE* output)
+static inline void rest__print_allow_origin(struct rest_head* head)
 {
-	fprintf(output, "Access-Control-Allow-Methods: GET, PUT\r\n");
+	rest__printf(head, "Access-Control-Allow-Origin: *\r\n");
 }
 
-static inline void rest__print_chunked_transfer_encoding(FILE* output)
+static inline void rest__print_allow_methods(struct rest_head* head)
 {
-	fprintf(output, "Transfer-Encoding: chunked\r\n");
+	rest__printf(head, "Access-Control-Allow-Methods: GET, PUT\r\n");
 }
 
-void rest_reply_header(FILE* output, struct rest_reply_data* data)
+static inline void rest__print_chunked_transfer_encoding(struct rest_head* head)
 {
-	rest__print_status_code(output, data->status_code);
+	rest__printf(head, "Transfer-Encoding: chunked\r\n");
+}
 
-	rest__print_server(output);
-	rest__print_connection_type(output);
-	rest__print_content_type(output, data->content_type);
+static inline void rest__print_etag(struct rest_head* head, const char* etag)
+{
+	rest__printf(head, "ETag: %s\r\n", etag);
+}
+
+static void rest__print_header(struct rest_head* head,
+			       struct rest_reply_data* data)
+{
+	head->length = 0;
+
+	rest__print_status_code(head, data->status_code);
+
+	rest__print_server(head);
+	rest__print_content_type(head, data->content_type);
 
 	if (data->content_length >= 0)
-		rest__print_content_length(output, data->content_length);
+		rest__print_content_length(head, data->content_length);
 	else
-		rest__print_chunked_transfer_encoding(output);
+		rest__print_chunked_transfer_encoding(head);
+
+	if (data->etag)
+		rest__print_etag(head, data->etag);
 
-	rest__print_allow_origin(output);
-	rest__print_allow_methods(output);
-	fprintf(output, "\r\n");
-	fflush(output);
+	rest__print_allow_origin(head);
+	rest__print_allow_methods(head);
+	rest__printf(head, "\r\n");
 }
 
-void rest_reply(FILE* output, struct rest_reply_data* data)
+/* Socket events are only watched for input while there is no output waiting,
+ * so that clients that do not read their replies cannot make more.
+ */
+static void rest__set_event(struct rest_client* client)
 {
-	rest_reply_header(output, data);
-	fwrite(data->content, 1, data->content_length, output);
-	fflush(output);
+	mloop_socket_set_event(client->socket, STAILQ_EMPTY(&client->output)
+			       ? MLOOP_SOCKET_EVENT_IN | MLOOP_SOCKET_EVENT_PRI
+			       : MLOOP_SOCKET_EVENT_OUT);
+}
+
+static ssize_t rest__send(int fd, struct iovec* iov, int iovcnt)
+{
+	ssize_t rc = net_send_iov(fd, iov, iovcnt);
+	if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+
+	return rc;
+}
+
+static void rest__free_output(struct rest_output* output)
+{
+	free(output->buffer);
+	free(output);
+}
+
+void rest__drop_output(struct rest_client* client)
+{
+	while (!STAILQ_EMPTY(&client->output)) {
+		struct rest_output* output = STAILQ_FIRST(&client->output);
+		STAILQ_REMOVE_HEAD(&client->output, links);
+		rest__free_output(output);
+	}
+
+	client->output_length = 0;
+}
+
+/* A connection whose reply cannot be sent is of no more use. Shutting it down
+ * makes the main loop report a hangup, and the client is freed from there.
+ */
+static void rest__fail_output(struct rest_client* client)
+{
+	rest__drop_output(client);
+	shutdown(mloop_socket_get_fd(client->socket), SHUT_RDWR);
+	rest__set_event(client);
+}
+
+static int rest__queue(struct rest_client* client, const char* data,
+		       size_t size, enum rest_content_ownership ownership,
+		       void* buffer)
+{
+	int is_copy = ownership == REST_CONTENT_COPY;
+
+	struct rest_output* output =
+		malloc(sizeof(*output) + (is_copy ? size : 0));
+	if (!output)
+		return -1;
+
+	if (is_copy) {
+		memcpy(output + 1, data, size);
+		data = (const char*)(output + 1);
+	}
+
+	output->data = data;
+	output->size = size;
+	output->buffer = ownership == REST_CONTENT_GIVEN ? buffer : NULL;
+
+	STAILQ_INSERT_TAIL(&client->output, output, links);
+	client->output_length += size;
+
+	return 0;
+}
+
+/* Whatever comes after output that is already waiting must wait too. The
+ * ownership applies to the last element of iov.
+ */
+void rest__write(struct rest_client* client, struct iovec* iov, int iovcnt,
+		 enum rest_content_ownership ownership)
+{
+	void* given = ownership == REST_CONTENT_GIVEN
+		    ? iov[iovcnt - 1].iov_base : NULL;
+
+	if (!client->socket) {
+		free(given);
+		return;
+	}
+
+	int was_empty = STAILQ_EMPTY(&client->output);
+	size_t written = 0;
+
+	if (was_empty) {
+		ssize_t rc = rest__send(mloop_socket_get_fd(client->socket),
+					iov, iovcnt);
+		if (rc < 0) {
+			free(given);
+			rest__fail_output(client);
+			return;
+		}
+
+		written = rc;
+	}
+
+	for (int i = 0; i < iovcnt; ++i) {
+		if (written >= iov[i].iov_len) {
+			written -= iov[i].iov_len;
+			continue;
+		}
+
+		int is_last = i == iovcnt - 1;
+
+		if (rest__queue(client, (char*)iov[i].iov_base + written,
+				iov[i].iov_len - written,
+				is_last ? ownership : REST_CONTENT_COPY,
+				given) < 0) {
+			free(given);
+			rest__fail_output(client);
+			return;
+		}
+
+		if (is_last)
+			given = NULL;
+
+		written = 0;
+	}
+
+	free(given);
+
+	if (was_empty && !STAILQ_EMPTY(&client->output))
+		rest__set_event(client);
+}
+
+/* Returns 1 if everything that was handed to the socket went out and there is
+ * more waiting, so that it is worth trying again.
+ */
+static int rest__flush_once(struct rest_client* client)
+{
+	struct iovec iov[REST_MAX_IOV];
+	int iovcnt = 0;
+	size_t size = 0;
+
+	struct rest_output* output;
+	STAILQ_FOREACH(output, &client->output, links) {
+		if (iovcnt == REST_MAX_IOV)
+			break;
+
+		iov[iovcnt].iov_base = (void*)output->data;
+		iov[iovcnt].iov_len = output->size;
+		size += output->size;
+		++iovcnt;
+	}
+
+	if (iovcnt == 0)
+		return 0;
+
+	ssize_t rc = rest__send(mloop_socket_get_fd(client->socket), iov,
+				iovcnt);
+	if (rc < 0) {
+		rest__fail_output(client);
+		return 0;
+	}
+
+	size_t written = rc;
+	client->output_length -= written;
+
+	while (written > 0) {
+		output = STAILQ_FIRST(&client->output);
+
+		if (written < output->size) {
+			output->data += written;
+			output->size -= written;
+			break;
+		}
+
+		written -= output->size;
+		STAILQ_REMOVE_HEAD(&client->output, links);
+		rest__free_output(output);
+	}
+
+	if (STAILQ_EMPTY(&client->output)) {
+		if (client->is_closing)
+			mloop_socket_stop(client->socket);
+		else
+			rest__set_event(client);
+		return 0;
+	}
+
+	return (size_t)rc == size;
+}
+
+/* The client socket may be edge-triggered, so there is no new event to wait
+ * for until the socket has taken all it can.
+ */
+void rest__flush(struct rest_client* client)
+{
+	while (rest__flush_once(client))
+		;
+}
+
+void rest_reply_header(struct rest_client* client,
+		       struct rest_reply_data* data)
+{
+	struct rest_head head;
+	rest__print_header(&head, data);
+
+	struct iovec iov = { .iov_base = head.data, .iov_len = head.length };
+	rest__write(client, &iov, 1, REST_CONTENT_COPY);
+}
+
+/* The header and the content go out together, in a single system call */
+void rest_reply(struct rest_client* client, struct rest_reply_data* data)
+{
+	struct rest_head head;
+	rest__print_header(&head, data);
+
+	struct iovec iov[2] = {
+		{ .iov_base = head.data, .iov_len = head.length },
+		{ .iov_base = (void*)data->content,
+		  .iov_len = data->content_length },
+	};
+
+	rest__write(client, iov, 2, data->ownership);
+}
+
+void rest_write(struct rest_client* client, const void* data, size_t size)
+{
+	struct iovec iov = { .iov_base = (void*)data, .iov_len = size };
+	rest__write(client, &iov, 1, REST_CONTENT_COPY);
+}
+
+int rest_is_accepted(const struct http_req* req, const char* content_type)
+{
+	return req->accept && strcasestr(req->accept, content_type);
 }
 
 void rest__not_found(struct rest_client* client)
@@ -233,7 +628,7 @@ void rest__not_found(struct rest_client* client)
 		.content_length = strlen(content),
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
 	client->state = REST_CLIENT_DONE;
 }
@@ -249,7 +644,7 @@ void rest__print_index(struct rest_client* client)
 		.content_length = strlen(content),
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
 	client->state = REST_CLIENT_DONE;
 }
@@ -257,22 +652,23 @@ void rest__print_index(struct rest_client* client)
 void rest__print_options(struct rest_client* client,
 			 const struct rest_service* service)
 {
-	FILE* output = client->output;
+	struct rest_head head = { .length = 0 };
 	enum http_method methods = service ? service->method : 0xff;
 
-	rest__print_status_code(client->output, "200 OK");
-	rest__print_server(output);
-	rest__print_connection_type(output);
-	rest__print_content_length(output, 0);
-	rest__print_allow_origin(output);
-	rest__print_allow_methods(output);
+	rest__print_status_code(&head, "200 OK");
+	rest__print_server(&head);
+	rest__print_content_length(&head, 0);
+	rest__print_allow_origin(&head);
+	rest__print_allow_methods(&head);
+
+	rest__printf(&head, "Allow:%s%s OPTIONS\r\n",
+		     methods & HTTP_GET ? " GET," : "",
+		     methods & HTTP_PUT ? " PUT," : "");
 
-	fprintf(output, "Allow:%s%s OPTIONS\r\n",
-		 methods & HTTP_GET ? " GET," : "",
-		 methods & HTTP_PUT ? " PUT," : "");
+	rest__printf(&head, "\r\n");
 
-	fprintf(client->output, "\r\n");
-	fflush(client->output);
+	struct iovec iov = { .iov_base = head.data, .iov_len = head.length };
+	rest__write(client, &iov, 1, REST_CONTENT_COPY);
 
 	client->state = REST_CLIENT_DONE;
 }
@@ -287,12 +683,6 @@ static inline int rest__have_full_content(struct rest_client* client)
 
 void rest__process_content(struct rest_client* client)
 {
-	size_t full_length = client->req.header_length
-			   + client->req.content_length;
-
-	if (!rest__have_full_content(client))
-		return;
-
 	const struct rest_service* service = rest__find_service(&client->req);
 	if (!service) {
 		rest__not_found(client);
@@ -344,57 +734,200 @@ void rest__handle_options(struct rest_client* client)
 	rest__print_options(client, service);
 }
 
-void rest__handle_header(int fd, struct rest_client* client,
-			 struct mloop_socket* socket)
+/* The buffer grows once instead of with every read. The parsed request
+ * points into it, so it is rebased if the buffer moves.
+ */
+static int rest__reserve_content(struct rest_client* client)
 {
-	int rc = rest__read_head(&client->buffer, fd);
-	if (rc < 0)
-		mloop_socket_stop(socket);
+	size_t content_length = client->req.content_length;
+	if (content_length > REST_MAX_CONTENT_RESERVE)
+		return 0;
+
+	void* base = client->buffer.data;
+
+	if (vector_reserve_exact(&client->buffer, client->req.header_length
+							+ content_length) < 0)
+		return -1;
+
+	if (client->buffer.data != base)
+		http_req_rebase(&client->req, base, client->buffer.data);
 
+	return 0;
+}
+
+int rest__handle_header(struct rest_client* client)
+{
+	int rc = rest__have_head(&client->buffer);
 	if (rc <= 0)
-		return;
+		return rc;
 
-	if (http_req_parse(&client->req, client->buffer.data) < 0)
-		mloop_socket_stop(socket);
+	if (http_req_parse(&client->req, client->buffer.data) < 0) {
+		http_req_free(&client->req);
+		memset(&client->req, 0, sizeof(client->req));
+		return -1;
+	}
+
+	client->start_time = gettime_us(CLOCK_MONOTONIC);
 
 	switch (client->req.method) {
 	case HTTP_GET:
-		rest__handle_get(client);
-		break;
+		if (client->req.content_length == 0) {
+			rest__handle_get(client);
+			break;
+		}
+		/* fall through */
 	case HTTP_PUT:
+		if (rest__reserve_content(client) < 0) {
+			http_req_free(&client->req);
+			memset(&client->req, 0, sizeof(client->req));
+			return -1;
+		}
+
 		client->state = REST_CLIENT_CONTENT;
-		rest__process_content(client);
 		break;
 	case HTTP_OPTIONS:
 		rest__handle_options(client);
 		break;
 	}
+
+	return 1;
 }
 
-void rest__handle_content(int fd, struct rest_client* client,
-			  struct mloop_socket* socket)
+static inline int rest__is_keep_alive(const struct rest_client* client)
 {
-	int rc = rest__read(&client->buffer, fd);
-	if (rc < 0) {
-		mloop_socket_stop(socket);
-		return;
+	return !client->req.is_connection_close;
+}
+
+/* Drop the request that was just serviced from the front of the buffer so that
+ * a pipelined request behind it, if any, can be parsed in its place.
+ */
+void rest__next_request(struct rest_client* client)
+{
+	struct vector* buffer = &client->buffer;
+	size_t length = client->req.header_length + client->req.content_length;
+
+	if (length > buffer->index)
+		length = buffer->index;
+
+	memmove(buffer->data, (char*)buffer->data + length,
+		buffer->index - length);
+	buffer->index -= length;
+
+	http_req_free(&client->req);
+	memset(&client->req, 0, sizeof(client->req));
+	arena_reset(&client->arena);
+
+	client->state = REST_CLIENT_START;
+}
+
+void rest_upgrade(struct rest_client* client, rest_input_fn fn,
+		  void* context)
+{
+	rest__count_request(client);
+	rest__next_request(client);
+
+	client->input_fn = fn;
+	client->input_context = context;
+	client->state = REST_CLIENT_UPGRADED;
+}
+
+void rest_consume(struct rest_client* client, size_t size)
+{
+	struct vector* buffer = &client->buffer;
+
+	if (size > buffer->index)
+		size = buffer->index;
+
+	memmove(buffer->data, (char*)buffer->data + size,
+		buffer->index - size);
+	buffer->index -= size;
+}
+
+void rest_close(struct rest_client* client)
+{
+	client->is_closing = 1;
+
+	if (client->socket && STAILQ_EMPTY(&client->output))
+		mloop_socket_stop(client->socket);
+}
+
+/* Service as many buffered requests as possible. The socket may be stopped,
+ * and the client freed with it, so the client must not be touched afterwards.
+ */
+static void rest__process(struct rest_client* client)
+{
+	while (1) {
+		switch (client->state) {
+		case REST_CLIENT_START:
+			switch (rest__handle_header(client)) {
+			case -1: mloop_socket_stop(client->socket); return;
+			case 0: return;
+			}
+			break;
+		case REST_CLIENT_CONTENT:
+			if (!rest__have_full_content(client))
+				return;
+
+			rest__process_content(client);
+			break;
+		case REST_CLIENT_SERVICING:
+		case REST_CLIENT_DISCONNECTED:
+			return;
+		case REST_CLIENT_UPGRADED:
+			if (client->is_closing)
+				client->buffer.index = 0;
+			else if (client->buffer.index > 0)
+				client->input_fn(client);
+			return;
+		case REST_CLIENT_DONE:
+			rest__count_request(client);
+
+			if (!rest__is_keep_alive(client)
+			 || !STAILQ_EMPTY(&client->output))
+				return;
+
+			rest__next_request(client);
+			break;
+		default:
+			abort();
+		}
 	}
+}
 
-	rest__process_content(client);
+static inline int rest__is_ready(const struct rest_client* client)
+{
+	return client->state == REST_CLIENT_DONE && rest__is_keep_alive(client)
+	    && STAILQ_EMPTY(&client->output);
 }
 
-void rest__handle_junk(int fd, struct rest_client* client,
-		       struct mloop_socket* socket)
+static struct rest_client* rest__find_ready_client(void)
 {
-	char junk[256];
-	ssize_t size;
+	struct rest_client* client;
 
-	do {
-		size = read(fd, &junk, sizeof(junk));
-	} while (size > 0);
+	LIST_FOREACH(client, &rest_client_list_, links)
+		if (rest__is_ready(client))
+			return client;
 
-	if (size == 0)
-		mloop_socket_stop(socket);
+	return NULL;
+}
+
+/* Services that reply asynchronously only set REST_CLIENT_DONE, so requests
+ * that were pipelined behind theirs are picked up here, as are those behind
+ * replies that had to wait for the socket.
+ */
+static int rest__have_ready_client(struct mloop_idle* idle)
+{
+	(void)idle;
+	return rest__find_ready_client() != NULL;
+}
+
+static void rest__process_ready(struct mloop_idle* idle)
+{
+	(void)idle;
+
+	struct rest_client* client;
+	while ((client = rest__find_ready_client()))
+		rest__process(client);
 }
 
 static void rest__on_client_data(struct mloop_socket* socket)
@@ -402,32 +935,71 @@ static void rest__on_client_data(struct mloop_socket* socket)
 	struct rest_client* client = mloop_socket_get_context(socket);
 	int fd = mloop_socket_get_fd(socket);
 
-	switch (client->state) {
-	case REST_CLIENT_START:
-		rest__handle_header(fd, client, socket);
-		break;
-	case REST_CLIENT_CONTENT:
-		rest__handle_content(fd, client, socket);
-		break;
-	case REST_CLIENT_SERVICING:
-		rest__handle_junk(fd, client, socket);
-		break;
-	case REST_CLIENT_DONE:
+	if (mloop_socket_get_event(socket) & MLOOP_SOCKET_EVENT_OUT) {
+		rest__flush(client);
+		return;
+	}
+
+	if (client->state == REST_CLIENT_DONE && !rest__is_keep_alive(client)) {
 		mloop_socket_stop(socket);
-		break;
-	default:
-		abort();
+		return;
 	}
+
+	/* The parsed request points into the buffer, which may be moved by
+	 * input that is pipelined behind it.
+	 */
+	void* base = client->buffer.data;
+
+	int rc = rest__read(&client->buffer, fd);
+
+	if (client->state > REST_CLIENT_START && client->buffer.data != base)
+		http_req_rebase(&client->req, base, client->buffer.data);
+
+	if (rc < 0) {
+		mloop_socket_stop(socket);
+		return;
+	}
+
+	rest__process(client);
 }
 
 static void rest__on_socket_free(void* ptr)
 {
 	struct rest_client* client = ptr;
+	LIST_REMOVE(client, links);
+	rest__stats_.n_clients--;
+	client->socket = NULL;
+
+	if (client->state == REST_CLIENT_DONE)
+		rest__count_request(client);
+
 	client->state = REST_CLIENT_DISCONNECTED;
-	fclose(client->output);
+	rest__drop_output(client);
 	rest_client_unref(client);
 }
 
+/* The reply is small enough to fit in the socket buffer of a new connection,
+ * so it is sent without waiting.
+ */
+static void rest__reject_connection(int fd)
+{
+	static const char reply[] =
+		"HTTP/1.1 503 Service Unavailable\r\n"
+		"Server: CANopen master REST service\r\n"
+		"Content-Type: text/plain\r\n"
+		"Content-Length: 18\r\n"
+		"Retry-After: 1\r\n"
+		"Connection: close\r\n"
+		"\r\n"
+		"Too many clients\r\n";
+
+	ssize_t rc = send(fd, reply, sizeof(reply) - 1, MSG_NOSIGNAL);
+	(void)rc;
+
+	rest__stats_.n_clients_rejected++;
+	close(fd);
+}
+
 static void rest__on_connection(struct mloop_socket* socket)
 {
 	int sfd = mloop_socket_get_fd(socket);
@@ -439,6 +1011,11 @@ static void rest__on_connection(struct mloop_socket* socket)
 	net_dont_block(cfd);
 	net_dont_delay(cfd);
 
+	if (rest__stats_.n_clients >= rest__max_clients) {
+		rest__reject_connection(cfd);
+		return;
+	}
+
 	struct mloop_socket* client = mloop_socket_new(mloop_default());
 	if (!client)
 		goto socket_failure;
@@ -447,26 +1024,21 @@ static void rest__on_connection(struct mloop_socket* socket)
 	if (!state)
 		goto state_failure;
 
-	int nfd = dup(cfd);
-	if (nfd < 0)
-		goto nfd_failure;
-
-	state->output = stream_open(nfd, "w");
-	if (!state->output)
-		goto fdopen_failure;
+	state->socket = client;
+	LIST_INSERT_HEAD(&rest_client_list_, state, links);
+	rest__stats_.n_clients++;
 
 	mloop_socket_set_fd(client, cfd);
 	mloop_socket_set_callback(client, rest__on_client_data);
+#ifdef mloop_socket_set_edge_triggered
+	mloop_socket_set_edge_triggered(client, 1);
+#endif
 	mloop_socket_set_context(client, state, rest__on_socket_free);
 	mloop_socket_start(client);
 
 	mloop_socket_unref(client);
 	return;
 
-fdopen_failure:
-	close(nfd);
-nfd_failure:
-	free(state);
 state_failure:
 	mloop_socket_unref(client);
 socket_failure:
@@ -493,14 +1065,47 @@ void rest__init_service_list(void)
 	SLIST_INIT(&rest_service_list_);
 }
 
+static int rest__init_idle(struct mloop* mloop)
+{
+	LIST_INIT(&rest_client_list_);
+
+	rest__idle = mloop_idle_new(mloop);
+	if (!rest__idle)
+		return -1;
+
+	mloop_idle_set_cond_fn(rest__idle, rest__have_ready_client);
+	mloop_idle_set_idle_fn(rest__idle, rest__process_ready);
+
+	if (mloop_idle_start(rest__idle) < 0) {
+		mloop_idle_unref(rest__idle);
+		rest__idle = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
 int rest_init(int port)
+{
+	int lfd = rest__open_server(port);
+	if (lfd < 0)
+		return -1;
+
+	if (rest_init_fd(lfd) < 0) {
+		close(lfd);
+		return -1;
+	}
+
+	return 0;
+}
+
+int rest_init_fd(int lfd)
 {
 	struct mloop* mloop = mloop_default();
 
 	rest__init_service_list();
 
-	int lfd = rest__open_server(port);
-	if (lfd < 0)
+	if (rest__init_idle(mloop) < 0)
 		return -1;
 
 	struct mloop_socket* socket = mloop_socket_new(mloop);
@@ -512,18 +1117,53 @@ int rest_init(int port)
 	if (mloop_socket_start(socket) < 0)
 		goto start_failure;
 
-	mloop_socket_unref(socket);
+	rest__server = socket;
 	return 0;
 
 start_failure:
+	mloop_socket_set_fd(socket, -1);
 	mloop_socket_unref(socket);
 socket_failure:
-	close(lfd);
+	mloop_idle_stop(rest__idle);
+	mloop_idle_unref(rest__idle);
+	rest__idle = NULL;
 	return -1;
 }
 
+int rest_get_server_fd(void)
+{
+	return rest__server ? mloop_socket_get_fd(rest__server) : -1;
+}
+
+void rest_stop_server(void)
+{
+	if (rest__server)
+		mloop_socket_stop(rest__server);
+}
+
 void rest_cleanup()
 {
+	if (rest__server) {
+		mloop_socket_stop(rest__server);
+		mloop_socket_unref(rest__server);
+		rest__server = NULL;
+	}
+
+	if (rest__idle) {
+		mloop_idle_stop(rest__idle);
+		mloop_idle_unref(rest__idle);
+		rest__idle = NULL;
+	}
+
+	while (!STAILQ_EMPTY(&rest_job_queue_)) {
+		struct rest_job* job = STAILQ_FIRST(&rest_job_queue_);
+		STAILQ_REMOVE_HEAD(&rest_job_queue_, links);
+		mloop_work_unref(job->work);
+		free(job);
+	}
+
+	rest__stats_.n_jobs_waiting = 0;
+
 	while (!SLIST_EMPTY(&rest_service_list_)) {
 		struct rest_service* service = SLIST_FIRST(&rest_service_list_);
 		SLIST_REMOVE_HEAD(&rest_service_list_, links);
@@ -0,0 +1,487 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "canopen.h"
+#include "canopen/eds.h"
+#include "canopen/master.h"
+#include "canopen/sdo.h"
+#include "canopen/sdo_batch.h"
+#include "canopen/sdo_future.h"
+#include "canopen/sdo_req.h"
+#include "canopen/types.h"
+#include "conversions.h"
+#include "cbor.h"
+#include "string-utils.h"
+#include "rest.h"
+#include "sdo-bulk-rest.h"
+
+#define SDO_BULK_REST_MAX_ITEMS 1024
+
+struct sdo_bulk_rest_item {
+	int nodeid, index, subindex;
+	enum canopen_type type;
+	enum sdo_req_type req_type;
+
+	/* Set for items that could not be queued */
+	const char* error;
+
+	/* The node's future and the item's position in its batch */
+	size_t future;
+	size_t pos;
+};
+
+struct sdo_bulk_rest_context {
+	struct rest_client* client;
+	struct sdo_bulk_rest_item* items;
+	size_t n_items;
+};
+
+static void sdo_bulk_rest__reply(struct rest_client* client,
+				 const char* status_code, const char* type,
+				 const char* message, size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void sdo_bulk_rest__error(struct rest_client* client,
+				 const char* status_code, const char* message)
+{
+	sdo_bulk_rest__reply(client, status_code, "text/plain", message,
+			     strlen(message));
+}
+
+static void sdo_bulk_rest__context_free(void* ptr)
+{
+	struct sdo_bulk_rest_context* context = ptr;
+
+	rest_client_unref(context->client);
+	free(context->items);
+	free(context);
+}
+
+static enum canopen_type
+sdo_bulk_rest__eds_type(const struct sdo_bulk_rest_item* item)
+{
+	const struct canopen_eds* eds = co_master_find_eds(item->nodeid);
+	if (!eds)
+		return CANOPEN_UNKNOWN;
+
+	const struct eds_obj* obj = eds_obj_find(eds, item->index,
+						 item->subindex);
+	return obj ? obj->type : CANOPEN_UNKNOWN;
+}
+
+/* <nodeid> <index> <subindex> [<type>] [= <value>]
+ *
+ * The index is in hex and the rest in decimal, as in the URLs of single
+ * objects. Items with a value are downloads and the others are uploads.
+ */
+static int sdo_bulk_rest__parse_item(struct sdo_bulk_rest_item* item,
+				     char** value, char* line)
+{
+	char type[32] = "";
+	int end = 0;
+
+	memset(item, 0, sizeof(*item));
+
+	*value = strchr(line, '=');
+	if (*value) {
+		**value = '\0';
+		*value = string_trim(*value + 1);
+	}
+
+	int n = sscanf(line, "%d %x %d %n%31s %n", &item->nodeid, &item->index,
+		       &item->subindex, &end, type, &end);
+	if (n < 3 || line[end] != '\0')
+		return -1;
+
+	if (item->nodeid < CANOPEN_NODEID_MIN
+	 || item->nodeid > CANOPEN_NODEID_MAX
+	 || item->index < 0x1000 || item->index > 0xffff
+	 || item->subindex < 0 || item->subindex > 0xff)
+		return -1;
+
+	item->req_type = *value ? SDO_REQ_DOWNLOAD : SDO_REQ_UPLOAD;
+	item->type = type[0] ? canopen_type_from_string(type)
+			     : sdo_bulk_rest__eds_type(item);
+
+	if (item->type == CANOPEN_UNKNOWN)
+		item->error = "Unknown type";
+
+	return 0;
+}
+
+static int sdo_bulk_rest__add(struct sdo_batch* batch,
+			      struct sdo_bulk_rest_item* item,
+			      const char* value)
+{
+	item->pos = batch->n_items;
+
+	if (item->req_type == SDO_REQ_UPLOAD)
+		return sdo_batch_add_upload(batch, item->index, item->subindex);
+
+	struct canopen_data data = { 0 };
+	if (canopen_data_fromstring(&data, item->type, value) < 0) {
+		item->error = "Data conversion failed";
+		return 0;
+	}
+
+	return sdo_batch_add_download(batch, item->index, item->subindex,
+				      data.data, data.size);
+}
+
+static ssize_t sdo_bulk_rest__parse(struct sdo_bulk_rest_context* context,
+				    struct sdo_batch** batches, char* input)
+{
+	char* save = NULL;
+
+	for (char* line = strtok_r(input, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
+		line = string_trim(line);
+		if (*line == '\0')
+			continue;
+
+		if (context->n_items >= SDO_BULK_REST_MAX_ITEMS)
+			return -1;
+
+		struct sdo_bulk_rest_item* item =
+			&context->items[context->n_items];
+
+		char* value;
+		if (sdo_bulk_rest__parse_item(item, &value, line) < 0)
+			return -1;
+
+		++context->n_items;
+
+		if (item->error)
+			continue;
+
+		struct sdo_batch** batch = &batches[item->nodeid];
+		if (!*batch) {
+			*batch = sdo_batch_new(SDO_REQ_PRIO_BACKGROUND, 0);
+			if (!*batch)
+				return -1;
+		}
+
+		if (sdo_bulk_rest__add(*batch, item, value) < 0)
+			return -1;
+	}
+
+	return context->n_items;
+}
+
+static void sdo_bulk_rest__print_string(struct arena_text* out, const char* str)
+{
+	arena_append(out, "\"", 1);
+
+	for (; *str; ++str)
+		if (*str == '"' || *str == '\\')
+			arena_printf(out, "\\%c", *str);
+		else if (isprint((unsigned char)*str))
+			arena_append(out, str, 1);
+		else
+			arena_printf(out, "\\u%04x", (unsigned char)*str);
+
+	arena_append(out, "\"", 1);
+}
+
+static void sdo_bulk_rest__print_item(struct arena_text* out,
+				      const struct sdo_bulk_rest_item* item,
+				      const struct sdo_batch_item* result)
+{
+	arena_printf(out,
+		     " { \"node\": %d, \"index\": \"%#x\", \"subindex\": %d",
+		     item->nodeid, item->index, item->subindex);
+
+	if (item->error) {
+		arena_printf(out, ", \"error\": ");
+		sdo_bulk_rest__print_string(out, item->error);
+	} else if (!result || result->status != SDO_REQ_OK) {
+		enum sdo_abort_code code = result ? result->abort_code : 0;
+		const char* error = result && code ? sdo_strerror(code)
+						   : "Cancelled";
+
+		arena_printf(out, ", \"abort-code\": \"%#x\", \"error\": ",
+			     code);
+		sdo_bulk_rest__print_string(out, error);
+	} else if (item->req_type == SDO_REQ_UPLOAD) {
+		struct canopen_data data = {
+			.type = item->type,
+			.data = result->data.data,
+			.size = result->data.index,
+			.is_size_unknown = !result->is_size_indicated
+		};
+
+		char buffer[256];
+		const char* str = canopen_data_tostring(buffer, sizeof(buffer),
+							&data);
+
+		arena_printf(out, ", \"value\": ");
+		if (str)
+			sdo_bulk_rest__print_string(out, str);
+		else
+			arena_printf(out, "null");
+	}
+
+	arena_printf(out, " }");
+}
+
+static void sdo_bulk_rest__put_item(struct cbor* out,
+				    const struct sdo_bulk_rest_item* item,
+				    const struct sdo_batch_item* result)
+{
+	cbor_begin_map(out);
+
+	cbor_put_string(out, "node");
+	cbor_put_uint(out, item->nodeid);
+	cbor_put_string(out, "index");
+	cbor_put_uint(out, item->index);
+	cbor_put_string(out, "subindex");
+	cbor_put_uint(out, item->subindex);
+
+	if (item->error) {
+		cbor_put_string(out, "error");
+		cbor_put_string(out, item->error);
+	} else if (!result || result->status != SDO_REQ_OK) {
+		enum sdo_abort_code code = result ? result->abort_code : 0;
+
+		cbor_put_string(out, "abort-code");
+		cbor_put_uint(out, code);
+		cbor_put_string(out, "error");
+		cbor_put_string(out, result && code ? sdo_strerror(code)
+						   : "Cancelled");
+	} else if (item->req_type == SDO_REQ_UPLOAD) {
+		struct canopen_data data = {
+			.type = item->type,
+			.data = result->data.data,
+			.size = result->data.index,
+			.is_size_unknown = !result->is_size_indicated
+		};
+
+		cbor_put_string(out, "value");
+		if (canopen_data_tocbor(out, &data) < 0)
+			cbor_put_null(out);
+	}
+
+	cbor_put_break(out);
+}
+
+static const struct sdo_batch_item*
+sdo_bulk_rest__get_result(const struct sdo_future* all,
+			  const struct sdo_bulk_rest_item* item)
+{
+	if (item->error)
+		return NULL;
+
+	const struct sdo_future* future = sdo_future_get_child(all, item->future);
+	if (!future)
+		return NULL;
+
+	return sdo_batch_get_item(sdo_future_get_batch(future), item->pos);
+}
+
+static void sdo_bulk_rest__send_cbor(struct sdo_bulk_rest_context* context,
+				     const struct sdo_future* future)
+{
+	struct rest_client* client = context->client;
+	struct cbor out;
+
+	if (cbor_init(&out, 16 + 64 * context->n_items) < 0)
+		goto failure;
+
+	cbor_put_array(&out, context->n_items);
+
+	for (size_t i = 0; i < context->n_items; ++i) {
+		const struct sdo_bulk_rest_item* item = &context->items[i];
+
+		sdo_bulk_rest__put_item(&out, item,
+				sdo_bulk_rest__get_result(future, item));
+	}
+
+	if (out.is_bad)
+		goto failure;
+
+	sdo_bulk_rest__reply(client, "200 OK", CBOR_CONTENT_TYPE,
+			     out.vector.data, out.vector.index);
+	cbor_destroy(&out);
+	return;
+
+failure:
+	cbor_destroy(&out);
+	sdo_bulk_rest__error(client, "500 Internal Server Error",
+			     "Out of memory\r\n");
+}
+
+static void sdo_bulk_rest__on_done(struct sdo_future* future)
+{
+	struct sdo_bulk_rest_context* context = sdo_future_get_context(future);
+	struct rest_client* client = context->client;
+
+	if (client->state == REST_CLIENT_DISCONNECTED)
+		return;
+
+	if (rest_is_accepted(&client->req, CBOR_CONTENT_TYPE)) {
+		sdo_bulk_rest__send_cbor(context, future);
+		return;
+	}
+
+	struct arena_text text;
+	arena_text_init(&text, &client->arena);
+	struct arena_text* out = &text;
+
+	arena_printf(out, "[\n");
+
+	for (size_t i = 0; i < context->n_items; ++i) {
+		const struct sdo_bulk_rest_item* item = &context->items[i];
+
+		sdo_bulk_rest__print_item(out, item,
+				sdo_bulk_rest__get_result(future, item));
+		arena_printf(out, "%s\n", i + 1 < context->n_items ? "," : "");
+	}
+
+	arena_printf(out, "]\n");
+
+	if (out->is_bad) {
+		sdo_bulk_rest__error(client, "500 Internal Server Error",
+				     "Out of memory\r\n");
+		return;
+	}
+
+	sdo_bulk_rest__reply(client, "200 OK", "application/json", out->data,
+			     out->length);
+}
+
+/* Each node's items go to its queue as one batch, and all the batches are
+ * started before any of them is waited for.
+ */
+static int sdo_bulk_rest__start(struct sdo_bulk_rest_context* context,
+				struct sdo_batch** batches)
+{
+	struct sdo_future* futures[CANOPEN_NODEID_MAX + 1];
+	size_t index[CANOPEN_NODEID_MAX + 1];
+	size_t n_futures = 0;
+
+	for (int nodeid = 0; nodeid <= CANOPEN_NODEID_MAX; ++nodeid) {
+		struct sdo_batch* batch = batches[nodeid];
+		if (!batch)
+			continue;
+
+		struct sdo_future* future = NULL;
+		if (batch->n_items > 0)
+			future = sdo_future_start(batch,
+						  sdo_req_queue_get(nodeid));
+
+		index[nodeid] = n_futures;
+
+		if (future)
+			futures[n_futures++] = future;
+		else
+			index[nodeid] = (size_t)-1;
+	}
+
+	for (size_t i = 0; i < context->n_items; ++i) {
+		struct sdo_bulk_rest_item* item = &context->items[i];
+		if (item->error)
+			continue;
+
+		item->future = index[item->nodeid];
+		if (item->future == (size_t)-1)
+			item->error = "Failed to start sdo request";
+	}
+
+	struct sdo_future* all = sdo_future_when_all(futures, n_futures);
+
+	for (size_t i = 0; i < n_futures; ++i)
+		sdo_future_unref(futures[i]);
+
+	if (!all)
+		return -1;
+
+	sdo_future_then(all, sdo_bulk_rest__on_done, context,
+			sdo_bulk_rest__context_free);
+	sdo_future_unref(all);
+
+	return 0;
+}
+
+void sdo_bulk_rest_service(struct rest_client* client, const void* content)
+{
+	size_t length = client->req.content_length;
+
+	if (!content || length == 0) {
+		sdo_bulk_rest__error(client, "400 Bad Request",
+				     "No objects given\r\n");
+		return;
+	}
+
+	struct sdo_batch* batches[CANOPEN_NODEID_MAX + 1] = { 0 };
+
+	struct sdo_bulk_rest_context* context = calloc(1, sizeof(*context));
+	char* input = arena_strndup(&client->arena, content, length);
+	if (!context || !input)
+		goto nomem;
+
+	context->items = malloc(SDO_BULK_REST_MAX_ITEMS
+				* sizeof(*context->items));
+	if (!context->items)
+		goto nomem;
+
+	if (sdo_bulk_rest__parse(context, batches, input) < 0) {
+		sdo_bulk_rest__error(client, "400 Bad Request",
+			"Objects must be given as lines of "
+			"<nodeid> <index> <subindex> [<type>] [= <value>], "
+			"at most 1024 of them\r\n");
+		goto done;
+	}
+
+	context->client = client;
+	rest_client_ref(client);
+
+	if (sdo_bulk_rest__start(context, batches) < 0) {
+		sdo_bulk_rest__error(client, "500 Internal Server Error",
+				     "Failed to start sdo requests\r\n");
+		sdo_bulk_rest__context_free(context);
+	}
+
+	context = NULL;
+	goto done;
+
+nomem:
+	sdo_bulk_rest__error(client, "500 Internal Server Error",
+			     "Out of memory\r\n");
+done:
+	for (int i = 0; i <= CANOPEN_NODEID_MAX; ++i)
+		if (batches[i])
+			sdo_batch_unref(batches[i]);
+
+	if (context) {
+		free(context->items);
+		free(context);
+	}
+}
@@ -12,26 +12,95 @@
  * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
  * PERFORMANCE OF THIS SOFTWARE.
  */
-
 #include "canopen/sdo-dict.h"
-#include "string-utils.h"
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #define XSTR(s) STR(s)
 #define STR(s) #s
 
-size_t strlcpy(char* dst, const char* src, size_t size);
+#define ARRAY_LENGTH(a) (sizeof(a) / sizeof((a)[0]))
+
+enum {
+#define X(idx, subidx, type, name) SDO_DICT__ ## name,
+	SDO_DICTIONARY
+#undef X
+	SDO_DICT__UNKNOWN,
+};
+
+struct sdo_dict__entry {
+	uint32_t mux;
+	char name[32];
+};
+
+/* The names are turned into their REST form, e.g. "device-type", in place by
+ * sdo_dict__init()
+ */
+static struct sdo_dict__entry sdo_dict__entries[] = {
+#define X(idx, subidx, type, name) \
+	[SDO_DICT__ ## name] = { SDO_MUX(idx, subidx), XSTR(name) },
+
+	SDO_DICTIONARY
+#undef X
+	[SDO_DICT__UNKNOWN] = { 0, "UNKNOWN" },
+};
+
+/* Entries sorted by name */
+static const struct sdo_dict__entry* sdo_dict__by_name[SDO_DICT__UNKNOWN];
+
+static pthread_once_t sdo_dict__once = PTHREAD_ONCE_INIT;
+
+static inline int sdo_dict__normalize(int c)
+{
+	return c == '_' ? '-' : tolower(c);
+}
+
+static int sdo_dict__strcmp(const char* a, const char* b)
+{
+	while (*a && sdo_dict__normalize(*a) == sdo_dict__normalize(*b))
+		++a, ++b;
+
+	return sdo_dict__normalize(*a) - sdo_dict__normalize(*b);
+}
+
+static int sdo_dict__cmp_entries(const void* a, const void* b)
+{
+	const struct sdo_dict__entry* const* x = a;
+	const struct sdo_dict__entry* const* y = b;
+	return sdo_dict__strcmp((*x)->name, (*y)->name);
+}
+
+static int sdo_dict__cmp_key(const void* key, const void* elem)
+{
+	const struct sdo_dict__entry* const* entry = elem;
+	return sdo_dict__strcmp(key, (*entry)->name);
+}
 
-static const char* str_dict__constname(uint32_t mux)
+static void sdo_dict__init(void)
+{
+	for (size_t i = 0; i < ARRAY_LENGTH(sdo_dict__entries); ++i)
+		for (char* c = sdo_dict__entries[i].name; *c; ++c)
+			*c = sdo_dict__normalize(*c);
+
+	for (size_t i = 0; i < ARRAY_LENGTH(sdo_dict__by_name); ++i)
+		sdo_dict__by_name[i] = &sdo_dict__entries[i];
+
+	qsort(sdo_dict__by_name, ARRAY_LENGTH(sdo_dict__by_name),
+	      sizeof(sdo_dict__by_name[0]), sdo_dict__cmp_entries);
+}
+
+static int sdo_dict__find(uint32_t mux)
 {
 	switch (mux) {
 #define X(idx, subidx, type, name) \
-	case SDO_MUX(idx, subidx): return XSTR(name);
+	case SDO_MUX(idx, subidx): return SDO_DICT__ ## name;
 
 	SDO_DICTIONARY
 #undef X
-	default: return "UNKNOWN";
+	default: return SDO_DICT__UNKNOWN;
 	}
 }
 
@@ -47,29 +116,19 @@ enum canopen_type sdo_dict_type(uint32_t mux)
 	}
 }
 
-static inline char* sdo_dict__constname_to_string(char* constname)
-{
-	return string_tolower(string_replace_char('_', '-', constname));
-}
-
 const char* sdo_dict_tostring(uint32_t mux)
 {
-	static __thread char buffer[64];
-	strlcpy(buffer, str_dict__constname(mux), sizeof(buffer));
-	return sdo_dict__constname_to_string(buffer);
+	pthread_once(&sdo_dict__once, sdo_dict__init);
+	return sdo_dict__entries[sdo_dict__find(mux)].name;
 }
 
 uint32_t sdo_dict_fromstring(const char* str)
 {
-	static __thread char buffer[64];
-	strlcpy(buffer, str, sizeof(buffer));
-	string_replace_char('-', '_', buffer);
+	pthread_once(&sdo_dict__once, sdo_dict__init);
 
-#define X(idx, subidx, type, name) \
-	if (0 == strcasecmp(buffer, XSTR(name))) return SDO_MUX(idx, subidx);
-
-	SDO_DICTIONARY
-#undef X
+	const struct sdo_dict__entry* const* entry;
+	entry = bsearch(str, sdo_dict__by_name, ARRAY_LENGTH(sdo_dict__by_name),
+			sizeof(sdo_dict__by_name[0]), sdo_dict__cmp_key);
 
-	return 0;
+	return entry ? (*entry)->mux : 0;
 }
@@ -0,0 +1,516 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <mloop.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "canopen.h"
+#include "canopen/sdo.h"
+#include "canopen/sdo_req.h"
+#include "canopen/byteorder.h"
+#include "net-util.h"
+#include "vector.h"
+#include "sdo-gateway.h"
+
+#define SDO_GATEWAY_BACKLOG 16
+#define SDO_GATEWAY_READ_SIZE 65536
+
+/* A client that has this many bytes of answers that it has not read is not
+ * read from
+ */
+#define SDO_GATEWAY_OUTPUT_MAX (1 << 20)
+
+struct sdo_gateway_client {
+	int ref;
+	LIST_ENTRY(sdo_gateway_client) links;
+	struct mloop_socket* socket;
+	struct vector input;
+	struct vector output;
+	size_t output_start;
+	size_t n_pending;
+	int is_processing;
+};
+
+LIST_HEAD(sdo_gateway_client_list, sdo_gateway_client);
+
+struct sdo_gateway_context {
+	struct sdo_gateway_client* client;
+	uint32_t tag;
+};
+
+static struct mloop_socket* sdo_gateway__server = NULL;
+static struct sdo_gateway_client_list sdo_gateway__clients =
+	LIST_HEAD_INITIALIZER(sdo_gateway__clients);
+
+ssize_t sdo_gateway_decode_request(struct sdo_gateway_request* req,
+				   const void* src, size_t size)
+{
+	if (size < sizeof(*req))
+		return 0;
+
+	memcpy(req, src, sizeof(*req));
+	req->tag = byteorder_u32(req->tag);
+	req->index = byteorder_u16(req->index);
+	req->size = byteorder_u32(req->size);
+
+	if (req->type != SDO_GATEWAY_UPLOAD && req->type != SDO_GATEWAY_DOWNLOAD)
+		return -1;
+
+	if (req->nodeid < CANOPEN_NODEID_MIN || req->nodeid > CANOPEN_NODEID_MAX)
+		return -1;
+
+	if (req->reserved[0] || req->reserved[1] || req->reserved[2])
+		return -1;
+
+	if (req->size > SDO_GATEWAY_SIZE_MAX
+	 || (req->type == SDO_GATEWAY_UPLOAD && req->size != 0))
+		return -1;
+
+	size_t total = sizeof(*req) + req->size;
+	return size < total ? 0 : (ssize_t)total;
+}
+
+void sdo_gateway_encode_response(void* dst, uint32_t tag, uint32_t abort_code,
+				 uint32_t size)
+{
+	struct sdo_gateway_response rsp = {
+		.tag = byteorder_u32(tag),
+		.abort_code = byteorder_u32(abort_code),
+		.size = byteorder_u32(size),
+	};
+
+	memcpy(dst, &rsp, sizeof(rsp));
+}
+
+static struct sdo_gateway_client* sdo_gateway_client_new(void)
+{
+	struct sdo_gateway_client* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+	self->ref = 1;
+
+	if (vector_init(&self->input, 256) < 0)
+		goto input_failure;
+
+	if (vector_init(&self->output, 256) < 0)
+		goto output_failure;
+
+	return self;
+
+output_failure:
+	vector_destroy(&self->input);
+input_failure:
+	free(self);
+	return NULL;
+}
+
+static void sdo_gateway_client_ref(struct sdo_gateway_client* self)
+{
+	++self->ref;
+}
+
+static void sdo_gateway_client_unref(struct sdo_gateway_client* self)
+{
+	if (--self->ref > 0)
+		return;
+
+	vector_destroy(&self->output);
+	vector_destroy(&self->input);
+	free(self);
+}
+
+static inline int
+sdo_gateway__has_output(const struct sdo_gateway_client* client)
+{
+	return client->output_start < client->output.index;
+}
+
+static inline int
+sdo_gateway__can_take_input(const struct sdo_gateway_client* client)
+{
+	return client->n_pending < SDO_GATEWAY_PENDING_MAX
+	    && client->output.index - client->output_start
+	       < SDO_GATEWAY_OUTPUT_MAX;
+}
+
+/* Answers go out once the socket is found writable, so that all those that
+ * are done within one main loop iteration are sent together.
+ */
+static void sdo_gateway__set_event(struct sdo_gateway_client* client)
+{
+	enum mloop_socket_event events = MLOOP_SOCKET_EVENT_NONE;
+
+	if (sdo_gateway__has_output(client))
+		events |= MLOOP_SOCKET_EVENT_OUT;
+
+	if (sdo_gateway__can_take_input(client))
+		events |= MLOOP_SOCKET_EVENT_IN | MLOOP_SOCKET_EVENT_PRI;
+
+	mloop_socket_set_event(client->socket, events);
+}
+
+/* The socket is freed right away, which clears client->socket. The client
+ * itself lives on until its pending requests are done.
+ */
+static void sdo_gateway__close(struct sdo_gateway_client* client)
+{
+	if (client->socket)
+		mloop_socket_stop(client->socket);
+}
+
+static void sdo_gateway__answer(struct sdo_gateway_client* client,
+				uint32_t tag, uint32_t abort_code,
+				const void* data, size_t size)
+{
+	char header[sizeof(struct sdo_gateway_response)];
+	sdo_gateway_encode_response(header, tag, abort_code, size);
+
+	if (vector_append(&client->output, header, sizeof(header)) < 0
+	 || (size > 0 && vector_append(&client->output, data, size) < 0))
+		sdo_gateway__close(client);
+}
+
+static int sdo_gateway__flush(struct sdo_gateway_client* client)
+{
+	int fd = mloop_socket_get_fd(client->socket);
+
+	while (sdo_gateway__has_output(client)) {
+		ssize_t rc = send(fd, (char*)client->output.data
+				  + client->output_start,
+				  client->output.index - client->output_start,
+				  MSG_NOSIGNAL);
+		if (rc < 0)
+			return (errno == EAGAIN || errno == EWOULDBLOCK)
+			       ? 0 : -1;
+
+		client->output_start += rc;
+	}
+
+	vector_clear(&client->output);
+	client->output_start = 0;
+	return 0;
+}
+
+static int sdo_gateway__process_input(struct sdo_gateway_client* client);
+
+static uint32_t sdo_gateway__abort_code(const struct sdo_req* req)
+{
+	switch (req->status) {
+	case SDO_REQ_OK: return 0;
+	case SDO_REQ_NOMEM: return SDO_ABORT_NOMEM;
+	default: break;
+	}
+
+	return req->abort_code ? (uint32_t)req->abort_code : SDO_ABORT_GENERAL;
+}
+
+static void sdo_gateway__on_done(struct sdo_req* req)
+{
+	struct sdo_gateway_context* context = req->context;
+	struct sdo_gateway_client* client = context->client;
+
+	client->n_pending--;
+
+	if (!client->socket)
+		goto done;
+
+	uint32_t abort_code = sdo_gateway__abort_code(req);
+	int has_data = abort_code == 0 && req->type == SDO_REQ_UPLOAD;
+
+	sdo_gateway__answer(client, context->tag, abort_code,
+			    has_data ? req->data.data : NULL,
+			    has_data ? req->data.index : 0);
+
+	if (client->is_processing)
+		goto done;
+
+	/* Requests that were held back may go now */
+	if (client->socket && sdo_gateway__process_input(client) < 0)
+		sdo_gateway__close(client);
+
+	if (client->socket)
+		sdo_gateway__set_event(client);
+
+done:
+	sdo_gateway_client_unref(client);
+	free(context);
+}
+
+static void sdo_gateway__start(struct sdo_gateway_client* client,
+			       const struct sdo_gateway_request* greq,
+			       const void* data)
+{
+	struct sdo_gateway_context* context = malloc(sizeof(*context));
+	if (!context)
+		goto failure;
+
+	context->client = client;
+	context->tag = greq->tag;
+
+	struct sdo_req_info info = {
+		.type = greq->type == SDO_GATEWAY_UPLOAD ? SDO_REQ_UPLOAD
+							 : SDO_REQ_DOWNLOAD,
+		.priority = SDO_REQ_PRIO_BACKGROUND,
+		.index = greq->index,
+		.subindex = greq->subindex,
+		.on_done = sdo_gateway__on_done,
+		.dl_data = data,
+		.dl_size = greq->size,
+		.context = context,
+	};
+
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req)
+		goto req_failure;
+
+	sdo_gateway_client_ref(client);
+	client->n_pending++;
+
+	sdo_req_start(req, sdo_req_queue_get(greq->nodeid));
+
+	/* The queue of the node is full */
+	if (sdo_req_unref(req) == 0) {
+		client->n_pending--;
+		sdo_gateway_client_unref(client);
+		goto req_failure;
+	}
+
+	return;
+
+req_failure:
+	free(context);
+failure:
+	sdo_gateway__answer(client, greq->tag, SDO_ABORT_NOMEM, NULL, 0);
+}
+
+/* Starts the requests that are complete in the input buffer, as long as the
+ * client may have more pending. Returns -1 on an invalid request.
+ */
+static int sdo_gateway__process_input(struct sdo_gateway_client* client)
+{
+	const char* data = client->input.data;
+	size_t pos = 0;
+	int rc = 0;
+
+	client->is_processing = 1;
+
+	while (client->socket && sdo_gateway__can_take_input(client)) {
+		struct sdo_gateway_request req;
+
+		ssize_t size = sdo_gateway_decode_request(&req, data + pos,
+						client->input.index - pos);
+		if (size < 0) {
+			rc = -1;
+			break;
+		}
+
+		if (size == 0)
+			break;
+
+		sdo_gateway__start(client, &req, data + pos + sizeof(req));
+		pos += size;
+	}
+
+	client->is_processing = 0;
+
+	memmove(client->input.data, data + pos, client->input.index - pos);
+	client->input.index -= pos;
+
+	return rc;
+}
+
+static int sdo_gateway__read(struct sdo_gateway_client* client)
+{
+	if (vector_reserve(&client->input, client->input.index
+				+ SDO_GATEWAY_READ_SIZE) < 0)
+		return -1;
+
+	ssize_t size = read(mloop_socket_get_fd(client->socket),
+			    (char*)client->input.data + client->input.index,
+			    SDO_GATEWAY_READ_SIZE);
+	if (size == 0)
+		return -1;
+
+	if (size < 0)
+		return (errno == EWOULDBLOCK || errno == EAGAIN) ? 0 : -1;
+
+	client->input.index += size;
+	return 0;
+}
+
+static void sdo_gateway__on_client_data(struct mloop_socket* socket)
+{
+	struct sdo_gateway_client* client = mloop_socket_get_context(socket);
+	enum mloop_socket_event events = mloop_socket_get_event(socket);
+
+	sdo_gateway_client_ref(client);
+
+	if ((events & MLOOP_SOCKET_EVENT_OUT) && sdo_gateway__flush(client) < 0)
+		goto failure;
+
+	if ((events & ~MLOOP_SOCKET_EVENT_OUT)
+	 && sdo_gateway__can_take_input(client)) {
+		if (sdo_gateway__read(client) < 0)
+			goto failure;
+
+		if (sdo_gateway__process_input(client) < 0)
+			goto failure;
+	}
+
+	if (client->socket)
+		sdo_gateway__set_event(client);
+
+	sdo_gateway_client_unref(client);
+	return;
+
+failure:
+	sdo_gateway__close(client);
+	sdo_gateway_client_unref(client);
+}
+
+static void sdo_gateway__on_socket_free(void* ptr)
+{
+	struct sdo_gateway_client* client = ptr;
+	LIST_REMOVE(client, links);
+	client->socket = NULL;
+	sdo_gateway_client_unref(client);
+}
+
+static void sdo_gateway__on_connection(struct mloop_socket* socket)
+{
+	int cfd = accept(mloop_socket_get_fd(socket), NULL, 0);
+	if (cfd < 0)
+		return;
+
+	net_dont_block(cfd);
+	net_dont_delay(cfd);
+
+	struct mloop_socket* client_socket = mloop_socket_new(mloop_default());
+	if (!client_socket)
+		goto socket_failure;
+
+	struct sdo_gateway_client* client = sdo_gateway_client_new();
+	if (!client)
+		goto client_failure;
+
+	client->socket = client_socket;
+	LIST_INSERT_HEAD(&sdo_gateway__clients, client, links);
+
+	mloop_socket_set_fd(client_socket, cfd);
+	mloop_socket_set_callback(client_socket, sdo_gateway__on_client_data);
+	mloop_socket_set_context(client_socket, client,
+				 sdo_gateway__on_socket_free);
+	mloop_socket_start(client_socket);
+
+	mloop_socket_unref(client_socket);
+	return;
+
+client_failure:
+	mloop_socket_unref(client_socket);
+socket_failure:
+	close(cfd);
+}
+
+static int sdo_gateway__open_server(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	net_reuse_addr(fd);
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+		goto failure;
+
+	if (listen(fd, SDO_GATEWAY_BACKLOG) < 0)
+		goto failure;
+
+	net_dont_block(fd);
+	return fd;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+int sdo_gateway_init(int port)
+{
+	int lfd = sdo_gateway__open_server(port);
+	if (lfd < 0)
+		return -1;
+
+	if (sdo_gateway_init_fd(lfd) < 0) {
+		close(lfd);
+		return -1;
+	}
+
+	return 0;
+}
+
+int sdo_gateway_init_fd(int lfd)
+{
+	struct mloop_socket* socket = mloop_socket_new(mloop_default());
+	if (!socket)
+		return -1;
+
+	mloop_socket_set_fd(socket, lfd);
+	mloop_socket_set_callback(socket, sdo_gateway__on_connection);
+	if (mloop_socket_start(socket) < 0) {
+		mloop_socket_set_fd(socket, -1);
+		mloop_socket_unref(socket);
+		return -1;
+	}
+
+	sdo_gateway__server = socket;
+	return 0;
+}
+
+int sdo_gateway_get_server_fd(void)
+{
+	return sdo_gateway__server
+	     ? mloop_socket_get_fd(sdo_gateway__server) : -1;
+}
+
+void sdo_gateway_stop_server(void)
+{
+	if (sdo_gateway__server)
+		mloop_socket_stop(sdo_gateway__server);
+}
+
+/* Requests that are still pending keep their clients until they are done */
+void sdo_gateway_cleanup(void)
+{
+	if (sdo_gateway__server) {
+		mloop_socket_stop(sdo_gateway__server);
+		mloop_socket_unref(sdo_gateway__server);
+		sdo_gateway__server = NULL;
+	}
+
+	while (!LIST_EMPTY(&sdo_gateway__clients))
+		mloop_socket_stop(LIST_FIRST(&sdo_gateway__clients)->socket);
+}
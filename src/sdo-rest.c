@@ -14,24 +14,39 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <mloop.h>
+#include <sys/queue.h>
 
 #include "canopen/sdo_req.h"
 #include "canopen/eds.h"
+#include "canopen/sdo_cache.h"
+#include "canopen/sdo_batch.h"
+#include "canopen/sdo_future.h"
 #include "canopen.h"
 #include "canopen/master.h"
 #include "vector.h"
 #include "rest.h"
 #include "conversions.h"
+#include "cbor.h"
 #include "string-utils.h"
 #include "canopen/types.h"
+#include "sdo-rest.h"
+#include "sdo-bulk-rest.h"
 
 size_t strlcpy(char*, const char*, size_t);
 
 #define is_in_range(x, min, max) ((min) <= (x) && (x) <= (max))
 
+/* Values for an EDS dump are uploaded this many at a time, so that the dump
+ * does not take up all of the node's queue.
+ */
+#define SDO_REST_EDS_CHUNK 64
+
 struct sdo_rest_path {
 	int nodeid, index, subindex;
 };
@@ -42,14 +57,51 @@ struct sdo_rest_context {
 	struct sdo_rest_path path;
 };
 
+struct sdo_rest_eds_value {
+	const struct eds_obj* obj;
+	struct vector data;
+	int is_size_indicated;
+	int is_valid;
+};
+
 struct sdo_rest_eds_context {
 	unsigned int nodeid;
 	struct rest_client* client;
 	const struct canopen_eds* eds;
+	int with_value;
+	int is_cbor;
+
+	/* One for each object, in the order of the EDS */
+	struct sdo_rest_eds_value* values;
+	size_t n_values;
+
+	/* Positions of the values that are to be uploaded */
+	size_t* reads;
+	size_t n_reads;
+	size_t n_started;
+
+	char* buffer;
+	size_t length;
+	char etag[20];
+};
+
+/* EDS dumps without values only depend on the EDS, which does not change once
+ * it has been loaded, so they are kept and sent from where they are.
+ */
+struct sdo_rest_eds_doc {
+	SLIST_ENTRY(sdo_rest_eds_doc) links;
+	const struct canopen_eds* eds;
+	int is_cbor;
 	char* buffer;
 	size_t length;
+	char etag[20];
 };
 
+SLIST_HEAD(sdo_rest_eds_doc_list, sdo_rest_eds_doc);
+
+static struct sdo_rest_eds_doc_list sdo_rest__eds_docs =
+	SLIST_HEAD_INITIALIZER(sdo_rest__eds_docs);
+
 static int sdo_rest__convert_path(struct sdo_rest_path* dst,
 				  const struct rest_client* client)
 {
@@ -61,34 +113,15 @@ static int sdo_rest__convert_path(struct sdo_rest_path* dst,
 	     && dst->index >= 0x1000) ? 0 : -1;
 }
 
-static const struct canopen_eds* sdo_rest__find_eds(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	assert(node);
-
-	const struct canopen_eds* eds;
-
-	if (node->vendor_id == 0)
-		return eds_db_find_by_name(node->name);
-
-	eds = eds_db_find(node->vendor_id, node->product_code,
-			  node->revision_number);
-	if (eds)
-		return eds;
-
-	return eds_db_find(node->vendor_id, node->product_code, -1);
-}
-
 static struct sdo_rest_context*
 sdo_rest_context_new(struct rest_client* client,
 		     const struct sdo_rest_path* path)
 {
-	struct sdo_rest_context* self = malloc(sizeof(*self));
+	struct sdo_rest_context* self = arena_zalloc(&client->arena,
+						     sizeof(*self));
 	if (!self)
 		return NULL;
 
-	memset(self, 0, sizeof(*self));
-
 	self->client = client;
 	self->path = *path;
 
@@ -104,7 +137,7 @@ static void sdo_rest_not_found(struct rest_client* client, const char* message)
 		.content = message
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
 	client->state = REST_CLIENT_DONE;
 }
@@ -119,7 +152,22 @@ static void sdo_rest_server_error(struct rest_client* client,
 		.content = message
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void sdo_rest_unavailable(struct rest_client* client,
+				 const char* message)
+{
+	struct rest_reply_data reply = {
+		.status_code = "503 Service Unavailable",
+		.content_type = "text/plain",
+		.content_length = strlen(message),
+		.content = message
+	};
+
+	rest_reply(client, &reply);
 
 	client->state = REST_CLIENT_DONE;
 }
@@ -128,7 +176,7 @@ static const struct eds_obj*
 sdo_rest__get_eds_obj(const struct sdo_rest_path* path,
 		      struct rest_client* client)
 {
-	const struct canopen_eds* eds = sdo_rest__find_eds(path->nodeid);
+	const struct canopen_eds* eds = co_master_find_eds(path->nodeid);
 	if (!eds) {
 		sdo_rest_server_error(client, "Could not find EDS for node\r\n");
 		return NULL;
@@ -154,11 +202,42 @@ static void sdo_rest_bad_request(struct rest_client* client,
 		.content = message
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
 	client->state = REST_CLIENT_DONE;
 }
 
+static void sdo_rest__send_cbor_value(struct rest_client* client,
+				      const struct canopen_data* data)
+{
+	struct cbor out;
+
+	if (cbor_init(&out, 16 + data->size) < 0) {
+		cbor_destroy(&out);
+		sdo_rest_server_error(client, "Out of memory\r\n");
+		return;
+	}
+
+	if (canopen_data_tocbor(&out, data) < 0 || out.is_bad) {
+		cbor_destroy(&out);
+		sdo_rest_server_error(client, "Data conversion failed\r\n");
+		return;
+	}
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = CBOR_CONTENT_TYPE,
+		.content_length = out.vector.index,
+		.content = out.vector.data
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+
+	cbor_destroy(&out);
+}
+
 static void on_sdo_rest_upload_done(struct sdo_req* req)
 {
 	struct sdo_rest_context* context = req->context;
@@ -180,6 +259,11 @@ static void on_sdo_rest_upload_done(struct sdo_req* req)
 		.is_size_unknown = !req->is_size_indicated
 	};
 
+	if (rest_is_accepted(&client->req, CBOR_CONTENT_TYPE)) {
+		sdo_rest__send_cbor_value(client, &data);
+		goto done;
+	}
+
 	char buffer[256];
 	char* message = canopen_data_tostring(buffer, sizeof(buffer), &data);
 	if (!message) {
@@ -194,13 +278,12 @@ static void on_sdo_rest_upload_done(struct sdo_req* req)
 		.content = message
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
 	client->state = REST_CLIENT_DONE;
 
 done:
 	rest_client_unref(client);
-	free(context);
 }
 
 static enum canopen_type sdo_rest__get_type(struct rest_client* client)
@@ -234,6 +317,7 @@ static int sdo_rest__get(struct sdo_rest_context* context)
 
 	struct sdo_req_info info = {
 		.type = SDO_REQ_UPLOAD,
+		.priority = SDO_REQ_PRIO_BACKGROUND,
 		.index = path->index,
 		.subindex = path->subindex,
 		.on_done = on_sdo_rest_upload_done,
@@ -279,13 +363,12 @@ static void on_sdo_rest_download_done(struct sdo_req* req)
 		.content = ""
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
 	client->state = REST_CLIENT_DONE;
 
 done:
 	rest_client_unref(client);
-	free(context);
 }
 
 static int sdo_rest__put(struct sdo_rest_context* context, const void* content)
@@ -312,17 +395,13 @@ static int sdo_rest__put(struct sdo_rest_context* context, const void* content)
 
 	struct canopen_data data = { 0 };
 
-	char* input = malloc(content_length + 1);
+	char* input = arena_strndup(&client->arena, content, content_length);
 	if (!input) {
 		sdo_rest_server_error(client, "Out of memory\r\n");
 		return -1;
 	}
 
-	memcpy(input, content, content_length);
-	input[content_length] = '\0';
-
 	int r = canopen_data_fromstring(&data, type, string_trim(input));
-	free(input);
 
 	if (r < 0) {
 		sdo_rest_server_error(client, "Data conversion failed\r\n");
@@ -331,6 +410,7 @@ static int sdo_rest__put(struct sdo_rest_context* context, const void* content)
 
 	struct sdo_req_info info = {
 		.type = SDO_REQ_DOWNLOAD,
+		.priority = SDO_REQ_PRIO_BACKGROUND,
 		.index = path->index,
 		.subindex = path->subindex,
 		.on_done = on_sdo_rest_download_done,
@@ -372,46 +452,23 @@ int sdo_rest__process(struct sdo_rest_context* context, const void* content)
 	return -1;
 }
 
-ssize_t sdo_rest__read_value(FILE* out, unsigned int nodeid, int index,
-			     int subindex, enum canopen_type type)
+static ssize_t sdo_rest__print_value(FILE* out, enum canopen_type type,
+				     const void* value, size_t size,
+				     int is_size_indicated)
 {
-	struct sdo_req_info info = {
-		.type = SDO_REQ_UPLOAD,
-		.index = index,
-		.subindex = subindex
-	};
-
-	struct sdo_req* req = sdo_req_new(&info);
-	if (!req)
-		goto nomem;
-
-	if (sdo_req_start(req, sdo_req_queue_get(nodeid)) < 0)
-		goto failure;
-
-	sdo_req_wait(req);
-
-	if (req->status != SDO_REQ_OK)
-		goto failure;
-
 	struct canopen_data data = {
 		.type = type,
-		.data = req->data.data,
-		.size = req->data.index,
-		.is_size_unknown = !req->is_size_indicated
+		.data = (void*)value,
+		.size = size,
+		.is_size_unknown = !is_size_indicated
 	};
 
 	char buffer[256];
 	char* str = canopen_data_tostring(buffer, sizeof(buffer), &data);
 	if (!str)
-		goto failure;
+		return fprintf(out, "null");
 
-	sdo_req_unref(req);
 	return fprintf(out, "\"%s\"", str);
-
-failure:
-	sdo_req_unref(req);
-nomem:
-	return fprintf(out, "null");
 }
 
 static char* sdo_rest__escape_string(const char* str)
@@ -445,6 +502,138 @@ static char* sdo_rest__clean_string(const char* str)
 	return string_keep_if(isprint, buffer);
 }
 
+static void sdo_rest__print_eds_value(FILE* out,
+				      const struct sdo_rest_eds_value* value)
+{
+	if (!value->is_valid) {
+		fprintf(out, "null");
+		return;
+	}
+
+	sdo_rest__print_value(out, value->obj->type, value->data.data,
+			      value->data.index, value->is_size_indicated);
+}
+
+static void sdo_rest__make_etag(char* dst, size_t size, const char* data,
+				size_t length)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	snprintf(dst, size, "\"%016" PRIx64 "\"", hash);
+}
+
+static void sdo_rest__put_eds_value(struct cbor* out,
+				    const struct sdo_rest_eds_value* value)
+{
+	struct canopen_data data = {
+		.type = value->obj->type,
+		.data = value->data.data,
+		.size = value->data.index,
+		.is_size_unknown = !value->is_size_indicated
+	};
+
+	if (!value->is_valid || canopen_data_tocbor(out, &data) < 0)
+		cbor_put_null(out);
+}
+
+static void sdo_rest__put_text_field(struct cbor* out, const char* key,
+				     const char* value)
+{
+	if (!value)
+		return;
+
+	cbor_put_string(out, key);
+	cbor_put_string(out, value);
+}
+
+/* Objects are keyed by index << 8 | subindex. The fields are the same as in
+ * the JSON document, but values are CBOR numbers and strings.
+ */
+static void sdo_rest__put_eds_obj(struct cbor* out,
+				  const struct sdo_rest_eds_value* value,
+				  int with_value)
+{
+	const struct eds_obj* obj = value->obj;
+
+	int is_const = !!(obj->access & EDS_OBJ_CONST);
+	int is_readable = !!(obj->access & EDS_OBJ_R);
+	int is_writable = !!(obj->access & EDS_OBJ_W);
+
+	cbor_put_uint(out, eds_obj_index(obj) << 8 | eds_obj_subindex(obj));
+	cbor_begin_map(out);
+
+	cbor_put_string(out, "type");
+	cbor_put_uint(out, obj->type);
+
+	if (is_const) {
+		cbor_put_string(out, "const");
+		cbor_put_bool(out, 1);
+	} else {
+		cbor_put_string(out, "read-write");
+		cbor_put_array(out, 2);
+		cbor_put_bool(out, is_readable);
+		cbor_put_bool(out, is_writable);
+	}
+
+	if ((is_const || is_readable) && with_value) {
+		cbor_put_string(out, "value");
+		sdo_rest__put_eds_value(out, value);
+	}
+
+	if (obj->name)
+		sdo_rest__put_text_field(out, "name",
+					 sdo_rest__clean_string(obj->name));
+
+	sdo_rest__put_text_field(out, "default-value", obj->default_value);
+	sdo_rest__put_text_field(out, "low-limit", obj->low_limit);
+	sdo_rest__put_text_field(out, "high-limit", obj->high_limit);
+	sdo_rest__put_text_field(out, "unit", obj->unit);
+	sdo_rest__put_text_field(out, "scaling", obj->scaling);
+
+	cbor_put_break(out);
+}
+
+static void sdo_rest__eds_cbor_job(struct mloop_work* work)
+{
+	struct sdo_rest_eds_context* context = mloop_work_get_context(work);
+	struct rest_client* client = context->client;
+	struct cbor out;
+
+	if (cbor_init(&out, 64 * (context->n_values + 1)) < 0)
+		goto failure;
+
+	cbor_put_map(&out, context->n_values);
+
+	for (size_t i = 0; i < context->n_values; ++i) {
+		if (client->state == REST_CLIENT_DISCONNECTED)
+			goto failure;
+
+		sdo_rest__put_eds_obj(&out, &context->values[i],
+				      context->with_value);
+	}
+
+	if (out.is_bad)
+		goto failure;
+
+	context->buffer = out.vector.data;
+	context->length = out.vector.index;
+
+	if (!context->with_value)
+		sdo_rest__make_etag(context->etag, sizeof(context->etag),
+				    context->buffer, context->length);
+
+	return;
+
+failure:
+	mloop_work_cancel(work);
+	cbor_destroy(&out);
+}
+
 void sdo_rest__eds_job(struct mloop_work* work)
 {
 	char* buffer = NULL;
@@ -453,13 +642,18 @@ void sdo_rest__eds_job(struct mloop_work* work)
 	struct sdo_rest_eds_context* context = mloop_work_get_context(work);
 	const struct canopen_eds* eds = context->eds;
 	struct rest_client* client = context->client;
-	unsigned int nodeid = context->nodeid;
+	const struct sdo_rest_eds_value* value = context->values;
 
 	int is_const, is_readable, is_writable;
-	int with_value = http_req_query(&client->req, "with_value") != NULL;
+	int with_value = context->with_value;
 
 	int index, subindex;
 
+	if (context->is_cbor) {
+		sdo_rest__eds_cbor_job(work);
+		return;
+	}
+
 	FILE* out = open_memstream(&buffer, &size);
 	if (!out) {
 		sdo_rest_server_error(client, "Out of memory\r\n");
@@ -477,7 +671,10 @@ void sdo_rest__eds_job(struct mloop_work* work)
 			goto failure;
 
 		fprintf(out, ",\n");
+		++value;
 first_object:
+		assert(value->obj == obj);
+
 		is_const = !!(obj->access & EDS_OBJ_CONST);
 		is_readable = !!(obj->access & EDS_OBJ_R);
 		is_writable = !!(obj->access & EDS_OBJ_W);
@@ -498,8 +695,7 @@ first_object:
 
 		if ((is_const || is_readable) && with_value) {
 			fprintf(out, ",\n  \"value\": ");
-			sdo_rest__read_value(out, nodeid, index,
-						    subindex, obj->type);
+			sdo_rest__print_eds_value(out, value);
 		}
 
 		if (obj->name) {
@@ -540,6 +736,10 @@ done:
 	context->buffer = buffer;
 	context->length = size;
 
+	if (!with_value)
+		sdo_rest__make_etag(context->etag, sizeof(context->etag),
+				    buffer, size);
+
 	return;
 
 failure:
@@ -549,10 +749,90 @@ failure:
 	return;
 }
 
+static struct sdo_rest_eds_doc*
+sdo_rest__find_eds_doc(const struct canopen_eds* eds, int is_cbor)
+{
+	struct sdo_rest_eds_doc* doc;
+
+	SLIST_FOREACH(doc, &sdo_rest__eds_docs, links)
+		if (doc->eds == eds && doc->is_cbor == is_cbor)
+			return doc;
+
+	return NULL;
+}
+
+static struct sdo_rest_eds_doc*
+sdo_rest__keep_eds_doc(struct sdo_rest_eds_context* context)
+{
+	struct sdo_rest_eds_doc* doc =
+		sdo_rest__find_eds_doc(context->eds, context->is_cbor);
+	if (doc)
+		return doc;
+
+	doc = malloc(sizeof(*doc));
+	if (!doc)
+		return NULL;
+
+	doc->eds = context->eds;
+	doc->is_cbor = context->is_cbor;
+	doc->buffer = context->buffer;
+	doc->length = context->length;
+	strlcpy(doc->etag, context->etag, sizeof(doc->etag));
+
+	context->buffer = NULL;
+
+	SLIST_INSERT_HEAD(&sdo_rest__eds_docs, doc, links);
+	return doc;
+}
+
+static int sdo_rest__is_etag_match(const struct rest_client* client,
+				   const char* etag)
+{
+	const char* match = client->req.if_none_match;
+	return match && (strcmp(match, "*") == 0 || strstr(match, etag));
+}
+
+static void sdo_rest__send_eds_doc(struct rest_client* client,
+				   const struct sdo_rest_eds_doc* doc)
+{
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = doc->is_cbor ? CBOR_CONTENT_TYPE
+					     : "application/json",
+		.content_length = doc->length,
+		.content = doc->buffer,
+		.etag = doc->etag,
+		.ownership = REST_CONTENT_STATIC
+	};
+
+	if (sdo_rest__is_etag_match(client, doc->etag)) {
+		reply.status_code = "304 Not Modified";
+		reply.content_length = 0;
+		reply.content = "";
+	}
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
 void sdo_rest__eds_job_done(struct mloop_work* work)
 {
 	struct sdo_rest_eds_context* context = mloop_work_get_context(work);
 	struct rest_client* client = context->client;
+
+	rest_work_done();
+
+	if (!context->with_value) {
+		const struct sdo_rest_eds_doc* doc =
+			sdo_rest__keep_eds_doc(context);
+		if (doc) {
+			if (client->state != REST_CLIENT_DISCONNECTED)
+				sdo_rest__send_eds_doc(client, doc);
+			return;
+		}
+	}
+
 	char* buffer = context->buffer;
 	size_t length = context->length;
 
@@ -561,12 +841,15 @@ void sdo_rest__eds_job_done(struct mloop_work* work)
 
 	struct rest_reply_data reply = {
 		.status_code = "200 OK",
-		.content_type = "application/json",
+		.content_type = context->is_cbor ? CBOR_CONTENT_TYPE
+						 : "application/json",
 		.content_length = length,
-		.content = buffer
+		.content = buffer,
+		.ownership = REST_CONTENT_GIVEN
 	};
 
-	rest_reply(client->output, &reply);
+	context->buffer = NULL;
+	rest_reply(client, &reply);
 
 	client->state = REST_CLIENT_DONE;
 }
@@ -576,53 +859,230 @@ void sdo_rest__eds_job_free(void* ptr)
 	struct sdo_rest_eds_context* context = ptr;
 	struct rest_client* client = context->client;
 	rest_client_unref(client);
+
+	for (size_t i = 0; i < context->n_values; ++i)
+		vector_destroy(&context->values[i].data);
+
+	free(context->values);
+	free(context->reads);
 	free(context->buffer);
 	free(context);
 }
 
-int sdo_rest__send_eds(struct rest_client* client)
+static int sdo_rest__eds_from_cache(struct sdo_rest_eds_value* value,
+				    unsigned int nodeid)
 {
-	unsigned int nodeid = strtoul(client->req.url[1], NULL, 10);
-	if (!is_in_range(nodeid, CANOPEN_NODEID_MIN, CANOPEN_NODEID_MAX)) {
-		sdo_rest_not_found(client, "URL is out of range\r\n");
+	char buffer[256];
+	const struct eds_obj* obj = value->obj;
+
+	ssize_t size = sdo_cache_get(nodeid, eds_obj_index(obj),
+				     eds_obj_subindex(obj), buffer,
+				     sizeof(buffer), &value->is_size_indicated);
+	if (size < 0 || (size_t)size > sizeof(buffer))
 		return -1;
-	}
 
-	const struct canopen_eds* eds = sdo_rest__find_eds(nodeid);
-	if (!eds) {
-		sdo_rest_server_error(client, "Could not find EDS for node\r\n");
+	if (vector_assign(&value->data, buffer, size) < 0)
 		return -1;
-	}
 
+	value->is_valid = 1;
+	return 0;
+}
+
+static struct sdo_rest_eds_context*
+sdo_rest__eds_context_new(struct rest_client* client,
+			  const struct canopen_eds* eds, unsigned int nodeid)
+{
 	struct sdo_rest_eds_context* context = malloc(sizeof(*context));
+	if (!context)
+		return NULL;
+
 	memset(context, 0, sizeof(*context));
 	context->client = client;
 	context->eds = eds;
 	context->nodeid = nodeid;
+	context->with_value = http_req_query(&client->req, "with_value") != NULL;
+	context->is_cbor = rest_is_accepted(&client->req, CBOR_CONTENT_TYPE);
+
+	size_t n = 0;
+	const struct eds_obj* obj;
+	for (obj = eds_obj_first(eds); obj; obj = eds_obj_next(eds, obj))
+		++n;
+
+	context->values = calloc(n, sizeof(*context->values));
+	context->reads = malloc(n * sizeof(*context->reads));
+	if (n && (!context->values || !context->reads))
+		goto failure;
+
+	for (obj = eds_obj_first(eds); obj; obj = eds_obj_next(eds, obj)) {
+		size_t i = context->n_values++;
+		struct sdo_rest_eds_value* value = &context->values[i];
+		value->obj = obj;
+
+		int is_const = !!(obj->access & EDS_OBJ_CONST);
+		int is_readable = !!(obj->access & EDS_OBJ_R);
+
+		if (!context->with_value || !(is_const || is_readable))
+			continue;
+
+		if (is_const && sdo_rest__eds_from_cache(value, nodeid) == 0)
+			continue;
+
+		context->reads[context->n_reads++] = i;
+	}
+
+	return context;
+
+failure:
+	free(context->values);
+	free(context->reads);
+	free(context);
+	return NULL;
+}
+
+static void sdo_rest__eds_print(struct sdo_rest_eds_context* context)
+{
+	struct rest_client* client = context->client;
 
 	struct mloop_work* work = mloop_work_new(mloop_default());
 	if (!work) {
 		sdo_rest_server_error(client, "Out of memory\r\n");
-		goto failure;
+		sdo_rest__eds_job_free(context);
+		return;
 	}
 
 	mloop_work_set_context(work, context, sdo_rest__eds_job_free);
 	mloop_work_set_work_fn(work, sdo_rest__eds_job);
 	mloop_work_set_done_fn(work, sdo_rest__eds_job_done);
-	if (mloop_work_start(work) < 0)
-		sdo_rest_server_error(client, "Failed to schedule response\r\n");
+	if (rest_work_start(work) < 0)
+		sdo_rest_unavailable(client, "Too many requests\r\n");
 
-	rest_client_ref(client);
 	mloop_work_unref(work);
+}
+
+static int sdo_rest__eds_read_next(struct sdo_rest_eds_context* context);
+
+static void sdo_rest__on_eds_values(struct sdo_future* future)
+{
+	struct sdo_rest_eds_context* context = sdo_future_get_context(future);
+	const struct sdo_batch* batch = sdo_future_get_batch(future);
+	size_t first = context->n_started - batch->n_items;
+
+	for (size_t i = 0; i < batch->n_items; ++i) {
+		const struct sdo_batch_item* item = sdo_batch_get_item(batch, i);
+		struct sdo_rest_eds_value* value =
+			&context->values[context->reads[first + i]];
+
+		if (item->status != SDO_REQ_OK)
+			continue;
+
+		if (vector_copy(&value->data, &item->data) < 0)
+			continue;
+
+		value->is_size_indicated = item->is_size_indicated;
+		value->is_valid = 1;
+
+		if (value->obj->access & EDS_OBJ_CONST)
+			sdo_cache_put(context->nodeid, item->index,
+				      item->subindex, item->data.data,
+				      item->data.index,
+				      item->is_size_indicated);
+	}
+
+	if (context->client->state == REST_CLIENT_DISCONNECTED) {
+		sdo_rest__eds_job_free(context);
+		return;
+	}
+
+	/* Values that can not be read are left out */
+	if (context->n_started < context->n_reads
+	 && sdo_rest__eds_read_next(context) == 0)
+		return;
+
+	sdo_rest__eds_print(context);
+}
+
+/* Values are all queued at once, a chunk at a time, and they are printed
+ * when the last one is in.
+ */
+static int sdo_rest__eds_read_next(struct sdo_rest_eds_context* context)
+{
+	size_t end = context->n_started + SDO_REST_EDS_CHUNK;
+	if (end > context->n_reads)
+		end = context->n_reads;
+
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_BACKGROUND, 0);
+	if (!batch)
+		return -1;
+
+	for (size_t i = context->n_started; i < end; ++i) {
+		const struct eds_obj* obj = context->values[context->reads[i]].obj;
+
+		if (sdo_batch_add_upload(batch, eds_obj_index(obj),
+					 eds_obj_subindex(obj)) < 0) {
+			sdo_batch_unref(batch);
+			return -1;
+		}
+	}
+
+	struct sdo_future* future =
+		sdo_future_start(batch, sdo_req_queue_get(context->nodeid));
+	sdo_batch_unref(batch);
+	if (!future)
+		return -1;
+
+	context->n_started = end;
+	sdo_future_then(future, sdo_rest__on_eds_values, context, NULL);
+	sdo_future_unref(future);
+
 	return 0;
+}
 
-failure:
-	free(context);
-	return -1;
+int sdo_rest__send_eds(struct rest_client* client)
+{
+	unsigned int nodeid = strtoul(client->req.url[1], NULL, 10);
+	if (!is_in_range(nodeid, CANOPEN_NODEID_MIN, CANOPEN_NODEID_MAX)) {
+		sdo_rest_not_found(client, "URL is out of range\r\n");
+		return -1;
+	}
+
+	const struct canopen_eds* eds = co_master_find_eds(nodeid);
+	if (!eds) {
+		sdo_rest_server_error(client, "Could not find EDS for node\r\n");
+		return -1;
+	}
+
+	if (!http_req_query(&client->req, "with_value")) {
+		const struct sdo_rest_eds_doc* doc = sdo_rest__find_eds_doc(eds,
+			rest_is_accepted(&client->req, CBOR_CONTENT_TYPE));
+		if (doc) {
+			sdo_rest__send_eds_doc(client, doc);
+			return 0;
+		}
+	}
+
+	struct sdo_rest_eds_context* context =
+		sdo_rest__eds_context_new(client, eds, nodeid);
+	if (!context) {
+		sdo_rest_server_error(client, "Out of memory\r\n");
+		return -1;
+	}
+
+	rest_client_ref(client);
+
+	if (context->n_reads > 0 && sdo_rest__eds_read_next(context) == 0)
+		return 0;
+
+	sdo_rest__eds_print(context);
+	return 0;
 }
 
 void sdo_rest_service(struct rest_client* client, const void* content)
 {
+	if (client->req.url_index == 1) {
+		sdo_bulk_rest_service(client, content);
+		return;
+	}
+
 	if (client->req.url_index == 2 && client->req.method == HTTP_GET) {
 		sdo_rest__send_eds(client);
 		return;
@@ -646,6 +1106,15 @@ void sdo_rest_service(struct rest_client* client, const void* content)
 		return;
 	}
 
-	if (sdo_rest__process(context, content) < 0)
-		free(context);
+	sdo_rest__process(context, content);
+}
+
+void sdo_rest_cleanup(void)
+{
+	while (!SLIST_EMPTY(&sdo_rest__eds_docs)) {
+		struct sdo_rest_eds_doc* doc = SLIST_FIRST(&sdo_rest__eds_docs);
+		SLIST_REMOVE_HEAD(&sdo_rest__eds_docs, links);
+		free(doc->buffer);
+		free(doc);
+	}
 }
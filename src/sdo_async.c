@@ -18,6 +18,7 @@
  * Features:
  * - Converts between plain data buffers and SDO transactions.
  * - Chooses expediated/segmented mode based on data size.
+ * - Block transfers with CRC if a block size is set.
  * - Automatic timeout with abort.
  * - Enforces correct communication according to standard.
  * - Validates data according to state and aborts when receiving unexpected
@@ -33,6 +34,7 @@
 #include "canopen.h"
 #include "net-util.h"
 #include "sock.h"
+#include "time-utils.h"
 
 #define MIN(a, b) ((a) < (b)) ? (a) : (b);
 
@@ -47,6 +49,11 @@ static int sdo_async__send(struct sdo_async* self, struct can_frame* cf)
 	if (self->quirks & SDO_ASYNC_QUIRK_NEEDS_FULL_FRAME)
 		cf->can_dlc = CAN_MAX_DLC;
 
+	self->sent_at = fastclock_us();
+
+	if (self->send_fn)
+		return self->send_fn(self, cf);
+
 	return sock_send(&self->sock, cf, 0);
 }
 
@@ -89,7 +96,7 @@ static inline void sdo_async__init_frame(const struct sdo_async* self,
 					 struct can_frame* cf)
 {
 	sdo_clear_frame(cf);
-	cf->can_id = R_RSDO + self->nodeid;
+	cf->can_id = self->tx_cob_id;
 }
 
 static int sdo_async__abort(struct sdo_async* self, enum sdo_abort_code code)
@@ -124,6 +131,8 @@ int sdo_async_init(struct sdo_async* self, const struct sock* sock, int nodeid)
 
 	self->sock = *sock;
 	self->nodeid = nodeid;
+	self->tx_cob_id = R_RSDO + nodeid;
+	self->rx_cob_id = R_TSDO + nodeid;
 	mloop_timer_set_context(self->timer, self, NULL);
 	mloop_timer_set_callback(self->timer, sdo_async__on_timeout);
 
@@ -134,6 +143,11 @@ failure:
 	return -1;
 }
 
+void sdo_async_set_send_fn(struct sdo_async* self, sdo_async_send_fn fn)
+{
+	self->send_fn = fn;
+}
+
 void sdo_async_destroy(struct sdo_async* self)
 {
 	vector_destroy(&self->buffer);
@@ -163,6 +177,7 @@ int sdo_async__send_init_dl(struct sdo_async* self)
 		sdo_set_indicated_size(&cf, self->buffer.index);
 		cf.can_dlc = CAN_MAX_DLC;
 	}
+	self->comm_state = SDO_ASYNC_COMM_INIT_DL_RESPONSE;
 	mloop_timer_start(self->timer);
 	sdo_async__send(self, &cf);
 	return 0;
@@ -176,6 +191,55 @@ int sdo_async__send_init_ul(struct sdo_async* self)
 	sdo_set_index(&cf, self->index);
 	sdo_set_subindex(&cf, self->subindex);
 	cf.can_dlc = 4;
+	self->comm_state = SDO_ASYNC_COMM_INIT_UL_RESPONSE;
+	mloop_timer_start(self->timer);
+	sdo_async__send(self, &cf);
+	return 0;
+}
+
+static inline int sdo_async__wants_block(const struct sdo_async* self)
+{
+	if (self->block_size == 0)
+		return 0;
+
+	return self->type == SDO_REQ_UPLOAD
+	    || self->buffer.index > SDO_ASYNC_BLOCK_THRESHOLD;
+}
+
+int sdo_async__send_init_block_dl(struct sdo_async* self)
+{
+	struct can_frame cf;
+	sdo_async__init_frame(self, &cf);
+	sdo_set_cs(&cf, SDO_CCS_BLOCK_DL_REQ);
+	sdo_block_set_subcmd(&cf, SDO_BLOCK_INIT);
+	sdo_block_use_crc(&cf);
+	sdo_block_indicate_size(&cf);
+	sdo_set_index(&cf, self->index);
+	sdo_set_subindex(&cf, self->subindex);
+	sdo_set_indicated_size(&cf, self->buffer.index);
+	cf.can_dlc = CAN_MAX_DLC;
+	self->comm_state = SDO_ASYNC_COMM_INIT_BLOCK_DL_RESPONSE;
+	mloop_timer_start(self->timer);
+	sdo_async__send(self, &cf);
+	return 0;
+}
+
+int sdo_async__send_init_block_ul(struct sdo_async* self)
+{
+	self->blksize = self->block_size < SDO_BLOCK_SIZE_MAX
+		      ? self->block_size : SDO_BLOCK_SIZE_MAX;
+
+	struct can_frame cf;
+	sdo_async__init_frame(self, &cf);
+	sdo_set_cs(&cf, SDO_CCS_BLOCK_UL_REQ);
+	sdo_block_set_subcmd(&cf, SDO_BLOCK_INIT);
+	sdo_block_use_crc(&cf);
+	sdo_set_index(&cf, self->index);
+	sdo_set_subindex(&cf, self->subindex);
+	cf.data[SDO_BLOCK_SIZE_IDX] = self->blksize;
+	cf.data[SDO_BLOCK_PST_IDX] = SDO_ASYNC_BLOCK_THRESHOLD;
+	cf.can_dlc = SDO_BLOCK_PST_IDX + 1;
+	self->comm_state = SDO_ASYNC_COMM_INIT_BLOCK_UL_RESPONSE;
 	mloop_timer_start(self->timer);
 	sdo_async__send(self, &cf);
 	return 0;
@@ -184,8 +248,12 @@ int sdo_async__send_init_ul(struct sdo_async* self)
 int sdo_async__send_init(struct sdo_async* self)
 {
 	switch (self->type) {
-	case SDO_REQ_DOWNLOAD: return sdo_async__send_init_dl(self);
-	case SDO_REQ_UPLOAD: return sdo_async__send_init_ul(self);
+	case SDO_REQ_DOWNLOAD:
+		return self->is_block ? sdo_async__send_init_block_dl(self)
+				      : sdo_async__send_init_dl(self);
+	case SDO_REQ_UPLOAD:
+		return self->is_block ? sdo_async__send_init_block_ul(self)
+				      : sdo_async__send_init_ul(self);
 	}
 
 	abort();
@@ -207,6 +275,7 @@ int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info)
 	self->index = info->index;
 	self->subindex = info->subindex;
 	self->is_size_indicated = 0;
+	self->rtt = 0;
 	mloop_timer_set_time(self->timer, info->timeout * 1000000ULL);
 
 	if (info->type == SDO_REQ_DOWNLOAD)
@@ -214,7 +283,10 @@ int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info)
 	else
 		vector_clear(&self->buffer);
 
-	self->comm_state = SDO_ASYNC_COMM_INIT_RESPONSE;
+	self->is_block = sdo_async__wants_block(self);
+	self->use_crc = 0;
+	self->seqno = 0;
+	self->block_start = 0;
 
 	self->is_running = 1;
 
@@ -228,11 +300,17 @@ static inline int sdo_async__is_at_end(const struct sdo_async* self)
 	return self->pos >= self->buffer.index;
 }
 
+static void sdo_async__init_seg_template(struct sdo_async* self,
+					 enum sdo_ccs cs)
+{
+	sdo_async__init_frame(self, &self->seg_template);
+	sdo_set_cs(&self->seg_template, cs);
+	self->seg_template.can_dlc = 1;
+}
+
 int sdo_async__request_dl_segment(struct sdo_async* self)
 {
-	struct can_frame cf;
-	sdo_async__init_frame(self, &cf);
-	sdo_set_cs(&cf, SDO_CCS_DL_SEG_REQ);
+	struct can_frame cf = self->seg_template;
 	if (self->is_toggled) sdo_toggle(&cf);
 
 	size_t size = MIN(SDO_SEGMENT_MAX_SIZE, self->buffer.index - self->pos);
@@ -259,13 +337,9 @@ int sdo_async__feed_init_dl_response(struct sdo_async* self,
 	if (cf->can_dlc < 4)
 		return sdo_async__abort(self, SDO_ABORT_GENERAL);
 
-	int cs = sdo_get_cs(cf);
 	int index = sdo_get_index(cf);
 	int subindex = sdo_get_subindex(cf);
 
-	if (cs != SDO_SCS_DL_INIT_RES)
-		return sdo_async__abort(self, SDO_ABORT_INVALID_CS);
-
 	if (!(self->quirks & SDO_ASYNC_QUIRK_IGNORE_MULTIPLEXER))
 		if (index != self->index || subindex != self->subindex)
 			return sdo_async__abort(self, SDO_ABORT_GENERAL);
@@ -274,8 +348,9 @@ int sdo_async__feed_init_dl_response(struct sdo_async* self,
 		self->status = SDO_REQ_OK;
 		sdo_async__on_done(self);
 	} else {
+		sdo_async__init_seg_template(self, SDO_CCS_DL_SEG_REQ);
 		sdo_async__request_dl_segment(self);
-		self->comm_state = SDO_ASYNC_COMM_SEG_RESPONSE;
+		self->comm_state = SDO_ASYNC_COMM_DL_SEG_RESPONSE;
 	}
 
 	return 0;
@@ -298,11 +373,8 @@ int sdo_async__handle_expediated_ul(struct sdo_async* self,
 
 int sdo_async__request_ul_segment(struct sdo_async* self)
 {
-	struct can_frame cf;
-	sdo_async__init_frame(self, &cf);
-	sdo_set_cs(&cf, SDO_CCS_UL_SEG_REQ);
+	struct can_frame cf = self->seg_template;
 	if (self->is_toggled) sdo_toggle(&cf);
-	cf.can_dlc = 1;
 	mloop_timer_start(self->timer);
 	sdo_async__send(self, &cf);
 	return 0;
@@ -313,11 +385,13 @@ int sdo_async__handle_init_segmented_ul(struct sdo_async* self,
 {
 	self->is_size_indicated = sdo_is_size_indicated(cf);
 	if (self->is_size_indicated && cf->can_dlc == CAN_MAX_DLC)
-		if (vector_reserve(&self->buffer, sdo_get_indicated_size(cf)) < 0)
+		if (vector_reserve_exact(&self->buffer,
+					 sdo_get_indicated_size(cf)) < 0)
 			return sdo_async__abort(self, SDO_ABORT_NOMEM);
 
+	sdo_async__init_seg_template(self, SDO_CCS_UL_SEG_REQ);
 	sdo_async__request_ul_segment(self);
-	self->comm_state = SDO_ASYNC_COMM_SEG_RESPONSE;
+	self->comm_state = SDO_ASYNC_COMM_UL_SEG_RESPONSE;
 
 	return 0;
 }
@@ -328,13 +402,9 @@ int sdo_async__feed_init_ul_response(struct sdo_async* self,
 	if (cf->can_dlc < 4)
 		return sdo_async__abort(self, SDO_ABORT_GENERAL);
 
-	int cs = sdo_get_cs(cf);
 	int index = sdo_get_index(cf);
 	int subindex = sdo_get_subindex(cf);
 
-	if (cs != SDO_SCS_UL_INIT_RES)
-		return sdo_async__abort(self, SDO_ABORT_INVALID_CS);
-
 	if (!(self->quirks & SDO_ASYNC_QUIRK_IGNORE_MULTIPLEXER))
 		if (index != self->index || subindex != self->subindex)
 			return sdo_async__abort(self, SDO_ABORT_GENERAL);
@@ -344,27 +414,257 @@ int sdo_async__feed_init_ul_response(struct sdo_async* self,
 	     : sdo_async__handle_init_segmented_ul(self, cf);
 }
 
-int sdo_async__feed_init_response(struct sdo_async* self,
+/* Sends as many segments as the server is ready for, starting at pos */
+int sdo_async__send_dl_block(struct sdo_async* self)
+{
+	self->block_start = self->pos;
+
+	for (unsigned int seqno = 1; seqno <= self->blksize
+				     && !sdo_async__is_at_end(self); ++seqno) {
+		struct can_frame cf;
+		sdo_async__init_frame(self, &cf);
+
+		size_t size = MIN(SDO_SEGMENT_MAX_SIZE,
+				  self->buffer.index - self->pos);
+		memcpy(&cf.data[SDO_SEGMENT_IDX], self->buffer.data + self->pos,
+		       size);
+		self->pos += size;
+
+		sdo_block_set_seqno(&cf, seqno, sdo_async__is_at_end(self));
+		cf.can_dlc = CAN_MAX_DLC;
+
+		sdo_async__send(self, &cf);
+	}
+
+	mloop_timer_start(self->timer);
+	self->comm_state = SDO_ASYNC_COMM_BLOCK_ACK;
+
+	return 0;
+}
+
+int sdo_async__send_block_dl_end(struct sdo_async* self)
+{
+	struct can_frame cf;
+	sdo_async__init_frame(self, &cf);
+	sdo_set_cs(&cf, SDO_CCS_BLOCK_DL_REQ);
+	sdo_block_set_subcmd(&cf, SDO_BLOCK_END);
+	sdo_block_set_end_size(&cf, (self->buffer.index - 1)
+				    % SDO_SEGMENT_MAX_SIZE + 1);
+
+	if (self->use_crc)
+		sdo_block_set_crc(&cf, sdo_crc16(0, self->buffer.data,
+						 self->buffer.index));
+
+	cf.can_dlc = CAN_MAX_DLC;
+	mloop_timer_start(self->timer);
+	sdo_async__send(self, &cf);
+
+	self->comm_state = SDO_ASYNC_COMM_BLOCK_DL_END;
+
+	return 0;
+}
+
+int sdo_async__feed_init_block_dl_response(struct sdo_async* self,
+					   const struct can_frame* cf)
+{
+	if (cf->can_dlc < SDO_BLOCK_SIZE_IDX + 1)
+		return sdo_async__abort(self, SDO_ABORT_GENERAL);
+
+	if (sdo_block_get_subcmd(cf) != SDO_BLOCK_INIT)
+		return sdo_async__abort(self, SDO_ABORT_INVALID_CS);
+
+	if (!(self->quirks & SDO_ASYNC_QUIRK_IGNORE_MULTIPLEXER))
+		if (sdo_get_index(cf) != self->index
+		 || sdo_get_subindex(cf) != self->subindex)
+			return sdo_async__abort(self, SDO_ABORT_GENERAL);
+
+	unsigned int blksize = cf->data[SDO_BLOCK_SIZE_IDX];
+	if (blksize < 1 || blksize > SDO_BLOCK_SIZE_MAX)
+		return sdo_async__abort(self, SDO_ABORT_BLOCKSZ);
+
+	self->blksize = blksize;
+	self->use_crc = sdo_block_has_crc(cf);
+
+	return sdo_async__send_dl_block(self);
+}
+
+int sdo_async__send_block_ul_req(struct sdo_async* self,
+				 enum sdo_block_subcmd subcmd)
+{
+	struct can_frame cf;
+	sdo_async__init_frame(self, &cf);
+	sdo_set_cs(&cf, SDO_CCS_BLOCK_UL_REQ);
+	sdo_block_set_subcmd(&cf, subcmd);
+	cf.can_dlc = 1;
+
+	if (subcmd == SDO_BLOCK_ACK) {
+		cf.data[SDO_BLOCK_ACKSEQ_IDX] = self->seqno;
+		cf.data[SDO_BLOCK_NEXT_SIZE_IDX] = self->blksize;
+		cf.can_dlc = SDO_BLOCK_NEXT_SIZE_IDX + 1;
+	}
+
+	if (subcmd != SDO_BLOCK_END)
+		mloop_timer_start(self->timer);
+
+	return sdo_async__send(self, &cf);
+}
+
+/* The server may switch to a normal transfer for small objects */
+int sdo_async__feed_block_ul_refusal(struct sdo_async* self,
+				     const struct can_frame* cf)
+{
+	self->is_block = 0;
+	return sdo_async__feed_init_ul_response(self, cf);
+}
+
+int sdo_async__feed_init_block_ul_response(struct sdo_async* self,
+					   const struct can_frame* cf)
+{
+	if (cf->can_dlc < 4)
+		return sdo_async__abort(self, SDO_ABORT_GENERAL);
+
+	if (sdo_block_is_end(cf))
+		return sdo_async__abort(self, SDO_ABORT_INVALID_CS);
+
+	if (!(self->quirks & SDO_ASYNC_QUIRK_IGNORE_MULTIPLEXER))
+		if (sdo_get_index(cf) != self->index
+		 || sdo_get_subindex(cf) != self->subindex)
+			return sdo_async__abort(self, SDO_ABORT_GENERAL);
+
+	self->use_crc = sdo_block_has_crc(cf);
+	self->is_size_indicated = sdo_block_is_size_indicated(cf);
+	/* Segments are always full until the padding is dropped at the end */
+	if (self->is_size_indicated && cf->can_dlc == CAN_MAX_DLC) {
+		size_t size = sdo_get_indicated_size(cf);
+		size += SDO_SEGMENT_MAX_SIZE - 1;
+		size -= size % SDO_SEGMENT_MAX_SIZE;
+
+		if (vector_reserve_exact(&self->buffer, size) < 0)
+			return sdo_async__abort(self, SDO_ABORT_NOMEM);
+	}
+
+	self->seqno = 0;
+	self->comm_state = SDO_ASYNC_COMM_BLOCK_SEGMENT;
+
+	return sdo_async__send_block_ul_req(self, SDO_BLOCK_START);
+}
+
+/* The server acknowledges the segments that it received in order. Anything
+ * after that is sent again in the next block.
+ */
+int sdo_async__feed_block_ack(struct sdo_async* self,
+			      const struct can_frame* cf)
+{
+	if (cf->can_dlc < SDO_BLOCK_NEXT_SIZE_IDX + 1)
+		return sdo_async__abort(self, SDO_ABORT_GENERAL);
+
+	if (sdo_block_get_subcmd(cf) != SDO_BLOCK_ACK)
+		return sdo_async__abort(self, SDO_ABORT_INVALID_CS);
+
+	size_t n_sent = (self->pos - self->block_start
+			 + SDO_SEGMENT_MAX_SIZE - 1) / SDO_SEGMENT_MAX_SIZE;
+	size_t ackseq = cf->data[SDO_BLOCK_ACKSEQ_IDX];
+	if (ackseq > n_sent)
+		return sdo_async__abort(self, SDO_ABORT_SEQNR);
+
+	unsigned int blksize = cf->data[SDO_BLOCK_NEXT_SIZE_IDX];
+	if (blksize < 1 || blksize > SDO_BLOCK_SIZE_MAX)
+		return sdo_async__abort(self, SDO_ABORT_BLOCKSZ);
+
+	self->blksize = blksize;
+
+	if (ackseq < n_sent)
+		self->pos = self->block_start + ackseq * SDO_SEGMENT_MAX_SIZE;
+
+	return sdo_async__is_at_end(self)
+	     ? sdo_async__send_block_dl_end(self)
+	     : sdo_async__send_dl_block(self);
+}
+
+int sdo_async__feed_block_segment(struct sdo_async* self,
 				  const struct can_frame* cf)
 {
-	switch (self->type) {
-	case SDO_REQ_DOWNLOAD: return sdo_async__feed_init_dl_response(self, cf);
-	case SDO_REQ_UPLOAD: return sdo_async__feed_init_ul_response(self, cf);
+	if (cf->can_dlc < 1)
+		return sdo_async__abort(self, SDO_ABORT_GENERAL);
+
+	int seqno = sdo_block_get_seqno(cf);
+	int is_last = sdo_block_is_last_segment(cf);
+
+	/* Segments that are out of order are dropped and sent again */
+	if (seqno == self->seqno + 1) {
+		if (vector_append(&self->buffer, &cf->data[SDO_SEGMENT_IDX],
+				  SDO_SEGMENT_MAX_SIZE) < 0)
+			return sdo_async__abort(self, SDO_ABORT_NOMEM);
+
+		self->seqno = seqno;
+	} else {
+		is_last = 0;
 	}
 
-	abort();
-	return -1;
+	if (seqno < (int)self->blksize && !sdo_block_is_last_segment(cf)) {
+		mloop_timer_start(self->timer);
+		return 0;
+	}
+
+	sdo_async__send_block_ul_req(self, SDO_BLOCK_ACK);
+
+	self->seqno = 0;
+
+	if (is_last)
+		self->comm_state = SDO_ASYNC_COMM_BLOCK_UL_END;
+
+	return 0;
 }
 
-int sdo_async__feed_dl_seg_response(struct sdo_async* self,
-				    const struct can_frame* cf)
+int sdo_async__feed_block_ul_end(struct sdo_async* self,
+				 const struct can_frame* cf)
+{
+	if (cf->can_dlc < 1 || (self->use_crc && cf->can_dlc < 3))
+		return sdo_async__abort(self, SDO_ABORT_GENERAL);
+
+	if (!sdo_block_is_end(cf))
+		return sdo_async__abort(self, SDO_ABORT_INVALID_CS);
+
+	/* The last segment was padded to a full frame */
+	size_t padding = SDO_SEGMENT_MAX_SIZE - sdo_block_get_end_size(cf);
+	if (padding > self->buffer.index)
+		return sdo_async__abort(self, SDO_ABORT_GENERAL);
+
+	self->buffer.index -= padding;
+
+	if (self->use_crc && sdo_block_get_crc(cf)
+			  != sdo_crc16(0, self->buffer.data, self->buffer.index))
+		return sdo_async__abort(self, SDO_ABORT_CRCERR);
+
+	sdo_async__send_block_ul_req(self, SDO_BLOCK_END);
+
+	self->status = SDO_REQ_OK;
+	sdo_async__on_done(self);
+
+	return 0;
+}
+
+int sdo_async__feed_block_dl_end(struct sdo_async* self,
+				 const struct can_frame* cf)
 {
 	if (cf->can_dlc < 1)
 		return sdo_async__abort(self, SDO_ABORT_GENERAL);
 
-	if (sdo_get_cs(cf) != SDO_SCS_DL_SEG_RES)
+	if (sdo_block_get_subcmd(cf) != SDO_BLOCK_END)
 		return sdo_async__abort(self, SDO_ABORT_INVALID_CS);
 
+	self->status = SDO_REQ_OK;
+	sdo_async__on_done(self);
+
+	return 0;
+}
+
+int sdo_async__feed_dl_seg_response(struct sdo_async* self,
+				    const struct can_frame* cf)
+{
+	if (cf->can_dlc < 1)
+		return sdo_async__abort(self, SDO_ABORT_GENERAL);
+
 	if (!sdo_async__is_at_end(self)
 	 && sdo_is_toggled(cf) != self->is_toggled)
 		return sdo_async__abort(self, SDO_ABORT_TOGGLE);
@@ -387,9 +687,6 @@ int sdo_async__feed_ul_seg_response(struct sdo_async* self,
 	if (cf->can_dlc < 1)
 		return sdo_async__abort(self, SDO_ABORT_GENERAL);
 
-	if (sdo_get_cs(cf) != SDO_SCS_UL_SEG_RES)
-		return sdo_async__abort(self, SDO_ABORT_INVALID_CS);
-
 	if (!sdo_is_end_segment(cf) && sdo_is_toggled(cf) != self->is_toggled)
 		return sdo_async__abort(self, SDO_ABORT_TOGGLE);
 
@@ -411,44 +708,64 @@ int sdo_async__feed_ul_seg_response(struct sdo_async* self,
 	return 0;
 }
 
-int sdo_async__feed_seg_response(struct sdo_async* self,
-				 const struct can_frame* cf)
-{
-	switch (self->type) {
-	case SDO_REQ_DOWNLOAD: return sdo_async__feed_dl_seg_response(self, cf);
-	case SDO_REQ_UPLOAD: return sdo_async__feed_ul_seg_response(self, cf);
-	}
+typedef int (*sdo_async__feed_fn)(struct sdo_async*, const struct can_frame*);
 
-	abort();
-	return -1;
-}
+/* Expected server command specifiers for each state. Anything that is not
+ * listed here is answered with an abort.
+ */
+#define SDO_ASYNC__TRANSITIONS(X) \
+	X(INIT_DL_RESPONSE, SDO_SCS_DL_INIT_RES, feed_init_dl_response) \
+	X(INIT_UL_RESPONSE, SDO_SCS_UL_INIT_RES, feed_init_ul_response) \
+	X(INIT_BLOCK_DL_RESPONSE, SDO_SCS_BLOCK_DL_RES, \
+	  feed_init_block_dl_response) \
+	X(INIT_BLOCK_UL_RESPONSE, SDO_SCS_BLOCK_UL_RES, \
+	  feed_init_block_ul_response) \
+	X(INIT_BLOCK_UL_RESPONSE, SDO_SCS_UL_INIT_RES, feed_block_ul_refusal) \
+	X(DL_SEG_RESPONSE, SDO_SCS_DL_SEG_RES, feed_dl_seg_response) \
+	X(UL_SEG_RESPONSE, SDO_SCS_UL_SEG_RES, feed_ul_seg_response) \
+	X(BLOCK_ACK, SDO_SCS_BLOCK_DL_RES, feed_block_ack) \
+	X(BLOCK_DL_END, SDO_SCS_BLOCK_DL_RES, feed_block_dl_end) \
+	X(BLOCK_UL_END, SDO_SCS_BLOCK_UL_RES, feed_block_ul_end)
+
+#define SDO_ASYNC__TRANSITION(state, cs, fn) \
+	[SDO_ASYNC_COMM_ ## state][cs] = sdo_async__ ## fn,
+
+static const sdo_async__feed_fn
+sdo_async__transitions[SDO_ASYNC_N_COMM_STATES][SDO_CS_COUNT] = {
+	SDO_ASYNC__TRANSITIONS(SDO_ASYNC__TRANSITION)
+
+	/* Segments within a block have no command specifier */
+	[SDO_ASYNC_COMM_BLOCK_SEGMENT][0 ... SDO_CS_COUNT - 1] =
+		sdo_async__feed_block_segment,
+};
 
 int sdo_async_feed(struct sdo_async* self, const struct can_frame* cf)
 {
-	assert(cf->can_id == R_TSDO + self->nodeid);
+	assert(cf->can_id == self->rx_cob_id);
 
 	if (!self->is_running)
 		return -1;
 
 	mloop_timer_stop(self->timer);
 
-	if (sdo_get_cs(cf) == SDO_SCS_ABORT) {
+	self->rtt = fastclock_us() - self->sent_at;
+
+	int is_abort = self->comm_state == SDO_ASYNC_COMM_BLOCK_SEGMENT
+		     ? sdo_block_is_abort(cf)
+		     : sdo_get_cs(cf) == SDO_SCS_ABORT;
+
+	if (is_abort) {
 		self->status = SDO_REQ_REMOTE_ABORT;
 		self->abort_code = sdo_get_abort_code(cf);
 		sdo_async__on_done(self);
 		return 0;
 	}
 
-	switch (self->comm_state) {
-	case SDO_ASYNC_COMM_INIT_RESPONSE:
-		return sdo_async__feed_init_response(self, cf);
-	case SDO_ASYNC_COMM_SEG_RESPONSE:
-		return sdo_async__feed_seg_response(self, cf);
-	case SDO_ASYNC_COMM_START:
-		break;
-	}
+	assert(self->comm_state != SDO_ASYNC_COMM_START);
 
-	abort();
-	return -1;
+	sdo_async__feed_fn fn =
+		sdo_async__transitions[self->comm_state][sdo_get_cs(cf)];
+
+	return fn ? fn(self, cf) : sdo_async__abort(self, SDO_ABORT_INVALID_CS);
 }
 
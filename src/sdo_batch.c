@@ -0,0 +1,254 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "co_atomic.h"
+#include "canopen/sdo_req.h"
+#include "canopen/sdo_batch.h"
+
+void sdo_batch_init(struct sdo_batch* self, enum sdo_req_priority priority,
+		    enum sdo_batch_flags flags)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->ref = 1;
+	self->priority = priority;
+	self->flags = flags;
+}
+
+struct sdo_batch* sdo_batch_new(enum sdo_req_priority priority,
+				enum sdo_batch_flags flags)
+{
+	struct sdo_batch* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	sdo_batch_init(self, priority, flags);
+	return self;
+}
+
+static void sdo_batch_free(struct sdo_batch* self)
+{
+	if (self->context && self->context_free_fn)
+		self->context_free_fn(self->context);
+
+	for (size_t i = 0; i < self->n_items; ++i)
+		vector_destroy(&self->items[i].data);
+
+	free(self->items);
+	free(self);
+}
+
+ARC_GENERATE(sdo_batch, sdo_batch_free)
+
+static struct sdo_batch_item* sdo_batch__add(struct sdo_batch* self,
+					     enum sdo_req_type type,
+					     int index, int subindex)
+{
+	if (self->is_started)
+		return NULL;
+
+	struct sdo_batch_item* items =
+		realloc(self->items, (self->n_items + 1) * sizeof(*items));
+	if (!items)
+		return NULL;
+
+	self->items = items;
+
+	struct sdo_batch_item* item = &items[self->n_items++];
+	memset(item, 0, sizeof(*item));
+
+	item->type = type;
+	item->index = index;
+	item->subindex = subindex;
+
+	return item;
+}
+
+int sdo_batch_add_upload(struct sdo_batch* self, int index, int subindex)
+{
+	return sdo_batch__add(self, SDO_REQ_UPLOAD, index, subindex) ? 0 : -1;
+}
+
+int sdo_batch_add_download(struct sdo_batch* self, int index, int subindex,
+			   const void* data, size_t size)
+{
+	struct sdo_batch_item* item =
+		sdo_batch__add(self, SDO_REQ_DOWNLOAD, index, subindex);
+	if (!item)
+		return -1;
+
+	if (vector_assign(&item->data, data, size) < 0) {
+		--self->n_items;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Items that have not been started are cancelled. The caller holds the lock
+ * of the queue, so the requests of the items can not go away underneath.
+ */
+static void sdo_batch__cancel_queued(struct sdo_batch* self)
+{
+	for (size_t i = 0; i < self->n_items; ++i) {
+		struct sdo_batch_item* item = &self->items[i];
+		if (item->req)
+			sdo_req_queue_cancel(self->queue, item->req);
+	}
+}
+
+static void sdo_batch__on_req_done(struct sdo_req* req)
+{
+	struct sdo_batch_item* item = req->context;
+	struct sdo_batch* self = item->parent;
+
+	item->abort_code = req->abort_code;
+	item->is_size_indicated = req->is_size_indicated;
+
+	enum sdo_req_status status = req->status;
+
+	if (req->type == SDO_REQ_UPLOAD && status == SDO_REQ_OK)
+		if (vector_assign(&item->data, req->data.data,
+				  req->data.index) < 0)
+			status = SDO_REQ_NOMEM;
+
+	item->status = status;
+
+	if (status != SDO_REQ_OK && (self->flags & SDO_BATCH_STOP_ON_ERROR)) {
+		sdo_req_queue__lock(self->queue);
+		sdo_batch__cancel_queued(self);
+		sdo_req_queue__unlock(self->queue);
+	}
+}
+
+/* Called when the request of an item is freed, whether it ran or not */
+static void sdo_batch__on_req_free(void* context)
+{
+	struct sdo_batch_item* item = context;
+	struct sdo_batch* self = item->parent;
+
+	sdo_req_queue__lock(self->queue);
+	item->req = NULL;
+	sdo_req_queue__unlock(self->queue);
+
+	if (item->status == SDO_REQ_PENDING)
+		item->status = SDO_REQ_CANCELLED;
+
+	if (co_atomic_sub_fetch(&self->n_pending, 1) != 0)
+		return;
+
+	sdo_batch_fn on_done = self->on_done;
+	if (on_done)
+		on_done(self);
+
+	co_atomic_store(&self->is_done, 1);
+	sdo_batch_unref(self);
+}
+
+static struct sdo_req* sdo_batch__new_req(struct sdo_batch* self,
+					  struct sdo_batch_item* item)
+{
+	struct sdo_req_info info = {
+		.type = item->type,
+		.priority = self->priority,
+		.index = item->index,
+		.subindex = item->subindex,
+		.on_done = sdo_batch__on_req_done,
+		.dl_data = item->data.data,
+		.dl_size = item->data.index,
+		.context = item,
+	};
+
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req)
+		return NULL;
+
+	req->context_free_fn = sdo_batch__on_req_free;
+	return req;
+}
+
+int sdo_batch_start(struct sdo_batch* self, struct sdo_req_queue* queue)
+{
+	size_t i;
+
+	if (!queue || self->is_started || self->n_items == 0)
+		return -1;
+
+	for (i = 0; i < self->n_items; ++i) {
+		struct sdo_batch_item* item = &self->items[i];
+
+		item->parent = self;
+		item->status = SDO_REQ_PENDING;
+
+		item->req = sdo_batch__new_req(self, item);
+		if (!item->req)
+			goto failure;
+	}
+
+	sdo_req_queue__lock(queue);
+
+	if (queue->is_lost || queue->limit - queue->size < self->n_items) {
+		sdo_req_queue__unlock(queue);
+		goto failure;
+	}
+
+	self->queue = queue;
+	self->is_started = 1;
+	self->n_pending = self->n_items;
+	sdo_batch_ref(self);
+
+	/* There is room for all of them, so none of them can fail. The queue
+	 * takes over the requests and they come back through
+	 * sdo_batch__on_req_free().
+	 */
+	for (i = 0; i < self->n_items; ++i) {
+		struct sdo_req* req = self->items[i].req;
+		sdo_req_start(req, queue);
+		sdo_req_unref(req);
+	}
+
+	sdo_req_queue__unlock(queue);
+	return 0;
+
+failure:
+	while (i-- > 0) {
+		struct sdo_req* req = self->items[i].req;
+		self->items[i].req = NULL;
+		req->context_free_fn = NULL;
+		sdo_req_unref(req);
+	}
+
+	return -1;
+}
+
+void sdo_batch_wait(struct sdo_batch* self)
+{
+	while (!co_atomic_load(&self->is_done))
+		usleep(100);
+}
+
+enum sdo_req_status sdo_batch_get_status(const struct sdo_batch* self)
+{
+	for (size_t i = 0; i < self->n_items; ++i)
+		if (self->items[i].status != SDO_REQ_OK)
+			return self->items[i].status;
+
+	return SDO_REQ_OK;
+}
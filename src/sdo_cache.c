@@ -0,0 +1,149 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "sys/tree.h"
+#include "canopen/sdo_cache.h"
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+struct sdo_cache__entry {
+	RB_ENTRY(sdo_cache__entry) rb_entry;
+	uint32_t key;
+	int is_size_indicated;
+	size_t size;
+	char data[0];
+};
+
+RB_HEAD(sdo_cache__tree, sdo_cache__entry);
+
+static inline int sdo_cache__cmp(const struct sdo_cache__entry* e1,
+				 const struct sdo_cache__entry* e2)
+{
+	return e1->key < e2->key ? -1 : e1->key > e2->key;
+}
+
+RB_GENERATE_STATIC(sdo_cache__tree, sdo_cache__entry, rb_entry,
+		   sdo_cache__cmp);
+
+static struct sdo_cache__tree sdo_cache__entries = RB_INITIALIZER(NULL);
+static pthread_mutex_t sdo_cache__mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint32_t sdo_cache__key(int nodeid, int index, int subindex)
+{
+	return (uint32_t)nodeid << 24 | (uint32_t)index << 8 | subindex;
+}
+
+static struct sdo_cache__entry* sdo_cache__find(uint32_t key)
+{
+	struct sdo_cache__entry needle = { .key = key };
+	return RB_FIND(sdo_cache__tree, &sdo_cache__entries, &needle);
+}
+
+int sdo_cache_put(int nodeid, int index, int subindex, const void* data,
+		  size_t size, int is_size_indicated)
+{
+	struct sdo_cache__entry* entry = malloc(sizeof(*entry) + size);
+	if (!entry)
+		return -1;
+
+	entry->key = sdo_cache__key(nodeid, index, subindex);
+	entry->is_size_indicated = is_size_indicated;
+	entry->size = size;
+	memcpy(entry->data, data, size);
+
+	pthread_mutex_lock(&sdo_cache__mutex);
+
+	struct sdo_cache__entry* old = sdo_cache__find(entry->key);
+	if (old)
+		RB_REMOVE(sdo_cache__tree, &sdo_cache__entries, old);
+
+	RB_INSERT(sdo_cache__tree, &sdo_cache__entries, entry);
+
+	pthread_mutex_unlock(&sdo_cache__mutex);
+
+	free(old);
+	return 0;
+}
+
+ssize_t sdo_cache_get(int nodeid, int index, int subindex, void* dst,
+		      size_t size, int* is_size_indicated)
+{
+	ssize_t rc = -1;
+
+	pthread_mutex_lock(&sdo_cache__mutex);
+
+	struct sdo_cache__entry* entry =
+		sdo_cache__find(sdo_cache__key(nodeid, index, subindex));
+	if (!entry)
+		goto done;
+
+	memcpy(dst, entry->data, MIN(size, entry->size));
+
+	if (is_size_indicated)
+		*is_size_indicated = entry->is_size_indicated;
+
+	rc = entry->size;
+done:
+	pthread_mutex_unlock(&sdo_cache__mutex);
+	return rc;
+}
+
+void sdo_cache_invalidate_node(int nodeid)
+{
+	struct sdo_cache__entry needle = {
+		.key = sdo_cache__key(nodeid, 0, 0)
+	};
+
+	pthread_mutex_lock(&sdo_cache__mutex);
+
+	struct sdo_cache__entry* entry =
+		RB_NFIND(sdo_cache__tree, &sdo_cache__entries, &needle);
+
+	while (entry && entry->key >> 24 == (uint32_t)nodeid) {
+		struct sdo_cache__entry* next =
+			RB_NEXT(sdo_cache__tree, &sdo_cache__entries, entry);
+
+		RB_REMOVE(sdo_cache__tree, &sdo_cache__entries, entry);
+		free(entry);
+
+		entry = next;
+	}
+
+	pthread_mutex_unlock(&sdo_cache__mutex);
+}
+
+void sdo_cache_clear(void)
+{
+	pthread_mutex_lock(&sdo_cache__mutex);
+
+	while (!RB_EMPTY(&sdo_cache__entries)) {
+		struct sdo_cache__entry* entry =
+			RB_MIN(sdo_cache__tree, &sdo_cache__entries);
+		RB_REMOVE(sdo_cache__tree, &sdo_cache__entries, entry);
+		free(entry);
+	}
+
+	pthread_mutex_unlock(&sdo_cache__mutex);
+}
@@ -31,6 +31,20 @@ void sdo_abort(struct can_frame* frame, enum sdo_abort_code code, int index,
 	frame->can_dlc = CAN_MAX_DLC;
 }
 
+uint16_t sdo_crc16(uint16_t crc, const void* data, size_t size)
+{
+	const uint8_t* bytes = data;
+
+	for (size_t i = 0; i < size; ++i) {
+		crc ^= (uint16_t)bytes[i] << 8;
+
+		for (int j = 0; j < 8; ++j)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
 const char* sdo_strerror(enum sdo_abort_code code)
 {
 	switch (code) {
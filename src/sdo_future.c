@@ -0,0 +1,325 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <pthread.h>
+#include <mloop.h>
+
+#include "co_atomic.h"
+#include "canopen/sdo_req.h"
+#include "canopen/sdo_batch.h"
+#include "canopen/sdo_future.h"
+
+struct sdo_future {
+	int ref;
+	pthread_mutex_t mutex;
+
+	struct sdo_batch* batch;
+	struct sdo_future** children;
+	size_t n_children;
+
+	/* A future that is not done holds a reference to itself */
+	size_t n_pending;
+	struct sdo_future* parent;
+	int is_done;
+
+	sdo_future_fn fn;
+	void* context;
+	sdo_future_free_fn context_free_fn;
+};
+
+static void sdo_future_free(struct sdo_future* self)
+{
+	if (self->context && self->context_free_fn)
+		self->context_free_fn(self->context);
+
+	for (size_t i = 0; i < self->n_children; ++i)
+		sdo_future_unref(self->children[i]);
+
+	free(self->children);
+
+	if (self->batch)
+		sdo_batch_unref(self->batch);
+
+	pthread_mutex_destroy(&self->mutex);
+	free(self);
+}
+
+ARC_GENERATE(sdo_future, sdo_future_free)
+
+static struct sdo_future* sdo_future__new(void)
+{
+	struct sdo_future* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+
+	self->ref = 1;
+	pthread_mutex_init(&self->mutex, NULL);
+
+	return self;
+}
+
+static void sdo_future__unref_context(void* ptr)
+{
+	sdo_future_unref(ptr);
+}
+
+static void sdo_future__run_continuation(struct mloop_async* async)
+{
+	struct sdo_future* self = mloop_async_get_context(async);
+	self->fn(self);
+}
+
+static int sdo_future__schedule(struct sdo_future* self)
+{
+	struct mloop_async* async = mloop_async_new(mloop_default());
+	if (!async)
+		return -1;
+
+	sdo_future_ref(self);
+	mloop_async_set_context(async, self, sdo_future__unref_context);
+	mloop_async_set_callback(async, sdo_future__run_continuation);
+
+	int rc = mloop_async_start(async);
+	mloop_async_unref(async);
+	return rc;
+}
+
+static void sdo_future__child_done(struct sdo_future* self);
+
+static void sdo_future__complete(struct sdo_future* self)
+{
+	pthread_mutex_lock(&self->mutex);
+	co_atomic_store(&self->is_done, 1);
+	struct sdo_future* parent = self->parent;
+	int has_continuation = self->fn != NULL;
+	pthread_mutex_unlock(&self->mutex);
+
+	if (has_continuation)
+		sdo_future__schedule(self);
+
+	if (parent)
+		sdo_future__child_done(parent);
+
+	sdo_future_unref(self);
+}
+
+static void sdo_future__child_done(struct sdo_future* self)
+{
+	if (co_atomic_sub_fetch(&self->n_pending, 1) == 0)
+		sdo_future__complete(self);
+}
+
+static void sdo_future__on_batch_done(struct sdo_batch* batch)
+{
+	sdo_future__complete(batch->context);
+}
+
+struct sdo_future* sdo_future_start(struct sdo_batch* batch,
+				    struct sdo_req_queue* queue)
+{
+	struct sdo_future* self = sdo_future__new();
+	if (!self)
+		return NULL;
+
+	sdo_batch_ref(batch);
+	self->batch = batch;
+
+	batch->on_done = sdo_future__on_batch_done;
+	batch->context = self;
+	batch->context_free_fn = NULL;
+
+	sdo_future_ref(self);
+
+	if (sdo_batch_start(batch, queue) < 0)
+		goto failure;
+
+	return self;
+
+failure:
+	batch->on_done = NULL;
+	batch->context = NULL;
+	sdo_future_unref(self);
+	sdo_future_unref(self);
+	return NULL;
+}
+
+static struct sdo_future* sdo_future__start_one(struct sdo_batch* batch,
+						struct sdo_req_queue* queue)
+{
+	struct sdo_future* self = sdo_future_start(batch, queue);
+	sdo_batch_unref(batch);
+	return self;
+}
+
+struct sdo_future* sdo_future_read(struct sdo_req_queue* queue,
+				   enum sdo_req_priority priority,
+				   int index, int subindex)
+{
+	struct sdo_batch* batch = sdo_batch_new(priority, 0);
+	if (!batch)
+		return NULL;
+
+	if (sdo_batch_add_upload(batch, index, subindex) < 0) {
+		sdo_batch_unref(batch);
+		return NULL;
+	}
+
+	return sdo_future__start_one(batch, queue);
+}
+
+struct sdo_future* sdo_future_write(struct sdo_req_queue* queue,
+				    enum sdo_req_priority priority,
+				    int index, int subindex,
+				    const void* data, size_t size)
+{
+	struct sdo_batch* batch = sdo_batch_new(priority, 0);
+	if (!batch)
+		return NULL;
+
+	if (sdo_batch_add_download(batch, index, subindex, data, size) < 0) {
+		sdo_batch_unref(batch);
+		return NULL;
+	}
+
+	return sdo_future__start_one(batch, queue);
+}
+
+struct sdo_future* sdo_future_when_all(struct sdo_future* const* futures,
+				       size_t n)
+{
+	struct sdo_future* self = sdo_future__new();
+	if (!self)
+		return NULL;
+
+	self->children = malloc(n * sizeof(*self->children));
+	if (n && !self->children) {
+		sdo_future_unref(self);
+		return NULL;
+	}
+
+	/* One extra so that it can not be done before all are linked */
+	self->n_pending = n + 1;
+	sdo_future_ref(self);
+
+	for (size_t i = 0; i < n; ++i) {
+		struct sdo_future* child = futures[i];
+		sdo_future_ref(child);
+		self->children[self->n_children++] = child;
+
+		pthread_mutex_lock(&child->mutex);
+		int is_done = child->is_done;
+		if (!is_done) {
+			assert(!child->parent);
+			child->parent = self;
+		}
+		pthread_mutex_unlock(&child->mutex);
+
+		if (is_done)
+			sdo_future__child_done(self);
+	}
+
+	sdo_future__child_done(self);
+	return self;
+}
+
+int sdo_future_then(struct sdo_future* self, sdo_future_fn fn, void* context,
+		    sdo_future_free_fn free_fn)
+{
+	pthread_mutex_lock(&self->mutex);
+
+	if (self->fn) {
+		pthread_mutex_unlock(&self->mutex);
+		return -1;
+	}
+
+	self->fn = fn;
+	self->context = context;
+	self->context_free_fn = free_fn;
+	int is_done = self->is_done;
+
+	pthread_mutex_unlock(&self->mutex);
+
+	return is_done ? sdo_future__schedule(self) : 0;
+}
+
+void* sdo_future_get_context(const struct sdo_future* self)
+{
+	return self->context;
+}
+
+void sdo_future_wait(struct sdo_future* self)
+{
+	while (!sdo_future_is_done(self))
+		usleep(100);
+}
+
+int sdo_future_is_done(const struct sdo_future* self)
+{
+	return co_atomic_load(&self->is_done);
+}
+
+enum sdo_req_status sdo_future_get_status(const struct sdo_future* self)
+{
+	if (!sdo_future_is_done(self))
+		return SDO_REQ_PENDING;
+
+	if (self->batch)
+		return sdo_batch_get_status(self->batch);
+
+	for (size_t i = 0; i < self->n_children; ++i) {
+		enum sdo_req_status status =
+			sdo_future_get_status(self->children[i]);
+		if (status != SDO_REQ_OK)
+			return status;
+	}
+
+	return SDO_REQ_OK;
+}
+
+const struct sdo_batch* sdo_future_get_batch(const struct sdo_future* self)
+{
+	return self->batch;
+}
+
+const void* sdo_future_get_data(const struct sdo_future* self, size_t* size)
+{
+	const struct sdo_batch_item* item =
+		self->batch ? sdo_batch_get_item(self->batch, 0) : NULL;
+
+	if (!item || item->status != SDO_REQ_OK)
+		return NULL;
+
+	if (size)
+		*size = item->data.index;
+
+	return item->data.data;
+}
+
+size_t sdo_future_get_child_count(const struct sdo_future* self)
+{
+	return self->n_children;
+}
+
+struct sdo_future* sdo_future_get_child(const struct sdo_future* self,
+					size_t i)
+{
+	return i < self->n_children ? self->children[i] : NULL;
+}
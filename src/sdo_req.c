@@ -20,9 +20,24 @@
  * When an SDO is requested, a request object is returned that can be used to
  * monitor the status and/or cancel the request. A request can be made to any
  * node with id between 1 and 127. Multiple requests can be made to the same
- * node at the same time. They will be queued up in FIFO order.
+ * node at the same time. They will be queued up in FIFO order for each
+ * priority, and higher priorities go first. Requests that have been passed
+ * over SDO_REQ_AGING_LIMIT times go before everything else, so that
+ * background requests can not be starved.
  *
- * There are 127 queues available; one for each possible node.
+ * An upload of an object that is already being uploaded, or queued for upload,
+ * does not go on the bus. It waits for the other upload and gets a copy of its
+ * result. This does not happen while a download is queued, as the new upload
+ * might be meant to see the effect of that download. Waiting uploads do not
+ * count towards the queue limit.
+ *
+ * There are 127 queues available; one for each possible node. A queue is
+ * marked as ready when a request is added to it or when one of its requests
+ * finishes, and only ready queues are serviced by the main loop.
+ *
+ * Each queue has at least one client channel on the default SDO COB-IDs.
+ * Nodes with more SDO servers can be given additional channels so that
+ * uploads can run side by side.
  *
  * A request can be handled in either a synchronous or asynchronous manner, by
  * either waiting for it to finish using sdo_req_wait() or registering an
@@ -30,6 +45,7 @@
  */
 #include <assert.h>
 #include <pthread.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include "vector.h"
 #include "sys/queue.h"
@@ -37,43 +53,98 @@
 #include "canopen/sdo_async.h"
 #include "canopen/sdo_req.h"
 #include "sock.h"
+#include "co_atomic.h"
+#include "objpool.h"
 
-#define SDO_REQ_TIMEOUT 1000 /* ms */
 #define SDO_REQ_ASYNC_PRIO 1000
 
-#define SDO_BUFFER_INITIAL_SIZE 8
+/* Queues are created when a node is first used, so that a master on a
+ * sparse bus does not pay for a buffer and timer per possible node id.
+ * Index 0 is unused.
+ */
+static struct sdo_req_queue* sdo_req__queues[128];
+static pthread_mutex_t sdo_req__queues_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Settings for queues that are yet to be created */
+static struct sock sdo_req__sock;
+static size_t sdo_req__limit;
+static enum sdo_async_quirks_flags sdo_req__quirks;
+static sdo_async_send_fn sdo_req__send_fn = NULL;
+
+/* One bit per queue that may have a request to start */
+static uint64_t sdo_req__ready[2];
 
-/* Index 0 is unused */
-static struct sdo_req_queue sdo_req__queues[128];
+/* Requests of this priority and lower are not started */
+#define SDO_REQ__NOT_HELD (SDO_REQ_PRIO_COUNT + 1)
+static int sdo_req__held_from = SDO_REQ__NOT_HELD;
+
+static struct mloop_idle* sdo_req__idle = NULL;
+
+static struct objpool sdo_req__pool = OBJPOOL_INITIALIZER(struct sdo_req);
+
+int sdo_req_set_data(struct sdo_req* self, const void* data, size_t size)
+{
+	if (!self->data.data || self->data.data == self->inline_data) {
+		if (size <= sizeof(self->inline_data)) {
+			self->data.data = self->inline_data;
+			self->data.size = sizeof(self->inline_data);
+			memcpy(self->inline_data, data, size);
+			self->data.index = size;
+			return 0;
+		}
+
+		memset(&self->data, 0, sizeof(self->data));
+	}
+
+	return vector_assign(&self->data, data, size);
+}
+
+/* Small payloads are copied inline. Larger ones are taken over without
+ * copying and src gets the previous storage of the request, if it had any.
+ */
+static int sdo_req__take_data(struct sdo_req* self, struct vector* src)
+{
+	if (src->index <= sizeof(self->inline_data))
+		return sdo_req_set_data(self, src->data, src->index);
+
+	if (self->data.data == self->inline_data)
+		memset(&self->data, 0, sizeof(self->data));
+
+	vector_swap(&self->data, src);
+	vector_clear(src);
+	return 0;
+}
 
 struct sdo_req* sdo_req_new(struct sdo_req_info* info)
 {
-	struct sdo_req* self = malloc(sizeof(*self));
+	struct sdo_req* self = objpool_alloc(&sdo_req__pool);
 	if (!self)
 		return NULL;
 
 	memset(self, 0, sizeof(*self));
 
+	self->pool = &sdo_req__pool;
 	self->ref = 1;
+	TAILQ_INIT(&self->waiters);
 	self->type = info->type;
+	self->priority = info->priority;
 	self->index = info->index;
 	self->subindex = info->subindex;
 	self->on_done = info->on_done;
 	self->context = info->context;
 
 	if (info->type == SDO_REQ_DOWNLOAD) {
-		if (vector_assign(&self->data, info->dl_data,
-				  info->dl_size) < 0)
+		if (sdo_req_set_data(self, info->dl_data, info->dl_size) < 0)
 			goto failure;
 	} else {
-		if (vector_init(&self->data, SDO_BUFFER_INITIAL_SIZE) < 0)
-			goto failure;
+		self->data.data = self->inline_data;
+		self->data.size = sizeof(self->inline_data);
 	}
 
 	return self;
 
 failure:
-	free(self);
+	objpool_free(&sdo_req__pool, self);
 	return NULL;
 }
 
@@ -82,13 +153,19 @@ void sdo_req_free(struct sdo_req* self)
 	if (self->context && self->context_free_fn)
 		self->context_free_fn(self->context);
 
-	vector_destroy(&self->data);
-	free(self);
+	if (self->data.data != self->inline_data)
+		vector_destroy(&self->data);
+
+	if (self->pool)
+		objpool_free(self->pool, self);
+	else
+		free(self);
 }
 
 ARC_GENERATE(sdo_req, sdo_req_free)
 
-void sdo_req__process_queue(struct mloop_idle* idle);
+void sdo_req__process_queue(struct sdo_req_queue* queue);
+void sdo_req__process_ready(struct mloop_idle* idle);
 int sdo_req__have_req(struct mloop_idle* idle);
 
 int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
@@ -100,19 +177,15 @@ int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 	if (sdo_async_init(&self->sdo_client, sock, nodeid) < 0)
 		return -1;
 
-	self->idle = mloop_idle_new(mloop_default());
-	if (!self->idle)
-		goto failure;
-
-	mloop_idle_set_idle_fn(self->idle, sdo_req__process_queue);
-	mloop_idle_set_cond_fn(self->idle, sdo_req__have_req);
-	mloop_idle_set_context(self->idle, self, NULL);
-	mloop_idle_start(self->idle);
-
 	self->sdo_client.quirks = quirks;
 
+	self->channel[0] = &self->sdo_client;
+	self->n_channels = 1;
+
 	self->limit = limit;
 	self->nodeid = nodeid;
+	self->timeout_min = SDO_REQ_TIMEOUT_MIN;
+	self->timeout_max = SDO_REQ_TIMEOUT_MAX;
 
 	pthread_mutexattr_t attr;
 	pthread_mutexattr_init(&attr);
@@ -120,29 +193,52 @@ int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 	pthread_mutex_init(&self->mutex, &attr);
 	pthread_mutexattr_destroy(&attr);
 
-	TAILQ_INIT(&self->list);
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i)
+		TAILQ_INIT(&self->list[i]);
 
 	return 0;
+}
 
-failure:
-	sdo_async_destroy(&self->sdo_client);
-	return -1;
+static inline struct sdo_req_list*
+sdo_req_queue__list(struct sdo_req_queue* self, const struct sdo_req* req)
+{
+	enum sdo_req_priority priority = req->priority ? req->priority
+						       : SDO_REQ_PRIO_DRIVER;
+	assert(priority <= SDO_REQ_PRIO_COUNT);
+	return &self->list[priority - 1];
 }
 
+static void sdo_req__finish_waiters(struct sdo_req* self, int call_on_done);
+
 void sdo_req__queue_clear(struct sdo_req_queue* self)
 {
-	while (!TAILQ_EMPTY(&self->list)) {
-		struct sdo_req* req = TAILQ_FIRST(&self->list);
-		TAILQ_REMOVE(&self->list, req, links);
-		req->status = SDO_REQ_CANCELLED;
-		sdo_req_unref(req);
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i) {
+		struct sdo_req_list* list = &self->list[i];
+
+		while (!TAILQ_EMPTY(list)) {
+			struct sdo_req* req = TAILQ_FIRST(list);
+			TAILQ_REMOVE(list, req, links);
+			req->status = SDO_REQ_CANCELLED;
+			sdo_req__finish_waiters(req, 0);
+			sdo_req_unref(req);
+		}
 	}
 	self->size = 0;
 }
 
+static void sdo_req_queue__remove_channels(struct sdo_req_queue* self)
+{
+	while (self->n_channels > 1) {
+		struct sdo_async* channel = self->channel[--self->n_channels];
+		sdo_async_stop(channel);
+		sdo_async_destroy(channel);
+		free(channel);
+	}
+}
+
 void sdo_req__queue_destroy(struct sdo_req_queue* self)
 {
-	mloop_idle_unref(self->idle);
+	sdo_req_queue__remove_channels(self);
 	sdo_async_destroy(&self->sdo_client);
 	sdo_req__queue_clear(self);
 	pthread_mutex_destroy(&self->mutex);
@@ -151,32 +247,97 @@ void sdo_req__queue_destroy(struct sdo_req_queue* self)
 int sdo_req_queues_init(const struct sock* sock, size_t limit,
 			enum sdo_async_quirks_flags quirks)
 {
-	size_t i;
+	memset(sdo_req__ready, 0, sizeof(sdo_req__ready));
+	co_atomic_store(&sdo_req__held_from, SDO_REQ__NOT_HELD);
 
-	for (i = 1; i < 128; ++i)
-		if (sdo_req__queue_init(&sdo_req__queues[i], sock, i, limit,
-					quirks) < 0)
-			goto failure;
+	sdo_req__idle = mloop_idle_new(mloop_default());
+	if (!sdo_req__idle)
+		return -1;
 
-	return 0;
+	mloop_idle_set_idle_fn(sdo_req__idle, sdo_req__process_ready);
+	mloop_idle_set_cond_fn(sdo_req__idle, sdo_req__have_req);
 
-failure:
-	for (--i; i > 0; --i)
-		sdo_req__queue_destroy(&sdo_req__queues[i]);
-	return -1;
+	sdo_req__sock = *sock;
+	sdo_req__limit = limit;
+	sdo_req__quirks = quirks;
+
+	mloop_idle_start(sdo_req__idle);
+
+	return 0;
 }
 
 void sdo_req_queues_cleanup()
 {
-	size_t i;
-	for (i = 1; i < 128; ++i)
-		sdo_req__queue_destroy(&sdo_req__queues[i]);
+	mloop_idle_unref(sdo_req__idle);
+	sdo_req__idle = NULL;
+
+	for (size_t i = 1; i < 128; ++i) {
+		struct sdo_req_queue* queue = sdo_req__queues[i];
+		if (!queue)
+			continue;
+
+		sdo_req__queue_destroy(queue);
+		free(queue);
+		sdo_req__queues[i] = NULL;
+	}
+
+	sdo_req__send_fn = NULL;
 }
 
-struct sdo_req_queue* sdo_req_queue_get(int nodeid)
+void sdo_req_queues_set_send_fn(sdo_async_send_fn fn)
+{
+	pthread_mutex_lock(&sdo_req__queues_mutex);
+
+	sdo_req__send_fn = fn;
+
+	for (size_t i = 1; i < 128; ++i)
+		if (sdo_req__queues[i])
+			sdo_req__queues[i]->sdo_client.send_fn = fn;
+
+	pthread_mutex_unlock(&sdo_req__queues_mutex);
+}
+
+static struct sdo_req_queue* sdo_req__queue_new(int nodeid)
+{
+	struct sdo_req_queue* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	if (sdo_req__queue_init(self, &sdo_req__sock, nodeid, sdo_req__limit,
+				sdo_req__quirks) < 0) {
+		free(self);
+		return NULL;
+	}
+
+	self->sdo_client.send_fn = sdo_req__send_fn;
+
+	return self;
+}
+
+struct sdo_req_queue* sdo_req_queue_find(int nodeid)
 {
 	assert(1 <= nodeid && nodeid <= 127);
-	return &sdo_req__queues[nodeid];
+	return co_atomic_load(&sdo_req__queues[nodeid]);
+}
+
+struct sdo_req_queue* sdo_req_queue_get(int nodeid)
+{
+	struct sdo_req_queue* queue = sdo_req_queue_find(nodeid);
+	if (queue)
+		return queue;
+
+	pthread_mutex_lock(&sdo_req__queues_mutex);
+
+	queue = sdo_req__queues[nodeid];
+	if (!queue) {
+		queue = sdo_req__queue_new(nodeid);
+		if (queue)
+			co_atomic_store(&sdo_req__queues[nodeid], queue);
+	}
+
+	pthread_mutex_unlock(&sdo_req__queues_mutex);
+
+	return queue;
 }
 
 void sdo_req_queue__lock(struct sdo_req_queue* self)
@@ -189,12 +350,224 @@ void sdo_req_queue__unlock(struct sdo_req_queue* self)
 	pthread_mutex_unlock(&self->mutex);
 }
 
+static void sdo_req_queue__mark_ready(struct sdo_req_queue* self)
+{
+	unsigned int nodeid = self->nodeid;
+	co_atomic_fetch_or(&sdo_req__ready[nodeid / 64], 1ULL << (nodeid % 64));
+}
+
+void sdo_req_queues_hold(enum sdo_req_priority priority)
+{
+	co_atomic_store(&sdo_req__held_from, priority ? priority
+						      : SDO_REQ_PRIO_DRIVER);
+}
+
+void sdo_req_queues_release(void)
+{
+	if (co_atomic_exchange(&sdo_req__held_from, SDO_REQ__NOT_HELD)
+			== SDO_REQ__NOT_HELD)
+		return;
+
+	pthread_mutex_lock(&sdo_req__queues_mutex);
+
+	for (size_t i = 1; i < 128; ++i)
+		if (sdo_req__queues[i])
+			sdo_req_queue__mark_ready(sdo_req__queues[i]);
+
+	pthread_mutex_unlock(&sdo_req__queues_mutex);
+
+	mloop_iterate(mloop_default());
+}
+
+int sdo_req_queues_is_held(void)
+{
+	return co_atomic_load(&sdo_req__held_from) != SDO_REQ__NOT_HELD;
+}
+
 void sdo_req_queue_flush(struct sdo_req_queue* self)
 {
 	sdo_req_queue__lock(self);
 	sdo_req__queue_clear(self);
-	sdo_async_stop(&self->sdo_client);
+	for (size_t i = 0; i < self->n_channels; ++i)
+		sdo_async_stop(self->channel[i]);
+	sdo_req_queue__unlock(self);
+}
+
+void sdo_req_queue_set_timeout_bounds(struct sdo_req_queue* self,
+				      unsigned long min_ms,
+				      unsigned long max_ms)
+{
+	self->timeout_min = min_ms;
+	self->timeout_max = max_ms > min_ms ? max_ms : min_ms;
+}
+
+unsigned long sdo_req_queue_get_timeout(const struct sdo_req_queue* self)
+{
+	if (!self->srtt)
+		return self->timeout_max;
+
+	unsigned long timeout = (self->srtt + 4 * self->rttvar + 999) / 1000;
+
+	if (timeout < self->timeout_min)
+		return self->timeout_min;
+
+	if (timeout > self->timeout_max)
+		return self->timeout_max;
+
+	return timeout;
+}
+
+/* The estimator from RFC 6298 with gains of 1/8 and 1/4 */
+static void sdo_req_queue__update_rtt(struct sdo_req_queue* self,
+				      uint64_t rtt)
+{
+	if (!self->srtt) {
+		self->srtt = rtt ? rtt : 1;
+		self->rttvar = rtt / 2;
+		return;
+	}
+
+	uint64_t error = rtt > self->srtt ? rtt - self->srtt
+					  : self->srtt - rtt;
+
+	self->rttvar = (3 * self->rttvar + error) / 4;
+	self->srtt = (7 * self->srtt + rtt) / 8;
+	if (!self->srtt)
+		self->srtt = 1;
+}
+
+void sdo_req_queue_set_lost(struct sdo_req_queue* self, int is_lost)
+{
+	sdo_req_queue__lock(self);
+
+	self->is_lost = is_lost;
+	if (is_lost)
+		sdo_req__queue_clear(self);
+
+	sdo_req_queue__unlock(self);
+}
+
+static struct sdo_async*
+sdo_req_queue__new_channel(struct sdo_req_queue* self,
+			   const struct sdo_req_channel_info* info)
+{
+	const struct sdo_async* dflt = &self->sdo_client;
+
+	struct sdo_async* channel = calloc(1, sizeof(*channel));
+	if (!channel)
+		return NULL;
+
+	if (sdo_async_init(channel, &dflt->sock, self->nodeid) < 0) {
+		free(channel);
+		return NULL;
+	}
+
+	channel->tx_cob_id = info->tx_cob_id;
+	channel->rx_cob_id = info->rx_cob_id;
+	channel->quirks = dflt->quirks;
+	channel->block_size = dflt->block_size;
+	channel->send_fn = dflt->send_fn;
+
+	return channel;
+}
+
+int sdo_req_queue_set_channels(struct sdo_req_queue* self,
+			       const struct sdo_req_channel_info* info,
+			       size_t n)
+{
+	int rc = -1;
+
+	if (n + 1 > SDO_REQ_CHANNELS_MAX)
+		return -1;
+
+	sdo_req_queue__lock(self);
+
+	sdo_req_queue__remove_channels(self);
+
+	for (size_t i = 0; i < n; ++i) {
+		struct sdo_async* channel =
+			sdo_req_queue__new_channel(self, &info[i]);
+		if (!channel)
+			goto failure;
+
+		self->channel[self->n_channels++] = channel;
+	}
+
+	rc = 0;
+failure:
+	sdo_req_queue__mark_ready(self);
 	sdo_req_queue__unlock(self);
+	return rc;
+}
+
+struct sdo_async* sdo_req_queue_find_channel(struct sdo_req_queue* self,
+					     uint32_t rx_cob_id)
+{
+	for (size_t i = 0; i < self->n_channels; ++i)
+		if (self->channel[i]->rx_cob_id == rx_cob_id)
+			return self->channel[i];
+
+	return NULL;
+}
+
+static inline int sdo_req__is_same_upload(const struct sdo_req* a,
+					  const struct sdo_req* b)
+{
+	return a->type == SDO_REQ_UPLOAD && b->type == SDO_REQ_UPLOAD
+	    && a->index == b->index && a->subindex == b->subindex;
+}
+
+/* Finds an identical upload that req can wait for. *is_queued is set if it has
+ * not been started yet.
+ */
+static struct sdo_req* sdo_req_queue__find_primary(struct sdo_req_queue* self,
+						   const struct sdo_req* req,
+						   int* is_queued)
+{
+	struct sdo_req* primary = NULL;
+	struct sdo_req* it;
+
+	if (req->type != SDO_REQ_UPLOAD)
+		return NULL;
+
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i)
+		TAILQ_FOREACH(it, &self->list[i], links) {
+			if (it->type == SDO_REQ_DOWNLOAD)
+				return NULL;
+
+			if (!primary && sdo_req__is_same_upload(it, req))
+				primary = it;
+		}
+
+	*is_queued = primary != NULL;
+	if (primary)
+		return primary;
+
+	for (size_t i = 0; i < self->n_channels; ++i) {
+		const struct sdo_async* channel = self->channel[i];
+		if (channel->is_running && channel->context
+		 && sdo_req__is_same_upload(channel->context, req))
+			return channel->context;
+	}
+
+	return NULL;
+}
+
+static void sdo_req_queue__attach(struct sdo_req_queue* self,
+				  struct sdo_req* primary, int is_queued,
+				  struct sdo_req* req)
+{
+	req->primary = primary;
+	TAILQ_INSERT_TAIL(&primary->waiters, req, links);
+
+	/* A queued upload is not started later than any of its waiters */
+	struct sdo_req_list* list = sdo_req_queue__list(self, primary);
+	if (is_queued && sdo_req_queue__list(self, req) < list) {
+		TAILQ_REMOVE(list, primary, links);
+		primary->priority = req->priority;
+		TAILQ_INSERT_TAIL(sdo_req_queue__list(self, primary), primary,
+				  links);
+	}
 }
 
 int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req)
@@ -202,14 +575,33 @@ int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req)
 	assert(req->parent == NULL);
 
 	int rc = -1;
+	int is_queued = 0;
 	sdo_req_queue__lock(self);
+
+	if (self->is_lost)
+		goto done;
+
+	req->n_passed = 0;
+	req->primary = NULL;
+	TAILQ_INIT(&req->waiters);
+
+	struct sdo_req* primary =
+		sdo_req_queue__find_primary(self, req, &is_queued);
+	if (primary) {
+		req->parent = self;
+		sdo_req_queue__attach(self, primary, is_queued, req);
+		rc = 0;
+		goto done;
+	}
+
 	if (self->size >= self->limit)
 		goto done;
 	else
 		++self->size;
 
 	req->parent = self;
-	TAILQ_INSERT_TAIL(&self->list, req, links);
+	TAILQ_INSERT_TAIL(sdo_req_queue__list(self, req), req, links);
+	sdo_req_queue__mark_ready(self);
 	mloop_iterate(mloop_default());
 
 	rc = 0;
@@ -218,19 +610,48 @@ done:
 	return rc;
 }
 
+/* Returns the request that is to be started next. Held requests are not
+ * started, not even those that have aged.
+ */
+static struct sdo_req* sdo_req_queue__peek(struct sdo_req_queue* self)
+{
+	struct sdo_req* first = NULL;
+	int n_lists = co_atomic_load(&sdo_req__held_from) - 1;
+
+	for (int i = 0; i < n_lists; ++i) {
+		struct sdo_req* req = TAILQ_FIRST(&self->list[i]);
+		if (!req)
+			continue;
+
+		if (!first)
+			first = req;
+		else if (req->n_passed >= SDO_REQ_AGING_LIMIT)
+			return req;
+	}
+
+	return first;
+}
+
 struct sdo_req* sdo_req_queue__dequeue(struct sdo_req_queue* self)
 {
 	sdo_req_queue__lock(self);
 
-	struct sdo_req* req = TAILQ_FIRST(&self->list);
+	struct sdo_req* req = sdo_req_queue__peek(self);
 	if (!req)
-		return NULL;
+		goto done;
 
 	assert(self->size);
 	--self->size;
 
-	TAILQ_REMOVE(&self->list, req, links);
+	struct sdo_req_list* list = sdo_req_queue__list(self, req);
+	TAILQ_REMOVE(list, req, links);
 
+	for (struct sdo_req_list* i = list + 1;
+	     i < &self->list[SDO_REQ_PRIO_COUNT]; ++i)
+		if (!TAILQ_EMPTY(i))
+			++TAILQ_FIRST(i)->n_passed;
+
+done:
 	sdo_req_queue__unlock(self);
 	return req;
 }
@@ -242,14 +663,71 @@ int sdo_req_queue_remove(struct sdo_req_queue* self, struct sdo_req* req)
 
 	sdo_req_queue__lock(self);
 
-	TAILQ_REMOVE(&self->list, req, links);
-	req->parent = NULL;
+	if (req->primary) {
+		TAILQ_REMOVE(&req->primary->waiters, req, links);
+		req->primary = NULL;
+		goto done;
+	}
+
+	/* The first waiter takes the place of the removed upload */
+	struct sdo_req* heir = TAILQ_FIRST(&req->waiters);
+	if (heir) {
+		TAILQ_REMOVE(&req->waiters, heir, links);
+		TAILQ_SWAP(&heir->waiters, &req->waiters, sdo_req, links);
 
+		struct sdo_req* it;
+		TAILQ_FOREACH(it, &heir->waiters, links)
+			it->primary = heir;
+
+		heir->primary = NULL;
+		heir->priority = req->priority;
+		TAILQ_INSERT_BEFORE(req, heir, links);
+	} else {
+		assert(self->size);
+		--self->size;
+	}
+
+	TAILQ_REMOVE(sdo_req_queue__list(self, req), req, links);
+
+done:
+	req->parent = NULL;
 	sdo_req_queue__unlock(self);
 
 	return 0;
 }
 
+static int sdo_req_queue__is_queued(struct sdo_req_queue* self,
+				    const struct sdo_req* req)
+{
+	if (req->primary)
+		return 1;
+
+	const struct sdo_req* it;
+	TAILQ_FOREACH(it, sdo_req_queue__list(self, req), links)
+		if (it == req)
+			return 1;
+
+	return 0;
+}
+
+int sdo_req_queue_cancel(struct sdo_req_queue* self, struct sdo_req* req)
+{
+	int rc = -1;
+	sdo_req_queue__lock(self);
+
+	if (req->parent != self || !sdo_req_queue__is_queued(self, req))
+		goto done;
+
+	sdo_req_queue_remove(self, req);
+	req->status = SDO_REQ_CANCELLED;
+	sdo_req_unref(req);
+
+	rc = 0;
+done:
+	sdo_req_queue__unlock(self);
+	return rc;
+}
+
 void sdo_req_wait(struct sdo_req* self)
 {
 	while (self->status == SDO_REQ_PENDING)
@@ -258,6 +736,43 @@ void sdo_req_wait(struct sdo_req* self)
 
 void sdo_req__on_done(struct sdo_async* async);
 
+/* Waiters are given the result of the upload that they waited for */
+static void sdo_req__finish_waiters(struct sdo_req* self, int call_on_done)
+{
+	struct sdo_req_list waiters;
+	TAILQ_INIT(&waiters);
+
+	sdo_req_queue__lock(self->parent);
+	TAILQ_SWAP(&waiters, &self->waiters, sdo_req, links);
+	sdo_req_queue__unlock(self->parent);
+
+	while (!TAILQ_EMPTY(&waiters)) {
+		struct sdo_req* waiter = TAILQ_FIRST(&waiters);
+		TAILQ_REMOVE(&waiters, waiter, links);
+		waiter->primary = NULL;
+
+		enum sdo_req_status status = self->status;
+		waiter->abort_code = self->abort_code;
+		waiter->is_size_indicated = self->is_size_indicated;
+
+		if (sdo_req_set_data(waiter, self->data.data,
+				     self->data.index) < 0)
+			status = SDO_REQ_NOMEM;
+
+		/* The status goes last as sdo_req_wait() polls it */
+		waiter->status = status;
+
+		sdo_req_fn on_done = waiter->on_done;
+		if (call_on_done && on_done)
+			on_done(waiter);
+
+		sdo_req_unref(waiter);
+	}
+}
+
+static int sdo_req__restart(struct sdo_req* self,
+			    struct sdo_req_queue* queue);
+
 void sdo_req__on_stop(void* ptr)
 {
 	struct sdo_req* req = ptr;
@@ -265,76 +780,238 @@ void sdo_req__on_stop(void* ptr)
 	if (req->status == SDO_REQ_PENDING)
 		req->status = SDO_REQ_CANCELLED;
 
+	sdo_req__finish_waiters(req, 0);
+
+	struct sdo_req_queue* parent = req->parent;
+
+	sdo_req_queue__lock(parent);
+	struct sdo_req_queue* restart_queue = req->restart_queue;
+	req->restart_queue = NULL;
+	req->is_running = 0;
+	sdo_req_queue__unlock(parent);
+
+	/* The reference that sdo_req_start() took is handed over */
+	if (restart_queue && sdo_req__restart(req, restart_queue) < 0) {
+		req->status = SDO_REQ_CANCELLED;
+
+		sdo_req_fn on_done = req->on_done;
+		if (on_done)
+			on_done(req);
+
+		sdo_req_unref(req);
+	}
+
 	sdo_req_unref(req);
 }
 
 int sdo_req__have_req(struct mloop_idle* idle)
 {
-	struct sdo_req_queue* queue = mloop_idle_get_context(idle);
-	if (queue->sdo_client.is_running)
-	       return 0;
+	(void)idle;
+	return co_atomic_load(&sdo_req__ready[0])
+	    || co_atomic_load(&sdo_req__ready[1]);
+}
 
-	__sync_synchronize();
-	return !TAILQ_EMPTY(&queue->list);
+/* Downloads run alone and uploads may run alongside other uploads */
+static int sdo_req_queue__can_start(const struct sdo_req_queue* queue,
+				    const struct sdo_req* req)
+{
+	for (size_t i = 0; i < queue->n_channels; ++i) {
+		const struct sdo_async* channel = queue->channel[i];
+		if (!channel->is_running)
+			continue;
+
+		if (req->type != SDO_REQ_UPLOAD
+		 || channel->type != SDO_REQ_UPLOAD)
+			return 0;
+	}
+
+	return 1;
 }
 
-void sdo_req__process_queue(struct mloop_idle* idle)
+static struct sdo_async*
+sdo_req_queue__idle_channel(const struct sdo_req_queue* queue)
 {
-	struct sdo_req_queue* queue = mloop_idle_get_context(idle);
-	assert(!queue->sdo_client.is_running);
+	for (size_t i = 0; i < queue->n_channels; ++i)
+		if (!queue->channel[i]->is_running)
+			return queue->channel[i];
+
+	return NULL;
+}
 
+void sdo_req__process_queue(struct sdo_req_queue* queue)
+{
 	sdo_req_queue__lock(queue);
 
-	struct sdo_req* req = sdo_req_queue__dequeue(queue);
-	if (!req)
-		goto done;
+	/* A busy queue is marked again when one of its requests is done */
+	while (1) {
+		struct sdo_async* channel = sdo_req_queue__idle_channel(queue);
+		if (!channel)
+			break;
+
+		struct sdo_req* req = sdo_req_queue__peek(queue);
+		if (!req || !sdo_req_queue__can_start(queue, req))
+			break;
+
+		sdo_req_queue__dequeue(queue);
+		req->is_running = 1;
+
+		struct sdo_async_info info = {
+			.type = req->type,
+			.index = req->index,
+			.subindex = req->subindex,
+			.timeout = sdo_req_queue_get_timeout(queue),
+			.data = req->data.data,
+			.size = req->data.index,
+			.on_done = sdo_req__on_done,
+			.context = req,
+			.free_fn = sdo_req__on_stop
+		};
+
+		sdo_async_start(channel, &info);
+
+		/* Try again on the next iteration if the request could not be
+		 * started
+		 */
+		if (!channel->is_running) {
+			if (sdo_req_queue__peek(queue))
+				sdo_req_queue__mark_ready(queue);
+			break;
+		}
+	}
 
-	struct sdo_async_info info = {
-		.type = req->type,
-		.index = req->index,
-		.subindex = req->subindex,
-		.timeout = SDO_REQ_TIMEOUT,
-		.data = req->data.data,
-		.size = req->data.index,
-		.on_done = sdo_req__on_done,
-		.context = req,
-		.free_fn = sdo_req__on_stop
-	};
+	sdo_req_queue__unlock(queue);
+}
 
-	sdo_async_start(&queue->sdo_client, &info);
+void sdo_req__process_ready(struct mloop_idle* idle)
+{
+	(void)idle;
 
-done:
-	sdo_req_queue__unlock(queue);
+	for (int i = 0; i < 2; ++i) {
+		uint64_t ready = co_atomic_exchange(&sdo_req__ready[i], 0);
+
+		while (ready) {
+			int bit = __builtin_ctzll(ready);
+			ready &= ready - 1;
+
+			struct sdo_req_queue* queue =
+				co_atomic_load(&sdo_req__queues[i * 64 + bit]);
+			if (queue)
+				sdo_req__process_queue(queue);
+		}
+	}
 }
 
-void sdo_req__on_done(struct sdo_async* async)
+static void sdo_req_queue__count(struct sdo_req_queue* self,
+				 const struct sdo_async* async)
 {
-	struct sdo_req_queue* queue = sdo_req_queue__from_async(async);
+	switch (async->status) {
+	case SDO_REQ_OK:
+		++self->n_ok;
+		break;
+	case SDO_REQ_LOCAL_ABORT:
+		if (async->abort_code == SDO_ABORT_TIMEOUT) {
+			++self->n_timeouts;
+			break;
+		}
+		/* fall through */
+	case SDO_REQ_REMOTE_ABORT:
+		++self->n_aborts;
+		break;
+	default:
+		break;
+	}
+}
 
+void sdo_req__on_done(struct sdo_async* async)
+{
 	struct sdo_req* req = async->context;
 	assert(req != NULL);
 
+	/* The request may have run on any of the channels of its queue */
+	struct sdo_req_queue* queue = req->parent;
+
 	assert(async->status != SDO_REQ_PENDING);
 	req->status = async->status;
 	req->abort_code = async->abort_code;
 	req->is_size_indicated = async->is_size_indicated;
 
+	/* Timed out exchanges say nothing about the round trip time */
+	if (async->rtt) {
+		sdo_req_queue__update_rtt(queue, async->rtt);
+
+		queue->rtt_total += async->rtt;
+		++queue->n_rtts;
+		if (async->rtt > queue->rtt_max)
+			queue->rtt_max = async->rtt;
+	}
+
+	sdo_req_queue__count(queue, async);
+
 	if (req->type == SDO_REQ_UPLOAD)
-		if (vector_copy(&req->data, &async->buffer) < 0)
+		if (sdo_req__take_data(req, &async->buffer) < 0)
 			req->status = SDO_REQ_NOMEM;
 
 	sdo_req_fn on_done = req->on_done;
 	if (on_done)
 		on_done(req);
 
+	sdo_req__finish_waiters(req, 1);
+
+	sdo_req_queue__mark_ready(queue);
 	mloop_iterate(mloop_default());
 }
 
+static int sdo_req__restart(struct sdo_req* self,
+			    struct sdo_req_queue* queue)
+{
+	if (self->status != SDO_REQ_PENDING) {
+		self->parent = NULL;
+		self->status = SDO_REQ_PENDING;
+		self->abort_code = 0;
+		self->is_size_indicated = 0;
+	}
+
+	return sdo_req_queue__enqueue(queue, self);
+}
+
+/* Returns 1 if the request is still on the channel that it ran on, in which
+ * case it is queued when the channel lets go of it
+ */
+static int sdo_req__defer_restart(struct sdo_req* self,
+				  struct sdo_req_queue* queue)
+{
+	struct sdo_req_queue* parent = self->parent;
+	if (!parent)
+		return 0;
+
+	sdo_req_queue__lock(parent);
+
+	int rc = 0;
+
+	if (self->is_running) {
+		rc = self->status == SDO_REQ_PENDING || self->restart_queue
+		   ? -1 : 1;
+
+		if (rc > 0)
+			self->restart_queue = queue;
+	}
+
+	sdo_req_queue__unlock(parent);
+	return rc;
+}
+
 int sdo_req_start(struct sdo_req* self, struct sdo_req_queue* queue)
 {
+	if (!queue)
+		return -1;
+
 	sdo_req_ref(self);
 
-	if (sdo_req_queue__enqueue(queue, self) == 0)
+	int rc = sdo_req__defer_restart(self, queue);
+	if (rc > 0)
+		return 0;
+
+	if (rc == 0 && sdo_req__restart(self, queue) == 0)
 		return 0;
 
 	sdo_req_unref(self);
@@ -38,6 +38,7 @@ int sdo_srv_init(struct sdo_srv* self, const struct sock* sock, int nodeid,
 	self->on_done = on_done;
 	self->comm_state = SDO_SRV_COMM_INIT_REQ;
 	self->pos = 0;
+	self->block_size = SDO_BLOCK_SIZE_MAX;
 
 	return vector_init(&self->buffer, 8);
 }
@@ -145,6 +146,14 @@ int sdo_srv__dl_expediated(struct sdo_srv* self, const struct can_frame* cf)
 	return sdo_srv__dl_init_res(self);
 }
 
+static void sdo_srv__init_seg_template(struct sdo_srv* self,
+				       enum sdo_scs cs)
+{
+	sdo_clear_frame(&self->seg_template);
+	sdo_set_cs(&self->seg_template, cs);
+	self->seg_template.can_dlc = 1;
+}
+
 int sdo_srv__dl_init_req(struct sdo_srv* self, const struct can_frame* cf)
 {
 	if (sdo_srv__init_req(self, cf) < 0)
@@ -160,6 +169,7 @@ int sdo_srv__dl_init_req(struct sdo_srv* self, const struct can_frame* cf)
 
 	self->status = SDO_REQ_PENDING;
 	self->comm_state = SDO_SRV_COMM_DL_SEG_REQ;
+	sdo_srv__init_seg_template(self, SDO_SCS_DL_SEG_RES);
 	return sdo_srv__dl_init_res(self);
 }
 
@@ -175,12 +185,9 @@ static int get_segment_size(const struct can_frame* cf)
 
 int sdo_srv__dl_seg_res(struct sdo_srv* self)
 {
-	struct can_frame cf;
-	sdo_clear_frame(&cf);
-	sdo_set_cs(&cf, SDO_SCS_DL_SEG_RES);
+	struct can_frame cf = self->seg_template;
 	if (self->is_toggled) sdo_toggle(&cf);
 	self->is_toggled ^= 1;
-	cf.can_dlc = 1;
 	return sdo_srv__send(self, &cf);
 }
 
@@ -197,9 +204,6 @@ int sdo_srv__seg_req(struct sdo_srv* self, const struct can_frame* cf)
 
 int sdo_srv__dl_seg_req(struct sdo_srv* self, const struct can_frame* cf)
 {
-	if (self->comm_state != SDO_SRV_COMM_DL_SEG_REQ)
-		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
-
 	if (sdo_srv__seg_req(self, cf) < 0)
 		return -1;
 
@@ -257,36 +261,38 @@ int sdo_srv__ul_init_res(struct sdo_srv* self)
 	return sdo_srv__send(self, &cf);
 }
 
-int sdo_srv__ul_init_req(struct sdo_srv* self, const struct can_frame* cf)
+/* Respond to an upload request once the buffer has been filled */
+int sdo_srv__ul_respond(struct sdo_srv* self)
 {
-	if (sdo_srv__init_req(self, cf) < 0)
-		return -1;
-
-	self->req_type = SDO_REQ_UPLOAD;
-	if (sdo_srv__on_init(self) < 0)
-		return -1;
-
 	if (self->buffer.index <= SDO_EXPEDIATED_DATA_SIZE)
 		return sdo_srv__ul_expediated(self);
 
 	self->status = SDO_REQ_PENDING;
 	self->comm_state = SDO_SRV_COMM_UL_SEG_REQ;
 	self->pos = 0;
+	sdo_srv__init_seg_template(self, SDO_SCS_UL_SEG_RES);
 
 	return sdo_srv__ul_init_res(self);
 }
 
-int sdo_srv__ul_seg_req(struct sdo_srv* self, const struct can_frame* cf)
+int sdo_srv__ul_init_req(struct sdo_srv* self, const struct can_frame* cf)
 {
-	if (self->comm_state != SDO_SRV_COMM_UL_SEG_REQ)
-		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+	if (sdo_srv__init_req(self, cf) < 0)
+		return -1;
 
+	self->req_type = SDO_REQ_UPLOAD;
+	if (sdo_srv__on_init(self) < 0)
+		return -1;
+
+	return sdo_srv__ul_respond(self);
+}
+
+int sdo_srv__ul_seg_req(struct sdo_srv* self, const struct can_frame* cf)
+{
 	if (sdo_srv__seg_req(self, cf) < 0)
 		return -1;
 
-	struct can_frame rcf;
-	sdo_clear_frame(&rcf);
-	sdo_set_cs(&rcf, SDO_SCS_UL_SEG_RES);
+	struct can_frame rcf = self->seg_template;
 
 	size_t size = MIN(SDO_SEGMENT_MAX_SIZE, self->buffer.index - self->pos);
 	assert(size > 0);
@@ -315,19 +321,314 @@ int sdo_srv__ul_seg_req(struct sdo_srv* self, const struct can_frame* cf)
 	return sdo_srv__send(self, &rcf);
 }
 
-int sdo_srv_feed(struct sdo_srv* self, const struct can_frame* cf)
+int sdo_srv__block_dl_init_req(struct sdo_srv* self,
+			       const struct can_frame* cf)
 {
-	assert(cf->can_id == R_RSDO + self->nodeid);
+	if (sdo_srv__init_req(self, cf) < 0)
+		return -1;
+
+	self->req_type = SDO_REQ_DOWNLOAD;
+
+	if (sdo_srv__on_init(self) < 0)
+		return -1;
+
+	if (sdo_block_is_size_indicated(cf) && cf->can_dlc == CAN_MAX_DLC)
+		if (vector_reserve(&self->buffer, sdo_get_indicated_size(cf)) < 0)
+			return sdo_srv_abort(self, SDO_ABORT_NOMEM);
 
-	enum sdo_ccs cs = sdo_get_cs(cf);
+	self->use_crc = sdo_block_has_crc(cf);
+	self->blksize = MIN(self->block_size, SDO_BLOCK_SIZE_MAX);
+	self->seqno = 0;
+	self->status = SDO_REQ_PENDING;
+	self->comm_state = SDO_SRV_COMM_BLOCK_DL_SEG;
 
-	switch (cs) {
-	case SDO_CCS_ABORT: return sdo_srv__remote_abort(self, cf);
-	case SDO_CCS_DL_INIT_REQ: return sdo_srv__dl_init_req(self, cf);
-	case SDO_CCS_DL_SEG_REQ: return sdo_srv__dl_seg_req(self, cf);
-	case SDO_CCS_UL_INIT_REQ: return sdo_srv__ul_init_req(self, cf);
-	case SDO_CCS_UL_SEG_REQ: return sdo_srv__ul_seg_req(self, cf);
+	struct can_frame rcf;
+	sdo_clear_frame(&rcf);
+	sdo_set_cs(&rcf, SDO_SCS_BLOCK_DL_RES);
+	sdo_block_set_subcmd(&rcf, SDO_BLOCK_INIT);
+	sdo_block_use_crc(&rcf);
+	sdo_set_index(&rcf, self->index);
+	sdo_set_subindex(&rcf, self->subindex);
+	rcf.data[SDO_BLOCK_SIZE_IDX] = self->blksize;
+	rcf.can_dlc = SDO_BLOCK_SIZE_IDX + 1;
+	return sdo_srv__send(self, &rcf);
+}
+
+/* Segments that are out of order are dropped and the client sends them again
+ * after the acknowledgement
+ */
+int sdo_srv__block_dl_seg(struct sdo_srv* self, const struct can_frame* cf)
+{
+	if (cf->can_dlc < 1)
+		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+
+	int seqno = sdo_block_get_seqno(cf);
+	int is_last = sdo_block_is_last_segment(cf);
+
+	if (seqno == self->seqno + 1) {
+		if (vector_append(&self->buffer, &cf->data[SDO_SEGMENT_IDX],
+				  SDO_SEGMENT_MAX_SIZE) < 0)
+			return sdo_srv_abort(self, SDO_ABORT_NOMEM);
+
+		self->seqno = seqno;
+	} else {
+		is_last = 0;
+	}
+
+	if (seqno < (int)self->blksize && !sdo_block_is_last_segment(cf))
+		return 0;
+
+	struct can_frame rcf;
+	sdo_clear_frame(&rcf);
+	sdo_set_cs(&rcf, SDO_SCS_BLOCK_DL_RES);
+	sdo_block_set_subcmd(&rcf, SDO_BLOCK_ACK);
+	rcf.data[SDO_BLOCK_ACKSEQ_IDX] = self->seqno;
+	rcf.data[SDO_BLOCK_NEXT_SIZE_IDX] = self->blksize;
+	rcf.can_dlc = SDO_BLOCK_NEXT_SIZE_IDX + 1;
+
+	self->seqno = 0;
+
+	if (is_last)
+		self->comm_state = SDO_SRV_COMM_BLOCK_DL_END;
+
+	return sdo_srv__send(self, &rcf);
+}
+
+int sdo_srv__block_dl_end_req(struct sdo_srv* self,
+			      const struct can_frame* cf)
+{
+	if (self->comm_state != SDO_SRV_COMM_BLOCK_DL_END)
+		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+
+	if (self->use_crc && cf->can_dlc < 3)
+		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+
+	/* The last segment was padded to a full frame */
+	size_t padding = SDO_SEGMENT_MAX_SIZE - sdo_block_get_end_size(cf);
+	if (padding > self->buffer.index)
+		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+
+	self->buffer.index -= padding;
+
+	if (self->use_crc && sdo_block_get_crc(cf)
+			  != sdo_crc16(0, self->buffer.data, self->buffer.index))
+		return sdo_srv_abort(self, SDO_ABORT_CRCERR);
+
+	self->status = SDO_REQ_OK;
+	if (sdo_srv__on_done(self) < 0)
+		return -1;
+
+	struct can_frame rcf;
+	sdo_clear_frame(&rcf);
+	sdo_set_cs(&rcf, SDO_SCS_BLOCK_DL_RES);
+	sdo_block_set_subcmd(&rcf, SDO_BLOCK_END);
+	rcf.can_dlc = 1;
+	return sdo_srv__send(self, &rcf);
+}
+
+int sdo_srv__block_dl_req(struct sdo_srv* self, const struct can_frame* cf)
+{
+	return sdo_block_is_end(cf) ? sdo_srv__block_dl_end_req(self, cf)
+				    : sdo_srv__block_dl_init_req(self, cf);
+}
+
+int sdo_srv__block_ul_init_req(struct sdo_srv* self,
+			       const struct can_frame* cf)
+{
+	if (sdo_srv__init_req(self, cf) < 0)
+		return -1;
+
+	if (cf->can_dlc < SDO_BLOCK_PST_IDX + 1)
+		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+
+	unsigned int blksize = cf->data[SDO_BLOCK_SIZE_IDX];
+	if (blksize < 1 || blksize > SDO_BLOCK_SIZE_MAX)
+		return sdo_srv_abort(self, SDO_ABORT_BLOCKSZ);
+
+	self->req_type = SDO_REQ_UPLOAD;
+	if (sdo_srv__on_init(self) < 0)
+		return -1;
+
+	/* Small objects are cheaper to send with a normal transfer */
+	size_t pst = cf->data[SDO_BLOCK_PST_IDX];
+	if (self->buffer.index <= pst)
+		return sdo_srv__ul_respond(self);
+
+	self->use_crc = sdo_block_has_crc(cf);
+	self->blksize = blksize;
+	self->pos = 0;
+	self->status = SDO_REQ_PENDING;
+	self->comm_state = SDO_SRV_COMM_BLOCK_UL_START;
+
+	struct can_frame rcf;
+	sdo_clear_frame(&rcf);
+	sdo_set_cs(&rcf, SDO_SCS_BLOCK_UL_RES);
+	sdo_block_set_subcmd(&rcf, SDO_BLOCK_INIT);
+	sdo_block_use_crc(&rcf);
+	sdo_block_indicate_size(&rcf);
+	sdo_set_index(&rcf, self->index);
+	sdo_set_subindex(&rcf, self->subindex);
+	sdo_set_indicated_size(&rcf, self->buffer.index);
+	rcf.can_dlc = CAN_MAX_DLC;
+	return sdo_srv__send(self, &rcf);
+}
+
+int sdo_srv__send_ul_block(struct sdo_srv* self)
+{
+	const char* data = self->buffer.data;
+
+	self->block_start = self->pos;
+	self->comm_state = SDO_SRV_COMM_BLOCK_UL_ACK;
+
+	for (unsigned int seqno = 1; seqno <= self->blksize
+				     && self->pos < self->buffer.index; ++seqno) {
+		struct can_frame cf;
+		sdo_clear_frame(&cf);
+
+		size_t size = MIN(SDO_SEGMENT_MAX_SIZE,
+				  self->buffer.index - self->pos);
+		memcpy(&cf.data[SDO_SEGMENT_IDX], &data[self->pos], size);
+		self->pos += size;
+
+		sdo_block_set_seqno(&cf, seqno,
+				    self->pos >= self->buffer.index);
+		cf.can_dlc = CAN_MAX_DLC;
+
+		if (sdo_srv__send(self, &cf) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int sdo_srv__send_ul_end(struct sdo_srv* self)
+{
+	struct can_frame cf;
+	sdo_clear_frame(&cf);
+	sdo_set_cs(&cf, SDO_SCS_BLOCK_UL_RES);
+	sdo_block_set_subcmd(&cf, SDO_BLOCK_END);
+	sdo_block_set_end_size(&cf, (self->buffer.index - 1)
+				    % SDO_SEGMENT_MAX_SIZE + 1);
+
+	if (self->use_crc)
+		sdo_block_set_crc(&cf, sdo_crc16(0, self->buffer.data,
+						 self->buffer.index));
+
+	cf.can_dlc = CAN_MAX_DLC;
+
+	self->comm_state = SDO_SRV_COMM_BLOCK_UL_END;
+
+	return sdo_srv__send(self, &cf);
+}
+
+/* The client acknowledges the segments that it received in order. Anything
+ * after that is sent again in the next block.
+ */
+int sdo_srv__block_ul_ack(struct sdo_srv* self, const struct can_frame* cf)
+{
+	if (self->comm_state != SDO_SRV_COMM_BLOCK_UL_ACK)
+		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+
+	if (cf->can_dlc < SDO_BLOCK_NEXT_SIZE_IDX + 1)
+		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+
+	size_t n_sent = (self->pos - self->block_start
+			 + SDO_SEGMENT_MAX_SIZE - 1) / SDO_SEGMENT_MAX_SIZE;
+	size_t ackseq = cf->data[SDO_BLOCK_ACKSEQ_IDX];
+	if (ackseq > n_sent)
+		return sdo_srv_abort(self, SDO_ABORT_SEQNR);
+
+	unsigned int blksize = cf->data[SDO_BLOCK_NEXT_SIZE_IDX];
+	if (blksize < 1 || blksize > SDO_BLOCK_SIZE_MAX)
+		return sdo_srv_abort(self, SDO_ABORT_BLOCKSZ);
+
+	self->blksize = blksize;
+
+	if (ackseq < n_sent)
+		self->pos = self->block_start + ackseq * SDO_SEGMENT_MAX_SIZE;
+
+	return self->pos >= self->buffer.index ? sdo_srv__send_ul_end(self)
+					       : sdo_srv__send_ul_block(self);
+}
+
+int sdo_srv__block_ul_end(struct sdo_srv* self)
+{
+	if (self->comm_state != SDO_SRV_COMM_BLOCK_UL_END)
+		return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+
+	self->status = SDO_REQ_OK;
+	return sdo_srv__on_done(self);
+}
+
+int sdo_srv__block_ul_req(struct sdo_srv* self, const struct can_frame* cf)
+{
+	switch (sdo_block_get_subcmd(cf)) {
+	case SDO_BLOCK_INIT:
+		return sdo_srv__block_ul_init_req(self, cf);
+	case SDO_BLOCK_START:
+		if (self->comm_state != SDO_SRV_COMM_BLOCK_UL_START)
+			return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+		return sdo_srv__send_ul_block(self);
+	case SDO_BLOCK_ACK:
+		return sdo_srv__block_ul_ack(self, cf);
+	case SDO_BLOCK_END:
+		return sdo_srv__block_ul_end(self);
 	}
 
 	return sdo_srv_abort(self, SDO_ABORT_INVALID_CS);
 }
+
+int sdo_srv__unexpected(struct sdo_srv* self, const struct can_frame* cf)
+{
+	(void)cf;
+	return sdo_srv_abort(self, SDO_ABORT_GENERAL);
+}
+
+int sdo_srv__invalid_cs(struct sdo_srv* self, const struct can_frame* cf)
+{
+	(void)cf;
+	return sdo_srv_abort(self, SDO_ABORT_INVALID_CS);
+}
+
+typedef int (*sdo_srv__feed_fn)(struct sdo_srv*, const struct can_frame*);
+
+/* Initiating requests and aborts are accepted in every state. Segment
+ * requests are only accepted while the matching transfer is in progress.
+ */
+#define SDO_SRV__ROW(dl_seg, ul_seg) { \
+	[SDO_CCS_DL_SEG_REQ] = sdo_srv__ ## dl_seg, \
+	[SDO_CCS_DL_INIT_REQ] = sdo_srv__dl_init_req, \
+	[SDO_CCS_UL_INIT_REQ] = sdo_srv__ul_init_req, \
+	[SDO_CCS_UL_SEG_REQ] = sdo_srv__ ## ul_seg, \
+	[SDO_CCS_ABORT] = sdo_srv__remote_abort, \
+	[SDO_CCS_BLOCK_UL_REQ] = sdo_srv__block_ul_req, \
+	[SDO_CCS_BLOCK_DL_REQ] = sdo_srv__block_dl_req, \
+	[SDO_CS_COUNT - 1] = sdo_srv__invalid_cs, \
+}
+
+static const sdo_srv__feed_fn
+sdo_srv__transitions[SDO_SRV_N_COMM_STATES][SDO_CS_COUNT] = {
+	[SDO_SRV_COMM_INIT_REQ] = SDO_SRV__ROW(unexpected, unexpected),
+	[SDO_SRV_COMM_DL_SEG_REQ] = SDO_SRV__ROW(dl_seg_req, unexpected),
+	[SDO_SRV_COMM_UL_SEG_REQ] = SDO_SRV__ROW(unexpected, ul_seg_req),
+
+	/* Segments within a block have no command specifier */
+	[SDO_SRV_COMM_BLOCK_DL_SEG][0 ... SDO_CS_COUNT - 1] =
+		sdo_srv__block_dl_seg,
+
+	[SDO_SRV_COMM_BLOCK_DL_END] = SDO_SRV__ROW(unexpected, unexpected),
+	[SDO_SRV_COMM_BLOCK_UL_START] = SDO_SRV__ROW(unexpected, unexpected),
+	[SDO_SRV_COMM_BLOCK_UL_ACK] = SDO_SRV__ROW(unexpected, unexpected),
+	[SDO_SRV_COMM_BLOCK_UL_END] = SDO_SRV__ROW(unexpected, unexpected),
+};
+
+int sdo_srv_feed(struct sdo_srv* self, const struct can_frame* cf)
+{
+	assert(cf->can_id == R_RSDO + self->nodeid);
+
+	if (self->comm_state == SDO_SRV_COMM_BLOCK_DL_SEG
+	 && sdo_block_is_abort(cf))
+		return sdo_srv__remote_abort(self, cf);
+
+	return sdo_srv__transitions[self->comm_state][sdo_get_cs(cf)](self, cf);
+}
@@ -21,6 +21,7 @@ struct sdo_req* sdo_sync_read(int nodeid, int index, int subindex)
 {
 	struct sdo_req_info info = {
 		.type = SDO_REQ_UPLOAD,
+		.priority = SDO_REQ_PRIO_CONFIG,
 		.index = index,
 		.subindex = subindex
 	};
@@ -0,0 +1,557 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "socketcan.h"
+#include "net-util.h"
+#include "plog.h"
+#include "canopen/shard.h"
+
+#define CO_SHARD__MAGIC 0x43534831 /* "CSH1" */
+#define CO_SHARD__MASK (CO_SHARD_RING_SIZE - 1)
+
+/* A cell holds the position of its frame plus one once it has been written
+ * and 0 while it is being written, so readers can tell if it was overwritten
+ * under them.
+ */
+struct co_shard__cell {
+	uint64_t seq;
+	uint64_t timestamp;
+	struct canfd_frame cf;
+};
+
+struct co_shard__ring {
+	uint32_t magic;
+	uint32_t size;
+	uint64_t head __attribute__((aligned(64)));
+	struct co_shard__cell cell[CO_SHARD_RING_SIZE]
+		__attribute__((aligned(64)));
+};
+
+struct co_shard__conn {
+	int fd;
+	int eventfd;
+	int range_start;
+	int range_stop;
+};
+
+struct co_shard_owner {
+	int listen_fd;
+	int epoll_fd;
+	int ring_fd;
+	struct co_shard__ring* ring;
+	int range_start;
+	int range_stop;
+	size_t n_conns;
+	struct co_shard__conn conn[CO_SHARD_MAX];
+};
+
+struct co_shard_client {
+	int fd;
+	int eventfd;
+	struct co_shard__ring* ring;
+	uint64_t tail;
+	uint64_t n_lost;
+};
+
+static struct co_shard__ring* co_shard__map(int fd)
+{
+	void* addr = mmap(NULL, sizeof(struct co_shard__ring),
+			  PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+static void co_shard__unmap(struct co_shard__ring* ring)
+{
+	if (ring)
+		munmap(ring, sizeof(*ring));
+}
+
+static ssize_t co_shard__send(int fd, const struct co_shard_msg* msg,
+			      int passed_fd)
+{
+	struct iovec iov = { .iov_base = (void*)msg, .iov_len = sizeof(*msg) };
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr hdr = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if (passed_fd >= 0) {
+		memset(control, 0, sizeof(control));
+		hdr.msg_control = control;
+		hdr.msg_controllen = sizeof(control);
+
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+	}
+
+	return sendmsg(fd, &hdr, MSG_NOSIGNAL);
+}
+
+/* Returns the size of the message or -1. The passed fd is -1 if there was
+ * none.
+ */
+static ssize_t co_shard__recv(int fd, struct co_shard_msg* msg,
+			      int* passed_fd, int flags)
+{
+	struct iovec iov = { .iov_base = msg, .iov_len = sizeof(*msg) };
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr hdr = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+
+	*passed_fd = -1;
+
+	ssize_t rsize = recvmsg(fd, &hdr, flags | MSG_CMSG_CLOEXEC);
+	if (rsize < 0)
+		return -1;
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+	 && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(passed_fd, CMSG_DATA(cmsg), sizeof(int));
+
+	return rsize;
+}
+
+struct co_shard_owner* co_shard_owner_new(const char* path, int range_start,
+					  int range_stop)
+{
+	struct co_shard_owner* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+	self->range_start = range_start;
+	self->range_stop = range_stop;
+
+	self->ring_fd = memfd_create("canopen-shard", MFD_CLOEXEC);
+	if (self->ring_fd < 0)
+		goto memfd_failure;
+
+	if (ftruncate(self->ring_fd, sizeof(*self->ring)) < 0)
+		goto ring_failure;
+
+	self->ring = co_shard__map(self->ring_fd);
+	if (!self->ring)
+		goto ring_failure;
+
+	self->ring->magic = CO_SHARD__MAGIC;
+	self->ring->size = CO_SHARD_RING_SIZE;
+
+	self->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (self->epoll_fd < 0)
+		goto epoll_failure;
+
+	self->listen_fd = net_unix_listen(path);
+	if (self->listen_fd < 0)
+		goto listen_failure;
+
+	net_dont_block(self->listen_fd);
+
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.fd = self->listen_fd,
+	};
+	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->listen_fd, &ev) < 0)
+		goto epoll_ctl_failure;
+
+	return self;
+
+epoll_ctl_failure:
+	close(self->listen_fd);
+listen_failure:
+	close(self->epoll_fd);
+epoll_failure:
+	co_shard__unmap(self->ring);
+ring_failure:
+	close(self->ring_fd);
+memfd_failure:
+	free(self);
+	return NULL;
+}
+
+static void co_shard__close_conn(struct co_shard_owner* self,
+				 struct co_shard__conn* conn)
+{
+	if (conn->range_start)
+		plog(LOG_NOTICE, "Shard for nodes %d-%d has left",
+		     conn->range_start, conn->range_stop);
+
+	close(conn->fd);
+	if (conn->eventfd >= 0)
+		close(conn->eventfd);
+
+	*conn = self->conn[--self->n_conns];
+}
+
+void co_shard_owner_free(struct co_shard_owner* self)
+{
+	if (!self)
+		return;
+
+	while (self->n_conns > 0)
+		co_shard__close_conn(self, &self->conn[0]);
+
+	close(self->listen_fd);
+	close(self->epoll_fd);
+	co_shard__unmap(self->ring);
+	close(self->ring_fd);
+	free(self);
+}
+
+int co_shard_owner_get_fd(const struct co_shard_owner* self)
+{
+	return self->epoll_fd;
+}
+
+size_t co_shard_owner_get_n_shards(const struct co_shard_owner* self)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < self->n_conns; ++i)
+		if (self->conn[i].range_start)
+			++n;
+
+	return n;
+}
+
+static int co_shard__overlaps(int a_start, int a_stop, int b_start, int b_stop)
+{
+	return a_start <= b_stop && b_start <= a_stop;
+}
+
+static int co_shard__is_range_free(const struct co_shard_owner* self,
+				   int start, int stop)
+{
+	if (co_shard__overlaps(start, stop, self->range_start,
+			       self->range_stop))
+		return 0;
+
+	for (size_t i = 0; i < self->n_conns; ++i) {
+		const struct co_shard__conn* conn = &self->conn[i];
+
+		if (conn->range_start
+		 && co_shard__overlaps(start, stop, conn->range_start,
+				       conn->range_stop))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void co_shard__accept(struct co_shard_owner* self)
+{
+	int fd;
+
+	while ((fd = accept4(self->listen_fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		if (self->n_conns >= CO_SHARD_MAX) {
+			plog(LOG_WARNING, "Too many shards; refusing another one");
+			close(fd);
+			continue;
+		}
+
+		struct co_shard__conn* conn = &self->conn[self->n_conns];
+
+		struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+		if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			close(fd);
+			continue;
+		}
+
+		conn->fd = fd;
+		conn->eventfd = -1;
+		conn->range_start = 0;
+		conn->range_stop = 0;
+		++self->n_conns;
+	}
+}
+
+static void co_shard__register(struct co_shard_owner* self,
+			       struct co_shard__conn* conn,
+			       const struct co_shard_msg* msg, int eventfd)
+{
+	struct co_shard_msg reply = { .type = CO_SHARD_MSG_REJECT };
+	int start = msg->range_start, stop = msg->range_stop;
+
+	if (conn->range_start || eventfd < 0 || start < 1 || stop < start
+	 || stop > 127 || !co_shard__is_range_free(self, start, stop)) {
+		plog(LOG_WARNING, "Refused shard for nodes %d-%d", start, stop);
+		goto done;
+	}
+
+	conn->range_start = start;
+	conn->range_stop = stop;
+	conn->eventfd = eventfd;
+	eventfd = -1;
+
+	reply.type = CO_SHARD_MSG_ACCEPT;
+	reply.range_start = start;
+	reply.range_stop = stop;
+
+	plog(LOG_NOTICE, "Shard for nodes %d-%d has joined", start, stop);
+
+done:
+	if (eventfd >= 0)
+		close(eventfd);
+
+	co_shard__send(conn->fd, &reply,
+		       reply.type == CO_SHARD_MSG_ACCEPT ? self->ring_fd : -1);
+}
+
+static struct co_shard__conn* co_shard__find_conn(struct co_shard_owner* self,
+						  int fd)
+{
+	for (size_t i = 0; i < self->n_conns; ++i)
+		if (self->conn[i].fd == fd)
+			return &self->conn[i];
+
+	return NULL;
+}
+
+static void co_shard__process_conn(struct co_shard_owner* self, int fd)
+{
+	struct co_shard__conn* conn = co_shard__find_conn(self, fd);
+	if (!conn)
+		return;
+
+	struct co_shard_msg msg;
+	int passed_fd;
+
+	while (1) {
+		ssize_t rsize = co_shard__recv(fd, &msg, &passed_fd,
+					       MSG_DONTWAIT);
+		if (rsize < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		if (rsize <= 0) {
+			if (passed_fd >= 0)
+				close(passed_fd);
+
+			co_shard__close_conn(self, conn);
+			return;
+		}
+
+		if (rsize == sizeof(msg) && msg.type == CO_SHARD_MSG_REGISTER) {
+			co_shard__register(self, conn, &msg, passed_fd);
+		} else if (passed_fd >= 0) {
+			close(passed_fd);
+		}
+	}
+}
+
+void co_shard_owner_process(struct co_shard_owner* self)
+{
+	struct epoll_event ev[CO_SHARD_MAX + 1];
+
+	int n = epoll_wait(self->epoll_fd, ev, CO_SHARD_MAX + 1, 0);
+
+	/* Connections are closed before new ones are accepted, so that an fd
+	 * number cannot be reused within the batch
+	 */
+	int has_listen = 0;
+
+	for (int i = 0; i < n; ++i) {
+		if (ev[i].data.fd == self->listen_fd)
+			has_listen = 1;
+		else
+			co_shard__process_conn(self, ev[i].data.fd);
+	}
+
+	if (has_listen)
+		co_shard__accept(self);
+}
+
+void co_shard_owner_publish(struct co_shard_owner* self,
+			    const struct canfd_frame* cf, const uint64_t* ts,
+			    size_t n)
+{
+	struct co_shard__ring* ring = self->ring;
+	uint64_t head = ring->head;
+
+	for (size_t i = 0; i < n; ++i, ++head) {
+		struct co_shard__cell* cell = &ring->cell[head & CO_SHARD__MASK];
+
+		__atomic_store_n(&cell->seq, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		cell->cf = cf[i];
+		cell->timestamp = ts[i];
+
+		__atomic_store_n(&cell->seq, head + 1, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+	uint64_t one = 1;
+	for (size_t i = 0; i < self->n_conns; ++i) {
+		if (self->conn[i].eventfd < 0)
+			continue;
+
+		ssize_t rc = write(self->conn[i].eventfd, &one, sizeof(one));
+		(void)rc;
+	}
+}
+
+struct co_shard_client* co_shard_client_open(const char* path,
+					     int range_start, int range_stop)
+{
+	struct co_shard_client* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+
+	self->fd = net_unix_connect(path);
+	if (self->fd < 0)
+		goto connect_failure;
+
+	self->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (self->eventfd < 0)
+		goto eventfd_failure;
+
+	struct co_shard_msg msg = {
+		.type = CO_SHARD_MSG_REGISTER,
+		.range_start = range_start,
+		.range_stop = range_stop,
+	};
+
+	if (co_shard__send(self->fd, &msg, self->eventfd) < 0)
+		goto register_failure;
+
+	int ring_fd;
+	if (co_shard__recv(self->fd, &msg, &ring_fd, 0) != sizeof(msg))
+		goto register_failure;
+
+	if (msg.type != CO_SHARD_MSG_ACCEPT || ring_fd < 0) {
+		if (ring_fd >= 0)
+			close(ring_fd);
+
+		errno = EADDRINUSE;
+		goto register_failure;
+	}
+
+	self->ring = co_shard__map(ring_fd);
+	close(ring_fd);
+
+	if (!self->ring || self->ring->magic != CO_SHARD__MAGIC
+	 || self->ring->size != CO_SHARD_RING_SIZE) {
+		co_shard__unmap(self->ring);
+		errno = EPROTO;
+		goto register_failure;
+	}
+
+	/* Frames from before the registration are not for us */
+	self->tail = __atomic_load_n(&self->ring->head, __ATOMIC_ACQUIRE);
+
+	return self;
+
+register_failure:
+	close(self->eventfd);
+eventfd_failure:
+	close(self->fd);
+connect_failure:
+	free(self);
+	return NULL;
+}
+
+void co_shard_client_close(struct co_shard_client* self)
+{
+	if (!self)
+		return;
+
+	co_shard__unmap(self->ring);
+	close(self->eventfd);
+	close(self->fd);
+	free(self);
+}
+
+int co_shard_client_get_fd(const struct co_shard_client* self)
+{
+	return self->eventfd;
+}
+
+int co_shard_client_get_control_fd(const struct co_shard_client* self)
+{
+	return self->fd;
+}
+
+uint64_t co_shard_client_get_n_lost(const struct co_shard_client* self)
+{
+	return self->n_lost;
+}
+
+ssize_t co_shard_client_recv(struct co_shard_client* self,
+			     struct canfd_frame* cf, uint64_t* ts, size_t n)
+{
+	struct co_shard__ring* ring = self->ring;
+	size_t count = 0;
+
+	uint64_t events;
+	ssize_t rc = read(self->eventfd, &events, sizeof(events));
+	(void)rc;
+
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head - self->tail > CO_SHARD_RING_SIZE) {
+		self->n_lost += head - self->tail - CO_SHARD_RING_SIZE;
+		self->tail = head - CO_SHARD_RING_SIZE;
+	}
+
+	while (count < n && self->tail != head) {
+		const struct co_shard__cell* cell =
+			&ring->cell[self->tail & CO_SHARD__MASK];
+
+		uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+		cf[count] = cell->cf;
+		if (ts)
+			ts[count] = cell->timestamp;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (seq != self->tail + 1
+		 || __atomic_load_n(&cell->seq, __ATOMIC_RELAXED) != seq)
+			++self->n_lost;
+		else
+			++count;
+
+		++self->tail;
+	}
+
+	/* The eventfd has been read, so it must be set again for whatever the
+	 * caller did not have room for
+	 */
+	if (self->tail != head) {
+		uint64_t one = 1;
+		rc = write(self->eventfd, &one, sizeof(one));
+		(void)rc;
+	}
+
+	return count;
+}
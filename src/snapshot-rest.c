@@ -0,0 +1,316 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canopen.h"
+#include "canopen/dcf.h"
+#include "canopen/eds.h"
+#include "canopen/master.h"
+#include "canopen/sdo_batch.h"
+#include "canopen/sdo_future.h"
+#include "canopen/sdo_req.h"
+#include "rest.h"
+#include "snapshot-rest.h"
+
+struct snapshot_rest_context {
+	struct rest_client* client;
+	int nodeid;
+	struct co_dcf dcf;
+	ssize_t n_changed;
+};
+
+static void snapshot_rest__reply(struct rest_client* client,
+				 const char* status_code, const char* type,
+				 const void* content, size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = type,
+		.content_length = length,
+		.content = content
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void snapshot_rest__error(struct rest_client* client,
+				 const char* status_code, const char* message)
+{
+	snapshot_rest__reply(client, status_code, "text/plain", message,
+			     strlen(message));
+}
+
+static struct snapshot_rest_context*
+snapshot_rest__context_new(struct rest_client* client, int nodeid)
+{
+	struct snapshot_rest_context* context = calloc(1, sizeof(*context));
+	if (!context)
+		return NULL;
+
+	context->client = client;
+	context->nodeid = nodeid;
+	rest_client_ref(client);
+	return context;
+}
+
+static void snapshot_rest__context_free(void* ptr)
+{
+	struct snapshot_rest_context* context = ptr;
+
+	rest_client_unref(context->client);
+	co_dcf_destroy(&context->dcf);
+	free(context);
+}
+
+/* Objects that are writable but do not take back the values that are read
+ * from them, or that describe the configuration rather than being part of it.
+ */
+static int snapshot_rest__is_excluded(int index)
+{
+	return index == 0x1010 || index == 0x1011
+	    || index == CO_DCF_VERIFY_INDEX || index == CO_DCF_OBJECT_INDEX;
+}
+
+static int snapshot_rest__add_uploads(struct sdo_batch* batch,
+				      const struct canopen_eds* eds)
+{
+	for (size_t i = 0; i < eds->n_objs; ++i) {
+		const struct eds_obj* obj = &eds->objs[i];
+		int index = obj->key >> 8;
+
+		if ((obj->access & EDS_OBJ_RW) != EDS_OBJ_RW
+		 || obj->access & EDS_OBJ_CONST
+		 || obj->type == CANOPEN_DOMAIN
+		 || snapshot_rest__is_excluded(index))
+			continue;
+
+		if (sdo_batch_add_upload(batch, index, obj->key & 0xff) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* The batch is always consumed. If free_fn is given, the continuation frees
+ * the context.
+ */
+static int snapshot_rest__start(struct snapshot_rest_context* context,
+				struct sdo_batch* batch, sdo_future_fn fn,
+				sdo_future_free_fn free_fn)
+{
+	struct sdo_future* future =
+		sdo_future_start(batch, sdo_req_queue_get(context->nodeid));
+	sdo_batch_unref(batch);
+	if (!future)
+		return -1;
+
+	sdo_future_then(future, fn, context, free_fn);
+	sdo_future_unref(future);
+	return 0;
+}
+
+static void snapshot_rest__on_uploaded(struct sdo_future* future)
+{
+	struct snapshot_rest_context* context = sdo_future_get_context(future);
+	struct rest_client* client = context->client;
+
+	if (client->state == REST_CLIENT_DISCONNECTED)
+		return;
+
+	if (co_dcf_from_uploads(&context->dcf,
+				sdo_future_get_batch(future)) < 0) {
+		snapshot_rest__error(client, "500 Internal Server Error",
+				     "Out of memory\r\n");
+		return;
+	}
+
+	snapshot_rest__reply(client, "200 OK", "application/octet-stream",
+			     context->dcf.data, context->dcf.size);
+}
+
+static void snapshot_rest__get(struct rest_client* client, int nodeid)
+{
+	const struct canopen_eds* eds = co_master_find_eds(nodeid);
+	if (!eds) {
+		snapshot_rest__error(client, "404 Not Found",
+				     "Could not find EDS for node\r\n");
+		return;
+	}
+
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_BACKGROUND, 0);
+	if (!batch)
+		goto nomem;
+
+	if (snapshot_rest__add_uploads(batch, eds) < 0) {
+		sdo_batch_unref(batch);
+		goto nomem;
+	}
+
+	struct snapshot_rest_context* context =
+		snapshot_rest__context_new(client, nodeid);
+	if (!context) {
+		sdo_batch_unref(batch);
+		goto nomem;
+	}
+
+	if (snapshot_rest__start(context, batch, snapshot_rest__on_uploaded,
+				 snapshot_rest__context_free) < 0) {
+		snapshot_rest__context_free(context);
+		snapshot_rest__error(client, "500 Internal Server Error",
+				     "Failed to start sdo requests\r\n");
+	}
+
+	return;
+
+nomem:
+	snapshot_rest__error(client, "500 Internal Server Error",
+			     "Out of memory\r\n");
+}
+
+static void snapshot_rest__reply_restored(struct snapshot_rest_context* context,
+					  const struct sdo_batch* batch)
+{
+	size_t n_failed = 0;
+
+	for (size_t i = 0; batch && i < batch->n_items; ++i)
+		if (batch->items[i].status != SDO_REQ_OK)
+			++n_failed;
+
+	char message[128];
+	int length = snprintf(message, sizeof(message),
+		"{ \"entries\": %u, \"changed\": %zd, \"failed\": %zu }\n",
+		context->dcf.n_entries, context->n_changed, n_failed);
+
+	snapshot_rest__reply(context->client,
+			     n_failed ? "502 Bad Gateway" : "200 OK",
+			     "application/json", message, length);
+}
+
+static void snapshot_rest__on_restored(struct sdo_future* future)
+{
+	struct snapshot_rest_context* context = sdo_future_get_context(future);
+
+	if (context->client->state != REST_CLIENT_DISCONNECTED)
+		snapshot_rest__reply_restored(context,
+					      sdo_future_get_batch(future));
+}
+
+/* The context is passed on to the downloads if there are any */
+static void snapshot_rest__on_compared(struct sdo_future* future)
+{
+	struct snapshot_rest_context* context = sdo_future_get_context(future);
+	struct rest_client* client = context->client;
+
+	if (client->state == REST_CLIENT_DISCONNECTED)
+		goto done;
+
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_BACKGROUND, 0);
+	if (!batch)
+		goto nomem;
+
+	context->n_changed = co_dcf_add_changed_downloads(&context->dcf,
+			sdo_future_get_batch(future), batch);
+	if (context->n_changed < 0) {
+		sdo_batch_unref(batch);
+		goto nomem;
+	}
+
+	if (batch->n_items == 0) {
+		sdo_batch_unref(batch);
+		snapshot_rest__reply_restored(context, NULL);
+		goto done;
+	}
+
+	if (snapshot_rest__start(context, batch, snapshot_rest__on_restored,
+				 snapshot_rest__context_free) < 0) {
+		snapshot_rest__error(client, "500 Internal Server Error",
+				     "Failed to start sdo requests\r\n");
+		goto done;
+	}
+
+	return;
+
+nomem:
+	snapshot_rest__error(client, "500 Internal Server Error",
+			     "Out of memory\r\n");
+done:
+	snapshot_rest__context_free(context);
+}
+
+static void snapshot_rest__put(struct rest_client* client, int nodeid,
+			       const void* content)
+{
+	struct snapshot_rest_context* context =
+		snapshot_rest__context_new(client, nodeid);
+	if (!context)
+		goto nomem;
+
+	if (!content || co_dcf_parse(&context->dcf, content,
+				     client->req.content_length) < 0) {
+		snapshot_rest__context_free(context);
+		snapshot_rest__error(client, "400 Bad Request",
+				     "Content must be a concise DCF\r\n");
+		return;
+	}
+
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_BACKGROUND, 0);
+	if (!batch || co_dcf_add_entry_uploads(&context->dcf, batch) < 0) {
+		if (batch)
+			sdo_batch_unref(batch);
+		snapshot_rest__context_free(context);
+		goto nomem;
+	}
+
+	if (snapshot_rest__start(context, batch, snapshot_rest__on_compared,
+				 NULL) < 0) {
+		snapshot_rest__context_free(context);
+		snapshot_rest__error(client, "500 Internal Server Error",
+				     "Failed to start sdo requests\r\n");
+	}
+
+	return;
+
+nomem:
+	snapshot_rest__error(client, "500 Internal Server Error",
+			     "Out of memory\r\n");
+}
+
+void snapshot_rest_service(struct rest_client* client, const void* content)
+{
+	if (client->req.url_index != 2) {
+		snapshot_rest__error(client, "404 Not Found",
+				     "Wrong URL format. Must be /snapshot/<nodeid>\r\n");
+		return;
+	}
+
+	char* end = NULL;
+	long nodeid = strtol(client->req.url[1], &end, 10);
+	if (*end != '\0' || nodeid < CANOPEN_NODEID_MIN
+	 || nodeid > CANOPEN_NODEID_MAX) {
+		snapshot_rest__error(client, "404 Not Found",
+				     "URL is out of range\r\n");
+		return;
+	}
+
+	if (client->req.method == HTTP_GET)
+		snapshot_rest__get(client, nodeid);
+	else
+		snapshot_rest__put(client, nodeid, content);
+}
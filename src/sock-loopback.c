@@ -0,0 +1,495 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+
+#include "socketcan.h"
+#include "sock-loopback.h"
+#include "time-utils.h"
+#include "canopen/bus_load.h"
+
+#define SOCK_LOOPBACK__NAME_SIZE 64
+
+size_t strlcpy(char* dst, const char* src, size_t size);
+
+/* The rings work like mpmcq, but carry the frames themselves */
+struct sock_loopback__cell {
+	unsigned long sequence;
+	uint64_t timestamp;
+	struct canfd_frame cf;
+};
+
+struct sock_loopback__bus {
+	char name[SOCK_LOOPBACK__NAME_SIZE];
+	uint32_t bitrate; /* bits/s */
+	uint64_t busy_until; /* ns, CLOCK_MONOTONIC */
+	pthread_rwlock_t lock;
+	LIST_HEAD(, sock_loopback) endpoints;
+	LIST_ENTRY(sock_loopback__bus) links;
+};
+
+struct sock_loopback {
+	struct sock_loopback__bus* bus;
+	int fd;
+	int is_signalled;
+	uint64_t n_dropped;
+	size_t mask;
+	struct sock_loopback__cell* cell;
+	unsigned long head __attribute__((aligned(64)));
+	unsigned long tail __attribute__((aligned(64)));
+	LIST_ENTRY(sock_loopback) links;
+};
+
+static pthread_mutex_t sock_loopback__mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(, sock_loopback__bus) sock_loopback__buses =
+	LIST_HEAD_INITIALIZER(sock_loopback__buses);
+
+#define sock_loopback__load(ptr, order) __atomic_load_n(ptr, __ATOMIC_##order)
+#define sock_loopback__store(ptr, val, order) \
+	__atomic_store_n(ptr, val, __ATOMIC_##order)
+#define sock_loopback__cas(ptr, expected_ptr, desired) \
+	__atomic_compare_exchange_n(ptr, expected_ptr, desired, 1, \
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
+static inline uint64_t sock_loopback__now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sock_loopback__push(struct sock_loopback* self,
+			       const struct canfd_frame* cf, uint64_t timestamp)
+{
+	unsigned long pos = sock_loopback__load(&self->head, RELAXED);
+	struct sock_loopback__cell* cell;
+
+	for (;;) {
+		cell = &self->cell[pos & self->mask];
+		unsigned long sequence =
+			sock_loopback__load(&cell->sequence, ACQUIRE);
+		long diff = (long)(sequence - pos);
+
+		if (diff == 0) {
+			if (sock_loopback__cas(&self->head, &pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = sock_loopback__load(&self->head, RELAXED);
+		}
+	}
+
+	cell->cf = *cf;
+	cell->timestamp = timestamp;
+	sock_loopback__store(&cell->sequence, pos + 1, RELEASE);
+
+	return 0;
+}
+
+static int sock_loopback__pop(struct sock_loopback* self,
+			      struct canfd_frame* cf, uint64_t* timestamp)
+{
+	unsigned long pos = sock_loopback__load(&self->tail, RELAXED);
+	struct sock_loopback__cell* cell;
+
+	for (;;) {
+		cell = &self->cell[pos & self->mask];
+		unsigned long sequence =
+			sock_loopback__load(&cell->sequence, ACQUIRE);
+		long diff = (long)(sequence - (pos + 1));
+
+		if (diff == 0) {
+			if (sock_loopback__cas(&self->tail, &pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = sock_loopback__load(&self->tail, RELAXED);
+		}
+	}
+
+	*cf = cell->cf;
+	*timestamp = cell->timestamp;
+	sock_loopback__store(&cell->sequence, pos + self->mask + 1, RELEASE);
+
+	return 0;
+}
+
+static int sock_loopback__is_empty(const struct sock_loopback* self)
+{
+	unsigned long pos = sock_loopback__load(&self->tail, RELAXED);
+	const struct sock_loopback__cell* cell = &self->cell[pos & self->mask];
+	unsigned long sequence = sock_loopback__load(&cell->sequence, ACQUIRE);
+
+	return (long)(sequence - (pos + 1)) < 0;
+}
+
+/* Only the first sender after the receiver has cleared the flag writes to the
+ * eventfd. The receiver drains the eventfd before it clears the flag and
+ * empties the ring after that, so a frame is either seen by the receiver or
+ * followed by a wakeup.
+ */
+static void sock_loopback__signal(struct sock_loopback* self)
+{
+	if (__atomic_exchange_n(&self->is_signalled, 1, __ATOMIC_SEQ_CST))
+		return;
+
+	uint64_t one = 1;
+	ssize_t rc = write(self->fd, &one, sizeof(one));
+	(void)rc;
+}
+
+static void sock_loopback__unsignal(struct sock_loopback* self)
+{
+	uint64_t count;
+	ssize_t rc = read(self->fd, &count, sizeof(count));
+	(void)rc;
+
+	__atomic_store_n(&self->is_signalled, 0, __ATOMIC_SEQ_CST);
+}
+
+static int sock_loopback__parse(char* name, uint32_t* bitrate,
+				const char* addr)
+{
+	strlcpy(name, addr, SOCK_LOOPBACK__NAME_SIZE);
+	*bitrate = 0;
+
+	char* at = strchr(name, '@');
+	if (!at)
+		return name[0] ? 0 : -1;
+
+	*at++ = '\0';
+
+	char* end = NULL;
+	unsigned long value = strtoul(at, &end, 0);
+	if (!*at || *end || value == 0 || value > UINT32_MAX)
+		return -1;
+
+	*bitrate = value;
+	return name[0] ? 0 : -1;
+}
+
+static struct sock_loopback__bus* sock_loopback__find_bus(const char* name)
+{
+	struct sock_loopback__bus* bus;
+
+	LIST_FOREACH(bus, &sock_loopback__buses, links)
+		if (strcmp(bus->name, name) == 0)
+			return bus;
+
+	return NULL;
+}
+
+static struct sock_loopback__bus* sock_loopback__get_bus(const char* name,
+							 uint32_t bitrate)
+{
+	struct sock_loopback__bus* bus = sock_loopback__find_bus(name);
+	if (bus) {
+		if (bitrate && bitrate != bus->bitrate) {
+			errno = EINVAL;
+			return NULL;
+		}
+
+		return bus;
+	}
+
+	bus = malloc(sizeof(*bus));
+	if (!bus)
+		return NULL;
+
+	memset(bus, 0, sizeof(*bus));
+	strlcpy(bus->name, name, sizeof(bus->name));
+	bus->bitrate = bitrate;
+	pthread_rwlock_init(&bus->lock, NULL);
+	LIST_INIT(&bus->endpoints);
+	LIST_INSERT_HEAD(&sock_loopback__buses, bus, links);
+
+	return bus;
+}
+
+static void sock_loopback__put_bus(struct sock_loopback__bus* bus)
+{
+	if (!LIST_EMPTY(&bus->endpoints))
+		return;
+
+	LIST_REMOVE(bus, links);
+	pthread_rwlock_destroy(&bus->lock);
+	free(bus);
+}
+
+struct sock_loopback* sock_loopback_open(const char* addr)
+{
+	char name[SOCK_LOOPBACK__NAME_SIZE];
+	uint32_t bitrate;
+
+	if (sock_loopback__parse(name, &bitrate, addr) < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sock_loopback* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+
+	self->cell = malloc(SOCK_LOOPBACK_RING_SIZE * sizeof(*self->cell));
+	if (!self->cell)
+		goto cell_failure;
+
+	for (size_t i = 0; i < SOCK_LOOPBACK_RING_SIZE; ++i)
+		self->cell[i].sequence = i;
+
+	self->mask = SOCK_LOOPBACK_RING_SIZE - 1;
+
+	self->fd = eventfd(0, EFD_NONBLOCK);
+	if (self->fd < 0)
+		goto eventfd_failure;
+
+	pthread_mutex_lock(&sock_loopback__mutex);
+
+	self->bus = sock_loopback__get_bus(name, bitrate);
+	if (!self->bus) {
+		pthread_mutex_unlock(&sock_loopback__mutex);
+		goto bus_failure;
+	}
+
+	pthread_rwlock_wrlock(&self->bus->lock);
+	LIST_INSERT_HEAD(&self->bus->endpoints, self, links);
+	pthread_rwlock_unlock(&self->bus->lock);
+
+	pthread_mutex_unlock(&sock_loopback__mutex);
+
+	return self;
+
+bus_failure:
+	close(self->fd);
+eventfd_failure:
+	free(self->cell);
+cell_failure:
+	free(self);
+	return NULL;
+}
+
+void sock_loopback_close(struct sock_loopback* self)
+{
+	if (!self)
+		return;
+
+	struct sock_loopback__bus* bus = self->bus;
+
+	pthread_mutex_lock(&sock_loopback__mutex);
+
+	pthread_rwlock_wrlock(&bus->lock);
+	LIST_REMOVE(self, links);
+	pthread_rwlock_unlock(&bus->lock);
+
+	sock_loopback__put_bus(bus);
+
+	pthread_mutex_unlock(&sock_loopback__mutex);
+
+	close(self->fd);
+	free(self->cell);
+	free(self);
+}
+
+int sock_loopback_get_fd(const struct sock_loopback* self)
+{
+	return self->fd;
+}
+
+uint64_t sock_loopback_get_n_dropped(const struct sock_loopback* self)
+{
+	return __atomic_load_n(&self->n_dropped, __ATOMIC_RELAXED);
+}
+
+/* Books the bus for the frame and returns the time at which it has been
+ * transmitted, or 0 if the bus is booked too far ahead for a sender that
+ * does not wait.
+ */
+static uint64_t sock_loopback__book(struct sock_loopback__bus* bus,
+				    const struct canfd_frame* cf, uint64_t now,
+				    int flags)
+{
+	uint64_t duration = co_bus_load_frame_bits(cf) * 1000000000ULL
+			  / bus->bitrate;
+
+	uint64_t busy_until = __atomic_load_n(&bus->busy_until,
+					      __ATOMIC_RELAXED);
+	uint64_t end;
+
+	do {
+		uint64_t start = busy_until > now ? busy_until : now;
+
+		if ((flags & MSG_DONTWAIT) && start > now + SOCK_LOOPBACK_BACKLOG)
+			return 0;
+
+		end = start + duration;
+	} while (!__atomic_compare_exchange_n(&bus->busy_until, &busy_until,
+					      end, 1, __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	return end;
+}
+
+static void sock_loopback__sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000ULL,
+		.tv_nsec = t % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+	       == EINTR)
+		;
+}
+
+static void sock_loopback__deliver(struct sock_loopback* self,
+				   const struct canfd_frame* cf,
+				   uint64_t timestamp)
+{
+	struct sock_loopback__bus* bus = self->bus;
+	struct sock_loopback* peer;
+
+	pthread_rwlock_rdlock(&bus->lock);
+
+	LIST_FOREACH(peer, &bus->endpoints, links) {
+		if (peer == self)
+			continue;
+
+		if (sock_loopback__push(peer, cf, timestamp) < 0) {
+			__atomic_add_fetch(&peer->n_dropped, 1,
+					   __ATOMIC_RELAXED);
+			continue;
+		}
+
+		sock_loopback__signal(peer);
+	}
+
+	pthread_rwlock_unlock(&bus->lock);
+}
+
+ssize_t sock_loopback_send(struct sock_loopback* self,
+			   const struct canfd_frame* cf, size_t n, int flags)
+{
+	struct sock_loopback__bus* bus = self->bus;
+
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t timestamp = gettime_us(CLOCK_REALTIME);
+
+		if (bus->bitrate) {
+			uint64_t now = sock_loopback__now();
+			uint64_t end = sock_loopback__book(bus, &cf[i], now,
+							   flags);
+			if (end == 0) {
+				if (i > 0)
+					return i;
+
+				errno = ENOBUFS;
+				return -1;
+			}
+
+			if (flags & MSG_DONTWAIT) {
+				timestamp += (end - now) / 1000;
+			} else {
+				sock_loopback__sleep_until(end);
+				timestamp = gettime_us(CLOCK_REALTIME);
+			}
+		}
+
+		sock_loopback__deliver(self, &cf[i], timestamp);
+	}
+
+	return n;
+}
+
+static size_t sock_loopback__take(struct sock_loopback* self,
+				  struct canfd_frame* cf, uint64_t* ts,
+				  size_t n)
+{
+	sock_loopback__unsignal(self);
+
+	size_t count = 0;
+	uint64_t timestamp;
+
+	while (count < n && sock_loopback__pop(self, &cf[count], &timestamp) == 0) {
+		if (ts)
+			ts[count] = timestamp;
+		++count;
+	}
+
+	/* The eventfd has been read, so it must be set again for whatever the
+	 * caller did not have room for.
+	 */
+	if (!sock_loopback__is_empty(self))
+		sock_loopback__signal(self);
+
+	return count;
+}
+
+static int sock_loopback__wait(struct sock_loopback* self, int timeout)
+{
+	struct pollfd pollfd = { .fd = self->fd, .events = POLLIN };
+
+	int rc = poll(&pollfd, 1, timeout);
+	if (rc == 0)
+		errno = ETIMEDOUT;
+
+	return rc == 1 ? 0 : -1;
+}
+
+ssize_t sock_loopback_recv(struct sock_loopback* self, struct canfd_frame* cf,
+			   uint64_t* ts, size_t n, int flags)
+{
+	while (1) {
+		size_t count = sock_loopback__take(self, cf, ts, n);
+		if (count > 0 || n == 0)
+			return count;
+
+		if (flags & MSG_DONTWAIT) {
+			errno = EAGAIN;
+			return -1;
+		}
+
+		if (sock_loopback__wait(self, -1) < 0)
+			return -1;
+	}
+}
+
+int sock_loopback_timed_recv(struct sock_loopback* self,
+			     struct canfd_frame* cf, uint64_t* ts, int timeout)
+{
+	uint64_t deadline = gettime_ms(CLOCK_MONOTONIC) + timeout;
+
+	while (1) {
+		if (sock_loopback__take(self, cf, ts, 1) == 1)
+			return 0;
+
+		int64_t left = deadline - gettime_ms(CLOCK_MONOTONIC);
+		if (left < 0 || sock_loopback__wait(self, left) < 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+}
@@ -0,0 +1,250 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "socketcan.h"
+#include "sock-udp.h"
+#include "net-util.h"
+#include "time-utils.h"
+#include "plog.h"
+
+#define SOCK_UDP_RCVBUF (1024 * 1024)
+
+size_t strlcpy(char* dst, const char* src, size_t size);
+
+struct sock_udp {
+	unsigned char buffer[SOCK_UDP_MAX_SIZE];
+	size_t pos;
+	size_t count;
+	uint64_t timestamp;
+
+	int is_synced;
+	uint32_t expected;
+
+	struct sock_udp_stats stats;
+};
+
+int sock_udp_parse_address(struct sockaddr_in* dst, const char* addr)
+{
+	char buffer[256];
+	strlcpy(buffer, addr, sizeof(buffer));
+
+	int port = SOCK_UDP_DEFAULT_PORT;
+
+	char* portptr = strchr(buffer, ':');
+	if (portptr) {
+		*portptr++ = '\0';
+		port = atoi(portptr);
+	}
+
+	memset(dst, 0, sizeof(*dst));
+	dst->sin_family = AF_INET;
+	dst->sin_port = htons(port);
+
+	if (port <= 0 || port > 0xffff
+	 || inet_pton(AF_INET, buffer, &dst->sin_addr) != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int sock_udp_open_publisher(int ttl)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	unsigned char value = ttl;
+	if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &value,
+		       sizeof(value)) < 0)
+		goto failure;
+
+	return fd;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+size_t sock_udp_encode(void* dst, uint32_t seq, const struct can_frame* cf,
+		       size_t n)
+{
+	struct sock_udp_header header = {
+		.magic = htonl(SOCK_UDP_MAGIC),
+		.seq = htonl(seq),
+		.n_frames = htons(n),
+	};
+
+	memcpy(dst, &header, sizeof(header));
+	memcpy((char*)dst + sizeof(header), cf, n * sizeof(*cf));
+
+	return sizeof(header) + n * sizeof(*cf);
+}
+
+int sock_udp_open_subscriber(const char* addr)
+{
+	struct sockaddr_in group;
+	if (sock_udp_parse_address(&group, addr) < 0)
+		return -1;
+
+	int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	/* Several subscribers may run on the same host */
+	net_reuse_addr(fd);
+
+	int rcvbuf = SOCK_UDP_RCVBUF;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	if (bind(fd, (struct sockaddr*)&group, sizeof(group)) < 0)
+		goto failure;
+
+	if (IN_MULTICAST(ntohl(group.sin_addr.s_addr))) {
+		struct ip_mreq mreq = {
+			.imr_multiaddr = group.sin_addr,
+			.imr_interface.s_addr = htonl(INADDR_ANY),
+		};
+
+		if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+			       sizeof(mreq)) < 0)
+			goto failure;
+	}
+
+	return fd;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+struct sock_udp* sock_udp_new(void)
+{
+	struct sock_udp* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+	return self;
+}
+
+void sock_udp_free(struct sock_udp* self)
+{
+	free(self);
+}
+
+static void sock_udp__check_sequence(struct sock_udp* self, uint32_t seq,
+				    size_t n)
+{
+	int32_t delta = seq - self->expected;
+
+	if (self->is_synced && delta > 0) {
+		self->stats.n_lost += delta;
+		self->stats.n_gaps++;
+		plog(LOG_WARNING, "sock_udp: Lost %d frames from the multicast feed",
+		     delta);
+	} else if (self->is_synced && delta < 0) {
+		plog(LOG_NOTICE, "sock_udp: Sequence went back by %d; the publisher may have restarted",
+		     -delta);
+	}
+
+	self->is_synced = 1;
+	self->expected = seq + n;
+	self->stats.n_frames += n;
+}
+
+static int sock_udp__accept(struct sock_udp* self, size_t size)
+{
+	struct sock_udp_header header;
+
+	if (size < sizeof(header))
+		return -1;
+
+	memcpy(&header, self->buffer, sizeof(header));
+
+	size_t n = ntohs(header.n_frames);
+
+	if (ntohl(header.magic) != SOCK_UDP_MAGIC || n > SOCK_UDP_MAX_FRAMES
+	 || size != sizeof(header) + n * sizeof(struct can_frame))
+		return -1;
+
+	sock_udp__check_sequence(self, ntohl(header.seq), n);
+
+	self->pos = 0;
+	self->count = n;
+	self->timestamp = gettime_us(CLOCK_REALTIME);
+	return 0;
+}
+
+int sock_udp_has_pending(const struct sock_udp* self)
+{
+	return self->pos < self->count;
+}
+
+ssize_t sock_udp_recv(struct sock_udp* self, int fd, struct canfd_frame* cf,
+		      uint64_t* ts, size_t n, int flags)
+{
+	size_t count = 0;
+
+	flags &= ~(MSG_WAITFORONE | MSG_WAITALL);
+
+	while (count < n) {
+		if (self->pos == self->count) {
+			/* Don't wait for more once there is something */
+			ssize_t rc = recv(fd, self->buffer, sizeof(self->buffer),
+					  count > 0 ? flags | MSG_DONTWAIT
+						    : flags);
+			if (rc < 0)
+				return count > 0 ? (ssize_t)count : -1;
+
+			if (sock_udp__accept(self, rc) < 0)
+				self->stats.n_invalid++;
+
+			continue;
+		}
+
+		struct can_frame frame;
+		memcpy(&frame, &self->buffer[sizeof(struct sock_udp_header)
+					     + self->pos * sizeof(frame)],
+		       sizeof(frame));
+		frame.can_id = ntohl(frame.can_id);
+
+		memset(&cf[count], 0, sizeof(cf[count]));
+		memcpy(&cf[count], &frame, sizeof(frame));
+
+		if (ts)
+			ts[count] = self->timestamp;
+
+		++self->pos;
+		++count;
+	}
+
+	return count;
+}
+
+void sock_udp_get_stats(const struct sock_udp* self,
+			struct sock_udp_stats* stats)
+{
+	*stats = self->stats;
+}
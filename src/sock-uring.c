@@ -0,0 +1,599 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "socketcan.h"
+#include "sock-uring.h"
+#include "time-utils.h"
+
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define SOCK_URING__HAVE_IO_URING
+#endif
+
+#ifdef SOCK_URING__HAVE_IO_URING
+
+#include <sys/mman.h>
+
+#define SOCK_URING__RX_ENTRIES 4
+#define SOCK_URING__TX_ENTRIES 64
+
+/* This must be a power of 2. Every received frame that has not been collected
+ * yet holds one buffer and one completion queue entry.
+ */
+#define SOCK_URING__N_BUFFERS 256
+
+#define SOCK_URING__CONTROL_SIZE CMSG_SPACE(3 * sizeof(struct timespec))
+
+#define SOCK_URING__BUFFER_SIZE \
+	(sizeof(struct io_uring_recvmsg_out) + SOCK_URING__CONTROL_SIZE \
+	 + CANFD_MTU)
+
+#define SOCK_URING__BGID 0
+#define SOCK_URING__RECV_TAG 1
+
+struct sock_uring__ring {
+	int fd;
+	unsigned entries;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned sqe_tail;
+
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	void* sq_ptr;
+	size_t sq_size;
+	void* cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+};
+
+struct sock_uring {
+	int fd;
+
+	struct sock_uring__ring rx;
+	struct sock_uring__ring tx;
+	pthread_mutex_t tx_lock;
+
+	struct io_uring_buf_ring* buf_ring;
+	size_t buf_ring_size;
+	unsigned char* buffers;
+
+	struct msghdr msg;
+	int is_armed;
+};
+
+static inline int sock_uring__setup(unsigned entries,
+				    struct io_uring_params* p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int sock_uring__enter(int fd, unsigned to_submit,
+				    unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		       NULL, 0);
+}
+
+static inline int sock_uring__register(int fd, unsigned opcode, void* arg,
+				       unsigned n)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+static void sock_uring__ring_destroy(struct sock_uring__ring* ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+
+	if (ring->cq_ptr)
+		munmap(ring->cq_ptr, ring->cq_size);
+
+	if (ring->sq_ptr)
+		munmap(ring->sq_ptr, ring->sq_size);
+
+	if (ring->fd >= 0)
+		close(ring->fd);
+}
+
+static void* sock_uring__map(int fd, size_t size, off_t offset)
+{
+	void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, fd, offset);
+	return ptr != MAP_FAILED ? ptr : NULL;
+}
+
+static int sock_uring__ring_init(struct sock_uring__ring* ring,
+				 unsigned entries, unsigned cq_entries)
+{
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = cq_entries;
+
+	ring->fd = sock_uring__setup(entries, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->entries = p.sq_entries;
+
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->sq_ptr = sock_uring__map(ring->fd, ring->sq_size,
+				       IORING_OFF_SQ_RING);
+	if (!ring->sq_ptr)
+		goto failure;
+
+	ring->cq_size = p.cq_off.cqes
+		      + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->cq_ptr = sock_uring__map(ring->fd, ring->cq_size,
+				       IORING_OFF_CQ_RING);
+	if (!ring->cq_ptr)
+		goto failure;
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = sock_uring__map(ring->fd, ring->sqes_size,
+				     IORING_OFF_SQES);
+	if (!ring->sqes)
+		goto failure;
+
+	char* sq = ring->sq_ptr;
+	ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+	ring->sqe_tail = *ring->sq_tail;
+
+	char* cq = ring->cq_ptr;
+	ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	return 0;
+
+failure:
+	sock_uring__ring_destroy(ring);
+	return -1;
+}
+
+static struct io_uring_sqe* sock_uring__get_sqe(struct sock_uring__ring* ring)
+{
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = ring->sqe_tail;
+
+	if (tail - head >= ring->entries)
+		return NULL;
+
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+
+	ring->sq_array[index] = index;
+	ring->sqe_tail = tail + 1;
+
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+/* Make the prepared entries visible to the kernel and tell it about them */
+static int sock_uring__submit(struct sock_uring__ring* ring,
+			      unsigned min_complete)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned to_submit = ring->sqe_tail - tail;
+
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+	unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+	int rc;
+	do rc = sock_uring__enter(ring->fd, to_submit, min_complete, flags);
+	while (rc < 0 && errno == EINTR);
+
+	return rc;
+}
+
+static struct io_uring_cqe* sock_uring__peek_cqe(struct sock_uring__ring* ring)
+{
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return NULL;
+
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+static inline void sock_uring__cqe_seen(struct sock_uring__ring* ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static void sock_uring__recycle_buffer(struct sock_uring* self, unsigned bid)
+{
+	struct io_uring_buf_ring* br = self->buf_ring;
+	unsigned short tail = br->tail;
+
+	struct io_uring_buf* buf =
+		&br->bufs[tail & (SOCK_URING__N_BUFFERS - 1)];
+
+	buf->addr = (uintptr_t)&self->buffers[bid * SOCK_URING__BUFFER_SIZE];
+	buf->len = SOCK_URING__BUFFER_SIZE;
+	buf->bid = bid;
+
+	__atomic_store_n(&br->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int sock_uring__init_buffers(struct sock_uring* self)
+{
+	self->buf_ring_size = SOCK_URING__N_BUFFERS
+			    * sizeof(struct io_uring_buf);
+
+	void* ring = mmap(NULL, self->buf_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (ring == MAP_FAILED)
+		return -1;
+
+	self->buf_ring = ring;
+	self->buf_ring->tail = 0;
+
+	self->buffers = malloc(SOCK_URING__N_BUFFERS * SOCK_URING__BUFFER_SIZE);
+	if (!self->buffers)
+		return -1;
+
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (uintptr_t)self->buf_ring,
+		.ring_entries = SOCK_URING__N_BUFFERS,
+		.bgid = SOCK_URING__BGID,
+	};
+
+	if (sock_uring__register(self->rx.fd, IORING_REGISTER_PBUF_RING, &reg,
+				 1) < 0)
+		return -1;
+
+	for (unsigned i = 0; i < SOCK_URING__N_BUFFERS; ++i)
+		sock_uring__recycle_buffer(self, i);
+
+	return 0;
+}
+
+static int sock_uring__arm_recv(struct sock_uring* self)
+{
+	struct io_uring_sqe* sqe = sock_uring__get_sqe(&self->rx);
+	if (!sqe)
+		return -1;
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = self->fd;
+	sqe->addr = (uintptr_t)&self->msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = SOCK_URING__BGID;
+	sqe->user_data = SOCK_URING__RECV_TAG;
+
+	if (sock_uring__submit(&self->rx, 0) < 0)
+		return -1;
+
+	self->is_armed = 1;
+	return 0;
+}
+
+struct sock_uring* sock_uring_new(int fd)
+{
+	struct sock_uring* self = calloc(1, sizeof(*self));
+	if (!self)
+		return NULL;
+
+	self->fd = fd;
+	self->rx.fd = -1;
+	self->tx.fd = -1;
+
+	self->msg.msg_controllen = SOCK_URING__CONTROL_SIZE;
+
+	if (sock_uring__ring_init(&self->rx, SOCK_URING__RX_ENTRIES,
+				  SOCK_URING__N_BUFFERS) < 0)
+		goto failure;
+
+	if (sock_uring__ring_init(&self->tx, SOCK_URING__TX_ENTRIES,
+				  SOCK_URING__TX_ENTRIES) < 0)
+		goto failure;
+
+	if (sock_uring__init_buffers(self) < 0)
+		goto failure;
+
+	if (sock_uring__arm_recv(self) < 0)
+		goto failure;
+
+	pthread_mutex_init(&self->tx_lock, NULL);
+
+	return self;
+
+failure:
+	sock_uring__ring_destroy(&self->tx);
+	sock_uring__ring_destroy(&self->rx);
+	if (self->buf_ring)
+		munmap(self->buf_ring, self->buf_ring_size);
+	free(self->buffers);
+	free(self);
+	return NULL;
+}
+
+void sock_uring_free(struct sock_uring* self)
+{
+	if (!self)
+		return;
+
+	/* Closing the ring cancels the pending receive */
+	sock_uring__ring_destroy(&self->tx);
+	sock_uring__ring_destroy(&self->rx);
+	munmap(self->buf_ring, self->buf_ring_size);
+	free(self->buffers);
+	pthread_mutex_destroy(&self->tx_lock);
+	free(self);
+}
+
+int sock_uring_get_fd(const struct sock_uring* self)
+{
+	return self->rx.fd;
+}
+
+/* Returns 1 if a frame was extracted, 0 if the completion carried none */
+static int sock_uring__unpack(struct sock_uring* self,
+			      const struct io_uring_cqe* cqe,
+			      struct canfd_frame* cf, uint64_t* ts)
+{
+	if (!(cqe->flags & IORING_CQE_F_BUFFER))
+		return 0;
+
+	unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	unsigned char* buf = &self->buffers[bid * SOCK_URING__BUFFER_SIZE];
+
+	const struct io_uring_recvmsg_out* out = (const void*)buf;
+	unsigned char* control = buf + sizeof(*out) + self->msg.msg_namelen;
+	const unsigned char* payload = control + self->msg.msg_controllen;
+
+	int rc = 0;
+
+	if (out->flags & MSG_TRUNC)
+		goto done;
+
+	switch (out->payloadlen) {
+	case CANFD_MTU:
+		memcpy(cf, payload, CANFD_MTU);
+		cf->flags |= CANFD_FDF;
+		break;
+	case CAN_MTU:
+		memcpy(cf, payload, CAN_MTU);
+		cf->flags = 0;
+		break;
+	default:
+		goto done;
+	}
+
+	if (ts) {
+		struct msghdr msg = {
+			.msg_control = control,
+			.msg_controllen = out->controllen,
+		};
+		*ts = sock_get_cmsg_timestamp(&msg);
+	}
+
+	rc = 1;
+done:
+	sock_uring__recycle_buffer(self, bid);
+	return rc;
+}
+
+static ssize_t sock_uring__reap(struct sock_uring* self,
+				struct canfd_frame* cf, uint64_t* ts, size_t n)
+{
+	struct io_uring_cqe* cqe;
+	size_t count = 0;
+	int error = 0;
+
+	while (count < n && (cqe = sock_uring__peek_cqe(&self->rx))) {
+		if (cqe->res < 0 && cqe->res != -ENOBUFS)
+			error = -cqe->res;
+		else
+			count += sock_uring__unpack(self, cqe, &cf[count],
+						    ts ? &ts[count] : NULL);
+
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			self->is_armed = 0;
+
+		sock_uring__cqe_seen(&self->rx);
+	}
+
+	/* The kernel stops a multishot receive on errors and when it runs out
+	 * of buffers.
+	 */
+	if (!self->is_armed && sock_uring__arm_recv(self) < 0 && count == 0)
+		return -1;
+
+	if (count == 0 && error) {
+		errno = error;
+		return -1;
+	}
+
+	return count;
+}
+
+ssize_t sock_uring_recv(struct sock_uring* self, struct canfd_frame* cf,
+			uint64_t* ts, size_t n, int timeout)
+{
+	ssize_t count = sock_uring__reap(self, cf, ts, n);
+	if (count != 0)
+		return count;
+
+	struct pollfd pollfd = { .fd = self->rx.fd, .events = POLLIN };
+
+	uint64_t t_end = gettime_ms(CLOCK_MONOTONIC) + timeout;
+
+	while (timeout != 0) {
+		int rc = poll(&pollfd, 1, timeout);
+		if (rc < 0 && errno != EINTR)
+			return -1;
+
+		count = sock_uring__reap(self, cf, ts, n);
+		if (count != 0)
+			return count;
+
+		if (timeout > 0) {
+			int64_t left = t_end - gettime_ms(CLOCK_MONOTONIC);
+			timeout = left > 0 ? left : 0;
+		}
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+static ssize_t sock_uring__send_chain(struct sock_uring* self,
+				      const struct canfd_frame* cf, size_t n,
+				      int flags)
+{
+	struct sock_uring__ring* ring = &self->tx;
+
+	for (size_t i = 0; i < n; ++i) {
+		struct io_uring_sqe* sqe = sock_uring__get_sqe(ring);
+
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = self->fd;
+		sqe->addr = (uintptr_t)&cf[i];
+		sqe->len = canfd_is_fd(&cf[i]) ? CANFD_MTU : CAN_MTU;
+		sqe->msg_flags = flags;
+		sqe->user_data = i;
+
+		/* A failed send cancels the rest so that order is kept */
+		if (i + 1 < n)
+			sqe->flags = IOSQE_IO_LINK;
+	}
+
+	if (sock_uring__submit(ring, n) < 0)
+		return -1;
+
+	size_t count = 0;
+	int error = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		struct io_uring_cqe* cqe;
+
+		while (!(cqe = sock_uring__peek_cqe(ring)))
+			if (sock_uring__enter(ring->fd, 0, 1,
+					      IORING_ENTER_GETEVENTS) < 0
+			    && errno != EINTR)
+				return count > 0 ? (ssize_t)count : -1;
+
+		if (cqe->res >= 0 && !error)
+			++count;
+		else if (!error)
+			error = -cqe->res;
+
+		sock_uring__cqe_seen(ring);
+	}
+
+	if (error)
+		errno = error;
+
+	return count > 0 ? (ssize_t)count : (error ? -1 : 0);
+}
+
+ssize_t sock_uring_send(struct sock_uring* self,
+			const struct canfd_frame* cf, size_t n, int flags)
+{
+	size_t count = 0;
+
+	pthread_mutex_lock(&self->tx_lock);
+
+	while (count < n) {
+		size_t chunk = n - count;
+		if (chunk > self->tx.entries)
+			chunk = self->tx.entries;
+
+		ssize_t rc = sock_uring__send_chain(self, &cf[count], chunk,
+						    flags);
+		if (rc > 0)
+			count += rc;
+
+		if (rc < (ssize_t)chunk)
+			break;
+	}
+
+	pthread_mutex_unlock(&self->tx_lock);
+
+	return count > 0 ? (ssize_t)count : -1;
+}
+
+#else /* SOCK_URING__HAVE_IO_URING */
+
+struct sock_uring* sock_uring_new(int fd)
+{
+	(void)fd;
+	errno = ENOSYS;
+	return NULL;
+}
+
+void sock_uring_free(struct sock_uring* self)
+{
+	(void)self;
+}
+
+int sock_uring_get_fd(const struct sock_uring* self)
+{
+	(void)self;
+	return -1;
+}
+
+ssize_t sock_uring_recv(struct sock_uring* self, struct canfd_frame* cf,
+			uint64_t* ts, size_t n, int timeout)
+{
+	(void)self; (void)cf; (void)ts; (void)n; (void)timeout;
+	errno = ENOSYS;
+	return -1;
+}
+
+ssize_t sock_uring_send(struct sock_uring* self,
+			const struct canfd_frame* cf, size_t n, int flags)
+{
+	(void)self; (void)cf; (void)n; (void)flags;
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif /* SOCK_URING__HAVE_IO_URING */
@@ -19,12 +19,23 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <poll.h>
+#include <linux/net_tstamp.h>
 
 #include "sock.h"
+#include "sock-udp.h"
+#include "sock-loopback.h"
 #include "socketcan.h"
 #include "net-util.h"
 #include "can-tcp.h"
 #include "trace-buffer.h"
+#include "time-utils.h"
+#include "plog.h"
+
+#define SOCK__TCP_FINISH_TIMEOUT 1000 /* ms */
+#define SOCK__CONTROL_SIZE CMSG_SPACE(3 * sizeof(struct timespec))
 
 size_t strlcpy(char* dst, const char* src, size_t size);
 
@@ -41,23 +52,68 @@ static int sock__open_tcp(const char* addr)
 	return can_tcp_open(buffer, port);
 }
 
+static enum sock_type sock__parse_scheme(const char** addr,
+					 enum sock_type type)
+{
+	static const struct {
+		const char* prefix;
+		enum sock_type type;
+	} schemes[] = {
+		{ "can:", SOCK_TYPE_CAN },
+		{ "tcp:", SOCK_TYPE_TCP },
+		{ "unix:", SOCK_TYPE_UNIX },
+		{ "udp:", SOCK_TYPE_UDP },
+		{ "loop:", SOCK_TYPE_LOOPBACK },
+	};
+
+	for (size_t i = 0; i < sizeof(schemes) / sizeof(schemes[0]); ++i) {
+		size_t len = strlen(schemes[i].prefix);
+		if (strncmp(*addr, schemes[i].prefix, len) == 0) {
+			*addr += len;
+			return schemes[i].type;
+		}
+	}
+
+	return type;
+}
+
 int sock_open(struct sock* sock, enum sock_type type, const char* addr,
 	      struct tracebuffer* tb)
 {
+	struct sock_loopback* loopback = NULL;
 	int fd = -1;
+
+	type = sock__parse_scheme(&addr, type);
+
 	switch (type) {
 	case SOCK_TYPE_CAN: fd = socketcan_open(addr); break;
 	case SOCK_TYPE_TCP: fd = sock__open_tcp(addr); break;
+	case SOCK_TYPE_UNIX: fd = net_unix_connect(addr); break;
+	case SOCK_TYPE_UDP: fd = sock_udp_open_subscriber(addr); break;
+	case SOCK_TYPE_LOOPBACK:
+		loopback = sock_loopback_open(addr);
+		fd = loopback ? sock_loopback_get_fd(loopback) : -1;
+		break;
 	default: abort();
 	}
 	sock_init(sock, type, fd, tb);
+	sock->loopback = loopback;
+
+	if (fd >= 0 && type == SOCK_TYPE_UDP) {
+		sock->udp = sock_udp_new();
+		if (!sock->udp) {
+			close(fd);
+			return -1;
+		}
+	}
+
 	return fd;
 }
 
 static inline struct can_frame*
 sock__frame_htonl(const struct sock* sock, struct can_frame* cf)
 {
-	if (sock->type != SOCK_TYPE_CAN)
+	if (sock->type == SOCK_TYPE_TCP)
 		cf->can_id = htonl(cf->can_id);
 	return cf;
 }
@@ -65,29 +121,274 @@ sock__frame_htonl(const struct sock* sock, struct can_frame* cf)
 static inline struct can_frame*
 sock__frame_ntohl(const struct sock* sock, struct can_frame* cf)
 {
-	if (sock->type != SOCK_TYPE_CAN)
+	if (sock->type == SOCK_TYPE_TCP)
 		cf->can_id = ntohl(cf->can_id);
 	return cf;
 }
 
+static ssize_t sock__send_batch_loopback(const struct sock* sock,
+					 const struct can_frame* cf, size_t n,
+					 int flags)
+{
+	struct canfd_frame cfd[n];
+
+	for (size_t i = 0; i < n; ++i) {
+		memcpy(&cfd[i], &cf[i], sizeof(cf[i]));
+		cfd[i].flags = 0;
+	}
+
+	return sock_loopback_send(sock->loopback, cfd, n, flags);
+}
+
 ssize_t sock_send(const struct sock* sock, struct can_frame* cf, int flags)
 {
 	if (sock->tb)
 		tb_append(sock->tb, cf);
 
+	if (sock->loopback)
+		return sock__send_batch_loopback(sock, cf, 1, flags) == 1
+		       ? (ssize_t)sizeof(*cf) : -1;
+
 	return send(sock->fd, sock__frame_htonl(sock, cf), sizeof(*cf), flags);
 }
 
+static ssize_t sock__send_batch_can(const struct sock* sock,
+				    const struct can_frame* cf, size_t n,
+				    int flags)
+{
+	struct mmsghdr msg[n];
+	struct iovec iov[n];
+
+	memset(msg, 0, sizeof(msg));
+
+	for (size_t i = 0; i < n; ++i) {
+		iov[i].iov_base = (void*)&cf[i];
+		iov[i].iov_len = sizeof(*cf);
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	size_t count = 0;
+	while (count < n) {
+		int rc = sendmmsg(sock->fd, &msg[count], n - count, flags);
+		if (rc <= 0)
+			return count > 0 ? (ssize_t)count : rc;
+
+		count += rc;
+	}
+
+	return count;
+}
+
+/* The rest of a frame that the socket only took part of is written before
+ * returning, waiting for the socket if need be. The stream would be out of
+ * step otherwise, as the caller sends the whole frame again.
+ */
+static int sock__finish_frame_tcp(const struct sock* sock, const char* data,
+				  size_t size)
+{
+	while (size > 0) {
+		ssize_t wsize = net_write(sock->fd, data, size,
+					  SOCK__TCP_FINISH_TIMEOUT);
+		if (wsize <= 0) {
+			shutdown(sock->fd, SHUT_RDWR);
+			return -1;
+		}
+
+		data += wsize;
+		size -= wsize;
+	}
+
+	return 0;
+}
+
+/* The frames are converted to network byte order in a copy, so that frames
+ * that are not sent stay as they were for the next attempt.
+ */
+static ssize_t sock__send_batch_tcp(const struct sock* sock,
+				    const struct can_frame* cf, size_t n,
+				    int flags)
+{
+	struct can_frame wire[n];
+
+	for (size_t i = 0; i < n; ++i) {
+		wire[i] = cf[i];
+		wire[i].can_id = htonl(cf[i].can_id);
+	}
+
+	size_t size = n * sizeof(*cf);
+	size_t total = 0;
+	ssize_t wsize = 0;
+
+	while (total < size) {
+		wsize = send(sock->fd, (char*)wire + total, size - total,
+			     flags);
+		if (wsize <= 0)
+			break;
+
+		total += wsize;
+	}
+
+	if (total == 0)
+		return wsize;
+
+	int error = errno;
+	size_t rest = total % sizeof(*cf);
+
+	if (rest && sock__finish_frame_tcp(sock, (char*)wire + total,
+					   sizeof(*cf) - rest) == 0)
+		total += sizeof(*cf) - rest;
+
+	errno = error;
+	return total / sizeof(*cf);
+}
+
+static ssize_t sock__send_batch_uring(const struct sock* sock,
+				      const struct can_frame* cf, size_t n,
+				      int flags)
+{
+	struct canfd_frame cfd[n];
+
+	for (size_t i = 0; i < n; ++i) {
+		memcpy(&cfd[i], &cf[i], sizeof(cf[i]));
+		cfd[i].flags = 0;
+	}
+
+	return sock_uring_send(sock->uring, cfd, n, flags);
+}
+
+static ssize_t sock__send_batch(const struct sock* sock,
+				const struct can_frame* cf, size_t n, int flags)
+{
+	if (sock->uring)
+		return sock__send_batch_uring(sock, cf, n, flags);
+
+	switch (sock->type) {
+	case SOCK_TYPE_CAN:
+	case SOCK_TYPE_UNIX: return sock__send_batch_can(sock, cf, n, flags);
+	case SOCK_TYPE_TCP: return sock__send_batch_tcp(sock, cf, n, flags);
+	case SOCK_TYPE_UDP: errno = EOPNOTSUPP; return -1;
+	case SOCK_TYPE_LOOPBACK:
+		return sock__send_batch_loopback(sock, cf, n, flags);
+	default: abort();
+	}
+
+	return -1;
+}
+
+/* Only the frames that were sent are traced, so that frames that are sent
+ * again after a short send are not traced twice.
+ */
+ssize_t sock_send_batch(const struct sock* sock, const struct can_frame* cf,
+			size_t n, int flags)
+{
+	ssize_t rc = sock__send_batch(sock, cf, n, flags);
+
+	if (sock->tb)
+		for (ssize_t i = 0; i < rc; ++i)
+			tb_append(sock->tb, &cf[i]);
+
+	return rc;
+}
+
 int sock_timed_send(const struct sock* sock, struct can_frame* cf, int timeout)
 {
 	if (sock->tb)
 		tb_append(sock->tb, cf);
 
+	/* The bus is never booked for long, so this does not need a timeout */
+	if (sock->loopback)
+		return sock__send_batch_loopback(sock, cf, 1, 0) == 1
+		       ? (ssize_t)sizeof(*cf) : -1;
+
 	return net_write_frame(sock->fd, sock__frame_htonl(sock, cf), timeout);
 }
 
+static inline int sock__uring_timeout(int flags)
+{
+	return flags & MSG_DONTWAIT ? 0 : -1;
+}
+
+static ssize_t sock__recv_uring(const struct sock* sock, struct can_frame* cf,
+				uint64_t* ts, size_t n, int timeout)
+{
+	struct canfd_frame cfd[n];
+
+	ssize_t count = sock_uring_recv(sock->uring, cfd, ts, n, timeout);
+
+	for (ssize_t i = 0; i < count; ++i)
+		memcpy(&cf[i], &cfd[i], sizeof(cf[i]));
+
+	return count;
+}
+
+static ssize_t sock__recv_batch_udp(const struct sock* sock,
+				    struct can_frame* cf, uint64_t* ts,
+				    size_t n, int flags)
+{
+	struct canfd_frame cfd[n];
+
+	ssize_t count = sock_udp_recv(sock->udp, sock->fd, cfd, ts, n, flags);
+
+	for (ssize_t i = 0; i < count; ++i)
+		memcpy(&cf[i], &cfd[i], sizeof(cf[i]));
+
+	return count;
+}
+
+static ssize_t sock__recv_batch_loopback(const struct sock* sock,
+					 struct can_frame* cf, uint64_t* ts,
+					 size_t n, int flags)
+{
+	struct canfd_frame cfd[n];
+
+	ssize_t count = sock_loopback_recv(sock->loopback, cfd, ts, n, flags);
+
+	for (ssize_t i = 0; i < count; ++i)
+		memcpy(&cf[i], &cfd[i], sizeof(cf[i]));
+
+	return count;
+}
+
 ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags)
 {
+	if (sock->udp) {
+		ssize_t count = sock__recv_batch_udp(sock, cf, NULL, 1, flags);
+		if (count <= 0)
+			return count;
+
+		if (sock->tb)
+			tb_append(sock->tb, cf);
+
+		return sizeof(*cf);
+	}
+
+	if (sock->uring) {
+		uint64_t ts;
+		ssize_t count = sock__recv_uring(sock, cf, &ts, 1,
+						 sock__uring_timeout(flags));
+		if (count <= 0)
+			return count;
+
+		if (sock->tb)
+			tb_append_ts(sock->tb, cf, ts);
+
+		return sizeof(*cf);
+	}
+
+	if (sock->loopback) {
+		uint64_t ts;
+		ssize_t count = sock__recv_batch_loopback(sock, cf, &ts, 1,
+							  flags);
+		if (count <= 0)
+			return count;
+
+		if (sock->tb)
+			tb_append_ts(sock->tb, cf, ts);
+
+		return sizeof(*cf);
+	}
+
 	ssize_t rsize = recv(sock->fd, cf, sizeof(*cf), flags);
 	if (rsize <= 0)
 		return rsize;
@@ -99,8 +400,241 @@ ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags)
 	return rsize;
 }
 
+int sock_enable_timestamps(const struct sock* sock)
+{
+	if (sock->type != SOCK_TYPE_CAN)
+		return -1;
+
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+		  | SOF_TIMESTAMPING_RX_HARDWARE
+		  | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if (setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+		       sizeof(flags)) == 0)
+		return 0;
+
+	int one = 1;
+	return setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPNS, &one,
+			  sizeof(one));
+}
+
+static inline uint64_t sock__timespec_to_us(const struct timespec* ts)
+{
+	return ts->tv_sec * 1000000ULL + ts->tv_nsec / 1000ULL;
+}
+
+/* The software timestamp is preferred because it is on the same clock as the
+ * rest of the system. The raw hardware timestamp is used if that is all we
+ * get.
+ */
+uint64_t sock_get_cmsg_timestamp(struct msghdr* msg)
+{
+	struct cmsghdr* cmsg;
+	struct timespec ts[3];
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		switch (cmsg->cmsg_type) {
+		case SCM_TIMESTAMPING:
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+			if (ts[0].tv_sec || ts[0].tv_nsec)
+				return sock__timespec_to_us(&ts[0]);
+			if (ts[2].tv_sec || ts[2].tv_nsec)
+				return sock__timespec_to_us(&ts[2]);
+			break;
+		case SCM_TIMESTAMPNS:
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(ts[0]));
+			return sock__timespec_to_us(&ts[0]);
+		}
+	}
+
+	return gettime_us(CLOCK_REALTIME);
+}
+
+/* Messages that are too short to be a frame are dropped. A batch of nothing
+ * but those is reported like an empty socket, because 0 means that the peer
+ * has gone away.
+ */
+static ssize_t sock__check_short(int count, int n_valid)
+{
+	if (n_valid == count)
+		return count;
+
+	plog(LOG_WARNING, "sock: Dropped %d messages that were too short",
+	     count - n_valid);
+
+	if (n_valid == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return n_valid;
+}
+
+static ssize_t sock__recv_batch_can(const struct sock* sock,
+				    struct can_frame* cf, uint64_t* ts,
+				    size_t n, int flags)
+{
+	struct mmsghdr msg[n];
+	struct iovec iov[n];
+	char control[ts ? n : 1][SOCK__CONTROL_SIZE];
+
+	memset(msg, 0, sizeof(msg));
+
+	for (size_t i = 0; i < n; ++i) {
+		iov[i].iov_base = &cf[i];
+		iov[i].iov_len = sizeof(*cf);
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+
+		if (ts) {
+			msg[i].msg_hdr.msg_control = control[i];
+			msg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
+	}
+
+	int count = recvmmsg(sock->fd, msg, n, flags, NULL);
+	if (count <= 0)
+		return count;
+
+	int n_valid = 0;
+
+	for (int i = 0; i < count; ++i) {
+		if (msg[i].msg_len < sizeof(*cf))
+			continue;
+
+		if (n_valid != i)
+			cf[n_valid] = cf[i];
+
+		if (ts)
+			ts[n_valid] = sock_get_cmsg_timestamp(&msg[i].msg_hdr);
+
+		++n_valid;
+	}
+
+	return sock__check_short(count, n_valid);
+}
+
+/* A stream carries no message boundaries, so we read as many whole frames as
+ * are available and complete a trailing partial frame with a short blocking
+ * read.
+ */
+static ssize_t sock__recv_batch_tcp(const struct sock* sock,
+				    struct can_frame* cf, uint64_t* ts,
+				    size_t n, int flags)
+{
+	ssize_t rsize = recv(sock->fd, cf, n * sizeof(*cf), flags);
+	if (rsize <= 0)
+		return rsize;
+
+	size_t rest = rsize % sizeof(*cf);
+	if (rest != 0) {
+		size_t missing = sizeof(*cf) - rest;
+		if (net_read(sock->fd, (char*)cf + rsize, missing, 1000)
+		    != (ssize_t)missing)
+			return -1;
+
+		rsize += missing;
+	}
+
+	size_t count = rsize / sizeof(*cf);
+
+	if (ts) {
+		uint64_t now = gettime_us(CLOCK_REALTIME);
+		for (size_t i = 0; i < count; ++i)
+			ts[i] = now;
+	}
+
+	return count;
+}
+
+ssize_t sock_recv_batch(const struct sock* sock, struct can_frame* cf,
+			uint64_t* ts, size_t n, int flags)
+{
+	ssize_t count = -1;
+
+	switch (sock->type) {
+	case SOCK_TYPE_CAN:
+		count = sock->uring
+		      ? sock__recv_uring(sock, cf, ts, n,
+					 sock__uring_timeout(flags))
+		      : sock__recv_batch_can(sock, cf, ts, n, flags);
+		break;
+	case SOCK_TYPE_UNIX:
+		count = sock__recv_batch_can(sock, cf, ts, n, flags);
+		break;
+	case SOCK_TYPE_UDP:
+		count = sock__recv_batch_udp(sock, cf, ts, n, flags);
+		break;
+	case SOCK_TYPE_LOOPBACK:
+		count = sock__recv_batch_loopback(sock, cf, ts, n, flags);
+		break;
+	case SOCK_TYPE_TCP:
+		count = sock__recv_batch_tcp(sock, cf, ts, n, flags);
+		break;
+	default: abort();
+	}
+
+	for (ssize_t i = 0; i < count; ++i) {
+		if (sock->tb) {
+			if (ts)
+				tb_append_ts(sock->tb, &cf[i], ts[i]);
+			else
+				tb_append(sock->tb, &cf[i]);
+		}
+
+		sock__frame_ntohl(sock, &cf[i]);
+	}
+
+	return count;
+}
+
 int sock_timed_recv(const struct sock* sock, struct can_frame* cf, int timeout)
 {
+	if (sock->udp) {
+		struct pollfd pollfd = { .fd = sock->fd, .events = POLLIN };
+
+		if (!sock_udp_has_pending(sock->udp)
+		 && poll(&pollfd, 1, timeout) != 1)
+			return -1;
+
+		if (sock__recv_batch_udp(sock, cf, NULL, 1, MSG_DONTWAIT) <= 0)
+			return -1;
+
+		if (sock->tb)
+			tb_append(sock->tb, cf);
+
+		return sizeof(*cf);
+	}
+
+	if (sock->uring) {
+		uint64_t ts;
+		if (sock__recv_uring(sock, cf, &ts, 1, timeout) <= 0)
+			return -1;
+
+		if (sock->tb)
+			tb_append_ts(sock->tb, cf, ts);
+
+		return sizeof(*cf);
+	}
+
+	if (sock->loopback) {
+		struct canfd_frame cfd;
+		uint64_t ts;
+		if (sock_loopback_timed_recv(sock->loopback, &cfd, &ts,
+					     timeout) < 0)
+			return -1;
+
+		memcpy(cf, &cfd, sizeof(*cf));
+
+		if (sock->tb)
+			tb_append_ts(sock->tb, cf, ts);
+
+		return sizeof(*cf);
+	}
+
 	int rc = net_read_frame(sock->fd, cf, timeout);
 
 	if (rc >= 0 && sock->tb)
@@ -110,3 +644,279 @@ int sock_timed_recv(const struct sock* sock, struct can_frame* cf, int timeout)
 	return rc;
 }
 
+
+int sock_enable_fd_frames(const struct sock* sock)
+{
+	/* Packets on UNIX sockets are as large as the frames and the loopback
+	 * carries FD frames as they are
+	 */
+	if (sock->type == SOCK_TYPE_UNIX || sock->type == SOCK_TYPE_LOOPBACK)
+		return 0;
+
+	if (sock->type != SOCK_TYPE_CAN)
+		return -1;
+
+	return socketcan_enable_fd_frames(sock->fd);
+}
+
+int sock_enable_error_frames(const struct sock* sock)
+{
+	if (sock->type != SOCK_TYPE_CAN)
+		return -1;
+
+	return socketcan_enable_error_frames(sock->fd);
+}
+
+static inline size_t sock__fd_frame_size(const struct canfd_frame* cf)
+{
+	return canfd_is_fd(cf) ? CANFD_MTU : CAN_MTU;
+}
+
+static inline void sock__trace_fd(const struct sock* sock,
+				  const struct canfd_frame* cf,
+				  const uint64_t* ts)
+{
+	if (!sock->tb)
+		return;
+
+	if (ts)
+		tb_append_fd(sock->tb, cf, *ts);
+	else
+		tb_append_fd(sock->tb, cf, fastclock_realtime_us());
+}
+
+ssize_t sock_send_fd(const struct sock* sock, struct canfd_frame* cf,
+		     int flags)
+{
+	if (canfd_is_fd(cf) && sock->type == SOCK_TYPE_TCP) {
+		errno = EPROTONOSUPPORT;
+		return -1;
+	}
+
+	sock__trace_fd(sock, cf, NULL);
+
+	if (sock->loopback)
+		return sock_loopback_send(sock->loopback, cf, 1, flags) == 1
+		       ? (ssize_t)sock__fd_frame_size(cf) : -1;
+
+	struct can_frame* classic = (struct can_frame*)cf;
+	return send(sock->fd, sock__frame_htonl(sock, classic),
+		    sock__fd_frame_size(cf), flags);
+}
+
+static ssize_t sock__send_fd_batch_can(const struct sock* sock,
+				       const struct canfd_frame* cf, size_t n,
+				       int flags)
+{
+	struct mmsghdr msg[n];
+	struct iovec iov[n];
+
+	memset(msg, 0, sizeof(msg));
+
+	for (size_t i = 0; i < n; ++i) {
+		iov[i].iov_base = (void*)&cf[i];
+		iov[i].iov_len = sock__fd_frame_size(&cf[i]);
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	size_t count = 0;
+	while (count < n) {
+		int rc = sendmmsg(sock->fd, &msg[count], n - count, flags);
+		if (rc <= 0)
+			return count > 0 ? (ssize_t)count : rc;
+
+		count += rc;
+	}
+
+	return count;
+}
+
+static ssize_t sock__send_fd_batch_tcp(const struct sock* sock,
+				       const struct canfd_frame* cf, size_t n,
+				       int flags)
+{
+	struct can_frame classic[n];
+
+	for (size_t i = 0; i < n; ++i) {
+		if (canfd_is_fd(&cf[i])) {
+			errno = EPROTONOSUPPORT;
+			return i > 0 ? sock__send_batch_tcp(sock, classic, i,
+							    flags)
+				     : -1;
+		}
+
+		memcpy(&classic[i], &cf[i], sizeof(classic[i]));
+	}
+
+	return sock__send_batch_tcp(sock, classic, n, flags);
+}
+
+static ssize_t sock__send_fd_batch(const struct sock* sock,
+				   const struct canfd_frame* cf, size_t n,
+				   int flags)
+{
+	if (sock->uring)
+		return sock_uring_send(sock->uring, cf, n, flags);
+
+	switch (sock->type) {
+	case SOCK_TYPE_CAN:
+	case SOCK_TYPE_UNIX:
+		return sock__send_fd_batch_can(sock, cf, n, flags);
+	case SOCK_TYPE_TCP: return sock__send_fd_batch_tcp(sock, cf, n, flags);
+	case SOCK_TYPE_UDP: errno = EOPNOTSUPP; return -1;
+	case SOCK_TYPE_LOOPBACK:
+		return sock_loopback_send(sock->loopback, cf, n, flags);
+	default: abort();
+	}
+
+	return -1;
+}
+
+ssize_t sock_send_fd_batch(const struct sock* sock,
+			   const struct canfd_frame* cf, size_t n, int flags)
+{
+	ssize_t rc = sock__send_fd_batch(sock, cf, n, flags);
+
+	for (ssize_t i = 0; i < rc; ++i)
+		sock__trace_fd(sock, &cf[i], NULL);
+
+	return rc;
+}
+
+static ssize_t sock__recv_fd_batch_can(const struct sock* sock,
+				       struct canfd_frame* cf, uint64_t* ts,
+				       size_t n, int flags)
+{
+	struct mmsghdr msg[n];
+	struct iovec iov[n];
+	char control[ts ? n : 1][SOCK__CONTROL_SIZE];
+
+	memset(msg, 0, sizeof(msg));
+
+	for (size_t i = 0; i < n; ++i) {
+		iov[i].iov_base = &cf[i];
+		iov[i].iov_len = sizeof(*cf);
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+
+		if (ts) {
+			msg[i].msg_hdr.msg_control = control[i];
+			msg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
+	}
+
+	int count = recvmmsg(sock->fd, msg, n, flags, NULL);
+	if (count <= 0)
+		return count;
+
+	int n_valid = 0;
+
+	for (int i = 0; i < count; ++i) {
+		switch (msg[i].msg_len) {
+		case CANFD_MTU: cf[i].flags |= CANFD_FDF; break;
+		case CAN_MTU: cf[i].flags = 0; break;
+		default: continue;
+		}
+
+		if (n_valid != i)
+			cf[n_valid] = cf[i];
+
+		if (ts)
+			ts[n_valid] = sock_get_cmsg_timestamp(&msg[i].msg_hdr);
+
+		++n_valid;
+	}
+
+	return sock__check_short(count, n_valid);
+}
+
+static ssize_t sock__recv_fd_batch_tcp(const struct sock* sock,
+				       struct canfd_frame* cf, uint64_t* ts,
+				       size_t n, int flags)
+{
+	struct can_frame classic[n];
+
+	ssize_t count = sock__recv_batch_tcp(sock, classic, ts, n, flags);
+
+	for (ssize_t i = 0; i < count; ++i) {
+		memcpy(&cf[i], &classic[i], sizeof(classic[i]));
+		cf[i].flags = 0;
+	}
+
+	return count;
+}
+
+ssize_t sock_recv_fd_batch(const struct sock* sock, struct canfd_frame* cf,
+			   uint64_t* ts, size_t n, int flags)
+{
+	ssize_t count = -1;
+
+	switch (sock->type) {
+	case SOCK_TYPE_CAN:
+		count = sock->uring
+		      ? sock_uring_recv(sock->uring, cf, ts, n,
+					sock__uring_timeout(flags))
+		      : sock__recv_fd_batch_can(sock, cf, ts, n, flags);
+		break;
+	case SOCK_TYPE_UNIX:
+		count = sock__recv_fd_batch_can(sock, cf, ts, n, flags);
+		break;
+	case SOCK_TYPE_UDP:
+		count = sock_udp_recv(sock->udp, sock->fd, cf, ts, n, flags);
+		break;
+	case SOCK_TYPE_LOOPBACK:
+		count = sock_loopback_recv(sock->loopback, cf, ts, n, flags);
+		break;
+	case SOCK_TYPE_TCP:
+		count = sock__recv_fd_batch_tcp(sock, cf, ts, n, flags);
+		break;
+	default: abort();
+	}
+
+	for (ssize_t i = 0; i < count; ++i) {
+		sock__trace_fd(sock, &cf[i], ts ? &ts[i] : NULL);
+		sock__frame_ntohl(sock, (struct can_frame*)&cf[i]);
+	}
+
+	return count;
+}
+
+int sock_enable_uring(struct sock* sock)
+{
+	if (sock->type != SOCK_TYPE_CAN)
+		return -1;
+
+	if (sock->uring)
+		return 0;
+
+	sock->uring = sock_uring_new(sock->fd);
+	return sock->uring ? 0 : -1;
+}
+
+int sock_get_udp_stats(const struct sock* sock, struct sock_udp_stats* stats)
+{
+	if (!sock->udp)
+		return -1;
+
+	sock_udp_get_stats(sock->udp, stats);
+	return 0;
+}
+
+int sock_close(struct sock* sock)
+{
+	sock_uring_free(sock->uring);
+	sock->uring = NULL;
+
+	sock_udp_free(sock->udp);
+	sock->udp = NULL;
+
+	/* The fd belongs to the endpoint */
+	if (sock->loopback) {
+		sock_loopback_close(sock->loopback);
+		sock->loopback = NULL;
+		return 0;
+	}
+
+	return close(sock->fd);
+}
@@ -21,6 +21,7 @@
 #include <unistd.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/can/error.h>
 #include <assert.h>
 
 #include "canopen.h"
@@ -102,6 +103,38 @@ int socketcan_apply_filters(int fd, struct can_filter* filters, int n)
 			  n*sizeof(struct can_filter));
 }
 
+int socketcan_enable_fd_frames(int fd)
+{
+	int one = 1;
+	return setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &one,
+			  sizeof(one));
+}
+
+int socketcan_enable_error_frames(int fd)
+{
+	can_err_mask_t mask = CAN_ERR_TX_TIMEOUT | CAN_ERR_LOSTARB
+			    | CAN_ERR_CRTL | CAN_ERR_PROT | CAN_ERR_TRX
+			    | CAN_ERR_ACK | CAN_ERR_BUSOFF | CAN_ERR_BUSERROR
+			    | CAN_ERR_RESTARTED;
+
+	return setsockopt(fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &mask,
+			  sizeof(mask));
+}
+
+size_t socketcan_fd_length(size_t size)
+{
+	static const unsigned char lengths[] = { 12, 16, 20, 24, 32, 48, 64 };
+
+	if (size <= CAN_MAX_DLEN)
+		return size;
+
+	for (size_t i = 0; i < sizeof(lengths); ++i)
+		if (size <= lengths[i])
+			return lengths[i];
+
+	return CANFD_MAX_DLEN;
+}
+
 int socketcan_open_slave(const char* iface, int nodeid)
 {
 	struct can_filter filters[CANOPEN_SLAVE_FILTER_LENGTH];
@@ -0,0 +1,211 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "canopen.h"
+#include "canopen/stats.h"
+#include "rest.h"
+#include "stats-rest.h"
+#include "time-utils.h"
+
+struct stats_rest_snapshot {
+	uint64_t time;
+	uint64_t rx[CO_STATS_FUNCTION_COUNT];
+	uint64_t tx[CO_STATS_FUNCTION_COUNT];
+};
+
+/* Counters at the time of the previous request, used to compute rates */
+static struct stats_rest_snapshot stats_rest__snapshot[CO_STATS_NODE_COUNT];
+
+static void stats_rest__reply(struct rest_client* client,
+			      const char* status_code, const char* type,
+			      const char* message, size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void stats_rest__error(struct rest_client* client,
+			      const char* status_code, const char* message)
+{
+	stats_rest__reply(client, status_code, "text/plain", message,
+			  strlen(message));
+}
+
+static int stats_rest__has_traffic(const struct co_stats_node* stats)
+{
+	for (int i = 0; i < CO_STATS_FUNCTION_COUNT; ++i)
+		if (stats->rx[i] || stats->tx[i])
+			return 1;
+
+	return 0;
+}
+
+static void stats_rest__print_counters(struct arena_text* out, const char* name,
+				       const uint64_t* count,
+				       const uint64_t* last, double dt)
+{
+	int is_first = 1;
+
+	arena_printf(out, "  \"%s\": {", name);
+
+	for (int i = 0; i < CO_STATS_FUNCTION_COUNT; ++i) {
+		const char* function = co_stats_function_name(i);
+		if (!function || count[i] == 0)
+			continue;
+
+		double rate = dt > 0.0 ? (count[i] - last[i]) / dt : 0.0;
+
+		arena_printf(out, "%s\n   \"%s\": { \"count\": %" PRIu64
+			     ", \"rate\": %.1f }", is_first ? "" : ",",
+			     function, count[i], rate);
+
+		is_first = 0;
+	}
+
+	arena_printf(out, "%s}", is_first ? "" : "\n  ");
+}
+
+static void stats_rest__print_histograms(struct arena_text* out,
+					 const struct co_stats_node* stats)
+{
+	int is_first = 1;
+
+	arena_printf(out, "  \"histograms\": {");
+
+	for (int i = 0; i < CO_STATS_HISTOGRAM_COUNT; ++i) {
+		const uint64_t* bucket = stats->histogram[i];
+
+		int last = CO_STATS_N_BUCKETS - 1;
+		while (last >= 0 && bucket[last] == 0)
+			--last;
+
+		if (last < 0)
+			continue;
+
+		arena_printf(out, "%s\n   \"%s\": [", is_first ? "" : ",",
+			     co_stats_histogram_name(i));
+
+		for (int j = 0; j <= last; ++j)
+			arena_printf(out, "%s%" PRIu64, j ? ", " : "",
+				     bucket[j]);
+
+		arena_printf(out, "]");
+
+		is_first = 0;
+	}
+
+	arena_printf(out, "%s}", is_first ? "" : "\n  ");
+}
+
+static void stats_rest__print_node(struct arena_text* out, int nodeid,
+				   uint64_t now)
+{
+	struct co_stats_node stats;
+	co_stats_get_node(&stats, nodeid);
+
+	struct stats_rest_snapshot* snapshot = &stats_rest__snapshot[nodeid];
+
+	uint64_t since = snapshot->time ? snapshot->time
+					: co_stats_get_start_time();
+	double dt = (now - since) / 1e6;
+
+	arena_printf(out, " \"%d\": {\n", nodeid);
+
+	stats_rest__print_counters(out, "rx", stats.rx, snapshot->rx, dt);
+	arena_printf(out, ",\n");
+	stats_rest__print_counters(out, "tx", stats.tx, snapshot->tx, dt);
+	arena_printf(out, ",\n");
+	stats_rest__print_histograms(out, &stats);
+
+	arena_printf(out, "\n }");
+
+	snapshot->time = now;
+	memcpy(snapshot->rx, stats.rx, sizeof(snapshot->rx));
+	memcpy(snapshot->tx, stats.tx, sizeof(snapshot->tx));
+}
+
+void stats_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	int nodeid = -1;
+
+	if (client->req.url_index > 2) {
+		stats_rest__error(client, "404 Not Found", "Not found\r\n");
+		return;
+	}
+
+	if (client->req.url_index == 2) {
+		char* end = NULL;
+		nodeid = strtoul(client->req.url[1], &end, 10);
+		if (*end != '\0' || nodeid > CANOPEN_NODEID_MAX) {
+			stats_rest__error(client, "400 Bad Request",
+					  "Invalid node id\r\n");
+			return;
+		}
+	}
+
+	struct arena_text text;
+	arena_text_init(&text, &client->arena);
+	struct arena_text* out = &text;
+
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+
+	arena_printf(out, "{\n");
+
+	if (nodeid >= 0) {
+		stats_rest__print_node(out, nodeid, now);
+	} else {
+		int is_first = 1;
+
+		for (int i = 0; i < CO_STATS_NODE_COUNT; ++i) {
+			struct co_stats_node stats;
+			co_stats_get_node(&stats, i);
+
+			if (!stats_rest__has_traffic(&stats))
+				continue;
+
+			if (!is_first)
+				arena_printf(out, ",\n");
+
+			stats_rest__print_node(out, i, now);
+			is_first = 0;
+		}
+	}
+
+	arena_printf(out, "\n}\n");
+
+	if (out->is_bad) {
+		stats_rest__error(client, "500 Internal Server Error",
+				  "Out of memory\r\n");
+		return;
+	}
+
+	stats_rest__reply(client, "200 OK", "application/json", out->data,
+			  out->length);
+}
@@ -0,0 +1,247 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/can.h>
+
+#include "canopen.h"
+#include "canopen/stats.h"
+#include "co_atomic.h"
+#include "time-utils.h"
+
+#define CO_STATS__COB_COUNT (CAN_SFF_MASK + 1)
+
+/* Each counter has a single writer, so a relaxed load and store is enough */
+#define co_stats__read(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define co_stats__write(ptr, value) \
+	__atomic_store_n(ptr, value, __ATOMIC_RELAXED)
+#define co_stats__inc(ptr) co_stats__write(ptr, co_stats__read(ptr) + 1)
+
+struct co_stats__block {
+	struct co_stats__block* next;
+	uint64_t rx[CO_STATS__COB_COUNT];
+	uint64_t tx[CO_STATS__COB_COUNT];
+	uint64_t last_rx[CO_STATS__COB_COUNT];
+	uint32_t histogram[CO_STATS_HISTOGRAM_COUNT][CO_STATS_NODE_COUNT]
+			  [CO_STATS_N_BUCKETS];
+};
+
+static struct co_stats__block* co_stats__blocks = NULL;
+static __thread struct co_stats__block* co_stats__local = NULL;
+
+/* Time at which the last SDO request was sent to each node */
+static uint64_t co_stats__sdo_sent_at[CO_STATS_NODE_COUNT];
+
+static uint64_t co_stats__start_time = 0;
+
+/* Maps function codes to interval histograms */
+static const signed char co_stats__interval_histogram[] = {
+	[R_TPDO1 >> 7] = CO_STATS_TPDO1_INTERVAL + 1,
+	[R_TPDO2 >> 7] = CO_STATS_TPDO2_INTERVAL + 1,
+	[R_TPDO3 >> 7] = CO_STATS_TPDO3_INTERVAL + 1,
+	[R_TPDO4 >> 7] = CO_STATS_TPDO4_INTERVAL + 1,
+	[R_HEARTBEAT >> 7] = CO_STATS_HEARTBEAT_INTERVAL + 1,
+	[CO_STATS_FUNCTION_COUNT - 1] = 0,
+};
+
+static struct co_stats__block* co_stats__get_block(void)
+{
+	struct co_stats__block* block = co_stats__local;
+	if (block)
+		return block;
+
+	block = calloc(1, sizeof(*block));
+	if (!block)
+		return NULL;
+
+	struct co_stats__block* head;
+	do {
+		head = co_atomic_load(&co_stats__blocks);
+		block->next = head;
+	} while (!co_atomic_cas(&co_stats__blocks, head, block));
+
+	co_stats__local = block;
+	return block;
+}
+
+static inline unsigned int co_stats__bucket(uint64_t value)
+{
+	if (value == 0)
+		return 0;
+
+	unsigned int bucket = 63 - __builtin_clzll(value);
+	return bucket < CO_STATS_N_BUCKETS ? bucket : CO_STATS_N_BUCKETS - 1;
+}
+
+static inline void co_stats__record(struct co_stats__block* block,
+				    enum co_stats_histogram histogram,
+				    int nodeid, uint64_t value)
+{
+	co_stats__inc(&block->histogram[histogram][nodeid]
+				       [co_stats__bucket(value)]);
+}
+
+void co_stats_reset(void)
+{
+	struct co_stats__block* block;
+
+	for (block = co_atomic_load(&co_stats__blocks); block;
+	     block = block->next) {
+		struct co_stats__block* next = block->next;
+		memset(block, 0, sizeof(*block));
+		block->next = next;
+	}
+
+	memset(co_stats__sdo_sent_at, 0, sizeof(co_stats__sdo_sent_at));
+
+	co_stats__start_time = gettime_us(CLOCK_MONOTONIC);
+}
+
+uint64_t co_stats_get_start_time(void)
+{
+	return co_stats__start_time;
+}
+
+void co_stats_count_rx(uint32_t cob_id, uint64_t timestamp)
+{
+	struct co_stats__block* block = co_stats__get_block();
+	if (!block)
+		return;
+
+	cob_id &= CAN_SFF_MASK;
+
+	unsigned int function = cob_id >> 7;
+	int nodeid = cob_id & 0x7f;
+
+	co_stats__inc(&block->rx[cob_id]);
+
+	int histogram = co_stats__interval_histogram[function] - 1;
+	if (histogram >= 0) {
+		uint64_t last = block->last_rx[cob_id];
+		block->last_rx[cob_id] = timestamp;
+
+		if (last != 0 && timestamp >= last)
+			co_stats__record(block, histogram, nodeid,
+					 timestamp - last);
+	}
+
+	if (function == (R_TSDO >> 7)) {
+		uint64_t sent = __atomic_exchange_n(
+				&co_stats__sdo_sent_at[nodeid], 0,
+				__ATOMIC_RELAXED);
+
+		if (sent != 0 && timestamp >= sent)
+			co_stats__record(block, CO_STATS_SDO_RTT, nodeid,
+					 timestamp - sent);
+	}
+}
+
+void co_stats_count_tx(uint32_t cob_id, uint64_t timestamp)
+{
+	struct co_stats__block* block = co_stats__get_block();
+	if (!block)
+		return;
+
+	cob_id &= CAN_SFF_MASK;
+
+	co_stats__inc(&block->tx[cob_id]);
+
+	if ((cob_id >> 7) == (R_RSDO >> 7))
+		co_stats__write(&co_stats__sdo_sent_at[cob_id & 0x7f],
+				timestamp);
+}
+
+void co_stats_get_node(struct co_stats_node* dst, int nodeid)
+{
+	struct co_stats__block* block;
+
+	memset(dst, 0, sizeof(*dst));
+
+	for (block = co_atomic_load(&co_stats__blocks); block;
+	     block = block->next) {
+		for (int i = 0; i < CO_STATS_FUNCTION_COUNT; ++i) {
+			uint32_t cob_id = (i << 7) | nodeid;
+			dst->rx[i] += co_stats__read(&block->rx[cob_id]);
+			dst->tx[i] += co_stats__read(&block->tx[cob_id]);
+		}
+
+		for (int i = 0; i < CO_STATS_HISTOGRAM_COUNT; ++i)
+			for (int j = 0; j < CO_STATS_N_BUCKETS; ++j)
+				dst->histogram[i][j] += co_stats__read(
+						&block->histogram[i][nodeid][j]);
+	}
+}
+
+uint64_t co_stats_get_rx(uint32_t cob_id)
+{
+	struct co_stats__block* block;
+	uint64_t sum = 0;
+
+	for (block = co_atomic_load(&co_stats__blocks); block;
+	     block = block->next)
+		sum += co_stats__read(&block->rx[cob_id & CAN_SFF_MASK]);
+
+	return sum;
+}
+
+uint64_t co_stats_get_tx(uint32_t cob_id)
+{
+	struct co_stats__block* block;
+	uint64_t sum = 0;
+
+	for (block = co_atomic_load(&co_stats__blocks); block;
+	     block = block->next)
+		sum += co_stats__read(&block->tx[cob_id & CAN_SFF_MASK]);
+
+	return sum;
+}
+
+const char* co_stats_function_name(unsigned int function)
+{
+	switch (function) {
+	case R_NMT >> 7:	return "NMT";
+	case R_EMCY >> 7:	return "EMCY";
+	case R_TIMESTAMP >> 7:	return "TIMESTAMP";
+	case R_TPDO1 >> 7:	return "TPDO1";
+	case R_RPDO1 >> 7:	return "RPDO1";
+	case R_TPDO2 >> 7:	return "TPDO2";
+	case R_RPDO2 >> 7:	return "RPDO2";
+	case R_TPDO3 >> 7:	return "TPDO3";
+	case R_RPDO3 >> 7:	return "RPDO3";
+	case R_TPDO4 >> 7:	return "TPDO4";
+	case R_RPDO4 >> 7:	return "RPDO4";
+	case R_TSDO >> 7:	return "TSDO";
+	case R_RSDO >> 7:	return "RSDO";
+	case R_HEARTBEAT >> 7:	return "HEARTBEAT";
+	}
+
+	return NULL;
+}
+
+const char* co_stats_histogram_name(enum co_stats_histogram histogram)
+{
+	switch (histogram) {
+	case CO_STATS_TPDO1_INTERVAL:		return "tpdo1-interval";
+	case CO_STATS_TPDO2_INTERVAL:		return "tpdo2-interval";
+	case CO_STATS_TPDO3_INTERVAL:		return "tpdo3-interval";
+	case CO_STATS_TPDO4_INTERVAL:		return "tpdo4-interval";
+	case CO_STATS_HEARTBEAT_INTERVAL:	return "heartbeat-interval";
+	case CO_STATS_SDO_RTT:			return "sdo-rtt";
+	case CO_STATS_HISTOGRAM_COUNT:		break;
+	}
+
+	return NULL;
+}
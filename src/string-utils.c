@@ -13,6 +13,8 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdlib.h>
+
 #define IN_STRING_UTILS_C_
 #include "string-utils.h"
 
@@ -66,3 +68,42 @@ char* string_replace_char(char m, char r, char* str)
 	return str;
 }
 
+
+int string_parse_int_list(int* dst, size_t max, const char* str)
+{
+	size_t n = 0;
+	char* end;
+
+	while (*str) {
+		if (!isdigit(*str))
+			return -1;
+
+		long first = strtol(str, &end, 10);
+		long last = first;
+
+		if (*end == '-') {
+			if (!isdigit(end[1]))
+				return -1;
+
+			last = strtol(end + 1, &end, 10);
+			if (last < first)
+				return -1;
+		}
+
+		for (long i = first; i <= last; ++i) {
+			if (n >= max)
+				return -1;
+
+			dst[n++] = i;
+		}
+
+		if (*end == ',' && end[1] != '\0')
+			++end;
+		else if (*end != '\0')
+			return -1;
+
+		str = end;
+	}
+
+	return n;
+}
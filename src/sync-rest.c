@@ -0,0 +1,88 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "canopen/sync.h"
+#include "rest.h"
+#include "sync-rest.h"
+
+static void sync_rest__reply(struct rest_client* client,
+			     const char* status_code, const char* type,
+			     const char* message, size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void sync_rest__error(struct rest_client* client,
+			     const char* status_code, const char* message)
+{
+	sync_rest__reply(client, status_code, "text/plain", message,
+			 strlen(message));
+}
+
+void sync_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (client->req.url_index > 1) {
+		sync_rest__error(client, "404 Not Found", "Not found\r\n");
+		return;
+	}
+
+	struct co_sync_stats stats;
+	co_sync_get_stats(&stats);
+
+	struct arena_text text;
+	arena_text_init(&text, &client->arena);
+	struct arena_text* out = &text;
+
+	int last = CO_SYNC_N_BUCKETS - 1;
+	while (last >= 0 && stats.bucket[last] == 0)
+		--last;
+
+	arena_printf(out, "{\n \"is-running\": %s",
+		     co_sync_is_running() ? "true" : "false");
+	arena_printf(out, ",\n \"count\": %" PRIu64, stats.count);
+	arena_printf(out, ",\n \"overruns\": %" PRIu64, stats.n_overruns);
+	arena_printf(out, ",\n \"jitter\": { \"max\": %" PRIu64
+		     ", \"buckets\": [", stats.jitter_max);
+
+	for (int i = 0; i <= last; ++i)
+		arena_printf(out, "%s%" PRIu64, i ? ", " : "", stats.bucket[i]);
+
+	arena_printf(out, "] }\n}\n");
+
+	if (out->is_bad) {
+		sync_rest__error(client, "500 Internal Server Error",
+				 "Out of memory\r\n");
+		return;
+	}
+
+	sync_rest__reply(client, "200 OK", "application/json", out->data,
+			 out->length);
+}
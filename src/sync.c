@@ -0,0 +1,173 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "canopen/sync.h"
+#include "time-utils.h"
+#include "plog.h"
+
+#define co_sync__read(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define co_sync__write(ptr, value) \
+	__atomic_store_n(ptr, value, __ATOMIC_RELAXED)
+
+static pthread_t co_sync__thread;
+static int co_sync__is_running = 0;
+static int co_sync__is_stopping = 0;
+
+static uint64_t co_sync__period_ns;
+static int co_sync__priority;
+static co_sync_fn co_sync__fn;
+
+/* Written by the SYNC thread only */
+static struct co_sync_stats co_sync__stats;
+
+static inline unsigned int co_sync__bucket(uint64_t value)
+{
+	if (value == 0)
+		return 0;
+
+	unsigned int bucket = 63 - __builtin_clzll(value);
+	return bucket < CO_SYNC_N_BUCKETS ? bucket : CO_SYNC_N_BUCKETS - 1;
+}
+
+static void co_sync__record(uint64_t jitter_ns, uint64_t n_missed)
+{
+	struct co_sync_stats* stats = &co_sync__stats;
+	uint64_t jitter = jitter_ns / 1000ULL;
+	uint64_t* bucket = &stats->bucket[co_sync__bucket(jitter)];
+
+	co_sync__write(&stats->count, co_sync__read(&stats->count) + 1);
+	co_sync__write(bucket, co_sync__read(bucket) + 1);
+
+	if (jitter > co_sync__read(&stats->jitter_max))
+		co_sync__write(&stats->jitter_max, jitter);
+
+	if (n_missed)
+		co_sync__write(&stats->n_overruns,
+			       co_sync__read(&stats->n_overruns) + n_missed);
+}
+
+static void co_sync__set_priority(void)
+{
+	if (co_sync__priority <= 0)
+		return;
+
+	struct sched_param param = { .sched_priority = co_sync__priority };
+
+	int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (rc != 0)
+		plog(LOG_WARNING, "Could not set SYNC thread priority to %d: %s",
+		     co_sync__priority, strerror(rc));
+}
+
+/* Moves the deadline past now and returns the jitter for the wake-up. Missed
+ * deadlines are skipped and counted in n_missed.
+ */
+uint64_t co_sync__advance(uint64_t* deadline, uint64_t now, uint64_t period,
+			  uint64_t* n_missed)
+{
+	uint64_t late = now > *deadline ? now - *deadline : 0;
+
+	*n_missed = late / period;
+	*deadline += (*n_missed + 1) * period;
+
+	return late - *n_missed * period;
+}
+
+static void* co_sync__main(void* arg)
+{
+	(void)arg;
+
+	co_sync__set_priority();
+
+	uint64_t period = co_sync__period_ns;
+	uint64_t deadline = gettime_ns(CLOCK_MONOTONIC) + period;
+
+	while (!__atomic_load_n(&co_sync__is_stopping, __ATOMIC_ACQUIRE)) {
+		struct timespec ts = ns_to_timespec(deadline);
+
+		int rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+					 NULL);
+		if (rc == EINTR)
+			continue;
+
+		uint64_t now = gettime_ns(CLOCK_MONOTONIC);
+		uint64_t n_missed;
+		uint64_t jitter = co_sync__advance(&deadline, now, period,
+						   &n_missed);
+
+		co_sync__fn();
+
+		co_sync__record(jitter, n_missed);
+	}
+
+	return NULL;
+}
+
+int co_sync_start(uint64_t period_us, int priority, co_sync_fn fn)
+{
+	if (co_sync__is_running || period_us == 0 || !fn)
+		return -1;
+
+	co_sync__period_ns = period_us * 1000ULL;
+	co_sync__priority = priority;
+	co_sync__fn = fn;
+	co_sync__is_stopping = 0;
+
+	if (pthread_create(&co_sync__thread, NULL, co_sync__main, NULL) != 0)
+		return -1;
+
+	co_sync__is_running = 1;
+	return 0;
+}
+
+void co_sync_stop(void)
+{
+	if (!co_sync__is_running)
+		return;
+
+	__atomic_store_n(&co_sync__is_stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(co_sync__thread, NULL);
+
+	co_sync__is_running = 0;
+}
+
+int co_sync_is_running(void)
+{
+	return co_sync__is_running;
+}
+
+void co_sync_get_stats(struct co_sync_stats* dst)
+{
+	const struct co_sync_stats* stats = &co_sync__stats;
+
+	dst->count = co_sync__read(&stats->count);
+	dst->n_overruns = co_sync__read(&stats->n_overruns);
+	dst->jitter_max = co_sync__read(&stats->jitter_max);
+
+	for (int i = 0; i < CO_SYNC_N_BUCKETS; ++i)
+		dst->bucket[i] = co_sync__read(&stats->bucket[i]);
+}
+
+/* Only safe while the thread is not running */
+void co_sync_reset_stats(void)
+{
+	memset(&co_sync__stats, 0, sizeof(co_sync__stats));
+}
@@ -0,0 +1,268 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "time-utils.h"
+
+#define FASTCLOCK__CALIBRATION_PERIOD nSEC_IN_SEC
+#define FASTCLOCK__FIRST_PERIOD msec_to_nsec(10)
+
+/* The counter was at ticks when CLOCK_MONOTONIC was at ns */
+struct fastclock__params {
+	uint64_t ticks;
+	uint64_t ns;
+	uint64_t mult; /* ns per tick, 32.32 fixed point */
+	uint64_t period; /* ticks until the next calibration */
+	int64_t realtime_offset; /* ns */
+};
+
+static struct fastclock__params fastclock__params;
+static unsigned int fastclock__seq = 0;
+static int fastclock__is_enabled = 0;
+
+/* The rate is taken over all the time since the first sample, so it gets more
+ * precise the longer the clock runs.
+ */
+static uint64_t fastclock__first_ticks;
+static uint64_t fastclock__first_ns;
+
+#if defined(__x86_64__)
+static inline uint64_t fastclock__read_counter(void)
+{
+	uint32_t lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return (uint64_t)hi << 32 | lo;
+}
+
+/* Only an invariant TSC ticks at the same rate in every power state */
+static int fastclock__has_counter(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+		return 0;
+
+	__cpuid(0x80000007, eax, ebx, ecx, edx);
+	return !!(edx & (1 << 8));
+}
+#elif defined(__aarch64__)
+static inline uint64_t fastclock__read_counter(void)
+{
+	uint64_t value;
+	__asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(value)
+			     :: "memory");
+	return value;
+}
+
+static int fastclock__has_counter(void)
+{
+	uint64_t freq;
+	__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+	return freq != 0;
+}
+#else
+static inline uint64_t fastclock__read_counter(void)
+{
+	return 0;
+}
+
+static int fastclock__has_counter(void)
+{
+	return 0;
+}
+#endif
+
+/* The counter is read on both sides of clock_gettime() and the middle is
+ * taken
+ */
+static void fastclock__sample(uint64_t* ticks, uint64_t* ns,
+			      int64_t* realtime_offset)
+{
+	uint64_t before = fastclock__read_counter();
+	*ns = gettime_ns(CLOCK_MONOTONIC);
+	uint64_t after = fastclock__read_counter();
+
+	*ticks = before + (after - before) / 2;
+
+	if (realtime_offset)
+		*realtime_offset = gettime_ns(CLOCK_REALTIME) - *ns;
+}
+
+static inline uint64_t fastclock__scale(uint64_t ticks, uint64_t mult)
+{
+	return ((unsigned __int128)ticks * mult) >> 32;
+}
+
+static inline uint64_t
+fastclock__project(const struct fastclock__params* params, uint64_t ticks)
+{
+	return ticks > params->ticks
+	     ? params->ns + fastclock__scale(ticks - params->ticks, params->mult)
+	     : params->ns;
+}
+
+static void fastclock__load(struct fastclock__params* params)
+{
+	unsigned int seq;
+
+	do {
+		seq = __atomic_load_n(&fastclock__seq, __ATOMIC_ACQUIRE);
+
+		params->ticks = __atomic_load_n(&fastclock__params.ticks,
+						__ATOMIC_RELAXED);
+		params->ns = __atomic_load_n(&fastclock__params.ns,
+					     __ATOMIC_RELAXED);
+		params->mult = __atomic_load_n(&fastclock__params.mult,
+					       __ATOMIC_RELAXED);
+		params->period = __atomic_load_n(&fastclock__params.period,
+						 __ATOMIC_RELAXED);
+		params->realtime_offset = __atomic_load_n(
+				&fastclock__params.realtime_offset,
+				__ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1)
+	      || seq != __atomic_load_n(&fastclock__seq, __ATOMIC_RELAXED));
+}
+
+static void fastclock__store(const struct fastclock__params* params)
+{
+	__atomic_store_n(&fastclock__params.ticks, params->ticks,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&fastclock__params.ns, params->ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&fastclock__params.mult, params->mult,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&fastclock__params.period, params->period,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&fastclock__params.realtime_offset,
+			 params->realtime_offset, __ATOMIC_RELAXED);
+}
+
+/* The first calibrations are the least precise, so they are refreshed soonest:
+ * the time until the next one doubles up to FASTCLOCK__CALIBRATION_PERIOD.
+ */
+static void fastclock__set_rate(struct fastclock__params* params)
+{
+	uint64_t elapsed = params->ns - fastclock__first_ns;
+
+	params->mult = ((unsigned __int128)elapsed << 32)
+		     / (params->ticks - fastclock__first_ticks);
+
+	if (elapsed > FASTCLOCK__CALIBRATION_PERIOD)
+		elapsed = FASTCLOCK__CALIBRATION_PERIOD;
+
+	params->period = ((unsigned __int128)elapsed << 32) / params->mult;
+}
+
+/* Whoever finds the calibration out of date first refreshes it; the others
+ * go on with the old one in the meantime. The clock is never set back.
+ */
+static void fastclock__calibrate(struct fastclock__params* params)
+{
+	unsigned int seq = __atomic_load_n(&fastclock__seq, __ATOMIC_RELAXED);
+
+	if ((seq & 1) || !__atomic_compare_exchange_n(&fastclock__seq, &seq,
+				seq + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return;
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	struct fastclock__params next;
+	fastclock__sample(&next.ticks, &next.ns, &next.realtime_offset);
+
+	fastclock__set_rate(&next);
+
+	uint64_t projected = fastclock__project(params, next.ticks);
+	if (next.ns < projected)
+		next.ns = projected;
+	fastclock__store(&next);
+
+	__atomic_store_n(&fastclock__seq, seq + 2, __ATOMIC_RELEASE);
+
+	*params = next;
+}
+
+int fastclock_init(void)
+{
+	if (__atomic_load_n(&fastclock__is_enabled, __ATOMIC_ACQUIRE))
+		return 0;
+
+	if (!fastclock__has_counter())
+		return -1;
+
+	fastclock__sample(&fastclock__first_ticks, &fastclock__first_ns, NULL);
+
+	struct timespec ts = ns_to_timespec(FASTCLOCK__FIRST_PERIOD);
+	while (nanosleep(&ts, &ts) < 0)
+		;
+
+	struct fastclock__params params;
+	fastclock__sample(&params.ticks, &params.ns, &params.realtime_offset);
+
+	if (params.ticks <= fastclock__first_ticks
+	 || params.ns <= fastclock__first_ns)
+		return -1;
+
+	fastclock__set_rate(&params);
+	fastclock__store(&params);
+
+	__atomic_store_n(&fastclock__is_enabled, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+uint64_t fastclock_ns(void)
+{
+	if (!__atomic_load_n(&fastclock__is_enabled, __ATOMIC_ACQUIRE))
+		return gettime_ns(CLOCK_MONOTONIC);
+
+	struct fastclock__params params;
+	fastclock__load(&params);
+
+	uint64_t ticks = fastclock__read_counter();
+	if (ticks > params.ticks && ticks - params.ticks > params.period)
+		fastclock__calibrate(&params);
+
+	return fastclock__project(&params, ticks);
+}
+
+uint64_t fastclock_to_realtime_us(uint64_t ns)
+{
+	int64_t offset;
+
+	if (__atomic_load_n(&fastclock__is_enabled, __ATOMIC_ACQUIRE)) {
+		struct fastclock__params params;
+		fastclock__load(&params);
+		offset = params.realtime_offset;
+	} else {
+		offset = gettime_ns(CLOCK_REALTIME)
+		       - gettime_ns(CLOCK_MONOTONIC);
+	}
+
+	return (ns + offset) / 1000ULL;
+}
+
+uint64_t fastclock_realtime_us(void)
+{
+	if (!__atomic_load_n(&fastclock__is_enabled, __ATOMIC_ACQUIRE))
+		return gettime_us(CLOCK_REALTIME);
+
+	return fastclock_to_realtime_us(fastclock_ns());
+}
@@ -0,0 +1,154 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "canopen.h"
+#include "canopen/timeline.h"
+#include "time-utils.h"
+
+struct co_timeline__span {
+	uint64_t begin, end;
+};
+
+static struct co_timeline__span
+co_timeline__span[CANOPEN_NODEID_MAX + 1][CO_TIMELINE_PHASE_COUNT];
+
+static uint64_t co_timeline__start_time = 0;
+static int co_timeline__is_enabled = 0;
+
+static const char* co_timeline__phase_name[CO_TIMELINE_PHASE_COUNT] = {
+	[CO_TIMELINE_RESET] = "reset",
+	[CO_TIMELINE_PROBE] = "probe",
+	[CO_TIMELINE_WAIT] = "wait for drivers",
+	[CO_TIMELINE_IDENTITY] = "identity",
+	[CO_TIMELINE_CONFIG] = "configuration",
+	[CO_TIMELINE_DRIVER_LOAD] = "driver load",
+	[CO_TIMELINE_INIT] = "init",
+	[CO_TIMELINE_PDO_SETUP] = "pdo setup",
+	[CO_TIMELINE_START] = "start",
+};
+
+void co_timeline_enable(int is_enabled)
+{
+	co_timeline__is_enabled = is_enabled;
+}
+
+int co_timeline_is_enabled(void)
+{
+	return co_timeline__is_enabled;
+}
+
+void co_timeline_reset(void)
+{
+	memset(co_timeline__span, 0, sizeof(co_timeline__span));
+	co_timeline__start_time = gettime_us(CLOCK_MONOTONIC);
+}
+
+static inline struct co_timeline__span*
+co_timeline__get(int nodeid, enum co_timeline_phase phase)
+{
+	if (!co_timeline__is_enabled || nodeid < 0
+	 || nodeid > CANOPEN_NODEID_MAX || phase >= CO_TIMELINE_PHASE_COUNT)
+		return NULL;
+
+	return &co_timeline__span[nodeid][phase];
+}
+
+/* 0 means not set, so the timestamps start at 1 */
+static inline uint64_t co_timeline__now(void)
+{
+	return gettime_us(CLOCK_MONOTONIC) - co_timeline__start_time + 1;
+}
+
+void co_timeline_begin(int nodeid, enum co_timeline_phase phase)
+{
+	struct co_timeline__span* span = co_timeline__get(nodeid, phase);
+	if (!span)
+		return;
+
+	span->end = 0;
+	span->begin = co_timeline__now();
+}
+
+void co_timeline_end(int nodeid, enum co_timeline_phase phase)
+{
+	struct co_timeline__span* span = co_timeline__get(nodeid, phase);
+	if (span && span->begin)
+		span->end = co_timeline__now();
+}
+
+const char* co_timeline_phase_name(enum co_timeline_phase phase)
+{
+	return phase < CO_TIMELINE_PHASE_COUNT
+	     ? co_timeline__phase_name[phase] : NULL;
+}
+
+static int co_timeline__has_spans(int nodeid)
+{
+	for (int i = 0; i < CO_TIMELINE_PHASE_COUNT; ++i)
+		if (co_timeline__span[nodeid][i].end)
+			return 1;
+
+	return 0;
+}
+
+static void co_timeline__dump_track(FILE* stream, int nodeid, int* is_first)
+{
+	char name[16];
+	if (nodeid == 0)
+		strcpy(name, "master");
+	else
+		snprintf(name, sizeof(name), "node %d", nodeid);
+
+	fprintf(stream, "%s\n  { \"name\": \"thread_name\", \"ph\": \"M\", "
+		"\"pid\": 1, \"tid\": %d, \"args\": { \"name\": \"%s\" } },\n"
+		"  { \"name\": \"thread_sort_index\", \"ph\": \"M\", "
+		"\"pid\": 1, \"tid\": %d, \"args\": { \"sort_index\": %d } }",
+		*is_first ? "" : ",", nodeid, name, nodeid, nodeid);
+
+	*is_first = 0;
+
+	for (int i = 0; i < CO_TIMELINE_PHASE_COUNT; ++i) {
+		const struct co_timeline__span* span =
+			&co_timeline__span[nodeid][i];
+		if (!span->end)
+			continue;
+
+		fprintf(stream, ",\n  { \"name\": \"%s\", \"cat\": \"bootup\", "
+			"\"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+			"\"ts\": %llu, \"dur\": %llu }",
+			co_timeline__phase_name[i], nodeid,
+			(unsigned long long)(span->begin - 1),
+			(unsigned long long)(span->end - span->begin));
+	}
+}
+
+int co_timeline_dump(FILE* stream)
+{
+	int is_first = 1;
+
+	fprintf(stream, "{\n \"displayTimeUnit\": \"ms\",\n"
+		" \"traceEvents\": [");
+
+	for (int i = 0; i <= CANOPEN_NODEID_MAX; ++i)
+		if (co_timeline__has_spans(i))
+			co_timeline__dump_track(stream, i, &is_first);
+
+	fprintf(stream, "\n ]\n}\n");
+
+	return ferror(stream) ? -1 : 0;
+}
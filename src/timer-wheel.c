@@ -0,0 +1,110 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "timer-wheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+
+void timer_wheel_init(struct timer_wheel* self, uint64_t now)
+{
+	self->now = now;
+	self->n_pending = 0;
+
+	for (int i = 0; i < TIMER_WHEEL_SIZE; ++i)
+		LIST_INIT(&self->slot[i]);
+}
+
+void timer_wheel_add(struct timer_wheel* self, struct timer_wheel_entry* entry,
+		     uint64_t deadline)
+{
+	timer_wheel_remove(self, entry);
+
+	if (deadline <= self->now)
+		deadline = self->now + 1;
+
+	entry->deadline = deadline;
+	entry->is_pending = 1;
+	LIST_INSERT_HEAD(&self->slot[deadline & TIMER_WHEEL_MASK], entry,
+			 links);
+	++self->n_pending;
+}
+
+void timer_wheel_remove(struct timer_wheel* self,
+			struct timer_wheel_entry* entry)
+{
+	if (!entry->is_pending)
+		return;
+
+	LIST_REMOVE(entry, links);
+	entry->is_pending = 0;
+	--self->n_pending;
+}
+
+/* Expired entries are moved to a separate list before any callback is run, so
+ * that entries which are re-added by a callback do not expire again during the
+ * same tick.
+ */
+static void timer_wheel__expire_slot(struct timer_wheel* self,
+				     struct timer_wheel_list* slot,
+				     timer_wheel_fn fn, void* context)
+{
+	struct timer_wheel_list expired = LIST_HEAD_INITIALIZER(expired);
+	struct timer_wheel_entry* entry = LIST_FIRST(slot);
+
+	while (entry) {
+		struct timer_wheel_entry* next = LIST_NEXT(entry, links);
+
+		if (entry->deadline <= self->now) {
+			LIST_REMOVE(entry, links);
+			LIST_INSERT_HEAD(&expired, entry, links);
+		}
+
+		entry = next;
+	}
+
+	while ((entry = LIST_FIRST(&expired))) {
+		timer_wheel_remove(self, entry);
+		fn(entry, context);
+	}
+}
+
+void timer_wheel_advance(struct timer_wheel* self, uint64_t now,
+			 timer_wheel_fn fn, void* context)
+{
+	if (now <= self->now)
+		return;
+
+	if (self->n_pending == 0) {
+		self->now = now;
+		return;
+	}
+
+	/* After a long stall, every slot has to be visited once anyway */
+	if (now - self->now >= TIMER_WHEEL_SIZE) {
+		self->now = now;
+
+		for (int i = 0; i < TIMER_WHEEL_SIZE; ++i)
+			timer_wheel__expire_slot(self, &self->slot[i], fn,
+						 context);
+		return;
+	}
+
+	while (self->now < now) {
+		++self->now;
+		timer_wheel__expire_slot(self,
+				&self->slot[self->now & TIMER_WHEEL_MASK],
+				fn, context);
+	}
+}
@@ -16,7 +16,6 @@
 #include "trace-buffer.h"
 
 #include "socketcan.h"
-#include "co_atomic.h"
 #include "time-utils.h"
 
 #include <stdlib.h>
@@ -24,6 +23,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static inline unsigned long clzl(unsigned long x)
 {
@@ -35,68 +38,428 @@ static inline unsigned long round_up_to_power_of_2(unsigned long x)
 	return 1UL << ((sizeof(x) << 3) - clzl(x - 1UL));
 }
 
-static inline int tb_try_block(struct tracebuffer* self)
+static inline size_t tb__length(size_t size)
 {
-	return co_atomic_cas(&self->is_blocked, 0, 1);
+	return round_up_to_power_of_2(size / sizeof(struct tb_frame));
 }
 
-static inline void tb_unblock(struct tracebuffer* self)
+int tb_init(struct tracebuffer* self, size_t size)
 {
-	co_atomic_store(&self->is_blocked, 0);
+	memset(self, 0, sizeof(*self));
+
+	self->length = tb__length(size);
+	self->slots = calloc(self->length, sizeof(self->slots[0]));
+
+	return self->slots ? 0 : -1;
 }
 
-static inline int tb_is_blocked(const struct tracebuffer* self)
+int tb_init_split(struct tracebuffer* self, size_t size, size_t event_size)
 {
-	return co_atomic_load(&self->is_blocked);
+	if (event_size == 0)
+		return tb_init(self, size);
+
+	if (event_size >= size)
+		return -1;
+
+	struct tracebuffer* events = malloc(sizeof(*events));
+	if (!events)
+		return -1;
+
+	if (tb_init(events, event_size) < 0)
+		goto events_failure;
+
+	if (tb_init(self, size - event_size) < 0)
+		goto failure;
+
+	self->events = events;
+	return 0;
+
+failure:
+	tb_destroy(events);
+events_failure:
+	free(events);
+	return -1;
 }
 
-int tb_init(struct tracebuffer* self, size_t size)
+static void* tb__map_file(const char* path, size_t size)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return NULL;
+
+	void* map = NULL;
+
+	if (ftruncate(fd, size) < 0)
+		goto done;
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		map = NULL;
+
+done:
+	close(fd);
+	return map;
+}
+
+int tb_init_file(struct tracebuffer* self, const char* path, size_t size,
+		 size_t event_size)
 {
 	memset(self, 0, sizeof(*self));
 
-	self->length = round_up_to_power_of_2(size / sizeof(self->data[0]));
-	self->data = malloc(self->length * sizeof(self->data[0]));
+	if (event_size >= size)
+		return -1;
+
+	size_t length = tb__length(size - event_size);
+	size_t event_length = event_size ? tb__length(event_size) : 0;
+
+	struct tracebuffer* events = NULL;
+	if (event_length) {
+		events = calloc(1, sizeof(*events));
+		if (!events)
+			return -1;
+	}
+
+	size_t map_size = sizeof(struct tb_file_header)
+			+ (length + event_length) * sizeof(struct tb_slot);
+
+	/* The file is created sparse, so the slots start out zeroed */
+	void* map = tb__map_file(path, map_size);
+	if (!map) {
+		free(events);
+		return -1;
+	}
+
+	struct tb_file_header* header = map;
+	header->magic = TB_FILE_MAGIC;
+	header->version = TB_FILE_VERSION;
+	header->slot_size = sizeof(struct tb_slot);
+	header->length = length;
+	header->event_length = event_length;
+	header->created = gettime_us(CLOCK_REALTIME);
+
+	self->map = map;
+	self->map_size = map_size;
+	self->is_mapped = 1;
+	self->length = length;
+	self->slots = (struct tb_slot*)(header + 1);
+
+	if (events) {
+		events->is_mapped = 1;
+		events->length = event_length;
+		events->slots = self->slots + length;
+		self->events = events;
+	}
 
-	return self->data ? 0 : -1;
+	return 0;
 }
 
 void tb_destroy(struct tracebuffer* self)
 {
-	free(self->data);
+	if (self->events) {
+		tb_destroy(self->events);
+		free(self->events);
+	}
+
+	free(self->pdo_count);
+
+	if (!self->is_mapped)
+		free(self->slots);
+
+	if (self->map)
+		munmap(self->map, self->map_size);
+}
+
+int tb_set_filter(struct tracebuffer* self, const struct tb_filter* filter)
+{
+	if (filter->pdo_decimation > 1 && !self->pdo_count) {
+		self->pdo_count = calloc(CAN_SFF_MASK + 1,
+					 sizeof(self->pdo_count[0]));
+		if (!self->pdo_count)
+			return -1;
+	}
+
+	self->filter = *filter;
+	self->has_filter = 1;
+	return 0;
+}
+
+static int tb__frame_nodeid(const struct canopen_msg* msg,
+			    const struct canfd_frame* frame)
+{
+	if (msg->object == CANOPEN_NMT)
+		return frame->len >= 2 ? frame->data[1] & 0x7f : 0;
+
+	return msg->id;
+}
+
+static int tb__is_pdo(enum canopen_object object)
+{
+	return object & (CANOPEN_TPDO1 | CANOPEN_TPDO2 | CANOPEN_TPDO3
+			 | CANOPEN_TPDO4 | CANOPEN_RPDO1 | CANOPEN_RPDO2
+			 | CANOPEN_RPDO3 | CANOPEN_RPDO4);
+}
+
+static int tb__is_wanted(struct tracebuffer* self,
+			 const struct canopen_msg* msg, int is_canopen,
+			 const struct canfd_frame* frame)
+{
+	const struct tb_filter* filter = &self->filter;
+	uint32_t cob_id = frame->can_id & CAN_SFF_MASK;
+
+	if (filter->objects && (!is_canopen || !(msg->object & filter->objects)))
+		return 0;
+
+	if (is_canopen && (filter->range_start || filter->range_stop)) {
+		int nodeid = tb__frame_nodeid(msg, frame);
+		if (nodeid != 0 && (nodeid < filter->range_start
+				    || nodeid > filter->range_stop))
+			return 0;
+	}
+
+	if ((cob_id & filter->cob_mask) != (filter->cob_id & filter->cob_mask))
+		return 0;
+
+	if (self->pdo_count && filter->pdo_decimation > 1 && is_canopen
+	 && tb__is_pdo(msg->object)) {
+		uint32_t n = __atomic_fetch_add(&self->pdo_count[cob_id], 1,
+						__ATOMIC_RELAXED);
+		if (n % filter->pdo_decimation != 0)
+			return 0;
+	}
+
+	return 1;
 }
 
 void tb_append(struct tracebuffer* self, const struct can_frame* frame)
 {
-	if (tb_is_blocked(self))
-		return;
+	tb_append_ts(self, frame, fastclock_realtime_us());
+}
 
-	struct tb_frame tb_frame = {
-		.timestamp = gettime_us(CLOCK_REALTIME),
-		.cf = *frame,
-	};
+void tb_append_ts(struct tracebuffer* self, const struct can_frame* frame,
+		  uint64_t timestamp)
+{
+	struct canfd_frame cfd;
+	memcpy(&cfd, frame, sizeof(*frame));
+	cfd.flags = 0;
+
+	tb_append_fd(self, &cfd, timestamp);
+}
 
-	self->data[self->index++] = tb_frame;
-	self->index &= (self->length - 1);
+static void tb__push(struct tracebuffer* self,
+		     const struct canfd_frame* frame, uint64_t timestamp)
+{
+	uint64_t pos = __atomic_fetch_add(&self->head, 1, __ATOMIC_RELAXED);
+	struct tb_slot* slot = &self->slots[pos & (self->length - 1)];
+
+	__atomic_store_n(&slot->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
 
-	if (self->count < self->length)
-		self->count++;
+	slot->frame.timestamp = timestamp;
+	slot->frame.cfd = *frame;
+
+	__atomic_store_n(&slot->seq, 2 * pos + 2, __ATOMIC_RELEASE);
 }
 
-void tb_dump(struct tracebuffer* self, FILE* stream)
+void tb_append_fd(struct tracebuffer* self, const struct canfd_frame* frame,
+		  uint64_t timestamp)
 {
-	if (!tb_try_block(self))
+	if (!self->has_filter && !self->events) {
+		tb__push(self, frame, timestamp);
 		return;
+	}
+
+	struct canopen_msg msg = { 0 };
+	int is_canopen = !(frame->can_id & CAN_EFF_FLAG)
+		      && canopen_get_object_type(&msg,
+				(const struct can_frame*)frame) == 0;
+
+	if (self->has_filter && !tb__is_wanted(self, &msg, is_canopen, frame))
+		return;
+
+	if (self->events && is_canopen && (msg.object & TB_EVENT_OBJECTS))
+		tb__push(self->events, frame, timestamp);
+	else
+		tb__push(self, frame, timestamp);
+}
+
+/* Copy the frame at position pos. Returns 0 on success, 1 if the frame has
+ * not been completely written yet and -1 if it has been overwritten.
+ */
+static int tb__read(const struct tracebuffer* self, uint64_t pos,
+		    struct tb_frame* dst)
+{
+	const struct tb_slot* slot = &self->slots[pos & (self->length - 1)];
+
+	uint64_t before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (before < 2 * pos + 2)
+		return 1;
+
+	if (before != 2 * pos + 2)
+		return -1;
+
+	memcpy(dst, &slot->frame, sizeof(*dst));
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	uint64_t after = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+	return before == after ? 0 : -1;
+}
+
+/* Find the next frame at or after *pos that can be read */
+static int tb__next(const struct tracebuffer* self, uint64_t* pos,
+		    uint64_t head, struct tb_frame* dst)
+{
+	for (; *pos < head; ++*pos)
+		if (tb__read(self, *pos, dst) == 0)
+			return 0;
+
+	return -1;
+}
+
+static uint64_t tb__tail(const struct tracebuffer* self, uint64_t head)
+{
+	return head > self->length ? head - self->length : 0;
+}
+
+void tb_foreach(const struct tracebuffer* self, tb_frame_fn fn, void* context)
+{
+	static const struct tracebuffer empty = { 0 };
+	const struct tracebuffer* events = self->events ? self->events : &empty;
 
-	if (self->count < self->length) {
-		fwrite(self->data, sizeof(self->data[0]), self->count, stream);
-	} else {
-		fwrite(&self->data[self->index], sizeof(self->data[0]),
-		       self->length - self->index, stream);
+	uint64_t head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+	uint64_t pos = tb__tail(self, head);
 
-		fwrite(self->data, sizeof(self->data[0]), self->index, stream);
+	uint64_t event_head = __atomic_load_n(&events->head, __ATOMIC_ACQUIRE);
+	uint64_t event_pos = tb__tail(events, event_head);
+
+	/* Frames that are overwritten or still being written while we go are
+	 * left out.
+	 */
+	struct tb_frame frame, event;
+	int has_frame = tb__next(self, &pos, head, &frame) == 0;
+	int has_event = tb__next(events, &event_pos, event_head, &event) == 0;
+
+	while (has_frame || has_event) {
+		if (has_frame && (!has_event
+				  || frame.timestamp <= event.timestamp)) {
+			fn(&frame, context);
+			++pos;
+			has_frame = tb__next(self, &pos, head, &frame) == 0;
+		} else {
+			fn(&event, context);
+			++event_pos;
+			has_event = tb__next(events, &event_pos, event_head,
+					     &event) == 0;
+		}
 	}
+}
 
-	tb_unblock(self);
+static void tb__write_frame(const struct tb_frame* frame, void* context)
+{
+	fwrite(frame, sizeof(*frame), 1, context);
+}
 
+void tb_dump(struct tracebuffer* self, FILE* stream)
+{
+	tb_foreach(self, tb__write_frame, stream);
 	fflush(stream);
 }
+
+/* The position after the newest complete frame in a ring that is no longer
+ * being written to.
+ */
+static uint64_t tb__recover_head(const struct tracebuffer* self)
+{
+	uint64_t head = 0;
+
+	for (size_t i = 0; i < self->length; ++i) {
+		uint64_t seq = self->slots[i].seq;
+		if (seq != 0 && seq % 2 == 0 && seq / 2 > head)
+			head = seq / 2;
+	}
+
+	return head;
+}
+
+int tb_recover(const char* path, tb_frame_fn fn, void* context)
+{
+	int rc = -1;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		goto done;
+
+	size_t size = st.st_size;
+	if (size < sizeof(struct tb_file_header)) {
+		errno = EPROTO;
+		goto done;
+	}
+
+	void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto done;
+
+	const struct tb_file_header* header = map;
+	if (header->magic != TB_FILE_MAGIC
+	 || header->version != TB_FILE_VERSION
+	 || header->slot_size != sizeof(struct tb_slot)
+	 || (header->length & (header->length - 1))
+	 || (header->event_length & (header->event_length - 1))
+	 || sizeof(*header) + (header->length + header->event_length)
+			      * sizeof(struct tb_slot) > size) {
+		errno = EPROTO;
+		goto unmap;
+	}
+
+	struct tracebuffer events = {
+		.length = header->event_length,
+		.slots = (struct tb_slot*)(header + 1) + header->length,
+	};
+
+	struct tracebuffer tb = {
+		.length = header->length,
+		.slots = (struct tb_slot*)(header + 1),
+		.events = header->event_length ? &events : NULL,
+	};
+
+	tb.head = tb__recover_head(&tb);
+	events.head = tb__recover_head(&events);
+
+	tb_foreach(&tb, fn, context);
+	rc = 0;
+
+unmap:
+	munmap(map, size);
+done:
+	close(fd);
+	return rc;
+}
+
+size_t tb_read(struct tracebuffer* self, uint64_t* cursor,
+	       struct tb_frame* dst, size_t max)
+{
+	uint64_t head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+	uint64_t pos = *cursor;
+	size_t count = 0;
+
+	if (head - pos > self->length)
+		pos = head - self->length;
+
+	while (pos < head && count < max) {
+		int rc = tb__read(self, pos, &dst[count]);
+		if (rc > 0)
+			break;
+
+		if (rc == 0)
+			++count;
+
+		++pos;
+	}
+
+	*cursor = pos;
+	return count;
+}
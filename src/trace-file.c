@@ -0,0 +1,365 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace-file.h"
+#include "socketcan.h"
+#include "time-utils.h"
+
+size_t strlcpy(char*, const char*, size_t);
+
+int trace_file_frame_nodeid(const struct tb_frame* frame)
+{
+	const struct can_frame* cf = &frame->cf;
+
+	if (cf->can_id & CAN_EFF_FLAG)
+		return 0;
+
+	uint32_t id = cf->can_id & CAN_SFF_MASK;
+
+	/* NMT commands carry the node id in the payload */
+	if (id == 0)
+		return cf->can_dlc >= 2 ? cf->data[1] & 0x7f : 0;
+
+	return id & 0x7f;
+}
+
+static int trace_file__write_all(int fd, const void* data, size_t size)
+{
+	const char* ptr = data;
+
+	while (size > 0) {
+		ssize_t rc = write(fd, ptr, size);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		ptr += rc;
+		size -= rc;
+	}
+
+	return 0;
+}
+
+int trace_file_writer_init(struct trace_file_writer* self, int fd,
+			   const char* iface, int range_start, int range_stop)
+{
+	memset(self, 0, sizeof(*self));
+	self->fd = fd;
+
+	struct trace_file_header header = {
+		.magic = TRACE_FILE_MAGIC,
+		.version = TRACE_FILE_VERSION,
+		.header_size = sizeof(header),
+		.frame_size = sizeof(struct tb_frame),
+		.range_start = range_start,
+		.range_stop = range_stop,
+		.created = gettime_us(CLOCK_REALTIME),
+	};
+
+	strlcpy(header.iface, iface ? iface : "", sizeof(header.iface));
+
+	if (trace_file__write_all(fd, &header, sizeof(header)) < 0)
+		return -1;
+
+	self->offset = sizeof(header);
+	return 0;
+}
+
+static int trace_file__grow_index(struct trace_file_writer* self)
+{
+	if (self->n_blocks < self->capacity)
+		return 0;
+
+	size_t capacity = self->capacity ? self->capacity * 2 : 64;
+	void* index = realloc(self->index, capacity * sizeof(*self->index));
+	if (!index)
+		return -1;
+
+	self->index = index;
+	self->capacity = capacity;
+	return 0;
+}
+
+int trace_file_write_block(struct trace_file_writer* self,
+			   const struct tb_frame* frames, size_t n)
+{
+	if (n == 0)
+		return 0;
+
+	struct trace_file_block block = {
+		.magic = TRACE_FILE_BLOCK_MAGIC,
+		.n_frames = n,
+		.t_min = UINT64_MAX,
+	};
+
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t t = frames[i].timestamp;
+		int nodeid = trace_file_frame_nodeid(&frames[i]);
+
+		if (t < block.t_min)
+			block.t_min = t;
+
+		if (t > block.t_max)
+			block.t_max = t;
+
+		block.nodes[nodeid / 8] |= 1 << (nodeid % 8);
+	}
+
+	size_t size = n * sizeof(frames[0]);
+
+	if (trace_file__write_all(self->fd, &block, sizeof(block)) < 0
+	 || trace_file__write_all(self->fd, frames, size) < 0)
+		return -1;
+
+	/* Without a complete index, readers have to walk the blocks */
+	if (!self->is_unindexed && trace_file__grow_index(self) == 0) {
+		self->index[self->n_blocks].offset = self->offset;
+		self->index[self->n_blocks].block = block;
+		self->n_blocks++;
+	} else {
+		self->is_unindexed = 1;
+	}
+
+	self->offset += sizeof(block) + size;
+	return 0;
+}
+
+int trace_file_writer_finish(struct trace_file_writer* self)
+{
+	int rc = -1;
+
+	if (self->is_unindexed) {
+		rc = 0;
+		goto done;
+	}
+
+	struct trace_file_trailer trailer = {
+		.index_offset = self->offset,
+		.n_blocks = self->n_blocks,
+		.magic = TRACE_FILE_INDEX_MAGIC,
+	};
+
+	if (trace_file__write_all(self->fd, self->index,
+				  self->n_blocks * sizeof(self->index[0])) < 0)
+		goto done;
+
+	if (trace_file__write_all(self->fd, &trailer, sizeof(trailer)) < 0)
+		goto done;
+
+	rc = 0;
+done:
+	free(self->index);
+	memset(self, 0, sizeof(*self));
+	self->fd = -1;
+	return rc;
+}
+
+static void trace_file__load_index(struct trace_file* self)
+{
+	const struct trace_file_trailer* trailer;
+
+	if (self->size < self->header->header_size + sizeof(*trailer))
+		return;
+
+	trailer = (const void*)(self->map + self->size - sizeof(*trailer));
+	if (trailer->magic != TRACE_FILE_INDEX_MAGIC)
+		return;
+
+	uint64_t index_size = (uint64_t)trailer->n_blocks
+			    * sizeof(struct trace_file_index_entry);
+
+	if (trailer->index_offset + index_size + sizeof(*trailer) != self->size)
+		return;
+
+	self->index = (const void*)(self->map + trailer->index_offset);
+	self->n_blocks = trailer->n_blocks;
+}
+
+int trace_file_open(struct trace_file* self, const char* path)
+{
+	int rc = -1;
+
+	memset(self, 0, sizeof(*self));
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		goto done;
+
+	if ((size_t)st.st_size < sizeof(struct trace_file_header)) {
+		rc = 1;
+		goto done;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto done;
+
+	self->map = map;
+	self->size = st.st_size;
+	self->header = map;
+
+	if (self->header->magic != TRACE_FILE_MAGIC) {
+		trace_file_close(self);
+		rc = 1;
+		goto done;
+	}
+
+	if (self->header->version != TRACE_FILE_VERSION
+	 || self->header->frame_size != sizeof(struct tb_frame)
+	 || self->header->header_size < sizeof(struct trace_file_header)
+	 || self->header->header_size > self->size) {
+		trace_file_close(self);
+		errno = EPROTO;
+		goto done;
+	}
+
+	trace_file__load_index(self);
+
+	rc = 0;
+done:
+	close(fd);
+	return rc;
+}
+
+void trace_file_close(struct trace_file* self)
+{
+	if (self->map)
+		munmap((void*)self->map, self->size);
+
+	memset(self, 0, sizeof(*self));
+}
+
+static int trace_file__is_block_in_filter(const struct trace_file_block* block,
+					  const struct trace_file_filter* filter)
+{
+	if (filter->to && block->t_min > filter->to)
+		return 0;
+
+	if (block->t_max < filter->from)
+		return 0;
+
+	if (filter->nodeid >= 0
+	 && !(block->nodes[filter->nodeid / 8] & (1 << (filter->nodeid % 8))))
+		return 0;
+
+	return 1;
+}
+
+int trace_file_filter_match(const struct trace_file_filter* filter,
+			    const struct tb_frame* frame)
+{
+	if (frame->timestamp < filter->from)
+		return 0;
+
+	if (filter->to && frame->timestamp > filter->to)
+		return 0;
+
+	if (filter->nodeid >= 0
+	 && trace_file_frame_nodeid(frame) != filter->nodeid)
+		return 0;
+
+	return 1;
+}
+
+/* Returns the number of frames in the block that are inside the file */
+static size_t trace_file__block_frames(const struct trace_file* self,
+				       uint64_t offset)
+{
+	const struct trace_file_block* block;
+
+	if (offset + sizeof(*block) > self->size)
+		return 0;
+
+	block = (const void*)(self->map + offset);
+	if (block->magic != TRACE_FILE_BLOCK_MAGIC)
+		return 0;
+
+	size_t max = (self->size - offset - sizeof(*block))
+		   / sizeof(struct tb_frame);
+
+	return block->n_frames < max ? block->n_frames : max;
+}
+
+static void trace_file__scan_block(const struct trace_file* self,
+				   uint64_t offset, size_t n,
+				   const struct trace_file_filter* filter,
+				   trace_file_frame_fn fn, void* context)
+{
+	const struct tb_frame* frames = (const void*)(self->map + offset
+					+ sizeof(struct trace_file_block));
+
+	for (size_t i = 0; i < n; ++i)
+		if (trace_file_filter_match(filter, &frames[i]))
+			fn(&frames[i], context);
+}
+
+int trace_file_scan(const struct trace_file* self,
+		    const struct trace_file_filter* filter,
+		    trace_file_frame_fn fn, void* context)
+{
+	if (self->index) {
+		for (size_t i = 0; i < self->n_blocks; ++i) {
+			const struct trace_file_index_entry* entry =
+				&self->index[i];
+
+			if (!trace_file__is_block_in_filter(&entry->block,
+							    filter))
+				continue;
+
+			size_t n = trace_file__block_frames(self, entry->offset);
+			if (n == 0)
+				return -1;
+
+			trace_file__scan_block(self, entry->offset, n, filter,
+					       fn, context);
+		}
+
+		return 0;
+	}
+
+	uint64_t offset = self->header->header_size;
+
+	for (;;) {
+		size_t n = trace_file__block_frames(self, offset);
+		if (n == 0)
+			break;
+
+		const struct trace_file_block* block =
+			(const void*)(self->map + offset);
+
+		if (trace_file__is_block_in_filter(block, filter))
+			trace_file__scan_block(self, offset, n, filter, fn,
+					       context);
+
+		offset += sizeof(*block) + n * sizeof(struct tb_frame);
+	}
+
+	return 0;
+}
@@ -0,0 +1,744 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace-format.h"
+#include "socketcan.h"
+
+size_t strlcpy(char*, const char*, size_t);
+
+#define LINKTYPE_CAN_SOCKETCAN 227
+
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_MAX_INTERFACES 16
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+
+/* The header of a LINKTYPE_CAN_SOCKETCAN packet. The CAN ID is big endian. */
+struct trace_format__can_header {
+	uint32_t can_id;
+	uint8_t len;
+	uint8_t flags;
+	uint8_t reserved[2];
+};
+
+static const char trace_format__hex[] = "0123456789ABCDEF";
+
+int trace_format_from_string(enum trace_format* dst, const char* name)
+{
+	if (strcmp(name, "raw") == 0)
+		*dst = TRACE_FORMAT_RAW;
+	else if (strcmp(name, "pcapng") == 0)
+		*dst = TRACE_FORMAT_PCAPNG;
+	else if (strcmp(name, "candump") == 0)
+		*dst = TRACE_FORMAT_CANDUMP;
+	else
+		return -1;
+
+	return 0;
+}
+
+const char* trace_format_extension(enum trace_format format)
+{
+	switch (format) {
+	case TRACE_FORMAT_RAW: return "trace";
+	case TRACE_FORMAT_PCAPNG: return "pcapng";
+	case TRACE_FORMAT_CANDUMP: return "log";
+	}
+
+	return "trace";
+}
+
+static inline size_t trace_format__pad4(size_t size)
+{
+	return (size + 3) & ~(size_t)3;
+}
+
+static int trace_format__write(FILE* stream, const void* data, size_t size)
+{
+	return fwrite(data, 1, size, stream) == size ? 0 : -1;
+}
+
+static int trace_format__write_u32(FILE* stream, uint32_t value)
+{
+	return trace_format__write(stream, &value, sizeof(value));
+}
+
+static int trace_export__pcapng_header(struct trace_export* self)
+{
+	struct {
+		uint32_t type;
+		uint32_t length;
+		uint32_t byte_order;
+		uint16_t major;
+		uint16_t minor;
+		int64_t section_length;
+		uint32_t length2;
+	} __attribute__((packed)) shb = {
+		.type = PCAPNG_SHB,
+		.length = sizeof(shb),
+		.byte_order = PCAPNG_BYTE_ORDER_MAGIC,
+		.major = 1,
+		.minor = 0,
+		.section_length = -1,
+		.length2 = sizeof(shb),
+	};
+
+	if (trace_format__write(self->stream, &shb, sizeof(shb)) < 0)
+		return -1;
+
+	/* The interface name is the only option; microseconds are the
+	 * default time resolution.
+	 */
+	size_t name_len = strlen(self->iface);
+	size_t options_len = name_len ? 4 + trace_format__pad4(name_len) + 4
+				      : 0;
+
+	struct {
+		uint32_t type;
+		uint32_t length;
+		uint16_t linktype;
+		uint16_t reserved;
+		uint32_t snaplen;
+	} idb = {
+		.type = PCAPNG_IDB,
+		.length = sizeof(idb) + options_len + 4,
+		.linktype = LINKTYPE_CAN_SOCKETCAN,
+		.snaplen = 0,
+	};
+
+	if (trace_format__write(self->stream, &idb, sizeof(idb)) < 0)
+		return -1;
+
+	if (name_len) {
+		uint16_t opt[2] = { PCAPNG_OPT_IF_NAME, name_len };
+		char name[sizeof(self->iface) + 4] = { 0 };
+		memcpy(name, self->iface, name_len);
+
+		uint16_t end[2] = { PCAPNG_OPT_END, 0 };
+
+		if (trace_format__write(self->stream, opt, sizeof(opt)) < 0
+		 || trace_format__write(self->stream, name,
+					trace_format__pad4(name_len)) < 0
+		 || trace_format__write(self->stream, end, sizeof(end)) < 0)
+			return -1;
+	}
+
+	return trace_format__write_u32(self->stream, idb.length);
+}
+
+int trace_export_begin(struct trace_export* self, FILE* stream,
+		       enum trace_format format, const char* iface)
+{
+	self->stream = stream;
+	self->format = format;
+	strlcpy(self->iface, iface ? iface : "", sizeof(self->iface));
+
+	if (format == TRACE_FORMAT_PCAPNG)
+		return trace_export__pcapng_header(self);
+
+	return 0;
+}
+
+static int trace_export__pcapng_frame(struct trace_export* self,
+				      const struct tb_frame* frame)
+{
+	const struct canfd_frame* cfd = &frame->cfd;
+	int is_fd = canfd_is_fd(cfd);
+
+	/* Wireshark tells FD frames from classic ones by their size */
+	size_t size = is_fd ? CANFD_MTU : CAN_MTU;
+	size_t data_size = size - sizeof(struct trace_format__can_header);
+
+	struct {
+		uint32_t type;
+		uint32_t length;
+		uint32_t interface;
+		uint32_t ts_high;
+		uint32_t ts_low;
+		uint32_t captured;
+		uint32_t original;
+		struct trace_format__can_header can;
+		uint8_t data[CANFD_MAX_DLEN];
+		uint32_t length2;
+	} epb;
+
+	memset(&epb, 0, sizeof(epb));
+
+	size_t length = offsetof(__typeof__(epb), data) + data_size + 4;
+
+	epb.type = PCAPNG_EPB;
+	epb.length = length;
+	epb.ts_high = frame->timestamp >> 32;
+	epb.ts_low = frame->timestamp & 0xffffffff;
+	epb.captured = size;
+	epb.original = size;
+	epb.can.can_id = htonl(cfd->can_id);
+	epb.can.len = cfd->len;
+	epb.can.flags = is_fd ? cfd->flags : 0;
+	memcpy(epb.data, cfd->data, cfd->len < data_size ? cfd->len
+							  : data_size);
+	memcpy(&epb.data[data_size], &epb.length, sizeof(epb.length));
+
+	return trace_format__write(self->stream, &epb, length);
+}
+
+static char* trace_export__put_hex(char* dst, uint32_t value, int digits)
+{
+	for (int i = digits - 1; i >= 0; --i)
+		*dst++ = trace_format__hex[(value >> (4 * i)) & 0xf];
+
+	return dst;
+}
+
+static int trace_export__candump_frame(struct trace_export* self,
+				       const struct tb_frame* frame)
+{
+	const struct canfd_frame* cfd = &frame->cfd;
+	char line[256];
+
+	int n = snprintf(line, sizeof(line), "(%llu.%06llu) %s ",
+			 (unsigned long long)(frame->timestamp / 1000000ULL),
+			 (unsigned long long)(frame->timestamp % 1000000ULL),
+			 self->iface[0] ? self->iface : "can0");
+	char* p = line + n;
+
+	if (cfd->can_id & (CAN_EFF_FLAG | CAN_ERR_FLAG))
+		p = trace_export__put_hex(p, cfd->can_id & (CAN_EFF_MASK
+							    | CAN_ERR_FLAG), 8);
+	else
+		p = trace_export__put_hex(p, cfd->can_id & CAN_SFF_MASK, 3);
+
+	*p++ = '#';
+
+	size_t len = cfd->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : cfd->len;
+
+	if (canfd_is_fd(cfd)) {
+		*p++ = '#';
+		p = trace_export__put_hex(p, cfd->flags & ~CANFD_FDF & 0xf, 1);
+	} else if (cfd->can_id & CAN_RTR_FLAG) {
+		*p++ = 'R';
+		if (len)
+			p = trace_export__put_hex(p, len, 1);
+		len = 0;
+	}
+
+	for (size_t i = 0; i < len; ++i)
+		p = trace_export__put_hex(p, cfd->data[i], 2);
+
+	*p++ = '\n';
+
+	return trace_format__write(self->stream, line, p - line);
+}
+
+int trace_export_frame(struct trace_export* self, const struct tb_frame* frame)
+{
+	switch (self->format) {
+	case TRACE_FORMAT_RAW:
+		return trace_format__write(self->stream, frame, sizeof(*frame));
+	case TRACE_FORMAT_PCAPNG:
+		return trace_export__pcapng_frame(self, frame);
+	case TRACE_FORMAT_CANDUMP:
+		return trace_export__candump_frame(self, frame);
+	}
+
+	return -1;
+}
+
+void trace_export_frame_fn(const struct tb_frame* frame, void* context)
+{
+	trace_export_frame(context, frame);
+}
+
+struct trace_import {
+	const uint8_t* data;
+	size_t size;
+	int is_swapped;
+	tb_frame_fn fn;
+	void* context;
+};
+
+static inline uint16_t trace_import__u16(const struct trace_import* self,
+					 const uint8_t* p)
+{
+	uint16_t value;
+	memcpy(&value, p, sizeof(value));
+	return self->is_swapped ? __builtin_bswap16(value) : value;
+}
+
+static inline uint32_t trace_import__u32(const struct trace_import* self,
+					 const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return self->is_swapped ? __builtin_bswap32(value) : value;
+}
+
+/* Time stamps in units of 10^-exp or 2^-exp seconds, as pcapng has it */
+static uint64_t trace_import__to_us(uint64_t ts, uint8_t resolution)
+{
+	unsigned int exp = resolution & 0x7f;
+
+	if (resolution & 0x80) {
+		if (exp >= 64)
+			return 0;
+		uint64_t mask = exp ? (1ULL << exp) - 1 : 0;
+		return (ts >> exp) * 1000000ULL
+		     + (((ts & mask) * 1000000ULL) >> exp);
+	}
+
+	for (; exp > 6; --exp)
+		ts /= 10;
+
+	for (; exp < 6; ++exp)
+		ts *= 10;
+
+	return ts;
+}
+
+static void trace_import__packet(struct trace_import* self,
+				 const uint8_t* packet, size_t size,
+				 uint64_t timestamp)
+{
+	if (size < sizeof(struct trace_format__can_header))
+		return;
+
+	struct tb_frame frame;
+	memset(&frame, 0, sizeof(frame));
+
+	uint32_t can_id;
+	memcpy(&can_id, packet, sizeof(can_id));
+
+	frame.timestamp = timestamp;
+	frame.cfd.can_id = ntohl(can_id);
+	frame.cfd.len = packet[4];
+
+	uint8_t flags = packet[5];
+
+	int is_fd = size == CANFD_MTU || (flags & CANFD_FDF)
+		 || frame.cfd.len > CAN_MAX_DLEN;
+	if (is_fd)
+		frame.cfd.flags = flags | CANFD_FDF;
+
+	size_t max = is_fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+	if (frame.cfd.len > max)
+		frame.cfd.len = max;
+
+	size_t len = size - sizeof(struct trace_format__can_header);
+	if (len > frame.cfd.len)
+		len = frame.cfd.len;
+
+	memcpy(frame.cfd.data, packet + sizeof(struct trace_format__can_header),
+	       len);
+
+	self->fn(&frame, self->context);
+}
+
+static int trace_import__pcapng(struct trace_import* self)
+{
+	uint16_t linktype[PCAPNG_MAX_INTERFACES];
+	uint8_t resolution[PCAPNG_MAX_INTERFACES];
+	unsigned int n_interfaces = 0;
+
+	size_t pos = 0;
+
+	while (pos + 12 <= self->size) {
+		const uint8_t* block = &self->data[pos];
+		uint32_t type;
+		memcpy(&type, block, sizeof(type));
+
+		/* Each section defines its own byte order */
+		if (type == PCAPNG_SHB) {
+			uint32_t magic;
+			memcpy(&magic, block + 8, sizeof(magic));
+
+			if (magic == PCAPNG_BYTE_ORDER_MAGIC)
+				self->is_swapped = 0;
+			else if (magic == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC))
+				self->is_swapped = 1;
+			else
+				return -1;
+
+			n_interfaces = 0;
+		} else {
+			type = trace_import__u32(self, block);
+		}
+
+		uint32_t length = trace_import__u32(self, block + 4);
+		if (length < 12 || length % 4 != 0 || length > self->size - pos)
+			return -1;
+
+		const uint8_t* body = block + 8;
+		size_t body_size = length - 12;
+
+		if (type == PCAPNG_IDB && body_size >= 8) {
+			if (n_interfaces >= PCAPNG_MAX_INTERFACES)
+				return -1;
+
+			linktype[n_interfaces] = trace_import__u16(self, body);
+			resolution[n_interfaces] = 6;
+
+			size_t opt = 8;
+			while (opt + 4 <= body_size) {
+				uint16_t code = trace_import__u16(self, body + opt);
+				uint16_t len = trace_import__u16(self, body + opt + 2);
+
+				if (code == PCAPNG_OPT_END)
+					break;
+
+				if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1
+				 && opt + 4 < body_size)
+					resolution[n_interfaces] = body[opt + 4];
+
+				opt += 4 + trace_format__pad4(len);
+			}
+
+			++n_interfaces;
+		} else if (type == PCAPNG_EPB && body_size >= 20) {
+			uint32_t interface = trace_import__u32(self, body);
+			uint64_t ts = (uint64_t)trace_import__u32(self, body + 4)
+					<< 32 | trace_import__u32(self, body + 8);
+			uint32_t captured = trace_import__u32(self, body + 12);
+
+			if (captured > body_size - 20)
+				return -1;
+
+			if (interface < n_interfaces
+			 && linktype[interface] == LINKTYPE_CAN_SOCKETCAN)
+				trace_import__packet(self, body + 20, captured,
+					trace_import__to_us(ts,
+						resolution[interface]));
+		} else if (type == PCAPNG_SPB && body_size >= 4) {
+			/* Simple packets carry no time stamp */
+			uint32_t original = trace_import__u32(self, body);
+			size_t captured = original < body_size - 4
+					? original : body_size - 4;
+
+			if (n_interfaces > 0
+			 && linktype[0] == LINKTYPE_CAN_SOCKETCAN)
+				trace_import__packet(self, body + 4, captured, 0);
+		}
+
+		pos += length;
+	}
+
+	return 0;
+}
+
+static int trace_import__pcap(struct trace_import* self, int is_nanosecond)
+{
+	if (self->size < 24)
+		return -1;
+
+	uint32_t linktype = trace_import__u32(self, self->data + 20);
+	if ((linktype & 0xffff) != LINKTYPE_CAN_SOCKETCAN)
+		return -1;
+
+	size_t pos = 24;
+
+	while (pos + 16 <= self->size) {
+		const uint8_t* record = &self->data[pos];
+		uint64_t sec = trace_import__u32(self, record);
+		uint64_t frac = trace_import__u32(self, record + 4);
+		uint32_t captured = trace_import__u32(self, record + 8);
+
+		if (captured > self->size - pos - 16)
+			return -1;
+
+		uint64_t ts = sec * 1000000ULL
+			    + (is_nanosecond ? frac / 1000 : frac);
+
+		trace_import__packet(self, record + 16, captured, ts);
+
+		pos += 16 + captured;
+	}
+
+	return 0;
+}
+
+static int trace_import__hex_digit(char c)
+{
+	if ('0' <= c && c <= '9')
+		return c - '0';
+	if ('a' <= c && c <= 'f')
+		return c - 'a' + 10;
+	if ('A' <= c && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Parses "(sec.usec) iface ID#DATA", "ID#R[len]" or "ID##FLAGSDATA".
+ * Returns 0 for a frame, 1 for a line to skip and -1 if it is no candump log
+ * line at all.
+ */
+static int trace_import__candump_line(const char* line, const char* end,
+				      struct tb_frame* frame)
+{
+	const char* p = line;
+
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		++p;
+
+	if (p == end)
+		return 1;
+
+	if (*p++ != '(')
+		return -1;
+
+	uint64_t sec = 0, usec = 0;
+	int n_digits = 0;
+
+	while (p < end && '0' <= *p && *p <= '9')
+		sec = sec * 10 + *p++ - '0';
+
+	if (p < end && *p == '.') {
+		for (++p; p < end && '0' <= *p && *p <= '9'; ++p)
+			if (n_digits++ < 6)
+				usec = usec * 10 + *p - '0';
+	}
+
+	for (; n_digits < 6; ++n_digits)
+		usec *= 10;
+
+	if (p == end || *p++ != ')')
+		return -1;
+
+	while (p < end && *p == ' ')
+		++p;
+
+	while (p < end && *p != ' ')
+		++p;
+
+	while (p < end && *p == ' ')
+		++p;
+
+	memset(frame, 0, sizeof(*frame));
+	frame->timestamp = sec * 1000000ULL + usec;
+
+	uint32_t can_id = 0;
+	int id_len = 0;
+	int digit;
+
+	for (; p < end && (digit = trace_import__hex_digit(*p)) >= 0; ++p) {
+		can_id = can_id << 4 | digit;
+		++id_len;
+	}
+
+	if (id_len == 0 || p == end || *p++ != '#')
+		return -1;
+
+	if (id_len > 3)
+		can_id |= CAN_EFF_FLAG;
+
+	size_t max = CAN_MAX_DLEN;
+
+	if (p < end && *p == '#') {
+		++p;
+		if (p == end || (digit = trace_import__hex_digit(*p++)) < 0)
+			return -1;
+
+		frame->cfd.flags = digit | CANFD_FDF;
+		max = CANFD_MAX_DLEN;
+	} else if (p < end && *p == 'R') {
+		++p;
+		can_id |= CAN_RTR_FLAG;
+
+		if (p < end && (digit = trace_import__hex_digit(*p)) >= 0
+		 && digit <= CAN_MAX_DLEN)
+			frame->cfd.len = digit;
+
+		frame->cfd.can_id = can_id;
+		return 0;
+	}
+
+	frame->cfd.can_id = can_id;
+
+	while (p < end && frame->cfd.len < max) {
+		if (*p == '.') {
+			++p;
+			continue;
+		}
+
+		int high = trace_import__hex_digit(*p);
+		int low = p + 1 < end ? trace_import__hex_digit(p[1]) : -1;
+		if (high < 0 || low < 0)
+			break;
+
+		frame->cfd.data[frame->cfd.len++] = high << 4 | low;
+		p += 2;
+	}
+
+	return 0;
+}
+
+static int trace_import__candump(struct trace_import* self)
+{
+	const char* p = (const char*)self->data;
+	const char* end = p + self->size;
+
+	while (p < end) {
+		const char* eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+
+		struct tb_frame frame;
+		int rc = trace_import__candump_line(p, eol, &frame);
+		if (rc < 0)
+			return -1;
+
+		if (rc == 0)
+			self->fn(&frame, self->context);
+
+		p = eol + 1;
+	}
+
+	return 0;
+}
+
+int trace_import(const char* path, tb_frame_fn fn, void* context)
+{
+	int rc = -1;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		goto done;
+
+	if (st.st_size < 4) {
+		rc = 1;
+		goto done;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto done;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	struct trace_import self = {
+		.data = map,
+		.size = st.st_size,
+		.fn = fn,
+		.context = context,
+	};
+
+	uint32_t magic;
+	memcpy(&magic, map, sizeof(magic));
+
+	if (magic == PCAPNG_SHB) {
+		rc = trace_import__pcapng(&self);
+	} else if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+		rc = trace_import__pcap(&self, magic == PCAP_MAGIC_NS);
+	} else if (magic == __builtin_bswap32(PCAP_MAGIC_US)
+		|| magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+		self.is_swapped = 1;
+		rc = trace_import__pcap(&self,
+				magic == __builtin_bswap32(PCAP_MAGIC_NS));
+	} else if (self.data[0] == '(') {
+		rc = trace_import__candump(&self);
+	} else {
+		rc = 1;
+	}
+
+	munmap(map, st.st_size);
+done:
+	close(fd);
+	return rc;
+}
+
+struct trace_format__filtered {
+	const struct trace_file_filter* filter;
+	tb_frame_fn fn;
+	void* context;
+};
+
+static void trace_format__filter_frame(const struct tb_frame* frame,
+				       void* context)
+{
+	struct trace_format__filtered* self = context;
+
+	if (trace_file_filter_match(self->filter, frame))
+		self->fn(frame, self->context);
+}
+
+/* Trace buffer dumps are a plain array of frames */
+static int trace_format__read_raw(const char* path,
+				  struct trace_format__filtered* filtered)
+{
+	FILE* stream = fopen(path, "r");
+	if (!stream)
+		return -1;
+
+	struct tb_frame frame;
+	while (fread(&frame, sizeof(frame), 1, stream))
+		trace_format__filter_frame(&frame, filtered);
+
+	int rc = ferror(stream) ? -1 : 0;
+
+	fclose(stream);
+	return rc;
+}
+
+int trace_read(const char* path, const struct trace_file_filter* filter,
+	       tb_frame_fn fn, void* context)
+{
+	static const struct trace_file_filter all = { .nodeid = -1 };
+
+	if (!filter)
+		filter = &all;
+
+	struct trace_file file;
+	int rc = trace_file_open(&file, path);
+	if (rc < 0)
+		return -1;
+
+	if (rc == 0) {
+		rc = trace_file_scan(&file, filter, fn, context);
+		trace_file_close(&file);
+		return rc;
+	}
+
+	struct trace_format__filtered filtered = {
+		.filter = filter,
+		.fn = fn,
+		.context = context,
+	};
+
+	rc = trace_import(path, trace_format__filter_frame, &filtered);
+	if (rc <= 0)
+		return rc;
+
+	return trace_format__read_raw(path, &filtered);
+}
@@ -0,0 +1,386 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "trace-stream.h"
+#include "trace-buffer.h"
+#include "trace-file.h"
+#include "time-utils.h"
+#include "plog.h"
+
+size_t strlcpy(char*, const char*, size_t);
+
+#define TRACE_STREAM_BATCH_SIZE 1024
+#define TRACE_STREAM_PERIOD_NS 100000000ULL /* 100 ms */
+#define TRACE_STREAM_PREFIX "stream-"
+#define TRACE_STREAM_SUFFIX ".trace"
+
+static pthread_t trace_stream__thread;
+static int trace_stream__is_running = 0;
+static int trace_stream__is_stopping = 0;
+
+static struct tracebuffer* trace_stream__tb;
+static char trace_stream__path[256];
+static uint64_t trace_stream__file_size;
+static uint64_t trace_stream__file_age;
+static uint64_t trace_stream__retention;
+static char trace_stream__iface[32];
+static char trace_stream__prefix[48];
+static int trace_stream__range_start;
+static int trace_stream__range_stop;
+
+/* Used by the stream thread only */
+static uint64_t trace_stream__cursor;
+static uint64_t trace_stream__event_cursor;
+static int trace_stream__fd = -1;
+static struct trace_file_writer trace_stream__writer;
+static char trace_stream__name[96];
+static uint64_t trace_stream__written;
+static uint64_t trace_stream__opened;
+static unsigned int trace_stream__seq;
+static struct tb_frame trace_stream__batch[TRACE_STREAM_BATCH_SIZE];
+
+static uint64_t trace_stream__dropped;
+
+struct trace_stream_file {
+	char name[96];
+	uint64_t size;
+};
+
+/* Buses that share the directory each have a prefix of their own */
+static void trace_stream__set_prefix(const char* iface)
+{
+	snprintf(trace_stream__prefix, sizeof(trace_stream__prefix),
+		 TRACE_STREAM_PREFIX "%s%s", iface, *iface ? "-" : "");
+
+	for (char* p = trace_stream__prefix; *p; ++p)
+		if (*p == '/')
+			*p = '_';
+}
+
+static int trace_stream__is_stream_file(const char* name)
+{
+	size_t len = strlen(name);
+	size_t prefix_len = strlen(trace_stream__prefix);
+	size_t suffix_len = strlen(TRACE_STREAM_SUFFIX);
+
+	return len > prefix_len + suffix_len
+	    && len < sizeof(((struct trace_stream_file*)0)->name)
+	    && strncmp(name, trace_stream__prefix, prefix_len) == 0
+	    && strcmp(name + len - suffix_len, TRACE_STREAM_SUFFIX) == 0;
+}
+
+static int trace_stream__cmp_file(const void* a, const void* b)
+{
+	const struct trace_stream_file* fa = a;
+	const struct trace_stream_file* fb = b;
+	return strcmp(fa->name, fb->name);
+}
+
+/* File names sort by creation time, so the oldest ones go first. */
+static void trace_stream__enforce_retention(void)
+{
+	if (trace_stream__retention == 0)
+		return;
+
+	DIR* dir = opendir(trace_stream__path);
+	if (!dir)
+		return;
+
+	struct trace_stream_file* files = NULL;
+	size_t n_files = 0, capacity = 0;
+	uint64_t total = 0;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir))) {
+		if (!trace_stream__is_stream_file(entry->d_name))
+			continue;
+
+		struct stat st;
+		if (fstatat(dirfd(dir), entry->d_name, &st, 0) < 0)
+			continue;
+
+		if (n_files == capacity) {
+			size_t new_capacity = capacity ? capacity * 2 : 16;
+			void* p = realloc(files, new_capacity * sizeof(*files));
+			if (!p)
+				goto done;
+
+			files = p;
+			capacity = new_capacity;
+		}
+
+		strlcpy(files[n_files].name, entry->d_name,
+			sizeof(files[n_files].name));
+		files[n_files].size = st.st_size;
+		total += st.st_size;
+		++n_files;
+	}
+
+	qsort(files, n_files, sizeof(*files), trace_stream__cmp_file);
+
+	for (size_t i = 0; i < n_files && total > trace_stream__retention; ++i) {
+		if (strcmp(files[i].name, trace_stream__name) == 0)
+			continue;
+
+		if (unlinkat(dirfd(dir), files[i].name, 0) < 0)
+			continue;
+
+		total -= files[i].size;
+	}
+
+done:
+	free(files);
+	closedir(dir);
+}
+
+static void trace_stream__close_file(void)
+{
+	if (trace_stream__fd < 0)
+		return;
+
+	trace_file_writer_finish(&trace_stream__writer);
+	close(trace_stream__fd);
+	trace_stream__fd = -1;
+}
+
+static int trace_stream__open_file(void)
+{
+	char ts[32];
+	struct tm tm;
+	time_t t = time(NULL);
+
+	localtime_r(&t, &tm);
+	strftime(ts, sizeof(ts), "%y%m%d-%H%M%S", &tm);
+
+	snprintf(trace_stream__name, sizeof(trace_stream__name),
+		 "%s%s.%06u" TRACE_STREAM_SUFFIX, trace_stream__prefix, ts,
+		 trace_stream__seq++);
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s", trace_stream__path,
+		 trace_stream__name);
+
+	trace_stream__fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				0644);
+	if (trace_stream__fd < 0) {
+		plog(LOG_WARNING, "Could not open trace stream file %s: %m",
+		     path);
+		return -1;
+	}
+
+	if (trace_file_writer_init(&trace_stream__writer, trace_stream__fd,
+				   trace_stream__iface, trace_stream__range_start,
+				   trace_stream__range_stop) < 0) {
+		plog(LOG_WARNING, "Could not write trace stream header: %m");
+		close(trace_stream__fd);
+		trace_stream__fd = -1;
+		return -1;
+	}
+
+	trace_stream__written = 0;
+	trace_stream__opened = gettime_us(CLOCK_MONOTONIC);
+
+	trace_stream__enforce_retention();
+	return 0;
+}
+
+static int trace_stream__is_file_full(void)
+{
+	if (trace_stream__written >= trace_stream__file_size)
+		return 1;
+
+	if (trace_stream__file_age == 0)
+		return 0;
+
+	uint64_t age = gettime_us(CLOCK_MONOTONIC) - trace_stream__opened;
+	return age >= trace_stream__file_age * 1000000ULL;
+}
+
+/* Returns the number of frames that could not be written */
+static size_t trace_stream__write(const struct tb_frame* frames, size_t n)
+{
+	const size_t frame_size = sizeof(frames[0]);
+
+	while (n > 0) {
+		if (trace_stream__fd >= 0 && trace_stream__is_file_full())
+			trace_stream__close_file();
+
+		if (trace_stream__fd < 0 && trace_stream__open_file() < 0)
+			return n;
+
+		size_t room = trace_stream__written < trace_stream__file_size
+			    ? (trace_stream__file_size - trace_stream__written)
+			      / frame_size
+			    : 0;
+		size_t count = room == 0 ? 1 : room < n ? room : n;
+
+		if (trace_file_write_block(&trace_stream__writer, frames,
+					   count) < 0) {
+			plog(LOG_WARNING, "Could not write trace stream: %m");
+			trace_stream__close_file();
+			return n;
+		}
+
+		trace_stream__written += count * frame_size;
+
+		frames += count;
+		n -= count;
+	}
+
+	return 0;
+}
+
+static void trace_stream__add_dropped(uint64_t n)
+{
+	if (n)
+		__atomic_add_fetch(&trace_stream__dropped, n, __ATOMIC_RELAXED);
+}
+
+static size_t trace_stream__read(struct tracebuffer* tb, uint64_t* cursor,
+				 struct tb_frame* dst, size_t max)
+{
+	uint64_t before = *cursor;
+	size_t n = tb_read(tb, cursor, dst, max);
+
+	trace_stream__add_dropped(*cursor - before - n);
+	return n;
+}
+
+static int trace_stream__cmp_frame(const void* a, const void* b)
+{
+	const struct tb_frame* fa = a;
+	const struct tb_frame* fb = b;
+
+	if (fa->timestamp == fb->timestamp)
+		return 0;
+
+	return fa->timestamp < fb->timestamp ? -1 : 1;
+}
+
+/* Returns the number of frames that were taken from the trace buffer. Frames
+ * from the event ring are merged into each batch by their timestamps.
+ */
+static size_t trace_stream__drain(void)
+{
+	struct tracebuffer* events = trace_stream__tb->events;
+	struct tb_frame* batch = trace_stream__batch;
+	size_t total = 0;
+
+	for (;;) {
+		size_t n = trace_stream__read(trace_stream__tb,
+					      &trace_stream__cursor, batch,
+					      TRACE_STREAM_BATCH_SIZE);
+		size_t n_events = 0;
+
+		if (events)
+			n_events = trace_stream__read(events,
+					&trace_stream__event_cursor, batch + n,
+					TRACE_STREAM_BATCH_SIZE - n);
+
+		if (n && n_events)
+			qsort(batch, n + n_events, sizeof(batch[0]),
+			      trace_stream__cmp_frame);
+
+		n += n_events;
+		if (n == 0)
+			break;
+
+		trace_stream__add_dropped(trace_stream__write(batch, n));
+
+		total += n;
+
+		if (n < TRACE_STREAM_BATCH_SIZE)
+			break;
+	}
+
+	return total;
+}
+
+static void* trace_stream__main(void* arg)
+{
+	(void)arg;
+
+	while (!__atomic_load_n(&trace_stream__is_stopping, __ATOMIC_ACQUIRE)) {
+		struct timespec ts = ns_to_timespec(TRACE_STREAM_PERIOD_NS);
+		nanosleep(&ts, NULL);
+
+		trace_stream__drain();
+	}
+
+	trace_stream__drain();
+	trace_stream__close_file();
+
+	return NULL;
+}
+
+int trace_stream_start(struct tracebuffer* tb,
+		       const struct trace_stream_params* params)
+{
+	if (trace_stream__is_running || !tb || params->file_size == 0)
+		return -1;
+
+	trace_stream__tb = tb;
+	strlcpy(trace_stream__path, params->path, sizeof(trace_stream__path));
+	trace_stream__file_size = params->file_size;
+	trace_stream__file_age = params->file_age;
+	trace_stream__retention = params->retention;
+	strlcpy(trace_stream__iface, params->iface ? params->iface : "",
+		sizeof(trace_stream__iface));
+	trace_stream__set_prefix(trace_stream__iface);
+	trace_stream__range_start = params->range_start;
+	trace_stream__range_stop = params->range_stop;
+
+	trace_stream__cursor = __atomic_load_n(&tb->head, __ATOMIC_ACQUIRE);
+	trace_stream__event_cursor = tb->events
+		? __atomic_load_n(&tb->events->head, __ATOMIC_ACQUIRE) : 0;
+	trace_stream__fd = -1;
+	trace_stream__name[0] = '\0';
+	trace_stream__dropped = 0;
+	trace_stream__is_stopping = 0;
+
+	if (pthread_create(&trace_stream__thread, NULL, trace_stream__main,
+			   NULL) != 0)
+		return -1;
+
+	trace_stream__is_running = 1;
+	return 0;
+}
+
+void trace_stream_stop(void)
+{
+	if (!trace_stream__is_running)
+		return;
+
+	__atomic_store_n(&trace_stream__is_stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(trace_stream__thread, NULL);
+
+	trace_stream__is_running = 0;
+}
+
+uint64_t trace_stream_get_dropped(void)
+{
+	return __atomic_load_n(&trace_stream__dropped, __ATOMIC_RELAXED);
+}
@@ -19,6 +19,7 @@
 #include <mloop.h>
 #include <errno.h>
 #include <stddef.h>
+#include <ctype.h>
 
 #include "socketcan.h"
 #include "canopen.h"
@@ -31,11 +32,19 @@
 #include "sock.h"
 #include "ini_parser.h"
 #include "conversions.h"
+#include "string-utils.h"
 #include "vnode.h"
 #include "type-macros.h"
+#include "timer-wheel.h"
+#include "time-utils.h"
 
 #define SDO_MUX(index, subindex) ((index << 16) | subindex)
 #define HEARTBEAT_PERIOD SDO_MUX(0x1017, 0)
+#define VNODE_BATCH_SIZE 128
+#define VNODE_PDO_COUNT 4
+#define VNODE_PDO_COUNTERS 0x5fff
+#define VNODE_TICK_PERIOD msec_to_nsec(1)
+#define VNODE_RSDO_QUEUE_SIZE 64
 
 enum vnode__bootup_method {
 	VNODE_BOOT_UNSPEC = 0,
@@ -44,10 +53,68 @@ enum vnode__bootup_method {
 	VNODE_BOOT_BOTH = VNODE_BOOT_STANDARD | VNODE_BOOT_LEGACY,
 };
 
+struct vnode;
+struct vnode_event;
+
+typedef void (*vnode_event_fn)(struct vnode_event*);
+
+/* Something that happens later, driven by the shared timer wheel */
+struct vnode_event {
+	struct timer_wheel_entry entry;
+	vnode_event_fn fn;
+};
+
+/* Optional misbehaviour for benchmarking the master against slow or flaky
+ * devices. Delays are in ms and the outcome of every roll of the dice only
+ * depends on the seed and the node id, so runs can be repeated.
+ */
+struct vnode_emulation {
+	uint64_t rng;
+	uint32_t sdo_delay;
+	uint32_t sdo_jitter;
+	double sdo_spike_probability;
+	uint32_t sdo_spike_delay;
+	double sdo_abort_probability;
+	double sdo_loss;
+	double heartbeat_loss;
+	uint32_t bootup_delay;
+	uint32_t bootup_jitter;
+};
+
+struct vnode_delayed_frame {
+	struct can_frame cf;
+	uint64_t release;
+};
+
+/* An entry in the object dictionary that is compiled from the config file */
+struct vnode_obj {
+	uint32_t mux;
+	enum canopen_type type;
+	int is_writable;
+	struct vector value;
+};
+
+struct vnode_tpdo {
+	struct vnode_event event;
+	struct vnode* node;
+	int is_enabled;
+	uint32_t cob_id;
+	uint32_t period; /* ms, 0 if not cyclic */
+	uint32_t sync_divisor; /* 0 if not synchronous */
+	uint32_t sync_count;
+	int rpdo_trigger; /* 1-4, 0 if not sent on reception of an RPDO */
+	int have_counter;
+	uint32_t count;
+	uint8_t length;
+	uint8_t data[8];
+};
+
 struct vnode {
 	int is_running;
 	struct ini_file config;
 	int nodeid;
+	struct vnode_obj* dict; /* sorted by mux */
+	size_t dict_length;
 	enum nmt_state state;
 	struct sdo_srv sdo_srv;
 	uint16_t heartbeat_period;
@@ -56,6 +123,16 @@ struct vnode {
 	int have_node_guarding;
 	int have_guard_status_bug;
 	enum vnode__bootup_method bootup_method;
+	struct vnode_tpdo tpdo[VNODE_PDO_COUNT];
+	uint32_t rpdo_count[VNODE_PDO_COUNT];
+	struct vnode_emulation emulation;
+	int is_booting;
+	int has_booted;
+	struct vnode_event boot_event;
+	struct vnode_event rsdo_event;
+	struct vnode_delayed_frame rsdo_queue[VNODE_RSDO_QUEUE_SIZE];
+	unsigned int rsdo_head, rsdo_length;
+	uint64_t rsdo_last_release;
 };
 
 struct sock vnode__sock;
@@ -63,11 +140,49 @@ static struct mloop_socket* vnode__socket = NULL;
 
 struct vnode vnode__node[127] = { 0 };
 
+/* All nodes share one socket. Frames that they send while handling received
+ * frames are held back and sent in one batch afterwards, so that e.g. a
+ * broadcast reset of a hundred nodes does not take a hundred system calls.
+ */
+static struct can_frame vnode__tx[VNODE_BATCH_SIZE];
+static size_t vnode__tx_length = 0;
+static int vnode__is_batching = 0;
+
+/* Cyclic TPDOs and delayed events of all nodes are driven by one wheel with a
+ * tick of 1 ms, so that thousands of them do not need thousands of timers.
+ */
+static struct timer_wheel vnode__wheel;
+static struct mloop_timer* vnode__wheel_timer = NULL;
+
 static inline struct vnode* vnode__get_node(int nodeid)
 {
+	if (!(CANOPEN_NODEID_MIN <= nodeid && nodeid <= CANOPEN_NODEID_MAX))
+		return NULL;
+
 	return &vnode__node[nodeid - 1];
 }
 
+static void vnode__flush(void)
+{
+	if (vnode__tx_length > 0)
+		sock_send_batch(&vnode__sock, vnode__tx, vnode__tx_length, 0);
+
+	vnode__tx_length = 0;
+}
+
+static void vnode__send(struct can_frame* cf)
+{
+	if (!vnode__is_batching) {
+		sock_send(&vnode__sock, cf, 0);
+		return;
+	}
+
+	if (vnode__tx_length == VNODE_BATCH_SIZE)
+		vnode__flush();
+
+	vnode__tx[vnode__tx_length++] = *cf;
+}
+
 static void vnode__init(struct vnode* self)
 {
 	memset(self, 0, sizeof(*self));
@@ -109,23 +224,449 @@ static void vnode__load_device_info(struct vnode* self)
 	self->bootup_method = vnode__get_bootup_method(s);
 }
 
-static int vnode__load_config(struct vnode* self, const char* path)
+static int vnode__hex_digit(int c)
+{
+	if (isdigit(c))
+		return c - '0';
+
+	return isxdigit(c) ? tolower(c) - 'a' + 10 : -1;
+}
+
+/* Accepts pairs of hex digits optionally separated by spaces, e.g. "01 ff" */
+static int vnode__parse_hex(uint8_t* dst, size_t max, const char* str)
+{
+	size_t len = 0;
+
+	while (*str) {
+		if (isspace(*str)) {
+			++str;
+			continue;
+		}
+
+		int high = vnode__hex_digit(str[0]);
+		int low = high >= 0 ? vnode__hex_digit(str[1]) : -1;
+		if (low < 0 || len >= max)
+			return -1;
+
+		dst[len++] = high << 4 | low;
+		str += 2;
+	}
+
+	return len;
+}
+
+static uint32_t vnode__get_uint(const struct ini_section* s, const char* key,
+				uint32_t default_value)
+{
+	const char* value = ini_find_key(s, key);
+	return value ? strtoul(value, NULL, 0) : default_value;
+}
+
+static double vnode__get_double(const struct ini_section* s, const char* key)
+{
+	const char* value = ini_find_key(s, key);
+	return value ? strtod(value, NULL) : 0.0;
+}
+
+static void vnode__load_emulation(struct vnode* self)
+{
+	struct vnode_emulation* emu = &self->emulation;
+
+	const struct ini_section* s;
+	s = ini_find_section(&self->config, "emulation");
+	if (!s)
+		return;
+
+	emu->rng = (uint64_t)vnode__get_uint(s, "seed", 1) << 7 | self->nodeid;
+	emu->sdo_delay = vnode__get_uint(s, "sdo_delay", 0);
+	emu->sdo_jitter = vnode__get_uint(s, "sdo_jitter", 0);
+	emu->sdo_spike_probability = vnode__get_double(s, "sdo_spike_probability");
+	emu->sdo_spike_delay = vnode__get_uint(s, "sdo_spike_delay", 0);
+	emu->sdo_abort_probability = vnode__get_double(s, "sdo_abort_probability");
+	emu->sdo_loss = vnode__get_double(s, "sdo_loss");
+	emu->heartbeat_loss = vnode__get_double(s, "heartbeat_loss");
+	emu->bootup_delay = vnode__get_uint(s, "bootup_delay", 0);
+	emu->bootup_jitter = vnode__get_uint(s, "bootup_jitter", 0);
+}
+
+static int vnode__load_tpdo(struct vnode* self, int n)
 {
-	FILE* stream = fopen(path, "r");
-	if (!stream) {
-		perror("Could not open config");
+	struct vnode_tpdo* tpdo = &self->tpdo[n];
+	char section[16];
+
+	tpdo->node = self;
+
+	snprintf(section, sizeof(section), "tpdo%d", n + 1);
+	const struct ini_section* s = ini_find_section(&self->config, section);
+	if (!s)
+		return 0;
+
+	/* The default COB-ID lets many nodes share one config file */
+	tpdo->cob_id = vnode__get_uint(s, "cob_id",
+				       R_TPDO1 + 0x100 * n + self->nodeid);
+	tpdo->period = vnode__get_uint(s, "period", 0);
+	tpdo->sync_divisor = vnode__get_uint(s, "sync", 0);
+	tpdo->rpdo_trigger = vnode__get_uint(s, "rpdo", 0);
+	tpdo->have_counter = vnode__config_is_true(s, "counter");
+
+	int length = vnode__get_uint(s, "length", 8);
+
+	const char* data = ini_find_key(s, "data");
+	if (data) {
+		length = vnode__parse_hex(tpdo->data, sizeof(tpdo->data), data);
+		if (length < 0) {
+			fprintf(stderr, "Invalid data in [%s]\n", section);
+			return -1;
+		}
+	}
+
+	if (length > 8 || tpdo->cob_id > CAN_SFF_MASK
+	 || tpdo->rpdo_trigger > VNODE_PDO_COUNT) {
+		fprintf(stderr, "Invalid PDO in [%s]\n", section);
 		return -1;
 	}
 
-	int rc = ini_parse(&self->config, stream);
-	if (rc < 0)
-		perror("Could not parse config");
+	tpdo->length = length;
+	tpdo->is_enabled = tpdo->period || tpdo->sync_divisor
+			|| tpdo->rpdo_trigger;
+
+	return 0;
+}
+
+/* Section names of objects have the form "<index>sub<subindex>" in hex */
+static int vnode__parse_section_name(uint32_t* mux, const char* name)
+{
+	char* end = NULL;
+
+	unsigned long index = strtoul(name, &end, 16);
+	if (end == name || index > 0xffff || !string_begins_with("sub", end))
+		return -1;
+
+	name = end + 3;
+	unsigned long subindex = strtoul(name, &end, 16);
+	if (end == name || *end != '\0' || subindex > 0xff)
+		return -1;
+
+	*mux = SDO_MUX(index, subindex);
+	return 0;
+}
+
+static enum canopen_type vnode__get_section_type(const struct ini_section* s)
+{
+	const char* type_str = ini_find_key(s, "type");
+	if (!type_str)
+		return CANOPEN_UNKNOWN;
+
+	return canopen_type_from_string(type_str);
+}
+
+static int vnode__section_is_writable(const struct ini_section* s)
+{
+	const char* access = ini_find_key(s, "access");
+	if (!access)
+		return 0;
 
-	fclose(stream);
+	return strcasecmp(access, "rw") == 0 || strcasecmp(access, "wo") == 0;
+}
+
+/* Objects with an unknown type or a value that cannot be parsed are left out,
+ * in which case the node reports that they do not exist.
+ */
+static int vnode__compile_obj(struct vnode_obj* obj,
+			      const struct ini_section* s)
+{
+	if (vnode__parse_section_name(&obj->mux, s->section) < 0)
+		return 0;
+
+	obj->type = vnode__get_section_type(s);
+	if (obj->type == CANOPEN_UNKNOWN)
+		return 0;
+
+	const char* value = ini_find_key(s, "value");
+	if (!value)
+		return 0;
+
+	struct canopen_data data;
+	if (canopen_data_fromstring(&data, obj->type, value) < 0) {
+		fprintf(stderr, "Invalid value in [%s]\n", s->section);
+		return 0;
+	}
+
+	obj->is_writable = vnode__section_is_writable(s);
+
+	if (vector_init(&obj->value, data.size + 1) < 0)
+		return -1;
+
+	memcpy(obj->value.data, data.data, data.size);
+	obj->value.index = data.size;
+	return 1;
+}
+
+static int vnode__cmp_obj(const void* ptr1, const void* ptr2)
+{
+	const struct vnode_obj* o1 = ptr1;
+	const struct vnode_obj* o2 = ptr2;
+
+	return (o1->mux > o2->mux) - (o1->mux < o2->mux);
+}
+
+static void vnode__destroy_dict(struct vnode* self)
+{
+	for (size_t i = 0; i < self->dict_length; ++i)
+		vector_destroy(&self->dict[i].value);
+
+	free(self->dict);
+	self->dict = NULL;
+	self->dict_length = 0;
+}
+
+/* SDO uploads and downloads are served from a sorted array of pre-encoded
+ * values rather than by looking the objects up in the config each time.
+ */
+static int vnode__compile_dict(struct vnode* self)
+{
+	size_t n_sections = ini_get_length(&self->config);
+	if (n_sections == 0)
+		return 0;
+
+	self->dict = malloc(n_sections * sizeof(*self->dict));
+	if (!self->dict)
+		return -1;
+
+	for (size_t i = 0; i < n_sections; ++i) {
+		const struct ini_section* s = ini_get_section(&self->config, i);
+		struct vnode_obj* obj = &self->dict[self->dict_length];
+
+		int rc = vnode__compile_obj(obj, s);
+		if (rc < 0)
+			goto failure;
+
+		self->dict_length += rc;
+	}
+
+	qsort(self->dict, self->dict_length, sizeof(*self->dict),
+	      vnode__cmp_obj);
+
+	return 0;
+
+failure:
+	vnode__destroy_dict(self);
+	return -1;
+}
+
+static struct vnode_obj* vnode__find_obj(struct vnode* self, uint32_t mux)
+{
+	struct vnode_obj key = { .mux = mux };
+
+	return bsearch(&key, self->dict, self->dict_length,
+		       sizeof(*self->dict), vnode__cmp_obj);
+}
+
+static int vnode__load_config(struct vnode* self, const char* path)
+{
+	int rc = ini_parse_file(&self->config, path);
+	if (rc < 0) {
+		perror("Could not load config");
+		return rc;
+	}
 
 	vnode__load_device_info(self);
+	vnode__load_emulation(self);
+
+	for (int i = 0; i < VNODE_PDO_COUNT; ++i)
+		if (vnode__load_tpdo(self, i) < 0)
+			goto failure;
+
+	if (vnode__compile_dict(self) < 0)
+		goto failure;
+
+	/* Everything that is needed later has been taken out of it */
+	ini_destroy(&self->config);
+	return 0;
+
+failure:
+	ini_destroy(&self->config);
+	return -1;
+}
+
+static void vnode__send_tpdo(struct vnode_tpdo* tpdo)
+{
+	struct can_frame cf = {
+		.can_id = tpdo->cob_id,
+		.can_dlc = tpdo->length
+	};
+
+	memcpy(cf.data, tpdo->data, tpdo->length);
+
+	/* Little endian, like any other CANopen number */
+	if (tpdo->have_counter)
+		for (int i = 0; i < 4 && i < tpdo->length; ++i)
+			cf.data[i] = tpdo->count >> (8 * i);
+
+	++tpdo->count;
+
+	vnode__send(&cf);
+}
+
+static inline uint64_t vnode__get_tick(void)
+{
+	return gettime_ms(CLOCK_MONOTONIC);
+}
+
+static void vnode__on_wheel_entry(struct timer_wheel_entry* entry,
+				  void* context)
+{
+	(void)context;
+
+	struct vnode_event* event = container_of(entry, struct vnode_event,
+						 entry);
+	event->fn(event);
+}
+
+static void vnode__on_wheel_tick(struct mloop_timer* timer)
+{
+	vnode__is_batching = 1;
+	timer_wheel_advance(&vnode__wheel, vnode__get_tick(),
+			    vnode__on_wheel_entry, NULL);
+	vnode__flush();
+	vnode__is_batching = 0;
+
+	if (timer_wheel_is_empty(&vnode__wheel))
+		mloop_timer_stop(timer);
+}
+
+/* The wheel is not advanced while it is empty, so it is moved to the current
+ * time before anything is added to it.
+ */
+static uint64_t vnode__get_wheel_time(void)
+{
+	if (timer_wheel_is_empty(&vnode__wheel))
+		timer_wheel_init(&vnode__wheel, vnode__get_tick());
+
+	return vnode__wheel.now;
+}
+
+static void vnode__schedule_at(struct vnode_event* event, uint64_t deadline)
+{
+	timer_wheel_add(&vnode__wheel, &event->entry, deadline);
+
+	if (!mloop_timer_is_started(vnode__wheel_timer))
+		mloop_timer_start(vnode__wheel_timer);
+}
+
+static void vnode__schedule(struct vnode_event* event, uint64_t delay)
+{
+	vnode__schedule_at(event, vnode__get_wheel_time() + delay);
+}
+
+static void vnode__on_tpdo_timeout(struct vnode_event* event)
+{
+	struct vnode_tpdo* tpdo = container_of(event, struct vnode_tpdo, event);
+	struct timer_wheel_entry* entry = &event->entry;
 
-	return rc;
+	vnode__send_tpdo(tpdo);
+	timer_wheel_add(&vnode__wheel, entry, entry->deadline + tpdo->period);
+}
+
+static void vnode__start_tpdos(struct vnode* self)
+{
+	for (int i = 0; i < VNODE_PDO_COUNT; ++i) {
+		struct vnode_tpdo* tpdo = &self->tpdo[i];
+		tpdo->sync_count = 0;
+
+		if (tpdo->is_enabled && tpdo->period)
+			vnode__schedule(&tpdo->event, tpdo->period);
+	}
+}
+
+static void vnode__stop_tpdos(struct vnode* self)
+{
+	for (int i = 0; i < VNODE_PDO_COUNT; ++i)
+		timer_wheel_remove(&vnode__wheel, &self->tpdo[i].event.entry);
+}
+
+/* splitmix64 */
+static uint64_t vnode__random(struct vnode* self)
+{
+	uint64_t z = (self->emulation.rng += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static int vnode__chance(struct vnode* self, double probability)
+{
+	if (probability <= 0.0)
+		return 0;
+
+	return (vnode__random(self) >> 11) * 0x1.0p-53 < probability;
+}
+
+static uint32_t vnode__get_delay(struct vnode* self, uint32_t delay,
+				 uint32_t jitter)
+{
+	return jitter ? delay + vnode__random(self) % (jitter + 1) : delay;
+}
+
+static uint32_t vnode__get_sdo_delay(struct vnode* self)
+{
+	const struct vnode_emulation* emu = &self->emulation;
+
+	if (vnode__chance(self, emu->sdo_spike_probability))
+		return emu->sdo_spike_delay;
+
+	return vnode__get_delay(self, emu->sdo_delay, emu->sdo_jitter);
+}
+
+static int vnode__has_sdo_delay(const struct vnode* self)
+{
+	const struct vnode_emulation* emu = &self->emulation;
+
+	return emu->sdo_delay || emu->sdo_jitter
+	    || (emu->sdo_spike_probability > 0.0 && emu->sdo_spike_delay);
+}
+
+static void vnode__sync(void)
+{
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		struct vnode* self = vnode__get_node(i);
+		if (!self->is_running || self->state != NMT_STATE_OPERATIONAL)
+			continue;
+
+		for (int j = 0; j < VNODE_PDO_COUNT; ++j) {
+			struct vnode_tpdo* tpdo = &self->tpdo[j];
+			if (!tpdo->is_enabled || !tpdo->sync_divisor)
+				continue;
+
+			if (++tpdo->sync_count < tpdo->sync_divisor)
+				continue;
+
+			tpdo->sync_count = 0;
+			vnode__send_tpdo(tpdo);
+		}
+	}
+}
+
+/* A TPDO that is triggered by an RPDO echoes its payload, so that round trips
+ * can be timed from the outside.
+ */
+static void vnode__rpdo(struct vnode* self, int n, const struct can_frame* cf)
+{
+	++self->rpdo_count[n];
+
+	if (self->state != NMT_STATE_OPERATIONAL)
+		return;
+
+	for (int i = 0; i < VNODE_PDO_COUNT; ++i) {
+		struct vnode_tpdo* tpdo = &self->tpdo[i];
+		if (!tpdo->is_enabled || tpdo->rpdo_trigger != n + 1)
+			continue;
+
+		struct can_frame echo = *cf;
+		echo.can_id = tpdo->cob_id;
+		++tpdo->count;
+		vnode__send(&echo);
+	}
 }
 
 static void vnode__send_state(struct vnode* self)
@@ -138,7 +679,7 @@ static void vnode__send_state(struct vnode* self)
 	if (!self->have_guard_status_bug)
 		heartbeat_set_state(&cf, self->state);
 
-	sock_send(&vnode__sock, &cf, 0);
+	vnode__send(&cf);
 }
 
 static void vnode__send_legacy_bootup(struct vnode* self)
@@ -148,7 +689,7 @@ static void vnode__send_legacy_bootup(struct vnode* self)
 		.can_dlc = 0
 	};
 
-	sock_send(&vnode__sock, &cf, 0);
+	vnode__send(&cf);
 }
 
 static void vnode__reset_communication(struct vnode* self)
@@ -161,17 +702,57 @@ static void vnode__reset_communication(struct vnode* self)
 	self->state = NMT_STATE_PREOPERATIONAL;
 }
 
+static void vnode__finish_boot(struct vnode* self)
+{
+	self->is_booting = 0;
+
+	if (!self->has_booted && (self->bootup_method & VNODE_BOOT_LEGACY))
+		vnode__send_legacy_bootup(self);
+
+	self->has_booted = 1;
+	vnode__reset_communication(self);
+}
+
+static void vnode__on_boot_timeout(struct vnode_event* event)
+{
+	vnode__finish_boot(container_of(event, struct vnode, boot_event));
+}
+
+/* A node that is still booting ignores everything but NMT resets, which start
+ * the delay over.
+ */
+static void vnode__boot(struct vnode* self)
+{
+	const struct vnode_emulation* emu = &self->emulation;
+
+	uint32_t delay = vnode__get_delay(self, emu->bootup_delay,
+					  emu->bootup_jitter);
+	if (delay == 0) {
+		vnode__finish_boot(self);
+		return;
+	}
+
+	self->is_booting = 1;
+	self->state = NMT_STATE_BOOTUP;
+	vnode__schedule(&self->boot_event, delay);
+}
+
 static void vnode__on_heartbeat(struct mloop_timer* timer)
 {
 	struct vnode* self = mloop_timer_get_context(timer);
-	vnode__send_state(self);
+
+	if (!vnode__chance(self, self->emulation.heartbeat_loss))
+		vnode__send_state(self);
 }
 
 static void vnode__heartbeat(struct vnode* self, const struct can_frame* cf)
 {
 	(void)cf;
 
-	if (self->have_node_guarding)
+	if (!self->have_node_guarding)
+		return;
+
+	if (!vnode__chance(self, self->emulation.heartbeat_loss))
 		vnode__send_state(self);
 }
 
@@ -205,24 +786,34 @@ static void vnode__nmt(struct vnode* self, const struct can_frame* cf)
 		return;
 
 	enum nmt_cs cs = nmt_get_cs(cf);
+
+	if (self->is_booting && cs != NMT_CS_RESET_NODE
+	 && cs != NMT_CS_RESET_COMMUNICATION)
+		return;
+
 	switch (cs) {
 	case NMT_CS_START:
+		if (self->state != NMT_STATE_OPERATIONAL)
+			vnode__start_tpdos(self);
 		self->state = NMT_STATE_OPERATIONAL;
 		vnode__start_heartbeat_timer(self);
 		break;
 	case NMT_CS_STOP:
 		self->state = NMT_STATE_STOPPED;
+		vnode__stop_tpdos(self);
 		if (self->have_heartbeat)
 			mloop_timer_stop(self->heartbeat_timer);
 		break;
 	case NMT_CS_ENTER_PREOPERATIONAL:
 		self->state = NMT_STATE_PREOPERATIONAL;
+		vnode__stop_tpdos(self);
 		break;
 	case NMT_CS_RESET_NODE:
 	case NMT_CS_RESET_COMMUNICATION:
+		vnode__stop_tpdos(self);
 		if (self->have_heartbeat)
 			mloop_timer_stop(self->heartbeat_timer);
-		vnode__reset_communication(self);
+		vnode__boot(self);
 		break;
 	}
 }
@@ -238,55 +829,64 @@ static int vnode__sdo_get_heartbeat(struct vnode* self, struct sdo_srv* srv)
 	return 0;
 }
 
-static const char* vnode__make_section_string(int index, int subindex)
+/* Sub-indices 1-4 count received RPDOs and 5-8 count sent TPDOs */
+static int vnode__sdo_get_pdo_counter(struct vnode* self, struct sdo_srv* srv)
 {
-	static char buffer[256];
-	snprintf(buffer, sizeof(buffer), "%xsub%x", index, subindex);
-	return buffer;
-}
-
-static enum canopen_type vnode__get_section_type(const struct ini_section* s)
-{
-	const char* type_str = ini_find_key(s, "type");
-	if (!type_str)
-		return CANOPEN_UNKNOWN;
+	uint32_t value;
+	int subindex = srv->subindex;
+
+	if (subindex == 0)
+		value = 2 * VNODE_PDO_COUNT;
+	else if (subindex <= VNODE_PDO_COUNT)
+		value = self->rpdo_count[subindex - 1];
+	else if (subindex <= 2 * VNODE_PDO_COUNT)
+		value = self->tpdo[subindex - VNODE_PDO_COUNT - 1].count;
+	else
+		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
 
-	return canopen_type_from_string(type_str);
+	uint32_t netorder = 0;
+	byteorder(&netorder, &value, sizeof(netorder));
+	vector_assign(&srv->buffer, &netorder, sizeof(netorder));
+	return 0;
 }
 
 static int vnode__sdo_get_config(struct vnode* self, struct sdo_srv* srv)
 {
-	const char* section;
-	section = vnode__make_section_string(srv->index, srv->subindex);
-
-	const struct ini_section* s = ini_find_section(&self->config, section);
-	if (!s)
-		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
-
-	enum canopen_type type = vnode__get_section_type(s);
-	if (type == CANOPEN_UNKNOWN)
+	const struct vnode_obj* obj;
+	obj = vnode__find_obj(self, SDO_MUX(srv->index, srv->subindex));
+	if (!obj)
 		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
 
-	const char* value = ini_find_key(s, "value");
-	if (!value)
-		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
-
-	struct canopen_data data;
-	if (canopen_data_fromstring(&data, type, value) < 0)
-		return sdo_srv_abort(srv, SDO_ABORT_NOMEM);
-
-	if (vector_assign(&srv->buffer, data.data, data.size) < 0)
+	if (vector_assign(&srv->buffer, obj->value.data, obj->value.index) < 0)
 		return sdo_srv_abort(srv, SDO_ABORT_NOMEM);
 
 	return 0;
 }
 
+static int vnode__sdo_check_config(struct vnode* self, struct sdo_srv* srv)
+{
+	const struct vnode_obj* obj;
+	obj = vnode__find_obj(self, SDO_MUX(srv->index, srv->subindex));
+	if (!obj)
+		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
+
+	return obj->is_writable ? 0 : sdo_srv_abort(srv, SDO_ABORT_RO);
+}
+
 static int vnode__on_sdo_init(struct sdo_srv* srv)
 {
 	struct vnode* self = container_of(srv, struct vnode, sdo_srv);
 	uint32_t index = srv->index;
 	uint32_t subindex = srv->subindex;
 
+	if (vnode__chance(self, self->emulation.sdo_abort_probability))
+		return sdo_srv_abort(srv, SDO_ABORT_GENERAL);
+
+	if (index == VNODE_PDO_COUNTERS)
+		return srv->req_type == SDO_REQ_UPLOAD
+		     ? vnode__sdo_get_pdo_counter(self, srv)
+		     : sdo_srv_abort(srv, SDO_ABORT_RO);
+
 	switch (SDO_MUX(index, subindex)) {
 	case HEARTBEAT_PERIOD:
 		return srv->req_type == SDO_REQ_UPLOAD
@@ -294,7 +894,7 @@ static int vnode__on_sdo_init(struct sdo_srv* srv)
 	default:
 		return srv->req_type == SDO_REQ_UPLOAD
 		     ? vnode__sdo_get_config(self, srv)
-		     : sdo_srv_abort(srv, SDO_ABORT_RO);
+		     : vnode__sdo_check_config(self, srv);
 	}
 
 	abort();
@@ -334,9 +934,24 @@ static int vnode__sdo_set_heartbeat(struct vnode* self, struct sdo_srv* srv)
 	return 0;
 }
 
-static int vnode__sdo_set_config(struct sdo_srv* srv)
+static int vnode__sdo_set_config(struct vnode* self, struct sdo_srv* srv)
 {
-	return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
+	struct vnode_obj* obj;
+	obj = vnode__find_obj(self, SDO_MUX(srv->index, srv->subindex));
+	if (!obj || !obj->is_writable)
+		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
+
+	size_t size = canopen_type_size(obj->type);
+	if (size > 0 && srv->buffer.index > size)
+		return sdo_srv_abort(srv, SDO_ABORT_TOO_LONG);
+
+	if (size > 0 && srv->buffer.index < size)
+		return sdo_srv_abort(srv, SDO_ABORT_TOO_SHORT);
+
+	if (vector_assign(&obj->value, srv->buffer.data, srv->buffer.index) < 0)
+		return sdo_srv_abort(srv, SDO_ABORT_NOMEM);
+
+	return 0;
 }
 
 static int vnode__on_sdo_done(struct sdo_srv* srv)
@@ -353,7 +968,7 @@ static int vnode__on_sdo_done(struct sdo_srv* srv)
 	case HEARTBEAT_PERIOD:
 		return vnode__sdo_set_heartbeat(self, srv);
 	default:
-		return vnode__sdo_set_config(srv);
+		return vnode__sdo_set_config(self, srv);
 	}
 
 	abort();
@@ -362,9 +977,68 @@ static int vnode__on_sdo_done(struct sdo_srv* srv)
 	return 0;
 }
 
+static void vnode__on_rsdo_timeout(struct vnode_event* event)
+{
+	struct vnode* self = container_of(event, struct vnode, rsdo_event);
+
+	while (self->rsdo_length > 0) {
+		struct vnode_delayed_frame* frame;
+		frame = &self->rsdo_queue[self->rsdo_head];
+
+		if (frame->release > vnode__wheel.now) {
+			vnode__schedule_at(event, frame->release);
+			return;
+		}
+
+		struct can_frame cf = frame->cf;
+		self->rsdo_head = (self->rsdo_head + 1) % VNODE_RSDO_QUEUE_SIZE;
+		--self->rsdo_length;
+
+		sdo_srv_feed(&self->sdo_srv, &cf);
+	}
+}
+
+/* Delayed requests are handled in the order in which they arrived. When the
+ * queue is full, requests are lost like on a device that cannot keep up.
+ */
+static void vnode__delay_rsdo(struct vnode* self, const struct can_frame* cf)
+{
+	if (self->rsdo_length == VNODE_RSDO_QUEUE_SIZE)
+		return;
+
+	uint64_t release = vnode__get_wheel_time() + vnode__get_sdo_delay(self);
+	if (release < self->rsdo_last_release)
+		release = self->rsdo_last_release;
+
+	self->rsdo_last_release = release;
+
+	unsigned int tail = (self->rsdo_head + self->rsdo_length)
+			  % VNODE_RSDO_QUEUE_SIZE;
+	self->rsdo_queue[tail].cf = *cf;
+	self->rsdo_queue[tail].release = release;
+
+	if (self->rsdo_length++ == 0)
+		vnode__schedule_at(&self->rsdo_event, release);
+}
+
 static void vnode__rsdo(struct vnode* self, const struct can_frame* cf)
 {
-	sdo_srv_feed(&self->sdo_srv, cf);
+	if (vnode__chance(self, self->emulation.sdo_loss))
+		return;
+
+	if (vnode__has_sdo_delay(self))
+		vnode__delay_rsdo(self, cf);
+	else
+		sdo_srv_feed(&self->sdo_srv, cf);
+}
+
+static void vnode__broadcast_nmt(const struct can_frame* cf)
+{
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		struct vnode* self = vnode__get_node(i);
+		if (self->is_running)
+			vnode__nmt(self, cf);
+	}
 }
 
 static void vnode__on_frame(const struct can_frame* cf)
@@ -375,30 +1049,28 @@ static void vnode__on_frame(const struct can_frame* cf)
 	if (canopen_get_object_type(&msg, cf) < 0)
 		return;
 
-	if (msg.object != CANOPEN_NMT) {
-		if (!(CANOPEN_NODEID_MIN <= msg.id
-		      && msg.id <= CANOPEN_NODEID_MAX))
-			return;
+	if (msg.object == CANOPEN_SYNC) {
+		vnode__sync();
+		return;
+	}
 
-		self = vnode__get_node(msg.id);
-		if (!self)
+	if (msg.object == CANOPEN_NMT) {
+		if (nmt_get_nodeid(cf) == 0) {
+			vnode__broadcast_nmt(cf);
 			return;
+		}
 
-		if (msg.id != self->nodeid)
-			return;
+		self = vnode__get_node(nmt_get_nodeid(cf));
 	} else {
-		if (nmt_get_nodeid(cf) == 0) {
-			for (int i = 1; i < 128; ++i) {
-				self = vnode__get_node(i);
-				if (self->is_running)
-					vnode__nmt(self, cf);
-				return;
-			}
-		} else {
-			self = vnode__get_node(nmt_get_nodeid(cf));
-		}
+		self = vnode__get_node(msg.id);
 	}
 
+	if (!self || !self->is_running)
+		return;
+
+	if (self->is_booting && msg.object != CANOPEN_NMT)
+		return;
+
 	switch (msg.object) {
 	case CANOPEN_HEARTBEAT:
 		vnode__heartbeat(self, cf);
@@ -409,6 +1081,10 @@ static void vnode__on_frame(const struct can_frame* cf)
 	case CANOPEN_RSDO:
 		vnode__rsdo(self, cf);
 		break;
+	case CANOPEN_RPDO1: vnode__rpdo(self, 0, cf); break;
+	case CANOPEN_RPDO2: vnode__rpdo(self, 1, cf); break;
+	case CANOPEN_RPDO3: vnode__rpdo(self, 2, cf); break;
+	case CANOPEN_RPDO4: vnode__rpdo(self, 3, cf); break;
 	default:
 		break;
 	}
@@ -416,25 +1092,51 @@ static void vnode__on_frame(const struct can_frame* cf)
 
 static void vnode__mux(struct mloop_socket* socket)
 {
-	struct can_frame cf;
+	struct can_frame cf[VNODE_BATCH_SIZE];
 
 	while (1) {
-		ssize_t rsize = sock_recv(&vnode__sock, &cf, MSG_DONTWAIT);
-		if (rsize == 0)
+		ssize_t n = sock_recv_batch(&vnode__sock, cf, NULL,
+					    VNODE_BATCH_SIZE, MSG_DONTWAIT);
+		if (n == 0)
 			mloop_socket_stop(socket);
 
-		if (rsize <= 0)
+		if (n <= 0)
 			return;
 
-		vnode__on_frame(&cf);
+		vnode__is_batching = 1;
+
+		for (ssize_t i = 0; i < n; ++i)
+			vnode__on_frame(&cf[i]);
+
+		vnode__flush();
+		vnode__is_batching = 0;
 	}
 }
 
+static int vnode__setup_wheel_timer(void)
+{
+	struct mloop_timer* timer = mloop_timer_new(mloop_default());
+	if (!timer)
+		return -1;
+
+	mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC | MLOOP_TIMER_RELATIVE);
+	mloop_timer_set_time(timer, VNODE_TICK_PERIOD);
+	mloop_timer_set_callback(timer, vnode__on_wheel_tick);
+
+	timer_wheel_init(&vnode__wheel, vnode__get_tick());
+	vnode__wheel_timer = timer;
+
+	return 0;
+}
+
 static int vnode__setup_mloop(struct vnode* self)
 {
+	if (vnode__setup_wheel_timer() < 0)
+		return -1;
+
 	struct mloop_socket* socket = mloop_socket_new(mloop_default());
 	if (!socket)
-		return -1;
+		goto socket_failure;
 
 	mloop_socket_set_fd(socket, vnode__sock.fd);
 	mloop_socket_set_context(socket, &vnode__sock,
@@ -443,11 +1145,16 @@ static int vnode__setup_mloop(struct vnode* self)
 
 	if (mloop_socket_start(socket) < 0) {
 		mloop_socket_unref(socket);
-		return -1;
+		goto socket_failure;
 	}
 
 	vnode__socket = socket;
 	return 0;
+
+socket_failure:
+	mloop_timer_unref(vnode__wheel_timer);
+	vnode__wheel_timer = NULL;
+	return -1;
 }
 
 static void vnode__cleanup_mloop(void)
@@ -455,6 +1162,10 @@ static void vnode__cleanup_mloop(void)
 	if (mloop_socket_unref(vnode__socket) == 1) {
 		mloop_socket_stop(vnode__socket);
 		vnode__socket = NULL;
+
+		mloop_timer_stop(vnode__wheel_timer);
+		mloop_timer_unref(vnode__wheel_timer);
+		vnode__wheel_timer = NULL;
 	}
 }
 
@@ -481,24 +1192,42 @@ failure:
 	return -1;
 }
 
+static void vnode__init_events(struct vnode* self)
+{
+	self->boot_event.fn = vnode__on_boot_timeout;
+	self->rsdo_event.fn = vnode__on_rsdo_timeout;
+
+	for (int i = 0; i < VNODE_PDO_COUNT; ++i)
+		self->tpdo[i].event.fn = vnode__on_tpdo_timeout;
+}
+
 __attribute__((visibility("default")))
 struct vnode* co_vnode_new(enum sock_type type, const char* iface,
 			   const char* config_path, int nodeid)
 {
 	struct vnode* self = vnode__get_node(nodeid);
-	if (!self)
+	if (!self) {
+		errno = EINVAL;
 		return NULL;
+	}
+
+	if (self->is_running) {
+		errno = EEXIST;
+		return NULL;
+	}
 
 	vnode__init(self);
+	vnode__init_events(self);
 
 	if (vnode__init_socket(self, type, iface) < 0)
 		return NULL;
 
+	self->nodeid = nodeid;
+
 	if (config_path)
 		if (vnode__load_config(self, config_path) < 0)
 			goto config_failure;
 
-	self->nodeid = nodeid;
 	self->state = NMT_STATE_BOOTUP;
 
 	if (sdo_srv_init(&self->sdo_srv, &vnode__sock, nodeid,
@@ -509,18 +1238,14 @@ struct vnode* co_vnode_new(enum sock_type type, const char* iface,
 		if (vnode__setup_heartbeat_timer(self) < 0)
 			goto srv_failure;
 
-	if (self->bootup_method & VNODE_BOOT_LEGACY)
-		vnode__send_legacy_bootup(self);
-
-	vnode__reset_communication(self);
+	vnode__boot(self);
 
 	self->is_running = 1;
 	return self;
 
 	sdo_srv_destroy(&self->sdo_srv);
 srv_failure:
-	if (config_path)
-		ini_destroy(&self->config);
+	vnode__destroy_dict(self);
 config_failure:
 	vnode__cleanup_mloop();
 	return NULL;
@@ -529,11 +1254,15 @@ config_failure:
 __attribute__((visibility("default")))
 void co_vnode_destroy(struct vnode* self)
 {
+	vnode__stop_tpdos(self);
+	timer_wheel_remove(&vnode__wheel, &self->boot_event.entry);
+	timer_wheel_remove(&vnode__wheel, &self->rsdo_event.entry);
+
 	if (self->have_heartbeat)
 		mloop_timer_unref(self->heartbeat_timer);
 
 	sdo_srv_destroy(&self->sdo_srv);
-	ini_destroy(&self->config);
+	vnode__destroy_dict(self);
 	vnode__cleanup_mloop();
 	self->is_running = 0;
 }
@@ -0,0 +1,564 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <sys/queue.h>
+#include <mloop.h>
+
+#include "canopen.h"
+#include "canopen/master.h"
+#include "rest.h"
+#include "ws.h"
+#include "ws-rest.h"
+
+#define WS_REST_PDO_COUNT 4
+#define WS_REST_DATA_SIZE 64
+#define WS_REST_DEFAULT_INTERVAL 20
+#define WS_REST_MIN_INTERVAL 5
+#define WS_REST_MAX_INTERVAL 1000
+#define WS_REST_MAX_OUTPUT (256 * 1024)
+#define WS_REST_MAX_MESSAGE 512
+
+/* The latest value of a PDO that has not been sent yet. Values that arrive
+ * before it is sent replace it and are counted as coalesced.
+ */
+struct ws_rest_pdo {
+	int is_pending;
+	uint32_t n_coalesced;
+	size_t len;
+	uint64_t timestamp;
+	uint8_t data[WS_REST_DATA_SIZE];
+};
+
+struct ws_rest_session {
+	LIST_ENTRY(ws_rest_session) links;
+	struct rest_client* client;
+	struct mloop_timer* timer;
+	uint8_t pdo_mask[CANOPEN_NODEID_MAX + 1]; /* bit n - 1 for PDO n */
+	int have_pdo;
+	struct vector output;
+	struct ws_rest_pdo pdo[CANOPEN_NODEID_MAX + 1][WS_REST_PDO_COUNT];
+};
+
+static LIST_HEAD(, ws_rest_session) ws_rest__sessions =
+	LIST_HEAD_INITIALIZER(ws_rest__sessions);
+
+static void ws_rest__reply(struct rest_client* client,
+			   const char* status_code, const char* message)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = "text/plain",
+		.content_length = strlen(message),
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static inline int ws_rest__is_open(const struct ws_rest_session* session)
+{
+	return session->client->state == REST_CLIENT_UPGRADED
+	    && !session->client->is_closing;
+}
+
+static void ws_rest__send(struct ws_rest_session* session,
+			  enum ws_opcode opcode, const void* data, size_t size)
+{
+	uint8_t header[WS_HEADER_MAX];
+	size_t header_length = ws_encode_header(header, opcode, size);
+
+	if (vector_append(&session->output, header, header_length) < 0
+	 || vector_append(&session->output, data, size) < 0)
+		rest_close(session->client);
+}
+
+static void ws_rest__send_text(struct ws_rest_session* session,
+			       const char* fmt, ...)
+{
+	char text[WS_REST_MAX_MESSAGE];
+
+	va_list ap;
+	va_start(ap, fmt);
+	int len = vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+
+	if ((size_t)len >= sizeof(text))
+		len = sizeof(text) - 1;
+
+	ws_rest__send(session, WS_TEXT, text, len);
+}
+
+static int ws_rest__is_congested(const struct ws_rest_session* session)
+{
+	return session->client->output_length + session->output.index
+	       > WS_REST_MAX_OUTPUT;
+}
+
+static void ws_rest__send_pdo(struct ws_rest_session* session, int nodeid,
+			      int n, struct ws_rest_pdo* pdo)
+{
+	char hex[2 * WS_REST_DATA_SIZE + 1];
+
+	for (size_t i = 0; i < pdo->len; ++i)
+		sprintf(&hex[2 * i], "%02x", pdo->data[i]);
+	hex[2 * pdo->len] = '\0';
+
+	ws_rest__send_text(session, "{ \"node\": %d, \"tpdo\": %d, "
+			   "\"data\": \"%s\", \"timestamp\": %" PRIu64
+			   ", \"coalesced\": %" PRIu32 " }", nodeid, n + 1, hex,
+			   pdo->timestamp, pdo->n_coalesced);
+
+	pdo->is_pending = 0;
+	pdo->n_coalesced = 0;
+}
+
+/* Values stay pending while the output is over the limit, so a slow client
+ * gets fewer and fresher values instead of stalling the main loop.
+ */
+static void ws_rest__send_pending_pdos(struct ws_rest_session* session)
+{
+	for (int nodeid = 0; nodeid <= CANOPEN_NODEID_MAX; ++nodeid)
+		for (int n = 0; n < WS_REST_PDO_COUNT; ++n) {
+			struct ws_rest_pdo* pdo = &session->pdo[nodeid][n];
+			if (!pdo->is_pending)
+				continue;
+
+			if (ws_rest__is_congested(session))
+				return;
+
+			ws_rest__send_pdo(session, nodeid, n, pdo);
+		}
+
+	session->have_pdo = 0;
+}
+
+static void ws_rest__flush(struct ws_rest_session* session)
+{
+	if (session->output.index == 0)
+		return;
+
+	if (session->client->state == REST_CLIENT_UPGRADED)
+		rest_write(session->client, session->output.data,
+			   session->output.index);
+
+	session->output.index = 0;
+}
+
+/* The close frame goes out before the connection is closed */
+static void ws_rest__close(struct ws_rest_session* session,
+			   const void* payload, size_t size)
+{
+	ws_rest__send(session, WS_CLOSE, payload, size);
+	ws_rest__flush(session);
+	rest_close(session->client);
+}
+
+static void ws_rest__close_with(struct ws_rest_session* session,
+				enum ws_close_code code)
+{
+	uint8_t payload[2] = { code >> 8, code & 0xff };
+
+	ws_rest__close(session, payload, sizeof(payload));
+}
+
+static void ws_rest__session_free(struct ws_rest_session* session)
+{
+	if (session->timer) {
+		mloop_timer_stop(session->timer);
+		mloop_timer_unref(session->timer);
+	}
+
+	LIST_REMOVE(session, links);
+	vector_destroy(&session->output);
+	rest_client_unref(session->client);
+	free(session);
+}
+
+static void ws_rest__on_tick(struct mloop_timer* timer)
+{
+	struct ws_rest_session* session = mloop_timer_get_context(timer);
+
+	if (session->client->state == REST_CLIENT_DISCONNECTED) {
+		ws_rest__session_free(session);
+		return;
+	}
+
+	if (session->have_pdo && ws_rest__is_open(session))
+		ws_rest__send_pending_pdos(session);
+
+	ws_rest__flush(session);
+}
+
+static int ws_rest__parse_int(const char* str, long min, long max)
+{
+	if (!str)
+		return -1;
+
+	char* end = NULL;
+	long value = strtol(str, &end, 10);
+	if (!*str || *end != '\0' || value < min || value > max)
+		return -1;
+
+	return value;
+}
+
+static int ws_rest__parse_hex(uint8_t* dst, const char* str)
+{
+	size_t len = str ? strlen(str) : 0;
+	if (len % 2 != 0 || len / 2 > WS_REST_DATA_SIZE)
+		return -1;
+
+	for (size_t i = 0; i < len; ++i)
+		if (!isxdigit((unsigned char)str[i]))
+			return -1;
+
+	for (size_t i = 0; i < len / 2; ++i) {
+		char byte[3] = { str[2 * i], str[2 * i + 1], '\0' };
+		dst[i] = strtoul(byte, NULL, 16);
+	}
+
+	return len / 2;
+}
+
+static int ws_rest__subscribe(struct ws_rest_session* session, char** args,
+			      int is_sub)
+{
+	int nodeid = ws_rest__parse_int(args[0], CANOPEN_NODEID_MIN,
+					CANOPEN_NODEID_MAX);
+	if (nodeid < 0)
+		return -1;
+
+	unsigned int mask = (1 << WS_REST_PDO_COUNT) - 1;
+
+	if (args[1]) {
+		int n = ws_rest__parse_int(args[1], 1, WS_REST_PDO_COUNT);
+		if (n < 0)
+			return -1;
+
+		mask = 1 << (n - 1);
+	}
+
+	if (is_sub) {
+		session->pdo_mask[nodeid] |= mask;
+		return 0;
+	}
+
+	session->pdo_mask[nodeid] &= ~mask;
+
+	for (int n = 0; n < WS_REST_PDO_COUNT; ++n)
+		if (mask & (1 << n))
+			memset(&session->pdo[nodeid][n], 0,
+			       sizeof(session->pdo[nodeid][n]));
+
+	return 0;
+}
+
+static int ws_rest__write_rpdo(char** args)
+{
+	uint8_t data[WS_REST_DATA_SIZE];
+
+	int nodeid = ws_rest__parse_int(args[0], CANOPEN_NODEID_MIN,
+					CANOPEN_NODEID_MAX);
+	int n = ws_rest__parse_int(args[1], 1, WS_REST_PDO_COUNT);
+	int size = ws_rest__parse_hex(data, args[2]);
+
+	if (nodeid < 0 || n < 0 || size < 0)
+		return -1;
+
+	return co__rpdox(nodeid, R_RPDO1 + (n - 1) * 0x100, data, size);
+}
+
+static void ws_rest__on_command(struct ws_rest_session* session, char* line)
+{
+	char* args[4] = { 0 };
+	char* save = NULL;
+	int n_args = 0;
+
+	char* command = strtok_r(line, " \t\r", &save);
+	if (!command)
+		return;
+
+	char* arg;
+	while ((arg = strtok_r(NULL, " \t\r", &save)))
+		if (n_args < 3)
+			args[n_args++] = arg;
+		else
+			goto invalid;
+
+	int rc;
+
+	if (strcmp(command, "sub") == 0 && n_args <= 2)
+		rc = ws_rest__subscribe(session, args, 1);
+	else if (strcmp(command, "unsub") == 0 && n_args <= 2)
+		rc = ws_rest__subscribe(session, args, 0);
+	else if (strcmp(command, "rpdo") == 0 && n_args == 3)
+		rc = ws_rest__write_rpdo(args);
+	else
+		goto invalid;
+
+	if (rc < 0)
+		ws_rest__send_text(session, "{ \"error\": \"%s failed\" }",
+				   command);
+	return;
+
+invalid:
+	ws_rest__send_text(session, "{ \"error\": \"Invalid command\" }");
+}
+
+/* The message is copied into the arena of the client, which is reset after
+ * each message.
+ */
+static void ws_rest__on_text(struct ws_rest_session* session,
+			     const char* payload, size_t size)
+{
+	struct rest_client* client = session->client;
+
+	char* text = arena_strndup(&client->arena, payload, size);
+	if (!text) {
+		rest_close(client);
+		return;
+	}
+
+	char* save = NULL;
+	char* line;
+
+	for (line = strtok_r(text, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save))
+		ws_rest__on_command(session, line);
+
+	arena_reset(&client->arena);
+}
+
+/* Fragmented and binary messages are not supported */
+static void ws_rest__on_frame(struct ws_rest_session* session,
+			      const struct ws_frame* frame, const char* payload)
+{
+	switch (frame->opcode) {
+	case WS_TEXT:
+		if (frame->is_final) {
+			ws_rest__on_text(session, payload,
+					 frame->payload_length);
+			return;
+		}
+		/* fall through */
+	case WS_CONTINUATION:
+	case WS_BINARY:
+		ws_rest__close_with(session, WS_CLOSE_UNSUPPORTED);
+		return;
+	case WS_PING:
+		ws_rest__send(session, WS_PONG, payload, frame->payload_length);
+		return;
+	case WS_PONG:
+		return;
+	case WS_CLOSE:
+		ws_rest__close(session, payload,
+			       frame->payload_length < 2 ? 0 : 2);
+		return;
+	}
+}
+
+static void ws_rest__on_input(struct rest_client* client)
+{
+	struct ws_rest_session* session = client->input_context;
+
+	while (!client->is_closing) {
+		struct ws_frame frame;
+		ssize_t size = ws_decode_frame(&frame, client->buffer.data,
+					       client->buffer.index);
+		if (size == 0)
+			break;
+
+		if (size < 0) {
+			int is_too_big = frame.payload_length > WS_PAYLOAD_MAX;
+			ws_rest__close_with(session, is_too_big
+					    ? WS_CLOSE_TOO_BIG
+					    : WS_CLOSE_PROTOCOL_ERROR);
+			break;
+		}
+
+		char* payload = (char*)client->buffer.data
+			      + frame.header_length;
+
+		ws_unmask(&frame, payload);
+		ws_rest__on_frame(session, &frame, payload);
+		rest_consume(client, size);
+	}
+
+	ws_rest__flush(session);
+}
+
+static int ws_rest__parse_interval(int* dst, const char* str)
+{
+	if (!str) {
+		*dst = WS_REST_DEFAULT_INTERVAL;
+		return 0;
+	}
+
+	*dst = ws_rest__parse_int(str, WS_REST_MIN_INTERVAL, INT32_MAX);
+	if (*dst < 0)
+		return -1;
+
+	/* A closed session is freed on its next tick */
+	if (*dst > WS_REST_MAX_INTERVAL)
+		*dst = WS_REST_MAX_INTERVAL;
+
+	return 0;
+}
+
+static int ws_rest__start_timer(struct ws_rest_session* session,
+				int interval)
+{
+	session->timer = mloop_timer_new(mloop_default());
+	if (!session->timer)
+		return -1;
+
+	mloop_timer_set_type(session->timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_time(session->timer, interval * 1000000ULL);
+	mloop_timer_set_context(session->timer, session, NULL);
+	mloop_timer_set_callback(session->timer, ws_rest__on_tick);
+
+	return mloop_timer_start(session->timer);
+}
+
+static int ws_rest__is_upgrade(const struct http_req* req)
+{
+	return req->is_connection_upgrade && req->upgrade
+	    && strcasecmp(req->upgrade, "websocket") == 0
+	    && req->websocket_key;
+}
+
+void ws_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	const struct http_req* req = &client->req;
+
+	if (req->url_index != 1) {
+		ws_rest__reply(client, "404 Not Found", "Not found\r\n");
+		return;
+	}
+
+	if (!ws_rest__is_upgrade(req)) {
+		ws_rest__reply(client, "400 Bad Request",
+			       "WebSocket upgrade expected\r\n");
+		return;
+	}
+
+	if (!req->websocket_version
+	 || strcmp(req->websocket_version, "13") != 0) {
+		static const char reply[] =
+			"HTTP/1.1 426 Upgrade Required\r\n"
+			"Sec-WebSocket-Version: 13\r\n"
+			"Content-Length: 0\r\n"
+			"\r\n";
+
+		rest_write(client, reply, sizeof(reply) - 1);
+		client->state = REST_CLIENT_DONE;
+		return;
+	}
+
+	int interval = 0;
+	if (ws_rest__parse_interval(&interval,
+				    http_req_query(&client->req, "interval"))
+	    < 0) {
+		ws_rest__reply(client, "400 Bad Request",
+			       "Invalid interval\r\n");
+		return;
+	}
+
+	struct ws_rest_session* session = calloc(1, sizeof(*session));
+	if (!session) {
+		ws_rest__reply(client, "500 Internal Server Error",
+			       "Out of memory\r\n");
+		return;
+	}
+
+	if (ws_rest__start_timer(session, interval) < 0) {
+		if (session->timer)
+			mloop_timer_unref(session->timer);
+		free(session);
+		ws_rest__reply(client, "500 Internal Server Error",
+			       "Could not start timer\r\n");
+		return;
+	}
+
+	char accept[WS_ACCEPT_SIZE];
+	ws_accept_key(accept, req->websocket_key);
+
+	char head[256];
+	int head_len = snprintf(head, sizeof(head),
+				"HTTP/1.1 101 Switching Protocols\r\n"
+				"Upgrade: websocket\r\n"
+				"Connection: Upgrade\r\n"
+				"Sec-WebSocket-Accept: %s\r\n"
+				"\r\n", accept);
+
+	session->client = client;
+	rest_client_ref(client);
+	LIST_INSERT_HEAD(&ws_rest__sessions, session, links);
+
+	rest_write(client, head, head_len);
+	rest_upgrade(client, ws_rest__on_input, session);
+}
+
+int ws_rest_is_active(void)
+{
+	return !LIST_EMPTY(&ws_rest__sessions);
+}
+
+void ws_rest_on_pdo(int nodeid, int n, const void* data, size_t len,
+		    uint64_t timestamp)
+{
+	struct ws_rest_session* session;
+
+	if (len > WS_REST_DATA_SIZE)
+		len = WS_REST_DATA_SIZE;
+
+	LIST_FOREACH(session, &ws_rest__sessions, links) {
+		if (!(session->pdo_mask[nodeid] & (1 << (n - 1))))
+			continue;
+
+		struct ws_rest_pdo* pdo = &session->pdo[nodeid][n - 1];
+
+		if (pdo->is_pending)
+			pdo->n_coalesced++;
+
+		pdo->is_pending = 1;
+		pdo->len = len;
+		pdo->timestamp = timestamp;
+		memcpy(pdo->data, data, len);
+
+		session->have_pdo = 1;
+	}
+}
+
+void ws_rest_cleanup(void)
+{
+	while (!LIST_EMPTY(&ws_rest__sessions))
+		ws_rest__session_free(LIST_FIRST(&ws_rest__sessions));
+}
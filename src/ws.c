@@ -0,0 +1,276 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include "ws.h"
+
+#define WS__GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS__KEY_MAX 64
+
+#define WS__FIN 0x80
+#define WS__RSV 0x70
+#define WS__OPCODE 0x0f
+#define WS__MASK 0x80
+#define WS__LENGTH 0x7f
+
+static inline int ws__is_control(enum ws_opcode opcode)
+{
+	return opcode & 8;
+}
+
+static int ws__is_known(enum ws_opcode opcode)
+{
+	switch (opcode) {
+	case WS_CONTINUATION:
+	case WS_TEXT:
+	case WS_BINARY:
+	case WS_CLOSE:
+	case WS_PING:
+	case WS_PONG:
+		return 1;
+	}
+
+	return 0;
+}
+
+ssize_t ws_decode_frame(struct ws_frame* frame, const void* src, size_t size)
+{
+	const uint8_t* p = src;
+
+	memset(frame, 0, sizeof(*frame));
+
+	if (size < 2)
+		return 0;
+
+	if ((p[0] & WS__RSV) || !(p[1] & WS__MASK))
+		return -1;
+
+	frame->is_final = !!(p[0] & WS__FIN);
+	frame->opcode = p[0] & WS__OPCODE;
+
+	if (!ws__is_known(frame->opcode))
+		return -1;
+
+	uint64_t length = p[1] & WS__LENGTH;
+	size_t pos = 2;
+
+	if (length == 126) {
+		if (size < 4)
+			return 0;
+
+		length = (uint64_t)p[2] << 8 | p[3];
+		pos = 4;
+	} else if (length == 127) {
+		if (size < 10)
+			return 0;
+
+		length = 0;
+		for (int i = 0; i < 8; ++i)
+			length = length << 8 | p[2 + i];
+		pos = 10;
+	}
+
+	frame->payload_length = length < SIZE_MAX ? length : SIZE_MAX;
+
+	/* Control frames are small and never fragmented */
+	if (ws__is_control(frame->opcode) && (length > 125 || !frame->is_final))
+		return -1;
+
+	if (length > WS_PAYLOAD_MAX)
+		return -1;
+
+	if (size < pos + 4)
+		return 0;
+
+	memcpy(frame->mask, &p[pos], 4);
+	pos += 4;
+
+	frame->header_length = pos;
+
+	return size < pos + length ? 0 : (ssize_t)(pos + length);
+}
+
+void ws_unmask(const struct ws_frame* frame, void* payload)
+{
+	uint8_t* p = payload;
+
+	for (size_t i = 0; i < frame->payload_length; ++i)
+		p[i] ^= frame->mask[i & 3];
+}
+
+size_t ws_encode_header(void* dst, enum ws_opcode opcode, size_t size)
+{
+	uint8_t* p = dst;
+
+	p[0] = WS__FIN | opcode;
+
+	if (size < 126) {
+		p[1] = size;
+		return 2;
+	}
+
+	if (size <= 0xffff) {
+		p[1] = 126;
+		p[2] = size >> 8;
+		p[3] = size;
+		return 4;
+	}
+
+	p[1] = 127;
+	for (int i = 0; i < 8; ++i)
+		p[2 + i] = (uint64_t)size >> (56 - 8 * i);
+	return 10;
+}
+
+struct ws__sha1 {
+	uint32_t h[5];
+	uint8_t block[64];
+	size_t length;
+};
+
+static inline uint32_t ws__rol(uint32_t x, int n)
+{
+	return x << n | x >> (32 - n);
+}
+
+static void ws__sha1_block(struct ws__sha1* self)
+{
+	uint32_t w[80];
+
+	for (int i = 0; i < 16; ++i)
+		w[i] = (uint32_t)self->block[4 * i] << 24
+		     | (uint32_t)self->block[4 * i + 1] << 16
+		     | (uint32_t)self->block[4 * i + 2] << 8
+		     | self->block[4 * i + 3];
+
+	for (int i = 16; i < 80; ++i)
+		w[i] = ws__rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	uint32_t a = self->h[0], b = self->h[1], c = self->h[2],
+		 d = self->h[3], e = self->h[4];
+
+	for (int i = 0; i < 80; ++i) {
+		uint32_t f, k;
+
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		uint32_t t = ws__rol(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ws__rol(b, 30);
+		b = a;
+		a = t;
+	}
+
+	self->h[0] += a;
+	self->h[1] += b;
+	self->h[2] += c;
+	self->h[3] += d;
+	self->h[4] += e;
+}
+
+static void ws__sha1_init(struct ws__sha1* self)
+{
+	self->h[0] = 0x67452301;
+	self->h[1] = 0xefcdab89;
+	self->h[2] = 0x98badcfe;
+	self->h[3] = 0x10325476;
+	self->h[4] = 0xc3d2e1f0;
+	self->length = 0;
+}
+
+static void ws__sha1_update(struct ws__sha1* self, const void* data,
+			    size_t size)
+{
+	const uint8_t* p = data;
+
+	for (size_t i = 0; i < size; ++i) {
+		self->block[self->length++ % 64] = p[i];
+		if (self->length % 64 == 0)
+			ws__sha1_block(self);
+	}
+}
+
+static void ws__sha1_final(struct ws__sha1* self, uint8_t* digest)
+{
+	uint64_t bits = (uint64_t)self->length * 8;
+	uint8_t pad = 0x80;
+
+	ws__sha1_update(self, &pad, 1);
+
+	pad = 0;
+	while (self->length % 64 != 56)
+		ws__sha1_update(self, &pad, 1);
+
+	uint8_t length[8];
+	for (int i = 0; i < 8; ++i)
+		length[i] = bits >> (56 - 8 * i);
+
+	ws__sha1_update(self, length, sizeof(length));
+
+	for (int i = 0; i < 20; ++i)
+		digest[i] = self->h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+static void ws__base64(char* dst, const uint8_t* src, size_t size)
+{
+	static const char table[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+		"0123456789+/";
+
+	for (size_t i = 0; i < size; i += 3) {
+		uint32_t v = (uint32_t)src[i] << 16;
+		if (i + 1 < size)
+			v |= (uint32_t)src[i + 1] << 8;
+		if (i + 2 < size)
+			v |= src[i + 2];
+
+		*dst++ = table[v >> 18 & 0x3f];
+		*dst++ = table[v >> 12 & 0x3f];
+		*dst++ = i + 1 < size ? table[v >> 6 & 0x3f] : '=';
+		*dst++ = i + 2 < size ? table[v & 0x3f] : '=';
+	}
+
+	*dst = '\0';
+}
+
+void ws_accept_key(char* dst, const char* key)
+{
+	struct ws__sha1 sha1;
+	uint8_t digest[20];
+
+	size_t key_length = strlen(key);
+	if (key_length > WS__KEY_MAX)
+		key_length = WS__KEY_MAX;
+
+	ws__sha1_init(&sha1);
+	ws__sha1_update(&sha1, key, key_length);
+	ws__sha1_update(&sha1, WS__GUID, strlen(WS__GUID));
+	ws__sha1_final(&sha1, digest);
+
+	ws__base64(dst, digest, sizeof(digest));
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include "wsdeque.h"
+
+#define wsdeque__load(ptr, order) __atomic_load_n(ptr, __ATOMIC_##order)
+#define wsdeque__store(ptr, val, order) \
+	__atomic_store_n(ptr, val, __ATOMIC_##order)
+#define wsdeque__fence(order) __atomic_thread_fence(__ATOMIC_##order)
+#define wsdeque__cas(ptr, expected, desired) \
+({ \
+	__typeof__(expected) expected_ = (expected); \
+	__atomic_compare_exchange_n(ptr, &expected_, desired, 0, \
+				    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED); \
+})
+
+int wsdeque_init(struct wsdeque* self, size_t size)
+{
+	size_t n = 1;
+	while (n < size)
+		n <<= 1;
+
+	self->buffer = calloc(n, sizeof(*self->buffer));
+	if (!self->buffer)
+		return -1;
+
+	self->mask = n - 1;
+	self->top = 0;
+	self->bottom = 0;
+
+	return 0;
+}
+
+void wsdeque_destroy(struct wsdeque* self)
+{
+	free(self->buffer);
+}
+
+int wsdeque_push(struct wsdeque* self, void* data)
+{
+	long bottom = wsdeque__load(&self->bottom, RELAXED);
+	long top = wsdeque__load(&self->top, ACQUIRE);
+
+	if (bottom - top > self->mask)
+		return -1;
+
+	wsdeque__store(&self->buffer[bottom & self->mask], data, RELAXED);
+	wsdeque__fence(RELEASE);
+	wsdeque__store(&self->bottom, bottom + 1, RELAXED);
+
+	return 0;
+}
+
+int wsdeque_pop(struct wsdeque* self, void** data)
+{
+	long bottom = wsdeque__load(&self->bottom, RELAXED) - 1;
+	wsdeque__store(&self->bottom, bottom, RELAXED);
+	wsdeque__fence(SEQ_CST);
+	long top = wsdeque__load(&self->top, RELAXED);
+
+	if (top > bottom) {
+		wsdeque__store(&self->bottom, bottom + 1, RELAXED);
+		return -1;
+	}
+
+	*data = wsdeque__load(&self->buffer[bottom & self->mask], RELAXED);
+
+	if (top < bottom)
+		return 0;
+
+	/* This is the last item, so we race against thieves for it */
+	int is_ours = wsdeque__cas(&self->top, top, top + 1);
+	wsdeque__store(&self->bottom, bottom + 1, RELAXED);
+
+	return is_ours ? 0 : -1;
+}
+
+int wsdeque_steal(struct wsdeque* self, void** data)
+{
+	long top = wsdeque__load(&self->top, ACQUIRE);
+	wsdeque__fence(SEQ_CST);
+	long bottom = wsdeque__load(&self->bottom, ACQUIRE);
+
+	if (top >= bottom)
+		return -1;
+
+	void* item = wsdeque__load(&self->buffer[top & self->mask], RELAXED);
+
+	if (!wsdeque__cas(&self->top, top, top + 1))
+		return -1;
+
+	*data = item;
+	return 0;
+}
+
+int wsdeque_is_empty(const struct wsdeque* self)
+{
+	long top = wsdeque__load(&self->top, ACQUIRE);
+	long bottom = wsdeque__load(&self->bottom, ACQUIRE);
+
+	return top >= bottom;
+}
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tst-bench.h"
+#include "fff.h"
+#include "canopen.h"
+#include "canopen/master.h"
+#include "canopen/sdo_async.h"
+#include "canopen/sdo_srv.h"
+#include "canopen/eds.h"
+#include "canopen/byteorder.h"
+#include "http.h"
+#include "ini_parser.h"
+#include "trace-buffer.h"
+#include "prioq.h"
+#include "vector.h"
+
+/* Times the functions on the paths that every frame or request takes. This
+ * is not a test; it gives optimisations something to be measured against.
+ */
+
+DEFINE_FFF_GLOBALS;
+
+struct mloop;
+
+struct mloop_timer {
+	int dummy;
+};
+
+FAKE_VALUE_FUNC(struct mloop*, mloop_default);
+FAKE_VALUE_FUNC(struct mloop_timer*, mloop_timer_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_timer_start, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_stop, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_unref, struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_time, struct mloop_timer*, uint64_t);
+FAKE_VOID_FUNC(mloop_timer_set_context, struct mloop_timer*, void*,
+	       mloop_free_fn);
+FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
+FAKE_VALUE_FUNC(void*, mloop_timer_get_context, const struct mloop_timer*);
+
+#define SDO_FRAMES_MAX 64
+
+static struct mloop_timer timer;
+
+/* Frames that the SDO client and server have sent, told apart by fd */
+static struct can_frame sent[2][SDO_FRAMES_MAX];
+static size_t n_sent[2];
+
+ssize_t sock_send(const struct sock* sock, struct can_frame* cf, int flags)
+{
+	(void)flags;
+
+	assert(sock->fd == 0 || sock->fd == 1);
+
+	if (n_sent[sock->fd] < SDO_FRAMES_MAX)
+		sent[sock->fd][n_sent[sock->fd]++] = *cf;
+
+	return sizeof(*cf);
+}
+
+static uint64_t n_pdos;
+
+static void on_pdo(struct co_drv* drv, const void* data, size_t size,
+		   uint64_t timestamp)
+{
+	(void)drv;
+	(void)data;
+	(void)size;
+	(void)timestamp;
+
+	++n_pdos;
+}
+
+static void bench_object_type(void)
+{
+	struct can_frame cf[256];
+
+	for (int i = 0; i < 256; ++i)
+		cf[i].can_id = (i * 0x47) & CAN_SFF_MASK;
+
+	TST_BENCH_N("canopen_get_object_type", 256,
+		for (int j = 0; j < 256; ++j) {
+			struct canopen_msg msg;
+			canopen_get_object_type(&msg, &cf[j]);
+			TST_BENCH_KEEP(msg.id);
+		}
+	);
+}
+
+static void bench_mux(void)
+{
+	static const int nodeid = 5;
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	node->is_initialized = 1;
+	node->driver_type = CO_MASTER_DRIVER_NEW;
+	co_set_pdo1_ts_fn(&node->ndrv, on_pdo);
+
+	struct canfd_frame cf[64];
+	uint64_t ts[64];
+
+	for (int i = 0; i < 64; ++i) {
+		memset(&cf[i], 0, sizeof(cf[i]));
+		cf[i].can_id = R_TPDO1 + nodeid;
+		cf[i].len = 8;
+		cf[i].data[0] = i;
+		ts[i] = i;
+	}
+
+	TST_BENCH_N("mux_on_frame (TPDO, stub driver)", 64,
+		co__mux_on_frames(cf, ts, 64)
+	);
+
+	assert(n_pdos > 0);
+
+	/* Frames that nobody wants are dropped by the mux table */
+	for (int i = 0; i < 64; ++i)
+		cf[i].can_id = R_TPDO1 + nodeid + 1;
+
+	TST_BENCH_N("mux_on_frame (unused COB-ID)", 64,
+		co__mux_on_frames(cf, ts, 64)
+	);
+
+	co_set_pdo1_ts_fn(&node->ndrv, NULL);
+	node->is_initialized = 0;
+	node->driver_type = CO_MASTER_DRIVER_NONE;
+}
+
+static char srv_data[64];
+static size_t srv_size;
+
+static int on_srv_init(struct sdo_srv* srv)
+{
+	if (srv->req_type == SDO_REQ_UPLOAD)
+		vector_assign(&srv->buffer, srv_data, srv_size);
+
+	return 0;
+}
+
+/* Runs an upload between a client and a server and records what they sent */
+static void record_upload(struct sdo_async* client, struct sdo_srv* server,
+			  const struct sdo_async_info* info,
+			  struct can_frame* requests, size_t* n_requests,
+			  struct can_frame* responses, size_t* n_responses)
+{
+	*n_requests = 0;
+	*n_responses = 0;
+	n_sent[0] = 0;
+	n_sent[1] = 0;
+
+	sdo_async_start(client, info);
+
+	while (client->is_running) {
+		assert(n_sent[0] == 1);
+		requests[(*n_requests)++] = sent[0][0];
+		n_sent[0] = 0;
+
+		sdo_srv_feed(server, &requests[*n_requests - 1]);
+
+		assert(n_sent[1] == 1);
+		responses[(*n_responses)++] = sent[1][0];
+		n_sent[1] = 0;
+
+		sdo_async_feed(client, &responses[*n_responses - 1]);
+	}
+
+	assert(client->status == SDO_REQ_OK);
+}
+
+static void bench_sdo_upload(const char* async_name, const char* srv_name,
+			     size_t size)
+{
+	static const struct sock client_sock = { .type = SOCK_TYPE_CAN, .fd = 0 };
+	static const struct sock server_sock = { .type = SOCK_TYPE_CAN, .fd = 1 };
+
+	struct sdo_async client;
+	struct sdo_srv server;
+
+	mloop_timer_new_fake.return_val = &timer;
+
+	sdo_async_init(&client, &client_sock, 42);
+	sdo_srv_init(&server, &server_sock, 42, on_srv_init, NULL);
+
+	memset(srv_data, 'x', sizeof(srv_data));
+	srv_size = size;
+
+	struct sdo_async_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x2000,
+		.subindex = 1,
+		.timeout = 1000,
+	};
+
+	struct can_frame requests[SDO_FRAMES_MAX], responses[SDO_FRAMES_MAX];
+	size_t n_requests, n_responses;
+
+	record_upload(&client, &server, &info, requests, &n_requests, responses,
+		      &n_responses);
+
+	TST_BENCH(async_name,
+		n_sent[0] = 0;
+		sdo_async_start(&client, &info);
+		for (size_t j = 0; j < n_responses; ++j)
+			sdo_async_feed(&client, &responses[j]);
+	);
+
+	TST_BENCH(srv_name,
+		n_sent[1] = 0;
+		for (size_t j = 0; j < n_requests; ++j)
+			sdo_srv_feed(&server, &requests[j]);
+	);
+
+	sdo_srv_destroy(&server);
+	sdo_async_destroy(&client);
+}
+
+static void bench_http(void)
+{
+	static const char request[] =
+		"PUT /sdo/5/2000/1?type=u32 HTTP/1.1\r\n"
+		"Host: localhost:9191\r\n"
+		"User-Agent: curl/7.58.0\r\n"
+		"Accept: */*\r\n"
+		"Content-Type: text/plain\r\n"
+		"Content-Length: 4\r\n"
+		"\r\n";
+
+	char head[sizeof(request)];
+
+	TST_BENCH("http_req_parse (copy and parse)",
+		struct http_req req;
+		memcpy(head, request, sizeof(request));
+		http_req_parse(&req, head);
+		http_req_free(&req);
+	);
+}
+
+static char* make_ini_text(size_t* size)
+{
+	char* text = NULL;
+	FILE* stream = open_memstream(&text, size);
+	if (!stream)
+		abort();
+
+	fprintf(stream, "[device]\nheartbeat=yes\nbootup=standard\n\n");
+
+	for (int i = 1; i <= 64; ++i)
+		fprintf(stream, "[2000sub%x]\ntype=UNSIGNED32\nvalue=%d\n"
+			"access=rw\n\n", i, i);
+
+	fclose(stream);
+	return text;
+}
+
+static void bench_ini(void)
+{
+	size_t size = 0;
+	char* text = make_ini_text(&size);
+
+	TST_BENCH("ini_parse (65 sections)",
+		FILE* stream = fmemopen(text, size, "r");
+		struct ini_file ini;
+		ini_parse(&ini, stream);
+		fclose(stream);
+		ini_destroy(&ini);
+	);
+
+	free(text);
+}
+
+static void bench_eds(void)
+{
+	struct canopen_eds eds;
+	memset(&eds, 0, sizeof(eds));
+
+	eds.n_objs = 512;
+	eds.objs = calloc(eds.n_objs, sizeof(*eds.objs));
+	eds.is_parsed = 1;
+
+	for (size_t i = 0; i < eds.n_objs; ++i)
+		eds.objs[i].key = ((0x1000 + (i / 8) * 0x10) << 8) | (i % 8);
+
+	TST_BENCH_N("eds_obj_find (512 objects)", 64,
+		for (int j = 0; j < 64; ++j) {
+			size_t k = (j * 37) % eds.n_objs;
+			TST_BENCH_KEEP(eds_obj_find(&eds,
+						    eds.objs[k].key >> 8,
+						    eds.objs[k].key & 0xff));
+		}
+	);
+
+	free(eds.objs);
+}
+
+static void bench_tb_append(void)
+{
+	struct tracebuffer tb;
+	tb_init(&tb, 1024 * sizeof(struct tb_frame));
+
+	struct can_frame cf = { .can_id = R_TPDO1 + 5, .can_dlc = 8 };
+
+	TST_BENCH("tb_append",
+		tb_append(&tb, &cf)
+	);
+
+	tb_destroy(&tb);
+}
+
+static void bench_byteorder(void)
+{
+	uint8_t src[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	uint32_t dst32 = 0;
+	uint64_t dst64 = 0;
+
+	TST_BENCH_N("byteorder2 (4 to 4 bytes)", 64,
+		for (int j = 0; j < 64; ++j) {
+			byteorder2(&dst32, src, sizeof(dst32), 4);
+			TST_BENCH_KEEP(dst32);
+		}
+	);
+
+	TST_BENCH_N("byteorder2 (3 to 8 bytes)", 64,
+		for (int j = 0; j < 64; ++j) {
+			byteorder2(&dst64, src, sizeof(dst64), 3);
+			TST_BENCH_KEEP(dst64);
+		}
+	);
+}
+
+static void bench_prioq(void)
+{
+	struct prioq queue;
+	prioq_init(&queue, 256);
+
+	unsigned long priority[256];
+	for (int i = 0; i < 256; ++i)
+		priority[i] = (i * 97) % 256;
+
+	TST_BENCH_N("prioq_insert + prioq_pop (256 queued)", 256,
+		for (int j = 0; j < 256; ++j)
+			prioq_insert(&queue, priority[j], NULL);
+		for (int j = 0; j < 256; ++j) {
+			struct prioq_elem elem;
+			prioq_pop(&queue, &elem, 0);
+		}
+	);
+
+	/* Priorities below PRIOQ_N_LEVELS skip the heap */
+	for (int i = 0; i < 256; ++i)
+		priority[i] %= 8;
+
+	TST_BENCH_N("prioq_insert + prioq_pop (256 queued, 8 levels)", 256,
+		for (int j = 0; j < 256; ++j)
+			prioq_insert(&queue, priority[j], NULL);
+		for (int j = 0; j < 256; ++j) {
+			struct prioq_elem elem;
+			prioq_pop(&queue, &elem, 0);
+		}
+	);
+
+	prioq_destroy(&queue);
+}
+
+int main()
+{
+	bench_object_type();
+	bench_mux();
+	bench_sdo_upload("sdo_async_feed (expedited upload)",
+			 "sdo_srv_feed (expedited upload)", 4);
+	bench_sdo_upload("sdo_async_feed (49 B segmented upload)",
+			 "sdo_srv_feed (49 B segmented upload)", 49);
+	bench_http();
+	bench_ini();
+	bench_eds();
+	bench_tb_append();
+	bench_byteorder();
+	bench_prioq();
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+#include "tst.h"
+#include "arena.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static int test_alloc_from_buffer()
+{
+	static char buffer[256] __attribute__((aligned(16)));
+	struct arena arena;
+	arena_init(&arena, buffer, sizeof(buffer));
+
+	char* a = arena_alloc(&arena, 3);
+	char* b = arena_alloc(&arena, 8);
+	ASSERT_PTR_EQ(buffer, a);
+	ASSERT_PTR_EQ(buffer + 16, b);
+	ASSERT_TRUE(arena.blocks == NULL);
+
+	/* Everything is handed out again after a reset */
+	arena_reset(&arena);
+	ASSERT_PTR_EQ(buffer, arena_alloc(&arena, 1));
+
+	arena_destroy(&arena);
+	return 0;
+}
+
+static int test_overflow_into_blocks()
+{
+	static char buffer[64] __attribute__((aligned(16)));
+	struct arena arena;
+	arena_init(&arena, buffer, sizeof(buffer));
+
+	ASSERT_PTR_EQ(buffer, arena_alloc(&arena, 48));
+
+	char* big = arena_alloc(&arena, 10000);
+	ASSERT_TRUE(big != NULL);
+	ASSERT_TRUE(arena.blocks != NULL);
+	ASSERT_INT_EQ(0, (uintptr_t)big % 16);
+	memset(big, 0xaa, 10000);
+
+	char* next = arena_alloc(&arena, 100);
+	ASSERT_TRUE(next != NULL);
+	memset(next, 0x55, 100);
+
+	arena_reset(&arena);
+	ASSERT_TRUE(arena.blocks == NULL);
+	ASSERT_PTR_EQ(buffer, arena_alloc(&arena, 1));
+
+	arena_destroy(&arena);
+	return 0;
+}
+
+static int test_zeroed_arena()
+{
+	struct arena arena;
+	memset(&arena, 0, sizeof(arena));
+
+	char* str = arena_strndup(&arena, "hello world", 5);
+	ASSERT_STR_EQ("hello", str);
+
+	int* zeroes = arena_zalloc(&arena, 10 * sizeof(int));
+	for (int i = 0; i < 10; ++i)
+		ASSERT_INT_EQ(0, zeroes[i]);
+
+	arena_reset(&arena);
+	ASSERT_TRUE(arena.blocks == NULL);
+	arena_destroy(&arena);
+	return 0;
+}
+
+static int test_text_grows_in_place()
+{
+	static char buffer[4096] __attribute__((aligned(16)));
+	struct arena arena;
+	arena_init(&arena, buffer, sizeof(buffer));
+
+	struct arena_text text;
+	arena_text_init(&text, &arena);
+
+	arena_printf(&text, "%s", "");
+	for (int i = 0; i < 100; ++i)
+		arena_printf(&text, "%d,", i);
+
+	ASSERT_FALSE(text.is_bad);
+	ASSERT_PTR_EQ(buffer, text.data);
+	ASSERT_UINT_EQ(strlen(text.data), text.length);
+	ASSERT_INT_EQ(0, strncmp("0,1,2,3,", text.data, 8));
+	ASSERT_INT_EQ(0, strcmp("98,99,", text.data + text.length - 6));
+
+	arena_destroy(&arena);
+	return 0;
+}
+
+static int test_text_moves()
+{
+	struct arena arena;
+	arena_init(&arena, NULL, 0);
+
+	struct arena_text text;
+	arena_text_init(&text, &arena);
+
+	arena_printf(&text, "abc");
+
+	/* Something allocated behind the text keeps it from growing there */
+	char* other = arena_alloc(&arena, 4);
+	strcpy(other, "xyz");
+
+	char line[100];
+	memset(line, 'x', sizeof(line) - 1);
+	line[sizeof(line) - 1] = '\0';
+
+	for (int i = 0; i < 100; ++i)
+		arena_printf(&text, "%s", line);
+
+	arena_append(&text, "!", 1);
+
+	ASSERT_FALSE(text.is_bad);
+	ASSERT_UINT_EQ(3 + 99 * 100 + 1, text.length);
+	ASSERT_UINT_EQ(text.length, strlen(text.data));
+	ASSERT_INT_EQ(0, strncmp("abcxxx", text.data, 6));
+	ASSERT_INT_EQ('!', text.data[text.length - 1]);
+	ASSERT_STR_EQ("xyz", other);
+
+	arena_destroy(&arena);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_alloc_from_buffer);
+	RUN_TEST(test_overflow_into_blocks);
+	RUN_TEST(test_zeroed_arena);
+	RUN_TEST(test_text_grows_in_place);
+	RUN_TEST(test_text_moves);
+	return r;
+}
@@ -0,0 +1,135 @@
+#include "tst.h"
+#include "canopen/bus_health.h"
+
+#include <string.h>
+#include <linux/can.h>
+#include <linux/can/error.h>
+
+static struct can_frame error_frame(uint32_t error)
+{
+	struct can_frame cf;
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = CAN_ERR_FLAG | error;
+	cf.can_dlc = CAN_ERR_DLC;
+	return cf;
+}
+
+int test_counters(void)
+{
+	co_bus_health_reset();
+
+	struct can_frame cf = error_frame(CAN_ERR_TX_TIMEOUT);
+	ASSERT_INT_EQ(0, co_bus_health_on_error_frame(&cf, 1));
+
+	cf = error_frame(CAN_ERR_LOSTARB | CAN_ERR_ACK);
+	co_bus_health_on_error_frame(&cf, 2);
+
+	cf = error_frame(CAN_ERR_PROT | CAN_ERR_BUSERROR);
+	co_bus_health_on_error_frame(&cf, 3);
+
+	struct co_bus_health health;
+	co_bus_health_get(&health, 4);
+
+	ASSERT_INT_EQ(CO_BUS_ERROR_ACTIVE, health.state);
+	ASSERT_TRUE(health.n_error_frames == 3);
+	ASSERT_TRUE(health.n_tx_timeouts == 1);
+	ASSERT_TRUE(health.n_lost_arbitration == 1);
+	ASSERT_TRUE(health.n_no_ack == 1);
+	ASSERT_TRUE(health.n_protocol_errors == 1);
+	ASSERT_TRUE(health.n_bus_errors == 1);
+	ASSERT_TRUE(health.last_error == 3);
+	return 0;
+}
+
+int test_controller_states(void)
+{
+	co_bus_health_reset();
+	co_bus_health_set_recovery_time(0);
+
+	struct can_frame cf = error_frame(CAN_ERR_CRTL);
+	cf.data[1] = CAN_ERR_CRTL_TX_WARNING;
+	ASSERT_INT_EQ(1, co_bus_health_on_error_frame(&cf, 1));
+	ASSERT_INT_EQ(CO_BUS_ERROR_WARNING, co_bus_health_get_state(1));
+
+	cf.data[1] = CAN_ERR_CRTL_RX_PASSIVE;
+	ASSERT_INT_EQ(1, co_bus_health_on_error_frame(&cf, 2));
+	ASSERT_INT_EQ(CO_BUS_ERROR_PASSIVE, co_bus_health_get_state(2));
+	ASSERT_TRUE(co_bus_is_degraded(co_bus_health_get_state(2)));
+
+	cf = error_frame(CAN_ERR_BUSOFF);
+	ASSERT_INT_EQ(1, co_bus_health_on_error_frame(&cf, 3));
+	ASSERT_INT_EQ(CO_BUS_OFF, co_bus_health_get_state(1000000000));
+
+	cf = error_frame(CAN_ERR_RESTARTED);
+	ASSERT_INT_EQ(1, co_bus_health_on_error_frame(&cf, 4));
+	ASSERT_INT_EQ(CO_BUS_ERROR_ACTIVE, co_bus_health_get_state(4));
+
+	struct co_bus_health health;
+	co_bus_health_get(&health, 5);
+	ASSERT_TRUE(health.n_error_warning == 1);
+	ASSERT_TRUE(health.n_error_passive == 1);
+	ASSERT_TRUE(health.n_bus_off == 1);
+	ASSERT_TRUE(health.n_restarts == 1);
+	return 0;
+}
+
+int test_state_from_error_counts(void)
+{
+	co_bus_health_reset();
+	co_bus_health_set_recovery_time(0);
+
+	struct can_frame cf = error_frame(CAN_ERR_CNT);
+	cf.data[6] = 100;
+	cf.data[7] = 3;
+	co_bus_health_on_error_frame(&cf, 1);
+	ASSERT_INT_EQ(CO_BUS_ERROR_WARNING, co_bus_health_get_state(1));
+
+	cf.data[7] = 130;
+	co_bus_health_on_error_frame(&cf, 2);
+	ASSERT_INT_EQ(CO_BUS_ERROR_PASSIVE, co_bus_health_get_state(2));
+
+	cf.data[6] = 10;
+	cf.data[7] = 10;
+	co_bus_health_on_error_frame(&cf, 3);
+	ASSERT_INT_EQ(CO_BUS_ERROR_ACTIVE, co_bus_health_get_state(3));
+
+	struct co_bus_health health;
+	co_bus_health_get(&health, 3);
+	ASSERT_INT_EQ(10, health.tx_error_count);
+	ASSERT_INT_EQ(10, health.rx_error_count);
+	return 0;
+}
+
+int test_recovery_time(void)
+{
+	co_bus_health_reset();
+	co_bus_health_set_recovery_time(1000);
+
+	struct can_frame cf = error_frame(CAN_ERR_CRTL);
+	cf.data[1] = CAN_ERR_CRTL_TX_PASSIVE;
+	co_bus_health_on_error_frame(&cf, 5000);
+
+	ASSERT_INT_EQ(CO_BUS_ERROR_PASSIVE, co_bus_health_get_state(5999));
+	ASSERT_INT_EQ(CO_BUS_ERROR_ACTIVE, co_bus_health_get_state(6000));
+
+	/* Going error passive again after recovery counts as a new event */
+	ASSERT_INT_EQ(1, co_bus_health_on_error_frame(&cf, 7000));
+	ASSERT_INT_EQ(CO_BUS_ERROR_PASSIVE, co_bus_health_get_state(7000));
+
+	struct co_bus_health health;
+	co_bus_health_get(&health, 7000);
+	ASSERT_TRUE(health.n_error_passive == 2);
+
+	co_bus_health_set_recovery_time(5000000);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_counters);
+	RUN_TEST(test_controller_states);
+	RUN_TEST(test_state_from_error_counts);
+	RUN_TEST(test_recovery_time);
+	return r;
+}
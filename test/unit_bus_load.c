@@ -0,0 +1,93 @@
+#include "tst.h"
+#include "canopen/bus_load.h"
+
+#include <string.h>
+
+static int test_frame_bits(void)
+{
+	struct canfd_frame cf;
+	memset(&cf, 0, sizeof(cf));
+
+	/* 34 + 8 bits before stuffing, 10 stuff bits and 13 at the end */
+	cf.can_id = 0x181;
+	cf.len = 1;
+	ASSERT_INT_EQ(65, co_bus_load_frame_bits(&cf));
+
+	cf.len = 8;
+	ASSERT_INT_EQ(135, co_bus_load_frame_bits(&cf));
+
+	/* Remote frames have no data on the wire */
+	cf.can_id = 0x701 | CAN_RTR_FLAG;
+	ASSERT_INT_EQ(55, co_bus_load_frame_bits(&cf));
+
+	cf.can_id = 0x1234 | CAN_EFF_FLAG;
+	cf.len = 0;
+	ASSERT_INT_EQ(80, co_bus_load_frame_bits(&cf));
+	return 0;
+}
+
+static void count_frames(struct co_bus_load* load, int n)
+{
+	struct canfd_frame cf;
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = 0x181;
+	cf.len = 8;
+
+	for (int i = 0; i < n; ++i)
+		co_bus_load_count(load, &cf);
+}
+
+static int test_sample(void)
+{
+	struct co_bus_load load;
+	co_bus_load_init(&load, 500000, 1000000);
+
+	/* 50000 bits per 100 ms is all of it; 185 frames is half */
+	uint64_t t = 1000000;
+	for (int i = 0; i < 50; ++i) {
+		count_frames(&load, 185);
+		t += 100000;
+		co_bus_load_sample(&load, t);
+	}
+
+	ASSERT_INT_EQ(499, co_bus_load_get(&load));
+
+	/* The average follows a change within a few samples */
+	count_frames(&load, 370);
+	t += 100000;
+	ASSERT_TRUE(co_bus_load_sample(&load, t) > 600);
+
+	for (int i = 0; i < 50; ++i) {
+		t += 100000;
+		co_bus_load_sample(&load, t);
+	}
+
+	ASSERT_INT_EQ(0, co_bus_load_get(&load));
+	return 0;
+}
+
+static int test_sample_saturates(void)
+{
+	struct co_bus_load load;
+	co_bus_load_init(&load, 125000, 0);
+
+	for (int i = 1; i <= 50; ++i) {
+		count_frames(&load, 1000);
+		co_bus_load_sample(&load, i * 100000);
+	}
+
+	ASSERT_INT_EQ(CO_BUS_LOAD_MAX, co_bus_load_get(&load));
+
+	/* Time that does not move leaves the load as it is */
+	ASSERT_INT_EQ(CO_BUS_LOAD_MAX, co_bus_load_sample(&load, 5000000));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_frame_bits);
+	RUN_TEST(test_sample);
+	RUN_TEST(test_sample_saturates);
+	return r;
+}
@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "tst.h"
+#include "canopen/byteorder.h"
+
+static const uint8_t bytes_[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+static int test_specialised_sizes()
+{
+	uint8_t u8 = 0;
+	uint16_t u16 = 0;
+	uint32_t u32 = 0;
+	uint64_t u64 = 0;
+
+	byteorder(&u8, bytes_, sizeof(u8));
+	byteorder(&u16, bytes_, sizeof(u16));
+	byteorder(&u32, bytes_, sizeof(u32));
+	byteorder(&u64, bytes_, sizeof(u64));
+
+	ASSERT_UINT_EQ(0x01, u8);
+	ASSERT_UINT_EQ(0x0201, u16);
+	ASSERT_UINT_EQ(0x04030201, u32);
+	ASSERT_TRUE(u64 == 0x0807060504030201ULL);
+	return 0;
+}
+
+static int test_round_trip()
+{
+	uint32_t value = 0xdeadbeef, result = 0;
+	uint8_t wire[4];
+
+	BYTEORDER(wire, value);
+	ASSERT_UINT_EQ(0xef, wire[0]);
+	ASSERT_UINT_EQ(0xde, wire[3]);
+
+	byteorder(&result, wire, sizeof(result));
+	ASSERT_UINT_EQ(value, result);
+	return 0;
+}
+
+static int test_odd_sizes()
+{
+	uint32_t u24 = 0;
+	uint64_t u48 = 0;
+
+	byteorder2(&u24, bytes_, sizeof(u24), 3);
+	byteorder2(&u48, bytes_, sizeof(u48), 6);
+
+	ASSERT_UINT_EQ(0x030201, u24);
+	ASSERT_TRUE(u48 == 0x060504030201ULL);
+	return 0;
+}
+
+static int test_too_wide()
+{
+	uint8_t u8[2] = { 0, 0 };
+
+	byteorder2(&u8[0], bytes_, 1, 2);
+	ASSERT_UINT_EQ(1, u8[0]);
+	ASSERT_UINT_EQ(0, u8[1]);
+	return 0;
+}
+
+static int test_reverse()
+{
+	uint8_t dst[4] = { 0 };
+
+	byteorder__reverse(dst, bytes_, sizeof(dst), 3);
+	ASSERT_UINT_EQ(0, dst[0]);
+	ASSERT_UINT_EQ(3, dst[1]);
+	ASSERT_UINT_EQ(2, dst[2]);
+	ASSERT_UINT_EQ(1, dst[3]);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_specialised_sizes);
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_odd_sizes);
+	RUN_TEST(test_too_wide);
+	RUN_TEST(test_reverse);
+	return r;
+}
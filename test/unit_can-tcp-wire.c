@@ -0,0 +1,223 @@
+#include "tst.h"
+#include "can-tcp-wire.h"
+
+#include "socketcan.h"
+#include <linux/can/error.h>
+
+#include <string.h>
+#include <arpa/inet.h>
+
+static int assert_round_trip(const struct can_frame* in, const uint64_t* ts,
+			     size_t expected_size)
+{
+	unsigned char buffer[CAN_TCP_WIRE_MAX_SIZE];
+	struct can_frame out;
+	uint64_t delta = 1;
+
+	size_t size = can_tcp_wire_encode(buffer, in, ts);
+	ASSERT_INT_EQ((int)expected_size, (int)size);
+
+	ASSERT_INT_EQ((int)size, (int)can_tcp_wire_decode(&out, &delta, buffer,
+							  size));
+	ASSERT_INT_EQ((int)in->can_id, (int)out.can_id);
+	ASSERT_INT_EQ(in->can_dlc, out.can_dlc);
+	ASSERT_TRUE(delta == (ts ? *ts : 0));
+
+	if (!(in->can_id & CAN_RTR_FLAG))
+		ASSERT_TRUE(memcmp(in->data, out.data, in->can_dlc) == 0);
+
+	return 0;
+}
+
+static int test_standard_frames()
+{
+	struct can_frame cf = { .can_id = 0x181, .can_dlc = 8 };
+	memcpy(cf.data, "\x01\x02\x03\x04\x05\x06\x07\x08", 8);
+	ASSERT_INT_EQ(0, assert_round_trip(&cf, NULL, 11));
+
+	struct can_frame heartbeat = { .can_id = 0x705, .can_dlc = 1 };
+	heartbeat.data[0] = 5;
+	ASSERT_INT_EQ(0, assert_round_trip(&heartbeat, NULL, 4));
+
+	struct can_frame nmt = { .can_id = 0, .can_dlc = 2 };
+	ASSERT_INT_EQ(0, assert_round_trip(&nmt, NULL, 4));
+
+	return 0;
+}
+
+static int test_flags()
+{
+	struct can_frame eff = { .can_id = 0x1fffffff | CAN_EFF_FLAG,
+				 .can_dlc = 3 };
+	memcpy(eff.data, "abc", 3);
+	ASSERT_INT_EQ(0, assert_round_trip(&eff, NULL, 1 + 5 + 3));
+
+	struct can_frame rtr = { .can_id = 0x701 | CAN_RTR_FLAG, .can_dlc = 1 };
+	ASSERT_INT_EQ(0, assert_round_trip(&rtr, NULL, 3));
+
+	struct can_frame err = { .can_id = CAN_ERR_FLAG | CAN_ERR_BUSOFF,
+				 .can_dlc = 8 };
+	ASSERT_INT_EQ(0, assert_round_trip(&err, NULL, 11));
+
+	struct can_frame restarted = { .can_id = CAN_ERR_FLAG | 0x1000,
+				       .can_dlc = 8 };
+	ASSERT_INT_EQ(0, assert_round_trip(&restarted, NULL, 1 + 3 + 8));
+
+	return 0;
+}
+
+static int test_timestamps()
+{
+	struct can_frame cf = { .can_id = 0x281, .can_dlc = 2 };
+
+	uint64_t ts = 1000;
+	ASSERT_INT_EQ(0, assert_round_trip(&cf, &ts, 1 + 2 + 2 + 2));
+
+	ts = 0;
+	ASSERT_INT_EQ(0, assert_round_trip(&cf, &ts, 1 + 2 + 1 + 2));
+
+	ts = UINT64_MAX;
+	ASSERT_INT_EQ(0, assert_round_trip(&cf, &ts, 1 + 2 + 10 + 2));
+
+	return 0;
+}
+
+static int test_incomplete()
+{
+	unsigned char buffer[CAN_TCP_WIRE_MAX_SIZE];
+	struct can_frame cf = { .can_id = 0x12345 | CAN_EFF_FLAG,
+				.can_dlc = 8 };
+	struct can_frame out;
+
+	uint64_t ts = 123456;
+	size_t size = can_tcp_wire_encode(buffer, &cf, &ts);
+
+	for (size_t i = 0; i < size; ++i)
+		ASSERT_INT_EQ(0, (int)can_tcp_wire_decode(&out, NULL, buffer,
+							  i));
+
+	return 0;
+}
+
+static int test_invalid()
+{
+	struct can_frame out;
+
+	const unsigned char bad_dlc[] = { 0x09, 0x00, 0, 0, 0, 0, 0, 0, 0, 0 };
+	ASSERT_INT_EQ(-1, (int)can_tcp_wire_decode(&out, NULL, bad_dlc,
+						   sizeof(bad_dlc)));
+
+	const unsigned char reserved[] = { 0x20, 0x00 };
+	ASSERT_INT_EQ(-1, (int)can_tcp_wire_decode(&out, NULL, reserved,
+						   sizeof(reserved)));
+
+	const unsigned char long_id[] = { 0x00, 0x80, 0x80, 0x80, 0x80, 0x80,
+					  0x01 };
+	ASSERT_INT_EQ(-1, (int)can_tcp_wire_decode(&out, NULL, long_id,
+						   sizeof(long_id)));
+
+	/* 0x800 without the EFF flag */
+	const unsigned char big_sff[] = { 0x00, 0x80, 0x80, 0x02 };
+	ASSERT_INT_EQ(-1, (int)can_tcp_wire_decode(&out, NULL, big_sff,
+						   sizeof(big_sff)));
+
+	return 0;
+}
+
+static int test_control()
+{
+	struct can_frame cf;
+
+	can_tcp_wire_make_control(&cf, CAN_TCP_WIRE_OFFER);
+	ASSERT_INT_EQ(CAN_TCP_WIRE_OFFER, can_tcp_wire_get_control(&cf));
+	ASSERT_INT_GE(CAN_MAX_DLEN + 1, cf.can_dlc);
+
+	can_tcp_wire_make_control(&cf, CAN_TCP_WIRE_SWITCH);
+	ASSERT_INT_EQ(CAN_TCP_WIRE_SWITCH, can_tcp_wire_get_control(&cf));
+
+	struct can_frame data = { .can_id = 0x181, .can_dlc = 8 };
+	memcpy(data.data, "CTCP\x01\x00\x00\x00", 8);
+	ASSERT_INT_EQ(CAN_TCP_WIRE_DATA, can_tcp_wire_get_control(&data));
+
+	return 0;
+}
+
+static int test_filter_round_trip()
+{
+	unsigned char buffer[CAN_TCP_WIRE_MAX_FILTER_SIZE];
+	struct can_filter filter[2] = {
+		{ .can_id = 0x80, .can_mask = 0x780 },
+		{ .can_id = 0x700 | CAN_INV_FILTER, .can_mask = 0x7ff },
+	};
+	struct can_filter out[CAN_TCP_WIRE_MAX_FILTERS];
+	struct can_frame cf;
+	size_t n = 0;
+
+	for (int is_compact = 0; is_compact < 2; ++is_compact) {
+		ssize_t size = can_tcp_wire_encode_filter(buffer, filter, 2,
+							  is_compact);
+		ASSERT_INT_EQ(is_compact + 16 + 16, (int)size);
+
+		ssize_t rc = is_compact
+			   ? can_tcp_wire_decode(&cf, NULL, buffer, size)
+			   : 16;
+		ASSERT_INT_EQ(is_compact + 16, (int)rc);
+
+		if (!is_compact) {
+			memcpy(&cf, buffer, sizeof(cf));
+			cf.can_id = ntohl(cf.can_id);
+		}
+
+		ASSERT_INT_EQ(CAN_TCP_WIRE_FILTER,
+			      can_tcp_wire_get_control(&cf));
+
+		ASSERT_INT_EQ(0, (int)can_tcp_wire_decode_filter(out, &n, &cf,
+				buffer + rc, size - rc - 1));
+		ASSERT_INT_EQ(16, (int)can_tcp_wire_decode_filter(out, &n, &cf,
+				buffer + rc, size - rc));
+		ASSERT_INT_EQ(2, (int)n);
+		ASSERT_INT_EQ((int)filter[1].can_id, (int)out[1].can_id);
+		ASSERT_INT_EQ((int)filter[1].can_mask, (int)out[1].can_mask);
+	}
+
+	struct can_filter many[CAN_TCP_WIRE_MAX_FILTERS + 1];
+	ASSERT_INT_EQ(-1, (int)can_tcp_wire_encode_filter(buffer, many,
+			CAN_TCP_WIRE_MAX_FILTERS + 1, 0));
+
+	return 0;
+}
+
+static int test_filter_match()
+{
+	struct can_filter filter[2] = {
+		{ .can_id = 0x80, .can_mask = 0x780 },
+		{ .can_id = 0x700, .can_mask = 0x780 },
+	};
+
+	ASSERT_TRUE(can_tcp_wire_filter_match(filter, 0, 0x181));
+	ASSERT_TRUE(can_tcp_wire_filter_match(filter, 2, 0x85));
+	ASSERT_TRUE(can_tcp_wire_filter_match(filter, 2, 0x77f));
+	ASSERT_FALSE(can_tcp_wire_filter_match(filter, 2, 0x181));
+	ASSERT_FALSE(can_tcp_wire_filter_match(filter, 2, 0x585));
+
+	struct can_filter inverted = { .can_id = 0x181 | CAN_INV_FILTER,
+				       .can_mask = CAN_SFF_MASK };
+	ASSERT_FALSE(can_tcp_wire_filter_match(&inverted, 1, 0x181));
+	ASSERT_TRUE(can_tcp_wire_filter_match(&inverted, 1, 0x182));
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_standard_frames);
+	RUN_TEST(test_flags);
+	RUN_TEST(test_timestamps);
+	RUN_TEST(test_incomplete);
+	RUN_TEST(test_invalid);
+	RUN_TEST(test_control);
+	RUN_TEST(test_filter_round_trip);
+	RUN_TEST(test_filter_match);
+	return r;
+}
@@ -0,0 +1,86 @@
+#include <string.h>
+
+#include "tst.h"
+#include "canopen.h"
+
+static struct canopen_msg msg_;
+
+static int classify(uint32_t cob)
+{
+	struct can_frame cf;
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = cob;
+
+	return canopen_get_object_type(&msg_, &cf);
+}
+
+#define ASSERT_OBJECT(cob, object_, id_) \
+({ \
+	ASSERT_INT_EQ(0, classify(cob)); \
+	ASSERT_INT_EQ(object_, msg_.object); \
+	ASSERT_INT_EQ(id_, msg_.id); \
+})
+
+#define ASSERT_UNSPEC(cob) \
+({ \
+	ASSERT_INT_EQ(-1, classify(cob)); \
+	ASSERT_INT_EQ(CANOPEN_UNSPEC, msg_.object); \
+	ASSERT_INT_EQ(cob, msg_.id); \
+})
+
+static int test_broadcast_objects()
+{
+	ASSERT_OBJECT(0x000, CANOPEN_NMT, 0);
+	ASSERT_OBJECT(0x080, CANOPEN_SYNC, 0);
+	ASSERT_OBJECT(0x100, CANOPEN_TIMESTAMP, 0);
+	return 0;
+}
+
+static int test_node_objects()
+{
+	ASSERT_OBJECT(0x081, CANOPEN_EMCY, 1);
+	ASSERT_OBJECT(0x0ff, CANOPEN_EMCY, 127);
+	ASSERT_OBJECT(0x180, CANOPEN_TPDO1, 0);
+	ASSERT_OBJECT(0x1ff, CANOPEN_TPDO1, 127);
+	ASSERT_OBJECT(0x205, CANOPEN_RPDO1, 5);
+	ASSERT_OBJECT(0x285, CANOPEN_TPDO2, 5);
+	ASSERT_OBJECT(0x305, CANOPEN_RPDO2, 5);
+	ASSERT_OBJECT(0x385, CANOPEN_TPDO3, 5);
+	ASSERT_OBJECT(0x405, CANOPEN_RPDO3, 5);
+	ASSERT_OBJECT(0x485, CANOPEN_TPDO4, 5);
+	ASSERT_OBJECT(0x505, CANOPEN_RPDO4, 5);
+	ASSERT_OBJECT(0x585, CANOPEN_TSDO, 5);
+	ASSERT_OBJECT(0x605, CANOPEN_RSDO, 5);
+	ASSERT_OBJECT(0x700, CANOPEN_HEARTBEAT, 0);
+	ASSERT_OBJECT(0x77f, CANOPEN_HEARTBEAT, 127);
+	return 0;
+}
+
+static int test_unspecified()
+{
+	ASSERT_UNSPEC(0x001);
+	ASSERT_UNSPEC(0x07f);
+	ASSERT_UNSPEC(0x101);
+	ASSERT_UNSPEC(0x17f);
+	ASSERT_UNSPEC(0x680);
+	ASSERT_UNSPEC(0x6ff);
+	ASSERT_UNSPEC(0x7e5);
+	return 0;
+}
+
+static int test_flags_are_ignored()
+{
+	ASSERT_OBJECT(0x185 | CAN_RTR_FLAG, CANOPEN_TPDO1, 5);
+	ASSERT_OBJECT(0x705 | CAN_EFF_FLAG, CANOPEN_HEARTBEAT, 5);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_broadcast_objects);
+	RUN_TEST(test_node_objects);
+	RUN_TEST(test_unspecified);
+	RUN_TEST(test_flags_are_ignored);
+	return r;
+}
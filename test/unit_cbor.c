@@ -0,0 +1,111 @@
+#include <string.h>
+
+#include "tst.h"
+#include "cbor.h"
+
+static struct cbor cbor;
+
+static void begin(void)
+{
+	cbor_init(&cbor, 4);
+}
+
+static int is_encoded(const void* expected, size_t size)
+{
+	int rc = !cbor.is_bad && cbor.vector.index == size
+	      && memcmp(cbor.vector.data, expected, size) == 0;
+	cbor_destroy(&cbor);
+	return rc;
+}
+
+#define ASSERT_ENCODED(...) \
+({ \
+	static const unsigned char expected_[] = { __VA_ARGS__ }; \
+	ASSERT_TRUE(is_encoded(expected_, sizeof(expected_))); \
+})
+
+static int test_uint()
+{
+	begin(); cbor_put_uint(&cbor, 0); ASSERT_ENCODED(0x00);
+	begin(); cbor_put_uint(&cbor, 23); ASSERT_ENCODED(0x17);
+	begin(); cbor_put_uint(&cbor, 24); ASSERT_ENCODED(0x18, 0x18);
+	begin(); cbor_put_uint(&cbor, 1000); ASSERT_ENCODED(0x19, 0x03, 0xe8);
+	begin(); cbor_put_uint(&cbor, 1000000);
+	ASSERT_ENCODED(0x1a, 0x00, 0x0f, 0x42, 0x40);
+	begin(); cbor_put_uint(&cbor, 1000000000000ULL);
+	ASSERT_ENCODED(0x1b, 0x00, 0x00, 0x00, 0xe8, 0xd4, 0xa5, 0x10, 0x00);
+	return 0;
+}
+
+static int test_int()
+{
+	begin(); cbor_put_int(&cbor, 10); ASSERT_ENCODED(0x0a);
+	begin(); cbor_put_int(&cbor, -1); ASSERT_ENCODED(0x20);
+	begin(); cbor_put_int(&cbor, -100); ASSERT_ENCODED(0x38, 0x63);
+	begin(); cbor_put_int(&cbor, -1000); ASSERT_ENCODED(0x39, 0x03, 0xe7);
+	begin(); cbor_put_int(&cbor, INT64_MIN);
+	ASSERT_ENCODED(0x3b, 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff);
+	return 0;
+}
+
+static int test_simple()
+{
+	begin(); cbor_put_bool(&cbor, 0); ASSERT_ENCODED(0xf4);
+	begin(); cbor_put_bool(&cbor, 1); ASSERT_ENCODED(0xf5);
+	begin(); cbor_put_null(&cbor); ASSERT_ENCODED(0xf6);
+	return 0;
+}
+
+static int test_float()
+{
+	begin(); cbor_put_float(&cbor, 100000.0f);
+	ASSERT_ENCODED(0xfa, 0x47, 0xc3, 0x50, 0x00);
+	begin(); cbor_put_double(&cbor, 1.1);
+	ASSERT_ENCODED(0xfb, 0x3f, 0xf1, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a);
+	return 0;
+}
+
+static int test_strings()
+{
+	begin(); cbor_put_string(&cbor, ""); ASSERT_ENCODED(0x60);
+	begin(); cbor_put_string(&cbor, "IETF");
+	ASSERT_ENCODED(0x64, 0x49, 0x45, 0x54, 0x46);
+	begin(); cbor_put_bytes(&cbor, "\x01\x02\x03\x04", 4);
+	ASSERT_ENCODED(0x44, 0x01, 0x02, 0x03, 0x04);
+	return 0;
+}
+
+static int test_containers()
+{
+	begin();
+	cbor_put_map(&cbor, 2);
+	cbor_put_string(&cbor, "a");
+	cbor_put_uint(&cbor, 1);
+	cbor_put_string(&cbor, "b");
+	cbor_put_array(&cbor, 2);
+	cbor_put_uint(&cbor, 2);
+	cbor_put_uint(&cbor, 3);
+	ASSERT_ENCODED(0xa2, 0x61, 0x61, 0x01, 0x61, 0x62, 0x82, 0x02, 0x03);
+
+	begin();
+	cbor_begin_map(&cbor);
+	cbor_put_string(&cbor, "a");
+	cbor_begin_array(&cbor);
+	cbor_put_uint(&cbor, 1);
+	cbor_put_break(&cbor);
+	cbor_put_break(&cbor);
+	ASSERT_ENCODED(0xbf, 0x61, 0x61, 0x9f, 0x01, 0xff, 0xff);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_uint);
+	RUN_TEST(test_int);
+	RUN_TEST(test_simple);
+	RUN_TEST(test_float);
+	RUN_TEST(test_strings);
+	RUN_TEST(test_containers);
+	return r;
+}
@@ -1,3 +1,6 @@
+#include <unistd.h>
+#include <stdlib.h>
+
 #include "tst.h"
 #include "cfg.h"
 #include "canopen/master.h"
@@ -18,13 +21,8 @@ static int test_priority_order(void)
 	"a=6\n"
 	"";
 
-	struct co_master_node* node;
-
-	node = co_master_get_node(23);
-	strcpy(node->name, "foobar");
-
-	node = co_master_get_node(42);
-	strcpy(node->name, "mynode");
+	strcpy(co_master_get_ident(23)->name, "foobar");
+	strcpy(co_master_get_ident(42)->name, "mynode");
 
 	FILE* stream = fmemopen((void*)text, strlen(text) + 1, "r");
 	cfg__load_stream(stream);
@@ -42,9 +40,116 @@ static int test_priority_order(void)
 	return 0;
 }
 
+static int write_file(const char* path, const char* text)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return -1;
+
+	fputs(text, file);
+	fclose(file);
+	return 0;
+}
+
+static int test_reload(void)
+{
+	char path[] = "/tmp/unit_cfg_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_INT_GE(0, fd);
+	close(fd);
+
+	ASSERT_INT_EQ(0, write_file(path,
+		"[master]\n"
+		"iface=can0\n"
+		"sync_interval=1000\n"
+		"[#42]\n"
+		"heartbeat_period=500\n"));
+
+	cfg_load_defaults();
+	ASSERT_INT_EQ(0, cfg_load_file(path));
+	cfg_load_globals();
+	cfg_load_node(42);
+
+	ASSERT_STR_EQ("can0", cfg.iface);
+	ASSERT_INT_EQ(1000, cfg.sync_interval);
+	ASSERT_INT_EQ(500, cfg.node[42].heartbeat_period);
+
+	ASSERT_INT_EQ(0, write_file(path,
+		"[master]\n"
+		"iface=can1\n"
+		"sync_interval=2000\n"
+		"[#42]\n"
+		"heartbeat_period=250\n"
+		"enable_node_guarding=no\n"));
+
+	static struct cfg old;
+	ASSERT_INT_EQ(0, cfg_reload_file(&old));
+
+	ASSERT_INT_EQ(1000, old.sync_interval);
+	ASSERT_INT_EQ(2000, cfg.sync_interval);
+
+	/* Needs a restart */
+	ASSERT_STR_EQ("can0", cfg.iface);
+
+	/* Nodes are reloaded by the caller */
+	ASSERT_INT_EQ(500, cfg.node[42].heartbeat_period);
+	cfg_load_node(42);
+	ASSERT_INT_EQ(250, cfg.node[42].heartbeat_period);
+	ASSERT_FALSE(cfg.node[42].enable_node_guarding);
+	ASSERT_TRUE(old.node[42].enable_node_guarding);
+
+	/* A file that can't be read leaves everything as it was */
+	unlink(path);
+	ASSERT_INT_EQ(-1, cfg_reload_file(&old));
+	ASSERT_INT_EQ(2000, cfg.sync_interval);
+	ASSERT_STR_EQ("250", cfg__file_read(42, "heartbeat_period"));
+
+	cfg_unload_file();
+	return 0;
+}
+
+static int test_reload_defaults_and_kept(void)
+{
+	char path[] = "/tmp/unit_cfg_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_INT_GE(0, fd);
+	close(fd);
+
+	ASSERT_INT_EQ(0, write_file(path,
+		"[master]\n"
+		"sync_interval=1000\n"
+		"heartbeat_period=100\n"));
+
+	cfg_load_defaults();
+	ASSERT_INT_EQ(0, cfg_load_file(path));
+	cfg_load_globals();
+
+	/* As with -p */
+	cfg.heartbeat_period = 300;
+	cfg_keep_on_reload(CFG_RELOADABLE_heartbeat_period);
+
+	ASSERT_INT_EQ(0, write_file(path,
+		"[master]\n"
+		"heartbeat_period=200\n"));
+
+	static struct cfg old;
+	ASSERT_INT_EQ(0, cfg_reload_file(&old));
+
+	/* Gone from the file */
+	ASSERT_INT_EQ(0, cfg.sync_interval);
+
+	ASSERT_INT_EQ(300, cfg.heartbeat_period);
+
+	unlink(path);
+	cfg_unload_file();
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
 	RUN_TEST(test_priority_order);
+	RUN_TEST(test_reload);
+	RUN_TEST(test_reload_defaults_and_kept);
 	return r;
 }
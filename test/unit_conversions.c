@@ -1,5 +1,8 @@
+#include <string.h>
+
 #include "tst.h"
 #include "conversions.h"
+#include "cbor.h"
 
 static int test_bool_tostring()
 {
@@ -152,6 +155,56 @@ static int test_string_tostring()
 	return 0;
 }
 
+static int is_cbor(struct canopen_data* data, const void* expected,
+		   size_t size)
+{
+	struct cbor cbor;
+	cbor_init(&cbor, 16);
+
+	int rc = canopen_data_tocbor(&cbor, data) == 0
+	      && cbor.vector.index == size
+	      && memcmp(cbor.vector.data, expected, size) == 0;
+
+	cbor_destroy(&cbor);
+	return rc;
+}
+
+static int test_int_tocbor()
+{
+	unsigned char value[] = { 0x18, 0xfc };
+	struct canopen_data data = {
+		.type = CANOPEN_INTEGER16,
+		.data = value,
+		.size = 2
+	};
+	ASSERT_TRUE(is_cbor(&data, "\x39\x03\xe7", 3));
+
+	data.type = CANOPEN_UNSIGNED16;
+	ASSERT_TRUE(is_cbor(&data, "\x19\xfc\x18", 3));
+
+	data.type = CANOPEN_UNSIGNED8;
+	struct cbor cbor;
+	cbor_init(&cbor, 16);
+	ASSERT_INT_EQ(-1, canopen_data_tocbor(&cbor, &data));
+	ASSERT_UINT_EQ(0, cbor.vector.index);
+	cbor_destroy(&cbor);
+	return 0;
+}
+
+static int test_string_tocbor()
+{
+	struct canopen_data data = {
+		.type = CANOPEN_VISIBLE_STRING,
+		.data = "foo",
+		.size = 3
+	};
+	ASSERT_TRUE(is_cbor(&data, "\x63" "foo", 4));
+
+	data.type = CANOPEN_OCTET_STRING;
+	ASSERT_TRUE(is_cbor(&data, "\x43" "foo", 4));
+	return 0;
+}
+
 static int test_bool_fromstring()
 {
 	struct canopen_data data;
@@ -192,6 +245,94 @@ static int test_int_fromstring()
 	return 0;
 }
 
+static int test_int_tostring__limits()
+{
+	char buf[32];
+	int64_t value = INT64_MIN;
+	struct canopen_data data = {
+		.type = CANOPEN_INTEGER64,
+		.data = &value,
+		.size = sizeof(value)
+	};
+
+	ASSERT_STR_EQ("-9223372036854775808",
+		      canopen_data_tostring(buf, sizeof(buf), &data));
+
+	uint64_t uvalue = UINT64_MAX;
+	data.type = CANOPEN_UNSIGNED64;
+	data.data = &uvalue;
+	ASSERT_STR_EQ("18446744073709551615",
+		      canopen_data_tostring(buf, sizeof(buf), &data));
+
+	uvalue = 0;
+	ASSERT_STR_EQ("0", canopen_data_tostring(buf, sizeof(buf), &data));
+
+	uvalue = 1234567;
+	ASSERT_STR_EQ("1234", canopen_data_tostring(buf, 5, &data));
+	return 0;
+}
+
+static int test_int_fromstring__bases()
+{
+	struct canopen_data data;
+
+	ASSERT_INT_EQ(0, canopen_data_fromstring(&data, CANOPEN_UNSIGNED32,
+							"0x1A2b"));
+	ASSERT_INT_EQ(0x1a2b, *(uint32_t*)data.data);
+
+	ASSERT_INT_EQ(0, canopen_data_fromstring(&data, CANOPEN_UNSIGNED32,
+							"010"));
+	ASSERT_INT_EQ(8, *(uint32_t*)data.data);
+
+	ASSERT_INT_EQ(0, canopen_data_fromstring(&data, CANOPEN_UNSIGNED32,
+							"+7"));
+	ASSERT_INT_EQ(7, *(uint32_t*)data.data);
+
+	ASSERT_INT_EQ(0, canopen_data_fromstring(&data, CANOPEN_INTEGER16,
+							"-0x10"));
+	ASSERT_INT_EQ(-16, *(int16_t*)data.data);
+
+	ASSERT_INT_LT(0, canopen_data_fromstring(&data, CANOPEN_UNSIGNED32,
+							"0x"));
+	ASSERT_INT_LT(0, canopen_data_fromstring(&data, CANOPEN_UNSIGNED32,
+							"08"));
+	ASSERT_INT_LT(0, canopen_data_fromstring(&data, CANOPEN_INTEGER32,
+							"-+1"));
+	ASSERT_INT_LT(0, canopen_data_fromstring(&data, CANOPEN_INTEGER32,
+							"-"));
+	ASSERT_INT_LT(0, canopen_data_fromstring(&data, CANOPEN_INTEGER32,
+							""));
+	ASSERT_INT_LT(0, canopen_data_fromstring(&data, CANOPEN_INTEGER32,
+							"12 "));
+	return 0;
+}
+
+static int test_int_fromstring__limits()
+{
+	struct canopen_data data;
+
+	ASSERT_INT_EQ(0, canopen_data_fromstring(&data, CANOPEN_UNSIGNED64,
+						 "18446744073709551615"));
+	ASSERT_TRUE(*(uint64_t*)data.data == UINT64_MAX);
+
+	ASSERT_INT_EQ(0, canopen_data_fromstring(&data, CANOPEN_UNSIGNED64,
+						 "99999999999999999999"));
+	ASSERT_TRUE(*(uint64_t*)data.data == UINT64_MAX);
+
+	ASSERT_INT_EQ(0, canopen_data_fromstring(&data, CANOPEN_INTEGER64,
+						 "-9223372036854775808"));
+	ASSERT_TRUE(*(int64_t*)data.data == INT64_MIN);
+
+	ASSERT_INT_EQ(0, canopen_data_fromstring(&data, CANOPEN_INTEGER64,
+						 "-9223372036854775809"));
+	ASSERT_TRUE(*(int64_t*)data.data == INT64_MIN);
+
+	ASSERT_INT_EQ(0, canopen_data_fromstring(&data, CANOPEN_INTEGER64,
+						 "9223372036854775808"));
+	ASSERT_TRUE(*(int64_t*)data.data == INT64_MAX);
+	return 0;
+}
+
 static int test_float_fromstring()
 {
 	struct canopen_data data;
@@ -232,10 +373,15 @@ int main()
 	RUN_TEST(test_float_tostring);
 	RUN_TEST(test_double_tostring);
 	RUN_TEST(test_string_tostring);
+	RUN_TEST(test_int_tostring__limits);
+	RUN_TEST(test_int_tocbor);
+	RUN_TEST(test_string_tocbor);
 
 	RUN_TEST(test_bool_fromstring);
 	RUN_TEST(test_uint_fromstring);
 	RUN_TEST(test_int_fromstring);
+	RUN_TEST(test_int_fromstring__bases);
+	RUN_TEST(test_int_fromstring__limits);
 	RUN_TEST(test_float_fromstring);
 	RUN_TEST(test_double_fromstring);
 	return r;
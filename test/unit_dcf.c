@@ -0,0 +1,309 @@
+#include "tst.h"
+#include "canopen/dcf.h"
+#include "canopen/sdo_batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* 0x1017:0 = 1000 and 0x2000:1 = "abc" */
+static const uint8_t concise[] = {
+	2, 0, 0, 0,
+	0x17, 0x10, 0, 2, 0, 0, 0, 0xe8, 0x03,
+	0x00, 0x20, 1, 3, 0, 0, 0, 'a', 'b', 'c',
+};
+
+static int test_crc32(void)
+{
+	ASSERT_UINT_EQ(0xcbf43926, co_dcf_crc32(0, "123456789", 9));
+
+	/* It can be computed in parts */
+	uint32_t crc = co_dcf_crc32(0, "1234", 4);
+	ASSERT_UINT_EQ(0xcbf43926, co_dcf_crc32(crc, "56789", 5));
+	return 0;
+}
+
+static int test_parse(void)
+{
+	struct co_dcf dcf;
+	ASSERT_INT_EQ(0, co_dcf_parse(&dcf, concise, sizeof(concise)));
+	ASSERT_UINT_EQ(2, dcf.n_entries);
+	ASSERT_UINT_EQ(co_dcf_crc32(0, concise, sizeof(concise)), dcf.checksum);
+
+	size_t pos = 0;
+	struct co_dcf_entry entry;
+
+	ASSERT_INT_EQ(0, co_dcf_next(&dcf, &pos, &entry));
+	ASSERT_INT_EQ(0x1017, entry.index);
+	ASSERT_INT_EQ(0, entry.subindex);
+	ASSERT_UINT_EQ(2, entry.size);
+	ASSERT_INT_EQ(0xe8, entry.data[0]);
+
+	ASSERT_INT_EQ(0, co_dcf_next(&dcf, &pos, &entry));
+	ASSERT_INT_EQ(0x2000, entry.index);
+	ASSERT_INT_EQ(1, entry.subindex);
+	ASSERT_UINT_EQ(3, entry.size);
+	ASSERT_INT_EQ(0, memcmp(entry.data, "abc", 3));
+
+	ASSERT_INT_EQ(-1, co_dcf_next(&dcf, &pos, &entry));
+
+	co_dcf_destroy(&dcf);
+	return 0;
+}
+
+static int test_parse_invalid(void)
+{
+	struct co_dcf dcf;
+	uint8_t data[sizeof(concise) + 1];
+
+	ASSERT_INT_EQ(-1, co_dcf_parse(&dcf, concise, 3));
+
+	/* Truncated */
+	ASSERT_INT_EQ(-1, co_dcf_parse(&dcf, concise, sizeof(concise) - 1));
+
+	/* Trailing garbage */
+	memcpy(data, concise, sizeof(concise));
+	ASSERT_INT_EQ(-1, co_dcf_parse(&dcf, data, sizeof(data)));
+
+	/* Too many entries */
+	data[0] = 3;
+	ASSERT_INT_EQ(-1, co_dcf_parse(&dcf, data, sizeof(concise)));
+
+	/* An empty DCF is fine */
+	static const uint8_t empty[] = { 0, 0, 0, 0 };
+	ASSERT_INT_EQ(0, co_dcf_parse(&dcf, empty, sizeof(empty)));
+	ASSERT_UINT_EQ(0, dcf.n_entries);
+	co_dcf_destroy(&dcf);
+	return 0;
+}
+
+static int test_load(void)
+{
+	char path[] = "/tmp/unit_dcf_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_TRUE(fd >= 0);
+
+	FILE* stream = fdopen(fd, "wb");
+	fwrite(concise, 1, sizeof(concise), stream);
+	fclose(stream);
+
+	struct co_dcf dcf;
+	ASSERT_INT_EQ(0, co_dcf_load(&dcf, path));
+	ASSERT_UINT_EQ(sizeof(concise), dcf.size);
+	ASSERT_UINT_EQ(2, dcf.n_entries);
+	co_dcf_destroy(&dcf);
+
+	unlink(path);
+	ASSERT_INT_EQ(-1, co_dcf_load(&dcf, path));
+	return 0;
+}
+
+static uint32_t get_u32(const struct sdo_batch_item* item)
+{
+	const uint8_t* p = item->data.data;
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int test_downloads(void)
+{
+	struct co_dcf dcf;
+	ASSERT_INT_EQ(0, co_dcf_parse(&dcf, concise, sizeof(concise)));
+
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	ASSERT_INT_EQ(0, co_dcf_add_downloads(&dcf, batch, 0, 5));
+	ASSERT_UINT_EQ(2, batch->n_items);
+	ASSERT_INT_EQ(0x1017, sdo_batch_get_item(batch, 0)->index);
+	ASSERT_INT_EQ(0x2000, sdo_batch_get_item(batch, 1)->index);
+	ASSERT_UINT_EQ(3, sdo_batch_get_item(batch, 1)->data.index);
+	sdo_batch_unref(batch);
+
+	/* The checksum is cleared first and set last */
+	batch = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	ASSERT_INT_EQ(0, co_dcf_add_downloads(&dcf, batch, CO_DCF_VERIFY, 5));
+	ASSERT_UINT_EQ(5, batch->n_items);
+
+	const struct sdo_batch_item* item = sdo_batch_get_item(batch, 0);
+	ASSERT_INT_EQ(CO_DCF_VERIFY_INDEX, item->index);
+	ASSERT_INT_EQ(1, item->subindex);
+	ASSERT_UINT_EQ(0, get_u32(item));
+
+	item = sdo_batch_get_item(batch, 3);
+	ASSERT_INT_EQ(2, item->subindex);
+	ASSERT_UINT_EQ(sizeof(concise), get_u32(item));
+
+	item = sdo_batch_get_item(batch, 4);
+	ASSERT_INT_EQ(1, item->subindex);
+	ASSERT_UINT_EQ(dcf.checksum, get_u32(item));
+	sdo_batch_unref(batch);
+
+	/* All of it in one download to 0x1F22 */
+	batch = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	ASSERT_INT_EQ(0, co_dcf_add_downloads(&dcf, batch, CO_DCF_OBJECT, 5));
+	ASSERT_UINT_EQ(1, batch->n_items);
+	item = sdo_batch_get_item(batch, 0);
+	ASSERT_INT_EQ(CO_DCF_OBJECT_INDEX, item->index);
+	ASSERT_INT_EQ(5, item->subindex);
+	ASSERT_UINT_EQ(sizeof(concise), item->data.index);
+	ASSERT_INT_EQ(0, memcmp(concise, item->data.data, sizeof(concise)));
+	sdo_batch_unref(batch);
+
+	co_dcf_destroy(&dcf);
+	return 0;
+}
+
+static void set_result(struct sdo_batch* batch, size_t i,
+		       enum sdo_req_status status, uint32_t value)
+{
+	uint8_t data[4] = { value, value >> 8, value >> 16, value >> 24 };
+	batch->items[i].status = status;
+	vector_assign(&batch->items[i].data, data, sizeof(data));
+}
+
+static int test_verify(void)
+{
+	struct co_dcf dcf;
+	ASSERT_INT_EQ(0, co_dcf_parse(&dcf, concise, sizeof(concise)));
+
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	ASSERT_INT_EQ(0, co_dcf_add_verify_uploads(batch));
+	ASSERT_UINT_EQ(2, batch->n_items);
+
+	set_result(batch, 0, SDO_REQ_OK, dcf.checksum);
+	set_result(batch, 1, SDO_REQ_OK, dcf.size);
+	ASSERT_INT_EQ(1, co_dcf_is_verified(&dcf, batch));
+
+	set_result(batch, 0, SDO_REQ_OK, dcf.checksum ^ 1);
+	ASSERT_INT_EQ(0, co_dcf_is_verified(&dcf, batch));
+
+	set_result(batch, 0, SDO_REQ_OK, dcf.checksum);
+	set_result(batch, 1, SDO_REQ_OK, dcf.size + 1);
+	ASSERT_INT_EQ(0, co_dcf_is_verified(&dcf, batch));
+
+	set_result(batch, 0, SDO_REQ_REMOTE_ABORT, 0);
+	ASSERT_INT_EQ(-1, co_dcf_is_verified(&dcf, batch));
+
+	sdo_batch_unref(batch);
+	co_dcf_destroy(&dcf);
+	return 0;
+}
+
+static void add_upload(struct sdo_batch* batch, int index, int subindex,
+		       const void* data, size_t size)
+{
+	sdo_batch_add_upload(batch, index, subindex);
+	struct sdo_batch_item* item = &batch->items[batch->n_items - 1];
+	item->status = SDO_REQ_OK;
+	vector_assign(&item->data, data, size);
+}
+
+static int test_snapshot(void)
+{
+	struct sdo_batch* uploads = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+
+	add_upload(uploads, 0x1017, 0, "\xe8\x03", 2);
+	sdo_batch_add_upload(uploads, 0x1018, 1);
+	uploads->items[1].status = SDO_REQ_REMOTE_ABORT;
+	add_upload(uploads, 0x2000, 1, "abc", 3);
+
+	/* Only the uploads that succeeded are in the snapshot */
+	struct co_dcf dcf;
+	ASSERT_INT_EQ(0, co_dcf_from_uploads(&dcf, uploads));
+	ASSERT_UINT_EQ(sizeof(concise), dcf.size);
+	ASSERT_INT_EQ(0, memcmp(concise, dcf.data, sizeof(concise)));
+	sdo_batch_unref(uploads);
+
+	struct sdo_batch* current = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	ASSERT_INT_EQ(0, co_dcf_add_entry_uploads(&dcf, current));
+	ASSERT_UINT_EQ(2, current->n_items);
+	ASSERT_INT_EQ(0x2000, current->items[1].index);
+
+	/* Nothing differs */
+	current->items[0].status = SDO_REQ_OK;
+	vector_assign(&current->items[0].data, "\xe8\x03", 2);
+	current->items[1].status = SDO_REQ_OK;
+	vector_assign(&current->items[1].data, "abc", 3);
+
+	struct sdo_batch* downloads = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	ASSERT_INT_EQ(0, co_dcf_add_changed_downloads(&dcf, current,
+						      downloads));
+	ASSERT_UINT_EQ(0, downloads->n_items);
+
+	/* A different value and one that could not be read */
+	vector_assign(&current->items[0].data, "\xe9\x03", 2);
+	current->items[1].status = SDO_REQ_REMOTE_ABORT;
+
+	ASSERT_INT_EQ(2, co_dcf_add_changed_downloads(&dcf, current,
+						      downloads));
+	ASSERT_UINT_EQ(2, downloads->n_items);
+	ASSERT_INT_EQ(0x1017, downloads->items[0].index);
+	ASSERT_INT_EQ(0xe8, ((uint8_t*)downloads->items[0].data.data)[0]);
+	ASSERT_INT_EQ(0x2000, downloads->items[1].index);
+
+	sdo_batch_unref(downloads);
+	sdo_batch_unref(current);
+	co_dcf_destroy(&dcf);
+	return 0;
+}
+
+static int test_snapshot_pdo(void)
+{
+	struct sdo_batch* uploads = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+
+	add_upload(uploads, 0x1800, 1, "\x85\x01\x00\x00", 4);
+	add_upload(uploads, 0x1800, 2, "\xff", 1);
+	add_upload(uploads, 0x1a00, 0, "\x02", 1);
+	add_upload(uploads, 0x1a00, 1, "\x10\x00\x00\x60", 4);
+	add_upload(uploads, 0x1a00, 2, "\x10\x00\x41\x60", 4);
+
+	struct co_dcf dcf;
+	ASSERT_INT_EQ(0, co_dcf_from_uploads(&dcf, uploads));
+
+	/* The node has another mapping and transmission type */
+	vector_assign(&uploads->items[1].data, "\x01", 1);
+	vector_assign(&uploads->items[4].data, "\x20\x00\x41\x60", 4);
+
+	struct sdo_batch* downloads = sdo_batch_new(SDO_REQ_PRIO_CONFIG, 0);
+	ASSERT_INT_EQ(2, co_dcf_add_changed_downloads(&dcf, uploads,
+						      downloads));
+	ASSERT_UINT_EQ(6, downloads->n_items);
+
+	/* The COB-ID is invalid while the PDO is changed */
+	const struct sdo_batch_item* item = &downloads->items[0];
+	ASSERT_INT_EQ(0x1800, item->index);
+	ASSERT_INT_EQ(1, item->subindex);
+	ASSERT_INT_EQ(0x80, ((uint8_t*)item->data.data)[3]);
+	ASSERT_INT_EQ(2, downloads->items[1].subindex);
+	item = &downloads->items[2];
+	ASSERT_INT_EQ(1, item->subindex);
+	ASSERT_INT_EQ(0x00, ((uint8_t*)item->data.data)[3]);
+
+	/* And the mapping is empty while it is changed */
+	item = &downloads->items[3];
+	ASSERT_INT_EQ(0x1a00, item->index);
+	ASSERT_INT_EQ(0, item->subindex);
+	ASSERT_INT_EQ(0, ((uint8_t*)item->data.data)[0]);
+	ASSERT_INT_EQ(2, downloads->items[4].subindex);
+	item = &downloads->items[5];
+	ASSERT_INT_EQ(0, item->subindex);
+	ASSERT_INT_EQ(2, ((uint8_t*)item->data.data)[0]);
+
+	sdo_batch_unref(downloads);
+	sdo_batch_unref(uploads);
+	co_dcf_destroy(&dcf);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_crc32);
+	RUN_TEST(test_parse);
+	RUN_TEST(test_parse_invalid);
+	RUN_TEST(test_load);
+	RUN_TEST(test_downloads);
+	RUN_TEST(test_verify);
+	RUN_TEST(test_snapshot);
+	RUN_TEST(test_snapshot_pdo);
+	return r;
+}
@@ -0,0 +1,149 @@
+#include "tst.h"
+#include "fff.h"
+#include "canopen/master.h"
+
+#include <string.h>
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VOID_FUNC(co__update_filters, int);
+FAKE_VALUE_FUNC(int, co__send_pdo, uint32_t, const void*, size_t);
+
+static void on_pdo(struct co_drv* drv, const void* data, size_t size,
+		   uint64_t timestamp)
+{
+	(void)drv;
+	(void)data;
+	(void)size;
+	(void)timestamp;
+}
+
+static struct co_drv* get_drv(int nodeid)
+{
+	struct co_drv* drv = &co_master_get_node(nodeid)->ndrv;
+	memset(drv, 0, sizeof(*drv));
+	return drv;
+}
+
+static int test_predefined_tpdo(void)
+{
+	struct co_drv* drv = get_drv(5);
+
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 2, 0, on_pdo));
+	ASSERT_PTR_EQ(on_pdo, drv->pdo2_ts_fn);
+	ASSERT_UINT_EQ(0, drv->n_tpdos);
+
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 3, R_TPDO3 + 5, on_pdo));
+	ASSERT_PTR_EQ(on_pdo, drv->pdo3_ts_fn);
+	ASSERT_UINT_EQ(0, drv->n_tpdos);
+
+	/* Beyond 4 there is no predefined COB-ID */
+	ASSERT_INT_EQ(-1, co_set_tpdo_fn(drv, 5, 0, on_pdo));
+	ASSERT_INT_EQ(-1, co_set_tpdo_fn(drv, CO_PDO_MAX + 1, 0x300, on_pdo));
+	ASSERT_INT_EQ(-1, co_set_tpdo_fn(drv, 5, 0x800, on_pdo));
+
+	co_drv_unload(drv);
+	return 0;
+}
+
+static int test_tpdo_table(void)
+{
+	struct co_drv* drv = get_drv(5);
+
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 5, 0x385, on_pdo));
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 16, 0x3f5, on_pdo));
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 1, 0x190, on_pdo));
+	ASSERT_UINT_EQ(3, drv->n_tpdos);
+	ASSERT_TRUE(drv->pdo1_ts_fn == NULL);
+
+	/* Moving a PDO keeps one entry */
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 5, 0x386, on_pdo));
+	ASSERT_UINT_EQ(3, drv->n_tpdos);
+	ASSERT_UINT_EQ(0x386, drv->tpdo[0].cob_id);
+
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 5, 0x386, NULL));
+	ASSERT_UINT_EQ(2, drv->n_tpdos);
+	ASSERT_INT_EQ(16, drv->tpdo[1].n);
+
+	/* Back on the predefined COB-ID */
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 1, 0, on_pdo));
+	ASSERT_UINT_EQ(1, drv->n_tpdos);
+	ASSERT_INT_EQ(16, drv->tpdo[0].n);
+	ASSERT_PTR_EQ(on_pdo, drv->pdo1_ts_fn);
+
+	co_drv_unload(drv);
+	return 0;
+}
+
+static int test_rpdo(void)
+{
+	struct co_drv* drv = get_drv(5);
+	const char data[] = "abc";
+
+	RESET_FAKE(co__send_pdo);
+
+	ASSERT_INT_EQ(0, co_rpdo(drv, 2, data, 3));
+	ASSERT_UINT_EQ(R_RPDO2 + 5, co__send_pdo_fake.arg0_val);
+
+	ASSERT_INT_EQ(-1, co_rpdo(drv, 7, data, 3));
+	ASSERT_UINT_EQ(1, co__send_pdo_fake.call_count);
+
+	ASSERT_INT_EQ(0, co_set_rpdo_cob_id(drv, 7, 0x4a5));
+	ASSERT_INT_EQ(0, co_rpdo(drv, 7, data, 3));
+	ASSERT_UINT_EQ(0x4a5, co__send_pdo_fake.arg0_val);
+	ASSERT_UINT_EQ(3, co__send_pdo_fake.arg2_val);
+
+	ASSERT_INT_EQ(0, co_set_rpdo_cob_id(drv, 2, 0x4a6));
+	ASSERT_INT_EQ(0, co_rpdo(drv, 2, data, 3));
+	ASSERT_UINT_EQ(0x4a6, co__send_pdo_fake.arg0_val);
+
+	ASSERT_INT_EQ(0, co_set_rpdo_cob_id(drv, 2, 0));
+	ASSERT_INT_EQ(0, co_rpdo(drv, 2, data, 3));
+	ASSERT_UINT_EQ(R_RPDO2 + 5, co__send_pdo_fake.arg0_val);
+
+	co_drv_unload(drv);
+	return 0;
+}
+
+static int test_tpdo_on_change(void)
+{
+	struct co_drv* drv = get_drv(5);
+	struct co_master_node* node = co_master_get_node(5);
+
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 9, 0x389, on_pdo));
+	drv->tpdo[0].last.is_valid = 1;
+	node->tpdo_last[1].is_valid = 1;
+
+	ASSERT_INT_EQ(0, co_set_tpdo_on_change(drv, 9, 1));
+	ASSERT_INT_EQ(0, co_set_tpdo_on_change(drv, 2, 1));
+	ASSERT_TRUE(drv->tpdo_on_change[1] & (1 << 1));
+	ASSERT_TRUE(drv->tpdo_on_change[0] & (1 << 2));
+	ASSERT_FALSE(drv->tpdo[0].last.is_valid);
+	ASSERT_FALSE(node->tpdo_last[1].is_valid);
+
+	ASSERT_INT_EQ(0, co_set_tpdo_on_change(drv, 9, 0));
+	ASSERT_FALSE(drv->tpdo_on_change[1] & (1 << 1));
+	ASSERT_TRUE(drv->tpdo_on_change[0] & (1 << 2));
+
+	ASSERT_INT_EQ(-1, co_set_tpdo_on_change(drv, 0, 1));
+	ASSERT_INT_EQ(-1, co_set_tpdo_on_change(drv, CO_PDO_MAX + 1, 1));
+	ASSERT_INT_EQ(0, co_set_tpdo_on_change(drv, CO_PDO_MAX, 1));
+
+	/* Moving the PDO forgets the last payload */
+	drv->tpdo[0].last.is_valid = 1;
+	ASSERT_INT_EQ(0, co_set_tpdo_fn(drv, 9, 0x38a, on_pdo));
+	ASSERT_FALSE(drv->tpdo[0].last.is_valid);
+
+	co_drv_unload(drv);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_predefined_tpdo);
+	RUN_TEST(test_tpdo_table);
+	RUN_TEST(test_rpdo);
+	RUN_TEST(test_tpdo_on_change);
+	return r;
+}
@@ -0,0 +1,519 @@
+#include "tst.h"
+#include "canopen/master.h"
+#include "canopen/drv_exec.h"
+#include "canopen/drv_cycle.h"
+#include "mloop.h"
+#include "time-utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static const int nodeid = 5;
+
+static int n_calls;
+static pthread_t caller;
+static uint8_t last_data[8];
+static size_t last_size;
+static useconds_t delay;
+static int is_blocked;
+
+static void on_job(struct co_drv* drv, const struct co_drv_job* job)
+{
+	(void)drv;
+
+	while (__atomic_load_n(&is_blocked, __ATOMIC_ACQUIRE))
+		usleep(100);
+
+	if (delay)
+		usleep(delay);
+
+	if (job->data) {
+		memcpy(last_data, job->data, job->size);
+		last_size = job->size;
+	}
+
+	caller = pthread_self();
+	__atomic_add_fetch(&n_calls, 1, __ATOMIC_RELEASE);
+}
+
+static int wait_for_calls(int n)
+{
+	for (int i = 0; i < 1000; ++i) {
+		if (__atomic_load_n(&n_calls, __ATOMIC_ACQUIRE) >= n)
+			return 0;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+static struct co_drv* setup(void)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	memset(&node->ndrv, 0, sizeof(node->ndrv));
+	memset(&node->watchdog, 0, sizeof(node->watchdog));
+
+	n_calls = 0;
+	delay = 0;
+	is_blocked = 0;
+	last_size = 0;
+
+	co_drv_exec_set_default_budget(0);
+
+	return &node->ndrv;
+}
+
+static int test_inline(void)
+{
+	struct co_drv* drv = setup();
+	uint8_t data[] = { 1, 2, 3 };
+
+	struct co_drv_job job = {
+		.fn = on_job,
+		.what = "TPDO1",
+		.data = data,
+		.size = sizeof(data),
+	};
+
+	co_drv_exec_run(drv, &job);
+
+	ASSERT_INT_EQ(1, n_calls);
+	ASSERT_TRUE(pthread_equal(caller, pthread_self()));
+	ASSERT_INT_EQ(3, last_size);
+	return 0;
+}
+
+static int test_watchdog(void)
+{
+	struct co_drv* drv = setup();
+	struct co_master_node* node = co_drv_node(drv);
+
+	struct co_drv_job job = { .fn = on_job, .what = "TPDO1" };
+
+	co_drv_exec_set_default_budget(1000);
+	co_drv_exec_run(drv, &job);
+	ASSERT_INT_EQ(0, node->watchdog.n_overruns);
+
+	delay = 5000;
+	co_drv_exec_run(drv, &job);
+	ASSERT_INT_EQ(1, node->watchdog.n_overruns);
+	ASSERT_TRUE(node->watchdog.max_time >= 5000);
+
+	/* The budget of the driver takes precedence */
+	co_set_callback_budget(drv, 1000000);
+	co_drv_exec_run(drv, &job);
+	ASSERT_INT_EQ(1, node->watchdog.n_overruns);
+
+	/* Inline drivers stay inline */
+	ASSERT_TRUE(drv->exec == NULL);
+	return 0;
+}
+
+static int test_thread(void)
+{
+	struct co_drv* drv = setup();
+	uint8_t data[] = { 1, 2, 3, 4 };
+
+	ASSERT_INT_EQ(0, co_set_exec_mode(drv, CO_EXEC_THREAD));
+	ASSERT_TRUE(drv->exec != NULL);
+
+	struct co_drv_job job = {
+		.fn = on_job,
+		.what = "TPDO1",
+		.data = data,
+		.size = sizeof(data),
+	};
+
+	co_drv_exec_run(drv, &job);
+
+	/* The job has its own copy of the payload */
+	data[0] = 42;
+
+	ASSERT_INT_EQ(0, wait_for_calls(1));
+	ASSERT_FALSE(pthread_equal(caller, pthread_self()));
+	ASSERT_INT_EQ(4, last_size);
+	ASSERT_INT_EQ(1, last_data[0]);
+
+	co_set_exec_mode(drv, CO_EXEC_INLINE);
+	ASSERT_TRUE(drv->exec == NULL);
+
+	co_drv_exec_run(drv, &job);
+	ASSERT_INT_EQ(2, n_calls);
+	ASSERT_TRUE(pthread_equal(caller, pthread_self()));
+	return 0;
+}
+
+static int test_full_queue(void)
+{
+	struct co_drv* drv = setup();
+	struct co_master_node* node = co_drv_node(drv);
+
+	ASSERT_INT_EQ(0, co_set_exec_mode(drv, CO_EXEC_THREAD));
+
+	struct co_drv_job job = { .fn = on_job, .what = "EMCY" };
+
+	is_blocked = 1;
+
+	/* One job is taken off the queue and blocks the thread */
+	for (int i = 0; i < CO_DRV_EXEC_QUEUE_LENGTH + 10; ++i)
+		co_drv_exec_run(drv, &job);
+
+	ASSERT_TRUE(node->watchdog.n_dropped >= 9);
+	ASSERT_TRUE(node->watchdog.n_dropped <= 10);
+
+	__atomic_store_n(&is_blocked, 0, __ATOMIC_RELEASE);
+
+	int n_queued = CO_DRV_EXEC_QUEUE_LENGTH + 10
+		     - node->watchdog.n_dropped;
+	ASSERT_INT_EQ(0, wait_for_calls(n_queued));
+
+	co_drv_exec_stop(drv);
+	ASSERT_TRUE(drv->exec == NULL);
+	return 0;
+}
+
+static int test_auto_demotes(void)
+{
+	struct co_drv* drv = setup();
+	struct co_master_node* node = co_drv_node(drv);
+
+	co_drv_exec_set_default_budget(1000);
+	ASSERT_INT_EQ(0, co_set_exec_mode(drv, CO_EXEC_AUTO));
+	ASSERT_TRUE(drv->exec == NULL);
+
+	struct co_drv_job job = { .fn = on_job, .what = "TPDO2" };
+
+	delay = 2000;
+
+	for (int i = 0; i < CO_DRV_EXEC_DEMOTE_COUNT - 1; ++i)
+		co_drv_exec_run(drv, &job);
+
+	ASSERT_TRUE(drv->exec == NULL);
+
+	co_drv_exec_run(drv, &job);
+	ASSERT_INT_EQ(CO_DRV_EXEC_DEMOTE_COUNT, node->watchdog.n_overruns);
+	ASSERT_TRUE(drv->exec != NULL);
+
+	co_drv_exec_run(drv, &job);
+	ASSERT_INT_EQ(0, wait_for_calls(CO_DRV_EXEC_DEMOTE_COUNT + 1));
+	ASSERT_FALSE(pthread_equal(caller, pthread_self()));
+
+	co_drv_exec_stop(drv);
+	return 0;
+}
+
+static struct co_pdo_frame batch[8];
+static uint8_t batch_data[8][8];
+static size_t batch_size;
+static int n_batches;
+
+static void on_pdo_batch(struct co_drv* drv, const struct co_pdo_frame* frames,
+			 size_t count, unsigned int sync_count)
+{
+	(void)drv;
+	(void)sync_count;
+
+	for (size_t i = 0; i < count && i < 8; ++i) {
+		batch[i] = frames[i];
+		memcpy(batch_data[i], frames[i].data, frames[i].size);
+	}
+
+	batch_size = count;
+	caller = pthread_self();
+	__atomic_add_fetch(&n_batches, 1, __ATOMIC_RELEASE);
+}
+
+static int wait_for_batches(int n)
+{
+	for (int i = 0; i < 1000; ++i) {
+		if (__atomic_load_n(&n_batches, __ATOMIC_ACQUIRE) >= n)
+			return 0;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+static int test_pdo_batch(void)
+{
+	struct co_drv* drv = setup();
+	struct co_master_node* node = co_drv_node(drv);
+
+	node->is_initialized = 1;
+	node->driver_type = CO_MASTER_DRIVER_NEW;
+	n_batches = 0;
+
+	ASSERT_INT_EQ(0, co_set_pdo_batch_fn(drv, on_pdo_batch));
+	co__update_filters(nodeid);
+
+	struct canfd_frame cf[3];
+	uint64_t ts[3] = { 10, 20, 30 };
+	memset(cf, 0, sizeof(cf));
+
+	cf[0].can_id = R_TPDO2 + nodeid;
+	cf[0].len = 2;
+	cf[0].data[0] = 0x22;
+	cf[1].can_id = R_TPDO1 + nodeid + 1;
+	cf[1].len = 1;
+	cf[2].can_id = R_TPDO1 + nodeid;
+	cf[2].len = 1;
+	cf[2].data[0] = 0x11;
+
+	co__mux_on_frames(cf, ts, 3);
+
+	ASSERT_INT_EQ(1, n_batches);
+	ASSERT_INT_EQ(2, batch_size);
+	ASSERT_INT_EQ(2, batch[0].n);
+	ASSERT_UINT_EQ(10, batch[0].timestamp);
+	ASSERT_INT_EQ(2, batch[0].size);
+	ASSERT_INT_EQ(0x22, batch_data[0][0]);
+	ASSERT_INT_EQ(1, batch[1].n);
+	ASSERT_UINT_EQ(30, batch[1].timestamp);
+	ASSERT_INT_EQ(0x11, batch_data[1][0]);
+
+	/* Nothing for the node, no call */
+	co__mux_on_frames(&cf[1], &ts[1], 1);
+	ASSERT_INT_EQ(1, n_batches);
+
+	/* A driver thread gets its own copy of the frames */
+	ASSERT_INT_EQ(0, co_set_exec_mode(drv, CO_EXEC_THREAD));
+	co__mux_on_frames(cf, ts, 3);
+	cf[0].data[0] = 0;
+
+	ASSERT_INT_EQ(0, wait_for_batches(2));
+	ASSERT_FALSE(pthread_equal(caller, pthread_self()));
+	ASSERT_INT_EQ(2, batch_size);
+	ASSERT_INT_EQ(0x22, batch_data[0][0]);
+
+	co_drv_unload(drv);
+	node->driver_type = CO_MASTER_DRIVER_NONE;
+	co__update_filters(nodeid);
+	node->is_initialized = 0;
+	return 0;
+}
+
+static unsigned int cycle_count;
+static int cycle_missing;
+static int n_cycles;
+static pthread_t cycle_caller[2];
+static useconds_t cycle_delay;
+
+static void on_cycle(struct co_drv* drv, unsigned int sync_count,
+		     int n_missing)
+{
+	if (cycle_delay)
+		usleep(cycle_delay);
+
+	cycle_count = sync_count;
+	cycle_missing = n_missing;
+	cycle_caller[co_get_nodeid(drv) == nodeid ? 0 : 1] = pthread_self();
+	__atomic_add_fetch(&n_cycles, 1, __ATOMIC_RELEASE);
+}
+
+static void on_pdo(struct co_drv* drv, const void* data, size_t size)
+{
+	(void)drv;
+	(void)data;
+	(void)size;
+}
+
+static void on_pdo_ts(struct co_drv* drv, const void* data, size_t size,
+		      uint64_t timestamp)
+{
+	(void)drv;
+	(void)data;
+	(void)size;
+	(void)timestamp;
+}
+
+static struct co_drv* setup_cycle(int id)
+{
+	struct co_master_node* node = co_master_get_node(id);
+	memset(&node->ndrv, 0, sizeof(node->ndrv));
+	memset(&node->cycle_watchdog, 0, sizeof(node->cycle_watchdog));
+
+	node->is_initialized = 1;
+	node->driver_type = CO_MASTER_DRIVER_NEW;
+
+	n_cycles = 0;
+	cycle_count = 0;
+	cycle_missing = -1;
+	cycle_delay = 0;
+
+	struct co_drv* drv = &node->ndrv;
+	co_set_cycle_fn(drv, on_cycle, 0);
+	return drv;
+}
+
+static void teardown_cycle(int id)
+{
+	struct co_master_node* node = co_master_get_node(id);
+
+	co_drv_unload(&node->ndrv);
+	node->driver_type = CO_MASTER_DRIVER_NONE;
+	co__update_filters(id);
+	node->is_initialized = 0;
+}
+
+static void receive_tpdo(int type)
+{
+	struct canfd_frame cf = { .can_id = type + nodeid, .len = 1 };
+	uint64_t ts = 0;
+	co__mux_on_frames(&cf, &ts, 1);
+}
+
+static int test_cycle_waits_for_inputs(void)
+{
+	struct co_drv* drv = setup_cycle(nodeid);
+
+	co_set_pdo1_fn(drv, on_pdo);
+	co_set_pdo2_ts_fn(drv, on_pdo_ts);
+	co__update_filters(nodeid);
+
+	co__cycle_begin(7);
+	ASSERT_INT_EQ(0, n_cycles);
+
+	/* Each input counts once */
+	receive_tpdo(R_TPDO1);
+	receive_tpdo(R_TPDO1);
+	ASSERT_INT_EQ(0, n_cycles);
+
+	/* Not an input */
+	receive_tpdo(R_TPDO3);
+	ASSERT_INT_EQ(0, n_cycles);
+
+	receive_tpdo(R_TPDO2);
+	ASSERT_INT_EQ(1, n_cycles);
+	ASSERT_UINT_EQ(7, cycle_count);
+	ASSERT_INT_EQ(0, cycle_missing);
+	ASSERT_TRUE(pthread_equal(cycle_caller[0], pthread_self()));
+
+	/* Once per cycle */
+	receive_tpdo(R_TPDO2);
+	co__cycle_deadline();
+	ASSERT_INT_EQ(1, n_cycles);
+
+	teardown_cycle(nodeid);
+	return 0;
+}
+
+static int test_cycle_deadline(void)
+{
+	struct co_drv* drv = setup_cycle(nodeid);
+
+	co_set_pdo1_fn(drv, on_pdo);
+	co_set_pdo2_fn(drv, on_pdo);
+	co__update_filters(nodeid);
+
+	co__cycle_begin(8);
+	receive_tpdo(R_TPDO2);
+	ASSERT_INT_EQ(0, n_cycles);
+
+	co__cycle_deadline();
+	ASSERT_INT_EQ(1, n_cycles);
+	ASSERT_UINT_EQ(8, cycle_count);
+	ASSERT_INT_EQ(1, cycle_missing);
+
+	/* A cycle that is still waiting when the next begins is run first */
+	co__cycle_begin(9);
+	co__cycle_begin(10);
+	ASSERT_INT_EQ(2, n_cycles);
+	ASSERT_UINT_EQ(9, cycle_count);
+	ASSERT_INT_EQ(2, cycle_missing);
+
+	teardown_cycle(nodeid);
+	return 0;
+}
+
+static int test_cycle_without_inputs(void)
+{
+	setup_cycle(nodeid);
+
+	co__cycle_begin(3);
+	ASSERT_INT_EQ(1, n_cycles);
+	ASSERT_UINT_EQ(3, cycle_count);
+	ASSERT_INT_EQ(0, cycle_missing);
+
+	teardown_cycle(nodeid);
+	return 0;
+}
+
+static int test_cycle_budget(void)
+{
+	struct co_drv* drv = setup_cycle(nodeid);
+	struct co_master_node* node = co_drv_node(drv);
+
+	co_set_cycle_fn(drv, on_cycle, 1000);
+
+	cycle_delay = 5000;
+	co__cycle_begin(4);
+	ASSERT_INT_EQ(1, n_cycles);
+	ASSERT_INT_EQ(1, node->cycle_watchdog.n_overruns);
+
+	/* Cycles are not counted against the callback budget */
+	ASSERT_INT_EQ(0, node->watchdog.n_overruns);
+
+	teardown_cycle(nodeid);
+	return 0;
+}
+
+static int test_cycle_parallel(void)
+{
+	struct co_drv* drv[2] = { setup_cycle(nodeid), setup_cycle(nodeid + 1) };
+
+	ASSERT_INT_EQ(0, mloop_require_workers(2));
+
+	drv[0]->cycle = drv[1]->cycle = 11;
+	cycle_delay = 20000;
+
+	co_drv_cycle_run(drv, 2, 2);
+
+	/* Both are done on return */
+	ASSERT_INT_EQ(2, n_cycles);
+	ASSERT_FALSE(pthread_equal(cycle_caller[0], cycle_caller[1]));
+
+	teardown_cycle(nodeid);
+	teardown_cycle(nodeid + 1);
+	return 0;
+}
+
+static int test_cycle_thread(void)
+{
+	struct co_drv* drv = setup_cycle(nodeid);
+
+	ASSERT_INT_EQ(0, co_set_exec_mode(drv, CO_EXEC_THREAD));
+
+	co__cycle_begin(12);
+
+	for (int i = 0; i < 1000 && !__atomic_load_n(&n_cycles,
+						     __ATOMIC_ACQUIRE); ++i)
+		usleep(1000);
+
+	ASSERT_INT_EQ(1, n_cycles);
+	ASSERT_UINT_EQ(12, cycle_count);
+	ASSERT_FALSE(pthread_equal(cycle_caller[0], pthread_self()));
+
+	teardown_cycle(nodeid);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_inline);
+	RUN_TEST(test_watchdog);
+	RUN_TEST(test_thread);
+	RUN_TEST(test_full_queue);
+	RUN_TEST(test_auto_demotes);
+	RUN_TEST(test_pdo_batch);
+	RUN_TEST(test_cycle_waits_for_inputs);
+	RUN_TEST(test_cycle_deadline);
+	RUN_TEST(test_cycle_without_inputs);
+	RUN_TEST(test_cycle_budget);
+	RUN_TEST(test_cycle_parallel);
+	RUN_TEST(test_cycle_thread);
+	return r;
+}
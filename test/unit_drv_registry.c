@@ -0,0 +1,110 @@
+#include "tst.h"
+#include "canopen/master.h"
+#include "canopen/drv_registry.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DRIVER_DIR "unit_drv_registry.d"
+
+static void touch(const char* name)
+{
+	char path[256];
+	snprintf(path, sizeof(path), DRIVER_DIR "/%s", name);
+
+	FILE* file = fopen(path, "w");
+	if (file)
+		fclose(file);
+}
+
+static void remove_dir(void)
+{
+	static const char* files[] = {
+		"co_drv_cia402.so", "co_drv_valve.so", "libother.so",
+		"co_drv_.so", "co_drv_notes.txt",
+	};
+
+	char path[256];
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+		snprintf(path, sizeof(path), DRIVER_DIR "/%s", files[i]);
+		unlink(path);
+	}
+
+	rmdir(DRIVER_DIR);
+}
+
+int test_scan()
+{
+	remove_dir();
+	mkdir(DRIVER_DIR, 0755);
+	touch("co_drv_cia402.so");
+	touch("co_drv_valve.so");
+	touch("libother.so");
+	touch("co_drv_.so");
+	touch("co_drv_notes.txt");
+
+	ASSERT_INT_EQ(2, co_drv_registry_scan(DRIVER_DIR));
+	ASSERT_TRUE(co_drv_registry_has("cia402"));
+	ASSERT_TRUE(co_drv_registry_has("Valve"));
+	ASSERT_FALSE(co_drv_registry_has("other"));
+	ASSERT_FALSE(co_drv_registry_has("notes"));
+	ASSERT_FALSE(co_drv_registry_has(""));
+
+	/* The file system is not looked at again until the next scan */
+	touch("co_drv_late.so");
+	ASSERT_FALSE(co_drv_registry_has("late"));
+	ASSERT_INT_EQ(3, co_drv_registry_scan(DRIVER_DIR));
+	ASSERT_TRUE(co_drv_registry_has("late"));
+
+	unlink(DRIVER_DIR "/co_drv_late.so");
+	co_drv_registry_clear();
+	remove_dir();
+	return 0;
+}
+
+int test_missing_dir()
+{
+	remove_dir();
+
+	ASSERT_INT_LT(0, co_drv_registry_scan(DRIVER_DIR));
+	ASSERT_FALSE(co_drv_registry_has("cia402"));
+
+	co_drv_registry_clear();
+	return 0;
+}
+
+int test_broken_dso()
+{
+	remove_dir();
+	mkdir(DRIVER_DIR, 0755);
+	touch("co_drv_valve.so");
+
+	ASSERT_INT_EQ(1, co_drv_registry_scan(DRIVER_DIR));
+
+	struct co_drv drv;
+	memset(&drv, 0, sizeof(drv));
+
+	/* An empty file is not a DSO */
+	ASSERT_INT_LT(0, co_drv_registry_get(&drv, "valve"));
+	ASSERT_INT_LT(0, co_drv_registry_get(&drv, "valve"));
+	ASSERT_TRUE(drv.dso == NULL);
+	ASSERT_TRUE(co_drv_registry_peek("valve") == NULL);
+	ASSERT_INT_LT(0, co_drv_registry_close(NULL));
+
+	ASSERT_INT_LT(0, co_drv_registry_get(&drv, "cia402"));
+
+	co_drv_registry_clear();
+	remove_dir();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_scan);
+	RUN_TEST(test_missing_dir);
+	RUN_TEST(test_broken_dso);
+	return r;
+}
@@ -0,0 +1,173 @@
+#include "tst.h"
+#include "canopen/eds.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define EDS_DIR "unit_eds.d"
+#define EDS_FILE EDS_DIR "/drive.eds"
+#define EDS_IMAGE "unit_eds.db"
+
+int eds__db_load_from(const char* dir, const char* image_path);
+
+static const char eds_text_[] =
+"[DeviceInfo]\n"
+"VendorNumber=0x2f\n"
+"ProductNumber=0x1234\n"
+"RevisionNumber=0x10002\n"
+"ProductName=Test drive\n"
+"\n"
+"[1000]\n"
+"ParameterName=Device type\n"
+"DataType=0x0007\n"
+"AccessType=const\n"
+"DefaultValue=0x20192\n"
+"\n"
+"[1018sub1]\n"
+"ParameterName=Vendor-ID\n"
+"DataType=0x0007\n"
+"AccessType=ro\n"
+"\n"
+"[6040]\n"
+"ParameterName=Controlword\n"
+"DataType=0x0006\n"
+"AccessType=rww\n"
+"LowLimit=0\n"
+"HighLimit=0xffff\n";
+
+static void write_eds(const char* extra)
+{
+	mkdir(EDS_DIR, 0755);
+
+	FILE* file = fopen(EDS_FILE, "w");
+	if (!file)
+		abort();
+
+	fputs(eds_text_, file);
+	fputs(extra, file);
+	fclose(file);
+}
+
+static void cleanup(void)
+{
+	eds_db_unload();
+	unlink(EDS_IMAGE);
+	unlink(EDS_FILE);
+	rmdir(EDS_DIR);
+}
+
+static int check_db(void)
+{
+	ASSERT_INT_EQ(1, eds_db_length());
+
+	const struct canopen_eds* eds = eds_db_find(0x2f, 0x1234, 0x10002);
+	ASSERT_TRUE(eds != NULL);
+	ASSERT_STR_EQ("Test drive", eds->name);
+	ASSERT_TRUE(eds == eds_db_find_by_name("Test drive 2000"));
+
+	const struct eds_obj* obj = eds_obj_find(eds, 0x1000, 0);
+	ASSERT_TRUE(obj != NULL);
+	ASSERT_STR_EQ("Device type", obj->name);
+	ASSERT_STR_EQ("0x20192", obj->default_value);
+	ASSERT_INT_EQ(EDS_OBJ_CONST, obj->access);
+	ASSERT_INT_EQ(CANOPEN_UNSIGNED32, obj->type);
+	ASSERT_TRUE(obj->unit == NULL);
+
+	obj = eds_obj_find(eds, 0x6040, 0);
+	ASSERT_TRUE(obj != NULL);
+	ASSERT_STR_EQ("0xffff", obj->high_limit);
+	ASSERT_INT_EQ(EDS_OBJ_RW, obj->access);
+
+	ASSERT_TRUE(eds_obj_find(eds, 0x1018, 2) == NULL);
+
+	int n = 0;
+	uint32_t last = 0;
+	for (obj = eds_obj_first(eds); obj; obj = eds_obj_next(eds, obj)) {
+		ASSERT_INT_LT(obj->key, last);
+		last = obj->key;
+		++n;
+	}
+	ASSERT_INT_EQ(3, n);
+
+	return 0;
+}
+
+int test_parse()
+{
+	cleanup();
+	write_eds("");
+
+	ASSERT_INT_EQ(0, eds__db_load_from(EDS_DIR, EDS_IMAGE));
+	ASSERT_TRUE(eds_db_get(0)->image_objs == NULL);
+
+	/* Only the device info is read until the EDS is looked up */
+	ASSERT_FALSE(eds_db_get(0)->is_parsed);
+	ASSERT_TRUE(eds_db_get(0)->objs == NULL);
+
+	ASSERT_INT_EQ(0, check_db());
+	ASSERT_TRUE(eds_db_get(0)->is_parsed);
+
+	cleanup();
+	return 0;
+}
+
+int test_image()
+{
+	cleanup();
+	write_eds("");
+
+	ASSERT_INT_EQ(0, eds_db_compile(EDS_DIR, EDS_IMAGE));
+	ASSERT_INT_EQ(0, eds_db_length());
+
+	ASSERT_INT_EQ(0, eds__db_load_from(EDS_DIR, EDS_IMAGE));
+	ASSERT_TRUE(eds_db_get(0)->image_objs != NULL);
+	ASSERT_INT_EQ(0, check_db());
+
+	cleanup();
+	return 0;
+}
+
+int test_stale_image()
+{
+	cleanup();
+	write_eds("");
+
+	ASSERT_INT_EQ(0, eds_db_compile(EDS_DIR, EDS_IMAGE));
+
+	write_eds("\n[2000]\nParameterName=New\nDataType=0x0005\n");
+
+	ASSERT_INT_EQ(0, eds__db_load_from(EDS_DIR, EDS_IMAGE));
+	ASSERT_TRUE(eds_db_get(0)->image_objs == NULL);
+	ASSERT_TRUE(eds_obj_find(eds_db_get(0), 0x2000, 0) != NULL);
+
+	cleanup();
+	return 0;
+}
+
+int test_corrupt_image()
+{
+	cleanup();
+	write_eds("");
+
+	ASSERT_INT_EQ(0, eds_db_compile(EDS_DIR, EDS_IMAGE));
+	ASSERT_INT_EQ(0, truncate(EDS_IMAGE, 100));
+
+	ASSERT_INT_EQ(0, eds__db_load_from(EDS_DIR, EDS_IMAGE));
+	ASSERT_TRUE(eds_db_get(0)->image_objs == NULL);
+	ASSERT_INT_EQ(0, check_db());
+
+	cleanup();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_parse);
+	RUN_TEST(test_image);
+	RUN_TEST(test_stale_image);
+	RUN_TEST(test_corrupt_image);
+	return r;
+}
@@ -0,0 +1,134 @@
+#include "tst.h"
+#include "canopen/emcy_limit.h"
+
+#include <string.h>
+
+static const struct co_emcy_limit_config first = {
+	.policy = CO_EMCY_POLICY_FIRST,
+	.window = 1000,
+};
+
+static const struct co_emcy_limit_config rate = {
+	.policy = CO_EMCY_POLICY_RATE,
+	.rate = 10,
+	.burst = 3,
+};
+
+static int test_all(void)
+{
+	struct co_emcy_limit limit;
+	memset(&limit, 0, sizeof(limit));
+
+	const struct co_emcy_limit_config all = { .policy = CO_EMCY_POLICY_ALL };
+
+	for (int i = 0; i < 100; ++i)
+		ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &all, 0x2310, 1,
+						     1000 + i));
+
+	ASSERT_UINT_EQ(100, limit.n_passed);
+	return 0;
+}
+
+static int test_first(void)
+{
+	struct co_emcy_limit limit;
+	memset(&limit, 0, sizeof(limit));
+
+	uint64_t t = 1000000;
+
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &first, 0x2310, 1, t));
+
+	for (int i = 1; i <= 450; ++i)
+		ASSERT_INT_EQ(0, co_emcy_limit_check(&limit, &first, 0x2310, 1,
+						     t + i * 2000));
+
+	ASSERT_UINT_EQ(450, limit.n_aggregated);
+
+	/* The next repeat after the window is passed on */
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &first, 0x2310, 1,
+					     t + 1000000));
+	ASSERT_INT_EQ(0, co_emcy_limit_check(&limit, &first, 0x2310, 1,
+					     t + 1000001));
+
+	ASSERT_UINT_EQ(2, limit.n_passed);
+	return 0;
+}
+
+static int test_changes_are_passed_on(void)
+{
+	struct co_emcy_limit limit;
+	memset(&limit, 0, sizeof(limit));
+
+	uint64_t t = 1000000;
+
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &first, 0x2310, 1, t));
+	ASSERT_INT_EQ(0, co_emcy_limit_check(&limit, &first, 0x2310, 1, t + 1));
+
+	/* A different register is a change of state */
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &first, 0x2310, 5, t + 2));
+
+	/* Error reset */
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &first, 0x0000, 0, t + 3));
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &first, 0x2310, 1, t + 4));
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &first, 0x0000, 0, t + 5));
+
+	ASSERT_UINT_EQ(1, limit.n_aggregated);
+	return 0;
+}
+
+static int test_rate(void)
+{
+	struct co_emcy_limit limit;
+	memset(&limit, 0, sizeof(limit));
+
+	uint64_t t = 1000000;
+
+	/* The first takes one of the 3 tokens and 2 repeats take the rest */
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &rate, 0x2310, 1, t));
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &rate, 0x2310, 1, t));
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &rate, 0x2310, 1, t));
+	ASSERT_INT_EQ(0, co_emcy_limit_check(&limit, &rate, 0x2310, 1, t));
+
+	/* Changes get through without tokens */
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &rate, 0x0000, 0, t));
+
+	/* One token every 100 ms */
+	ASSERT_INT_EQ(0, co_emcy_limit_check(&limit, &rate, 0x0000, 0,
+					     t + 50000));
+	ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &rate, 0x0000, 0,
+					     t + 100000));
+	ASSERT_INT_EQ(0, co_emcy_limit_check(&limit, &rate, 0x0000, 0,
+					     t + 100001));
+
+	/* The bucket doesn't fill beyond the burst */
+	t += 10000000;
+	for (int i = 0; i < 3; ++i)
+		ASSERT_INT_EQ(1, co_emcy_limit_check(&limit, &rate, 0x0000, 0,
+						     t));
+	ASSERT_INT_EQ(0, co_emcy_limit_check(&limit, &rate, 0x0000, 0, t));
+
+	ASSERT_UINT_EQ(4, limit.n_dropped);
+	return 0;
+}
+
+static int test_policy_names(void)
+{
+	ASSERT_INT_EQ(CO_EMCY_POLICY_ALL, co_emcy_policy_from_string("all"));
+	ASSERT_INT_EQ(CO_EMCY_POLICY_FIRST,
+		      co_emcy_policy_from_string("first"));
+	ASSERT_INT_EQ(CO_EMCY_POLICY_RATE, co_emcy_policy_from_string("rate"));
+	ASSERT_INT_EQ(-1, co_emcy_policy_from_string("some"));
+	ASSERT_STR_EQ("rate", co_emcy_policy_name(CO_EMCY_POLICY_RATE));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_all);
+	RUN_TEST(test_first);
+	RUN_TEST(test_changes_are_passed_on);
+	RUN_TEST(test_rate);
+	RUN_TEST(test_policy_names);
+	return r;
+}
@@ -0,0 +1,118 @@
+#include "tst.h"
+#include "canopen/handover.h"
+#include "net-util.h"
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define PATH "@unit-handover"
+
+struct take {
+	struct co_handover_state state;
+	int fds[CO_HANDOVER_FDS_MAX];
+	size_t n_fds;
+	int rc;
+	int error;
+};
+
+static void* take_fn(void* arg)
+{
+	struct take* take = arg;
+
+	take->rc = co_handover_take(PATH, &take->state, take->fds,
+				    &take->n_fds);
+	take->error = errno;
+	return NULL;
+}
+
+static int test_give_and_take()
+{
+	int lfd = net_unix_listen(PATH);
+	ASSERT_TRUE(lfd >= 0);
+
+	int pipefd[2];
+	ASSERT_INT_EQ(0, pipe(pipefd));
+
+	static struct co_handover_state state;
+	memset(&state, 0, sizeof(state));
+	state.sock_type = 1;
+	state.n_nodes = 2;
+	state.node[0].nodeid = 3;
+	state.node[0].flags = CO_HANDOVER_NODE_STARTED;
+	state.node[0].vendor_id = 0x1234;
+	state.node[0].srtt = 900;
+	strcpy(state.node[0].name, "drive");
+	state.node[1].nodeid = 42;
+	state.node[1].flags = CO_HANDOVER_NODE_HEARTBEAT;
+
+	static struct take take;
+	pthread_t thread;
+	pthread_create(&thread, NULL, take_fn, &take);
+
+	ASSERT_INT_EQ(0, co_handover_give(lfd, &state, &pipefd[1], 1));
+
+	pthread_join(thread, NULL);
+	ASSERT_INT_EQ(0, take.rc);
+	ASSERT_UINT_EQ(1, take.n_fds);
+	ASSERT_INT_EQ(1, take.state.sock_type);
+	ASSERT_INT_EQ(2, take.state.n_nodes);
+	ASSERT_INT_EQ(3, take.state.node[0].nodeid);
+	ASSERT_INT_EQ(CO_HANDOVER_NODE_STARTED, take.state.node[0].flags);
+	ASSERT_UINT_EQ(0x1234, take.state.node[0].vendor_id);
+	ASSERT_UINT_EQ(900, take.state.node[0].srtt);
+	ASSERT_STR_EQ("drive", take.state.node[0].name);
+	ASSERT_INT_EQ(42, take.state.node[1].nodeid);
+
+	/* The passed fd is the write end of the same pipe */
+	char c = 'x';
+	ASSERT_INT_EQ(1, (int)write(take.fds[0], &c, 1));
+	c = 0;
+	ASSERT_INT_EQ(1, (int)read(pipefd[0], &c, 1));
+	ASSERT_INT_EQ('x', c);
+
+	close(take.fds[0]);
+	close(pipefd[1]);
+	close(pipefd[0]);
+	close(lfd);
+	return 0;
+}
+
+static int test_refused()
+{
+	int lfd = net_unix_listen(PATH);
+	ASSERT_TRUE(lfd >= 0);
+
+	static struct take take;
+	pthread_t thread;
+	pthread_create(&thread, NULL, take_fn, &take);
+
+	co_handover_refuse(lfd);
+
+	pthread_join(thread, NULL);
+	ASSERT_INT_EQ(-1, take.rc);
+	ASSERT_INT_EQ(ECONNRESET, take.error);
+	ASSERT_UINT_EQ(0, take.n_fds);
+
+	close(lfd);
+	return 0;
+}
+
+static int test_nobody_listening()
+{
+	struct take take;
+	take_fn(&take);
+	ASSERT_INT_EQ(-1, take.rc);
+	ASSERT_INT_EQ(ECONNREFUSED, take.error);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_give_and_take);
+	RUN_TEST(test_refused);
+	RUN_TEST(test_nobody_listening);
+	return r;
+}
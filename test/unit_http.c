@@ -1,12 +1,20 @@
 #include "tst.h"
 #include "http.h"
 
+/* The head is parsed in place, so the literals are parsed from a copy */
+static int parse(struct http_req* req, const char* text)
+{
+	static char head[256];
+	strcpy(head, text);
+	return http_req_parse(req, head);
+}
+
 int test_get_empty_path()
 {
 	const char* text = "GET / HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, parse(&req, text));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(0, req.url_index);
@@ -21,7 +29,7 @@ int test_get_one_elem_path()
 	const char* text = "GET /foo HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, parse(&req, text));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(1, req.url_index);
@@ -37,7 +45,7 @@ int test_get_two_elem_path()
 	const char* text = "GET /foo/bar HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, parse(&req, text));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(2, req.url_index);
@@ -54,7 +62,7 @@ int test_put_empty_path()
 	const char* text = "PUT / HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, parse(&req, text));
 
 	ASSERT_INT_EQ(HTTP_PUT, req.method);
 	ASSERT_INT_EQ(0, req.url_index);
@@ -72,7 +80,7 @@ int test_put_with_content_length()
 	"\r\n";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, parse(&req, text));
 
 	ASSERT_INT_EQ(HTTP_PUT, req.method);
 	ASSERT_INT_EQ(0, req.url_index);
@@ -91,7 +99,7 @@ int test_get_with_content_type()
 	"\r\n";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, parse(&req, text));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(0, req.url_index);
@@ -102,12 +110,79 @@ int test_get_with_content_type()
 	return 0;
 }
 
+int test_get_with_connection_close()
+{
+	const char* text =
+	"GET / HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"Connection: Close\r\n"
+	"\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, parse(&req, text));
+
+	ASSERT_INT_EQ(HTTP_GET, req.method);
+	ASSERT_TRUE(req.is_connection_close);
+	ASSERT_UINT_EQ(strlen(text), req.header_length);
+
+	http_req_free(&req);
+	return 0;
+}
+
+int test_get_with_keep_alive()
+{
+	const char* first =
+	"GET / HTTP/1.1\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n";
+	const char* text =
+	"GET / HTTP/1.1\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n"
+	"GET / HTTP/1.1\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, parse(&req, text));
+
+	ASSERT_FALSE(req.is_connection_close);
+	ASSERT_UINT_EQ(strlen(first), req.header_length);
+
+	http_req_free(&req);
+	return 0;
+}
+
+int test_get_with_websocket_upgrade()
+{
+	const char* text =
+	"GET /ws HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"Upgrade: websocket\r\n"
+	"Connection: keep-alive, Upgrade\r\n"
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	"Sec-WebSocket-Version: 13\r\n"
+	"\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, parse(&req, text));
+
+	ASSERT_TRUE(req.is_connection_upgrade);
+	ASSERT_FALSE(req.is_connection_close);
+	ASSERT_STR_EQ("websocket", req.upgrade);
+	ASSERT_STR_EQ("dGhlIHNhbXBsZSBub25jZQ==", req.websocket_key);
+	ASSERT_STR_EQ("13", req.websocket_version);
+
+	http_req_free(&req);
+	return 0;
+}
+
 int test_get_with_single_query()
 {
 	const char* text = "GET /path?key=value HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, parse(&req, text));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(1, req.url_index);
@@ -127,7 +202,7 @@ int test_get_with_two_query_pairs()
 	const char* text = "GET /path?foo=bar&asdf=xyz HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, parse(&req, text));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(1, req.url_index);
@@ -145,6 +220,104 @@ int test_get_with_two_query_pairs()
 	return 0;
 }
 
+int test_get_with_accept()
+{
+	const char* text =
+	"GET /sdo/5 HTTP/1.1\r\n"
+	"accept: application/cbor\r\n"
+	"\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, parse(&req, text));
+
+	ASSERT_STR_EQ("application/cbor", req.accept);
+	ASSERT_PTR_EQ(NULL, req.if_none_match);
+
+	http_req_free(&req);
+	return 0;
+}
+
+int test_get_with_if_none_match()
+{
+	const char* text =
+	"GET /sdo/5 HTTP/1.1\r\n"
+	"If-None-Match: \"abc\"\r\n"
+	"\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, parse(&req, text));
+
+	ASSERT_STR_EQ("\"abc\"", req.if_none_match);
+	ASSERT_UINT_EQ(strlen(text), req.header_length);
+
+	http_req_free(&req);
+	return 0;
+}
+
+int test_get_with_slashes()
+{
+	const char* text = "GET //foo//bar/ HTTP/1.1\r\n\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, parse(&req, text));
+
+	ASSERT_INT_EQ(2, req.url_index);
+	ASSERT_STR_EQ("foo", req.url[0]);
+	ASSERT_STR_EQ("bar", req.url[1]);
+	ASSERT_UINT_EQ(strlen(text), req.header_length);
+
+	http_req_free(&req);
+	return 0;
+}
+
+int test_get_with_query_flag()
+{
+	const char* text = "GET /path?flag&key=value HTTP/1.1\r\n\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, parse(&req, text));
+
+	ASSERT_STR_EQ("", http_req_query(&req, "flag"));
+	ASSERT_STR_EQ("value", http_req_query(&req, "key"));
+	ASSERT_PTR_EQ(NULL, http_req_query(&req, "missing"));
+
+	http_req_free(&req);
+	return 0;
+}
+
+int test_bad_requests()
+{
+	struct http_req req;
+	ASSERT_INT_EQ(-1, parse(&req, "POST / HTTP/1.1\r\n\r\n"));
+	ASSERT_INT_EQ(-1, parse(&req, "GET / HTTP/1.0\r\n\r\n"));
+	ASSERT_INT_EQ(-1, parse(&req, "GET foo HTTP/1.1\r\n\r\n"));
+	ASSERT_INT_EQ(-1, parse(&req, "GET /a=b HTTP/1.1\r\n\r\n"));
+	ASSERT_INT_EQ(-1, parse(&req, "GET / HTTP/1.1\r\nfoo\r\n\r\n"));
+	ASSERT_INT_EQ(-1, parse(&req, "GET / HTTP/1.1\r\nFoo: bar"));
+	return 0;
+}
+
+int test_rebase()
+{
+	char a[64] = "PUT /foo?x=y HTTP/1.1\r\nContent-Type: a/b\r\n\r\n";
+	char b[64];
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, http_req_parse(&req, a));
+
+	memcpy(b, a, sizeof(b));
+	memset(a, 0, sizeof(a));
+	http_req_rebase(&req, a, b);
+
+	ASSERT_STR_EQ("foo", req.url[0]);
+	ASSERT_STR_EQ("y", http_req_query(&req, "x"));
+	ASSERT_STR_EQ("a/b", req.content_type);
+	ASSERT_TRUE(req.url[0] > b && req.url[0] < b + sizeof(b));
+
+	http_req_free(&req);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -154,7 +327,16 @@ int main()
 	RUN_TEST(test_put_empty_path);
 	RUN_TEST(test_put_with_content_length);
 	RUN_TEST(test_get_with_content_type);
+	RUN_TEST(test_get_with_connection_close);
+	RUN_TEST(test_get_with_keep_alive);
+	RUN_TEST(test_get_with_websocket_upgrade);
 	RUN_TEST(test_get_with_single_query);
 	RUN_TEST(test_get_with_two_query_pairs);
+	RUN_TEST(test_get_with_if_none_match);
+	RUN_TEST(test_get_with_accept);
+	RUN_TEST(test_get_with_slashes);
+	RUN_TEST(test_get_with_query_flag);
+	RUN_TEST(test_bad_requests);
+	RUN_TEST(test_rebase);
 	return r;
 }
@@ -0,0 +1,118 @@
+#include "tst.h"
+#include "canopen/identity_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CACHE_PATH "unit_identity_cache.identity"
+
+size_t strlcpy(char*, const char*, size_t);
+
+static void make_entry(struct identity_cache_entry* entry, uint32_t vendor,
+		       const char* name)
+{
+	memset(entry, 0, sizeof(*entry));
+	entry->device_type = 0x20192;
+	entry->vendor_id = vendor;
+	entry->product_code = 0x1234;
+	entry->revision_number = 0x10002;
+	strlcpy(entry->name, name, sizeof(entry->name));
+	strlcpy(entry->hw_version, "rev B", sizeof(entry->hw_version));
+	strlcpy(entry->sw_version, "1.2\t3", sizeof(entry->sw_version));
+}
+
+int test_missing_file()
+{
+	unlink(CACHE_PATH);
+	identity_cache_clear();
+
+	struct identity_cache_entry entry;
+	ASSERT_INT_EQ(0, identity_cache_load(CACHE_PATH));
+	ASSERT_INT_LT(0, identity_cache_get(1, &entry));
+
+	/* Nothing has changed, so nothing is written */
+	ASSERT_INT_EQ(0, identity_cache_save(CACHE_PATH));
+	ASSERT_INT_LT(0, access(CACHE_PATH, F_OK));
+	return 0;
+}
+
+int test_save_load()
+{
+	struct identity_cache_entry entry, result;
+
+	unlink(CACHE_PATH);
+	identity_cache_clear();
+
+	make_entry(&entry, 0x2f, "drive");
+	identity_cache_set(5, &entry);
+	make_entry(&entry, 0, "valve");
+	identity_cache_set(127, &entry);
+	ASSERT_INT_EQ(0, identity_cache_save(CACHE_PATH));
+
+	identity_cache_clear();
+	ASSERT_INT_EQ(0, identity_cache_load(CACHE_PATH));
+
+	ASSERT_INT_EQ(0, identity_cache_get(5, &result));
+	ASSERT_INT_EQ(0x20192, result.device_type);
+	ASSERT_INT_EQ(0x2f, result.vendor_id);
+	ASSERT_INT_EQ(0x1234, result.product_code);
+	ASSERT_INT_EQ(0x10002, result.revision_number);
+	ASSERT_STR_EQ("drive", result.name);
+	ASSERT_STR_EQ("rev B", result.hw_version);
+	ASSERT_STR_EQ("1.2 3", result.sw_version);
+
+	ASSERT_INT_EQ(0, identity_cache_get(127, &result));
+	ASSERT_INT_EQ(0, result.vendor_id);
+	ASSERT_STR_EQ("valve", result.name);
+
+	ASSERT_INT_LT(0, identity_cache_get(6, &result));
+
+	identity_cache_invalidate(5);
+	ASSERT_INT_EQ(0, identity_cache_save(CACHE_PATH));
+
+	identity_cache_clear();
+	ASSERT_INT_EQ(0, identity_cache_load(CACHE_PATH));
+	ASSERT_INT_LT(0, identity_cache_get(5, &result));
+	ASSERT_INT_EQ(0, identity_cache_get(127, &result));
+
+	unlink(CACHE_PATH);
+	identity_cache_clear();
+	return 0;
+}
+
+int test_bad_lines()
+{
+	struct identity_cache_entry result;
+
+	identity_cache_clear();
+
+	FILE* file = fopen(CACHE_PATH, "w");
+	ASSERT_TRUE(file != NULL);
+	fprintf(file, "garbage\n");
+	fprintf(file, "0\t0x1\t0x2\t0x3\t0x4\tzero\t\t\n");
+	fprintf(file, "128\t0x1\t0x2\t0x3\t0x4\ttoo-high\t\t\n");
+	fprintf(file, "3\t0x1\t0x2\t0x3\n");
+	fprintf(file, "9\t0x191\t0\t0\t0\tio\t\t\n");
+	fclose(file);
+
+	ASSERT_INT_EQ(0, identity_cache_load(CACHE_PATH));
+	ASSERT_INT_LT(0, identity_cache_get(3, &result));
+	ASSERT_INT_EQ(0, identity_cache_get(9, &result));
+	ASSERT_INT_EQ(0x191, result.device_type);
+	ASSERT_STR_EQ("io", result.name);
+	ASSERT_STR_EQ("", result.hw_version);
+
+	unlink(CACHE_PATH);
+	identity_cache_clear();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_missing_file);
+	RUN_TEST(test_save_load);
+	RUN_TEST(test_bad_lines);
+	return r;
+}
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "tst.h"
@@ -49,12 +51,97 @@ static int test_simple_file()
 	return 0;
 }
 
+#define INI_PATH "unit_init_parser.ini"
+
+static int write_file(const char* text, size_t size)
+{
+	FILE* file = fopen(INI_PATH, "w");
+	if (!file)
+		return -1;
+
+	fwrite(text, 1, size, file);
+	fclose(file);
+	return 0;
+}
+
+static int test_parse_file()
+{
+	const char* text =
+	"; a simple test file\r\n"
+	"root=1\r\n"
+	"[Section]\r\n"
+	"Foo = bar baz \r\n"
+	"x=y\r\n"
+	"[Other]\n"
+	"x=z";
+
+	ASSERT_INT_EQ(0, write_file(text, strlen(text)));
+
+	struct ini_file file;
+	ASSERT_INT_EQ(0, ini_parse_file(&file, INI_PATH));
+
+	ASSERT_STR_EQ("1", ini_find(&file, "(root)", "root"));
+	ASSERT_STR_EQ("bar baz", ini_find(&file, "section", "foo"));
+	ASSERT_STR_EQ("y", ini_find(&file, "section", "x"));
+	ASSERT_STR_EQ("z", ini_find(&file, "other", "x"));
+	ASSERT_TRUE(ini_find(&file, "other", "foo") == NULL);
+	ASSERT_INT_EQ(3, ini_get_length(&file));
+	ASSERT_INT_EQ(2, ini_get_section_length(
+				ini_find_section(&file, "section")));
+
+	ini_destroy(&file);
+	unlink(INI_PATH);
+	return 0;
+}
+
+/* A file that fills its last page cannot be terminated in the mapping */
+static int test_parse_file_page_sized()
+{
+	size_t size = sysconf(_SC_PAGESIZE);
+	char* text = malloc(size);
+	ASSERT_TRUE(text != NULL);
+
+	memset(text, ';', size);
+	memcpy(text, "[a]\nkey=value\n", 14);
+	memcpy(text + size - 6, "\nb=cd", 6);
+
+	ASSERT_INT_EQ(0, write_file(text, size));
+	free(text);
+
+	struct ini_file file;
+	ASSERT_INT_EQ(0, ini_parse_file(&file, INI_PATH));
+	ASSERT_STR_EQ("value", ini_find(&file, "a", "key"));
+	ASSERT_STR_EQ("cd", ini_find(&file, "a", "b"));
+	ini_destroy(&file);
+
+	unlink(INI_PATH);
+	return 0;
+}
+
+static int test_parse_file_errors()
+{
+	struct ini_file file;
+
+	unlink(INI_PATH);
+	ASSERT_INT_EQ(-1, ini_parse_file(&file, INI_PATH));
+
+	const char* text = "[a]\nkey=value\nnot a key value\n";
+	ASSERT_INT_EQ(0, write_file(text, strlen(text)));
+	ASSERT_INT_EQ(-3, ini_parse_file(&file, INI_PATH));
+
+	unlink(INI_PATH);
+	return 0;
+}
+
 int main()
 {
     int r = 0;
     setup();
 
     RUN_TEST(test_simple_file);
+    RUN_TEST(test_parse_file);
+    RUN_TEST(test_parse_file_page_sized);
+    RUN_TEST(test_parse_file_errors);
 
     cleanup();
     return r;
@@ -0,0 +1,115 @@
+#include "tst.h"
+#include "canopen/latency.h"
+
+#include <string.h>
+
+static struct co_latency_stats get_stats(size_t i)
+{
+	struct co_latency_rule rule;
+	struct co_latency_stats stats;
+	memset(&stats, 0, sizeof(stats));
+	co_latency_get(i, &rule, &stats);
+	return stats;
+}
+
+static int test_add_rule(void)
+{
+	co_latency_clear();
+
+	struct co_latency_rule rule = { .nodeid = 5, .rpdo = 1, .tpdo = 2 };
+	ASSERT_INT_EQ(0, co_latency_add_rule(&rule));
+
+	struct co_latency_rule bad = rule;
+	bad.nodeid = 0;
+	ASSERT_INT_EQ(-1, co_latency_add_rule(&bad));
+
+	bad = rule;
+	bad.tpdo = 5;
+	ASSERT_INT_EQ(-1, co_latency_add_rule(&bad));
+
+	bad = rule;
+	bad.mask_size = CO_LATENCY_MASK_SIZE + 1;
+	ASSERT_INT_EQ(-1, co_latency_add_rule(&bad));
+
+	struct co_latency_rule out;
+	struct co_latency_stats stats;
+	ASSERT_INT_EQ(0, co_latency_get(0, &out, &stats));
+	ASSERT_INT_EQ(5, out.nodeid);
+	ASSERT_INT_EQ(-1, co_latency_get(1, &out, &stats));
+
+	co_latency_clear();
+	ASSERT_INT_EQ(-1, co_latency_get(0, &out, &stats));
+	return 0;
+}
+
+static int test_round_trip(void)
+{
+	co_latency_clear();
+
+	struct co_latency_rule rule = { .nodeid = 5, .rpdo = 1, .tpdo = 2 };
+	ASSERT_INT_EQ(0, co_latency_add_rule(&rule));
+
+	/* A TPDO without an RPDO before it is not a round trip */
+	co_latency_on_rx(0x285, "a", 1, 900);
+	ASSERT_UINT_EQ(0, get_stats(0).count);
+
+	co_latency_on_tx(0x205, "a", 1, 1000);
+
+	/* Other PDOs and nodes don't count */
+	co_latency_on_rx(0x185, "a", 1, 1100);
+	co_latency_on_rx(0x286, "a", 1, 1100);
+	ASSERT_UINT_EQ(0, get_stats(0).count);
+
+	co_latency_on_rx(0x285, "b", 1, 1300);
+
+	struct co_latency_stats stats = get_stats(0);
+	ASSERT_UINT_EQ(1, stats.count);
+	ASSERT_UINT_EQ(300, stats.max);
+	ASSERT_UINT_EQ(1, stats.bucket[8]);
+
+	/* Only the first TPDO after the RPDO counts */
+	co_latency_on_rx(0x285, "b", 1, 1400);
+	ASSERT_UINT_EQ(1, get_stats(0).count);
+
+	co_latency_on_tx(0x205, "a", 1, 2000);
+	co_latency_on_tx(0x205, "a", 1, 3000);
+	ASSERT_UINT_EQ(1, get_stats(0).n_unanswered);
+
+	co_latency_clear();
+	return 0;
+}
+
+static int test_mask(void)
+{
+	co_latency_clear();
+
+	struct co_latency_rule rule = {
+		.nodeid = 5, .rpdo = 1, .tpdo = 1,
+		.mask_size = 2, .mask = { 0xff, 0x0f },
+	};
+	ASSERT_INT_EQ(0, co_latency_add_rule(&rule));
+
+	co_latency_on_tx(0x205, "\x12\x34\x56", 3, 1000);
+
+	co_latency_on_rx(0x185, "\x12\x33\x56", 3, 1100);
+	ASSERT_UINT_EQ(0, get_stats(0).count);
+
+	/* Bytes and bits outside of the mask don't matter */
+	co_latency_on_rx(0x185, "\x12\xf4\x00", 3, 1200);
+
+	struct co_latency_stats stats = get_stats(0);
+	ASSERT_UINT_EQ(1, stats.count);
+	ASSERT_UINT_EQ(200, stats.max);
+
+	co_latency_clear();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_add_rule);
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_mask);
+	return r;
+}
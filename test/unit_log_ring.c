@@ -0,0 +1,72 @@
+#include "tst.h"
+#include "canopen/log_ring.h"
+#include "plog.h"
+
+static int test_not_started(void)
+{
+	uint64_t key = CO_LOG_KEY(CO_LOG_EMCY, 12, 0x2310);
+
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, key, "Node %d", 12));
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, key, "Node %d", 12));
+	return 0;
+}
+
+static int test_repeats(void)
+{
+	uint64_t key = CO_LOG_KEY(CO_LOG_EMCY, 12, 0x2310);
+	uint64_t other = CO_LOG_KEY(CO_LOG_EMCY, 13, 0x2310);
+
+	ASSERT_INT_EQ(0, co_log_start(60000));
+
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, key, "Node %d", 12));
+
+	for (int i = 0; i < 100; ++i)
+		ASSERT_INT_EQ(0, co_log(LOG_DEBUG, key, "Node %d", 12));
+
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, other, "Node %d", 13));
+
+	/* Messages without a key are never counted as repeats */
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, 0, "No key"));
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, 0, "No key"));
+
+	co_log_stop();
+
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, key, "Node %d", 12));
+	return 0;
+}
+
+static int test_windows_are_reset(void)
+{
+	uint64_t key = CO_LOG_KEY(CO_LOG_LATE_NODE, 5, 0);
+
+	ASSERT_INT_EQ(0, co_log_start(60000));
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, key, "Node %d was late", 5));
+	ASSERT_INT_EQ(0, co_log(LOG_DEBUG, key, "Node %d was late", 5));
+	co_log_stop();
+
+	ASSERT_INT_EQ(0, co_log_start(60000));
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, key, "Node %d was late", 5));
+	co_log_stop();
+	return 0;
+}
+
+static int test_no_window(void)
+{
+	uint64_t key = CO_LOG_KEY(CO_LOG_HEARTBEAT_TIMEOUT, 7, 0);
+
+	ASSERT_INT_EQ(0, co_log_start(0));
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, key, "Node %d", 7));
+	ASSERT_INT_EQ(1, co_log(LOG_DEBUG, key, "Node %d", 7));
+	co_log_stop();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_not_started);
+	RUN_TEST(test_repeats);
+	RUN_TEST(test_windows_are_reset);
+	RUN_TEST(test_no_window);
+	return r;
+}
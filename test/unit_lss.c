@@ -0,0 +1,392 @@
+#include <string.h>
+#include "tst.h"
+#include "fff.h"
+#include "canopen/lss.h"
+#include "canopen.h"
+
+DEFINE_FFF_GLOBALS;
+
+struct mloop;
+
+struct mloop_timer {
+	int dummy;
+};
+
+FAKE_VALUE_FUNC(struct mloop*, mloop_default);
+FAKE_VALUE_FUNC(struct mloop_timer*, mloop_timer_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_timer_start, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_stop, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_unref, struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_time, struct mloop_timer*, uint64_t);
+FAKE_VOID_FUNC(mloop_timer_set_type, struct mloop_timer*,
+	       enum mloop_timer_type);
+FAKE_VOID_FUNC(mloop_timer_set_context, struct mloop_timer*, void*,
+	       mloop_free_fn);
+FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
+FAKE_VALUE_FUNC(void*, mloop_timer_get_context, const struct mloop_timer*);
+FAKE_VOID_FUNC(on_done, struct co_lss*);
+
+static struct mloop_timer timer;
+static const struct sock sock = { .type = SOCK_TYPE_CAN, .fd = -1 };
+
+#define SLAVES_MAX 8
+#define FRAMES_MAX 16
+
+/* A simple LSS slave that only knows the services the master uses */
+struct slave {
+	uint32_t part[4];
+	int pending_nodeid;
+	int is_configuration;
+	int lss_pos;
+	int is_stored;
+	int refuses;
+};
+
+static struct slave slaves[SLAVES_MAX];
+static size_t n_slaves;
+
+static struct can_frame sent[FRAMES_MAX];
+static size_t n_sent;
+
+ssize_t sock_send(const struct sock* s, struct can_frame* cf, int flags)
+{
+	(void)s;
+	(void)flags;
+
+	if (n_sent < FRAMES_MAX)
+		sent[n_sent++] = *cf;
+
+	return sizeof(*cf);
+}
+
+static int slave_answer(struct slave* slave, const struct can_frame* cf,
+			struct can_frame* response)
+{
+	int is_unconfigured = slave->pending_nodeid == 0xff;
+
+	switch (cf->data[0]) {
+	case CO_LSS_CS_SWITCH_GLOBAL:
+		slave->is_configuration = cf->data[1];
+		return 0;
+
+	case CO_LSS_CS_FASTSCAN: {
+		uint32_t id = cf->data[1] | cf->data[2] << 8 | cf->data[3] << 16
+			    | (uint32_t)cf->data[4] << 24;
+		int bit = cf->data[5], sub = cf->data[6], next = cf->data[7];
+
+		if (slave->is_configuration || !is_unconfigured)
+			return 0;
+
+		if (bit == 0x80) {
+			slave->lss_pos = 0;
+		} else {
+			if (slave->lss_pos != sub)
+				return 0;
+
+			uint32_t mask = 0xffffffffUL << bit;
+			if ((slave->part[sub] ^ id) & mask)
+				return 0;
+
+			if (bit == 0) {
+				slave->lss_pos = next;
+				if (next < sub)
+					slave->is_configuration = 1;
+			}
+		}
+
+		response->data[0] = CO_LSS_CS_IDENTIFY_SLAVE;
+		return 1;
+	}
+
+	case CO_LSS_CS_CONFIGURE_NODEID:
+		if (!slave->is_configuration)
+			return 0;
+
+		response->data[0] = CO_LSS_CS_CONFIGURE_NODEID;
+		response->data[1] = slave->refuses;
+		if (!slave->refuses)
+			slave->pending_nodeid = cf->data[1];
+		return 1;
+
+	case CO_LSS_CS_STORE:
+		if (!slave->is_configuration)
+			return 0;
+
+		response->data[0] = CO_LSS_CS_STORE;
+		slave->is_stored = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* The response is only written if there is one */
+static int slave_feed(struct slave* slave, const struct can_frame* cf,
+		      struct can_frame* response)
+{
+	struct can_frame answer;
+	memset(&answer, 0, sizeof(answer));
+	answer.can_id = CO_LSS_SLAVE_COB_ID;
+	answer.can_dlc = 8;
+
+	if (!slave_answer(slave, cf, &answer))
+		return 0;
+
+	*response = answer;
+	return 1;
+}
+
+/* Plays the bus until the scan is done. Answers that are sent at the same
+ * time are identical and arrive as one frame.
+ */
+static void run(struct co_lss* lss)
+{
+	while (lss->is_running) {
+		struct can_frame response;
+		int has_response = 0;
+
+		for (size_t i = 0; i < n_sent; ++i)
+			for (size_t j = 0; j < n_slaves; ++j)
+				if (slave_feed(&slaves[j], &sent[i], &response))
+					has_response = 1;
+
+		n_sent = 0;
+
+		if (has_response)
+			co_lss_feed(lss, &response);
+		else
+			mloop_timer_set_callback_fake.arg1_val(&timer);
+	}
+}
+
+static void add_slave(uint32_t vendor, uint32_t product, uint32_t revision,
+		      uint32_t serial)
+{
+	struct slave* slave = &slaves[n_slaves++];
+	memset(slave, 0, sizeof(*slave));
+	slave->part[0] = vendor;
+	slave->part[1] = product;
+	slave->part[2] = revision;
+	slave->part[3] = serial;
+	slave->pending_nodeid = 0xff;
+}
+
+/* Gives each slave the node id of its place in the list plus 10 */
+static int assign(struct co_lss* lss, const struct co_lss_identity* identity)
+{
+	(void)lss;
+
+	for (size_t i = 0; i < n_slaves; ++i)
+		if (slaves[i].part[3] == identity->serial_number
+		 && slaves[i].part[0] == identity->vendor_id)
+			return 10 + i;
+
+	return -1;
+}
+
+static int assign_none(struct co_lss* lss,
+		       const struct co_lss_identity* identity)
+{
+	(void)lss;
+	(void)identity;
+	return -1;
+}
+
+static void setup(struct co_lss* lss)
+{
+	RESET_FAKE(mloop_timer_set_callback);
+	RESET_FAKE(on_done);
+
+	n_slaves = 0;
+	n_sent = 0;
+
+	mloop_timer_new_fake.return_val = &timer;
+	mloop_timer_get_context_fake.return_val = lss;
+
+	co_lss_init(lss, &sock);
+}
+
+static int test_no_nodes(void)
+{
+	struct co_lss lss;
+	setup(&lss);
+
+	struct co_lss_info info = { .timeout = 10, .on_done = on_done };
+	ASSERT_INT_EQ(0, co_lss_start(&lss, &info));
+	run(&lss);
+
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+	ASSERT_INT_EQ(CO_LSS_OK, lss.status);
+	ASSERT_UINT_EQ(0, lss.n_assigned);
+
+	co_lss_destroy(&lss);
+	return 0;
+}
+
+static int test_assign(void)
+{
+	struct co_lss lss;
+	setup(&lss);
+
+	add_slave(0x1234, 0x42, 0x10001, 1);
+	add_slave(0x1234, 0x42, 0x10001, 2);
+	add_slave(0x1234, 0x42, 0x10002, 0xfffffffe);
+	add_slave(0xdeadbeef, 1, 0, 7);
+
+	struct co_lss_info info = {
+		.timeout = 10,
+		.is_store = 1,
+		.assign_fn = assign,
+		.on_done = on_done,
+	};
+
+	ASSERT_INT_EQ(0, co_lss_start(&lss, &info));
+	run(&lss);
+
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+	ASSERT_INT_EQ(CO_LSS_OK, lss.status);
+	ASSERT_UINT_EQ(4, lss.n_assigned);
+
+	for (size_t i = 0; i < n_slaves; ++i) {
+		ASSERT_INT_EQ(10 + i, slaves[i].pending_nodeid);
+		ASSERT_TRUE(slaves[i].is_stored);
+		ASSERT_FALSE(slaves[i].is_configuration);
+	}
+
+	/* 4 x 33 queries per node, plus the confirmations and the rest */
+	ASSERT_UINT_LT(4 * 140 + 3, lss.n_frames);
+
+	co_lss_destroy(&lss);
+	return 0;
+}
+
+static int test_unknown_identity(void)
+{
+	struct co_lss lss;
+	setup(&lss);
+
+	add_slave(0x1234, 0x42, 1, 99);
+
+	struct co_lss_info info = {
+		.timeout = 10,
+		.assign_fn = assign_none,
+		.on_done = on_done,
+	};
+
+	ASSERT_INT_EQ(0, co_lss_start(&lss, &info));
+	run(&lss);
+
+	ASSERT_INT_EQ(CO_LSS_UNKNOWN_IDENTITY, lss.status);
+
+	struct co_lss_identity identity;
+	co_lss_get_identity(&lss, &identity);
+	ASSERT_UINT_EQ(0x1234, identity.vendor_id);
+	ASSERT_UINT_EQ(0x42, identity.product_code);
+	ASSERT_UINT_EQ(1, identity.revision_number);
+	ASSERT_UINT_EQ(99, identity.serial_number);
+
+	/* The node is not left in the configuration state */
+	for (size_t i = 0; i < n_sent; ++i)
+		slave_feed(&slaves[0], &sent[i], &(struct can_frame){ 0 });
+	ASSERT_FALSE(slaves[0].is_configuration);
+	ASSERT_INT_EQ(0xff, slaves[0].pending_nodeid);
+
+	co_lss_destroy(&lss);
+	return 0;
+}
+
+static int test_refused(void)
+{
+	struct co_lss lss;
+	setup(&lss);
+
+	add_slave(0x1234, 0x42, 1, 5);
+	slaves[0].refuses = 1;
+
+	struct co_lss_info info = {
+		.timeout = 10,
+		.assign_fn = assign,
+		.on_done = on_done,
+	};
+
+	ASSERT_INT_EQ(0, co_lss_start(&lss, &info));
+	run(&lss);
+
+	ASSERT_INT_EQ(CO_LSS_REFUSED, lss.status);
+	ASSERT_UINT_EQ(0, lss.n_assigned);
+
+	co_lss_destroy(&lss);
+	return 0;
+}
+
+static int test_lost_node(void)
+{
+	struct co_lss lss;
+	setup(&lss);
+
+	add_slave(0x1234, 0x42, 1, 5);
+
+	struct co_lss_info info = {
+		.timeout = 10,
+		.assign_fn = assign,
+		.on_done = on_done,
+	};
+
+	ASSERT_INT_EQ(0, co_lss_start(&lss, &info));
+
+	/* The node stops answering in the middle of the scan */
+	for (int i = 0; i < 40; ++i) {
+		struct can_frame response;
+		int has_response = 0;
+
+		for (size_t j = 0; j < n_sent; ++j)
+			has_response |= slave_feed(&slaves[0], &sent[j],
+						   &response);
+		n_sent = 0;
+
+		if (has_response)
+			co_lss_feed(&lss, &response);
+		else
+			mloop_timer_set_callback_fake.arg1_val(&timer);
+	}
+
+	n_slaves = 0;
+	run(&lss);
+
+	ASSERT_INT_EQ(CO_LSS_OK, lss.status);
+	ASSERT_UINT_EQ(0, lss.n_assigned);
+
+	co_lss_destroy(&lss);
+	return 0;
+}
+
+static int test_identity_from_string(void)
+{
+	struct co_lss_identity identity;
+
+	ASSERT_INT_EQ(0, co_lss_identity_from_string(&identity,
+						      "0x1234:66:0x10001:7"));
+	ASSERT_UINT_EQ(0x1234, identity.vendor_id);
+	ASSERT_UINT_EQ(66, identity.product_code);
+	ASSERT_UINT_EQ(0x10001, identity.revision_number);
+	ASSERT_UINT_EQ(7, identity.serial_number);
+
+	ASSERT_INT_EQ(-1, co_lss_identity_from_string(&identity, ""));
+	ASSERT_INT_EQ(-1, co_lss_identity_from_string(&identity, "1:2:3"));
+	ASSERT_INT_EQ(-1, co_lss_identity_from_string(&identity, "1:2:3:4:5"));
+	ASSERT_INT_EQ(-1, co_lss_identity_from_string(&identity, "1:2::4"));
+	ASSERT_INT_EQ(-1, co_lss_identity_from_string(&identity, "1:2:3:x"));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_no_nodes);
+	RUN_TEST(test_assign);
+	RUN_TEST(test_unknown_identity);
+	RUN_TEST(test_refused);
+	RUN_TEST(test_lost_node);
+	RUN_TEST(test_identity_from_string);
+	return r;
+}
@@ -0,0 +1,154 @@
+#include "tst.h"
+#include "mloop.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+
+#define N_SOURCES 40
+
+static int n_calls_;
+
+static void read_one(struct mloop_socket* socket)
+{
+	char c;
+	++n_calls_;
+
+	if (read(mloop_socket_get_fd(socket), &c, 1) == 1)
+		mloop_socket_continue(socket);
+}
+
+static void read_nothing(struct mloop_socket* socket)
+{
+	(void)socket;
+	++n_calls_;
+}
+
+int test_edge_triggered_continue(void)
+{
+	struct mloop* loop = mloop_new();
+	int fds[2];
+	ASSERT_INT_EQ(0, pipe2(fds, O_NONBLOCK));
+
+	struct mloop_socket* socket = mloop_socket_new(loop);
+	mloop_socket_set_fd(socket, fds[0]);
+	mloop_socket_set_callback(socket, read_one);
+	mloop_socket_set_edge_triggered(socket, 1);
+	ASSERT_INT_EQ(0, mloop_socket_start(socket));
+
+	n_calls_ = 0;
+	ASSERT_INT_EQ(3, write(fds[1], "abc", 3));
+
+	/* One byte at a time, without a new edge in between */
+	mloop_run_once(loop);
+	ASSERT_INT_EQ(1, n_calls_);
+	mloop_run_once(loop);
+	ASSERT_INT_EQ(2, n_calls_);
+	mloop_run_once(loop);
+	ASSERT_INT_EQ(3, n_calls_);
+
+	/* The last call found the pipe empty and did not continue */
+	mloop_run_once(loop);
+	mloop_run_once(loop);
+	ASSERT_INT_EQ(4, n_calls_);
+
+	mloop_socket_stop(socket);
+	mloop_socket_unref(socket);
+	close(fds[1]);
+	mloop_unref(loop);
+	return 0;
+}
+
+int test_edge_triggered_needs_edge(void)
+{
+	struct mloop* loop = mloop_new();
+	int fds[2];
+	ASSERT_INT_EQ(0, pipe2(fds, O_NONBLOCK));
+
+	struct mloop_socket* socket = mloop_socket_new(loop);
+	mloop_socket_set_fd(socket, fds[0]);
+	mloop_socket_set_callback(socket, read_nothing);
+	mloop_socket_set_edge_triggered(socket, 1);
+	ASSERT_INT_EQ(0, mloop_socket_start(socket));
+
+	n_calls_ = 0;
+	ASSERT_INT_EQ(1, write(fds[1], "a", 1));
+
+	mloop_run_once(loop);
+	mloop_run_once(loop);
+	ASSERT_INT_EQ(1, n_calls_);
+
+	/* Level-triggered sockets are reported again and cannot continue */
+	mloop_socket_set_edge_triggered(socket, 0);
+	mloop_socket_continue(socket);
+	mloop_run_once(loop);
+	ASSERT_INT_EQ(2, n_calls_);
+
+	mloop_socket_stop(socket);
+	mloop_socket_unref(socket);
+	close(fds[1]);
+	mloop_unref(loop);
+	return 0;
+}
+
+int test_event_batch_grows_and_shrinks(void)
+{
+	struct mloop* loop = mloop_new();
+	struct mloop_socket* socket[N_SOURCES];
+	struct mloop_stats stats;
+
+	n_calls_ = 0;
+
+	for (int i = 0; i < N_SOURCES; ++i) {
+		int fd = eventfd(1, EFD_NONBLOCK);
+		ASSERT_TRUE(fd >= 0);
+
+		socket[i] = mloop_socket_new(loop);
+		mloop_socket_set_fd(socket[i], fd);
+		mloop_socket_set_callback(socket[i], read_nothing);
+		ASSERT_INT_EQ(0, mloop_socket_start(socket[i]));
+	}
+
+	mloop_get_stats(loop, &stats);
+	ASSERT_UINT_EQ(16, stats.event_batch_size);
+
+	mloop_run_once(loop);
+	mloop_run_once(loop);
+	mloop_get_stats(loop, &stats);
+	ASSERT_UINT_EQ(64, stats.event_batch_size);
+
+	/* Everyone got a turn */
+	mloop_run_once(loop);
+	ASSERT_INT_EQ(16 + 32 + N_SOURCES, n_calls_);
+
+	ASSERT_INT_EQ(0, mloop_set_max_events(loop, 32));
+	mloop_get_stats(loop, &stats);
+	ASSERT_UINT_EQ(32, stats.event_batch_size);
+
+	for (int i = 0; i < N_SOURCES; ++i) {
+		uint64_t count;
+		ASSERT_INT_EQ(8, read(mloop_socket_get_fd(socket[i]), &count,
+				      sizeof(count)));
+	}
+
+	mloop_run_once(loop);
+	mloop_get_stats(loop, &stats);
+	ASSERT_UINT_EQ(16, stats.event_batch_size);
+
+	for (int i = 0; i < N_SOURCES; ++i) {
+		mloop_socket_stop(socket[i]);
+		mloop_socket_unref(socket[i]);
+	}
+
+	mloop_unref(loop);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_edge_triggered_continue);
+	RUN_TEST(test_edge_triggered_needs_edge);
+	RUN_TEST(test_event_batch_grows_and_shrinks);
+	return r;
+}
@@ -0,0 +1,327 @@
+#include "tst.h"
+#include "mloop.h"
+
+#include <time.h>
+
+static struct mloop* loop_;
+static int order_[16];
+static int norder_;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000ULL;
+}
+
+static void on_timeout(struct mloop_timer* timer)
+{
+	order_[norder_++] = (int)(intptr_t)mloop_timer_get_context(timer);
+}
+
+static void on_exit_timeout(struct mloop_timer* timer)
+{
+	(void)timer;
+	mloop_exit(loop_);
+}
+
+static struct mloop_timer* start_timer(enum mloop_timer_type type,
+				       uint64_t ms, mloop_timer_fn fn, int id)
+{
+	struct mloop_timer* timer = mloop_timer_new(loop_);
+	mloop_timer_set_type(timer, type);
+	mloop_timer_set_time(timer, ms * 1000000ULL);
+	mloop_timer_set_callback(timer, fn);
+	mloop_timer_set_context(timer, (void*)(intptr_t)id, NULL);
+	mloop_timer_start(timer);
+	return timer;
+}
+
+static void run_for(uint64_t ms)
+{
+	struct mloop_timer* timer =
+		start_timer(MLOOP_TIMER_RELATIVE, ms, on_exit_timeout, -1);
+	mloop_run(loop_);
+	mloop_timer_stop(timer);
+	mloop_timer_unref(timer);
+}
+
+static void setup(void)
+{
+	loop_ = mloop_new();
+	norder_ = 0;
+}
+
+static void teardown(void)
+{
+	mloop_unref(loop_);
+}
+
+int test_single_shots_fire_in_order(void)
+{
+	setup();
+
+	struct mloop_timer* a = start_timer(MLOOP_TIMER_RELATIVE, 30, on_timeout, 3);
+	struct mloop_timer* b = start_timer(MLOOP_TIMER_RELATIVE, 10, on_timeout, 1);
+	struct mloop_timer* c = start_timer(MLOOP_TIMER_RELATIVE, 20, on_timeout, 2);
+
+	/* Lands on the second level and has to be cascaded */
+	struct mloop_timer* d = start_timer(MLOOP_TIMER_RELATIVE, 100, on_timeout, 4);
+
+	uint64_t start = now_ms();
+	run_for(120);
+
+	ASSERT_INT_GE(120, now_ms() - start);
+	ASSERT_INT_EQ(4, norder_);
+	ASSERT_INT_EQ(1, order_[0]);
+	ASSERT_INT_EQ(2, order_[1]);
+	ASSERT_INT_EQ(3, order_[2]);
+	ASSERT_INT_EQ(4, order_[3]);
+	ASSERT_FALSE(mloop_timer_is_started(a));
+
+	mloop_timer_unref(a);
+	mloop_timer_unref(b);
+	mloop_timer_unref(c);
+	mloop_timer_unref(d);
+	teardown();
+	return 0;
+}
+
+int test_stopped_timer_does_not_fire(void)
+{
+	setup();
+
+	struct mloop_timer* a = start_timer(MLOOP_TIMER_RELATIVE, 10, on_timeout, 1);
+	struct mloop_timer* b = start_timer(MLOOP_TIMER_RELATIVE, 10, on_timeout, 2);
+	ASSERT_INT_EQ(0, mloop_timer_stop(a));
+
+	run_for(30);
+
+	ASSERT_INT_EQ(1, norder_);
+	ASSERT_INT_EQ(2, order_[0]);
+
+	mloop_timer_unref(a);
+	mloop_timer_unref(b);
+	teardown();
+	return 0;
+}
+
+int test_periodic(void)
+{
+	setup();
+
+	struct mloop_timer* timer =
+		start_timer(MLOOP_TIMER_PERIODIC, 10, on_timeout, 1);
+
+	run_for(55);
+
+	/* Periods missed while the process is not scheduled are skipped */
+	ASSERT_INT_GE(3, norder_);
+	ASSERT_INT_LE(5, norder_);
+	ASSERT_TRUE(mloop_timer_is_started(timer));
+
+	mloop_timer_stop(timer);
+	mloop_timer_unref(timer);
+	teardown();
+	return 0;
+}
+
+int test_precise_periodic(void)
+{
+	setup();
+
+	struct mloop_timer* timer =
+		start_timer(MLOOP_TIMER_PERIODIC | MLOOP_TIMER_PRECISE, 10,
+			    on_timeout, 1);
+
+	run_for(55);
+
+	/* Periods missed while the process is not scheduled are skipped */
+	ASSERT_INT_GE(3, norder_);
+	ASSERT_INT_LE(5, norder_);
+
+	mloop_timer_stop(timer);
+	mloop_timer_unref(timer);
+	teardown();
+	return 0;
+}
+
+static void on_restart_timeout(struct mloop_timer* timer)
+{
+	on_timeout(timer);
+
+	if (norder_ < 3)
+		mloop_timer_start(timer);
+}
+
+int test_restart_from_callback(void)
+{
+	setup();
+
+	struct mloop_timer* timer =
+		start_timer(MLOOP_TIMER_RELATIVE, 5, on_restart_timeout, 1);
+
+	run_for(40);
+
+	ASSERT_INT_EQ(3, norder_);
+
+	mloop_timer_unref(timer);
+	teardown();
+	return 0;
+}
+
+int test_push_back(void)
+{
+	setup();
+
+	struct mloop_timer* timer =
+		start_timer(MLOOP_TIMER_RELATIVE, 50, on_timeout, 1);
+
+	for (int i = 0; i < 4; ++i) {
+		run_for(10);
+		mloop_timer_stop(timer);
+		mloop_timer_start(timer);
+	}
+
+	ASSERT_INT_EQ(0, norder_);
+
+	run_for(60);
+
+	ASSERT_INT_EQ(1, norder_);
+
+	mloop_timer_unref(timer);
+	teardown();
+	return 0;
+}
+
+static uint64_t count_wakeups(uint64_t slack)
+{
+	static struct mloop_stats stats;
+	struct mloop_timer* timer[8];
+
+	for (int i = 0; i < 8; ++i) {
+		timer[i] = mloop_timer_new(loop_);
+		mloop_timer_set_time(timer[i], (5 + i) * 1000000ULL);
+		mloop_timer_set_slack(timer[i], slack);
+		mloop_timer_set_callback(timer[i], on_timeout);
+		mloop_timer_start(timer[i]);
+	}
+
+	run_for(40);
+
+	for (int i = 0; i < 8; ++i)
+		mloop_timer_unref(timer[i]);
+
+	mloop_get_stats(loop_, &stats);
+	return stats.iteration.count;
+}
+
+int test_slack_shares_wakeups(void)
+{
+	setup();
+
+	/* Without slack, this takes a wakeup per timer and one to exit */
+	ASSERT_INT_LE(5, count_wakeups(20000000ULL));
+	ASSERT_INT_EQ(8, norder_);
+
+	teardown();
+	return 0;
+}
+
+static const struct mloop_stats_callback*
+find_callback(const struct mloop_stats* stats, const void* fn)
+{
+	for (size_t i = 0; i < stats->n_callbacks; ++i)
+		if (stats->callback[i].fn == fn)
+			return &stats->callback[i];
+
+	return NULL;
+}
+
+int test_stats(void)
+{
+	setup();
+
+	struct mloop_timer* a = start_timer(MLOOP_TIMER_RELATIVE, 10, on_timeout, 1);
+	struct mloop_timer* b = start_timer(MLOOP_TIMER_RELATIVE, 20, on_timeout, 2);
+
+	run_for(40);
+
+	ASSERT_INT_EQ(2, norder_);
+
+	static struct mloop_stats stats;
+	mloop_get_stats(loop_, &stats);
+
+	ASSERT_TRUE(stats.iteration.count > 0);
+	ASSERT_TRUE(stats.timer_lag.count >= 2);
+
+	const struct mloop_stats_callback* callback =
+		find_callback(&stats, (const void*)on_timeout);
+	ASSERT_TRUE(callback != NULL);
+	ASSERT_INT_EQ(2, callback->duration.count);
+	ASSERT_TRUE(find_callback(&stats, (const void*)on_exit_timeout) != NULL);
+
+	mloop_timer_unref(a);
+	mloop_timer_unref(b);
+	teardown();
+	return 0;
+}
+
+static uint64_t loop_now_[2];
+static uint64_t woken_at_[2];
+
+static void on_loop_now(struct mloop_timer* timer)
+{
+	int id = (int)(intptr_t)mloop_timer_get_context(timer);
+
+	loop_now_[id] = mloop_now(loop_);
+
+	/* Time spent in one callback does not move the other's clock */
+	struct timespec ts = { 0, 2000000 };
+	nanosleep(&ts, NULL);
+
+	woken_at_[id] = now_ms();
+}
+
+int test_now_is_cached_per_iteration(void)
+{
+	setup();
+
+	uint64_t before = now_ms();
+
+	/* Same deadline, so both fire on the same wakeup */
+	struct mloop_timer* a = start_timer(MLOOP_TIMER_RELATIVE, 10, on_loop_now, 0);
+	struct mloop_timer* b = start_timer(MLOOP_TIMER_RELATIVE, 10, on_loop_now, 1);
+
+	run_for(30);
+
+	ASSERT_TRUE(loop_now_[0] != 0);
+	ASSERT_TRUE(loop_now_[0] == loop_now_[1]);
+	ASSERT_TRUE(loop_now_[0] / 1000000ULL >= before + 10);
+	ASSERT_TRUE(loop_now_[0] / 1000000ULL <= woken_at_[0]);
+
+	/* Outside of an iteration it is the current time */
+	uint64_t now = mloop_now(loop_) / 1000000ULL;
+	ASSERT_TRUE(now >= woken_at_[1]);
+	ASSERT_TRUE(now <= now_ms());
+
+	mloop_timer_unref(a);
+	mloop_timer_unref(b);
+	teardown();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_single_shots_fire_in_order);
+	RUN_TEST(test_stopped_timer_does_not_fire);
+	RUN_TEST(test_periodic);
+	RUN_TEST(test_precise_periodic);
+	RUN_TEST(test_restart_from_callback);
+	RUN_TEST(test_push_back);
+	RUN_TEST(test_slack_shares_wakeups);
+	RUN_TEST(test_stats);
+	RUN_TEST(test_now_is_cached_per_iteration);
+	return r;
+}
@@ -0,0 +1,182 @@
+#include "tst.h"
+#include "mloop.h"
+
+#define N_JOBS 200
+
+static struct mloop* loop_;
+static int n_worked_;
+static int n_done_;
+static int order_[N_JOBS];
+
+static void work(struct mloop_work* self)
+{
+	(void)self;
+	__atomic_add_fetch(&n_worked_, 1, __ATOMIC_SEQ_CST);
+}
+
+static void done(struct mloop_work* self)
+{
+	order_[n_done_++] = (intptr_t)mloop_work_get_context(self);
+
+	if (n_done_ == N_JOBS)
+		mloop_exit(loop_);
+}
+
+int test_all_jobs_complete(void)
+{
+	loop_ = mloop_new();
+	mloop_set_job_queue_size(N_JOBS);
+	ASSERT_INT_EQ(0, mloop_require_workers(4));
+
+	for (intptr_t i = 0; i < N_JOBS; ++i) {
+		struct mloop_work* job = mloop_work_new(loop_);
+		mloop_work_set_context(job, (void*)i, NULL);
+		mloop_work_set_work_fn(job, work);
+		mloop_work_set_done_fn(job, done);
+		ASSERT_INT_EQ(0, mloop_work_start(job));
+		mloop_work_unref(job);
+	}
+
+	mloop_run(loop_);
+
+	ASSERT_INT_EQ(N_JOBS, n_worked_);
+	ASSERT_INT_EQ(N_JOBS, n_done_);
+
+	mloop_unref(loop_);
+	return 0;
+}
+
+static void on_async(struct mloop_async* self)
+{
+	order_[n_done_++] = (intptr_t)mloop_async_get_context(self);
+
+	if (n_done_ == 4)
+		mloop_exit(loop_);
+}
+
+int test_async_priority_lanes(void)
+{
+	loop_ = mloop_new();
+	n_done_ = 0;
+
+	static const int priority[] = { 5, 1, 0, 1 };
+
+	for (intptr_t i = 0; i < 4; ++i) {
+		struct mloop_async* async = mloop_async_new(loop_);
+		mloop_async_set_context(async, (void*)i, NULL);
+		mloop_async_set_callback(async, on_async);
+		mloop_async_set_priority(async, priority[i]);
+		ASSERT_INT_EQ(0, mloop_async_start(async));
+		mloop_async_unref(async);
+	}
+
+	mloop_run(loop_);
+
+	ASSERT_INT_EQ(2, order_[0]);
+	ASSERT_INT_EQ(1, order_[1]);
+	ASSERT_INT_EQ(3, order_[2]);
+	ASSERT_INT_EQ(0, order_[3]);
+
+	mloop_unref(loop_);
+	return 0;
+}
+
+static void child_work(struct mloop_work* self)
+{
+	(void)self;
+	__atomic_add_fetch(&n_worked_, 1, __ATOMIC_SEQ_CST);
+}
+
+static void child_done(struct mloop_work* self)
+{
+	(void)self;
+
+	if (++n_done_ == N_JOBS)
+		mloop_exit(loop_);
+}
+
+static void parent_work(struct mloop_work* self)
+{
+	(void)self;
+
+	/* These land on this worker's own deque */
+	for (int i = 0; i < N_JOBS; ++i) {
+		struct mloop_work* job = mloop_work_new(loop_);
+		mloop_work_set_work_fn(job, child_work);
+		mloop_work_set_done_fn(job, child_done);
+		mloop_work_start(job);
+		mloop_work_unref(job);
+	}
+}
+
+int test_jobs_started_from_workers(void)
+{
+	loop_ = mloop_new();
+	n_worked_ = 0;
+	n_done_ = 0;
+
+	mloop_set_work_stealing(1);
+	mloop_set_job_queue_size(N_JOBS);
+	ASSERT_INT_EQ(0, mloop_require_workers(4));
+
+	struct mloop_work* job = mloop_work_new(loop_);
+	mloop_work_set_work_fn(job, parent_work);
+	ASSERT_INT_EQ(0, mloop_work_start(job));
+	mloop_work_unref(job);
+
+	mloop_run(loop_);
+
+	ASSERT_INT_EQ(N_JOBS, n_worked_);
+	ASSERT_INT_EQ(N_JOBS, n_done_);
+
+	mloop_unref(loop_);
+	mloop_set_work_stealing(0);
+	return 0;
+}
+
+static void count_async(struct mloop_async* self)
+{
+	(void)self;
+	++n_done_;
+}
+
+int test_async_wakeups_are_coalesced(void)
+{
+	loop_ = mloop_new();
+	n_done_ = 0;
+
+	for (int i = 0; i < 16; ++i) {
+		struct mloop_async* async = mloop_async_new(loop_);
+		mloop_async_set_callback(async, count_async);
+		ASSERT_INT_EQ(0, mloop_async_start(async));
+		mloop_async_unref(async);
+	}
+
+	/* One wakeup and one pass for all of them */
+	mloop_run_once(loop_);
+	ASSERT_INT_EQ(16, n_done_);
+
+	struct mloop_stats stats;
+	mloop_get_stats(loop_, &stats);
+	ASSERT_UINT_EQ(1, stats.n_wakeups);
+	ASSERT_UINT_EQ(15, stats.n_wakeups_coalesced);
+
+	/* The loop is woken up again after it picked up the last wakeup */
+	mloop_iterate(loop_);
+	mloop_run_once(loop_);
+	mloop_get_stats(loop_, &stats);
+	ASSERT_UINT_EQ(2, stats.n_wakeups);
+
+	mloop_unref(loop_);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_all_jobs_complete);
+	RUN_TEST(test_async_priority_lanes);
+	RUN_TEST(test_jobs_started_from_workers);
+	RUN_TEST(test_async_wakeups_are_coalesced);
+	return r;
+}
@@ -0,0 +1,102 @@
+#include "tst.h"
+#include "mpmcq.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#define N_THREADS 4
+#define N_ITEMS 100000
+
+static struct mpmcq queue_;
+static unsigned long sum_;
+
+int test_fifo(void)
+{
+	struct mpmcq q;
+	void* data;
+
+	ASSERT_INT_EQ(0, mpmcq_init(&q, 3));
+	ASSERT_TRUE(mpmcq_is_empty(&q));
+	ASSERT_INT_EQ(-1, mpmcq_pop(&q, &data));
+
+	for (intptr_t i = 1; i <= 4; ++i)
+		ASSERT_INT_EQ(0, mpmcq_push(&q, (void*)i));
+
+	ASSERT_INT_EQ(-1, mpmcq_push(&q, (void*)5));
+	ASSERT_FALSE(mpmcq_is_empty(&q));
+
+	for (intptr_t i = 1; i <= 4; ++i) {
+		ASSERT_INT_EQ(0, mpmcq_pop(&q, &data));
+		ASSERT_INT_EQ(i, (intptr_t)data);
+	}
+
+	ASSERT_TRUE(mpmcq_is_empty(&q));
+
+	/* Wrap around */
+	ASSERT_INT_EQ(0, mpmcq_push(&q, (void*)6));
+	ASSERT_INT_EQ(0, mpmcq_pop(&q, &data));
+	ASSERT_INT_EQ(6, (intptr_t)data);
+
+	mpmcq_destroy(&q);
+	return 0;
+}
+
+static void* produce(void* arg)
+{
+	(void)arg;
+
+	for (uintptr_t i = 1; i <= N_ITEMS; ++i)
+		while (mpmcq_push(&queue_, (void*)i) < 0)
+			sched_yield();
+
+	return NULL;
+}
+
+static void* consume(void* arg)
+{
+	(void)arg;
+	unsigned long sum = 0;
+
+	for (int i = 0; i < N_ITEMS; ++i) {
+		void* data;
+		while (mpmcq_pop(&queue_, &data) < 0)
+			sched_yield();
+		sum += (uintptr_t)data;
+	}
+
+	__atomic_add_fetch(&sum_, sum, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+int test_many_producers_and_consumers(void)
+{
+	pthread_t producer[N_THREADS], consumer[N_THREADS];
+
+	ASSERT_INT_EQ(0, mpmcq_init(&queue_, 64));
+
+	for (int i = 0; i < N_THREADS; ++i) {
+		pthread_create(&producer[i], NULL, produce, NULL);
+		pthread_create(&consumer[i], NULL, consume, NULL);
+	}
+
+	for (int i = 0; i < N_THREADS; ++i) {
+		pthread_join(producer[i], NULL);
+		pthread_join(consumer[i], NULL);
+	}
+
+	unsigned long expected = N_THREADS * (N_ITEMS * (N_ITEMS + 1UL) / 2);
+	ASSERT_TRUE(sum_ == expected);
+	ASSERT_TRUE(mpmcq_is_empty(&queue_));
+
+	mpmcq_destroy(&queue_);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_fifo);
+	RUN_TEST(test_many_producers_and_consumers);
+	return r;
+}
@@ -171,11 +171,141 @@ int test_net__wait_for_bootup()
 	return 0;
 }
 
+static struct co_net_scan scan;
+
+static void make_response(struct can_frame* cf, int nodeid, int cs,
+			  int index, int subindex)
+{
+	sdo_clear_frame(cf);
+	cf->can_id = R_TSDO + nodeid;
+	cf->can_dlc = 8;
+	sdo_set_cs(cf, cs);
+	sdo_set_index(cf, index);
+	sdo_set_subindex(cf, subindex);
+}
+
+static void make_expedited(struct can_frame* cf, int nodeid, int index,
+			   int subindex, uint32_t value)
+{
+	make_response(cf, nodeid, SDO_SCS_UL_INIT_RES, index, subindex);
+	sdo_expediate(cf);
+	sdo_indicate_size(cf);
+	sdo_set_expediated_size(cf, 4);
+	byteorder(&cf->data[SDO_EXPEDIATED_DATA_IDX], &value, 4);
+}
+
+static void make_segment(struct can_frame* cf, int nodeid, int toggle,
+			 const char* text, int is_end)
+{
+	sdo_clear_frame(cf);
+	cf->can_id = R_TSDO + nodeid;
+	cf->can_dlc = 8;
+	sdo_set_cs(cf, SDO_SCS_UL_SEG_RES);
+	if (toggle)
+		sdo_toggle(cf);
+	sdo_set_segment_size(cf, strlen(text));
+	memcpy(&cf->data[SDO_SEGMENT_IDX], text, strlen(text));
+	if (is_end)
+		sdo_end_segment(cf);
+}
+
+int test_net_scan()
+{
+	struct can_frame out[CANOPEN_NODEID_MAX];
+	struct can_frame in;
+
+	ASSERT_INT_EQ(3, co_net_scan_begin(&scan, 1, 3, 100, out, 1000));
+	ASSERT_INT_EQ(R_RSDO + 1, out[0].can_id);
+	ASSERT_INT_EQ(SDO_CCS_UL_INIT_REQ, sdo_get_cs(&out[2]));
+	ASSERT_INT_EQ(0x1000, sdo_get_index(&out[2]));
+	ASSERT_INT_EQ(100, co_net_scan_expire(&scan, 1000));
+
+	/* Each answer is followed by the next request */
+	make_expedited(&in, 2, 0x1000, 0, 0x191);
+	ASSERT_INT_EQ(1, co_net_scan_feed(&scan, &in, out, 1010));
+	ASSERT_INT_EQ(R_RSDO + 2, out[0].can_id);
+	ASSERT_INT_EQ(0x1018, sdo_get_index(&out[0]));
+	ASSERT_INT_EQ(1, sdo_get_subindex(&out[0]));
+
+	/* Answers to someone else are not taken */
+	make_expedited(&in, 2, 0x6000, 0, 1);
+	ASSERT_INT_EQ(0, co_net_scan_feed(&scan, &in, out, 1010));
+
+	make_expedited(&in, 2, 0x1018, 1, 0x1234);
+	ASSERT_INT_EQ(1, co_net_scan_feed(&scan, &in, out, 1020));
+
+	for (int i = 2; i <= 4; ++i) {
+		make_response(&in, 2, SDO_SCS_ABORT, 0x1018, i);
+		ASSERT_INT_EQ(1, co_net_scan_feed(&scan, &in, out, 1020));
+	}
+
+	ASSERT_INT_EQ(0x1008, sdo_get_index(&out[0]));
+
+	/* The name comes in segments */
+	make_response(&in, 2, SDO_SCS_UL_INIT_RES, 0x1008, 0);
+	ASSERT_INT_EQ(1, co_net_scan_feed(&scan, &in, out, 1030));
+	ASSERT_INT_EQ(SDO_CCS_UL_SEG_REQ, sdo_get_cs(&out[0]));
+	ASSERT_FALSE(sdo_is_toggled(&out[0]));
+
+	make_segment(&in, 2, 0, "Servo d", 0);
+	ASSERT_INT_EQ(1, co_net_scan_feed(&scan, &in, out, 1040));
+	ASSERT_TRUE(sdo_is_toggled(&out[0]));
+
+	make_segment(&in, 2, 1, "rive", 1);
+	ASSERT_INT_EQ(1, co_net_scan_feed(&scan, &in, out, 1050));
+	ASSERT_INT_EQ(0x1009, sdo_get_index(&out[0]));
+
+	make_response(&in, 2, SDO_SCS_ABORT, 0x1009, 0);
+	ASSERT_INT_EQ(1, co_net_scan_feed(&scan, &in, out, 1060));
+
+	make_expedited(&in, 2, 0x100a, 0, 0x322e31);
+	ASSERT_INT_EQ(0, co_net_scan_feed(&scan, &in, out, 1070));
+
+	/* Nodes 1 and 3 never answer */
+	ASSERT_INT_EQ(30, co_net_scan_expire(&scan, 1070));
+	ASSERT_INT_EQ(-1, co_net_scan_expire(&scan, 1100));
+
+	ASSERT_FALSE(scan.node[1].is_present);
+	ASSERT_FALSE(scan.node[3].is_present);
+
+	const struct co_net_node_info* node = &scan.node[2];
+	ASSERT_TRUE(node->is_present);
+	ASSERT_UINT_EQ(0x191, node->device_type);
+	ASSERT_UINT_EQ(0x1234, node->vendor_id);
+	ASSERT_UINT_EQ(0, node->product_code);
+	ASSERT_STR_EQ("Servo drive", node->name);
+	ASSERT_STR_EQ("", node->hw_version);
+	ASSERT_STR_EQ("1.2", node->sw_version);
+	return 0;
+}
+
+int test_net_scan_bad_toggle()
+{
+	struct can_frame out[CANOPEN_NODEID_MAX];
+	struct can_frame in;
+
+	co_net_scan_begin(&scan, 5, 5, 100, out, 0);
+
+	make_response(&in, 5, SDO_SCS_UL_INIT_RES, 0x1000, 0);
+	ASSERT_INT_EQ(1, co_net_scan_feed(&scan, &in, out, 10));
+
+	make_segment(&in, 5, 1, "abc", 1);
+	ASSERT_INT_EQ(1, co_net_scan_feed(&scan, &in, out, 20));
+	ASSERT_INT_EQ(SDO_CCS_ABORT, sdo_get_cs(&out[0]));
+	ASSERT_UINT_EQ(SDO_ABORT_TOGGLE, sdo_get_abort_code(&out[0]));
+
+	ASSERT_TRUE(scan.node[5].is_present);
+	ASSERT_INT_EQ(-1, co_net_scan_expire(&scan, 20));
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
 	RUN_TEST(test_net_write);
 	RUN_TEST(test_net_read);
+	RUN_TEST(test_net_scan);
+	RUN_TEST(test_net_scan_bad_toggle);
 //	RUN_TEST(test_net__send_nmt);
 //	RUN_TEST(test_net__wait_for_bootup);
 	return r;
@@ -0,0 +1,103 @@
+#include "tst.h"
+#include "objpool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#define N_THREADS 4
+#define N_OBJECTS 200
+#define N_ROUNDS 100
+
+struct thing {
+	uint64_t id;
+	char payload[40];
+};
+
+static struct objpool pool_ = OBJPOOL_INITIALIZER(struct thing);
+
+int test_reuse(void)
+{
+	struct thing* a = objpool_alloc(&pool_);
+	ASSERT_TRUE(a != NULL);
+	ASSERT_INT_EQ(0, (uintptr_t)a % 16);
+
+	objpool_free(&pool_, a);
+
+	/* The last object freed on a thread is handed out first */
+	struct thing* b = objpool_alloc(&pool_);
+	ASSERT_PTR_EQ(a, b);
+
+	objpool_free(&pool_, b);
+	objpool_free(&pool_, NULL);
+	return 0;
+}
+
+int test_distinct_objects(void)
+{
+	struct thing* obj[N_OBJECTS];
+
+	for (int i = 0; i < N_OBJECTS; ++i) {
+		obj[i] = objpool_alloc(&pool_);
+		ASSERT_TRUE(obj[i] != NULL);
+		memset(obj[i], 0, sizeof(*obj[i]));
+		obj[i]->id = i;
+	}
+
+	for (int i = 0; i < N_OBJECTS; ++i)
+		ASSERT_INT_EQ(i, obj[i]->id);
+
+	for (int i = 0; i < N_OBJECTS; ++i)
+		objpool_free(&pool_, obj[i]);
+
+	return 0;
+}
+
+static void* churn(void* arg)
+{
+	uint64_t id = (uintptr_t)arg;
+	struct thing* obj[N_OBJECTS];
+
+	for (int round = 0; round < N_ROUNDS; ++round) {
+		for (int i = 0; i < N_OBJECTS; ++i) {
+			obj[i] = objpool_alloc(&pool_);
+			if (!obj[i])
+				return (void*)1;
+			obj[i]->id = id * N_OBJECTS + i;
+		}
+
+		for (int i = 0; i < N_OBJECTS; ++i)
+			if (obj[i]->id != id * N_OBJECTS + i)
+				return (void*)1;
+
+		for (int i = 0; i < N_OBJECTS; ++i)
+			objpool_free(&pool_, obj[i]);
+	}
+
+	return NULL;
+}
+
+int test_threads(void)
+{
+	pthread_t thread[N_THREADS];
+
+	for (uintptr_t i = 0; i < N_THREADS; ++i)
+		pthread_create(&thread[i], NULL, churn, (void*)i);
+
+	for (int i = 0; i < N_THREADS; ++i) {
+		void* result = NULL;
+		pthread_join(thread[i], &result);
+		ASSERT_PTR_EQ(NULL, result);
+	}
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_reuse);
+	RUN_TEST(test_distinct_objects);
+	RUN_TEST(test_threads);
+	return r;
+}
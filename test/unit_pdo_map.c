@@ -0,0 +1,153 @@
+#include "tst.h"
+#include "canopen/pdo_map.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static struct pdo_map map_;
+
+static int test_compile(void)
+{
+	const uint32_t mapping[] = {
+		CO_PDO_MAPPING(0x6041, 0, 16),
+		CO_PDO_MAPPING(0x6064, 0, 32),
+		CO_PDO_MAPPING(0x2000, 1, 1),
+	};
+
+	ASSERT_INT_EQ(0, pdo_map_compile(&map_, mapping, 3, NULL));
+	ASSERT_TRUE(map_.is_ready);
+	ASSERT_UINT_EQ(3, map_.n_entries);
+	ASSERT_UINT_EQ(7, map_.size);
+
+	ASSERT_INT_EQ(0, pdo_map_find(&map_, 0x6041, 0));
+	ASSERT_INT_EQ(2, pdo_map_find(&map_, 0x2000, 1));
+	ASSERT_INT_EQ(-1, pdo_map_find(&map_, 0x2000, 2));
+
+	ASSERT_UINT_EQ(6, map_.entry[2].byte);
+	ASSERT_UINT_EQ(0, map_.entry[2].shift);
+	ASSERT_UINT_EQ(32, map_.signal[1].length);
+	return 0;
+}
+
+static int test_compile_invalid(void)
+{
+	const uint32_t zero_length[] = { CO_PDO_MAPPING(0x6041, 0, 0) };
+	ASSERT_INT_EQ(-1, pdo_map_compile(&map_, zero_length, 1, NULL));
+	ASSERT_FALSE(map_.is_ready);
+
+	uint32_t too_long[9];
+	for (int i = 0; i < 9; ++i)
+		too_long[i] = CO_PDO_MAPPING(0x2000, i + 1, 64);
+
+	ASSERT_INT_EQ(0, pdo_map_compile(&map_, too_long, 8, NULL));
+	ASSERT_INT_EQ(-1, pdo_map_compile(&map_, too_long, 9, NULL));
+	return 0;
+}
+
+static int test_decode(void)
+{
+	const uint32_t mapping[] = {
+		CO_PDO_MAPPING(0x2000, 1, 4),
+		CO_PDO_MAPPING(0x2000, 2, 12),
+		CO_PDO_MAPPING(0x2000, 3, 8),
+	};
+
+	ASSERT_INT_EQ(0, pdo_map_compile(&map_, mapping, 3, NULL));
+
+	const uint8_t data[] = { 0x21, 0x43, 0x65 };
+	ASSERT_INT_EQ(0, pdo_map_decode(&map_, data, sizeof(data)));
+
+	ASSERT_UINT_EQ(0x1, map_.signal[0].u);
+	ASSERT_UINT_EQ(0x432, map_.signal[1].u);
+	ASSERT_UINT_EQ(0x65, map_.signal[2].u);
+
+	ASSERT_INT_EQ(-1, pdo_map_decode(&map_, data, 2));
+	return 0;
+}
+
+static int test_decode_types(void)
+{
+	const uint32_t mapping[] = {
+		/* Dummy entries have their type as index */
+		CO_PDO_MAPPING(0x0003, 0, 16),
+		CO_PDO_MAPPING(0x0008, 0, 32),
+	};
+
+	ASSERT_INT_EQ(0, pdo_map_compile(&map_, mapping, 2, NULL));
+	ASSERT_INT_EQ(CO_SIGNAL_SIGNED, map_.signal[0].type);
+	ASSERT_INT_EQ(CO_SIGNAL_REAL, map_.signal[1].type);
+
+	uint8_t data[6] = { 0xfe, 0xff };
+	float f = 1.5f;
+	memcpy(&data[2], &f, sizeof(f));
+
+	ASSERT_INT_EQ(0, pdo_map_decode(&map_, data, sizeof(data)));
+	ASSERT_INT_EQ(-2, map_.signal[0].i);
+	ASSERT_DOUBLE_EQ(1.5, map_.signal[1].f);
+	return 0;
+}
+
+static int test_unaligned_64_bits(void)
+{
+	const uint32_t mapping[] = {
+		CO_PDO_MAPPING(0x2000, 1, 4),
+		CO_PDO_MAPPING(0x2000, 2, 64),
+	};
+
+	ASSERT_INT_EQ(0, pdo_map_compile(&map_, mapping, 2, NULL));
+	ASSERT_UINT_EQ(9, map_.size);
+
+	map_.signal[0].u = 0xa;
+	map_.signal[1].u = 0x0123456789abcdefULL;
+
+	uint8_t data[PDO_MAP_SIZE_MAX];
+	ASSERT_INT_EQ(9, pdo_map_encode(&map_, data, sizeof(data)));
+	ASSERT_UINT_EQ(0xfa, data[0]);
+	ASSERT_UINT_EQ(0x0, data[8]);
+
+	map_.signal[0].u = 0;
+	map_.signal[1].u = 0;
+
+	ASSERT_INT_EQ(0, pdo_map_decode(&map_, data, 9));
+	ASSERT_UINT_EQ(0xa, map_.signal[0].u);
+	ASSERT_TRUE(map_.signal[1].u == 0x0123456789abcdefULL);
+	return 0;
+}
+
+static int test_encode(void)
+{
+	const uint32_t mapping[] = {
+		CO_PDO_MAPPING(0x6040, 0, 16),
+		CO_PDO_MAPPING(0x0002, 0, 8),
+		CO_PDO_MAPPING(0x60ff, 0, 32),
+	};
+
+	ASSERT_INT_EQ(0, pdo_map_compile(&map_, mapping, 3, NULL));
+
+	map_.signal[0].u = 0x000f;
+	map_.signal[1].i = -1;
+	map_.signal[2].u = 0x12345678;
+
+	uint8_t data[8];
+	memset(data, 0xaa, sizeof(data));
+
+	ASSERT_INT_EQ(7, pdo_map_encode(&map_, data, sizeof(data)));
+
+	const uint8_t expected[] = { 0x0f, 0x00, 0xff, 0x78, 0x56, 0x34, 0x12 };
+	ASSERT_INT_EQ(0, memcmp(expected, data, sizeof(expected)));
+
+	ASSERT_INT_EQ(-1, pdo_map_encode(&map_, data, 6));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_compile);
+	RUN_TEST(test_compile_invalid);
+	RUN_TEST(test_decode);
+	RUN_TEST(test_decode_types);
+	RUN_TEST(test_unaligned_64_bits);
+	RUN_TEST(test_encode);
+	return r;
+}
@@ -0,0 +1,117 @@
+#include "tst.h"
+#include "prioq.h"
+
+static int pop_data(struct prioq* queue)
+{
+	struct prioq_elem elem;
+	if (prioq_pop(queue, &elem, 0) < 0)
+		return -1;
+
+	return (int)(intptr_t)elem.data;
+}
+
+static int test_priority_order(void)
+{
+	struct prioq queue;
+	ASSERT_INT_EQ(0, prioq_init(&queue, 4));
+
+	static const unsigned long priority[] = { 3, 0, 1000, 63, 1, 64, 0 };
+
+	for (intptr_t i = 0; i < 7; ++i)
+		ASSERT_INT_EQ(0, prioq_insert(&queue, priority[i], (void*)i));
+
+	ASSERT_INT_EQ(1, pop_data(&queue));
+	ASSERT_INT_EQ(6, pop_data(&queue));
+	ASSERT_INT_EQ(4, pop_data(&queue));
+	ASSERT_INT_EQ(0, pop_data(&queue));
+	ASSERT_INT_EQ(3, pop_data(&queue));
+	ASSERT_INT_EQ(5, pop_data(&queue));
+	ASSERT_INT_EQ(2, pop_data(&queue));
+	ASSERT_INT_EQ(-1, pop_data(&queue));
+
+	prioq_destroy(&queue);
+	return 0;
+}
+
+static int test_fifo_within_priority(void)
+{
+	struct prioq queue;
+	ASSERT_INT_EQ(0, prioq_init(&queue, 1));
+
+	for (intptr_t i = 0; i < 100; ++i)
+		ASSERT_INT_EQ(0, prioq_insert(&queue, i % 2 ? 2 : 100,
+					      (void*)i));
+
+	ASSERT_TRUE(queue.size >= 50);
+
+	for (int i = 1; i < 100; i += 2)
+		ASSERT_INT_EQ(i, pop_data(&queue));
+
+	for (int i = 0; i < 100; i += 2)
+		ASSERT_INT_EQ(i, pop_data(&queue));
+
+	prioq_destroy(&queue);
+	return 0;
+}
+
+static int test_slots_are_reused(void)
+{
+	struct prioq queue;
+	ASSERT_INT_EQ(0, prioq_init(&queue, 2));
+
+	for (intptr_t i = 0; i < 50; ++i) {
+		ASSERT_INT_EQ(0, prioq_insert(&queue, 7, (void*)i));
+		ASSERT_INT_EQ(0, prioq_insert(&queue, 5, (void*)(i + 100)));
+		ASSERT_INT_EQ(i + 100, pop_data(&queue));
+		ASSERT_INT_EQ(i, pop_data(&queue));
+	}
+
+	ASSERT_UINT_EQ(2, queue.size);
+
+	prioq_destroy(&queue);
+	return 0;
+}
+
+static int test_copy_and_move(void)
+{
+	struct prioq src, dst;
+	ASSERT_INT_EQ(0, prioq_init(&src, 2));
+	ASSERT_INT_EQ(0, prioq_init(&dst, 8));
+
+	for (intptr_t i = 0; i < 6; ++i)
+		ASSERT_INT_EQ(0, prioq_insert(&src, i % 3 * 40, (void*)i));
+
+	ASSERT_INT_EQ(0, prioq_copy(&dst, &src));
+	ASSERT_INT_EQ(0, pop_data(&src));
+
+	ASSERT_INT_EQ(0, prioq_move(&src, &dst));
+	ASSERT_INT_EQ(-1, pop_data(&dst));
+
+	ASSERT_INT_EQ(0, pop_data(&src));
+	ASSERT_INT_EQ(3, pop_data(&src));
+	ASSERT_INT_EQ(1, pop_data(&src));
+	ASSERT_INT_EQ(4, pop_data(&src));
+	ASSERT_INT_EQ(2, pop_data(&src));
+	ASSERT_INT_EQ(5, pop_data(&src));
+	ASSERT_INT_EQ(-1, pop_data(&src));
+
+	/* Spare slots of the destination stay usable */
+	for (intptr_t i = 0; i < 8; ++i)
+		ASSERT_INT_EQ(0, prioq_insert(&src, 1, (void*)i));
+	for (int i = 0; i < 8; ++i)
+		ASSERT_INT_EQ(i, pop_data(&src));
+
+	prioq_destroy(&dst);
+	prioq_destroy(&src);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_priority_order);
+	RUN_TEST(test_fifo_within_priority);
+	RUN_TEST(test_slots_are_reused);
+	RUN_TEST(test_copy_and_move);
+	return r;
+}
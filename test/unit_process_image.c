@@ -0,0 +1,110 @@
+#include "tst.h"
+#include "canopen/process_image.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+static char iface[64];
+
+static int test_not_open(void)
+{
+	ASSERT_FALSE(co_pi_is_open());
+	ASSERT_TRUE(co_pi_open(iface) == NULL);
+
+	/* Writing without an image does nothing */
+	co_pi_write(CO_PI_TPDO, 1, 1, "x", 1, 0);
+	return 0;
+}
+
+static int test_write_read(void)
+{
+	ASSERT_INT_EQ(0, co_pi_init(iface));
+	ASSERT_TRUE(co_pi_is_open());
+
+	const struct co_pi* pi = co_pi_open(iface);
+	ASSERT_TRUE(pi != NULL);
+
+	struct co_pi_value value;
+	ASSERT_INT_EQ(-1, co_pi_read(pi, CO_PI_TPDO, 5, 2, &value));
+
+	co_pi_write(CO_PI_TPDO, 5, 2, "abcd", 4, 1234);
+	co_pi_write(CO_PI_RPDO, 5, 2, "xy", 2, 5678);
+
+	ASSERT_INT_EQ(0, co_pi_read(pi, CO_PI_TPDO, 5, 2, &value));
+	ASSERT_UINT_EQ(4, value.len);
+	ASSERT_UINT_EQ(1234, value.timestamp);
+	ASSERT_INT_EQ(0, memcmp(value.data, "abcd", 4));
+
+	ASSERT_INT_EQ(0, co_pi_read(pi, CO_PI_RPDO, 5, 2, &value));
+	ASSERT_UINT_EQ(2, value.len);
+	ASSERT_INT_EQ(0, memcmp(value.data, "xy", 2));
+
+	ASSERT_INT_EQ(-1, co_pi_read(pi, CO_PI_TPDO, 5, 1, &value));
+	ASSERT_INT_EQ(-1, co_pi_read(pi, CO_PI_TPDO, 5, 5, &value));
+	ASSERT_INT_EQ(-1, co_pi_read(pi, CO_PI_TPDO, CO_PI_NODE_COUNT, 1,
+				     &value));
+
+	co_pi_close(pi);
+	co_pi_cleanup();
+	ASSERT_FALSE(co_pi_is_open());
+	ASSERT_TRUE(co_pi_open(iface) == NULL);
+	return 0;
+}
+
+static volatile int is_writing;
+
+static void* writer(void* arg)
+{
+	(void)arg;
+	uint8_t data[CO_PI_DATA_SIZE];
+
+	for (uint64_t i = 1; i <= 100000; ++i) {
+		memset(data, i & 0xff, sizeof(data));
+		co_pi_write(CO_PI_TPDO, 1, 1, data, sizeof(data), i);
+	}
+
+	is_writing = 0;
+	return NULL;
+}
+
+static int test_snapshots_are_consistent(void)
+{
+	ASSERT_INT_EQ(0, co_pi_init(iface));
+
+	const struct co_pi* pi = co_pi_open(iface);
+	ASSERT_TRUE(pi != NULL);
+
+	is_writing = 1;
+
+	pthread_t thread;
+	ASSERT_INT_EQ(0, pthread_create(&thread, NULL, writer, NULL));
+
+	while (is_writing) {
+		struct co_pi_value value;
+		if (co_pi_read(pi, CO_PI_TPDO, 1, 1, &value) < 0)
+			continue;
+
+		ASSERT_UINT_EQ(CO_PI_DATA_SIZE, value.len);
+
+		for (size_t i = 0; i < value.len; ++i)
+			ASSERT_UINT_EQ(value.timestamp & 0xff, value.data[i]);
+	}
+
+	pthread_join(thread, NULL);
+
+	co_pi_close(pi);
+	co_pi_cleanup();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	snprintf(iface, sizeof(iface), "unit-test-%d", getpid());
+	RUN_TEST(test_not_open);
+	RUN_TEST(test_write_read);
+	RUN_TEST(test_snapshots_are_consistent);
+	return r;
+}
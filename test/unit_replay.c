@@ -0,0 +1,206 @@
+#include "tst.h"
+#include "sock.h"
+#include "trace-buffer.h"
+#include "canopen/replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+
+static char trace_path_[64];
+static char output_path_[64];
+
+static struct sock replayer_;
+static struct sock peer_;
+
+/* Master and node output, interleaved */
+static const uint32_t trace_ids_[] = {
+	0x000, 0x185, 0x080, 0x205, 0x605, 0x585, 0x705, 0x085,
+};
+
+#define N_TRACE_IDS (sizeof(trace_ids_) / sizeof(trace_ids_[0]))
+
+static int write_trace(uint64_t interval)
+{
+	FILE* stream = fopen(trace_path_, "w");
+	ASSERT_TRUE(stream != NULL);
+
+	for (size_t i = 0; i < N_TRACE_IDS; ++i) {
+		struct tb_frame frame;
+		memset(&frame, 0, sizeof(frame));
+
+		frame.timestamp = 1520000000000000ULL + i * interval;
+		frame.cf.can_id = trace_ids_[i];
+		frame.cf.can_dlc = 1;
+		frame.cf.data[0] = i;
+
+		fwrite(&frame, sizeof(frame), 1, stream);
+	}
+
+	fclose(stream);
+	return 0;
+}
+
+static int receive(uint32_t* ids, int max)
+{
+	struct can_frame cf[16];
+
+	ssize_t count = sock_recv_batch(&peer_, cf, NULL, 16, MSG_DONTWAIT);
+	if (count < 0)
+		return 0;
+
+	for (ssize_t i = 0; i < count && i < max; ++i)
+		ids[i] = cf[i].can_id;
+
+	return count;
+}
+
+static int test_replays_node_output()
+{
+	ASSERT_INT_EQ(0, write_trace(0));
+
+	struct co_replay_params params = {
+		.path = trace_path_,
+		.speed = 0.0,
+	};
+
+	struct co_replay_stats stats;
+	ASSERT_INT_EQ(0, co_replay_sock(&replayer_, &params, &stats));
+	ASSERT_TRUE(stats.n_sent == 4);
+	ASSERT_TRUE(stats.n_skipped == 4);
+
+	uint32_t ids[16];
+	ASSERT_INT_EQ(4, receive(ids, 16));
+	ASSERT_INT_EQ(0x185, ids[0]);
+	ASSERT_INT_EQ(0x585, ids[1]);
+	ASSERT_INT_EQ(0x705, ids[2]);
+	ASSERT_INT_EQ(0x085, ids[3]);
+
+	return 0;
+}
+
+static int test_replays_all()
+{
+	ASSERT_INT_EQ(0, write_trace(0));
+
+	struct co_replay_params params = {
+		.path = trace_path_,
+		.speed = 0.0,
+		.objects = CO_REPLAY_ALL,
+	};
+
+	struct co_replay_stats stats;
+	ASSERT_INT_EQ(0, co_replay_sock(&replayer_, &params, &stats));
+	ASSERT_TRUE(stats.n_sent == N_TRACE_IDS);
+
+	uint32_t ids[16];
+	ASSERT_INT_EQ(N_TRACE_IDS, receive(ids, 16));
+
+	for (size_t i = 0; i < N_TRACE_IDS; ++i)
+		ASSERT_INT_EQ(trace_ids_[i], ids[i]);
+
+	return 0;
+}
+
+static int test_records_output()
+{
+	ASSERT_INT_EQ(0, write_trace(0));
+
+	struct can_frame cf[2];
+	memset(cf, 0, sizeof(cf));
+	cf[0].can_id = 0x205;
+	cf[1].can_id = 0x605;
+	ASSERT_INT_EQ(2, sock_send_batch(&peer_, cf, 2, 0));
+
+	struct co_replay_params params = {
+		.path = trace_path_,
+		.output = output_path_,
+		.speed = 0.0,
+		.linger = 10,
+	};
+
+	struct co_replay_stats stats;
+	ASSERT_INT_EQ(0, co_replay_sock(&replayer_, &params, &stats));
+	ASSERT_TRUE(stats.n_received == 2);
+
+	uint32_t ids[16];
+	receive(ids, 16);
+
+	FILE* stream = fopen(output_path_, "r");
+	ASSERT_TRUE(stream != NULL);
+
+	struct tb_frame frame[3];
+	ASSERT_INT_EQ(2, fread(frame, sizeof(frame[0]), 3, stream));
+	fclose(stream);
+
+	ASSERT_INT_EQ(0x205, frame[0].cf.can_id);
+	ASSERT_INT_EQ(0x605, frame[1].cf.can_id);
+
+	return 0;
+}
+
+static int test_keeps_timing()
+{
+	/* The 4 node frames are 10 ms apart in the trace */
+	ASSERT_INT_EQ(0, write_trace(5000));
+
+	struct co_replay_params params = {
+		.path = trace_path_,
+		.speed = 1.0,
+	};
+
+	struct co_replay_stats stats;
+	ASSERT_INT_EQ(0, co_replay_sock(&replayer_, &params, &stats));
+	ASSERT_TRUE(stats.n_sent == 4);
+	ASSERT_TRUE(stats.duration >= 30000);
+	ASSERT_TRUE(stats.duration < 1000000);
+
+	params.speed = 3.0;
+	ASSERT_INT_EQ(0, co_replay_sock(&replayer_, &params, &stats));
+	ASSERT_TRUE(stats.duration >= 10000);
+	ASSERT_TRUE(stats.duration < 30000);
+
+	uint32_t ids[16];
+	receive(ids, 16);
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	strcpy(trace_path_, "/tmp/unit_replay.XXXXXX");
+	int fd = mkstemp(trace_path_);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	strcpy(output_path_, "/tmp/unit_replay.XXXXXX");
+	fd = mkstemp(output_path_);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		return 1;
+
+	sock_init(&replayer_, SOCK_TYPE_TCP, fds[0], NULL);
+	sock_init(&peer_, SOCK_TYPE_TCP, fds[1], NULL);
+
+	RUN_TEST(test_replays_node_output);
+	RUN_TEST(test_replays_all);
+	RUN_TEST(test_records_output);
+	RUN_TEST(test_keeps_timing);
+
+	close(fds[0]);
+	close(fds[1]);
+	unlink(trace_path_);
+	unlink(output_path_);
+	return r;
+}
@@ -1,11 +1,14 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <sys/uio.h>
 
 #include "tst.h"
 #include "fff.h"
 #include "rest.h"
 #include "vector.h"
+#include "mloop.h"
 
 DEFINE_FFF_GLOBALS;
 
@@ -16,6 +19,15 @@ FAKE_VALUE_FUNC(int, close, int);
 FAKE_VALUE_FUNC(int, net_dont_block, int);
 FAKE_VALUE_FUNC(int, net_reuse_addr, int);
 FAKE_VALUE_FUNC(ssize_t, read, int, void*, size_t);
+FAKE_VALUE_FUNC(int, mloop_work_start, struct mloop_work*);
+FAKE_VOID_FUNC(mloop_work_ref, struct mloop_work*);
+FAKE_VALUE_FUNC(int, mloop_work_unref, struct mloop_work*);
+FAKE_VOID_FUNC(mloop_work_set_priority, struct mloop_work*, unsigned long);
+FAKE_VALUE_FUNC(ssize_t, net_send_iov, int, struct iovec*, int);
+FAKE_VALUE_FUNC(int, shutdown, int, int);
+FAKE_VALUE_FUNC(int, mloop_socket_get_fd, const struct mloop_socket*);
+FAKE_VOID_FUNC(mloop_socket_set_event, struct mloop_socket*,
+	       enum mloop_socket_event);
 
 static void reset_fakes(void)
 {
@@ -26,6 +38,14 @@ static void reset_fakes(void)
 	RESET_FAKE(net_dont_block);
 	RESET_FAKE(net_reuse_addr);
 	RESET_FAKE(read);
+	RESET_FAKE(mloop_work_start);
+	RESET_FAKE(mloop_work_ref);
+	RESET_FAKE(mloop_work_unref);
+	RESET_FAKE(mloop_work_set_priority);
+	RESET_FAKE(net_send_iov);
+	RESET_FAKE(shutdown);
+	RESET_FAKE(mloop_socket_get_fd);
+	RESET_FAKE(mloop_socket_set_event);
 }
 
 static struct rest_service*
@@ -261,6 +281,263 @@ static int test_read__twice(void)
 	return 0;
 }
 
+static int test_next_request(void)
+{
+	const char* text =
+	"PUT /foo HTTP/1.1\r\n"
+	"Content-Length: 3\r\n"
+	"\r\n"
+	"abc"
+	"GET /bar HTTP/1.1\r\n"
+	"\r\n";
+
+	struct rest_client client;
+	memset(&client, 0, sizeof(client));
+	vector_init(&client.buffer, 16);
+	vector_append(&client.buffer, text, strlen(text));
+
+	ASSERT_INT_EQ(1, rest__have_head(&client.buffer));
+	ASSERT_INT_EQ(0, http_req_parse(&client.req, client.buffer.data));
+	ASSERT_UINT_EQ(3, client.req.content_length);
+	ASSERT_TRUE(arena_alloc(&client.arena, 100) != NULL);
+	client.state = REST_CLIENT_DONE;
+
+	/* What the request allocated goes with it */
+	rest__next_request(&client);
+	ASSERT_INT_EQ(REST_CLIENT_START, client.state);
+	ASSERT_TRUE(client.arena.blocks == NULL);
+	ASSERT_UINT_EQ(strlen("GET /bar HTTP/1.1\r\n\r\n"), client.buffer.index);
+
+	ASSERT_INT_EQ(1, rest__have_head(&client.buffer));
+	ASSERT_INT_EQ(0, http_req_parse(&client.req, client.buffer.data));
+	ASSERT_INT_EQ(HTTP_GET, client.req.method);
+	ASSERT_STR_EQ("bar", client.req.url[0]);
+
+	rest__next_request(&client);
+	ASSERT_UINT_EQ(0, client.buffer.index);
+	ASSERT_INT_EQ(0, rest__have_head(&client.buffer));
+
+	vector_destroy(&client.buffer);
+	return 0;
+}
+
+static int test_content_is_reserved(void)
+{
+	const char* text =
+	"PUT /foo HTTP/1.1\r\n"
+	"Content-Length: 1000\r\n"
+	"\r\n";
+
+	struct rest_client client;
+	memset(&client, 0, sizeof(client));
+	vector_init(&client.buffer, 16);
+	vector_append(&client.buffer, text, strlen(text));
+
+	ASSERT_INT_EQ(1, rest__handle_header(&client));
+	ASSERT_INT_EQ(REST_CLIENT_CONTENT, client.state);
+	ASSERT_UINT_EQ(strlen(text) + 1000, client.buffer.size);
+
+	/* The request still points into the buffer after it has moved */
+	ASSERT_STR_EQ("foo", client.req.url[0]);
+
+	http_req_free(&client.req);
+	vector_destroy(&client.buffer);
+	return 0;
+}
+
+static int test_work_limits(void)
+{
+	reset_fakes();
+	rest_set_limits(64, 1, 1);
+
+	struct mloop_work* a = (struct mloop_work*)1;
+	struct mloop_work* b = (struct mloop_work*)2;
+	struct mloop_work* c = (struct mloop_work*)3;
+	struct rest_stats stats;
+
+	ASSERT_INT_EQ(0, rest_work_start(a));
+	ASSERT_INT_EQ(1, mloop_work_start_fake.call_count);
+	ASSERT_PTR_EQ(a, mloop_work_start_fake.arg0_val);
+	ASSERT_INT_EQ(1, mloop_work_set_priority_fake.call_count);
+
+	ASSERT_INT_EQ(0, rest_work_start(b));
+	ASSERT_INT_EQ(1, mloop_work_start_fake.call_count);
+	ASSERT_INT_EQ(1, mloop_work_ref_fake.call_count);
+
+	errno = 0;
+	ASSERT_INT_EQ(-1, rest_work_start(c));
+	ASSERT_INT_EQ(EAGAIN, errno);
+
+	rest_get_stats(&stats);
+	ASSERT_UINT_EQ(1, stats.n_jobs_running);
+	ASSERT_UINT_EQ(1, stats.n_jobs_waiting);
+	ASSERT_UINT_EQ(1, stats.n_jobs_rejected);
+
+	rest_work_done();
+	ASSERT_INT_EQ(2, mloop_work_start_fake.call_count);
+	ASSERT_PTR_EQ(b, mloop_work_start_fake.arg0_val);
+	ASSERT_INT_EQ(1, mloop_work_unref_fake.call_count);
+
+	rest_get_stats(&stats);
+	ASSERT_UINT_EQ(1, stats.n_jobs_running);
+	ASSERT_UINT_EQ(0, stats.n_jobs_waiting);
+
+	rest_work_done();
+	ASSERT_INT_EQ(2, mloop_work_start_fake.call_count);
+
+	rest_get_stats(&stats);
+	ASSERT_UINT_EQ(0, stats.n_jobs_running);
+	return 0;
+}
+
+static char sent_[256];
+static size_t sent_length_;
+static size_t send_budget_;
+
+/* Takes at most send_budget_ bytes, like a socket with a full buffer */
+static ssize_t send_iov_custom(int fd, struct iovec* iov, int iovcnt)
+{
+	(void)fd;
+
+	size_t total = 0;
+
+	for (int i = 0; i < iovcnt; ++i) {
+		size_t len = iov[i].iov_len;
+		if (len > send_budget_ - total)
+			len = send_budget_ - total;
+
+		memcpy(sent_ + sent_length_, iov[i].iov_base, len);
+		sent_length_ += len;
+		total += len;
+	}
+
+	if (total == 0 && send_budget_ == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return total;
+}
+
+static void init_client(struct rest_client* client)
+{
+	reset_fakes();
+	net_send_iov_fake.custom_fake = send_iov_custom;
+	sent_length_ = 0;
+
+	memset(client, 0, sizeof(*client));
+	STAILQ_INIT(&client->output);
+	client->socket = (struct mloop_socket*)1;
+}
+
+static int test_write_all(void)
+{
+	struct rest_client client;
+	init_client(&client);
+	send_budget_ = sizeof(sent_);
+
+	rest_write(&client, "foo", 3);
+	rest_write(&client, "bar", 3);
+
+	ASSERT_INT_EQ(2, net_send_iov_fake.call_count);
+	ASSERT_INT_EQ(0, mloop_socket_set_event_fake.call_count);
+	ASSERT_TRUE(STAILQ_EMPTY(&client.output));
+	ASSERT_UINT_EQ(6, sent_length_);
+	ASSERT_INT_EQ(0, memcmp("foobar", sent_, 6));
+	return 0;
+}
+
+static int test_write_partial(void)
+{
+	struct rest_client client;
+	init_client(&client);
+	send_budget_ = 2;
+
+	rest_write(&client, "foo", 3);
+	ASSERT_UINT_EQ(1, client.output_length);
+	ASSERT_INT_EQ(1, mloop_socket_set_event_fake.call_count);
+	ASSERT_INT_EQ(MLOOP_SOCKET_EVENT_OUT,
+		      mloop_socket_set_event_fake.arg1_val);
+
+	/* Nothing is sent ahead of what is waiting */
+	rest_write(&client, "bar", 3);
+	ASSERT_INT_EQ(1, net_send_iov_fake.call_count);
+	ASSERT_UINT_EQ(4, client.output_length);
+
+	send_budget_ = 0;
+	rest__flush(&client);
+	ASSERT_UINT_EQ(4, client.output_length);
+
+	send_budget_ = 2;
+	rest__flush(&client);
+	ASSERT_UINT_EQ(2, client.output_length);
+	ASSERT_INT_EQ(1, mloop_socket_set_event_fake.call_count);
+
+	send_budget_ = sizeof(sent_);
+	rest__flush(&client);
+	ASSERT_UINT_EQ(0, client.output_length);
+	ASSERT_TRUE(STAILQ_EMPTY(&client.output));
+	ASSERT_INT_EQ(2, mloop_socket_set_event_fake.call_count);
+	ASSERT_INT_EQ(MLOOP_SOCKET_EVENT_IN | MLOOP_SOCKET_EVENT_PRI,
+		      mloop_socket_set_event_fake.arg1_val);
+
+	ASSERT_UINT_EQ(6, sent_length_);
+	ASSERT_INT_EQ(0, memcmp("foobar", sent_, 6));
+	return 0;
+}
+
+static int test_reply_given(void)
+{
+	struct rest_client client;
+	init_client(&client);
+	send_budget_ = 0;
+
+	char* content = strdup("hello");
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "text/plain",
+		.content_length = 5,
+		.content = content,
+		.ownership = REST_CONTENT_GIVEN
+	};
+
+	rest_reply(&client, &reply);
+	ASSERT_FALSE(STAILQ_EMPTY(&client.output));
+
+	content[0] = 'j';
+
+	send_budget_ = sizeof(sent_);
+	rest__flush(&client);
+	ASSERT_TRUE(STAILQ_EMPTY(&client.output));
+
+	sent_[sent_length_] = '\0';
+	ASSERT_TRUE(strncmp("HTTP/1.1 200 OK\r\n", sent_, 17) == 0);
+	ASSERT_TRUE(strstr(sent_, "Content-Length: 5\r\n") != NULL);
+	ASSERT_STR_EQ("\r\n\r\njello", strstr(sent_, "\r\n\r\n"));
+	return 0;
+}
+
+static int test_write_failure(void)
+{
+	struct rest_client client;
+	init_client(&client);
+	send_budget_ = 1;
+
+	rest_write(&client, "foo", 3);
+	ASSERT_UINT_EQ(2, client.output_length);
+
+	net_send_iov_fake.custom_fake = NULL;
+	net_send_iov_fake.return_val = -1;
+	errno = EPIPE;
+
+	rest__flush(&client);
+	ASSERT_INT_EQ(1, shutdown_fake.call_count);
+	ASSERT_TRUE(STAILQ_EMPTY(&client.output));
+	ASSERT_UINT_EQ(0, client.output_length);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -274,5 +551,12 @@ int main()
 	RUN_TEST(test_read__empty);
 	RUN_TEST(test_read__closed);
 	RUN_TEST(test_read__twice);
+	RUN_TEST(test_next_request);
+	RUN_TEST(test_content_is_reserved);
+	RUN_TEST(test_work_limits);
+	RUN_TEST(test_write_all);
+	RUN_TEST(test_write_partial);
+	RUN_TEST(test_reply_given);
+	RUN_TEST(test_write_failure);
 	return r;
 }
@@ -17,6 +17,31 @@ static int test_sdo_dict_fromstring(void)
 	return 0;
 }
 
+static int test_sdo_dict_fromstring_forms(void)
+{
+	ASSERT_UINT_EQ(SDO_MUX(0x1017, 0),
+		       sdo_dict_fromstring("PRODUCER_HEARTBEAT_TIME"));
+	ASSERT_UINT_EQ(SDO_MUX(0x1017, 0),
+		       sdo_dict_fromstring("Producer-Heartbeat_time"));
+	ASSERT_UINT_EQ(0, sdo_dict_fromstring("producer-heartbeat"));
+	ASSERT_UINT_EQ(0, sdo_dict_fromstring("producer-heartbeat-time-x"));
+	ASSERT_UINT_EQ(0, sdo_dict_fromstring(""));
+	return 0;
+}
+
+static int test_sdo_dict_round_trip(void)
+{
+#define X(idx, subidx, type, name) \
+	ASSERT_UINT_EQ(SDO_MUX(idx, subidx), \
+		       sdo_dict_fromstring(sdo_dict_tostring(SDO_MUX(idx, subidx))));
+
+	SDO_DICTIONARY
+#undef X
+
+	ASSERT_STR_EQ("unknown", sdo_dict_tostring(SDO_MUX(0x2000, 0)));
+	return 0;
+}
+
 static int test_sdo_dict_type(void)
 {
 	ASSERT_UINT_EQ(CANOPEN_UNSIGNED32, sdo_dict_type(SDO_MUX(0x1000, 0)));
@@ -29,6 +54,8 @@ int main()
 	int r = 0;
 	RUN_TEST(test_sdo_dict_tostring);
 	RUN_TEST(test_sdo_dict_fromstring);
+	RUN_TEST(test_sdo_dict_fromstring_forms);
+	RUN_TEST(test_sdo_dict_round_trip);
 	RUN_TEST(test_sdo_dict_type);
 	return r;
 }
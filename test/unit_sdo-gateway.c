@@ -0,0 +1,116 @@
+#include "tst.h"
+#include "sdo-gateway.h"
+
+#include <string.h>
+
+static size_t make_request(unsigned char* dst, uint32_t tag, uint8_t type,
+			   uint8_t nodeid, uint16_t index, uint8_t subindex,
+			   const void* data, uint32_t size)
+{
+	unsigned char header[] = {
+		tag, tag >> 8, tag >> 16, tag >> 24,
+		type, nodeid, index, index >> 8, subindex, 0, 0, 0,
+		size, size >> 8, size >> 16, size >> 24,
+	};
+
+	memcpy(dst, header, sizeof(header));
+	memcpy(dst + sizeof(header), data, size);
+	return sizeof(header) + size;
+}
+
+static int test_upload()
+{
+	unsigned char buffer[64];
+	struct sdo_gateway_request req;
+
+	size_t size = make_request(buffer, 0x01020304, SDO_GATEWAY_UPLOAD, 42,
+				   0x1018, 1, NULL, 0);
+	ASSERT_UINT_EQ(16, size);
+
+	ASSERT_INT_EQ(16, (int)sdo_gateway_decode_request(&req, buffer, size));
+	ASSERT_UINT_EQ(0x01020304, req.tag);
+	ASSERT_INT_EQ(SDO_GATEWAY_UPLOAD, req.type);
+	ASSERT_INT_EQ(42, req.nodeid);
+	ASSERT_UINT_EQ(0x1018, req.index);
+	ASSERT_INT_EQ(1, req.subindex);
+	ASSERT_UINT_EQ(0, req.size);
+
+	/* Nothing is decoded until the header is complete */
+	ASSERT_INT_EQ(0, (int)sdo_gateway_decode_request(&req, buffer, 15));
+	return 0;
+}
+
+static int test_download()
+{
+	unsigned char buffer[64];
+	struct sdo_gateway_request req;
+
+	size_t size = make_request(buffer, 7, SDO_GATEWAY_DOWNLOAD, 1, 0x2000,
+				   0, "\x01\x02\x03\x04\x05", 5);
+	ASSERT_UINT_EQ(21, size);
+
+	/* The data must be there too */
+	ASSERT_INT_EQ(0, (int)sdo_gateway_decode_request(&req, buffer, 20));
+
+	ASSERT_INT_EQ(21, (int)sdo_gateway_decode_request(&req, buffer, 64));
+	ASSERT_UINT_EQ(7, req.tag);
+	ASSERT_INT_EQ(SDO_GATEWAY_DOWNLOAD, req.type);
+	ASSERT_UINT_EQ(5, req.size);
+	return 0;
+}
+
+static int test_invalid_requests()
+{
+	unsigned char buffer[64];
+	struct sdo_gateway_request req;
+
+	make_request(buffer, 1, 3, 1, 0x1000, 0, NULL, 0);
+	ASSERT_INT_EQ(-1, (int)sdo_gateway_decode_request(&req, buffer, 16));
+
+	make_request(buffer, 1, SDO_GATEWAY_UPLOAD, 0, 0x1000, 0, NULL, 0);
+	ASSERT_INT_EQ(-1, (int)sdo_gateway_decode_request(&req, buffer, 16));
+
+	make_request(buffer, 1, SDO_GATEWAY_UPLOAD, 128, 0x1000, 0, NULL, 0);
+	ASSERT_INT_EQ(-1, (int)sdo_gateway_decode_request(&req, buffer, 16));
+
+	make_request(buffer, 1, SDO_GATEWAY_UPLOAD, 1, 0x1000, 0, "x", 1);
+	ASSERT_INT_EQ(-1, (int)sdo_gateway_decode_request(&req, buffer, 17));
+
+	make_request(buffer, 1, SDO_GATEWAY_DOWNLOAD, 1, 0x1000, 0, NULL, 0);
+	buffer[9] = 1;
+	ASSERT_INT_EQ(-1, (int)sdo_gateway_decode_request(&req, buffer, 16));
+
+	/* Too large to be waited for */
+	make_request(buffer, 1, SDO_GATEWAY_DOWNLOAD, 1, 0x1000, 0, NULL, 0);
+	uint32_t size = SDO_GATEWAY_SIZE_MAX + 1;
+	buffer[12] = size;
+	buffer[13] = size >> 8;
+	buffer[14] = size >> 16;
+	buffer[15] = size >> 24;
+	ASSERT_INT_EQ(-1, (int)sdo_gateway_decode_request(&req, buffer, 16));
+	return 0;
+}
+
+static int test_response()
+{
+	unsigned char buffer[sizeof(struct sdo_gateway_response)];
+	const unsigned char expected[] = {
+		0x04, 0x03, 0x02, 0x01,
+		0x00, 0x00, 0x02, 0x06,
+		0x00, 0x00, 0x00, 0x00,
+	};
+
+	sdo_gateway_encode_response(buffer, 0x01020304, 0x06020000, 0);
+	ASSERT_INT_EQ(0, memcmp(expected, buffer, sizeof(expected)));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_upload);
+	RUN_TEST(test_download);
+	RUN_TEST(test_invalid_requests);
+	RUN_TEST(test_response);
+	return r;
+}
@@ -263,6 +263,184 @@ static int test_upload_big()
 	return upload(loremipsum);
 }
 
+static int n_frames_via_send_fn;
+
+static int send_via_send_fn(struct sdo_async* self, struct can_frame* cf)
+{
+	ASSERT_PTR_EQ(&client, self);
+	++n_frames_via_send_fn;
+	return send(cwfd, cf, sizeof(*cf), 0);
+}
+
+static int test_download_via_send_fn()
+{
+	n_frames_via_send_fn = 0;
+	sdo_async_set_send_fn(&client, send_via_send_fn);
+
+	int rc = download(loremipsum);
+
+	sdo_async_set_send_fn(&client, NULL);
+
+	ASSERT_INT_EQ(0, rc);
+	ASSERT_INT_GT(1, n_frames_via_send_fn);
+	return 0;
+}
+
+/* Block transfers send several frames in a row, so keep going until both
+ * sides are quiet
+ */
+static void pump()
+{
+	int n;
+
+	do {
+		struct can_frame cf = { 0 };
+		n = 0;
+
+		while (recv(crfd, &cf, sizeof(cf), MSG_DONTWAIT) == sizeof(cf)) {
+			sdo_srv_feed(&server, &cf);
+			++n;
+		}
+
+		while (recv(srfd, &cf, sizeof(cf), MSG_DONTWAIT) == sizeof(cf)) {
+			sdo_async_feed(&client, &cf);
+			++n;
+		}
+	} while (n > 0);
+}
+
+static int block_download(const char* str)
+{
+	size_t size = strlen(str) + 1;
+
+	struct sdo_async_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.data = str,
+		.size = size,
+		.on_done = on_done
+	};
+
+	RESET_FAKE(on_done);
+
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	ASSERT_TRUE(client.is_block == (size > SDO_ASYNC_BLOCK_THRESHOLD));
+	reset_srv_data();
+	pump();
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+	ASSERT_INT_EQ(SDO_REQ_OK, client.status);
+	ASSERT_STR_EQ(str, srv_data);
+	ASSERT_UINT_EQ(size, srv_size);
+	ASSERT_INT_EQ(0x1234, srv_index);
+	ASSERT_INT_EQ(42, srv_subindex);
+
+	return 0;
+}
+
+static int block_upload(const char* str)
+{
+	struct sdo_async_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.on_done = on_done,
+	};
+
+	RESET_FAKE(on_done);
+
+	set_srv_data(str);
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	pump();
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+	ASSERT_INT_EQ(SDO_REQ_OK, client.status);
+	ASSERT_UINT_EQ(strlen(str) + 1, client.buffer.index);
+	ASSERT_STR_EQ(str, client.buffer.data);
+	ASSERT_INT_EQ(0x1234, srv_index);
+	ASSERT_INT_EQ(42, srv_subindex);
+
+	return 0;
+}
+
+/* Small blocks keep the socket queues short and make for many blocks */
+static void use_block_transfers(int is_enabled)
+{
+	client.block_size = is_enabled ? 5 : 0;
+	server.block_size = 4;
+}
+
+static int test_block_download()
+{
+	use_block_transfers(1);
+
+	int rc = block_download("")
+	      || block_download("foobar")
+	      || block_download("0123456789abcdefghij")
+	      || block_download("0123456789abcdefghijk")
+	      || block_download("0123456789abcdefghijkl")
+	      || block_download("0123456789abcdefghijklmnopqrstuvwxyz")
+	      || block_download(loremipsum);
+
+	use_block_transfers(0);
+	return rc;
+}
+
+static int test_block_upload()
+{
+	use_block_transfers(1);
+
+	int rc = block_upload("")
+	      || block_upload("foo")
+	      || block_upload("foobarx")
+	      || block_upload("0123456789abcdefghij")
+	      || block_upload("0123456789abcdefghijk")
+	      || block_upload("0123456789abcdefghijklmnopqrstuvwxyz")
+	      || block_upload(loremipsum);
+
+	use_block_transfers(0);
+	return rc;
+}
+
+static int n_block_frames;
+
+/* Drops the third segment of the first block; the fourth one makes the
+ * server acknowledge the first two.
+ */
+static int drop_third_segment(struct sdo_async* self, struct can_frame* cf)
+{
+	(void)self;
+
+	if (++n_block_frames == 4)
+		return sizeof(*cf);
+
+	return send(cwfd, cf, sizeof(*cf), 0);
+}
+
+static int test_block_download_resends_lost_segments()
+{
+	use_block_transfers(1);
+	n_block_frames = 0;
+	sdo_async_set_send_fn(&client, drop_third_segment);
+
+	int rc = block_download(loremipsum);
+
+	sdo_async_set_send_fn(&client, NULL);
+	use_block_transfers(0);
+
+	ASSERT_INT_EQ(0, rc);
+	ASSERT_INT_GT(5, n_block_frames);
+	return 0;
+}
+
+static int test_block_crc()
+{
+	ASSERT_INT_EQ(0x31c3, sdo_crc16(0, "123456789", 9));
+	ASSERT_INT_EQ(0, sdo_crc16(0, "", 0));
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -271,6 +449,11 @@ int main()
 	RUN_TEST(test_download_big);
 	RUN_TEST(test_upload);
 	RUN_TEST(test_upload_big);
+	RUN_TEST(test_download_via_send_fn);
+	RUN_TEST(test_block_download);
+	RUN_TEST(test_block_upload);
+	RUN_TEST(test_block_download_resends_lost_segments);
+	RUN_TEST(test_block_crc);
 	cleanup();
 	return r;
 }
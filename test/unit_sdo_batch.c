@@ -0,0 +1,180 @@
+#include "tst.h"
+#include "fff.h"
+#include "canopen/sdo_req.h"
+#include "canopen/sdo_batch.h"
+#include "sock.h"
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VOID_FUNC(mloop_iterate, struct mloop*);
+FAKE_VALUE_FUNC(struct mloop*, mloop_default);
+FAKE_VALUE_FUNC(int, sdo_async_init, struct sdo_async*, const struct sock*,
+		int);
+FAKE_VALUE_FUNC(int, sdo_async_stop, struct sdo_async*);
+FAKE_VOID_FUNC(sdo_async_destroy, struct sdo_async*);
+
+void sdo_req__on_done(struct sdo_async* async);
+void sdo_req__on_stop(void* ptr);
+
+static int n_batches_done = 0;
+
+static void on_batch_done(struct sdo_batch* batch)
+{
+	(void)batch;
+	++n_batches_done;
+}
+
+/* Runs the next request in the queue to completion */
+static struct sdo_req* run_next(struct sdo_req_queue* queue,
+				enum sdo_req_status status,
+				const void* data, size_t size)
+{
+	struct sdo_req* req = sdo_req_queue__dequeue(queue);
+	if (!req)
+		return NULL;
+
+	struct sdo_async async;
+	memset(&async, 0, sizeof(async));
+	async.status = status;
+	async.context = req;
+	vector_init(&async.buffer, 16);
+	vector_assign(&async.buffer, data, size);
+
+	sdo_req__on_done(&async);
+	sdo_req__on_stop(req);
+
+	vector_destroy(&async.buffer);
+	return req;
+}
+
+static struct sdo_batch* new_batch(enum sdo_batch_flags flags)
+{
+	struct sdo_batch* batch = sdo_batch_new(SDO_REQ_PRIO_CONFIG, flags);
+	batch->on_done = on_batch_done;
+
+	sdo_batch_add_download(batch, 0x1a00, 0, "\0", 1);
+	sdo_batch_add_upload(batch, 0x1018, 1);
+	sdo_batch_add_upload(batch, 0x1018, 2);
+
+	return batch;
+}
+
+static int test_batch_all_or_nothing()
+{
+	RESET_FAKE(sdo_async_init);
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 2, 0);
+
+	struct sdo_batch* batch = new_batch(0);
+	ASSERT_INT_EQ(3, batch->n_items);
+
+	ASSERT_INT_LT(0, sdo_batch_start(batch, &queue));
+	ASSERT_INT_EQ(0, queue.size);
+
+	queue.limit = 3;
+	ASSERT_INT_EQ(0, sdo_batch_start(batch, &queue));
+	ASSERT_INT_EQ(3, queue.size);
+
+	/* Nothing can be added once it has started */
+	ASSERT_INT_LT(0, sdo_batch_add_upload(batch, 0x1018, 3));
+	ASSERT_INT_LT(0, sdo_batch_start(batch, &queue));
+
+	sdo_batch_unref(batch);
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_batch_done()
+{
+	RESET_FAKE(sdo_async_init);
+	n_batches_done = 0;
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 8, 0);
+
+	struct sdo_batch* batch = new_batch(0);
+	ASSERT_INT_EQ(0, sdo_batch_start(batch, &queue));
+
+	struct sdo_req* req = run_next(&queue, SDO_REQ_OK, "", 0);
+	ASSERT_INT_EQ(SDO_REQ_DOWNLOAD, req->type);
+	ASSERT_INT_EQ(SDO_REQ_PRIO_CONFIG, req->priority);
+
+	run_next(&queue, SDO_REQ_OK, "\x42\0\0\0", 4);
+	ASSERT_INT_EQ(0, n_batches_done);
+
+	run_next(&queue, SDO_REQ_REMOTE_ABORT, "", 0);
+	ASSERT_INT_EQ(1, n_batches_done);
+	ASSERT_TRUE(batch->is_done);
+
+	const struct sdo_batch_item* item = sdo_batch_get_item(batch, 1);
+	ASSERT_INT_EQ(SDO_REQ_OK, item->status);
+	ASSERT_INT_EQ(4, item->data.index);
+	ASSERT_INT_EQ(0x42, *(char*)item->data.data);
+
+	ASSERT_INT_EQ(SDO_REQ_REMOTE_ABORT, sdo_batch_get_item(batch, 2)->status);
+	ASSERT_INT_EQ(SDO_REQ_REMOTE_ABORT, sdo_batch_get_status(batch));
+	ASSERT_TRUE(sdo_batch_get_item(batch, 3) == NULL);
+
+	ASSERT_INT_EQ(0, sdo_batch_unref(batch));
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_batch_stop_on_error()
+{
+	RESET_FAKE(sdo_async_init);
+	n_batches_done = 0;
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 8, 0);
+
+	struct sdo_batch* batch = new_batch(SDO_BATCH_STOP_ON_ERROR);
+	ASSERT_INT_EQ(0, sdo_batch_start(batch, &queue));
+
+	run_next(&queue, SDO_REQ_LOCAL_ABORT, "", 0);
+	ASSERT_INT_EQ(1, n_batches_done);
+	ASSERT_INT_EQ(0, queue.size);
+	ASSERT_PTR_EQ(NULL, sdo_req_queue__dequeue(&queue));
+
+	ASSERT_INT_EQ(SDO_REQ_LOCAL_ABORT, sdo_batch_get_status(batch));
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, sdo_batch_get_item(batch, 1)->status);
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, sdo_batch_get_item(batch, 2)->status);
+
+	ASSERT_INT_EQ(0, sdo_batch_unref(batch));
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_batch_cancelled()
+{
+	RESET_FAKE(sdo_async_init);
+	n_batches_done = 0;
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 8, 0);
+
+	struct sdo_batch* batch = new_batch(0);
+	ASSERT_INT_EQ(0, sdo_batch_start(batch, &queue));
+
+	run_next(&queue, SDO_REQ_OK, "", 0);
+
+	sdo_req_queue_set_lost(&queue, 1);
+	ASSERT_INT_EQ(1, n_batches_done);
+	ASSERT_INT_EQ(SDO_REQ_OK, sdo_batch_get_item(batch, 0)->status);
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, sdo_batch_get_status(batch));
+
+	ASSERT_INT_EQ(0, sdo_batch_unref(batch));
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_batch_all_or_nothing);
+	RUN_TEST(test_batch_done);
+	RUN_TEST(test_batch_stop_on_error);
+	RUN_TEST(test_batch_cancelled);
+	return r;
+}
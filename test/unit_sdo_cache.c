@@ -0,0 +1,96 @@
+#include "tst.h"
+#include "canopen/sdo_cache.h"
+
+#include <string.h>
+
+int test_get_missing(void)
+{
+	char buffer[8];
+	ASSERT_INT_EQ(-1, sdo_cache_get(1, 0x1018, 1, buffer, sizeof(buffer),
+					NULL));
+	return 0;
+}
+
+int test_put_get(void)
+{
+	char buffer[8] = { 0 };
+	int is_size_indicated = 0;
+
+	ASSERT_INT_EQ(0, sdo_cache_put(1, 0x1008, 0, "device", 6, 1));
+	ASSERT_INT_EQ(6, sdo_cache_get(1, 0x1008, 0, buffer, sizeof(buffer),
+				       &is_size_indicated));
+	ASSERT_STR_EQ("device", buffer);
+	ASSERT_TRUE(is_size_indicated);
+
+	ASSERT_INT_EQ(-1, sdo_cache_get(2, 0x1008, 0, buffer, sizeof(buffer),
+					NULL));
+	ASSERT_INT_EQ(-1, sdo_cache_get(1, 0x1008, 1, buffer, sizeof(buffer),
+					NULL));
+
+	sdo_cache_clear();
+	return 0;
+}
+
+int test_short_buffer(void)
+{
+	char buffer[4] = { 0 };
+
+	ASSERT_INT_EQ(0, sdo_cache_put(1, 0x1009, 0, "abcdefgh", 8, 1));
+	ASSERT_INT_EQ(8, sdo_cache_get(1, 0x1009, 0, buffer, 3, NULL));
+	ASSERT_STR_EQ("abc", buffer);
+
+	sdo_cache_clear();
+	return 0;
+}
+
+int test_overwrite(void)
+{
+	char buffer[8] = { 0 };
+	int is_size_indicated = 1;
+
+	ASSERT_INT_EQ(0, sdo_cache_put(1, 0x100a, 0, "1.0", 3, 1));
+	ASSERT_INT_EQ(0, sdo_cache_put(1, 0x100a, 0, "2.00", 4, 0));
+	ASSERT_INT_EQ(4, sdo_cache_get(1, 0x100a, 0, buffer, sizeof(buffer),
+				       &is_size_indicated));
+	ASSERT_STR_EQ("2.00", buffer);
+	ASSERT_FALSE(is_size_indicated);
+
+	sdo_cache_clear();
+	return 0;
+}
+
+int test_invalidate_node(void)
+{
+	char buffer[8];
+
+	ASSERT_INT_EQ(0, sdo_cache_put(1, 0xffff, 0xff, "a", 1, 1));
+	ASSERT_INT_EQ(0, sdo_cache_put(2, 0x0000, 0x00, "b", 1, 1));
+	ASSERT_INT_EQ(0, sdo_cache_put(2, 0x1018, 0x01, "c", 1, 1));
+	ASSERT_INT_EQ(0, sdo_cache_put(2, 0xffff, 0xff, "d", 1, 1));
+	ASSERT_INT_EQ(0, sdo_cache_put(3, 0x0000, 0x00, "e", 1, 1));
+
+	sdo_cache_invalidate_node(2);
+
+	ASSERT_INT_EQ(1, sdo_cache_get(1, 0xffff, 0xff, buffer, 1, NULL));
+	ASSERT_INT_EQ(-1, sdo_cache_get(2, 0x0000, 0x00, buffer, 1, NULL));
+	ASSERT_INT_EQ(-1, sdo_cache_get(2, 0x1018, 0x01, buffer, 1, NULL));
+	ASSERT_INT_EQ(-1, sdo_cache_get(2, 0xffff, 0xff, buffer, 1, NULL));
+	ASSERT_INT_EQ(1, sdo_cache_get(3, 0x0000, 0x00, buffer, 1, NULL));
+
+	sdo_cache_clear();
+
+	ASSERT_INT_EQ(-1, sdo_cache_get(1, 0xffff, 0xff, buffer, 1, NULL));
+	ASSERT_INT_EQ(-1, sdo_cache_get(3, 0x0000, 0x00, buffer, 1, NULL));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_get_missing);
+	RUN_TEST(test_put_get);
+	RUN_TEST(test_short_buffer);
+	RUN_TEST(test_overwrite);
+	RUN_TEST(test_invalidate_node);
+	return r;
+}
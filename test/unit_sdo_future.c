@@ -0,0 +1,237 @@
+#include "tst.h"
+#include "fff.h"
+#include "canopen/sdo_req.h"
+#include "canopen/sdo_batch.h"
+#include "canopen/sdo_future.h"
+#include "sock.h"
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VOID_FUNC(mloop_iterate, struct mloop*);
+FAKE_VALUE_FUNC(struct mloop*, mloop_default);
+FAKE_VALUE_FUNC(int, sdo_async_init, struct sdo_async*, const struct sock*,
+		int);
+FAKE_VALUE_FUNC(int, sdo_async_stop, struct sdo_async*);
+FAKE_VOID_FUNC(sdo_async_destroy, struct sdo_async*);
+
+void sdo_req__on_done(struct sdo_async* async);
+void sdo_req__on_stop(void* ptr);
+
+/* Async jobs are collected and run by run_asyncs() */
+struct mloop_async {
+	mloop_async_fn fn;
+	void* context;
+	mloop_free_fn free_fn;
+};
+
+static struct mloop_async asyncs_[8];
+static size_t n_asyncs_ = 0;
+
+struct mloop_async* mloop_async_new(struct mloop* mloop)
+{
+	(void)mloop;
+	struct mloop_async* async = &asyncs_[n_asyncs_++];
+	memset(async, 0, sizeof(*async));
+	return async;
+}
+
+void mloop_async_set_context(struct mloop_async* async, void* context,
+			     mloop_free_fn free_fn)
+{
+	async->context = context;
+	async->free_fn = free_fn;
+}
+
+void* mloop_async_get_context(const struct mloop_async* async)
+{
+	return async->context;
+}
+
+void mloop_async_set_callback(struct mloop_async* async, mloop_async_fn fn)
+{
+	async->fn = fn;
+}
+
+int mloop_async_start(struct mloop_async* async)
+{
+	(void)async;
+	return 0;
+}
+
+int mloop_async_unref(struct mloop_async* async)
+{
+	(void)async;
+	return 1;
+}
+
+static void run_asyncs(void)
+{
+	for (size_t i = 0; i < n_asyncs_; ++i) {
+		asyncs_[i].fn(&asyncs_[i]);
+		asyncs_[i].free_fn(asyncs_[i].context);
+	}
+
+	n_asyncs_ = 0;
+}
+
+static int n_continuations = 0;
+static struct sdo_future* last_future = NULL;
+
+static void on_future_done(struct sdo_future* future)
+{
+	++n_continuations;
+	last_future = future;
+}
+
+static void run_next(struct sdo_req_queue* queue, enum sdo_req_status status,
+		     const void* data, size_t size)
+{
+	struct sdo_req* req = sdo_req_queue__dequeue(queue);
+	if (!req)
+		abort();
+
+	struct sdo_async async;
+	memset(&async, 0, sizeof(async));
+	async.status = status;
+	async.context = req;
+	vector_init(&async.buffer, 16);
+	vector_assign(&async.buffer, data, size);
+
+	sdo_req__on_done(&async);
+	sdo_req__on_stop(req);
+
+	vector_destroy(&async.buffer);
+}
+
+static void reset(struct sdo_req_queue* queue)
+{
+	RESET_FAKE(sdo_async_init);
+	n_asyncs_ = 0;
+	n_continuations = 0;
+	last_future = NULL;
+
+	sdo_req__queue_init(queue, 0, 1, 8, 0);
+}
+
+static int test_future_then()
+{
+	struct sdo_req_queue queue;
+	reset(&queue);
+
+	struct sdo_future* future =
+		sdo_future_read(&queue, SDO_REQ_PRIO_DRIVER, 0x1000, 0);
+	ASSERT_TRUE(future != NULL);
+	ASSERT_INT_EQ(0, sdo_future_then(future, on_future_done, (void*)1,
+					 NULL));
+	ASSERT_INT_LT(0, sdo_future_then(future, on_future_done, NULL, NULL));
+	ASSERT_PTR_EQ((void*)1, sdo_future_get_context(future));
+	ASSERT_INT_EQ(SDO_REQ_PENDING, sdo_future_get_status(future));
+
+	run_next(&queue, SDO_REQ_OK, "\x91\x01\x02\x00", 4);
+	ASSERT_TRUE(sdo_future_is_done(future));
+
+	/* The continuation runs on the main loop */
+	ASSERT_INT_EQ(0, n_continuations);
+	run_asyncs();
+	ASSERT_INT_EQ(1, n_continuations);
+	ASSERT_PTR_EQ(future, last_future);
+
+	size_t size = 0;
+	const char* data = sdo_future_get_data(future, &size);
+	ASSERT_INT_EQ(SDO_REQ_OK, sdo_future_get_status(future));
+	ASSERT_INT_EQ(4, size);
+	ASSERT_INT_EQ(0, memcmp("\x91\x01\x02\x00", data, 4));
+
+	ASSERT_INT_EQ(0, sdo_future_unref(future));
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_future_then_when_done()
+{
+	struct sdo_req_queue queue;
+	reset(&queue);
+
+	struct sdo_future* future =
+		sdo_future_write(&queue, 0, 0x1017, 0, "\xe8\x03", 2);
+	run_next(&queue, SDO_REQ_REMOTE_ABORT, "", 0);
+
+	ASSERT_INT_EQ(0, sdo_future_then(future, on_future_done, NULL, NULL));
+	run_asyncs();
+	ASSERT_INT_EQ(1, n_continuations);
+	ASSERT_INT_EQ(SDO_REQ_REMOTE_ABORT, sdo_future_get_status(future));
+	ASSERT_TRUE(sdo_future_get_data(future, NULL) == NULL);
+
+	ASSERT_INT_EQ(0, sdo_future_unref(future));
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_future_when_all()
+{
+	struct sdo_req_queue queue;
+	reset(&queue);
+
+	struct sdo_future* reads[3];
+	for (int i = 0; i < 3; ++i)
+		reads[i] = sdo_future_read(&queue, 0, 0x1018, i + 1);
+
+	run_next(&queue, SDO_REQ_OK, "\x01\0\0\0", 4);
+
+	struct sdo_future* all = sdo_future_when_all(reads, 3);
+	for (int i = 0; i < 3; ++i)
+		sdo_future_unref(reads[i]);
+
+	ASSERT_INT_EQ(0, sdo_future_then(all, on_future_done, NULL, NULL));
+	ASSERT_INT_EQ(3, sdo_future_get_child_count(all));
+
+	run_next(&queue, SDO_REQ_OK, "\x02\0\0\0", 4);
+	ASSERT_FALSE(sdo_future_is_done(all));
+
+	/* Results are kept until the combined future goes away */
+	sdo_req_queue_set_lost(&queue, 1);
+	ASSERT_TRUE(sdo_future_is_done(all));
+	run_asyncs();
+
+	ASSERT_INT_EQ(1, n_continuations);
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, sdo_future_get_status(all));
+	ASSERT_INT_EQ(SDO_REQ_OK,
+		      sdo_future_get_status(sdo_future_get_child(all, 1)));
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED,
+		      sdo_future_get_status(sdo_future_get_child(all, 2)));
+
+	ASSERT_INT_EQ(0, sdo_future_unref(all));
+
+	/* A lost node does not take any more */
+	ASSERT_TRUE(sdo_future_read(&queue, 0, 0x1018, 1) == NULL);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_future_when_none()
+{
+	n_asyncs_ = 0;
+	n_continuations = 0;
+
+	struct sdo_future* all = sdo_future_when_all(NULL, 0);
+	ASSERT_TRUE(sdo_future_is_done(all));
+	ASSERT_INT_EQ(SDO_REQ_OK, sdo_future_get_status(all));
+
+	ASSERT_INT_EQ(0, sdo_future_then(all, on_future_done, NULL, NULL));
+	run_asyncs();
+	ASSERT_INT_EQ(1, n_continuations);
+
+	ASSERT_INT_EQ(0, sdo_future_unref(all));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_future_then);
+	RUN_TEST(test_future_then_when_done);
+	RUN_TEST(test_future_when_all);
+	RUN_TEST(test_future_when_none);
+	return r;
+}
@@ -50,16 +50,42 @@ static int test_req_new_free()
 	return 0;
 }
 
+static int test_req_data_storage()
+{
+	char small[4] = { 1, 2, 3, 4 };
+	char large[SDO_REQ_INLINE_SIZE + 8] = { 5 };
+
+	struct sdo_req_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.dl_data = small,
+		.dl_size = sizeof(small)
+	};
+
+	struct sdo_req* req = sdo_req_new(&info);
+	ASSERT_PTR_EQ(req->inline_data, req->data.data);
+	ASSERT_INT_EQ(0, memcmp(small, req->data.data, sizeof(small)));
+
+	ASSERT_INT_EQ(0, sdo_req_set_data(req, large, sizeof(large)));
+	ASSERT_TRUE(req->data.data != req->inline_data);
+	ASSERT_INT_EQ(sizeof(large), req->data.index);
+	ASSERT_INT_EQ(0, memcmp(large, req->data.data, sizeof(large)));
+
+	sdo_req_free(req);
+
+	info.type = SDO_REQ_UPLOAD;
+	req = sdo_req_new(&info);
+	ASSERT_PTR_EQ(req->inline_data, req->data.data);
+	ASSERT_INT_EQ(0, req->data.index);
+
+	sdo_req_free(req);
+	return 0;
+}
+
 static int test_req_queue_init_destroy()
 {
 	RESET_FAKE(sdo_async_init);
 	sdo_async_init_fake.return_val = 0;
 
-	struct mloop_idle* idle = (void*)0xdeadbeef;
-
-	RESET_FAKE(mloop_idle_new);
-	mloop_idle_new_fake.return_val = idle;
-
 	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
 
 	struct sdo_req_queue queue;
@@ -105,6 +131,668 @@ static int test_req_queue_enqueue_dequeue()
 	return 0;
 }
 
+static int test_req_queue_priorities()
+{
+	RESET_FAKE(sdo_async_init);
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 16, 0);
+
+	struct sdo_req req[4];
+	memset(req, 0, sizeof(req));
+	req[0].priority = SDO_REQ_PRIO_BACKGROUND;
+	req[1].priority = SDO_REQ_PRIO_CONFIG;
+	req[2].priority = 0;
+	req[3].priority = SDO_REQ_PRIO_REALTIME;
+
+	for (int i = 0; i < 4; ++i)
+		ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &req[i]));
+
+	ASSERT_PTR_EQ(&req[3], sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(&req[2], sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(&req[1], sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(&req[0], sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(NULL, sdo_req_queue__dequeue(&queue));
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_req_queue_aging()
+{
+	RESET_FAKE(sdo_async_init);
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 16, 0);
+
+	struct sdo_req background;
+	memset(&background, 0, sizeof(background));
+	background.priority = SDO_REQ_PRIO_BACKGROUND;
+	ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &background));
+
+	struct sdo_req req[SDO_REQ_AGING_LIMIT + 1];
+	memset(req, 0, sizeof(req));
+	for (int i = 0; i < SDO_REQ_AGING_LIMIT + 1; ++i) {
+		req[i].priority = SDO_REQ_PRIO_REALTIME;
+		ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &req[i]));
+	}
+
+	for (int i = 0; i < SDO_REQ_AGING_LIMIT; ++i)
+		ASSERT_PTR_EQ(&req[i], sdo_req_queue__dequeue(&queue));
+
+	ASSERT_PTR_EQ(&background, sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(&req[SDO_REQ_AGING_LIMIT], sdo_req_queue__dequeue(&queue));
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_req_queue_hold()
+{
+	RESET_FAKE(sdo_async_init);
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 16, 0);
+
+	struct sdo_req background;
+	memset(&background, 0, sizeof(background));
+	background.priority = SDO_REQ_PRIO_BACKGROUND;
+	background.n_passed = SDO_REQ_AGING_LIMIT;
+	ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &background));
+
+	struct sdo_req driver;
+	memset(&driver, 0, sizeof(driver));
+	ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &driver));
+
+	sdo_req_queues_hold(SDO_REQ_PRIO_BACKGROUND);
+	ASSERT_TRUE(sdo_req_queues_is_held());
+
+	/* Aged requests are held too */
+	ASSERT_PTR_EQ(&driver, sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(NULL, sdo_req_queue__dequeue(&queue));
+
+	sdo_req_queues_release();
+	ASSERT_FALSE(sdo_req_queues_is_held());
+	ASSERT_PTR_EQ(&background, sdo_req_queue__dequeue(&queue));
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+void sdo_req__on_done(struct sdo_async* async);
+
+static int fake_sdo_async_start(struct sdo_async* async,
+				const struct sdo_async_info* info)
+{
+	async->context = info->context;
+	async->type = info->type;
+	async->is_running = 1;
+	return 0;
+}
+
+static int test_req_queue_ready()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	RESET_FAKE(mloop_idle_new);
+	RESET_FAKE(mloop_idle_set_idle_fn);
+	RESET_FAKE(mloop_idle_set_cond_fn);
+
+	sdo_async_start_fake.custom_fake = fake_sdo_async_start;
+	mloop_idle_new_fake.return_val = (void*)0xdeadbeef;
+
+	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
+	ASSERT_INT_EQ(0, sdo_req_queues_init(&sock, 3, 0));
+
+	mloop_idle_fn process = mloop_idle_set_idle_fn_fake.arg1_val;
+	mloop_idle_cond_fn have_req = mloop_idle_set_cond_fn_fake.arg1_val;
+	struct mloop_idle* idle = mloop_idle_new_fake.return_val;
+
+	ASSERT_FALSE(have_req(idle));
+
+	struct sdo_req_queue* queue = sdo_req_queue_get(100);
+
+	struct sdo_req req[2];
+	memset(req, 0, sizeof(req));
+	req[0].type = req[1].type = SDO_REQ_DOWNLOAD;
+
+	ASSERT_INT_EQ(0, sdo_req_queue__enqueue(queue, &req[0]));
+	ASSERT_INT_EQ(0, sdo_req_queue__enqueue(queue, &req[1]));
+	ASSERT_TRUE(have_req(idle));
+
+	process(idle);
+	ASSERT_INT_EQ(1, sdo_async_start_fake.call_count);
+	ASSERT_PTR_EQ(&queue->sdo_client, sdo_async_start_fake.arg0_val);
+
+	/* Nothing more can be started until the running request is done */
+	ASSERT_FALSE(have_req(idle));
+
+	queue->sdo_client.is_running = 0;
+	queue->sdo_client.status = SDO_REQ_OK;
+	sdo_req__on_done(&queue->sdo_client);
+	ASSERT_TRUE(have_req(idle));
+
+	process(idle);
+	ASSERT_INT_EQ(2, sdo_async_start_fake.call_count);
+	ASSERT_PTR_EQ(&req[1], queue->sdo_client.context);
+	ASSERT_FALSE(have_req(idle));
+
+	sdo_req_queues_cleanup();
+	return 0;
+}
+
+static int fake_send(struct sdo_async* async, const struct can_frame* cf)
+{
+	(void)async;
+	(void)cf;
+	return 0;
+}
+
+static int test_req_queues_are_lazy()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_destroy);
+	RESET_FAKE(mloop_idle_new);
+
+	mloop_idle_new_fake.return_val = (void*)0xdeadbeef;
+
+	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
+	ASSERT_INT_EQ(0, sdo_req_queues_init(&sock, 3, 0));
+	sdo_req_queues_set_send_fn(fake_send);
+	ASSERT_INT_EQ(0, sdo_async_init_fake.call_count);
+	ASSERT_TRUE(sdo_req_queue_find(7) == NULL);
+
+	struct sdo_req_queue* queue = sdo_req_queue_get(7);
+	ASSERT_TRUE(queue != NULL);
+	ASSERT_INT_EQ(1, sdo_async_init_fake.call_count);
+	ASSERT_INT_EQ(7, sdo_async_init_fake.arg2_val);
+	ASSERT_INT_EQ(3, queue->limit);
+	ASSERT_TRUE(queue->sdo_client.send_fn == fake_send);
+
+	ASSERT_PTR_EQ(queue, sdo_req_queue_get(7));
+	ASSERT_PTR_EQ(queue, sdo_req_queue_find(7));
+	ASSERT_INT_EQ(1, sdo_async_init_fake.call_count);
+
+	sdo_req_queues_cleanup();
+	ASSERT_INT_EQ(1, sdo_async_destroy_fake.call_count);
+	ASSERT_TRUE(sdo_req_queue_find(7) == NULL);
+	return 0;
+}
+
+static int test_req_queue_get_failure()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(mloop_idle_new);
+
+	mloop_idle_new_fake.return_val = (void*)0xdeadbeef;
+	sdo_async_init_fake.return_val = -1;
+
+	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
+	ASSERT_INT_EQ(0, sdo_req_queues_init(&sock, 3, 0));
+
+	ASSERT_TRUE(sdo_req_queue_get(9) == NULL);
+
+	struct sdo_req req;
+	memset(&req, 0, sizeof(req));
+	ASSERT_INT_EQ(-1, sdo_req_start(&req, sdo_req_queue_get(9)));
+
+	sdo_async_init_fake.return_val = 0;
+	ASSERT_TRUE(sdo_req_queue_get(9) != NULL);
+
+	sdo_req_queues_cleanup();
+	return 0;
+}
+
+static void finish(struct sdo_async* async)
+{
+	async->is_running = 0;
+	async->status = SDO_REQ_OK;
+	sdo_req__on_done(async);
+}
+
+static int test_req_queue_channels()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	RESET_FAKE(mloop_idle_new);
+	RESET_FAKE(mloop_idle_set_idle_fn);
+
+	sdo_async_start_fake.custom_fake = fake_sdo_async_start;
+	mloop_idle_new_fake.return_val = (void*)0xdeadbeef;
+
+	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
+	ASSERT_INT_EQ(0, sdo_req_queues_init(&sock, 8, 0));
+
+	mloop_idle_fn process = mloop_idle_set_idle_fn_fake.arg1_val;
+	struct mloop_idle* idle = mloop_idle_new_fake.return_val;
+
+	struct sdo_req_queue* queue = sdo_req_queue_get(5);
+	queue->sdo_client.rx_cob_id = 0x585;
+
+	struct sdo_req_channel_info info[] = {
+		{ .tx_cob_id = 0x641, .rx_cob_id = 0x5c1 },
+		{ .tx_cob_id = 0x642, .rx_cob_id = 0x5c2 },
+	};
+
+	ASSERT_INT_EQ(0, sdo_req_queue_set_channels(queue, info, 2));
+	ASSERT_INT_EQ(3, queue->n_channels);
+	ASSERT_INT_EQ(0x642, queue->channel[2]->tx_cob_id);
+
+	ASSERT_PTR_EQ(&queue->sdo_client,
+		      sdo_req_queue_find_channel(queue, 0x585));
+	ASSERT_PTR_EQ(queue->channel[1],
+		      sdo_req_queue_find_channel(queue, 0x5c1));
+	ASSERT_PTR_EQ(NULL, sdo_req_queue_find_channel(queue, 0x5c3));
+
+	struct sdo_req req[5];
+	memset(req, 0, sizeof(req));
+	req[0].type = req[1].type = req[2].type = SDO_REQ_UPLOAD;
+	req[3].type = SDO_REQ_DOWNLOAD;
+	req[4].type = SDO_REQ_UPLOAD;
+
+	for (int i = 0; i < 5; ++i) {
+		req[i].index = 0x2000 + i;
+		ASSERT_INT_EQ(0, sdo_req_queue__enqueue(queue, &req[i]));
+	}
+
+	/* Uploads run side by side */
+	process(idle);
+	ASSERT_INT_EQ(3, sdo_async_start_fake.call_count);
+	ASSERT_PTR_EQ(&req[0], queue->channel[0]->context);
+	ASSERT_PTR_EQ(&req[1], queue->channel[1]->context);
+	ASSERT_PTR_EQ(&req[2], queue->channel[2]->context);
+
+	/* The download waits for all uploads to finish */
+	finish(queue->channel[1]);
+	process(idle);
+	finish(queue->channel[0]);
+	process(idle);
+	ASSERT_INT_EQ(3, sdo_async_start_fake.call_count);
+
+	finish(queue->channel[2]);
+	process(idle);
+	ASSERT_INT_EQ(4, sdo_async_start_fake.call_count);
+	ASSERT_PTR_EQ(&req[3], queue->channel[0]->context);
+
+	/* ...and nothing starts alongside it */
+	process(idle);
+	ASSERT_INT_EQ(4, sdo_async_start_fake.call_count);
+
+	finish(queue->channel[0]);
+	process(idle);
+	ASSERT_INT_EQ(5, sdo_async_start_fake.call_count);
+	ASSERT_PTR_EQ(&req[4], queue->channel[0]->context);
+
+	ASSERT_INT_EQ(0, sdo_req_queue_set_channels(queue, NULL, 0));
+	ASSERT_INT_EQ(1, queue->n_channels);
+
+	sdo_req_queues_cleanup();
+	return 0;
+}
+
+static int test_req_takes_upload_buffer()
+{
+	RESET_FAKE(sdo_async_init);
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 3, 0);
+
+	struct sdo_req_info info = { .type = SDO_REQ_UPLOAD };
+	struct sdo_req* req = sdo_req_new(&info);
+	req->parent = &queue;
+
+	struct sdo_async async;
+	memset(&async, 0, sizeof(async));
+	async.status = SDO_REQ_OK;
+	async.context = req;
+
+	/* Small results are copied and the buffer stays with the client */
+	vector_init(&async.buffer, 16);
+	vector_assign(&async.buffer, "1234", 4);
+	void* data = async.buffer.data;
+
+	sdo_req__on_done(&async);
+	ASSERT_PTR_EQ(req->inline_data, req->data.data);
+	ASSERT_PTR_EQ(data, async.buffer.data);
+
+	/* Large results are handed over */
+	char large[SDO_REQ_INLINE_SIZE + 8];
+	memset(large, 'x', sizeof(large));
+	vector_assign(&async.buffer, large, sizeof(large));
+	data = async.buffer.data;
+
+	sdo_req__on_done(&async);
+	ASSERT_PTR_EQ(data, req->data.data);
+	ASSERT_INT_EQ(sizeof(large), req->data.index);
+	ASSERT_INT_EQ(0, memcmp(large, req->data.data, sizeof(large)));
+	ASSERT_PTR_EQ(NULL, async.buffer.data);
+	ASSERT_INT_EQ(0, async.buffer.index);
+
+	vector_destroy(&async.buffer);
+	sdo_req_free(req);
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int n_uploads_done = 0;
+
+static void on_upload_done(struct sdo_req* req)
+{
+	(void)req;
+	++n_uploads_done;
+}
+
+static struct sdo_req* new_req(enum sdo_req_type type, int index)
+{
+	struct sdo_req_info info = {
+		.type = type,
+		.index = index,
+		.on_done = on_upload_done,
+		.dl_data = "",
+		.dl_size = 1
+	};
+
+	return sdo_req_new(&info);
+}
+
+static int test_req_coalescing()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	RESET_FAKE(mloop_idle_new);
+	RESET_FAKE(mloop_idle_set_idle_fn);
+
+	sdo_async_start_fake.custom_fake = fake_sdo_async_start;
+	mloop_idle_new_fake.return_val = (void*)0xdeadbeef;
+	n_uploads_done = 0;
+
+	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
+	ASSERT_INT_EQ(0, sdo_req_queues_init(&sock, 8, 0));
+
+	mloop_idle_fn process = mloop_idle_set_idle_fn_fake.arg1_val;
+	struct mloop_idle* idle = mloop_idle_new_fake.return_val;
+
+	struct sdo_req_queue* queue = sdo_req_queue_get(7);
+
+	struct sdo_req* status[3] = {
+		new_req(SDO_REQ_UPLOAD, 0x6041),
+		new_req(SDO_REQ_UPLOAD, 0x6041),
+		new_req(SDO_REQ_UPLOAD, 0x6041),
+	};
+	struct sdo_req* position[2] = {
+		new_req(SDO_REQ_UPLOAD, 0x6064),
+		new_req(SDO_REQ_UPLOAD, 0x6064),
+	};
+
+	ASSERT_INT_EQ(0, sdo_req_start(status[0], queue));
+	ASSERT_INT_EQ(0, sdo_req_start(position[0], queue));
+	process(idle);
+	ASSERT_INT_EQ(1, sdo_async_start_fake.call_count);
+	ASSERT_PTR_EQ(status[0], queue->sdo_client.context);
+
+	/* Joins an upload that is in flight... */
+	ASSERT_INT_EQ(0, sdo_req_start(status[1], queue));
+	/* ...and one that is queued */
+	ASSERT_INT_EQ(0, sdo_req_start(position[1], queue));
+	ASSERT_INT_EQ(1, queue->size);
+
+	/* Uploads do not join anything across a queued download */
+	struct sdo_req* control = new_req(SDO_REQ_DOWNLOAD, 0x6040);
+	ASSERT_INT_EQ(0, sdo_req_start(control, queue));
+	ASSERT_INT_EQ(0, sdo_req_start(status[2], queue));
+	ASSERT_INT_EQ(3, queue->size);
+
+	vector_init(&queue->sdo_client.buffer, 16);
+	vector_assign(&queue->sdo_client.buffer, "\x37\x02", 2);
+	queue->sdo_client.is_running = 0;
+	queue->sdo_client.status = SDO_REQ_OK;
+	sdo_req__on_done(&queue->sdo_client);
+
+	ASSERT_INT_EQ(2, n_uploads_done);
+	ASSERT_INT_EQ(SDO_REQ_OK, status[1]->status);
+	ASSERT_INT_EQ(2, status[1]->data.index);
+	ASSERT_INT_EQ(0, memcmp("\x37\x02", status[1]->data.data, 2));
+	ASSERT_INT_EQ(SDO_REQ_PENDING, status[2]->status);
+
+	vector_destroy(&queue->sdo_client.buffer);
+
+	/* Waiters are cancelled along with the upload that they wait for */
+	sdo_req_queues_cleanup();
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, position[0]->status);
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, position[1]->status);
+	ASSERT_INT_EQ(2, n_uploads_done);
+
+	for (int i = 0; i < 3; ++i)
+		sdo_req_unref(status[i]);
+	for (int i = 0; i < 2; ++i)
+		sdo_req_unref(position[i]);
+	sdo_req_unref(control);
+	return 0;
+}
+
+void sdo_req__on_stop(void* ptr);
+
+static void finish_req(struct sdo_req_queue* queue, enum sdo_req_status status,
+		       uint32_t abort_code, uint64_t rtt)
+{
+	vector_init(&queue->sdo_client.buffer, 16);
+	queue->sdo_client.is_running = 0;
+	queue->sdo_client.status = status;
+	queue->sdo_client.abort_code = abort_code;
+	queue->sdo_client.rtt = rtt;
+	sdo_req__on_done(&queue->sdo_client);
+	vector_destroy(&queue->sdo_client.buffer);
+}
+
+static int test_req_queue_counters()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	RESET_FAKE(mloop_idle_new);
+	RESET_FAKE(mloop_idle_set_idle_fn);
+
+	sdo_async_start_fake.custom_fake = fake_sdo_async_start;
+	mloop_idle_new_fake.return_val = (void*)0xdeadbeef;
+
+	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
+	ASSERT_INT_EQ(0, sdo_req_queues_init(&sock, 8, 0));
+
+	mloop_idle_fn process = mloop_idle_set_idle_fn_fake.arg1_val;
+	struct mloop_idle* idle = mloop_idle_new_fake.return_val;
+
+	struct sdo_req_queue* queue = sdo_req_queue_get(7);
+
+	static const struct {
+		enum sdo_req_status status;
+		uint32_t abort_code;
+		uint64_t rtt;
+	} outcome[] = {
+		{ SDO_REQ_OK, 0, 100 },
+		{ SDO_REQ_OK, 0, 300 },
+		{ SDO_REQ_LOCAL_ABORT, SDO_ABORT_TIMEOUT, 0 },
+		{ SDO_REQ_REMOTE_ABORT, SDO_ABORT_NEXIST, 200 },
+	};
+
+	for (size_t i = 0; i < sizeof(outcome) / sizeof(outcome[0]); ++i) {
+		struct sdo_req* req = new_req(SDO_REQ_DOWNLOAD, 0x2000 + i);
+		ASSERT_INT_EQ(0, sdo_req_start(req, queue));
+		process(idle);
+		ASSERT_PTR_EQ(req, queue->sdo_client.context);
+
+		finish_req(queue, outcome[i].status, outcome[i].abort_code,
+			   outcome[i].rtt);
+		sdo_req__on_stop(req);
+		sdo_req_unref(req);
+	}
+
+	ASSERT_UINT_EQ(2, queue->n_ok);
+	ASSERT_UINT_EQ(1, queue->n_timeouts);
+	ASSERT_UINT_EQ(1, queue->n_aborts);
+	ASSERT_UINT_EQ(3, queue->n_rtts);
+	ASSERT_UINT_EQ(600, queue->rtt_total);
+	ASSERT_UINT_EQ(300, queue->rtt_max);
+
+	sdo_req_queues_cleanup();
+	return 0;
+}
+
+
+static struct sdo_req_queue* restart_queue;
+
+static void on_done_restart(struct sdo_req* req)
+{
+	++n_uploads_done;
+
+	if (n_uploads_done < 2)
+		sdo_req_start(req, restart_queue);
+}
+
+static int test_req_restart()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	RESET_FAKE(mloop_idle_new);
+	RESET_FAKE(mloop_idle_set_idle_fn);
+
+	sdo_async_start_fake.custom_fake = fake_sdo_async_start;
+	mloop_idle_new_fake.return_val = (void*)0xdeadbeef;
+	n_uploads_done = 0;
+
+	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
+	ASSERT_INT_EQ(0, sdo_req_queues_init(&sock, 8, 0));
+
+	mloop_idle_fn process = mloop_idle_set_idle_fn_fake.arg1_val;
+	struct mloop_idle* idle = mloop_idle_new_fake.return_val;
+
+	struct sdo_req_queue* queue = sdo_req_queue_get(7);
+	restart_queue = queue;
+
+	struct sdo_req* req = new_req(SDO_REQ_UPLOAD, 0x6041);
+	req->on_done = on_done_restart;
+
+	ASSERT_INT_EQ(0, sdo_req_start(req, queue));
+	process(idle);
+	ASSERT_INT_EQ(1, sdo_async_start_fake.call_count);
+
+	/* A pending request can't be started again */
+	ASSERT_INT_EQ(-1, sdo_req_start(req, queue));
+
+	vector_init(&queue->sdo_client.buffer, 16);
+	vector_assign(&queue->sdo_client.buffer, "\x37\x02", 2);
+	queue->sdo_client.is_running = 0;
+	queue->sdo_client.status = SDO_REQ_OK;
+	sdo_req__on_done(&queue->sdo_client);
+
+	/* Started again from on_done, it waits for the channel to let go */
+	ASSERT_INT_EQ(1, n_uploads_done);
+	ASSERT_INT_EQ(SDO_REQ_OK, req->status);
+	ASSERT_INT_EQ(0, queue->size);
+
+	sdo_req__on_stop(req);
+	ASSERT_INT_EQ(SDO_REQ_PENDING, req->status);
+	ASSERT_INT_EQ(1, queue->size);
+	ASSERT_INT_EQ(2, req->ref);
+
+	process(idle);
+	ASSERT_INT_EQ(2, sdo_async_start_fake.call_count);
+	ASSERT_PTR_EQ(req, queue->sdo_client.context);
+
+	queue->sdo_client.is_running = 0;
+	queue->sdo_client.status = SDO_REQ_OK;
+	sdo_req__on_done(&queue->sdo_client);
+	sdo_req__on_stop(req);
+	ASSERT_INT_EQ(2, n_uploads_done);
+	ASSERT_INT_EQ(1, req->ref);
+	ASSERT_INT_EQ(2, req->data.index);
+
+	/* Once it's done, it can be started again right away */
+	ASSERT_INT_EQ(0, sdo_req_start(req, queue));
+	ASSERT_INT_EQ(SDO_REQ_PENDING, req->status);
+	ASSERT_INT_EQ(1, queue->size);
+
+	/* The queue is freed by the cleanup */
+	vector_destroy(&queue->sdo_client.buffer);
+
+	sdo_req_queues_cleanup();
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, req->status);
+
+	sdo_req_unref(req);
+	return 0;
+}
+
+static int test_req_queue_timeout()
+{
+	RESET_FAKE(sdo_async_init);
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 3, 0);
+
+	ASSERT_INT_EQ(SDO_REQ_TIMEOUT_MAX, sdo_req_queue_get_timeout(&queue));
+
+	sdo_req_queue_set_timeout_bounds(&queue, 20, 500);
+	ASSERT_INT_EQ(500, sdo_req_queue_get_timeout(&queue));
+
+	struct sdo_req_info info = { .type = SDO_REQ_DOWNLOAD };
+	struct sdo_req* req = sdo_req_new(&info);
+	req->parent = &queue;
+
+	struct sdo_async async;
+	memset(&async, 0, sizeof(async));
+	async.status = SDO_REQ_OK;
+	async.context = req;
+
+	/* 10 ms plus four times the initial deviation of 5 ms */
+	async.rtt = 10000;
+	sdo_req__on_done(&async);
+	ASSERT_INT_EQ(30, sdo_req_queue_get_timeout(&queue));
+
+	/* The deviation shrinks with steady measurements */
+	for (int i = 0; i < 20; ++i)
+		sdo_req__on_done(&async);
+	ASSERT_INT_EQ(20, sdo_req_queue_get_timeout(&queue));
+
+	/* Timeouts are not measurements */
+	async.rtt = 0;
+	async.status = SDO_REQ_LOCAL_ABORT;
+	sdo_req__on_done(&async);
+	ASSERT_INT_EQ(20, sdo_req_queue_get_timeout(&queue));
+
+	async.rtt = 2000000;
+	async.status = SDO_REQ_OK;
+	sdo_req__on_done(&async);
+	ASSERT_INT_EQ(500, sdo_req_queue_get_timeout(&queue));
+
+	sdo_req_free(req);
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_req_queue_lost()
+{
+	RESET_FAKE(sdo_async_init);
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 3, 0);
+
+	struct sdo_req_info info = { .type = SDO_REQ_DOWNLOAD };
+	struct sdo_req* req[2] = { sdo_req_new(&info), sdo_req_new(&info) };
+
+	ASSERT_INT_EQ(0, sdo_req_start(req[0], &queue));
+
+	sdo_req_queue_set_lost(&queue, 1);
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, req[0]->status);
+	ASSERT_INT_EQ(0, queue.size);
+	ASSERT_INT_LT(0, sdo_req_start(req[1], &queue));
+
+	sdo_req_queue_set_lost(&queue, 0);
+	ASSERT_INT_EQ(0, sdo_req_start(req[1], &queue));
+
+	sdo_req__queue_destroy(&queue);
+	sdo_req_unref(req[0]);
+	sdo_req_unref(req[1]);
+	return 0;
+}
+
 static int test_req_queue_from_async()
 {
 	struct sdo_req_queue queue;
@@ -116,8 +804,22 @@ int main()
 {
 	int r = 0;
 	RUN_TEST(test_req_new_free);
+	RUN_TEST(test_req_data_storage);
 	RUN_TEST(test_req_queue_init_destroy);
 	RUN_TEST(test_req_queue_enqueue_dequeue);
+	RUN_TEST(test_req_queue_priorities);
+	RUN_TEST(test_req_queue_aging);
+	RUN_TEST(test_req_queue_hold);
+	RUN_TEST(test_req_queue_ready);
+	RUN_TEST(test_req_queues_are_lazy);
+	RUN_TEST(test_req_queue_get_failure);
+	RUN_TEST(test_req_queue_channels);
+	RUN_TEST(test_req_takes_upload_buffer);
+	RUN_TEST(test_req_coalescing);
+	RUN_TEST(test_req_restart);
+	RUN_TEST(test_req_queue_counters);
+	RUN_TEST(test_req_queue_timeout);
+	RUN_TEST(test_req_queue_lost);
 	RUN_TEST(test_req_queue_from_async);
 	return r;
 }
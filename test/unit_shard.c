@@ -0,0 +1,195 @@
+#include "tst.h"
+#include "canopen/shard.h"
+#include "socketcan.h"
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define PATH "@unit-shard"
+
+struct join {
+	int range_start;
+	int range_stop;
+	struct co_shard_client* client;
+	int error;
+	int is_done;
+};
+
+static void* join_fn(void* arg)
+{
+	struct join* join = arg;
+
+	join->client = co_shard_client_open(PATH, join->range_start,
+					    join->range_stop);
+	join->error = errno;
+	__atomic_store_n(&join->is_done, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+/* The client waits for the answer, so the owner is served meanwhile */
+static struct co_shard_client* join(struct co_shard_owner* owner, int start,
+				    int stop)
+{
+	struct join join = { .range_start = start, .range_stop = stop };
+	pthread_t thread;
+
+	pthread_create(&thread, NULL, join_fn, &join);
+
+	while (!__atomic_load_n(&join.is_done, __ATOMIC_SEQ_CST)) {
+		struct pollfd pollfd = {
+			.fd = co_shard_owner_get_fd(owner),
+			.events = POLLIN,
+		};
+
+		if (poll(&pollfd, 1, 10) == 1)
+			co_shard_owner_process(owner);
+	}
+
+	pthread_join(thread, NULL);
+	errno = join.error;
+	return join.client;
+}
+
+static int is_readable(int fd)
+{
+	struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+	return poll(&pollfd, 1, 0) == 1;
+}
+
+static int test_ranges()
+{
+	struct co_shard_owner* owner = co_shard_owner_new(PATH, 1, 10);
+	ASSERT_TRUE(owner != NULL);
+
+	struct co_shard_client* a = join(owner, 11, 20);
+	ASSERT_TRUE(a != NULL);
+	ASSERT_UINT_EQ(1, co_shard_owner_get_n_shards(owner));
+
+	/* Overlaps with the owner and with a */
+	ASSERT_PTR_EQ(NULL, join(owner, 5, 15));
+	ASSERT_INT_EQ(EADDRINUSE, errno);
+	ASSERT_PTR_EQ(NULL, join(owner, 20, 30));
+	ASSERT_PTR_EQ(NULL, join(owner, 0, 30));
+	ASSERT_PTR_EQ(NULL, join(owner, 40, 30));
+
+	struct co_shard_client* b = join(owner, 21, 127);
+	ASSERT_TRUE(b != NULL);
+	ASSERT_UINT_EQ(2, co_shard_owner_get_n_shards(owner));
+
+	/* The range of a shard is free again once it has left */
+	co_shard_client_close(a);
+	while (co_shard_owner_get_n_shards(owner) != 1) {
+		ASSERT_TRUE(is_readable(co_shard_owner_get_fd(owner)));
+		co_shard_owner_process(owner);
+	}
+
+	a = join(owner, 11, 15);
+	ASSERT_TRUE(a != NULL);
+
+	co_shard_client_close(b);
+	co_shard_client_close(a);
+
+	/* The shards see the owner leave */
+	b = join(owner, 21, 30);
+	ASSERT_TRUE(b != NULL);
+	ASSERT_FALSE(is_readable(co_shard_client_get_control_fd(b)));
+	co_shard_owner_free(owner);
+	ASSERT_TRUE(is_readable(co_shard_client_get_control_fd(b)));
+	co_shard_client_close(b);
+	return 0;
+}
+
+static int test_frames()
+{
+	struct co_shard_owner* owner = co_shard_owner_new(PATH, 1, 10);
+	ASSERT_TRUE(owner != NULL);
+
+	struct canfd_frame cf[100];
+	uint64_t ts[100];
+	memset(cf, 0, sizeof(cf));
+
+	for (int i = 0; i < 100; ++i) {
+		cf[i].can_id = 0x181 + i;
+		cf[i].len = 8;
+		cf[i].data[7] = i;
+		ts[i] = 1000 + i;
+	}
+
+	/* Frames from before registering are not passed on */
+	co_shard_owner_publish(owner, cf, ts, 10);
+
+	struct co_shard_client* a = join(owner, 11, 20);
+	struct co_shard_client* b = join(owner, 21, 30);
+	ASSERT_TRUE(a && b);
+
+	ASSERT_FALSE(is_readable(co_shard_client_get_fd(a)));
+
+	co_shard_owner_publish(owner, cf, ts, 100);
+
+	ASSERT_TRUE(is_readable(co_shard_client_get_fd(a)));
+	ASSERT_TRUE(is_readable(co_shard_client_get_fd(b)));
+
+	struct canfd_frame rcf[64];
+	uint64_t rts[64];
+	int n = 0;
+
+	/* What does not fit keeps the eventfd readable */
+	while (is_readable(co_shard_client_get_fd(a))) {
+		ssize_t count = co_shard_client_recv(a, rcf, rts, 64);
+
+		for (ssize_t i = 0; i < count; ++i, ++n) {
+			ASSERT_UINT_EQ(0x181 + n, rcf[i].can_id);
+			ASSERT_INT_EQ(n, rcf[i].data[7]);
+			ASSERT_UINT_EQ(1000 + n, rts[i]);
+		}
+	}
+
+	ASSERT_INT_EQ(100, n);
+	ASSERT_INT_EQ(0, (int)co_shard_client_recv(a, rcf, rts, 64));
+
+	ASSERT_INT_EQ(64, (int)co_shard_client_recv(b, rcf, NULL, 64));
+	ASSERT_INT_EQ(36, (int)co_shard_client_recv(b, rcf, NULL, 64));
+	ASSERT_UINT_EQ(0, co_shard_client_get_n_lost(b));
+
+	co_shard_client_close(b);
+	co_shard_client_close(a);
+	co_shard_owner_free(owner);
+	return 0;
+}
+
+static int test_slow_shard_loses_frames()
+{
+	struct co_shard_owner* owner = co_shard_owner_new(PATH, 1, 10);
+	ASSERT_TRUE(owner != NULL);
+
+	struct co_shard_client* a = join(owner, 11, 20);
+	ASSERT_TRUE(a != NULL);
+
+	struct canfd_frame cf = { .can_id = 0x80 };
+	uint64_t ts = 0;
+
+	for (int i = 0; i < CO_SHARD_RING_SIZE + 5; ++i) {
+		cf.data[0] = i;
+		co_shard_owner_publish(owner, &cf, &ts, 1);
+	}
+
+	struct canfd_frame rcf;
+	ASSERT_INT_EQ(1, (int)co_shard_client_recv(a, &rcf, NULL, 1));
+	ASSERT_INT_EQ(5, rcf.data[0]);
+	ASSERT_UINT_EQ(5, co_shard_client_get_n_lost(a));
+
+	co_shard_client_close(a);
+	co_shard_owner_free(owner);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_ranges);
+	RUN_TEST(test_frames);
+	RUN_TEST(test_slow_shard_loses_frames);
+	return r;
+}
@@ -0,0 +1,203 @@
+#include "tst.h"
+#include "sock.h"
+#include "sock-loopback.h"
+#include "socketcan.h"
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+static int is_readable(int fd)
+{
+	struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+	return poll(&pollfd, 1, 0) == 1;
+}
+
+static int test_fan_out()
+{
+	struct sock a, b, c, other;
+
+	ASSERT_INT_GE(0, sock_open(&a, SOCK_TYPE_CAN, "loop:fan-out", NULL));
+	ASSERT_INT_EQ(SOCK_TYPE_LOOPBACK, a.type);
+	ASSERT_INT_GE(0, sock_open(&b, SOCK_TYPE_LOOPBACK, "fan-out", NULL));
+	ASSERT_INT_GE(0, sock_open(&c, SOCK_TYPE_LOOPBACK, "fan-out", NULL));
+	ASSERT_INT_GE(0, sock_open(&other, SOCK_TYPE_LOOPBACK, "other", NULL));
+
+	struct can_frame cf = { .can_id = 0x181, .can_dlc = 2,
+				.data = { 1, 2 } };
+	ASSERT_INT_EQ((int)sizeof(cf), (int)sock_send(&a, &cf, 0));
+
+	ASSERT_TRUE(is_readable(sock_get_poll_fd(&b)));
+	ASSERT_TRUE(is_readable(sock_get_poll_fd(&c)));
+	ASSERT_FALSE(is_readable(sock_get_poll_fd(&a)));
+	ASSERT_FALSE(is_readable(sock_get_poll_fd(&other)));
+
+	struct can_frame rcf;
+	ASSERT_INT_EQ((int)sizeof(rcf), (int)sock_recv(&b, &rcf, MSG_DONTWAIT));
+	ASSERT_UINT_EQ(0x181, rcf.can_id);
+	ASSERT_INT_EQ(2, rcf.can_dlc);
+	ASSERT_INT_EQ(2, rcf.data[1]);
+
+	ASSERT_INT_EQ(0, sock_timed_recv(&c, &rcf, 100) < 0);
+	ASSERT_UINT_EQ(0x181, rcf.can_id);
+
+	/* The sender does not see its own frames */
+	ASSERT_INT_EQ(-1, (int)sock_recv(&a, &rcf, MSG_DONTWAIT));
+	ASSERT_INT_EQ(EAGAIN, errno);
+	ASSERT_INT_EQ(-1, sock_timed_recv(&a, &rcf, 10));
+
+	ASSERT_FALSE(is_readable(sock_get_poll_fd(&b)));
+
+	sock_close(&other);
+	sock_close(&c);
+	sock_close(&b);
+	sock_close(&a);
+	return 0;
+}
+
+static int test_batches_keep_order()
+{
+	struct sock tx, rx;
+
+	ASSERT_INT_GE(0, sock_open(&tx, SOCK_TYPE_LOOPBACK, "order", NULL));
+	ASSERT_INT_GE(0, sock_open(&rx, SOCK_TYPE_LOOPBACK, "order", NULL));
+
+	struct can_frame cf[10];
+	memset(cf, 0, sizeof(cf));
+
+	for (int i = 0; i < 10; ++i) {
+		cf[i].can_id = 0x200 + i;
+		cf[i].can_dlc = 1;
+	}
+
+	ASSERT_INT_EQ(10, (int)sock_send_batch(&tx, cf, 10, MSG_DONTWAIT));
+
+	struct can_frame rcf[4];
+	uint64_t ts[4];
+	int n = 0;
+
+	/* What does not fit keeps the socket readable */
+	while (is_readable(sock_get_poll_fd(&rx))) {
+		ssize_t count = sock_recv_batch(&rx, rcf, ts, 4, MSG_DONTWAIT);
+		ASSERT_INT_GT(0, (int)count);
+
+		for (ssize_t i = 0; i < count; ++i)
+			ASSERT_UINT_EQ(0x200 + n++, rcf[i].can_id);
+	}
+
+	ASSERT_INT_EQ(10, n);
+
+	/* FD frames keep their size and flags */
+	struct canfd_frame fd = { .can_id = 0x300, .len = 64,
+				  .flags = CANFD_FDF };
+	fd.data[63] = 42;
+
+	ASSERT_INT_EQ(0, sock_enable_fd_frames(&rx));
+	ASSERT_INT_EQ(CANFD_MTU, (int)sock_send_fd(&tx, &fd, 0));
+
+	struct canfd_frame rfd;
+	ASSERT_INT_EQ(1, (int)sock_recv_fd_batch(&rx, &rfd, NULL, 1, 0));
+	ASSERT_INT_EQ(64, rfd.len);
+	ASSERT_TRUE(canfd_is_fd(&rfd));
+	ASSERT_INT_EQ(42, rfd.data[63]);
+
+	sock_close(&rx);
+	sock_close(&tx);
+	return 0;
+}
+
+static int test_full_ring_drops()
+{
+	struct sock_loopback* tx = sock_loopback_open("full");
+	struct sock_loopback* rx = sock_loopback_open("full");
+	ASSERT_TRUE(tx && rx);
+
+	struct canfd_frame cf = { .can_id = 0x80 };
+
+	for (int i = 0; i < SOCK_LOOPBACK_RING_SIZE + 5; ++i)
+		ASSERT_INT_EQ(1, (int)sock_loopback_send(tx, &cf, 1, 0));
+
+	ASSERT_UINT_EQ(5, sock_loopback_get_n_dropped(rx));
+	ASSERT_UINT_EQ(0, sock_loopback_get_n_dropped(tx));
+
+	struct canfd_frame rcf[64];
+	int n = 0;
+	ssize_t count;
+
+	while ((count = sock_loopback_recv(rx, rcf, NULL, 64, MSG_DONTWAIT)) > 0)
+		n += count;
+
+	ASSERT_INT_EQ(SOCK_LOOPBACK_RING_SIZE, n);
+
+	/* There is room again */
+	ASSERT_INT_EQ(1, (int)sock_loopback_send(tx, &cf, 1, 0));
+	ASSERT_INT_EQ(1, (int)sock_loopback_recv(rx, rcf, NULL, 64, 0));
+	ASSERT_UINT_EQ(5, sock_loopback_get_n_dropped(rx));
+
+	sock_loopback_close(rx);
+	sock_loopback_close(tx);
+	return 0;
+}
+
+static int test_bitrate()
+{
+	ASSERT_PTR_EQ(NULL, sock_loopback_open("slow@fast"));
+	ASSERT_PTR_EQ(NULL, sock_loopback_open("@125000"));
+
+	struct sock_loopback* tx = sock_loopback_open("slow@125000");
+	ASSERT_TRUE(tx != NULL);
+
+	/* Endpoints may leave out the bit rate but must not change it */
+	struct sock_loopback* rx = sock_loopback_open("slow");
+	ASSERT_TRUE(rx != NULL);
+	ASSERT_PTR_EQ(NULL, sock_loopback_open("slow@250000"));
+	ASSERT_INT_EQ(EINVAL, errno);
+
+	/* About 1 ms per frame, so the backlog fills up after about 10 */
+	struct canfd_frame cf[32];
+	memset(cf, 0, sizeof(cf));
+	for (int i = 0; i < 32; ++i) {
+		cf[i].can_id = 0x181;
+		cf[i].len = 8;
+	}
+
+	ssize_t count = sock_loopback_send(tx, cf, 32, MSG_DONTWAIT);
+	ASSERT_INT_GE(5, (int)count);
+	ASSERT_INT_LE(15, (int)count);
+
+	ASSERT_INT_EQ(-1, (int)sock_loopback_send(tx, cf, 1, MSG_DONTWAIT));
+	ASSERT_INT_EQ(ENOBUFS, errno);
+
+	struct canfd_frame rcf[32];
+	uint64_t ts[32];
+	ASSERT_INT_EQ((int)count,
+		      (int)sock_loopback_recv(rx, rcf, ts, 32, MSG_DONTWAIT));
+
+	for (ssize_t i = 1; i < count; ++i) {
+		ASSERT_UINT_GE(800, ts[i] - ts[i - 1]);
+		ASSERT_UINT_LE(1500, ts[i] - ts[i - 1]);
+	}
+
+	/* A blocking sender waits for the bus */
+	ASSERT_INT_EQ(1, (int)sock_loopback_send(tx, cf, 1, 0));
+
+	sock_loopback_close(rx);
+	sock_loopback_close(tx);
+
+	/* The bus is gone with its last endpoint */
+	rx = sock_loopback_open("slow@250000");
+	ASSERT_TRUE(rx != NULL);
+	sock_loopback_close(rx);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_fan_out);
+	RUN_TEST(test_batches_keep_order);
+	RUN_TEST(test_full_ring_drops);
+	RUN_TEST(test_bitrate);
+	return r;
+}
@@ -0,0 +1,175 @@
+#include "tst.h"
+#include "sock.h"
+#include "sock-udp.h"
+#include "socketcan.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static char address_[64];
+static struct sockaddr_in dst_;
+static int publisher_ = -1;
+
+static int publish(uint32_t seq, size_t n)
+{
+	unsigned char buffer[SOCK_UDP_MAX_SIZE];
+	struct can_frame cf[SOCK_UDP_MAX_FRAMES];
+
+	memset(cf, 0, sizeof(cf));
+
+	for (size_t i = 0; i < n; ++i) {
+		cf[i].can_id = htonl(0x181);
+		cf[i].can_dlc = 4;
+		uint32_t value = seq + i;
+		memcpy(cf[i].data, &value, sizeof(value));
+	}
+
+	size_t size = sock_udp_encode(buffer, seq, cf, n);
+
+	ASSERT_INT_EQ((int)size, (int)sendto(publisher_, buffer, size, 0,
+					     (struct sockaddr*)&dst_,
+					     sizeof(dst_)));
+	return 0;
+}
+
+static int open_subscriber(struct sock* sock)
+{
+	ASSERT_INT_GE(0, sock_open(sock, SOCK_TYPE_CAN, address_, NULL));
+	ASSERT_INT_EQ(SOCK_TYPE_UDP, sock->type);
+	return 0;
+}
+
+static int test_parse_address()
+{
+	struct sockaddr_in addr;
+
+	ASSERT_INT_EQ(0, sock_udp_parse_address(&addr, "239.255.42.1"));
+	ASSERT_INT_EQ(SOCK_UDP_DEFAULT_PORT, ntohs(addr.sin_port));
+
+	ASSERT_INT_EQ(0, sock_udp_parse_address(&addr, "239.255.42.1:6000"));
+	ASSERT_INT_EQ(6000, ntohs(addr.sin_port));
+
+	ASSERT_INT_EQ(-1, sock_udp_parse_address(&addr, "bus.example:6000"));
+	ASSERT_INT_EQ(-1, sock_udp_parse_address(&addr, "239.255.42.1:0"));
+
+	return 0;
+}
+
+static int test_receive_in_batches()
+{
+	struct sock sock;
+	ASSERT_INT_EQ(0, open_subscriber(&sock));
+
+	ASSERT_INT_EQ(0, publish(100, 5));
+	ASSERT_INT_EQ(0, publish(105, 3));
+
+	struct can_frame cf[4];
+	uint64_t ts[4];
+
+	/* The rest of the first datagram comes before the second one */
+	ASSERT_INT_EQ(4, (int)sock_recv_batch(&sock, cf, ts, 4, 0));
+	ASSERT_INT_EQ(0x181, (int)cf[0].can_id);
+	ASSERT_INT_EQ(4, cf[0].can_dlc);
+	ASSERT_INT_EQ(1, (int)sock_recv_batch(&sock, cf, ts, 1, 0));
+	ASSERT_INT_EQ(104, cf[0].data[0]);
+
+	ASSERT_INT_EQ(3, (int)sock_recv_batch(&sock, cf, ts, 4, 0));
+	ASSERT_INT_EQ(107, cf[2].data[0]);
+
+	struct can_frame single;
+	ASSERT_INT_EQ(-1, (int)sock_recv(&sock, &single, MSG_DONTWAIT));
+
+	struct sock_udp_stats stats;
+	ASSERT_INT_EQ(0, sock_get_udp_stats(&sock, &stats));
+	ASSERT_TRUE(stats.n_frames == 8);
+	ASSERT_TRUE(stats.n_lost == 0);
+
+	sock_close(&sock);
+	return 0;
+}
+
+static int test_gaps()
+{
+	struct sock sock;
+	ASSERT_INT_EQ(0, open_subscriber(&sock));
+
+	ASSERT_INT_EQ(0, publish(0, 2));
+	ASSERT_INT_EQ(0, publish(10, 2));
+	ASSERT_INT_EQ(0, publish(12, 1));
+
+	struct can_frame cf[8];
+	ssize_t total = 0;
+
+	while (total < 5) {
+		ssize_t n = sock_recv_batch(&sock, cf, NULL, 8, 0);
+		ASSERT_INT_GE(1, (int)n);
+		total += n;
+	}
+
+	struct sock_udp_stats stats;
+	ASSERT_INT_EQ(0, sock_get_udp_stats(&sock, &stats));
+	ASSERT_TRUE(stats.n_lost == 8);
+	ASSERT_TRUE(stats.n_gaps == 1);
+
+	sock_close(&sock);
+	return 0;
+}
+
+static int test_invalid_datagrams()
+{
+	struct sock sock;
+	ASSERT_INT_EQ(0, open_subscriber(&sock));
+
+	const char junk[] = "not a frame";
+	sendto(publisher_, junk, sizeof(junk), 0, (struct sockaddr*)&dst_,
+	       sizeof(dst_));
+	ASSERT_INT_EQ(0, publish(0, 1));
+
+	struct can_frame cf;
+	ASSERT_INT_EQ((int)sizeof(cf), (int)sock_recv(&sock, &cf, 0));
+
+	struct sock_udp_stats stats;
+	ASSERT_INT_EQ(0, sock_get_udp_stats(&sock, &stats));
+	ASSERT_TRUE(stats.n_invalid == 1);
+
+	sock_close(&sock);
+	return 0;
+}
+
+static int test_no_sending()
+{
+	struct sock sock;
+	ASSERT_INT_EQ(0, open_subscriber(&sock));
+
+	struct can_frame cf = { .can_id = 0x80 };
+	ASSERT_INT_EQ(-1, (int)sock_send_batch(&sock, &cf, 1, 0));
+
+	sock_close(&sock);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	int port = 20000 + getpid() % 20000;
+	snprintf(address_, sizeof(address_), "udp:127.0.0.1:%d", port);
+	sock_udp_parse_address(&dst_, address_ + 4);
+
+	publisher_ = sock_udp_open_publisher(1);
+	if (publisher_ < 0)
+		return 1;
+
+	RUN_TEST(test_parse_address);
+	RUN_TEST(test_receive_in_batches);
+	RUN_TEST(test_gaps);
+	RUN_TEST(test_invalid_datagrams);
+	RUN_TEST(test_no_sending);
+
+	close(publisher_);
+	return r;
+}
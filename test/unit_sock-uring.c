@@ -0,0 +1,144 @@
+#include "tst.h"
+#include "sock-uring.h"
+
+#include "socketcan.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/* The kernel may not support io_uring; only run the tests if it does */
+static struct sock_uring* make_uring(int* fds)
+{
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0)
+		return NULL;
+
+	struct sock_uring* uring = sock_uring_new(fds[0]);
+	if (!uring) {
+		close(fds[0]);
+		close(fds[1]);
+		printf("io_uring is not available; skipping\n");
+	}
+
+	return uring;
+}
+
+int test_recv(void)
+{
+	int fds[2];
+	struct sock_uring* uring = make_uring(fds);
+	if (!uring)
+		return 0;
+
+	struct can_frame cf = { .can_id = 0x181, .can_dlc = 2 };
+	ASSERT_INT_EQ(CAN_MTU, write(fds[1], &cf, sizeof(cf)));
+	cf.can_id = 0x182;
+	ASSERT_INT_EQ(CAN_MTU, write(fds[1], &cf, sizeof(cf)));
+
+	struct canfd_frame fd = { .can_id = 0x281, .len = 64 };
+	fd.data[63] = 42;
+	ASSERT_INT_EQ(CANFD_MTU, write(fds[1], &fd, sizeof(fd)));
+
+	struct canfd_frame buffer[4];
+	uint64_t ts[4];
+
+	ASSERT_INT_EQ(3, sock_uring_recv(uring, buffer, ts, 4, 1000));
+
+	ASSERT_INT_EQ(0x181, buffer[0].can_id);
+	ASSERT_FALSE(canfd_is_fd(&buffer[0]));
+	ASSERT_INT_EQ(0x182, buffer[1].can_id);
+	ASSERT_INT_EQ(0x281, buffer[2].can_id);
+	ASSERT_TRUE(canfd_is_fd(&buffer[2]));
+	ASSERT_INT_EQ(42, buffer[2].data[63]);
+
+	ASSERT_INT_EQ(-1, sock_uring_recv(uring, buffer, ts, 4, 0));
+
+	sock_uring_free(uring);
+	close(fds[0]);
+	close(fds[1]);
+	return 0;
+}
+
+int test_recv_many(void)
+{
+	int fds[2];
+	struct sock_uring* uring = make_uring(fds);
+	if (!uring)
+		return 0;
+
+	struct canfd_frame buffer[16];
+	struct can_frame cf = { .can_dlc = 1 };
+	int n = 0;
+
+	/* More frames than there are buffers in the ring */
+	for (int i = 0; i < 1000; ++i) {
+		cf.can_id = i & CAN_SFF_MASK;
+		ASSERT_INT_EQ(CAN_MTU, write(fds[1], &cf, sizeof(cf)));
+
+		if (i % 16 != 15)
+			continue;
+
+		ssize_t count = sock_uring_recv(uring, buffer, NULL, 16, 1000);
+		ASSERT_INT_GT(0, count);
+
+		for (ssize_t j = 0; j < count; ++j, ++n)
+			ASSERT_INT_EQ(n & CAN_SFF_MASK, buffer[j].can_id);
+	}
+
+	while (n < 1000) {
+		ssize_t count = sock_uring_recv(uring, buffer, NULL, 16, 1000);
+		ASSERT_INT_GT(0, count);
+
+		for (ssize_t j = 0; j < count; ++j, ++n)
+			ASSERT_INT_EQ(n & CAN_SFF_MASK, buffer[j].can_id);
+	}
+
+	sock_uring_free(uring);
+	close(fds[0]);
+	close(fds[1]);
+	return 0;
+}
+
+int test_send(void)
+{
+	int fds[2];
+	struct sock_uring* uring = make_uring(fds);
+	if (!uring)
+		return 0;
+
+	struct canfd_frame frames[100];
+	memset(frames, 0, sizeof(frames));
+
+	for (int i = 0; i < 100; ++i) {
+		frames[i].can_id = i;
+		frames[i].len = 1;
+	}
+
+	frames[99].flags = CANFD_FDF;
+	frames[99].len = 64;
+
+	ASSERT_INT_EQ(100, sock_uring_send(uring, frames, 100, 0));
+
+	struct canfd_frame cf;
+	for (int i = 0; i < 99; ++i) {
+		ASSERT_INT_EQ(CAN_MTU, read(fds[1], &cf, sizeof(cf)));
+		ASSERT_INT_EQ(i, cf.can_id);
+	}
+
+	ASSERT_INT_EQ(CANFD_MTU, read(fds[1], &cf, sizeof(cf)));
+	ASSERT_INT_EQ(99, cf.can_id);
+
+	sock_uring_free(uring);
+	close(fds[0]);
+	close(fds[1]);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_recv);
+	RUN_TEST(test_recv_many);
+	RUN_TEST(test_send);
+	return r;
+}
@@ -0,0 +1,247 @@
+#include "tst.h"
+#include "sock.h"
+#include "net-util.h"
+#include "socketcan.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+static int make_pair(struct sock* a, struct sock* b, enum sock_type type)
+{
+	int fds[2];
+	int kind = type == SOCK_TYPE_TCP ? SOCK_STREAM : SOCK_SEQPACKET;
+
+	ASSERT_INT_EQ(0, socketpair(AF_UNIX, kind, 0, fds));
+
+	sock_init(a, type, fds[0], NULL);
+	sock_init(b, type, fds[1], NULL);
+	return 0;
+}
+
+static int test_unix_batch()
+{
+	struct sock a, b;
+	ASSERT_INT_EQ(0, make_pair(&a, &b, SOCK_TYPE_UNIX));
+
+	struct can_frame out[3], in[4];
+	memset(out, 0, sizeof(out));
+
+	for (int i = 0; i < 3; ++i) {
+		out[i].can_id = 0x181 + i;
+		out[i].can_dlc = i;
+	}
+
+	ASSERT_INT_EQ(3, (int)sock_send_batch(&a, out, 3, 0));
+	ASSERT_INT_EQ(3, (int)sock_recv_batch(&b, in, NULL, 4, MSG_DONTWAIT));
+
+	for (int i = 0; i < 3; ++i) {
+		ASSERT_INT_EQ(0x181 + i, (int)in[i].can_id);
+		ASSERT_INT_EQ(i, in[i].can_dlc);
+	}
+
+	sock_close(&a);
+	sock_close(&b);
+	return 0;
+}
+
+static int test_unix_short_messages()
+{
+	struct sock a, b;
+	ASSERT_INT_EQ(0, make_pair(&a, &b, SOCK_TYPE_UNIX));
+
+	struct can_frame out, in[4];
+	memset(&out, 0, sizeof(out));
+	out.can_id = 0x181;
+
+	ASSERT_INT_EQ(1, (int)sock_send_batch(&a, &out, 1, 0));
+	ASSERT_INT_EQ(3, (int)send(a.fd, "abc", 3, 0));
+	out.can_id = 0x182;
+	ASSERT_INT_EQ(1, (int)sock_send_batch(&a, &out, 1, 0));
+
+	/* The frame after the short message is not lost */
+	ASSERT_INT_EQ(2, (int)sock_recv_batch(&b, in, NULL, 4, MSG_DONTWAIT));
+	ASSERT_INT_EQ(0x181, (int)in[0].can_id);
+	ASSERT_INT_EQ(0x182, (int)in[1].can_id);
+
+	/* Nothing but short messages looks like an empty socket */
+	ASSERT_INT_EQ(3, (int)send(a.fd, "abc", 3, 0));
+	ASSERT_INT_EQ(-1, (int)sock_recv_batch(&b, in, NULL, 4,
+					       MSG_DONTWAIT));
+	ASSERT_INT_EQ(EAGAIN, errno);
+
+	sock_close(&a);
+	sock_close(&b);
+	return 0;
+}
+
+static int test_unix_fd_frames()
+{
+	struct sock a, b;
+	ASSERT_INT_EQ(0, make_pair(&a, &b, SOCK_TYPE_UNIX));
+	ASSERT_INT_EQ(0, sock_enable_fd_frames(&a));
+
+	struct canfd_frame out[2], in[2];
+	memset(out, 0, sizeof(out));
+
+	out[0].can_id = 0x281;
+	out[0].len = 12;
+	out[0].flags = CANFD_FDF;
+	memset(out[0].data, 0xaa, 12);
+
+	out[1].can_id = 0x181;
+	out[1].len = 8;
+
+	ASSERT_INT_EQ(2, (int)sock_send_fd_batch(&a, out, 2, 0));
+	ASSERT_INT_EQ(2, (int)sock_recv_fd_batch(&b, in, NULL, 2,
+						 MSG_DONTWAIT));
+
+	ASSERT_TRUE(canfd_is_fd(&in[0]));
+	ASSERT_INT_EQ(12, in[0].len);
+	ASSERT_INT_EQ(0xaa, in[0].data[11]);
+	ASSERT_FALSE(canfd_is_fd(&in[1]));
+	ASSERT_INT_EQ(0x181, (int)in[1].can_id);
+
+	/* A message of the wrong size does not cost the frame after it */
+	ASSERT_INT_EQ(3, (int)send(a.fd, "abc", 3, 0));
+	ASSERT_INT_EQ(1, (int)sock_send_fd_batch(&a, &out[1], 1, 0));
+	ASSERT_INT_EQ(1, (int)sock_recv_fd_batch(&b, in, NULL, 2,
+						 MSG_DONTWAIT));
+	ASSERT_INT_EQ(0x181, (int)in[0].can_id);
+
+	sock_close(&a);
+	sock_close(&b);
+	return 0;
+}
+
+static int test_tcp_byte_order()
+{
+	struct sock a, raw;
+	ASSERT_INT_EQ(0, make_pair(&a, &raw, SOCK_TYPE_TCP));
+
+	struct can_frame cf = { .can_id = 0x705, .can_dlc = 1 };
+	ASSERT_INT_EQ((int)sizeof(cf), (int)sock_send(&a, &cf, 0));
+
+	struct can_frame wire;
+	ASSERT_INT_EQ((int)sizeof(wire), (int)read(raw.fd, &wire,
+						   sizeof(wire)));
+	ASSERT_INT_EQ(0x705, (int)ntohl(wire.can_id));
+
+	sock_close(&a);
+	sock_close(&raw);
+	return 0;
+}
+
+static int drain_tcp(int fd, int* next_id)
+{
+	static char buffer[sizeof(struct can_frame) * 64];
+	static size_t length;
+
+	ssize_t rc;
+	while ((rc = recv(fd, buffer + length, sizeof(buffer) - length,
+			  MSG_DONTWAIT)) > 0) {
+		length += rc;
+
+		size_t n = length / sizeof(struct can_frame);
+		for (size_t i = 0; i < n; ++i) {
+			struct can_frame cf;
+			memcpy(&cf, buffer + i * sizeof(cf), sizeof(cf));
+			ASSERT_INT_EQ(*next_id, (int)ntohl(cf.can_id));
+			++*next_id;
+		}
+
+		length -= n * sizeof(struct can_frame);
+		memmove(buffer, buffer + n * sizeof(struct can_frame), length);
+	}
+
+	return 0;
+}
+
+static int test_tcp_batch_short_send()
+{
+	struct sock a, raw;
+	ASSERT_INT_EQ(0, make_pair(&a, &raw, SOCK_TYPE_TCP));
+
+	int sndbuf = 1000;
+	setsockopt(a.fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	struct can_frame out[1000];
+	memset(out, 0, sizeof(out));
+
+	for (int i = 0; i < 1000; ++i) {
+		out[i].can_id = 0x100 + i;
+		out[i].can_dlc = 8;
+	}
+
+	int next_id = 0x100;
+	size_t sent = 0;
+
+	while (sent < 1000) {
+		ssize_t rc = sock_send_batch(&a, &out[sent], 1000 - sent,
+					     MSG_DONTWAIT);
+		if (rc > 0)
+			sent += rc;
+
+		ASSERT_INT_EQ(0, drain_tcp(raw.fd, &next_id));
+	}
+
+	ASSERT_INT_EQ(0, drain_tcp(raw.fd, &next_id));
+	ASSERT_INT_EQ(0x100 + 1000, next_id);
+
+	/* Frames are left in host byte order */
+	for (int i = 0; i < 1000; ++i)
+		ASSERT_INT_EQ(0x100 + i, (int)out[i].can_id);
+
+	sock_close(&a);
+	sock_close(&raw);
+	return 0;
+}
+
+static int test_open_unix_scheme()
+{
+	char path[64];
+	snprintf(path, sizeof(path), "@unit_sock.%d", (int)getpid());
+
+	int lfd = net_unix_listen(path);
+	ASSERT_INT_GE(0, lfd);
+
+	char addr[80];
+	snprintf(addr, sizeof(addr), "unix:%s", path);
+
+	struct sock client;
+	ASSERT_INT_GE(0, sock_open(&client, SOCK_TYPE_CAN, addr, NULL));
+	ASSERT_INT_EQ(SOCK_TYPE_UNIX, client.type);
+
+	int cfd = accept(lfd, NULL, NULL);
+	ASSERT_INT_GE(0, cfd);
+
+	struct sock server;
+	sock_init(&server, SOCK_TYPE_UNIX, cfd, NULL);
+
+	struct can_frame cf = { .can_id = 0x80, .can_dlc = 0 };
+	ASSERT_INT_EQ((int)sizeof(cf), (int)sock_send(&client, &cf, 0));
+
+	struct can_frame in;
+	ASSERT_INT_EQ((int)sizeof(in), (int)sock_recv(&server, &in, 0));
+	ASSERT_INT_EQ(0x80, (int)in.can_id);
+
+	sock_close(&client);
+	sock_close(&server);
+	close(lfd);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_unix_batch);
+	RUN_TEST(test_unix_short_messages);
+	RUN_TEST(test_unix_fd_frames);
+	RUN_TEST(test_tcp_byte_order);
+	RUN_TEST(test_tcp_batch_short_send);
+	RUN_TEST(test_open_unix_scheme);
+	return r;
+}
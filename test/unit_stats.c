@@ -0,0 +1,102 @@
+#include "tst.h"
+#include "canopen.h"
+#include "canopen/stats.h"
+
+#include <pthread.h>
+
+int test_count_by_function(void)
+{
+	co_stats_reset();
+
+	co_stats_count_rx(R_TPDO1 + 5, 1);
+	co_stats_count_rx(R_TPDO1 + 5, 2);
+	co_stats_count_rx(R_HEARTBEAT + 5, 3);
+	co_stats_count_tx(R_RPDO2 + 5, 4);
+	co_stats_count_rx(R_TPDO1 + 6, 5);
+
+	struct co_stats_node stats;
+	co_stats_get_node(&stats, 5);
+
+	ASSERT_INT_EQ(2, stats.rx[R_TPDO1 >> 7]);
+	ASSERT_INT_EQ(1, stats.rx[R_HEARTBEAT >> 7]);
+	ASSERT_INT_EQ(1, stats.tx[R_RPDO2 >> 7]);
+	ASSERT_INT_EQ(0, stats.rx[R_RPDO2 >> 7]);
+	ASSERT_INT_EQ(3, co_stats_get_rx(R_TPDO1 + 5) + co_stats_get_rx(R_HEARTBEAT + 5));
+	return 0;
+}
+
+int test_interval_histogram(void)
+{
+	co_stats_reset();
+
+	co_stats_count_rx(R_TPDO3 + 1, 1000);
+	co_stats_count_rx(R_TPDO3 + 1, 2000);
+	co_stats_count_rx(R_TPDO3 + 1, 2001);
+
+	struct co_stats_node stats;
+	co_stats_get_node(&stats, 1);
+
+	const uint64_t* bucket = stats.histogram[CO_STATS_TPDO3_INTERVAL];
+	ASSERT_INT_EQ(1, bucket[0]);
+	ASSERT_INT_EQ(1, bucket[9]);
+	ASSERT_INT_EQ(0, stats.histogram[CO_STATS_TPDO1_INTERVAL][9]);
+	return 0;
+}
+
+int test_sdo_round_trip(void)
+{
+	co_stats_reset();
+
+	co_stats_count_tx(R_RSDO + 7, 100);
+	co_stats_count_rx(R_TSDO + 7, 164);
+
+	/* A response without a request is not timed */
+	co_stats_count_rx(R_TSDO + 7, 200);
+
+	struct co_stats_node stats;
+	co_stats_get_node(&stats, 7);
+
+	uint64_t total = 0;
+	for (int i = 0; i < CO_STATS_N_BUCKETS; ++i)
+		total += stats.histogram[CO_STATS_SDO_RTT][i];
+
+	ASSERT_INT_EQ(1, total);
+	ASSERT_INT_EQ(1, stats.histogram[CO_STATS_SDO_RTT][6]);
+	return 0;
+}
+
+static void* count_in_thread(void* arg)
+{
+	(void)arg;
+
+	for (int i = 0; i < 1000; ++i)
+		co_stats_count_rx(R_EMCY + 2, i);
+
+	return NULL;
+}
+
+int test_threads_are_summed(void)
+{
+	co_stats_reset();
+
+	pthread_t thread[4];
+
+	for (int i = 0; i < 4; ++i)
+		pthread_create(&thread[i], NULL, count_in_thread, NULL);
+
+	for (int i = 0; i < 4; ++i)
+		pthread_join(thread[i], NULL);
+
+	ASSERT_INT_EQ(4000, co_stats_get_rx(R_EMCY + 2));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_count_by_function);
+	RUN_TEST(test_interval_histogram);
+	RUN_TEST(test_sdo_round_trip);
+	RUN_TEST(test_threads_are_summed);
+	return r;
+}
@@ -74,6 +74,30 @@ static int test_string_replace_char()
 	return 0;
 }
 
+static int test_string_parse_int_list()
+{
+	int list[8];
+
+	ASSERT_INT_EQ(0, string_parse_int_list(list, 8, ""));
+
+	ASSERT_INT_EQ(1, string_parse_int_list(list, 8, "3"));
+	ASSERT_INT_EQ(3, list[0]);
+
+	ASSERT_INT_EQ(5, string_parse_int_list(list, 8, "0,2,4-6"));
+	ASSERT_INT_EQ(0, list[0]);
+	ASSERT_INT_EQ(2, list[1]);
+	ASSERT_INT_EQ(4, list[2]);
+	ASSERT_INT_EQ(5, list[3]);
+	ASSERT_INT_EQ(6, list[4]);
+
+	ASSERT_INT_EQ(-1, string_parse_int_list(list, 2, "1-3"));
+	ASSERT_INT_EQ(-1, string_parse_int_list(list, 8, "3-1"));
+	ASSERT_INT_EQ(-1, string_parse_int_list(list, 8, "1,"));
+	ASSERT_INT_EQ(-1, string_parse_int_list(list, 8, "1;2"));
+	ASSERT_INT_EQ(-1, string_parse_int_list(list, 8, "-1"));
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -85,5 +109,6 @@ int main()
 	RUN_TEST(test_string_begins_with);
 	RUN_TEST(test_string_ends_with);
 	RUN_TEST(test_string_replace_char);
+	RUN_TEST(test_string_parse_int_list);
 	return r;
 }
@@ -0,0 +1,124 @@
+#include "tst.h"
+#include "canopen/sync.h"
+
+#include <unistd.h>
+
+static int n_calls;
+static int delay_us;
+
+static void on_sync(void)
+{
+	__atomic_fetch_add(&n_calls, 1, __ATOMIC_RELAXED);
+
+	if (delay_us)
+		usleep(delay_us);
+}
+
+static void reset(void)
+{
+	co_sync_reset_stats();
+	n_calls = 0;
+	delay_us = 0;
+}
+
+static int test_start_stop(void)
+{
+	reset();
+
+	ASSERT_FALSE(co_sync_is_running());
+	ASSERT_INT_EQ(-1, co_sync_start(0, 0, on_sync));
+	ASSERT_INT_EQ(-1, co_sync_start(1000, 0, NULL));
+
+	ASSERT_INT_EQ(0, co_sync_start(1000, 0, on_sync));
+	ASSERT_TRUE(co_sync_is_running());
+	ASSERT_INT_EQ(-1, co_sync_start(1000, 0, on_sync));
+
+	usleep(50000);
+	co_sync_stop();
+	ASSERT_FALSE(co_sync_is_running());
+
+	int n = __atomic_load_n(&n_calls, __ATOMIC_RELAXED);
+	ASSERT_INT_GE(20, n);
+
+	struct co_sync_stats stats;
+	co_sync_get_stats(&stats);
+	ASSERT_UINT_EQ(n, stats.count);
+
+	uint64_t sum = 0;
+	for (int i = 0; i < CO_SYNC_N_BUCKETS; ++i)
+		sum += stats.bucket[i];
+	ASSERT_UINT_EQ(stats.count, sum);
+
+	/* Nothing more is called once stopped */
+	usleep(5000);
+	ASSERT_INT_EQ(n, __atomic_load_n(&n_calls, __ATOMIC_RELAXED));
+
+	co_sync_stop();
+	return 0;
+}
+
+static int test_deadlines_do_not_drift(void)
+{
+	uint64_t period = 2000000;
+	uint64_t start = 1000000;
+	uint64_t deadline = start;
+	uint64_t n_missed;
+
+	/* Deadlines are absolute, so they stay on the grid even though each
+	 * wake-up is a little late.
+	 */
+	for (int i = 0; i < 100; ++i) {
+		uint64_t late = (i * 7919) % 500000;
+		uint64_t jitter = co_sync__advance(&deadline, deadline + late,
+						   period, &n_missed);
+		ASSERT_UINT_EQ(late, jitter);
+		ASSERT_UINT_EQ(0, n_missed);
+	}
+
+	ASSERT_UINT_EQ(start + 100 * period, deadline);
+	return 0;
+}
+
+static int test_missed_deadlines(void)
+{
+	uint64_t period = 1000000;
+	uint64_t deadline = 5000000;
+	uint64_t n_missed;
+
+	/* The missed periods are not counted as jitter */
+	ASSERT_UINT_EQ(500000, co_sync__advance(&deadline, 8500000, period,
+						&n_missed));
+	ASSERT_UINT_EQ(3, n_missed);
+	ASSERT_UINT_EQ(9000000, deadline);
+	return 0;
+}
+
+static int test_overruns(void)
+{
+	reset();
+	delay_us = 3500;
+
+	ASSERT_INT_EQ(0, co_sync_start(1000, 0, on_sync));
+	usleep(50000);
+	co_sync_stop();
+
+	struct co_sync_stats stats;
+	co_sync_get_stats(&stats);
+
+	ASSERT_INT_GE(1, (int)stats.count);
+	ASSERT_INT_GE(2 * (int)stats.count - 2, (int)stats.n_overruns);
+
+	/* The missed periods are not counted as jitter */
+	ASSERT_INT_LT(1000, (int)stats.jitter_max);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_start_stop);
+	RUN_TEST(test_deadlines_do_not_drift);
+	RUN_TEST(test_missed_deadlines);
+	RUN_TEST(test_overruns);
+	return r;
+}
@@ -0,0 +1,67 @@
+#include "tst.h"
+#include "time-utils.h"
+
+#include <time.h>
+
+/* Clocks that are read one after the other should be this close */
+#define TOLERANCE_US 1000
+
+static int is_near(uint64_t a, uint64_t b)
+{
+	return (a > b ? a - b : b - a) <= TOLERANCE_US;
+}
+
+static void sleep_ms(unsigned int ms)
+{
+	struct timespec ts = ns_to_timespec(msec_to_nsec(ms));
+	while (nanosleep(&ts, &ts) < 0)
+		;
+}
+
+static int check_clocks(void)
+{
+	ASSERT_TRUE(is_near(gettime_us(CLOCK_MONOTONIC), fastclock_us()));
+	ASSERT_TRUE(is_near(gettime_us(CLOCK_REALTIME),
+			    fastclock_realtime_us()));
+	ASSERT_TRUE(is_near(gettime_us(CLOCK_REALTIME),
+			    fastclock_to_realtime_us(fastclock_ns())));
+	return 0;
+}
+
+static int test_fallback(void)
+{
+	return check_clocks();
+}
+
+static int test_counter(void)
+{
+	if (fastclock_init() < 0)
+		return 0;
+
+	ASSERT_INT_EQ(0, check_clocks());
+
+	uint64_t last = fastclock_ns();
+	for (int i = 0; i < 100000; ++i) {
+		uint64_t now = fastclock_ns();
+		ASSERT_TRUE(now >= last);
+		last = now;
+	}
+
+	/* Long enough for the calibration to be refreshed */
+	sleep_ms(1100);
+
+	ASSERT_TRUE(fastclock_ns() >= last);
+	ASSERT_INT_EQ(0, check_clocks());
+
+	/* It is only done once */
+	ASSERT_INT_EQ(0, fastclock_init());
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_fallback);
+	RUN_TEST(test_counter);
+	return r;
+}
@@ -0,0 +1,106 @@
+#include "tst.h"
+#include "canopen/timeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char* dump(void)
+{
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* stream = open_memstream(&buffer, &size);
+	if (!stream)
+		abort();
+
+	co_timeline_dump(stream);
+	fclose(stream);
+	return buffer;
+}
+
+static int test_disabled(void)
+{
+	co_timeline_enable(0);
+	co_timeline_reset();
+
+	co_timeline_begin(5, CO_TIMELINE_IDENTITY);
+	co_timeline_end(5, CO_TIMELINE_IDENTITY);
+
+	char* json = dump();
+	ASSERT_TRUE(strstr(json, "\"traceEvents\": [") != NULL);
+	ASSERT_TRUE(strstr(json, "identity") == NULL);
+	free(json);
+	return 0;
+}
+
+static int test_spans(void)
+{
+	co_timeline_enable(1);
+	co_timeline_reset();
+
+	co_timeline_begin(0, CO_TIMELINE_RESET);
+	co_timeline_end(0, CO_TIMELINE_RESET);
+	co_timeline_begin(5, CO_TIMELINE_IDENTITY);
+	co_timeline_end(5, CO_TIMELINE_IDENTITY);
+
+	/* Unfinished spans are left out */
+	co_timeline_begin(5, CO_TIMELINE_INIT);
+
+	/* An end without a beginning is ignored */
+	co_timeline_end(7, CO_TIMELINE_START);
+
+	char* json = dump();
+	ASSERT_TRUE(strstr(json, "\"args\": { \"name\": \"master\" }") != NULL);
+	ASSERT_TRUE(strstr(json, "\"args\": { \"name\": \"node 5\" }") != NULL);
+	ASSERT_TRUE(strstr(json, "\"name\": \"reset\"") != NULL);
+	ASSERT_TRUE(strstr(json, "\"name\": \"identity\", \"cat\": \"bootup\", \"ph\": \"X\", \"pid\": 1, \"tid\": 5") != NULL);
+	ASSERT_TRUE(strstr(json, "\"init\"") == NULL);
+	ASSERT_TRUE(strstr(json, "node 7") == NULL);
+	free(json);
+
+	co_timeline_enable(0);
+	return 0;
+}
+
+static int test_span_is_replaced(void)
+{
+	co_timeline_enable(1);
+	co_timeline_reset();
+
+	co_timeline_begin(3, CO_TIMELINE_START);
+	co_timeline_end(3, CO_TIMELINE_START);
+	co_timeline_begin(3, CO_TIMELINE_START);
+
+	char* json = dump();
+	ASSERT_TRUE(strstr(json, "node 3") == NULL);
+	free(json);
+
+	co_timeline_end(3, CO_TIMELINE_START);
+
+	json = dump();
+	ASSERT_TRUE(strstr(json, "\"start\"") != NULL);
+	free(json);
+
+	co_timeline_enable(0);
+	return 0;
+}
+
+static int test_phase_names(void)
+{
+	ASSERT_STR_EQ("probe", co_timeline_phase_name(CO_TIMELINE_PROBE));
+	ASSERT_STR_EQ("driver load",
+		      co_timeline_phase_name(CO_TIMELINE_DRIVER_LOAD));
+	ASSERT_TRUE(co_timeline_phase_name(CO_TIMELINE_PHASE_COUNT) == NULL);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_disabled);
+	RUN_TEST(test_spans);
+	RUN_TEST(test_span_is_replaced);
+	RUN_TEST(test_phase_names);
+	return r;
+}
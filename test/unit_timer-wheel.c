@@ -0,0 +1,182 @@
+#include "tst.h"
+#include "timer-wheel.h"
+
+#include <string.h>
+
+#define N_ENTRIES 8
+
+struct thing {
+	struct timer_wheel_entry entry;
+	int id;
+	uint64_t period;
+	int n_expired;
+	uint64_t expired_at;
+};
+
+static struct timer_wheel wheel_;
+static struct thing thing_[N_ENTRIES];
+
+static void setup(void)
+{
+	timer_wheel_init(&wheel_, 1000);
+	memset(thing_, 0, sizeof(thing_));
+
+	for (int i = 0; i < N_ENTRIES; ++i)
+		thing_[i].id = i;
+}
+
+static void on_expired(struct timer_wheel_entry* entry, void* context)
+{
+	struct thing* thing = (struct thing*)entry;
+	struct timer_wheel* wheel = context;
+
+	++thing->n_expired;
+	thing->expired_at = wheel->now;
+
+	if (thing->period)
+		timer_wheel_add(wheel, entry, entry->deadline + thing->period);
+}
+
+static void on_expired_remove_other(struct timer_wheel_entry* entry,
+				    void* context)
+{
+	struct thing* thing = (struct thing*)entry;
+	(void)context;
+
+	++thing->n_expired;
+
+	for (int i = 0; i < N_ENTRIES; ++i)
+		timer_wheel_remove(&wheel_, &thing_[i].entry);
+}
+
+int test_expire_in_order(void)
+{
+	setup();
+
+	timer_wheel_add(&wheel_, &thing_[0].entry, 1003);
+	timer_wheel_add(&wheel_, &thing_[1].entry, 1001);
+	timer_wheel_add(&wheel_, &thing_[2].entry, 1000 + TIMER_WHEEL_SIZE + 3);
+	ASSERT_INT_EQ(3, wheel_.n_pending);
+
+	timer_wheel_advance(&wheel_, 1001, on_expired, &wheel_);
+	ASSERT_INT_EQ(0, thing_[0].n_expired);
+	ASSERT_INT_EQ(1, thing_[1].n_expired);
+
+	timer_wheel_advance(&wheel_, 1003, on_expired, &wheel_);
+	ASSERT_INT_EQ(1, thing_[0].n_expired);
+	ASSERT_INT_EQ(1003, thing_[0].expired_at);
+
+	/* Same slot, but one round later */
+	ASSERT_INT_EQ(0, thing_[2].n_expired);
+	ASSERT_INT_EQ(1, wheel_.n_pending);
+
+	timer_wheel_advance(&wheel_, 1000 + TIMER_WHEEL_SIZE + 3, on_expired,
+			    &wheel_);
+	ASSERT_INT_EQ(1, thing_[2].n_expired);
+	ASSERT_TRUE(timer_wheel_is_empty(&wheel_));
+	return 0;
+}
+
+int test_past_deadline(void)
+{
+	setup();
+
+	timer_wheel_add(&wheel_, &thing_[0].entry, 10);
+	ASSERT_INT_EQ(1001, thing_[0].entry.deadline);
+
+	timer_wheel_advance(&wheel_, 1001, on_expired, &wheel_);
+	ASSERT_INT_EQ(1, thing_[0].n_expired);
+	return 0;
+}
+
+int test_periodic(void)
+{
+	setup();
+
+	thing_[0].period = 3;
+	thing_[1].period = TIMER_WHEEL_SIZE;
+	timer_wheel_add(&wheel_, &thing_[0].entry, 1003);
+	timer_wheel_add(&wheel_, &thing_[1].entry, 1000 + TIMER_WHEEL_SIZE);
+
+	for (uint64_t t = 1001; t <= 1000 + 3 * TIMER_WHEEL_SIZE; ++t)
+		timer_wheel_advance(&wheel_, t, on_expired, &wheel_);
+
+	ASSERT_INT_EQ(TIMER_WHEEL_SIZE, thing_[0].n_expired);
+	ASSERT_INT_EQ(3, thing_[1].n_expired);
+	ASSERT_INT_EQ(2, wheel_.n_pending);
+	return 0;
+}
+
+int test_remove(void)
+{
+	setup();
+
+	timer_wheel_add(&wheel_, &thing_[0].entry, 1001);
+	timer_wheel_add(&wheel_, &thing_[1].entry, 1001);
+	timer_wheel_remove(&wheel_, &thing_[0].entry);
+	timer_wheel_remove(&wheel_, &thing_[0].entry);
+	ASSERT_INT_EQ(1, wheel_.n_pending);
+
+	/* Adding a pending entry moves it */
+	timer_wheel_add(&wheel_, &thing_[1].entry, 1002);
+	ASSERT_INT_EQ(1, wheel_.n_pending);
+
+	timer_wheel_advance(&wheel_, 1001, on_expired, &wheel_);
+	ASSERT_INT_EQ(0, thing_[0].n_expired);
+	ASSERT_INT_EQ(0, thing_[1].n_expired);
+
+	timer_wheel_advance(&wheel_, 1002, on_expired, &wheel_);
+	ASSERT_INT_EQ(1, thing_[1].n_expired);
+	return 0;
+}
+
+int test_remove_from_callback(void)
+{
+	setup();
+
+	for (int i = 0; i < N_ENTRIES; ++i)
+		timer_wheel_add(&wheel_, &thing_[i].entry, 1001);
+
+	timer_wheel_advance(&wheel_, 1001, on_expired_remove_other, &wheel_);
+
+	int n_expired = 0;
+	for (int i = 0; i < N_ENTRIES; ++i)
+		n_expired += thing_[i].n_expired;
+
+	ASSERT_INT_EQ(1, n_expired);
+	ASSERT_TRUE(timer_wheel_is_empty(&wheel_));
+	return 0;
+}
+
+int test_stall(void)
+{
+	setup();
+
+	thing_[0].period = 1;
+	timer_wheel_add(&wheel_, &thing_[0].entry, 1001);
+	timer_wheel_add(&wheel_, &thing_[1].entry, 1010);
+	timer_wheel_add(&wheel_, &thing_[2].entry, 100000);
+
+	timer_wheel_advance(&wheel_, 1000 + 10 * TIMER_WHEEL_SIZE, on_expired,
+			    &wheel_);
+
+	/* A periodic entry fires once and then resumes from now */
+	ASSERT_INT_EQ(1, thing_[0].n_expired);
+	ASSERT_INT_EQ(1, thing_[1].n_expired);
+	ASSERT_INT_EQ(0, thing_[2].n_expired);
+	ASSERT_INT_EQ(1000 + 10 * TIMER_WHEEL_SIZE + 1,
+		      thing_[0].entry.deadline);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_expire_in_order);
+	RUN_TEST(test_past_deadline);
+	RUN_TEST(test_periodic);
+	RUN_TEST(test_remove);
+	RUN_TEST(test_remove_from_callback);
+	RUN_TEST(test_stall);
+	return r;
+}
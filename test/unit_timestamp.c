@@ -0,0 +1,61 @@
+#include "tst.h"
+#include "canopen/timestamp.h"
+
+static int test_epoch(void)
+{
+	struct can_frame cf = { 0 };
+
+	timestamp_set(&cf, TIMESTAMP_EPOCH * 1000000ULL);
+
+	ASSERT_INT_EQ(TIMESTAMP_SIZE, cf.can_dlc);
+	for (int i = 0; i < TIMESTAMP_SIZE; ++i)
+		ASSERT_UINT_EQ(0, cf.data[i]);
+
+	return 0;
+}
+
+static int test_encoding(void)
+{
+	struct can_frame cf = { 0 };
+
+	/* 2016-01-01 12:00:00.250 UTC is 11688 days and 43200250 ms after the
+	 * CANopen epoch.
+	 */
+	timestamp_set(&cf, 1451649600250123ULL);
+
+	ASSERT_UINT_EQ(0xfa, cf.data[0]);
+	ASSERT_UINT_EQ(0x2e, cf.data[1]);
+	ASSERT_UINT_EQ(0x93, cf.data[2]);
+	ASSERT_UINT_EQ(0x02, cf.data[3]);
+	ASSERT_UINT_EQ(0xa8, cf.data[4]);
+	ASSERT_UINT_EQ(0x2d, cf.data[5]);
+
+	ASSERT_TRUE(timestamp_is_valid(&cf));
+	ASSERT_TRUE(timestamp_get(&cf) == 1451649600250000ULL);
+
+	return 0;
+}
+
+static int test_reserved_bits_are_ignored(void)
+{
+	struct can_frame cf = { 0 };
+
+	timestamp_set(&cf, 1451649600250000ULL);
+	cf.data[3] |= 0xf0;
+
+	ASSERT_TRUE(timestamp_get(&cf) == 1451649600250000ULL);
+
+	cf.can_dlc = 4;
+	ASSERT_FALSE(timestamp_is_valid(&cf));
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_epoch);
+	RUN_TEST(test_encoding);
+	RUN_TEST(test_reserved_bits_are_ignored);
+	return r;
+}
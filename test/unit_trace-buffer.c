@@ -4,6 +4,9 @@
 #include "socketcan.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 
 int test_incomplete_buffer(void)
 {
@@ -66,10 +69,319 @@ int test_full_buffer(void)
 	return 0;
 }
 
+int test_append_with_timestamp(void)
+{
+	struct tracebuffer tb;
+
+	ASSERT_INT_GE(0, tb_init(&tb, 4 * sizeof(struct tb_frame)));
+
+	struct can_frame cf = { 0 };
+	cf.can_id = 1;
+	tb_append_ts(&tb, &cf, 42);
+
+	struct tb_frame* buffer;
+	size_t size;
+	FILE* stream = open_memstream((char**)&buffer, &size);
+
+	tb_dump(&tb, stream);
+
+	ASSERT_INT_EQ(1, buffer[0].cf.can_id);
+	ASSERT_INT_EQ(42, buffer[0].timestamp);
+
+	fclose(stream);
+	free(buffer);
+	tb_destroy(&tb);
+	return 0;
+}
+
+int test_append_fd_frame(void)
+{
+	struct tracebuffer tb;
+
+	ASSERT_INT_GE(0, tb_init(&tb, 4 * sizeof(struct tb_frame)));
+
+	struct can_frame cf = { .can_id = 1, .can_dlc = 1 };
+	tb_append_ts(&tb, &cf, 1);
+
+	struct canfd_frame cfd = {
+		.can_id = 2,
+		.len = CANFD_MAX_DLEN,
+		.flags = CANFD_FDF,
+	};
+	cfd.data[CANFD_MAX_DLEN - 1] = 0xa5;
+	tb_append_fd(&tb, &cfd, 2);
+
+	struct tb_frame* buffer;
+	size_t size;
+	FILE* stream = open_memstream((char**)&buffer, &size);
+
+	tb_dump(&tb, stream);
+
+	ASSERT_INT_EQ(1, buffer[0].cf.can_id);
+	ASSERT_FALSE(canfd_is_fd(&buffer[0].cfd));
+	ASSERT_INT_EQ(2, buffer[1].cfd.can_id);
+	ASSERT_TRUE(canfd_is_fd(&buffer[1].cfd));
+	ASSERT_INT_EQ(CANFD_MAX_DLEN, buffer[1].cfd.len);
+	ASSERT_INT_EQ(0xa5, buffer[1].cfd.data[CANFD_MAX_DLEN - 1]);
+
+	fclose(stream);
+	free(buffer);
+	tb_destroy(&tb);
+	return 0;
+}
+
+#define N_WRITERS 4
+#define N_APPENDS 10000
+
+static void* append_frames(void* context)
+{
+	struct tracebuffer* tb = context;
+
+	for (int i = 0; i < N_APPENDS; ++i) {
+		struct can_frame cf = { .can_id = i, .can_dlc = 8 };
+		memset(cf.data, i & 0xff, sizeof(cf.data));
+		tb_append_ts(tb, &cf, i);
+	}
+
+	return NULL;
+}
+
+static int check_dump(const struct tb_frame* buffer, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		const struct tb_frame* frame = &buffer[i];
+
+		ASSERT_INT_EQ(frame->timestamp, frame->cf.can_id);
+
+		for (int j = 0; j < 8; ++j)
+			ASSERT_INT_EQ(frame->cf.can_id & 0xff,
+				      frame->cf.data[j]);
+	}
+
+	return 0;
+}
+
+int test_concurrent_appends(void)
+{
+	struct tracebuffer tb;
+
+	ASSERT_INT_GE(0, tb_init(&tb, 256 * sizeof(struct tb_frame)));
+
+	pthread_t writers[N_WRITERS];
+	for (int i = 0; i < N_WRITERS; ++i)
+		ASSERT_INT_EQ(0, pthread_create(&writers[i], NULL,
+						append_frames, &tb));
+
+	struct tb_frame* buffer;
+	size_t size;
+	FILE* stream = open_memstream((char**)&buffer, &size);
+
+	/* Dumping while the writers are busy must only yield whole frames */
+	tb_dump(&tb, stream);
+	ASSERT_INT_EQ(0, check_dump(buffer, size / sizeof(*buffer)));
+	fclose(stream);
+	free(buffer);
+
+	for (int i = 0; i < N_WRITERS; ++i)
+		pthread_join(writers[i], NULL);
+
+	ASSERT_TRUE(tb.head == N_WRITERS * N_APPENDS);
+
+	stream = open_memstream((char**)&buffer, &size);
+	tb_dump(&tb, stream);
+	ASSERT_INT_EQ(tb.length, size / sizeof(*buffer));
+	ASSERT_INT_EQ(0, check_dump(buffer, size / sizeof(*buffer)));
+
+	fclose(stream);
+	free(buffer);
+	tb_destroy(&tb);
+	return 0;
+}
+
+static size_t dump_frames(struct tracebuffer* tb, struct tb_frame** buffer)
+{
+	size_t size;
+	FILE* stream = open_memstream((char**)buffer, &size);
+
+	tb_dump(tb, stream);
+	fclose(stream);
+
+	return size / sizeof(**buffer);
+}
+
+static void append_id(struct tracebuffer* tb, uint32_t id, uint64_t timestamp)
+{
+	struct can_frame cf = { .can_id = id, .can_dlc = 2 };
+	tb_append_ts(tb, &cf, timestamp);
+}
+
+int test_filter_objects_and_range(void)
+{
+	struct tracebuffer tb;
+	ASSERT_INT_GE(0, tb_init(&tb, 16 * sizeof(struct tb_frame)));
+
+	struct tb_filter filter = {
+		.objects = CANOPEN_EMCY | CANOPEN_SYNC,
+		.range_start = 2,
+		.range_stop = 3,
+	};
+	ASSERT_INT_EQ(0, tb_set_filter(&tb, &filter));
+
+	append_id(&tb, 0x181, 1); /* TPDO1 of node 1: wrong object */
+	append_id(&tb, 0x081, 2); /* EMCY of node 1: out of range */
+	append_id(&tb, 0x082, 3);
+	append_id(&tb, 0x080, 4); /* SYNC is not addressed to a node */
+	append_id(&tb, 0x084, 5);
+
+	struct tb_frame* buffer;
+	ASSERT_INT_EQ(2, dump_frames(&tb, &buffer));
+	ASSERT_INT_EQ(0x082, buffer[0].cf.can_id);
+	ASSERT_INT_EQ(0x080, buffer[1].cf.can_id);
+
+	free(buffer);
+	tb_destroy(&tb);
+	return 0;
+}
+
+int test_filter_cob_id_and_decimation(void)
+{
+	struct tracebuffer tb;
+	ASSERT_INT_GE(0, tb_init(&tb, 16 * sizeof(struct tb_frame)));
+
+	struct tb_filter filter = {
+		.cob_mask = 0x7f,
+		.cob_id = 0x05,
+		.pdo_decimation = 3,
+	};
+	ASSERT_INT_EQ(0, tb_set_filter(&tb, &filter));
+
+	for (int i = 0; i < 6; ++i) {
+		append_id(&tb, 0x185, i);
+		append_id(&tb, 0x186, i);
+	}
+
+	append_id(&tb, 0x705, 6);
+	append_id(&tb, 0x706, 7);
+
+	struct tb_frame* buffer;
+	ASSERT_INT_EQ(3, dump_frames(&tb, &buffer));
+	ASSERT_INT_EQ(0x185, buffer[0].cf.can_id);
+	ASSERT_INT_EQ(0, buffer[0].timestamp);
+	ASSERT_INT_EQ(0x185, buffer[1].cf.can_id);
+	ASSERT_INT_EQ(3, buffer[1].timestamp);
+	ASSERT_INT_EQ(0x705, buffer[2].cf.can_id);
+
+	free(buffer);
+	tb_destroy(&tb);
+	return 0;
+}
+
+int test_event_ring(void)
+{
+	struct tracebuffer tb;
+	ASSERT_INT_GE(0, tb_init_split(&tb, 8 * sizeof(struct tb_frame),
+				       4 * sizeof(struct tb_frame)));
+	ASSERT_INT_EQ(4, tb.length);
+	ASSERT_INT_EQ(4, tb.events->length);
+
+	append_id(&tb, 0x701, 1);
+	append_id(&tb, 0x581, 2);
+
+	/* Cyclic traffic only pushes out other cyclic traffic */
+	for (int i = 0; i < 10; ++i)
+		append_id(&tb, 0x181, 10 + i);
+
+	append_id(&tb, 0x081, 15);
+
+	struct tb_frame* buffer;
+	ASSERT_INT_EQ(7, dump_frames(&tb, &buffer));
+	ASSERT_INT_EQ(0x701, buffer[0].cf.can_id);
+	ASSERT_INT_EQ(0x581, buffer[1].cf.can_id);
+	ASSERT_INT_EQ(0x081, buffer[2].cf.can_id);
+	ASSERT_INT_EQ(0x181, buffer[3].cf.can_id);
+	ASSERT_INT_EQ(16, buffer[3].timestamp);
+	ASSERT_INT_EQ(19, buffer[6].timestamp);
+
+	free(buffer);
+	tb_destroy(&tb);
+	return 0;
+}
+
+struct recovered {
+	int n;
+	struct tb_frame frame[16];
+};
+
+static void recover_frame(const struct tb_frame* frame, void* context)
+{
+	struct recovered* r = context;
+	r->frame[r->n++] = *frame;
+}
+
+int test_recover_file(void)
+{
+	char path[] = "/tmp/unit_trace-buffer.XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_INT_GE(0, fd);
+	close(fd);
+
+	struct tracebuffer tb;
+	ASSERT_INT_EQ(0, tb_init_file(&tb, path, 8 * sizeof(struct tb_frame),
+				      4 * sizeof(struct tb_frame)));
+	ASSERT_INT_EQ(4, tb.length);
+
+	for (int i = 0; i < 6; ++i)
+		append_id(&tb, 0x181, 10 + i);
+
+	append_id(&tb, 0x701, 12);
+
+	/* A frame that was being written when the process died */
+	tb.slots[(tb.head - 1) & (tb.length - 1)].seq |= 1;
+
+	tb_destroy(&tb);
+
+	struct recovered r = { 0 };
+	ASSERT_INT_EQ(0, tb_recover(path, recover_frame, &r));
+
+	ASSERT_INT_EQ(4, r.n);
+	ASSERT_INT_EQ(12, r.frame[0].timestamp);
+	ASSERT_INT_EQ(0x181, r.frame[0].cf.can_id);
+	ASSERT_INT_EQ(0x701, r.frame[1].cf.can_id);
+	ASSERT_INT_EQ(13, r.frame[2].timestamp);
+	ASSERT_INT_EQ(14, r.frame[3].timestamp);
+
+	unlink(path);
+	return 0;
+}
+
+int test_recover_invalid_file(void)
+{
+	char path[] = "/tmp/unit_trace-buffer.XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_INT_GE(0, fd);
+	ASSERT_INT_EQ(8, write(fd, "garbage!", 8));
+	close(fd);
+
+	struct recovered r = { 0 };
+	ASSERT_INT_EQ(-1, tb_recover(path, recover_frame, &r));
+	ASSERT_INT_EQ(0, r.n);
+
+	unlink(path);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
 	RUN_TEST(test_incomplete_buffer);
 	RUN_TEST(test_full_buffer);
+	RUN_TEST(test_append_with_timestamp);
+	RUN_TEST(test_append_fd_frame);
+	RUN_TEST(test_concurrent_appends);
+	RUN_TEST(test_filter_objects_and_range);
+	RUN_TEST(test_filter_cob_id_and_decimation);
+	RUN_TEST(test_event_ring);
+	RUN_TEST(test_recover_file);
+	RUN_TEST(test_recover_invalid_file);
 	return r;
 }
@@ -0,0 +1,181 @@
+#include "tst.h"
+#include "trace-buffer.h"
+#include "trace-file.h"
+
+#include "socketcan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static char path_[64];
+
+struct collected {
+	int n;
+	uint32_t id[64];
+};
+
+static void collect(const struct tb_frame* frame, void* context)
+{
+	struct collected* c = context;
+	c->id[c->n++] = frame->cf.can_id;
+}
+
+/* Writes 4 blocks of 8 frames; block i has timestamps 100 * i + j and the
+ * frames of block i are TPDO1 of node i + 1.
+ */
+static int write_file(int do_finish)
+{
+	int fd = open(path_, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ASSERT_INT_GE(0, fd);
+
+	struct trace_file_writer writer;
+	ASSERT_INT_EQ(0, trace_file_writer_init(&writer, fd, "can0", 1, 4));
+
+	for (int i = 0; i < 4; ++i) {
+		struct tb_frame frames[8];
+		memset(frames, 0, sizeof(frames));
+
+		for (int j = 0; j < 8; ++j) {
+			frames[j].timestamp = 100 * i + j;
+			frames[j].cf.can_id = 0x180 + i + 1;
+		}
+
+		ASSERT_INT_EQ(0, trace_file_write_block(&writer, frames, 8));
+	}
+
+	if (do_finish)
+		ASSERT_INT_EQ(0, trace_file_writer_finish(&writer));
+	else
+		free(writer.index);
+
+	close(fd);
+	return 0;
+}
+
+static int scan(int has_index, uint64_t from, uint64_t to, int nodeid,
+		struct collected* c)
+{
+	struct trace_file file;
+	ASSERT_INT_EQ(0, trace_file_open(&file, path_));
+
+	ASSERT_INT_EQ(has_index, file.index != NULL);
+	ASSERT_STR_EQ("can0", file.header->iface);
+	ASSERT_INT_EQ(1, file.header->range_start);
+	ASSERT_INT_EQ(4, file.header->range_stop);
+
+	struct trace_file_filter filter = {
+		.from = from,
+		.to = to,
+		.nodeid = nodeid,
+	};
+
+	memset(c, 0, sizeof(*c));
+	ASSERT_INT_EQ(0, trace_file_scan(&file, &filter, collect, c));
+
+	trace_file_close(&file);
+	return 0;
+}
+
+static int check_filters(int has_index)
+{
+	struct collected c;
+
+	ASSERT_INT_EQ(0, scan(has_index, 0, 0, -1, &c));
+	ASSERT_INT_EQ(32, c.n);
+
+	ASSERT_INT_EQ(0, scan(has_index, 105, 203, -1, &c));
+	ASSERT_INT_EQ(7, c.n);
+	ASSERT_INT_EQ(0x182, c.id[0]);
+	ASSERT_INT_EQ(0x183, c.id[6]);
+
+	ASSERT_INT_EQ(0, scan(has_index, 0, 0, 4, &c));
+	ASSERT_INT_EQ(8, c.n);
+	ASSERT_INT_EQ(0x184, c.id[0]);
+
+	ASSERT_INT_EQ(0, scan(has_index, 0, 150, 4, &c));
+	ASSERT_INT_EQ(0, c.n);
+
+	return 0;
+}
+
+int test_indexed(void)
+{
+	ASSERT_INT_EQ(0, write_file(1));
+	ASSERT_INT_EQ(0, check_filters(1));
+	return 0;
+}
+
+int test_without_index(void)
+{
+	ASSERT_INT_EQ(0, write_file(0));
+	ASSERT_INT_EQ(0, check_filters(0));
+	return 0;
+}
+
+int test_truncated(void)
+{
+	ASSERT_INT_EQ(0, write_file(0));
+
+	size_t size = sizeof(struct trace_file_header)
+		    + 3 * sizeof(struct trace_file_block)
+		    + 21 * sizeof(struct tb_frame);
+	ASSERT_INT_EQ(0, truncate(path_, size));
+
+	struct collected c;
+	ASSERT_INT_EQ(0, scan(0, 0, 0, -1, &c));
+	ASSERT_INT_EQ(21, c.n);
+	return 0;
+}
+
+int test_raw_file(void)
+{
+	FILE* stream = fopen(path_, "w");
+	struct tb_frame frame = { .timestamp = 1 };
+	fwrite(&frame, sizeof(frame), 1, stream);
+	fclose(stream);
+
+	struct trace_file file;
+	ASSERT_INT_EQ(1, trace_file_open(&file, path_));
+	return 0;
+}
+
+int test_frame_nodeid(void)
+{
+	struct tb_frame frame = { 0 };
+
+	frame.cf.can_id = 0x701;
+	ASSERT_INT_EQ(1, trace_file_frame_nodeid(&frame));
+
+	frame.cf.can_id = 0x80;
+	ASSERT_INT_EQ(0, trace_file_frame_nodeid(&frame));
+
+	frame.cf.can_id = 0;
+	frame.cf.can_dlc = 2;
+	frame.cf.data[1] = 42;
+	ASSERT_INT_EQ(42, trace_file_frame_nodeid(&frame));
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	strcpy(path_, "/tmp/unit_trace-file.XXXXXX");
+	int fd = mkstemp(path_);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	RUN_TEST(test_indexed);
+	RUN_TEST(test_without_index);
+	RUN_TEST(test_truncated);
+	RUN_TEST(test_raw_file);
+	RUN_TEST(test_frame_nodeid);
+
+	unlink(path_);
+	return r;
+}
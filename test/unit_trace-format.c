@@ -0,0 +1,207 @@
+#include "tst.h"
+#include "trace-buffer.h"
+#include "trace-format.h"
+
+#include "socketcan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char path_[64];
+
+struct collected {
+	int n;
+	struct tb_frame frame[16];
+};
+
+static void collect(const struct tb_frame* frame, void* context)
+{
+	struct collected* c = context;
+	if (c->n < 16)
+		c->frame[c->n] = *frame;
+	c->n++;
+}
+
+/* A standard, an extended, an RTR and an FD frame */
+static void make_frames(struct tb_frame* frames)
+{
+	memset(frames, 0, 4 * sizeof(*frames));
+
+	frames[0].timestamp = 1520000000123456ULL;
+	frames[0].cf.can_id = 0x185;
+	frames[0].cf.can_dlc = 4;
+	memcpy(frames[0].cf.data, "\xde\xad\xbe\xef", 4);
+
+	frames[1].timestamp = 1520000000200000ULL;
+	frames[1].cf.can_id = 0x12345678 | CAN_EFF_FLAG;
+	frames[1].cf.can_dlc = 1;
+	frames[1].cf.data[0] = 0x42;
+
+	frames[2].timestamp = 1520000001000001ULL;
+	frames[2].cf.can_id = 0x701 | CAN_RTR_FLAG;
+
+	frames[3].timestamp = 1520000002000000ULL;
+	frames[3].cfd.can_id = 0x281;
+	frames[3].cfd.len = 12;
+	frames[3].cfd.flags = CANFD_FDF | CANFD_BRS;
+	for (int i = 0; i < 12; ++i)
+		frames[3].cfd.data[i] = i;
+}
+
+static int assert_frames_equal(const struct tb_frame* expected,
+			       const struct tb_frame* actual)
+{
+	for (int i = 0; i < 4; ++i) {
+		ASSERT_TRUE(expected[i].timestamp == actual[i].timestamp);
+		ASSERT_INT_EQ((int)expected[i].cfd.can_id,
+			      (int)actual[i].cfd.can_id);
+		ASSERT_INT_EQ(expected[i].cfd.len, actual[i].cfd.len);
+		ASSERT_INT_EQ(expected[i].cfd.flags, actual[i].cfd.flags);
+		ASSERT_INT_EQ(0, memcmp(expected[i].cfd.data,
+					actual[i].cfd.data,
+					expected[i].cfd.len));
+	}
+
+	return 0;
+}
+
+static int round_trip(enum trace_format format)
+{
+	struct tb_frame frames[4];
+	make_frames(frames);
+
+	FILE* stream = fopen(path_, "w");
+	ASSERT_TRUE(stream != NULL);
+
+	struct trace_export export;
+	ASSERT_INT_EQ(0, trace_export_begin(&export, stream, format, "can0"));
+
+	for (int i = 0; i < 4; ++i)
+		ASSERT_INT_EQ(0, trace_export_frame(&export, &frames[i]));
+
+	fclose(stream);
+
+	struct collected c = { 0 };
+	ASSERT_INT_EQ(0, trace_import(path_, collect, &c));
+	ASSERT_INT_EQ(4, c.n);
+
+	return assert_frames_equal(frames, c.frame);
+}
+
+static int test_pcapng_round_trip()
+{
+	return round_trip(TRACE_FORMAT_PCAPNG);
+}
+
+static int test_candump_round_trip()
+{
+	return round_trip(TRACE_FORMAT_CANDUMP);
+}
+
+static int test_candump_output()
+{
+	struct tb_frame frames[4];
+	make_frames(frames);
+
+	char* buffer = NULL;
+	size_t size = 0;
+	FILE* stream = open_memstream(&buffer, &size);
+
+	struct trace_export export;
+	trace_export_begin(&export, stream, TRACE_FORMAT_CANDUMP, "can1");
+
+	for (int i = 0; i < 4; ++i)
+		trace_export_frame(&export, &frames[i]);
+
+	fclose(stream);
+
+	ASSERT_STR_EQ("(1520000000.123456) can1 185#DEADBEEF\n"
+		      "(1520000000.200000) can1 12345678#42\n"
+		      "(1520000001.000001) can1 701#R\n"
+		      "(1520000002.000000) can1 281##1000102030405060708090A0B\n",
+		      buffer);
+
+	free(buffer);
+	return 0;
+}
+
+/* A big endian classic pcap file with nanosecond time stamps */
+static int test_pcap_import()
+{
+	static const uint8_t file[] = {
+		0xa1, 0xb2, 0x3c, 0x4d, 0, 2, 0, 4,
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 16, 0, 0, 0, 227,
+		/* record */
+		0, 0, 0, 10, 0, 0, 0x07, 0xd0,
+		0, 0, 0, 16, 0, 0, 0, 16,
+		0, 0, 0x01, 0x85, 2, 0, 0, 0,
+		0x11, 0x22, 0, 0, 0, 0, 0, 0,
+	};
+
+	FILE* stream = fopen(path_, "w");
+	ASSERT_TRUE(stream != NULL);
+	fwrite(file, 1, sizeof(file), stream);
+	fclose(stream);
+
+	struct collected c = { 0 };
+	ASSERT_INT_EQ(0, trace_import(path_, collect, &c));
+	ASSERT_INT_EQ(1, c.n);
+	ASSERT_TRUE(c.frame[0].timestamp == 10000002ULL);
+	ASSERT_INT_EQ(0x185, c.frame[0].cf.can_id);
+	ASSERT_INT_EQ(2, c.frame[0].cf.can_dlc);
+	ASSERT_INT_EQ(0x22, c.frame[0].cf.data[1]);
+
+	return 0;
+}
+
+static int test_unknown_format()
+{
+	FILE* stream = fopen(path_, "w");
+	ASSERT_TRUE(stream != NULL);
+	fprintf(stream, "this is not a trace\n");
+	fclose(stream);
+
+	struct collected c = { 0 };
+	ASSERT_INT_EQ(1, trace_import(path_, collect, &c));
+	ASSERT_INT_EQ(0, c.n);
+
+	return 0;
+}
+
+static int test_format_names()
+{
+	enum trace_format format;
+
+	ASSERT_INT_EQ(0, trace_format_from_string(&format, "pcapng"));
+	ASSERT_INT_EQ(TRACE_FORMAT_PCAPNG, format);
+	ASSERT_INT_EQ(0, trace_format_from_string(&format, "candump"));
+	ASSERT_INT_EQ(TRACE_FORMAT_CANDUMP, format);
+	ASSERT_INT_EQ(-1, trace_format_from_string(&format, "csv"));
+	ASSERT_STR_EQ("pcapng", trace_format_extension(TRACE_FORMAT_PCAPNG));
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	strcpy(path_, "/tmp/unit_trace-format.XXXXXX");
+	int fd = mkstemp(path_);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	RUN_TEST(test_pcapng_round_trip);
+	RUN_TEST(test_candump_round_trip);
+	RUN_TEST(test_candump_output);
+	RUN_TEST(test_pcap_import);
+	RUN_TEST(test_unknown_format);
+	RUN_TEST(test_format_names);
+
+	unlink(path_);
+	return r;
+}
@@ -0,0 +1,243 @@
+#include "tst.h"
+#include "trace-buffer.h"
+#include "trace-stream.h"
+#include "trace-file.h"
+
+#include "socketcan.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static char dir_[64];
+
+static void append_frames(struct tracebuffer* tb, int start, int n)
+{
+	for (int i = start; i < start + n; ++i) {
+		struct can_frame cf = { .can_id = i };
+		tb_append_ts(tb, &cf, i);
+	}
+}
+
+static int cmp_names(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* Returns the number of stream files and stores their sorted names */
+static int list_files(char** names, int max)
+{
+	DIR* dir = opendir(dir_);
+	if (!dir)
+		return -1;
+
+	int n = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) && n < max)
+		if (strncmp(entry->d_name, "stream-", 7) == 0)
+			names[n++] = strdup(entry->d_name);
+
+	closedir(dir);
+
+	qsort(names, n, sizeof(names[0]), cmp_names);
+	return n;
+}
+
+struct file_frames {
+	long n;
+	int first_id;
+};
+
+static void count_frame(const struct tb_frame* frame, void* context)
+{
+	struct file_frames* frames = context;
+
+	if (frames->n++ == 0)
+		frames->first_id = frame->cf.can_id;
+}
+
+static long file_frames(const char* name, int* first_id)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir_, name);
+
+	struct trace_file file;
+	if (trace_file_open(&file, path) != 0)
+		return -1;
+
+	struct trace_file_filter filter = { .nodeid = -1 };
+	struct file_frames frames = { 0 };
+
+	trace_file_scan(&file, &filter, count_frame, &frames);
+	trace_file_close(&file);
+
+	*first_id = frames.first_id;
+	return frames.n;
+}
+
+static void remove_files(void)
+{
+	char* names[64];
+	int n = list_files(names, 64);
+
+	for (int i = 0; i < n; ++i) {
+		char path[256];
+		snprintf(path, sizeof(path), "%s/%s", dir_, names[i]);
+		unlink(path);
+		free(names[i]);
+	}
+}
+
+int test_rotate_by_size(void)
+{
+	struct tracebuffer tb;
+	ASSERT_INT_GE(0, tb_init(&tb, 64 * sizeof(struct tb_frame)));
+
+	struct trace_stream_params params = {
+		.path = dir_,
+		.file_size = 10 * sizeof(struct tb_frame),
+	};
+
+	ASSERT_INT_EQ(0, trace_stream_start(&tb, &params));
+	append_frames(&tb, 0, 35);
+	trace_stream_stop();
+
+	char* names[64];
+	ASSERT_INT_EQ(4, list_files(names, 64));
+
+	int first_id = -1;
+	ASSERT_INT_EQ(10, file_frames(names[0], &first_id));
+	ASSERT_INT_EQ(0, first_id);
+	ASSERT_INT_EQ(10, file_frames(names[1], &first_id));
+	ASSERT_INT_EQ(10, first_id);
+	ASSERT_INT_EQ(10, file_frames(names[2], &first_id));
+	ASSERT_INT_EQ(5, file_frames(names[3], &first_id));
+	ASSERT_INT_EQ(30, first_id);
+
+	ASSERT_TRUE(trace_stream_get_dropped() == 0);
+
+	for (int i = 0; i < 4; ++i)
+		free(names[i]);
+
+	remove_files();
+	tb_destroy(&tb);
+	return 0;
+}
+
+int test_retention(void)
+{
+	struct tracebuffer tb;
+	ASSERT_INT_GE(0, tb_init(&tb, 64 * sizeof(struct tb_frame)));
+
+	struct trace_stream_params params = {
+		.path = dir_,
+		.file_size = 10 * sizeof(struct tb_frame),
+		.retention = 25 * sizeof(struct tb_frame),
+	};
+
+	ASSERT_INT_EQ(0, trace_stream_start(&tb, &params));
+	append_frames(&tb, 0, 35);
+	trace_stream_stop();
+
+	char* names[64];
+	ASSERT_INT_EQ(3, list_files(names, 64));
+
+	int first_id = -1;
+	ASSERT_INT_EQ(10, file_frames(names[0], &first_id));
+	ASSERT_INT_EQ(10, first_id);
+
+	for (int i = 0; i < 3; ++i)
+		free(names[i]);
+
+	remove_files();
+	tb_destroy(&tb);
+	return 0;
+}
+
+int test_dropped_frames(void)
+{
+	struct tracebuffer tb;
+	ASSERT_INT_GE(0, tb_init(&tb, 4 * sizeof(struct tb_frame)));
+
+	struct trace_stream_params params = {
+		.path = dir_,
+		.file_size = 100 * sizeof(struct tb_frame),
+	};
+
+	ASSERT_INT_EQ(0, trace_stream_start(&tb, &params));
+	append_frames(&tb, 0, 10);
+	trace_stream_stop();
+
+	char* names[64];
+	ASSERT_INT_EQ(1, list_files(names, 64));
+
+	int first_id = -1;
+	ASSERT_INT_EQ(4, file_frames(names[0], &first_id));
+	ASSERT_INT_EQ(6, first_id);
+	ASSERT_TRUE(trace_stream_get_dropped() == 6);
+
+	free(names[0]);
+
+	remove_files();
+	tb_destroy(&tb);
+	return 0;
+}
+
+int test_retention_per_iface(void)
+{
+	struct tracebuffer tb;
+	ASSERT_INT_GE(0, tb_init(&tb, 64 * sizeof(struct tb_frame)));
+
+	/* A file of another bus in the same directory */
+	char path[256];
+	snprintf(path, sizeof(path), "%s/stream-can0-000101-000000.000000.trace",
+		 dir_);
+	FILE* file = fopen(path, "w");
+	ASSERT_TRUE(file != NULL);
+	for (int i = 0; i < 100; ++i)
+		fwrite(&tb, 1, sizeof(struct tb_frame), file);
+	fclose(file);
+
+	struct trace_stream_params params = {
+		.path = dir_,
+		.iface = "unix:/run/can1",
+		.file_size = 10 * sizeof(struct tb_frame),
+		.retention = 25 * sizeof(struct tb_frame),
+	};
+
+	ASSERT_INT_EQ(0, trace_stream_start(&tb, &params));
+	append_frames(&tb, 0, 35);
+	trace_stream_stop();
+
+	char* names[64];
+	ASSERT_INT_EQ(4, list_files(names, 64));
+	ASSERT_STR_EQ("stream-can0-000101-000000.000000.trace", names[0]);
+	ASSERT_INT_EQ(0, strncmp(names[1], "stream-unix:_run_can1-", 22));
+
+	for (int i = 0; i < 4; ++i)
+		free(names[i]);
+
+	remove_files();
+	tb_destroy(&tb);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	strcpy(dir_, "/tmp/unit_trace-stream.XXXXXX");
+	if (!mkdtemp(dir_))
+		return 1;
+
+	RUN_TEST(test_rotate_by_size);
+	RUN_TEST(test_retention);
+	RUN_TEST(test_dropped_frames);
+	RUN_TEST(test_retention_per_iface);
+
+	rmdir(dir_);
+	return r;
+}
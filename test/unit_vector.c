@@ -36,6 +36,18 @@ static int test_reserve_more()
 	return 0;
 }
 
+static int test_reserve_exact()
+{
+	struct vector vector;
+	vector_init(&vector, 42);
+	vector_reserve_exact(&vector, 5);
+	ASSERT_UINT_EQ(42, vector.size);
+	vector_reserve_exact(&vector, 1000);
+	ASSERT_UINT_EQ(1000, vector.size);
+	vector_destroy(&vector);
+	return 0;
+}
+
 static int test_append_nothing()
 {
 	struct vector vector;
@@ -112,17 +124,37 @@ static int test_vector_fill()
 	return 0;
 }
 
+static int test_vector_swap()
+{
+	struct vector a, b;
+	vector_init(&a, 1);
+	vector_init(&b, 16);
+	vector_assign(&a, "foo", 4);
+	void* data = a.data;
+	vector_swap(&a, &b);
+	ASSERT_PTR_EQ(data, b.data);
+	ASSERT_STR_EQ("foo", b.data);
+	ASSERT_UINT_EQ(4, b.index);
+	ASSERT_UINT_EQ(0, a.index);
+	ASSERT_UINT_EQ(16, a.size);
+	vector_destroy(&a);
+	vector_destroy(&b);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
 	RUN_TEST(test_init_destroy);
 	RUN_TEST(test_reserve_less);
 	RUN_TEST(test_reserve_more);
+	RUN_TEST(test_reserve_exact);
 	RUN_TEST(test_append_nothing);
 	RUN_TEST(test_append_something);
 	RUN_TEST(test_vector_clear);
 	RUN_TEST(test_vector_assign_once);
 	RUN_TEST(test_vector_assign_twice);
 	RUN_TEST(test_vector_fill);
+	RUN_TEST(test_vector_swap);
 	return r;
 }
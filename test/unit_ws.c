@@ -0,0 +1,120 @@
+#include "tst.h"
+#include "ws.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static int test_accept_key()
+{
+	char accept[WS_ACCEPT_SIZE];
+
+	/* The example from RFC 6455 */
+	ws_accept_key(accept, "dGhlIHNhbXBsZSBub25jZQ==");
+	ASSERT_STR_EQ("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", accept);
+	return 0;
+}
+
+static int test_decode_masked_text()
+{
+	/* "Hello", masked, from RFC 6455 */
+	uint8_t frame_data[] = {
+		0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51,
+		0x58
+	};
+
+	struct ws_frame frame;
+
+	for (size_t i = 0; i < sizeof(frame_data); ++i)
+		ASSERT_INT_EQ(0, ws_decode_frame(&frame, frame_data, i));
+
+	ASSERT_INT_EQ(sizeof(frame_data),
+		      ws_decode_frame(&frame, frame_data, sizeof(frame_data)));
+	ASSERT_TRUE(frame.is_final);
+	ASSERT_INT_EQ(WS_TEXT, frame.opcode);
+	ASSERT_UINT_EQ(6, frame.header_length);
+	ASSERT_UINT_EQ(5, frame.payload_length);
+
+	ws_unmask(&frame, frame_data + frame.header_length);
+	ASSERT_INT_EQ(0, memcmp("Hello", frame_data + frame.header_length, 5));
+	return 0;
+}
+
+static int test_decode_16_bit_length()
+{
+	uint8_t data[8 + 300] = { 0x82, 0x80 | 126, 300 >> 8, 300 & 0xff };
+
+	struct ws_frame frame;
+	ASSERT_INT_EQ(0, ws_decode_frame(&frame, data, 100));
+	ASSERT_INT_EQ(sizeof(data),
+		      ws_decode_frame(&frame, data, sizeof(data)));
+	ASSERT_INT_EQ(WS_BINARY, frame.opcode);
+	ASSERT_UINT_EQ(8, frame.header_length);
+	ASSERT_UINT_EQ(300, frame.payload_length);
+	return 0;
+}
+
+static int test_decode_invalid()
+{
+	struct ws_frame frame;
+
+	/* Not masked */
+	uint8_t unmasked[] = { 0x81, 0x00 };
+	ASSERT_INT_EQ(-1, ws_decode_frame(&frame, unmasked, sizeof(unmasked)));
+
+	/* Reserved bits */
+	uint8_t reserved[] = { 0xc1, 0x80, 0, 0, 0, 0 };
+	ASSERT_INT_EQ(-1, ws_decode_frame(&frame, reserved, sizeof(reserved)));
+
+	/* Unknown opcode */
+	uint8_t unknown[] = { 0x83, 0x80, 0, 0, 0, 0 };
+	ASSERT_INT_EQ(-1, ws_decode_frame(&frame, unknown, sizeof(unknown)));
+
+	/* Fragmented ping */
+	uint8_t fragmented[] = { 0x09, 0x80, 0, 0, 0, 0 };
+	ASSERT_INT_EQ(-1, ws_decode_frame(&frame, fragmented,
+					  sizeof(fragmented)));
+
+	/* Control frames are no larger than 125 bytes */
+	uint8_t big_ping[] = { 0x89, 0x80 | 126, 0, 126 };
+	ASSERT_INT_EQ(-1, ws_decode_frame(&frame, big_ping, sizeof(big_ping)));
+
+	/* Too big, known before the payload is in */
+	uint8_t too_big[] = { 0x81, 0x80 | 127, 0, 0, 0, 0, 0, 1, 0, 0 };
+	ASSERT_INT_EQ(-1, ws_decode_frame(&frame, too_big, sizeof(too_big)));
+	ASSERT_TRUE(frame.payload_length > WS_PAYLOAD_MAX);
+	return 0;
+}
+
+static int test_encode_header()
+{
+	uint8_t header[WS_HEADER_MAX];
+
+	ASSERT_UINT_EQ(2, ws_encode_header(header, WS_TEXT, 5));
+	ASSERT_INT_EQ(0x81, header[0]);
+	ASSERT_INT_EQ(5, header[1]);
+
+	ASSERT_UINT_EQ(4, ws_encode_header(header, WS_TEXT, 300));
+	ASSERT_INT_EQ(126, header[1]);
+	ASSERT_INT_EQ(300, header[2] << 8 | header[3]);
+
+	ASSERT_UINT_EQ(10, ws_encode_header(header, WS_BINARY, 70000));
+	ASSERT_INT_EQ(0x82, header[0]);
+	ASSERT_INT_EQ(127, header[1]);
+	ASSERT_INT_EQ(70000, header[7] << 16 | header[8] << 8 | header[9]);
+
+	ASSERT_UINT_EQ(2, ws_encode_header(header, WS_PONG, 0));
+	ASSERT_INT_EQ(0x8a, header[0]);
+	ASSERT_INT_EQ(0, header[1]);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_accept_key);
+	RUN_TEST(test_decode_masked_text);
+	RUN_TEST(test_decode_16_bit_length);
+	RUN_TEST(test_decode_invalid);
+	RUN_TEST(test_encode_header);
+	return r;
+}
@@ -0,0 +1,99 @@
+#include "tst.h"
+#include "wsdeque.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#define N_THIEVES 3
+#define N_ITEMS 100000
+
+static struct wsdeque deque_;
+static unsigned long stolen_sum_;
+static int is_done_;
+
+int test_owner_is_lifo_and_thief_is_fifo(void)
+{
+	struct wsdeque d;
+	void* data;
+
+	ASSERT_INT_EQ(0, wsdeque_init(&d, 4));
+	ASSERT_TRUE(wsdeque_is_empty(&d));
+	ASSERT_INT_EQ(-1, wsdeque_pop(&d, &data));
+	ASSERT_INT_EQ(-1, wsdeque_steal(&d, &data));
+
+	for (intptr_t i = 1; i <= 4; ++i)
+		ASSERT_INT_EQ(0, wsdeque_push(&d, (void*)i));
+
+	ASSERT_INT_EQ(-1, wsdeque_push(&d, (void*)5));
+
+	ASSERT_INT_EQ(0, wsdeque_steal(&d, &data));
+	ASSERT_INT_EQ(1, (intptr_t)data);
+	ASSERT_INT_EQ(0, wsdeque_pop(&d, &data));
+	ASSERT_INT_EQ(4, (intptr_t)data);
+	ASSERT_INT_EQ(0, wsdeque_pop(&d, &data));
+	ASSERT_INT_EQ(3, (intptr_t)data);
+	ASSERT_INT_EQ(0, wsdeque_steal(&d, &data));
+	ASSERT_INT_EQ(2, (intptr_t)data);
+	ASSERT_TRUE(wsdeque_is_empty(&d));
+
+	wsdeque_destroy(&d);
+	return 0;
+}
+
+static void* steal(void* arg)
+{
+	(void)arg;
+	unsigned long sum = 0;
+
+	while (!__atomic_load_n(&is_done_, __ATOMIC_SEQ_CST)
+	    || !wsdeque_is_empty(&deque_)) {
+		void* data;
+		if (wsdeque_steal(&deque_, &data) == 0)
+			sum += (uintptr_t)data;
+		else
+			sched_yield();
+	}
+
+	__atomic_add_fetch(&stolen_sum_, sum, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+int test_every_item_is_taken_once(void)
+{
+	pthread_t thief[N_THIEVES];
+	unsigned long sum = 0;
+
+	ASSERT_INT_EQ(0, wsdeque_init(&deque_, 128));
+
+	for (int i = 0; i < N_THIEVES; ++i)
+		pthread_create(&thief[i], NULL, steal, NULL);
+
+	for (uintptr_t i = 1; i <= N_ITEMS; ++i) {
+		while (wsdeque_push(&deque_, (void*)i) < 0)
+			sched_yield();
+
+		void* data;
+		if (i % 3 == 0 && wsdeque_pop(&deque_, &data) == 0)
+			sum += (uintptr_t)data;
+	}
+
+	__atomic_store_n(&is_done_, 1, __ATOMIC_SEQ_CST);
+
+	for (int i = 0; i < N_THIEVES; ++i)
+		pthread_join(thief[i], NULL);
+
+	unsigned long expected = N_ITEMS * (N_ITEMS + 1UL) / 2;
+	ASSERT_TRUE(sum + stolen_sum_ == expected);
+
+	wsdeque_destroy(&deque_);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_owner_is_lifo_and_thief_is_fifo);
+	RUN_TEST(test_every_item_is_taken_once);
+	return r;
+}